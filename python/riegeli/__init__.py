@@ -29,7 +29,8 @@ __all__ = ('RiegeliError', 'CancelledError', 'UnknownError',
            'UnimplementedError', 'InternalError', 'UnavailableError',
            'DataLossError', 'FlushType', 'RecordPosition', 'SkippedRegion',
            'RecordsMetadata', 'set_record_type', 'RecordWriter',
-           'EXISTENCE_ONLY', 'get_record_type', 'RecordReader')
+           'EXISTENCE_ONLY', 'get_record_type', 'split_record_file',
+           'RecordReader', 'ShardedReader')
 
 # pylint: disable=invalid-name
 RiegeliError = riegeli_error.RiegeliError
@@ -57,4 +58,6 @@ set_record_type = record_writer.set_record_type
 RecordWriter = record_writer.RecordWriter
 EXISTENCE_ONLY = record_reader.EXISTENCE_ONLY
 get_record_type = record_reader.get_record_type
+split_record_file = record_reader.split_record_file
 RecordReader = record_reader.RecordReader
+ShardedReader = record_reader.ShardedReader
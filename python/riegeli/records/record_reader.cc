@@ -23,11 +23,19 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <deque>
+#include <limits>
 #include <memory>
+#include <random>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/compare.h"
 #include "absl/types/optional.h"
 #include "python/riegeli/base/utils.h"
@@ -35,9 +43,12 @@
 #include "python/riegeli/records/record_position.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/records/record_file_split.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/record_reader.h"
+#include "riegeli/records/sharded_record_reader.h"
 #include "riegeli/records/skipped_region.h"
 
 namespace riegeli {
@@ -48,6 +59,16 @@ namespace {
 constexpr ImportedCapsule<RecordPositionApi> kRecordPositionApi(
     kRecordPositionCapsuleName);
 
+// The maximum number of entries of `record_type_cache`. When it is reached,
+// the cache is cleared.
+constexpr Py_ssize_t kMaxCachedRecordTypes = 64;
+
+// Message classes returned by `get_record_type()`, keyed by
+// `(record_type_name, *serialized_file_descriptors)`, so that reading many
+// files with the same record type builds the class once. Created on the first
+// use, it persists until interpreter shutdown, like the classes themselves.
+PyObject* record_type_cache = nullptr;
+
 // `extern "C"` sets the C calling convention for compatibility with the Python
 // API. Functions are marked `static` to avoid making their symbols public, as
 // `extern "C"` trumps anonymous namespace.
@@ -80,6 +101,44 @@ static PyObject* GetRecordType(PyObject* self, PyObject* args,
   const int file_descriptors_is_true = PyObject_IsTrue(file_descriptors.get());
   if (ABSL_PREDICT_FALSE(file_descriptors_is_true < 0)) return nullptr;
   if (file_descriptors_is_true == 0) Py_RETURN_NONE;
+  // key = (record_type_name,
+  //        *(file_descriptor.SerializeToString()
+  //          for file_descriptor in file_descriptors))
+  const PythonPtr key_list(PyList_New(0));
+  if (ABSL_PREDICT_FALSE(key_list == nullptr)) return nullptr;
+  if (ABSL_PREDICT_FALSE(
+          PyList_Append(key_list.get(), record_type_name.get()) < 0)) {
+    return nullptr;
+  }
+  {
+    const PythonPtr iter(PyObject_GetIter(file_descriptors.get()));
+    if (ABSL_PREDICT_FALSE(iter == nullptr)) return nullptr;
+    while (const PythonPtr file_descriptor{PyIter_Next(iter.get())}) {
+      static constexpr Identifier id_SerializeToString("SerializeToString");
+      const PythonPtr serialized(PyObject_CallMethodObjArgs(
+          file_descriptor.get(), id_SerializeToString.get(), nullptr));
+      if (ABSL_PREDICT_FALSE(serialized == nullptr)) return nullptr;
+      if (ABSL_PREDICT_FALSE(
+              PyList_Append(key_list.get(), serialized.get()) < 0)) {
+        return nullptr;
+      }
+    }
+    if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return nullptr;
+  }
+  const PythonPtr key(PyList_AsTuple(key_list.get()));
+  if (ABSL_PREDICT_FALSE(key == nullptr)) return nullptr;
+  // if key in record_type_cache: return record_type_cache[key]
+  if (record_type_cache == nullptr) {
+    record_type_cache = PyDict_New();
+    if (ABSL_PREDICT_FALSE(record_type_cache == nullptr)) return nullptr;
+  }
+  PyObject* const cached_record_type =
+      PyDict_GetItemWithError(record_type_cache, key.get());
+  if (cached_record_type != nullptr) {
+    Py_INCREF(cached_record_type);
+    return cached_record_type;
+  }
+  if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return nullptr;
   // pool = DescriptorPool()
   static constexpr ImportedConstant kDescriptorPool(
       "google.protobuf.descriptor_pool", "DescriptorPool");
@@ -111,10 +170,63 @@ static PyObject* GetRecordType(PyObject* self, PyObject* args,
   const PythonPtr factory(
       PyObject_CallFunctionObjArgs(kMessageFactory.get(), pool.get(), nullptr));
   if (ABSL_PREDICT_FALSE(factory == nullptr)) return nullptr;
-  // return factory.GetPrototype(message_descriptor)
+  // record_type = factory.GetPrototype(message_descriptor)
   static constexpr Identifier id_GetPrototype("GetPrototype");
-  return PyObject_CallMethodObjArgs(factory.get(), id_GetPrototype.get(),
-                                    message_descriptor.get(), nullptr);
+  PythonPtr record_type(PyObject_CallMethodObjArgs(
+      factory.get(), id_GetPrototype.get(), message_descriptor.get(), nullptr));
+  if (ABSL_PREDICT_FALSE(record_type == nullptr)) return nullptr;
+  // record_type_cache[key] = record_type
+  if (PyDict_Size(record_type_cache) >= kMaxCachedRecordTypes) {
+    PyDict_Clear(record_type_cache);
+  }
+  if (ABSL_PREDICT_FALSE(PyDict_SetItem(record_type_cache, key.get(),
+                                        record_type.get()) < 0)) {
+    return nullptr;
+  }
+  return record_type.release();
+}
+
+static PyObject* SplitRecordFileToPython(PyObject* self, PyObject* args,
+                                         PyObject* kwargs) {
+  static constexpr const char* keywords[] = {"filename", "max_splits",
+                                             nullptr};
+  PyObject* filename_object;
+  Py_ssize_t max_splits;
+  if (ABSL_PREDICT_FALSE(!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "O&n:split_record_file", const_cast<char**>(keywords),
+          PyUnicode_FSConverter, &filename_object, &max_splits))) {
+    return nullptr;
+  }
+  const PythonPtr filename_bytes(filename_object);
+  if (ABSL_PREDICT_FALSE(max_splits <= 0)) {
+    PyErr_Format(PyExc_ValueError, "max_splits must be positive, not %zd",
+                 max_splits);
+    return nullptr;
+  }
+  const absl::string_view filename(
+      PyBytes_AS_STRING(filename_bytes.get()),
+      IntCast<size_t>(PyBytes_GET_SIZE(filename_bytes.get())));
+  std::vector<RecordFileSplit> splits;
+  const absl::Status status = PythonUnlocked([&] {
+    return SplitRecordFile(filename, IntCast<size_t>(max_splits), splits);
+  });
+  if (ABSL_PREDICT_FALSE(!status.ok())) {
+    SetRiegeliError(status);
+    return nullptr;
+  }
+  PythonPtr list(PyList_New(IntCast<Py_ssize_t>(splits.size())));
+  if (ABSL_PREDICT_FALSE(list == nullptr)) return nullptr;
+  for (size_t i = 0; i < splits.size(); ++i) {
+    const PythonPtr begin_object = PositionToPython(splits[i].begin);
+    if (ABSL_PREDICT_FALSE(begin_object == nullptr)) return nullptr;
+    const PythonPtr end_object = PositionToPython(splits[i].end);
+    if (ABSL_PREDICT_FALSE(end_object == nullptr)) return nullptr;
+    PyObject* const split_object =
+        PyTuple_Pack(2, begin_object.get(), end_object.get());
+    if (ABSL_PREDICT_FALSE(split_object == nullptr)) return nullptr;
+    PyList_SET_ITEM(list.get(), IntCast<Py_ssize_t>(i), split_object);
+  }
+  return list.release();
 }
 
 }  // extern "C"
@@ -145,6 +257,35 @@ struct PyRecordIterObject {
 
 extern PyTypeObject PyRecordIter_Type;
 
+struct PyRecordBufferObject {
+  // clang-format off
+  PyObject_HEAD
+  static_assert(true, "");  // clang-format workaround.
+  // clang-format on
+
+  // Flat, so that it can be exported through the buffer protocol. A long
+  // record shares memory with the decoded chunk it was read from.
+  PythonWrapped<Chain> record;
+};
+
+extern PyTypeObject PyRecordBuffer_Type;
+
+// Returns a `memoryview` sharing memory of `record`.
+//
+// Returns `nullptr` on failure (with Python exception set).
+//
+// Precondition: `record` is flat
+PyObject* RecordToMemoryView(Chain&& record) {
+  RIEGELI_ASSERT(record.TryFlat() != absl::nullopt)
+      << "Failed precondition of RecordToMemoryView(): record not flat";
+  PythonPtr record_buffer(
+      PyRecordBuffer_Type.tp_alloc(&PyRecordBuffer_Type, 0));
+  if (ABSL_PREDICT_FALSE(record_buffer == nullptr)) return nullptr;
+  reinterpret_cast<PyRecordBufferObject*>(record_buffer.get())
+      ->record.emplace(std::move(record));
+  return PyMemoryView_FromObject(record_buffer.get());
+}
+
 bool RecordReaderHasException(PyRecordReaderObject* self) {
   return self->recovery_exception.has_value() ||
          !self->record_reader->healthy();
@@ -251,18 +392,21 @@ static int RecordReaderClear(PyRecordReaderObject* self) {
 static int RecordReaderInit(PyRecordReaderObject* self, PyObject* args,
                             PyObject* kwargs) {
   static constexpr const char* keywords[] = {
-      "src",      "owns_src", "assumed_pos", "buffer_size", "field_projection",
-      "recovery", nullptr};
+      "src",     "owns_src",    "assumed_pos", "buffer_size", "field_projection",
+      "end_pos", "parallelism", "recovery",    nullptr};
   PyObject* src_arg;
   PyObject* owns_src_arg = nullptr;
   PyObject* assumed_pos_arg = nullptr;
   PyObject* buffer_size_arg = nullptr;
   PyObject* field_projection_arg = nullptr;
+  PyObject* end_pos_arg = nullptr;
+  PyObject* parallelism_arg = nullptr;
   PyObject* recovery_arg = nullptr;
   if (ABSL_PREDICT_FALSE(!PyArg_ParseTupleAndKeywords(
-          args, kwargs, "O|$OOOOO:RecordReader", const_cast<char**>(keywords),
-          &src_arg, &owns_src_arg, &assumed_pos_arg, &buffer_size_arg,
-          &field_projection_arg, &recovery_arg))) {
+          args, kwargs, "O|$OOOOOOO:RecordReader",
+          const_cast<char**>(keywords), &src_arg, &owns_src_arg,
+          &assumed_pos_arg, &buffer_size_arg, &field_projection_arg,
+          &end_pos_arg, &parallelism_arg, &recovery_arg))) {
     return -1;
   }
 
@@ -291,6 +435,22 @@ static int RecordReaderInit(PyRecordReaderObject* self, PyObject* args,
     if (ABSL_PREDICT_FALSE(field_projection == absl::nullopt)) return -1;
     record_reader_options.set_field_projection(*std::move(field_projection));
   }
+  if (end_pos_arg != nullptr && end_pos_arg != Py_None) {
+    const absl::optional<Position> end_pos = PositionFromPython(end_pos_arg);
+    if (ABSL_PREDICT_FALSE(end_pos == absl::nullopt)) return -1;
+    record_reader_options.set_end_pos(*end_pos);
+  }
+  if (parallelism_arg != nullptr) {
+    const absl::optional<size_t> parallelism = SizeFromPython(parallelism_arg);
+    if (ABSL_PREDICT_FALSE(parallelism == absl::nullopt)) return -1;
+    if (ABSL_PREDICT_FALSE(*parallelism >
+                           size_t{std::numeric_limits<int>::max()})) {
+      PyErr_Format(PyExc_OverflowError, "parallelism too large: %zu",
+                   *parallelism);
+      return -1;
+    }
+    record_reader_options.set_parallelism(IntCast<int>(*parallelism));
+  }
   if (recovery_arg != nullptr && recovery_arg != Py_None) {
     Py_INCREF(recovery_arg);
     Py_XDECREF(self->recovery);
@@ -484,6 +644,27 @@ static PyObject* RecordReaderReadRecord(PyRecordReaderObject* self,
   return ChainToPython(record).release();
 }
 
+static PyObject* RecordReaderReadRecordView(PyRecordReaderObject* self,
+                                            PyObject* args) {
+  if (ABSL_PREDICT_FALSE(!self->record_reader.Verify())) return nullptr;
+  Chain record;
+  const bool ok = PythonUnlocked([&] {
+    if (ABSL_PREDICT_FALSE(!self->record_reader->ReadRecord(record))) {
+      return false;
+    }
+    record.Flatten();
+    return true;
+  });
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    if (ABSL_PREDICT_FALSE(RecordReaderHasException(self))) {
+      SetExceptionFromRecordReader(self);
+      return nullptr;
+    }
+    Py_RETURN_NONE;
+  }
+  return RecordToMemoryView(std::move(record));
+}
+
 static PyObject* RecordReaderReadMessage(PyRecordReaderObject* self,
                                          PyObject* args, PyObject* kwargs) {
   static constexpr const char* keywords[] = {"message_type", nullptr};
@@ -516,6 +697,51 @@ static PyObject* RecordReaderReadMessage(PyRecordReaderObject* self,
   return message.release();
 }
 
+static PyObject* RecordReaderReadRecordBatch(PyRecordReaderObject* self,
+                                             PyObject* args, PyObject* kwargs) {
+  static constexpr const char* keywords[] = {"max_records", nullptr};
+  Py_ssize_t max_records;
+  if (ABSL_PREDICT_FALSE(!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "n:read_record_batch", const_cast<char**>(keywords),
+          &max_records))) {
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(max_records < 0)) {
+    PyErr_Format(PyExc_ValueError, "max_records must be non-negative, not %zd",
+                 max_records);
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(!self->record_reader.Verify())) return nullptr;
+  std::vector<Chain> records;
+  const bool ok = PythonUnlocked([&] {
+    records.reserve(UnsignedMin(IntCast<size_t>(max_records), size_t{1} << 16));
+    while (records.size() < IntCast<size_t>(max_records)) {
+      Chain record;
+      if (ABSL_PREDICT_FALSE(!self->record_reader->ReadRecord(record))) {
+        return false;
+      }
+      records.push_back(std::move(record));
+    }
+    return true;
+  });
+  if (ABSL_PREDICT_FALSE(!ok) && records.empty() &&
+      ABSL_PREDICT_FALSE(RecordReaderHasException(self))) {
+    SetExceptionFromRecordReader(self);
+    return nullptr;
+  }
+  // If reading failed after some records, they are returned, and the
+  // exception is raised by the next call.
+  PythonPtr list(PyList_New(IntCast<Py_ssize_t>(records.size())));
+  if (ABSL_PREDICT_FALSE(list == nullptr)) return nullptr;
+  for (size_t i = 0; i < records.size(); ++i) {
+    PythonPtr record_object = ChainToPython(records[i]);
+    if (ABSL_PREDICT_FALSE(record_object == nullptr)) return nullptr;
+    PyList_SET_ITEM(list.get(), IntCast<Py_ssize_t>(i),
+                    record_object.release());
+  }
+  return list.release();
+}
+
 static PyRecordIterObject* RecordReaderReadRecords(PyRecordReaderObject* self,
                                                    PyObject* args) {
   std::unique_ptr<PyRecordIterObject, Deleter> iter(
@@ -530,6 +756,20 @@ static PyRecordIterObject* RecordReaderReadRecords(PyRecordReaderObject* self,
   return iter.release();
 }
 
+static PyRecordIterObject* RecordReaderReadRecordViews(
+    PyRecordReaderObject* self, PyObject* args) {
+  std::unique_ptr<PyRecordIterObject, Deleter> iter(
+      PyObject_GC_New(PyRecordIterObject, &PyRecordIter_Type));
+  if (ABSL_PREDICT_FALSE(iter == nullptr)) return nullptr;
+  iter->read_record = [](PyRecordReaderObject* self, PyObject* args) {
+    return RecordReaderReadRecordView(self, args);
+  };
+  Py_INCREF(self);
+  iter->record_reader = self;
+  iter->args = nullptr;
+  return iter.release();
+}
+
 static PyRecordIterObject* RecordReaderReadMessages(PyRecordReaderObject* self,
                                                     PyObject* args,
                                                     PyObject* kwargs) {
@@ -915,6 +1155,20 @@ Reads the next record.
 
 Returns:
   The record read as bytes, or None at end of file.
+)doc"},
+    {"read_record_view",
+     reinterpret_cast<PyCFunction>(RecordReaderReadRecordView), METH_NOARGS,
+     R"doc(
+read_record_view(self) -> Optional[memoryview]
+
+Reads the next record, without copying it to a new bytes object.
+
+A record longer than 255 bytes shares memory with the decoded chunk, which is
+kept alive as long as the memoryview or an object created from it, e.g. by
+numpy.frombuffer(), refers to it. This avoids copying large records.
+
+Returns:
+  The record read as a read-only memoryview, or None at end of file.
 )doc"},
     {"read_message", reinterpret_cast<PyCFunction>(RecordReaderReadMessage),
      METH_VARARGS | METH_KEYWORDS, R"doc(
@@ -927,6 +1181,24 @@ Args:
 
 Returns:
   The record read as a parsed message, or None at end of file.
+)doc"},
+    {"read_record_batch",
+     reinterpret_cast<PyCFunction>(RecordReaderReadRecordBatch),
+     METH_VARARGS | METH_KEYWORDS, R"doc(
+read_record_batch(self, max_records: int) -> List[bytes]
+
+Reads up to max_records next records.
+
+This is faster than reading records one by one, because records are read
+without holding the GIL, and Python objects are created afterwards.
+
+Args:
+  max_records: Maximum number of records to read.
+
+Returns:
+  The records read as bytes. Fewer than max_records are returned only at end of
+  file, or if reading failed after some records; then the exception is raised
+  by the next read. An empty list means end of file if max_records > 0.
 )doc"},
     {"read_records", reinterpret_cast<PyCFunction>(RecordReaderReadRecords),
      METH_NOARGS, R"doc(
@@ -936,6 +1208,16 @@ Returns an iterator which reads all remaining records.
 
 Yields:
   The next record read as bytes.
+)doc"},
+    {"read_record_views",
+     reinterpret_cast<PyCFunction>(RecordReaderReadRecordViews), METH_NOARGS,
+     R"doc(
+read_record_views(self) -> Iterator[memoryview]
+
+Returns an iterator which reads all remaining records, like read_record_view().
+
+Yields:
+  The next record read as a read-only memoryview.
 )doc"},
     {"read_messages", reinterpret_cast<PyCFunction>(RecordReaderReadMessages),
      METH_VARARGS | METH_KEYWORDS, R"doc(
@@ -1175,6 +1457,8 @@ RecordReader(
     assumed_pos: Optional[int] = None,
     buffer_size: int = 64 << 10,
     field_projection: Optional[Iterable[Iterable[int]]] = None,
+    end_pos: Optional[int] = None,
+    parallelism: int = 0,
     recovery: Optional[Callable[[SkippedRegion], Any]] = None) -> RecordReader
 
 Will read from the given file.
@@ -1198,6 +1482,12 @@ Args:
     field EXISTENCE_ONLY can be added to the end of the path; it preserves
     field existence but ignores its value; warning: for a repeated field this
     preserves the field count only if the field is not packed.
+  end_pos: If not None, chunks beginning at or after this numeric position are
+    not read, as if the file ended there. Together with seek_numeric() to the
+    beginning, this reads a range returned by split_record_file().
+  parallelism: The maximum number of chunks decoded in parallel in background
+    while reading records sequentially. 0 decodes chunks when they are needed,
+    without background threads.
   recovery: If None, then invalid file contents cause RecordReader to raise
     RiegeliError. If not None, then invalid file contents cause RecordReader to
     skip over the invalid region and call this recovery function with a
@@ -1343,6 +1633,519 @@ PyTypeObject PyRecordIter_Type = {
     nullptr,                                             // tp_finalize
 };
 
+extern "C" {
+
+static void RecordBufferDestructor(PyRecordBufferObject* self) {
+  self->record.reset();
+  Py_TYPE(self)->tp_free(self);
+}
+
+static int RecordBufferGetBuffer(PyRecordBufferObject* self, Py_buffer* view,
+                                 int flags) {
+  const absl::string_view record = self->record->Flatten();
+  return PyBuffer_FillInfo(view, reinterpret_cast<PyObject*>(self),
+                           const_cast<char*>(record.data()),
+                           IntCast<Py_ssize_t>(record.size()), 1, flags);
+}
+
+}  // extern "C"
+
+const PyBufferProcs RecordBufferAsBuffer = {
+    reinterpret_cast<getbufferproc>(RecordBufferGetBuffer),  // bf_getbuffer
+    nullptr,                                                 // bf_releasebuffer
+};
+
+PyTypeObject PyRecordBuffer_Type = {
+    // clang-format off
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    // clang-format on
+    "RecordBuffer",                                        // tp_name
+    sizeof(PyRecordBufferObject),                          // tp_basicsize
+    0,                                                     // tp_itemsize
+    reinterpret_cast<destructor>(RecordBufferDestructor),  // tp_dealloc
+#if PY_VERSION_HEX >= 0x03080000
+    0,  // tp_vectorcall_offset
+#else
+    nullptr,  // tp_print
+#endif
+    nullptr,                                               // tp_getattr
+    nullptr,                                               // tp_setattr
+    nullptr,                                               // tp_as_async
+    nullptr,                                               // tp_repr
+    nullptr,                                               // tp_as_number
+    nullptr,                                               // tp_as_sequence
+    nullptr,                                               // tp_as_mapping
+    nullptr,                                               // tp_hash
+    nullptr,                                               // tp_call
+    nullptr,                                               // tp_str
+    nullptr,                                               // tp_getattro
+    nullptr,                                               // tp_setattro
+    const_cast<PyBufferProcs*>(&RecordBufferAsBuffer),     // tp_as_buffer
+    Py_TPFLAGS_DEFAULT,                                    // tp_flags
+    nullptr,                                               // tp_doc
+    nullptr,                                               // tp_traverse
+    nullptr,                                               // tp_clear
+    nullptr,                                               // tp_richcompare
+    0,                                                     // tp_weaklistoffset
+    nullptr,                                               // tp_iter
+    nullptr,                                               // tp_iternext
+    nullptr,                                               // tp_methods
+    nullptr,                                               // tp_members
+    nullptr,                                               // tp_getset
+    nullptr,                                               // tp_base
+    nullptr,                                               // tp_dict
+    nullptr,                                               // tp_descr_get
+    nullptr,                                               // tp_descr_set
+    0,                                                     // tp_dictoffset
+    nullptr,                                               // tp_init
+    nullptr,                                               // tp_alloc
+    nullptr,                                               // tp_new
+    nullptr,                                               // tp_free
+    nullptr,                                               // tp_is_gc
+    nullptr,                                               // tp_bases
+    nullptr,                                               // tp_mro
+    nullptr,                                               // tp_cache
+    nullptr,                                               // tp_subclasses
+    nullptr,                                               // tp_weaklist
+    nullptr,                                               // tp_del
+    0,                                                     // tp_version_tag
+    nullptr,                                               // tp_finalize
+};
+
+// Reads records of a set of shards by `ShardedRecordReader` in a background
+// thread, optionally shuffles them, and hands batches of them to the consumer
+// through a bounded queue.
+class ShardedBatchReader {
+ public:
+  explicit ShardedBatchReader(std::vector<std::string> filenames,
+                              ShardedRecordReader::Options options,
+                              size_t shuffle_buffer, uint64_t seed,
+                              size_t batch_size);
+
+  ShardedBatchReader(const ShardedBatchReader&) = delete;
+  ShardedBatchReader& operator=(const ShardedBatchReader&) = delete;
+
+  // Stops reading in the background and waits for it to finish.
+  ~ShardedBatchReader();
+
+  // Waits for the next batch of records. Records read before a failure are
+  // returned before the failure is reported.
+  //
+  // Return values:
+  //  * `true`                           - success (`batch` is set)
+  //  * `false` (when `status().ok()`)   - all shards end
+  //  * `false` (when `!status().ok()`)  - failure
+  bool ReadBatch(std::vector<Chain>& batch);
+
+  // Returns the failure of reading, if any.
+  absl::Status status();
+
+ private:
+  // Maximum number of batches waiting for the consumer.
+  static constexpr size_t kMaxQueuedBatches = 4;
+
+  void Run(std::vector<std::string> filenames,
+           ShardedRecordReader::Options options);
+
+  // Appends `batch` to `queue_`, waiting while the queue is full.
+  //
+  // Returns `false` if reading was cancelled.
+  bool PutBatch(std::vector<Chain>&& batch);
+
+  const size_t shuffle_buffer_;
+  std::mt19937_64 random_;
+  const size_t batch_size_;
+
+  absl::Mutex mutex_;
+  std::deque<std::vector<Chain>> queue_ ABSL_GUARDED_BY(mutex_);
+  // Set by the consumer to stop reading.
+  bool cancelled_ ABSL_GUARDED_BY(mutex_) = false;
+  // Set by the reading thread when it finishes.
+  bool finished_ ABSL_GUARDED_BY(mutex_) = false;
+  absl::Status status_ ABSL_GUARDED_BY(mutex_);
+};
+
+ShardedBatchReader::ShardedBatchReader(std::vector<std::string> filenames,
+                                       ShardedRecordReader::Options options,
+                                       size_t shuffle_buffer, uint64_t seed,
+                                       size_t batch_size)
+    : shuffle_buffer_(shuffle_buffer), random_(seed), batch_size_(batch_size) {
+  ThreadPool::global().Schedule(
+      [this, filenames = std::move(filenames),
+       options = std::move(options)]() mutable {
+        Run(std::move(filenames), std::move(options));
+      });
+}
+
+ShardedBatchReader::~ShardedBatchReader() {
+  absl::MutexLock lock(&mutex_);
+  cancelled_ = true;
+  mutex_.Await(absl::Condition(&finished_));
+}
+
+void ShardedBatchReader::Run(std::vector<std::string> filenames,
+                             ShardedRecordReader::Options options) {
+  ShardedRecordReader reader(std::move(filenames), std::move(options));
+  // Records not returned yet, from which they are picked at random if
+  // shuffling.
+  std::vector<Chain> pool;
+  std::vector<Chain> batch;
+  bool reader_ended = false;
+  for (;;) {
+    while (!reader_ended && pool.size() < UnsignedMax(shuffle_buffer_, 1u)) {
+      Chain record;
+      if (ABSL_PREDICT_FALSE(!reader.ReadRecord(record))) {
+        reader_ended = true;
+        break;
+      }
+      pool.push_back(std::move(record));
+    }
+    if (pool.empty()) break;
+    if (shuffle_buffer_ > 1) {
+      std::swap(pool[std::uniform_int_distribution<size_t>(
+                    0, pool.size() - 1)(random_)],
+                pool.back());
+    }
+    batch.push_back(std::move(pool.back()));
+    pool.pop_back();
+    if (batch.size() == batch_size_) {
+      if (ABSL_PREDICT_FALSE(!PutBatch(std::move(batch)))) break;
+      batch.clear();
+    }
+  }
+  if (!batch.empty()) PutBatch(std::move(batch));
+  reader.Close();
+  absl::MutexLock lock(&mutex_);
+  status_ = reader.status();
+  finished_ = true;
+}
+
+bool ShardedBatchReader::PutBatch(std::vector<Chain>&& batch) {
+  absl::MutexLock lock(&mutex_);
+  struct Args {
+    ShardedBatchReader* self;
+  } args = {this};
+  mutex_.Await(absl::Condition(
+      +[](Args* args) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+        return args->self->cancelled_ ||
+               args->self->queue_.size() < kMaxQueuedBatches;
+      },
+      &args));
+  if (cancelled_) return false;
+  queue_.push_back(std::move(batch));
+  return true;
+}
+
+bool ShardedBatchReader::ReadBatch(std::vector<Chain>& batch) {
+  absl::MutexLock lock(&mutex_);
+  struct Args {
+    ShardedBatchReader* self;
+  } args = {this};
+  mutex_.Await(absl::Condition(
+      +[](Args* args) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+        return args->self->finished_ || !args->self->queue_.empty();
+      },
+      &args));
+  if (queue_.empty()) return false;
+  batch = std::move(queue_.front());
+  queue_.pop_front();
+  return true;
+}
+
+absl::Status ShardedBatchReader::status() {
+  absl::MutexLock lock(&mutex_);
+  return status_;
+}
+
+struct PyShardedReaderObject {
+  // clang-format off
+  PyObject_HEAD
+  static_assert(true, "");  // clang-format workaround.
+  // clang-format on
+
+  PythonWrapped<ShardedBatchReader> sharded_reader;
+};
+
+extern PyTypeObject PyShardedReader_Type;
+
+extern "C" {
+
+static void ShardedReaderDestructor(PyShardedReaderObject* self) {
+  PythonUnlocked([&] { self->sharded_reader.reset(); });
+  Py_TYPE(self)->tp_free(self);
+}
+
+static int ShardedReaderInit(PyShardedReaderObject* self, PyObject* args,
+                             PyObject* kwargs) {
+  static constexpr const char* keywords[] = {
+      "paths",      "num_threads",      "shuffle_buffer", "seed",
+      "batch_size", "field_projection", nullptr};
+  PyObject* paths_arg;
+  Py_ssize_t num_threads = 1;
+  Py_ssize_t shuffle_buffer = 0;
+  PyObject* seed_arg = nullptr;
+  Py_ssize_t batch_size = 256;
+  PyObject* field_projection_arg = nullptr;
+  if (ABSL_PREDICT_FALSE(!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "O|$nnOnO:ShardedReader", const_cast<char**>(keywords),
+          &paths_arg, &num_threads, &shuffle_buffer, &seed_arg, &batch_size,
+          &field_projection_arg))) {
+    return -1;
+  }
+  if (ABSL_PREDICT_FALSE(num_threads <= 0)) {
+    PyErr_Format(PyExc_ValueError, "num_threads must be positive, not %zd",
+                 num_threads);
+    return -1;
+  }
+  if (ABSL_PREDICT_FALSE(shuffle_buffer < 0)) {
+    PyErr_Format(PyExc_ValueError,
+                 "shuffle_buffer must be non-negative, not %zd",
+                 shuffle_buffer);
+    return -1;
+  }
+  if (ABSL_PREDICT_FALSE(batch_size <= 0)) {
+    PyErr_Format(PyExc_ValueError, "batch_size must be positive, not %zd",
+                 batch_size);
+    return -1;
+  }
+  std::vector<std::string> filenames;
+  const PythonPtr path_iter(PyObject_GetIter(paths_arg));
+  if (ABSL_PREDICT_FALSE(path_iter == nullptr)) return -1;
+  while (const PythonPtr path_object{PyIter_Next(path_iter.get())}) {
+    PyObject* filename_object;
+    if (ABSL_PREDICT_FALSE(
+            !PyUnicode_FSConverter(path_object.get(), &filename_object))) {
+      return -1;
+    }
+    const PythonPtr filename_bytes(filename_object);
+    filenames.emplace_back(
+        PyBytes_AS_STRING(filename_bytes.get()),
+        IntCast<size_t>(PyBytes_GET_SIZE(filename_bytes.get())));
+  }
+  if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return -1;
+  uint64_t seed;
+  if (seed_arg == nullptr || seed_arg == Py_None) {
+    seed = std::random_device()();
+  } else {
+    seed = PyLong_AsUnsignedLongLongMask(seed_arg);
+    if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return -1;
+  }
+  ShardedRecordReader::Options options;
+  options.set_parallelism(IntCast<int>(num_threads))
+      .set_order(ShardedRecordReader::Order::kInterleaved);
+  if (field_projection_arg != nullptr && field_projection_arg != Py_None) {
+    absl::optional<FieldProjection> field_projection =
+        FieldProjectionFromPython(field_projection_arg);
+    if (ABSL_PREDICT_FALSE(field_projection == absl::nullopt)) return -1;
+    options.record_reader_options().set_field_projection(
+        *std::move(field_projection));
+  }
+  PythonUnlocked([&] {
+    self->sharded_reader.emplace(std::move(filenames), std::move(options),
+                                 IntCast<size_t>(shuffle_buffer), seed,
+                                 IntCast<size_t>(batch_size));
+  });
+  return 0;
+}
+
+static PyObject* ShardedReaderReadBatch(PyShardedReaderObject* self,
+                                        PyObject* args) {
+  if (ABSL_PREDICT_FALSE(!self->sharded_reader.Verify())) return nullptr;
+  std::vector<Chain> batch;
+  const bool ok =
+      PythonUnlocked([&] { return self->sharded_reader->ReadBatch(batch); });
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    const absl::Status status = self->sharded_reader->status();
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      SetRiegeliError(status);
+      return nullptr;
+    }
+    Py_RETURN_NONE;
+  }
+  PythonPtr list(PyList_New(IntCast<Py_ssize_t>(batch.size())));
+  if (ABSL_PREDICT_FALSE(list == nullptr)) return nullptr;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    PythonPtr record_object = ChainToPython(batch[i]);
+    if (ABSL_PREDICT_FALSE(record_object == nullptr)) return nullptr;
+    PyList_SET_ITEM(list.get(), IntCast<Py_ssize_t>(i),
+                    record_object.release());
+  }
+  return list.release();
+}
+
+static PyObject* ShardedReaderNext(PyShardedReaderObject* self) {
+  PythonPtr batch(ShardedReaderReadBatch(self, nullptr));
+  if (ABSL_PREDICT_FALSE(batch.get() == Py_None)) return nullptr;
+  return batch.release();
+}
+
+static PyObject* ShardedReaderClose(PyShardedReaderObject* self,
+                                    PyObject* args) {
+  if (ABSL_PREDICT_TRUE(self->sharded_reader.has_value())) {
+    const absl::Status status = self->sharded_reader->status();
+    PythonUnlocked([&] { self->sharded_reader.reset(); });
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      SetRiegeliError(status);
+      return nullptr;
+    }
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* ShardedReaderEnter(PyObject* self, PyObject* args) {
+  // return self
+  Py_INCREF(self);
+  return self;
+}
+
+static PyObject* ShardedReaderExit(PyShardedReaderObject* self,
+                                   PyObject* args) {
+  PyObject* exc_type;
+  PyObject* exc_value;
+  PyObject* traceback;
+  if (ABSL_PREDICT_FALSE(!PyArg_ParseTuple(args, "OOO:__exit__", &exc_type,
+                                           &exc_value, &traceback))) {
+    return nullptr;
+  }
+  // self.close(), suppressing exceptions if exc_type != None.
+  PythonPtr close_result(ShardedReaderClose(self, nullptr));
+  if (ABSL_PREDICT_FALSE(close_result == nullptr) && exc_type != Py_None) {
+    PyErr_Clear();
+  } else if (ABSL_PREDICT_FALSE(close_result == nullptr)) {
+    return nullptr;
+  }
+  Py_RETURN_FALSE;
+}
+
+}  // extern "C"
+
+const PyMethodDef ShardedReaderMethods[] = {
+    {"__enter__", ShardedReaderEnter, METH_NOARGS,
+     R"doc(
+__enter__(self) -> ShardedReader
+
+Returns self.
+)doc"},
+    {"__exit__", reinterpret_cast<PyCFunction>(ShardedReaderExit),
+     METH_VARARGS,
+     R"doc(
+__exit__(self, exc_type, exc_value, traceback) -> bool
+
+Calls close().
+
+Suppresses exceptions from close() if an exception is already in flight.
+
+Args:
+  exc_type: None or exception in flight (type).
+  exc_value: None or exception in flight (value).
+  traceback: None or exception in flight (traceback).
+)doc"},
+    {"close", reinterpret_cast<PyCFunction>(ShardedReaderClose), METH_NOARGS,
+     R"doc(
+close(self) -> None
+
+Stops reading, and raises an exception if reading failed.
+)doc"},
+    {"read_batch", reinterpret_cast<PyCFunction>(ShardedReaderReadBatch),
+     METH_NOARGS, R"doc(
+read_batch(self) -> Optional[List[bytes]]
+
+Reads the next batch of records.
+
+Returns:
+  The records read as bytes, batch_size of them except that the last batch can
+  be smaller, or None at end of all shards.
+)doc"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyTypeObject PyShardedReader_Type = {
+    // clang-format off
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    // clang-format on
+    "riegeli.records.record_reader.ShardedReader",          // tp_name
+    sizeof(PyShardedReaderObject),                          // tp_basicsize
+    0,                                                      // tp_itemsize
+    reinterpret_cast<destructor>(ShardedReaderDestructor),  // tp_dealloc
+#if PY_VERSION_HEX >= 0x03080000
+    0,  // tp_vectorcall_offset
+#else
+    nullptr,  // tp_print
+#endif
+    nullptr,                                                // tp_getattr
+    nullptr,                                                // tp_setattr
+    nullptr,                                                // tp_as_async
+    nullptr,                                                // tp_repr
+    nullptr,                                                // tp_as_number
+    nullptr,                                                // tp_as_sequence
+    nullptr,                                                // tp_as_mapping
+    nullptr,                                                // tp_hash
+    nullptr,                                                // tp_call
+    nullptr,                                                // tp_str
+    nullptr,                                                // tp_getattro
+    nullptr,                                                // tp_setattro
+    nullptr,                                                // tp_as_buffer
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,               // tp_flags
+    R"doc(
+ShardedReader(
+    paths: Iterable[Union[str, bytes, os.PathLike]],
+    *,
+    num_threads: int = 1,
+    shuffle_buffer: int = 0,
+    seed: Optional[int] = None,
+    batch_size: int = 256,
+    field_projection: Optional[Iterable[Iterable[int]]] = None
+) -> ShardedReader
+
+Reads records of a set of Riegeli/records files (shards) in native threads,
+handing batches of records to Python.
+
+Shards are read and decoded without holding the GIL, so a single process can
+replace a pool of loader processes, without duplicating memory or pickling
+records. Batches are prepared ahead, up to a small bound, while Python
+processes previous batches.
+
+Iterating over a ShardedReader yields batches, like read_batch().
+
+Args:
+  paths: Names of the files to read.
+  num_threads: How many shards are read at once. Records are taken from them in
+    turn; when a shard ends, the next one takes its place.
+  shuffle_buffer: If greater than 1, records are shuffled: each returned record
+    is picked at random from this many records read ahead.
+  seed: Seed for shuffling. If None, a random seed is used.
+  batch_size: Number of records in each batch.
+  field_projection: Like field_projection of RecordReader.
+)doc",                                                      // tp_doc
+    nullptr,                                                // tp_traverse
+    nullptr,                                                // tp_clear
+    nullptr,                                                // tp_richcompare
+    0,                                                      // tp_weaklistoffset
+    PyObject_SelfIter,                                      // tp_iter
+    reinterpret_cast<iternextfunc>(ShardedReaderNext),      // tp_iternext
+    const_cast<PyMethodDef*>(ShardedReaderMethods),         // tp_methods
+    nullptr,                                                // tp_members
+    nullptr,                                                // tp_getset
+    nullptr,                                                // tp_base
+    nullptr,                                                // tp_dict
+    nullptr,                                                // tp_descr_get
+    nullptr,                                                // tp_descr_set
+    0,                                                      // tp_dictoffset
+    reinterpret_cast<initproc>(ShardedReaderInit),          // tp_init
+    nullptr,                                                // tp_alloc
+    PyType_GenericNew,                                      // tp_new
+    nullptr,                                                // tp_free
+    nullptr,                                                // tp_is_gc
+    nullptr,                                                // tp_bases
+    nullptr,                                                // tp_mro
+    nullptr,                                                // tp_cache
+    nullptr,                                                // tp_subclasses
+    nullptr,                                                // tp_weaklist
+    nullptr,                                                // tp_del
+    0,                                                      // tp_version_tag
+    nullptr,                                                // tp_finalize
+};
+
 const char* const kModuleName = "riegeli.records.record_reader";
 const char kModuleDoc[] = R"doc(Reads records from a Riegeli/records file.)doc";
 
@@ -1361,6 +2164,30 @@ Args:
 Returns:
   A generated message type corresponding to the type of records, or None if that
   information is not available in metadata.
+)doc"},
+    {"split_record_file",
+     reinterpret_cast<PyCFunction>(SplitRecordFileToPython),
+     METH_VARARGS | METH_KEYWORDS, R"doc(
+split_record_file(
+    filename: Union[str, bytes, os.PathLike], max_splits: int
+) -> List[Tuple[int, int]]
+
+Splits a Riegeli/records file into ranges for processing them independently.
+
+Ranges have similar sizes, and together they cover the whole file without
+sharing records. Finding them reads only block headers near evenly spaced
+positions, not chunks in between.
+
+A range (begin, end) is read by RecordReader(src, end_pos=end) after
+seek_numeric(begin).
+
+Args:
+  filename: Name of the file to split.
+  max_splits: Maximum number of ranges. Fewer ranges are returned if the file
+    has too few chunks.
+
+Returns:
+  The ranges as numeric positions (begin, end), in order of the file.
 )doc"},
     {nullptr, nullptr, 0, nullptr},
 };
@@ -1384,6 +2211,12 @@ PyObject* InitModule() {
   if (ABSL_PREDICT_FALSE(PyType_Ready(&PyRecordIter_Type) < 0)) {
     return nullptr;
   }
+  if (ABSL_PREDICT_FALSE(PyType_Ready(&PyRecordBuffer_Type) < 0)) {
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(PyType_Ready(&PyShardedReader_Type) < 0)) {
+    return nullptr;
+  }
   PythonPtr module(PyModule_Create(&kModuleDef));
   if (ABSL_PREDICT_FALSE(module == nullptr)) return nullptr;
   PythonPtr existence_only = IntToPython(Field::kExistenceOnly);
@@ -1398,6 +2231,12 @@ PyObject* InitModule() {
                                                 &PyRecordReader_Type)) < 0)) {
     return nullptr;
   }
+  Py_INCREF(&PyShardedReader_Type);
+  if (ABSL_PREDICT_FALSE(PyModule_AddObject(module.get(), "ShardedReader",
+                                            reinterpret_cast<PyObject*>(
+                                                &PyShardedReader_Type)) < 0)) {
+    return nullptr;
+  }
   return module.release();
 }
 
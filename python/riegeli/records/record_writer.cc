@@ -20,8 +20,12 @@
 #include <Python.h>
 // clang-format: do not reorder the above include.
 
+#include <fcntl.h>
 #include <stddef.h>
 
+#include <cstring>
+#include <deque>
+#include <memory>
 #include <utility>
 
 #include "absl/base/optimization.h"
@@ -33,6 +37,9 @@
 #include "python/riegeli/records/record_position.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/record_writer.h"
 
@@ -194,42 +201,65 @@ struct PyRecordWriterObject {
   static_assert(true, "");  // clang-format workaround.
   // clang-format on
 
-  PythonWrapped<RecordWriter<PythonWriter>> record_writer;
+  // A `PythonWriter` if `dest_path == nullptr`, otherwise an `FdWriter<>`.
+  PythonWrapped<RecordWriter<std::unique_ptr<Writer>>> record_writer;
+  // If not `nullptr`, `dest` was a path, and the file is written natively,
+  // without holding the GIL.
+  PyObject* dest_path;
 };
 
 extern PyTypeObject PyRecordWriter_Type;
 
+// Returns the `PythonWriter` written to, or `nullptr` if the file is written
+// natively.
+PythonWriter* PythonDest(PyRecordWriterObject* self) {
+  if (self->dest_path != nullptr) return nullptr;
+  return static_cast<PythonWriter*>(self->record_writer->dest().get());
+}
+
 void SetExceptionFromRecordWriter(PyRecordWriterObject* self) {
   RIEGELI_ASSERT(!self->record_writer->healthy())
       << "Failed precondition of SetExceptionFromRecordWriter(): "
          "RecordWriter healthy";
-  if (!self->record_writer->dest().exception().ok()) {
-    self->record_writer->dest().exception().Restore();
+  PythonWriter* const python_dest = PythonDest(self);
+  if (python_dest != nullptr && !python_dest->exception().ok()) {
+    python_dest->exception().Restore();
     return;
   }
   SetRiegeliError(self->record_writer->status());
 }
 
+// Returns a borrowed reference to `dest` passed to the constructor.
+PyObject* RecordWriterDestObject(PyRecordWriterObject* self) {
+  if (ABSL_PREDICT_FALSE(!self->record_writer.has_value())) return Py_None;
+  if (self->dest_path != nullptr) return self->dest_path;
+  return PythonDest(self)->dest();
+}
+
 extern "C" {
 
 static void RecordWriterDestructor(PyRecordWriterObject* self) {
   PyObject_GC_UnTrack(self);
   Py_TRASHCAN_SAFE_BEGIN(self);
   PythonUnlocked([&] { self->record_writer.reset(); });
+  Py_XDECREF(self->dest_path);
   Py_TYPE(self)->tp_free(self);
   Py_TRASHCAN_SAFE_END(self);
 }
 
 static int RecordWriterTraverse(PyRecordWriterObject* self, visitproc visit,
                                 void* arg) {
+  Py_VISIT(self->dest_path);
   if (self->record_writer.has_value()) {
-    return self->record_writer->dest().Traverse(visit, arg);
+    PythonWriter* const python_dest = PythonDest(self);
+    if (python_dest != nullptr) return python_dest->Traverse(visit, arg);
   }
   return 0;
 }
 
 static int RecordWriterClear(PyRecordWriterObject* self) {
   PythonUnlocked([&] { self->record_writer.reset(); });
+  Py_CLEAR(self->dest_path);
   return 0;
 }
 
@@ -252,7 +282,20 @@ static int RecordWriterInit(PyRecordWriterObject* self, PyObject* args,
     return -1;
   }
 
+  static constexpr Identifier id_fspath("__fspath__");
+  const bool dest_is_path = PyUnicode_Check(dest_arg) ||
+                            PyBytes_Check(dest_arg) ||
+                            PyObject_HasAttr(dest_arg, id_fspath.get());
+  if (dest_is_path && (owns_dest_arg != nullptr ||
+                       (assumed_pos_arg != nullptr &&
+                        assumed_pos_arg != Py_None))) {
+    PyErr_SetString(PyExc_TypeError,
+                    "RecordWriter() got keyword arguments 'owns_dest' or "
+                    "'assumed_pos' which are not applicable to a path");
+    return -1;
+  }
   PythonWriter::Options python_writer_options;
+  FdWriterBase::Options fd_writer_options;
   if (owns_dest_arg != nullptr) {
     const int owns_dest_is_true = PyObject_IsTrue(owns_dest_arg);
     if (ABSL_PREDICT_FALSE(owns_dest_is_true < 0)) return -1;
@@ -268,6 +311,7 @@ static int RecordWriterInit(PyRecordWriterObject* self, PyObject* args,
     const absl::optional<size_t> buffer_size = SizeFromPython(buffer_size_arg);
     if (ABSL_PREDICT_FALSE(buffer_size == absl::nullopt)) return -1;
     python_writer_options.set_buffer_size(*buffer_size);
+    fd_writer_options.set_buffer_size(*buffer_size);
   }
 
   RecordWriterBase::Options record_writer_options;
@@ -309,13 +353,42 @@ static int RecordWriterInit(PyRecordWriterObject* self, PyObject* args,
         *std::move(serialized_metadata));
   }
 
-  PythonWriter python_writer(dest_arg, std::move(python_writer_options));
+  if (dest_is_path) {
+    PyObject* filename_object;
+    if (ABSL_PREDICT_FALSE(
+            !PyUnicode_FSConverter(dest_arg, &filename_object))) {
+      return -1;
+    }
+    const PythonPtr filename_bytes(filename_object);
+    const absl::string_view filename(
+        PyBytes_AS_STRING(filename_bytes.get()),
+        IntCast<size_t>(PyBytes_GET_SIZE(filename_bytes.get())));
+    PythonUnlocked([&] { self->record_writer.reset(); });
+    Py_INCREF(dest_arg);
+    Py_XSETREF(self->dest_path, dest_arg);
+    PythonUnlocked([&] {
+      self->record_writer.emplace(
+          std::make_unique<FdWriter<>>(filename, O_WRONLY | O_CREAT | O_TRUNC,
+                                       std::move(fd_writer_options)),
+          std::move(record_writer_options));
+    });
+    if (ABSL_PREDICT_FALSE(!self->record_writer->healthy())) {
+      SetExceptionFromRecordWriter(self);
+      return -1;
+    }
+    return 0;
+  }
+  std::unique_ptr<PythonWriter> python_writer =
+      std::make_unique<PythonWriter>(dest_arg,
+                                     std::move(python_writer_options));
+  PythonUnlocked([&] { self->record_writer.reset(); });
+  Py_CLEAR(self->dest_path);
   PythonUnlocked([&] {
     self->record_writer.emplace(std::move(python_writer),
                                 std::move(record_writer_options));
   });
   if (ABSL_PREDICT_FALSE(!self->record_writer->healthy())) {
-    self->record_writer->dest().Close();
+    PythonDest(self)->Close();
     SetExceptionFromRecordWriter(self);
     return -1;
   }
@@ -323,9 +396,7 @@ static int RecordWriterInit(PyRecordWriterObject* self, PyObject* args,
 }
 
 static PyObject* RecordWriterDest(PyRecordWriterObject* self, void* closure) {
-  PyObject* const dest = ABSL_PREDICT_FALSE(!self->record_writer.has_value())
-                             ? Py_None
-                             : self->record_writer->dest().dest();
+  PyObject* const dest = RecordWriterDestObject(self);
   Py_INCREF(dest);
   return dest;
 }
@@ -334,9 +405,7 @@ static PyObject* RecordWriterRepr(PyRecordWriterObject* self) {
   const PythonPtr format = StringToPython("<RecordWriter dest={!r}>");
   if (ABSL_PREDICT_FALSE(format == nullptr)) return nullptr;
   // return format.format(self.dest)
-  PyObject* const dest = ABSL_PREDICT_FALSE(!self->record_writer.has_value())
-                             ? Py_None
-                             : self->record_writer->dest().dest();
+  PyObject* const dest = RecordWriterDestObject(self);
   static constexpr Identifier id_format("format");
   return PyObject_CallMethodObjArgs(format.get(), id_format.get(), dest,
                                     nullptr);
@@ -431,6 +500,46 @@ static PyObject* RecordWriterWriteMessage(PyRecordWriterObject* self,
   Py_RETURN_NONE;
 }
 
+static PyObject* RecordWriterWriteChunk(PyRecordWriterObject* self,
+                                        PyObject* args, PyObject* kwargs) {
+  static constexpr const char* keywords[] = {"chunk", nullptr};
+  PyObject* chunk_arg;
+  if (ABSL_PREDICT_FALSE(!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "O:write_chunk", const_cast<char**>(keywords),
+          &chunk_arg))) {
+    return nullptr;
+  }
+  BytesLike chunk_bytes;
+  if (ABSL_PREDICT_FALSE(!chunk_bytes.FromPython(chunk_arg))) return nullptr;
+  const absl::string_view chunk_view(chunk_bytes);
+  if (ABSL_PREDICT_FALSE(chunk_view.size() < ChunkHeader::size())) {
+    PyErr_SetString(PyExc_ValueError, "Chunk header truncated");
+    return nullptr;
+  }
+  Chunk chunk;
+  std::memcpy(chunk.header.bytes(), chunk_view.data(), ChunkHeader::size());
+  if (ABSL_PREDICT_FALSE(chunk.header.computed_header_hash() !=
+                         chunk.header.stored_header_hash())) {
+    PyErr_SetString(PyExc_ValueError, "Corrupted chunk header");
+    return nullptr;
+  }
+  if (ABSL_PREDICT_FALSE(chunk.header.data_size() !=
+                         chunk_view.size() - ChunkHeader::size())) {
+    PyErr_SetString(PyExc_ValueError,
+                    "Chunk data size does not match its header");
+    return nullptr;
+  }
+  chunk.data = Chain(chunk_view.substr(ChunkHeader::size()));
+  if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
+  const bool ok =
+      PythonUnlocked([&] { return self->record_writer->WriteChunk(chunk); });
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    SetExceptionFromRecordWriter(self);
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
 static PyObject* RecordWriterWriteRecords(PyRecordWriterObject* self,
                                           PyObject* args, PyObject* kwargs) {
   static constexpr const char* keywords[] = {"records", nullptr};
@@ -442,23 +551,47 @@ static PyObject* RecordWriterWriteRecords(PyRecordWriterObject* self,
   }
   // for record in records:
   //   self.write_record(record)
+  //
+  // Records are collected in batches, so that the GIL is released once per
+  // batch rather than once per record.
+  static constexpr size_t kMaxBatchRecords = 1024;
+  static constexpr size_t kMaxBatchBytes = size_t{1} << 20;
   const PythonPtr iter(PyObject_GetIter(records_arg));
   if (ABSL_PREDICT_FALSE(iter == nullptr)) return nullptr;
-  while (const PythonPtr record_object{PyIter_Next(iter.get())}) {
-    BytesLike record;
-    if (ABSL_PREDICT_FALSE(!record.FromPython(record_object.get()))) {
-      return nullptr;
+  std::deque<BytesLike> batch;
+  bool iter_done = false;
+  while (!iter_done) {
+    size_t batch_bytes = 0;
+    while (batch.size() < kMaxBatchRecords && batch_bytes < kMaxBatchBytes) {
+      const PythonPtr record_object(PyIter_Next(iter.get()));
+      if (record_object == nullptr) {
+        if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return nullptr;
+        iter_done = true;
+        break;
+      }
+      batch.emplace_back();
+      if (ABSL_PREDICT_FALSE(!batch.back().FromPython(record_object.get()))) {
+        return nullptr;
+      }
+      batch_bytes += absl::string_view(batch.back()).size();
     }
+    if (batch.empty()) break;
     if (ABSL_PREDICT_FALSE(!self->record_writer.Verify())) return nullptr;
     const bool ok = PythonUnlocked([&] {
-      return self->record_writer->WriteRecord(absl::string_view(record));
+      for (const BytesLike& record : batch) {
+        if (ABSL_PREDICT_FALSE(!self->record_writer->WriteRecord(
+                absl::string_view(record)))) {
+          return false;
+        }
+      }
+      return true;
     });
     if (ABSL_PREDICT_FALSE(!ok)) {
       SetExceptionFromRecordWriter(self);
       return nullptr;
     }
+    batch.clear();
   }
-  if (ABSL_PREDICT_FALSE(PyErr_Occurred() != nullptr)) return nullptr;
   Py_RETURN_NONE;
 }
 
@@ -600,6 +733,21 @@ Writes the next record.
 
 Args:
   record: Record to write as a proto message.
+)doc"},
+    {"write_chunk", reinterpret_cast<PyCFunction>(RecordWriterWriteChunk),
+     METH_VARARGS | METH_KEYWORDS, R"doc(
+write_chunk(self, chunk: Union[bytes, bytearray, memoryview]) -> None
+
+Writes an already encoded chunk of records, e.g. copied from another file,
+without decoding and encoding it again.
+
+The chunk is not validated beyond its header, and it is not checked against
+options of the RecordWriter.
+
+Args:
+  chunk: Chunk to write as a bytes-like object, consisting of a chunk header
+    followed by chunk data, as stored in a file if the chunk does not cross a
+    block boundary.
 )doc"},
     {"write_records", reinterpret_cast<PyCFunction>(RecordWriterWriteRecords),
      METH_VARARGS | METH_KEYWORDS, R"doc(
@@ -608,6 +756,9 @@ write_records(
 
 Writes a number of records.
 
+This is faster than calling write_record() for each record, because records are
+written in batches without holding the GIL.
+
 Args:
   records: Records to write as an iterable of bytes-like objects.
 )doc"},
@@ -740,7 +891,7 @@ PyTypeObject PyRecordWriter_Type = {
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC,  // tp_flags
     R"doc(
 RecordWriter(
-    dest: BinaryIO,
+    dest: Union[BinaryIO, str, bytes, os.PathLike],
     *,
     owns_dest: bool = True,
     assumed_pos: Optional[int] = None,
@@ -753,13 +904,16 @@ RecordWriter(
 Will write to the given file.
 
 Args:
-  dest: Binary IO stream to write to.
+  dest: Binary IO stream to write to, or a filename. A file given by name is
+    created or truncated, and written natively without holding the GIL, which
+    lets the parallelism option take effect without contention with Python
+    threads.
   owns_dest: If True, dest is owned, close() or __exit__() calls dest.close(),
     and flush(flush_type) calls dest.flush() even if flush_type is
-    FlushType.FROM_OBJECT.
+    FlushType.FROM_OBJECT. Not applicable to a filename.
   assumed_pos: If None, dest must support random access. If an int, it is enough
     that dest supports sequential access, and this position will be assumed
-    initially.
+    initially. Not applicable to a filename.
   buffer_size: Tunes how much data is buffered before writing to dest.
   options: Compression and other writing options. See below.
   metadata: If not None, file metadata to be written at the beginning (if
@@ -399,6 +399,161 @@ class RecordsTest(parameterized.TestCase):
             list(reader.read_records()),
             [sample_string(i, 10000) for i in range(23)])
 
+  @parameterized.parameters(0, 10)
+  def test_write_chunk(self, parallelism):
+    # The first chunk of records follows a block header and a file signature
+    # chunk.
+    chunk_begin = 64
+    contents = io.BytesIO()
+    with riegeli.RecordWriter(
+        contents, owns_dest=False, options='uncompressed') as writer:
+      writer.write_records(sample_string(1000 + i, 100) for i in range(10))
+    contents = contents.getvalue()
+    data_size = int.from_bytes(
+        contents[chunk_begin + 8:chunk_begin + 16], byteorder='little')
+    chunk = contents[chunk_begin:chunk_begin + 40 + data_size]
+    chunk_records = [sample_string(1000 + i, 100) for i in range(10)]
+    expected = []
+    filename = self.create_tempfile().full_path
+    with riegeli.RecordWriter(
+        filename,
+        options=(f'zstd,zstd_reference_chunks:100,chunk_size:1000,'
+                 f'parallelism:{parallelism}')) as writer:
+      for i in range(30):
+        writer.write_record(sample_string(i, 100))
+        expected.append(sample_string(i, 100))
+      # The chunk is written while an empty chunk is open.
+      writer.flush()
+      writer.write_chunk(chunk)
+      expected.extend(chunk_records)
+      for i in range(30):
+        writer.write_record(sample_string(100 + i, 100))
+        expected.append(sample_string(100 + i, 100))
+      # The chunk is written while a chunk with records is open.
+      writer.write_chunk(chunk)
+      expected.extend(chunk_records)
+      writer.write_chunk(chunk)
+      expected.extend(chunk_records)
+      for i in range(30):
+        writer.write_record(sample_string(200 + i, 100))
+        expected.append(sample_string(200 + i, 100))
+    with riegeli.RecordReader(io.FileIO(filename, mode='rb')) as reader:
+      self.assertEqual(list(reader.read_records()), expected)
+    with self.assertRaises(ValueError):
+      with riegeli.RecordWriter(io.BytesIO()) as writer:
+        writer.write_chunk(chunk[:-1])
+
+  @parameterized.parameters(0, 10)
+  def test_zstd_dictionary_training(self, parallelism):
+    filename = self.create_tempfile().full_path
+    positions = []
+    with riegeli.RecordWriter(
+        filename,
+        options='zstd,zstd_dictionary_training:10000,chunk_size:1000') as writer:
+      for i in range(1000):
+        writer.write_record(sample_string(i, 100))
+      writer.flush()
+      for i in range(1000):
+        positions.append(writer.pos)
+        writer.write_record(sample_string(1000 + i, 100))
+    # The dictionary is loaded from file metadata without read_metadata().
+    with riegeli.RecordReader(
+        io.FileIO(filename, mode='rb'), parallelism=parallelism) as reader:
+      self.assertEqual(
+          list(reader.read_records()),
+          [sample_string(i, 100) for i in range(2000)])
+    with riegeli.RecordReader(
+        io.FileIO(filename, mode='rb'), parallelism=parallelism) as reader:
+      reader.seek(positions[500])
+      self.assertEqual(reader.read_record(), sample_string(1500, 100))
+
+  @parameterized.parameters(0, 10)
+  def test_write_records_to_filename(self, parallelism):
+    filename = self.create_tempfile().full_path
+    with riegeli.RecordWriter(
+        filename, options=record_writer_options(parallelism)) as writer:
+      self.assertEqual(writer.dest, filename)
+      writer.write_records(sample_string(i, 10000) for i in range(23))
+    with riegeli.RecordReader(io.FileIO(filename, mode='rb')) as reader:
+      self.assertEqual(
+          list(reader.read_records()),
+          [sample_string(i, 10000) for i in range(23)])
+    with self.assertRaises(TypeError):
+      riegeli.RecordWriter(filename, owns_dest=True)
+
+  @parameterized.parameters((1, 0), (3, 0), (3, 10))
+  def test_sharded_reader(self, num_threads, shuffle_buffer):
+    filenames = []
+    for shard in range(5):
+      filename = self.create_tempfile().full_path
+      with riegeli.RecordWriter(filename) as writer:
+        writer.write_records(
+            sample_string(shard * 100 + i, 100) for i in range(shard * 7))
+      filenames.append(filename)
+    with riegeli.ShardedReader(
+        filenames,
+        num_threads=num_threads,
+        shuffle_buffer=shuffle_buffer,
+        seed=1,
+        batch_size=4) as reader:
+      batches = list(reader)
+    self.assertTrue(all(len(batch) == 4 for batch in batches[:-1]))
+    self.assertEqual(
+        sorted(record for batch in batches for record in batch),
+        sorted(
+            sample_string(shard * 100 + i, 100)
+            for shard in range(5)
+            for i in range(shard * 7)))
+
+  @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
+  def test_write_read_record_batches(self, file_spec, random_access,
+                                     parallelism):
+    with contextlib.closing(file_spec(self.create_tempfile,
+                                      random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          owns_dest=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(parallelism)) as writer:
+        writer.write_records(sample_string(i, 10000) for i in range(23))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          owns_src=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos) as reader:
+        self.assertEqual(reader.read_record_batch(0), [])
+        self.assertEqual(
+            reader.read_record_batch(10),
+            [sample_string(i, 10000) for i in range(10)])
+        self.assertEqual(
+            reader.read_record_batch(20),
+            [sample_string(i, 10000) for i in range(10, 23)])
+        self.assertEqual(reader.read_record_batch(10), [])
+
+  @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
+  def test_write_read_record_views(self, file_spec, random_access,
+                                   parallelism):
+    with contextlib.closing(file_spec(self.create_tempfile,
+                                      random_access)) as files:
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          owns_dest=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options=record_writer_options(parallelism)) as writer:
+        writer.write_records(sample_string(i, 10000) for i in range(23))
+      with riegeli.RecordReader(
+          files.reading_open(),
+          owns_src=files.reading_should_close,
+          assumed_pos=files.reading_assumed_pos) as reader:
+        record = reader.read_record_view()
+        self.assertIsInstance(record, memoryview)
+        self.assertTrue(record.readonly)
+        self.assertEqual(record.tobytes(), sample_string(0, 10000))
+        records = list(reader.read_record_views())
+        # Views stay valid after the reader moves on.
+        self.assertEqual([record.tobytes() for record in records],
+                         [sample_string(i, 10000) for i in range(1, 23)])
+        self.assertIsNone(reader.read_record_view())
+
   @_PARAMETERIZE_BY_FILE_SPEC_AND_RANDOM_ACCESS_AND_PARALLELISM
   def test_write_read_messages(self, file_spec, random_access, parallelism):
     with contextlib.closing(file_spec(self.create_tempfile,
@@ -502,6 +657,8 @@ class RecordsTest(parameterized.TestCase):
         assert record_type is not None
         self.assertEqual(record_type.DESCRIPTOR.full_name,
                          'riegeli.tests.SimpleMessage')
+        # The message class is cached for the same metadata.
+        self.assertIs(riegeli.get_record_type(metadata_read), record_type)
         message_read = reader.read_message(record_type)
         assert message_read is not None
         # Serialize and deserialize because messages have descriptors of
@@ -690,6 +847,35 @@ class RecordsTest(parameterized.TestCase):
         self.assertGreater(reader.pos, positions[10])
         self.assertLessEqual(reader.pos, positions[11])
 
+  @_PARAMETERIZE_BY_FILE_SPEC
+  def test_seek_and_close_while_reading_ahead(self, file_spec):
+    with contextlib.closing(
+        file_spec(
+            self.create_tempfile,
+            random_access=RandomAccess.RANDOM_ACCESS)) as files:
+      positions = []
+      with riegeli.RecordWriter(
+          files.writing_open(),
+          owns_dest=files.writing_should_close,
+          assumed_pos=files.writing_assumed_pos,
+          options='zstd,chunk_size:1000') as writer:
+        for i in range(1000):
+          writer.write_record(sample_string(i, 100))
+          positions.append(writer.last_pos)
+      for _ in range(10):
+        # Chunks read ahead are still being decoded in background when the
+        # RecordReader seeks, and when it is closed.
+        with riegeli.RecordReader(
+            files.reading_open(),
+            owns_src=files.reading_should_close,
+            assumed_pos=files.reading_assumed_pos,
+            parallelism=10) as reader:
+          self.assertEqual(reader.read_record(), sample_string(0, 100))
+          reader.seek(positions[500])
+          self.assertEqual(reader.read_record(), sample_string(500, 100))
+          reader.seek(positions[10])
+          self.assertEqual(reader.read_record(), sample_string(10, 100))
+
   @_PARAMETERIZE_BY_FILE_SPEC
   def test_seek_back(self, file_spec):
     with contextlib.closing(
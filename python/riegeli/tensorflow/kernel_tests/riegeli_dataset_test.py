@@ -238,6 +238,55 @@ class RiegeliDatasetTest(DatasetTestBase):
           [self._record(j, i) for i in range(self._num_records)])
     self.assertDatasetProduces(dataset, expected_output=expected_output * 10)
 
+  def test_read_batches_in_op(self):
+    records = []
+    for j in range(self._num_files):
+      records.extend([self._record(j, i) for i in range(self._num_records)])
+    dataset = riegeli_dataset_ops.RiegeliDataset(
+        self.test_filenames, batch_size=3)
+    # Batches span files, and the last batch is smaller.
+    expected_output = [records[i:i + 3] for i in range(0, len(records), 3)]
+    self.assertDatasetProduces(dataset, expected_output=expected_output)
+
+  def test_read_files_in_parallel(self):
+    dataset = riegeli_dataset_ops.RiegeliDataset(
+        self.test_filenames, cycle_length=self._num_files)
+    expected_output = []
+    for i in range(self._num_records):
+      expected_output.extend(
+          [self._record(j, i) for j in range(self._num_files)])
+    self.assertDatasetProduces(dataset, expected_output=expected_output)
+
+  def test_read_batches_of_files_in_parallel(self):
+    dataset = riegeli_dataset_ops.RiegeliDataset(
+        self.test_filenames, batch_size=4, cycle_length=self._num_files)
+    records = []
+    for i in range(0, self._num_records, 4):
+      for j in range(self._num_files):
+        records.extend([
+            self._record(j, k) for k in range(i, min(i + 4, self._num_records))
+        ])
+    expected_output = [records[i:i + 4] for i in range(0, len(records), 4)]
+    self.assertDatasetProduces(dataset, expected_output=expected_output)
+
+  def test_read_with_field_projection(self):
+    filename = os.path.join(self.get_temp_dir(), 'riegeli.projection')
+    with riegeli.RecordWriter(
+        tf.io.gfile.GFile(filename, 'wb'), options='transpose') as writer:
+      for i in range(self._num_records):
+        writer.write_message(
+            riegeli.RecordsMetadata(
+                file_comment=f'Comment {i}', record_type_name=f'Type {i}'))
+    dataset = riegeli_dataset_ops.RiegeliDataset(
+        filename, field_projection=[[2]])
+    self.assertDatasetProduces(
+        dataset,
+        expected_output=[
+            riegeli.RecordsMetadata(
+                record_type_name=f'Type {i}').SerializeToString()
+            for i in range(self._num_records)
+        ])
+
 
 if __name__ == '__main__':
   tf.test.main()
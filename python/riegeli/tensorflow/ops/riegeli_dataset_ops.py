@@ -31,23 +31,61 @@ _DEFAULT_BUFFER_SIZE = 64 << 10
 class RiegeliDataset(dataset_ops.DatasetSource):
   """A `Dataset` comprising records from one or more Riegeli/records files."""
 
-  __slots__ = ('_filenames', '_buffer_size')
+  __slots__ = ('_filenames', '_buffer_size', '_batch_size', '_cycle_length',
+               '_field_projection')
 
-  def __init__(self, filenames, buffer_size=None):
+  def __init__(self,
+               filenames,
+               buffer_size=None,
+               batch_size=None,
+               cycle_length=None,
+               field_projection=None):
     """Creates a `RiegeliDataset`.
 
     Args:
       filenames: A `tf.string` tensor containing one or more filenames.
       buffer_size: A `tf.int64` scalar which tunes how much data is buffered
         after reading from the file. Default: 64K.
+      batch_size: If not `None`, a Python integer: elements are `tf.string`
+        vectors of this many consecutive records, except that the last one can
+        be smaller. This is equivalent to `.batch(batch_size)` but avoids the
+        overhead of a dataset element per record. Default: `None` (elements
+        are `tf.string` scalars).
+      cycle_length: A Python integer: how many files are read concurrently.
+        Blocks of `batch_size` records (or single records if `batch_size` is
+        `None`) are taken from the files in turn, as in `interleave()`.
+        Default: 1 (files are read one after another).
+      field_projection: If not `None`, a sequence of fields to include in
+        records, where a field is a sequence of field numbers from the root
+        message to a nested field, and `riegeli.EXISTENCE_ONLY` at the end
+        includes only the existence of the field as an empty submessage. Other
+        fields are removed. This is efficient for files written with
+        `transpose`, where only the needed fields are decompressed.
+        Default: `None` (all fields are included).
     """
     self._filenames = tf.convert_to_tensor(filenames, name='filenames')
     self._buffer_size = convert.optional_param_to_tensor(
         'buffer_size', buffer_size, argument_default=_DEFAULT_BUFFER_SIZE)
+    if batch_size is not None and batch_size <= 0:
+      raise ValueError(f'batch_size must be positive, not {batch_size}')
+    if cycle_length is not None and cycle_length <= 0:
+      raise ValueError(f'cycle_length must be positive, not {cycle_length}')
+    self._batch_size = batch_size
+    self._cycle_length = 1 if cycle_length is None else cycle_length
+    self._field_projection = ([] if field_projection is None else [
+        '.'.join(str(field_number) for field_number in field)
+        for field in field_projection
+    ])
     variant_tensor = gen_riegeli_dataset_ops.riegeli_dataset(
-        self._filenames, self._buffer_size)
+        self._filenames,
+        self._buffer_size,
+        batch_size=0 if batch_size is None else batch_size,
+        cycle_length=self._cycle_length,
+        field_projection=self._field_projection)
     super(RiegeliDataset, self).__init__(variant_tensor)
 
   @property
   def element_spec(self):
-    return tf.TensorSpec([], tf.dtypes.string)
+    if self._batch_size is None:
+      return tf.TensorSpec([], tf.dtypes.string)
+    return tf.TensorSpec([None], tf.dtypes.string)
@@ -0,0 +1,123 @@
+# Copyright 2021 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""PyTorch dataset for Riegeli/records files."""
+
+import io
+
+import riegeli
+import torch
+
+__all__ = ('RiegeliIterableDataset',)
+
+_DEFAULT_BATCH_SIZE = 256
+
+
+def _worker_index_and_count():
+  """Returns the index of this reader among all readers, and their count.
+
+  Readers are `torch.utils.data` workers of all ranks of `torch.distributed`,
+  or a single reader outside of them.
+  """
+  worker_info = torch.utils.data.get_worker_info()
+  if worker_info is None:
+    worker_id, num_workers = 0, 1
+  else:
+    worker_id, num_workers = worker_info.id, worker_info.num_workers
+  if torch.distributed.is_available() and torch.distributed.is_initialized():
+    rank = torch.distributed.get_rank()
+    world_size = torch.distributed.get_world_size()
+  else:
+    rank, world_size = 0, 1
+  return rank * num_workers + worker_id, world_size * num_workers
+
+
+class RiegeliIterableDataset(torch.utils.data.IterableDataset):
+  """An `IterableDataset` comprising records from Riegeli/records files.
+
+  Files are divided into ranges of chunks by `riegeli.split_record_file()`,
+  and the ranges are distributed among readers: `torch.utils.data` workers of
+  all ranks of `torch.distributed`. Each reader reads only its ranges, so that
+  together readers read each record once, without coordination.
+
+  Records are read in batches by `RecordReader.read_record_batch()`, which
+  decodes a batch without taking the GIL for each record.
+  """
+
+  def __init__(self,
+               filenames,
+               *,
+               splits_per_reader=1,
+               batch_size=None,
+               field_projection=None,
+               buffer_size=64 << 10):
+    """Creates a `RiegeliIterableDataset`.
+
+    Args:
+      filenames: A sequence of names of files to read.
+      splits_per_reader: How many ranges of each file are planned per reader.
+        More ranges balance readers better when files have different sizes,
+        at the cost of opening files more often.
+      batch_size: If not `None`, elements are lists of this many consecutive
+        records of a range, except that the last list of a range can be
+        smaller. This avoids the overhead of yielding each record separately,
+        and works with `DataLoader(batch_size=None)`. Default: `None` (elements
+        are records).
+      field_projection: Like `field_projection` of `riegeli.RecordReader`.
+      buffer_size: Like `buffer_size` of `riegeli.RecordReader`.
+    """
+    super().__init__()
+    if splits_per_reader <= 0:
+      raise ValueError(
+          f'splits_per_reader must be positive, not {splits_per_reader}')
+    if batch_size is not None and batch_size <= 0:
+      raise ValueError(f'batch_size must be positive, not {batch_size}')
+    self._filenames = list(filenames)
+    self._splits_per_reader = splits_per_reader
+    self._batch_size = batch_size
+    self._field_projection = field_projection
+    self._buffer_size = buffer_size
+
+  def _plan(self, reader_index, num_readers):
+    """Yields (filename, begin, end) of ranges of this reader."""
+    range_index = 0
+    for filename in self._filenames:
+      for begin, end in riegeli.split_record_file(
+          filename, num_readers * self._splits_per_reader):
+        if range_index % num_readers == reader_index:
+          yield filename, begin, end
+        range_index += 1
+
+  def _read_batches(self, filename, begin, end):
+    """Yields batches of records of a range."""
+    batch_size = self._batch_size or _DEFAULT_BATCH_SIZE
+    with riegeli.RecordReader(
+        io.FileIO(filename, mode='rb'),
+        buffer_size=self._buffer_size,
+        field_projection=self._field_projection,
+        end_pos=end) as reader:
+      reader.seek_numeric(begin)
+      while True:
+        batch = reader.read_record_batch(batch_size)
+        if not batch:
+          return
+        yield batch
+
+  def __iter__(self):
+    reader_index, num_readers = _worker_index_and_count()
+    for filename, begin, end in self._plan(reader_index, num_readers):
+      for batch in self._read_batches(filename, begin, end):
+        if self._batch_size is None:
+          yield from batch
+        else:
+          yield batch
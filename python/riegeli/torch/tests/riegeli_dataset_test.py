@@ -0,0 +1,71 @@
+# Copyright 2021 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Tests for RiegeliIterableDataset."""
+
+from absl.testing import absltest
+from absl.testing import parameterized
+import riegeli
+from riegeli.torch import riegeli_dataset
+import torch
+
+
+def sample_string(i, size):
+  piece = f'{i} '.encode()
+  result = piece * -(-size // len(piece))  # len(result) >= size
+  return result[:size]
+
+
+class RiegeliIterableDatasetTest(parameterized.TestCase):
+
+  def write_files(self, num_files, num_records):
+    filenames = []
+    for file_index in range(num_files):
+      filename = self.create_tempfile().full_path
+      with riegeli.RecordWriter(
+          filename, options='uncompressed,chunk_size:10000') as writer:
+        writer.write_records(
+            sample_string(file_index * num_records + i, 1000)
+            for i in range(num_records))
+      filenames.append(filename)
+    return filenames
+
+  def test_read_all(self):
+    filenames = self.write_files(3, 100)
+    dataset = riegeli_dataset.RiegeliIterableDataset(
+        filenames, splits_per_reader=4)
+    self.assertEqual(
+        list(dataset), [sample_string(i, 1000) for i in range(3 * 100)])
+
+  def test_read_batches(self):
+    filenames = self.write_files(1, 100)
+    dataset = riegeli_dataset.RiegeliIterableDataset(filenames, batch_size=30)
+    batches = list(dataset)
+    self.assertEqual([len(batch) for batch in batches], [30, 30, 30, 10])
+    self.assertEqual([record for batch in batches for record in batch],
+                     [sample_string(i, 1000) for i in range(100)])
+
+  @parameterized.parameters((1, 1), (3, 1), (3, 5))
+  def test_read_with_workers(self, num_workers, splits_per_reader):
+    filenames = self.write_files(2, 100)
+    dataset = riegeli_dataset.RiegeliIterableDataset(
+        filenames, splits_per_reader=splits_per_reader, batch_size=7)
+    loader = torch.utils.data.DataLoader(
+        dataset, batch_size=None, num_workers=num_workers)
+    self.assertEqual(
+        sorted(record for batch in loader for record in batch),
+        sorted(sample_string(i, 1000) for i in range(2 * 100)))
+
+
+if __name__ == '__main__':
+  absltest.main()
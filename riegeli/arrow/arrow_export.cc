@@ -0,0 +1,780 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/arrow/arrow_export.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/config.h"
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/notification.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "google/protobuf/descriptor.h"
+#include "riegeli/arrow/arrow_c_data.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/field_value_decoder.h"
+#include "riegeli/endian/endian_reading.h"
+#include "riegeli/messages/message_wire_format.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/varint/varint_reading.h"
+
+namespace riegeli {
+
+namespace {
+
+using FieldType = google::protobuf::FieldDescriptor::Type;
+
+// Storage of an Arrow buffer, aligned to 8 bytes as recommended by Arrow.
+//
+// Invariant: bytes between `size()` and the end of the last word are zero.
+class ArrowBuffer {
+ public:
+  char* data() { return reinterpret_cast<char*>(words_.data()); }
+  const char* data() const {
+    return reinterpret_cast<const char*>(words_.data());
+  }
+  size_t size() const { return size_; }
+
+  // Bytes added by growing are zero.
+  void Resize(size_t size) {
+    if (size < size_) std::memset(data() + size, 0, size_ - size);
+    SetSize(size);
+  }
+
+  void Append(const void* src, size_t length) {
+    const size_t old_size = size_;
+    SetSize(size_ + length);
+    std::memcpy(data() + old_size, src, length);
+  }
+
+  template <typename T>
+  void AppendValue(T value) {
+    Append(&value, sizeof(T));
+  }
+
+  template <typename T>
+  T ValueAt(size_t index) const {
+    T value;
+    std::memcpy(&value, data() + index * sizeof(T), sizeof(T));
+    return value;
+  }
+
+  template <typename T>
+  void SetValueAt(size_t index, T value) {
+    std::memcpy(data() + index * sizeof(T), &value, sizeof(T));
+  }
+
+  void SetBit(size_t index) {
+    data()[index / 8] |= static_cast<char>(1 << (index % 8));
+  }
+
+ private:
+  void SetSize(size_t size) {
+    words_.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    size_ = size;
+  }
+
+  std::vector<uint64_t> words_;
+  size_t size_ = 0;
+};
+
+struct ArrayPrivateData {
+  std::vector<ArrowBuffer> buffers;
+  std::vector<const void*> buffer_pointers;
+  std::vector<ArrowArray> children;
+  std::vector<ArrowArray*> child_pointers;
+};
+
+void ReleaseArray(ArrowArray* array) {
+  ArrayPrivateData* const private_data =
+      static_cast<ArrayPrivateData*>(array->private_data);
+  // Children moved out by the consumer have their `release` set to `nullptr`.
+  for (ArrowArray& child : private_data->children) {
+    if (child.release != nullptr) child.release(&child);
+  }
+  delete private_data;
+  array->release = nullptr;
+}
+
+// Exports an array owning `buffers` and `children`. An empty buffer is exported
+// as `nullptr`, which is how an absent validity bitmap is represented.
+void ExportArray(int64_t length, int64_t null_count,
+                 std::vector<ArrowBuffer> buffers,
+                 std::vector<ArrowArray> children, ArrowArray& array) {
+  ArrayPrivateData* const private_data = new ArrayPrivateData();
+  private_data->buffers = std::move(buffers);
+  private_data->children = std::move(children);
+  private_data->buffer_pointers.reserve(private_data->buffers.size());
+  for (const ArrowBuffer& buffer : private_data->buffers) {
+    private_data->buffer_pointers.push_back(
+        buffer.size() == 0 ? nullptr : buffer.data());
+  }
+  private_data->child_pointers.reserve(private_data->children.size());
+  for (ArrowArray& child : private_data->children) {
+    private_data->child_pointers.push_back(&child);
+  }
+  array.length = length;
+  array.null_count = null_count;
+  array.offset = 0;
+  array.n_buffers = IntCast<int64_t>(private_data->buffer_pointers.size());
+  array.n_children = IntCast<int64_t>(private_data->child_pointers.size());
+  array.buffers = private_data->buffer_pointers.data();
+  array.children = private_data->child_pointers.data();
+  array.dictionary = nullptr;
+  array.release = ReleaseArray;
+  array.private_data = private_data;
+}
+
+struct SchemaPrivateData {
+  std::string format;
+  std::string name;
+  std::vector<ArrowSchema> children;
+  std::vector<ArrowSchema*> child_pointers;
+};
+
+void ReleaseSchema(ArrowSchema* schema) {
+  SchemaPrivateData* const private_data =
+      static_cast<SchemaPrivateData*>(schema->private_data);
+  for (ArrowSchema& child : private_data->children) {
+    if (child.release != nullptr) child.release(&child);
+  }
+  delete private_data;
+  schema->release = nullptr;
+}
+
+void ExportSchema(absl::string_view format, absl::string_view name,
+                  int64_t flags, std::vector<ArrowSchema> children,
+                  ArrowSchema& schema) {
+  SchemaPrivateData* const private_data = new SchemaPrivateData();
+  private_data->format = std::string(format);
+  private_data->name = std::string(name);
+  private_data->children = std::move(children);
+  private_data->child_pointers.reserve(private_data->children.size());
+  for (ArrowSchema& child : private_data->children) {
+    private_data->child_pointers.push_back(&child);
+  }
+  schema.format = private_data->format.c_str();
+  schema.name = private_data->name.c_str();
+  schema.metadata = nullptr;
+  schema.flags = flags;
+  schema.n_children = IntCast<int64_t>(private_data->child_pointers.size());
+  schema.children = private_data->child_pointers.data();
+  schema.dictionary = nullptr;
+  schema.release = ReleaseSchema;
+  schema.private_data = private_data;
+}
+
+// How values of a field type are represented in the wire format and in Arrow.
+enum class Encoding {
+  kVarint64,  // 64-bit varint, stored as is
+  kVarint32,  // 64-bit varint, truncated to 32 bits
+  kZigZag64,  // 64-bit zigzag-encoded varint
+  kZigZag32,  // 32-bit zigzag-encoded varint
+  kBool,      // varint, stored as a bit
+  kFixed64,   // 64-bit little endian, stored as is
+  kFixed32,   // 32-bit little endian, stored as is
+  kBinary,    // length-delimited or group, stored as variable length binary
+};
+
+struct TypeInfo {
+  // Arrow format string.
+  const char* format;
+  Encoding encoding;
+  // Wire type of a single value.
+  WireType wire_type;
+  // Whether multiple occurrences of a non-repeated field are merged instead of
+  // the last one winning.
+  bool merge;
+};
+
+TypeInfo GetTypeInfo(FieldType type) {
+  switch (type) {
+    case google::protobuf::FieldDescriptor::TYPE_DOUBLE:
+      return TypeInfo{"g", Encoding::kFixed64, WireType::kFixed64, false};
+    case google::protobuf::FieldDescriptor::TYPE_FLOAT:
+      return TypeInfo{"f", Encoding::kFixed32, WireType::kFixed32, false};
+    case google::protobuf::FieldDescriptor::TYPE_INT64:
+      return TypeInfo{"l", Encoding::kVarint64, WireType::kVarint, false};
+    case google::protobuf::FieldDescriptor::TYPE_UINT64:
+      return TypeInfo{"L", Encoding::kVarint64, WireType::kVarint, false};
+    case google::protobuf::FieldDescriptor::TYPE_INT32:
+    case google::protobuf::FieldDescriptor::TYPE_ENUM:
+      return TypeInfo{"i", Encoding::kVarint32, WireType::kVarint, false};
+    case google::protobuf::FieldDescriptor::TYPE_FIXED64:
+      return TypeInfo{"L", Encoding::kFixed64, WireType::kFixed64, false};
+    case google::protobuf::FieldDescriptor::TYPE_FIXED32:
+      return TypeInfo{"I", Encoding::kFixed32, WireType::kFixed32, false};
+    case google::protobuf::FieldDescriptor::TYPE_BOOL:
+      return TypeInfo{"b", Encoding::kBool, WireType::kVarint, false};
+    case google::protobuf::FieldDescriptor::TYPE_STRING:
+      return TypeInfo{"u", Encoding::kBinary, WireType::kLengthDelimited,
+                      false};
+    case google::protobuf::FieldDescriptor::TYPE_GROUP:
+      return TypeInfo{"z", Encoding::kBinary, WireType::kStartGroup, true};
+    case google::protobuf::FieldDescriptor::TYPE_MESSAGE:
+      return TypeInfo{"z", Encoding::kBinary, WireType::kLengthDelimited,
+                      true};
+    case google::protobuf::FieldDescriptor::TYPE_BYTES:
+      return TypeInfo{"z", Encoding::kBinary, WireType::kLengthDelimited,
+                      false};
+    case google::protobuf::FieldDescriptor::TYPE_UINT32:
+      return TypeInfo{"I", Encoding::kVarint32, WireType::kVarint, false};
+    case google::protobuf::FieldDescriptor::TYPE_SFIXED32:
+      return TypeInfo{"i", Encoding::kFixed32, WireType::kFixed32, false};
+    case google::protobuf::FieldDescriptor::TYPE_SFIXED64:
+      return TypeInfo{"l", Encoding::kFixed64, WireType::kFixed64, false};
+    case google::protobuf::FieldDescriptor::TYPE_SINT32:
+      return TypeInfo{"i", Encoding::kZigZag32, WireType::kVarint, false};
+    case google::protobuf::FieldDescriptor::TYPE_SINT64:
+      return TypeInfo{"l", Encoding::kZigZag64, WireType::kVarint, false};
+  }
+  RIEGELI_ASSERT_UNREACHABLE() << "Unknown field type: " << type;
+}
+
+constexpr size_t kMaxOffset = size_t{std::numeric_limits<int32_t>::max()};
+
+// Builds buffers of a non-nullable Arrow array of values of a field type.
+class ValuesBuilder {
+ public:
+  explicit ValuesBuilder(const TypeInfo& type_info) : type_info_(type_info) {
+    if (type_info_.encoding == Encoding::kBinary) {
+      values_.AppendValue(int32_t{0});
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  // Returns `true` if a value with `wire_type` is a value of the field, as
+  // opposed to an unknown field for a proto parser.
+  bool Accepts(WireType wire_type, bool repeated) const {
+    return wire_type == type_info_.wire_type ||
+           (repeated && wire_type == WireType::kLengthDelimited &&
+            type_info_.encoding != Encoding::kBinary);
+  }
+
+  // Appends the value, or values of a packed run.
+  //
+  // Precondition: `Accepts(value.wire_type, repeated)`
+  absl::Status Append(const FieldValue& value);
+
+  // Appends `bytes` to the last value.
+  //
+  // Precondition: `size() > 0` and type is binary
+  absl::Status AppendToLast(absl::string_view bytes);
+
+  // Appends a zero or empty value, as a placeholder for a null value.
+  void AppendNull();
+
+  // Removes values after the first `size` ones.
+  //
+  // Precondition: `size <= size()`
+  void Truncate(size_t size);
+
+  // Returns buffers of the array, preceded by `validity`.
+  std::vector<ArrowBuffer> Release(ArrowBuffer validity) &&;
+
+ private:
+  void AppendNumeric(uint64_t repr);
+  absl::Status AppendPacked(absl::string_view packed);
+
+  TypeInfo type_info_;
+  size_t size_ = 0;
+  // Values, or a bitmap for `Encoding::kBool`, or `int32_t` offsets to `data_`
+  // for `Encoding::kBinary`.
+  ArrowBuffer values_;
+  // Concatenated values for `Encoding::kBinary`.
+  ArrowBuffer data_;
+};
+
+absl::Status ValuesBuilder::Append(const FieldValue& value) {
+  if (type_info_.encoding == Encoding::kBinary) {
+    if (ABSL_PREDICT_FALSE(value.bytes.size() > kMaxOffset - data_.size())) {
+      return absl::ResourceExhaustedError(
+          "Arrow binary array size overflow");
+    }
+    data_.Append(value.bytes.data(), value.bytes.size());
+    values_.AppendValue(static_cast<int32_t>(data_.size()));
+    ++size_;
+    return absl::OkStatus();
+  }
+  if (value.wire_type == WireType::kLengthDelimited) {
+    return AppendPacked(value.bytes);
+  }
+  AppendNumeric(value.numeric);
+  return absl::OkStatus();
+}
+
+absl::Status ValuesBuilder::AppendToLast(absl::string_view bytes) {
+  RIEGELI_ASSERT_GT(size_, 0u)
+      << "Failed precondition of ValuesBuilder::AppendToLast(): no values";
+  RIEGELI_ASSERT(type_info_.encoding == Encoding::kBinary)
+      << "Failed precondition of ValuesBuilder::AppendToLast(): "
+         "type is not binary";
+  if (ABSL_PREDICT_FALSE(bytes.size() > kMaxOffset - data_.size())) {
+    return absl::ResourceExhaustedError("Arrow binary array size overflow");
+  }
+  data_.Append(bytes.data(), bytes.size());
+  values_.SetValueAt(size_, static_cast<int32_t>(data_.size()));
+  return absl::OkStatus();
+}
+
+void ValuesBuilder::AppendNull() {
+  switch (type_info_.encoding) {
+    case Encoding::kVarint64:
+    case Encoding::kZigZag64:
+    case Encoding::kFixed64:
+      values_.AppendValue(uint64_t{0});
+      break;
+    case Encoding::kVarint32:
+    case Encoding::kZigZag32:
+    case Encoding::kFixed32:
+      values_.AppendValue(uint32_t{0});
+      break;
+    case Encoding::kBool:
+      values_.Resize((size_ + 8) / 8);
+      break;
+    case Encoding::kBinary:
+      values_.AppendValue(static_cast<int32_t>(data_.size()));
+      break;
+  }
+  ++size_;
+}
+
+void ValuesBuilder::Truncate(size_t size) {
+  RIEGELI_ASSERT_LE(size, size_)
+      << "Failed precondition of ValuesBuilder::Truncate(): "
+         "size larger than the number of values";
+  switch (type_info_.encoding) {
+    case Encoding::kVarint64:
+    case Encoding::kZigZag64:
+    case Encoding::kFixed64:
+      values_.Resize(size * sizeof(uint64_t));
+      break;
+    case Encoding::kVarint32:
+    case Encoding::kZigZag32:
+    case Encoding::kFixed32:
+      values_.Resize(size * sizeof(uint32_t));
+      break;
+    case Encoding::kBool:
+      values_.Resize((size + 7) / 8);
+      if (size % 8 != 0) {
+        values_.data()[size / 8] &= static_cast<char>((1 << (size % 8)) - 1);
+      }
+      break;
+    case Encoding::kBinary:
+      data_.Resize(IntCast<size_t>(values_.ValueAt<int32_t>(size)));
+      values_.Resize((size + 1) * sizeof(int32_t));
+      break;
+  }
+  size_ = size;
+}
+
+std::vector<ArrowBuffer> ValuesBuilder::Release(ArrowBuffer validity) && {
+  std::vector<ArrowBuffer> buffers;
+  buffers.reserve(3);
+  buffers.push_back(std::move(validity));
+  buffers.push_back(std::move(values_));
+  if (type_info_.encoding == Encoding::kBinary) {
+    buffers.push_back(std::move(data_));
+  }
+  return buffers;
+}
+
+void ValuesBuilder::AppendNumeric(uint64_t repr) {
+  switch (type_info_.encoding) {
+    case Encoding::kVarint64:
+    case Encoding::kFixed64:
+      values_.AppendValue(repr);
+      break;
+    case Encoding::kZigZag64:
+      values_.AppendValue(DecodeSint64(repr));
+      break;
+    case Encoding::kVarint32:
+    case Encoding::kFixed32:
+      values_.AppendValue(static_cast<uint32_t>(repr));
+      break;
+    case Encoding::kZigZag32:
+      values_.AppendValue(DecodeSint32(static_cast<uint32_t>(repr)));
+      break;
+    case Encoding::kBool:
+      values_.Resize((size_ + 8) / 8);
+      if (repr != 0) values_.SetBit(size_);
+      break;
+    case Encoding::kBinary:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed precondition of ValuesBuilder::AppendNumeric(): "
+             "type is binary";
+  }
+  ++size_;
+}
+
+absl::Status ValuesBuilder::AppendPacked(absl::string_view packed) {
+  const char* cursor = packed.data();
+  const char* const limit = packed.data() + packed.size();
+  switch (type_info_.wire_type) {
+    case WireType::kVarint:
+      while (cursor < limit) {
+        const absl::optional<ReadFromStringResult<uint64_t>> value =
+            ReadVarint64(cursor, limit);
+        if (ABSL_PREDICT_FALSE(value == absl::nullopt)) {
+          return absl::DataLossError("Invalid packed varint field");
+        }
+        cursor = value->cursor;
+        AppendNumeric(value->value);
+      }
+      return absl::OkStatus();
+    case WireType::kFixed32:
+      if (ABSL_PREDICT_FALSE(packed.size() % sizeof(uint32_t) != 0)) {
+        return absl::DataLossError("Invalid packed fixed32 field");
+      }
+#ifdef ABSL_IS_LITTLE_ENDIAN
+      if (type_info_.encoding == Encoding::kFixed32) {
+        // Values are stored in host order, which is the wire order here, so
+        // the whole run is copied at once.
+        values_.Append(packed.data(), packed.size());
+        size_ += packed.size() / sizeof(uint32_t);
+        return absl::OkStatus();
+      }
+#endif
+      for (; cursor < limit; cursor += sizeof(uint32_t)) {
+        AppendNumeric(ReadLittleEndian32(cursor));
+      }
+      return absl::OkStatus();
+    case WireType::kFixed64:
+      if (ABSL_PREDICT_FALSE(packed.size() % sizeof(uint64_t) != 0)) {
+        return absl::DataLossError("Invalid packed fixed64 field");
+      }
+#ifdef ABSL_IS_LITTLE_ENDIAN
+      if (type_info_.encoding == Encoding::kFixed64) {
+        // Values are stored in host order, which is the wire order here, so
+        // the whole run is copied at once.
+        values_.Append(packed.data(), packed.size());
+        size_ += packed.size() / sizeof(uint64_t);
+        return absl::OkStatus();
+      }
+#endif
+      for (; cursor < limit; cursor += sizeof(uint64_t)) {
+        AppendNumeric(ReadLittleEndian64(cursor));
+      }
+      return absl::OkStatus();
+    default:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed precondition of ValuesBuilder::AppendPacked(): "
+             "type is not packable";
+  }
+}
+
+// Converts `values` of a column across `num_records` records.
+//
+// On success, `array` and `schema` are exported. On failure, they are left
+// unchanged.
+absl::Status ConvertColumn(absl::string_view name, FieldType type,
+                           bool repeated, absl::Span<const FieldValue> values,
+                           uint64_t num_records, ArrowArray& array,
+                           ArrowSchema& schema) {
+  const TypeInfo type_info = GetTypeInfo(type);
+  ValuesBuilder builder(type_info);
+  const FieldValue* value = values.data();
+  const FieldValue* const values_end = values.data() + values.size();
+  if (!repeated) {
+    ArrowBuffer validity;
+    validity.Resize(IntCast<size_t>((num_records + 7) / 8));
+    int64_t null_count = 0;
+    for (uint64_t record_index = 0; record_index < num_records;
+         ++record_index) {
+      for (; value != values_end && value->record_index == record_index;
+           ++value) {
+        if (!builder.Accepts(value->wire_type, false)) continue;
+        absl::Status status;
+        if (builder.size() > record_index) {
+          if (type_info.merge) {
+            status = builder.AppendToLast(value->bytes);
+          } else {
+            // The last value wins.
+            builder.Truncate(IntCast<size_t>(record_index));
+            status = builder.Append(*value);
+          }
+        } else {
+          status = builder.Append(*value);
+        }
+        if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+      }
+      if (builder.size() == record_index) {
+        builder.AppendNull();
+        ++null_count;
+      } else {
+        validity.SetBit(IntCast<size_t>(record_index));
+      }
+    }
+    RIEGELI_ASSERT(value == values_end)
+        << "Values not sorted by record index or out of range";
+    ExportArray(IntCast<int64_t>(num_records), null_count,
+                std::move(builder).Release(
+                    null_count == 0 ? ArrowBuffer() : std::move(validity)),
+                {}, array);
+    ExportSchema(type_info.format, name, ARROW_FLAG_NULLABLE, {}, schema);
+    return absl::OkStatus();
+  }
+  ArrowBuffer offsets;
+  for (uint64_t record_index = 0; record_index < num_records; ++record_index) {
+    offsets.AppendValue(static_cast<int32_t>(builder.size()));
+    for (; value != values_end && value->record_index == record_index;
+         ++value) {
+      if (!builder.Accepts(value->wire_type, true)) continue;
+      const absl::Status status = builder.Append(*value);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+      if (ABSL_PREDICT_FALSE(builder.size() > kMaxOffset)) {
+        return absl::ResourceExhaustedError("Arrow list array size overflow");
+      }
+    }
+  }
+  RIEGELI_ASSERT(value == values_end)
+      << "Values not sorted by record index or out of range";
+  offsets.AppendValue(static_cast<int32_t>(builder.size()));
+  std::vector<ArrowArray> item_array(1);
+  ExportArray(IntCast<int64_t>(builder.size()), 0,
+              std::move(builder).Release(ArrowBuffer()), {}, item_array[0]);
+  std::vector<ArrowSchema> item_schema(1);
+  ExportSchema(type_info.format, "item", 0, {}, item_schema[0]);
+  std::vector<ArrowBuffer> buffers(2);
+  buffers[1] = std::move(offsets);
+  ExportArray(IntCast<int64_t>(num_records), 0, std::move(buffers),
+              std::move(item_array), array);
+  ExportSchema("+l", name, 0, std::move(item_schema), schema);
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+ChunkToArrowConverter::ChunkToArrowConverter(
+    const google::protobuf::Descriptor& descriptor,
+    absl::Span<const std::string> columns,
+    ChunkDecoder::Options chunk_decoder_options)
+    : ChunkToArrowConverter(ResolveColumns(descriptor, columns),
+                            std::move(chunk_decoder_options)) {}
+
+ChunkToArrowConverter::ChunkToArrowConverter(
+    ResolvedColumns resolved_columns,
+    ChunkDecoder::Options chunk_decoder_options)
+    : Object(kInitiallyOpen),
+      columns_(std::move(resolved_columns.columns)),
+      field_value_decoder_(ColumnFields(columns_),
+                           std::move(chunk_decoder_options)) {
+  if (ABSL_PREDICT_FALSE(!resolved_columns.status.ok())) {
+    Fail(std::move(resolved_columns.status));
+  }
+}
+
+ChunkToArrowConverter::ResolvedColumns ChunkToArrowConverter::ResolveColumns(
+    const google::protobuf::Descriptor& descriptor,
+    absl::Span<const std::string> columns) {
+  ResolvedColumns resolved_columns;
+  resolved_columns.columns.reserve(columns.size());
+  for (const std::string& name : columns) {
+    Column column;
+    column.name = name;
+    column.repeated = false;
+    const google::protobuf::Descriptor* message_type = &descriptor;
+    const google::protobuf::FieldDescriptor* field = nullptr;
+    for (const absl::string_view field_name : absl::StrSplit(name, '.')) {
+      if (ABSL_PREDICT_FALSE(message_type == nullptr)) {
+        resolved_columns.columns.clear();
+        resolved_columns.status = absl::InvalidArgumentError(
+            absl::StrCat("Field ", field->full_name(), " in column ", name,
+                         " is not a message"));
+        return resolved_columns;
+      }
+      field = message_type->FindFieldByName(std::string(field_name));
+      if (ABSL_PREDICT_FALSE(field == nullptr)) {
+        resolved_columns.columns.clear();
+        resolved_columns.status = absl::InvalidArgumentError(
+            absl::StrCat("Unknown field ", field_name, " of ",
+                         message_type->full_name(), " in column ", name));
+        return resolved_columns;
+      }
+      column.field.AddFieldNumber(field->number());
+      column.repeated = column.repeated || field->is_repeated();
+      message_type = field->message_type();
+    }
+    column.type = field->type();
+    resolved_columns.columns.push_back(std::move(column));
+  }
+  return resolved_columns;
+}
+
+std::vector<Field> ChunkToArrowConverter::ColumnFields(
+    const std::vector<Column>& columns) {
+  std::vector<Field> fields;
+  fields.reserve(columns.size());
+  for (const Column& column : columns) fields.push_back(column.field);
+  return fields;
+}
+
+bool ChunkToArrowConverter::Convert(const Chunk& chunk, ArrowArray& array,
+                                    ArrowSchema& schema) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!field_value_decoder_.Decode(chunk))) {
+    return Fail(field_value_decoder_);
+  }
+  const uint64_t num_records = field_value_decoder_.num_records();
+  std::vector<ArrowArray> column_arrays(columns_.size());
+  std::vector<ArrowSchema> column_schemas(columns_.size());
+  for (size_t column_index = 0; column_index < columns_.size();
+       ++column_index) {
+    const Column& column = columns_[column_index];
+    const absl::Status status = ConvertColumn(
+        column.name, column.type, column.repeated,
+        field_value_decoder_.values(column_index), num_records,
+        column_arrays[column_index], column_schemas[column_index]);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      for (size_t i = 0; i < column_index; ++i) {
+        column_arrays[i].release(&column_arrays[i]);
+        column_schemas[i].release(&column_schemas[i]);
+      }
+      return Fail(Annotate(status, absl::StrCat("in column ", column.name)));
+    }
+  }
+  std::vector<ArrowBuffer> buffers(1);
+  ExportArray(IntCast<int64_t>(num_records), 0, std::move(buffers),
+              std::move(column_arrays), array);
+  ExportSchema("+s", "", 0, std::move(column_schemas), schema);
+  return true;
+}
+
+namespace {
+
+// A chunk being converted in the background.
+struct PendingBatch {
+  Chunk chunk;
+  ArrowArray array{};
+  ArrowSchema schema{};
+  // If not OK, conversion failed, and `array` and `schema` are not exported.
+  absl::Status status;
+  // Notified when conversion has finished.
+  absl::Notification done;
+};
+
+void ReleaseBatch(PendingBatch& batch) {
+  if (batch.array.release != nullptr) batch.array.release(&batch.array);
+  if (batch.schema.release != nullptr) batch.schema.release(&batch.schema);
+}
+
+}  // namespace
+
+absl::Status ExportArrowRecordBatches(
+    absl::string_view filename, const google::protobuf::Descriptor& descriptor,
+    absl::Span<const std::string> columns,
+    const std::function<absl::Status(ArrowArray& array, ArrowSchema& schema)>&
+        consumer,
+    const ArrowExportOptions& options) {
+  const size_t parallelism = IntCast<size_t>(options.parallelism());
+  // Converters and batches being converted in the background, indexed by chunk
+  // index modulo `parallelism`.
+  std::vector<std::unique_ptr<ChunkToArrowConverter>> converters;
+  converters.reserve(parallelism);
+  for (size_t i = 0; i < parallelism; ++i) {
+    converters.push_back(
+        std::make_unique<ChunkToArrowConverter>(descriptor, columns));
+    if (ABSL_PREDICT_FALSE(!converters.back()->healthy())) {
+      return converters.back()->status();
+    }
+  }
+  std::vector<std::unique_ptr<PendingBatch>> in_flight(parallelism);
+  DefaultChunkReader<FdReader<>> chunk_reader(
+      std::forward_as_tuple(filename, O_RDONLY));
+  size_t next_to_schedule = 0;
+  bool more_chunks = true;
+  const auto schedule = [&] {
+    Chunk chunk;
+    for (;;) {
+      if (ABSL_PREDICT_FALSE(!chunk_reader.ReadChunk(chunk))) {
+        more_chunks = false;
+        return;
+      }
+      if ((chunk.header.chunk_type() == ChunkType::kSimple ||
+           chunk.header.chunk_type() == ChunkType::kTransposed ||
+           chunk.header.chunk_type() == ChunkType::kDeduplicated) &&
+          chunk.header.num_records() > 0) {
+        break;
+      }
+    }
+    const size_t slot = next_to_schedule % parallelism;
+    std::unique_ptr<PendingBatch>& batch = in_flight[slot];
+    batch = std::make_unique<PendingBatch>();
+    batch->chunk = std::move(chunk);
+    ThreadPool::global().Schedule(
+        [converter = converters[slot].get(), batch = batch.get()] {
+          if (ABSL_PREDICT_FALSE(!converter->Convert(
+                  batch->chunk, batch->array, batch->schema))) {
+            batch->status = converter->status();
+          }
+          batch->done.Notify();
+        });
+    ++next_to_schedule;
+  };
+  while (more_chunks && next_to_schedule < parallelism) schedule();
+
+  absl::Status status;
+  for (size_t next_to_consume = 0; next_to_consume < next_to_schedule;
+       ++next_to_consume) {
+    std::unique_ptr<PendingBatch> batch =
+        std::move(in_flight[next_to_consume % parallelism]);
+    batch->done.WaitForNotification();
+    // The slot of the batch just taken is free now.
+    if (more_chunks) schedule();
+    if (ABSL_PREDICT_FALSE(!batch->status.ok())) {
+      status = std::move(batch->status);
+      break;
+    }
+    status = consumer(batch->array, batch->schema);
+    ReleaseBatch(*batch);
+    if (ABSL_PREDICT_FALSE(!status.ok())) break;
+  }
+  // Wait for batches still in flight after a failure, because they refer to
+  // `converters`.
+  for (std::unique_ptr<PendingBatch>& batch : in_flight) {
+    if (batch != nullptr) {
+      batch->done.WaitForNotification();
+      ReleaseBatch(*batch);
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Close())) return chunk_reader.status();
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,170 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_ARROW_ARROW_EXPORT_H_
+#define RIEGELI_ARROW_ARROW_EXPORT_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "google/protobuf/descriptor.h"
+#include "riegeli/arrow/arrow_c_data.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/field_value_decoder.h"
+
+namespace riegeli {
+
+// Converts chunks of records of a proto message type to Apache Arrow record
+// batches, exported through the Arrow C Data Interface, without parsing records
+// into messages.
+//
+// A record batch is a struct array with a child array per column, and an
+// element per record. A column is specified by a path of field names from the
+// message type, separated by '.', e.g. "a.b.c", where all fields but the last
+// one are submessages or groups.
+//
+// If no field of the path is repeated, the column is a nullable array of the
+// field type, where a record without the field yields null. If the field occurs
+// multiple times, the last value wins, except that occurrences of a submessage
+// are merged.
+//
+// If some field of the path is repeated, the column is a non-nullable list
+// array of non-nullable values of the field type, in the order of the
+// serialized record. Packed repeated fields are unpacked.
+//
+// Arrow types of fields:
+//  * `double`                          - float64
+//  * `float`                           - float32
+//  * `int64`, `sint64`, `sfixed64`     - int64
+//  * `uint64`, `fixed64`               - uint64
+//  * `int32`, `sint32`, `sfixed32`     - int32
+//  * enum                              - int32
+//  * `uint32`, `fixed32`               - uint32
+//  * `bool`                            - boolean
+//  * `string`                          - utf8
+//  * `bytes`, submessage, group        - binary (serialized message)
+//
+// Values with a wire type not matching the field type are ignored, as a proto
+// parser would treat them as unknown fields.
+class ChunkToArrowConverter : public Object {
+ public:
+  // Creates a `ChunkToArrowConverter` for `columns` of records of the message
+  // type `descriptor`.
+  //
+  // `ChunkDecoder::Options::field_projection()` in `chunk_decoder_options` is
+  // ignored: chunks are decoded with a projection to `columns`.
+  //
+  // Fails with `absl::InvalidArgumentError` if a column does not name a field.
+  explicit ChunkToArrowConverter(
+      const google::protobuf::Descriptor& descriptor,
+      absl::Span<const std::string> columns,
+      ChunkDecoder::Options chunk_decoder_options = ChunkDecoder::Options());
+
+  ChunkToArrowConverter(const ChunkToArrowConverter&) = delete;
+  ChunkToArrowConverter& operator=(const ChunkToArrowConverter&) = delete;
+
+  // Decodes `chunk` and converts its records to a record batch.
+  //
+  // On success, `array` and `schema` are owned by the caller, who must release
+  // them by their `release` callbacks.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool Convert(const Chunk& chunk, ArrowArray& array, ArrowSchema& schema);
+
+ private:
+  struct Column {
+    std::string name;
+    Field field;
+    google::protobuf::FieldDescriptor::Type type;
+    bool repeated;
+  };
+
+  struct ResolvedColumns {
+    std::vector<Column> columns;
+    absl::Status status;
+  };
+
+  explicit ChunkToArrowConverter(ResolvedColumns resolved_columns,
+                                 ChunkDecoder::Options chunk_decoder_options);
+
+  static ResolvedColumns ResolveColumns(
+      const google::protobuf::Descriptor& descriptor,
+      absl::Span<const std::string> columns);
+  static std::vector<Field> ColumnFields(const std::vector<Column>& columns);
+
+  std::vector<Column> columns_;
+  FieldValueDecoder field_value_decoder_;
+};
+
+class ArrowExportOptions {
+ public:
+  ArrowExportOptions() noexcept {}
+
+  // Maximum number of chunks converted in parallel.
+  //
+  // Default: 1.
+  ArrowExportOptions& set_parallelism(int parallelism) & {
+    RIEGELI_ASSERT_GT(parallelism, 0)
+        << "Failed precondition of ArrowExportOptions::set_parallelism(): "
+           "non-positive parallelism";
+    parallelism_ = parallelism;
+    return *this;
+  }
+  ArrowExportOptions&& set_parallelism(int parallelism) && {
+    return std::move(set_parallelism(parallelism));
+  }
+  int parallelism() const { return parallelism_; }
+
+ private:
+  int parallelism_ = 1;
+};
+
+// Reads the Riegeli/records file `filename` with records of the message type
+// `descriptor`, and calls `consumer` with a record batch of `columns` per chunk
+// containing records, in order. See `ChunkToArrowConverter` for the mapping of
+// fields to Arrow columns.
+//
+// Chunks are decoded and converted in parallel. Transposed chunks are decoded
+// with a projection to `columns`, so that only buckets containing them are
+// decompressed.
+//
+// `consumer` may take ownership of `array` and `schema` by moving them, i.e.
+// copying the structures and setting `release` of the originals to `nullptr`.
+// Otherwise they are released after `consumer` returns. If `consumer` returns a
+// failed status, exporting stops and the status is returned.
+//
+// Returns status:
+//  * `status.ok()`  - success (all chunks have been converted and consumed)
+//  * `!status.ok()` - failure
+absl::Status ExportArrowRecordBatches(
+    absl::string_view filename, const google::protobuf::Descriptor& descriptor,
+    absl::Span<const std::string> columns,
+    const std::function<absl::Status(ArrowArray& array, ArrowSchema& schema)>&
+        consumer,
+    const ArrowExportOptions& options = ArrowExportOptions());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_ARROW_ARROW_EXPORT_H_
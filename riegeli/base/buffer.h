@@ -50,7 +50,8 @@ class Buffer {
   size_t capacity() const { return capacity_; }
 
   // Returns the data pointer, releasing its ownership; the `Buffer` is left
-  // deallocated. The returned pointer must be deleted using `DeleteReleased()`.
+  // deallocated. The returned pointer must be deleted using `DeleteReleased()`,
+  // passing `capacity()` from before `Release()`.
   //
   // If the returned pointer is `nullptr`, it allowed but not required to call
   // `DeleteReleased()`.
@@ -59,13 +60,15 @@ class Buffer {
   // Deletes the pointer obtained by `Release()`.
   //
   // Does nothing if `ptr == nullptr`.
-  static void DeleteReleased(void* ptr);
+  static void DeleteReleased(void* ptr, size_t capacity);
 
   // Converts `*this` to `absl::Cord`. `substr` must be contained in `*this`.
   // `*this` is left unchanged or deallocated.
   absl::Cord ToCord(absl::string_view substr);
 
  private:
+  static constexpr size_t kAlignment = alignof(max_align_t);
+
   void AllocateInternal(size_t min_capacity);
   void DeleteInternal();
 
@@ -101,16 +104,12 @@ inline void Buffer::Reset(size_t min_capacity) {
 
 inline void Buffer::AllocateInternal(size_t min_capacity) {
   const size_t capacity = EstimatedAllocatedSize(min_capacity);
-  data_ = static_cast<char*>(operator new(capacity));
+  data_ = static_cast<char*>(internal::Allocate<kAlignment>(capacity));
   capacity_ = capacity;
 }
 
 inline void Buffer::DeleteInternal() {
-#if __cpp_sized_deallocation || __GXX_DELETE_WITH_SIZE__
-  if (data_ != nullptr) operator delete(data_, capacity_);
-#else
-  if (data_ != nullptr) operator delete(data_);
-#endif
+  if (data_ != nullptr) internal::Deallocate<kAlignment>(data_, capacity_);
 }
 
 inline char* Buffer::Release() {
@@ -118,7 +117,9 @@ inline char* Buffer::Release() {
   return std::exchange(data_, nullptr);
 }
 
-inline void Buffer::DeleteReleased(void* ptr) { operator delete(ptr); }
+inline void Buffer::DeleteReleased(void* ptr, size_t capacity) {
+  if (ptr != nullptr) internal::Deallocate<kAlignment>(ptr, capacity);
+}
 
 }  // namespace riegeli
 
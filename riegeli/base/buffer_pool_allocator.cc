@@ -0,0 +1,192 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/buffer_pool_allocator.h"
+
+#include <stddef.h>
+
+#include <new>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/numeric/bits.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition at
+// namespace scope is required. Since C++17 these definitions are deprecated:
+// http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr size_t BufferPoolAllocator::kMinPooledSize;
+constexpr size_t BufferPoolAllocator::kMaxPooledSize;
+constexpr size_t BufferPoolAllocator::kDefaultMaxCachedBytesPerThread;
+#endif
+
+namespace {
+
+constexpr int kMinPooledShift = 12;
+constexpr int kMaxPooledShift = 20;
+static_assert(BufferPoolAllocator::kMinPooledSize == size_t{1}
+                                                         << kMinPooledShift,
+              "kMinPooledShift does not match kMinPooledSize");
+static_assert(BufferPoolAllocator::kMaxPooledSize == size_t{1}
+                                                         << kMaxPooledShift,
+              "kMaxPooledShift does not match kMaxPooledSize");
+
+// Size classes are `1 << shift` and `3 << (shift - 1)`, ending with
+// `kMaxPooledSize`.
+constexpr size_t kNumSizeClasses = 2 * (kMaxPooledShift - kMinPooledShift) + 1;
+
+// Returns the index of the smallest size class which fits `size`.
+//
+// Precondition: `size >= kMinPooledSize && size <= kMaxPooledSize`
+inline size_t SizeClassIndex(size_t size) {
+  const int shift = IntCast<int>(absl::bit_width(size - 1));
+  if (shift <= kMinPooledShift) return 0;
+  const size_t index = 2 * IntCast<size_t>(shift - kMinPooledShift);
+  return (size_t{3} << (shift - 2)) >= size ? index - 1 : index;
+}
+
+// Returns the size of blocks of the given size class.
+inline size_t SizeClassSize(size_t index) {
+  const int shift = kMinPooledShift + IntCast<int>((index + 1) / 2);
+  return index % 2 == 0 ? size_t{1} << shift : size_t{3} << (shift - 2);
+}
+
+// Free blocks of one thread.
+class ThreadCache {
+ public:
+  ThreadCache() = default;
+
+  ThreadCache(const ThreadCache&) = delete;
+  ThreadCache& operator=(const ThreadCache&) = delete;
+
+  ~ThreadCache();
+
+  // Returns a free block of the given size class, or `nullptr` if there is
+  // none.
+  void* Get(size_t index);
+
+  // Keeps a free block of the given size class if it fits within
+  // `max_cached_bytes`. Returns `false` if the block should be freed instead.
+  bool Put(size_t index, void* ptr, size_t max_cached_bytes);
+
+ private:
+  std::vector<void*> free_lists_[kNumSizeClasses];
+  size_t cached_bytes_ = 0;
+};
+
+// Set when the `ThreadCache` of the current thread is destroyed, so that blocks
+// freed afterwards by destructors of other thread-local objects bypass it.
+// This is trivially destructible, so it remains valid until the thread exits.
+thread_local bool thread_cache_destroyed = false;
+
+ThreadCache::~ThreadCache() {
+  thread_cache_destroyed = true;
+  for (size_t index = 0; index < kNumSizeClasses; ++index) {
+    for (void* const ptr : free_lists_[index]) {
+      operator delete(ptr);
+    }
+  }
+}
+
+inline void* ThreadCache::Get(size_t index) {
+  std::vector<void*>& free_list = free_lists_[index];
+  if (free_list.empty()) return nullptr;
+  void* const ptr = free_list.back();
+  free_list.pop_back();
+  cached_bytes_ -= SizeClassSize(index);
+  return ptr;
+}
+
+inline bool ThreadCache::Put(size_t index, void* ptr,
+                             size_t max_cached_bytes) {
+  const size_t size = SizeClassSize(index);
+  if (cached_bytes_ + size > max_cached_bytes) return false;
+  free_lists_[index].push_back(ptr);
+  cached_bytes_ += size;
+  return true;
+}
+
+inline ThreadCache* GetThreadCache() {
+  if (ABSL_PREDICT_FALSE(thread_cache_destroyed)) return nullptr;
+  thread_local ThreadCache thread_cache;
+  return &thread_cache;
+}
+
+inline bool IsPooled(size_t size, size_t alignment) {
+  return size >= BufferPoolAllocator::kMinPooledSize &&
+         size <= BufferPoolAllocator::kMaxPooledSize &&
+         alignment <= alignof(max_align_t);
+}
+
+inline void* AllocateUnpooled(size_t size, size_t alignment) {
+#if __cpp_aligned_new
+  if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return operator new(size, std::align_val_t(alignment));
+  }
+#else
+  RIEGELI_CHECK_LE(alignment, alignof(max_align_t))
+      << "BufferPoolAllocator does not support over-aligned blocks "
+         "before C++17";
+#endif
+  return operator new(size);
+}
+
+inline void DeallocateUnpooled(void* ptr, size_t alignment) {
+#if __cpp_aligned_new
+  if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    operator delete(ptr, std::align_val_t(alignment));
+    return;
+  }
+#endif
+  operator delete(ptr);
+}
+
+}  // namespace
+
+BufferPoolAllocator& BufferPoolAllocator::global() {
+  static NoDestructor<BufferPoolAllocator> kGlobalBufferPoolAllocator;
+  return *kGlobalBufferPoolAllocator;
+}
+
+void* BufferPoolAllocator::Allocate(size_t size, size_t alignment) {
+  if (!IsPooled(size, alignment)) return AllocateUnpooled(size, alignment);
+  const size_t index = SizeClassIndex(size);
+  ThreadCache* const thread_cache = GetThreadCache();
+  if (ABSL_PREDICT_TRUE(thread_cache != nullptr)) {
+    void* const ptr = thread_cache->Get(index);
+    if (ptr != nullptr) return ptr;
+  }
+  return operator new(SizeClassSize(index));
+}
+
+void BufferPoolAllocator::Deallocate(void* ptr, size_t size,
+                                     size_t alignment) {
+  if (!IsPooled(size, alignment)) {
+    DeallocateUnpooled(ptr, alignment);
+    return;
+  }
+  const size_t index = SizeClassIndex(size);
+  ThreadCache* const thread_cache = GetThreadCache();
+  if (ABSL_PREDICT_TRUE(thread_cache != nullptr) &&
+      thread_cache->Put(index, ptr, max_cached_bytes_per_thread_)) {
+    return;
+  }
+  operator delete(ptr);
+}
+
+}  // namespace riegeli
@@ -0,0 +1,74 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_BUFFER_POOL_ALLOCATOR_H_
+#define RIEGELI_BASE_BUFFER_POOL_ALLOCATOR_H_
+
+#include <stddef.h>
+
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+
+// An `Allocator` which keeps freed blocks of common buffer sizes in
+// thread-local free lists, and reuses them for later allocations of the same
+// size class by the same thread.
+//
+// This helps when short-lived objects allocate and free buffers at a high
+// rate, e.g. request handlers opening a `BufferedReader` or `BufferedWriter`
+// with a 64 KiB buffer for each request. Freeing and reallocating such a block
+// then does not reach `operator new`, and the block tends to stay in cache.
+//
+// Sizes between `kMinPooledSize` and `kMaxPooledSize` are rounded up to size
+// classes spaced by factors of about 1.4 (powers of 2 and 1.5 times powers of
+// 2), so up to a third of a block can be unused. Other sizes, and alignments
+// larger than `alignof(max_align_t)`, are passed to `operator new`.
+//
+// A block freed by a different thread than the one which allocated it goes to
+// the free list of the freeing thread. Free lists of a thread are emptied when
+// the thread exits.
+//
+// To use it for all buffers, call
+// `SetAllocator(&BufferPoolAllocator::global())` at the beginning of `main()`.
+class BufferPoolAllocator : public Allocator {
+ public:
+  // Blocks smaller than this are not pooled.
+  static constexpr size_t kMinPooledSize = size_t{4} << 10;
+  // Blocks larger than this are not pooled.
+  static constexpr size_t kMaxPooledSize = size_t{1} << 20;
+  // The default value of `max_cached_bytes_per_thread`.
+  static constexpr size_t kDefaultMaxCachedBytesPerThread = size_t{4} << 20;
+
+  // `max_cached_bytes_per_thread` bounds the total size of free blocks kept by
+  // each thread. Blocks freed beyond that are passed to `operator delete`.
+  explicit BufferPoolAllocator(
+      size_t max_cached_bytes_per_thread = kDefaultMaxCachedBytesPerThread)
+      : max_cached_bytes_per_thread_(max_cached_bytes_per_thread) {}
+
+  BufferPoolAllocator(const BufferPoolAllocator&) = delete;
+  BufferPoolAllocator& operator=(const BufferPoolAllocator&) = delete;
+
+  // Returns a default global `BufferPoolAllocator`.
+  static BufferPoolAllocator& global();
+
+  void* Allocate(size_t size, size_t alignment) override;
+  void Deallocate(void* ptr, size_t size, size_t alignment) override;
+
+ private:
+  size_t max_cached_bytes_per_thread_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_BUFFER_POOL_ALLOCATOR_H_
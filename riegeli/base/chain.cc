@@ -85,6 +85,122 @@ void ZeroRef::RegisterSubobjects(MemoryEstimator& memory_estimator) const {}
 
 void ZeroRef::DumpStructure(std::ostream& out) const { out << "[zero] { }"; }
 
+// A per-thread cache of small internal blocks, bucketed by allocated size.
+//
+// Streams of short records written through a `ChainWriter` allocate and free
+// many small blocks. Freed blocks are kept on a free list of the freeing thread
+// (up to `kMaxCachedPerClass` for each size class) and reused by later
+// allocations of the same size class without going to the allocator.
+//
+// Memory comes from `internal::Allocate()`, so an `Allocator` installed with
+// `SetAllocator()` is still used.
+class SmallBlockCache {
+ public:
+  // Allocated sizes are rounded up to a multiple of `kGranularity`.
+  static constexpr size_t kGranularity = 64;
+  // Allocated sizes up to `kMaxSize` are served by the cache.
+  static constexpr size_t kMaxSize = 8 * kGranularity;
+
+  // Alignment of blocks served by the cache.
+  static constexpr size_t kAlignment = alignof(max_align_t);
+
+  static constexpr size_t RoundUpSize(size_t size) {
+    return RoundUp<kGranularity>(size);
+  }
+
+  // Precondition: `size` is a multiple of `kGranularity` in (0, `kMaxSize`].
+  static void* Allocate(size_t size);
+  // Precondition: `size` is a multiple of `kGranularity` in (0, `kMaxSize`].
+  static void Deallocate(void* ptr, size_t size);
+
+ private:
+  static constexpr size_t kNumClasses = kMaxSize / kGranularity;
+  static constexpr size_t kMaxCachedPerClass = 64;
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // Trivially destructible, so that it remains usable when blocks are freed by
+  // destructors of other thread-local or static objects after `Cleanup` ran.
+  struct FreeLists {
+    FreeBlock* head[kNumClasses];
+    size_t length[kNumClasses];
+    bool registered;
+    bool destroyed;
+  };
+
+  // Returns cached blocks to the allocator when the thread exits.
+  class Cleanup {
+   public:
+    ~Cleanup();
+  };
+
+  static size_t ClassIndex(size_t size) { return size / kGranularity - 1; }
+
+  static FreeLists& ThreadFreeLists();
+
+  static thread_local FreeLists free_lists_;
+};
+
+thread_local SmallBlockCache::FreeLists SmallBlockCache::free_lists_;
+
+inline SmallBlockCache::FreeLists& SmallBlockCache::ThreadFreeLists() {
+  FreeLists& free_lists = free_lists_;
+  if (ABSL_PREDICT_FALSE(!free_lists.registered)) {
+    free_lists.registered = true;
+    static thread_local Cleanup cleanup;
+    static_cast<void>(cleanup);
+  }
+  return free_lists;
+}
+
+SmallBlockCache::Cleanup::~Cleanup() {
+  FreeLists& free_lists = free_lists_;
+  free_lists.destroyed = true;
+  for (size_t index = 0; index < kNumClasses; ++index) {
+    const size_t size = (index + 1) * kGranularity;
+    while (free_lists.head[index] != nullptr) {
+      FreeBlock* const block = free_lists.head[index];
+      free_lists.head[index] = block->next;
+      internal::Deallocate<kAlignment>(block, size);
+    }
+    free_lists.length[index] = 0;
+  }
+}
+
+inline void* SmallBlockCache::Allocate(size_t size) {
+  RIEGELI_ASSERT(size > 0 && size <= kMaxSize && size % kGranularity == 0)
+      << "Failed precondition of SmallBlockCache::Allocate(): "
+         "size not served by the cache: "
+      << size;
+  FreeLists& free_lists = ThreadFreeLists();
+  const size_t index = ClassIndex(size);
+  FreeBlock* const block = free_lists.head[index];
+  if (block == nullptr) return internal::Allocate<kAlignment>(size);
+  free_lists.head[index] = block->next;
+  --free_lists.length[index];
+  return block;
+}
+
+inline void SmallBlockCache::Deallocate(void* ptr, size_t size) {
+  RIEGELI_ASSERT(size > 0 && size <= kMaxSize && size % kGranularity == 0)
+      << "Failed precondition of SmallBlockCache::Deallocate(): "
+         "size not served by the cache: "
+      << size;
+  FreeLists& free_lists = ThreadFreeLists();
+  const size_t index = ClassIndex(size);
+  if (ABSL_PREDICT_FALSE(free_lists.destroyed ||
+                         free_lists.length[index] >= kMaxCachedPerClass)) {
+    internal::Deallocate<kAlignment>(ptr, size);
+    return;
+  }
+  FreeBlock* const block = static_cast<FreeBlock*>(ptr);
+  block->next = free_lists.head[index];
+  free_lists.head[index] = block;
+  ++free_lists.length[index];
+}
+
 // Like `dest.Append(src)`, but avoids splitting `src` into 4083-byte fragments.
 void AppendToCord(absl::string_view src, absl::Cord& dest) {
   if (src.size() <= 4096 - 13 /* `kMaxFlatSize` from cord.cc */) {
@@ -292,11 +408,34 @@ inline void Chain::FlatCordRef::PrependTo(absl::Cord& dest) const {
 inline Chain::RawBlock* Chain::RawBlock::NewInternal(size_t min_capacity) {
   RIEGELI_ASSERT_GT(min_capacity, 0u)
       << "Failed precondition of Chain::RawBlock::NewInternal(): zero capacity";
+  static_assert(alignof(RawBlock) <= SmallBlockCache::kAlignment,
+                "SmallBlockCache does not provide enough alignment");
   size_t raw_capacity;
+  if (min_capacity <= SmallBlockCache::kMaxSize - kInternalAllocatedOffset()) {
+    // The block fills its size class exactly, so that `DeleteInternal()` can
+    // recover the size class from `capacity()`.
+    raw_capacity =
+        SmallBlockCache::RoundUpSize(kInternalAllocatedOffset() + min_capacity);
+    return new (SmallBlockCache::Allocate(raw_capacity))
+        RawBlock(&raw_capacity);
+  }
   return SizeReturningNewAligned<RawBlock>(
       kInternalAllocatedOffset() + min_capacity, &raw_capacity, &raw_capacity);
 }
 
+void Chain::RawBlock::DeleteInternal() {
+  RIEGELI_ASSERT(is_internal())
+      << "Failed precondition of Chain::RawBlock::DeleteInternal(): "
+         "block not internal";
+  const size_t raw_capacity = kInternalAllocatedOffset() + capacity();
+  if (raw_capacity <= SmallBlockCache::kMaxSize) {
+    this->~RawBlock();
+    SmallBlockCache::Deallocate(this, raw_capacity);
+    return;
+  }
+  DeleteAligned<RawBlock>(this, raw_capacity);
+}
+
 inline Chain::RawBlock::RawBlock(const size_t* raw_capacity)
     : data_(allocated_begin_, 0),
       // Redundant cast is needed for `-fsanitize=bounds`.
@@ -378,6 +517,15 @@ inline bool Chain::RawBlock::wasteful(size_t extra_size) const {
   return Wasteful(capacity(), size() + extra_size);
 }
 
+inline bool Chain::RawBlock::copy_to_cord(size_t length,
+                                          absl::Cord& dest) const {
+  if (length <= MaxBytesToCopyToCord(dest)) return true;
+  // Copying a wasteful block lets its memory be freed when the `Chain` lets it
+  // go, instead of being pinned by the `absl::Cord`. If the block has other
+  // owners, its memory stays allocated anyway, so share it.
+  return wasteful() && has_unique_owner();
+}
+
 inline void Chain::RawBlock::RegisterShared(
     MemoryEstimator& memory_estimator) const {
   if (memory_estimator.RegisterNode(this)) {
@@ -539,7 +687,7 @@ inline void Chain::RawBlock::AppendTo(absl::Cord& dest) {
   RIEGELI_ASSERT_LE(size(), std::numeric_limits<size_t>::max() - dest.size())
       << "Failed precondition of Chain::RawBlock::AppendTo(Cord&): "
          "Cord size overflow";
-  if (size() <= MaxBytesToCopyToCord(dest) || wasteful()) {
+  if (copy_to_cord(size(), dest)) {
     AppendToCord(absl::string_view(*this), dest);
     Unref<ownership>();
     return;
@@ -605,7 +753,7 @@ inline void Chain::RawBlock::AppendSubstrTo(absl::string_view substr,
                     std::numeric_limits<size_t>::max() - dest.size())
       << "Failed precondition of Chain::RawBlock::AppendSubstrTo(Cord&): "
          "Cord size overflow";
-  if (substr.size() <= MaxBytesToCopyToCord(dest) || wasteful()) {
+  if (copy_to_cord(substr.size(), dest)) {
     AppendToCord(substr, dest);
     return;
   }
@@ -626,7 +774,7 @@ inline void Chain::RawBlock::PrependTo(absl::Cord& dest) {
   RIEGELI_ASSERT_LE(size(), std::numeric_limits<size_t>::max() - dest.size())
       << "Failed precondition of Chain::RawBlock::PrependTo(Cord&): "
          "Chain size overflow";
-  if (size() <= MaxBytesToCopyToCord(dest) || wasteful()) {
+  if (copy_to_cord(size(), dest)) {
     PrependToCord(absl::string_view(*this), dest);
     Unref<ownership>();
     return;
@@ -811,6 +959,71 @@ absl::string_view Chain::FlattenSlow() {
   return absl::string_view(*block);
 }
 
+void Chain::Compact(size_t target_block_size) {
+  target_block_size = UnsignedMax(target_block_size, kMinBufferSize);
+  // Find the first pair of adjacent blocks to merge, to return early without
+  // rebuilding block pointers if there is none.
+  const BlockPtr* iter = begin_;
+  for (;;) {
+    if (end_ - iter < 2) return;
+    if (iter[0].block_ptr->size() < target_block_size &&
+        iter[1].block_ptr->size() < target_block_size) {
+      break;
+    }
+    ++iter;
+  }
+  Chain compacted;
+  compacted.AppendBlocks<Ownership::kShare>(begin_, iter);
+  while (iter != end_) {
+    const BlockPtr* run_end = iter + 1;
+    size_t remaining = iter->block_ptr->size();
+    if (remaining < target_block_size) {
+      while (run_end != end_ &&
+             run_end->block_ptr->size() < target_block_size) {
+        remaining += run_end->block_ptr->size();
+        ++run_end;
+      }
+    }
+    if (run_end - iter == 1) {
+      // A large block, or a small block between large blocks.
+      compacted.AppendBlocks<Ownership::kShare>(iter, run_end);
+      iter = run_end;
+      continue;
+    }
+    // Copy the run to blocks of `target_block_size`, except that the last block
+    // takes the remainder if it would be tiny otherwise.
+    RawBlock* block = nullptr;
+    size_t block_remaining = 0;
+    do {
+      absl::string_view data(*iter->block_ptr);
+      while (!data.empty()) {
+        if (block == nullptr) {
+          block_remaining =
+              remaining - UnsignedMin(remaining, target_block_size) <
+                      kMinBufferSize
+                  ? remaining
+                  : target_block_size;
+          block = RawBlock::NewInternal(block_remaining);
+        }
+        const size_t length = UnsignedMin(data.size(), block_remaining);
+        block->Append(data.substr(0, length));
+        data.remove_prefix(length);
+        block_remaining -= length;
+        remaining -= length;
+        if (block_remaining == 0) {
+          compacted.PushBack(block);
+          block = nullptr;
+        }
+      }
+      ++iter;
+    } while (iter != run_end);
+    RIEGELI_ASSERT(block == nullptr)
+        << "Failed invariant of Chain::Compact(): block not filled";
+  }
+  compacted.size_ = size_;
+  *this = std::move(compacted);
+}
+
 inline Chain::BlockPtr* Chain::NewBlockPtrs(size_t capacity) {
   return std::allocator<BlockPtr>().allocate(2 * capacity);
 }
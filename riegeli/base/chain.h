@@ -272,6 +272,13 @@ class Chain {
   size_t size() const { return size_; }
   bool empty() const { return size_ == 0; }
 
+  // Converts to or appends/prepends to a flat or `absl::Cord` destination.
+  //
+  // Conversion to `absl::Cord` shares blocks by reference where possible:
+  // external blocks, including those holding an `absl::Cord`, and internal
+  // blocks are wrapped with `absl::MakeCordFromExternal()` instead of being
+  // copied. Only short blocks are copied, and wasteful internal blocks which
+  // are not shared with other owners, to avoid pinning unused memory.
   void CopyTo(char* dest) const;
   void AppendTo(std::string& dest) const&;
   void AppendTo(std::string& dest) &&;
@@ -292,6 +299,14 @@ class Chain {
   // contents.
   absl::string_view Flatten();
 
+  // Merges runs of adjacent blocks smaller than `target_block_size` by copying
+  // them to new blocks of about `target_block_size`, so that iterating over
+  // blocks visits fewer and larger pieces of memory. Blocks of at least
+  // `target_block_size` are kept without copying.
+  //
+  // `target_block_size` is increased to `kMinBufferSize` if smaller.
+  void Compact(size_t target_block_size = kMaxBufferSize);
+
   // Locates the block containing the given character position, and the
   // character index within the block.
   //
@@ -997,6 +1012,10 @@ class Chain::RawBlock {
   bool tiny(size_t extra_size = 0) const;
   bool wasteful(size_t extra_size = 0) const;
 
+  // Returns `true` if `length` bytes of this block should be copied to `dest`
+  // instead of being shared with it.
+  bool copy_to_cord(size_t length, absl::Cord& dest) const;
+
   // Registers this `RawBlock` with `MemoryEstimator`.
   void RegisterShared(MemoryEstimator& memory_estimator) const;
   // Shows internal structure in a human-readable way, for debugging.
@@ -1061,6 +1080,9 @@ class Chain::RawBlock {
 
   bool has_unique_owner() const;
 
+  // Destroys and frees an internal block.
+  void DeleteInternal();
+
   bool is_internal() const { return allocated_end_ != nullptr; }
   bool is_external() const { return allocated_end_ == nullptr; }
 
@@ -1333,7 +1355,7 @@ void Chain::RawBlock::Unref() {
       (has_unique_owner() ||
        ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1)) {
     if (is_internal()) {
-      DeleteAligned<RawBlock>(this, kInternalAllocatedOffset() + capacity());
+      DeleteInternal();
     } else {
       external_.methods->delete_block(this);
     }
@@ -0,0 +1,230 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures basic `Chain` operations: appending and prepending small and large
+// pieces, conversion to and from `absl::Cord`, `Flatten()`, `CopyTo()`, block
+// iteration, and `RemoveSuffix()`.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/functional/function_ref.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+
+ABSL_FLAG(std::string, benchmarks,
+          "append_small append_large prepend_small prepend_large "
+          "to_cord from_cord flatten copy_to iterate_blocks remove_suffix",
+          "Whitespace-separated names of benchmarks to run");
+ABSL_FLAG(uint64_t, total_size, uint64_t{64} << 20,
+          "Number of bytes in each Chain");
+ABSL_FLAG(uint64_t, small_size, 64, "Size of small pieces");
+ABSL_FLAG(uint64_t, large_size, uint64_t{64} << 10, "Size of large pieces");
+ABSL_FLAG(int32_t, repetitions, 5, "Number of times to repeat each benchmark");
+
+namespace {
+
+uint64_t RealTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_MONOTONIC, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+// Results of benchmarks are accumulated here, so that the compiler can not
+// optimize away the measured operations.
+uint64_t sink = 0;
+
+class ChainBenchmarks {
+ public:
+  explicit ChainBenchmarks(size_t total_size, size_t small_size,
+                           size_t large_size, int repetitions);
+
+  // Runs the benchmark with the given name and prints its results.
+  void Run(absl::string_view name);
+
+ private:
+  // Returns the fastest time of `operation()` over `repetitions_`, calling
+  // `prepare()` before each repetition without timing it.
+  uint64_t BestTime_ns(absl::FunctionRef<void()> prepare,
+                       absl::FunctionRef<void()> operation) const;
+
+  // Returns a `Chain` of `total_size_` bytes built from pieces of
+  // `piece_size` bytes.
+  riegeli::Chain MakeChain(size_t piece_size) const;
+
+  // Returns the number of pieces of `piece_size` bytes in `total_size_`,
+  // at least 1.
+  size_t NumPieces(size_t piece_size) const;
+
+  size_t total_size_;
+  size_t small_size_;
+  size_t large_size_;
+  int repetitions_;
+  std::string small_piece_;
+  std::string large_piece_;
+};
+
+ChainBenchmarks::ChainBenchmarks(size_t total_size, size_t small_size,
+                                 size_t large_size, int repetitions)
+    : total_size_(total_size),
+      small_size_(small_size),
+      large_size_(large_size),
+      repetitions_(repetitions),
+      small_piece_(small_size, 's'),
+      large_piece_(large_size, 'l') {}
+
+uint64_t ChainBenchmarks::BestTime_ns(
+    absl::FunctionRef<void()> prepare,
+    absl::FunctionRef<void()> operation) const {
+  uint64_t best_time_ns = 0;
+  for (int repetition = 0; repetition < repetitions_; ++repetition) {
+    prepare();
+    const uint64_t start_ns = RealTimeNow_ns();
+    operation();
+    const uint64_t time_ns = RealTimeNow_ns() - start_ns;
+    if (repetition == 0 || time_ns < best_time_ns) best_time_ns = time_ns;
+  }
+  return best_time_ns;
+}
+
+size_t ChainBenchmarks::NumPieces(size_t piece_size) const {
+  return riegeli::UnsignedMax(total_size_ / piece_size, size_t{1});
+}
+
+riegeli::Chain ChainBenchmarks::MakeChain(size_t piece_size) const {
+  const std::string piece(piece_size, 'c');
+  riegeli::Chain chain;
+  for (size_t i = NumPieces(piece_size); i > 0; --i) {
+    chain.Append(absl::string_view(piece));
+  }
+  return chain;
+}
+
+void ChainBenchmarks::Run(absl::string_view name) {
+  riegeli::Chain chain;
+  absl::Cord cord;
+  std::unique_ptr<char[]> flat;
+  // Number of operations timed, used to report the time per operation.
+  size_t num_operations = 1;
+  uint64_t time_ns;
+  if (name == "append_small" || name == "append_large" ||
+      name == "prepend_small" || name == "prepend_large") {
+    const bool small = name == "append_small" || name == "prepend_small";
+    const bool prepend = name == "prepend_small" || name == "prepend_large";
+    const absl::string_view piece = small ? small_piece_ : large_piece_;
+    num_operations = NumPieces(piece.size());
+    time_ns = BestTime_ns([&] { chain = riegeli::Chain(); },
+                          [&] {
+                            for (size_t i = num_operations; i > 0; --i) {
+                              if (prepend) {
+                                chain.Prepend(piece);
+                              } else {
+                                chain.Append(piece);
+                              }
+                            }
+                          });
+    sink += chain.size();
+  } else if (name == "to_cord") {
+    const riegeli::Chain src = MakeChain(small_size_);
+    time_ns = BestTime_ns([&] { cord.Clear(); },
+                          [&] { cord = absl::Cord(src); });
+    sink += cord.size();
+  } else if (name == "from_cord") {
+    const absl::Cord src = absl::Cord(MakeChain(small_size_));
+    time_ns = BestTime_ns([&] { chain = riegeli::Chain(); },
+                          [&] { chain = riegeli::Chain(src); });
+    sink += chain.size();
+  } else if (name == "flatten") {
+    const riegeli::Chain src = MakeChain(small_size_);
+    time_ns = BestTime_ns([&] { chain = src; },
+                          [&] { sink += chain.Flatten().size(); });
+  } else if (name == "copy_to") {
+    const riegeli::Chain src = MakeChain(small_size_);
+    flat = std::make_unique<char[]>(src.size());
+    time_ns = BestTime_ns([] {}, [&] { src.CopyTo(flat.get()); });
+    sink += static_cast<unsigned char>(flat[0]);
+  } else if (name == "iterate_blocks") {
+    const riegeli::Chain src = MakeChain(small_size_);
+    num_operations = src.blocks().size();
+    time_ns = BestTime_ns([] {}, [&] {
+      for (const absl::string_view block : src.blocks()) {
+        sink += static_cast<unsigned char>(block.front());
+      }
+    });
+  } else if (name == "remove_suffix") {
+    const riegeli::Chain src = MakeChain(small_size_);
+    num_operations = NumPieces(small_size_);
+    time_ns = BestTime_ns([&] { chain = src; },
+                          [&] {
+                            for (size_t i = num_operations; i > 0; --i) {
+                              chain.RemoveSuffix(small_size_);
+                            }
+                          });
+    sink += chain.size();
+  } else {
+    RIEGELI_CHECK_UNREACHABLE() << "Unknown benchmark: " << name;
+  }
+  absl::Format(&std::cout, "%-16s %12.3f %12.1f %12.1f\n", name,
+               static_cast<double>(time_ns) / 1e6,
+               static_cast<double>(time_ns) /
+                   static_cast<double>(num_operations),
+               static_cast<double>(total_size_) /
+                   static_cast<double>(time_ns) * 1e3);
+}
+
+const char kUsage[] =
+    "Usage: chain_benchmark (OPTION...)\n"
+    "\n"
+    "Measures basic Chain operations.\n";
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(kUsage);
+  absl::ParseCommandLine(argc, argv);
+  const size_t total_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_total_size));
+  const size_t small_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_small_size));
+  const size_t large_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_large_size));
+  RIEGELI_CHECK_GT(total_size, 0u) << "--total_size must be positive";
+  RIEGELI_CHECK_GT(small_size, 0u) << "--small_size must be positive";
+  RIEGELI_CHECK_GT(large_size, 0u) << "--large_size must be positive";
+  ChainBenchmarks benchmarks(total_size, small_size, large_size,
+                             absl::GetFlag(FLAGS_repetitions));
+  absl::Format(&std::cout, "%-16s %12s %12s %12s\n", "Benchmark", "Time [ms]",
+               "ns/op", "MB/s");
+  for (const absl::string_view name :
+       absl::StrSplit(absl::GetFlag(FLAGS_benchmarks),
+                      absl::ByAnyChar("\t\n "), absl::SkipEmpty())) {
+    benchmarks.Run(name);
+  }
+  std::cerr << "Checksum: " << sink << std::endl;
+}
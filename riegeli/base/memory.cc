@@ -15,8 +15,11 @@
 #include "riegeli/base/memory.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include <array>
+#include <atomic>
 
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
@@ -24,6 +27,43 @@
 
 namespace riegeli {
 
+namespace {
+
+std::atomic<bool> huge_pages_for_large_allocations{false};
+
+}  // namespace
+
+void SetHugePagesForLargeAllocations(bool enabled) {
+  huge_pages_for_large_allocations.store(enabled, std::memory_order_relaxed);
+}
+
+Allocator::~Allocator() {}
+
+void SetAllocator(Allocator* allocator) {
+  internal::global_allocator.store(allocator, std::memory_order_release);
+}
+
+namespace internal {
+
+std::atomic<Allocator*> global_allocator{nullptr};
+
+void AdviseHugePagesSlow(void* ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+  if (!huge_pages_for_large_allocations.load(std::memory_order_relaxed)) {
+    return;
+  }
+  const uintptr_t begin =
+      RoundUp<kHugePageSize>(reinterpret_cast<uintptr_t>(ptr));
+  const uintptr_t end =
+      RoundDown<kHugePageSize>(reinterpret_cast<uintptr_t>(ptr) + size);
+  if (begin >= end) return;
+  // Errors are ignored because this is only a hint.
+  madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+#endif
+}
+
+}  // namespace internal
+
 extern const std::array<char, kDefaultBufferSize> kArrayOfZeros = {0};
 
 absl::Cord CordOfZeros(size_t length) {
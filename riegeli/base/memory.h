@@ -16,12 +16,15 @@
 #define RIEGELI_BASE_MEMORY_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <array>
+#include <atomic>
 #include <limits>
 #include <new>
 #include <utility>
 
+#include "absl/base/optimization.h"
 #include "absl/strings/cord.h"
 #include "riegeli/base/base.h"
 
@@ -66,35 +69,80 @@ inline size_t EstimatedAllocatedSize(size_t requested_size) {
   return RoundUp<sizeof(size_t) * 2>(requested_size);
 }
 
-// `NewAligned()`/`DeleteAligned()` provide memory allocation with the specified
-// alignment known at compile time, with the size specified in bytes, and which
-// allow deallocation to be faster by knowing the size.
+// Enables or disables asking the kernel to back large blocks allocated by
+// `Buffer`, `NewAligned()`, and `SizeReturningNewAligned()` (hence also by
+// `Chain` and `SharedBuffer`) with transparent huge pages, using
+// `madvise(MADV_HUGEPAGE)`.
 //
-// The alignment and size passed to `DeleteAligned()` must be the same as in the
-// corresponding `NewAligned()`. Pointer types must be compatible as with new
-// and delete expressions.
+// This reduces TLB misses when large buffers are processed, e.g. when chunks
+// of several MiB are decoded, at the cost of possibly higher memory usage. Only
+// whole huge pages contained in an allocated block are affected, so this
+// matters mostly for blocks several times larger than a huge page.
 //
-// If the allocated size is given in terms of objects rather than bytes
-// and the type is not over-aligned (i.e. its alignment is not larger than
-// `alignof(max_align_t))`, it is simpler to use `std::allocator<T>()` instead.
-// If the type is over-aligned, `std::allocator<T>()` works correctly only when
-// `operator new(size_t, std::align_val_t)` from C++17 is available.
+// This has no effect if `MADV_HUGEPAGE` is not available, or if transparent
+// huge pages are disabled in the kernel.
+//
+// Default: disabled.
+void SetHugePagesForLargeAllocations(bool enabled);
 
-// TODO: Test this with overaligned types.
+namespace internal {
 
-template <typename T, size_t alignment = alignof(T), typename... Args>
-inline T* NewAligned(size_t num_bytes, Args&&... args) {
-  static_assert(alignment != 0 && (alignment & (alignment - 1)) == 0,
-                "alignment must be a power of 2");
-  // Allocate enough space to construct the object, even if the caller does not
-  // need the whole tail part of the object.
-  num_bytes = UnsignedMax(num_bytes, sizeof(T));
-  T* ptr;
+// The size of a transparent huge page on common platforms.
+constexpr size_t kHugePageSize = size_t{2} << 20;
+
+void AdviseHugePagesSlow(void* ptr, size_t size);
+
+// Applies `SetHugePagesForLargeAllocations()` to a newly allocated block.
+inline void AdviseHugePages(void* ptr, size_t size) {
+  if (ABSL_PREDICT_FALSE(size >= kHugePageSize)) AdviseHugePagesSlow(ptr, size);
+}
+
+}  // namespace internal
+
+// Memory allocator used by `Buffer`, `NewAligned()`, and
+// `SizeReturningNewAligned()` (hence also by `Chain` and `SharedBuffer`).
+//
+// A custom `Allocator` can be used to place these blocks in per-thread arenas,
+// NUMA-local pools, or jemalloc arenas. Since blocks can be freed by a
+// different thread than the one which allocated them, an `Allocator` which
+// dispatches per thread or per node must find the owning arena from the
+// pointer.
+class Allocator {
+ public:
+  virtual ~Allocator();
+
+  // Allocates `size` bytes aligned to `alignment`, which is a power of 2.
+  //
+  // Returns a non-null pointer. Failure to allocate should be reported like by
+  // `operator new`, i.e. by throwing `std::bad_alloc` or terminating.
+  virtual void* Allocate(size_t size, size_t alignment) = 0;
+
+  // Frees a block obtained from `Allocate()` with the same `size` and
+  // `alignment`.
+  virtual void Deallocate(void* ptr, size_t size, size_t alignment) = 0;
+};
+
+// Sets the `Allocator` used by `Buffer`, `NewAligned()`, and
+// `SizeReturningNewAligned()`, or restores the default of using
+// `operator new` if `nullptr`.
+//
+// This must be called before the first allocation of these kinds, typically at
+// the beginning of `main()`, because blocks are freed with the `Allocator`
+// current at the time of freeing. `allocator` must outlive all blocks allocated
+// with it.
+void SetAllocator(Allocator* allocator);
+
+namespace internal {
+
+extern std::atomic<Allocator*> global_allocator;
+
+template <size_t alignment>
+inline void* AllocateDefault(size_t num_bytes) {
 #if __cpp_aligned_new
   if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
-    ptr = static_cast<T*>(operator new(num_bytes));
+    return operator new(num_bytes);
   } else {
-    ptr = static_cast<T*>(operator new(num_bytes, std::align_val_t(alignment)));
+    return operator new(num_bytes, std::align_val_t(alignment));
   }
 #else
 #ifdef __STDCPP_DEFAULT_NEW_ALIGNMENT__
@@ -103,7 +151,7 @@ inline T* NewAligned(size_t num_bytes, Args&&... args) {
   constexpr size_t kDefaultNewAlignment = alignof(max_align_t);
 #endif
   if (alignment <= kDefaultNewAlignment) {
-    ptr = static_cast<T*>(operator new(num_bytes));
+    return operator new(num_bytes);
   } else {
     RIEGELI_CHECK_LE(num_bytes, std::numeric_limits<size_t>::max() -
                                     sizeof(void*) - alignment +
@@ -115,19 +163,13 @@ inline T* NewAligned(size_t num_bytes, Args&&... args) {
         reinterpret_cast<void*>(RoundUp<alignment>(reinterpret_cast<uintptr_t>(
             static_cast<char*>(allocated) + sizeof(void*))));
     reinterpret_cast<void**>(aligned)[-1] = allocated;
-    ptr = static_cast<T*>(aligned);
+    return aligned;
   }
 #endif
-  new (ptr) T(std::forward<Args>(args)...);
-  return ptr;
 }
 
-template <typename T, size_t alignment = alignof(T)>
-inline void DeleteAligned(T* ptr, size_t num_bytes) {
-  static_assert(alignment != 0 && (alignment & (alignment - 1)) == 0,
-                "alignment must be a power of 2");
-  num_bytes = UnsignedMax(num_bytes, sizeof(T));
-  ptr->~T();
+template <size_t alignment>
+inline void DeallocateDefault(void* ptr, size_t num_bytes) {
 #if __cpp_aligned_new
 #if __cpp_sized_deallocation || __GXX_DELETE_WITH_SIZE__
   if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
@@ -174,6 +216,74 @@ inline void DeleteAligned(T* ptr, size_t num_bytes) {
 #endif
 }
 
+// Allocates `num_bytes` aligned to `alignment` using the current `Allocator`.
+template <size_t alignment>
+inline void* Allocate(size_t num_bytes) {
+  static_assert(alignment != 0 && (alignment & (alignment - 1)) == 0,
+                "alignment must be a power of 2");
+  Allocator* const allocator =
+      global_allocator.load(std::memory_order_acquire);
+  void* const ptr = ABSL_PREDICT_TRUE(allocator == nullptr)
+                        ? AllocateDefault<alignment>(num_bytes)
+                        : allocator->Allocate(num_bytes, alignment);
+  AdviseHugePages(ptr, num_bytes);
+  return ptr;
+}
+
+// Frees a block obtained from `Allocate()` with the same `num_bytes` and
+// `alignment`.
+template <size_t alignment>
+inline void Deallocate(void* ptr, size_t num_bytes) {
+  static_assert(alignment != 0 && (alignment & (alignment - 1)) == 0,
+                "alignment must be a power of 2");
+  Allocator* const allocator =
+      global_allocator.load(std::memory_order_acquire);
+  if (ABSL_PREDICT_TRUE(allocator == nullptr)) {
+    DeallocateDefault<alignment>(ptr, num_bytes);
+  } else {
+    allocator->Deallocate(ptr, num_bytes, alignment);
+  }
+}
+
+}  // namespace internal
+
+// `NewAligned()`/`DeleteAligned()` provide memory allocation with the specified
+// alignment known at compile time, with the size specified in bytes, and which
+// allow deallocation to be faster by knowing the size.
+//
+// The alignment and size passed to `DeleteAligned()` must be the same as in the
+// corresponding `NewAligned()`. Pointer types must be compatible as with new
+// and delete expressions.
+//
+// Memory is obtained from the `Allocator` set by `SetAllocator()`, or from
+// `operator new` by default.
+//
+// If the allocated size is given in terms of objects rather than bytes
+// and the type is not over-aligned (i.e. its alignment is not larger than
+// `alignof(max_align_t))`, it is simpler to use `std::allocator<T>()` instead,
+// unless the memory should be obtained from the `Allocator`. If the type is
+// over-aligned, `std::allocator<T>()` works correctly only when
+// `operator new(size_t, std::align_val_t)` from C++17 is available.
+
+// TODO: Test this with overaligned types.
+
+template <typename T, size_t alignment = alignof(T), typename... Args>
+inline T* NewAligned(size_t num_bytes, Args&&... args) {
+  // Allocate enough space to construct the object, even if the caller does not
+  // need the whole tail part of the object.
+  num_bytes = UnsignedMax(num_bytes, sizeof(T));
+  T* const ptr = static_cast<T*>(internal::Allocate<alignment>(num_bytes));
+  new (ptr) T(std::forward<Args>(args)...);
+  return ptr;
+}
+
+template <typename T, size_t alignment = alignof(T)>
+inline void DeleteAligned(T* ptr, size_t num_bytes) {
+  num_bytes = UnsignedMax(num_bytes, sizeof(T));
+  ptr->~T();
+  internal::Deallocate<alignment>(ptr, num_bytes);
+}
+
 // `SizeReturningNewAligned()` is like `NewAligned()`, but it returns the number
 // of bytes actually allocated, which can be greater than the requested number
 // of bytes.
@@ -185,41 +295,11 @@ inline void DeleteAligned(T* ptr, size_t num_bytes) {
 template <typename T, size_t alignment = alignof(T), typename... Args>
 inline T* SizeReturningNewAligned(size_t min_num_bytes,
                                   size_t* actual_num_bytes, Args&&... args) {
-  static_assert(alignment != 0 && (alignment & (alignment - 1)) == 0,
-                "alignment must be a power of 2");
   // Allocate enough space to construct the object, even if the caller does not
   // need the whole tail part of the object.
   min_num_bytes = UnsignedMax(min_num_bytes, sizeof(T));
-  T* ptr;
   const size_t capacity = EstimatedAllocatedSize(min_num_bytes);
-#if __cpp_aligned_new
-  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
-    ptr = static_cast<T*>(operator new(capacity));
-  } else {
-    ptr = static_cast<T*>(operator new(capacity, std::align_val_t(alignment)));
-  }
-#else
-#ifdef __STDCPP_DEFAULT_NEW_ALIGNMENT__
-  constexpr size_t kDefaultNewAlignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
-#else
-  constexpr size_t kDefaultNewAlignment = alignof(max_align_t);
-#endif
-  if (alignment <= kDefaultNewAlignment) {
-    ptr = static_cast<T*>(operator new(capacity));
-  } else {
-    RIEGELI_CHECK_LE(capacity, std::numeric_limits<size_t>::max() -
-                                   sizeof(void*) - alignment +
-                                   kDefaultNewAlignment)
-        << "Out of memory";
-    void* const allocated = operator new(sizeof(void*) + capacity + alignment -
-                                         kDefaultNewAlignment);
-    void* const aligned =
-        reinterpret_cast<void*>(RoundUp<alignment>(reinterpret_cast<uintptr_t>(
-            static_cast<char*>(allocated) + sizeof(void*))));
-    reinterpret_cast<void**>(aligned)[-1] = allocated;
-    ptr = static_cast<T*>(aligned);
-  }
-#endif
+  T* const ptr = static_cast<T*>(internal::Allocate<alignment>(capacity));
   *actual_num_bytes = capacity;
   new (ptr) T(std::forward<Args>(args)...);
   return ptr;
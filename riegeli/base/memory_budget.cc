@@ -0,0 +1,74 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/base/memory_budget.h"
+
+#include <stddef.h>
+
+#include "absl/base/optimization.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+MemoryBudget::~MemoryBudget() {
+  absl::MutexLock lock(&mutex_);
+  RIEGELI_ASSERT_EQ(reserved_, 0u)
+      << "Failed precondition of MemoryBudget::~MemoryBudget(): "
+         "memory still reserved";
+}
+
+inline bool MemoryBudget::Fits(size_t size) const {
+  return reserved_ == 0 || size <= limit_ - UnsignedMin(reserved_, limit_);
+}
+
+MemoryBudget::Reservation MemoryBudget::Reserve(size_t size) {
+  if (size == 0) return Reservation();
+  absl::MutexLock lock(&mutex_);
+  struct Args {
+    const MemoryBudget* budget;
+    size_t size;
+  } args = {this, size};
+  mutex_.Await(absl::Condition(
+      +[](Args* args) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+        return args->budget->Fits(args->size);
+      },
+      &args));
+  reserved_ += size;
+  return Reservation(this, size);
+}
+
+absl::optional<MemoryBudget::Reservation> MemoryBudget::TryReserve(
+    size_t size) {
+  if (size == 0) return Reservation();
+  absl::MutexLock lock(&mutex_);
+  if (ABSL_PREDICT_FALSE(!Fits(size))) return absl::nullopt;
+  reserved_ += size;
+  return Reservation(this, size);
+}
+
+size_t MemoryBudget::reserved() const {
+  absl::MutexLock lock(&mutex_);
+  return reserved_;
+}
+
+void MemoryBudget::Release(size_t size) {
+  absl::MutexLock lock(&mutex_);
+  RIEGELI_ASSERT_LE(size, reserved_)
+      << "Failed invariant of MemoryBudget: releasing more than reserved";
+  reserved_ -= size;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,132 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BASE_MEMORY_BUDGET_H_
+#define RIEGELI_BASE_MEMORY_BUDGET_H_
+
+#include <stddef.h>
+
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+
+namespace riegeli {
+
+// A limit of memory shared by objects which can hold a lot of it temporarily,
+// e.g. by `RecordReader` and `RecordWriter` while decoding or encoding chunks.
+//
+// Memory is reserved before it is used and released afterwards. A reservation
+// which does not fit waits until enough memory is released, which applies
+// backpressure to its user. A reservation is granted even above the limit if
+// nothing else is reserved, so that a single large request does not wait
+// forever.
+//
+// A thread which holds a reservation must not wait for another reservation
+// from the same `MemoryBudget`, because other threads might do the same and
+// deadlock. It can use `TryReserve()` instead.
+class MemoryBudget {
+ public:
+  // Memory reserved from a `MemoryBudget`, released when the `Reservation` is
+  // destroyed, assigned to, or `Release()` is called.
+  //
+  // A default-constructed `Reservation` holds nothing.
+  class Reservation {
+   public:
+    Reservation() noexcept {}
+
+    Reservation(const Reservation&) = delete;
+    Reservation& operator=(const Reservation&) = delete;
+
+    Reservation(Reservation&& that) noexcept;
+    Reservation& operator=(Reservation&& that) noexcept;
+
+    ~Reservation() { Release(); }
+
+    // Releases the reserved memory. Afterwards the `Reservation` holds
+    // nothing.
+    void Release();
+
+    // Returns the amount of reserved memory.
+    size_t size() const { return size_; }
+
+   private:
+    friend class MemoryBudget;
+
+    explicit Reservation(MemoryBudget* budget, size_t size)
+        : budget_(budget), size_(size) {}
+
+    MemoryBudget* budget_ = nullptr;
+    size_t size_ = 0;
+  };
+
+  // Creates a `MemoryBudget` allowing to reserve `limit` bytes at a time.
+  explicit MemoryBudget(size_t limit) : limit_(limit) {}
+
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+  // Precondition: nothing is reserved.
+  ~MemoryBudget();
+
+  // Reserves `size` bytes, waiting until they fit in the limit, or until
+  // nothing else is reserved.
+  Reservation Reserve(size_t size);
+
+  // Reserves `size` bytes if they fit in the limit now, or if nothing else is
+  // reserved. Returns `absl::nullopt` otherwise.
+  absl::optional<Reservation> TryReserve(size_t size);
+
+  // Returns the limit.
+  size_t limit() const { return limit_; }
+
+  // Returns the amount of memory reserved now.
+  size_t reserved() const;
+
+ private:
+  bool Fits(size_t size) const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void Release(size_t size);
+
+  const size_t limit_;
+  mutable absl::Mutex mutex_;
+  size_t reserved_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+// Implementation details follow.
+
+inline MemoryBudget::Reservation::Reservation(Reservation&& that) noexcept
+    : budget_(std::exchange(that.budget_, nullptr)),
+      size_(std::exchange(that.size_, 0)) {}
+
+inline MemoryBudget::Reservation& MemoryBudget::Reservation::operator=(
+    Reservation&& that) noexcept {
+  if (ABSL_PREDICT_TRUE(&that != this)) {
+    Release();
+    budget_ = std::exchange(that.budget_, nullptr);
+    size_ = std::exchange(that.size_, 0);
+  }
+  return *this;
+}
+
+inline void MemoryBudget::Reservation::Release() {
+  if (budget_ != nullptr) {
+    std::exchange(budget_, nullptr)->Release(std::exchange(size_, 0));
+  }
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BASE_MEMORY_BUDGET_H_
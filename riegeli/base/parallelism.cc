@@ -12,23 +12,120 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// Make `sched_getcpu()` available.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "riegeli/base/parallelism.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include <deque>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
+#include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/memory.h"
 
 namespace riegeli {
-namespace internal {
+
+namespace {
+
+// Binds the current thread to `cpu`, ignoring failures.
+void SetCpuAffinity(int cpu) {
+#ifdef __linux__
+  if (ABSL_PREDICT_FALSE(cpu < 0 || cpu >= CPU_SETSIZE)) return;
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#endif
+}
+
+// Parses a Linux list of CPUs or nodes like "0-3,8-11", appending its elements
+// to `values`.
+bool ParseList(absl::string_view text, std::vector<int>& values) {
+  text = absl::StripAsciiWhitespace(text);
+  if (text.empty()) return true;
+  for (const absl::string_view range : absl::StrSplit(text, ',')) {
+    const std::pair<absl::string_view, absl::string_view> bounds =
+        absl::StrSplit(range, absl::MaxSplits('-', 1));
+    int first, last;
+    if (ABSL_PREDICT_FALSE(!absl::SimpleAtoi(bounds.first, &first))) {
+      return false;
+    }
+    if (bounds.second.empty()) {
+      last = first;
+    } else if (ABSL_PREDICT_FALSE(!absl::SimpleAtoi(bounds.second, &last))) {
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(first < 0 || last < first)) return false;
+    for (int value = first; value <= last; ++value) values.push_back(value);
+  }
+  return true;
+}
+
+// Reads a Linux list of CPUs or nodes from `filename`.
+bool ReadList(const std::string& filename, std::vector<int>& values) {
+  std::ifstream file(filename);
+  std::string text;
+  if (ABSL_PREDICT_FALSE(!std::getline(file, text))) return false;
+  return ParseList(text, values);
+}
+
+// Returns CPUs of each NUMA node, or an empty vector if unknown.
+std::vector<std::vector<int>> NumaNodeCpus() {
+  std::vector<std::vector<int>> node_cpus;
+#ifdef __linux__
+  std::vector<int> nodes;
+  if (ABSL_PREDICT_FALSE(!ReadList("/sys/devices/system/node/online", nodes))) {
+    return node_cpus;
+  }
+  for (const int node : nodes) {
+    std::vector<int> cpus;
+    if (ABSL_PREDICT_FALSE(!ReadList(
+            absl::StrCat("/sys/devices/system/node/node", node, "/cpulist"),
+            cpus))) {
+      return std::vector<std::vector<int>>();
+    }
+    // A node can have memory without CPUs. It gets no pool.
+    if (!cpus.empty()) node_cpus.push_back(std::move(cpus));
+  }
+#endif
+  return node_cpus;
+}
+
+}  // namespace
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition at
+// namespace scope is required. Since C++17 these definitions are deprecated:
+// http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr uint64_t ThreadPool::kMaxBypassed;
+constexpr size_t ThreadPool::kNumPriorities;
+#endif
+
+ThreadPool::ThreadPool(Options options) : options_(std::move(options)) {}
 
 ThreadPool::~ThreadPool() {
   absl::MutexLock lock(&mutex_);
@@ -37,34 +134,94 @@ ThreadPool::~ThreadPool() {
       +[](size_t* num_threads) { return *num_threads == 0; }, &num_threads_));
 }
 
-void ThreadPool::Schedule(std::function<void()> task) {
-  {
-    absl::MutexLock lock(&mutex_);
-    RIEGELI_ASSERT(!exiting_)
-        << "Failed precondition of ThreadPool::Schedule(): no new threads may "
-           "be scheduled while the thread pool is exiting";
-    tasks_.push_back(std::move(task));
-    if (num_idle_threads_ >= tasks_.size()) return;
-    ++num_threads_;
+void ThreadPool::Schedule(std::function<void()> task, Priority priority,
+                          const void* tag) {
+  absl::MutexLock lock(&mutex_);
+  RIEGELI_ASSERT(!exiting_)
+      << "Failed precondition of ThreadPool::Schedule(): no new threads may "
+         "be scheduled while the thread pool is exiting";
+  tasks_[static_cast<size_t>(priority)].push_back(
+      Task{std::move(task), tag, num_tasks_started_});
+  ++num_tasks_;
+  if (num_idle_threads_ >= num_tasks_ ||
+      num_threads_ >= options_.max_threads()) {
+    return;
   }
-  std::thread([this] {
+  StartThread();
+}
+
+void ThreadPool::Boost(const void* tag) {
+  RIEGELI_ASSERT(tag != nullptr)
+      << "Failed precondition of ThreadPool::Boost(): null tag";
+  absl::MutexLock lock(&mutex_);
+  std::deque<Task>& high_tasks =
+      tasks_[static_cast<size_t>(Priority::kHigh)];
+  for (size_t priority = 0; priority < static_cast<size_t>(Priority::kHigh);
+       ++priority) {
+    std::deque<Task>& tasks = tasks_[priority];
+    std::deque<Task> remaining_tasks;
+    for (Task& task : tasks) {
+      if (task.tag == tag) {
+        high_tasks.push_back(std::move(task));
+      } else {
+        remaining_tasks.push_back(std::move(task));
+      }
+    }
+    tasks = std::move(remaining_tasks);
+  }
+}
+
+std::function<void()> ThreadPool::TakeTask() {
+  RIEGELI_ASSERT_GT(num_tasks_, 0u)
+      << "Failed precondition of ThreadPool::TakeTask(): no tasks";
+  size_t priority = kNumPriorities;
+  while (tasks_[priority - 1].empty()) --priority;
+  --priority;
+  // A task of lower priority which was bypassed too many times runs first,
+  // starting from the lowest priority.
+  for (size_t lower_priority = 0; lower_priority < priority;
+       ++lower_priority) {
+    if (!tasks_[lower_priority].empty() &&
+        num_tasks_started_ - tasks_[lower_priority].front().scheduled_at >=
+            kMaxBypassed) {
+      priority = lower_priority;
+      break;
+    }
+  }
+  std::function<void()> task = std::move(tasks_[priority].front().function);
+  tasks_[priority].pop_front();
+  --num_tasks_;
+  ++num_tasks_started_;
+  return task;
+}
+
+void ThreadPool::StartThread() {
+  ++num_threads_;
+  const int cpu = options_.cpu_affinity().empty()
+                      ? -1
+                      : options_.cpu_affinity()[num_threads_started_ %
+                                                options_.cpu_affinity().size()];
+  ++num_threads_started_;
+  std::thread([this, cpu] {
+    if (cpu >= 0) SetCpuAffinity(cpu);
     for (;;) {
       absl::ReleasableMutexLock lock(&mutex_);
       ++num_idle_threads_;
       mutex_.AwaitWithTimeout(
           absl::Condition(
               +[](ThreadPool* self) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
-                return !self->tasks_.empty() || self->exiting_;
+                return self->num_tasks_ > 0 || self->exiting_;
               },
               this),
           absl::Seconds(60));
       --num_idle_threads_;
-      if (tasks_.empty() || exiting_) {
+      // Tasks already scheduled are finished even when exiting, because with
+      // a thread count limit they might be queued rather than running.
+      if (num_tasks_ == 0) {
         --num_threads_;
         return;
       }
-      const std::function<void()> task = std::move(tasks_.front());
-      tasks_.pop_front();
+      const std::function<void()> task = TakeTask();
       lock.Release();
       task();
     }
@@ -76,5 +233,47 @@ ThreadPool& ThreadPool::global() {
   return *kStaticThreadPool;
 }
 
-}  // namespace internal
+NumaThreadPools::NumaThreadPools(ThreadPool::Options options) {
+  std::vector<std::vector<int>> node_cpus = NumaNodeCpus();
+  if (node_cpus.size() <= 1) {
+    // No NUMA, or unknown topology: binding would not help.
+    pools_.push_back(std::make_unique<ThreadPool>(std::move(options)));
+    return;
+  }
+  for (std::vector<int>& cpus : node_cpus) {
+    for (const int cpu : cpus) {
+      if (IntCast<size_t>(cpu) >= cpu_to_node_.size()) {
+        cpu_to_node_.resize(IntCast<size_t>(cpu) + 1, 0);
+      }
+      cpu_to_node_[IntCast<size_t>(cpu)] = pools_.size();
+    }
+    ThreadPool::Options node_options = options;
+    node_options.set_cpu_affinity(std::move(cpus));
+    pools_.push_back(std::make_unique<ThreadPool>(std::move(node_options)));
+  }
+}
+
+size_t NumaThreadPools::CurrentNode() const {
+#ifdef __linux__
+  if (cpu_to_node_.empty()) return 0;
+  const int cpu = sched_getcpu();
+  if (ABSL_PREDICT_FALSE(cpu < 0 ||
+                         IntCast<size_t>(cpu) >= cpu_to_node_.size())) {
+    return 0;
+  }
+  return cpu_to_node_[IntCast<size_t>(cpu)];
+#else
+  return 0;
+#endif
+}
+
+void NumaThreadPools::Boost(const void* tag) const {
+  for (const std::unique_ptr<ThreadPool>& pool : pools_) pool->Boost(tag);
+}
+
+NumaThreadPools& NumaThreadPools::global() {
+  static NoDestructor<NumaThreadPools> kStaticNumaThreadPools;
+  return *kStaticNumaThreadPools;
+}
+
 }  // namespace riegeli
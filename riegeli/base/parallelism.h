@@ -16,40 +16,193 @@
 #define RIEGELI_BASE_PARALLELISM_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <deque>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
 
 namespace riegeli {
-namespace internal {
 
-// A thread pool with lazily created worker threads, without a thread count
-// limit. Worker threads exit after being idle for one minute.
+// A thread pool with lazily created worker threads. Worker threads exit after
+// being idle for one minute.
+//
+// If the number of threads is limited, a task waiting for another task
+// scheduled on the same pool can deadlock.
+//
+// When tasks wait in a queue, tasks of higher priority run first. A task which
+// has waited while `kMaxBypassed` other tasks started runs next regardless of
+// priority, so that tasks of lower priority are not starved.
 class ThreadPool {
  public:
-  ThreadPool() {}
+  enum class Priority {
+    // Bulk work which can be delayed, e.g. a background export.
+    kLow,
+    kNormal,
+    // Work which somebody is waiting for.
+    kHigh,
+  };
+
+  // How many tasks may start before a waiting task, regardless of priority.
+  static constexpr uint64_t kMaxBypassed = 16;
+
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the maximum number of worker threads. When all of them are busy,
+    // tasks wait in a queue.
+    //
+    // Default: no limit.
+    Options& set_max_threads(size_t max_threads) & {
+      RIEGELI_ASSERT_GT(max_threads, 0u)
+          << "Failed precondition of ThreadPool::Options::set_max_threads(): "
+             "zero threads";
+      max_threads_ = max_threads;
+      return *this;
+    }
+    Options&& set_max_threads(size_t max_threads) && {
+      return std::move(set_max_threads(max_threads));
+    }
+    size_t max_threads() const { return max_threads_; }
+
+    // Sets CPUs to bind worker threads to, as a hint. Consecutive worker
+    // threads are bound to consecutive CPUs from the list, cyclically.
+    //
+    // This is supported only on Linux, and failures are ignored.
+    //
+    // Default: empty (no binding).
+    Options& set_cpu_affinity(std::vector<int> cpu_affinity) & {
+      cpu_affinity_ = std::move(cpu_affinity);
+      return *this;
+    }
+    Options&& set_cpu_affinity(std::vector<int> cpu_affinity) && {
+      return std::move(set_cpu_affinity(std::move(cpu_affinity)));
+    }
+    std::vector<int>& cpu_affinity() { return cpu_affinity_; }
+    const std::vector<int>& cpu_affinity() const { return cpu_affinity_; }
+
+   private:
+    size_t max_threads_ = std::numeric_limits<size_t>::max();
+    std::vector<int> cpu_affinity_;
+  };
+
+  explicit ThreadPool(Options options = Options());
 
   ThreadPool(const ThreadPool&) = delete;
   ThreadPool& operator=(const ThreadPool&) = delete;
 
+  // Waits for worker threads to exit, after they finish tasks already
+  // scheduled.
   ~ThreadPool();
 
+  // Returns a process-wide thread pool without a thread count limit.
   static ThreadPool& global();
 
-  void Schedule(std::function<void()> task);
+  // Schedules `task` to run in a worker thread.
+  //
+  // If `tag` is not `nullptr`, `Boost(tag)` can raise the priority of `task`
+  // while it waits in the queue.
+  void Schedule(std::function<void()> task,
+                Priority priority = Priority::kNormal,
+                const void* tag = nullptr);
+
+  // Raises the priority of tasks scheduled with `tag` which have not started
+  // yet to `Priority::kHigh`, keeping their relative order.
+  //
+  // This is meant for a caller which is about to wait for these tasks, e.g. in
+  // `Flush()`.
+  void Boost(const void* tag);
 
  private:
+  static constexpr size_t kNumPriorities = 3;
+
+  struct Task {
+    std::function<void()> function;
+    const void* tag;
+    // `num_tasks_started_` when the task was scheduled.
+    uint64_t scheduled_at;
+  };
+
+  void StartThread() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes and returns the next task to run.
+  //
+  // Precondition: `num_tasks_ > 0`
+  std::function<void()> TakeTask() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const Options options_;
   absl::Mutex mutex_;
   bool exiting_ ABSL_GUARDED_BY(mutex_) = false;
   size_t num_threads_ ABSL_GUARDED_BY(mutex_) = 0;
   size_t num_idle_threads_ ABSL_GUARDED_BY(mutex_) = 0;
-  std::deque<std::function<void()>> tasks_ ABSL_GUARDED_BY(mutex_);
+  // Used for `Options::cpu_affinity()`.
+  size_t num_threads_started_ ABSL_GUARDED_BY(mutex_) = 0;
+  // Waiting tasks, indexed by `Priority`.
+  std::deque<Task> tasks_[kNumPriorities] ABSL_GUARDED_BY(mutex_);
+  // Total size of `tasks_`.
+  size_t num_tasks_ ABSL_GUARDED_BY(mutex_) = 0;
+  uint64_t num_tasks_started_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+// Thread pools for NUMA nodes, one per node, with worker threads bound to CPUs
+// of their node.
+//
+// Running a task on the pool of the node where its data were produced keeps
+// memory accesses node-local: the data are read on the same node, and memory
+// which the task allocates and touches first is placed on that node by the
+// default memory policy.
+//
+// NUMA nodes are discovered from `/sys/devices/system/node` on Linux.
+// Otherwise, or if discovery fails, there is a single pool without CPU binding.
+class NumaThreadPools {
+ public:
+  // `options` apply to the pool of each node, except that
+  // `ThreadPool::Options::cpu_affinity()` is replaced with CPUs of the node.
+  explicit NumaThreadPools(ThreadPool::Options options = ThreadPool::Options());
+
+  NumaThreadPools(const NumaThreadPools&) = delete;
+  NumaThreadPools& operator=(const NumaThreadPools&) = delete;
+
+  // Returns process-wide thread pools without a thread count limit.
+  static NumaThreadPools& global();
+
+  // Returns the number of NUMA nodes, at least 1.
+  size_t num_nodes() const { return pools_.size(); }
+
+  // Returns the index of the NUMA node of the CPU the current thread is running
+  // on, or 0 if this is unknown.
+  size_t CurrentNode() const;
+
+  // Returns the pool of the given NUMA node.
+  //
+  // Precondition: `node < num_nodes()`
+  ThreadPool& pool(size_t node) const {
+    RIEGELI_ASSERT_LT(node, pools_.size())
+        << "Failed precondition of NumaThreadPools::pool(): "
+           "node index out of range";
+    return *pools_[node];
+  }
+
+  // Returns the pool of the NUMA node the current thread is running on.
+  ThreadPool& ForCurrentNode() const { return pool(CurrentNode()); }
+
+  // Calls `ThreadPool::Boost(tag)` for the pool of each node.
+  void Boost(const void* tag) const;
+
+ private:
+  std::vector<std::unique_ptr<ThreadPool>> pools_;
+  // Maps a CPU number to an index in `pools_`.
+  std::vector<size_t> cpu_to_node_;
 };
 
-}  // namespace internal
 }  // namespace riegeli
 
 #endif  // RIEGELI_BASE_PARALLELISM_H_
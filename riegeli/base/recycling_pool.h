@@ -16,11 +16,13 @@
 #define RIEGELI_BASE_RECYCLING_POOL_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <atomic>
 #include <deque>
 #include <list>
 #include <memory>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -28,11 +30,117 @@
 #include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/memory.h"
 
 namespace riegeli {
 
+// Counters describing the effectiveness of a `RecyclingPool` or
+// `KeyedRecyclingPool`, returned by their `stats()`.
+struct RecyclingPoolStats {
+  // Number of `Get()` calls which returned an existing object.
+  size_t num_recycled = 0;
+  // Number of `Get()` calls which created a new object.
+  size_t num_created = 0;
+  // Number of objects deleted because the pool was full.
+  size_t num_evicted = 0;
+  // Number of objects deleted because they were idle longer than
+  // `RecyclingPoolOptions::max_age()`.
+  size_t num_expired = 0;
+  // Number of idle objects currently kept in the pool.
+  size_t num_idle = 0;
+};
+
+// Options for `RecyclingPool` and `KeyedRecyclingPool`.
+//
+// Idle objects are kept in shards, each used by a subset of threads, in front
+// of a part shared by all threads. A thread takes an object from its shard
+// before trying the shared part, and an object which does not fit in the shard
+// moves to the shared part. Shards avoid contention on the shared part when
+// many threads use the pool.
+class RecyclingPoolOptions {
+ public:
+  // The default value of `max_size()`.
+  static constexpr size_t kDefaultMaxSize = 16;
+  // The default value of `shard_size()`.
+  static constexpr size_t kDefaultShardSize = 2;
+
+  RecyclingPoolOptions() noexcept {}
+
+  // Maximum number of idle objects kept in the shared part.
+  //
+  // Default: `kDefaultMaxSize` (16).
+  RecyclingPoolOptions& set_max_size(size_t max_size) & {
+    max_size_ = max_size;
+    return *this;
+  }
+  RecyclingPoolOptions&& set_max_size(size_t max_size) && {
+    return std::move(set_max_size(max_size));
+  }
+  size_t max_size() const { return max_size_; }
+
+  // Maximum number of idle objects kept in each shard.
+  //
+  // There is a shard per hardware thread, up to 64. Threads are assigned to
+  // shards round-robin, so that with few enough threads each thread has its
+  // own shard.
+  //
+  // `0` disables shards.
+  //
+  // Default: `kDefaultShardSize` (2).
+  RecyclingPoolOptions& set_shard_size(size_t shard_size) & {
+    shard_size_ = shard_size;
+    return *this;
+  }
+  RecyclingPoolOptions&& set_shard_size(size_t shard_size) && {
+    return std::move(set_shard_size(shard_size));
+  }
+  size_t shard_size() const { return shard_size_; }
+
+  // Idle objects kept longer than `max_age` are deleted when an object is next
+  // put into their shard or the shared part. Objects moved to the shared part
+  // keep their age, so the order of deletion is approximate.
+  //
+  // Default: `absl::InfiniteDuration()`.
+  RecyclingPoolOptions& set_max_age(absl::Duration max_age) & {
+    max_age_ = max_age;
+    return *this;
+  }
+  RecyclingPoolOptions&& set_max_age(absl::Duration max_age) && {
+    return std::move(set_max_age(max_age));
+  }
+  absl::Duration max_age() const { return max_age_; }
+
+ private:
+  size_t max_size_ = kDefaultMaxSize;
+  size_t shard_size_ = kDefaultShardSize;
+  absl::Duration max_age_ = absl::InfiniteDuration();
+};
+
+namespace internal {
+
+// Returns the number of shards of a `RecyclingPool` or `KeyedRecyclingPool`.
+inline size_t RecyclingPoolNumShards() {
+  static const size_t kNumShards = UnsignedMin(
+      UnsignedMax(size_t{std::thread::hardware_concurrency()}, size_t{1}),
+      size_t{64});
+  return kNumShards;
+}
+
+// Returns the index of the shard of a `RecyclingPool` or `KeyedRecyclingPool`
+// assigned to the current thread.
+inline size_t RecyclingPoolShardIndex() {
+  static std::atomic<size_t> next_index{0};
+  thread_local const size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed) %
+      RecyclingPoolNumShards();
+  return index;
+}
+
+}  // namespace internal
+
 // `RecyclingPool<T, Deleter>` keeps a pool of idle objects of type `T`, so that
 // instead of creating a new object of type `T`, an existing object can be
 // recycled. This is helpful if constructing a new object is more expensive than
@@ -78,12 +186,16 @@ class RecyclingPool {
     void operator()(T* ptr) const {}
   };
 
-  // The default value of the constructor argument.
-  static constexpr size_t kDefaultMaxSize = 16;
+  // The default value of `RecyclingPoolOptions::max_size()`.
+  static constexpr size_t kDefaultMaxSize =
+      RecyclingPoolOptions::kDefaultMaxSize;
+
+  explicit RecyclingPool(RecyclingPoolOptions options = RecyclingPoolOptions());
 
-  // Creates a pool with the given maximum number of objects to keep.
-  explicit RecyclingPool(size_t max_size = kDefaultMaxSize)
-      : max_size_(max_size) {}
+  // Creates a pool with the given maximum number of objects in the shared
+  // part, and default other options.
+  explicit RecyclingPool(size_t max_size)
+      : RecyclingPool(RecyclingPoolOptions().set_max_size(max_size)) {}
 
   RecyclingPool(const RecyclingPool&) = delete;
   RecyclingPool& operator=(const RecyclingPool&) = delete;
@@ -91,9 +203,10 @@ class RecyclingPool {
   // Returns a default global pool specific to template parameters of
   // `RecyclingPool`.
   //
-  // If called multiple times with different `max_size` arguments, the last
-  // `max_size` is in effect.
-  static RecyclingPool& global(size_t max_size = kDefaultMaxSize);
+  // If called multiple times with different `options`, the last `options` are
+  // in effect.
+  static RecyclingPool& global(
+      RecyclingPoolOptions options = RecyclingPoolOptions());
 
   // Creates an object, or returns an existing object from the pool if possible.
   //
@@ -105,15 +218,46 @@ class RecyclingPool {
   template <typename Factory, typename Refurbisher = DefaultRefurbisher>
   Handle Get(Factory factory, Refurbisher refurbisher = DefaultRefurbisher());
 
+  // Returns counters describing how objects were obtained by `Get()` since the
+  // pool was created.
+  RecyclingPoolStats stats() const;
+
  private:
-  void set_max_size(size_t max_size);
+  struct Entry {
+    std::unique_ptr<T, Deleter> object;
+    // When the object became idle.
+    absl::Time time;
+  };
+
+  // A shard or the shared part.
+  struct Part {
+    mutable absl::Mutex mutex;
+    // Idle objects, ordered by freshness (older to newer).
+    std::deque<Entry> by_freshness ABSL_GUARDED_BY(mutex);
+  };
+
+  void set_options(const RecyclingPoolOptions& options);
+
+  Part& shard() { return *shards_[internal::RecyclingPoolShardIndex()]; }
 
   void Put(std::unique_ptr<T, Deleter> object);
 
+  // Moves objects of `part` idle longer than `max_age` to `expired`.
+  static void RemoveExpired(Part& part, absl::Time now, absl::Duration max_age,
+                            std::vector<std::unique_ptr<T, Deleter>>& expired)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(part.mutex);
+
   std::atomic<size_t> max_size_;
-  absl::Mutex mutex_;
-  // All objects, ordered by freshness (older to newer).
-  std::deque<std::unique_ptr<T, Deleter>> by_freshness_ ABSL_GUARDED_BY(mutex_);
+  std::atomic<size_t> shard_size_;
+  std::atomic<int64_t> max_age_ns_;
+  std::atomic<size_t> num_recycled_{0};
+  std::atomic<size_t> num_created_{0};
+  std::atomic<size_t> num_evicted_{0};
+  std::atomic<size_t> num_expired_{0};
+  // Elements are wrapped in `std::unique_ptr` so that shards are allocated
+  // separately, which keeps their mutexes apart.
+  std::vector<std::unique_ptr<Part>> shards_;
+  Part shared_;
 };
 
 // `KeyedRecyclingPool<T, Key, Deleter>` keeps a pool of idle objects of type
@@ -167,12 +311,17 @@ class KeyedRecyclingPool {
     void operator()(T* ptr) const {}
   };
 
-  // The default value of the constructor argument.
-  static constexpr size_t kDefaultMaxSize = 16;
+  // The default value of `RecyclingPoolOptions::max_size()`.
+  static constexpr size_t kDefaultMaxSize =
+      RecyclingPoolOptions::kDefaultMaxSize;
 
-  // Creates a pool with the given maximum number of objects to keep.
-  explicit KeyedRecyclingPool(size_t max_size = kDefaultMaxSize)
-      : max_size_(max_size), cache_(by_key_.end()) {}
+  explicit KeyedRecyclingPool(
+      RecyclingPoolOptions options = RecyclingPoolOptions());
+
+  // Creates a pool with the given maximum number of objects in the shared
+  // part, and default other options.
+  explicit KeyedRecyclingPool(size_t max_size)
+      : KeyedRecyclingPool(RecyclingPoolOptions().set_max_size(max_size)) {}
 
   KeyedRecyclingPool(const KeyedRecyclingPool&) = delete;
   KeyedRecyclingPool& operator=(const KeyedRecyclingPool&) = delete;
@@ -180,9 +329,10 @@ class KeyedRecyclingPool {
   // Returns a default global pool specific to template parameters of
   // `KeyedRecyclingPool`.
   //
-  // If called multiple times with different `max_size` arguments, the last
-  // `max_size` is in effect.
-  static KeyedRecyclingPool& global(size_t max_size = kDefaultMaxSize);
+  // If called multiple times with different `options`, the last `options` are
+  // in effect.
+  static KeyedRecyclingPool& global(
+      RecyclingPoolOptions options = RecyclingPoolOptions());
 
   // Creates an object, or returns an existing object from the pool if possible.
   //
@@ -195,46 +345,105 @@ class KeyedRecyclingPool {
   Handle Get(Key key, Factory factory,
              Refurbisher refurbisher = DefaultRefurbisher());
 
- private:
-  // Adding or removing elements in `ByFreshness` must not invalidate other
-  // iterators.
-  using ByFreshness = std::list<Key>;
-
-  struct Entry {
-    Entry(std::unique_ptr<T, Deleter> object,
-          typename ByFreshness::iterator by_freshness_iter)
-        : object(std::move(object)), by_freshness_iter(by_freshness_iter) {}
+  // Returns counters describing how objects were obtained by `Get()` since the
+  // pool was created.
+  RecyclingPoolStats stats() const;
 
+ private:
+  // An object removed from a `Part` because it did not fit there.
+  struct Excess {
+    Key key;
     std::unique_ptr<T, Deleter> object;
-    typename ByFreshness::iterator by_freshness_iter;
+    absl::Time time;
   };
 
-  // `std::list` has a smaller overhead than `std::deque` for short sequences.
-  using Entries = std::list<Entry>;
+  // A shard or the shared part.
+  class Part {
+   public:
+    Part() : cache_(by_key_.end()) {}
+
+    Part(const Part&) = delete;
+    Part& operator=(const Part&) = delete;
+
+    // Returns the newest object with `key`, or `nullptr` if there is none.
+    std::unique_ptr<T, Deleter> Get(const Key& key);
+
+    // Adds `object` with `key` which became idle at `time`. Moves objects
+    // beyond `max_size` to `excess`, and objects idle longer than `max_age` to
+    // `expired`.
+    void Put(const Key& key, std::unique_ptr<T, Deleter> object,
+             absl::Time time, absl::Time now, size_t max_size,
+             absl::Duration max_age, std::vector<Excess>& excess,
+             std::vector<std::unique_ptr<T, Deleter>>& expired);
+
+    size_t num_idle() const;
 
-  using ByKey = absl::flat_hash_map<Key, Entries>;
+   private:
+    struct Freshness {
+      Key key;
+      // When the object became idle.
+      absl::Time time;
+    };
+
+    // Adding or removing elements in `ByFreshness` must not invalidate other
+    // iterators.
+    using ByFreshness = std::list<Freshness>;
+
+    struct Entry {
+      Entry(std::unique_ptr<T, Deleter> object,
+            typename ByFreshness::iterator by_freshness_iter)
+          : object(std::move(object)), by_freshness_iter(by_freshness_iter) {}
+
+      std::unique_ptr<T, Deleter> object;
+      typename ByFreshness::iterator by_freshness_iter;
+    };
+
+    // `std::list` has a smaller overhead than `std::deque` for short
+    // sequences.
+    using Entries = std::list<Entry>;
+
+    using ByKey = absl::flat_hash_map<Key, Entries>;
+
+    void FinishErasingCached() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+    mutable absl::Mutex mutex_;
+    // The key and time of each object, ordered by the freshness of the object
+    // (older to newer).
+    ByFreshness by_freshness_ ABSL_GUARDED_BY(mutex_);
+    // Objects grouped by their keys. Within each map value the list of objects
+    // is non-empty and is ordered by their freshness (older to newer). Each
+    // object is associated with the matching `by_freshness_` iterator.
+    ByKey by_key_ ABSL_GUARDED_BY(mutex_);
+    // Optimization for `Get()` followed by `Put()` with a matching key.
+    // If `cache_ != by_key_.end()`, then `cache_->second.back().object` is
+    // replaced with `nullptr` instead of erasing its entries.
+    typename ByKey::iterator cache_ ABSL_GUARDED_BY(mutex_);
+  };
 
-  void set_max_size(size_t max_size);
+  void set_options(const RecyclingPoolOptions& options);
+
+  Part& shard() { return *shards_[internal::RecyclingPoolShardIndex()]; }
 
   void Put(const Key& key, std::unique_ptr<T, Deleter> object);
 
   std::atomic<size_t> max_size_;
-  absl::Mutex mutex_;
-  // The key of each object, ordered by the freshness of the object (older to
-  // newer).
-  ByFreshness by_freshness_ ABSL_GUARDED_BY(mutex_);
-  // Objects grouped by their keys. Within each map value the list of objects is
-  // non-empty and is ordered by their freshness (older to newer). Each object
-  // is associated with the matching `by_freshness_` iterator.
-  ByKey by_key_ ABSL_GUARDED_BY(mutex_);
-  // Optimization for `Get()` followed by `Put()` with a matching key.
-  // If `cache_ != by_key_.end()`, then `cache_->second.back().object` is
-  // replaced with `nullptr` instead of erasing its entries.
-  typename ByKey::iterator cache_ ABSL_GUARDED_BY(mutex_);
+  std::atomic<size_t> shard_size_;
+  std::atomic<int64_t> max_age_ns_;
+  std::atomic<size_t> num_recycled_{0};
+  std::atomic<size_t> num_created_{0};
+  std::atomic<size_t> num_evicted_{0};
+  std::atomic<size_t> num_expired_{0};
+  // Elements are wrapped in `std::unique_ptr` so that shards are allocated
+  // separately, which keeps their mutexes apart.
+  std::vector<std::unique_ptr<Part>> shards_;
+  Part shared_;
 };
 
 // Implementation details follow.
 
+template <typename T, typename Deleter>
+constexpr size_t RecyclingPool<T, Deleter>::kDefaultMaxSize;
+
 template <typename T, typename Deleter>
 inline void RecyclingPool<T, Deleter>::Recycler::operator()(T* ptr) const {
   RIEGELI_ASSERT(pool_ != nullptr)
@@ -244,15 +453,31 @@ inline void RecyclingPool<T, Deleter>::Recycler::operator()(T* ptr) const {
 }
 
 template <typename T, typename Deleter>
-RecyclingPool<T, Deleter>& RecyclingPool<T, Deleter>::global(size_t max_size) {
-  static NoDestructor<RecyclingPool> kStaticRecyclingPool(max_size);
-  kStaticRecyclingPool->set_max_size(max_size);
+RecyclingPool<T, Deleter>::RecyclingPool(RecyclingPoolOptions options)
+    : max_size_(options.max_size()),
+      shard_size_(options.shard_size()),
+      max_age_ns_(absl::ToInt64Nanoseconds(options.max_age())) {
+  shards_.reserve(internal::RecyclingPoolNumShards());
+  for (size_t i = 0; i < internal::RecyclingPoolNumShards(); ++i) {
+    shards_.push_back(std::make_unique<Part>());
+  }
+}
+
+template <typename T, typename Deleter>
+RecyclingPool<T, Deleter>& RecyclingPool<T, Deleter>::global(
+    RecyclingPoolOptions options) {
+  static NoDestructor<RecyclingPool> kStaticRecyclingPool(options);
+  kStaticRecyclingPool->set_options(options);
   return *kStaticRecyclingPool;
 }
 
 template <typename T, typename Deleter>
-inline void RecyclingPool<T, Deleter>::set_max_size(size_t max_size) {
-  max_size_.store(max_size, std::memory_order_relaxed);
+inline void RecyclingPool<T, Deleter>::set_options(
+    const RecyclingPoolOptions& options) {
+  max_size_.store(options.max_size(), std::memory_order_relaxed);
+  shard_size_.store(options.shard_size(), std::memory_order_relaxed);
+  max_age_ns_.store(absl::ToInt64Nanoseconds(options.max_age()),
+                    std::memory_order_relaxed);
 }
 
 template <typename T, typename Deleter>
@@ -260,38 +485,104 @@ template <typename Factory, typename Refurbisher>
 typename RecyclingPool<T, Deleter>::Handle RecyclingPool<T, Deleter>::Get(
     Factory factory, Refurbisher refurbisher) {
   std::unique_ptr<T, Deleter> returned;
-  {
-    absl::MutexLock lock(&mutex_);
-    if (ABSL_PREDICT_TRUE(!by_freshness_.empty())) {
-      // Return the newest entry.
-      returned = std::move(by_freshness_.back());
-      by_freshness_.pop_back();
+  if (shard_size_.load(std::memory_order_relaxed) > 0) {
+    Part& part = shard();
+    absl::MutexLock lock(&part.mutex);
+    if (ABSL_PREDICT_TRUE(!part.by_freshness.empty())) {
+      // Return the newest entry of the shard.
+      returned = std::move(part.by_freshness.back().object);
+      part.by_freshness.pop_back();
+    }
+  }
+  if (returned == nullptr) {
+    absl::MutexLock lock(&shared_.mutex);
+    if (ABSL_PREDICT_TRUE(!shared_.by_freshness.empty())) {
+      // Return the newest entry of the shared part.
+      returned = std::move(shared_.by_freshness.back().object);
+      shared_.by_freshness.pop_back();
     }
   }
   if (ABSL_PREDICT_TRUE(returned != nullptr)) {
+    num_recycled_.fetch_add(1, std::memory_order_relaxed);
     refurbisher(returned.get());
   } else {
+    num_created_.fetch_add(1, std::memory_order_relaxed);
     returned = factory();
   }
   return Handle(returned.release(),
                 Recycler(this, std::move(returned.get_deleter())));
 }
 
+template <typename T, typename Deleter>
+RecyclingPoolStats RecyclingPool<T, Deleter>::stats() const {
+  RecyclingPoolStats stats;
+  stats.num_recycled = num_recycled_.load(std::memory_order_relaxed);
+  stats.num_created = num_created_.load(std::memory_order_relaxed);
+  stats.num_evicted = num_evicted_.load(std::memory_order_relaxed);
+  stats.num_expired = num_expired_.load(std::memory_order_relaxed);
+  for (const std::unique_ptr<Part>& part : shards_) {
+    absl::MutexLock lock(&part->mutex);
+    stats.num_idle += part->by_freshness.size();
+  }
+  absl::MutexLock lock(&shared_.mutex);
+  stats.num_idle += shared_.by_freshness.size();
+  return stats;
+}
+
 template <typename T, typename Deleter>
 void RecyclingPool<T, Deleter>::Put(std::unique_ptr<T, Deleter> object) {
+  const absl::Time now = absl::Now();
+  const absl::Duration max_age =
+      absl::Nanoseconds(max_age_ns_.load(std::memory_order_relaxed));
+  // Objects to delete after releasing mutexes.
+  std::vector<std::unique_ptr<T, Deleter>> expired;
   std::vector<std::unique_ptr<T, Deleter>> evicted;
-  absl::MutexLock lock(&mutex_);
-  // Add a newest entry.
-  by_freshness_.push_back(std::move(object));
-  while (ABSL_PREDICT_FALSE(by_freshness_.size() >
-                            max_size_.load(std::memory_order_relaxed))) {
-    // Evict the oldest entry.
-    evicted.push_back(std::move(by_freshness_.front()));
-    by_freshness_.pop_front();
+  Entry entry{std::move(object), now};
+  const size_t shard_size = shard_size_.load(std::memory_order_relaxed);
+  if (shard_size > 0) {
+    Part& part = shard();
+    absl::MutexLock lock(&part.mutex);
+    // Add a newest entry to the shard.
+    part.by_freshness.push_back(std::move(entry));
+    RemoveExpired(part, now, max_age, expired);
+    if (ABSL_PREDICT_TRUE(part.by_freshness.size() <= shard_size)) {
+      num_expired_.fetch_add(expired.size(), std::memory_order_relaxed);
+      return;
+    }
+    // Move the oldest entry of the shard to the shared part.
+    entry = std::move(part.by_freshness.front());
+    part.by_freshness.pop_front();
+  }
+  {
+    absl::MutexLock lock(&shared_.mutex);
+    // Add a newest entry to the shared part.
+    shared_.by_freshness.push_back(std::move(entry));
+    RemoveExpired(shared_, now, max_age, expired);
+    while (ABSL_PREDICT_FALSE(shared_.by_freshness.size() >
+                              max_size_.load(std::memory_order_relaxed))) {
+      // Evict the oldest entry.
+      evicted.push_back(std::move(shared_.by_freshness.front().object));
+      shared_.by_freshness.pop_front();
+    }
+  }
+  num_expired_.fetch_add(expired.size(), std::memory_order_relaxed);
+  num_evicted_.fetch_add(evicted.size(), std::memory_order_relaxed);
+}
+
+template <typename T, typename Deleter>
+inline void RecyclingPool<T, Deleter>::RemoveExpired(
+    Part& part, absl::Time now, absl::Duration max_age,
+    std::vector<std::unique_ptr<T, Deleter>>& expired) {
+  while (ABSL_PREDICT_FALSE(!part.by_freshness.empty() &&
+                            now - part.by_freshness.front().time > max_age)) {
+    expired.push_back(std::move(part.by_freshness.front().object));
+    part.by_freshness.pop_front();
   }
-  // Destroy `evicted` after releasing `mutex_`.
 }
 
+template <typename T, typename Key, typename Deleter>
+constexpr size_t KeyedRecyclingPool<T, Key, Deleter>::kDefaultMaxSize;
+
 template <typename T, typename Key, typename Deleter>
 inline void KeyedRecyclingPool<T, Key, Deleter>::Recycler::operator()(
     T* ptr) const {
@@ -301,17 +592,33 @@ inline void KeyedRecyclingPool<T, Key, Deleter>::Recycler::operator()(
   pool_->Put(key_, std::unique_ptr<T, Deleter>(ptr, original_deleter()));
 }
 
+template <typename T, typename Key, typename Deleter>
+KeyedRecyclingPool<T, Key, Deleter>::KeyedRecyclingPool(
+    RecyclingPoolOptions options)
+    : max_size_(options.max_size()),
+      shard_size_(options.shard_size()),
+      max_age_ns_(absl::ToInt64Nanoseconds(options.max_age())) {
+  shards_.reserve(internal::RecyclingPoolNumShards());
+  for (size_t i = 0; i < internal::RecyclingPoolNumShards(); ++i) {
+    shards_.push_back(std::make_unique<Part>());
+  }
+}
+
 template <typename T, typename Key, typename Deleter>
 KeyedRecyclingPool<T, Key, Deleter>&
-KeyedRecyclingPool<T, Key, Deleter>::global(size_t max_size) {
-  static NoDestructor<KeyedRecyclingPool> kStaticKeyedRecyclingPool(max_size);
-  kStaticKeyedRecyclingPool->set_max_size(max_size);
+KeyedRecyclingPool<T, Key, Deleter>::global(RecyclingPoolOptions options) {
+  static NoDestructor<KeyedRecyclingPool> kStaticKeyedRecyclingPool(options);
+  kStaticKeyedRecyclingPool->set_options(options);
   return *kStaticKeyedRecyclingPool;
 }
 
 template <typename T, typename Key, typename Deleter>
-inline void KeyedRecyclingPool<T, Key, Deleter>::set_max_size(size_t max_size) {
-  max_size_.store(max_size, std::memory_order_relaxed);
+inline void KeyedRecyclingPool<T, Key, Deleter>::set_options(
+    const RecyclingPoolOptions& options) {
+  max_size_.store(options.max_size(), std::memory_order_relaxed);
+  shard_size_.store(options.shard_size(), std::memory_order_relaxed);
+  max_age_ns_.store(absl::ToInt64Nanoseconds(options.max_age()),
+                    std::memory_order_relaxed);
 }
 
 template <typename T, typename Key, typename Deleter>
@@ -320,38 +627,15 @@ typename KeyedRecyclingPool<T, Key, Deleter>::Handle
 KeyedRecyclingPool<T, Key, Deleter>::Get(Key key, Factory factory,
                                          Refurbisher refurbisher) {
   std::unique_ptr<T, Deleter> returned;
-  {
-    absl::MutexLock lock(&mutex_);
-    if (cache_ != by_key_.end()) {
-      // Finish erasing the cached entry.
-      Entries& entries = cache_->second;
-      RIEGELI_ASSERT(!entries.empty())
-          << "Failed invariant of KeyedRecyclingPool: "
-             "empty by_key_ value";
-      RIEGELI_ASSERT(entries.back().object == nullptr)
-          << "Failed invariant of KeyedRecyclingPool: "
-             "non-nullptr object pointed to by cache_";
-      by_freshness_.erase(entries.back().by_freshness_iter);
-      entries.pop_back();
-      if (entries.empty()) by_key_.erase(cache_);
-    }
-    const typename ByKey::iterator by_key_iter = by_key_.find(key);
-    if (ABSL_PREDICT_TRUE(by_key_iter != by_key_.end())) {
-      // Return the newest entry with this key.
-      Entries& entries = by_key_iter->second;
-      RIEGELI_ASSERT(!entries.empty())
-          << "Failed invariant of KeyedRecyclingPool: "
-             "empty by_key_ value";
-      RIEGELI_ASSERT(entries.back().object != nullptr)
-          << "Failed invariant of KeyedRecyclingPool: "
-             "nullptr object not pointed to by cache_";
-      returned = std::move(entries.back().object);
-    }
-    cache_ = by_key_iter;
+  if (shard_size_.load(std::memory_order_relaxed) > 0) {
+    returned = shard().Get(key);
   }
+  if (returned == nullptr) returned = shared_.Get(key);
   if (ABSL_PREDICT_TRUE(returned != nullptr)) {
+    num_recycled_.fetch_add(1, std::memory_order_relaxed);
     refurbisher(returned.get());
   } else {
+    num_created_.fetch_add(1, std::memory_order_relaxed);
     returned = factory();
   }
   return Handle(
@@ -359,41 +643,125 @@ KeyedRecyclingPool<T, Key, Deleter>::Get(Key key, Factory factory,
       Recycler(this, std::move(key), std::move(returned.get_deleter())));
 }
 
+template <typename T, typename Key, typename Deleter>
+RecyclingPoolStats KeyedRecyclingPool<T, Key, Deleter>::stats() const {
+  RecyclingPoolStats stats;
+  stats.num_recycled = num_recycled_.load(std::memory_order_relaxed);
+  stats.num_created = num_created_.load(std::memory_order_relaxed);
+  stats.num_evicted = num_evicted_.load(std::memory_order_relaxed);
+  stats.num_expired = num_expired_.load(std::memory_order_relaxed);
+  for (const std::unique_ptr<Part>& part : shards_) {
+    stats.num_idle += part->num_idle();
+  }
+  stats.num_idle += shared_.num_idle();
+  return stats;
+}
+
 template <typename T, typename Key, typename Deleter>
 void KeyedRecyclingPool<T, Key, Deleter>::Put(
     const Key& key, std::unique_ptr<T, Deleter> object) {
-  std::vector<std::unique_ptr<T, Deleter>> evicted;
+  const absl::Time now = absl::Now();
+  const absl::Duration max_age =
+      absl::Nanoseconds(max_age_ns_.load(std::memory_order_relaxed));
+  const size_t max_size = max_size_.load(std::memory_order_relaxed);
+  // Objects to delete after releasing mutexes.
+  std::vector<std::unique_ptr<T, Deleter>> expired;
+  std::vector<Excess> excess;
+  const size_t shard_size = shard_size_.load(std::memory_order_relaxed);
+  if (shard_size > 0) {
+    shard().Put(key, std::move(object), now, now, shard_size, max_age, excess,
+                expired);
+    // Move entries which did not fit in the shard to the shared part.
+    std::vector<Excess> shard_excess = std::move(excess);
+    excess.clear();
+    for (Excess& entry : shard_excess) {
+      shared_.Put(entry.key, std::move(entry.object), entry.time, now,
+                  max_size, max_age, excess, expired);
+    }
+  } else {
+    shared_.Put(key, std::move(object), now, now, max_size, max_age, excess,
+                expired);
+  }
+  num_expired_.fetch_add(expired.size(), std::memory_order_relaxed);
+  num_evicted_.fetch_add(excess.size(), std::memory_order_relaxed);
+}
+
+template <typename T, typename Key, typename Deleter>
+inline void KeyedRecyclingPool<T, Key, Deleter>::Part::FinishErasingCached() {
+  if (cache_ == by_key_.end()) return;
+  Entries& entries = cache_->second;
+  RIEGELI_ASSERT(!entries.empty())
+      << "Failed invariant of KeyedRecyclingPool: "
+         "empty by_key_ value";
+  RIEGELI_ASSERT(entries.back().object == nullptr)
+      << "Failed invariant of KeyedRecyclingPool: "
+         "non-nullptr object pointed to by cache_";
+  by_freshness_.erase(entries.back().by_freshness_iter);
+  entries.pop_back();
+  if (entries.empty()) by_key_.erase(cache_);
+  cache_ = by_key_.end();
+}
+
+template <typename T, typename Key, typename Deleter>
+std::unique_ptr<T, Deleter> KeyedRecyclingPool<T, Key, Deleter>::Part::Get(
+    const Key& key) {
+  absl::MutexLock lock(&mutex_);
+  FinishErasingCached();
+  const typename ByKey::iterator by_key_iter = by_key_.find(key);
+  if (by_key_iter == by_key_.end()) return nullptr;
+  // Return the newest entry with this key.
+  Entries& entries = by_key_iter->second;
+  RIEGELI_ASSERT(!entries.empty())
+      << "Failed invariant of KeyedRecyclingPool: "
+         "empty by_key_ value";
+  RIEGELI_ASSERT(entries.back().object != nullptr)
+      << "Failed invariant of KeyedRecyclingPool: "
+         "nullptr object not pointed to by cache_";
+  cache_ = by_key_iter;
+  return std::move(entries.back().object);
+}
+
+template <typename T, typename Key, typename Deleter>
+void KeyedRecyclingPool<T, Key, Deleter>::Part::Put(
+    const Key& key, std::unique_ptr<T, Deleter> object, absl::Time time,
+    absl::Time now, size_t max_size, absl::Duration max_age,
+    std::vector<Excess>& excess,
+    std::vector<std::unique_ptr<T, Deleter>>& expired) {
   absl::MutexLock lock(&mutex_);
   // Add a newest entry with this key.
-  if (ABSL_PREDICT_TRUE(cache_ != by_key_.end())) {
+  if (cache_ != by_key_.end() && cache_->first == key) {
+    // `cache_` hit. Set the object pointer again, and make it the newest.
     Entries& entries = cache_->second;
     RIEGELI_ASSERT(!entries.empty())
         << "Failed invariant of KeyedRecyclingPool: "
            "empty by_key_ value";
-    if (ABSL_PREDICT_TRUE(cache_->first == key)) {
-      // `cache_` hit. Set the object pointer again.
-      RIEGELI_ASSERT(entries.back().object == nullptr)
-          << "Failed invariant of KeyedRecyclingPool: "
-             "non-nullptr object pointed to by cache_";
-      entries.back().object = std::move(object);
-      cache_ = by_key_.end();
-      return;
-    }
-    // `cache_` miss. Finish erasing the cached entry.
-    by_freshness_.erase(entries.back().by_freshness_iter);
-    entries.pop_back();
-    if (entries.empty()) by_key_.erase(cache_);
+    RIEGELI_ASSERT(entries.back().object == nullptr)
+        << "Failed invariant of KeyedRecyclingPool: "
+           "non-nullptr object pointed to by cache_";
+    entries.back().object = std::move(object);
+    const typename ByFreshness::iterator by_freshness_iter =
+        entries.back().by_freshness_iter;
+    by_freshness_iter->time = time;
+    by_freshness_.splice(by_freshness_.end(), by_freshness_,
+                         by_freshness_iter);
+    cache_ = by_key_.end();
+  } else {
+    FinishErasingCached();
+    by_freshness_.push_back(Freshness{key, time});
+    typename ByFreshness::iterator by_freshness_iter = by_freshness_.end();
+    --by_freshness_iter;
+    // This invalidates `by_key_` iterators.
+    by_key_[key].emplace_back(std::move(object), by_freshness_iter);
   }
-  by_freshness_.push_back(key);
-  typename ByFreshness::iterator by_freshness_iter = by_freshness_.end();
-  --by_freshness_iter;
-  // This invalidates `by_key_` iterators, including `cache_`.
-  by_key_[key].emplace_back(std::move(object), by_freshness_iter);
-  while (ABSL_PREDICT_FALSE(by_freshness_.size() >
-                            max_size_.load(std::memory_order_relaxed))) {
-    // Evict the oldest entry.
-    const Key& evicted_key = by_freshness_.front();
-    const typename ByKey::iterator by_key_iter = by_key_.find(evicted_key);
+  for (;;) {
+    if (by_freshness_.empty()) break;
+    const Freshness& oldest = by_freshness_.front();
+    const bool is_expired = now - oldest.time > max_age;
+    if (ABSL_PREDICT_TRUE(!is_expired && by_freshness_.size() <= max_size)) {
+      break;
+    }
+    // Remove the oldest entry.
+    const typename ByKey::iterator by_key_iter = by_key_.find(oldest.key);
     RIEGELI_ASSERT(by_key_iter != by_key_.end())
         << "Failed invariant of KeyedRecyclingPool: "
            "a key from by_freshness_ absent in by_key_";
@@ -401,16 +769,28 @@ void KeyedRecyclingPool<T, Key, Deleter>::Put(
     RIEGELI_ASSERT(!entries.empty())
         << "Failed invariant of KeyedRecyclingPool: "
            "empty by_key_ value";
-    RIEGELI_ASSERT(entries.back().object != nullptr)
+    RIEGELI_ASSERT(entries.front().object != nullptr)
         << "Failed invariant of KeyedRecyclingPool: "
            "nullptr object not pointed to by cache_";
-    evicted.push_back(std::move(entries.front().object));
+    if (is_expired) {
+      expired.push_back(std::move(entries.front().object));
+    } else {
+      excess.push_back(
+          Excess{oldest.key, std::move(entries.front().object), oldest.time});
+    }
     entries.pop_front();
     if (entries.empty()) by_key_.erase(by_key_iter);
     by_freshness_.pop_front();
   }
-  cache_ = by_key_.end();
-  // Destroy `evicted` after releasing `mutex_`.
+}
+
+template <typename T, typename Key, typename Deleter>
+size_t KeyedRecyclingPool<T, Key, Deleter>::Part::num_idle() const {
+  absl::MutexLock lock(&mutex_);
+  size_t num_idle = by_freshness_.size();
+  // An object pointed to by `cache_` is not idle.
+  if (cache_ != by_key_.end()) --num_idle;
+  return num_idle;
 }
 
 }  // namespace riegeli
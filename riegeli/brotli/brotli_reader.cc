@@ -50,6 +50,15 @@ void BrotliReaderBase::Initialize(Reader* src) {
           uint32_t{true}))) {
     Fail(absl::InternalError(
         "BrotliDecoderSetParameter(BROTLI_DECODER_PARAM_LARGE_WINDOW) failed"));
+    return;
+  }
+  if (!dictionary_.empty()) {
+    if (ABSL_PREDICT_FALSE(!BrotliDecoderAttachDictionary(
+            decompressor_.get(), BROTLI_SHARED_DICTIONARY_RAW,
+            dictionary_.data().size(),
+            reinterpret_cast<const uint8_t*>(dictionary_.data().data())))) {
+      Fail(absl::InternalError("BrotliDecoderAttachDictionary() failed"));
+    }
   }
 }
 
@@ -18,6 +18,7 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -25,8 +26,10 @@
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
+#include "absl/strings/string_view.h"
 #include "brotli/decode.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/brotli/brotli_allocator.h"
 #include "riegeli/bytes/pullable_reader.h"
@@ -37,10 +40,114 @@ namespace riegeli {
 // Template parameter independent part of `BrotliReader`.
 class BrotliReaderBase : public PullableReader {
  public:
+  // Stores an optional Brotli dictionary for decompression.
+  //
+  // An empty dictionary is equivalent to no dictionary.
+  //
+  // A `Dictionary` object can own the dictionary data, or can hold a pointer
+  // to unowned dictionary data which must not be changed until the last
+  // `BrotliReader` using this dictionary is closed or no longer used.
+  //
+  // The Brotli decoder uses dictionary data directly, without preparing them,
+  // so `Dictionary` only holds the data.
+  //
+  // Copying a `Dictionary` object is cheap, sharing the actual dictionary.
+  class Dictionary {
+   public:
+    Dictionary() noexcept {}
+
+    Dictionary(const Dictionary& that) = default;
+    Dictionary& operator=(const Dictionary& that) = default;
+
+    Dictionary(Dictionary&& that) noexcept;
+    Dictionary& operator=(Dictionary&& that) noexcept;
+
+    // Sets parameters to defaults.
+    Dictionary& reset() & {
+      owned_data_.reset();
+      data_ = absl::string_view();
+      return *this;
+    }
+    Dictionary&& reset() && { return std::move(reset()); }
+
+    // Sets a dictionary.
+    //
+    // `std::string&&` is accepted with a template to avoid implicit conversions
+    // to `std::string` which can be ambiguous against `absl::string_view`
+    // (e.g. `const char*`).
+    Dictionary& set_data(absl::string_view data) & {
+      owned_data_ = std::make_shared<const std::string>(data);
+      data_ = *owned_data_;
+      return *this;
+    }
+    template <typename Src,
+              std::enable_if_t<std::is_same<Src, std::string>::value, int> = 0>
+    Dictionary& set_data(Src&& data) & {
+      // `std::move(data)` is correct and `std::forward<Src>(data)` is not
+      // necessary: `Src` is always `std::string`, never an lvalue reference.
+      owned_data_ = std::make_shared<const std::string>(std::move(data));
+      data_ = *owned_data_;
+      return *this;
+    }
+    Dictionary&& set_data(absl::string_view data) && {
+      return std::move(set_data(data));
+    }
+    template <typename Src,
+              std::enable_if_t<std::is_same<Src, std::string>::value, int> = 0>
+    Dictionary&& set_data(Src&& data) && {
+      // `std::move(data)` is correct and `std::forward<Src>(data)` is not
+      // necessary: `Src` is always `std::string`, never an lvalue reference.
+      return std::move(set_data(std::move(data)));
+    }
+
+    // Like `set_data()`, but does not take ownership of `data`, which must not
+    // be changed until the last `BrotliReader` using this dictionary is closed
+    // or no longer used.
+    Dictionary& set_data_unowned(absl::string_view data) & {
+      owned_data_.reset();
+      data_ = data;
+      return *this;
+    }
+    Dictionary&& set_data_unowned(absl::string_view data) && {
+      return std::move(set_data_unowned(data));
+    }
+
+    // Returns `true` if no dictionary is present.
+    bool empty() const { return data_.empty(); }
+
+    // Returns the dictionary data.
+    absl::string_view data() const { return data_; }
+
+   private:
+    std::shared_ptr<const std::string> owned_data_;
+    absl::string_view data_;
+  };
+
   class Options {
    public:
     Options() noexcept {}
 
+    // Brotli dictionary. The same dictionary must have been used for
+    // compression.
+    //
+    // Default: `Dictionary()`.
+    Options& set_dictionary(const Dictionary& dictionary) & {
+      dictionary_ = dictionary;
+      return *this;
+    }
+    Options& set_dictionary(Dictionary&& dictionary) & {
+      dictionary_ = std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(const Dictionary& dictionary) && {
+      return std::move(set_dictionary(dictionary));
+    }
+    Options&& set_dictionary(Dictionary&& dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+    Dictionary& dictionary() { return dictionary_; }
+    const Dictionary& dictionary() const { return dictionary_; }
+
     // Memory allocator used by the Brotli engine.
     //
     // Default: `BrotliAllocator()`.
@@ -62,6 +169,7 @@ class BrotliReaderBase : public PullableReader {
     const BrotliAllocator& allocator() const { return allocator_; }
 
    private:
+    Dictionary dictionary_;
     BrotliAllocator allocator_;
   };
 
@@ -84,13 +192,14 @@ class BrotliReaderBase : public PullableReader {
  protected:
   BrotliReaderBase() noexcept : PullableReader(kInitiallyClosed) {}
 
-  explicit BrotliReaderBase(BrotliAllocator&& allocator);
+  explicit BrotliReaderBase(Dictionary&& dictionary,
+                            BrotliAllocator&& allocator);
 
   BrotliReaderBase(BrotliReaderBase&& that) noexcept;
   BrotliReaderBase& operator=(BrotliReaderBase&& that) noexcept;
 
   void Reset();
-  void Reset(BrotliAllocator&& allocator);
+  void Reset(Dictionary&& dictionary, BrotliAllocator&& allocator);
   void Initialize(Reader* src);
 
   void Done() override;
@@ -103,6 +212,8 @@ class BrotliReaderBase : public PullableReader {
     }
   };
 
+  // Kept alive while `decompressor_` refers to its data.
+  Dictionary dictionary_;
   BrotliAllocator allocator_;
   // If `true`, the source is truncated (without a clean end of the compressed
   // stream) at the current position. If the source does not grow, `Close()`
@@ -165,6 +276,8 @@ class BrotliReader : public BrotliReaderBase {
   Reader* src_reader() override { return src_.get(); }
   const Reader* src_reader() const override { return src_.get(); }
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
   void VerifyEnd() override;
 
  protected:
@@ -195,13 +308,28 @@ explicit BrotliReader(
 
 // Implementation details follow.
 
-inline BrotliReaderBase::BrotliReaderBase(BrotliAllocator&& allocator)
-    : PullableReader(kInitiallyOpen), allocator_(std::move(allocator)) {}
+inline BrotliReaderBase::Dictionary::Dictionary(Dictionary&& that) noexcept
+    : owned_data_(std::move(that.owned_data_)),
+      data_(std::exchange(that.data_, absl::string_view())) {}
+
+inline BrotliReaderBase::Dictionary& BrotliReaderBase::Dictionary::operator=(
+    Dictionary&& that) noexcept {
+  owned_data_ = std::move(that.owned_data_);
+  data_ = std::exchange(that.data_, absl::string_view());
+  return *this;
+}
+
+inline BrotliReaderBase::BrotliReaderBase(Dictionary&& dictionary,
+                                          BrotliAllocator&& allocator)
+    : PullableReader(kInitiallyOpen),
+      dictionary_(std::move(dictionary)),
+      allocator_(std::move(allocator)) {}
 
 inline BrotliReaderBase::BrotliReaderBase(BrotliReaderBase&& that) noexcept
     : PullableReader(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
+      dictionary_(std::move(that.dictionary_)),
       allocator_(std::move(that.allocator_)),
       truncated_(that.truncated_),
       decompressor_(std::move(that.decompressor_)) {}
@@ -211,6 +339,7 @@ inline BrotliReaderBase& BrotliReaderBase::operator=(
   PullableReader::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
+  dictionary_ = std::move(that.dictionary_);
   allocator_ = std::move(that.allocator_);
   truncated_ = that.truncated_;
   decompressor_ = std::move(that.decompressor_);
@@ -222,24 +351,31 @@ inline void BrotliReaderBase::Reset() {
   truncated_ = false;
   decompressor_.reset();
   allocator_ = BrotliAllocator();
+  dictionary_.reset();
 }
 
-inline void BrotliReaderBase::Reset(BrotliAllocator&& allocator) {
+inline void BrotliReaderBase::Reset(Dictionary&& dictionary,
+                                    BrotliAllocator&& allocator) {
   PullableReader::Reset(kInitiallyOpen);
   truncated_ = false;
   decompressor_.reset();
   allocator_ = std::move(allocator);
+  dictionary_ = std::move(dictionary);
 }
 
 template <typename Src>
 inline BrotliReader<Src>::BrotliReader(const Src& src, Options options)
-    : BrotliReaderBase(std::move(options.allocator())), src_(src) {
+    : BrotliReaderBase(std::move(options.dictionary()),
+                       std::move(options.allocator())),
+      src_(src) {
   Initialize(src_.get());
 }
 
 template <typename Src>
 inline BrotliReader<Src>::BrotliReader(Src&& src, Options options)
-    : BrotliReaderBase(std::move(options.allocator())), src_(std::move(src)) {
+    : BrotliReaderBase(std::move(options.dictionary()),
+                       std::move(options.allocator())),
+      src_(std::move(src)) {
   Initialize(src_.get());
 }
 
@@ -247,7 +383,8 @@ template <typename Src>
 template <typename... SrcArgs>
 inline BrotliReader<Src>::BrotliReader(std::tuple<SrcArgs...> src_args,
                                        Options options)
-    : BrotliReaderBase(std::move(options.allocator())),
+    : BrotliReaderBase(std::move(options.dictionary()),
+                       std::move(options.allocator())),
       src_(std::move(src_args)) {
   Initialize(src_.get());
 }
@@ -277,14 +414,16 @@ inline void BrotliReader<Src>::Reset() {
 
 template <typename Src>
 inline void BrotliReader<Src>::Reset(const Src& src, Options options) {
-  BrotliReaderBase::Reset(std::move(options.allocator()));
+  BrotliReaderBase::Reset(std::move(options.dictionary()),
+                          std::move(options.allocator()));
   src_.Reset(src);
   Initialize(src_.get());
 }
 
 template <typename Src>
 inline void BrotliReader<Src>::Reset(Src&& src, Options options) {
-  BrotliReaderBase::Reset(std::move(options.allocator()));
+  BrotliReaderBase::Reset(std::move(options.dictionary()),
+                          std::move(options.allocator()));
   src_.Reset(std::move(src));
   Initialize(src_.get());
 }
@@ -293,7 +432,8 @@ template <typename Src>
 template <typename... SrcArgs>
 inline void BrotliReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
                                      Options options) {
-  BrotliReaderBase::Reset(std::move(options.allocator()));
+  BrotliReaderBase::Reset(std::move(options.dictionary()),
+                          std::move(options.allocator()));
   src_.Reset(std::move(src_args));
   Initialize(src_.get());
 }
@@ -312,6 +452,13 @@ void BrotliReader<Src>::VerifyEnd() {
   if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) src_->VerifyEnd();
 }
 
+template <typename Src>
+void BrotliReader<Src>::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  BrotliReaderBase::RegisterSubobjects(memory_estimator);
+  if (src_.is_owning()) src_->RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BROTLI_BROTLI_READER_H_
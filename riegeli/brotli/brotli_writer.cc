@@ -22,9 +22,11 @@
 #include <string>
 
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "brotli/encode.h"
 #include "riegeli/base/base.h"
@@ -47,6 +49,58 @@ constexpr int BrotliWriterBase::Options::kMaxWindowLog;
 constexpr int BrotliWriterBase::Options::kDefaultWindowLog;
 #endif
 
+namespace {
+
+struct BrotliEncoderPreparedDictionaryDeleter {
+  void operator()(BrotliEncoderPreparedDictionary* ptr) const {
+    BrotliEncoderDestroyPreparedDictionary(ptr);
+  }
+};
+
+}  // namespace
+
+struct BrotliWriterBase::Dictionary::Shared {
+  absl::Mutex mutex;
+  int compression_level ABSL_GUARDED_BY(mutex) =
+      std::numeric_limits<int>::min();
+  std::shared_ptr<const BrotliEncoderPreparedDictionary> shared_dictionary
+      ABSL_GUARDED_BY(mutex);
+};
+
+std::shared_ptr<BrotliWriterBase::Dictionary::Shared>
+BrotliWriterBase::Dictionary::EnsureShared() const {
+  absl::MutexLock lock(&mutex_);
+  if (shared_ == nullptr) shared_ = std::make_shared<Shared>();
+  return shared_;
+}
+
+inline std::shared_ptr<const BrotliEncoderPreparedDictionary>
+BrotliWriterBase::Dictionary::PrepareDictionary(int compression_level) const {
+  RIEGELI_ASSERT_NE(compression_level, std::numeric_limits<int>::min())
+      << "Failed precondition of "
+         "BrotliWriterBase::Dictionary::PrepareDictionary(): "
+         "compression level out of range";
+  const std::shared_ptr<Shared> prepared = EnsureShared();
+  {
+    absl::MutexLock lock(&prepared->mutex);
+    if (prepared->compression_level == compression_level) {
+      return prepared->shared_dictionary;
+    }
+  }
+  // The prepared dictionary uses the default allocator because it can be
+  // shared between `BrotliWriter` objects with different allocators.
+  std::unique_ptr<BrotliEncoderPreparedDictionary,
+                  BrotliEncoderPreparedDictionaryDeleter>
+      shared_dictionary(BrotliEncoderPrepareDictionary(
+          BROTLI_SHARED_DICTIONARY_RAW, data().size(),
+          reinterpret_cast<const uint8_t*>(data().data()), compression_level,
+          nullptr, nullptr, nullptr));
+  absl::MutexLock lock(&prepared->mutex);
+  prepared->compression_level = compression_level;
+  prepared->shared_dictionary = std::move(shared_dictionary);
+  return prepared->shared_dictionary;
+}
+
 void BrotliWriterBase::Initialize(Writer* dest, int compression_level,
                                   int window_log,
                                   absl::optional<Position> size_hint) {
@@ -105,6 +159,19 @@ void BrotliWriterBase::Initialize(Writer* dest, int compression_level,
     BrotliEncoderSetParameter(compressor_.get(), BROTLI_PARAM_SIZE_HINT,
                               SaturatingIntCast<uint32_t>(*size_hint));
   }
+  if (!dictionary_.empty()) {
+    prepared_dictionary_ = dictionary_.PrepareDictionary(compression_level);
+    if (ABSL_PREDICT_FALSE(prepared_dictionary_ == nullptr)) {
+      Fail(absl::InternalError("BrotliEncoderPrepareDictionary() failed"));
+      return;
+    }
+    if (ABSL_PREDICT_FALSE(!BrotliEncoderAttachPreparedDictionary(
+            compressor_.get(), prepared_dictionary_.get()))) {
+      Fail(absl::InternalError(
+          "BrotliEncoderAttachPreparedDictionary() failed"));
+      return;
+    }
+  }
 }
 
 void BrotliWriterBase::Done() {
@@ -115,6 +182,7 @@ void BrotliWriterBase::Done() {
     WriteInternal(data, dest, BROTLI_OPERATION_FINISH);
   }
   compressor_.reset();
+  prepared_dictionary_.reset();
   BufferedWriter::Done();
 }
 
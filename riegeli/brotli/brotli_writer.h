@@ -18,6 +18,7 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -26,10 +27,12 @@
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "brotli/encode.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/brotli/brotli_allocator.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
@@ -39,6 +42,122 @@ namespace riegeli {
 // Template parameter independent part of `BrotliWriter`.
 class BrotliWriterBase : public BufferedWriter {
  public:
+  // Stores an optional Brotli dictionary for compression.
+  //
+  // An empty dictionary is equivalent to no dictionary. Dictionary data should
+  // contain sequences that are commonly seen in the data being compressed.
+  //
+  // A `Dictionary` object can own the dictionary data, or can hold a pointer
+  // to unowned dictionary data which must not be changed until the last
+  // `BrotliWriter` using this dictionary is closed or no longer used.
+  // A `Dictionary` object also holds prepared structures derived from
+  // dictionary data. If the same dictionary is needed for multiple compression
+  // sessions, the `Dictionary` object can be reused.
+  //
+  // The prepared dictionary depends on the compression level. At most one
+  // prepared dictionary is cached, corresponding to the last compression level
+  // used.
+  //
+  // Copying a `Dictionary` object is cheap, sharing the actual dictionary.
+  class Dictionary {
+   public:
+    Dictionary() noexcept {}
+
+    Dictionary(const Dictionary& that);
+    Dictionary& operator=(const Dictionary& that);
+
+    Dictionary(Dictionary&& that) noexcept;
+    Dictionary& operator=(Dictionary&& that) noexcept;
+
+    // Sets parameters to defaults.
+    Dictionary& reset() & {
+      owned_data_.reset();
+      data_ = absl::string_view();
+      InvalidateShared();
+      return *this;
+    }
+    Dictionary&& reset() && { return std::move(reset()); }
+
+    // Sets a dictionary.
+    //
+    // `std::string&&` is accepted with a template to avoid implicit conversions
+    // to `std::string` which can be ambiguous against `absl::string_view`
+    // (e.g. `const char*`).
+    Dictionary& set_data(absl::string_view data) & {
+      owned_data_ = std::make_shared<const std::string>(data);
+      data_ = *owned_data_;
+      InvalidateShared();
+      return *this;
+    }
+    template <typename Src,
+              std::enable_if_t<std::is_same<Src, std::string>::value, int> = 0>
+    Dictionary& set_data(Src&& data) & {
+      // `std::move(data)` is correct and `std::forward<Src>(data)` is not
+      // necessary: `Src` is always `std::string`, never an lvalue reference.
+      owned_data_ = std::make_shared<const std::string>(std::move(data));
+      data_ = *owned_data_;
+      InvalidateShared();
+      return *this;
+    }
+    Dictionary&& set_data(absl::string_view data) && {
+      return std::move(set_data(data));
+    }
+    template <typename Src,
+              std::enable_if_t<std::is_same<Src, std::string>::value, int> = 0>
+    Dictionary&& set_data(Src&& data) && {
+      // `std::move(data)` is correct and `std::forward<Src>(data)` is not
+      // necessary: `Src` is always `std::string`, never an lvalue reference.
+      return std::move(set_data(std::move(data)));
+    }
+
+    // Like `set_data()`, but does not take ownership of `data`, which must not
+    // be changed until the last `BrotliWriter` using this dictionary is closed
+    // or no longer used.
+    Dictionary& set_data_unowned(absl::string_view data) & {
+      owned_data_.reset();
+      data_ = data;
+      InvalidateShared();
+      return *this;
+    }
+    Dictionary&& set_data_unowned(absl::string_view data) && {
+      return std::move(set_data_unowned(data));
+    }
+
+    // Returns `true` if no dictionary is present.
+    bool empty() const { return data_.empty(); }
+
+    // Returns the dictionary data.
+    absl::string_view data() const { return data_; }
+
+   private:
+    friend class BrotliWriterBase;
+
+    struct Shared;
+
+    // Ensures that `shared_` is present.
+    std::shared_ptr<Shared> EnsureShared() const;
+
+    // Clears `shared_`.
+    void InvalidateShared();
+
+    // Returns the dictionary in the prepared form, or `nullptr` if
+    // `BrotliEncoderPrepareDictionary()` failed.
+    std::shared_ptr<const BrotliEncoderPreparedDictionary> PrepareDictionary(
+        int compression_level) const;
+
+    std::shared_ptr<const std::string> owned_data_;
+    absl::string_view data_;
+
+    mutable absl::Mutex mutex_;
+    // If multiple `Dictionary` objects are known to use the same dictionary,
+    // `shared_` is present and shared between them, to avoid preparing the
+    // dictionary from the same data multiple times.
+    //
+    // `shared_` is guarded by `mutex_` for const access. It is not guarded
+    // for non-const access which is assumed to be exclusive.
+    mutable std::shared_ptr<Shared> shared_;
+  };
+
   class Options {
    public:
     Options() noexcept {}
@@ -94,6 +213,26 @@ class BrotliWriterBase : public BufferedWriter {
     }
     int window_log() const { return window_log_; }
 
+    // Brotli dictionary. The same dictionary must be used for decompression.
+    //
+    // Default: `Dictionary()`.
+    Options& set_dictionary(const Dictionary& dictionary) & {
+      dictionary_ = dictionary;
+      return *this;
+    }
+    Options& set_dictionary(Dictionary&& dictionary) & {
+      dictionary_ = std::move(dictionary);
+      return *this;
+    }
+    Options&& set_dictionary(const Dictionary& dictionary) && {
+      return std::move(set_dictionary(dictionary));
+    }
+    Options&& set_dictionary(Dictionary&& dictionary) && {
+      return std::move(set_dictionary(std::move(dictionary)));
+    }
+    Dictionary& dictionary() { return dictionary_; }
+    const Dictionary& dictionary() const { return dictionary_; }
+
     // Memory allocator used by the Brotli engine.
     //
     // Default: `BrotliAllocator()`.
@@ -152,6 +291,7 @@ class BrotliWriterBase : public BufferedWriter {
    private:
     int compression_level_ = kDefaultCompressionLevel;
     int window_log_ = kDefaultWindowLog;
+    Dictionary dictionary_;
     BrotliAllocator allocator_;
     absl::optional<Position> size_hint_;
     size_t buffer_size_ = kDefaultBufferSize;
@@ -173,15 +313,16 @@ class BrotliWriterBase : public BufferedWriter {
  protected:
   BrotliWriterBase() noexcept {}
 
-  explicit BrotliWriterBase(BrotliAllocator&& allocator, size_t buffer_size,
+  explicit BrotliWriterBase(Dictionary&& dictionary,
+                            BrotliAllocator&& allocator, size_t buffer_size,
                             absl::optional<Position> size_hint);
 
   BrotliWriterBase(BrotliWriterBase&& that) noexcept;
   BrotliWriterBase& operator=(BrotliWriterBase&& that) noexcept;
 
   void Reset();
-  void Reset(BrotliAllocator&& allocator, size_t buffer_size,
-             absl::optional<Position> size_hint);
+  void Reset(Dictionary&& dictionary, BrotliAllocator&& allocator,
+             size_t buffer_size, absl::optional<Position> size_hint);
   void Initialize(Writer* dest, int compression_level, int window_log,
                   absl::optional<Position> size_hint);
 
@@ -198,7 +339,10 @@ class BrotliWriterBase : public BufferedWriter {
   bool WriteInternal(absl::string_view src, Writer& dest,
                      BrotliEncoderOperation op);
 
+  Dictionary dictionary_;
   BrotliAllocator allocator_;
+  // Kept alive while `compressor_` refers to it.
+  std::shared_ptr<const BrotliEncoderPreparedDictionary> prepared_dictionary_;
   std::unique_ptr<BrotliEncoderState, BrotliEncoderStateDeleter> compressor_;
 };
 
@@ -251,6 +395,8 @@ class BrotliWriter : public BrotliWriterBase {
   Writer* dest_writer() override { return dest_.get(); }
   const Writer* dest_writer() const override { return dest_.get(); }
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  protected:
   void Done() override;
   bool FlushImpl(FlushType flush_type) override;
@@ -280,17 +426,51 @@ explicit BrotliWriter(
 
 // Implementation details follow.
 
-inline BrotliWriterBase::BrotliWriterBase(BrotliAllocator&& allocator,
+inline BrotliWriterBase::Dictionary::Dictionary(const Dictionary& that)
+    : owned_data_(that.owned_data_),
+      data_(that.data_),
+      shared_(that.empty() ? nullptr : that.EnsureShared()) {}
+
+inline BrotliWriterBase::Dictionary& BrotliWriterBase::Dictionary::operator=(
+    const Dictionary& that) {
+  owned_data_ = that.owned_data_;
+  data_ = that.data_;
+  shared_ = that.empty() ? nullptr : that.EnsureShared();
+  return *this;
+}
+
+inline BrotliWriterBase::Dictionary::Dictionary(Dictionary&& that) noexcept
+    : owned_data_(std::move(that.owned_data_)),
+      data_(std::exchange(that.data_, absl::string_view())),
+      shared_(std::move(that.shared_)) {}
+
+inline BrotliWriterBase::Dictionary& BrotliWriterBase::Dictionary::operator=(
+    Dictionary&& that) noexcept {
+  owned_data_ = std::move(that.owned_data_);
+  data_ = std::exchange(that.data_, absl::string_view());
+  shared_ = std::move(that.shared_);
+  return *this;
+}
+
+inline void BrotliWriterBase::Dictionary::InvalidateShared() {
+  shared_.reset();
+}
+
+inline BrotliWriterBase::BrotliWriterBase(Dictionary&& dictionary,
+                                          BrotliAllocator&& allocator,
                                           size_t buffer_size,
                                           absl::optional<Position> size_hint)
     : BufferedWriter(buffer_size, size_hint),
+      dictionary_(std::move(dictionary)),
       allocator_(std::move(allocator)) {}
 
 inline BrotliWriterBase::BrotliWriterBase(BrotliWriterBase&& that) noexcept
     : BufferedWriter(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
+      dictionary_(std::move(that.dictionary_)),
       allocator_(std::move(that.allocator_)),
+      prepared_dictionary_(std::move(that.prepared_dictionary_)),
       compressor_(std::move(that.compressor_)) {}
 
 inline BrotliWriterBase& BrotliWriterBase::operator=(
@@ -298,7 +478,9 @@ inline BrotliWriterBase& BrotliWriterBase::operator=(
   BufferedWriter::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
+  dictionary_ = std::move(that.dictionary_);
   allocator_ = std::move(that.allocator_);
+  prepared_dictionary_ = std::move(that.prepared_dictionary_);
   compressor_ = std::move(that.compressor_);
   return *this;
 }
@@ -306,20 +488,26 @@ inline BrotliWriterBase& BrotliWriterBase::operator=(
 inline void BrotliWriterBase::Reset() {
   BufferedWriter::Reset();
   compressor_.reset();
+  prepared_dictionary_.reset();
   allocator_ = BrotliAllocator();
+  dictionary_.reset();
 }
 
-inline void BrotliWriterBase::Reset(BrotliAllocator&& allocator,
+inline void BrotliWriterBase::Reset(Dictionary&& dictionary,
+                                    BrotliAllocator&& allocator,
                                     size_t buffer_size,
                                     absl::optional<Position> size_hint) {
   BufferedWriter::Reset(buffer_size, size_hint);
   compressor_.reset();
+  prepared_dictionary_.reset();
   allocator_ = std::move(allocator);
+  dictionary_ = std::move(dictionary);
 }
 
 template <typename Dest>
 inline BrotliWriter<Dest>::BrotliWriter(const Dest& dest, Options options)
-    : BrotliWriterBase(std::move(options.allocator()), options.buffer_size(),
+    : BrotliWriterBase(std::move(options.dictionary()),
+                       std::move(options.allocator()), options.buffer_size(),
                        options.size_hint()),
       dest_(dest) {
   Initialize(dest_.get(), options.compression_level(), options.window_log(),
@@ -328,7 +516,8 @@ inline BrotliWriter<Dest>::BrotliWriter(const Dest& dest, Options options)
 
 template <typename Dest>
 inline BrotliWriter<Dest>::BrotliWriter(Dest&& dest, Options options)
-    : BrotliWriterBase(std::move(options.allocator()), options.buffer_size(),
+    : BrotliWriterBase(std::move(options.dictionary()),
+                       std::move(options.allocator()), options.buffer_size(),
                        options.size_hint()),
       dest_(std::move(dest)) {
   Initialize(dest_.get(), options.compression_level(), options.window_log(),
@@ -339,7 +528,8 @@ template <typename Dest>
 template <typename... DestArgs>
 inline BrotliWriter<Dest>::BrotliWriter(std::tuple<DestArgs...> dest_args,
                                         Options options)
-    : BrotliWriterBase(std::move(options.allocator()), options.buffer_size(),
+    : BrotliWriterBase(std::move(options.dictionary()),
+                       std::move(options.allocator()), options.buffer_size(),
                        options.size_hint()),
       dest_(std::move(dest_args)) {
   Initialize(dest_.get(), options.compression_level(), options.window_log(),
@@ -371,7 +561,8 @@ inline void BrotliWriter<Dest>::Reset() {
 
 template <typename Dest>
 inline void BrotliWriter<Dest>::Reset(const Dest& dest, Options options) {
-  BrotliWriterBase::Reset(std::move(options.allocator()), options.buffer_size(),
+  BrotliWriterBase::Reset(std::move(options.dictionary()),
+                          std::move(options.allocator()), options.buffer_size(),
                           options.size_hint());
   dest_.Reset(dest);
   Initialize(dest_.get(), options.compression_level(), options.window_log(),
@@ -380,7 +571,8 @@ inline void BrotliWriter<Dest>::Reset(const Dest& dest, Options options) {
 
 template <typename Dest>
 inline void BrotliWriter<Dest>::Reset(Dest&& dest, Options options) {
-  BrotliWriterBase::Reset(std::move(options.allocator()), options.buffer_size(),
+  BrotliWriterBase::Reset(std::move(options.dictionary()),
+                          std::move(options.allocator()), options.buffer_size(),
                           options.size_hint());
   dest_.Reset(std::move(dest));
   Initialize(dest_.get(), options.compression_level(), options.window_log(),
@@ -391,7 +583,8 @@ template <typename Dest>
 template <typename... DestArgs>
 inline void BrotliWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
                                       Options options) {
-  BrotliWriterBase::Reset(std::move(options.allocator()), options.buffer_size(),
+  BrotliWriterBase::Reset(std::move(options.dictionary()),
+                          std::move(options.allocator()), options.buffer_size(),
                           options.size_hint());
   dest_.Reset(std::move(dest_args));
   Initialize(dest_.get(), options.compression_level(), options.window_log(),
@@ -415,6 +608,13 @@ bool BrotliWriter<Dest>::FlushImpl(FlushType flush_type) {
   return true;
 }
 
+template <typename Dest>
+void BrotliWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  BrotliWriterBase::RegisterSubobjects(memory_estimator);
+  if (dest_.is_owning()) dest_->RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BROTLI_BROTLI_WRITER_H_
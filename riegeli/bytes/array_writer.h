@@ -60,7 +60,7 @@ class ArrayWriterBase : public PushableWriter {
   void Initialize(absl::Span<char> dest);
 
   void Done() override;
-  bool PushSlow(size_t min_length, size_t recommended_length) override;
+  bool PushSlow(size_t min_length, size_t recommended_length) final;
   bool FlushImpl(FlushType flush_type) override;
 
   // Written data. Valid only after `Close()` or `Flush()`.
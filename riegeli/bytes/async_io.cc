@@ -0,0 +1,61 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/async_io.h"
+
+#include <stddef.h>
+
+#include <functional>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+void PullAsync(Reader& src, size_t min_length, size_t recommended_length,
+               std::function<void(bool)> done, ThreadPool& thread_pool) {
+  if (ABSL_PREDICT_TRUE(src.available() >= min_length)) {
+    done(true);
+    return;
+  }
+  thread_pool.Schedule(
+      [&src, min_length, recommended_length, done = std::move(done)] {
+        done(src.Pull(min_length, recommended_length));
+      });
+}
+
+void PushAsync(Writer& dest, size_t min_length, size_t recommended_length,
+               std::function<void(bool)> done, ThreadPool& thread_pool) {
+  if (ABSL_PREDICT_TRUE(dest.available() >= min_length)) {
+    done(true);
+    return;
+  }
+  thread_pool.Schedule(
+      [&dest, min_length, recommended_length, done = std::move(done)] {
+        done(dest.Push(min_length, recommended_length));
+      });
+}
+
+void FlushAsync(Writer& dest, FlushType flush_type,
+                std::function<void(bool)> done, ThreadPool& thread_pool) {
+  thread_pool.Schedule([&dest, flush_type, done = std::move(done)] {
+    done(dest.Flush(flush_type));
+  });
+}
+
+}  // namespace riegeli
@@ -0,0 +1,63 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_ASYNC_IO_H_
+#define RIEGELI_BYTES_ASYNC_IO_H_
+
+#include <stddef.h>
+
+#include <functional>
+
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Asynchronous variants of operations of `Reader` and `Writer` which can block,
+// for callers which must not block, e.g. event loops or coroutines.
+//
+// The operation runs in `thread_pool`, and then `done` is called there with its
+// result. Until `done` is called, no other member function of the `Reader` or
+// `Writer` may be called, and it must not be moved or destroyed. A thread is
+// occupied only while an operation is in progress, rather than for the lifetime
+// of each `Reader` or `Writer`.
+//
+// After a successful `PullAsync()` or `PushAsync()`, at least `min_length`
+// bytes are available in the buffer, so that reading or writing them does not
+// block, and can be done directly by the caller. If they are available already,
+// `done(true)` is called immediately in the calling thread instead.
+//
+// With C++20 coroutines, an awaitable can call these from `await_suspend()`,
+// with `done` storing the result and resuming the coroutine.
+
+// Like `src.Pull(min_length, recommended_length)`, but asynchronous.
+void PullAsync(Reader& src, size_t min_length, size_t recommended_length,
+               std::function<void(bool)> done,
+               ThreadPool& thread_pool = ThreadPool::global());
+
+// Like `dest.Push(min_length, recommended_length)`, but asynchronous.
+void PushAsync(Writer& dest, size_t min_length, size_t recommended_length,
+               std::function<void(bool)> done,
+               ThreadPool& thread_pool = ThreadPool::global());
+
+// Like `dest.Flush(flush_type)`, but asynchronous.
+void FlushAsync(Writer& dest, FlushType flush_type,
+                std::function<void(bool)> done,
+                ThreadPool& thread_pool = ThreadPool::global());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_ASYNC_IO_H_
@@ -0,0 +1,89 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_BUFFER_SIZER_H_
+#define RIEGELI_BYTES_BUFFER_SIZER_H_
+
+#include <stddef.h>
+
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+namespace internal {
+
+// Adapts the buffer size of `BufferedReader` or `BufferedWriter` to the access
+// pattern.
+//
+// A run is a sequence of transfers to or from the underlying source or
+// destination where each transfer starts where the previous one ended. The
+// buffer size is the length of the current run, clamped between a small
+// minimum and `max_buffer_size`, so it grows with sustained sequential access,
+// and drops to the minimum after a seek.
+//
+// Before the first transfer the buffer size is `buffer_size`, as if a run of
+// that length preceded it, so that the initial sequential access is not slowed
+// down.
+class BufferSizer {
+ public:
+  // The buffer size after a seek, unless `buffer_size` is smaller.
+  static constexpr size_t kMinAdaptiveBufferSize = size_t{4} << 10;
+
+  BufferSizer() = default;
+
+  // `max_buffer_size` smaller than `buffer_size` is treated as `buffer_size`.
+  explicit BufferSizer(size_t buffer_size, size_t max_buffer_size = 0)
+      : min_buffer_size_(UnsignedMin(buffer_size, kMinAdaptiveBufferSize)),
+        max_buffer_size_(UnsignedMax(buffer_size, max_buffer_size)),
+        run_length_(buffer_size) {}
+
+  BufferSizer(const BufferSizer& that) = default;
+  BufferSizer& operator=(const BufferSizer& that) = default;
+
+  // Changes the maximum buffer size. Values smaller than the minimum buffer
+  // size are treated as the minimum buffer size.
+  void set_max_buffer_size(size_t max_buffer_size) {
+    max_buffer_size_ = UnsignedMax(max_buffer_size, min_buffer_size_);
+  }
+  size_t max_buffer_size() const { return max_buffer_size_; }
+
+  // Returns the buffer size to use for a transfer starting at `pos`.
+  size_t BufferSize(Position pos) const {
+    if (started_ && pos != run_end_) return min_buffer_size_;
+    return UnsignedMax(IntCast<size_t>(UnsignedMin(run_length_,
+                                                   max_buffer_size_)),
+                       min_buffer_size_);
+  }
+
+  // Records a transfer from `pos_before` to `pos_after`.
+  void Transferred(Position pos_before, Position pos_after) {
+    if (started_ && pos_before != run_end_) run_length_ = 0;
+    started_ = true;
+    run_length_ = SaturatingAdd(run_length_, pos_after - pos_before);
+    run_end_ = pos_after;
+  }
+
+ private:
+  size_t min_buffer_size_ = 0;
+  size_t max_buffer_size_ = 0;
+  // `false` before the first transfer.
+  bool started_ = false;
+  // The position where the current run ends.
+  Position run_end_ = 0;
+  Position run_length_ = 0;
+};
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_BUFFER_SIZER_H_
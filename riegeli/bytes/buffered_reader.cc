@@ -27,6 +27,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
@@ -37,8 +38,17 @@ inline size_t BufferedReader::LengthToReadDirectly() const {
   // Read directly if reading through `buffer_` would need more than one read,
   // or if `buffer_` would be full. Read directly also if `size_hint_` is
   // reached.
-  return SaturatingAdd(available(),
-                       BufferLength(0, buffer_size_, size_hint_, limit_pos()));
+  return SaturatingAdd(
+      available(), BufferLength(0, buffer_sizer_.BufferSize(limit_pos()),
+                                size_hint_, limit_pos()));
+}
+
+inline bool BufferedReader::ReadFromSource(size_t min_length,
+                                           size_t max_length, char* dest) {
+  const Position pos_before = limit_pos();
+  const bool ok = ReadInternal(min_length, max_length, dest);
+  buffer_sizer_.Transferred(pos_before, limit_pos());
+  return ok;
 }
 
 void BufferedReader::VerifyEnd() {
@@ -48,6 +58,12 @@ void BufferedReader::VerifyEnd() {
   Reader::VerifyEnd();
 }
 
+void BufferedReader::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  Reader::RegisterSubobjects(memory_estimator);
+  buffer_.RegisterSubobjects(memory_estimator);
+}
+
 bool BufferedReader::PullSlow(size_t min_length, size_t recommended_length) {
   RIEGELI_ASSERT_LT(available(), min_length)
       << "Failed precondition of Reader::PullSlow(): "
@@ -56,8 +72,8 @@ bool BufferedReader::PullSlow(size_t min_length, size_t recommended_length) {
   const size_t available_length = available();
   size_t cursor_index = read_from_buffer();
   const size_t buffer_length =
-      BufferLength(UnsignedMax(min_length, recommended_length), buffer_size_,
-                   size_hint_, pos());
+      BufferLength(UnsignedMax(min_length, recommended_length),
+                   buffer_sizer_.BufferSize(limit_pos()), size_hint_, pos());
   absl::Span<char> flat_buffer = buffer_.AppendBuffer(
       0, buffer_length - available_length,
       SaturatingAdd(buffer_length, buffer_length) - available_length);
@@ -72,7 +88,7 @@ bool BufferedReader::PullSlow(size_t min_length, size_t recommended_length) {
   }
   // Read more data into `buffer_`.
   const Position pos_before = limit_pos();
-  const bool ok = ReadInternal(min_length - available_length,
+  const bool ok = ReadFromSource(min_length - available_length,
                                flat_buffer.size(), flat_buffer.data());
   RIEGELI_ASSERT_GE(limit_pos(), pos_before)
       << "BufferedReader::ReadInternal() decreased limit_pos()";
@@ -99,7 +115,7 @@ bool BufferedReader::ReadSlow(size_t length, char* dest) {
     }
     ClearBuffer();
     if (ABSL_PREDICT_FALSE(!healthy())) return false;
-    return ReadInternal(length, length, dest);
+    return ReadFromSource(length, length, dest);
   }
   return Reader::ReadSlow(length, dest);
 }
@@ -124,7 +140,7 @@ bool BufferedReader::ReadSlow(size_t length, Chain& dest) {
       ClearBuffer();
       const absl::Span<char> flat_buffer = dest.AppendFixedBuffer(length);
       const Position pos_before = limit_pos();
-      if (ABSL_PREDICT_FALSE(!ReadInternal(
+      if (ABSL_PREDICT_FALSE(!ReadFromSource(
               flat_buffer.size(), flat_buffer.size(), flat_buffer.data()))) {
         RIEGELI_ASSERT_GE(limit_pos(), pos_before)
             << "BufferedReader::ReadInternal() decreased limit_pos()";
@@ -137,8 +153,8 @@ bool BufferedReader::ReadSlow(size_t length, Chain& dest) {
       return true;
     }
     size_t cursor_index = read_from_buffer();
-    const size_t buffer_length =
-        BufferLength(0, buffer_size_, size_hint_, limit_pos());
+    const size_t buffer_length = BufferLength(
+        0, buffer_sizer_.BufferSize(limit_pos()), size_hint_, limit_pos());
     absl::Span<char> flat_buffer = buffer_.AppendBuffer(
         0, buffer_length, SaturatingAdd(buffer_length, buffer_length));
     if (flat_buffer.empty()) {
@@ -154,7 +170,7 @@ bool BufferedReader::ReadSlow(size_t length, Chain& dest) {
     }
     // Read more data into `buffer_`.
     const Position pos_before = limit_pos();
-    ok = ReadInternal(1, flat_buffer.size(), flat_buffer.data());
+    ok = ReadFromSource(1, flat_buffer.size(), flat_buffer.data());
     RIEGELI_ASSERT_GE(limit_pos(), pos_before)
         << "BufferedReader::ReadInternal() decreased limit_pos()";
     const Position length_read = limit_pos() - pos_before;
@@ -189,7 +205,7 @@ bool BufferedReader::ReadSlow(size_t length, absl::Cord& dest) {
       Buffer flat_buffer(length);
       const Position pos_before = limit_pos();
       if (ABSL_PREDICT_FALSE(
-              !ReadInternal(length, length, flat_buffer.data()))) {
+              !ReadFromSource(length, length, flat_buffer.data()))) {
         RIEGELI_ASSERT_GE(limit_pos(), pos_before)
             << "BufferedReader::ReadInternal() decreased limit_pos()";
         const Position length_read = limit_pos() - pos_before;
@@ -204,8 +220,8 @@ bool BufferedReader::ReadSlow(size_t length, absl::Cord& dest) {
       return true;
     }
     size_t cursor_index = read_from_buffer();
-    const size_t buffer_length =
-        BufferLength(0, buffer_size_, size_hint_, limit_pos());
+    const size_t buffer_length = BufferLength(
+        0, buffer_sizer_.BufferSize(limit_pos()), size_hint_, limit_pos());
     absl::Span<char> flat_buffer = buffer_.AppendBuffer(
         0, buffer_length, SaturatingAdd(buffer_length, buffer_length));
     if (flat_buffer.empty()) {
@@ -221,7 +237,7 @@ bool BufferedReader::ReadSlow(size_t length, absl::Cord& dest) {
     }
     // Read more data into `buffer_`.
     const Position pos_before = limit_pos();
-    ok = ReadInternal(1, flat_buffer.size(), flat_buffer.data());
+    ok = ReadFromSource(1, flat_buffer.size(), flat_buffer.data());
     RIEGELI_ASSERT_GE(limit_pos(), pos_before)
         << "BufferedReader::ReadInternal() decreased limit_pos()";
     const Position length_read = limit_pos() - pos_before;
@@ -249,8 +265,8 @@ bool BufferedReader::CopySlow(Position length, Writer& dest) {
       break;
     }
     size_t cursor_index = read_from_buffer();
-    const size_t buffer_length =
-        BufferLength(0, buffer_size_, size_hint_, limit_pos());
+    const size_t buffer_length = BufferLength(
+        0, buffer_sizer_.BufferSize(limit_pos()), size_hint_, limit_pos());
     absl::Span<char> flat_buffer = buffer_.AppendBuffer(
         0, buffer_length, SaturatingAdd(buffer_length, buffer_length));
     if (flat_buffer.empty()) {
@@ -280,7 +296,7 @@ bool BufferedReader::CopySlow(Position length, Writer& dest) {
     }
     // Read more data into `buffer_`.
     const Position pos_before = limit_pos();
-    read_ok = ReadInternal(1, flat_buffer.size(), flat_buffer.data());
+    read_ok = ReadFromSource(1, flat_buffer.size(), flat_buffer.data());
     RIEGELI_ASSERT_GE(limit_pos(), pos_before)
         << "BufferedReader::ReadInternal() decreased limit_pos()";
     const Position length_read = limit_pos() - pos_before;
@@ -332,7 +348,8 @@ void BufferedReader::ReadHintSlow(size_t length) {
   const size_t available_length = available();
   size_t cursor_index = read_from_buffer();
   const size_t buffer_length =
-      BufferLength(length, buffer_size_, size_hint_, pos());
+      BufferLength(length, buffer_sizer_.BufferSize(limit_pos()), size_hint_,
+                   pos());
   absl::Span<char> flat_buffer = buffer_.AppendBuffer(
       0, buffer_length - available_length,
       SaturatingAdd(buffer_length, buffer_length) - available_length);
@@ -347,7 +364,7 @@ void BufferedReader::ReadHintSlow(size_t length) {
   }
   // Read more data into `buffer_`.
   const Position pos_before = limit_pos();
-  ReadInternal(1, flat_buffer.size(), flat_buffer.data());
+  ReadFromSource(1, flat_buffer.size(), flat_buffer.data());
   RIEGELI_ASSERT_GE(limit_pos(), pos_before)
       << "BufferedReader::ReadInternal() decreased limit_pos()";
   const Position length_read = limit_pos() - pos_before;
@@ -23,8 +23,10 @@
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
+#include "riegeli/bytes/buffer_sizer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 
@@ -36,9 +38,17 @@ namespace riegeli {
 //
 // `BufferedReader` accumulates data which has been pulled in a flat buffer.
 // Reading a large enough array bypasses the buffer.
+//
+// The buffer size adapts to the access pattern: it drops to a small size after
+// a seek, so that small random reads do not read much more than needed, and
+// then grows with the length read sequentially, up to the maximum buffer size.
+// The maximum buffer size is the buffer size given to the constructor, unless
+// increased with `set_max_buffer_size()`. A `ReadHint()` reads at least the
+// hinted length regardless.
 class BufferedReader : public Reader {
  public:
   void VerifyEnd() override;
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
 
  protected:
   // Creates a closed `BufferedReader`.
@@ -67,13 +77,13 @@ class BufferedReader : public Reader {
 
   bool PullSlow(size_t min_length, size_t recommended_length) override;
   using Reader::ReadSlow;
-  bool ReadSlow(size_t length, char* dest) override;
-  bool ReadSlow(size_t length, Chain& dest) override;
-  bool ReadSlow(size_t length, absl::Cord& dest) override;
+  bool ReadSlow(size_t length, char* dest) final;
+  bool ReadSlow(size_t length, Chain& dest) final;
+  bool ReadSlow(size_t length, absl::Cord& dest) final;
   using Reader::CopySlow;
   bool CopySlow(Position length, Writer& dest) override;
   bool CopySlow(size_t length, BackwardWriter& dest) override;
-  void ReadHintSlow(size_t length) override;
+  void ReadHintSlow(size_t length) final;
 
   // Reads data from the source, from the physical source position which is
   // `limit_pos()`.
@@ -98,14 +108,22 @@ class BufferedReader : public Reader {
     size_hint_ = size_hint.value_or(0);
   }
 
+  // Allows the buffer to grow beyond the buffer size given to the constructor
+  // during sustained sequential reading, up to `max_buffer_size`.
+  void set_max_buffer_size(size_t max_buffer_size) {
+    buffer_sizer_.set_max_buffer_size(max_buffer_size);
+  }
+
  private:
   // Minimum length for which it is better to append current contents of
   // `buffer_` and read the remaining data directly than to read the data
   // through `buffer_`.
   size_t LengthToReadDirectly() const;
 
-  // Invariant: if `is_open()` then `buffer_size_ > 0`
-  size_t buffer_size_ = 0;
+  // Calls `ReadInternal()`, and records the read for adapting the buffer size.
+  bool ReadFromSource(size_t min_length, size_t max_length, char* dest);
+
+  internal::BufferSizer buffer_sizer_;
   Position size_hint_ = 0;
   // Buffered data, read directly before the physical source position which is
   // `limit_pos()`.
@@ -121,7 +139,7 @@ class BufferedReader : public Reader {
 inline BufferedReader::BufferedReader(
     size_t buffer_size, absl::optional<Position> size_hint) noexcept
     : Reader(kInitiallyOpen),
-      buffer_size_(buffer_size),
+      buffer_sizer_(buffer_size),
       size_hint_(size_hint.value_or(0)) {
   RIEGELI_ASSERT_GT(buffer_size, 0u)
       << "Failed precondition of BufferedReader::BufferedReader(size_t): "
@@ -132,7 +150,7 @@ inline BufferedReader::BufferedReader(BufferedReader&& that) noexcept
     : Reader(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
-      buffer_size_(that.buffer_size_),
+      buffer_sizer_(that.buffer_sizer_),
       size_hint_(that.size_hint_),
       buffer_(std::move(that.buffer_)) {}
 
@@ -141,7 +159,7 @@ inline BufferedReader& BufferedReader::operator=(
   Reader::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
-  buffer_size_ = that.buffer_size_;
+  buffer_sizer_ = that.buffer_sizer_;
   size_hint_ = that.size_hint_;
   buffer_ = std::move(that.buffer_);
   return *this;
@@ -149,7 +167,7 @@ inline BufferedReader& BufferedReader::operator=(
 
 inline void BufferedReader::Reset() {
   Reader::Reset(kInitiallyClosed);
-  buffer_size_ = 0;
+  buffer_sizer_ = internal::BufferSizer();
   size_hint_ = 0;
   buffer_.Clear();
 }
@@ -159,7 +177,7 @@ inline void BufferedReader::Reset(size_t buffer_size,
   RIEGELI_ASSERT_GT(buffer_size, 0u)
       << "Failed precondition of BufferedReader::Reset(): zero buffer size";
   Reader::Reset(kInitiallyOpen);
-  buffer_size_ = buffer_size;
+  buffer_sizer_ = internal::BufferSizer(buffer_size);
   size_hint_ = size_hint.value_or(0);
   buffer_.Clear();
 }
@@ -23,13 +23,15 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/memory.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
 
 inline size_t BufferedWriter::LengthToWriteDirectly() const {
-  size_t length = buffer_size_;
+  size_t length = buffer_sizer_.BufferSize(start_pos());
   if (written_to_buffer() > 0) {
     // Two writes are needed because current contents of `buffer_` must be
     // pushed. Write directly if writing through `buffer_` would need more than
@@ -50,6 +52,22 @@ inline size_t BufferedWriter::LengthToWriteDirectly() const {
   return length;
 }
 
+template <typename Src>
+inline bool BufferedWriter::WriteToDestination(const Src& src) {
+  const Position pos_before = start_pos();
+  const bool ok = WriteInternal(src);
+  buffer_sizer_.Transferred(pos_before, start_pos());
+  return ok;
+}
+
+void BufferedWriter::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  Writer::RegisterSubobjects(memory_estimator);
+  if (buffer_.capacity() > 0) {
+    memory_estimator.RegisterDynamicMemory(buffer_.capacity());
+  }
+}
+
 bool BufferedWriter::PushSlow(size_t min_length, size_t recommended_length) {
   RIEGELI_ASSERT_LT(available(), min_length)
       << "Failed precondition of Writer::PushSlow(): "
@@ -61,7 +79,8 @@ bool BufferedWriter::PushSlow(size_t min_length, size_t recommended_length) {
   }
   const size_t buffer_length =
       UnsignedMin(BufferLength(UnsignedMax(min_length, recommended_length),
-                               buffer_size_, size_hint_, start_pos()),
+                               buffer_sizer_.BufferSize(start_pos()),
+                               size_hint_, start_pos()),
                   std::numeric_limits<Position>::max() - start_pos());
   buffer_.Reset(buffer_length);
   set_buffer(buffer_.data(), buffer_length);
@@ -72,7 +91,7 @@ bool BufferedWriter::PushInternal() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   const absl::string_view data(start(), written_to_buffer());
   set_buffer();
-  return data.empty() || WriteInternal(data);
+  return data.empty() || WriteToDestination(data);
 }
 
 bool BufferedWriter::WriteSlow(absl::string_view src) {
@@ -81,11 +100,30 @@ bool BufferedWriter::WriteSlow(absl::string_view src) {
          "enough space available, use Write(string_view) instead";
   if (src.size() >= LengthToWriteDirectly()) {
     if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
-    return WriteInternal(src);
+    return WriteToDestination(src);
   }
   return Writer::WriteSlow(src);
 }
 
+bool BufferedWriter::WriteSlow(const Chain& src) {
+  RIEGELI_ASSERT_LT(UnsignedMin(available(), kMaxBytesToCopy), src.size())
+      << "Failed precondition of Writer::WriteSlow(Chain): "
+         "enough space available, use Write(Chain) instead";
+  if (src.size() >= LengthToWriteDirectly()) {
+    if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+    return WriteToDestination(src);
+  }
+  return Writer::WriteSlow(src);
+}
+
+bool BufferedWriter::WriteInternal(const Chain& src) {
+  for (const absl::string_view fragment : src.blocks()) {
+    if (fragment.empty()) continue;
+    if (ABSL_PREDICT_FALSE(!WriteInternal(fragment))) return false;
+  }
+  return true;
+}
+
 bool BufferedWriter::WriteZerosSlow(Position length) {
   RIEGELI_ASSERT_LT(UnsignedMin(available(), kMaxBytesToCopy), length)
       << "Failed precondition of Writer::WriteZerosSlow(): "
@@ -105,7 +143,8 @@ void BufferedWriter::WriteHintSlow(size_t length) {
          "enough space available, use WriteHint() instead";
   if (ABSL_PREDICT_FALSE(!PushInternal())) return;
   const size_t buffer_length =
-      UnsignedMin(BufferLength(length, buffer_size_, size_hint_, start_pos()),
+      UnsignedMin(BufferLength(length, buffer_sizer_.BufferSize(start_pos()),
+                               size_hint_, start_pos()),
                   std::numeric_limits<Position>::max() - start_pos());
   buffer_.Reset(buffer_length);
   set_buffer(buffer_.data(), buffer_length);
@@ -23,7 +23,10 @@
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/bytes/buffer_sizer.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
@@ -34,9 +37,15 @@ namespace riegeli {
 //
 // `BufferedWriter` accumulates data to be pushed in a flat buffer. Writing a
 // large enough array bypasses the buffer.
+//
+// The buffer size adapts to the access pattern: it drops to a small size after
+// a seek, and then grows with the length written sequentially, up to the
+// maximum buffer size. The maximum buffer size is the buffer size given to the
+// constructor, unless increased with `set_max_buffer_size()`.
 class BufferedWriter : public Writer {
  public:
   bool PrefersCopying() const override { return true; }
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
 
  protected:
   // Creates a closed `BufferedWriter`.
@@ -63,11 +72,12 @@ class BufferedWriter : public Writer {
   void Reset(size_t buffer_size,
              absl::optional<Position> size_hint = absl::nullopt);
 
-  bool PushSlow(size_t min_length, size_t recommended_length) override;
+  bool PushSlow(size_t min_length, size_t recommended_length) final;
   using Writer::WriteSlow;
-  bool WriteSlow(absl::string_view src) override;
-  bool WriteZerosSlow(Position length) override;
-  void WriteHintSlow(size_t length) override;
+  bool WriteSlow(absl::string_view src) final;
+  bool WriteSlow(const Chain& src) final;
+  bool WriteZerosSlow(Position length) final;
+  void WriteHintSlow(size_t length) final;
 
   // Writes buffered data to the destination, but unlike `PushSlow()`, does not
   // ensure that a buffer is allocated.
@@ -86,13 +96,35 @@ class BufferedWriter : public Writer {
   //   `written_to_buffer() == 0`
   virtual bool WriteInternal(absl::string_view src) = 0;
 
+  // Like `WriteInternal(absl::string_view)`, but writes the blocks of a
+  // `Chain`, which can be done without copying them to a flat buffer, e.g. with
+  // vectored I/O.
+  //
+  // By default writes each block with `WriteInternal(absl::string_view)`.
+  //
+  // Preconditions:
+  //   `!src.empty()`
+  //   `healthy()`
+  //   `written_to_buffer() == 0`
+  virtual bool WriteInternal(const Chain& src);
+
+  // Allows the buffer to grow beyond the buffer size given to the constructor
+  // during sustained sequential writing, up to `max_buffer_size`.
+  void set_max_buffer_size(size_t max_buffer_size) {
+    buffer_sizer_.set_max_buffer_size(max_buffer_size);
+  }
+
  private:
   // Minimum length for which it is better to push current contents of `buffer_`
   // and write the data directly than to write the data through `buffer_`.
   size_t LengthToWriteDirectly() const;
 
-  // Invariant: if `is_open()` then `buffer_size_ > 0`
-  size_t buffer_size_ = 0;
+  // Calls `WriteInternal()`, and records the write for adapting the buffer
+  // size.
+  template <typename Src>
+  bool WriteToDestination(const Src& src);
+
+  internal::BufferSizer buffer_sizer_;
   Position size_hint_ = 0;
   // Buffered data, to be written directly after the physical destination
   // position which is `start_pos()`.
@@ -104,7 +136,7 @@ class BufferedWriter : public Writer {
 inline BufferedWriter::BufferedWriter(
     size_t buffer_size, absl::optional<Position> size_hint) noexcept
     : Writer(kInitiallyOpen),
-      buffer_size_(buffer_size),
+      buffer_sizer_(buffer_size),
       size_hint_(size_hint.value_or(0)) {
   RIEGELI_ASSERT_GT(buffer_size, 0u)
       << "Failed precondition of BufferedWriter::BufferedWriter(size_t): "
@@ -115,7 +147,7 @@ inline BufferedWriter::BufferedWriter(BufferedWriter&& that) noexcept
     : Writer(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
-      buffer_size_(that.buffer_size_),
+      buffer_sizer_(that.buffer_sizer_),
       size_hint_(that.size_hint_),
       buffer_(std::move(that.buffer_)) {}
 
@@ -124,7 +156,7 @@ inline BufferedWriter& BufferedWriter::operator=(
   Writer::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
-  buffer_size_ = that.buffer_size_;
+  buffer_sizer_ = that.buffer_sizer_;
   size_hint_ = that.size_hint_;
   buffer_ = std::move(that.buffer_);
   return *this;
@@ -132,7 +164,7 @@ inline BufferedWriter& BufferedWriter::operator=(
 
 inline void BufferedWriter::Reset() {
   Writer::Reset(kInitiallyClosed);
-  buffer_size_ = 0;
+  buffer_sizer_ = internal::BufferSizer();
   size_hint_ = 0;
 }
 
@@ -141,7 +173,7 @@ inline void BufferedWriter::Reset(size_t buffer_size,
   RIEGELI_ASSERT_GT(buffer_size, 0u)
       << "Failed precondition of BufferedWriter::Reset(): zero buffer size";
   Writer::Reset(kInitiallyOpen);
-  buffer_size_ = buffer_size;
+  buffer_sizer_ = internal::BufferSizer(buffer_size);
   size_hint_ = size_hint.value_or(0);
 }
 
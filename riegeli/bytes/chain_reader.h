@@ -57,14 +57,14 @@ class ChainReaderBase : public PullableReader {
   void Initialize(const Chain* src);
 
   void Done() override;
-  bool PullSlow(size_t min_length, size_t recommended_length) override;
+  bool PullSlow(size_t min_length, size_t recommended_length) final;
   using PullableReader::ReadSlow;
-  bool ReadSlow(size_t length, Chain& dest) override;
-  bool ReadSlow(size_t length, absl::Cord& dest) override;
+  bool ReadSlow(size_t length, Chain& dest) final;
+  bool ReadSlow(size_t length, absl::Cord& dest) final;
   using PullableReader::CopySlow;
-  bool CopySlow(Position length, Writer& dest) override;
-  bool CopySlow(size_t length, BackwardWriter& dest) override;
-  bool SeekSlow(Position new_pos) override;
+  bool CopySlow(Position length, Writer& dest) final;
+  bool CopySlow(size_t length, BackwardWriter& dest) final;
+  bool SeekSlow(Position new_pos) final;
 
   // Invariant: `iter_.chain() == (is_open() ? src_chain() : nullptr)`
   Chain::BlockIterator iter_;
@@ -0,0 +1,258 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/concat_reader.h"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/pullable_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+void ConcatReader::CancelPrefetch() {
+  if (prefetched_.valid()) prefetched_.get();
+}
+
+inline void ConcatReader::StartPrefetch(size_t index) {
+  if (!prefetch_ || index >= openers_.size()) return;
+  if (prefetched_.valid()) {
+    if (prefetched_index_ == index) return;
+    CancelPrefetch();
+  }
+  struct PrefetchRequest {
+    ReaderOpener opener;
+    std::promise<std::unique_ptr<Reader>> opened;
+  };
+  PrefetchRequest* const request = new PrefetchRequest();
+  request->opener = openers_[index];
+  prefetched_ = request->opened.get_future();
+  prefetched_index_ = index;
+  ThreadPool::global().Schedule([request] {
+    std::unique_ptr<Reader> src = request->opener();
+    RIEGELI_ASSERT(src != nullptr)
+        << "Failed postcondition of ReaderOpener: null Reader pointer";
+    // Pull the first buffer, so that it is ready when the source is needed.
+    src->Pull();
+    request->opened.set_value(std::move(src));
+    delete request;
+  });
+}
+
+inline bool ConcatReader::OpenSource(size_t index) {
+  RIEGELI_ASSERT(current_ == nullptr)
+      << "Failed precondition of ConcatReader::OpenSource(): "
+         "source already opened";
+  std::unique_ptr<Reader> src;
+  if (prefetched_.valid() && prefetched_index_ == index) {
+    src = prefetched_.get();
+  } else {
+    src = openers_[index]();
+    RIEGELI_ASSERT(src != nullptr)
+        << "Failed postcondition of ReaderOpener: null Reader pointer";
+  }
+  current_index_ = index;
+  if (ABSL_PREDICT_FALSE(!src->healthy())) return FailSource(*src, index);
+  if (index == probed_) {
+    all_support_random_access_ &= src->SupportsRandomAccess();
+    all_support_size_ &= src->SupportsSize();
+    ++probed_;
+  }
+  current_base_ = src->pos();
+  current_ = std::move(src);
+  MakeBuffer();
+  StartPrefetch(index + 1);
+  return true;
+}
+
+inline bool ConcatReader::CloseSource() {
+  set_buffer();
+  if (current_ == nullptr) return true;
+  const std::unique_ptr<Reader> src = std::move(current_);
+  if (ABSL_PREDICT_FALSE(!src->Close())) {
+    return FailSource(*src, current_index_);
+  }
+  return true;
+}
+
+inline void ConcatReader::SourceEnds() {
+  if (current_index_ + 1 < starts_.size()) {
+    if (ABSL_PREDICT_TRUE(starts_[current_index_ + 1] == limit_pos())) return;
+    // The source changed since its size was learned. Forget positions of
+    // further sources.
+    starts_.resize(current_index_ + 1);
+  }
+  starts_.push_back(limit_pos());
+}
+
+inline void ConcatReader::SyncBuffer() { current_->set_cursor(cursor()); }
+
+inline void ConcatReader::MakeBuffer() {
+  Reader& src = *current_;
+  set_buffer(src.start(), src.buffer_size(), src.read_from_buffer());
+  set_limit_pos(starts_[current_index_] +
+                (src.pos() + src.available() - current_base_));
+  if (ABSL_PREDICT_FALSE(!src.healthy())) FailSource(src, current_index_);
+}
+
+bool ConcatReader::FailSource(const Reader& src, size_t index) {
+  RIEGELI_ASSERT(!src.healthy())
+      << "Failed precondition of ConcatReader::FailSource(): "
+         "source healthy";
+  return Fail(Annotate(src.status(), absl::StrCat("reading source ", index)));
+}
+
+void ConcatReader::Done() {
+  CancelPrefetch();
+  PullableReader::Done();
+  CloseSource();
+}
+
+bool ConcatReader::PullSlow(size_t min_length, size_t recommended_length) {
+  RIEGELI_ASSERT_LT(available(), min_length)
+      << "Failed precondition of Reader::PullSlow(): "
+         "enough data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!PullUsingScratch(min_length, recommended_length))) {
+    return available() >= min_length;
+  }
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  for (;;) {
+    if (current_ != nullptr) {
+      SyncBuffer();
+      const bool ok = current_->Pull(min_length, recommended_length);
+      MakeBuffer();
+      if (ABSL_PREDICT_TRUE(ok)) return true;
+      if (ABSL_PREDICT_FALSE(!healthy())) return false;
+      // The source ends. Continue with the next source.
+      SourceEnds();
+      if (ABSL_PREDICT_FALSE(!CloseSource())) return false;
+      ++current_index_;
+    }
+    if (current_index_ == openers_.size()) return false;
+    if (ABSL_PREDICT_FALSE(!OpenSource(current_index_))) return false;
+  }
+}
+
+bool ConcatReader::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!SeekUsingScratch(new_pos))) return true;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  // The last source known to begin at or before `new_pos`. Its end might be
+  // unknown, in which case `new_pos` might be in a further source.
+  size_t index = IntCast<size_t>(
+      std::upper_bound(starts_.begin(), starts_.end(), new_pos) -
+      starts_.begin() - 1);
+  for (;;) {
+    if (index == openers_.size()) {
+      // Seeking to the end or beyond.
+      if (ABSL_PREDICT_FALSE(!CloseSource())) return false;
+      current_index_ = index;
+      set_limit_pos(starts_[index]);
+      return new_pos == starts_[index];
+    }
+    if (current_ == nullptr || current_index_ != index) {
+      if (ABSL_PREDICT_FALSE(!CloseSource())) return false;
+      if (ABSL_PREDICT_FALSE(!OpenSource(index))) return false;
+    }
+    SyncBuffer();
+    const bool ok = current_->Seek(current_base_ + (new_pos - starts_[index]));
+    MakeBuffer();
+    if (ABSL_PREDICT_TRUE(ok)) return true;
+    if (ABSL_PREDICT_FALSE(!healthy())) return false;
+    // The source ends before `new_pos`. Continue with the next source.
+    SourceEnds();
+    ++index;
+  }
+}
+
+bool ConcatReader::ProbeSources() {
+  if (probed_ == openers_.size() &&
+      (starts_.size() > openers_.size() || !all_support_size_)) {
+    return true;
+  }
+  for (size_t index = UnsignedMin(probed_, starts_.size() - 1);
+       index < openers_.size(); ++index) {
+    std::unique_ptr<Reader> opened;
+    Reader* src;
+    Position base;
+    if (current_ != nullptr && index == current_index_) {
+      src = current_.get();
+      base = current_base_;
+    } else {
+      opened = openers_[index]();
+      RIEGELI_ASSERT(opened != nullptr)
+          << "Failed postcondition of ReaderOpener: null Reader pointer";
+      if (ABSL_PREDICT_FALSE(!opened->healthy())) {
+        return FailSource(*opened, index);
+      }
+      src = opened.get();
+      base = src->pos();
+    }
+    if (index == probed_) {
+      all_support_random_access_ &= src->SupportsRandomAccess();
+      all_support_size_ &= src->SupportsSize();
+      ++probed_;
+    }
+    if (index + 1 == starts_.size() && src->SupportsSize()) {
+      const absl::optional<Position> size = src->Size();
+      if (ABSL_PREDICT_FALSE(size == absl::nullopt)) {
+        return FailSource(*src, index);
+      }
+      starts_.push_back(starts_[index] + (*size - base));
+    }
+    if (opened != nullptr && ABSL_PREDICT_FALSE(!opened->Close())) {
+      return FailSource(*opened, index);
+    }
+  }
+  return true;
+}
+
+bool ConcatReader::SupportsRandomAccess() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!ProbeSources())) return false;
+  return all_support_random_access_;
+}
+
+bool ConcatReader::SupportsSize() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!ProbeSources())) return false;
+  return all_support_size_;
+}
+
+absl::optional<Position> ConcatReader::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  if (ABSL_PREDICT_FALSE(!ProbeSources())) return absl::nullopt;
+  if (ABSL_PREDICT_FALSE(starts_.size() <= openers_.size())) {
+    Fail(absl::UnimplementedError(
+        "ConcatReader::Size() requires sizes of all sources"));
+    return absl::nullopt;
+  }
+  return starts_.back();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,264 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_CONCAT_READER_H_
+#define RIEGELI_BYTES_CONCAT_READER_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/pullable_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// Opens a source of a `ConcatReader`, e.g. by constructing an `FdReader` for a
+// file name.
+//
+// The returned `Reader` must not be `nullptr`. A failure to open the source is
+// reported by returning a failed `Reader`.
+//
+// It can be called from another thread than the one which created the
+// `ConcatReader`, and more than once for the same source if the `ConcatReader`
+// seeks back to the source after reading past it.
+using ReaderOpener = std::function<std::unique_ptr<Reader>()>;
+
+// A `Reader` which reads the concatenation of several sources, each opened by
+// a `ReaderOpener` when it is needed and closed when reading moves past it.
+//
+// While a source is being read, the next source is opened and its first
+// buffer is pulled in the background, on a thread from `ThreadPool::global()`.
+// This hides the latency of opening each source, e.g. a file on a network
+// filesystem.
+//
+// The buffer of `ConcatReader` is the buffer of the current source, so data
+// are not copied, except for a `Pull()` spanning a boundary between sources.
+//
+// Positions of `ConcatReader` count bytes from the beginning of the first
+// source. Positions of each source count from its position just after it was
+// opened.
+//
+// `ConcatReader` supports random access and `Size()` if all sources support
+// them. Determining this, and `Size()` unless all sources have been read, open
+// sources which were not opened yet, in the calling thread. Seeking forwards
+// does not need random access nor sizes of sources: sources are read or
+// skipped with their own `Seek()`.
+class ConcatReader : public PullableReader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // If `true`, the next source is opened and its first buffer is pulled in
+    // the background while the current source is being read.
+    //
+    // Default: `true`.
+    Options& set_prefetch(bool prefetch) & {
+      prefetch_ = prefetch;
+      return *this;
+    }
+    Options&& set_prefetch(bool prefetch) && {
+      return std::move(set_prefetch(prefetch));
+    }
+    bool prefetch() const { return prefetch_; }
+
+   private:
+    bool prefetch_ = true;
+  };
+
+  // Creates a closed `ConcatReader`.
+  ConcatReader() noexcept : PullableReader(kInitiallyClosed) {}
+
+  // Will read the concatenation of sources opened by `openers`.
+  explicit ConcatReader(std::vector<ReaderOpener> openers,
+                        Options options = Options());
+
+  ConcatReader(ConcatReader&& that) noexcept;
+  ConcatReader& operator=(ConcatReader&& that) noexcept;
+
+  // Waits until opening the next source in the background is finished.
+  ~ConcatReader();
+
+  // Makes `*this` equivalent to a newly constructed `ConcatReader`. This
+  // avoids constructing a temporary `ConcatReader` and moving from it.
+  void Reset();
+  void Reset(std::vector<ReaderOpener> openers, Options options = Options());
+
+  // Returns the number of sources.
+  size_t num_sources() const { return openers_.size(); }
+
+  // Returns the index of the source containing the current position, or
+  // `num_sources()` at the end.
+  size_t source_index() const { return current_index_; }
+
+  bool SupportsRandomAccess() override;
+  bool SupportsSize() override;
+  absl::optional<Position> Size() override;
+
+ protected:
+  void Done() override;
+  bool PullSlow(size_t min_length, size_t recommended_length) override;
+  bool SeekSlow(Position new_pos) override;
+
+ private:
+  // Waits until opening the next source in the background is finished, and
+  // discards it.
+  void CancelPrefetch();
+
+  // Starts opening source `index` in the background, if enabled.
+  void StartPrefetch(size_t index);
+
+  // Makes source `index` the current source, positioned at its beginning.
+  // Takes it from the background if it was being opened there.
+  //
+  // Precondition: `current_ == nullptr`
+  bool OpenSource(size_t index);
+
+  // Closes the current source if any, leaving no buffer.
+  bool CloseSource();
+
+  // Records that the current source ends at `limit_pos()`.
+  void SourceEnds();
+
+  // Opens sources which were not opened yet to find out whether they support
+  // random access and sizes, and learns sizes of sources following sources of
+  // known sizes where possible.
+  bool ProbeSources();
+
+  // Sets buffer pointers of `current_` to buffer pointers of `*this`.
+  void SyncBuffer();
+
+  // Sets buffer pointers of `*this` to buffer pointers of `current_`. Fails
+  // `*this` if `current_` failed.
+  void MakeBuffer();
+
+  ABSL_ATTRIBUTE_COLD bool FailSource(const Reader& src, size_t index);
+
+  std::vector<ReaderOpener> openers_;
+  bool prefetch_ = false;
+  // `starts_[i]` is the position of the beginning of source `i`, known for
+  // sources following sources of known sizes. `starts_[num_sources()]`, if
+  // known, is the total size.
+  std::vector<Position> starts_;
+  // The index of the source containing `limit_pos()`. If `current_ == nullptr`,
+  // the source is not opened yet, or this is `num_sources()` at the end.
+  size_t current_index_ = 0;
+  std::unique_ptr<Reader> current_;
+  // The position of `*current_` corresponding to `starts_[current_index_]`.
+  Position current_base_ = 0;
+  // The source being opened in the background, if `prefetched_.valid()`.
+  std::future<std::unique_ptr<Reader>> prefetched_;
+  size_t prefetched_index_ = 0;
+  // The number of sources, from the first one, for which support for random
+  // access and sizes is recorded in `all_support_random_access_` and
+  // `all_support_size_`.
+  size_t probed_ = 0;
+  bool all_support_random_access_ = true;
+  bool all_support_size_ = true;
+
+  // Invariants if `is_open()` and scratch is not used:
+  //   `current_index_ < starts_.size()`
+  //   if `current_ != nullptr` then `start() == current_->start()`,
+  //       `limit() == current_->limit()`, and `limit_pos() ==
+  //       starts_[current_index_] + current_->limit_pos() - current_base_`
+  //   if `current_ == nullptr` then `start() == nullptr`
+};
+
+// Implementation details follow.
+
+inline ConcatReader::ConcatReader(std::vector<ReaderOpener> openers,
+                                  Options options)
+    : PullableReader(kInitiallyOpen),
+      openers_(std::move(openers)),
+      prefetch_(options.prefetch()),
+      starts_(1, 0) {}
+
+inline ConcatReader::ConcatReader(ConcatReader&& that) noexcept
+    : PullableReader(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      openers_(std::move(that.openers_)),
+      prefetch_(that.prefetch_),
+      starts_(std::move(that.starts_)),
+      current_index_(std::exchange(that.current_index_, 0)),
+      current_(std::move(that.current_)),
+      current_base_(that.current_base_),
+      prefetched_(std::move(that.prefetched_)),
+      prefetched_index_(that.prefetched_index_),
+      probed_(std::exchange(that.probed_, 0)),
+      all_support_random_access_(that.all_support_random_access_),
+      all_support_size_(that.all_support_size_) {}
+
+inline ConcatReader& ConcatReader::operator=(ConcatReader&& that) noexcept {
+  CancelPrefetch();
+  PullableReader::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  openers_ = std::move(that.openers_);
+  prefetch_ = that.prefetch_;
+  starts_ = std::move(that.starts_);
+  current_index_ = std::exchange(that.current_index_, 0);
+  current_ = std::move(that.current_);
+  current_base_ = that.current_base_;
+  prefetched_ = std::move(that.prefetched_);
+  prefetched_index_ = that.prefetched_index_;
+  probed_ = std::exchange(that.probed_, 0);
+  all_support_random_access_ = that.all_support_random_access_;
+  all_support_size_ = that.all_support_size_;
+  return *this;
+}
+
+inline ConcatReader::~ConcatReader() { CancelPrefetch(); }
+
+inline void ConcatReader::Reset() {
+  CancelPrefetch();
+  PullableReader::Reset(kInitiallyClosed);
+  openers_.clear();
+  prefetch_ = false;
+  starts_.clear();
+  current_index_ = 0;
+  current_.reset();
+  current_base_ = 0;
+  probed_ = 0;
+  all_support_random_access_ = true;
+  all_support_size_ = true;
+}
+
+inline void ConcatReader::Reset(std::vector<ReaderOpener> openers,
+                                Options options) {
+  CancelPrefetch();
+  PullableReader::Reset(kInitiallyOpen);
+  openers_ = std::move(openers);
+  prefetch_ = options.prefetch();
+  starts_.assign(1, 0);
+  current_index_ = 0;
+  current_.reset();
+  current_base_ = 0;
+  probed_ = 0;
+  all_support_random_access_ = true;
+  all_support_size_ = true;
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_CONCAT_READER_H_
@@ -131,13 +131,13 @@ class CordWriterBase : public Writer {
   void Initialize(absl::Cord* dest, bool append);
 
   void Done() override;
-  bool PushSlow(size_t min_length, size_t recommended_length) override;
+  bool PushSlow(size_t min_length, size_t recommended_length) final;
   using Writer::WriteSlow;
-  bool WriteSlow(const Chain& src) override;
-  bool WriteSlow(Chain&& src) override;
-  bool WriteSlow(const absl::Cord& src) override;
-  bool WriteSlow(absl::Cord&& src) override;
-  bool WriteZerosSlow(Position length) override;
+  bool WriteSlow(const Chain& src) final;
+  bool WriteSlow(Chain&& src) final;
+  bool WriteSlow(const absl::Cord& src) final;
+  bool WriteSlow(absl::Cord&& src) final;
+  bool WriteZerosSlow(Position length) final;
   bool FlushImpl(FlushType flush_type) override;
 
  private:
@@ -113,6 +113,9 @@ class DigestingReaderBase : public Reader {
 //   DigestType Digest();
 // ```
 //
+// `riegeli/digests` provides `Crc32cDigester`, and `AsyncDigester` which moves
+// an expensive digest to a background thread.
+//
 // The `Src` template parameter specifies the type of the object providing and
 // possibly owning the original `Reader`. `Src` must support
 // `Dependency<Reader*, Src>`, e.g. `Reader*` (not owned, default),
@@ -338,8 +341,8 @@ template <typename Digester, typename Src>
 inline typename DigestingReader<Digester, Src>::DigestType
 DigestingReader<Digester, Src>::Digest() {
   if (read_from_buffer() > 0) {
-    DigesterWrite(absl::string_view(start(), read_from_buffer()));
-    set_buffer(cursor(), available());
+    SyncBuffer(*src_);
+    MakeBuffer(*src_);
   }
   return internal::DigesterDigest(digester_);
 }
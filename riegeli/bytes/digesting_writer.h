@@ -122,6 +122,9 @@ class DigestingWriterBase : public Writer {
 //   DigestType Digest();
 // ```
 //
+// `riegeli/digests` provides `Crc32cDigester`, and `AsyncDigester` which moves
+// an expensive digest to a background thread.
+//
 // The `Dest` template parameter specifies the type of the object providing and
 // possibly owning the original `Writer`. `Dest` must support
 // `Dependency<Writer*, Dest>`, e.g. `Writer*` (not owned, default),
@@ -358,9 +361,8 @@ template <typename Digester, typename Dest>
 inline typename DigestingWriter<Digester, Dest>::DigestType
 DigestingWriter<Digester, Dest>::Digest() {
   if (written_to_buffer() > 0) {
-    DigesterWrite(absl::string_view(start(), written_to_buffer()));
-    set_start_pos(pos());
-    set_buffer(cursor(), available());
+    SyncBuffer(*dest_);
+    MakeBuffer(*dest_);
   }
   return internal::DigesterDigest(digester_);
 }
@@ -18,6 +18,11 @@
 #define _XOPEN_SOURCE 500
 #endif
 
+// Make `O_DIRECT` available.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 // Make `off_t` 64-bit even on 32-bit systems.
 #undef _FILE_OFFSET_BITS
 #define _FILE_OFFSET_BITS 64
@@ -26,6 +31,7 @@
 
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -33,22 +39,33 @@
 #include <unistd.h>
 
 #include <cerrno>
+#include <cstring>
 #include <limits>
 #include <string>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/errno_mapping.h"
 #include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
 
 namespace riegeli {
 
@@ -75,14 +92,81 @@ void MMapRef::RegisterSubobjects(MemoryEstimator& memory_estimator) const {}
 
 void MMapRef::DumpStructure(std::ostream& out) const { out << "[mmap] { }"; }
 
+size_t PageSize() {
+  static const size_t kPageSize = IntCast<size_t>(sysconf(_SC_PAGESIZE));
+  return kPageSize;
+}
+
+// Passes `access_pattern` to `posix_fadvise()` for `length` bytes of `fd`
+// starting from `offset`, or until the end if `length == 0`.
+void AdviseFile(int fd, Position offset, Position length,
+                AccessPattern access_pattern) {
+#ifdef POSIX_FADV_NORMAL
+  int advice;
+  switch (access_pattern) {
+    case AccessPattern::kNormal:
+      return;
+    case AccessPattern::kSequential:
+      advice = POSIX_FADV_SEQUENTIAL;
+      break;
+    case AccessPattern::kRandom:
+      advice = POSIX_FADV_RANDOM;
+      break;
+    case AccessPattern::kWillNeed:
+      advice = POSIX_FADV_WILLNEED;
+      break;
+    default:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Unknown access pattern: " << static_cast<int>(access_pattern);
+  }
+  // Errors are ignored because this is only a hint.
+  posix_fadvise(
+      fd, IntCast<off_t>(offset),
+      IntCast<off_t>(UnsignedMin(
+          length, Position{std::numeric_limits<off_t>::max()} - offset)),
+      advice);
+#endif
+}
+
+// Passes `access_pattern` to `madvise()` for the pages containing `length`
+// bytes of mapped memory starting from `data`.
+void AdviseMemory(const char* data, size_t length,
+                  AccessPattern access_pattern) {
+#ifdef MADV_NORMAL
+  int advice;
+  switch (access_pattern) {
+    case AccessPattern::kNormal:
+      return;
+    case AccessPattern::kSequential:
+      advice = MADV_SEQUENTIAL;
+      break;
+    case AccessPattern::kRandom:
+      advice = MADV_RANDOM;
+      break;
+    case AccessPattern::kWillNeed:
+      advice = MADV_WILLNEED;
+      break;
+    default:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Unknown access pattern: " << static_cast<int>(access_pattern);
+  }
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(data) &
+                          ~(IntCast<uintptr_t>(PageSize()) - 1);
+  const uintptr_t end = reinterpret_cast<uintptr_t>(data) + length;
+  // Errors are ignored because this is only a hint.
+  madvise(reinterpret_cast<void*>(begin), end - begin, advice);
+#endif
+}
+
 }  // namespace
 
 void FdReaderBase::Initialize(int src, absl::optional<Position> assumed_pos,
-                              absl::optional<Position> independent_pos) {
+                              absl::optional<Position> independent_pos,
+                              AccessPattern access_pattern) {
   RIEGELI_ASSERT_GE(src, 0)
       << "Failed precondition of FdReader: negative file descriptor";
   SetFilename(src);
-  InitializePos(src, assumed_pos, independent_pos);
+  InitializePos(src, assumed_pos, independent_pos, access_pattern);
 }
 
 inline void FdReaderBase::SetFilename(int src) {
@@ -108,7 +192,8 @@ again:
 }
 
 void FdReaderBase::InitializePos(int src, absl::optional<Position> assumed_pos,
-                                 absl::optional<Position> independent_pos) {
+                                 absl::optional<Position> independent_pos,
+                                 AccessPattern access_pattern) {
   RIEGELI_ASSERT(assumed_pos == absl::nullopt ||
                  independent_pos == absl::nullopt)
       << "Failed precondition of FdReaderBase: "
@@ -119,7 +204,14 @@ void FdReaderBase::InitializePos(int src, absl::optional<Position> assumed_pos,
   RIEGELI_ASSERT(!has_independent_pos_)
       << "Failed precondition of FdReaderBase::InitializePos(): "
          "has_independent_pos_ not reset";
+  AdviseFile(src, 0, 0, access_pattern);
   if (assumed_pos != absl::nullopt) {
+    if (ABSL_PREDICT_FALSE(direct_buffer_size_ > 0)) {
+      Fail(absl::InvalidArgumentError(
+          "Options::direct_io() requires random access, which is not "
+          "supported with Options::assumed_pos()"));
+      return;
+    }
     if (ABSL_PREDICT_FALSE(*assumed_pos >
                            Position{std::numeric_limits<off_t>::max()})) {
       FailOverflow();
@@ -135,11 +227,17 @@ void FdReaderBase::InitializePos(int src, absl::optional<Position> assumed_pos,
       return;
     }
     set_limit_pos(*independent_pos);
+    if (direct_buffer_size_ > 0) InitializeDirectIo(src);
   } else {
     const off_t file_pos = lseek(src, 0, SEEK_CUR);
     if (file_pos < 0) {
       if (errno == ESPIPE) {
         // Random access is not supported. Assume 0 as the initial position.
+        if (ABSL_PREDICT_FALSE(direct_buffer_size_ > 0)) {
+          Fail(absl::InvalidArgumentError(
+              "Options::direct_io() requires random access, which is not "
+              "supported by the fd"));
+        }
       } else {
         FailOperation("lseek()");
       }
@@ -147,9 +245,28 @@ void FdReaderBase::InitializePos(int src, absl::optional<Position> assumed_pos,
     }
     set_limit_pos(IntCast<Position>(file_pos));
     supports_random_access_ = true;
+    if (direct_buffer_size_ > 0) InitializeDirectIo(src);
   }
 }
 
+inline void FdReaderBase::InitializeDirectIo(int src) {
+#ifdef O_DIRECT
+  const int flags = fcntl(src, F_GETFL);
+  if (ABSL_PREDICT_FALSE(flags < 0)) {
+    FailOperation("fcntl()");
+    return;
+  }
+  if ((flags & O_DIRECT) == 0 &&
+      ABSL_PREDICT_FALSE(fcntl(src, F_SETFL, flags | O_DIRECT) < 0)) {
+    FailOperation("fcntl()");
+  }
+#else
+  Fail(absl::UnimplementedError(
+      "Options::direct_io() requires O_DIRECT, which is not available on "
+      "this platform"));
+#endif
+}
+
 inline bool FdReaderBase::SyncPos(int src) {
   RIEGELI_ASSERT(supports_random_access_)
       << "Failed precondition of FdReaderBase::SyncPos(): "
@@ -163,12 +280,16 @@ inline bool FdReaderBase::SyncPos(int src) {
 }
 
 void FdReaderBase::Done() {
+  // With `O_DIRECT` the fd position is not advanced by reading, so it is always
+  // synchronized.
   if (ABSL_PREDICT_TRUE(healthy()) && supports_random_access_ &&
-      available() > 0) {
+      (available() > 0 || direct_buffer_size_ > 0)) {
     const int src = src_fd();
     SyncPos(src);
   }
   BufferedReader::Done();
+  direct_buffer_ = Buffer();
+  direct_buffer_length_ = 0;
 }
 
 bool FdReaderBase::FailOperation(absl::string_view operation) {
@@ -206,6 +327,9 @@ bool FdReaderBase::ReadInternal(size_t min_length, size_t max_length,
                              limit_pos())) {
     return FailOverflow();
   }
+  if (direct_buffer_size_ > 0) {
+    return ReadDirect(src, min_length, max_length, dest);
+  }
   for (;;) {
   again:
     const ssize_t length_read =
@@ -233,15 +357,92 @@ bool FdReaderBase::ReadInternal(size_t min_length, size_t max_length,
   }
 }
 
+inline bool FdReaderBase::ReadDirect(int src, size_t min_length,
+                                     size_t max_length, char* dest) {
+  direct_buffer_.Reset(direct_buffer_size_ + (kDirectIoAlignment - 1));
+  char* const aligned_buffer =
+      reinterpret_cast<char*>(RoundUp<kDirectIoAlignment>(
+          reinterpret_cast<uintptr_t>(direct_buffer_.data())));
+  for (;;) {
+    if (limit_pos() >= direct_buffer_pos_ &&
+        limit_pos() - direct_buffer_pos_ < direct_buffer_length_) {
+      // Copy what is available in `direct_buffer_`.
+      const size_t offset = IntCast<size_t>(limit_pos() - direct_buffer_pos_);
+      const size_t length =
+          UnsignedMin(max_length, direct_buffer_length_ - offset);
+      std::memcpy(dest, aligned_buffer + offset, length);
+      move_limit_pos(length);
+      if (length >= min_length) return true;
+      dest += length;
+      min_length -= length;
+      max_length -= length;
+    }
+    // Refill `direct_buffer_` starting from the aligned block containing
+    // `limit_pos()`. Only the length requested must be aligned, not the length
+    // read, so the end of the file needs no special handling.
+    direct_buffer_pos_ = RoundDown<kDirectIoAlignment>(limit_pos());
+    direct_buffer_length_ = 0;
+  again:
+    const ssize_t length_read =
+        pread(src, aligned_buffer, direct_buffer_size_,
+              IntCast<off_t>(direct_buffer_pos_));
+    if (ABSL_PREDICT_FALSE(length_read < 0)) {
+      if (errno == EINTR) goto again;
+      return FailOperation("pread()");
+    }
+    RIEGELI_ASSERT_LE(IntCast<size_t>(length_read), direct_buffer_size_)
+        << "pread() read more than requested";
+    direct_buffer_length_ = IntCast<size_t>(length_read);
+    if (ABSL_PREDICT_FALSE(direct_buffer_length_ <=
+                           limit_pos() - direct_buffer_pos_)) {
+      // File ends.
+      return false;
+    }
+  }
+}
+
 bool FdReaderBase::Sync() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  if (supports_random_access_ && available() > 0) {
+  // Data read ahead with `O_DIRECT` are read again after `Sync()`.
+  direct_buffer_length_ = 0;
+  if (supports_random_access_ &&
+      (available() > 0 || direct_buffer_size_ > 0)) {
     const int src = src_fd();
     return SyncPos(src);
   }
   return true;
 }
 
+bool FdReaderBase::CopySlow(Position length, Writer& dest) {
+  RIEGELI_ASSERT_LT(UnsignedMin(available(), kMaxBytesToCopy), length)
+      << "Failed precondition of Reader::CopySlow(Writer&): "
+         "enough data available, use Copy(Writer&) instead";
+  if (length < available() + kMinLengthToCopyInKernel ||
+      direct_buffer_size_ > 0 || ABSL_PREDICT_FALSE(!healthy()) ||
+      dest.GetTypeId() != TypeId::For<FdWriterBase>()) {
+    return BufferedReader::CopySlow(length, dest);
+  }
+  FdWriterBase& fd_dest = static_cast<FdWriterBase&>(dest);
+  const size_t available_length = available();
+  if (available_length > 0) {
+    const bool write_ok =
+        dest.Write(absl::string_view(cursor(), available_length));
+    move_cursor(available_length);
+    if (ABSL_PREDICT_FALSE(!write_ok)) return false;
+    length -= available_length;
+  }
+  ClearBuffer();
+  Position src_pos = limit_pos();
+  Position length_copied;
+  const bool copy_ok = fd_dest.CopyFromFd(
+      src_fd(), has_independent_pos_ ? &src_pos : nullptr, length,
+      length_copied);
+  move_limit_pos(length_copied);
+  if (copy_ok) return length_copied == length;
+  if (ABSL_PREDICT_FALSE(!fd_dest.healthy())) return false;
+  return BufferedReader::CopySlow(length, dest);
+}
+
 bool FdReaderBase::SeekSlow(Position new_pos) {
   RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
       << "Failed precondition of Reader::SeekSlow(): "
@@ -269,6 +470,89 @@ bool FdReaderBase::SeekSlow(Position new_pos) {
   return SyncPos(src);
 }
 
+void FdReaderBase::PrefetchHint(Position length) {
+  if (ABSL_PREDICT_FALSE(!healthy()) || !supports_random_access_ ||
+      length <= available()) {
+    return;
+  }
+  const int src = src_fd();
+  AdviseFile(src, limit_pos(), length - available(), AccessPattern::kWillNeed);
+}
+
+bool FdReaderBase::ReadRanges(absl::Span<const ReadRange> ranges,
+                              absl::Span<Chain> dest) {
+  RIEGELI_ASSERT_EQ(ranges.size(), dest.size())
+      << "Failed precondition of Reader::ReadRanges(): "
+         "ranges and dest have different sizes";
+  if (!supports_random_access_ || direct_buffer_size_ > 0 ||
+      ABSL_PREDICT_FALSE(!healthy())) {
+    return BufferedReader::ReadRanges(ranges, dest);
+  }
+  if (ranges.empty()) return true;
+  static constexpr Position kMaxPos =
+      Position{std::numeric_limits<off_t>::max()};
+  for (const ReadRange& range : ranges) {
+    if (ABSL_PREDICT_FALSE(range.pos > kMaxPos ||
+                           range.length > kMaxPos - range.pos)) {
+      for (Chain& chain : dest) chain.Clear();
+      return FailOverflow();
+    }
+  }
+  const int src = src_fd();
+  // Ranges with `index % num_tasks == task` are read by `task`. Task 0 runs in
+  // the current thread.
+  const size_t num_tasks = UnsignedMin(ranges.size(), kMaxConcurrentReads);
+  std::vector<int> error_numbers(num_tasks, 0);
+  std::vector<char> all_read(num_tasks, true);
+  const auto read_ranges = [&](size_t task) {
+    for (size_t index = task; index < ranges.size(); index += num_tasks) {
+      Chain& chain = dest[index];
+      chain.Clear();
+      const absl::Span<char> flat_buffer =
+          chain.AppendFixedBuffer(ranges[index].length);
+      size_t length_read = 0;
+      while (length_read < flat_buffer.size()) {
+        const ssize_t result = pread(
+            src, flat_buffer.data() + length_read,
+            UnsignedMin(flat_buffer.size() - length_read,
+                        size_t{std::numeric_limits<ssize_t>::max()}),
+            IntCast<off_t>(ranges[index].pos + length_read));
+        if (ABSL_PREDICT_FALSE(result < 0)) {
+          if (errno == EINTR) continue;
+          error_numbers[task] = errno;
+          chain.Clear();
+          return;
+        }
+        if (ABSL_PREDICT_FALSE(result == 0)) {
+          all_read[task] = false;
+          break;
+        }
+        length_read += IntCast<size_t>(result);
+      }
+      chain.RemoveSuffix(flat_buffer.size() - length_read);
+    }
+  };
+  absl::BlockingCounter tasks_done(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&read_ranges, &tasks_done, task] {
+      read_ranges(task);
+      tasks_done.DecrementCount();
+    });
+  }
+  read_ranges(0);
+  tasks_done.Wait();
+  for (const int error_number : error_numbers) {
+    if (ABSL_PREDICT_FALSE(error_number != 0)) {
+      errno = error_number;
+      return FailOperation("pread()");
+    }
+  }
+  for (const char task_read_all : all_read) {
+    if (!task_read_all) return false;
+  }
+  return true;
+}
+
 absl::optional<Position> FdReaderBase::Size() {
   if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
   const int src = src_fd();
@@ -281,11 +565,12 @@ absl::optional<Position> FdReaderBase::Size() {
 }
 
 void FdMMapReaderBase::Initialize(int src,
-                                  absl::optional<Position> independent_pos) {
+                                  absl::optional<Position> independent_pos,
+                                  AccessPattern access_pattern) {
   RIEGELI_ASSERT_GE(src, 0)
       << "Failed precondition of FdMMapReader: negative file descriptor";
   SetFilename(src);
-  InitializePos(src, independent_pos);
+  InitializePos(src, independent_pos, access_pattern);
 }
 
 inline void FdMMapReaderBase::SetFilename(int src) {
@@ -311,7 +596,8 @@ again:
 }
 
 void FdMMapReaderBase::InitializePos(int src,
-                                     absl::optional<Position> independent_pos) {
+                                     absl::optional<Position> independent_pos,
+                                     AccessPattern access_pattern) {
   struct stat stat_info;
   if (ABSL_PREDICT_FALSE(fstat(src, &stat_info) < 0)) {
     FailOperation("fstat()");
@@ -330,6 +616,8 @@ void FdMMapReaderBase::InitializePos(int src,
     FailOperation("mmap()");
     return;
   }
+  AdviseMemory(static_cast<const char*>(data),
+               IntCast<size_t>(stat_info.st_size), access_pattern);
   // `FdMMapReaderBase` derives from `ChainReader<Chain>` but the `Chain` to
   // read from was not known in `FdMMapReaderBase` constructor. This sets the
   // `Chain` and updates the `ChainReader` to read from it.
@@ -386,10 +674,236 @@ bool FdMMapReaderBase::Fail(absl::Status status) {
       Annotate(status, absl::StrCat("reading ", filename_)));
 }
 
+void FdMMapReaderBase::PrefetchHint(Position length) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  const size_t length_to_prefetch =
+      IntCast<size_t>(UnsignedMin(length, available()));
+  if (length_to_prefetch == 0) return;
+  AdviseMemory(cursor(), length_to_prefetch, AccessPattern::kWillNeed);
+}
+
+bool FdMMapReaderBase::ReadRanges(absl::Span<const ReadRange> ranges,
+                                  absl::Span<Chain> dest) {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    const absl::optional<absl::string_view> data = src_chain()->TryFlat();
+    if (data != absl::nullopt) {
+      // Let the kernel fault in pages of all ranges concurrently before they
+      // are copied.
+      for (const ReadRange& range : ranges) {
+        if (range.pos >= data->size()) continue;
+        AdviseMemory(data->data() + IntCast<size_t>(range.pos),
+                     IntCast<size_t>(UnsignedMin(
+                         range.length, data->size() - range.pos)),
+                     AccessPattern::kWillNeed);
+      }
+    }
+  }
+  return ChainReader::ReadRanges(ranges, dest);
+}
+
 bool FdMMapReaderBase::Sync() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   const int src = src_fd();
   return SyncPos(src);
 }
 
+void FdWindowedMMapReaderBase::Initialize(
+    int src, absl::optional<Position> independent_pos,
+    AccessPattern access_pattern) {
+  RIEGELI_ASSERT_GE(src, 0) << "Failed precondition of FdWindowedMMapReader: "
+                               "negative file descriptor";
+  SetFilename(src);
+  InitializePos(src, independent_pos, access_pattern);
+}
+
+inline void FdWindowedMMapReaderBase::SetFilename(int src) {
+  if (src == 0) {
+    filename_ = "/dev/stdin";
+  } else {
+    filename_ = absl::StrCat("/proc/self/fd/", src);
+  }
+}
+
+int FdWindowedMMapReaderBase::OpenFd(absl::string_view filename, int flags) {
+  // TODO: When `absl::string_view` becomes C++17 `std::string_view`:
+  // `filename_ = filename`
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int src = open(filename_.c_str(), flags, 0666);
+  if (ABSL_PREDICT_FALSE(src < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return -1;
+  }
+  return src;
+}
+
+void FdWindowedMMapReaderBase::InitializePos(
+    int src, absl::optional<Position> independent_pos,
+    AccessPattern access_pattern) {
+  RIEGELI_ASSERT_GT(window_size_, 0u)
+      << "Failed precondition of FdWindowedMMapReader: zero window size";
+  window_size_ = (window_size_ + (PageSize() - 1)) / PageSize() * PageSize();
+  access_pattern_ = access_pattern;
+  if (ABSL_PREDICT_FALSE(!UpdateSize(src))) return;
+  if (independent_pos != absl::nullopt) {
+    set_limit_pos(UnsignedMin(*independent_pos, size_));
+  } else {
+    const off_t file_pos = lseek(src, 0, SEEK_CUR);
+    if (ABSL_PREDICT_FALSE(file_pos < 0)) {
+      FailOperation("lseek()");
+      return;
+    }
+    set_limit_pos(UnsignedMin(IntCast<Position>(file_pos), size_));
+  }
+}
+
+inline bool FdWindowedMMapReaderBase::SyncPos(int src) {
+  if (!has_independent_pos_) {
+    if (ABSL_PREDICT_FALSE(lseek(src, IntCast<off_t>(pos()), SEEK_SET) < 0)) {
+      return FailOperation("lseek()");
+    }
+  }
+  return true;
+}
+
+inline bool FdWindowedMMapReaderBase::UpdateSize(int src) {
+  struct stat stat_info;
+  if (ABSL_PREDICT_FALSE(fstat(src, &stat_info) < 0)) {
+    return FailOperation("fstat()");
+  }
+  size_ = IntCast<Position>(stat_info.st_size);
+  return true;
+}
+
+bool FdWindowedMMapReaderBase::MapWindow(int src, Position new_pos,
+                                         size_t min_length) {
+  RIEGELI_ASSERT_LT(new_pos, size_)
+      << "Failed precondition of FdWindowedMMapReaderBase::MapWindow(): "
+         "position out of range";
+  UnmapWindow();
+  set_buffer();
+  set_limit_pos(new_pos);
+  const Position window_pos = new_pos - new_pos % PageSize();
+  const size_t offset_in_window = IntCast<size_t>(new_pos - window_pos);
+  const Position window_end = UnsignedMin(
+      size_, window_pos + UnsignedMax(Position{window_size_},
+                                      Position{offset_in_window} + min_length));
+  if (ABSL_PREDICT_FALSE(window_end - window_pos >
+                         std::numeric_limits<size_t>::max())) {
+    return Fail(absl::OutOfRangeError("Window too large for mmap()"));
+  }
+  const size_t window_length = IntCast<size_t>(window_end - window_pos);
+  void* const data = mmap(nullptr, window_length, PROT_READ, MAP_SHARED, src,
+                          IntCast<off_t>(window_pos));
+  if (ABSL_PREDICT_FALSE(data == MAP_FAILED)) return FailOperation("mmap()");
+  window_data_ = static_cast<char*>(data);
+  window_length_ = window_length;
+  AdviseMemory(window_data_, window_length_, access_pattern_);
+  set_buffer(window_data_, window_length_, offset_in_window);
+  set_limit_pos(window_end);
+  return true;
+}
+
+void FdWindowedMMapReaderBase::UnmapWindow() {
+  if (window_data_ == nullptr) return;
+  RIEGELI_CHECK_EQ(munmap(std::exchange(window_data_, nullptr),
+                          std::exchange(window_length_, 0)),
+                   0)
+      << ErrnoToCanonicalStatus(errno, "munmap() failed").message();
+}
+
+FdWindowedMMapReaderBase::~FdWindowedMMapReaderBase() { UnmapWindow(); }
+
+void FdWindowedMMapReaderBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    const int src = src_fd();
+    SyncPos(src);
+  }
+  Reader::Done();
+  UnmapWindow();
+}
+
+bool FdWindowedMMapReaderBase::FailOperation(absl::string_view operation) {
+  const int error_number = errno;
+  RIEGELI_ASSERT_NE(error_number, 0)
+      << "Failed precondition of FdWindowedMMapReaderBase::FailOperation(): "
+         "zero errno";
+  RIEGELI_ASSERT(is_open())
+      << "Failed precondition of FdWindowedMMapReaderBase::FailOperation(): "
+         "Object closed";
+  return Fail(
+      ErrnoToCanonicalStatus(error_number, absl::StrCat(operation, " failed")));
+}
+
+bool FdWindowedMMapReaderBase::Fail(absl::Status status) {
+  RIEGELI_ASSERT(!status.ok())
+      << "Failed precondition of Object::Fail(): status not failed";
+  return Reader::Fail(Annotate(status, absl::StrCat("reading ", filename_)));
+}
+
+bool FdWindowedMMapReaderBase::PullSlow(size_t min_length,
+                                        size_t recommended_length) {
+  RIEGELI_ASSERT_LT(available(), min_length)
+      << "Failed precondition of Reader::PullSlow(): "
+         "enough data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int src = src_fd();
+  const Position new_pos = pos();
+  if (size_ <= new_pos || size_ - new_pos < min_length) {
+    // The file might have grown.
+    if (ABSL_PREDICT_FALSE(!UpdateSize(src))) return false;
+    if (size_ <= new_pos) return false;
+  }
+  if (ABSL_PREDICT_FALSE(!MapWindow(src, new_pos, min_length))) return false;
+  return available() >= min_length;
+}
+
+bool FdWindowedMMapReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int src = src_fd();
+  if (new_pos >= size_) {
+    // The file might have grown.
+    if (ABSL_PREDICT_FALSE(!UpdateSize(src))) return false;
+    if (new_pos > size_) {
+      // File ends.
+      UnmapWindow();
+      set_buffer();
+      set_limit_pos(size_);
+      return false;
+    }
+    if (new_pos == size_) {
+      UnmapWindow();
+      set_buffer();
+      set_limit_pos(size_);
+      return true;
+    }
+  }
+  return MapWindow(src, new_pos, 0);
+}
+
+bool FdWindowedMMapReaderBase::Sync() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int src = src_fd();
+  return SyncPos(src);
+}
+
+absl::optional<Position> FdWindowedMMapReaderBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  const int src = src_fd();
+  if (ABSL_PREDICT_FALSE(!UpdateSize(src))) return absl::nullopt;
+  return size_;
+}
+
+void FdWindowedMMapReaderBase::PrefetchHint(Position length) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  const size_t length_to_prefetch =
+      IntCast<size_t>(UnsignedMin(length, available()));
+  if (length_to_prefetch == 0) return;
+  AdviseMemory(cursor(), length_to_prefetch, AccessPattern::kWillNeed);
+}
+
 }  // namespace riegeli
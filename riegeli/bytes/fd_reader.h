@@ -29,14 +29,29 @@
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/bytes/buffered_reader.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/reader.h"
 
 namespace riegeli {
 
+// Expected pattern of reading a file, passed to the kernel as a hint.
+enum class AccessPattern {
+  // No hint.
+  kNormal,
+  // Data will be read sequentially: read ahead more aggressively.
+  kSequential,
+  // Data will be read in random order: do not read ahead.
+  kRandom,
+  // The whole file will be read soon: start loading it.
+  kWillNeed,
+};
+
 // Template parameter independent part of `FdReader`.
 class FdReaderBase : public BufferedReader {
  public:
@@ -101,10 +116,71 @@ class FdReaderBase : public BufferedReader {
     }
     size_t buffer_size() const { return buffer_size_; }
 
+    // If larger than `buffer_size()`, the buffer grows during sustained
+    // sequential reading, up to this size, so that a long scan needs fewer
+    // `read()` calls. After a seek the buffer drops to a small size regardless,
+    // so that small random reads do not read much more than needed.
+    //
+    // Default: 0 (the buffer does not grow beyond `buffer_size()`).
+    Options& set_max_buffer_size(size_t max_buffer_size) & {
+      max_buffer_size_ = max_buffer_size;
+      return *this;
+    }
+    Options&& set_max_buffer_size(size_t max_buffer_size) && {
+      return std::move(set_max_buffer_size(max_buffer_size));
+    }
+    size_t max_buffer_size() const { return max_buffer_size_; }
+
+    // If `true`, the file is read with `O_DIRECT`, bypassing the page cache.
+    // This avoids evicting other cached data when a large file is scanned
+    // once.
+    //
+    // `O_DIRECT` requires the file offset, length, and memory address of each
+    // read to be aligned. `FdReader` reads whole aligned blocks into an
+    // aligned buffer and copies the requested data from there, with
+    // `buffer_size()` rounded up to a multiple of 4K.
+    //
+    // If the fd was given rather than opened by `FdReader`, `O_DIRECT` is set
+    // on it with `fcntl()`. The fd position is updated only by `Sync()` and
+    // `Close()`.
+    //
+    // Direct I/O requires random access, and is supported only where
+    // `O_DIRECT` is available (Linux).
+    //
+    // Default: `false`.
+    Options& set_direct_io(bool direct_io) & {
+      direct_io_ = direct_io;
+      return *this;
+    }
+    Options&& set_direct_io(bool direct_io) && {
+      return std::move(set_direct_io(direct_io));
+    }
+    bool direct_io() const { return direct_io_; }
+
+    // Expected pattern of reading the file, passed to the kernel with
+    // `posix_fadvise()` when reading starts. Errors are ignored because this
+    // is only a hint.
+    //
+    // Regardless of this, `PrefetchHint()` passes `POSIX_FADV_WILLNEED` for
+    // the given range.
+    //
+    // Default: `AccessPattern::kNormal`.
+    Options& set_access_pattern(AccessPattern access_pattern) & {
+      access_pattern_ = access_pattern;
+      return *this;
+    }
+    Options&& set_access_pattern(AccessPattern access_pattern) && {
+      return std::move(set_access_pattern(access_pattern));
+    }
+    AccessPattern access_pattern() const { return access_pattern_; }
+
    private:
     absl::optional<Position> assumed_pos_;
     absl::optional<Position> independent_pos_;
     size_t buffer_size_ = kDefaultBufferSize;
+    size_t max_buffer_size_ = 0;
+    bool direct_io_ = false;
+    AccessPattern access_pattern_ = AccessPattern::kNormal;
   };
 
   // Returns the fd being read from. If the fd is owned then changed to -1 by
@@ -121,35 +197,67 @@ class FdReaderBase : public BufferedReader {
   bool SupportsRandomAccess() override { return supports_random_access_; }
   bool SupportsSize() override { return supports_random_access_; }
   absl::optional<Position> Size() override;
+  void PrefetchHint(Position length) override;
+  bool ReadRanges(absl::Span<const ReadRange> ranges,
+                  absl::Span<Chain> dest) override;
 
  protected:
   FdReaderBase() noexcept {}
 
-  explicit FdReaderBase(size_t buffer_size);
+  explicit FdReaderBase(size_t buffer_size, size_t max_buffer_size,
+                        bool direct_io);
 
   FdReaderBase(FdReaderBase&& that) noexcept;
   FdReaderBase& operator=(FdReaderBase&& that) noexcept;
 
   void Reset();
-  void Reset(size_t buffer_size);
+  void Reset(size_t buffer_size, size_t max_buffer_size, bool direct_io);
   void Initialize(int src, absl::optional<Position> assumed_pos,
-                  absl::optional<Position> independent_pos);
+                  absl::optional<Position> independent_pos,
+                  AccessPattern access_pattern);
   int OpenFd(absl::string_view filename, int flags);
   void InitializePos(int src, absl::optional<Position> assumed_pos,
-                     absl::optional<Position> independent_pos);
+                     absl::optional<Position> independent_pos,
+                     AccessPattern access_pattern);
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
 
   void Done() override;
-  bool ReadInternal(size_t min_length, size_t max_length, char* dest) override;
-  bool SeekSlow(Position new_pos) override;
+  bool ReadInternal(size_t min_length, size_t max_length, char* dest) final;
+  using BufferedReader::CopySlow;
+  bool CopySlow(Position length, Writer& dest) final;
+  bool SeekSlow(Position new_pos) final;
 
  private:
+  // Alignment of file offsets, lengths, and memory addresses for `O_DIRECT`.
+  // This is the common logical block size of storage devices, and it divides
+  // the 64K block size of the Riegeli/records file format.
+  static constexpr size_t kDirectIoAlignment = size_t{4} << 10;
+
+  // Minimum length for which `CopySlow()` to an `FdWriter` lets the kernel copy
+  // the data.
+  static constexpr Position kMinLengthToCopyInKernel = Position{64} << 10;
+
+  // Maximum number of threads issuing `pread()` concurrently in
+  // `ReadRanges()`.
+  static constexpr size_t kMaxConcurrentReads = 16;
+
   void SetFilename(int src);
+  void InitializeDirectIo(int src);
   bool SyncPos(int src);
+  bool ReadDirect(int src, size_t min_length, size_t max_length, char* dest);
 
   std::string filename_;
   bool supports_random_access_ = false;
   bool has_independent_pos_ = false;
+  // Size of the aligned part of `direct_buffer_`, or 0 if `O_DIRECT` is not
+  // used.
+  size_t direct_buffer_size_ = 0;
+  // If `direct_buffer_size_ > 0`, holds `direct_buffer_length_` bytes read
+  // from the file starting at `direct_buffer_pos_`, at the first
+  // `kDirectIoAlignment`-aligned address in `direct_buffer_`.
+  Buffer direct_buffer_;
+  Position direct_buffer_pos_ = 0;
+  size_t direct_buffer_length_ = 0;
 
   // Invariant: `limit_pos() <= std::numeric_limits<off_t>::max()`
 };
@@ -181,8 +289,26 @@ class FdMMapReaderBase : public ChainReader<Chain> {
       return independent_pos_;
     }
 
+    // Expected pattern of reading the file, passed to the kernel with
+    // `madvise()` for the mapping. Errors are ignored because this is only a
+    // hint.
+    //
+    // Regardless of this, `PrefetchHint()` passes `MADV_WILLNEED` for the
+    // given range, so that reading it does not wait for a page fault per page.
+    //
+    // Default: `AccessPattern::kNormal`.
+    Options& set_access_pattern(AccessPattern access_pattern) & {
+      access_pattern_ = access_pattern;
+      return *this;
+    }
+    Options&& set_access_pattern(AccessPattern access_pattern) && {
+      return std::move(set_access_pattern(access_pattern));
+    }
+    AccessPattern access_pattern() const { return access_pattern_; }
+
    private:
     absl::optional<Position> independent_pos_;
+    AccessPattern access_pattern_ = AccessPattern::kNormal;
   };
 
   // Returns the fd being read from. If the fd is owned then changed to -1 by
@@ -196,6 +322,9 @@ class FdMMapReaderBase : public ChainReader<Chain> {
   using ChainReader::Fail;
   bool Fail(absl::Status status) override;
   bool Sync() override;
+  void PrefetchHint(Position length) override;
+  bool ReadRanges(absl::Span<const ReadRange> ranges,
+                  absl::Span<Chain> dest) override;
 
  protected:
   FdMMapReaderBase() noexcept {}
@@ -207,9 +336,11 @@ class FdMMapReaderBase : public ChainReader<Chain> {
 
   void Reset();
   void Reset(bool has_independent_pos);
-  void Initialize(int src, absl::optional<Position> independent_pos);
+  void Initialize(int src, absl::optional<Position> independent_pos,
+                  AccessPattern access_pattern);
   int OpenFd(absl::string_view filename, int flags);
-  void InitializePos(int src, absl::optional<Position> independent_pos);
+  void InitializePos(int src, absl::optional<Position> independent_pos,
+                     AccessPattern access_pattern);
 
   void Done() override;
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
@@ -222,6 +353,137 @@ class FdMMapReaderBase : public ChainReader<Chain> {
   bool has_independent_pos_ = false;
 };
 
+// Template parameter independent part of `FdWindowedMMapReader`.
+class FdWindowedMMapReaderBase : public Reader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // If `absl::nullopt`, `FdWindowedMMapReader` reads starting from the
+    // current fd position. The `FdWindowedMMapReader` position is synchronized
+    // back to the fd by `Close()` and `Sync()`.
+    //
+    // If not `absl::nullopt`, `FdWindowedMMapReader` reads starting from this
+    // position, without disturbing the current fd position. This is useful for
+    // multiple readers concurrently reading from the same fd.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_independent_pos(absl::optional<Position> independent_pos) & {
+      independent_pos_ = independent_pos;
+      return *this;
+    }
+    Options&& set_independent_pos(absl::optional<Position> independent_pos) && {
+      return std::move(set_independent_pos(independent_pos));
+    }
+    absl::optional<Position> independent_pos() const {
+      return independent_pos_;
+    }
+
+    // Size of a part of the file mapped to memory at a time. It is rounded up
+    // to a multiple of the page size.
+    //
+    // Seeking within the current window does not change the mapping. A window
+    // is mapped when reading or seeking leaves the current window, and it is
+    // unmapped when the next window is mapped.
+    //
+    // Default: 64M
+    Options& set_window_size(size_t window_size) & {
+      RIEGELI_ASSERT_GT(window_size, 0u)
+          << "Failed precondition of "
+             "FdWindowedMMapReaderBase::Options::set_window_size(): "
+             "zero window size";
+      window_size_ = window_size;
+      return *this;
+    }
+    Options&& set_window_size(size_t window_size) && {
+      return std::move(set_window_size(window_size));
+    }
+    size_t window_size() const { return window_size_; }
+
+    // Expected pattern of reading the file, passed to the kernel with
+    // `madvise()` for each window. Errors are ignored because this is only a
+    // hint.
+    //
+    // Default: `AccessPattern::kNormal`.
+    Options& set_access_pattern(AccessPattern access_pattern) & {
+      access_pattern_ = access_pattern;
+      return *this;
+    }
+    Options&& set_access_pattern(AccessPattern access_pattern) && {
+      return std::move(set_access_pattern(access_pattern));
+    }
+    AccessPattern access_pattern() const { return access_pattern_; }
+
+   private:
+    absl::optional<Position> independent_pos_;
+    size_t window_size_ = size_t{64} << 20;
+    AccessPattern access_pattern_ = AccessPattern::kNormal;
+  };
+
+  ~FdWindowedMMapReaderBase();
+
+  // Returns the fd being read from. If the fd is owned then changed to -1 by
+  // `Close()`, otherwise unchanged.
+  virtual int src_fd() const = 0;
+
+  // Returns the original name of the file being read from (or "/dev/stdin" or
+  // "/proc/self/fd/<fd>" if fd was given). Unchanged by `Close()`.
+  const std::string& filename() const { return filename_; }
+
+  using Reader::Fail;
+  bool Fail(absl::Status status) override;
+  bool Sync() override;
+  bool SupportsRandomAccess() override { return true; }
+  bool SupportsSize() override { return true; }
+  absl::optional<Position> Size() override;
+  void PrefetchHint(Position length) override;
+
+ protected:
+  FdWindowedMMapReaderBase() noexcept : Reader(kInitiallyClosed) {}
+
+  explicit FdWindowedMMapReaderBase(size_t window_size,
+                                    bool has_independent_pos);
+
+  FdWindowedMMapReaderBase(FdWindowedMMapReaderBase&& that) noexcept;
+  FdWindowedMMapReaderBase& operator=(FdWindowedMMapReaderBase&& that) noexcept;
+
+  void Reset();
+  void Reset(size_t window_size, bool has_independent_pos);
+  void Initialize(int src, absl::optional<Position> independent_pos,
+                  AccessPattern access_pattern);
+  int OpenFd(absl::string_view filename, int flags);
+  void InitializePos(int src, absl::optional<Position> independent_pos,
+                     AccessPattern access_pattern);
+
+  void Done() override;
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+  bool PullSlow(size_t min_length, size_t recommended_length) override;
+  bool SeekSlow(Position new_pos) override;
+
+ private:
+  void SetFilename(int src);
+  bool SyncPos(int src);
+  bool UpdateSize(int src);
+  // Maps a window containing at least `min_length` bytes starting from
+  // `new_pos`, or fewer if the file ends earlier, and makes it the buffer.
+  //
+  // Precondition: `new_pos < size_`
+  bool MapWindow(int src, Position new_pos, size_t min_length);
+  void UnmapWindow();
+
+  std::string filename_;
+  bool has_independent_pos_ = false;
+  size_t window_size_ = 0;
+  AccessPattern access_pattern_ = AccessPattern::kNormal;
+  // File size as of the last `fstat()`.
+  Position size_ = 0;
+  // The current window, or `nullptr` if none is mapped. It starts at a page
+  // boundary at or before `start()`.
+  char* window_data_ = nullptr;
+  size_t window_length_ = 0;
+};
+
 // A `Reader` which reads from a file descriptor.
 //
 // The fd must support:
@@ -231,6 +493,16 @@ class FdMMapReaderBase : public ChainReader<Chain> {
 //  * `lseek()` - for `Seek()` or `Size()`
 //                if `Options::independent_pos() == absl::nullopt`
 //  * `fstat()` - for `Seek()` or `Size()`
+//  * `fcntl()` - if `Options::direct_io()`
+//
+// `ReadRanges()` reads the ranges with `pread()` from up to 16 threads
+// concurrently if random access is supported, without changing the buffer or
+// the fd position.
+//
+// Copying a large amount of data to an `FdWriter` with `Copy()` lets the kernel
+// copy it with `copy_file_range()` or `sendfile()` where possible (Linux),
+// without passing it through process memory, unless either side uses
+// `Options::direct_io()`.
 //
 // `FdReader` supports random access if
 // `Options::assumed_pos() == absl::nullopt` and the fd supports random access
@@ -302,7 +574,8 @@ class FdReader : public FdReaderBase {
   using FdReaderBase::Initialize;
   void Initialize(absl::string_view filename, int flags,
                   absl::optional<Position> assumed_pos,
-                  absl::optional<Position> independent_pos);
+                  absl::optional<Position> independent_pos,
+                  AccessPattern access_pattern);
 
   // The object providing and possibly owning the fd being read from.
   Dependency<int, Src> src_;
@@ -400,7 +673,8 @@ class FdMMapReader : public FdMMapReaderBase {
  private:
   using FdMMapReaderBase::Initialize;
   void Initialize(absl::string_view filename, int flags,
-                  absl::optional<Position> independent_pos);
+                  absl::optional<Position> independent_pos,
+                  AccessPattern access_pattern);
 
   // The object providing and possibly owning the fd being read from.
   Dependency<int, Src> src_;
@@ -431,10 +705,128 @@ explicit FdMMapReader(
     ->FdMMapReader<>;
 #endif
 
+// A `Reader` which reads from a file descriptor by mapping a window of the file
+// to memory at a time. It supports random access.
+//
+// In contrast to `FdMMapReader`, the file does not have to fit in the address
+// space, and reading many large files concurrently does not keep whole files
+// mapped. On the other hand, reading to a `Chain` or `absl::Cord` copies the
+// data.
+//
+// The fd must support:
+//  * `close()` - if the fd is owned
+//  * `fstat()`
+//  * `mmap()`
+//  * `lseek()` - if `Options::independent_pos() == absl::nullopt`
+//
+// The `Src` template parameter specifies the type of the object providing and
+// possibly owning the fd being read from. `Src` must support
+// `Dependency<int, Src>`, e.g. `OwnedFd` (owned, default), `UnownedFd`
+// (not owned).
+//
+// By relying on CTAD the template argument can be deduced as `OwnedFd` if the
+// first constructor argument is a filename or an `int`, otherwise as the value
+// type of the first constructor argument. This requires C++17.
+//
+// The fd must not be closed until the `FdWindowedMMapReader` is closed or no
+// longer used. `File` contents must not be changed while data read from the
+// file is accessed without a memory copy. Data pointed to by `cursor()` is
+// valid only until the next non-const operation.
+template <typename Src = OwnedFd>
+class FdWindowedMMapReader : public FdWindowedMMapReaderBase {
+ public:
+  // Creates a closed `FdWindowedMMapReader`.
+  FdWindowedMMapReader() noexcept {}
+
+  // Will read from the fd provided by `src`.
+  explicit FdWindowedMMapReader(const Src& src, Options options = Options());
+  explicit FdWindowedMMapReader(Src&& src, Options options = Options());
+
+  // Will read from the fd provided by a `Src` constructed from elements of
+  // `src_args`. This avoids constructing a temporary `Src` and moving from it.
+  template <typename... SrcArgs>
+  explicit FdWindowedMMapReader(std::tuple<SrcArgs...> src_args,
+                                Options options = Options());
+
+  // Opens a file for reading.
+  //
+  // `flags` is the second argument of `open()`, typically `O_RDONLY`.
+  //
+  // `flags` must include either `O_RDONLY` or `O_RDWR`.
+  explicit FdWindowedMMapReader(absl::string_view filename, int flags,
+                                Options options = Options());
+
+  FdWindowedMMapReader(FdWindowedMMapReader&& that) noexcept;
+  FdWindowedMMapReader& operator=(FdWindowedMMapReader&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `FdWindowedMMapReader`.
+  // This avoids constructing a temporary `FdWindowedMMapReader` and moving from
+  // it.
+  void Reset();
+  void Reset(const Src& src, Options options = Options());
+  void Reset(Src&& src, Options options = Options());
+  template <typename... SrcArgs>
+  void Reset(std::tuple<SrcArgs...> src_args, Options options = Options());
+  void Reset(absl::string_view filename, int flags,
+             Options options = Options());
+
+  // Returns the object providing and possibly owning the fd being read from. If
+  // the fd is owned then changed to -1 by `Close()`, otherwise unchanged.
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  int src_fd() const override { return src_.get(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  using FdWindowedMMapReaderBase::Initialize;
+  void Initialize(absl::string_view filename, int flags,
+                  absl::optional<Position> independent_pos,
+                  AccessPattern access_pattern);
+
+  // The object providing and possibly owning the fd being read from.
+  Dependency<int, Src> src_;
+};
+
+// Support CTAD.
+#if __cpp_deduction_guides
+FdWindowedMMapReader()->FdWindowedMMapReader<DeleteCtad<>>;
+template <typename Src>
+explicit FdWindowedMMapReader(const Src& src,
+                              FdWindowedMMapReaderBase::Options options =
+                                  FdWindowedMMapReaderBase::Options())
+    -> FdWindowedMMapReader<
+        std::conditional_t<std::is_convertible<const Src&, int>::value, OwnedFd,
+                           std::decay_t<Src>>>;
+template <typename Src>
+explicit FdWindowedMMapReader(Src&& src,
+                              FdWindowedMMapReaderBase::Options options =
+                                  FdWindowedMMapReaderBase::Options())
+    -> FdWindowedMMapReader<
+        std::conditional_t<std::is_convertible<Src&&, int>::value, OwnedFd,
+                           std::decay_t<Src>>>;
+template <typename... SrcArgs>
+explicit FdWindowedMMapReader(std::tuple<SrcArgs...> src_args,
+                              FdWindowedMMapReaderBase::Options options =
+                                  FdWindowedMMapReaderBase::Options())
+    -> FdWindowedMMapReader<DeleteCtad<std::tuple<SrcArgs...>>>;
+explicit FdWindowedMMapReader(absl::string_view filename, int flags,
+                              FdWindowedMMapReaderBase::Options options =
+                                  FdWindowedMMapReaderBase::Options())
+    ->FdWindowedMMapReader<>;
+#endif
+
 // Implementation details follow.
 
-inline FdReaderBase::FdReaderBase(size_t buffer_size)
-    : BufferedReader(buffer_size) {}
+inline FdReaderBase::FdReaderBase(size_t buffer_size, size_t max_buffer_size,
+                                  bool direct_io)
+    : BufferedReader(direct_io ? RoundUp<kDirectIoAlignment>(buffer_size)
+                               : buffer_size),
+      direct_buffer_size_(
+          direct_io ? RoundUp<kDirectIoAlignment>(buffer_size) : 0) {
+  set_max_buffer_size(max_buffer_size);
+}
 
 inline FdReaderBase::FdReaderBase(FdReaderBase&& that) noexcept
     : BufferedReader(std::move(that)),
@@ -442,7 +834,11 @@ inline FdReaderBase::FdReaderBase(FdReaderBase&& that) noexcept
       // part was moved.
       filename_(std::move(that.filename_)),
       supports_random_access_(that.supports_random_access_),
-      has_independent_pos_(that.has_independent_pos_) {}
+      has_independent_pos_(that.has_independent_pos_),
+      direct_buffer_size_(that.direct_buffer_size_),
+      direct_buffer_(std::move(that.direct_buffer_)),
+      direct_buffer_pos_(that.direct_buffer_pos_),
+      direct_buffer_length_(std::exchange(that.direct_buffer_length_, 0)) {}
 
 inline FdReaderBase& FdReaderBase::operator=(FdReaderBase&& that) noexcept {
   BufferedReader::operator=(std::move(that));
@@ -451,6 +847,10 @@ inline FdReaderBase& FdReaderBase::operator=(FdReaderBase&& that) noexcept {
   filename_ = std::move(that.filename_);
   supports_random_access_ = that.supports_random_access_;
   has_independent_pos_ = that.has_independent_pos_;
+  direct_buffer_size_ = that.direct_buffer_size_;
+  direct_buffer_ = std::move(that.direct_buffer_);
+  direct_buffer_pos_ = that.direct_buffer_pos_;
+  direct_buffer_length_ = std::exchange(that.direct_buffer_length_, 0);
   return *this;
 }
 
@@ -459,13 +859,24 @@ inline void FdReaderBase::Reset() {
   filename_.clear();
   supports_random_access_ = false;
   has_independent_pos_ = false;
+  direct_buffer_size_ = 0;
+  direct_buffer_ = Buffer();
+  direct_buffer_pos_ = 0;
+  direct_buffer_length_ = 0;
 }
 
-inline void FdReaderBase::Reset(size_t buffer_size) {
-  BufferedReader::Reset(buffer_size);
+inline void FdReaderBase::Reset(size_t buffer_size, size_t max_buffer_size,
+                                bool direct_io) {
+  BufferedReader::Reset(direct_io ? RoundUp<kDirectIoAlignment>(buffer_size)
+                                  : buffer_size);
+  set_max_buffer_size(max_buffer_size);
   // `filename_` will be set by `Initialize()`.
   supports_random_access_ = false;
   has_independent_pos_ = false;
+  direct_buffer_size_ =
+      direct_io ? RoundUp<kDirectIoAlignment>(buffer_size) : 0;
+  direct_buffer_pos_ = 0;
+  direct_buffer_length_ = 0;
 }
 
 inline FdMMapReaderBase::FdMMapReaderBase(bool has_independent_pos)
@@ -505,30 +916,95 @@ inline void FdMMapReaderBase::Reset(bool has_independent_pos) {
   has_independent_pos_ = has_independent_pos;
 }
 
+inline FdWindowedMMapReaderBase::FdWindowedMMapReaderBase(
+    size_t window_size, bool has_independent_pos)
+    : Reader(kInitiallyOpen),
+      has_independent_pos_(has_independent_pos),
+      window_size_(window_size) {}
+
+inline FdWindowedMMapReaderBase::FdWindowedMMapReaderBase(
+    FdWindowedMMapReaderBase&& that) noexcept
+    : Reader(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      filename_(std::move(that.filename_)),
+      has_independent_pos_(that.has_independent_pos_),
+      window_size_(that.window_size_),
+      access_pattern_(that.access_pattern_),
+      size_(that.size_),
+      window_data_(std::exchange(that.window_data_, nullptr)),
+      window_length_(std::exchange(that.window_length_, 0)) {}
+
+inline FdWindowedMMapReaderBase& FdWindowedMMapReaderBase::operator=(
+    FdWindowedMMapReaderBase&& that) noexcept {
+  UnmapWindow();
+  Reader::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  filename_ = std::move(that.filename_);
+  has_independent_pos_ = that.has_independent_pos_;
+  window_size_ = that.window_size_;
+  access_pattern_ = that.access_pattern_;
+  size_ = that.size_;
+  window_data_ = std::exchange(that.window_data_, nullptr);
+  window_length_ = std::exchange(that.window_length_, 0);
+  return *this;
+}
+
+inline void FdWindowedMMapReaderBase::Reset() {
+  UnmapWindow();
+  Reader::Reset(kInitiallyClosed);
+  filename_.clear();
+  has_independent_pos_ = false;
+  window_size_ = 0;
+  access_pattern_ = AccessPattern::kNormal;
+  size_ = 0;
+}
+
+inline void FdWindowedMMapReaderBase::Reset(size_t window_size,
+                                            bool has_independent_pos) {
+  UnmapWindow();
+  Reader::Reset(kInitiallyOpen);
+  // `filename_` will be set by `Initialize()`.
+  has_independent_pos_ = has_independent_pos;
+  window_size_ = window_size;
+  // `access_pattern_` and `size_` will be set by `InitializePos()`.
+}
+
 template <typename Src>
 inline FdReader<Src>::FdReader(const Src& src, Options options)
-    : FdReaderBase(options.buffer_size()), src_(src) {
-  Initialize(src_.get(), options.assumed_pos(), options.independent_pos());
+    : FdReaderBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io()), src_(src) {
+  Initialize(src_.get(), options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 inline FdReader<Src>::FdReader(Src&& src, Options options)
-    : FdReaderBase(options.buffer_size()), src_(std::move(src)) {
-  Initialize(src_.get(), options.assumed_pos(), options.independent_pos());
+    : FdReaderBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io()),
+      src_(std::move(src)) {
+  Initialize(src_.get(), options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 template <typename... SrcArgs>
 inline FdReader<Src>::FdReader(std::tuple<SrcArgs...> src_args, Options options)
-    : FdReaderBase(options.buffer_size()), src_(std::move(src_args)) {
-  Initialize(src_.get(), options.assumed_pos(), options.independent_pos());
+    : FdReaderBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io()),
+      src_(std::move(src_args)) {
+  Initialize(src_.get(), options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 inline FdReader<Src>::FdReader(absl::string_view filename, int flags,
                                Options options)
-    : FdReaderBase(options.buffer_size()) {
-  Initialize(filename, flags, options.assumed_pos(), options.independent_pos());
+    : FdReaderBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io()) {
+  Initialize(filename, flags, options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
@@ -555,39 +1031,48 @@ inline void FdReader<Src>::Reset() {
 
 template <typename Src>
 inline void FdReader<Src>::Reset(const Src& src, Options options) {
-  FdReaderBase::Reset(options.buffer_size());
+  FdReaderBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io());
   src_.Reset(src);
-  Initialize(src_.get(), options.assumed_pos(), options.independent_pos());
+  Initialize(src_.get(), options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 inline void FdReader<Src>::Reset(Src&& src, Options options) {
-  FdReaderBase::Reset(options.buffer_size());
+  FdReaderBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io());
   src_.Reset(std::move(src));
-  Initialize(src_.get(), options.assumed_pos(), options.independent_pos());
+  Initialize(src_.get(), options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 template <typename... SrcArgs>
 inline void FdReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
                                  Options options) {
-  FdReaderBase::Reset(options.buffer_size());
+  FdReaderBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io());
   src_.Reset(std::move(src_args));
-  Initialize(src_.get(), options.assumed_pos(), options.independent_pos());
+  Initialize(src_.get(), options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 inline void FdReader<Src>::Reset(absl::string_view filename, int flags,
                                  Options options) {
-  FdReaderBase::Reset(options.buffer_size());
+  FdReaderBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io());
   src_.Reset();  // In case `OpenFd()` fails.
-  Initialize(filename, flags, options.assumed_pos(), options.independent_pos());
+  Initialize(filename, flags, options.assumed_pos(), options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 void FdReader<Src>::Initialize(absl::string_view filename, int flags,
                                absl::optional<Position> assumed_pos,
-                               absl::optional<Position> independent_pos) {
+                               absl::optional<Position> independent_pos,
+                               AccessPattern access_pattern) {
   RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
                  (flags & O_ACCMODE) == O_RDWR)
       << "Failed precondition of FdReader: "
@@ -595,7 +1080,7 @@ void FdReader<Src>::Initialize(absl::string_view filename, int flags,
   const int src = OpenFd(filename, flags);
   if (ABSL_PREDICT_FALSE(src < 0)) return;
   src_.Reset(std::forward_as_tuple(src));
-  InitializePos(src_.get(), assumed_pos, independent_pos);
+  InitializePos(src_.get(), assumed_pos, independent_pos, access_pattern);
 }
 
 template <typename Src>
@@ -613,14 +1098,14 @@ void FdReader<Src>::Done() {
 template <typename Src>
 inline FdMMapReader<Src>::FdMMapReader(const Src& src, Options options)
     : FdMMapReaderBase(options.independent_pos() != absl::nullopt), src_(src) {
-  Initialize(src_.get(), options.independent_pos());
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
 }
 
 template <typename Src>
 inline FdMMapReader<Src>::FdMMapReader(Src&& src, Options options)
     : FdMMapReaderBase(options.independent_pos() != absl::nullopt),
       src_(std::move(src)) {
-  Initialize(src_.get(), options.independent_pos());
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
 }
 
 template <typename Src>
@@ -629,14 +1114,15 @@ inline FdMMapReader<Src>::FdMMapReader(std::tuple<SrcArgs...> src_args,
                                        Options options)
     : FdMMapReaderBase(options.independent_pos() != absl::nullopt),
       src_(std::move(src_args)) {
-  Initialize(src_.get(), options.independent_pos());
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
 }
 
 template <typename Src>
 inline FdMMapReader<Src>::FdMMapReader(absl::string_view filename, int flags,
                                        Options options)
     : FdMMapReaderBase(options.independent_pos() != absl::nullopt) {
-  Initialize(filename, flags, options.independent_pos());
+  Initialize(filename, flags, options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
@@ -666,14 +1152,14 @@ template <typename Src>
 inline void FdMMapReader<Src>::Reset(const Src& src, Options options) {
   FdMMapReaderBase::Reset(options.independent_pos() != absl::nullopt);
   src_.Reset(src);
-  Initialize(src_.get(), options.independent_pos());
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
 }
 
 template <typename Src>
 inline void FdMMapReader<Src>::Reset(Src&& src, Options options) {
   FdMMapReaderBase::Reset(options.independent_pos() != absl::nullopt);
   src_.Reset(std::move(src));
-  Initialize(src_.get(), options.independent_pos());
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
 }
 
 template <typename Src>
@@ -682,7 +1168,7 @@ inline void FdMMapReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
                                      Options options) {
   FdMMapReaderBase::Reset(options.independent_pos() != absl::nullopt);
   src_.Reset(std::move(src_args));
-  Initialize(src_.get(), options.independent_pos());
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
 }
 
 template <typename Src>
@@ -690,12 +1176,14 @@ inline void FdMMapReader<Src>::Reset(absl::string_view filename, int flags,
                                      Options options) {
   FdMMapReaderBase::Reset(options.independent_pos() != absl::nullopt);
   src_.Reset();  // In case `OpenFd()` fails.
-  Initialize(filename, flags, options.independent_pos());
+  Initialize(filename, flags, options.independent_pos(),
+             options.access_pattern());
 }
 
 template <typename Src>
 void FdMMapReader<Src>::Initialize(absl::string_view filename, int flags,
-                                   absl::optional<Position> independent_pos) {
+                                   absl::optional<Position> independent_pos,
+                                   AccessPattern access_pattern) {
   RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
                  (flags & O_ACCMODE) == O_RDWR)
       << "Failed precondition of FdMMapReader: "
@@ -703,7 +1191,7 @@ void FdMMapReader<Src>::Initialize(absl::string_view filename, int flags,
   const int src = OpenFd(filename, flags);
   if (ABSL_PREDICT_FALSE(src < 0)) return;
   src_.Reset(std::forward_as_tuple(src));
-  InitializePos(src_.get(), independent_pos);
+  InitializePos(src_.get(), independent_pos, access_pattern);
 }
 
 template <typename Src>
@@ -718,6 +1206,130 @@ void FdMMapReader<Src>::Done() {
   }
 }
 
+template <typename Src>
+inline FdWindowedMMapReader<Src>::FdWindowedMMapReader(const Src& src,
+                                                       Options options)
+    : FdWindowedMMapReaderBase(options.window_size(),
+                               options.independent_pos() != absl::nullopt),
+      src_(src) {
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
+}
+
+template <typename Src>
+inline FdWindowedMMapReader<Src>::FdWindowedMMapReader(Src&& src,
+                                                       Options options)
+    : FdWindowedMMapReaderBase(options.window_size(),
+                               options.independent_pos() != absl::nullopt),
+      src_(std::move(src)) {
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline FdWindowedMMapReader<Src>::FdWindowedMMapReader(
+    std::tuple<SrcArgs...> src_args, Options options)
+    : FdWindowedMMapReaderBase(options.window_size(),
+                               options.independent_pos() != absl::nullopt),
+      src_(std::move(src_args)) {
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
+}
+
+template <typename Src>
+inline FdWindowedMMapReader<Src>::FdWindowedMMapReader(
+    absl::string_view filename, int flags, Options options)
+    : FdWindowedMMapReaderBase(options.window_size(),
+                               options.independent_pos() != absl::nullopt) {
+  Initialize(filename, flags, options.independent_pos(),
+             options.access_pattern());
+}
+
+template <typename Src>
+inline FdWindowedMMapReader<Src>::FdWindowedMMapReader(
+    FdWindowedMMapReader&& that) noexcept
+    : FdWindowedMMapReaderBase(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline FdWindowedMMapReader<Src>& FdWindowedMMapReader<Src>::operator=(
+    FdWindowedMMapReader&& that) noexcept {
+  FdWindowedMMapReaderBase::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+inline void FdWindowedMMapReader<Src>::Reset() {
+  FdWindowedMMapReaderBase::Reset();
+  src_.Reset();
+}
+
+template <typename Src>
+inline void FdWindowedMMapReader<Src>::Reset(const Src& src,
+                                             Options options) {
+  FdWindowedMMapReaderBase::Reset(options.window_size(),
+                                  options.independent_pos() != absl::nullopt);
+  src_.Reset(src);
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
+}
+
+template <typename Src>
+inline void FdWindowedMMapReader<Src>::Reset(Src&& src, Options options) {
+  FdWindowedMMapReaderBase::Reset(options.window_size(),
+                                  options.independent_pos() != absl::nullopt);
+  src_.Reset(std::move(src));
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline void FdWindowedMMapReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
+                                             Options options) {
+  FdWindowedMMapReaderBase::Reset(options.window_size(),
+                                  options.independent_pos() != absl::nullopt);
+  src_.Reset(std::move(src_args));
+  Initialize(src_.get(), options.independent_pos(), options.access_pattern());
+}
+
+template <typename Src>
+inline void FdWindowedMMapReader<Src>::Reset(absl::string_view filename,
+                                             int flags, Options options) {
+  FdWindowedMMapReaderBase::Reset(options.window_size(),
+                                  options.independent_pos() != absl::nullopt);
+  src_.Reset();  // In case `OpenFd()` fails.
+  Initialize(filename, flags, options.independent_pos(),
+             options.access_pattern());
+}
+
+template <typename Src>
+void FdWindowedMMapReader<Src>::Initialize(
+    absl::string_view filename, int flags,
+    absl::optional<Position> independent_pos, AccessPattern access_pattern) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of FdWindowedMMapReader: "
+         "flags must include either O_RDONLY or O_RDWR";
+  const int src = OpenFd(filename, flags);
+  if (ABSL_PREDICT_FALSE(src < 0)) return;
+  src_.Reset(std::forward_as_tuple(src));
+  InitializePos(src_.get(), independent_pos, access_pattern);
+}
+
+template <typename Src>
+void FdWindowedMMapReader<Src>::Done() {
+  FdWindowedMMapReaderBase::Done();
+  if (src_.is_owning()) {
+    const int src = src_.Release();
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(src) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BYTES_FD_READER_H_
@@ -0,0 +1,174 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make `fdatasync()` available.
+#if !defined(_XOPEN_SOURCE) || _XOPEN_SOURCE < 500
+#undef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 500
+#endif
+
+// Make `syncfs()` available.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "riegeli/bytes/fd_sync_group.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/memory.h"
+
+namespace riegeli {
+
+namespace internal {
+
+int SyncFd(int fd, bool sync_metadata) {
+#ifdef __linux__
+  if (!sync_metadata) return fdatasync(fd);
+#endif
+  return fsync(fd);
+}
+
+const char* SyncFunctionName(bool sync_metadata) {
+#ifdef __linux__
+  if (!sync_metadata) return "fdatasync()";
+#endif
+  return "fsync()";
+}
+
+}  // namespace internal
+
+FdSyncGroup::FdSyncGroup(Options options)
+    : interval_(options.interval()),
+      sync_filesystem_(options.sync_filesystem()) {}
+
+FdSyncGroup& FdSyncGroup::global() {
+  static NoDestructor<FdSyncGroup> kStaticFdSyncGroup;
+  return *kStaticFdSyncGroup;
+}
+
+absl::Status FdSyncGroup::Sync(int fd, bool sync_metadata) {
+  std::shared_ptr<Pass> pass;
+  size_t request_index;
+  bool is_leader = false;
+  {
+    absl::MutexLock lock(&mutex_);
+    ++stats_.num_requests;
+    if (pending_ == nullptr) {
+      pending_ = std::make_shared<Pass>();
+      is_leader = true;
+    }
+    pass = pending_;
+    request_index = pass->requests.size();
+    pass->requests.push_back(Request{fd, sync_metadata});
+  }
+  if (is_leader) {
+    if (interval_ > absl::ZeroDuration()) absl::SleepFor(interval_);
+    {
+      absl::MutexLock lock(&mutex_);
+      // Further requests start the next pass, so `pass->requests` stays
+      // unchanged.
+      pending_ = nullptr;
+      ++stats_.num_passes;
+    }
+    const uint64_t num_syncs = RunPass(*pass);
+    absl::MutexLock lock(&mutex_);
+    stats_.num_syncs += num_syncs;
+    pass->done = true;
+  } else {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(&pass->done));
+  }
+  const Request& request = pass->requests[request_index];
+  if (ABSL_PREDICT_FALSE(request.error_number != 0)) {
+    return ErrnoToCanonicalStatus(request.error_number,
+                                  request.function_name);
+  }
+  return absl::OkStatus();
+}
+
+uint64_t FdSyncGroup::RunPass(Pass& pass) const {
+  std::vector<Request*> requests;
+  requests.reserve(pass.requests.size());
+  for (Request& request : pass.requests) {
+    request.group_key = static_cast<uint64_t>(request.fd);
+#ifdef __linux__
+    if (sync_filesystem_) {
+      struct stat stat_info;
+      if (ABSL_PREDICT_FALSE(fstat(request.fd, &stat_info) < 0)) {
+        request.function_name = "fstat()";
+        request.error_number = errno;
+        continue;
+      }
+      request.group_key = static_cast<uint64_t>(stat_info.st_dev);
+    }
+#endif
+    requests.push_back(&request);
+  }
+  std::sort(requests.begin(), requests.end(),
+            [](const Request* a, const Request* b) {
+              return a->group_key < b->group_key;
+            });
+  uint64_t num_syncs = 0;
+  for (auto begin = requests.begin(); begin != requests.end();) {
+    const uint64_t group_key = (*begin)->group_key;
+    bool sync_metadata = false;
+    auto end = begin;
+    for (; end != requests.end() && (*end)->group_key == group_key; ++end) {
+      sync_metadata |= (*end)->sync_metadata;
+    }
+    const int fd = (*begin)->fd;
+    const char* function_name;
+    int result;
+#ifdef __linux__
+    if (sync_filesystem_) {
+      function_name = "syncfs()";
+      result = syncfs(fd);
+    } else
+#endif
+    {
+      function_name = internal::SyncFunctionName(sync_metadata);
+      result = internal::SyncFd(fd, sync_metadata);
+    }
+    const int error_number = ABSL_PREDICT_FALSE(result < 0) ? errno : 0;
+    ++num_syncs;
+    for (; begin != end; ++begin) {
+      (*begin)->function_name = function_name;
+      (*begin)->error_number = error_number;
+    }
+  }
+  return num_syncs;
+}
+
+FdSyncGroup::Stats FdSyncGroup::stats() const {
+  absl::MutexLock lock(&mutex_);
+  return stats_;
+}
+
+}  // namespace riegeli
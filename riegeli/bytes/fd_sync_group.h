@@ -0,0 +1,153 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_FD_SYNC_GROUP_H_
+#define RIEGELI_BYTES_FD_SYNC_GROUP_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace riegeli {
+
+// Groups syncs of file descriptors requested concurrently, e.g. by
+// `Flush(FlushType::kFromMachine)` of `FdWriter` objects with
+// `FdWriterBase::Options::set_sync_group()`, so that many writers flushing
+// after each transaction share sync passes instead of each waiting for its own
+// `fsync()`.
+//
+// The first request waits for `Options::interval()` to collect further
+// requests, then syncs each distinct fd (or filesystem) once, and wakes all
+// requests of the pass. Requests arriving meanwhile start the next pass.
+//
+// `FdSyncGroup` is thread-safe.
+class FdSyncGroup {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // How long the first request of a pass waits for further requests. Longer
+    // intervals group more requests per pass at the cost of sync latency.
+    //
+    // Default: `absl::Milliseconds(1)`.
+    Options& set_interval(absl::Duration interval) & {
+      interval_ = interval;
+      return *this;
+    }
+    Options&& set_interval(absl::Duration interval) && {
+      return std::move(set_interval(interval));
+    }
+    absl::Duration interval() const { return interval_; }
+
+    // If `true`, a pass calls `syncfs()` once per filesystem of the requested
+    // fds instead of syncing each fd. This makes all dirty data of the
+    // filesystem durable, including data of unrelated files, which is cheaper
+    // than many `fsync()` calls on a journaling filesystem unless there is much
+    // unrelated dirty data. Failures of writing back data are reported by
+    // `syncfs()` since Linux 5.8.
+    //
+    // This is supported only on Linux. Otherwise each fd is synced.
+    //
+    // Default: `false`.
+    Options& set_sync_filesystem(bool sync_filesystem) & {
+      sync_filesystem_ = sync_filesystem;
+      return *this;
+    }
+    Options&& set_sync_filesystem(bool sync_filesystem) && {
+      return std::move(set_sync_filesystem(sync_filesystem));
+    }
+    bool sync_filesystem() const { return sync_filesystem_; }
+
+   private:
+    absl::Duration interval_ = absl::Milliseconds(1);
+    bool sync_filesystem_ = false;
+  };
+
+  struct Stats {
+    // Number of `Sync()` calls.
+    uint64_t num_requests = 0;
+    // Number of passes.
+    uint64_t num_passes = 0;
+    // Number of `fsync()`, `fdatasync()`, and `syncfs()` calls.
+    uint64_t num_syncs = 0;
+  };
+
+  explicit FdSyncGroup(Options options = Options());
+
+  FdSyncGroup(const FdSyncGroup&) = delete;
+  FdSyncGroup& operator=(const FdSyncGroup&) = delete;
+
+  // Returns a process-wide `FdSyncGroup` with default options.
+  static FdSyncGroup& global();
+
+  // Makes data written to `fd` durable, in a pass shared with concurrent
+  // requests. Blocks until the pass completes.
+  //
+  // If `sync_metadata` then `fsync()` is used, otherwise `fdatasync()` where
+  // available. If requests for the same fd differ, `fsync()` is used.
+  //
+  // `fd` must remain open until `Sync()` returns.
+  absl::Status Sync(int fd, bool sync_metadata = true);
+
+  // Returns statistics collected so far.
+  Stats stats() const;
+
+ private:
+  struct Request {
+    int fd;
+    bool sync_metadata;
+    // Set by the leader of the pass.
+    uint64_t group_key = 0;
+    const char* function_name = nullptr;
+    int error_number = 0;
+  };
+
+  struct Pass {
+    std::vector<Request> requests;
+    bool done = false;
+  };
+
+  // Syncs distinct fds or filesystems of `pass.requests`, setting their
+  // `error_number`. Returns the number of syncs.
+  uint64_t RunPass(Pass& pass) const;
+
+  const absl::Duration interval_;
+  const bool sync_filesystem_;
+  mutable absl::Mutex mutex_;
+  // The pass collecting requests, or `nullptr` if there is none.
+  std::shared_ptr<Pass> pending_ ABSL_GUARDED_BY(mutex_);
+  Stats stats_ ABSL_GUARDED_BY(mutex_);
+};
+
+namespace internal {
+
+// Calls `fsync()` if `sync_metadata`, otherwise `fdatasync()` where available.
+int SyncFd(int fd, bool sync_metadata);
+
+// Returns the name of the function called by `SyncFd()`, for error messages.
+const char* SyncFunctionName(bool sync_metadata);
+
+}  // namespace internal
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_FD_SYNC_GROUP_H_
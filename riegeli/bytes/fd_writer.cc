@@ -18,6 +18,16 @@
 #define _XOPEN_SOURCE 500
 #endif
 
+// Make `pwritev()` available.
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+// Make `O_DIRECT`, `fallocate()`, and `copy_file_range()` available.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 // Make `off_t` 64-bit even on 32-bit systems.
 #undef _FILE_OFFSET_BITS
 #define _FILE_OFFSET_BITS 64
@@ -25,15 +35,24 @@
 #include "riegeli/bytes/fd_writer.h"
 
 #include <fcntl.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <cerrno>
+#include <cstring>
 #include <limits>
 #include <string>
+#include <utility>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
@@ -41,9 +60,14 @@
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/object.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/fd_sync_group.h"
+#include "riegeli/bytes/writer.h"
 
 namespace riegeli {
 
@@ -110,6 +134,12 @@ void FdWriterBase::InitializePos(int dest, int flags,
       << "Failed precondition of FdWriterBase::InitializePos(): "
          "has_independent_pos_ not reset";
   if (assumed_pos != absl::nullopt) {
+    if (ABSL_PREDICT_FALSE(direct_buffer_size_ > 0)) {
+      Fail(absl::InvalidArgumentError(
+          "Options::direct_io() requires random access, which is not "
+          "supported with Options::assumed_pos()"));
+      return;
+    }
     if (ABSL_PREDICT_FALSE(*assumed_pos >
                            Position{std::numeric_limits<off_t>::max()})) {
       FailOverflow();
@@ -125,22 +155,48 @@ void FdWriterBase::InitializePos(int dest, int flags,
       return;
     }
     set_start_pos(*independent_pos);
+    preallocated_end_ = start_pos();
+    if (direct_buffer_size_ > 0) SetDirectIo(dest, true);
   } else {
     const off_t file_pos =
         lseek(dest, 0, (flags & O_APPEND) != 0 ? SEEK_END : SEEK_CUR);
     if (file_pos < 0) {
       if (errno == ESPIPE) {
         // Random access is not supported. Assume the current position as 0.
+        if (ABSL_PREDICT_FALSE(direct_buffer_size_ > 0)) {
+          Fail(absl::InvalidArgumentError(
+              "Options::direct_io() requires random access, which is not "
+              "supported by the fd"));
+        }
       } else {
         FailOperation("lseek()");
       }
       return;
     }
     set_start_pos(IntCast<Position>(file_pos));
+    preallocated_end_ = start_pos();
     supports_random_access_ = true;
+    if (direct_buffer_size_ > 0) SetDirectIo(dest, true);
   }
 }
 
+inline bool FdWriterBase::SetDirectIo(int dest, bool direct_io) {
+#ifdef O_DIRECT
+  const int flags = fcntl(dest, F_GETFL);
+  if (ABSL_PREDICT_FALSE(flags < 0)) return FailOperation("fcntl()");
+  const int new_flags = direct_io ? flags | O_DIRECT : flags & ~O_DIRECT;
+  if (new_flags != flags &&
+      ABSL_PREDICT_FALSE(fcntl(dest, F_SETFL, new_flags) < 0)) {
+    return FailOperation("fcntl()");
+  }
+  return true;
+#else
+  return Fail(absl::UnimplementedError(
+      "Options::direct_io() requires O_DIRECT, which is not available on "
+      "this platform"));
+#endif
+}
+
 inline bool FdWriterBase::SyncPos(int dest) {
   RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
       << "Failed precondition of FdWriterBase::SyncPos(): buffer not empty";
@@ -153,9 +209,60 @@ inline bool FdWriterBase::SyncPos(int dest) {
   return true;
 }
 
+inline void FdWriterBase::Preallocate(int dest, Position end_pos) {
+  if (preallocate_ == 0 || !supports_random_access_ ||
+      end_pos <= preallocated_end_) {
+    return;
+  }
+#ifdef __linux__
+  static constexpr Position kMaxPos =
+      Position{std::numeric_limits<off_t>::max()};
+  const Position rounded_end_pos = end_pos - end_pos % preallocate_;
+  const Position new_end = preallocate_ > kMaxPos - rounded_end_pos
+                               ? kMaxPos
+                               : rounded_end_pos + preallocate_;
+again:
+  if (ABSL_PREDICT_FALSE(
+          fallocate(dest, FALLOC_FL_KEEP_SIZE,
+                    IntCast<off_t>(preallocated_end_),
+                    IntCast<off_t>(new_end - preallocated_end_)) < 0)) {
+    if (errno == EINTR) goto again;
+    // Reserving space is only an optimization. If the filesystem does not
+    // support it or the disk is full, do not try again; writing reports its
+    // own errors. Space reserved so far is still released by `Close()`.
+    preallocated_end_ = kMaxPos;
+    return;
+  }
+  preallocated_end_ = new_end;
+#endif
+}
+
+inline bool FdWriterBase::ReleasePreallocated(int dest) {
+  if (preallocate_ == 0 || !supports_random_access_ || has_independent_pos_) {
+    return true;
+  }
+  struct stat stat_info;
+  if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
+    return FailOperation("fstat()");
+  }
+  if (preallocated_end_ <= IntCast<Position>(stat_info.st_size)) return true;
+again:
+  // Truncating to the current size releases blocks beyond the end of the file.
+  if (ABSL_PREDICT_FALSE(ftruncate(dest, stat_info.st_size) < 0)) {
+    if (errno == EINTR) goto again;
+    return FailOperation("ftruncate()");
+  }
+  return true;
+}
+
 void FdWriterBase::Done() {
-  PushInternal();
+  if (ABSL_PREDICT_TRUE(PushInternal())) {
+    const int dest = dest_fd();
+    if (ABSL_PREDICT_TRUE(PushDirect(dest))) ReleasePreallocated(dest);
+  }
   BufferedWriter::Done();
+  direct_buffer_ = Buffer();
+  direct_buffer_length_ = 0;
 }
 
 bool FdWriterBase::FailOperation(absl::string_view operation) {
@@ -177,6 +284,8 @@ bool FdWriterBase::Fail(absl::Status status) {
       Annotate(status, absl::StrCat("writing ", filename_)));
 }
 
+TypeId FdWriterBase::GetTypeId() const { return TypeId::For<FdWriterBase>(); }
+
 bool FdWriterBase::WriteInternal(absl::string_view src) {
   RIEGELI_ASSERT(!src.empty())
       << "Failed precondition of BufferedWriter::WriteInternal(): "
@@ -192,6 +301,8 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
                              start_pos())) {
     return FailOverflow();
   }
+  Preallocate(dest, start_pos() + src.size());
+  if (direct_buffer_size_ > 0) return WriteDirect(dest, src);
   do {
   again:
     const ssize_t length_written =
@@ -218,16 +329,296 @@ bool FdWriterBase::WriteInternal(absl::string_view src) {
   return true;
 }
 
+inline bool FdWriterBase::WriteToFd(int dest, absl::string_view src,
+                                    Position file_pos) {
+  do {
+  again:
+    const ssize_t length_written =
+        has_independent_pos_
+            ? pwrite(dest, src.data(),
+                     UnsignedMin(src.size(),
+                                 size_t{std::numeric_limits<ssize_t>::max()}),
+                     IntCast<off_t>(file_pos))
+            : write(dest, src.data(),
+                    UnsignedMin(src.size(),
+                                size_t{std::numeric_limits<ssize_t>::max()}));
+    if (ABSL_PREDICT_FALSE(length_written < 0)) {
+      if (errno == EINTR) goto again;
+      return FailOperation(has_independent_pos_ ? "pwrite()" : "write()");
+    }
+    RIEGELI_ASSERT_GT(length_written, 0)
+        << (has_independent_pos_ ? "pwrite()" : "write()") << " returned 0";
+    RIEGELI_ASSERT_LE(IntCast<size_t>(length_written), src.size())
+        << (has_independent_pos_ ? "pwrite()" : "write()")
+        << " wrote more than requested";
+    file_pos += IntCast<size_t>(length_written);
+    src.remove_prefix(IntCast<size_t>(length_written));
+  } while (!src.empty());
+  return true;
+}
+
+inline bool FdWriterBase::WriteWithoutDirectIo(int dest, absl::string_view src,
+                                               Position file_pos) {
+  if (ABSL_PREDICT_FALSE(!SetDirectIo(dest, false))) return false;
+  if (ABSL_PREDICT_FALSE(!WriteToFd(dest, src, file_pos))) return false;
+  return SetDirectIo(dest, true);
+}
+
+inline bool FdWriterBase::WriteDirect(int dest, absl::string_view src) {
+  if (direct_buffer_length_ == 0) {
+    // Write the unaligned head without `O_DIRECT`. This avoids reading the
+    // beginning of its block for a read-modify-write.
+    const size_t head_length = UnsignedMin(
+        src.size(),
+        IntCast<size_t>(RoundUp<kDirectIoAlignment>(start_pos()) -
+                        start_pos()));
+    if (head_length > 0) {
+      if (ABSL_PREDICT_FALSE(!WriteWithoutDirectIo(
+              dest, src.substr(0, head_length), start_pos()))) {
+        return false;
+      }
+      move_start_pos(head_length);
+      src.remove_prefix(head_length);
+    }
+  }
+  direct_buffer_.Reset(direct_buffer_size_ + (kDirectIoAlignment - 1));
+  char* const aligned_buffer =
+      reinterpret_cast<char*>(RoundUp<kDirectIoAlignment>(
+          reinterpret_cast<uintptr_t>(direct_buffer_.data())));
+  while (!src.empty()) {
+    const size_t length =
+        UnsignedMin(src.size(), direct_buffer_size_ - direct_buffer_length_);
+    std::memcpy(aligned_buffer + direct_buffer_length_, src.data(), length);
+    direct_buffer_length_ += length;
+    move_start_pos(length);
+    src.remove_prefix(length);
+    if (direct_buffer_length_ == direct_buffer_size_) {
+      if (ABSL_PREDICT_FALSE(
+              !WriteDirectBuffer(dest, aligned_buffer, direct_buffer_size_))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+inline bool FdWriterBase::WriteDirectBuffer(int dest, char* aligned_buffer,
+                                            size_t length) {
+  RIEGELI_ASSERT_EQ(length % kDirectIoAlignment, 0u)
+      << "Failed precondition of FdWriterBase::WriteDirectBuffer(): "
+         "unaligned length";
+  RIEGELI_ASSERT_LE(length, direct_buffer_length_)
+      << "Failed precondition of FdWriterBase::WriteDirectBuffer(): "
+         "length exceeds buffered data";
+  if (ABSL_PREDICT_FALSE(
+          !WriteToFd(dest, absl::string_view(aligned_buffer, length),
+                     start_pos() - direct_buffer_length_))) {
+    return false;
+  }
+  direct_buffer_length_ -= length;
+  if (direct_buffer_length_ > 0) {
+    std::memmove(aligned_buffer, aligned_buffer + length,
+                 direct_buffer_length_);
+  }
+  return true;
+}
+
+inline bool FdWriterBase::PushDirect(int dest) {
+  if (direct_buffer_length_ == 0) return true;
+  char* const aligned_buffer =
+      reinterpret_cast<char*>(RoundUp<kDirectIoAlignment>(
+          reinterpret_cast<uintptr_t>(direct_buffer_.data())));
+  const size_t aligned_length =
+      RoundDown<kDirectIoAlignment>(direct_buffer_length_);
+  if (aligned_length > 0) {
+    if (ABSL_PREDICT_FALSE(
+            !WriteDirectBuffer(dest, aligned_buffer, aligned_length))) {
+      return false;
+    }
+  }
+  if (direct_buffer_length_ > 0) {
+    // Write the unaligned tail without `O_DIRECT`. Further data will continue
+    // with an unaligned head.
+    if (ABSL_PREDICT_FALSE(!WriteWithoutDirectIo(
+            dest, absl::string_view(aligned_buffer, direct_buffer_length_),
+            start_pos() - direct_buffer_length_))) {
+      return false;
+    }
+    direct_buffer_length_ = 0;
+  }
+  return true;
+}
+
+bool FdWriterBase::WriteInternal(const Chain& src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): " << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not empty";
+  if (direct_buffer_size_ > 0) return BufferedWriter::WriteInternal(src);
+#ifndef __linux__
+  if (has_independent_pos_) return BufferedWriter::WriteInternal(src);
+#endif
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         Position{std::numeric_limits<off_t>::max()} -
+                             start_pos())) {
+    return FailOverflow();
+  }
+  Preallocate(dest, start_pos() + src.size());
+  // Write up to `kMaxIovecs` blocks with one system call, starting from
+  // `offset` in the block with `block_index`.
+#ifdef IOV_MAX
+  static constexpr int kMaxIovecs = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#else
+  static constexpr int kMaxIovecs = 16;
+#endif
+  static constexpr size_t kMaxLength =
+      size_t{std::numeric_limits<ssize_t>::max()};
+  const Chain::Blocks blocks = src.blocks();
+  size_t block_index = 0;
+  size_t offset = 0;
+  size_t remaining = src.size();
+  do {
+    struct iovec iov[kMaxIovecs];
+    int iovcnt = 0;
+    size_t length = 0;
+    for (size_t i = block_index;
+         i < blocks.size() && iovcnt < kMaxIovecs && length < kMaxLength; ++i) {
+      absl::string_view fragment = blocks[i];
+      if (i == block_index) fragment.remove_prefix(offset);
+      if (fragment.empty()) continue;
+      const size_t fragment_length =
+          UnsignedMin(fragment.size(), kMaxLength - length);
+      iov[iovcnt].iov_base = const_cast<char*>(fragment.data());
+      iov[iovcnt].iov_len = fragment_length;
+      ++iovcnt;
+      length += fragment_length;
+    }
+    ssize_t length_written;
+  again:
+#ifdef __linux__
+    if (has_independent_pos_) {
+      length_written = pwritev(dest, iov, iovcnt, IntCast<off_t>(start_pos()));
+    } else
+#endif
+    {
+      length_written = writev(dest, iov, iovcnt);
+    }
+    if (ABSL_PREDICT_FALSE(length_written < 0)) {
+      if (errno == EINTR) goto again;
+      return FailOperation(has_independent_pos_ ? "pwritev()" : "writev()");
+    }
+    RIEGELI_ASSERT_GT(length_written, 0)
+        << (has_independent_pos_ ? "pwritev()" : "writev()") << " returned 0";
+    RIEGELI_ASSERT_LE(IntCast<size_t>(length_written), length)
+        << (has_independent_pos_ ? "pwritev()" : "writev()")
+        << " wrote more than requested";
+    move_start_pos(IntCast<size_t>(length_written));
+    remaining -= IntCast<size_t>(length_written);
+    // Skip blocks which have been written.
+    size_t to_skip = IntCast<size_t>(length_written);
+    while (to_skip > 0) {
+      const size_t left = blocks[block_index].size() - offset;
+      if (to_skip < left) {
+        offset += to_skip;
+        break;
+      }
+      to_skip -= left;
+      ++block_index;
+      offset = 0;
+    }
+  } while (remaining > 0);
+  return true;
+}
+
+bool FdWriterBase::CopyFromFd(int src, Position* src_pos, Position length,
+                              Position& length_copied) {
+  length_copied = 0;
+#ifdef __linux__
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  // Kernel copies bypass the alignment handling of `O_DIRECT`.
+  if (direct_buffer_size_ > 0) return false;
+  static constexpr Position kMaxPos =
+      Position{std::numeric_limits<off_t>::max()};
+  if (ABSL_PREDICT_FALSE(length > kMaxPos - pos() ||
+                         (src_pos != nullptr && length > kMaxPos - *src_pos))) {
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  const int dest = dest_fd();
+  Preallocate(dest, start_pos() + length);
+  // `sendfile()` writes at the current fd position, so it is not applicable
+  // with `Options::independent_pos()`.
+  bool use_sendfile = false;
+  off_t src_offset = src_pos == nullptr ? 0 : IntCast<off_t>(*src_pos);
+  off_t dest_offset = IntCast<off_t>(start_pos());
+  // Copy at most 1G at a time, so that copying can be interrupted.
+  static constexpr size_t kMaxLength = size_t{1} << 30;
+  while (length_copied < length) {
+    const size_t length_to_copy =
+        IntCast<size_t>(UnsignedMin(length - length_copied, kMaxLength));
+    const ssize_t result =
+        use_sendfile
+            ? sendfile(dest, src, src_pos == nullptr ? nullptr : &src_offset,
+                       length_to_copy)
+            : copy_file_range(src, src_pos == nullptr ? nullptr : &src_offset,
+                              dest,
+                              has_independent_pos_ ? &dest_offset : nullptr,
+                              length_to_copy, 0);
+    if (ABSL_PREDICT_FALSE(result < 0)) {
+      if (errno == EINTR) continue;
+      if (length_copied == 0 &&
+          (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+           errno == EOPNOTSUPP || errno == EBADF)) {
+        // The kernel cannot copy between these fds, e.g. because they are not
+        // regular files on the same filesystem.
+        if (!use_sendfile && !has_independent_pos_) {
+          use_sendfile = true;
+          continue;
+        }
+        return false;
+      }
+      return FailOperation(use_sendfile ? "sendfile()" : "copy_file_range()");
+    }
+    if (result == 0) {
+      // Some special files, e.g. in `/proc`, report 0 even though they have
+      // data. Let the caller read them normally.
+      if (length_copied == 0) return false;
+      break;
+    }
+    RIEGELI_ASSERT_LE(IntCast<size_t>(result), length_to_copy)
+        << (use_sendfile ? "sendfile()" : "copy_file_range()")
+        << " copied more than requested";
+    length_copied += IntCast<size_t>(result);
+    move_start_pos(IntCast<size_t>(result));
+  }
+  if (src_pos != nullptr) *src_pos += length_copied;
+  return true;
+#else
+  return false;
+#endif
+}
+
 bool FdWriterBase::FlushImpl(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!PushDirect(dest))) return false;
   switch (flush_type) {
     case FlushType::kFromObject:
     case FlushType::kFromProcess:
       return true;
     case FlushType::kFromMachine: {
-      const int dest = dest_fd();
-      if (ABSL_PREDICT_FALSE(fsync(dest) < 0)) {
-        return FailOperation("fsync()");
+      if (sync_group_ != nullptr) {
+        absl::Status status = sync_group_->Sync(dest, sync_metadata_);
+        if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+        return true;
+      }
+      if (ABSL_PREDICT_FALSE(internal::SyncFd(dest, sync_metadata_) < 0)) {
+        return FailOperation(internal::SyncFunctionName(sync_metadata_));
       }
       return true;
     }
@@ -244,6 +635,7 @@ bool FdWriterBase::SeekSlow(Position new_pos) {
   RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
       << "BufferedWriter::PushInternal() did not empty the buffer";
   const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!PushDirect(dest))) return false;
   if (new_pos >= start_pos()) {
     // Seeking forwards.
     struct stat stat_info;
@@ -277,6 +669,7 @@ bool FdWriterBase::Truncate(Position new_size) {
   RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
       << "BufferedWriter::PushInternal() did not empty the buffer";
   const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!PushDirect(dest))) return false;
   if (new_size >= start_pos()) {
     // Seeking forwards.
     struct stat stat_info;
@@ -296,7 +689,307 @@ again:
     return FailOperation("ftruncate()");
   }
   set_start_pos(new_size);
+  // `ftruncate()` released space reserved beyond `new_size`.
+  preallocated_end_ = UnsignedMin(preallocated_end_, new_size);
   return SyncPos(dest);
 }
 
+namespace {
+
+size_t PageSize() {
+  static const size_t kPageSize = IntCast<size_t>(sysconf(_SC_PAGESIZE));
+  return kPageSize;
+}
+
+}  // namespace
+
+void FdMMapWriterBase::Initialize(int dest,
+                                  absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT_GE(dest, 0)
+      << "Failed precondition of FdMMapWriter: negative file descriptor";
+  SetFilename(dest);
+  int flags = 0;
+  if (independent_pos == absl::nullopt) {
+    // Flags are needed only if `independent_pos == absl::nullopt`. Avoid
+    // `fcntl()` otherwise.
+    flags = fcntl(dest, F_GETFL);
+    if (ABSL_PREDICT_FALSE(flags < 0)) {
+      FailOperation("fcntl()");
+      return;
+    }
+  }
+  InitializePos(dest, flags, independent_pos);
+}
+
+inline void FdMMapWriterBase::SetFilename(int dest) {
+  filename_ = absl::StrCat("/proc/self/fd/", dest);
+}
+
+int FdMMapWriterBase::OpenFd(absl::string_view filename, int flags,
+                             mode_t permissions) {
+  // TODO: When `absl::string_view` becomes C++17 `std::string_view`:
+  // `filename_ = filename`
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int dest = open(filename_.c_str(), flags, permissions);
+  if (ABSL_PREDICT_FALSE(dest < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return -1;
+  }
+  return dest;
+}
+
+void FdMMapWriterBase::InitializePos(int dest, int flags,
+                                     absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT_GT(window_size_, 0u)
+      << "Failed precondition of FdMMapWriter: zero window size";
+  window_size_ = (window_size_ + (PageSize() - 1)) / PageSize() * PageSize();
+  struct stat stat_info;
+  if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
+    FailOperation("fstat()");
+    return;
+  }
+  file_size_ = IntCast<Position>(stat_info.st_size);
+  data_size_ = file_size_;
+  if (independent_pos != absl::nullopt) {
+    if (ABSL_PREDICT_FALSE(*independent_pos >
+                           Position{std::numeric_limits<off_t>::max()})) {
+      FailOverflow();
+      return;
+    }
+    set_start_pos(*independent_pos);
+  } else {
+    const off_t file_pos =
+        lseek(dest, 0, (flags & O_APPEND) != 0 ? SEEK_END : SEEK_CUR);
+    if (ABSL_PREDICT_FALSE(file_pos < 0)) {
+      FailOperation("lseek()");
+      return;
+    }
+    set_start_pos(IntCast<Position>(file_pos));
+  }
+}
+
+inline bool FdMMapWriterBase::SyncPos(int dest) {
+  if (!has_independent_pos_) {
+    if (ABSL_PREDICT_FALSE(lseek(dest, IntCast<off_t>(pos()), SEEK_SET) < 0)) {
+      return FailOperation("lseek()");
+    }
+  }
+  return true;
+}
+
+inline bool FdMMapWriterBase::ExtendFile(int dest, Position new_size) {
+  RIEGELI_ASSERT_GT(new_size, file_size_)
+      << "Failed precondition of FdMMapWriterBase::ExtendFile(): "
+         "file not extended";
+#ifdef __linux__
+again:
+  if (ABSL_PREDICT_TRUE(fallocate(dest, 0, IntCast<off_t>(file_size_),
+                                  IntCast<off_t>(new_size - file_size_)) ==
+                        0)) {
+    file_size_ = new_size;
+    return true;
+  }
+  if (errno == EINTR) goto again;
+  if (ABSL_PREDICT_FALSE(errno != EOPNOTSUPP && errno != ENOSYS)) {
+    return FailOperation("fallocate()");
+  }
+  // The filesystem does not support allocating space. Extend the file without
+  // allocating it.
+#endif
+again_truncate:
+  if (ABSL_PREDICT_FALSE(ftruncate(dest, IntCast<off_t>(new_size)) < 0)) {
+    if (errno == EINTR) goto again_truncate;
+    return FailOperation("ftruncate()");
+  }
+  file_size_ = new_size;
+  return true;
+}
+
+inline bool FdMMapWriterBase::TruncateToData(int dest) {
+  if (file_size_ <= data_size_) return true;
+again:
+  if (ABSL_PREDICT_FALSE(ftruncate(dest, IntCast<off_t>(data_size_)) < 0)) {
+    if (errno == EINTR) goto again;
+    return FailOperation("ftruncate()");
+  }
+  file_size_ = data_size_;
+  return true;
+}
+
+bool FdMMapWriterBase::MapWindow(int dest, Position new_pos,
+                                 size_t min_length) {
+  RIEGELI_ASSERT(window_data_ == nullptr)
+      << "Failed precondition of FdMMapWriterBase::MapWindow(): "
+         "window already mapped";
+  static constexpr Position kMaxPos =
+      Position{std::numeric_limits<off_t>::max()};
+  if (ABSL_PREDICT_FALSE(new_pos > kMaxPos ||
+                         min_length > kMaxPos - new_pos)) {
+    return FailOverflow();
+  }
+  const Position window_pos = new_pos - new_pos % PageSize();
+  const size_t offset_in_window = IntCast<size_t>(new_pos - window_pos);
+  const Position window_end =
+      window_pos +
+      UnsignedMin(kMaxPos - window_pos,
+                  UnsignedMax(Position{window_size_},
+                              Position{offset_in_window} + min_length));
+  if (ABSL_PREDICT_FALSE(window_end - window_pos >
+                         std::numeric_limits<size_t>::max())) {
+    return Fail(absl::OutOfRangeError("Window too large for mmap()"));
+  }
+  const size_t window_length = IntCast<size_t>(window_end - window_pos);
+  if (window_end > file_size_) {
+    if (ABSL_PREDICT_FALSE(!ExtendFile(dest, window_end))) return false;
+  }
+  void* const data = mmap(nullptr, window_length, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, dest, IntCast<off_t>(window_pos));
+  if (ABSL_PREDICT_FALSE(data == MAP_FAILED)) return FailOperation("mmap()");
+  window_data_ = static_cast<char*>(data);
+  window_length_ = window_length;
+  // The buffer starts at `new_pos` rather than at the window start, so that
+  // `pos()` never goes back below data written since the window was mapped,
+  // and seeking back leaves the buffer through `SeekSlow()`, which accounts the
+  // written data.
+  set_buffer(window_data_ + offset_in_window,
+             window_length_ - offset_in_window);
+  return true;
+}
+
+bool FdMMapWriterBase::ReleaseWindow(bool sync) {
+  const Position new_pos = pos();
+  data_size_ = UnsignedMax(data_size_, new_pos);
+  set_buffer();
+  set_start_pos(new_pos);
+  if (window_data_ == nullptr) return true;
+  if (sync) {
+    // Changes made through a mapping are guaranteed to reach the file only
+    // after `msync()`.
+    if (ABSL_PREDICT_FALSE(msync(window_data_, window_length_, MS_SYNC) < 0)) {
+      FailOperation("msync()");
+      UnmapWindow();
+      return false;
+    }
+  }
+  UnmapWindow();
+  return true;
+}
+
+void FdMMapWriterBase::UnmapWindow() {
+  if (window_data_ == nullptr) return;
+  RIEGELI_CHECK_EQ(munmap(std::exchange(window_data_, nullptr),
+                          std::exchange(window_length_, 0)),
+                   0)
+      << ErrnoToCanonicalStatus(errno, "munmap() failed").message();
+}
+
+FdMMapWriterBase::~FdMMapWriterBase() { UnmapWindow(); }
+
+void FdMMapWriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    const int dest = dest_fd();
+    ReleaseWindow();
+    if (ABSL_PREDICT_TRUE(TruncateToData(dest))) SyncPos(dest);
+  }
+  Writer::Done();
+  UnmapWindow();
+}
+
+bool FdMMapWriterBase::FailOperation(absl::string_view operation) {
+  const int error_number = errno;
+  RIEGELI_ASSERT_NE(error_number, 0)
+      << "Failed precondition of FdMMapWriterBase::FailOperation(): "
+         "zero errno";
+  RIEGELI_ASSERT(is_open())
+      << "Failed precondition of FdMMapWriterBase::FailOperation(): "
+         "Object closed";
+  return Fail(
+      ErrnoToCanonicalStatus(error_number, absl::StrCat(operation, " failed")));
+}
+
+bool FdMMapWriterBase::Fail(absl::Status status) {
+  RIEGELI_ASSERT(!status.ok())
+      << "Failed precondition of Object::Fail(): status not failed";
+  return Writer::Fail(Annotate(status, absl::StrCat("writing ", filename_)));
+}
+
+bool FdMMapWriterBase::PushSlow(size_t min_length,
+                                size_t recommended_length) {
+  RIEGELI_ASSERT_LT(available(), min_length)
+      << "Failed precondition of Writer::PushSlow(): "
+         "enough space available, use Push() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int dest = dest_fd();
+  ReleaseWindow();
+  return MapWindow(dest, start_pos(), min_length);
+}
+
+bool FdMMapWriterBase::FlushImpl(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int dest = dest_fd();
+  // The file is truncated to the end of the data, so that it can be read back.
+  // The window is unmapped first, because accessing a mapping beyond the end
+  // of the file would raise `SIGBUS`.
+  if (ABSL_PREDICT_FALSE(
+          !ReleaseWindow(flush_type == FlushType::kFromMachine))) {
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!TruncateToData(dest))) return false;
+  switch (flush_type) {
+    case FlushType::kFromObject:
+    case FlushType::kFromProcess:
+      return true;
+    case FlushType::kFromMachine:
+      if (ABSL_PREDICT_FALSE(internal::SyncFd(dest, sync_metadata_) < 0)) {
+        return FailOperation(internal::SyncFunctionName(sync_metadata_));
+      }
+      return true;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown flush type: " << static_cast<int>(flush_type);
+}
+
+bool FdMMapWriterBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > pos())
+      << "Failed precondition of Writer::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  ReleaseWindow();
+  if (ABSL_PREDICT_FALSE(new_pos > data_size_)) {
+    // File ends.
+    set_start_pos(data_size_);
+    return false;
+  }
+  // The window containing `new_pos` is mapped by the next `PushSlow()`.
+  set_start_pos(new_pos);
+  return true;
+}
+
+absl::optional<Position> FdMMapWriterBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  return UnsignedMax(data_size_, pos());
+}
+
+bool FdMMapWriterBase::Truncate(Position new_size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int dest = dest_fd();
+  ReleaseWindow();
+  if (ABSL_PREDICT_FALSE(new_size > data_size_)) {
+    // File ends.
+    set_start_pos(data_size_);
+    return false;
+  }
+again:
+  if (ABSL_PREDICT_FALSE(ftruncate(dest, IntCast<off_t>(new_size)) < 0)) {
+    if (errno == EINTR) goto again;
+    return FailOperation("ftruncate()");
+  }
+  file_size_ = new_size;
+  data_size_ = new_size;
+  set_start_pos(new_size);
+  return true;
+}
+
 }  // namespace riegeli
@@ -30,9 +30,14 @@
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_sync_group.h"
+#include "riegeli/bytes/writer.h"
 
 namespace riegeli {
 
@@ -113,11 +118,119 @@ class FdWriterBase : public BufferedWriter {
     }
     size_t buffer_size() const { return buffer_size_; }
 
+    // If larger than `buffer_size()`, the buffer grows during sustained
+    // sequential writing, up to this size, so that writing a large file needs
+    // fewer `write()` calls. After a seek the buffer drops to a small size
+    // regardless.
+    //
+    // Default: 0 (the buffer does not grow beyond `buffer_size()`).
+    Options& set_max_buffer_size(size_t max_buffer_size) & {
+      max_buffer_size_ = max_buffer_size;
+      return *this;
+    }
+    Options&& set_max_buffer_size(size_t max_buffer_size) && {
+      return std::move(set_max_buffer_size(max_buffer_size));
+    }
+    size_t max_buffer_size() const { return max_buffer_size_; }
+
+    // If `true`, the file is written with `O_DIRECT`, bypassing the page
+    // cache. This avoids evicting other cached data when a large file is
+    // written and not read back soon.
+    //
+    // `O_DIRECT` requires the file offset, length, and memory address of each
+    // write to be aligned. `FdWriter` collects data in an aligned buffer, with
+    // `buffer_size()` rounded up to a multiple of 4K, and writes whole aligned
+    // blocks from there. The unaligned head up to the first aligned position,
+    // and the unaligned tail written by `Flush()` or `Close()`, are written
+    // with `O_DIRECT` temporarily cleared. A file written from an aligned
+    // position with `RecordWriterBase::Options::set_pad_to_block_boundary()`
+    // has no unaligned tail, because records are laid out in 64K blocks.
+    //
+    // If the fd was given rather than opened by `FdWriter`, `O_DIRECT` is set
+    // on it with `fcntl()`.
+    //
+    // Direct I/O requires random access, and is supported only where
+    // `O_DIRECT` is available (Linux).
+    //
+    // Default: `false`.
+    Options& set_direct_io(bool direct_io) & {
+      direct_io_ = direct_io;
+      return *this;
+    }
+    Options&& set_direct_io(bool direct_io) && {
+      return std::move(set_direct_io(direct_io));
+    }
+    bool direct_io() const { return direct_io_; }
+
+    // If `true`, `Flush(FlushType::kFromMachine)` uses `fsync()`, making all
+    // file metadata durable.
+    //
+    // If `false`, it uses `fdatasync()` where available, which skips metadata
+    // not needed to read the data back, e.g. the modification time. The file
+    // size is still made durable.
+    //
+    // Default: `true`.
+    Options& set_sync_metadata(bool sync_metadata) & {
+      sync_metadata_ = sync_metadata;
+      return *this;
+    }
+    Options&& set_sync_metadata(bool sync_metadata) && {
+      return std::move(set_sync_metadata(sync_metadata));
+    }
+    bool sync_metadata() const { return sync_metadata_; }
+
+    // If not `nullptr`, `Flush(FlushType::kFromMachine)` syncs the fd through
+    // `*sync_group`, sharing a pass with concurrent flushes of other writers
+    // using the same group. See `FdSyncGroup` for details.
+    //
+    // The `FdSyncGroup` must outlive the `FdWriter`.
+    //
+    // Default: `nullptr`.
+    Options& set_sync_group(FdSyncGroup* sync_group) & {
+      sync_group_ = sync_group;
+      return *this;
+    }
+    Options&& set_sync_group(FdSyncGroup* sync_group) && {
+      return std::move(set_sync_group(sync_group));
+    }
+    FdSyncGroup* sync_group() const { return sync_group_; }
+
+    // If positive, disk space for the file is reserved ahead of writing, in
+    // steps of this size, with `fallocate(FALLOC_FL_KEEP_SIZE)`. This keeps
+    // the file in few contiguous extents when many files are appended to
+    // concurrently, which makes later sequential reads faster.
+    //
+    // The file size is not changed by reserving space. `Close()` releases the
+    // space reserved beyond the end of the file, unless `independent_pos()` is
+    // set, because other writers may be writing further parts of the file.
+    //
+    // A multiple of the 64K block size of the Riegeli/records file format is
+    // recommended, e.g. 64M.
+    //
+    // Preallocation requires random access, and is supported only where
+    // `fallocate()` is available (Linux) and supported by the filesystem;
+    // otherwise it is silently skipped.
+    //
+    // Default: 0 (no preallocation).
+    Options& set_preallocate(Position preallocate) & {
+      preallocate_ = preallocate;
+      return *this;
+    }
+    Options&& set_preallocate(Position preallocate) && {
+      return std::move(set_preallocate(preallocate));
+    }
+    Position preallocate() const { return preallocate_; }
+
    private:
     mode_t permissions_ = 0666;
     absl::optional<Position> assumed_pos_;
     absl::optional<Position> independent_pos_;
     size_t buffer_size_ = kDefaultBufferSize;
+    size_t max_buffer_size_ = 0;
+    bool direct_io_ = false;
+    bool sync_metadata_ = true;
+    FdSyncGroup* sync_group_ = nullptr;
+    Position preallocate_ = 0;
   };
 
   // Returns the fd being written to. If the fd is owned then changed to -1 by
@@ -131,6 +244,7 @@ class FdWriterBase : public BufferedWriter {
 
   using BufferedWriter::Fail;
   bool Fail(absl::Status status) override;
+  TypeId GetTypeId() const override;
   bool SupportsRandomAccess() override { return supports_random_access_; }
   absl::optional<Position> Size() override;
   bool SupportsTruncate() override { return supports_random_access_; }
@@ -139,13 +253,16 @@ class FdWriterBase : public BufferedWriter {
  protected:
   FdWriterBase() noexcept {}
 
-  explicit FdWriterBase(size_t buffer_size);
+  explicit FdWriterBase(size_t buffer_size, size_t max_buffer_size,
+                        bool direct_io, bool sync_metadata,
+                        FdSyncGroup* sync_group, Position preallocate);
 
   FdWriterBase(FdWriterBase&& that) noexcept;
   FdWriterBase& operator=(FdWriterBase&& that) noexcept;
 
   void Reset();
-  void Reset(size_t buffer_size);
+  void Reset(size_t buffer_size, size_t max_buffer_size, bool direct_io,
+             bool sync_metadata, FdSyncGroup* sync_group, Position preallocate);
   void Initialize(int dest, absl::optional<Position> assumed_pos,
                   absl::optional<Position> independent_pos);
   void SetFilename(int dest);
@@ -158,16 +275,69 @@ class FdWriterBase : public BufferedWriter {
   ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
 
   void Done() override;
-  bool WriteInternal(absl::string_view src) override;
+  bool WriteInternal(absl::string_view src) final;
+  bool WriteInternal(const Chain& src) final;
   bool FlushImpl(FlushType flush_type) override;
-  bool SeekSlow(Position new_pos) override;
+  bool SeekSlow(Position new_pos) final;
 
  private:
+  friend class FdReaderBase;  // For `CopyFromFd()`.
+
+  // Alignment of file offsets, lengths, and memory addresses for `O_DIRECT`.
+  // This is the common logical block size of storage devices, and it divides
+  // the 64K block size of the Riegeli/records file format.
+  static constexpr size_t kDirectIoAlignment = size_t{4} << 10;
+
+  bool SetDirectIo(int dest, bool direct_io);
+  bool WriteToFd(int dest, absl::string_view src, Position file_pos);
+  bool WriteWithoutDirectIo(int dest, absl::string_view src,
+                            Position file_pos);
+  bool WriteDirect(int dest, absl::string_view src);
+  bool WriteDirectBuffer(int dest, char* aligned_buffer, size_t length);
+  bool PushDirect(int dest);
+  // Reserves space for writing up to `end_pos` if `preallocate_ > 0`.
+  void Preallocate(int dest, Position end_pos);
+  // Releases space reserved beyond the end of the file.
+  bool ReleasePreallocated(int dest);
+
+  // Writes up to `length` bytes read from `src`, starting from `*src_pos` (or
+  // from the current fd position if `src_pos == nullptr`), letting the kernel
+  // copy them with `copy_file_range()` or `sendfile()` (Linux), so that they do
+  // not pass through process memory. Increments `*src_pos` and sets
+  // `length_copied` to the length copied.
+  //
+  // Return values:
+  //  * `true`                 - success (`length_copied == length`),
+  //                             or the source ends (`length_copied < length`)
+  //  * `false` (`healthy()`)  - the kernel cannot copy between these fds,
+  //                             nothing was copied
+  //  * `false` (`!healthy()`) - failure
+  bool CopyFromFd(int src, Position* src_pos, Position length,
+                  Position& length_copied);
+
   std::string filename_;
   bool supports_random_access_ = false;
   bool has_independent_pos_ = false;
+  // Size of the aligned part of `direct_buffer_`, or 0 if `O_DIRECT` is not
+  // used.
+  size_t direct_buffer_size_ = 0;
+  // If `direct_buffer_size_ > 0`, holds `direct_buffer_length_` bytes to be
+  // written before `start_pos()`, at the first `kDirectIoAlignment`-aligned
+  // address in `direct_buffer_`.
+  Buffer direct_buffer_;
+  size_t direct_buffer_length_ = 0;
+  bool sync_metadata_ = true;
+  FdSyncGroup* sync_group_ = nullptr;
+  // Step of reserving space, or 0 if space is not reserved.
+  Position preallocate_ = 0;
+  // The file position up to which space is known to be reserved.
+  Position preallocated_end_ = 0;
 
-  // Invariant: `start_pos() <= std::numeric_limits<off_t>::max()`
+  // Invariants:
+  //   `start_pos() <= std::numeric_limits<off_t>::max()`
+  //   if `direct_buffer_length_ > 0` then
+  //       `start_pos() - direct_buffer_length_` is a multiple of
+  //       `kDirectIoAlignment`
 };
 
 // A `Writer` which writes to a file descriptor.
@@ -175,7 +345,8 @@ class FdWriterBase : public BufferedWriter {
 // The fd must support:
 //  * `fcntl()`     - for the constructor from fd,
 //                    if `Options::assumed_pos() == absl::nullopt`
-//                    and `Options::independent_pos() == absl::nullopt`
+//                    and `Options::independent_pos() == absl::nullopt`,
+//                    or if `Options::direct_io()`
 //  * `close()`     - if the fd is owned
 //  * `write()`     - if `Options::independent_pos() == absl::nullopt`
 //  * `pwrite()`    - if `Options::independent_pos() != absl::nullopt`
@@ -183,7 +354,13 @@ class FdWriterBase : public BufferedWriter {
 //                    if `Options::independent_pos() == absl::nullopt`
 //  * `fstat()`     - for `Seek()`, `Size()`, or `Truncate()`
 //  * `fsync()`     - for `Flush(FlushType::kFromMachine)`
-//  * `ftruncate()` - for `Truncate()`
+//                    if `Options::sync_metadata()`
+//  * `fdatasync()` - for `Flush(FlushType::kFromMachine)`
+//                    if `!Options::sync_metadata()` (Linux, otherwise
+//                    `fsync()`)
+//  * `ftruncate()` - for `Truncate()`, or for `Close()`
+//                    if `Options::preallocate() > 0`
+//  * `fallocate()` - if `Options::preallocate() > 0` (optional)
 //
 // `FdWriter` supports random access if
 // `Options::assumed_pos() == absl::nullopt` and the fd supports random access
@@ -286,10 +463,306 @@ explicit FdWriter(absl::string_view filename, int flags,
     ->FdWriter<>;
 #endif
 
+// Template parameter independent part of `FdMMapWriter`.
+class FdMMapWriterBase : public Writer {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Permissions to use in case a new file is created (9 bits). The effective
+    // permissions are modified by the process's umask.
+    //
+    // Default: `0666`.
+    Options& set_permissions(mode_t permissions) & {
+      permissions_ = permissions;
+      return *this;
+    }
+    Options&& set_permissions(mode_t permissions) && {
+      return std::move(set_permissions(permissions));
+    }
+    mode_t permissions() const { return permissions_; }
+
+    // If `absl::nullopt`, `FdMMapWriter` writes starting from the current fd
+    // position. The `FdMMapWriter` position is synchronized back to the fd by
+    // `Close()`.
+    //
+    // If not `absl::nullopt`, `FdMMapWriter` writes starting from this
+    // position, without disturbing the current fd position.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_independent_pos(absl::optional<Position> independent_pos) & {
+      independent_pos_ = independent_pos;
+      return *this;
+    }
+    Options&& set_independent_pos(absl::optional<Position> independent_pos) && {
+      return std::move(set_independent_pos(independent_pos));
+    }
+    absl::optional<Position> independent_pos() const {
+      return independent_pos_;
+    }
+
+    // Size of a part of the file mapped to memory at a time. It is rounded up
+    // to a multiple of the page size.
+    //
+    // When writing leaves the current window, the file is extended to cover
+    // the next window with `fallocate()` (or `ftruncate()` where it is not
+    // supported), and the next window is mapped in place of the current one.
+    //
+    // Default: 64M
+    Options& set_window_size(size_t window_size) & {
+      RIEGELI_ASSERT_GT(window_size, 0u)
+          << "Failed precondition of "
+             "FdMMapWriterBase::Options::set_window_size(): "
+             "zero window size";
+      window_size_ = window_size;
+      return *this;
+    }
+    Options&& set_window_size(size_t window_size) && {
+      return std::move(set_window_size(window_size));
+    }
+    size_t window_size() const { return window_size_; }
+
+    // If `true`, `Flush(FlushType::kFromMachine)` uses `fsync()`, making all
+    // file metadata durable.
+    //
+    // If `false`, it uses `fdatasync()` where available, which skips metadata
+    // not needed to read the data back, e.g. the modification time. The file
+    // size is still made durable.
+    //
+    // Default: `true`.
+    Options& set_sync_metadata(bool sync_metadata) & {
+      sync_metadata_ = sync_metadata;
+      return *this;
+    }
+    Options&& set_sync_metadata(bool sync_metadata) && {
+      return std::move(set_sync_metadata(sync_metadata));
+    }
+    bool sync_metadata() const { return sync_metadata_; }
+
+   private:
+    mode_t permissions_ = 0666;
+    absl::optional<Position> independent_pos_;
+    size_t window_size_ = size_t{64} << 20;
+    bool sync_metadata_ = true;
+  };
+
+  ~FdMMapWriterBase();
+
+  // Returns the fd being written to. If the fd is owned then changed to -1 by
+  // `Close()`, otherwise unchanged.
+  virtual int dest_fd() const = 0;
+
+  // Returns the original name of the file being written to (or
+  // "/proc/self/fd/<fd>" if fd was given). Unchanged by `Close()`.
+  const std::string& filename() const { return filename_; }
+
+  using Writer::Fail;
+  bool Fail(absl::Status status) override;
+  bool SupportsRandomAccess() override { return true; }
+  absl::optional<Position> Size() override;
+  bool SupportsTruncate() override { return true; }
+  bool Truncate(Position new_size) override;
+
+ protected:
+  FdMMapWriterBase() noexcept : Writer(kInitiallyClosed) {}
+
+  explicit FdMMapWriterBase(size_t window_size, bool has_independent_pos,
+                            bool sync_metadata);
+
+  FdMMapWriterBase(FdMMapWriterBase&& that) noexcept;
+  FdMMapWriterBase& operator=(FdMMapWriterBase&& that) noexcept;
+
+  void Reset();
+  void Reset(size_t window_size, bool has_independent_pos, bool sync_metadata);
+  void Initialize(int dest, absl::optional<Position> independent_pos);
+  int OpenFd(absl::string_view filename, int flags, mode_t permissions);
+  void InitializePos(int dest, int flags,
+                     absl::optional<Position> independent_pos);
+
+  void Done() override;
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+  bool PushSlow(size_t min_length, size_t recommended_length) override;
+  bool FlushImpl(FlushType flush_type) override;
+  bool SeekSlow(Position new_pos) override;
+
+ private:
+  void SetFilename(int dest);
+  bool SyncPos(int dest);
+  // Extends the file to `new_size`, allocating disk space for it.
+  //
+  // Precondition: `new_size > file_size_`
+  bool ExtendFile(int dest, Position new_size);
+  // Truncates the file to `data_size_` if it was extended beyond that.
+  bool TruncateToData(int dest);
+  // Maps a window containing at least `min_length` bytes starting from
+  // `new_pos`, extending the file if needed, and makes it the buffer.
+  bool MapWindow(int dest, Position new_pos, size_t min_length);
+  // Accounts data written to the buffer in `data_size_`, and leaves no buffer
+  // and no window mapped. If `sync`, changes made through the window are
+  // written to the disk before unmapping it.
+  bool ReleaseWindow(bool sync = false);
+  void UnmapWindow();
+
+  std::string filename_;
+  bool has_independent_pos_ = false;
+  size_t window_size_ = 0;
+  bool sync_metadata_ = true;
+  // The file size, including space beyond `data_size_` allocated ahead of
+  // writing.
+  Position file_size_ = 0;
+  // The size of the data: the original file size or the end of written data,
+  // whichever is larger. The file is truncated to this by `Flush()` and
+  // `Close()`.
+  Position data_size_ = 0;
+  // The current window, or `nullptr` if none is mapped. It starts at a page
+  // boundary at or before `start()`.
+  char* window_data_ = nullptr;
+  size_t window_length_ = 0;
+};
+
+// A `Writer` which writes to a file descriptor by mapping a window of the file
+// to memory at a time. It supports random access.
+//
+// The buffer points directly into the mapping, so data are written without a
+// `write()` call and without copying them from a separate buffer. The file is
+// extended ahead of writing by whole windows, and truncated to the end of the
+// data by `Flush()` and `Close()`. This makes frequent flushing slower than
+// with `FdWriter`.
+//
+// Where `fallocate()` is available (Linux) and supported by the filesystem,
+// disk space for each window is allocated before it is mapped, so that a full
+// disk is reported as a failure. Otherwise the file is extended with
+// `ftruncate()`, and a full disk raises `SIGBUS` when writing to the mapping.
+//
+// The fd must be opened with `O_RDWR`, because writable shared mappings need
+// read access, and must refer to a regular file.
+//
+// The fd must support:
+//  * `close()`     - if the fd is owned
+//  * `fstat()`
+//  * `mmap()`
+//  * `ftruncate()`
+//  * `fallocate()` - optional
+//  * `lseek()`     - if `Options::independent_pos() == absl::nullopt`
+//  * `msync()`     - for `Flush(FlushType::kFromMachine)`
+//  * `fsync()`     - for `Flush(FlushType::kFromMachine)`
+//                    if `Options::sync_metadata()`
+//  * `fdatasync()` - for `Flush(FlushType::kFromMachine)`
+//                    if `!Options::sync_metadata()` (Linux, otherwise
+//                    `fsync()`)
+//
+// The `Dest` template parameter specifies the type of the object providing and
+// possibly owning the fd being written to. `Dest` must support
+// `Dependency<int, Dest>`, e.g. `OwnedFd` (owned, default), `UnownedFd`
+// (not owned).
+//
+// By relying on CTAD the template argument can be deduced as `OwnedFd` if the
+// first constructor argument is a filename or an `int`, otherwise as the value
+// type of the first constructor argument. This requires C++17.
+//
+// Until the `FdMMapWriter` is closed or no longer used, the fd must not be
+// closed, and the file must not be changed by other means, because its size is
+// changed ahead of writing.
+template <typename Dest = OwnedFd>
+class FdMMapWriter : public FdMMapWriterBase {
+ public:
+  // Creates a closed `FdMMapWriter`.
+  FdMMapWriter() noexcept {}
+
+  // Will write to the fd provided by `dest`.
+  explicit FdMMapWriter(const Dest& dest, Options options = Options());
+  explicit FdMMapWriter(Dest&& dest, Options options = Options());
+
+  // Will write to the fd provided by a `Dest` constructed from elements of
+  // `dest_args`. This avoids constructing a temporary `Dest` and moving from
+  // it.
+  template <typename... DestArgs>
+  explicit FdMMapWriter(std::tuple<DestArgs...> dest_args,
+                        Options options = Options());
+
+  // Opens a file for writing.
+  //
+  // `flags` is the second argument of `open()`, typically one of:
+  //  * `O_RDWR | O_CREAT | O_TRUNC`
+  //  * `O_RDWR | O_CREAT | O_APPEND`
+  //
+  // `flags` must include `O_RDWR`.
+  explicit FdMMapWriter(absl::string_view filename, int flags,
+                        Options options = Options());
+
+  FdMMapWriter(FdMMapWriter&& that) noexcept;
+  FdMMapWriter& operator=(FdMMapWriter&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `FdMMapWriter`. This
+  // avoids constructing a temporary `FdMMapWriter` and moving from it.
+  void Reset();
+  void Reset(const Dest& dest, Options options = Options());
+  void Reset(Dest&& dest, Options options = Options());
+  template <typename... DestArgs>
+  void Reset(std::tuple<DestArgs...> dest_args, Options options = Options());
+  void Reset(absl::string_view filename, int flags,
+             Options options = Options());
+
+  // Returns the object providing and possibly owning the fd being written to.
+  // If the fd is owned then changed to -1 by `Close()`, otherwise unchanged.
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  int dest_fd() const override { return dest_.get(); }
+
+ protected:
+  using FdMMapWriterBase::Initialize;
+  void Initialize(absl::string_view filename, int flags, mode_t permissions,
+                  absl::optional<Position> independent_pos);
+
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the fd being written to.
+  Dependency<int, Dest> dest_;
+};
+
+// Support CTAD.
+#if __cpp_deduction_guides
+FdMMapWriter()->FdMMapWriter<DeleteCtad<>>;
+template <typename Dest>
+explicit FdMMapWriter(
+    const Dest& dest,
+    FdMMapWriterBase::Options options = FdMMapWriterBase::Options())
+    -> FdMMapWriter<std::conditional_t<
+        std::is_convertible<const Dest&, int>::value, OwnedFd,
+        std::decay_t<Dest>>>;
+template <typename Dest>
+explicit FdMMapWriter(
+    Dest&& dest,
+    FdMMapWriterBase::Options options = FdMMapWriterBase::Options())
+    -> FdMMapWriter<std::conditional_t<std::is_convertible<Dest&&, int>::value,
+                                       OwnedFd, std::decay_t<Dest>>>;
+template <typename... DestArgs>
+explicit FdMMapWriter(
+    std::tuple<DestArgs...> dest_args,
+    FdMMapWriterBase::Options options = FdMMapWriterBase::Options())
+    -> FdMMapWriter<DeleteCtad<std::tuple<DestArgs...>>>;
+explicit FdMMapWriter(
+    absl::string_view filename, int flags,
+    FdMMapWriterBase::Options options = FdMMapWriterBase::Options())
+    ->FdMMapWriter<>;
+#endif
+
 // Implementation details follow.
 
-inline FdWriterBase::FdWriterBase(size_t buffer_size)
-    : BufferedWriter(buffer_size) {}
+inline FdWriterBase::FdWriterBase(size_t buffer_size, size_t max_buffer_size,
+                                  bool direct_io, bool sync_metadata,
+                                  FdSyncGroup* sync_group, Position preallocate)
+    : BufferedWriter(direct_io ? RoundUp<kDirectIoAlignment>(buffer_size)
+                               : buffer_size),
+      direct_buffer_size_(
+          direct_io ? RoundUp<kDirectIoAlignment>(buffer_size) : 0),
+      sync_metadata_(sync_metadata),
+      sync_group_(sync_group),
+      preallocate_(preallocate) {
+  set_max_buffer_size(max_buffer_size);
+}
 
 inline FdWriterBase::FdWriterBase(FdWriterBase&& that) noexcept
     : BufferedWriter(std::move(that)),
@@ -297,7 +770,14 @@ inline FdWriterBase::FdWriterBase(FdWriterBase&& that) noexcept
       // part was moved.
       filename_(std::move(that.filename_)),
       supports_random_access_(that.supports_random_access_),
-      has_independent_pos_(that.has_independent_pos_) {}
+      has_independent_pos_(that.has_independent_pos_),
+      direct_buffer_size_(that.direct_buffer_size_),
+      direct_buffer_(std::move(that.direct_buffer_)),
+      direct_buffer_length_(std::exchange(that.direct_buffer_length_, 0)),
+      sync_metadata_(that.sync_metadata_),
+      sync_group_(that.sync_group_),
+      preallocate_(that.preallocate_),
+      preallocated_end_(that.preallocated_end_) {}
 
 inline FdWriterBase& FdWriterBase::operator=(FdWriterBase&& that) noexcept {
   BufferedWriter::operator=(std::move(that));
@@ -306,6 +786,13 @@ inline FdWriterBase& FdWriterBase::operator=(FdWriterBase&& that) noexcept {
   filename_ = std::move(that.filename_);
   supports_random_access_ = that.supports_random_access_;
   has_independent_pos_ = that.has_independent_pos_;
+  direct_buffer_size_ = that.direct_buffer_size_;
+  direct_buffer_ = std::move(that.direct_buffer_);
+  direct_buffer_length_ = std::exchange(that.direct_buffer_length_, 0);
+  sync_metadata_ = that.sync_metadata_;
+  sync_group_ = that.sync_group_;
+  preallocate_ = that.preallocate_;
+  preallocated_end_ = that.preallocated_end_;
   return *this;
 }
 
@@ -314,24 +801,109 @@ inline void FdWriterBase::Reset() {
   filename_.clear();
   supports_random_access_ = false;
   has_independent_pos_ = false;
+  direct_buffer_size_ = 0;
+  direct_buffer_ = Buffer();
+  direct_buffer_length_ = 0;
+  sync_metadata_ = true;
+  sync_group_ = nullptr;
+  preallocate_ = 0;
+  preallocated_end_ = 0;
 }
 
-inline void FdWriterBase::Reset(size_t buffer_size) {
-  BufferedWriter::Reset(buffer_size);
+inline void FdWriterBase::Reset(size_t buffer_size, size_t max_buffer_size,
+                                bool direct_io, bool sync_metadata,
+                                FdSyncGroup* sync_group, Position preallocate) {
+  BufferedWriter::Reset(direct_io ? RoundUp<kDirectIoAlignment>(buffer_size)
+                                  : buffer_size);
+  set_max_buffer_size(max_buffer_size);
   // `filename_` will be set by `Initialize()`.
   supports_random_access_ = false;
   has_independent_pos_ = false;
+  direct_buffer_size_ =
+      direct_io ? RoundUp<kDirectIoAlignment>(buffer_size) : 0;
+  direct_buffer_length_ = 0;
+  sync_metadata_ = sync_metadata;
+  sync_group_ = sync_group;
+  preallocate_ = preallocate;
+  preallocated_end_ = 0;
+}
+
+inline FdMMapWriterBase::FdMMapWriterBase(size_t window_size,
+                                          bool has_independent_pos,
+                                          bool sync_metadata)
+    : Writer(kInitiallyOpen),
+      has_independent_pos_(has_independent_pos),
+      window_size_(window_size),
+      sync_metadata_(sync_metadata) {}
+
+inline FdMMapWriterBase::FdMMapWriterBase(FdMMapWriterBase&& that) noexcept
+    : Writer(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      filename_(std::move(that.filename_)),
+      has_independent_pos_(that.has_independent_pos_),
+      window_size_(that.window_size_),
+      sync_metadata_(that.sync_metadata_),
+      file_size_(that.file_size_),
+      data_size_(that.data_size_),
+      window_data_(std::exchange(that.window_data_, nullptr)),
+      window_length_(std::exchange(that.window_length_, 0)) {}
+
+inline FdMMapWriterBase& FdMMapWriterBase::operator=(
+    FdMMapWriterBase&& that) noexcept {
+  UnmapWindow();
+  Writer::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  filename_ = std::move(that.filename_);
+  has_independent_pos_ = that.has_independent_pos_;
+  window_size_ = that.window_size_;
+  sync_metadata_ = that.sync_metadata_;
+  file_size_ = that.file_size_;
+  data_size_ = that.data_size_;
+  window_data_ = std::exchange(that.window_data_, nullptr);
+  window_length_ = std::exchange(that.window_length_, 0);
+  return *this;
+}
+
+inline void FdMMapWriterBase::Reset() {
+  UnmapWindow();
+  Writer::Reset(kInitiallyClosed);
+  filename_.clear();
+  has_independent_pos_ = false;
+  window_size_ = 0;
+  sync_metadata_ = true;
+  file_size_ = 0;
+  data_size_ = 0;
+}
+
+inline void FdMMapWriterBase::Reset(size_t window_size,
+                                    bool has_independent_pos,
+                                    bool sync_metadata) {
+  UnmapWindow();
+  Writer::Reset(kInitiallyOpen);
+  // `filename_` will be set by `Initialize()`.
+  has_independent_pos_ = has_independent_pos;
+  window_size_ = window_size;
+  sync_metadata_ = sync_metadata;
+  // `file_size_` and `data_size_` will be set by `InitializePos()`.
 }
 
 template <typename Dest>
 inline FdWriter<Dest>::FdWriter(const Dest& dest, Options options)
-    : FdWriterBase(options.buffer_size()), dest_(dest) {
+    : FdWriterBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io(), options.sync_metadata(),
+                   options.sync_group(), options.preallocate()),
+      dest_(dest) {
   Initialize(dest_.get(), options.assumed_pos(), options.independent_pos());
 }
 
 template <typename Dest>
 inline FdWriter<Dest>::FdWriter(Dest&& dest, Options options)
-    : FdWriterBase(options.buffer_size()), dest_(std::move(dest)) {
+    : FdWriterBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io(), options.sync_metadata(),
+                   options.sync_group(), options.preallocate()),
+      dest_(std::move(dest)) {
   Initialize(dest_.get(), options.assumed_pos(), options.independent_pos());
 }
 
@@ -339,14 +911,19 @@ template <typename Dest>
 template <typename... DestArgs>
 inline FdWriter<Dest>::FdWriter(std::tuple<DestArgs...> dest_args,
                                 Options options)
-    : FdWriterBase(options.buffer_size()), dest_(std::move(dest_args)) {
+    : FdWriterBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io(), options.sync_metadata(),
+                   options.sync_group(), options.preallocate()),
+      dest_(std::move(dest_args)) {
   Initialize(dest_.get(), options.assumed_pos(), options.independent_pos());
 }
 
 template <typename Dest>
 inline FdWriter<Dest>::FdWriter(absl::string_view filename, int flags,
                                 Options options)
-    : FdWriterBase(options.buffer_size()) {
+    : FdWriterBase(options.buffer_size(), options.max_buffer_size(),
+                   options.direct_io(), options.sync_metadata(),
+                   options.sync_group(), options.preallocate()) {
   Initialize(filename, flags, options.permissions(), options.assumed_pos(),
              options.independent_pos());
 }
@@ -375,14 +952,18 @@ inline void FdWriter<Dest>::Reset() {
 
 template <typename Dest>
 inline void FdWriter<Dest>::Reset(const Dest& dest, Options options) {
-  FdWriterBase::Reset(options.buffer_size());
+  FdWriterBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io(), options.sync_metadata(),
+                      options.sync_group(), options.preallocate());
   dest_.Reset(dest);
   Initialize(dest_.get(), options.assumed_pos(), options.independent_pos());
 }
 
 template <typename Dest>
 inline void FdWriter<Dest>::Reset(Dest&& dest, Options options) {
-  FdWriterBase::Reset(options.buffer_size());
+  FdWriterBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io(), options.sync_metadata(),
+                      options.sync_group(), options.preallocate());
   dest_.Reset(std::move(dest));
   Initialize(dest_.get(), options.assumed_pos(), options.independent_pos());
 }
@@ -391,7 +972,9 @@ template <typename Dest>
 template <typename... DestArgs>
 inline void FdWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
                                   Options options) {
-  FdWriterBase::Reset(options.buffer_size());
+  FdWriterBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io(), options.sync_metadata(),
+                      options.sync_group(), options.preallocate());
   dest_.Reset(std::move(dest_args));
   Initialize(dest_.get(), options.assumed_pos(), options.independent_pos());
 }
@@ -399,7 +982,9 @@ inline void FdWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
 template <typename Dest>
 inline void FdWriter<Dest>::Reset(absl::string_view filename, int flags,
                                   Options options) {
-  FdWriterBase::Reset(options.buffer_size());
+  FdWriterBase::Reset(options.buffer_size(), options.max_buffer_size(),
+                      options.direct_io(), options.sync_metadata(),
+                      options.sync_group(), options.preallocate());
   dest_.Reset();  // In case `OpenFd()` fails.
   Initialize(filename, flags, options.permissions(), options.assumed_pos(),
              options.independent_pos());
@@ -432,6 +1017,132 @@ void FdWriter<Dest>::Done() {
   }
 }
 
+template <typename Dest>
+inline FdMMapWriter<Dest>::FdMMapWriter(const Dest& dest, Options options)
+    : FdMMapWriterBase(options.window_size(),
+                       options.independent_pos() != absl::nullopt,
+                       options.sync_metadata()),
+      dest_(dest) {
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline FdMMapWriter<Dest>::FdMMapWriter(Dest&& dest, Options options)
+    : FdMMapWriterBase(options.window_size(),
+                       options.independent_pos() != absl::nullopt,
+                       options.sync_metadata()),
+      dest_(std::move(dest)) {
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+template <typename... DestArgs>
+inline FdMMapWriter<Dest>::FdMMapWriter(std::tuple<DestArgs...> dest_args,
+                                        Options options)
+    : FdMMapWriterBase(options.window_size(),
+                       options.independent_pos() != absl::nullopt,
+                       options.sync_metadata()),
+      dest_(std::move(dest_args)) {
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline FdMMapWriter<Dest>::FdMMapWriter(absl::string_view filename, int flags,
+                                        Options options)
+    : FdMMapWriterBase(options.window_size(),
+                       options.independent_pos() != absl::nullopt,
+                       options.sync_metadata()) {
+  Initialize(filename, flags, options.permissions(),
+             options.independent_pos());
+}
+
+template <typename Dest>
+inline FdMMapWriter<Dest>::FdMMapWriter(FdMMapWriter&& that) noexcept
+    : FdMMapWriterBase(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      dest_(std::move(that.dest_)) {}
+
+template <typename Dest>
+inline FdMMapWriter<Dest>& FdMMapWriter<Dest>::operator=(
+    FdMMapWriter&& that) noexcept {
+  FdMMapWriterBase::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  dest_ = std::move(that.dest_);
+  return *this;
+}
+
+template <typename Dest>
+inline void FdMMapWriter<Dest>::Reset() {
+  FdMMapWriterBase::Reset();
+  dest_.Reset();
+}
+
+template <typename Dest>
+inline void FdMMapWriter<Dest>::Reset(const Dest& dest, Options options) {
+  FdMMapWriterBase::Reset(options.window_size(),
+                          options.independent_pos() != absl::nullopt,
+                          options.sync_metadata());
+  dest_.Reset(dest);
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline void FdMMapWriter<Dest>::Reset(Dest&& dest, Options options) {
+  FdMMapWriterBase::Reset(options.window_size(),
+                          options.independent_pos() != absl::nullopt,
+                          options.sync_metadata());
+  dest_.Reset(std::move(dest));
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+template <typename... DestArgs>
+inline void FdMMapWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
+                                      Options options) {
+  FdMMapWriterBase::Reset(options.window_size(),
+                          options.independent_pos() != absl::nullopt,
+                          options.sync_metadata());
+  dest_.Reset(std::move(dest_args));
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline void FdMMapWriter<Dest>::Reset(absl::string_view filename, int flags,
+                                      Options options) {
+  FdMMapWriterBase::Reset(options.window_size(),
+                          options.independent_pos() != absl::nullopt,
+                          options.sync_metadata());
+  dest_.Reset();  // In case `OpenFd()` fails.
+  Initialize(filename, flags, options.permissions(),
+             options.independent_pos());
+}
+
+template <typename Dest>
+void FdMMapWriter<Dest>::Initialize(absl::string_view filename, int flags,
+                                    mode_t permissions,
+                                    absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of FdMMapWriter: flags must include O_RDWR";
+  const int dest = OpenFd(filename, flags, permissions);
+  if (ABSL_PREDICT_FALSE(dest < 0)) return;
+  dest_.Reset(std::forward_as_tuple(dest));
+  InitializePos(dest_.get(), flags, independent_pos);
+}
+
+template <typename Dest>
+void FdMMapWriter<Dest>::Done() {
+  FdMMapWriterBase::Done();
+  if (dest_.is_owning()) {
+    const int dest = dest_.Release();
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(dest) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_BYTES_FD_WRITER_H_
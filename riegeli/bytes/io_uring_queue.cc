@@ -0,0 +1,187 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/io_uring_queue.h"
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+inline unsigned* RingField(void* ring, uint32_t offset) {
+  return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+}
+
+inline unsigned LoadAcquire(const unsigned* field) {
+  return __atomic_load_n(field, __ATOMIC_ACQUIRE);
+}
+
+inline void StoreRelease(unsigned* field, unsigned value) {
+  __atomic_store_n(field, value, __ATOMIC_RELEASE);
+}
+
+}  // namespace
+
+IoUringQueue::~IoUringQueue() {
+  if (ring_fd_ < 0) return;
+  // The kernel may still use buffers of outstanding operations after the ring
+  // is closed, so wait for them first.
+  while (in_flight_ > 0) {
+    while (PeekCqe() != nullptr) SeenCqe();
+    if (in_flight_ == 0) break;
+    if (ABSL_PREDICT_FALSE(!Submit(1).ok())) break;
+  }
+  if (sqes_ != nullptr) munmap(sqes_, sqes_size_);
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != nullptr) munmap(sq_ring_, sq_ring_size_);
+  close(ring_fd_);
+}
+
+absl::Status IoUringQueue::Initialize(uint32_t entries) {
+  RIEGELI_ASSERT_LT(ring_fd_, 0)
+      << "Failed precondition of IoUringQueue::Initialize(): "
+         "already initialized";
+  RIEGELI_ASSERT_GT(entries, 0u)
+      << "Failed precondition of IoUringQueue::Initialize(): zero entries";
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  const int ring_fd =
+      static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (ABSL_PREDICT_FALSE(ring_fd < 0)) {
+    return ErrnoToCanonicalStatus(errno, "io_uring_setup() failed");
+  }
+  ring_fd_ = ring_fd;
+  entries_ = UnsignedMin(params.sq_entries, params.cq_entries);
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size_ = UnsignedMax(sq_ring_size_, cq_ring_size_);
+    cq_ring_size_ = sq_ring_size_;
+  }
+  void* const sq_ring =
+      mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (ABSL_PREDICT_FALSE(sq_ring == MAP_FAILED)) {
+    return ErrnoToCanonicalStatus(errno, "mmap() failed");
+  }
+  sq_ring_ = sq_ring;
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    void* const cq_ring =
+        mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (ABSL_PREDICT_FALSE(cq_ring == MAP_FAILED)) {
+      return ErrnoToCanonicalStatus(errno, "mmap() failed");
+    }
+    cq_ring_ = cq_ring;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* const sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (ABSL_PREDICT_FALSE(sqes == MAP_FAILED)) {
+    return ErrnoToCanonicalStatus(errno, "mmap() failed");
+  }
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  sq_head_ = RingField(sq_ring_, params.sq_off.head);
+  sq_tail_ = RingField(sq_ring_, params.sq_off.tail);
+  sq_mask_ = *RingField(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = RingField(sq_ring_, params.sq_off.array);
+  cq_head_ = RingField(cq_ring_, params.cq_off.head);
+  cq_tail_ = RingField(cq_ring_, params.cq_off.tail);
+  cq_mask_ = *RingField(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cq_ring_) +
+                                          params.cq_off.cqes);
+  // Submission queue entries are used in order, so the indirection array is
+  // the identity.
+  for (unsigned i = 0; i < params.sq_entries; ++i) sq_array_[i] = i;
+  sqe_head_ = *sq_tail_;
+  sqe_tail_ = sqe_head_;
+  return absl::OkStatus();
+}
+
+io_uring_sqe* IoUringQueue::GetSqe() {
+  RIEGELI_ASSERT_GE(ring_fd_, 0)
+      << "Failed precondition of IoUringQueue::GetSqe(): not initialized";
+  // Limiting operations in flight to `entries_` ensures that neither queue
+  // overflows.
+  if (ABSL_PREDICT_FALSE(in_flight_ >= entries_)) return nullptr;
+  io_uring_sqe* const sqe = &sqes_[sqe_tail_ & sq_mask_];
+  ++sqe_tail_;
+  ++in_flight_;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+absl::Status IoUringQueue::Submit(uint32_t min_complete) {
+  RIEGELI_ASSERT_GE(ring_fd_, 0)
+      << "Failed precondition of IoUringQueue::Submit(): not initialized";
+  if (sqe_head_ != sqe_tail_) {
+    StoreRelease(sq_tail_, sqe_tail_);
+    sqe_head_ = sqe_tail_;
+  }
+  for (;;) {
+    const unsigned to_submit = sqe_tail_ - LoadAcquire(sq_head_);
+    if (to_submit == 0 && min_complete == 0) return absl::OkStatus();
+    const long result =
+        syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                min_complete > 0 ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+    if (ABSL_PREDICT_FALSE(result < 0)) {
+      if (errno == EINTR) continue;
+      return ErrnoToCanonicalStatus(errno, "io_uring_enter() failed");
+    }
+    // If not all entries were consumed, submit the rest. Otherwise waiting
+    // for completions was done together with the submission.
+    if (sqe_tail_ == LoadAcquire(sq_head_)) return absl::OkStatus();
+  }
+}
+
+const io_uring_cqe* IoUringQueue::PeekCqe() const {
+  RIEGELI_ASSERT_GE(ring_fd_, 0)
+      << "Failed precondition of IoUringQueue::PeekCqe(): not initialized";
+  const unsigned head = *cq_head_;
+  if (head == LoadAcquire(cq_tail_)) return nullptr;
+  return &cqes_[head & cq_mask_];
+}
+
+void IoUringQueue::SeenCqe() {
+  RIEGELI_ASSERT(PeekCqe() != nullptr)
+      << "Failed precondition of IoUringQueue::SeenCqe(): no completion";
+  StoreRelease(cq_head_, *cq_head_ + 1);
+  --in_flight_;
+}
+
+}  // namespace internal
+}  // namespace riegeli
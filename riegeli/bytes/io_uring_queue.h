@@ -0,0 +1,108 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_IO_URING_QUEUE_H_
+#define RIEGELI_BYTES_IO_URING_QUEUE_H_
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "absl/status/status.h"
+
+namespace riegeli {
+namespace internal {
+
+// A Linux `io_uring` instance: a submission queue and a completion queue
+// shared with the kernel, used with `io_uring_setup()` and `io_uring_enter()`
+// directly.
+//
+// `IoUringQueue` is thread-compatible. Buffers used by submitted operations
+// must remain valid until their completions are seen; the destructor waits for
+// outstanding operations for that reason.
+class IoUringQueue {
+ public:
+  IoUringQueue() noexcept {}
+
+  IoUringQueue(const IoUringQueue&) = delete;
+  IoUringQueue& operator=(const IoUringQueue&) = delete;
+
+  // Waits for outstanding operations, then releases the queues.
+  ~IoUringQueue();
+
+  // Sets up queues for at least `entries` operations in flight.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - failure (e.g. `io_uring` is not supported)
+  absl::Status Initialize(uint32_t entries);
+
+  // Returns a cleared submission queue entry to be filled by the caller, or
+  // `nullptr` if the submission queue or the completion queue is full.
+  //
+  // The entry is passed to the kernel by the next `Submit()`.
+  io_uring_sqe* GetSqe();
+
+  // Submits entries obtained by `GetSqe()` since the last `Submit()`, and
+  // waits until at least `min_complete` completions are available.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - failure of `io_uring_enter()`
+  absl::Status Submit(uint32_t min_complete = 0);
+
+  // Returns the next available completion, or `nullptr` if none is available
+  // without waiting. It remains valid until `SeenCqe()`.
+  const io_uring_cqe* PeekCqe() const;
+
+  // Marks the completion returned by `PeekCqe()` as processed.
+  void SeenCqe();
+
+  // Returns the number of operations obtained by `GetSqe()` whose completions
+  // have not been processed yet.
+  uint32_t in_flight() const { return in_flight_; }
+
+ private:
+  int ring_fd_ = -1;
+  uint32_t entries_ = 0;
+
+  void* sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  // Pointers into `sq_ring_`.
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* sq_array_ = nullptr;
+  // Pointers into `cq_ring_`.
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+
+  // Entries in `sqes_` obtained by `GetSqe()` but not yet published in
+  // `sq_array_`, are between `sqe_head_` and `sqe_tail_`.
+  unsigned sqe_head_ = 0;
+  unsigned sqe_tail_ = 0;
+  uint32_t in_flight_ = 0;
+};
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_IO_URING_QUEUE_H_
@@ -0,0 +1,338 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make `off_t` 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include "riegeli/bytes/io_uring_reader.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/io_uring_queue.h"
+
+namespace riegeli {
+
+void IoUringReaderBase::Initialize(int src,
+                                   absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT_GE(src, 0)
+      << "Failed precondition of IoUringReader: negative file descriptor";
+  SetFilename(src);
+  InitializePos(src, independent_pos);
+}
+
+inline void IoUringReaderBase::SetFilename(int src) {
+  if (src == 0) {
+    filename_ = "/dev/stdin";
+  } else {
+    filename_ = absl::StrCat("/proc/self/fd/", src);
+  }
+}
+
+int IoUringReaderBase::OpenFd(absl::string_view filename, int flags) {
+  // TODO: When `absl::string_view` becomes C++17 `std::string_view`:
+  // `filename_ = filename`
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int src = open(filename_.c_str(), flags, 0666);
+  if (ABSL_PREDICT_FALSE(src < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return -1;
+  }
+  return src;
+}
+
+void IoUringReaderBase::InitializePos(
+    int src, absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT(!has_independent_pos_)
+      << "Failed precondition of IoUringReaderBase::InitializePos(): "
+         "has_independent_pos_ not reset";
+  if (independent_pos != absl::nullopt) {
+    has_independent_pos_ = true;
+    if (ABSL_PREDICT_FALSE(*independent_pos >
+                           Position{std::numeric_limits<off_t>::max()})) {
+      FailOverflow();
+      return;
+    }
+    set_limit_pos(*independent_pos);
+  } else {
+    const off_t file_pos = lseek(src, 0, SEEK_CUR);
+    if (ABSL_PREDICT_FALSE(file_pos < 0)) {
+      FailOperation("lseek()");
+      return;
+    }
+    set_limit_pos(IntCast<Position>(file_pos));
+  }
+  next_read_pos_ = limit_pos();
+  ring_ = std::make_unique<internal::IoUringQueue>();
+  {
+    const absl::Status status =
+        ring_->Initialize(IntCast<uint32_t>(UnsignedMin(
+            slots_.size(), size_t{std::numeric_limits<uint32_t>::max()})));
+    if (ABSL_PREDICT_FALSE(!status.ok())) Fail(status);
+  }
+}
+
+inline bool IoUringReaderBase::SyncPos(int src) {
+  if (!has_independent_pos_) {
+    if (ABSL_PREDICT_FALSE(lseek(src, IntCast<off_t>(pos()), SEEK_SET) < 0)) {
+      return FailOperation("lseek()");
+    }
+  }
+  return true;
+}
+
+void IoUringReaderBase::Done() {
+  if (ring_ != nullptr) DiscardPending();
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    const int src = src_fd();
+    SyncPos(src);
+  }
+  BufferedReader::Done();
+  ring_.reset();
+  slots_ = std::vector<Slot>();
+}
+
+bool IoUringReaderBase::FailOperation(absl::string_view operation) {
+  const int error_number = errno;
+  RIEGELI_ASSERT_NE(error_number, 0)
+      << "Failed precondition of IoUringReaderBase::FailOperation(): "
+         "zero errno";
+  RIEGELI_ASSERT(is_open())
+      << "Failed precondition of IoUringReaderBase::FailOperation(): "
+         "Object closed";
+  return Fail(
+      ErrnoToCanonicalStatus(error_number, absl::StrCat(operation, " failed")));
+}
+
+bool IoUringReaderBase::Fail(absl::Status status) {
+  RIEGELI_ASSERT(!status.ok())
+      << "Failed precondition of Object::Fail(): status not failed";
+  return BufferedReader::Fail(
+      Annotate(status, absl::StrCat("reading ", filename_)));
+}
+
+inline bool IoUringReaderBase::SubmitReads(int src) {
+  bool submitted = false;
+  while (num_pending_ < slots_.size()) {
+    const Position max_length =
+        Position{std::numeric_limits<off_t>::max()} - next_read_pos_;
+    if (max_length == 0) break;
+    io_uring_sqe* const sqe = ring_->GetSqe();
+    if (sqe == nullptr) break;
+    const size_t index = (head_ + num_pending_) % slots_.size();
+    Slot& slot = slots_[index];
+    if (slot.buffer.capacity() < read_size_) slot.buffer.Reset(read_size_);
+    slot.iov.iov_base = slot.buffer.data();
+    slot.iov.iov_len = UnsignedMin(read_size_, max_length);
+    slot.pos = next_read_pos_;
+    slot.completed = false;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = src;
+    sqe->off = slot.pos;
+    sqe->addr = reinterpret_cast<uintptr_t>(&slot.iov);
+    sqe->len = 1;
+    sqe->user_data = index;
+    next_read_pos_ += slot.iov.iov_len;
+    ++num_pending_;
+    submitted = true;
+  }
+  if (!submitted) return true;
+  const absl::Status status = ring_->Submit();
+  if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(status);
+  return true;
+}
+
+inline bool IoUringReaderBase::ResubmitRead(int src, size_t index) {
+  io_uring_sqe* const sqe = ring_->GetSqe();
+  RIEGELI_ASSERT(sqe != nullptr)
+      << "IoUringQueue full after a completion was processed";
+  Slot& slot = slots_[index];
+  slot.completed = false;
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = src;
+  sqe->off = slot.pos;
+  sqe->addr = reinterpret_cast<uintptr_t>(&slot.iov);
+  sqe->len = 1;
+  sqe->user_data = index;
+  const absl::Status status = ring_->Submit();
+  if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(status);
+  return true;
+}
+
+inline void IoUringReaderBase::ReapCompletions() {
+  while (const io_uring_cqe* const cqe = ring_->PeekCqe()) {
+    RIEGELI_ASSERT_LT(cqe->user_data, slots_.size())
+        << "io_uring completion of an unknown read";
+    Slot& slot = slots_[cqe->user_data];
+    slot.result = cqe->res;
+    slot.completed = true;
+    ring_->SeenCqe();
+  }
+}
+
+inline bool IoUringReaderBase::WaitForSlot(size_t index) {
+  for (;;) {
+    ReapCompletions();
+    if (slots_[index].completed) return true;
+    const absl::Status status = ring_->Submit(1);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(status);
+  }
+}
+
+void IoUringReaderBase::DiscardPending() {
+  // Buffers of pending reads must not be reused until the reads complete.
+  while (ring_->in_flight() > 0) {
+    ReapCompletions();
+    if (ring_->in_flight() == 0) break;
+    if (ABSL_PREDICT_FALSE(!ring_->Submit(1).ok())) break;
+  }
+  head_ = 0;
+  num_pending_ = 0;
+  head_offset_ = 0;
+  next_read_pos_ = limit_pos();
+}
+
+bool IoUringReaderBase::ReadInternal(size_t min_length, size_t max_length,
+                                     char* dest) {
+  RIEGELI_ASSERT_GT(min_length, 0u)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "nothing to read";
+  RIEGELI_ASSERT_GE(max_length, min_length)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "max_length < min_length";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedReader::ReadInternal(): " << status();
+  const int src = src_fd();
+  if (ABSL_PREDICT_FALSE(max_length >
+                         Position{std::numeric_limits<off_t>::max()} -
+                             limit_pos())) {
+    return FailOverflow();
+  }
+  for (;;) {
+    if (ABSL_PREDICT_FALSE(!SubmitReads(src))) return false;
+    RIEGELI_ASSERT_GT(num_pending_, 0u)
+        << "No reads pending after IoUringReaderBase::SubmitReads()";
+    if (ABSL_PREDICT_FALSE(!WaitForSlot(head_))) return false;
+    Slot& slot = slots_[head_];
+    if (ABSL_PREDICT_FALSE(slot.result < 0)) {
+      if (slot.result == -EINTR || slot.result == -EAGAIN) {
+        if (ABSL_PREDICT_FALSE(!ResubmitRead(src, head_))) return false;
+        continue;
+      }
+      errno = -slot.result;
+      return FailOperation("readv()");
+    }
+    const size_t length_read = IntCast<size_t>(slot.result);
+    RIEGELI_ASSERT_LE(length_read, slot.iov.iov_len)
+        << "readv() read more than requested";
+    if (ABSL_PREDICT_FALSE(length_read == 0)) {
+      // End of file. Reads issued after this one are at or past the end too,
+      // but they are discarded in case the file grows later.
+      DiscardPending();
+      return false;
+    }
+    RIEGELI_ASSERT_LE(head_offset_, length_read)
+        << "Failed invariant of IoUringReaderBase: "
+           "consumed more than was read";
+    const size_t length = UnsignedMin(length_read - head_offset_, max_length);
+    memcpy(dest, slot.buffer.data() + head_offset_, length);
+    move_limit_pos(length);
+    head_offset_ += length;
+    if (head_offset_ == length_read) {
+      if (ABSL_PREDICT_FALSE(length_read < slot.iov.iov_len)) {
+        // A short read. Reads issued after this one do not start where this
+        // one ended, so read again from the current position.
+        DiscardPending();
+      } else {
+        head_ = (head_ + 1) % slots_.size();
+        --num_pending_;
+        head_offset_ = 0;
+      }
+    }
+    if (length >= min_length) return true;
+    dest += length;
+    min_length -= length;
+    max_length -= length;
+  }
+}
+
+bool IoUringReaderBase::Sync() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int src = src_fd();
+  return SyncPos(src);
+}
+
+bool IoUringReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const int src = src_fd();
+  ClearBuffer();
+  if (new_pos > limit_pos()) {
+    // Seeking forwards.
+    struct stat stat_info;
+    if (ABSL_PREDICT_FALSE(fstat(src, &stat_info) < 0)) {
+      return FailOperation("fstat()");
+    }
+    if (ABSL_PREDICT_FALSE(new_pos > IntCast<Position>(stat_info.st_size))) {
+      // File ends.
+      set_limit_pos(IntCast<Position>(stat_info.st_size));
+      DiscardPending();
+      SyncPos(src);
+      return false;
+    }
+  }
+  set_limit_pos(new_pos);
+  // Pending reads follow the old position.
+  DiscardPending();
+  return SyncPos(src);
+}
+
+absl::optional<Position> IoUringReaderBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  const int src = src_fd();
+  struct stat stat_info;
+  if (ABSL_PREDICT_FALSE(fstat(src, &stat_info) < 0)) {
+    FailOperation("fstat()");
+    return absl::nullopt;
+  }
+  return IntCast<Position>(stat_info.st_size);
+}
+
+}  // namespace riegeli
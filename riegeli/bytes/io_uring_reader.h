@@ -0,0 +1,475 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_IO_URING_READER_H_
+#define RIEGELI_BYTES_IO_URING_READER_H_
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/io_uring_queue.h"
+
+namespace riegeli {
+
+// Template parameter independent part of `IoUringReader`.
+class IoUringReaderBase : public BufferedReader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // If `absl::nullopt`, `IoUringReader` reads starting from the current fd
+    // position. The `IoUringReader` position is synchronized back to the fd by
+    // `Close()` and `Sync()`.
+    //
+    // If not `absl::nullopt`, `IoUringReader` reads starting from this
+    // position, without disturbing the current fd position. This is useful for
+    // multiple readers concurrently reading from the same fd.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_independent_pos(absl::optional<Position> independent_pos) & {
+      independent_pos_ = independent_pos;
+      return *this;
+    }
+    Options&& set_independent_pos(absl::optional<Position> independent_pos) && {
+      return std::move(set_independent_pos(independent_pos));
+    }
+    absl::optional<Position> independent_pos() const {
+      return independent_pos_;
+    }
+
+    // Tunes how much data is buffered after reading from the file. This is
+    // also the length of each read in flight.
+    //
+    // Default: `kDefaultBufferSize` (64K).
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "IoUringReaderBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+    size_t buffer_size() const { return buffer_size_; }
+
+    // Maximum number of reads in flight. Reads of consecutive `buffer_size()`
+    // regions following the current position are issued ahead of time, so
+    // that `queue_depth() * buffer_size()` bytes can be read concurrently.
+    //
+    // Default: 4.
+    Options& set_queue_depth(size_t queue_depth) & {
+      RIEGELI_ASSERT_GT(queue_depth, 0u)
+          << "Failed precondition of "
+             "IoUringReaderBase::Options::set_queue_depth(): "
+             "zero queue depth";
+      queue_depth_ = queue_depth;
+      return *this;
+    }
+    Options&& set_queue_depth(size_t queue_depth) && {
+      return std::move(set_queue_depth(queue_depth));
+    }
+    size_t queue_depth() const { return queue_depth_; }
+
+   private:
+    absl::optional<Position> independent_pos_;
+    size_t buffer_size_ = kDefaultBufferSize;
+    size_t queue_depth_ = 4;
+  };
+
+  // Returns the fd being read from. If the fd is owned then changed to -1 by
+  // `Close()`, otherwise unchanged.
+  virtual int src_fd() const = 0;
+
+  // Returns the original name of the file being read from (or "/dev/stdin" or
+  // "/proc/self/fd/<fd>" if fd was given). Unchanged by `Close()`.
+  const std::string& filename() const { return filename_; }
+
+  using BufferedReader::Fail;
+  bool Fail(absl::Status status) override;
+  bool Sync() override;
+  bool SupportsRandomAccess() override { return true; }
+  bool SupportsSize() override { return true; }
+  absl::optional<Position> Size() override;
+
+ protected:
+  IoUringReaderBase() noexcept {}
+
+  explicit IoUringReaderBase(size_t buffer_size, size_t queue_depth);
+
+  IoUringReaderBase(IoUringReaderBase&& that) noexcept;
+  IoUringReaderBase& operator=(IoUringReaderBase&& that) noexcept;
+
+  void Reset();
+  void Reset(size_t buffer_size, size_t queue_depth);
+  void Initialize(int src, absl::optional<Position> independent_pos);
+  int OpenFd(absl::string_view filename, int flags);
+  void InitializePos(int src, absl::optional<Position> independent_pos);
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+
+  void Done() override;
+  bool ReadInternal(size_t min_length, size_t max_length, char* dest) override;
+  bool SeekSlow(Position new_pos) override;
+
+ private:
+  // A read in flight, or a completed read whose data are not consumed yet.
+  struct Slot {
+    Buffer buffer;
+    struct iovec iov;
+    Position pos = 0;
+    bool completed = false;
+    // Valid if `completed`: the length read, or negated `errno`.
+    int result = 0;
+  };
+
+  void SetFilename(int src);
+  bool SyncPos(int src);
+  // Issues reads following `next_read_pos_` until `queue_depth_` reads are
+  // pending.
+  bool SubmitReads(int src);
+  // Issues the read of `slots_[index]` again.
+  bool ResubmitRead(int src, size_t index);
+  // Waits until the read of `slots_[index]` completes.
+  bool WaitForSlot(size_t index);
+  // Records completions which are available in their slots.
+  void ReapCompletions();
+  // Waits for all pending reads and discards their data, so that the next read
+  // starts at `limit_pos()`.
+  void DiscardPending();
+
+  std::string filename_;
+  bool has_independent_pos_ = false;
+  size_t read_size_ = 0;
+  // Circular buffer of `queue_depth` slots. Pending reads are
+  // `slots_[(head_ + i) % slots_.size()]` for `i < num_pending_`, reading
+  // consecutive regions starting at `limit_pos() - head_offset_`.
+  std::vector<Slot> slots_;
+  size_t head_ = 0;
+  size_t num_pending_ = 0;
+  // The length of data from `slots_[head_]` already consumed.
+  size_t head_offset_ = 0;
+  // The position of the next read to issue.
+  Position next_read_pos_ = 0;
+  // Destroyed before `slots_` because it waits for reads into their buffers.
+  std::unique_ptr<internal::IoUringQueue> ring_;
+
+  // Invariant: `limit_pos() <= std::numeric_limits<off_t>::max()`
+};
+
+// A `Reader` which reads from a file descriptor using Linux `io_uring`.
+//
+// Several reads of the following parts of the file are kept in flight, which
+// lets the kernel and the device overlap them with processing of data already
+// read. This benefits reading large files sequentially, especially from
+// devices with high latency or parallelism.
+//
+// The fd must support:
+//  * `close()` - if the fd is owned
+//  * `lseek()` - if `Options::independent_pos() == absl::nullopt`
+//  * `fstat()` - for `Seek()` or `Size()`
+//  * reading at an explicit position through `io_uring`
+//
+// `IoUringReader` supports random access.
+//
+// The `Src` template parameter specifies the type of the object providing and
+// possibly owning the fd being read from. `Src` must support
+// `Dependency<int, Src>`, e.g. `OwnedFd` (owned, default), `UnownedFd`
+// (not owned).
+//
+// By relying on CTAD the template argument can be deduced as `OwnedFd` if the
+// first constructor argument is a filename or an `int`, otherwise as the value
+// type of the first constructor argument. This requires C++17.
+//
+// Until the `IoUringReader` is closed or no longer used, the fd must not be
+// closed.
+template <typename Src = OwnedFd>
+class IoUringReader : public IoUringReaderBase {
+ public:
+  // Creates a closed `IoUringReader`.
+  IoUringReader() noexcept {}
+
+  // Will read from the fd provided by `src`.
+  explicit IoUringReader(const Src& src, Options options = Options());
+  explicit IoUringReader(Src&& src, Options options = Options());
+
+  // Will read from the fd provided by a `Src` constructed from elements of
+  // `src_args`. This avoids constructing a temporary `Src` and moving from it.
+  template <typename... SrcArgs>
+  explicit IoUringReader(std::tuple<SrcArgs...> src_args,
+                         Options options = Options());
+
+  // Opens a file for reading.
+  //
+  // `flags` is the second argument of `open()`, typically `O_RDONLY`.
+  //
+  // `flags` must include either `O_RDONLY` or `O_RDWR`.
+  explicit IoUringReader(absl::string_view filename, int flags,
+                         Options options = Options());
+
+  IoUringReader(IoUringReader&& that) noexcept;
+  IoUringReader& operator=(IoUringReader&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `IoUringReader`. This
+  // avoids constructing a temporary `IoUringReader` and moving from it.
+  void Reset();
+  void Reset(const Src& src, Options options = Options());
+  void Reset(Src&& src, Options options = Options());
+  template <typename... SrcArgs>
+  void Reset(std::tuple<SrcArgs...> src_args, Options options = Options());
+  void Reset(absl::string_view filename, int flags,
+             Options options = Options());
+
+  // Returns the object providing and possibly owning the fd being read from. If
+  // the fd is owned then changed to -1 by `Close()`, otherwise unchanged.
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  int src_fd() const override { return src_.get(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  using IoUringReaderBase::Initialize;
+  void Initialize(absl::string_view filename, int flags,
+                  absl::optional<Position> independent_pos);
+
+  // The object providing and possibly owning the fd being read from.
+  Dependency<int, Src> src_;
+};
+
+// Support CTAD.
+#if __cpp_deduction_guides
+IoUringReader()->IoUringReader<DeleteCtad<>>;
+template <typename Src>
+explicit IoUringReader(const Src& src, IoUringReaderBase::Options options =
+                                           IoUringReaderBase::Options())
+    -> IoUringReader<
+        std::conditional_t<std::is_convertible<const Src&, int>::value, OwnedFd,
+                           std::decay_t<Src>>>;
+template <typename Src>
+explicit IoUringReader(Src&& src, IoUringReaderBase::Options options =
+                                      IoUringReaderBase::Options())
+    -> IoUringReader<std::conditional_t<std::is_convertible<Src&&, int>::value,
+                                        OwnedFd, std::decay_t<Src>>>;
+template <typename... SrcArgs>
+explicit IoUringReader(
+    std::tuple<SrcArgs...> src_args,
+    IoUringReaderBase::Options options = IoUringReaderBase::Options())
+    -> IoUringReader<DeleteCtad<std::tuple<SrcArgs...>>>;
+explicit IoUringReader(
+    absl::string_view filename, int flags,
+    IoUringReaderBase::Options options = IoUringReaderBase::Options())
+    ->IoUringReader<>;
+#endif
+
+// Implementation details follow.
+
+inline IoUringReaderBase::IoUringReaderBase(size_t buffer_size,
+                                            size_t queue_depth)
+    : BufferedReader(buffer_size),
+      read_size_(buffer_size),
+      slots_(queue_depth) {}
+
+inline IoUringReaderBase::IoUringReaderBase(IoUringReaderBase&& that) noexcept
+    : BufferedReader(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      filename_(std::move(that.filename_)),
+      has_independent_pos_(that.has_independent_pos_),
+      read_size_(that.read_size_),
+      slots_(std::move(that.slots_)),
+      head_(that.head_),
+      num_pending_(std::exchange(that.num_pending_, 0)),
+      head_offset_(that.head_offset_),
+      next_read_pos_(that.next_read_pos_),
+      ring_(std::move(that.ring_)) {}
+
+inline IoUringReaderBase& IoUringReaderBase::operator=(
+    IoUringReaderBase&& that) noexcept {
+  BufferedReader::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  filename_ = std::move(that.filename_);
+  has_independent_pos_ = that.has_independent_pos_;
+  read_size_ = that.read_size_;
+  // `ring_` is assigned before `slots_` because it waits for reads into the
+  // buffers of the old `slots_`.
+  ring_ = std::move(that.ring_);
+  slots_ = std::move(that.slots_);
+  head_ = that.head_;
+  num_pending_ = std::exchange(that.num_pending_, 0);
+  head_offset_ = that.head_offset_;
+  next_read_pos_ = that.next_read_pos_;
+  return *this;
+}
+
+inline void IoUringReaderBase::Reset() {
+  BufferedReader::Reset();
+  filename_.clear();
+  has_independent_pos_ = false;
+  read_size_ = 0;
+  ring_.reset();
+  slots_.clear();
+  head_ = 0;
+  num_pending_ = 0;
+  head_offset_ = 0;
+  next_read_pos_ = 0;
+}
+
+inline void IoUringReaderBase::Reset(size_t buffer_size, size_t queue_depth) {
+  BufferedReader::Reset(buffer_size);
+  // `filename_` will be set by `Initialize()`.
+  has_independent_pos_ = false;
+  read_size_ = buffer_size;
+  ring_.reset();
+  slots_.clear();
+  slots_.resize(queue_depth);
+  head_ = 0;
+  num_pending_ = 0;
+  head_offset_ = 0;
+  next_read_pos_ = 0;
+}
+
+template <typename Src>
+inline IoUringReader<Src>::IoUringReader(const Src& src, Options options)
+    : IoUringReaderBase(options.buffer_size(), options.queue_depth()),
+      src_(src) {
+  Initialize(src_.get(), options.independent_pos());
+}
+
+template <typename Src>
+inline IoUringReader<Src>::IoUringReader(Src&& src, Options options)
+    : IoUringReaderBase(options.buffer_size(), options.queue_depth()),
+      src_(std::move(src)) {
+  Initialize(src_.get(), options.independent_pos());
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline IoUringReader<Src>::IoUringReader(std::tuple<SrcArgs...> src_args,
+                                         Options options)
+    : IoUringReaderBase(options.buffer_size(), options.queue_depth()),
+      src_(std::move(src_args)) {
+  Initialize(src_.get(), options.independent_pos());
+}
+
+template <typename Src>
+inline IoUringReader<Src>::IoUringReader(absl::string_view filename, int flags,
+                                         Options options)
+    : IoUringReaderBase(options.buffer_size(), options.queue_depth()) {
+  Initialize(filename, flags, options.independent_pos());
+}
+
+template <typename Src>
+inline IoUringReader<Src>::IoUringReader(IoUringReader&& that) noexcept
+    : IoUringReaderBase(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      src_(std::move(that.src_)) {}
+
+template <typename Src>
+inline IoUringReader<Src>& IoUringReader<Src>::operator=(
+    IoUringReader&& that) noexcept {
+  IoUringReaderBase::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+inline void IoUringReader<Src>::Reset() {
+  IoUringReaderBase::Reset();
+  src_.Reset();
+}
+
+template <typename Src>
+inline void IoUringReader<Src>::Reset(const Src& src, Options options) {
+  IoUringReaderBase::Reset(options.buffer_size(), options.queue_depth());
+  src_.Reset(src);
+  Initialize(src_.get(), options.independent_pos());
+}
+
+template <typename Src>
+inline void IoUringReader<Src>::Reset(Src&& src, Options options) {
+  IoUringReaderBase::Reset(options.buffer_size(), options.queue_depth());
+  src_.Reset(std::move(src));
+  Initialize(src_.get(), options.independent_pos());
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline void IoUringReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
+                                      Options options) {
+  IoUringReaderBase::Reset(options.buffer_size(), options.queue_depth());
+  src_.Reset(std::move(src_args));
+  Initialize(src_.get(), options.independent_pos());
+}
+
+template <typename Src>
+inline void IoUringReader<Src>::Reset(absl::string_view filename, int flags,
+                                      Options options) {
+  IoUringReaderBase::Reset(options.buffer_size(), options.queue_depth());
+  src_.Reset();  // In case `OpenFd()` fails.
+  Initialize(filename, flags, options.independent_pos());
+}
+
+template <typename Src>
+void IoUringReader<Src>::Initialize(absl::string_view filename, int flags,
+                                    absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_RDONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of IoUringReader: "
+         "flags must include either O_RDONLY or O_RDWR";
+  const int src = OpenFd(filename, flags);
+  if (ABSL_PREDICT_FALSE(src < 0)) return;
+  src_.Reset(std::forward_as_tuple(src));
+  InitializePos(src_.get(), independent_pos);
+}
+
+template <typename Src>
+void IoUringReader<Src>::Done() {
+  IoUringReaderBase::Done();
+  if (src_.is_owning()) {
+    const int src = src_.Release();
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(src) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_IO_URING_READER_H_
@@ -0,0 +1,317 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make `off_t` 64-bit even on 32-bit systems.
+#undef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+
+#include "riegeli/bytes/io_uring_writer.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/io_uring_queue.h"
+
+namespace riegeli {
+
+void IoUringWriterBase::Initialize(int dest,
+                                   absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT_GE(dest, 0)
+      << "Failed precondition of IoUringWriter: negative file descriptor";
+  SetFilename(dest);
+  const int flags = fcntl(dest, F_GETFL);
+  if (ABSL_PREDICT_FALSE(flags < 0)) {
+    FailOperation("fcntl()");
+    return;
+  }
+  InitializePos(dest, flags, independent_pos);
+}
+
+inline void IoUringWriterBase::SetFilename(int dest) {
+  if (dest == 1) {
+    filename_ = "/dev/stdout";
+  } else if (dest == 2) {
+    filename_ = "/dev/stderr";
+  } else {
+    filename_ = absl::StrCat("/proc/self/fd/", dest);
+  }
+}
+
+int IoUringWriterBase::OpenFd(absl::string_view filename, int flags,
+                              mode_t permissions) {
+  // TODO: When `absl::string_view` becomes C++17 `std::string_view`:
+  // `filename_ = filename`
+  filename_.assign(filename.data(), filename.size());
+again:
+  const int dest = open(filename_.c_str(), flags, permissions);
+  if (ABSL_PREDICT_FALSE(dest < 0)) {
+    if (errno == EINTR) goto again;
+    FailOperation("open()");
+    return -1;
+  }
+  return dest;
+}
+
+void IoUringWriterBase::InitializePos(
+    int dest, int flags, absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT(!has_independent_pos_)
+      << "Failed precondition of IoUringWriterBase::InitializePos(): "
+         "has_independent_pos_ not reset";
+  if (ABSL_PREDICT_FALSE((flags & O_APPEND) != 0)) {
+    Fail(absl::InvalidArgumentError(
+        "IoUringWriter does not support O_APPEND because writes complete in "
+        "an unspecified order"));
+    return;
+  }
+  if (independent_pos != absl::nullopt) {
+    has_independent_pos_ = true;
+    if (ABSL_PREDICT_FALSE(*independent_pos >
+                           Position{std::numeric_limits<off_t>::max()})) {
+      FailOverflow();
+      return;
+    }
+    set_start_pos(*independent_pos);
+  } else {
+    const off_t file_pos = lseek(dest, 0, SEEK_CUR);
+    if (ABSL_PREDICT_FALSE(file_pos < 0)) {
+      FailOperation("lseek()");
+      return;
+    }
+    set_start_pos(IntCast<Position>(file_pos));
+  }
+  ring_ = std::make_unique<internal::IoUringQueue>();
+  {
+    const absl::Status status =
+        ring_->Initialize(IntCast<uint32_t>(UnsignedMin(
+            slots_.size(), size_t{std::numeric_limits<uint32_t>::max()})));
+    if (ABSL_PREDICT_FALSE(!status.ok())) Fail(status);
+  }
+}
+
+inline bool IoUringWriterBase::SyncPos(int dest) {
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of IoUringWriterBase::SyncPos(): "
+         "buffer not empty";
+  RIEGELI_ASSERT_EQ(num_pending_, 0u)
+      << "Failed precondition of IoUringWriterBase::SyncPos(): "
+         "writes pending";
+  if (!has_independent_pos_) {
+    if (ABSL_PREDICT_FALSE(lseek(dest, IntCast<off_t>(start_pos()), SEEK_SET) <
+                           0)) {
+      return FailOperation("lseek()");
+    }
+  }
+  return true;
+}
+
+void IoUringWriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(PushInternal())) {
+    const int dest = dest_fd();
+    if (ABSL_PREDICT_TRUE(CompletePending(dest))) SyncPos(dest);
+  }
+  if (ring_ != nullptr) DiscardPending();
+  BufferedWriter::Done();
+  ring_.reset();
+  slots_ = std::vector<Slot>();
+}
+
+bool IoUringWriterBase::FailOperation(absl::string_view operation) {
+  const int error_number = errno;
+  RIEGELI_ASSERT_NE(error_number, 0)
+      << "Failed precondition of IoUringWriterBase::FailOperation(): "
+         "zero errno";
+  RIEGELI_ASSERT(is_open())
+      << "Failed precondition of IoUringWriterBase::FailOperation(): "
+         "Object closed";
+  return Fail(
+      ErrnoToCanonicalStatus(error_number, absl::StrCat(operation, " failed")));
+}
+
+bool IoUringWriterBase::Fail(absl::Status status) {
+  RIEGELI_ASSERT(!status.ok())
+      << "Failed precondition of Object::Fail(): status not failed";
+  return BufferedWriter::Fail(
+      Annotate(status, absl::StrCat("writing ", filename_)));
+}
+
+inline void IoUringWriterBase::PrepareWrite(int dest, size_t index) {
+  io_uring_sqe* const sqe = ring_->GetSqe();
+  RIEGELI_ASSERT(sqe != nullptr)
+      << "IoUringQueue full with fewer writes in flight than its entries";
+  Slot& slot = slots_[index];
+  slot.iov.iov_base = slot.buffer.data() + slot.written;
+  slot.iov.iov_len = slot.length - slot.written;
+  slot.completed = false;
+  sqe->opcode = IORING_OP_WRITEV;
+  sqe->fd = dest;
+  sqe->off = slot.pos + slot.written;
+  sqe->addr = reinterpret_cast<uintptr_t>(&slot.iov);
+  sqe->len = 1;
+  sqe->user_data = index;
+}
+
+inline void IoUringWriterBase::ReapCompletions() {
+  while (const io_uring_cqe* const cqe = ring_->PeekCqe()) {
+    RIEGELI_ASSERT_LT(cqe->user_data, slots_.size())
+        << "io_uring completion of an unknown write";
+    Slot& slot = slots_[cqe->user_data];
+    slot.result = cqe->res;
+    slot.completed = true;
+    ring_->SeenCqe();
+  }
+}
+
+inline bool IoUringWriterBase::CompleteSlot(int dest, size_t index) {
+  Slot& slot = slots_[index];
+  for (;;) {
+    ReapCompletions();
+    if (!slot.completed) {
+      const absl::Status status = ring_->Submit(1);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(status);
+      continue;
+    }
+    if (ABSL_PREDICT_FALSE(slot.result < 0)) {
+      if (slot.result != -EINTR && slot.result != -EAGAIN) {
+        errno = -slot.result;
+        return FailOperation("writev()");
+      }
+    } else {
+      RIEGELI_ASSERT_GT(slot.result, 0) << "writev() returned 0";
+      RIEGELI_ASSERT_LE(IntCast<size_t>(slot.result),
+                        slot.length - slot.written)
+          << "writev() wrote more than requested";
+      slot.written += IntCast<size_t>(slot.result);
+      if (slot.written == slot.length) return true;
+    }
+    // Write again what is left.
+    PrepareWrite(dest, index);
+    const absl::Status status = ring_->Submit();
+    if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(status);
+  }
+}
+
+inline bool IoUringWriterBase::CompletePending(int dest) {
+  while (num_pending_ > 0) {
+    if (ABSL_PREDICT_FALSE(!CompleteSlot(dest, head_))) return false;
+    head_ = (head_ + 1) % slots_.size();
+    --num_pending_;
+  }
+  return true;
+}
+
+void IoUringWriterBase::DiscardPending() {
+  // Buffers of pending writes must not be reused until the writes complete.
+  while (ring_->in_flight() > 0) {
+    ReapCompletions();
+    if (ring_->in_flight() == 0) break;
+    if (ABSL_PREDICT_FALSE(!ring_->Submit(1).ok())) break;
+  }
+  head_ = 0;
+  num_pending_ = 0;
+}
+
+bool IoUringWriterBase::WriteInternal(absl::string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): " << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not empty";
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         Position{std::numeric_limits<off_t>::max()} -
+                             start_pos())) {
+    return FailOverflow();
+  }
+  do {
+    if (num_pending_ == slots_.size()) {
+      // All slots are in use. Wait for the oldest write.
+      if (ABSL_PREDICT_FALSE(!CompleteSlot(dest, head_))) return false;
+      head_ = (head_ + 1) % slots_.size();
+      --num_pending_;
+    }
+    const size_t index = (head_ + num_pending_) % slots_.size();
+    Slot& slot = slots_[index];
+    if (slot.buffer.capacity() < write_size_) slot.buffer.Reset(write_size_);
+    slot.pos = start_pos();
+    slot.length = UnsignedMin(src.size(), write_size_);
+    slot.written = 0;
+    // Copying lets the caller reuse `src` before the write completes.
+    memcpy(slot.buffer.data(), src.data(), slot.length);
+    PrepareWrite(dest, index);
+    ++num_pending_;
+    move_start_pos(slot.length);
+    src.remove_prefix(slot.length);
+  } while (!src.empty());
+  // Submit all writes prepared by this call at once.
+  const absl::Status status = ring_->Submit();
+  if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(status);
+  return true;
+}
+
+bool IoUringWriterBase::FlushImpl(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
+  const int dest = dest_fd();
+  if (ABSL_PREDICT_FALSE(!CompletePending(dest))) return false;
+  switch (flush_type) {
+    case FlushType::kFromObject:
+    case FlushType::kFromProcess:
+      break;
+    case FlushType::kFromMachine:
+      if (ABSL_PREDICT_FALSE(fsync(dest) < 0)) {
+        return FailOperation("fsync()");
+      }
+      break;
+    default:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Unknown flush type: " << static_cast<int>(flush_type);
+  }
+  return SyncPos(dest);
+}
+
+absl::optional<Position> IoUringWriterBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  const int dest = dest_fd();
+  struct stat stat_info;
+  if (ABSL_PREDICT_FALSE(fstat(dest, &stat_info) < 0)) {
+    FailOperation("fstat()");
+    return absl::nullopt;
+  }
+  return UnsignedMax(IntCast<Position>(stat_info.st_size), pos());
+}
+
+}  // namespace riegeli
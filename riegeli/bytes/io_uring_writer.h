@@ -0,0 +1,491 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_IO_URING_WRITER_H_
+#define RIEGELI_BYTES_IO_URING_WRITER_H_
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/io_uring_queue.h"
+
+namespace riegeli {
+
+// Template parameter independent part of `IoUringWriter`.
+class IoUringWriterBase : public BufferedWriter {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Permissions to use in case a new file is created (9 bits). The effective
+    // permissions are modified by the process's umask.
+    //
+    // Default: `0666`.
+    Options& set_permissions(mode_t permissions) & {
+      permissions_ = permissions;
+      return *this;
+    }
+    Options&& set_permissions(mode_t permissions) && {
+      return std::move(set_permissions(permissions));
+    }
+    mode_t permissions() const { return permissions_; }
+
+    // If `absl::nullopt`, `IoUringWriter` writes starting from the current fd
+    // position. The `IoUringWriter` position is synchronized back to the fd by
+    // `Flush()` and `Close()`.
+    //
+    // If not `absl::nullopt`, `IoUringWriter` writes starting from this
+    // position, without disturbing the current fd position. This is useful for
+    // multiple writers concurrently writing to disjoint regions of the same
+    // file.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_independent_pos(absl::optional<Position> independent_pos) & {
+      independent_pos_ = independent_pos;
+      return *this;
+    }
+    Options&& set_independent_pos(absl::optional<Position> independent_pos) && {
+      return std::move(set_independent_pos(independent_pos));
+    }
+    absl::optional<Position> independent_pos() const {
+      return independent_pos_;
+    }
+
+    // Tunes how much data is buffered before writing to the file. This is
+    // also the maximum length of each write in flight.
+    //
+    // Default: `kDefaultBufferSize` (64K).
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "IoUringWriterBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+    size_t buffer_size() const { return buffer_size_; }
+
+    // Maximum number of writes in flight. Writing waits only when this many
+    // writes are not completed yet, and writes issued together are submitted
+    // to the kernel together.
+    //
+    // Default: 4.
+    Options& set_queue_depth(size_t queue_depth) & {
+      RIEGELI_ASSERT_GT(queue_depth, 0u)
+          << "Failed precondition of "
+             "IoUringWriterBase::Options::set_queue_depth(): "
+             "zero queue depth";
+      queue_depth_ = queue_depth;
+      return *this;
+    }
+    Options&& set_queue_depth(size_t queue_depth) && {
+      return std::move(set_queue_depth(queue_depth));
+    }
+    size_t queue_depth() const { return queue_depth_; }
+
+   private:
+    mode_t permissions_ = 0666;
+    absl::optional<Position> independent_pos_;
+    size_t buffer_size_ = kDefaultBufferSize;
+    size_t queue_depth_ = 4;
+  };
+
+  // Returns the fd being written to. If the fd is owned then changed to -1 by
+  // `Close()`, otherwise unchanged.
+  virtual int dest_fd() const = 0;
+
+  // Returns the original name of the file being written to (or "/dev/stdout",
+  // "/dev/stderr", or "/proc/self/fd/<fd>" if fd was given). Unchanged by
+  // `Close()`.
+  const std::string& filename() const { return filename_; }
+
+  using BufferedWriter::Fail;
+  bool Fail(absl::Status status) override;
+  absl::optional<Position> Size() override;
+
+ protected:
+  IoUringWriterBase() noexcept {}
+
+  explicit IoUringWriterBase(size_t buffer_size, size_t queue_depth);
+
+  IoUringWriterBase(IoUringWriterBase&& that) noexcept;
+  IoUringWriterBase& operator=(IoUringWriterBase&& that) noexcept;
+
+  void Reset();
+  void Reset(size_t buffer_size, size_t queue_depth);
+  void Initialize(int dest, absl::optional<Position> independent_pos);
+  int OpenFd(absl::string_view filename, int flags, mode_t permissions);
+  void InitializePos(int dest, int flags,
+                     absl::optional<Position> independent_pos);
+  ABSL_ATTRIBUTE_COLD bool FailOperation(absl::string_view operation);
+
+  void Done() override;
+  bool WriteInternal(absl::string_view src) override;
+  bool FlushImpl(FlushType flush_type) override;
+
+ private:
+  // A write in flight, or a completed write whose slot is not reused yet.
+  struct Slot {
+    Buffer buffer;
+    struct iovec iov;
+    Position pos = 0;
+    size_t length = 0;
+    // The length already written, excluding the write in flight.
+    size_t written = 0;
+    bool completed = false;
+    // Valid if `completed`: the length written, or negated `errno`.
+    int result = 0;
+  };
+
+  void SetFilename(int dest);
+  bool SyncPos(int dest);
+  // Prepares the write of the unwritten part of `slots_[index]`. It is
+  // submitted by the next `ring_->Submit()`.
+  void PrepareWrite(int dest, size_t index);
+  // Waits until `slots_[index]` is fully written, writing again what a short
+  // write left.
+  bool CompleteSlot(int dest, size_t index);
+  // Waits until all pending writes are fully written.
+  bool CompletePending(int dest);
+  // Records completions which are available in their slots.
+  void ReapCompletions();
+  // Waits for all writes in flight without checking their results.
+  void DiscardPending();
+
+  std::string filename_;
+  bool has_independent_pos_ = false;
+  size_t write_size_ = 0;
+  // Circular buffer of `queue_depth` slots. Pending writes are
+  // `slots_[(head_ + i) % slots_.size()]` for `i < num_pending_`.
+  std::vector<Slot> slots_;
+  size_t head_ = 0;
+  size_t num_pending_ = 0;
+  // Destroyed before `slots_` because it waits for writes from their buffers.
+  std::unique_ptr<internal::IoUringQueue> ring_;
+
+  // Invariant: `start_pos() <= std::numeric_limits<off_t>::max()`
+};
+
+// A `Writer` which writes to a file descriptor using Linux `io_uring`.
+//
+// Filled buffers are written asynchronously, several at a time, so that
+// filling further buffers overlaps with writing. This benefits writing large
+// files sequentially, especially to devices with high latency or parallelism.
+//
+// The fd must support:
+//  * `fcntl()` - for the constructor from fd
+//  * `close()` - if the fd is owned
+//  * `lseek()` - if `Options::independent_pos() == absl::nullopt`
+//  * `fstat()` - for `Size()`
+//  * `fsync()` - for `Flush(FlushType::kFromMachine)`
+//  * writing at an explicit position through `io_uring`
+//
+// Writes complete in an unspecified order, hence the fd must not be opened
+// with `O_APPEND`.
+//
+// `IoUringWriter` does not support random access.
+//
+// The `Dest` template parameter specifies the type of the object providing and
+// possibly owning the fd being written to. `Dest` must support
+// `Dependency<int, Dest>`, e.g. `OwnedFd` (owned, default), `UnownedFd`
+// (not owned).
+//
+// By relying on CTAD the template argument can be deduced as `OwnedFd` if the
+// first constructor argument is a filename or an `int`, otherwise as the value
+// type of the first constructor argument. This requires C++17.
+//
+// Until the `IoUringWriter` is closed or no longer used, the fd must not be
+// closed; additionally, if `Options::independent_pos() == absl::nullopt`, the
+// fd should not have its position changed.
+template <typename Dest = OwnedFd>
+class IoUringWriter : public IoUringWriterBase {
+ public:
+  // Creates a closed `IoUringWriter`.
+  IoUringWriter() noexcept {}
+
+  // Will write to the fd provided by `dest`.
+  explicit IoUringWriter(const Dest& dest, Options options = Options());
+  explicit IoUringWriter(Dest&& dest, Options options = Options());
+
+  // Will write to the fd provided by a `Dest` constructed from elements of
+  // `dest_args`. This avoids constructing a temporary `Dest` and moving from
+  // it.
+  template <typename... DestArgs>
+  explicit IoUringWriter(std::tuple<DestArgs...> dest_args,
+                         Options options = Options());
+
+  // Opens a file for writing.
+  //
+  // `flags` is the second argument of `open()`, typically
+  // `O_WRONLY | O_CREAT | O_TRUNC`.
+  //
+  // `flags` must include either `O_WRONLY` or `O_RDWR`, and must not include
+  // `O_APPEND`.
+  explicit IoUringWriter(absl::string_view filename, int flags,
+                         Options options = Options());
+
+  IoUringWriter(IoUringWriter&& that) noexcept;
+  IoUringWriter& operator=(IoUringWriter&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `IoUringWriter`. This
+  // avoids constructing a temporary `IoUringWriter` and moving from it.
+  void Reset();
+  void Reset(const Dest& dest, Options options = Options());
+  void Reset(Dest&& dest, Options options = Options());
+  template <typename... DestArgs>
+  void Reset(std::tuple<DestArgs...> dest_args, Options options = Options());
+  void Reset(absl::string_view filename, int flags,
+             Options options = Options());
+
+  // Returns the object providing and possibly owning the fd being written to.
+  // If the fd is owned then changed to -1 by `Close()`, otherwise unchanged.
+  Dest& dest() { return dest_.manager(); }
+  const Dest& dest() const { return dest_.manager(); }
+  int dest_fd() const override { return dest_.get(); }
+
+ protected:
+  using IoUringWriterBase::Initialize;
+  void Initialize(absl::string_view filename, int flags, mode_t permissions,
+                  absl::optional<Position> independent_pos);
+
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the fd being written to.
+  Dependency<int, Dest> dest_;
+};
+
+// Support CTAD.
+#if __cpp_deduction_guides
+IoUringWriter()->IoUringWriter<DeleteCtad<>>;
+template <typename Dest>
+explicit IoUringWriter(const Dest& dest, IoUringWriterBase::Options options =
+                                             IoUringWriterBase::Options())
+    -> IoUringWriter<
+        std::conditional_t<std::is_convertible<const Dest&, int>::value,
+                           OwnedFd, std::decay_t<Dest>>>;
+template <typename Dest>
+explicit IoUringWriter(Dest&& dest, IoUringWriterBase::Options options =
+                                        IoUringWriterBase::Options())
+    -> IoUringWriter<std::conditional_t<std::is_convertible<Dest&&, int>::value,
+                                        OwnedFd, std::decay_t<Dest>>>;
+template <typename... DestArgs>
+explicit IoUringWriter(
+    std::tuple<DestArgs...> dest_args,
+    IoUringWriterBase::Options options = IoUringWriterBase::Options())
+    -> IoUringWriter<DeleteCtad<std::tuple<DestArgs...>>>;
+explicit IoUringWriter(
+    absl::string_view filename, int flags,
+    IoUringWriterBase::Options options = IoUringWriterBase::Options())
+    ->IoUringWriter<>;
+#endif
+
+// Implementation details follow.
+
+inline IoUringWriterBase::IoUringWriterBase(size_t buffer_size,
+                                            size_t queue_depth)
+    : BufferedWriter(buffer_size),
+      write_size_(buffer_size),
+      slots_(queue_depth) {}
+
+inline IoUringWriterBase::IoUringWriterBase(IoUringWriterBase&& that) noexcept
+    : BufferedWriter(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      filename_(std::move(that.filename_)),
+      has_independent_pos_(that.has_independent_pos_),
+      write_size_(that.write_size_),
+      slots_(std::move(that.slots_)),
+      head_(that.head_),
+      num_pending_(std::exchange(that.num_pending_, 0)),
+      ring_(std::move(that.ring_)) {}
+
+inline IoUringWriterBase& IoUringWriterBase::operator=(
+    IoUringWriterBase&& that) noexcept {
+  BufferedWriter::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  filename_ = std::move(that.filename_);
+  has_independent_pos_ = that.has_independent_pos_;
+  write_size_ = that.write_size_;
+  // `ring_` is assigned before `slots_` because it waits for writes from the
+  // buffers of the old `slots_`.
+  ring_ = std::move(that.ring_);
+  slots_ = std::move(that.slots_);
+  head_ = that.head_;
+  num_pending_ = std::exchange(that.num_pending_, 0);
+  return *this;
+}
+
+inline void IoUringWriterBase::Reset() {
+  BufferedWriter::Reset();
+  filename_.clear();
+  has_independent_pos_ = false;
+  write_size_ = 0;
+  ring_.reset();
+  slots_.clear();
+  head_ = 0;
+  num_pending_ = 0;
+}
+
+inline void IoUringWriterBase::Reset(size_t buffer_size, size_t queue_depth) {
+  BufferedWriter::Reset(buffer_size);
+  // `filename_` will be set by `Initialize()`.
+  has_independent_pos_ = false;
+  write_size_ = buffer_size;
+  ring_.reset();
+  slots_.clear();
+  slots_.resize(queue_depth);
+  head_ = 0;
+  num_pending_ = 0;
+}
+
+template <typename Dest>
+inline IoUringWriter<Dest>::IoUringWriter(const Dest& dest, Options options)
+    : IoUringWriterBase(options.buffer_size(), options.queue_depth()),
+      dest_(dest) {
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline IoUringWriter<Dest>::IoUringWriter(Dest&& dest, Options options)
+    : IoUringWriterBase(options.buffer_size(), options.queue_depth()),
+      dest_(std::move(dest)) {
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+template <typename... DestArgs>
+inline IoUringWriter<Dest>::IoUringWriter(std::tuple<DestArgs...> dest_args,
+                                          Options options)
+    : IoUringWriterBase(options.buffer_size(), options.queue_depth()),
+      dest_(std::move(dest_args)) {
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline IoUringWriter<Dest>::IoUringWriter(absl::string_view filename,
+                                          int flags, Options options)
+    : IoUringWriterBase(options.buffer_size(), options.queue_depth()) {
+  Initialize(filename, flags, options.permissions(),
+             options.independent_pos());
+}
+
+template <typename Dest>
+inline IoUringWriter<Dest>::IoUringWriter(IoUringWriter&& that) noexcept
+    : IoUringWriterBase(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      dest_(std::move(that.dest_)) {}
+
+template <typename Dest>
+inline IoUringWriter<Dest>& IoUringWriter<Dest>::operator=(
+    IoUringWriter&& that) noexcept {
+  IoUringWriterBase::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  dest_ = std::move(that.dest_);
+  return *this;
+}
+
+template <typename Dest>
+inline void IoUringWriter<Dest>::Reset() {
+  IoUringWriterBase::Reset();
+  dest_.Reset();
+}
+
+template <typename Dest>
+inline void IoUringWriter<Dest>::Reset(const Dest& dest, Options options) {
+  IoUringWriterBase::Reset(options.buffer_size(), options.queue_depth());
+  dest_.Reset(dest);
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline void IoUringWriter<Dest>::Reset(Dest&& dest, Options options) {
+  IoUringWriterBase::Reset(options.buffer_size(), options.queue_depth());
+  dest_.Reset(std::move(dest));
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+template <typename... DestArgs>
+inline void IoUringWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
+                                       Options options) {
+  IoUringWriterBase::Reset(options.buffer_size(), options.queue_depth());
+  dest_.Reset(std::move(dest_args));
+  Initialize(dest_.get(), options.independent_pos());
+}
+
+template <typename Dest>
+inline void IoUringWriter<Dest>::Reset(absl::string_view filename, int flags,
+                                       Options options) {
+  IoUringWriterBase::Reset(options.buffer_size(), options.queue_depth());
+  dest_.Reset();  // In case `OpenFd()` fails.
+  Initialize(filename, flags, options.permissions(),
+             options.independent_pos());
+}
+
+template <typename Dest>
+void IoUringWriter<Dest>::Initialize(absl::string_view filename, int flags,
+                                     mode_t permissions,
+                                     absl::optional<Position> independent_pos) {
+  RIEGELI_ASSERT((flags & O_ACCMODE) == O_WRONLY ||
+                 (flags & O_ACCMODE) == O_RDWR)
+      << "Failed precondition of IoUringWriter: "
+         "flags must include either O_WRONLY or O_RDWR";
+  const int dest = OpenFd(filename, flags, permissions);
+  if (ABSL_PREDICT_FALSE(dest < 0)) return;
+  dest_.Reset(std::forward_as_tuple(dest));
+  InitializePos(dest_.get(), flags, independent_pos);
+}
+
+template <typename Dest>
+void IoUringWriter<Dest>::Done() {
+  IoUringWriterBase::Done();
+  if (dest_.is_owning()) {
+    const int dest = dest_.Release();
+    if (ABSL_PREDICT_FALSE(internal::CloseFd(dest) < 0) &&
+        ABSL_PREDICT_TRUE(healthy())) {
+      FailOperation(internal::CloseFunctionName());
+    }
+  }
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_IO_URING_WRITER_H_
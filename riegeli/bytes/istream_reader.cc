@@ -19,6 +19,7 @@
 #include <cerrno>
 #include <istream>
 #include <limits>
+#include <streambuf>
 #include <string>
 
 #include "absl/base/optimization.h"
@@ -157,6 +158,29 @@ bool IstreamReaderBase::ReadInternal(size_t min_length, size_t max_length,
   errno = 0;
   for (;;) {
     std::streamsize length_read;
+    if (min_length < max_length && src.tie() == nullptr) {
+      // `std::streambuf::in_avail()` tells how many characters can be read
+      // without blocking: for a `std::filebuf` of a regular file this is
+      // usually the rest of the file, for a `std::stringbuf` the rest of the
+      // string. Read them with `std::streambuf::sgetn()`, which lets
+      // `std::filebuf` read a large length directly to `dest` instead of
+      // through its own buffer, limited only by `max_length`.
+      //
+      // This bypasses `std::istream`, which is valid if there is no tied
+      // stream to flush first.
+      std::streambuf* const streambuf = src.rdbuf();
+      const std::streamsize available = streambuf->in_avail();
+      if (available > 0) {
+        length_read = streambuf->sgetn(
+            dest, IntCast<std::streamsize>(UnsignedMin(
+                      max_length, IntCast<size_t>(available),
+                      size_t{std::numeric_limits<std::streamsize>::max()})));
+        RIEGELI_ASSERT_GE(length_read, 0) << "negative streambuf::sgetn()";
+        RIEGELI_ASSERT_LE(IntCast<size_t>(length_read), max_length)
+            << "streambuf::sgetn() read more than requested";
+        if (ABSL_PREDICT_TRUE(length_read > 0)) goto fragment_read;
+      }
+    }
     if (min_length < max_length) {
       // Use `std::istream::readsome()` to read as much data as is available,
       // up to `max_length`.
@@ -156,6 +156,16 @@ void LimitingReaderBase::ReadHintSlow(size_t length) {
   MakeBuffer(src);
 }
 
+void LimitingReaderBase::PrefetchHint(Position length) {
+  RIEGELI_ASSERT_LE(pos(), size_limit_)
+      << "Failed invariant of LimitingReaderBase: position exceeds size limit";
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  Reader& src = *src_reader();
+  SyncBuffer(src);
+  src.PrefetchHint(UnsignedMin(length, size_limit_ - pos()));
+  MakeBuffer(src);
+}
+
 bool LimitingReaderBase::Sync() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   Reader& src = *src_reader();
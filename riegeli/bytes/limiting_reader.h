@@ -60,6 +60,7 @@ class LimitingReaderBase : public Reader {
   bool SupportsRandomAccess() override;
   bool SupportsSize() override;
   absl::optional<Position> Size() override;
+  void PrefetchHint(Position length) override;
 
  protected:
   LimitingReaderBase() noexcept : Reader(kInitiallyClosed) {}
@@ -19,6 +19,7 @@
 #include <cerrno>
 #include <limits>
 #include <ostream>
+#include <streambuf>
 #include <string>
 
 #include "absl/base/optimization.h"
@@ -133,13 +134,31 @@ bool OstreamWriterBase::WriteInternal(absl::string_view src) {
                              start_pos())) {
     return FailOverflow();
   }
+  // Writing with `std::streambuf::sputn()` bypasses `std::ostream`, which is
+  // valid if there is no tied stream to flush first, and no flush is requested
+  // after each output operation. `std::filebuf` writes a large length directly
+  // to its file instead of through its own buffer either way.
+  std::streambuf* const streambuf =
+      dest.tie() == nullptr && (dest.flags() & std::ios_base::unitbuf) == 0
+          ? dest.rdbuf()
+          : nullptr;
   errno = 0;
   do {
     const size_t length_to_write = UnsignedMin(
         src.size(), size_t{std::numeric_limits<std::streamsize>::max()});
-    dest.write(src.data(), IntCast<std::streamsize>(length_to_write));
-    if (ABSL_PREDICT_FALSE(dest.fail())) {
-      return FailOperation("ostream::write()");
+    if (streambuf != nullptr) {
+      const std::streamsize length_written = streambuf->sputn(
+          src.data(), IntCast<std::streamsize>(length_to_write));
+      if (ABSL_PREDICT_FALSE(length_written !=
+                             IntCast<std::streamsize>(length_to_write))) {
+        dest.setstate(std::ios_base::badbit);
+        return FailOperation("streambuf::sputn()");
+      }
+    } else {
+      dest.write(src.data(), IntCast<std::streamsize>(length_to_write));
+      if (ABSL_PREDICT_FALSE(dest.fail())) {
+        return FailOperation("ostream::write()");
+      }
     }
     move_start_pos(length_to_write);
     src.remove_prefix(length_to_write);
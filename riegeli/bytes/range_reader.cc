@@ -0,0 +1,200 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/range_reader.h"
+
+#include <stddef.h>
+
+#include <chrono>
+#include <future>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/pullable_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+void RangeReaderBase::WaitForReads() {
+  for (Pending& pending : pending_) pending.fetched.wait();
+  for (std::future<Fetched>& fetched : abandoned_) fetched.wait();
+  abandoned_.clear();
+}
+
+void RangeReaderBase::Done() {
+  WaitForReads();
+  PullableReader::Done();
+  block_ = Chain();
+  iter_ = block_.blocks().cend();
+  pending_.clear();
+}
+
+inline void RangeReaderBase::StartReads() {
+  // Forget abandoned reads which are already finished.
+  for (size_t i = 0; i < abandoned_.size();) {
+    if (abandoned_[i].wait_for(std::chrono::seconds(0)) ==
+        std::future_status::ready) {
+      abandoned_[i] = std::move(abandoned_.back());
+      abandoned_.pop_back();
+    } else {
+      ++i;
+    }
+  }
+  RangeSource* const src = src_source();
+  while (pending_.size() < read_ahead_ &&
+         (size_ == absl::nullopt || request_pos_ < *size_)) {
+    struct FetchRequest {
+      std::promise<Fetched> fetched;
+    };
+    FetchRequest* const request = new FetchRequest();
+    Pending pending;
+    pending.pos = request_pos_;
+    pending.length = size_ == absl::nullopt
+                         ? block_size_
+                         : IntCast<size_t>(UnsignedMin(
+                               block_size_, *size_ - request_pos_));
+    pending.fetched = request->fetched.get_future();
+    ThreadPool::global().Schedule(
+        [request, src, pos = pending.pos, length = pending.length] {
+          Fetched fetched;
+          fetched.status = src->ReadRange(pos, length, fetched.data);
+          request->fetched.set_value(std::move(fetched));
+          delete request;
+        });
+    request_pos_ += pending.length;
+    pending_.push_back(std::move(pending));
+  }
+}
+
+inline void RangeReaderBase::AbandonReads() {
+  for (Pending& pending : pending_) {
+    abandoned_.push_back(std::move(pending.fetched));
+  }
+  pending_.clear();
+}
+
+inline bool RangeReaderBase::TakeBlock() {
+  set_buffer();
+  block_.Clear();
+  iter_ = block_.blocks().cend();
+  if (size_ != absl::nullopt && limit_pos() >= *size_) return false;
+  StartReads();
+  RIEGELI_ASSERT(!pending_.empty())
+      << "Failed invariant of RangeReaderBase: no range read ahead";
+  RIEGELI_ASSERT_EQ(pending_.front().pos, limit_pos())
+      << "Failed invariant of RangeReaderBase: "
+         "range read ahead does not follow the buffer";
+  Pending pending = std::move(pending_.front());
+  pending_.pop_front();
+  Fetched fetched = pending.fetched.get();
+  if (ABSL_PREDICT_FALSE(!fetched.status.ok())) {
+    return Fail(std::move(fetched.status));
+  }
+  RIEGELI_ASSERT_LE(fetched.data.size(), pending.length)
+      << "Failed postcondition of RangeSource::ReadRange(): "
+         "read more than requested";
+  if (fetched.data.size() < pending.length) {
+    // The source ends. Ranges read ahead are not needed.
+    size_ = pending.pos + fetched.data.size();
+    AbandonReads();
+    request_pos_ = *size_;
+  }
+  read_ahead_ = UnsignedMin(read_ahead_ * 2, parallelism_);
+  if (fetched.data.empty()) return false;
+  block_ = std::move(fetched.data);
+  iter_ = block_.blocks().cbegin();
+  StartReads();
+  return true;
+}
+
+inline bool RangeReaderBase::NextFragment() {
+  while (iter_ != block_.blocks().cend()) {
+    if (!iter_->empty()) {
+      set_buffer(iter_->data(), iter_->size());
+      move_limit_pos(available());
+      return true;
+    }
+    ++iter_;
+  }
+  return false;
+}
+
+bool RangeReaderBase::PullSlow(size_t min_length, size_t recommended_length) {
+  RIEGELI_ASSERT_LT(available(), min_length)
+      << "Failed precondition of Reader::PullSlow(): "
+         "enough data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!PullUsingScratch(min_length, recommended_length))) {
+    return available() >= min_length;
+  }
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (iter_ != block_.blocks().cend()) {
+    ++iter_;
+    if (NextFragment()) return true;
+  }
+  for (;;) {
+    if (!TakeBlock()) return false;
+    if (NextFragment()) return true;
+  }
+}
+
+bool RangeReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!SeekUsingScratch(new_pos))) return true;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (new_pos > limit_pos() && new_pos < request_pos_) {
+    // Seeking forwards into data being read ahead.
+    return PullableReader::SeekSlow(new_pos);
+  }
+  // Seeking elsewhere. Start reading ahead from `new_pos` with one range.
+  set_buffer();
+  block_.Clear();
+  iter_ = block_.blocks().cend();
+  AbandonReads();
+  read_ahead_ = 1;
+  if (size_ == absl::nullopt && new_pos > 0) {
+    if (ABSL_PREDICT_FALSE(Size() == absl::nullopt)) return false;
+  }
+  if (size_ != absl::nullopt && new_pos > *size_) {
+    // Source ends.
+    set_limit_pos(*size_);
+    request_pos_ = *size_;
+    return false;
+  }
+  set_limit_pos(new_pos);
+  request_pos_ = new_pos;
+  return true;
+}
+
+absl::optional<Position> RangeReaderBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  if (size_ == absl::nullopt) {
+    Position size;
+    absl::Status status = src_source()->Size(size);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      Fail(std::move(status));
+      return absl::nullopt;
+    }
+    size_ = size;
+  }
+  return size_;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,435 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_RANGE_READER_H_
+#define RIEGELI_BYTES_RANGE_READER_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <future>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/pullable_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// A source which is read by ranges of bytes, e.g. an object in an object store
+// read with HTTP range requests.
+//
+// Member functions are called concurrently from multiple threads, at most
+// `RangeReaderBase::Options::parallelism()` at a time for one `RangeReader`,
+// so a pool of that many connections can be reused without waiting.
+class RangeSource {
+ public:
+  virtual ~RangeSource() {}
+
+  // Reads up to `length` bytes starting from `pos`, appending them to `dest`,
+  // e.g. with an HTTP GET with `Range: bytes=<pos>-<pos + length - 1>`.
+  //
+  // Reading fewer than `length` bytes means that the source ends there.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - failure
+  virtual absl::Status ReadRange(Position pos, size_t length, Chain& dest) = 0;
+
+  // Sets `size` to the size of the source, e.g. from the `Content-Length` of
+  // an HTTP HEAD.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success (`size` is set)
+  //  * `!status.ok()` - failure
+  virtual absl::Status Size(Position& size) = 0;
+};
+
+// Template parameter independent part of `RangeReader`.
+class RangeReaderBase : public PullableReader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Length of a range read from the source by one `RangeSource::ReadRange()`
+    // call.
+    //
+    // Default: 2M.
+    Options& set_block_size(size_t block_size) & {
+      RIEGELI_ASSERT_GT(block_size, 0u)
+          << "Failed precondition of "
+             "RangeReaderBase::Options::set_block_size(): "
+             "zero block size";
+      block_size_ = block_size;
+      return *this;
+    }
+    Options&& set_block_size(size_t block_size) && {
+      return std::move(set_block_size(block_size));
+    }
+    size_t block_size() const { return block_size_; }
+
+    // Maximum number of ranges being read ahead of the current position
+    // concurrently.
+    //
+    // After a seek, one range is read. While reading continues sequentially,
+    // the number of ranges read ahead doubles with each range until it reaches
+    // `parallelism()`. This avoids reading unneeded ranges when seeking to read
+    // small parts of the source, e.g. chunks of a Riegeli/records file.
+    //
+    // Default: 4.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "RangeReaderBase::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+   private:
+    size_t block_size_ = size_t{2} << 20;
+    int parallelism_ = 4;
+  };
+
+  // Returns the `RangeSource` being read from. Unchanged by `Close()`.
+  virtual RangeSource* src_source() const = 0;
+
+  bool SupportsRandomAccess() override { return true; }
+  bool SupportsSize() override { return true; }
+  absl::optional<Position> Size() override;
+
+ protected:
+  explicit RangeReaderBase(InitiallyClosed) noexcept
+      : PullableReader(kInitiallyClosed) {}
+  explicit RangeReaderBase(size_t block_size, int parallelism) noexcept;
+
+  RangeReaderBase(RangeReaderBase&& that) noexcept;
+  RangeReaderBase& operator=(RangeReaderBase&& that) noexcept;
+
+  void Reset(InitiallyClosed);
+  void Reset(size_t block_size, int parallelism);
+
+  // Waits until reading ranges in the background is finished, so that
+  // `*src_source()` can be moved or destroyed. Ranges read ahead are kept.
+  void WaitForReads();
+
+  void Done() override;
+  bool PullSlow(size_t min_length, size_t recommended_length) override;
+  bool SeekSlow(Position new_pos) override;
+
+ private:
+  struct Fetched {
+    absl::Status status;
+    Chain data;
+  };
+
+  struct Pending {
+    Position pos = 0;
+    size_t length = 0;
+    std::future<Fetched> fetched;
+  };
+
+  // Starts reading ranges following `request_pos_` in the background, until
+  // `read_ahead_` ranges are pending or the source ends.
+  void StartReads();
+
+  // Stops waiting for ranges being read ahead, e.g. after seeking elsewhere.
+  // They are waited for by `WaitForReads()`.
+  void AbandonReads();
+
+  // Waits for the next pending range and makes it the current block.
+  //
+  // Return values:
+  //  * `true`                 - success (`block_` is not empty)
+  //  * `false` (`healthy()`)  - source ends
+  //  * `false` (`!healthy()`) - failure
+  bool TakeBlock();
+
+  // Makes the first non-empty fragment of `block_` following `iter_` the
+  // buffer, or returns `false` if there is none.
+  bool NextFragment();
+
+  size_t block_size_ = 0;
+  size_t parallelism_ = 0;
+  // The number of ranges to keep being read ahead.
+  size_t read_ahead_ = 1;
+  // The size of the source, if known.
+  absl::optional<Position> size_;
+  // Data of the range containing the buffer.
+  Chain block_;
+  // The fragment of `block_` which is the buffer, or `block_.blocks().cend()`.
+  Chain::BlockIterator iter_;
+  // Ranges being read ahead, contiguous from the end of `block_`.
+  std::deque<Pending> pending_;
+  // The position following `block_` and `pending_`.
+  Position request_pos_ = 0;
+  // Ranges being read which are no longer needed.
+  std::vector<std::future<Fetched>> abandoned_;
+
+  // Invariants if `is_open()` and scratch is not used:
+  //   `start() == nullptr` or `start() == iter_->data()`
+  //   `parallelism_ > 0`
+};
+
+// A `Reader` which reads from a `RangeSource`, reading ranges of the source
+// ahead of the current position in the background, in parallel, on threads
+// from `ThreadPool::global()`.
+//
+// This is meant for sources with a high latency and a high bandwidth, e.g.
+// objects in an object store read with HTTP range requests. `RangeSource`
+// abstracts the protocol, which lets `RangeReader` work with any HTTP client
+// or storage API.
+//
+// `RangeReader` supports random access. `Size()` is known after reading to the
+// end of the source, otherwise it is queried with `RangeSource::Size()` once.
+//
+// The `Src` template parameter specifies the type of the object providing and
+// possibly owning the `RangeSource`. `Src` must support
+// `Dependency<RangeSource*, Src>`, e.g. `RangeSource*` (not owned, default),
+// `std::unique_ptr<RangeSource>` (owned), `MyRangeSource` (owned).
+//
+// By relying on CTAD the template argument can be deduced as the value type of
+// the first constructor argument. This requires C++17.
+//
+// The source must not be changed until the `RangeReader` is closed or no
+// longer used.
+template <typename Src = RangeSource*>
+class RangeReader : public RangeReaderBase {
+ public:
+  // Creates a closed `RangeReader`.
+  RangeReader() noexcept : RangeReaderBase(kInitiallyClosed) {}
+
+  // Will read from the `RangeSource` provided by `src`.
+  explicit RangeReader(const Src& src, Options options = Options());
+  explicit RangeReader(Src&& src, Options options = Options());
+
+  // Will read from the `RangeSource` provided by a `Src` constructed from
+  // elements of `src_args`. This avoids constructing a temporary `Src` and
+  // moving from it.
+  template <typename... SrcArgs>
+  explicit RangeReader(std::tuple<SrcArgs...> src_args,
+                       Options options = Options());
+
+  RangeReader(RangeReader&& that) noexcept;
+  RangeReader& operator=(RangeReader&& that) noexcept;
+
+  // Waits until reading ranges in the background is finished.
+  ~RangeReader();
+
+  // Makes `*this` equivalent to a newly constructed `RangeReader`. This avoids
+  // constructing a temporary `RangeReader` and moving from it.
+  void Reset();
+  void Reset(const Src& src, Options options = Options());
+  void Reset(Src&& src, Options options = Options());
+  template <typename... SrcArgs>
+  void Reset(std::tuple<SrcArgs...> src_args, Options options = Options());
+
+  // Returns the object providing and possibly owning the `RangeSource`.
+  // Unchanged by `Close()`.
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  RangeSource* src_source() const override { return src_.get(); }
+
+ private:
+  // The object providing and possibly owning the `RangeSource`.
+  Dependency<RangeSource*, Src> src_;
+};
+
+// Support CTAD.
+#if __cpp_deduction_guides
+RangeReader()->RangeReader<DeleteCtad<>>;
+template <typename Src>
+explicit RangeReader(const Src& src, RangeReaderBase::Options options =
+                                         RangeReaderBase::Options())
+    -> RangeReader<std::decay_t<Src>>;
+template <typename Src>
+explicit RangeReader(Src&& src, RangeReaderBase::Options options =
+                                    RangeReaderBase::Options())
+    -> RangeReader<std::decay_t<Src>>;
+template <typename... SrcArgs>
+explicit RangeReader(
+    std::tuple<SrcArgs...> src_args,
+    RangeReaderBase::Options options = RangeReaderBase::Options())
+    -> RangeReader<DeleteCtad<std::tuple<SrcArgs...>>>;
+#endif
+
+// Implementation details follow.
+
+inline RangeReaderBase::RangeReaderBase(size_t block_size,
+                                        int parallelism) noexcept
+    : PullableReader(kInitiallyOpen),
+      block_size_(block_size),
+      parallelism_(IntCast<size_t>(parallelism)),
+      iter_(block_.blocks().cend()) {}
+
+inline RangeReaderBase::RangeReaderBase(RangeReaderBase&& that) noexcept
+    : PullableReader(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      block_size_(that.block_size_),
+      parallelism_(that.parallelism_),
+      read_ahead_(that.read_ahead_),
+      size_(that.size_) {
+  BehindScratch behind_scratch(this);
+  const size_t block_index = that.iter_.block_index();
+  const size_t cursor_index = read_from_buffer();
+  block_ = std::move(that.block_);
+  iter_ = Chain::BlockIterator(&block_, block_index);
+  if (start() != nullptr) {
+    set_buffer(iter_->data(), iter_->size(), cursor_index);
+  }
+  pending_ = std::move(that.pending_);
+  request_pos_ = that.request_pos_;
+  abandoned_ = std::move(that.abandoned_);
+}
+
+inline RangeReaderBase& RangeReaderBase::operator=(
+    RangeReaderBase&& that) noexcept {
+  // The `RangeSource` of `*this` is about to be replaced.
+  WaitForReads();
+  PullableReader::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  block_size_ = that.block_size_;
+  parallelism_ = that.parallelism_;
+  read_ahead_ = that.read_ahead_;
+  size_ = that.size_;
+  BehindScratch behind_scratch(this);
+  const size_t block_index = that.iter_.block_index();
+  const size_t cursor_index = read_from_buffer();
+  block_ = std::move(that.block_);
+  iter_ = Chain::BlockIterator(&block_, block_index);
+  if (start() != nullptr) {
+    set_buffer(iter_->data(), iter_->size(), cursor_index);
+  }
+  pending_ = std::move(that.pending_);
+  request_pos_ = that.request_pos_;
+  abandoned_ = std::move(that.abandoned_);
+  return *this;
+}
+
+inline void RangeReaderBase::Reset(InitiallyClosed) {
+  WaitForReads();
+  PullableReader::Reset(kInitiallyClosed);
+  block_size_ = 0;
+  parallelism_ = 0;
+  read_ahead_ = 1;
+  size_ = absl::nullopt;
+  block_.Clear();
+  iter_ = block_.blocks().cend();
+  pending_.clear();
+  request_pos_ = 0;
+  abandoned_.clear();
+}
+
+inline void RangeReaderBase::Reset(size_t block_size, int parallelism) {
+  WaitForReads();
+  PullableReader::Reset(kInitiallyOpen);
+  block_size_ = block_size;
+  parallelism_ = IntCast<size_t>(parallelism);
+  read_ahead_ = 1;
+  size_ = absl::nullopt;
+  block_.Clear();
+  iter_ = block_.blocks().cend();
+  pending_.clear();
+  request_pos_ = 0;
+  abandoned_.clear();
+}
+
+template <typename Src>
+inline RangeReader<Src>::RangeReader(const Src& src, Options options)
+    : RangeReaderBase(options.block_size(), options.parallelism()),
+      src_(src) {}
+
+template <typename Src>
+inline RangeReader<Src>::RangeReader(Src&& src, Options options)
+    : RangeReaderBase(options.block_size(), options.parallelism()),
+      src_(std::move(src)) {}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline RangeReader<Src>::RangeReader(std::tuple<SrcArgs...> src_args,
+                                     Options options)
+    : RangeReaderBase(options.block_size(), options.parallelism()),
+      src_(std::move(src_args)) {}
+
+template <typename Src>
+inline RangeReader<Src>::RangeReader(RangeReader&& that) noexcept
+    : RangeReaderBase(std::move(that)) {
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved. Reading which was pending in `that` must finish before its
+  // `RangeSource` is moved.
+  WaitForReads();
+  src_ = std::move(that.src_);
+}
+
+template <typename Src>
+inline RangeReader<Src>& RangeReader<Src>::operator=(
+    RangeReader&& that) noexcept {
+  RangeReaderBase::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved. Reading which was pending in `that` must finish before its
+  // `RangeSource` is moved.
+  WaitForReads();
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+inline RangeReader<Src>::~RangeReader() {
+  WaitForReads();
+}
+
+template <typename Src>
+inline void RangeReader<Src>::Reset() {
+  RangeReaderBase::Reset(kInitiallyClosed);
+  src_.Reset();
+}
+
+template <typename Src>
+inline void RangeReader<Src>::Reset(const Src& src, Options options) {
+  RangeReaderBase::Reset(options.block_size(), options.parallelism());
+  src_.Reset(src);
+}
+
+template <typename Src>
+inline void RangeReader<Src>::Reset(Src&& src, Options options) {
+  RangeReaderBase::Reset(options.block_size(), options.parallelism());
+  src_.Reset(std::move(src));
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline void RangeReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
+                                    Options options) {
+  RangeReaderBase::Reset(options.block_size(), options.parallelism());
+  src_.Reset(std::move(src_args));
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_RANGE_READER_H_
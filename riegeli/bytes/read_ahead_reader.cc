@@ -0,0 +1,193 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/bytes/read_ahead_reader.h"
+
+#include <stddef.h>
+
+#include <future>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/pullable_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+void ReadAheadReaderBase::WaitForReadAhead() {
+  if (pending_.valid()) {
+    Filled filled = pending_.get();
+    ahead_ = std::move(filled.buffer);
+    ahead_length_ = filled.length;
+    ahead_ready_ = true;
+  }
+}
+
+inline void ReadAheadReaderBase::StartReadAhead() {
+  RIEGELI_ASSERT(!ahead_ready_)
+      << "Failed precondition of ReadAheadReaderBase::StartReadAhead(): "
+         "data read ahead not taken";
+  RIEGELI_ASSERT(!pending_.valid())
+      << "Failed precondition of ReadAheadReaderBase::StartReadAhead(): "
+         "reading ahead already pending";
+  struct ReadAheadRequest {
+    Buffer buffer;
+    std::promise<Filled> filled;
+  };
+  ReadAheadRequest* const request = new ReadAheadRequest();
+  request->buffer = std::move(ahead_);
+  request->buffer.Reset(buffer_size_);
+  pending_ = request->filled.get_future();
+  ThreadPool::global().Schedule(
+      [request, src = src_reader(), length = buffer_size_] {
+        const Position pos_before = src->pos();
+        src->Read(length, request->buffer.data());
+        const size_t length_read = IntCast<size_t>(src->pos() - pos_before);
+        request->filled.set_value(
+            Filled{std::move(request->buffer), length_read});
+        delete request;
+      });
+}
+
+inline void ReadAheadReaderBase::TakeReadAhead() {
+  RIEGELI_ASSERT(ahead_ready_)
+      << "Failed precondition of ReadAheadReaderBase::TakeReadAhead(): "
+         "no data read ahead";
+  RIEGELI_ASSERT_GT(ahead_length_, 0u)
+      << "Failed precondition of ReadAheadReaderBase::TakeReadAhead(): "
+         "no data read ahead";
+  std::swap(buffer_, ahead_);
+  set_buffer(buffer_.data(), ahead_length_);
+  move_limit_pos(ahead_length_);
+  ahead_ready_ = false;
+}
+
+inline bool ReadAheadReaderBase::SyncSrc(Reader& src) {
+  RIEGELI_ASSERT(!pending_.valid())
+      << "Failed precondition of ReadAheadReaderBase::SyncSrc(): "
+         "reading ahead pending";
+  if (!supports_random_access_) return true;
+  const Position new_pos = pos();
+  if (src.pos() == new_pos) return true;
+  // Stop using scratch if it is used, then discard buffered data.
+  SeekUsingScratch(new_pos);
+  set_buffer();
+  set_limit_pos(new_pos);
+  ahead_ready_ = false;
+  if (ABSL_PREDICT_FALSE(!src.Seek(new_pos))) {
+    return FailWithoutAnnotation(src);
+  }
+  return true;
+}
+
+void ReadAheadReaderBase::Done() {
+  WaitForReadAhead();
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    Reader& src = *src_reader();
+    SyncSrc(src);
+  }
+  PullableReader::Done();
+  buffer_ = Buffer();
+  ahead_ = Buffer();
+  ahead_ready_ = false;
+}
+
+bool ReadAheadReaderBase::PullSlow(size_t min_length,
+                                   size_t recommended_length) {
+  RIEGELI_ASSERT_LT(available(), min_length)
+      << "Failed precondition of Reader::PullSlow(): "
+         "enough data available, use Pull() instead";
+  if (ABSL_PREDICT_FALSE(!PullUsingScratch(min_length, recommended_length))) {
+    return available() >= min_length;
+  }
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  WaitForReadAhead();
+  if (!ahead_ready_) {
+    // Reading ahead was not started, e.g. because this is the first read, or
+    // the previous read reached the end of the source. Read synchronously.
+    StartReadAhead();
+    WaitForReadAhead();
+  }
+  if (ABSL_PREDICT_FALSE(ahead_length_ == 0)) {
+    ahead_ready_ = false;
+    set_buffer();
+    Reader& src = *src_reader();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return FailWithoutAnnotation(src);
+    return false;
+  }
+  // A short read suggests that the source ended. Do not read further ahead,
+  // so that a source which grows later is read again on demand.
+  const bool src_ended = ahead_length_ < buffer_size_;
+  TakeReadAhead();
+  if (!src_ended) StartReadAhead();
+  return true;
+}
+
+bool ReadAheadReaderBase::Sync() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  WaitForReadAhead();
+  Reader& src = *src_reader();
+  if (ABSL_PREDICT_FALSE(!SyncSrc(src))) return false;
+  if (ABSL_PREDICT_FALSE(!src.Sync())) return FailWithoutAnnotation(src);
+  return true;
+}
+
+bool ReadAheadReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!SeekUsingScratch(new_pos))) return true;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  WaitForReadAhead();
+  if (ahead_ready_ && ahead_length_ > 0 && new_pos > limit_pos() &&
+      new_pos - limit_pos() <= ahead_length_) {
+    // Seeking forwards into data read ahead.
+    const size_t offset = IntCast<size_t>(new_pos - limit_pos());
+    const bool src_ended = ahead_length_ < buffer_size_;
+    TakeReadAhead();
+    set_cursor(start() + offset);
+    if (!src_ended) StartReadAhead();
+    return true;
+  }
+  Reader& src = *src_reader();
+  // Discard buffered data. `src.Seek()` takes an absolute position, so it
+  // does not matter that `src` is ahead of `limit_pos()`.
+  set_buffer();
+  ahead_ready_ = false;
+  const bool ok = src.Seek(new_pos);
+  set_limit_pos(src.pos());
+  if (ABSL_PREDICT_FALSE(!ok)) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return FailWithoutAnnotation(src);
+    return false;
+  }
+  return true;
+}
+
+absl::optional<Position> ReadAheadReaderBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  WaitForReadAhead();
+  Reader& src = *src_reader();
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) {
+    FailWithoutAnnotation(src);
+    return absl::nullopt;
+  }
+  return size;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,392 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_BYTES_READ_AHEAD_READER_H_
+#define RIEGELI_BYTES_READ_AHEAD_READER_H_
+
+#include <stddef.h>
+
+#include <future>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/buffer.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/pullable_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+// Template parameter independent part of `ReadAheadReader`.
+class ReadAheadReaderBase : public PullableReader {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Tunes how much data is read ahead at a time. Two buffers of this size are
+    // used: one being read by the caller, and one being filled in the
+    // background.
+    //
+    // Default: `kDefaultBufferSize` (64K).
+    Options& set_buffer_size(size_t buffer_size) & {
+      RIEGELI_ASSERT_GT(buffer_size, 0u)
+          << "Failed precondition of "
+             "ReadAheadReaderBase::Options::set_buffer_size(): "
+             "zero buffer size";
+      buffer_size_ = buffer_size;
+      return *this;
+    }
+    Options&& set_buffer_size(size_t buffer_size) && {
+      return std::move(set_buffer_size(buffer_size));
+    }
+    size_t buffer_size() const { return buffer_size_; }
+
+   private:
+    size_t buffer_size_ = kDefaultBufferSize;
+  };
+
+  // Returns the original `Reader`. Unchanged by `Close()`.
+  virtual Reader* src_reader() = 0;
+  virtual const Reader* src_reader() const = 0;
+
+  bool Sync() override;
+  bool SupportsRandomAccess() override { return supports_random_access_; }
+  bool SupportsSize() override { return supports_size_; }
+  absl::optional<Position> Size() override;
+
+ protected:
+  explicit ReadAheadReaderBase(InitiallyClosed) noexcept
+      : PullableReader(kInitiallyClosed) {}
+  explicit ReadAheadReaderBase(size_t buffer_size) noexcept;
+
+  ReadAheadReaderBase(ReadAheadReaderBase&& that) noexcept;
+  ReadAheadReaderBase& operator=(ReadAheadReaderBase&& that) noexcept;
+
+  void Reset(InitiallyClosed);
+  void Reset(size_t buffer_size);
+  void Initialize(Reader* src);
+
+  // Waits until reading ahead in the background is finished, so that
+  // `*src_reader()` can be used or moved. Data read ahead are kept.
+  void WaitForReadAhead();
+
+  void Done() override;
+  bool PullSlow(size_t min_length, size_t recommended_length) override;
+  bool SeekSlow(Position new_pos) override;
+
+ private:
+  struct Filled {
+    Buffer buffer;
+    size_t length = 0;
+  };
+
+  // Starts filling `ahead_` in the background.
+  //
+  // Precondition: `!ahead_ready_ && !pending_.valid()`
+  void StartReadAhead();
+
+  // Makes `ahead_` the current buffer.
+  //
+  // Precondition: `ahead_ready_ && ahead_length_ > 0`
+  void TakeReadAhead();
+
+  // Discards data read ahead and moves the source back to `pos()` if
+  // possible.
+  bool SyncSrc(Reader& src);
+
+  size_t buffer_size_ = 0;
+  bool supports_random_access_ = false;
+  bool supports_size_ = false;
+  // The buffer being read by the caller.
+  Buffer buffer_;
+  // The buffer being filled in the background if `pending_.valid()`, or
+  // filled with `ahead_length_` bytes following `limit_pos()` if
+  // `ahead_ready_`.
+  Buffer ahead_;
+  size_t ahead_length_ = 0;
+  bool ahead_ready_ = false;
+  std::future<Filled> pending_;
+
+  // Invariants if `is_open()` and scratch is not used:
+  //   `start() == nullptr` or `start() == buffer_.data()`
+  //   if `!pending_.valid() && !ahead_ready_` then
+  //       `limit_pos() == src_reader()->pos()`
+  //   if `ahead_ready_` then
+  //       `limit_pos() + ahead_length_ == src_reader()->pos()`
+};
+
+// A `Reader` which reads from another `Reader`, filling the next buffer in the
+// background while the current one is being read.
+//
+// This overlaps the latency of the original `Reader` with processing of data
+// already read, which helps when reading sequentially from a source which
+// stalls on every refill, e.g. a file on a network filesystem. It works with
+// any original `Reader`, e.g. `FdReader`, `IstreamReader`, or
+// `tensorflow::FileReader`.
+//
+// The original `Reader` is read on a thread from `ThreadPool::global()`, so it
+// must allow being used from another thread than the one which created it.
+//
+// `ReadAheadReader` supports random access if the original `Reader` supports
+// it. If the original `Reader` does not support random access, it will have an
+// unpredictable amount of extra data consumed because of reading ahead.
+//
+// The `Src` template parameter specifies the type of the object providing and
+// possibly owning the original `Reader`. `Src` must support
+// `Dependency<Reader*, Src>`, e.g. `Reader*` (not owned, default),
+// `std::unique_ptr<Reader>` (owned), `FdReader<>` (owned).
+//
+// By relying on CTAD the template argument can be deduced as the value type of
+// the first constructor argument. This requires C++17.
+//
+// The original `Reader` must not be accessed until the `ReadAheadReader` is
+// closed or no longer used.
+template <typename Src = Reader*>
+class ReadAheadReader : public ReadAheadReaderBase {
+ public:
+  // Creates a closed `ReadAheadReader`.
+  ReadAheadReader() noexcept : ReadAheadReaderBase(kInitiallyClosed) {}
+
+  // Will read from the original `Reader` provided by `src`.
+  explicit ReadAheadReader(const Src& src, Options options = Options());
+  explicit ReadAheadReader(Src&& src, Options options = Options());
+
+  // Will read from the original `Reader` provided by a `Src` constructed from
+  // elements of `src_args`. This avoids constructing a temporary `Src` and
+  // moving from it.
+  template <typename... SrcArgs>
+  explicit ReadAheadReader(std::tuple<SrcArgs...> src_args,
+                           Options options = Options());
+
+  ReadAheadReader(ReadAheadReader&& that) noexcept;
+  ReadAheadReader& operator=(ReadAheadReader&& that) noexcept;
+
+  // Waits until reading ahead in the background is finished.
+  ~ReadAheadReader();
+
+  // Makes `*this` equivalent to a newly constructed `ReadAheadReader`. This
+  // avoids constructing a temporary `ReadAheadReader` and moving from it.
+  void Reset();
+  void Reset(const Src& src, Options options = Options());
+  void Reset(Src&& src, Options options = Options());
+  template <typename... SrcArgs>
+  void Reset(std::tuple<SrcArgs...> src_args, Options options = Options());
+
+  // Returns the object providing and possibly owning the original `Reader`.
+  // Unchanged by `Close()`.
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  Reader* src_reader() override { return src_.get(); }
+  const Reader* src_reader() const override { return src_.get(); }
+
+  void VerifyEnd() override;
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the original `Reader`.
+  Dependency<Reader*, Src> src_;
+};
+
+// Support CTAD.
+#if __cpp_deduction_guides
+ReadAheadReader()->ReadAheadReader<DeleteCtad<>>;
+template <typename Src>
+explicit ReadAheadReader(
+    const Src& src,
+    ReadAheadReaderBase::Options options = ReadAheadReaderBase::Options())
+    -> ReadAheadReader<std::decay_t<Src>>;
+template <typename Src>
+explicit ReadAheadReader(Src&& src, ReadAheadReaderBase::Options options =
+                                        ReadAheadReaderBase::Options())
+    -> ReadAheadReader<std::decay_t<Src>>;
+template <typename... SrcArgs>
+explicit ReadAheadReader(
+    std::tuple<SrcArgs...> src_args,
+    ReadAheadReaderBase::Options options = ReadAheadReaderBase::Options())
+    -> ReadAheadReader<DeleteCtad<std::tuple<SrcArgs...>>>;
+#endif
+
+// Implementation details follow.
+
+inline ReadAheadReaderBase::ReadAheadReaderBase(size_t buffer_size) noexcept
+    : PullableReader(kInitiallyOpen), buffer_size_(buffer_size) {}
+
+inline ReadAheadReaderBase::ReadAheadReaderBase(
+    ReadAheadReaderBase&& that) noexcept
+    : PullableReader(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      buffer_size_(that.buffer_size_),
+      supports_random_access_(that.supports_random_access_),
+      supports_size_(that.supports_size_),
+      buffer_(std::move(that.buffer_)),
+      ahead_(std::move(that.ahead_)),
+      ahead_length_(that.ahead_length_),
+      ahead_ready_(std::exchange(that.ahead_ready_, false)),
+      pending_(std::move(that.pending_)) {}
+
+inline ReadAheadReaderBase& ReadAheadReaderBase::operator=(
+    ReadAheadReaderBase&& that) noexcept {
+  // The original `Reader` of `*this` is about to be replaced.
+  WaitForReadAhead();
+  PullableReader::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  buffer_size_ = that.buffer_size_;
+  supports_random_access_ = that.supports_random_access_;
+  supports_size_ = that.supports_size_;
+  buffer_ = std::move(that.buffer_);
+  ahead_ = std::move(that.ahead_);
+  ahead_length_ = that.ahead_length_;
+  ahead_ready_ = std::exchange(that.ahead_ready_, false);
+  pending_ = std::move(that.pending_);
+  return *this;
+}
+
+inline void ReadAheadReaderBase::Reset(InitiallyClosed) {
+  WaitForReadAhead();
+  PullableReader::Reset(kInitiallyClosed);
+  buffer_size_ = 0;
+  supports_random_access_ = false;
+  supports_size_ = false;
+  ahead_length_ = 0;
+  ahead_ready_ = false;
+}
+
+inline void ReadAheadReaderBase::Reset(size_t buffer_size) {
+  WaitForReadAhead();
+  PullableReader::Reset(kInitiallyOpen);
+  buffer_size_ = buffer_size;
+  supports_random_access_ = false;
+  supports_size_ = false;
+  ahead_length_ = 0;
+  ahead_ready_ = false;
+}
+
+inline void ReadAheadReaderBase::Initialize(Reader* src) {
+  RIEGELI_ASSERT(src != nullptr)
+      << "Failed precondition of ReadAheadReader: null Reader pointer";
+  supports_random_access_ = src->SupportsRandomAccess();
+  supports_size_ = src->SupportsSize();
+  // Data already buffered in `*src` are read ahead by the first
+  // `PullSlow()`.
+  set_limit_pos(src->pos());
+  if (ABSL_PREDICT_FALSE(!src->healthy())) FailWithoutAnnotation(*src);
+}
+
+template <typename Src>
+inline ReadAheadReader<Src>::ReadAheadReader(const Src& src, Options options)
+    : ReadAheadReaderBase(options.buffer_size()), src_(src) {
+  Initialize(src_.get());
+}
+
+template <typename Src>
+inline ReadAheadReader<Src>::ReadAheadReader(Src&& src, Options options)
+    : ReadAheadReaderBase(options.buffer_size()), src_(std::move(src)) {
+  Initialize(src_.get());
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline ReadAheadReader<Src>::ReadAheadReader(std::tuple<SrcArgs...> src_args,
+                                             Options options)
+    : ReadAheadReaderBase(options.buffer_size()), src_(std::move(src_args)) {
+  Initialize(src_.get());
+}
+
+template <typename Src>
+inline ReadAheadReader<Src>::ReadAheadReader(ReadAheadReader&& that) noexcept
+    : ReadAheadReaderBase(std::move(that)) {
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved. Reading ahead which was pending in `that` must finish before
+  // its original `Reader` is moved.
+  WaitForReadAhead();
+  src_ = std::move(that.src_);
+}
+
+template <typename Src>
+inline ReadAheadReader<Src>& ReadAheadReader<Src>::operator=(
+    ReadAheadReader&& that) noexcept {
+  ReadAheadReaderBase::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved. Reading ahead which was pending in `that` must finish before
+  // its original `Reader` is moved.
+  WaitForReadAhead();
+  src_ = std::move(that.src_);
+  return *this;
+}
+
+template <typename Src>
+inline ReadAheadReader<Src>::~ReadAheadReader() {
+  WaitForReadAhead();
+}
+
+template <typename Src>
+inline void ReadAheadReader<Src>::Reset() {
+  ReadAheadReaderBase::Reset(kInitiallyClosed);
+  src_.Reset();
+}
+
+template <typename Src>
+inline void ReadAheadReader<Src>::Reset(const Src& src, Options options) {
+  ReadAheadReaderBase::Reset(options.buffer_size());
+  src_.Reset(src);
+  Initialize(src_.get());
+}
+
+template <typename Src>
+inline void ReadAheadReader<Src>::Reset(Src&& src, Options options) {
+  ReadAheadReaderBase::Reset(options.buffer_size());
+  src_.Reset(std::move(src));
+  Initialize(src_.get());
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline void ReadAheadReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
+                                        Options options) {
+  ReadAheadReaderBase::Reset(options.buffer_size());
+  src_.Reset(std::move(src_args));
+  Initialize(src_.get());
+}
+
+template <typename Src>
+void ReadAheadReader<Src>::Done() {
+  ReadAheadReaderBase::Done();
+  if (src_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!src_->Close())) FailWithoutAnnotation(*src_);
+  }
+}
+
+template <typename Src>
+void ReadAheadReader<Src>::VerifyEnd() {
+  ReadAheadReaderBase::VerifyEnd();
+  if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) {
+    WaitForReadAhead();
+    src_->VerifyEnd();
+    if (ABSL_PREDICT_FALSE(!src_->healthy())) FailWithoutAnnotation(*src_);
+  }
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_BYTES_READ_AHEAD_READER_H_
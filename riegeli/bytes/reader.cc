@@ -16,10 +16,13 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <cstring>
 #include <limits>
+#include <numeric>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
@@ -204,6 +207,8 @@ void Reader::ReadHintSlow(size_t length) {
          "enough data available, use ReadHint() instead";
 }
 
+void Reader::PrefetchHint(Position length) {}
+
 bool Reader::ReadAll(absl::string_view& dest, size_t max_length) {
   max_length = UnsignedMin(max_length, dest.max_size());
   if (SupportsSize()) {
@@ -431,6 +436,30 @@ bool Reader::CopyAll(BackwardWriter& dest, size_t max_length) {
   }
 }
 
+bool Reader::ReadRanges(absl::Span<const ReadRange> ranges,
+                        absl::Span<Chain> dest) {
+  RIEGELI_ASSERT_EQ(ranges.size(), dest.size())
+      << "Failed precondition of Reader::ReadRanges(): "
+         "ranges and dest have different sizes";
+  for (Chain& chain : dest) chain.Clear();
+  // Read the ranges in the order of positions, so that reading proceeds
+  // forwards.
+  std::vector<size_t> order(ranges.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return ranges[a].pos < ranges[b].pos;
+  });
+  bool all_read = true;
+  for (const size_t index : order) {
+    if (ABSL_PREDICT_FALSE(!Seek(ranges[index].pos) ||
+                           !Read(ranges[index].length, dest[index]))) {
+      if (ABSL_PREDICT_FALSE(!healthy())) return false;
+      all_read = false;
+    }
+  }
+  return all_read;
+}
+
 bool Reader::SeekSlow(Position new_pos) {
   RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
       << "Failed precondition of Reader::SeekSlow(): "
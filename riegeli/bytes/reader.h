@@ -29,14 +29,22 @@
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/writer.h"
 
 namespace riegeli {
 
+// A range of bytes of a source, for `Reader::ReadRanges()`.
+struct ReadRange {
+  Position pos = 0;
+  size_t length = 0;
+};
+
 // Abstract class `Reader` reads sequences of bytes from a source. The nature of
 // the source depends on the particular class derived from `Reader`.
 //
@@ -201,6 +209,17 @@ class Reader : public Object {
   // into an internal buffer.
   void ReadHint(size_t length);
 
+  // Hints that `length` bytes starting from `pos()` will be read soon, even if
+  // they are already available in the buffer.
+  //
+  // Unlike `ReadHint()`, this does not read the data, but lets the source
+  // start loading them in the background, e.g. with `posix_fadvise()` for a
+  // file, or with `madvise()` for a memory-mapped file whose buffer is not
+  // necessarily resident in memory.
+  //
+  // By default does nothing.
+  virtual void PrefetchHint(Position length);
+
   // Reads all remaining bytes from the buffer and/or the source to `dest`,
   // clearing any existing data in `dest`.
   //
@@ -307,6 +326,26 @@ class Reader : public Object {
   //  * `false` (when `!healthy()`) - failure
   bool Skip(Position length);
 
+  // Reads several ranges of the source, e.g. scattered records found by an
+  // index, setting `dest[i]` to data of `ranges[i]`. Ranges can be given in any
+  // order and can overlap.
+  //
+  // By default this seeks to each range and reads it, in the order of
+  // positions. `FdReader`, `FdMMapReader`, and `tensorflow::FileReader` fetch
+  // the ranges concurrently, which is faster if the source has a high latency.
+  //
+  // If the source ends within a range, the corresponding element of `dest` is
+  // shortened. The current position is unspecified afterwards.
+  //
+  // Precondition: `ranges.size() == dest.size()`
+  //
+  // Return values:
+  //  * `true`                      - success (all ranges read fully)
+  //  * `false` (when `healthy()`)  - source ends within some range
+  //  * `false` (when `!healthy()`) - failure
+  virtual bool ReadRanges(absl::Span<const ReadRange> ranges,
+                          absl::Span<Chain> dest);
+
   // Returns `true` if this `Reader` supports `Size()`.
   virtual bool SupportsSize() { return false; }
 
@@ -315,6 +354,14 @@ class Reader : public Object {
   // Returns `absl::nullopt` on failure (`!healthy()`).
   virtual absl::optional<Position> Size();
 
+  // Registers memory owned by this `Reader` with `MemoryEstimator`, but does
+  // not include `sizeof(*this)`: buffers, (de)compression contexts, and the
+  // source if it is owned.
+  //
+  // By default registers nothing. Derived classes which override it should
+  // include a call to the base class version.
+  virtual void RegisterSubobjects(MemoryEstimator& memory_estimator) const {}
+
  protected:
   // Creates a `Reader` with the given initial state.
   explicit Reader(InitiallyClosed) noexcept : Object(kInitiallyClosed) {}
@@ -388,6 +435,9 @@ class Reader : public Object {
   //
   // Precondition for `ReadSlow(Chain&)` and `ReadSlow(absl::Cord&)`:
   //   `length <= std::numeric_limits<size_t>::max() - dest->size()`
+  //
+  // Overrides not meant to be overridden further are declared `final`, so that
+  // calls through the concrete reader type dispatch statically.
   virtual bool ReadSlow(size_t length, char* dest);
   bool ReadSlow(size_t length, std::string& dest);
   virtual bool ReadSlow(size_t length, Chain& dest);
@@ -51,8 +51,8 @@ class StringReaderBase : public Reader {
 
   void Initialize(absl::string_view src);
 
-  bool PullSlow(size_t min_length, size_t recommended_length) override;
-  bool SeekSlow(Position new_pos) override;
+  bool PullSlow(size_t min_length, size_t recommended_length) final;
+  bool SeekSlow(Position new_pos) final;
 };
 
 // A `Reader` which reads from a `std::string` or array. It supports random
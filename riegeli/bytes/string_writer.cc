@@ -38,6 +38,14 @@ void StringWriterBase::Done() {
   Writer::Done();
 }
 
+void StringWriterBase::Reserve(std::string& dest, size_t length) {
+  dest.reserve(UnsignedMin(
+      UnsignedMax(SaturatingAdd(dest.size(), length),
+                  // Ensure amortized constant time of a reallocation.
+                  SaturatingAdd(dest.capacity(), dest.capacity() / 2)),
+      dest.max_size()));
+}
+
 bool StringWriterBase::PushSlow(size_t min_length, size_t recommended_length) {
   RIEGELI_ASSERT_LT(available(), min_length)
       << "Failed precondition of Writer::PushSlow(): "
@@ -51,12 +59,7 @@ bool StringWriterBase::PushSlow(size_t min_length, size_t recommended_length) {
     if (ABSL_PREDICT_FALSE(min_length > dest.max_size() - dest.size())) {
       return FailOverflow();
     }
-    dest.reserve(UnsignedMin(
-        UnsignedMax(SaturatingAdd(dest.size(),
-                                  UnsignedMax(min_length, recommended_length)),
-                    // Ensure amortized constant time of a reallocation.
-                    SaturatingAdd(dest.capacity(), dest.capacity() / 2)),
-        dest.max_size()));
+    Reserve(dest, UnsignedMax(min_length, recommended_length));
   }
   MakeBuffer(dest);
   return true;
@@ -127,6 +130,8 @@ bool StringWriterBase::WriteSlow(const absl::Cord& src) {
     return FailOverflow();
   }
   SyncBuffer(dest);
+  // Reallocate at most once, instead of possibly once per fragment.
+  if (src.size() > dest.capacity() - dest.size()) Reserve(dest, src.size());
   for (absl::string_view fragment : src.Chunks()) {
     // TODO: When `absl::string_view` becomes C++17 `std::string_view`:
     // `dest.append(fragment)`
@@ -143,13 +148,7 @@ void StringWriterBase::WriteHintSlow(size_t length) {
   if (ABSL_PREDICT_FALSE(!healthy())) return;
   std::string& dest = *dest_string();
   SyncBuffer(dest);
-  if (length > dest.capacity() - dest.size()) {
-    dest.reserve(UnsignedMin(
-        UnsignedMax(SaturatingAdd(dest.size(), length),
-                    // Ensure amortized constant time of a reallocation.
-                    SaturatingAdd(dest.capacity(), dest.capacity() / 2)),
-        dest.max_size()));
-  }
+  if (length > dest.capacity() - dest.size()) Reserve(dest, length);
   MakeBuffer(dest);
 }
 
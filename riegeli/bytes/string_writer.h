@@ -95,13 +95,13 @@ class StringWriterBase : public Writer {
                   absl::optional<Position> size_hint);
 
   void Done() override;
-  bool PushSlow(size_t min_length, size_t recommended_length) override;
+  bool PushSlow(size_t min_length, size_t recommended_length) final;
   using Writer::WriteSlow;
-  bool WriteSlow(absl::string_view src) override;
-  bool WriteSlow(const Chain& src) override;
-  bool WriteSlow(Chain&& src) override;
-  bool WriteSlow(const absl::Cord& src) override;
-  void WriteHintSlow(size_t length) override;
+  bool WriteSlow(absl::string_view src) final;
+  bool WriteSlow(const Chain& src) final;
+  bool WriteSlow(Chain&& src) final;
+  bool WriteSlow(const absl::Cord& src) final;
+  void WriteHintSlow(size_t length) final;
   bool FlushImpl(FlushType flush_type) override;
 
  private:
@@ -113,6 +113,10 @@ class StringWriterBase : public Writer {
   // reallocation.
   void MakeBuffer(std::string& dest);
 
+  // Increases the capacity of `dest` to hold at least `length` more bytes,
+  // growing it by at least a constant factor to amortize reallocations.
+  static void Reserve(std::string& dest, size_t length);
+
   // Invariants if `healthy()`:
   //   `start() == &(*dest_string())[0]`
   //   `buffer_size() == dest_string()->size()`
@@ -126,6 +126,14 @@ void WrappedReaderBase::ReadHintSlow(size_t length) {
   MakeBuffer(src);
 }
 
+void WrappedReaderBase::PrefetchHint(Position length) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return;
+  Reader& src = *src_reader();
+  SyncBuffer(src);
+  src.PrefetchHint(length);
+  MakeBuffer(src);
+}
+
 bool WrappedReaderBase::Sync() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   Reader& src = *src_reader();
@@ -45,6 +45,7 @@ class WrappedReaderBase : public Reader {
   bool SupportsRandomAccess() override;
   bool SupportsSize() override;
   absl::optional<Position> Size() override;
+  void PrefetchHint(Position length) override;
 
  protected:
   explicit WrappedReaderBase(InitiallyClosed) noexcept
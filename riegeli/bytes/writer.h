@@ -32,6 +32,7 @@
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 
 namespace riegeli {
@@ -244,6 +245,14 @@ class Writer : public Object {
   //  * `false` (when `!healthy()`) - failure
   virtual bool Truncate(Position new_size);
 
+  // Registers memory owned by this `Writer` with `MemoryEstimator`, but does
+  // not include `sizeof(*this)`: buffers, compression contexts, and the
+  // destination if it is owned.
+  //
+  // By default registers nothing. Derived classes which override it should
+  // include a call to the base class version.
+  virtual void RegisterSubobjects(MemoryEstimator& memory_estimator) const {}
+
  protected:
   // Creates a `Writer` with the given initial state.
   explicit Writer(InitiallyClosed) noexcept : Object(kInitiallyClosed) {}
@@ -281,6 +290,10 @@ class Writer : public Object {
 
   // Implementation of the slow part of `Push()`.
   //
+  // Overrides of this and other slow paths not meant to be overridden further
+  // are declared `final`, so that calls through the concrete writer type
+  // dispatch statically.
+  //
   // Precondition: `available() < min_length`
   virtual bool PushSlow(size_t min_length, size_t recommended_length) = 0;
 
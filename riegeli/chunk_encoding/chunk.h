@@ -32,8 +32,10 @@ class ChunkHeader {
  public:
   ChunkHeader() noexcept {}
 
+  // Computes `data_hash` and `header_hash` with `hash_type`.
   explicit ChunkHeader(const Chain& data, ChunkType chunk_type,
-                       uint64_t num_records, uint64_t decoded_data_size);
+                       uint64_t num_records, uint64_t decoded_data_size,
+                       HashType hash_type = HashType::kHighwayHash);
 
   ChunkHeader(const ChunkHeader& that) noexcept = default;
   ChunkHeader& operator=(const ChunkHeader& that) noexcept = default;
@@ -42,6 +44,8 @@ class ChunkHeader {
   const char* bytes() const { return bytes_; }
   static constexpr size_t size() { return sizeof(bytes_); }
 
+  // Computes the header hash with the hash function which
+  // `stored_header_hash()` appears to have been computed with.
   uint64_t computed_header_hash() const;
   uint64_t stored_header_hash() const { return ReadLittleEndian64(bytes_); }
   uint64_t data_size() const {
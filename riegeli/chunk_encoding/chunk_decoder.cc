@@ -17,32 +17,54 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <limits>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
+#include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/limiting_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/decompressor.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/simple_decoder.h"
 #include "riegeli/chunk_encoding/transpose_decoder.h"
 #include "riegeli/messages/message_parse.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 namespace riegeli {
 
 void ChunkDecoder::Done() { recoverable_ = false; }
 
+size_t ChunkDecoder::EstimateMemory() const {
+  MemoryEstimator memory_estimator;
+  memory_estimator.RegisterMemory(sizeof(ChunkDecoder));
+  RegisterSubobjects(memory_estimator);
+  return memory_estimator.TotalMemory();
+}
+
+void ChunkDecoder::RegisterSubobjects(MemoryEstimator& memory_estimator) const {
+  memory_estimator.RegisterDynamicMemory(limits_.capacity() * sizeof(size_t));
+  values_reader_.src().RegisterSubobjects(memory_estimator);
+}
+
 bool ChunkDecoder::Decode(const Chunk& chunk) {
   Clear();
   ChainReader<> data_reader(&chunk.data);
@@ -50,7 +72,10 @@ bool ChunkDecoder::Decode(const Chunk& chunk) {
     return Fail(absl::ResourceExhaustedError("Too many records"));
   }
   Chain values;
-  if (ABSL_PREDICT_FALSE(!Parse(chunk.header, data_reader, values))) {
+  const bool parse_ok = Parse(chunk.header, chunk.header.chunk_type(),
+                              zstd_dictionary_, data_reader, values);
+  reference_ = absl::nullopt;
+  if (ABSL_PREDICT_FALSE(!parse_ok)) {
     limits_.clear();  // Ensure that `index() == num_records()`.
     return false;
   }
@@ -71,9 +96,24 @@ bool ChunkDecoder::Decode(const Chunk& chunk) {
   return true;
 }
 
-inline bool ChunkDecoder::Parse(const ChunkHeader& header, Reader& src,
-                                Chain& dest) {
-  switch (header.chunk_type()) {
+absl::optional<ChunkDecoder::Reference> ChunkDecoder::ReadReference(
+    const Chunk& chunk) {
+  ChainReader<> data_reader(&chunk.data);
+  const absl::optional<uint64_t> distance = ReadVarint64(data_reader);
+  if (ABSL_PREDICT_FALSE(distance == absl::nullopt || *distance == 0)) {
+    return absl::nullopt;
+  }
+  const absl::optional<uint64_t> num_chunks = ReadVarint64(data_reader);
+  if (ABSL_PREDICT_FALSE(num_chunks == absl::nullopt || *num_chunks == 0)) {
+    return absl::nullopt;
+  }
+  return Reference{*distance, *num_chunks};
+}
+
+bool ChunkDecoder::Parse(const ChunkHeader& header, ChunkType chunk_type,
+                         const ZstdReaderBase::Dictionary& zstd_dictionary,
+                         Reader& src, Chain& dest) {
+  switch (chunk_type) {
     case ChunkType::kFileSignature:
       if (ABSL_PREDICT_FALSE(header.data_size() != 0)) {
         return Fail(absl::DataLossError(absl::StrCat(
@@ -110,39 +150,83 @@ inline bool ChunkDecoder::Parse(const ChunkHeader& header, Reader& src,
             header.decoded_data_size())));
       }
       return true;
-    case ChunkType::kSimple: {
-      SimpleDecoder simple_decoder;
-      if (ABSL_PREDICT_FALSE(!simple_decoder.Decode(&src, header.num_records(),
-                                                    header.decoded_data_size(),
-                                                    limits_))) {
-        return Fail(simple_decoder);
-      }
-      if (ABSL_PREDICT_FALSE(!simple_decoder.reader().Read(
-              IntCast<size_t>(header.decoded_data_size()), dest))) {
-        simple_decoder.reader().Fail(
-            absl::DataLossError("Reading record values failed"));
-        return Fail(simple_decoder.reader());
-      }
-      if (ABSL_PREDICT_FALSE(!simple_decoder.VerifyEndAndClose())) {
-        return Fail(simple_decoder);
-      }
-      if (ABSL_PREDICT_FALSE(!src.VerifyEndAndClose())) return Fail(src);
+    case ChunkType::kChunkIndex:
+      if (ABSL_PREDICT_FALSE(header.num_records() != 0)) {
+        return Fail(absl::DataLossError(absl::StrCat(
+            "Invalid chunk index: number of records is not zero: ",
+            header.num_records())));
+      }
       return true;
-    }
-    case ChunkType::kTransposed: {
-      TransposeDecoder transpose_decoder;
-      ChainBackwardWriter<> dest_writer(
-          &dest, ChainBackwardWriterBase::Options().set_size_hint(
-                     field_projection_.includes_all()
-                         ? absl::make_optional(header.decoded_data_size())
-                         : absl::nullopt));
-      const bool ok = transpose_decoder.Decode(
-          header.num_records(), header.decoded_data_size(), field_projection_,
-          src, dest_writer, limits_);
-      if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return Fail(dest_writer);
-      if (ABSL_PREDICT_FALSE(!ok)) return Fail(transpose_decoder);
-      if (ABSL_PREDICT_FALSE(!src.VerifyEndAndClose())) return Fail(src);
+    case ChunkType::kFileSummary:
+      if (ABSL_PREDICT_FALSE(header.num_records() != 0)) {
+        return Fail(absl::DataLossError(absl::StrCat(
+            "Invalid file summary: number of records is not zero: ",
+            header.num_records())));
+      }
       return true;
+    case ChunkType::kSimple: {
+      if (simple_uncompressed_only_) {
+        return ParseSimpleUncompressed(header, src, dest);
+      }
+      return ParseSimple(header.num_records(), header.decoded_data_size(),
+                         zstd_dictionary, src, dest);
+    }
+    case ChunkType::kTransposed:
+      if (ABSL_PREDICT_FALSE(simple_uncompressed_only_)) {
+        return Fail(absl::FailedPreconditionError(
+            "Transposed chunk found but ChunkDecoder::Options::"
+            "simple_uncompressed_only() is set"));
+      }
+      return ParseTransposed(header.num_records(), header.decoded_data_size(),
+                             zstd_dictionary, src, dest);
+    case ChunkType::kDeduplicated:
+      if (ABSL_PREDICT_FALSE(simple_uncompressed_only_)) {
+        return Fail(absl::FailedPreconditionError(
+            "Deduplicated chunk found but ChunkDecoder::Options::"
+            "simple_uncompressed_only() is set"));
+      }
+      return ParseDeduplicated(header, zstd_dictionary, src, dest);
+    case ChunkType::kReferencing: {
+      if (ABSL_PREDICT_FALSE(simple_uncompressed_only_)) {
+        return Fail(absl::FailedPreconditionError(
+            "Chunk with a reference found but ChunkDecoder::Options::"
+            "simple_uncompressed_only() is set"));
+      }
+      if (ABSL_PREDICT_FALSE(chunk_type != header.chunk_type())) {
+        return Fail(absl::DataLossError(
+            "Invalid chunk with a reference: nested reference"));
+      }
+      const absl::optional<uint64_t> distance = ReadVarint64(src);
+      const absl::optional<uint64_t> num_chunks =
+          distance == absl::nullopt ? absl::nullopt : ReadVarint64(src);
+      const absl::optional<uint8_t> inner_chunk_type =
+          num_chunks == absl::nullopt ? absl::nullopt : src.ReadByte();
+      if (ABSL_PREDICT_FALSE(inner_chunk_type == absl::nullopt)) {
+        src.Fail(absl::DataLossError("Reading chunk reference failed"));
+        return Fail(src);
+      }
+      if (ABSL_PREDICT_FALSE(
+              static_cast<ChunkType>(*inner_chunk_type) != ChunkType::kSimple &&
+              static_cast<ChunkType>(*inner_chunk_type) !=
+                  ChunkType::kTransposed &&
+              static_cast<ChunkType>(*inner_chunk_type) !=
+                  ChunkType::kDeduplicated)) {
+        return Fail(absl::DataLossError(absl::StrCat(
+            "Invalid chunk with a reference: chunk type of records: ",
+            static_cast<int>(*inner_chunk_type))));
+      }
+      if (ABSL_PREDICT_FALSE(reference_ == absl::nullopt)) {
+        return Fail(absl::FailedPreconditionError(
+            "Chunk with a reference found but "
+            "ChunkDecoder::SetReference() was not called"));
+      }
+      ZstdReaderBase::Dictionary reference_dictionary;
+      reference_dictionary
+          .set_content_type(ZstdReaderBase::ContentType::kRaw)
+          .set_data(std::string(*reference_));
+      reference_ = absl::nullopt;
+      return Parse(header, static_cast<ChunkType>(*inner_chunk_type),
+                   reference_dictionary, src, dest);
     }
   }
   if (header.num_records() == 0) {
@@ -153,15 +237,265 @@ inline bool ChunkDecoder::Parse(const ChunkHeader& header, Reader& src,
       "Unknown chunk type: ", static_cast<uint64_t>(header.chunk_type()))));
 }
 
+inline bool ChunkDecoder::ParseSimple(
+    uint64_t num_records, uint64_t decoded_data_size,
+    const ZstdReaderBase::Dictionary& zstd_dictionary, Reader& src,
+    Chain& dest) {
+  SimpleDecoder simple_decoder;
+  if (ABSL_PREDICT_FALSE(!simple_decoder.Decode(
+          &src, num_records, decoded_data_size, limits_, zstd_dictionary,
+          brotli_dictionary_, decompression_backend_))) {
+    return Fail(simple_decoder);
+  }
+  // Without compression this shares blocks of `src` instead of copying.
+  if (ABSL_PREDICT_FALSE(!simple_decoder.reader().Read(
+          IntCast<size_t>(decoded_data_size), dest))) {
+    simple_decoder.reader().Fail(
+        absl::DataLossError("Reading record values failed"));
+    return Fail(simple_decoder.reader());
+  }
+  if (ABSL_PREDICT_FALSE(!simple_decoder.VerifyEndAndClose())) {
+    return Fail(simple_decoder);
+  }
+  if (ABSL_PREDICT_FALSE(!src.VerifyEndAndClose())) return Fail(src);
+  return true;
+}
+
+inline bool ChunkDecoder::ParseTransposed(
+    uint64_t num_records, uint64_t decoded_data_size,
+    const ZstdReaderBase::Dictionary& zstd_dictionary, Reader& src,
+    Chain& dest) {
+  ChainBackwardWriter<> dest_writer(
+      &dest, ChainBackwardWriterBase::Options().set_size_hint(
+                 field_projection_.includes_all()
+                     ? absl::make_optional(decoded_data_size)
+                     : absl::nullopt));
+  const bool ok = transpose_decoder_.Decode(
+      num_records, decoded_data_size, field_projection_, src, dest_writer,
+      limits_, zstd_dictionary, brotli_dictionary_, parallelism_,
+      decompression_backend_);
+  if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return Fail(dest_writer);
+  if (ABSL_PREDICT_FALSE(!ok)) return Fail(transpose_decoder_);
+  if (ABSL_PREDICT_FALSE(!src.VerifyEndAndClose())) return Fail(src);
+  return true;
+}
+
+inline bool ChunkDecoder::ParseDeduplicated(
+    const ChunkHeader& header,
+    const ZstdReaderBase::Dictionary& zstd_dictionary, Reader& src,
+    Chain& dest) {
+  const absl::optional<uint64_t> num_unique_records = ReadVarint64(src);
+  const absl::optional<uint64_t> unique_data_size =
+      num_unique_records == absl::nullopt ? absl::nullopt : ReadVarint64(src);
+  const absl::optional<uint8_t> compression_type_byte =
+      unique_data_size == absl::nullopt ? absl::nullopt : src.ReadByte();
+  const absl::optional<uint64_t> indices_size =
+      compression_type_byte == absl::nullopt ? absl::nullopt
+                                             : ReadVarint64(src);
+  if (ABSL_PREDICT_FALSE(indices_size == absl::nullopt)) {
+    src.Fail(absl::DataLossError("Reading deduplicated chunk header failed"));
+    return Fail(src);
+  }
+  if (ABSL_PREDICT_FALSE(*num_unique_records > header.num_records())) {
+    return Fail(absl::DataLossError(absl::StrCat(
+        "Invalid deduplicated chunk: more distinct records than records: ",
+        *num_unique_records, " > ", header.num_records())));
+  }
+  if (ABSL_PREDICT_FALSE(*indices_size >
+                         std::numeric_limits<Position>::max() - src.pos())) {
+    return Fail(absl::ResourceExhaustedError("Size of indices too large"));
+  }
+
+  // Each record is encoded as 0 for the first occurrence of a distinct record,
+  // or 1 + index of a distinct record seen before.
+  std::vector<size_t> indices;
+  indices.reserve(IntCast<size_t>(header.num_records()));
+  {
+    internal::Decompressor<LimitingReader<>> indices_decompressor(
+        std::forward_as_tuple(&src, src.pos() + *indices_size),
+        static_cast<CompressionType>(*compression_type_byte), zstd_dictionary,
+        brotli_dictionary_, decompression_backend_);
+    if (ABSL_PREDICT_FALSE(!indices_decompressor.healthy())) {
+      return Fail(indices_decompressor);
+    }
+    uint64_t num_seen = 0;
+    while (indices.size() != header.num_records()) {
+      const absl::optional<uint64_t> index =
+          ReadVarint64(indices_decompressor.reader());
+      if (ABSL_PREDICT_FALSE(index == absl::nullopt)) {
+        indices_decompressor.reader().Fail(
+            absl::DataLossError("Reading record index failed"));
+        return Fail(indices_decompressor.reader());
+      }
+      if (*index == 0) {
+        if (ABSL_PREDICT_FALSE(num_seen == *num_unique_records)) {
+          return Fail(absl::DataLossError(
+              "Invalid deduplicated chunk: too many distinct records"));
+        }
+        indices.push_back(IntCast<size_t>(num_seen++));
+      } else {
+        if (ABSL_PREDICT_FALSE(*index > num_seen)) {
+          return Fail(absl::DataLossError(absl::StrCat(
+              "Invalid deduplicated chunk: record index out of range: ",
+              *index - 1)));
+        }
+        indices.push_back(IntCast<size_t>(*index - 1));
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!indices_decompressor.VerifyEndAndClose())) {
+      return Fail(indices_decompressor);
+    }
+    if (ABSL_PREDICT_FALSE(num_seen != *num_unique_records)) {
+      return Fail(absl::DataLossError(
+          "Invalid deduplicated chunk: some distinct records are not used"));
+    }
+  }
+
+  const absl::optional<uint8_t> unique_chunk_type = src.ReadByte();
+  if (ABSL_PREDICT_FALSE(unique_chunk_type == absl::nullopt)) {
+    src.Fail(absl::DataLossError("Reading chunk type of records failed"));
+    return Fail(src);
+  }
+  Chain unique_values;
+  switch (static_cast<ChunkType>(*unique_chunk_type)) {
+    case ChunkType::kSimple:
+      if (ABSL_PREDICT_FALSE(!ParseSimple(*num_unique_records,
+                                          *unique_data_size, zstd_dictionary,
+                                          src, unique_values))) {
+        return false;
+      }
+      break;
+    case ChunkType::kTransposed:
+      if (ABSL_PREDICT_FALSE(!ParseTransposed(
+              *num_unique_records, *unique_data_size, zstd_dictionary, src,
+              unique_values))) {
+        return false;
+      }
+      break;
+    default:
+      return Fail(absl::DataLossError(absl::StrCat(
+          "Invalid deduplicated chunk: chunk type of records: ",
+          static_cast<int>(*unique_chunk_type))));
+  }
+
+  // Expand indices to records. Blocks of `unique_values` are shared with
+  // `dest` where this is cheaper than copying.
+  std::vector<size_t> unique_limits;
+  unique_limits.swap(limits_);
+  limits_.reserve(indices.size());
+  ChainReader<> unique_reader(&unique_values);
+  for (const size_t index : indices) {
+    const size_t begin = index == 0 ? size_t{0} : unique_limits[index - 1];
+    const size_t size = unique_limits[index] - begin;
+    if (ABSL_PREDICT_FALSE(size > header.decoded_data_size() - dest.size())) {
+      return Fail(
+          absl::DataLossError("Decoded data size larger than expected"));
+    }
+    if (ABSL_PREDICT_FALSE(!unique_reader.Seek(begin)) ||
+        ABSL_PREDICT_FALSE(!unique_reader.ReadAndAppend(size, dest))) {
+      unique_reader.Fail(absl::DataLossError("Reading record value failed"));
+      return Fail(unique_reader);
+    }
+    limits_.push_back(dest.size());
+  }
+  if (field_projection_.includes_all() &&
+      ABSL_PREDICT_FALSE(dest.size() != header.decoded_data_size())) {
+    return Fail(absl::DataLossError("Decoded data size smaller than expected"));
+  }
+  return true;
+}
+
+inline bool ChunkDecoder::ParseSimpleUncompressed(const ChunkHeader& header,
+                                                  Reader& src, Chain& dest) {
+  if (ABSL_PREDICT_FALSE(header.decoded_data_size() >
+                         std::numeric_limits<size_t>::max())) {
+    return Fail(absl::ResourceExhaustedError("Records too large"));
+  }
+  const size_t decoded_data_size = IntCast<size_t>(header.decoded_data_size());
+  const absl::optional<uint8_t> compression_type_byte = src.ReadByte();
+  if (ABSL_PREDICT_FALSE(compression_type_byte == absl::nullopt)) {
+    src.Fail(absl::DataLossError("Reading compression type failed"));
+    return Fail(src);
+  }
+  if (ABSL_PREDICT_FALSE(static_cast<CompressionType>(*compression_type_byte) !=
+                         CompressionType::kNone)) {
+    return Fail(absl::FailedPreconditionError(absl::StrCat(
+        "Compressed chunk found but ChunkDecoder::Options::"
+        "simple_uncompressed_only() is set, compression type: ",
+        static_cast<int>(*compression_type_byte))));
+  }
+  const absl::optional<uint64_t> sizes_size = ReadVarint64(src);
+  if (ABSL_PREDICT_FALSE(sizes_size == absl::nullopt)) {
+    src.Fail(absl::DataLossError("Reading size of sizes failed"));
+    return Fail(src);
+  }
+  // Record sizes are parsed in place, which needs them to be contiguous. They
+  // usually are, being a small prefix of the chunk data.
+  if (ABSL_PREDICT_FALSE(*sizes_size >
+                             SaturatingSub(header.data_size(), src.pos()) ||
+                         !src.Pull(IntCast<size_t>(*sizes_size)))) {
+    src.Fail(absl::DataLossError("Reading record sizes failed"));
+    return Fail(src);
+  }
+  const char* cursor = src.cursor();
+  const char* const sizes_limit = cursor + IntCast<size_t>(*sizes_size);
+  size_t limit = 0;
+  constexpr size_t kMaxBatchSize = 256;
+  uint64_t sizes[kMaxBatchSize];
+  while (limits_.size() != header.num_records()) {
+    const size_t batch_size = IntCast<size_t>(UnsignedMin(
+        header.num_records() - limits_.size(), uint64_t{kMaxBatchSize}));
+    const absl::optional<const char*> next_cursor =
+        ReadVarints64(cursor, sizes_limit, batch_size, sizes);
+    if (ABSL_PREDICT_FALSE(next_cursor == absl::nullopt)) {
+      return Fail(absl::DataLossError("Reading record size failed"));
+    }
+    cursor = *next_cursor;
+    for (size_t i = 0; i < batch_size; ++i) {
+      if (ABSL_PREDICT_FALSE(sizes[i] > decoded_data_size - limit)) {
+        return Fail(
+            absl::DataLossError("Decoded data size larger than expected"));
+      }
+      limit += IntCast<size_t>(sizes[i]);
+      limits_.push_back(limit);
+    }
+  }
+  if (ABSL_PREDICT_FALSE(cursor != sizes_limit)) {
+    return Fail(absl::DataLossError("Record sizes have trailing data"));
+  }
+  if (ABSL_PREDICT_FALSE(limit != decoded_data_size)) {
+    return Fail(absl::DataLossError("Decoded data size smaller than expected"));
+  }
+  src.set_cursor(sizes_limit);
+  // This shares blocks of `src` instead of copying.
+  if (ABSL_PREDICT_FALSE(!src.Read(decoded_data_size, dest))) {
+    src.Fail(absl::DataLossError("Reading record values failed"));
+    return Fail(src);
+  }
+  if (ABSL_PREDICT_FALSE(!src.VerifyEndAndClose())) return Fail(src);
+  return true;
+}
+
 bool ChunkDecoder::ReadRecord(google::protobuf::MessageLite& record) {
   if (ABSL_PREDICT_FALSE(!healthy() || index() == num_records())) return false;
   const size_t start = IntCast<size_t>(values_reader_.pos());
   const size_t limit = limits_[IntCast<size_t>(index_)];
   RIEGELI_ASSERT_LE(start, limit)
       << "Failed invariant of ChunkDecoder: record end positions not sorted";
+  const size_t length = limit - start;
+  if (values_reader_.available() == 0 && length > 0) values_reader_.Pull();
   {
-    absl::Status status =
-        ParseFromReader(LimitingReader<>(&values_reader_, limit), record);
+    absl::Status status;
+    if (length <= values_reader_.available()) {
+      // The record is contiguous. Parse it in place instead of setting up a
+      // `LimitingReader`, which would be synced with `values_reader_` twice.
+      status = ParseFromString(
+          absl::string_view(values_reader_.cursor(), length), record);
+      values_reader_.move_cursor(length);
+    } else {
+      status =
+          ParseFromReader(LimitingReader<>(&values_reader_, limit), record);
+    }
     if (ABSL_PREDICT_FALSE(!status.ok())) {
       if (!values_reader_.Seek(limit)) {
         RIEGELI_ASSERT_UNREACHABLE()
@@ -175,6 +509,109 @@ bool ChunkDecoder::ReadRecord(google::protobuf::MessageLite& record) {
   return true;
 }
 
+bool ChunkDecoder::ReadRecord(const google::protobuf::MessageLite& prototype,
+                              google::protobuf::Arena& arena,
+                              google::protobuf::MessageLite*& record) {
+  if (ABSL_PREDICT_FALSE(!healthy() || index() == num_records())) return false;
+  google::protobuf::MessageLite* const message = prototype.New(&arena);
+  if (ABSL_PREDICT_FALSE(!ReadRecord(*message))) return false;
+  record = message;
+  return true;
+}
+
+size_t ChunkDecoder::ReadRecords(absl::Span<absl::string_view> records) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return 0;
+  size_t num_read = 0;
+  while (num_read < records.size() && index() < num_records()) {
+    const size_t start = IntCast<size_t>(values_reader_.pos());
+    const size_t limit = limits_[IntCast<size_t>(index_)];
+    RIEGELI_ASSERT_LE(start, limit)
+        << "Failed invariant of ChunkDecoder: record end positions not sorted";
+    const size_t length = limit - start;
+    if (values_reader_.available() == 0 && length > 0) values_reader_.Pull();
+    // A record which is not contiguous is copied to a scratch buffer, which is
+    // reused by the next record.
+    const bool contiguous = length <= values_reader_.available();
+    if (!contiguous && num_read > 0) break;
+    if (!values_reader_.Read(length, records[num_read])) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed reading record from values reader: "
+          << values_reader_.status();
+    }
+    ++index_;
+    ++num_read;
+    if (!contiguous) break;
+  }
+  return num_read;
+}
+
+size_t ChunkDecoder::ReadRecords(absl::Span<Chain> records) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return 0;
+  size_t num_read = 0;
+  while (num_read < records.size() && index() < num_records()) {
+    const size_t start = IntCast<size_t>(values_reader_.pos());
+    const size_t limit = limits_[IntCast<size_t>(index_)];
+    RIEGELI_ASSERT_LE(start, limit)
+        << "Failed invariant of ChunkDecoder: record end positions not sorted";
+    if (!values_reader_.Read(limit - start, records[num_read])) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed reading record from values reader: "
+          << values_reader_.status();
+    }
+    ++index_;
+    ++num_read;
+  }
+  return num_read;
+}
+
+size_t ChunkDecoder::ReadRecords(absl::Span<absl::Cord> records) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return 0;
+  size_t num_read = 0;
+  while (num_read < records.size() && index() < num_records()) {
+    const size_t start = IntCast<size_t>(values_reader_.pos());
+    const size_t limit = limits_[IntCast<size_t>(index_)];
+    RIEGELI_ASSERT_LE(start, limit)
+        << "Failed invariant of ChunkDecoder: record end positions not sorted";
+    if (!values_reader_.Read(limit - start, records[num_read])) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed reading record from values reader: "
+          << values_reader_.status();
+    }
+    ++index_;
+    ++num_read;
+  }
+  return num_read;
+}
+
+void ChunkDecoder::TakeRecords(Chain& values, std::vector<size_t>& limits) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of ChunkDecoder::TakeRecords(): " << status();
+  values = values_reader_.src();
+  limits = std::move(limits_);
+  Clear();
+}
+
+void ChunkDecoder::SetRecords(Chain values, std::vector<size_t> limits) {
+  RIEGELI_ASSERT_EQ(limits.empty() ? size_t{0} : limits.back(), values.size())
+      << "Failed precondition of ChunkDecoder::SetRecords(): "
+         "record end positions do not match concatenated record values";
+  Clear();
+  limits_ = std::move(limits);
+  values_reader_.Reset(std::move(values));
+}
+
+size_t ChunkDecoder::ReadRecords(
+    const google::protobuf::MessageLite& prototype,
+    google::protobuf::Arena& arena,
+    absl::Span<google::protobuf::MessageLite*> records) {
+  size_t num_read = 0;
+  while (num_read < records.size() &&
+         ReadRecord(prototype, arena, records[num_read])) {
+    ++num_read;
+  }
+  return num_read;
+}
+
 bool ChunkDecoder::Recover() {
   if (!recoverable_) return false;
   RIEGELI_ASSERT(!healthy()) << "Failed invariant of ChunkDecoder: "
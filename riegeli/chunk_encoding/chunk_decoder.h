@@ -27,14 +27,23 @@
 #include "absl/status/status.h"
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/decompression_backend.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/transpose_decoder.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 namespace riegeli {
 
@@ -68,8 +77,129 @@ class ChunkDecoder : public Object {
       return field_projection_;
     }
 
+    // Zstd dictionary used for compression of chunks to be decoded.
+    //
+    // Default: `ZstdReaderBase::Dictionary()` (no dictionary).
+    Options& set_zstd_dictionary(
+        const ZstdReaderBase::Dictionary& zstd_dictionary) & {
+      zstd_dictionary_ = zstd_dictionary;
+      return *this;
+    }
+    Options& set_zstd_dictionary(
+        ZstdReaderBase::Dictionary&& zstd_dictionary) & {
+      zstd_dictionary_ = std::move(zstd_dictionary);
+      return *this;
+    }
+    Options&& set_zstd_dictionary(
+        const ZstdReaderBase::Dictionary& zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(zstd_dictionary));
+    }
+    Options&& set_zstd_dictionary(
+        ZstdReaderBase::Dictionary&& zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+    }
+    ZstdReaderBase::Dictionary& zstd_dictionary() { return zstd_dictionary_; }
+    const ZstdReaderBase::Dictionary& zstd_dictionary() const {
+      return zstd_dictionary_;
+    }
+
+    // Brotli dictionary used for compression of chunks to be decoded.
+    //
+    // Default: `BrotliReaderBase::Dictionary()` (no dictionary).
+    Options& set_brotli_dictionary(
+        const BrotliReaderBase::Dictionary& brotli_dictionary) & {
+      brotli_dictionary_ = brotli_dictionary;
+      return *this;
+    }
+    Options& set_brotli_dictionary(
+        BrotliReaderBase::Dictionary&& brotli_dictionary) & {
+      brotli_dictionary_ = std::move(brotli_dictionary);
+      return *this;
+    }
+    Options&& set_brotli_dictionary(
+        const BrotliReaderBase::Dictionary& brotli_dictionary) && {
+      return std::move(set_brotli_dictionary(brotli_dictionary));
+    }
+    Options&& set_brotli_dictionary(
+        BrotliReaderBase::Dictionary&& brotli_dictionary) && {
+      return std::move(set_brotli_dictionary(std::move(brotli_dictionary)));
+    }
+    BrotliReaderBase::Dictionary& brotli_dictionary() {
+      return brotli_dictionary_;
+    }
+    const BrotliReaderBase::Dictionary& brotli_dictionary() const {
+      return brotli_dictionary_;
+    }
+
+    // Sets the maximum number of buckets of a transposed chunk decompressed in
+    // parallel in background, in addition to the calling thread. This reduces
+    // the latency of decoding a single large chunk which was written with
+    // `RecordWriterBase::Options::set_bucket_fraction() < 1`.
+    //
+    // If `parallelism == 0`, buckets are decompressed one after another. This
+    // does not apply to projected reads, which decompress buckets on demand.
+    //
+    // Default: 0.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of ChunkDecoder::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+    // Alternative implementation of decompressing chunk data, e.g. on a GPU.
+    // Streams which it does not support or fails to decompress are
+    // decompressed on the CPU.
+    //
+    // `decompression_backend` is not owned and must be kept alive while the
+    // `ChunkDecoder` is used.
+    //
+    // `nullptr` decompresses everything on the CPU.
+    //
+    // Default: `nullptr`.
+    Options& set_decompression_backend(
+        DecompressionBackend* decompression_backend) & {
+      decompression_backend_ = decompression_backend;
+      return *this;
+    }
+    Options&& set_decompression_backend(
+        DecompressionBackend* decompression_backend) && {
+      return std::move(set_decompression_backend(decompression_backend));
+    }
+    DecompressionBackend* decompression_backend() const {
+      return decompression_backend_;
+    }
+
+    // If `true`, the caller asserts that records were written only to simple
+    // chunks without compression, e.g. with
+    // `RecordWriterBase::Options::FromString("uncompressed")`. Such chunks are
+    // then decoded by a specialized path which parses record sizes directly
+    // from chunk data, without setting up decompressors. Transposed or
+    // compressed chunks fail the `ChunkDecoder` with
+    // `absl::FailedPreconditionError()`.
+    //
+    // Default: `false`.
+    Options& set_simple_uncompressed_only(bool simple_uncompressed_only) & {
+      simple_uncompressed_only_ = simple_uncompressed_only;
+      return *this;
+    }
+    Options&& set_simple_uncompressed_only(bool simple_uncompressed_only) && {
+      return std::move(set_simple_uncompressed_only(simple_uncompressed_only));
+    }
+    bool simple_uncompressed_only() const { return simple_uncompressed_only_; }
+
    private:
     FieldProjection field_projection_ = FieldProjection::All();
+    ZstdReaderBase::Dictionary zstd_dictionary_;
+    BrotliReaderBase::Dictionary brotli_dictionary_;
+    int parallelism_ = 0;
+    DecompressionBackend* decompression_backend_ = nullptr;
+    bool simple_uncompressed_only_ = false;
   };
 
   // Creates an empty `ChunkDecoder`.
@@ -85,6 +215,34 @@ class ChunkDecoder : public Object {
   // Resets the `ChunkDecoder` to an empty chunk. Keeps options unchanged.
   void Clear();
 
+  // Changes the Zstd dictionary for chunks decoded later. Keeps other options
+  // unchanged.
+  void SetZstdDictionary(ZstdReaderBase::Dictionary zstd_dictionary) {
+    zstd_dictionary_ = std::move(zstd_dictionary);
+  }
+
+  // Returns the field projection used for decoding chunks.
+  const FieldProjection& field_projection() const { return field_projection_; }
+
+  // Describes chunks referred to by a chunk of type `ChunkType::kReferencing`,
+  // whose records, concatenated, are the Zstd dictionary of the chunk:
+  // `num_chunks` consecutive chunks with records, the first of which begins
+  // `distance` bytes before the chunk.
+  struct Reference {
+    Position distance;
+    uint64_t num_chunks;
+  };
+
+  // Reads the `Reference` of a chunk of type `ChunkType::kReferencing`.
+  //
+  // Returns `absl::nullopt` if chunk data are invalid.
+  static absl::optional<Reference> ReadReference(const Chunk& chunk);
+
+  // Sets concatenated records of chunks referred to by the chunk passed to the
+  // next `Decode()`, which needs them if the chunk has type
+  // `ChunkType::kReferencing`.
+  void SetReference(Chain reference) { reference_ = std::move(reference); }
+
   // Resets the `ChunkDecoder` and parses the chunk. Keeps options unchanged.
   //
   // Return values:
@@ -100,6 +258,13 @@ class ChunkDecoder : public Object {
   // `absl::string_view` is valid until the next non-const operation on this
   // `ChunkDecoder`.
   //
+  // For simple chunks without compression record values share the data of the
+  // chunk passed to `Decode()` instead of being copied.
+  //
+  // For `ReadRecord(Chain&)` and `ReadRecord(absl::Cord&)` records longer than
+  // `kMaxBytesToCopy` are not copied from the decoded chunk: they share its
+  // blocks by reference, which keeps the blocks alive as long as needed.
+  //
   // Return values:
   //  * `true`                      - success (`record` is set, `healthy()`)
   //  * `false` (when `healthy()`)  - chunk ends
@@ -110,6 +275,51 @@ class ChunkDecoder : public Object {
   bool ReadRecord(Chain& record);
   bool ReadRecord(absl::Cord& record);
 
+  // Like `ReadRecord(google::protobuf::MessageLite&)`, but parses the record
+  // into a new message of the same type as `prototype`, created on `arena`.
+  // Submessages are allocated on `arena` too, and all of them are freed
+  // together with `arena`, which avoids a heap allocation per submessage.
+  //
+  // A message is created only if a record is available. If parsing fails, the
+  // message remains allocated on `arena` but `record` is unchanged.
+  //
+  // Return values:
+  //  * `true`                      - success (`record` is set, `healthy()`)
+  //  * `false` (when `healthy()`)  - chunk ends
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadRecord(const google::protobuf::MessageLite& prototype,
+                  google::protobuf::Arena& arena,
+                  google::protobuf::MessageLite*& record);
+
+  // Reads up to `records.size()` next records, stopping when the chunk ends.
+  // This is faster than reading them one by one with `ReadRecord()`.
+  //
+  // For `ReadRecords(absl::Span<absl::string_view>)` all `absl::string_view`
+  // values are valid until the next non-const operation on this
+  // `ChunkDecoder`. In order for that, if a record after the first one would
+  // not be stored contiguously in values of records, reading stops before it.
+  //
+  // For `ReadRecords(absl::Span<Chain>)` and
+  // `ReadRecords(absl::Span<absl::Cord>)` long records share blocks of the
+  // decoded chunk, as with `ReadRecord()`, so a whole chunk can be consumed
+  // without copying record values.
+  //
+  // Returns the number of records read, which is 0 if the chunk ends or
+  // `!healthy()`.
+  size_t ReadRecords(absl::Span<absl::string_view> records);
+  size_t ReadRecords(absl::Span<Chain> records);
+  size_t ReadRecords(absl::Span<absl::Cord> records);
+
+  // Like `ReadRecord(prototype, arena, record)` repeated for up to
+  // `records.size()` next records, stopping when the chunk ends or parsing
+  // fails. All messages are created on the same `arena`.
+  //
+  // If parsing fails after some records have been read, their number is
+  // returned, and the failure is reported by the next call.
+  size_t ReadRecords(const google::protobuf::MessageLite& prototype,
+                     google::protobuf::Arena& arena,
+                     absl::Span<google::protobuf::MessageLite*> records);
+
   // If `!healthy()` and the failure was caused by an unparsable message, then
   // `Recover()` allows reading again by skipping the unparsable message.
   //
@@ -121,6 +331,23 @@ class ChunkDecoder : public Object {
   //  * `false` - failure not caused by an unparsable message
   bool Recover();
 
+  // Moves decoded records out of the `ChunkDecoder`, e.g. to keep them in a
+  // cache shared between threads: `values` is set to the concatenation of
+  // record values, and `limits` to positions in `values` where consecutive
+  // records end. Leaves the `ChunkDecoder` empty, with options unchanged.
+  //
+  // Precondition: `healthy()`
+  void TakeRecords(Chain& values, std::vector<size_t>& limits);
+
+  // Replaces decoded records with records previously taken by
+  // `TakeRecords()`, e.g. found in a cache, positioning the `ChunkDecoder` at
+  // the first record. Marks the `ChunkDecoder` as healthy.
+  //
+  // Precondition:
+  //   `limits` are sorted
+  //   `(limits.empty() ? 0 : limits.back()) == values.size()`
+  void SetRecords(Chain values, std::vector<size_t> limits);
+
   // Returns the current record index. Unchanged by `Close()`.
   uint64_t index() const { return index_; }
 
@@ -134,13 +361,46 @@ class ChunkDecoder : public Object {
   // Returns the number of records. Unchanged by `Close()`.
   uint64_t num_records() const { return IntCast<uint64_t>(limits_.size()); }
 
+  // Returns an estimate of memory used by this `ChunkDecoder`, including
+  // decoded records of the current chunk. Blocks shared with records returned
+  // by `ReadRecord()` are included.
+  size_t EstimateMemory() const;
+
+  // Registers decoded records of the current chunk with `MemoryEstimator`, but
+  // does not include `sizeof(*this)`.
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const;
+
  protected:
   void Done() override;
 
  private:
-  bool Parse(const ChunkHeader& header, Reader& src, Chain& dest);
+  bool Parse(const ChunkHeader& header, ChunkType chunk_type,
+             const ZstdReaderBase::Dictionary& zstd_dictionary, Reader& src,
+             Chain& dest);
+  bool ParseSimple(uint64_t num_records, uint64_t decoded_data_size,
+                   const ZstdReaderBase::Dictionary& zstd_dictionary,
+                   Reader& src, Chain& dest);
+  bool ParseTransposed(uint64_t num_records, uint64_t decoded_data_size,
+                       const ZstdReaderBase::Dictionary& zstd_dictionary,
+                       Reader& src, Chain& dest);
+  bool ParseDeduplicated(const ChunkHeader& header,
+                         const ZstdReaderBase::Dictionary& zstd_dictionary,
+                         Reader& src, Chain& dest);
+  bool ParseSimpleUncompressed(const ChunkHeader& header, Reader& src,
+                               Chain& dest);
 
   FieldProjection field_projection_;
+  ZstdReaderBase::Dictionary zstd_dictionary_;
+  BrotliReaderBase::Dictionary brotli_dictionary_;
+  int parallelism_ = 0;
+  DecompressionBackend* decompression_backend_ = nullptr;
+  bool simple_uncompressed_only_ = false;
+  // Records of chunks referred to by the chunk passed to the next `Decode()`,
+  // set by `SetReference()`.
+  absl::optional<Chain> reference_;
+  // Kept across chunks so that the compiled `field_projection_` and the memory
+  // allocated for decoding are reused.
+  TransposeDecoder transpose_decoder_;
   // Invariants if `healthy()`:
   //   `limits_` are sorted
   //   `(limits_.empty() ? 0 : limits_.back())` == size of `values_reader_`
@@ -160,6 +420,11 @@ class ChunkDecoder : public Object {
 inline ChunkDecoder::ChunkDecoder(Options options)
     : Object(kInitiallyOpen),
       field_projection_(std::move(options.field_projection())),
+      zstd_dictionary_(std::move(options.zstd_dictionary())),
+      brotli_dictionary_(std::move(options.brotli_dictionary())),
+      parallelism_(options.parallelism()),
+      decompression_backend_(options.decompression_backend()),
+      simple_uncompressed_only_(options.simple_uncompressed_only()),
       values_reader_(std::forward_as_tuple()) {}
 
 inline ChunkDecoder::ChunkDecoder(ChunkDecoder&& that) noexcept
@@ -167,6 +432,13 @@ inline ChunkDecoder::ChunkDecoder(ChunkDecoder&& that) noexcept
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
       field_projection_(std::move(that.field_projection_)),
+      zstd_dictionary_(std::move(that.zstd_dictionary_)),
+      brotli_dictionary_(std::move(that.brotli_dictionary_)),
+      parallelism_(that.parallelism_),
+      decompression_backend_(that.decompression_backend_),
+      simple_uncompressed_only_(that.simple_uncompressed_only_),
+      reference_(std::move(that.reference_)),
+      transpose_decoder_(std::move(that.transpose_decoder_)),
       limits_(std::move(that.limits_)),
       values_reader_(std::move(that.values_reader_)),
       index_(that.index_),
@@ -177,6 +449,13 @@ inline ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& that) noexcept {
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
   field_projection_ = std::move(that.field_projection_);
+  zstd_dictionary_ = std::move(that.zstd_dictionary_);
+  brotli_dictionary_ = std::move(that.brotli_dictionary_);
+  parallelism_ = that.parallelism_;
+  decompression_backend_ = that.decompression_backend_;
+  simple_uncompressed_only_ = that.simple_uncompressed_only_;
+  reference_ = std::move(that.reference_);
+  transpose_decoder_ = std::move(that.transpose_decoder_);
   limits_ = std::move(that.limits_);
   values_reader_ = std::move(that.values_reader_);
   index_ = that.index_;
@@ -186,6 +465,12 @@ inline ChunkDecoder& ChunkDecoder::operator=(ChunkDecoder&& that) noexcept {
 
 inline void ChunkDecoder::Reset(Options options) {
   field_projection_ = std::move(options.field_projection());
+  zstd_dictionary_ = std::move(options.zstd_dictionary());
+  brotli_dictionary_ = std::move(options.brotli_dictionary());
+  parallelism_ = options.parallelism();
+  decompression_backend_ = options.decompression_backend();
+  simple_uncompressed_only_ = options.simple_uncompressed_only();
+  reference_ = absl::nullopt;
   Clear();
 }
 
@@ -29,6 +29,7 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/constants.h"
@@ -100,6 +101,13 @@ class ChunkEncoder : public Object {
                               uint64_t& num_records,
                               uint64_t& decoded_data_size) = 0;
 
+  // Registers memory owned by this `ChunkEncoder` with `MemoryEstimator`, but
+  // does not include `sizeof(*this)`: records added so far, and buffers and
+  // compressor state kept for encoding them.
+  //
+  // By default registers nothing.
+  virtual void RegisterSubobjects(MemoryEstimator& memory_estimator) const {}
+
  protected:
   void Done() override;
 
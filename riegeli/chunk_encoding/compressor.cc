@@ -24,12 +24,14 @@
 #include "absl/memory/memory.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/brotli/brotli_writer.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/lz4/lz4_writer.h"
 #include "riegeli/snappy/snappy_writer.h"
 #include "riegeli/varint/varint_writing.h"
 #include "riegeli/zstd/zstd_writer.h"
@@ -37,6 +39,22 @@
 namespace riegeli {
 namespace internal {
 
+namespace {
+
+// Makes `writer` a `WriterType` constructed from `args`. If `writer` already
+// holds a `WriterType`, it is reset instead, which lets it keep its buffer and
+// compression state.
+template <typename WriterType, typename... Args>
+void ResetWriter(std::unique_ptr<Writer>& writer, Args&&... args) {
+  if (writer == nullptr) {
+    writer = absl::make_unique<WriterType>(std::forward<Args>(args)...);
+  } else {
+    static_cast<WriterType&>(*writer).Reset(std::forward<Args>(args)...);
+  }
+}
+
+}  // namespace
+
 Compressor::Compressor(CompressorOptions compressor_options,
                        TuningOptions tuning_options)
     : Object(kInitiallyOpen),
@@ -50,44 +68,106 @@ void Compressor::Clear(TuningOptions tuning_options) {
   Clear();
 }
 
+void Compressor::RegisterSubobjects(MemoryEstimator& memory_estimator) const {
+  compressed_.RegisterSubobjects(memory_estimator);
+  if (writer_ != nullptr) writer_->RegisterSubobjects(memory_estimator);
+}
+
 void Compressor::Clear() {
   Object::Reset(kInitiallyOpen);
   Initialize();
 }
 
+absl::optional<Position> Compressor::CompressedSizeHint() const {
+  absl::optional<Position> uncompressed_size_hint =
+      tuning_options_.pledged_size() != absl::nullopt
+          ? tuning_options_.pledged_size()
+          : tuning_options_.size_hint();
+  if (recent_uncompressed_size_ == 0) {
+    // Without compressed data to learn from, a compression ratio is unknown,
+    // and reserving the uncompressed size would waste memory.
+    return absl::nullopt;
+  }
+  if (uncompressed_size_hint == absl::nullopt) {
+    uncompressed_size_hint = recent_uncompressed_size_;
+  }
+  if (recent_compressed_size_ >= recent_uncompressed_size_) {
+    // Data do not compress.
+    return uncompressed_size_hint;
+  }
+  return static_cast<Position>(
+      static_cast<double>(*uncompressed_size_hint) *
+      (static_cast<double>(recent_compressed_size_) /
+       static_cast<double>(recent_uncompressed_size_)));
+}
+
 void Compressor::Initialize() {
+  const absl::optional<Position> compressed_size_hint = CompressedSizeHint();
+  // `writer_`, if not `nullptr`, has the type corresponding to
+  // `compressor_options_.compression_type()`, which does not change.
   switch (compressor_options_.compression_type()) {
     case CompressionType::kNone:
-      writer_ = absl::make_unique<ChainWriter<>>(
-          &compressed_, ChainWriterBase::Options().set_size_hint(
-                            tuning_options_.pledged_size() != absl::nullopt
-                                ? tuning_options_.pledged_size()
-                                : tuning_options_.size_hint()));
+      ResetWriter<ChainWriter<>>(
+          writer_, &compressed_,
+          ChainWriterBase::Options().set_size_hint(
+              tuning_options_.pledged_size() != absl::nullopt
+                  ? tuning_options_.pledged_size()
+                  : tuning_options_.size_hint()));
       return;
     case CompressionType::kBrotli:
-      writer_ = absl::make_unique<BrotliWriter<ChainWriter<>>>(
-          std::forward_as_tuple(&compressed_),
+      ResetWriter<BrotliWriter<ChainWriter<>>>(
+          writer_,
+          std::forward_as_tuple(&compressed_,
+                                ChainWriterBase::Options().set_size_hint(
+                                    compressed_size_hint)),
           BrotliWriterBase::Options()
               .set_compression_level(compressor_options_.compression_level())
               .set_window_log(compressor_options_.brotli_window_log())
+              .set_dictionary(compressor_options_.brotli_dictionary())
               .set_size_hint(tuning_options_.pledged_size() != absl::nullopt
                                  ? tuning_options_.pledged_size()
                                  : tuning_options_.size_hint()));
       return;
     case CompressionType::kZstd:
-      writer_ = absl::make_unique<ZstdWriter<ChainWriter<>>>(
-          std::forward_as_tuple(&compressed_),
+      ResetWriter<ZstdWriter<ChainWriter<>>>(
+          writer_,
+          std::forward_as_tuple(&compressed_,
+                                ChainWriterBase::Options().set_size_hint(
+                                    compressed_size_hint)),
           ZstdWriterBase::Options()
               .set_compression_level(compressor_options_.compression_level())
               .set_window_log(compressor_options_.zstd_window_log())
+              .set_dictionary(compressor_options_.zstd_dictionary())
+              .set_num_workers(compressor_options_.zstd_num_workers())
+              .set_job_size(compressor_options_.zstd_job_size())
+              .set_long_distance_matching(
+                  compressor_options_.zstd_long_distance_matching())
+              .set_ldm_hash_log(compressor_options_.zstd_ldm_hash_log())
+              .set_target_length(compressor_options_.zstd_target_length())
+              .set_strategy(compressor_options_.zstd_strategy())
               .set_pledged_size(tuning_options_.pledged_size())
               .set_size_hint(tuning_options_.size_hint()));
       return;
     case CompressionType::kSnappy:
-      writer_ = absl::make_unique<SnappyWriter<ChainWriter<>>>(
-          std::forward_as_tuple(&compressed_),
-          SnappyWriterBase::Options().set_size_hint(
-              tuning_options_.size_hint()));
+      ResetWriter<SnappyWriter<ChainWriter<>>>(
+          writer_,
+          std::forward_as_tuple(&compressed_,
+                                ChainWriterBase::Options().set_size_hint(
+                                    compressed_size_hint)),
+          SnappyWriterBase::Options()
+              .set_size_hint(tuning_options_.size_hint())
+              .set_parallelism(compressor_options_.snappy_parallelism()));
+      return;
+    case CompressionType::kLz4:
+      ResetWriter<Lz4Writer<ChainWriter<>>>(
+          writer_,
+          std::forward_as_tuple(&compressed_,
+                                ChainWriterBase::Options().set_size_hint(
+                                    compressed_size_hint)),
+          Lz4WriterBase::Options()
+              .set_compression_level(compressor_options_.compression_level())
+              .set_pledged_size(tuning_options_.pledged_size())
+              .set_size_hint(tuning_options_.size_hint()));
       return;
   }
   RIEGELI_ASSERT_UNREACHABLE()
@@ -99,6 +179,15 @@ bool Compressor::EncodeAndClose(Writer& dest) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   const Position uncompressed_size = writer().pos();
   if (ABSL_PREDICT_FALSE(!writer().Close())) return Fail(writer());
+  if (recent_uncompressed_size_ == 0) {
+    recent_uncompressed_size_ = uncompressed_size;
+    recent_compressed_size_ = compressed_.size();
+  } else {
+    recent_uncompressed_size_ =
+        recent_uncompressed_size_ / 2 + uncompressed_size / 2;
+    recent_compressed_size_ =
+        recent_compressed_size_ / 2 + compressed_.size() / 2;
+  }
   if (compressor_options_.compression_type() != CompressionType::kNone) {
     if (ABSL_PREDICT_FALSE(
             !WriteVarint64(IntCast<uint64_t>(uncompressed_size), dest))) {
@@ -22,6 +22,7 @@
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
@@ -85,6 +86,10 @@ class Compressor : public Object {
 
   // Resets the `Compressor` back to empty. Keeps compressor options unchanged.
   // Changes tuning options.
+  //
+  // The compression ratio of data compressed before is kept, and is used to
+  // estimate the compressed size of the next data for reserving the output
+  // buffer.
   void Clear(TuningOptions tuning_options);
 
   // Resets the `Compressor` back to empty. Keeps compressor options and tuning
@@ -106,11 +111,24 @@ class Compressor : public Object {
   //  * `false` - failure (`!healthy()`)
   bool EncodeAndClose(Writer& dest);
 
+  // Registers compressed data and compressor state with `MemoryEstimator`.
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const;
+
  private:
   void Initialize();
 
+  // Returns the expected compressed size of the next data, or `absl::nullopt`
+  // if unknown, from their expected uncompressed size and the compression
+  // ratio of recently compressed data.
+  absl::optional<Position> CompressedSizeHint() const;
+
   CompressorOptions compressor_options_;
   TuningOptions tuning_options_;
+  // Moving averages of uncompressed and compressed sizes of recently
+  // compressed data, halving the weight of earlier data with each
+  // `EncodeAndClose()`. Zero if nothing was compressed yet.
+  Position recent_uncompressed_size_ = 0;
+  Position recent_compressed_size_ = 0;
   Chain compressed_;
   std::unique_ptr<Writer> writer_;
 };
@@ -25,6 +25,7 @@
 #include "riegeli/base/options_parser.h"
 #include "riegeli/brotli/brotli_writer.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/lz4/lz4_writer.h"
 #include "riegeli/zstd/zstd_writer.h"
 
 namespace riegeli {
@@ -39,6 +40,9 @@ constexpr int CompressorOptions::kDefaultBrotli;
 constexpr int CompressorOptions::kMinZstd;
 constexpr int CompressorOptions::kMaxZstd;
 constexpr int CompressorOptions::kDefaultZstd;
+constexpr int CompressorOptions::kMinLz4;
+constexpr int CompressorOptions::kMaxLz4;
+constexpr int CompressorOptions::kDefaultLz4;
 constexpr int CompressorOptions::kMinWindowLog;
 constexpr int CompressorOptions::kMaxWindowLog;
 #endif
@@ -50,39 +54,61 @@ absl::Status CompressorOptions::FromString(absl::string_view text) {
     OptionsParser options_parser;
     options_parser.AddOption(
         "uncompressed",
-        ValueParser::And(ValueParser::FailIfSeen("brotli", "zstd", "snappy"),
-                         [this](ValueParser& value_parser) {
-                           compression_type_ = CompressionType::kNone;
-                           return true;
-                         }));
+        ValueParser::And(
+            ValueParser::FailIfSeen("brotli", "zstd", "snappy", "lz4"),
+            [this](ValueParser& value_parser) {
+              compression_type_ = CompressionType::kNone;
+              return true;
+            }));
     options_parser.AddOption(
-        "brotli", ValueParser::And(
-                      ValueParser::FailIfSeen("uncompressed", "zstd", "snappy"),
-                      [this](ValueParser& value_parser) {
-                        compression_type_ = CompressionType::kBrotli;
-                        return true;
-                      }));
+        "brotli",
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "zstd", "snappy", "lz4"),
+            [this](ValueParser& value_parser) {
+              compression_type_ = CompressionType::kBrotli;
+              return true;
+            }));
     options_parser.AddOption(
-        "zstd", ValueParser::And(
-                    ValueParser::FailIfSeen("uncompressed", "brotli", "snappy"),
-                    [this](ValueParser& value_parser) {
-                      compression_type_ = CompressionType::kZstd;
-                      return true;
-                    }));
+        "zstd",
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "brotli", "snappy", "lz4"),
+            [this](ValueParser& value_parser) {
+              compression_type_ = CompressionType::kZstd;
+              return true;
+            }));
     options_parser.AddOption(
-        "snappy", ValueParser::And(
-                      ValueParser::FailIfSeen("uncompressed", "brotli", "zstd"),
-                      [this](ValueParser& value_parser) {
-                        compression_type_ = CompressionType::kSnappy;
-                        return true;
-                      }));
+        "snappy",
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "brotli", "zstd", "lz4"),
+            [this](ValueParser& value_parser) {
+              compression_type_ = CompressionType::kSnappy;
+              return true;
+            }));
+    options_parser.AddOption(
+        "lz4",
+        ValueParser::And(
+            ValueParser::FailIfSeen("uncompressed", "brotli", "zstd", "snappy"),
+            [this](ValueParser& value_parser) {
+              compression_type_ = CompressionType::kLz4;
+              return true;
+            }));
     options_parser.AddOption("window_log",
                              [](ValueParser& value_parser) { return true; });
+    options_parser.AddOption("long_distance_matching",
+                             [](ValueParser& value_parser) { return true; });
+    options_parser.AddOption("ldm_hash_log",
+                             [](ValueParser& value_parser) { return true; });
+    options_parser.AddOption("target_length",
+                             [](ValueParser& value_parser) { return true; });
+    options_parser.AddOption("strategy",
+                             [](ValueParser& value_parser) { return true; });
     if (ABSL_PREDICT_FALSE(!options_parser.FromString(text))) {
       return options_parser.status();
     }
   }
   int window_log;
+  int ldm_hash_log;
+  int target_length;
   OptionsParser options_parser;
   options_parser.AddOption(
       "uncompressed",
@@ -108,6 +134,17 @@ absl::Status CompressorOptions::FromString(absl::string_view text) {
   options_parser.AddOption(
       "snappy", ValueParser::And(ValueParser::FailIfSeen("window_log"),
                                  ValueParser::Empty(0, &compression_level_)));
+  options_parser.AddOption(
+      "lz4",
+      ValueParser::And(
+          ValueParser::FailIfSeen("window_log"),
+          ValueParser::Or(
+              ValueParser::Empty(
+                  Lz4WriterBase::Options::kDefaultCompressionLevel,
+                  &compression_level_),
+              ValueParser::Int(Lz4WriterBase::Options::kMinCompressionLevel,
+                               Lz4WriterBase::Options::kMaxCompressionLevel,
+                               &compression_level_))));
   options_parser.AddOption("window_log", [&] {
     switch (compression_type_) {
       case CompressionType::kNone:
@@ -136,10 +173,73 @@ absl::Status CompressorOptions::FromString(absl::string_view text) {
                 }));
       case CompressionType::kSnappy:
         return ValueParser::FailIfSeen("snappy");
+      case CompressionType::kLz4:
+        return ValueParser::FailIfSeen("lz4");
     }
     RIEGELI_ASSERT_UNREACHABLE() << "Unknown compression type: "
                                  << static_cast<unsigned>(compression_type_);
   }());
+  // Remaining options are specific to Zstd.
+  const auto only_zstd = [this](ValueParser::Function parser) {
+    switch (compression_type_) {
+      case CompressionType::kNone:
+        return ValueParser::FailIfSeen("uncompressed");
+      case CompressionType::kBrotli:
+        return ValueParser::FailIfSeen("brotli");
+      case CompressionType::kZstd:
+        return parser;
+      case CompressionType::kSnappy:
+        return ValueParser::FailIfSeen("snappy");
+      case CompressionType::kLz4:
+        return ValueParser::FailIfSeen("lz4");
+    }
+    RIEGELI_ASSERT_UNREACHABLE() << "Unknown compression type: "
+                                 << static_cast<unsigned>(compression_type_);
+  };
+  options_parser.AddOption(
+      "long_distance_matching",
+      only_zstd(ValueParser::Enum({{"", true},
+                                   {"true", true},
+                                   {"false", false},
+                                   {"auto", absl::nullopt}},
+                                  &zstd_long_distance_matching_)));
+  options_parser.AddOption(
+      "ldm_hash_log",
+      only_zstd(ValueParser::Or(
+          ValueParser::Enum({{"auto", absl::nullopt}}, &zstd_ldm_hash_log_),
+          ValueParser::And(
+              ValueParser::Int(ZstdWriterBase::Options::kMinLdmHashLog,
+                               ZstdWriterBase::Options::kMaxLdmHashLog,
+                               &ldm_hash_log),
+              [this, &ldm_hash_log](ValueParser& value_parser) {
+                zstd_ldm_hash_log_ = ldm_hash_log;
+                return true;
+              }))));
+  options_parser.AddOption(
+      "target_length",
+      only_zstd(ValueParser::Or(
+          ValueParser::Enum({{"auto", absl::nullopt}}, &zstd_target_length_),
+          ValueParser::And(
+              ValueParser::Int(0, ZstdWriterBase::Options::kMaxTargetLength,
+                               &target_length),
+              [this, &target_length](ValueParser& value_parser) {
+                zstd_target_length_ = target_length;
+                return true;
+              }))));
+  options_parser.AddOption(
+      "strategy",
+      only_zstd(ValueParser::Enum(
+          {{"auto", absl::nullopt},
+           {"fast", ZstdWriterBase::Strategy::kFast},
+           {"dfast", ZstdWriterBase::Strategy::kDfast},
+           {"greedy", ZstdWriterBase::Strategy::kGreedy},
+           {"lazy", ZstdWriterBase::Strategy::kLazy},
+           {"lazy2", ZstdWriterBase::Strategy::kLazy2},
+           {"btlazy2", ZstdWriterBase::Strategy::kBtlazy2},
+           {"btopt", ZstdWriterBase::Strategy::kBtopt},
+           {"btultra", ZstdWriterBase::Strategy::kBtultra},
+           {"btultra2", ZstdWriterBase::Strategy::kBtultra2}},
+          &zstd_strategy_)));
   if (ABSL_PREDICT_FALSE(!options_parser.FromString(text))) {
     return options_parser.status();
   }
@@ -15,6 +15,8 @@
 #ifndef RIEGELI_CHUNK_ENCODING_COMPRESSOR_OPTIONS_H_
 #define RIEGELI_CHUNK_ENCODING_COMPRESSOR_OPTIONS_H_
 
+#include <stddef.h>
+
 #include <utility>
 
 #include "absl/status/status.h"
@@ -23,6 +25,7 @@
 #include "riegeli/base/base.h"
 #include "riegeli/brotli/brotli_writer.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/lz4/lz4_writer.h"
 #include "riegeli/zstd/zstd_writer.h"
 
 namespace riegeli {
@@ -39,10 +42,18 @@ class CompressorOptions {
   //     "brotli" (":" brotli_level)? |
   //     "zstd" (":" zstd_level)? |
   //     "snappy" |
-  //     "window_log" ":" window_log
+  //     "window_log" ":" window_log |
+  //     "long_distance_matching" (":" ("true" | "false" | "auto"))? |
+  //     "ldm_hash_log" ":" ldm_hash_log |
+  //     "target_length" ":" target_length |
+  //     "strategy" ":" strategy
   //   brotli_level ::= integer 0..11 (default 6)
   //   zstd_level ::= integer -131072..22 (default 3)
   //   window_log ::= "auto" or integer 10..31
+  //   ldm_hash_log ::= "auto" or integer 6..30
+  //   target_length ::= "auto" or integer 0..131072
+  //   strategy ::= "auto" | "fast" | "dfast" | "greedy" | "lazy" | "lazy2" |
+  //     "btlazy2" | "btopt" | "btultra" | "btultra2"
   // ```
   //
   // Returns status:
@@ -125,6 +136,34 @@ class CompressorOptions {
   }
   CompressorOptions&& set_snappy() && { return std::move(set_snappy()); }
 
+  // Changes compression algorithm to LZ4. Sets compression level which tunes
+  // the tradeoff between compression density and compression speed (higher =
+  // better density but slower).
+  //
+  // Levels from 3 use the LZ4-HC compressor, which is much slower but denser;
+  // decompression is fast at every level.
+  //
+  // `compression_level` must be between `kMinLz4` (-65537) and `kMaxLz4` (12).
+  // Default: `kDefaultLz4` (0).
+  static constexpr int kMinLz4 = Lz4WriterBase::Options::kMinCompressionLevel;
+  static constexpr int kMaxLz4 = Lz4WriterBase::Options::kMaxCompressionLevel;
+  static constexpr int kDefaultLz4 =
+      Lz4WriterBase::Options::kDefaultCompressionLevel;
+  CompressorOptions& set_lz4(int compression_level = kDefaultLz4) & {
+    RIEGELI_ASSERT_GE(compression_level, kMinLz4)
+        << "Failed precondition of CompressorOptions::set_lz4(): "
+           "compression level out of range";
+    RIEGELI_ASSERT_LE(compression_level, kMaxLz4)
+        << "Failed precondition of CompressorOptions::set_lz4(): "
+           "compression level out of range";
+    compression_type_ = CompressionType::kLz4;
+    compression_level_ = compression_level;
+    return *this;
+  }
+  CompressorOptions&& set_lz4(int compression_level = kDefaultLz4) && {
+    return std::move(set_lz4(compression_level));
+  }
+
   CompressionType compression_type() const { return compression_type_; }
 
   int compression_level() const { return compression_level_; }
@@ -136,7 +175,7 @@ class CompressorOptions {
   // Special value `absl::nullopt` means to keep the default (Brotli: 22,
   // Zstd: derived from compression level and chunk size).
   //
-  // For Uncompressed and Snappy, `window_log` must be `absl::nullopt`.
+  // For Uncompressed, Snappy, and LZ4, `window_log` must be `absl::nullopt`.
   //
   // For Brotli, `window_log` must be `absl::nullopt` or between
   // `BrotliWriterBase::Options::kMinWindowLog` (10) and
@@ -171,6 +210,210 @@ class CompressorOptions {
   }
   absl::optional<int> window_log() const { return window_log_; }
 
+  // Zstd dictionary, used if `compression_type() == CompressionType::kZstd`.
+  // The same dictionary must be used for decompression.
+  //
+  // A dictionary trained on samples of records allows to keep compression
+  // density with smaller chunks.
+  //
+  // Default: `ZstdWriterBase::Dictionary()` (no dictionary).
+  CompressorOptions& set_zstd_dictionary(
+      const ZstdWriterBase::Dictionary& zstd_dictionary) & {
+    zstd_dictionary_ = zstd_dictionary;
+    return *this;
+  }
+  CompressorOptions& set_zstd_dictionary(
+      ZstdWriterBase::Dictionary&& zstd_dictionary) & {
+    zstd_dictionary_ = std::move(zstd_dictionary);
+    return *this;
+  }
+  CompressorOptions&& set_zstd_dictionary(
+      const ZstdWriterBase::Dictionary& zstd_dictionary) && {
+    return std::move(set_zstd_dictionary(zstd_dictionary));
+  }
+  CompressorOptions&& set_zstd_dictionary(
+      ZstdWriterBase::Dictionary&& zstd_dictionary) && {
+    return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+  }
+  ZstdWriterBase::Dictionary& zstd_dictionary() { return zstd_dictionary_; }
+  const ZstdWriterBase::Dictionary& zstd_dictionary() const {
+    return zstd_dictionary_;
+  }
+
+  // Brotli dictionary, used if
+  // `compression_type() == CompressionType::kBrotli`. The same dictionary must
+  // be used for decompression.
+  //
+  // The dictionary is prepared once per compression level and shared by all
+  // compressors using copies of the same `BrotliWriterBase::Dictionary`.
+  //
+  // Default: `BrotliWriterBase::Dictionary()` (no dictionary).
+  CompressorOptions& set_brotli_dictionary(
+      const BrotliWriterBase::Dictionary& brotli_dictionary) & {
+    brotli_dictionary_ = brotli_dictionary;
+    return *this;
+  }
+  CompressorOptions& set_brotli_dictionary(
+      BrotliWriterBase::Dictionary&& brotli_dictionary) & {
+    brotli_dictionary_ = std::move(brotli_dictionary);
+    return *this;
+  }
+  CompressorOptions&& set_brotli_dictionary(
+      const BrotliWriterBase::Dictionary& brotli_dictionary) && {
+    return std::move(set_brotli_dictionary(brotli_dictionary));
+  }
+  CompressorOptions&& set_brotli_dictionary(
+      BrotliWriterBase::Dictionary&& brotli_dictionary) && {
+    return std::move(set_brotli_dictionary(std::move(brotli_dictionary)));
+  }
+  BrotliWriterBase::Dictionary& brotli_dictionary() {
+    return brotli_dictionary_;
+  }
+  const BrotliWriterBase::Dictionary& brotli_dictionary() const {
+    return brotli_dictionary_;
+  }
+
+  // Maximum number of threads compressing one chunk with Snappy, see
+  // `SnappyWriterBase::Options::set_parallelism()`. The compressed chunk is the
+  // same regardless of parallelism.
+  //
+  // Default: 1.
+  CompressorOptions& set_snappy_parallelism(int snappy_parallelism) & {
+    RIEGELI_ASSERT_GT(snappy_parallelism, 0)
+        << "Failed precondition of "
+           "CompressorOptions::set_snappy_parallelism(): "
+           "non-positive parallelism";
+    snappy_parallelism_ = snappy_parallelism;
+    return *this;
+  }
+  CompressorOptions&& set_snappy_parallelism(int snappy_parallelism) && {
+    return std::move(set_snappy_parallelism(snappy_parallelism));
+  }
+  int snappy_parallelism() const { return snappy_parallelism_; }
+
+  // Number of worker threads compressing one chunk with Zstd, see
+  // `ZstdWriterBase::Options::set_num_workers()`. Zstd splits data into jobs of
+  // `zstd_job_size()`, so this helps only for chunks larger than a job.
+  //
+  // Default: 0 (compress in the encoding thread).
+  CompressorOptions& set_zstd_num_workers(int zstd_num_workers) & {
+    RIEGELI_ASSERT_GE(zstd_num_workers, 0)
+        << "Failed precondition of "
+           "CompressorOptions::set_zstd_num_workers(): "
+           "negative number of workers";
+    zstd_num_workers_ = zstd_num_workers;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_num_workers(int zstd_num_workers) && {
+    return std::move(set_zstd_num_workers(zstd_num_workers));
+  }
+  int zstd_num_workers() const { return zstd_num_workers_; }
+
+  // Size of a Zstd compression job if `zstd_num_workers() > 0`, see
+  // `ZstdWriterBase::Options::set_job_size()`.
+  //
+  // Default: `absl::nullopt` (derived from the window size).
+  CompressorOptions& set_zstd_job_size(absl::optional<size_t> zstd_job_size) & {
+    zstd_job_size_ = zstd_job_size;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_job_size(
+      absl::optional<size_t> zstd_job_size) && {
+    return std::move(set_zstd_job_size(zstd_job_size));
+  }
+  absl::optional<size_t> zstd_job_size() const { return zstd_job_size_; }
+
+  // Whether Zstd uses long distance matching, see
+  // `ZstdWriterBase::Options::set_long_distance_matching()`. This helps large
+  // chunks written with a large `window_log()`.
+  //
+  // Default: `absl::nullopt` (derived from other parameters).
+  CompressorOptions& set_zstd_long_distance_matching(
+      absl::optional<bool> zstd_long_distance_matching) & {
+    zstd_long_distance_matching_ = zstd_long_distance_matching;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_long_distance_matching(
+      absl::optional<bool> zstd_long_distance_matching) && {
+    return std::move(
+        set_zstd_long_distance_matching(zstd_long_distance_matching));
+  }
+  absl::optional<bool> zstd_long_distance_matching() const {
+    return zstd_long_distance_matching_;
+  }
+
+  // Logarithm of the size of the Zstd long distance matching hash table, see
+  // `ZstdWriterBase::Options::set_ldm_hash_log()`.
+  //
+  // Default: `absl::nullopt` (derived from `window_log()`).
+  CompressorOptions& set_zstd_ldm_hash_log(
+      absl::optional<int> zstd_ldm_hash_log) & {
+    if (zstd_ldm_hash_log != absl::nullopt) {
+      RIEGELI_ASSERT_GE(*zstd_ldm_hash_log,
+                        ZstdWriterBase::Options::kMinLdmHashLog)
+          << "Failed precondition of "
+             "CompressorOptions::set_zstd_ldm_hash_log(): "
+             "LDM hash log out of range";
+      RIEGELI_ASSERT_LE(*zstd_ldm_hash_log,
+                        ZstdWriterBase::Options::kMaxLdmHashLog)
+          << "Failed precondition of "
+             "CompressorOptions::set_zstd_ldm_hash_log(): "
+             "LDM hash log out of range";
+    }
+    zstd_ldm_hash_log_ = zstd_ldm_hash_log;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_ldm_hash_log(
+      absl::optional<int> zstd_ldm_hash_log) && {
+    return std::move(set_zstd_ldm_hash_log(zstd_ldm_hash_log));
+  }
+  absl::optional<int> zstd_ldm_hash_log() const { return zstd_ldm_hash_log_; }
+
+  // Zstd target match length, see
+  // `ZstdWriterBase::Options::set_target_length()`.
+  //
+  // Default: `absl::nullopt` (derived from compression level).
+  CompressorOptions& set_zstd_target_length(
+      absl::optional<int> zstd_target_length) & {
+    if (zstd_target_length != absl::nullopt) {
+      RIEGELI_ASSERT_GE(*zstd_target_length, 0)
+          << "Failed precondition of "
+             "CompressorOptions::set_zstd_target_length(): "
+             "target length out of range";
+      RIEGELI_ASSERT_LE(*zstd_target_length,
+                        ZstdWriterBase::Options::kMaxTargetLength)
+          << "Failed precondition of "
+             "CompressorOptions::set_zstd_target_length(): "
+             "target length out of range";
+    }
+    zstd_target_length_ = zstd_target_length;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_target_length(
+      absl::optional<int> zstd_target_length) && {
+    return std::move(set_zstd_target_length(zstd_target_length));
+  }
+  absl::optional<int> zstd_target_length() const {
+    return zstd_target_length_;
+  }
+
+  // Zstd match finding strategy, see
+  // `ZstdWriterBase::Options::set_strategy()`.
+  //
+  // Default: `absl::nullopt` (derived from compression level).
+  CompressorOptions& set_zstd_strategy(
+      absl::optional<ZstdWriterBase::Strategy> zstd_strategy) & {
+    zstd_strategy_ = zstd_strategy;
+    return *this;
+  }
+  CompressorOptions&& set_zstd_strategy(
+      absl::optional<ZstdWriterBase::Strategy> zstd_strategy) && {
+    return std::move(set_zstd_strategy(zstd_strategy));
+  }
+  absl::optional<ZstdWriterBase::Strategy> zstd_strategy() const {
+    return zstd_strategy_;
+  }
+
   // Returns `window_log()` translated for `BrotliWriter`.
   //
   // Precondition: `compression_type() == CompressionType::kBrotli`
@@ -185,6 +428,15 @@ class CompressorOptions {
   CompressionType compression_type_ = CompressionType::kBrotli;
   int compression_level_ = kDefaultBrotli;
   absl::optional<int> window_log_;
+  ZstdWriterBase::Dictionary zstd_dictionary_;
+  BrotliWriterBase::Dictionary brotli_dictionary_;
+  int snappy_parallelism_ = 1;
+  int zstd_num_workers_ = 0;
+  absl::optional<size_t> zstd_job_size_;
+  absl::optional<bool> zstd_long_distance_matching_;
+  absl::optional<int> zstd_ldm_hash_log_;
+  absl::optional<int> zstd_target_length_;
+  absl::optional<ZstdWriterBase::Strategy> zstd_strategy_;
 };
 
 }  // namespace riegeli
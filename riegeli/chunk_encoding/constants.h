@@ -30,6 +30,10 @@ enum class ChunkType : uint8_t {
   kPadding = 'p',
   kSimple = 'r',
   kTransposed = 't',
+  kDeduplicated = 'd',
+  kReferencing = 'x',
+  kChunkIndex = 'i',
+  kFileSummary = 'f',
 };
 
 // These values are frozen in the file format.
@@ -38,6 +42,17 @@ enum class CompressionType : uint8_t {
   kBrotli = 'b',
   kZstd = 'z',
   kSnappy = 's',
+  kLz4 = 'l',
+};
+
+// Hash function protecting chunk headers, chunk data, and block headers.
+//
+// The hash function is not stored separately: a CRC32C hash value is marked
+// by `internal::kCrc32cHashTag` in its high 32 bits, and readers recognize it
+// (see `internal::HashLike()`).
+enum class HashType {
+  kHighwayHash,
+  kCrc32c,
 };
 
 RIEGELI_INTERNAL_INLINE_CONSTEXPR(uint64_t, kMaxNumRecords,
@@ -0,0 +1,66 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_DECOMPRESSION_BACKEND_H_
+#define RIEGELI_CHUNK_ENCODING_DECOMPRESSION_BACKEND_H_
+
+#include <stdint.h>
+
+#include "absl/status/status.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/chunk_encoding/constants.h"
+
+namespace riegeli {
+
+// An alternative implementation of decompressing chunk data, e.g. offloading
+// it to an accelerator such as a GPU with nvCOMP.
+//
+// Each compressed stream of a chunk (record sizes and values of a simple
+// chunk, the header, buckets, and transitions of a transposed chunk) is
+// offered to the backend as a whole. Streams compressed with a dictionary are
+// always decompressed on the CPU.
+//
+// Member functions are called concurrently from multiple threads when chunks
+// or buckets are decoded in parallel, e.g. with
+// `RecordReaderBase::Options::set_parallelism()`. A backend which benefits
+// from batching can gather concurrent calls into a batch before launching
+// work on the device.
+class DecompressionBackend {
+ public:
+  virtual ~DecompressionBackend() {}
+
+  // Returns `true` if streams compressed with `compression_type` should be
+  // passed to `Decompress()`. Otherwise they are decompressed on the CPU.
+  //
+  // `compression_type` is never `CompressionType::kNone`.
+  virtual bool Supports(CompressionType compression_type) = 0;
+
+  // Decompresses `src`, compressed with `compression_type`, appending
+  // `uncompressed_size` bytes to `dest`. `src` does not include the varint
+  // with the uncompressed size which precedes compressed data in a chunk.
+  //
+  // Failure is not fatal: the stream is then decompressed on the CPU, which
+  // also reports corrupted data with its usual message.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success (`uncompressed_size` bytes appended to `dest`)
+  //  * `!status.ok()` - failure (`dest` is unspecified)
+  virtual absl::Status Decompress(CompressionType compression_type,
+                                  const Chain& src, uint64_t uncompressed_size,
+                                  Chain& dest) = 0;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_DECOMPRESSION_BACKEND_H_
@@ -31,9 +31,12 @@
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/brotli/brotli_reader.h"
+#include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/wrapped_reader.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/decompression_backend.h"
+#include "riegeli/lz4/lz4_reader.h"
 #include "riegeli/snappy/snappy_reader.h"
 #include "riegeli/varint/varint_reading.h"
 #include "riegeli/zstd/zstd_reader.h"
@@ -55,6 +58,15 @@ absl::optional<uint64_t> UncompressedSize(const Chain& compressed_data,
 //
 // If `compression_type` is not `kNone`, reads uncompressed size as a varint
 // from the beginning of compressed data.
+//
+// If `compression_type` is `kZstd`, `zstd_dictionary` must be the dictionary
+// used for compression. Similarly, if `compression_type` is `kBrotli`,
+// `brotli_dictionary` must be the dictionary used for compression.
+//
+// If `decompression_backend` is not `nullptr` and supports `compression_type`,
+// and no dictionary applies, compressed data are read whole and decompressed
+// by `decompression_backend`, falling back to decompressing them here if that
+// fails.
 template <typename Src = Reader*>
 class Decompressor : public Object {
  public:
@@ -62,15 +74,30 @@ class Decompressor : public Object {
   Decompressor() noexcept : Object(kInitiallyClosed) {}
 
   // Will read from the compressed stream provided by `src`.
-  explicit Decompressor(const Src& src, CompressionType compression_type);
-  explicit Decompressor(Src&& src, CompressionType compression_type);
+  explicit Decompressor(const Src& src, CompressionType compression_type,
+                        const ZstdReaderBase::Dictionary& zstd_dictionary =
+                            ZstdReaderBase::Dictionary(),
+                        const BrotliReaderBase::Dictionary& brotli_dictionary =
+                            BrotliReaderBase::Dictionary(),
+                        DecompressionBackend* decompression_backend = nullptr);
+  explicit Decompressor(Src&& src, CompressionType compression_type,
+                        const ZstdReaderBase::Dictionary& zstd_dictionary =
+                            ZstdReaderBase::Dictionary(),
+                        const BrotliReaderBase::Dictionary& brotli_dictionary =
+                            BrotliReaderBase::Dictionary(),
+                        DecompressionBackend* decompression_backend = nullptr);
 
   // Will read from the compressed stream provided by a `Src` constructed from
   // elements of `src_args`. This avoids constructing a temporary `Src` and
   // moving from it.
   template <typename... SrcArgs>
   explicit Decompressor(std::tuple<SrcArgs...> src_args,
-                        CompressionType compression_type);
+                        CompressionType compression_type,
+                        const ZstdReaderBase::Dictionary& zstd_dictionary =
+                            ZstdReaderBase::Dictionary(),
+                        const BrotliReaderBase::Dictionary& brotli_dictionary =
+                            BrotliReaderBase::Dictionary(),
+                        DecompressionBackend* decompression_backend = nullptr);
 
   Decompressor(Decompressor&& that) noexcept;
   Decompressor& operator=(Decompressor&& that) noexcept;
@@ -78,10 +105,25 @@ class Decompressor : public Object {
   // Makes `*this` equivalent to a newly constructed `Decompressor`. This avoids
   // constructing a temporary `Decompressor` and moving from it.
   void Reset();
-  void Reset(const Src& src, CompressionType compression_type);
-  void Reset(Src&& src, CompressionType compression_type);
+  void Reset(const Src& src, CompressionType compression_type,
+             const ZstdReaderBase::Dictionary& zstd_dictionary =
+                 ZstdReaderBase::Dictionary(),
+             const BrotliReaderBase::Dictionary& brotli_dictionary =
+                 BrotliReaderBase::Dictionary(),
+             DecompressionBackend* decompression_backend = nullptr);
+  void Reset(Src&& src, CompressionType compression_type,
+             const ZstdReaderBase::Dictionary& zstd_dictionary =
+                 ZstdReaderBase::Dictionary(),
+             const BrotliReaderBase::Dictionary& brotli_dictionary =
+                 BrotliReaderBase::Dictionary(),
+             DecompressionBackend* decompression_backend = nullptr);
   template <typename... SrcArgs>
-  void Reset(std::tuple<SrcArgs...> src_args, CompressionType compression_type);
+  void Reset(std::tuple<SrcArgs...> src_args, CompressionType compression_type,
+             const ZstdReaderBase::Dictionary& zstd_dictionary =
+                 ZstdReaderBase::Dictionary(),
+             const BrotliReaderBase::Dictionary& brotli_dictionary =
+                 BrotliReaderBase::Dictionary(),
+             DecompressionBackend* decompression_backend = nullptr);
 
   // Returns the `Reader` from which uncompressed data should be read.
   //
@@ -109,7 +151,16 @@ class Decompressor : public Object {
 
  private:
   template <typename SrcInit>
-  void Initialize(SrcInit&& src_init, CompressionType compression_type);
+  void Initialize(SrcInit&& src_init, CompressionType compression_type,
+                  const ZstdReaderBase::Dictionary& zstd_dictionary,
+                  const BrotliReaderBase::Dictionary& brotli_dictionary,
+                  DecompressionBackend* decompression_backend);
+  template <typename CompressedSrc, typename CompressedSrcInit>
+  void InitializeReader(CompressedSrcInit&& compressed_src_init,
+                        CompressionType compression_type,
+                        uint64_t uncompressed_size,
+                        const ZstdReaderBase::Dictionary& zstd_dictionary,
+                        const BrotliReaderBase::Dictionary& brotli_dictionary);
 
   std::unique_ptr<Reader> reader_;
 };
@@ -117,25 +168,37 @@ class Decompressor : public Object {
 // Implementation details follow.
 
 template <typename Src>
-inline Decompressor<Src>::Decompressor(const Src& src,
-                                       CompressionType compression_type)
+inline Decompressor<Src>::Decompressor(
+    const Src& src, CompressionType compression_type,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend)
     : Object(kInitiallyOpen) {
-  Initialize(src, compression_type);
+  Initialize(src, compression_type, zstd_dictionary, brotli_dictionary,
+             decompression_backend);
 }
 
 template <typename Src>
-inline Decompressor<Src>::Decompressor(Src&& src,
-                                       CompressionType compression_type)
+inline Decompressor<Src>::Decompressor(
+    Src&& src, CompressionType compression_type,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend)
     : Object(kInitiallyOpen) {
-  Initialize(std::move(src), compression_type);
+  Initialize(std::move(src), compression_type, zstd_dictionary,
+             brotli_dictionary, decompression_backend);
 }
 
 template <typename Src>
 template <typename... SrcArgs>
-inline Decompressor<Src>::Decompressor(std::tuple<SrcArgs...> src_args,
-                                       CompressionType compression_type)
+inline Decompressor<Src>::Decompressor(
+    std::tuple<SrcArgs...> src_args, CompressionType compression_type,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend)
     : Object(kInitiallyOpen) {
-  Initialize(std::move(src_args), compression_type);
+  Initialize(std::move(src_args), compression_type, zstd_dictionary,
+             brotli_dictionary, decompression_backend);
 }
 
 template <typename Src>
@@ -162,31 +225,46 @@ inline void Decompressor<Src>::Reset() {
 }
 
 template <typename Src>
-inline void Decompressor<Src>::Reset(const Src& src,
-                                     CompressionType compression_type) {
+inline void Decompressor<Src>::Reset(
+    const Src& src, CompressionType compression_type,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend) {
   Object::Reset(kInitiallyOpen);
-  Initialize(src, compression_type);
+  Initialize(src, compression_type, zstd_dictionary, brotli_dictionary,
+             decompression_backend);
 }
 
 template <typename Src>
-inline void Decompressor<Src>::Reset(Src&& src,
-                                     CompressionType compression_type) {
+inline void Decompressor<Src>::Reset(
+    Src&& src, CompressionType compression_type,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend) {
   Object::Reset(kInitiallyOpen);
-  Initialize(std::move(src), compression_type);
+  Initialize(std::move(src), compression_type, zstd_dictionary,
+             brotli_dictionary, decompression_backend);
 }
 
 template <typename Src>
 template <typename... SrcArgs>
-inline void Decompressor<Src>::Reset(std::tuple<SrcArgs...> src_args,
-                                     CompressionType compression_type) {
+inline void Decompressor<Src>::Reset(
+    std::tuple<SrcArgs...> src_args, CompressionType compression_type,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend) {
   Object::Reset(kInitiallyOpen);
-  Initialize(std::move(src_args), compression_type);
+  Initialize(std::move(src_args), compression_type, zstd_dictionary,
+             brotli_dictionary, decompression_backend);
 }
 
 template <typename Src>
 template <typename SrcInit>
-void Decompressor<Src>::Initialize(SrcInit&& src_init,
-                                   CompressionType compression_type) {
+void Decompressor<Src>::Initialize(
+    SrcInit&& src_init, CompressionType compression_type,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend) {
   if (compression_type == CompressionType::kNone) {
     reader_ =
         absl::make_unique<WrappedReader<Src>>(std::forward<SrcInit>(src_init));
@@ -201,21 +279,73 @@ void Decompressor<Src>::Initialize(SrcInit&& src_init,
     Fail(*compressed_reader);
     return;
   }
+  if (decompression_backend != nullptr &&
+      !(compression_type == CompressionType::kZstd &&
+        !zstd_dictionary.empty()) &&
+      !(compression_type == CompressionType::kBrotli &&
+        !brotli_dictionary.empty()) &&
+      decompression_backend->Supports(compression_type)) {
+    Chain compressed;
+    if (ABSL_PREDICT_FALSE(!compressed_reader->ReadAll(compressed))) {
+      Fail(*compressed_reader);
+      return;
+    }
+    if (compressed_reader.is_owning()) {
+      if (ABSL_PREDICT_FALSE(!compressed_reader->Close())) {
+        Fail(*compressed_reader);
+        return;
+      }
+    }
+    Chain uncompressed;
+    if (ABSL_PREDICT_TRUE(decompression_backend
+                              ->Decompress(compression_type, compressed,
+                                           *uncompressed_size, uncompressed)
+                              .ok() &&
+                          uncompressed.size() == *uncompressed_size)) {
+      reader_ =
+          absl::make_unique<ChainReader<Chain>>(std::move(uncompressed));
+      return;
+    }
+    InitializeReader<ChainReader<Chain>>(
+        std::forward_as_tuple(std::move(compressed)), compression_type,
+        *uncompressed_size, zstd_dictionary, brotli_dictionary);
+    return;
+  }
+  InitializeReader<Src>(std::move(compressed_reader.manager()),
+                        compression_type, *uncompressed_size, zstd_dictionary,
+                        brotli_dictionary);
+}
+
+template <typename Src>
+template <typename CompressedSrc, typename CompressedSrcInit>
+void Decompressor<Src>::InitializeReader(
+    CompressedSrcInit&& compressed_src_init, CompressionType compression_type,
+    uint64_t uncompressed_size,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary) {
   switch (compression_type) {
     case CompressionType::kNone:
       RIEGELI_ASSERT_UNREACHABLE() << "kNone handled above";
     case CompressionType::kBrotli:
-      reader_ = absl::make_unique<BrotliReader<Src>>(
-          std::move(compressed_reader.manager()));
+      reader_ = absl::make_unique<BrotliReader<CompressedSrc>>(
+          std::forward<CompressedSrcInit>(compressed_src_init),
+          BrotliReaderBase::Options().set_dictionary(brotli_dictionary));
       return;
     case CompressionType::kZstd:
-      reader_ = absl::make_unique<ZstdReader<Src>>(
-          std::move(compressed_reader.manager()),
-          ZstdReaderBase::Options().set_size_hint(*uncompressed_size));
+      reader_ = absl::make_unique<ZstdReader<CompressedSrc>>(
+          std::forward<CompressedSrcInit>(compressed_src_init),
+          ZstdReaderBase::Options()
+              .set_dictionary(zstd_dictionary)
+              .set_size_hint(uncompressed_size));
       return;
     case CompressionType::kSnappy:
-      reader_ = absl::make_unique<SnappyReader<Src>>(
-          std::move(compressed_reader.manager()));
+      reader_ = absl::make_unique<SnappyReader<CompressedSrc>>(
+          std::forward<CompressedSrcInit>(compressed_src_init));
+      return;
+    case CompressionType::kLz4:
+      reader_ = absl::make_unique<Lz4Reader<CompressedSrc>>(
+          std::forward<CompressedSrcInit>(compressed_src_init),
+          Lz4ReaderBase::Options().set_size_hint(uncompressed_size));
       return;
   }
   Fail(absl::DataLossError(absl::StrCat(
@@ -0,0 +1,272 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/deduplicating_encoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <cstring>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/hash/hash.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/messages/message_serialize.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+
+void DeduplicatingEncoder::Clear() {
+  ChunkEncoder::Clear();
+  base_encoder_->Clear();
+  unique_records_.Clear();
+  unique_limits_.clear();
+  unique_indices_.clear();
+  indices_compressor_.Clear();
+}
+
+void DeduplicatingEncoder::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  ChunkEncoder::RegisterSubobjects(memory_estimator);
+  base_encoder_->RegisterSubobjects(memory_estimator);
+  unique_records_.RegisterSubobjects(memory_estimator);
+  memory_estimator.RegisterDynamicMemory(unique_limits_.capacity() *
+                                         sizeof(size_t));
+  memory_estimator.RegisterDynamicMemory(
+      unique_indices_.capacity() *
+      (sizeof(std::pair<const size_t, absl::InlinedVector<uint64_t, 1>>) +
+       1));
+  for (const auto& entry : unique_indices_) {
+    if (entry.second.capacity() > 1) {
+      memory_estimator.RegisterDynamicMemory(entry.second.capacity() *
+                                             sizeof(uint64_t));
+    }
+  }
+  indices_compressor_.RegisterSubobjects(memory_estimator);
+}
+
+bool DeduplicatingEncoder::AddRecord(
+    const google::protobuf::MessageLite& record,
+    SerializeOptions serialize_options) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  std::string serialized;
+  {
+    absl::Status status =
+        SerializeToString(record, serialized, std::move(serialize_options));
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      return Fail(std::move(status));
+    }
+  }
+  const absl::string_view contents = serialized;
+  return AddRecordImpl(contents, std::move(serialized));
+}
+
+bool DeduplicatingEncoder::AddRecord(absl::string_view record) {
+  return AddRecordImpl(record, record);
+}
+
+bool DeduplicatingEncoder::AddRecord(const Chain& record) {
+  if (const absl::optional<absl::string_view> flat = record.TryFlat()) {
+    return AddRecordImpl(*flat, record);
+  }
+  const std::string contents(record);
+  return AddRecordImpl(contents, record);
+}
+
+bool DeduplicatingEncoder::AddRecord(Chain&& record) {
+  if (const absl::optional<absl::string_view> flat = record.TryFlat()) {
+    return AddRecordImpl(*flat, std::move(record));
+  }
+  const std::string contents(record);
+  return AddRecordImpl(contents, std::move(record));
+}
+
+bool DeduplicatingEncoder::AddRecord(const absl::Cord& record) {
+  if (const absl::optional<absl::string_view> flat = record.TryFlat()) {
+    return AddRecordImpl(*flat, record);
+  }
+  const std::string contents(record);
+  return AddRecordImpl(contents, record);
+}
+
+bool DeduplicatingEncoder::AddRecord(absl::Cord&& record) {
+  if (const absl::optional<absl::string_view> flat = record.TryFlat()) {
+    return AddRecordImpl(*flat, std::move(record));
+  }
+  const std::string contents(record);
+  return AddRecordImpl(contents, std::move(record));
+}
+
+template <typename Record>
+bool DeduplicatingEncoder::AddRecordImpl(absl::string_view contents,
+                                         Record&& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(num_records_ == kMaxNumRecords)) {
+    return Fail(absl::ResourceExhaustedError("Too many records"));
+  }
+  if (ABSL_PREDICT_FALSE(contents.size() >
+                         std::numeric_limits<uint64_t>::max() -
+                             decoded_data_size_)) {
+    return Fail(absl::ResourceExhaustedError("Decoded data size too large"));
+  }
+  // 0 marks a new distinct record, which keeps indices of mostly distinct
+  // records compressible.
+  uint64_t index = 0;
+  absl::InlinedVector<uint64_t, 1>& candidates =
+      unique_indices_[absl::Hash<absl::string_view>()(contents)];
+  for (const uint64_t candidate : candidates) {
+    if (UniqueRecordEquals(candidate, contents)) {
+      index = candidate + 1;
+      break;
+    }
+  }
+  if (index == 0) {
+    candidates.push_back(IntCast<uint64_t>(unique_limits_.size()));
+    // `contents` are measured before `record` is moved from, because they may
+    // share storage.
+    const size_t limit = unique_records_.size() + contents.size();
+    unique_records_.Append(std::forward<Record>(record));
+    unique_limits_.push_back(limit);
+  }
+  ++num_records_;
+  decoded_data_size_ += IntCast<uint64_t>(contents.size());
+  if (ABSL_PREDICT_FALSE(
+          !WriteVarint64(index, indices_compressor_.writer()))) {
+    return Fail(indices_compressor_.writer());
+  }
+  return true;
+}
+
+bool DeduplicatingEncoder::UniqueRecordEquals(
+    uint64_t index, absl::string_view contents) const {
+  RIEGELI_ASSERT_LT(index, unique_limits_.size())
+      << "Failed precondition of DeduplicatingEncoder::UniqueRecordEquals(): "
+         "index out of range";
+  const size_t begin = index == 0 ? size_t{0} : unique_limits_[index - 1];
+  if (unique_limits_[index] - begin != contents.size()) return false;
+  if (contents.empty()) return true;
+  Chain::CharPosition position = unique_records_.FindPosition(begin);
+  for (;;) {
+    const absl::string_view fragment =
+        position.block_iter->substr(position.char_index);
+    const size_t length = UnsignedMin(fragment.size(), contents.size());
+    if (std::memcmp(fragment.data(), contents.data(), length) != 0) {
+      return false;
+    }
+    contents.remove_prefix(length);
+    if (contents.empty()) return true;
+    ++position.block_iter;
+    position.char_index = 0;
+  }
+}
+
+bool DeduplicatingEncoder::AddRecords(Chain records,
+                                      std::vector<size_t> limits) {
+  RIEGELI_ASSERT_EQ(limits.empty() ? 0u : limits.back(), records.size())
+      << "Failed precondition of ChunkEncoder::AddRecords(): "
+         "record end positions do not match concatenated record values";
+  ChainReader<> records_reader(&records);
+  for (const size_t limit : limits) {
+    // `contents` point into `records` unless the record spans blocks.
+    absl::string_view contents;
+    if (ABSL_PREDICT_FALSE(!records_reader.Read(limit - records_reader.pos(),
+                                                contents))) {
+      return Fail(records_reader);
+    }
+    if (ABSL_PREDICT_FALSE(!AddRecordImpl(contents, contents))) return false;
+  }
+  if (!records_reader.Close()) return Fail(records_reader);
+  return true;
+}
+
+bool DeduplicatingEncoder::EncodeAndClose(Writer& dest, ChunkType& chunk_type,
+                                          uint64_t& num_records,
+                                          uint64_t& decoded_data_size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const uint64_t expected_num_unique_records =
+      IntCast<uint64_t>(unique_limits_.size());
+  if (ABSL_PREDICT_FALSE(!base_encoder_->AddRecords(
+          std::move(unique_records_), std::move(unique_limits_)))) {
+    return Fail(*base_encoder_);
+  }
+  if (expected_num_unique_records == num_records_) {
+    // There are no repeated records. Record indices would be redundant.
+    if (ABSL_PREDICT_FALSE(!base_encoder_->EncodeAndClose(
+            dest, chunk_type, num_records, decoded_data_size))) {
+      return Fail(*base_encoder_);
+    }
+    return Close();
+  }
+  chunk_type = ChunkType::kDeduplicated;
+  num_records = num_records_;
+  decoded_data_size = decoded_data_size_;
+
+  ChainWriter<Chain> unique_writer(std::forward_as_tuple());
+  ChunkType unique_chunk_type;
+  uint64_t num_unique_records;
+  uint64_t unique_data_size;
+  if (ABSL_PREDICT_FALSE(!base_encoder_->EncodeAndClose(
+          unique_writer, unique_chunk_type, num_unique_records,
+          unique_data_size))) {
+    return Fail(*base_encoder_);
+  }
+  if (ABSL_PREDICT_FALSE(!unique_writer.Close())) return Fail(unique_writer);
+  RIEGELI_ASSERT_EQ(num_unique_records, expected_num_unique_records)
+      << "Base encoder encoded a wrong number of records";
+
+  if (ABSL_PREDICT_FALSE(!WriteVarint64(num_unique_records, dest)) ||
+      ABSL_PREDICT_FALSE(!WriteVarint64(unique_data_size, dest)) ||
+      ABSL_PREDICT_FALSE(
+          !dest.WriteByte(static_cast<uint8_t>(compression_type_)))) {
+    return Fail(dest);
+  }
+
+  ChainWriter<Chain> compressed_indices_writer(std::forward_as_tuple());
+  if (ABSL_PREDICT_FALSE(
+          !indices_compressor_.EncodeAndClose(compressed_indices_writer))) {
+    return Fail(indices_compressor_);
+  }
+  if (ABSL_PREDICT_FALSE(!compressed_indices_writer.Close())) {
+    return Fail(compressed_indices_writer);
+  }
+  if (ABSL_PREDICT_FALSE(!WriteVarint64(
+          IntCast<uint64_t>(compressed_indices_writer.dest().size()), dest)) ||
+      ABSL_PREDICT_FALSE(
+          !dest.Write(std::move(compressed_indices_writer.dest()))) ||
+      ABSL_PREDICT_FALSE(
+          !dest.WriteByte(static_cast<uint8_t>(unique_chunk_type))) ||
+      ABSL_PREDICT_FALSE(!dest.Write(std::move(unique_writer.dest())))) {
+    return Fail(dest);
+  }
+  return Close();
+}
+
+}  // namespace riegeli
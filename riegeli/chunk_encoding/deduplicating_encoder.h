@@ -0,0 +1,127 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_DEDUPLICATING_ENCODER_H_
+#define RIEGELI_CHUNK_ENCODING_DEDUPLICATING_ENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/compressor.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/messages/message_serialize.h"
+
+namespace riegeli {
+
+// `DeduplicatingEncoder` passes only the first occurrence of each distinct
+// record to the base encoder, and encodes the sequence of records as indices
+// of distinct records. Repeated records are then neither encoded nor stored
+// again, and the decoder shares their bytes.
+//
+// Distinct records are stored once, and are passed to the base encoder when
+// the chunk is encoded.
+//
+// If the chunk has no repeated records, the chunk of the base encoder is used
+// directly.
+//
+// Format (`ChunkType::kDeduplicated`):
+//  - Number of distinct records (varint)
+//  - Sum of sizes of distinct records (varint)
+//  - Compression type
+//  - Size of record indices (compressed if applicable)
+//  - Record indices (possibly compressed):
+//    - Array of `num_records` varints: 0 for the first occurrence of a distinct
+//      record, or 1 + index of a distinct record occurring before, with
+//      distinct records numbered in the order of their first occurrence
+//  - Chunk type of distinct records (`kSimple` or `kTransposed`)
+//  - Data of a chunk of distinct records
+//
+// If compression is used, a compressed block is prefixed by its varint-encoded
+// uncompressed size.
+class DeduplicatingEncoder : public ChunkEncoder {
+ public:
+  // Creates an empty `DeduplicatingEncoder`. Record indices are compressed
+  // with `options`.
+  explicit DeduplicatingEncoder(CompressorOptions options,
+                                std::unique_ptr<ChunkEncoder> base_encoder);
+
+  void Clear() override;
+
+  using ChunkEncoder::AddRecord;
+  bool AddRecord(const google::protobuf::MessageLite& record,
+                 SerializeOptions serialize_options) override;
+  bool AddRecord(absl::string_view record) override;
+  bool AddRecord(const Chain& record) override;
+  bool AddRecord(Chain&& record) override;
+  bool AddRecord(const absl::Cord& record) override;
+  bool AddRecord(absl::Cord&& record) override;
+
+  bool AddRecords(Chain records, std::vector<size_t> limits) override;
+
+  bool EncodeAndClose(Writer& dest, ChunkType& chunk_type,
+                      uint64_t& num_records,
+                      uint64_t& decoded_data_size) override;
+
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
+ private:
+  // This template is defined and used only in deduplicating_encoder.cc.
+  //
+  // `contents` are the contents of `record`, and may point into it.
+  template <typename Record>
+  bool AddRecordImpl(absl::string_view contents, Record&& record);
+
+  // Returns `true` if the distinct record with the given index is `contents`.
+  bool UniqueRecordEquals(uint64_t index, absl::string_view contents) const;
+
+  CompressionType compression_type_;
+  std::unique_ptr<ChunkEncoder> base_encoder_;
+  // Concatenated distinct records, in the order of their first occurrence.
+  Chain unique_records_;
+  // Positions of ends of distinct records in `unique_records_`.
+  std::vector<size_t> unique_limits_;
+  // Indices of distinct records, keyed by hashes of their contents. Records
+  // with a matching hash are compared with `unique_records_`.
+  absl::flat_hash_map<size_t, absl::InlinedVector<uint64_t, 1>>
+      unique_indices_;
+  internal::Compressor indices_compressor_;
+};
+
+// Implementation details follow.
+
+inline DeduplicatingEncoder::DeduplicatingEncoder(
+    CompressorOptions options, std::unique_ptr<ChunkEncoder> base_encoder)
+    : compression_type_(options.compression_type()),
+      base_encoder_(std::move(base_encoder)),
+      indices_compressor_(options) {}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_DEDUPLICATING_ENCODER_H_
@@ -17,6 +17,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <limits>
 #include <memory>
 #include <tuple>
@@ -27,9 +28,11 @@
 #include "absl/status/status.h"
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
@@ -40,11 +43,25 @@ namespace riegeli {
 
 void DeferredEncoder::Clear() {
   ChunkEncoder::Clear();
-  base_encoder_->Clear();
+  for (const std::unique_ptr<ChunkEncoder>& base_encoder : base_encoders_) {
+    base_encoder->Clear();
+  }
   records_writer_.Reset(std::forward_as_tuple());
   limits_.clear();
 }
 
+void DeferredEncoder::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  ChunkEncoder::RegisterSubobjects(memory_estimator);
+  memory_estimator.RegisterDynamicMemory(base_encoders_.capacity() *
+                                         sizeof(std::unique_ptr<ChunkEncoder>));
+  for (const std::unique_ptr<ChunkEncoder>& base_encoder : base_encoders_) {
+    base_encoder->RegisterSubobjects(memory_estimator);
+  }
+  records_writer_.dest().RegisterSubobjects(memory_estimator);
+  memory_estimator.RegisterDynamicMemory(limits_.capacity() * sizeof(size_t));
+}
+
 bool DeferredEncoder::AddRecord(const google::protobuf::MessageLite& record,
                                 SerializeOptions serialize_options) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
@@ -136,6 +153,54 @@ bool DeferredEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
   return true;
 }
 
+absl::optional<size_t> DeferredEncoder::ChooseBaseEncoder(
+    absl::optional<Chain>& encoded, ChunkType& chunk_type,
+    uint64_t& num_records, uint64_t& decoded_data_size) {
+  if (base_encoders_.size() == 1) return 0;
+  const Chain& records = records_writer_.dest();
+  size_t sample_num_records = IntCast<size_t>(
+      std::upper_bound(limits_.begin(), limits_.end(), sample_size_) -
+      limits_.begin());
+  if (sample_num_records == 0 && !limits_.empty()) sample_num_records = 1;
+  const bool whole_chunk = sample_num_records == limits_.size();
+  Chain sample = records;
+  if (!whole_chunk) {
+    sample.RemoveSuffix(records.size() - limits_[sample_num_records - 1]);
+  }
+  const std::vector<size_t> sample_limits(
+      limits_.begin(), limits_.begin() + sample_num_records);
+  size_t best_index = 0;
+  for (size_t index = 0; index < base_encoders_.size(); ++index) {
+    ChunkEncoder& base_encoder = *base_encoders_[index];
+    ChainWriter<Chain> trial_writer(std::forward_as_tuple());
+    ChunkType trial_chunk_type;
+    uint64_t trial_num_records;
+    uint64_t trial_decoded_data_size;
+    if (ABSL_PREDICT_FALSE(!base_encoder.AddRecords(sample, sample_limits)) ||
+        ABSL_PREDICT_FALSE(!base_encoder.EncodeAndClose(
+            trial_writer, trial_chunk_type, trial_num_records,
+            trial_decoded_data_size))) {
+      Fail(base_encoder);
+      return absl::nullopt;
+    }
+    if (ABSL_PREDICT_FALSE(!trial_writer.Close())) {
+      Fail(trial_writer);
+      return absl::nullopt;
+    }
+    if (encoded == absl::nullopt ||
+        trial_writer.dest().size() < encoded->size()) {
+      best_index = index;
+      encoded = std::move(trial_writer.dest());
+      chunk_type = trial_chunk_type;
+      num_records = trial_num_records;
+      decoded_data_size = trial_decoded_data_size;
+    }
+    base_encoder.Clear();
+  }
+  if (!whole_chunk) encoded = absl::nullopt;
+  return best_index;
+}
+
 bool DeferredEncoder::EncodeAndClose(Writer& dest, ChunkType& chunk_type,
                                      uint64_t& num_records,
                                      uint64_t& decoded_data_size) {
@@ -143,11 +208,25 @@ bool DeferredEncoder::EncodeAndClose(Writer& dest, ChunkType& chunk_type,
   if (ABSL_PREDICT_FALSE(!records_writer_.Close())) {
     return Fail(records_writer_);
   }
-  if (ABSL_PREDICT_FALSE(!base_encoder_->AddRecords(
+  // Merge small blocks once, before the records are possibly encoded several
+  // times by `ChooseBaseEncoder()`.
+  records_writer_.dest().Compact();
+  absl::optional<Chain> encoded;
+  const absl::optional<size_t> index =
+      ChooseBaseEncoder(encoded, chunk_type, num_records, decoded_data_size);
+  if (ABSL_PREDICT_FALSE(index == absl::nullopt)) return Close();
+  if (encoded != absl::nullopt) {
+    if (ABSL_PREDICT_FALSE(!dest.Write(std::move(*encoded)))) {
+      return Fail(dest);
+    }
+    return Close();
+  }
+  ChunkEncoder& base_encoder = *base_encoders_[*index];
+  if (ABSL_PREDICT_FALSE(!base_encoder.AddRecords(
           std::move(records_writer_.dest()), std::move(limits_))) ||
-      ABSL_PREDICT_FALSE(!base_encoder_->EncodeAndClose(
+      ABSL_PREDICT_FALSE(!base_encoder.EncodeAndClose(
           dest, chunk_type, num_records, decoded_data_size))) {
-    Fail(*base_encoder_);
+    Fail(base_encoder);
   }
   return Close();
 }
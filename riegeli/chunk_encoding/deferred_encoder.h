@@ -25,8 +25,11 @@
 
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
@@ -38,10 +41,26 @@ namespace riegeli {
 // `DeferredEncoder` performs a minimal amount of the encoding work in
 // `AddRecord()`, deferring as much as possible to `EncodeAndClose()`.
 // It does more memory copying than the base encoder though.
+//
+// If several base encoders are given, `EncodeAndClose()` encodes a sample of
+// records with each of them, and encodes the chunk with the one which produced
+// the smallest output for the sample, preferring earlier base encoders on ties.
+// This allows e.g. to use `TransposeEncoder` only for chunks which benefit from
+// it.
 class DeferredEncoder : public ChunkEncoder {
  public:
   explicit DeferredEncoder(std::unique_ptr<ChunkEncoder> base_encoder);
 
+  // Will choose one of `base_encoders` for each chunk, based on the records
+  // at the beginning of the chunk whose total size is at most `sample_size`
+  // (at least one record). If all records fit in the sample, the output of the
+  // chosen base encoder is used directly, without encoding records again.
+  //
+  // Precondition: `!base_encoders.empty()`
+  explicit DeferredEncoder(
+      std::vector<std::unique_ptr<ChunkEncoder>> base_encoders,
+      uint64_t sample_size);
+
   void Clear() override;
 
   using ChunkEncoder::AddRecord;
@@ -59,12 +78,29 @@ class DeferredEncoder : public ChunkEncoder {
                       uint64_t& num_records,
                       uint64_t& decoded_data_size) override;
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  private:
   // This template is defined and used only in deferred_encoder.cc.
   template <typename Record>
   bool AddRecordImpl(Record&& record);
 
-  std::unique_ptr<ChunkEncoder> base_encoder_;
+  // Returns the index in `base_encoders_` of the base encoder to use for the
+  // chunk. If the whole chunk was encoded already as the sample, sets
+  // `encoded`, `chunk_type`, `num_records`, and `decoded_data_size` to the
+  // output of that base encoder.
+  //
+  // Precondition: `records_writer_` is closed.
+  //
+  // If `!healthy()`, returns `absl::nullopt`.
+  absl::optional<size_t> ChooseBaseEncoder(absl::optional<Chain>& encoded,
+                                           ChunkType& chunk_type,
+                                           uint64_t& num_records,
+                                           uint64_t& decoded_data_size);
+
+  // Invariant: `!base_encoders_.empty()`
+  std::vector<std::unique_ptr<ChunkEncoder>> base_encoders_;
+  uint64_t sample_size_ = 0;
   // `Writer` of concatenated record values.
   ChainWriter<Chain> records_writer_;
   // Sorted record end positions.
@@ -80,8 +116,20 @@ class DeferredEncoder : public ChunkEncoder {
 
 inline DeferredEncoder::DeferredEncoder(
     std::unique_ptr<ChunkEncoder> base_encoder)
-    : base_encoder_(std::move(base_encoder)),
-      records_writer_(std::forward_as_tuple()) {}
+    : records_writer_(std::forward_as_tuple()) {
+  base_encoders_.push_back(std::move(base_encoder));
+}
+
+inline DeferredEncoder::DeferredEncoder(
+    std::vector<std::unique_ptr<ChunkEncoder>> base_encoders,
+    uint64_t sample_size)
+    : base_encoders_(std::move(base_encoders)),
+      sample_size_(sample_size),
+      records_writer_(std::forward_as_tuple()) {
+  RIEGELI_ASSERT(!base_encoders_.empty())
+      << "Failed precondition of DeferredEncoder::DeferredEncoder(): "
+         "no base encoders";
+}
 
 }  // namespace riegeli
 
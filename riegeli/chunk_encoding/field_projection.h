@@ -66,6 +66,11 @@ class Field {
   // message.
   const Path& path() const { return path_; }
 
+  friend bool operator==(const Field& a, const Field& b) {
+    return a.path_ == b.path_;
+  }
+  friend bool operator!=(const Field& a, const Field& b) { return !(a == b); }
+
  private:
   static void AssertValid(int field_number);
 
@@ -103,6 +108,13 @@ class FieldProjection {
   // Returns the set of fields to include.
   const Fields& fields() const { return fields_; }
 
+  friend bool operator==(const FieldProjection& a, const FieldProjection& b) {
+    return a.fields_ == b.fields_;
+  }
+  friend bool operator!=(const FieldProjection& a, const FieldProjection& b) {
+    return !(a == b);
+  }
+
  private:
   Fields fields_;
 };
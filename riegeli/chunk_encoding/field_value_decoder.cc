@@ -0,0 +1,218 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/field_value_decoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/endian/endian_reading.h"
+#include "riegeli/messages/message_wire_format.h"
+#include "riegeli/varint/varint_reading.h"
+
+namespace riegeli {
+
+namespace {
+
+ChunkDecoder::Options ProjectionOptions(const std::vector<Field>& fields,
+                                        ChunkDecoder::Options options) {
+  FieldProjection field_projection;
+  for (const Field& field : fields) {
+    RIEGELI_ASSERT(!field.path().empty())
+        << "Failed precondition of FieldValueDecoder: empty field path";
+    for (const int field_number : field.path()) {
+      RIEGELI_ASSERT_NE(field_number, Field::kExistenceOnly)
+          << "Failed precondition of FieldValueDecoder: "
+             "Field::kExistenceOnly in field path";
+    }
+    field_projection.AddField(field);
+  }
+  options.set_field_projection(std::move(field_projection));
+  return options;
+}
+
+}  // namespace
+
+FieldValueDecoder::FieldValueDecoder(
+    std::vector<Field> fields, ChunkDecoder::Options chunk_decoder_options)
+    : Object(kInitiallyOpen),
+      fields_(std::move(fields)),
+      chunk_decoder_(
+          ProjectionOptions(fields_, std::move(chunk_decoder_options))),
+      values_(fields_.size()) {}
+
+bool FieldValueDecoder::Decode(const Chunk& chunk) {
+  Object::Reset(kInitiallyOpen);
+  num_records_ = 0;
+  records_.clear();
+  for (std::vector<FieldValue>& values : values_) values.clear();
+  if (ABSL_PREDICT_FALSE(!chunk_decoder_.Decode(chunk))) {
+    return Fail(chunk_decoder_);
+  }
+  num_records_ = chunk_decoder_.num_records();
+  // Concatenate records first, so that `FieldValue::bytes` can point to
+  // `records_` without being invalidated by its reallocation.
+  std::vector<size_t> limits;
+  limits.reserve(IntCast<size_t>(num_records_));
+  absl::string_view record;
+  while (chunk_decoder_.ReadRecord(record)) {
+    records_.append(record.data(), record.size());
+    limits.push_back(records_.size());
+  }
+  if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
+    return Fail(chunk_decoder_);
+  }
+  for (size_t field_index = 0; field_index < fields_.size(); ++field_index) {
+    const Field::Path& path = fields_[field_index].path();
+    std::vector<FieldValue>& values = values_[field_index];
+    const char* cursor = records_.data();
+    for (size_t record_index = 0; record_index < limits.size();
+         ++record_index) {
+      const char* const limit = records_.data() + limits[record_index];
+      const char* group_end;
+      if (ABSL_PREDICT_FALSE(!ScanMessage(record_index, cursor, limit,
+                                          absl::nullopt, group_end, path, 0,
+                                          values))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool FieldValueDecoder::ScanMessage(uint64_t record_index, const char*& cursor,
+                                    const char* limit,
+                                    absl::optional<int> group_number,
+                                    const char*& group_end,
+                                    const Field::Path& path, size_t depth,
+                                    std::vector<FieldValue>& values) {
+  while (cursor < limit) {
+    const char* const tag_begin = cursor;
+    const absl::optional<ReadFromStringResult<uint32_t>> tag =
+        ReadVarint32(cursor, limit);
+    if (ABSL_PREDICT_FALSE(tag == absl::nullopt)) {
+      return Fail(absl::DataLossError("Invalid field tag"));
+    }
+    cursor = tag->cursor;
+    const int field_number = GetTagFieldNumber(tag->value);
+    const WireType wire_type = GetTagWireType(tag->value);
+    const bool selected = depth < path.size() && field_number == path[depth];
+    const bool leaf = selected && depth + 1 == path.size();
+    switch (wire_type) {
+      case WireType::kVarint: {
+        const absl::optional<ReadFromStringResult<uint64_t>> value =
+            ReadVarint64(cursor, limit);
+        if (ABSL_PREDICT_FALSE(value == absl::nullopt)) {
+          return Fail(absl::DataLossError("Invalid varint field"));
+        }
+        cursor = value->cursor;
+        if (leaf) {
+          values.push_back(FieldValue{record_index, wire_type, value->value,
+                                      absl::string_view()});
+        }
+        continue;
+      }
+      case WireType::kFixed32:
+        if (ABSL_PREDICT_FALSE(PtrDistance(cursor, limit) <
+                               sizeof(uint32_t))) {
+          return Fail(absl::DataLossError("Truncated fixed32 field"));
+        }
+        if (leaf) {
+          values.push_back(FieldValue{record_index, wire_type,
+                                      ReadLittleEndian32(cursor),
+                                      absl::string_view()});
+        }
+        cursor += sizeof(uint32_t);
+        continue;
+      case WireType::kFixed64:
+        if (ABSL_PREDICT_FALSE(PtrDistance(cursor, limit) <
+                               sizeof(uint64_t))) {
+          return Fail(absl::DataLossError("Truncated fixed64 field"));
+        }
+        if (leaf) {
+          values.push_back(FieldValue{record_index, wire_type,
+                                      ReadLittleEndian64(cursor),
+                                      absl::string_view()});
+        }
+        cursor += sizeof(uint64_t);
+        continue;
+      case WireType::kLengthDelimited: {
+        const absl::optional<ReadFromStringResult<uint32_t>> length =
+            ReadVarint32(cursor, limit);
+        if (ABSL_PREDICT_FALSE(length == absl::nullopt ||
+                               length->value >
+                                   PtrDistance(length->cursor, limit))) {
+          return Fail(absl::DataLossError("Invalid length-delimited field"));
+        }
+        cursor = length->cursor;
+        const char* const value_limit = cursor + length->value;
+        if (leaf) {
+          values.push_back(
+              FieldValue{record_index, wire_type, 0,
+                         absl::string_view(cursor, length->value)});
+        } else if (selected) {
+          const char* submessage_cursor = cursor;
+          const char* submessage_group_end;
+          if (ABSL_PREDICT_FALSE(!ScanMessage(
+                  record_index, submessage_cursor, value_limit, absl::nullopt,
+                  submessage_group_end, path, depth + 1, values))) {
+            return false;
+          }
+        }
+        cursor = value_limit;
+        continue;
+      }
+      case WireType::kStartGroup: {
+        const char* const contents = cursor;
+        const char* contents_end;
+        if (ABSL_PREDICT_FALSE(!ScanMessage(
+                record_index, cursor, limit, field_number, contents_end, path,
+                selected && !leaf ? depth + 1 : path.size(), values))) {
+          return false;
+        }
+        if (leaf) {
+          values.push_back(FieldValue{
+              record_index, wire_type, 0,
+              absl::string_view(contents,
+                                PtrDistance(contents, contents_end))});
+        }
+        continue;
+      }
+      case WireType::kEndGroup:
+        if (ABSL_PREDICT_FALSE(group_number != field_number)) {
+          return Fail(absl::DataLossError("Unmatched end group tag"));
+        }
+        group_end = tag_begin;
+        return true;
+    }
+    return Fail(absl::DataLossError("Invalid wire type"));
+  }
+  if (ABSL_PREDICT_FALSE(group_number != absl::nullopt)) {
+    return Fail(absl::DataLossError("Unterminated group"));
+  }
+  return true;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,136 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_FIELD_VALUE_DECODER_H_
+#define RIEGELI_CHUNK_ENCODING_FIELD_VALUE_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/messages/message_wire_format.h"
+
+namespace riegeli {
+
+// A value of a field in a record, as found in the serialized record.
+struct FieldValue {
+  // Index of the record in the chunk.
+  uint64_t record_index;
+  // `WireType::kVarint`, `WireType::kFixed32`, `WireType::kFixed64`,
+  // `WireType::kLengthDelimited`, or `WireType::kStartGroup`.
+  WireType wire_type;
+  // The value if `wire_type` is `kVarint`, `kFixed32`, or `kFixed64`. Use
+  // `DecodeSint64()`, `DecodeDouble()` etc. to interpret it.
+  uint64_t numeric;
+  // The value if `wire_type` is `kLengthDelimited` (a string, bytes, a
+  // submessage, or a packed repeated field) or `kStartGroup` (contents of the
+  // group without its end group tag).
+  absl::string_view bytes;
+};
+
+// Decodes values of selected fields across all records of a chunk, without
+// parsing records into messages, for columnar processing.
+//
+// A transposed chunk is decoded with a `FieldProjection` to the selected
+// fields, so that only buckets containing them are decompressed, and records
+// reassembled from them contain nothing else. Values are then found by
+// scanning the wire format of these records. A simple chunk can be decoded
+// too, but its records are scanned whole.
+//
+// A repeated field yields a value per element, or a `kLengthDelimited` value
+// per packed run, in the order of the serialized record. An absent field
+// yields no values.
+class FieldValueDecoder : public Object {
+ public:
+  // Creates a `FieldValueDecoder` for values of `fields`.
+  //
+  // `ChunkDecoder::Options::field_projection()` in `chunk_decoder_options` is
+  // ignored.
+  //
+  // Precondition: each of `fields` is not empty and does not contain
+  // `Field::kExistenceOnly`
+  explicit FieldValueDecoder(
+      std::vector<Field> fields,
+      ChunkDecoder::Options chunk_decoder_options = ChunkDecoder::Options());
+
+  FieldValueDecoder(const FieldValueDecoder&) = delete;
+  FieldValueDecoder& operator=(const FieldValueDecoder&) = delete;
+
+  // Returns the fields whose values are decoded.
+  const std::vector<Field>& fields() const { return fields_; }
+
+  // Resets the `FieldValueDecoder` and decodes the chunk.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool Decode(const Chunk& chunk);
+
+  // Returns the number of records in the decoded chunk.
+  uint64_t num_records() const { return num_records_; }
+
+  // Returns values of the field at `field_index` of `fields()`, sorted by
+  // `record_index`.
+  //
+  // `FieldValue::bytes` are valid until the next non-const operation on this
+  // `FieldValueDecoder`.
+  //
+  // Precondition: `field_index < fields().size()`
+  absl::Span<const FieldValue> values(size_t field_index) const;
+
+ private:
+  // Appends values of the field at `path` below the level `depth` from the
+  // message at [`cursor`, `limit`) to `values`. If `depth == path.size()`, the
+  // message is only skipped.
+  //
+  // If `group_number != absl::nullopt`, the message is a group, and ends with
+  // its end group tag; then `cursor` is set after it, and `group_end` is set to
+  // the end group tag. Otherwise the message ends at `limit`.
+  bool ScanMessage(uint64_t record_index, const char*& cursor,
+                   const char* limit, absl::optional<int> group_number,
+                   const char*& group_end, const Field::Path& path,
+                   size_t depth, std::vector<FieldValue>& values);
+
+  std::vector<Field> fields_;
+  ChunkDecoder chunk_decoder_;
+  uint64_t num_records_ = 0;
+  // Concatenated records, pointed to by `FieldValue::bytes`.
+  std::string records_;
+  std::vector<std::vector<FieldValue>> values_;
+};
+
+// Implementation details follow.
+
+inline absl::Span<const FieldValue> FieldValueDecoder::values(
+    size_t field_index) const {
+  RIEGELI_ASSERT_LT(field_index, values_.size())
+      << "Failed precondition of FieldValueDecoder::values(): "
+         "field index out of range";
+  return values_[field_index];
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_FIELD_VALUE_DECODER_H_
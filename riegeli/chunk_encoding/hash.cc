@@ -16,13 +16,17 @@
 
 #include <stdint.h>
 
+#include "absl/base/optimization.h"
 #include "absl/container/inlined_vector.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "crc32c/crc32c.h"
 #include "highwayhash/hh_types.h"
 #include "highwayhash/highwayhash_target.h"
 #include "highwayhash/instruction_sets.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/chunk_encoding/constants.h"
 
 namespace riegeli {
 namespace internal {
@@ -36,6 +40,19 @@ const highwayhash::HHKey kHashKey HH_ALIGNAS(32) = {
     0x0a7364726f636572,  // 'records\n'
 };
 
+inline uint64_t Crc32cHash(absl::string_view data) {
+  return kCrc32cHashTag | uint64_t{crc32c::Crc32c(data.data(), data.size())};
+}
+
+uint64_t Crc32cHash(const Chain& data) {
+  uint32_t crc = 0;
+  for (const absl::string_view fragment : data.blocks()) {
+    crc = crc32c::Extend(crc, reinterpret_cast<const uint8_t*>(fragment.data()),
+                         fragment.size());
+  }
+  return kCrc32cHashTag | uint64_t{crc};
+}
+
 }  // namespace
 
 uint64_t Hash(absl::string_view data) {
@@ -45,21 +62,59 @@ uint64_t Hash(absl::string_view data) {
   return result;
 }
 
-// uint64_t Hash(const Chain& data) {
-//   if (const absl::optional<absl::string_view> flat = data.TryFlat()) {
-//     return Hash(*flat);
-//   }
-//   absl::InlinedVector<highwayhash::StringView, 16> fragments;
-//   fragments.reserve(data.blocks().size());
-//   for (const absl::string_view fragment : data.blocks()) {
-//     fragments.push_back(
-//         highwayhash::StringView{fragment.data(), fragment.size()});
-//   }
-//   highwayhash::HHResult64 result;
-//   highwayhash::InstructionSets::Run<highwayhash::HighwayHashCat>(
-//       kHashKey, fragments.data(), fragments.size(), &result);
-//   return result;
-// }
+uint64_t Hash(const Chain& data) {
+  if (const absl::optional<absl::string_view> flat = data.TryFlat()) {
+    return Hash(*flat);
+  }
+  absl::InlinedVector<highwayhash::StringView, 16> fragments;
+  fragments.reserve(data.blocks().size());
+  for (const absl::string_view fragment : data.blocks()) {
+    fragments.push_back(
+        highwayhash::StringView{fragment.data(), fragment.size()});
+  }
+  highwayhash::HHResult64 result;
+  highwayhash::InstructionSets::Run<highwayhash::HighwayHashCat>(
+      kHashKey, fragments.data(), fragments.size(), &result);
+  return result;
+}
+
+uint64_t Hash(HashType hash_type, absl::string_view data) {
+  switch (hash_type) {
+    case HashType::kHighwayHash:
+      return Hash(data);
+    case HashType::kCrc32c:
+      return Crc32cHash(data);
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown hash type: " << static_cast<int>(hash_type);
+}
+
+uint64_t Hash(HashType hash_type, const Chain& data) {
+  switch (hash_type) {
+    case HashType::kHighwayHash:
+      return Hash(data);
+    case HashType::kCrc32c:
+      return Crc32cHash(data);
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown hash type: " << static_cast<int>(hash_type);
+}
+
+uint64_t HashLike(uint64_t stored_hash, absl::string_view data) {
+  if (HashTypeOf(stored_hash) == HashType::kCrc32c) {
+    const uint64_t crc32c_hash = Crc32cHash(data);
+    if (ABSL_PREDICT_TRUE(crc32c_hash == stored_hash)) return crc32c_hash;
+  }
+  return Hash(data);
+}
+
+uint64_t HashLike(uint64_t stored_hash, const Chain& data) {
+  if (HashTypeOf(stored_hash) == HashType::kCrc32c) {
+    const uint64_t crc32c_hash = Crc32cHash(data);
+    if (ABSL_PREDICT_TRUE(crc32c_hash == stored_hash)) return crc32c_hash;
+  }
+  return Hash(data);
+}
 
 }  // namespace internal
 }  // namespace riegeli
@@ -18,13 +18,49 @@
 #include <stdint.h>
 
 #include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/chunk_encoding/constants.h"
 
 namespace riegeli {
 namespace internal {
 
+// Computes the HighwayHash of `data` with the Riegeli/records key, using the
+// widest instruction set available at runtime.
 uint64_t Hash(absl::string_view data);
-// uint64_t Hash(const Chain& data);
+
+// Like `Hash(absl::string_view)` applied to the concatenated blocks of `data`,
+// but hashes blocks in place without flattening `data`.
+uint64_t Hash(const Chain& data);
+
+// High 32 bits of a hash value computed with `HashType::kCrc32c`: 'c32c'.
+// The low 32 bits are the CRC32C (unmasked) of the data.
+RIEGELI_INTERNAL_INLINE_CONSTEXPR(uint64_t, kCrc32cHashTag,
+                                  uint64_t{0x63323363} << 32);
+
+// Computes the hash of `data` with the given hash function.
+//
+// `HashType::kHighwayHash` is the same as `Hash(data)`. `HashType::kCrc32c`
+// is faster on hardware supporting CRC32C instructions, but it detects
+// corruption less reliably.
+uint64_t Hash(HashType hash_type, absl::string_view data);
+uint64_t Hash(HashType hash_type, const Chain& data);
+
+// Returns the hash function which `hash` appears to have been computed with.
+inline HashType HashTypeOf(uint64_t hash) {
+  return (hash & ~uint64_t{0xffffffff}) == kCrc32cHashTag
+             ? HashType::kCrc32c
+             : HashType::kHighwayHash;
+}
+
+// Computes the hash of `data` with the hash function which `stored_hash`
+// appears to have been computed with, so that the result equals `stored_hash`
+// if `data` is intact.
+//
+// A HighwayHash value can accidentally carry `kCrc32cHashTag`, so if a CRC32C
+// does not match a tagged `stored_hash`, HighwayHash is computed instead.
+uint64_t HashLike(uint64_t stored_hash, absl::string_view data);
+uint64_t HashLike(uint64_t stored_hash, const Chain& data);
 
 }  // namespace internal
 }  // namespace riegeli
@@ -26,11 +26,14 @@
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/object.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/limiting_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/decompression_backend.h"
 #include "riegeli/chunk_encoding/decompressor.h"
 #include "riegeli/varint/varint_reading.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 namespace riegeli {
 
@@ -40,9 +43,12 @@ void SimpleDecoder::Done() {
   }
 }
 
-bool SimpleDecoder::Decode(Reader* src, uint64_t num_records,
-                           uint64_t decoded_data_size,
-                           std::vector<size_t>& limits) {
+bool SimpleDecoder::Decode(
+    Reader* src, uint64_t num_records, uint64_t decoded_data_size,
+    std::vector<size_t>& limits,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary,
+    DecompressionBackend* decompression_backend) {
   Object::Reset(kInitiallyOpen);
   if (ABSL_PREDICT_FALSE(num_records > limits.max_size())) {
     return Fail(absl::ResourceExhaustedError("Too many records"));
@@ -71,26 +77,33 @@ bool SimpleDecoder::Decode(Reader* src, uint64_t num_records,
     return Fail(absl::ResourceExhaustedError("Size of sizes too large"));
   }
   internal::Decompressor<LimitingReader<>> sizes_decompressor(
-      std::forward_as_tuple(src, src->pos() + *sizes_size), compression_type);
+      std::forward_as_tuple(src, src->pos() + *sizes_size), compression_type,
+      zstd_dictionary, brotli_dictionary, decompression_backend);
   if (ABSL_PREDICT_FALSE(!sizes_decompressor.healthy())) {
     return Fail(sizes_decompressor);
   }
   limits.clear();
   size_t limit = 0;
+  // Record sizes are decoded in batches, which is faster than one by one.
+  constexpr size_t kMaxBatchSize = 256;
+  uint64_t sizes[kMaxBatchSize];
   while (limits.size() != num_records) {
-    const absl::optional<uint64_t> size =
-        ReadVarint64(sizes_decompressor.reader());
-    if (ABSL_PREDICT_FALSE(size == absl::nullopt)) {
+    const size_t batch_size = IntCast<size_t>(
+        UnsignedMin(num_records - limits.size(), uint64_t{kMaxBatchSize}));
+    if (ABSL_PREDICT_FALSE(
+            !ReadVarints64(sizes_decompressor.reader(), batch_size, sizes))) {
       sizes_decompressor.reader().Fail(
           absl::DataLossError("Reading record size failed"));
       return Fail(sizes_decompressor.reader());
     }
-    if (ABSL_PREDICT_FALSE(*size > decoded_data_size - limit)) {
-      return Fail(
-          absl::DataLossError("Decoded data size larger than expected"));
+    for (size_t i = 0; i < batch_size; ++i) {
+      if (ABSL_PREDICT_FALSE(sizes[i] > decoded_data_size - limit)) {
+        return Fail(
+            absl::DataLossError("Decoded data size larger than expected"));
+      }
+      limit += IntCast<size_t>(sizes[i]);
+      limits.push_back(limit);
     }
-    limit += IntCast<size_t>(*size);
-    limits.push_back(limit);
   }
   if (ABSL_PREDICT_FALSE(!sizes_decompressor.VerifyEndAndClose())) {
     return Fail(sizes_decompressor);
@@ -99,7 +112,8 @@ bool SimpleDecoder::Decode(Reader* src, uint64_t num_records,
     return Fail(absl::DataLossError("Decoded data size smaller than expected"));
   }
 
-  values_decompressor_.Reset(src, compression_type);
+  values_decompressor_.Reset(src, compression_type, zstd_dictionary,
+                             brotli_dictionary, decompression_backend);
   if (ABSL_PREDICT_FALSE(!values_decompressor_.healthy())) {
     return Fail(values_decompressor_);
   }
@@ -23,8 +23,11 @@
 #include "absl/status/status.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/object.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/decompression_backend.h"
 #include "riegeli/chunk_encoding/decompressor.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 namespace riegeli {
 
@@ -44,11 +47,23 @@ class SimpleDecoder : public Object {
   // `*src` is not owned by this `SimpleDecoder` and must be kept alive but not
   // accessed until closing the `SimpleDecoder`.
   //
+  // If the chunk was compressed with Zstd or Brotli, `zstd_dictionary` or
+  // `brotli_dictionary` respectively must be the dictionary used for
+  // compression.
+  //
+  // If `decompression_backend` is not `nullptr`, it is offered decompression
+  // of record sizes and values.
+  //
   // Return values:
   //  * `true`  - success (`healthy()`)
   //  * `false` - failure (`!healthy()`)
   bool Decode(Reader* src, uint64_t num_records, uint64_t decoded_data_size,
-              std::vector<size_t>& limits);
+              std::vector<size_t>& limits,
+              const ZstdReaderBase::Dictionary& zstd_dictionary =
+                  ZstdReaderBase::Dictionary(),
+              const BrotliReaderBase::Dictionary& brotli_dictionary =
+                  BrotliReaderBase::Dictionary(),
+              DecompressionBackend* decompression_backend = nullptr);
 
   // Returns the `Reader` from which concatenated record values should be read.
   //
@@ -29,7 +29,9 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
 #include "riegeli/chunk_encoding/compressor.h"
@@ -53,6 +55,13 @@ void SimpleEncoder::Clear() {
   values_compressor_.Clear();
 }
 
+void SimpleEncoder::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  ChunkEncoder::RegisterSubobjects(memory_estimator);
+  sizes_compressor_.RegisterSubobjects(memory_estimator);
+  values_compressor_.RegisterSubobjects(memory_estimator);
+}
+
 bool SimpleEncoder::AddRecord(const google::protobuf::MessageLite& record,
                               SerializeOptions serialize_options) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
@@ -123,6 +132,31 @@ bool SimpleEncoder::AddRecordImpl(Record&& record) {
   return true;
 }
 
+bool SimpleEncoder::AddRecordFrom(Reader& src, uint64_t size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(num_records_ == kMaxNumRecords)) {
+    return Fail(absl::ResourceExhaustedError("Too many records"));
+  }
+  if (ABSL_PREDICT_FALSE(size > std::numeric_limits<uint64_t>::max() -
+                                    decoded_data_size_)) {
+    return Fail(absl::ResourceExhaustedError("Decoded data size too large"));
+  }
+  ++num_records_;
+  decoded_data_size_ += size;
+  if (ABSL_PREDICT_FALSE(!WriteVarint64(size, sizes_compressor_.writer()))) {
+    return Fail(sizes_compressor_.writer());
+  }
+  if (ABSL_PREDICT_FALSE(!src.Copy(Position{size},
+                                   values_compressor_.writer()))) {
+    if (ABSL_PREDICT_FALSE(!values_compressor_.writer().healthy())) {
+      return Fail(values_compressor_.writer());
+    }
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+    return Fail(absl::InvalidArgumentError("Record truncated"));
+  }
+  return true;
+}
+
 bool SimpleEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
   RIEGELI_ASSERT_EQ(limits.empty() ? size_t{0} : limits.back(), records.size())
       << "Failed precondition of ChunkEncoder::AddRecords(): "
@@ -137,6 +171,9 @@ bool SimpleEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
   }
   num_records_ += IntCast<uint64_t>(limits.size());
   decoded_data_size_ += IntCast<uint64_t>(records.size());
+  // Records of a whole chunk are often many small blocks. Merge them so that
+  // the compressor consumes contiguous memory.
+  records.Compact();
   size_t start = 0;
   for (const size_t limit : limits) {
     RIEGELI_ASSERT_GE(limit, start)
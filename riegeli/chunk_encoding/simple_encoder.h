@@ -24,6 +24,8 @@
 #include "absl/strings/string_view.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
 #include "riegeli/chunk_encoding/compressor.h"
@@ -61,10 +63,23 @@ class SimpleEncoder : public ChunkEncoder {
 
   bool AddRecords(Chain records, std::vector<size_t> limits) override;
 
+  // Adds the next record, consisting of `size` bytes read from `src`.
+  //
+  // The record is passed through the compressor as it is read, so only its
+  // compressed form is held in memory.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`); if `src` failed or ended before
+  //              `size` bytes, its status is propagated
+  bool AddRecordFrom(Reader& src, uint64_t size);
+
   bool EncodeAndClose(Writer& dest, ChunkType& chunk_type,
                       uint64_t& num_records,
                       uint64_t& decoded_data_size) override;
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  private:
   // This template is defined and used only in simple_encoder.cc.
   template <typename Record>
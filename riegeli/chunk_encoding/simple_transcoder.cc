@@ -0,0 +1,139 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/simple_transcoder.h"
+
+#include <stdint.h>
+
+#include <limits>
+#include <tuple>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/brotli/brotli_reader.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/compressor.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/decompressor.h"
+#include "riegeli/chunk_encoding/hash.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+#include "riegeli/zstd/zstd_reader.h"
+
+namespace riegeli {
+
+absl::Status TranscodeSimpleChunk(
+    const Chunk& src, const CompressorOptions& compressor_options, Chunk& dest,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary) {
+  if (ABSL_PREDICT_FALSE(src.header.chunk_type() != ChunkType::kSimple)) {
+    return absl::InvalidArgumentError("Not a simple chunk");
+  }
+  ChainReader<> src_reader(&src.data);
+  const absl::optional<uint8_t> compression_type_byte = src_reader.ReadByte();
+  if (ABSL_PREDICT_FALSE(compression_type_byte == absl::nullopt)) {
+    return absl::DataLossError("Reading compression type failed");
+  }
+  const CompressionType compression_type =
+      static_cast<CompressionType>(*compression_type_byte);
+  const absl::optional<uint64_t> sizes_size = ReadVarint64(src_reader);
+  if (ABSL_PREDICT_FALSE(sizes_size == absl::nullopt)) {
+    return absl::DataLossError("Reading size of sizes failed");
+  }
+  if (ABSL_PREDICT_FALSE(*sizes_size > std::numeric_limits<Position>::max() -
+                                           src_reader.pos())) {
+    return absl::DataLossError("Size of sizes too large");
+  }
+
+  // Record sizes are recompressed as a whole, without parsing varints.
+  Chain compressed_sizes;
+  {
+    internal::Decompressor<LimitingReader<>> sizes_decompressor(
+        std::forward_as_tuple(&src_reader, src_reader.pos() + *sizes_size),
+        compression_type, zstd_dictionary, brotli_dictionary);
+    if (ABSL_PREDICT_FALSE(!sizes_decompressor.healthy())) {
+      return sizes_decompressor.status();
+    }
+    internal::Compressor sizes_compressor(compressor_options);
+    if (ABSL_PREDICT_FALSE(
+            !sizes_decompressor.reader().CopyAll(sizes_compressor.writer()))) {
+      if (!sizes_compressor.writer().healthy()) {
+        return sizes_compressor.writer().status();
+      }
+      return sizes_decompressor.reader().status();
+    }
+    if (ABSL_PREDICT_FALSE(!sizes_decompressor.VerifyEndAndClose())) {
+      return sizes_decompressor.status();
+    }
+    ChainWriter<> compressed_sizes_writer(&compressed_sizes);
+    if (ABSL_PREDICT_FALSE(
+            !sizes_compressor.EncodeAndClose(compressed_sizes_writer))) {
+      return sizes_compressor.status();
+    }
+    if (ABSL_PREDICT_FALSE(!compressed_sizes_writer.Close())) {
+      return compressed_sizes_writer.status();
+    }
+  }
+
+  dest.data.Clear();
+  ChainWriter<> dest_writer(&dest.data);
+  if (ABSL_PREDICT_FALSE(!dest_writer.WriteByte(
+          static_cast<uint8_t>(compressor_options.compression_type()))) ||
+      ABSL_PREDICT_FALSE(!WriteVarint64(
+          IntCast<uint64_t>(compressed_sizes.size()), dest_writer)) ||
+      ABSL_PREDICT_FALSE(!dest_writer.Write(std::move(compressed_sizes)))) {
+    return dest_writer.status();
+  }
+  {
+    internal::Decompressor<> values_decompressor(
+        &src_reader, compression_type, zstd_dictionary, brotli_dictionary);
+    if (ABSL_PREDICT_FALSE(!values_decompressor.healthy())) {
+      return values_decompressor.status();
+    }
+    // The size of values is known exactly, which lets the compressor store it
+    // in the stream header and size its buffers.
+    internal::Compressor values_compressor(
+        compressor_options,
+        internal::Compressor::TuningOptions().set_pledged_size(
+            src.header.decoded_data_size()));
+    if (ABSL_PREDICT_FALSE(!values_decompressor.reader().CopyAll(
+            values_compressor.writer()))) {
+      if (!values_compressor.writer().healthy()) {
+        return values_compressor.writer().status();
+      }
+      return values_decompressor.reader().status();
+    }
+    if (ABSL_PREDICT_FALSE(!values_decompressor.VerifyEndAndClose())) {
+      return values_decompressor.status();
+    }
+    if (ABSL_PREDICT_FALSE(!values_compressor.EncodeAndClose(dest_writer))) {
+      return values_compressor.status();
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return dest_writer.status();
+  dest.header = ChunkHeader(
+      dest.data, ChunkType::kSimple, src.header.num_records(),
+      src.header.decoded_data_size(),
+      internal::HashTypeOf(src.header.stored_header_hash()));
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
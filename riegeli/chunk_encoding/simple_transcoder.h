@@ -0,0 +1,50 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_SIMPLE_TRANSCODER_H_
+#define RIEGELI_CHUNK_ENCODING_SIMPLE_TRANSCODER_H_
+
+#include "absl/status/status.h"
+#include "riegeli/brotli/brotli_reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/zstd/zstd_reader.h"
+
+namespace riegeli {
+
+// Recompresses a simple chunk (`ChunkType::kSimple`) with `compressor_options`
+// and stores the result in `dest`, without splitting record values into
+// records. `num_records` and `decoded_data_size` are kept as they are, and so
+// is the hash function of the chunk header.
+//
+// This is much cheaper than reading the records and writing them again, and
+// the result decodes to the same records.
+//
+// If `src` was compressed with Zstd or Brotli with a dictionary,
+// `zstd_dictionary` or `brotli_dictionary` respectively must be the dictionary
+// used for compression.
+//
+// Returns status:
+//  * `status.ok()`  - success (`dest` is set)
+//  * `!status.ok()` - failure, e.g. `src` is not a valid simple chunk
+absl::Status TranscodeSimpleChunk(
+    const Chunk& src, const CompressorOptions& compressor_options, Chunk& dest,
+    const ZstdReaderBase::Dictionary& zstd_dictionary =
+        ZstdReaderBase::Dictionary(),
+    const BrotliReaderBase::Dictionary& brotli_dictionary =
+        BrotliReaderBase::Dictionary());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_SIMPLE_TRANSCODER_H_
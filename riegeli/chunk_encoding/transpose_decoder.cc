@@ -21,6 +21,7 @@
 #include <cstring>
 #include <iterator>
 #include <limits>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -31,23 +32,31 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/memory.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/limiting_backward_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/string_reader.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/decompression_backend.h"
 #include "riegeli/chunk_encoding/decompressor.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/transpose_dictionary_encoding.h"
+#include "riegeli/chunk_encoding/transpose_integer_encoding.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
+#include "riegeli/chunk_encoding/transpose_packed_encoding.h"
 #include "riegeli/messages/message_wire_format.h"
 #include "riegeli/varint/varint_reading.h"
 #include "riegeli/varint/varint_writing.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 namespace riegeli {
 
@@ -62,6 +71,13 @@ Reader* kEmptyReader() {
 
 constexpr uint32_t kInvalidPos = std::numeric_limits<uint32_t>::max();
 
+// Encoding of a data buffer.
+struct BufferEncodingInfo {
+  internal::BufferEncoding encoding = internal::BufferEncoding::kPlain;
+  // Wire type of values, meaningful if `encoding` is not `kPlain`.
+  WireType wire_type = WireType::kVarint;
+};
+
 // Information about one data bucket used in projection.
 struct DataBucket {
   // Raw bucket data, valid if not all buffers are already decompressed,
@@ -70,6 +86,14 @@ struct DataBucket {
   // Sizes of data buffers in the bucket, valid if not all buffers are already
   // decompressed, otherwise empty.
   std::vector<size_t> buffer_sizes;
+  // Whether each data buffer is known to be unused because its field is
+  // excluded by the projection. Such buffers are skipped instead of being kept
+  // when buffers after them are decompressed. Valid together with
+  // `buffer_sizes`.
+  std::vector<bool> buffer_excluded;
+  // Integer encodings of data buffers, valid together with `buffer_sizes`, or
+  // empty if all data buffers of the bucket are stored plain.
+  std::vector<BufferEncodingInfo> buffer_encodings;
   // Decompressor for the remaining data, valid if some but not all buffers are
   // already decompressed, otherwise closed.
   internal::Decompressor<ChainReader<>> decompressor;
@@ -77,12 +101,27 @@ struct DataBucket {
   std::vector<ChainReader<Chain>> buffers;
 };
 
-// Should the data content of the field be decoded?
-enum class FieldIncluded {
-  kYes,
-  kNo,
-  kExistenceOnly,
-};
+// Replaces the contents of `buffer` with the `BufferEncoding::kPlain`
+// representation of its values. Decoded data are limited to `max_size`.
+absl::Status DecodeBufferInPlace(const BufferEncodingInfo& encoding,
+                                 uint64_t max_size,
+                                 ChainReader<Chain>& buffer) {
+  Chain decoded;
+  absl::Status status;
+  if (encoding.encoding == internal::BufferEncoding::kDictionary) {
+    status = internal::DecodeDictionaryBuffer(buffer.src(), max_size, decoded);
+  } else if (internal::IsPackedEncoding(encoding.encoding)) {
+    status = internal::DecodePackedBuffer(encoding.encoding, buffer.src(),
+                                          max_size, decoded);
+  } else {
+    status = internal::DecodeIntegerBuffer(encoding.encoding,
+                                           encoding.wire_type, buffer.src(),
+                                           max_size, decoded);
+  }
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  buffer.Reset(std::move(decoded));
+  return absl::OkStatus();
+}
 
 // Returns `true` if `tag` is a valid protocol buffer tag.
 bool ValidTag(uint32_t tag) {
@@ -103,6 +142,13 @@ bool ValidTag(uint32_t tag) {
 
 namespace internal {
 
+// Should the data content of the field be decoded?
+enum class FieldIncluded : uint8_t {
+  kYes,
+  kNo,
+  kExistenceOnly,
+};
+
 // The types of callbacks in state machine states.
 enum class CallbackType : uint8_t {
   kNoOp,
@@ -368,6 +414,18 @@ inline bool IsImplicit(CallbackType callback_type) {
 struct TransposeDecoder::Context {
   // Compression type of the input.
   CompressionType compression_type = CompressionType::kNone;
+  // Zstd dictionary used for compression of the input.
+  ZstdReaderBase::Dictionary zstd_dictionary;
+  // Brotli dictionary used for compression of the input.
+  BrotliReaderBase::Dictionary brotli_dictionary;
+  // Maximum number of buckets decompressed in background when projection is
+  // disabled.
+  int parallelism = 0;
+  // Alternative implementation of decompression, or `nullptr`.
+  DecompressionBackend* decompression_backend = nullptr;
+  // Size of decoded records, which bounds the size of each decoded data
+  // buffer which is not stored plain.
+  uint64_t decoded_data_size = 0;
   // Buffer containing all the data.
   // Note: Used only when projection is disabled.
   std::vector<ChainReader<Chain>> buffers;
@@ -380,38 +438,90 @@ struct TransposeDecoder::Context {
   // State machine transitions. One byte = one transition.
   internal::Decompressor<> transitions;
 
-  enum class IncludeType : uint8_t {
-    // Field is included.
-    kIncludeFully,
-    // Some child fields are included.
-    kIncludeChild,
-    // Field is existence only.
-    kExistenceOnly,
-  };
-
   // --- Fields used in projection. ---
-  // Holds information about included field.
-  struct IncludedField {
-    // IDs are sequentially assigned to fields from FieldProjection.
-    uint32_t field_id;
-    IncludeType include_type;
-  };
-  // Fields form a tree structure stored in `include_fields` map. If `p` is
-  // the ID of parent submessage then `include_fields[std::make_pair(p, f)]`
-  // holds the include information of the child with field number `f`. The root
-  // ID is assumed to be `kInvalidPos` and the root `IncludeType` is assumed to
-  // be `kIncludeChild`.
-  absl::flat_hash_map<std::pair<uint32_t, int>, IncludedField> include_fields;
   // Data buckets.
   std::vector<DataBucket> buckets;
   // Template that can later be used later to finalize `StateMachineNode`.
   std::vector<StateMachineNodeTemplate> node_templates;
+  // Index of the first buffer of each bucket.
+  std::vector<uint32_t> first_buffer_indices;
+  // Bucket index of each buffer.
+  std::vector<uint32_t> bucket_indices;
+  // Buffers of `kNonProto` nodes, resolved after encodings of buffers are
+  // known: state machine node index, buffer index.
+  std::vector<std::pair<size_t, uint32_t>> nonproto_nodes;
+
+  // --- Scratch space for reading the state machine. ---
+  std::vector<uint32_t> tags;
+  std::vector<uint32_t> next_node_indices;
+  std::string subtypes;
+
+  // Releases data of the last chunk, keeping allocated capacity of vectors, so
+  // that decoding the next chunk of a similar shape does not allocate them
+  // again.
+  void Clear();
 };
 
-bool TransposeDecoder::Decode(uint64_t num_records, uint64_t decoded_data_size,
-                              const FieldProjection& field_projection,
-                              Reader& src, BackwardWriter& dest,
-                              std::vector<size_t>& limits) {
+inline void TransposeDecoder::Context::Clear() {
+  zstd_dictionary = ZstdReaderBase::Dictionary();
+  brotli_dictionary = BrotliReaderBase::Dictionary();
+  buffers.clear();
+  nonproto_lengths = nullptr;
+  first_node = 0;
+  transitions.Reset();
+  buckets.clear();
+  first_buffer_indices.clear();
+  bucket_indices.clear();
+  nonproto_nodes.clear();
+  tags.clear();
+  next_node_indices.clear();
+  subtypes.clear();
+}
+
+TransposeDecoder::TransposeDecoder() noexcept : Object(kInitiallyClosed) {}
+
+TransposeDecoder::~TransposeDecoder() {}
+
+TransposeDecoder::TransposeDecoder(TransposeDecoder&& that) noexcept
+    : Object(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      field_projection_(std::move(that.field_projection_)),
+      field_projection_compiled_(
+          std::exchange(that.field_projection_compiled_, false)),
+      projection_enabled_(that.projection_enabled_),
+      include_fields_(std::move(that.include_fields_)),
+      cached_tags_(std::move(that.cached_tags_)),
+      cached_next_node_indices_(std::move(that.cached_next_node_indices_)),
+      cached_subtypes_(std::move(that.cached_subtypes_)),
+      field_included_(std::move(that.field_included_)),
+      context_(std::move(that.context_)) {}
+
+TransposeDecoder& TransposeDecoder::operator=(
+    TransposeDecoder&& that) noexcept {
+  Object::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  field_projection_ = std::move(that.field_projection_);
+  field_projection_compiled_ =
+      std::exchange(that.field_projection_compiled_, false);
+  projection_enabled_ = that.projection_enabled_;
+  include_fields_ = std::move(that.include_fields_);
+  cached_tags_ = std::move(that.cached_tags_);
+  cached_next_node_indices_ = std::move(that.cached_next_node_indices_);
+  cached_subtypes_ = std::move(that.cached_subtypes_);
+  field_included_ = std::move(that.field_included_);
+  context_ = std::move(that.context_);
+  return *this;
+}
+
+bool TransposeDecoder::Decode(
+    uint64_t num_records, uint64_t decoded_data_size,
+    const FieldProjection& field_projection, Reader& src, BackwardWriter& dest,
+    std::vector<size_t>& limits,
+    const ZstdReaderBase::Dictionary& zstd_dictionary,
+    const BrotliReaderBase::Dictionary& brotli_dictionary, int parallelism,
+    DecompressionBackend* decompression_backend) {
   RIEGELI_ASSERT_EQ(dest.pos(), 0u)
       << "Failed precondition of TransposeDecoder::Reset(): "
          "non-zero destination position";
@@ -424,15 +534,25 @@ bool TransposeDecoder::Decode(uint64_t num_records, uint64_t decoded_data_size,
     return Fail(absl::ResourceExhaustedError("Records too large"));
   }
 
-  Context context;
-  if (ABSL_PREDICT_FALSE(!Parse(context, src, field_projection))) return false;
-  LimitingBackwardWriter<> limiting_dest(&dest, decoded_data_size);
-  if (ABSL_PREDICT_FALSE(
-          !Decode(context, num_records, limiting_dest, limits))) {
-    limiting_dest.Close();
-    return false;
+  if (context_ == nullptr) context_ = std::make_unique<Context>();
+  Context& context = *context_;
+  context.zstd_dictionary = zstd_dictionary;
+  context.brotli_dictionary = brotli_dictionary;
+  context.parallelism = parallelism;
+  context.decompression_backend = decompression_backend;
+  context.decoded_data_size = decoded_data_size;
+  bool ok = Parse(context, src, field_projection);
+  if (ABSL_PREDICT_TRUE(ok)) {
+    LimitingBackwardWriter<> limiting_dest(&dest, decoded_data_size);
+    ok = Decode(context, num_records, limiting_dest, limits);
+    if (ABSL_PREDICT_FALSE(!ok)) {
+      limiting_dest.Close();
+    } else if (ABSL_PREDICT_FALSE(!limiting_dest.Close())) {
+      ok = Fail(limiting_dest);
+    }
   }
-  if (ABSL_PREDICT_FALSE(!limiting_dest.Close())) return Fail(limiting_dest);
+  context.Clear();
+  if (ABSL_PREDICT_FALSE(!ok)) return false;
   RIEGELI_ASSERT_LE(dest.pos(), decoded_data_size)
       << "Decoded data size larger than expected";
   if (field_projection.includes_all() &&
@@ -442,12 +562,22 @@ bool TransposeDecoder::Decode(uint64_t num_records, uint64_t decoded_data_size,
   return true;
 }
 
-inline bool TransposeDecoder::Parse(Context& context, Reader& src,
-                                    const FieldProjection& field_projection) {
-  bool projection_enabled = true;
+inline bool TransposeDecoder::CompileFieldProjection(
+    const FieldProjection& field_projection) {
+  if (field_projection_compiled_ && field_projection == field_projection_) {
+    return true;
+  }
+  field_projection_compiled_ = false;
+  include_fields_.clear();
+  // Decisions in `field_included_` depend on the projection.
+  cached_tags_.clear();
+  cached_next_node_indices_.clear();
+  cached_subtypes_.clear();
+  field_included_.clear();
+  projection_enabled_ = true;
   for (const Field& include_field : field_projection.fields()) {
     if (include_field.path().empty()) {
-      projection_enabled = false;
+      projection_enabled_ = false;
       break;
     }
     size_t path_len = include_field.path().size();
@@ -463,26 +593,35 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
       if (field_number == Field::kExistenceOnly) {
         return false;
       }
-      uint32_t next_id = context.include_fields.size();
-      Context::IncludeType include_type = Context::IncludeType::kIncludeChild;
+      uint32_t next_id = include_fields_.size();
+      IncludeType include_type = IncludeType::kIncludeChild;
       if (i + 1 == path_len) {
-        include_type = existence_only ? Context::IncludeType::kExistenceOnly
-                                      : Context::IncludeType::kIncludeFully;
+        include_type = existence_only ? IncludeType::kExistenceOnly
+                                      : IncludeType::kIncludeFully;
       }
-      Context::IncludedField& val =
-          context.include_fields
+      IncludedField& val =
+          include_fields_
               .emplace(std::make_pair(current_id, field_number),
-                       Context::IncludedField{next_id, include_type})
+                       IncludedField{next_id, include_type})
               .first->second;
       current_id = val.field_id;
-      static_assert(Context::IncludeType::kExistenceOnly >
-                            Context::IncludeType::kIncludeChild &&
-                        Context::IncludeType::kIncludeChild >
-                            Context::IncludeType::kIncludeFully,
+      static_assert(IncludeType::kExistenceOnly > IncludeType::kIncludeChild &&
+                        IncludeType::kIncludeChild > IncludeType::kIncludeFully,
                     "Statement below assumes this ordering");
       val.include_type = std::min(val.include_type, include_type);
     }
   }
+  field_projection_ = field_projection;
+  field_projection_compiled_ = true;
+  return true;
+}
+
+inline bool TransposeDecoder::Parse(Context& context, Reader& src,
+                                    const FieldProjection& field_projection) {
+  if (ABSL_PREDICT_FALSE(!CompileFieldProjection(field_projection))) {
+    return false;
+  }
+  const bool projection_enabled = projection_enabled_;
 
   const absl::optional<uint8_t> compression_type_byte = src.ReadByte();
   if (ABSL_PREDICT_FALSE(compression_type_byte == absl::nullopt)) {
@@ -503,14 +642,16 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
     return Fail(src);
   }
   internal::Decompressor<ChainReader<>> header_decompressor(
-      std::forward_as_tuple(&header), context.compression_type);
+      std::forward_as_tuple(&header), context.compression_type,
+      context.zstd_dictionary, context.brotli_dictionary,
+      context.decompression_backend);
   if (ABSL_PREDICT_FALSE(!header_decompressor.healthy())) {
     return Fail(header_decompressor);
   }
 
   uint32_t num_buffers;
-  std::vector<uint32_t> first_buffer_indices;
-  std::vector<uint32_t> bucket_indices;
+  std::vector<uint32_t>& first_buffer_indices = context.first_buffer_indices;
+  std::vector<uint32_t>& bucket_indices = context.bucket_indices;
   if (projection_enabled) {
     if (ABSL_PREDICT_FALSE(!ParseBuffersForFiltering(
             context, header_decompressor.reader(), src, first_buffer_indices,
@@ -535,13 +676,20 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
   }
   // Additional `0xff` nodes to correctly handle invalid/malicious inputs.
   // TODO: Handle overflow.
-  context.state_machine_nodes.resize(*state_machine_size + 0xff);
-  if (projection_enabled) context.node_templates.resize(*state_machine_size);
+  context.state_machine_nodes.assign(*state_machine_size + 0xff,
+                                     StateMachineNode());
+  if (projection_enabled) {
+    context.node_templates.assign(*state_machine_size,
+                                  StateMachineNodeTemplate());
+  }
   std::vector<StateMachineNode>& state_machine_nodes =
       context.state_machine_nodes;
   bool has_nonproto_op = false;
+  // With projection, buffers of `kNonProto` nodes are resolved later.
+  std::vector<std::pair<size_t, uint32_t>>& nonproto_nodes =
+      context.nonproto_nodes;
   size_t num_subtypes = 0;
-  std::vector<uint32_t> tags;
+  std::vector<uint32_t>& tags = context.tags;
   tags.reserve(*state_machine_size);
   for (size_t i = 0; i < *state_machine_size; ++i) {
     const absl::optional<uint32_t> tag =
@@ -554,7 +702,7 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
     tags.push_back(*tag);
     if (ValidTag(*tag) && internal::HasSubtype(*tag)) ++num_subtypes;
   }
-  std::vector<uint32_t> next_node_indices;
+  std::vector<uint32_t>& next_node_indices = context.next_node_indices;
   next_node_indices.reserve(*state_machine_size);
   for (size_t i = 0; i < *state_machine_size; ++i) {
     const absl::optional<uint32_t> next_node =
@@ -566,13 +714,24 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
     }
     next_node_indices.push_back(*next_node);
   }
-  std::string subtypes;
+  std::string& subtypes = context.subtypes;
   if (ABSL_PREDICT_FALSE(
           !header_decompressor.reader().Read(num_subtypes, subtypes))) {
     header_decompressor.reader().Fail(
         absl::DataLossError("Reading subtypes failed"));
     return Fail(header_decompressor.reader());
   }
+  if (projection_enabled &&
+      (field_included_.size() != *state_machine_size || tags != cached_tags_ ||
+       next_node_indices != cached_next_node_indices_ ||
+       subtypes != cached_subtypes_)) {
+    // The state machine differs from the cached one. Decisions which fields
+    // are included will be made again as nodes are reached.
+    cached_tags_ = tags;
+    cached_next_node_indices_ = next_node_indices;
+    cached_subtypes_ = subtypes;
+    field_included_.assign(*state_machine_size, absl::nullopt);
+  }
   size_t subtype_index = 0;
   for (size_t i = 0; i < *state_machine_size; ++i) {
     uint32_t tag = tags[i];
@@ -595,12 +754,7 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
           return Fail(absl::DataLossError("Buffer index too large"));
         }
         if (projection_enabled) {
-          const uint32_t bucket = bucket_indices[*buffer_index];
-          state_machine_node.buffer = GetBuffer(
-              context, bucket, *buffer_index - first_buffer_indices[bucket]);
-          if (ABSL_PREDICT_FALSE(state_machine_node.buffer == nullptr)) {
-            return false;
-          }
+          nonproto_nodes.emplace_back(i, *buffer_index);
         } else {
           state_machine_node.buffer = &context.buffers[*buffer_index];
         }
@@ -617,6 +771,13 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
           state_machine_node.node_template = &context.node_templates[i];
           state_machine_node.callback_type =
               internal::CallbackType::kSelectCallback;
+          if (field_included_[i] != absl::nullopt) {
+            // The decision was made for the same node of the previous chunk.
+            if (ABSL_PREDICT_FALSE(!ApplyFieldIncluded(
+                    context, *field_included_[i], state_machine_node))) {
+              return false;
+            }
+          }
         } else {
           state_machine_node.callback_type =
               internal::CallbackType::kSubmessageStart;
@@ -683,9 +844,9 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
             }
             state_machine_node.buffer = &context.buffers[*buffer_index];
           }
-          state_machine_node.callback_type =
-              internal::GetCallbackType(FieldIncluded::kYes, tag, subtype,
-                                        tag_length, projection_enabled);
+          state_machine_node.callback_type = internal::GetCallbackType(
+              internal::FieldIncluded::kYes, tag, subtype, tag_length,
+              projection_enabled);
           if (ABSL_PREDICT_FALSE(state_machine_node.callback_type ==
                                  internal::CallbackType::kUnknown)) {
             return Fail(absl::DataLossError("Invalid node"));
@@ -700,6 +861,16 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
           state_machine_node.tag_data.data[tag_length] = 0;
         }
         state_machine_node.tag_data.size = IntCast<uint8_t>(tag_length);
+        if (projection_enabled && field_included_[i] != absl::nullopt &&
+            *field_included_[i] != internal::FieldIncluded::kYes) {
+          // The field was excluded from the same node of the previous chunk.
+          // Included fields are resolved when the node is first reached, so
+          // that their buckets are decompressed only when needed.
+          if (ABSL_PREDICT_FALSE(!ApplyFieldIncluded(
+                  context, *field_included_[i], state_machine_node))) {
+            return false;
+          }
+        }
       }
     }
     uint32_t next_node_id = next_node_indices[i];
@@ -716,6 +887,34 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
     state_machine_node.next_node = &state_machine_nodes[next_node_id];
   }
 
+  const absl::optional<uint32_t> first_node =
+      ReadVarint32(header_decompressor.reader());
+  if (ABSL_PREDICT_FALSE(first_node == absl::nullopt)) {
+    header_decompressor.reader().Fail(
+        absl::DataLossError("Reading first node index failed"));
+    return Fail(header_decompressor.reader());
+  }
+  if (ABSL_PREDICT_FALSE(*first_node >= *state_machine_size)) {
+    return Fail(absl::DataLossError("First node index too large"));
+  }
+  context.first_node = *first_node;
+
+  if (ABSL_PREDICT_FALSE(!ParseBufferEncodings(
+          context, header_decompressor.reader(), num_buffers,
+          first_buffer_indices, bucket_indices))) {
+    return false;
+  }
+  for (const std::pair<size_t, uint32_t>& nonproto_node : nonproto_nodes) {
+    const uint32_t bucket = bucket_indices[nonproto_node.second];
+    state_machine_nodes[nonproto_node.first].buffer =
+        GetBuffer(context, bucket,
+                  nonproto_node.second - first_buffer_indices[bucket]);
+    if (ABSL_PREDICT_FALSE(state_machine_nodes[nonproto_node.first].buffer ==
+                           nullptr)) {
+      return false;
+    }
+  }
+
   if (has_nonproto_op) {
     // If non-proto state exists then the last buffer is the
     // `nonproto_lengths` buffer.
@@ -734,18 +933,6 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
     }
   }
 
-  const absl::optional<uint32_t> first_node =
-      ReadVarint32(header_decompressor.reader());
-  if (ABSL_PREDICT_FALSE(first_node == absl::nullopt)) {
-    header_decompressor.reader().Fail(
-        absl::DataLossError("Reading first node index failed"));
-    return Fail(header_decompressor.reader());
-  }
-  if (ABSL_PREDICT_FALSE(*first_node >= *state_machine_size)) {
-    return Fail(absl::DataLossError("First node index too large"));
-  }
-  context.first_node = *first_node;
-
   // Add `0xff` failure nodes so we never overflow this array.
   for (uint64_t i = *state_machine_size; i < *state_machine_size + 0xff; ++i) {
     state_machine_nodes[i].callback_type = internal::CallbackType::kFailure;
@@ -758,7 +945,9 @@ inline bool TransposeDecoder::Parse(Context& context, Reader& src,
   if (ABSL_PREDICT_FALSE(!header_decompressor.VerifyEndAndClose())) {
     return Fail(header_decompressor);
   }
-  context.transitions.Reset(&src, context.compression_type);
+  context.transitions.Reset(&src, context.compression_type,
+                            context.zstd_dictionary, context.brotli_dictionary,
+                            context.decompression_backend);
   if (ABSL_PREDICT_FALSE(!context.transitions.healthy())) {
     return Fail(context.transitions);
   }
@@ -786,6 +975,10 @@ inline bool TransposeDecoder::ParseBuffers(Context& context,
     }
     return true;
   }
+  if (context.parallelism > 0 && *num_buckets > 1) {
+    return ParseBuffersInParallel(context, header_reader, src, *num_buckets,
+                                  *num_buffers);
+  }
   context.buffers.reserve(*num_buffers);
   std::vector<internal::Decompressor<ChainReader<Chain>>> bucket_decompressors;
   if (ABSL_PREDICT_FALSE(*num_buckets > bucket_decompressors.max_size())) {
@@ -809,7 +1002,10 @@ inline bool TransposeDecoder::ParseBuffers(Context& context,
       return Fail(src);
     }
     bucket_decompressors.emplace_back(std::forward_as_tuple(std::move(bucket)),
-                                      context.compression_type);
+                                      context.compression_type,
+                                      context.zstd_dictionary,
+                                      context.brotli_dictionary,
+                                      context.decompression_backend);
     if (ABSL_PREDICT_FALSE(!bucket_decompressors.back().healthy())) {
       return Fail(bucket_decompressors.back());
     }
@@ -853,6 +1049,141 @@ inline bool TransposeDecoder::ParseBuffers(Context& context,
   return true;
 }
 
+inline bool TransposeDecoder::ParseBuffersInParallel(Context& context,
+                                                     Reader& header_reader,
+                                                     Reader& src,
+                                                     uint32_t num_buckets,
+                                                     uint32_t num_buffers) {
+  RIEGELI_ASSERT_GT(context.parallelism, 0)
+      << "Failed precondition of TransposeDecoder::ParseBuffersInParallel(): "
+         "no parallelism";
+  if (ABSL_PREDICT_FALSE(num_buckets > context.buckets.max_size())) {
+    return Fail(absl::ResourceExhaustedError("Too many buckets"));
+  }
+  // Only `compressed_data` and `buffer_sizes` of `context.buckets` are used
+  // here.
+  context.buckets.resize(num_buckets);
+  for (DataBucket& bucket : context.buckets) {
+    const absl::optional<uint64_t> bucket_length = ReadVarint64(header_reader);
+    if (ABSL_PREDICT_FALSE(bucket_length == absl::nullopt)) {
+      header_reader.Fail(absl::DataLossError("Reading bucket length failed"));
+      return Fail(header_reader);
+    }
+    if (ABSL_PREDICT_FALSE(*bucket_length >
+                           std::numeric_limits<size_t>::max())) {
+      return Fail(absl::ResourceExhaustedError("Bucket too large"));
+    }
+    if (ABSL_PREDICT_FALSE(!src.Read(IntCast<size_t>(*bucket_length),
+                                     bucket.compressed_data))) {
+      src.Fail(absl::DataLossError("Reading bucket failed"));
+      return Fail(src);
+    }
+  }
+
+  // Assign buffers to buckets before decompressing them, using uncompressed
+  // sizes of buckets.
+  uint32_t bucket_index = 0;
+  absl::optional<uint64_t> remaining_bucket_size = internal::UncompressedSize(
+      context.buckets[0].compressed_data, context.compression_type);
+  if (ABSL_PREDICT_FALSE(remaining_bucket_size == absl::nullopt)) {
+    return Fail(absl::DataLossError("Reading uncompressed size failed"));
+  }
+  for (uint32_t buffer_index = 0; buffer_index < num_buffers; ++buffer_index) {
+    const absl::optional<uint64_t> buffer_length = ReadVarint64(header_reader);
+    if (ABSL_PREDICT_FALSE(buffer_length == absl::nullopt)) {
+      header_reader.Fail(absl::DataLossError("Reading buffer length failed"));
+      return Fail(header_reader);
+    }
+    if (ABSL_PREDICT_FALSE(*buffer_length >
+                           std::numeric_limits<size_t>::max())) {
+      return Fail(absl::ResourceExhaustedError("Buffer too large"));
+    }
+    if (ABSL_PREDICT_FALSE(*buffer_length > *remaining_bucket_size)) {
+      return Fail(absl::DataLossError("Buffer does not fit in bucket"));
+    }
+    context.buckets[bucket_index].buffer_sizes.push_back(
+        IntCast<size_t>(*buffer_length));
+    *remaining_bucket_size -= *buffer_length;
+    while (*remaining_bucket_size == 0 && bucket_index + 1 < num_buckets) {
+      ++bucket_index;
+      remaining_bucket_size = internal::UncompressedSize(
+          context.buckets[bucket_index].compressed_data,
+          context.compression_type);
+      if (ABSL_PREDICT_FALSE(remaining_bucket_size == absl::nullopt)) {
+        return Fail(absl::DataLossError("Reading uncompressed size failed"));
+      }
+    }
+  }
+  if (ABSL_PREDICT_FALSE(bucket_index + 1 < num_buckets)) {
+    return Fail(absl::DataLossError("Too few buckets"));
+  }
+  if (ABSL_PREDICT_FALSE(*remaining_bucket_size > 0)) {
+    return Fail(absl::DataLossError("End of data expected"));
+  }
+
+  // Decompress bucket `i` into `bucket_buffers[i]`, reporting a failure in
+  // `bucket_statuses[i]`. Buckets are distributed cyclically among
+  // `num_tasks` tasks, the first of which runs in the calling thread.
+  std::vector<std::vector<Chain>> bucket_buffers(num_buckets);
+  std::vector<absl::Status> bucket_statuses(num_buckets);
+  const uint32_t num_tasks =
+      UnsignedMin(num_buckets, IntCast<uint32_t>(context.parallelism) + 1);
+  const auto decompress_buckets = [&](uint32_t first_bucket) {
+    for (uint32_t i = first_bucket; i < num_buckets; i += num_tasks) {
+      DataBucket& bucket = context.buckets[i];
+      internal::Decompressor<ChainReader<>> decompressor(
+          std::forward_as_tuple(&bucket.compressed_data),
+          context.compression_type, context.zstd_dictionary,
+          context.brotli_dictionary, context.decompression_backend);
+      if (ABSL_PREDICT_FALSE(!decompressor.healthy())) {
+        bucket_statuses[i] = decompressor.status();
+        continue;
+      }
+      bucket_buffers[i].reserve(bucket.buffer_sizes.size());
+      for (const size_t buffer_size : bucket.buffer_sizes) {
+        Chain buffer;
+        if (ABSL_PREDICT_FALSE(
+                !decompressor.reader().Read(buffer_size, buffer))) {
+          decompressor.reader().Fail(
+              absl::DataLossError("Reading buffer failed"));
+          bucket_statuses[i] = decompressor.reader().status();
+          break;
+        }
+        bucket_buffers[i].push_back(std::move(buffer));
+      }
+      if (ABSL_PREDICT_FALSE(!bucket_statuses[i].ok())) continue;
+      if (ABSL_PREDICT_FALSE(!decompressor.VerifyEndAndClose())) {
+        bucket_statuses[i] = decompressor.status();
+        continue;
+      }
+      // Free memory early.
+      bucket.compressed_data = Chain();
+    }
+  };
+  absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+  for (uint32_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&decompress_buckets, &background_tasks,
+                                   task] {
+      decompress_buckets(task);
+      background_tasks.DecrementCount();
+    });
+  }
+  decompress_buckets(0);
+  background_tasks.Wait();
+
+  context.buffers.reserve(num_buffers);
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    if (ABSL_PREDICT_FALSE(!bucket_statuses[i].ok())) {
+      return Fail(std::move(bucket_statuses[i]));
+    }
+    for (Chain& buffer : bucket_buffers[i]) {
+      context.buffers.emplace_back(std::move(buffer));
+    }
+  }
+  context.buckets.clear();
+  return true;
+}
+
 inline bool TransposeDecoder::ParseBuffersForFiltering(
     Context& context, Reader& header_reader, Reader& src,
     std::vector<uint32_t>& first_buffer_indices,
@@ -919,6 +1250,7 @@ inline bool TransposeDecoder::ParseBuffersForFiltering(
     }
     context.buckets[bucket_index].buffer_sizes.push_back(
         IntCast<size_t>(*buffer_length));
+    context.buckets[bucket_index].buffer_excluded.push_back(false);
     if (ABSL_PREDICT_FALSE(*buffer_length > *remaining_bucket_size)) {
       return Fail(absl::DataLossError("Buffer does not fit in bucket"));
     }
@@ -944,6 +1276,68 @@ inline bool TransposeDecoder::ParseBuffersForFiltering(
   return true;
 }
 
+inline bool TransposeDecoder::ParseBufferEncodings(
+    Context& context, Reader& header_reader, uint32_t num_buffers,
+    const std::vector<uint32_t>& first_buffer_indices,
+    const std::vector<uint32_t>& bucket_indices) {
+  // The list of encodings is present only if some buffer is not stored plain.
+  if (!header_reader.Pull()) {
+    if (ABSL_PREDICT_FALSE(!header_reader.healthy())) {
+      return Fail(header_reader);
+    }
+    return true;
+  }
+  const absl::optional<uint32_t> num_encoded_buffers =
+      ReadVarint32(header_reader);
+  if (ABSL_PREDICT_FALSE(num_encoded_buffers == absl::nullopt)) {
+    header_reader.Fail(
+        absl::DataLossError("Reading number of encoded buffers failed"));
+    return Fail(header_reader);
+  }
+  if (ABSL_PREDICT_FALSE(*num_encoded_buffers > num_buffers)) {
+    return Fail(absl::DataLossError("Too many encoded buffers"));
+  }
+  for (uint32_t i = 0; i < *num_encoded_buffers; ++i) {
+    const absl::optional<uint32_t> buffer_index = ReadVarint32(header_reader);
+    if (ABSL_PREDICT_FALSE(buffer_index == absl::nullopt)) {
+      header_reader.Fail(absl::DataLossError("Reading buffer index failed"));
+      return Fail(header_reader);
+    }
+    if (ABSL_PREDICT_FALSE(*buffer_index >= num_buffers)) {
+      return Fail(absl::DataLossError("Buffer index too large"));
+    }
+    const absl::optional<uint8_t> wire_type_byte = header_reader.ReadByte();
+    const absl::optional<uint8_t> encoding_byte =
+        wire_type_byte == absl::nullopt ? absl::nullopt
+                                        : header_reader.ReadByte();
+    if (ABSL_PREDICT_FALSE(encoding_byte == absl::nullopt)) {
+      header_reader.Fail(absl::DataLossError("Reading buffer encoding failed"));
+      return Fail(header_reader);
+    }
+    BufferEncodingInfo encoding;
+    encoding.wire_type = static_cast<WireType>(*wire_type_byte);
+    encoding.encoding = static_cast<internal::BufferEncoding>(*encoding_byte);
+    if (ABSL_PREDICT_FALSE(!internal::ValidBufferEncoding(encoding.wire_type,
+                                                          encoding.encoding))) {
+      return Fail(absl::DataLossError("Invalid buffer encoding"));
+    }
+    if (projection_enabled_) {
+      // Buffers are decoded when their buckets are decompressed.
+      const uint32_t bucket_index = bucket_indices[*buffer_index];
+      DataBucket& bucket = context.buckets[bucket_index];
+      bucket.buffer_encodings.resize(bucket.buffer_sizes.size());
+      bucket.buffer_encodings[*buffer_index -
+                                      first_buffer_indices[bucket_index]] =
+          encoding;
+    } else {
+      const absl::Status status = DecodeBufferInPlace(
+          encoding, context.decoded_data_size, context.buffers[*buffer_index]);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(status);
+    }
+  }
+  return true;
+}
+
 inline Reader* TransposeDecoder::GetBuffer(Context& context,
                                            uint32_t bucket_index,
                                            uint32_t index_within_bucket) {
@@ -958,7 +1352,10 @@ inline Reader* TransposeDecoder::GetBuffer(Context& context,
     if (bucket.buffers.empty()) {
       // This is the first buffer to be decompressed from this bucket.
       bucket.decompressor.Reset(std::forward_as_tuple(&bucket.compressed_data),
-                                context.compression_type);
+                                context.compression_type,
+                                context.zstd_dictionary,
+                                context.brotli_dictionary,
+                                context.decompression_backend);
       if (ABSL_PREDICT_FALSE(!bucket.decompressor.healthy())) {
         Fail(bucket.decompressor);
         return nullptr;
@@ -966,15 +1363,37 @@ inline Reader* TransposeDecoder::GetBuffer(Context& context,
       // Important to prevent invalidating pointers by `emplace_back()`.
       bucket.buffers.reserve(bucket.buffer_sizes.size());
     }
+    const size_t buffer_size = bucket.buffer_sizes[bucket.buffers.size()];
+    const bool skip = bucket.buffers.size() != index_within_bucket &&
+                      bucket.buffer_excluded[bucket.buffers.size()];
     Chain buffer;
-    if (ABSL_PREDICT_FALSE(!bucket.decompressor.reader().Read(
-            bucket.buffer_sizes[bucket.buffers.size()], buffer))) {
+    if (skip) {
+      // This buffer will not be used. Do not keep it in memory.
+      if (ABSL_PREDICT_FALSE(!bucket.decompressor.reader().Skip(buffer_size))) {
+        bucket.decompressor.reader().Fail(
+            absl::DataLossError("Skipping buffer failed"));
+        Fail(bucket.decompressor.reader());
+        return nullptr;
+      }
+    } else if (ABSL_PREDICT_FALSE(!bucket.decompressor.reader().Read(
+                   buffer_size, buffer))) {
       bucket.decompressor.reader().Fail(
           absl::DataLossError("Reading buffer failed"));
       Fail(bucket.decompressor.reader());
       return nullptr;
     }
     bucket.buffers.emplace_back(std::move(buffer));
+    if (!skip && !bucket.buffer_encodings.empty() &&
+        bucket.buffer_encodings[bucket.buffers.size() - 1].encoding !=
+            internal::BufferEncoding::kPlain) {
+      const absl::Status status = DecodeBufferInPlace(
+          bucket.buffer_encodings[bucket.buffers.size() - 1],
+          context.decoded_data_size, bucket.buffers.back());
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        Fail(status);
+        return nullptr;
+      }
+    }
     if (bucket.buffers.size() == bucket.buffer_sizes.size()) {
       // This was the last decompressed buffer from this bucket.
       if (ABSL_PREDICT_FALSE(!bucket.decompressor.VerifyEndAndClose())) {
@@ -984,6 +1403,8 @@ inline Reader* TransposeDecoder::GetBuffer(Context& context,
       // Free memory of fields which are no longer needed.
       bucket.compressed_data = Chain();
       bucket.buffer_sizes = std::vector<size_t>();
+      bucket.buffer_excluded = std::vector<bool>();
+      bucket.buffer_encodings = std::vector<BufferEncodingInfo>();
     }
   }
   return &bucket.buffers[index_within_bucket];
@@ -1335,34 +1756,39 @@ ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
     Context& context, int skipped_submessage_level,
     const std::vector<SubmessageStackElement>& submessage_stack,
     StateMachineNode& node) {
-  const bool is_implicit = internal::IsImplicit(node.callback_type);
+  const size_t node_index = IntCast<size_t>(
+      PtrDistance(context.state_machine_nodes.data(), &node));
+  RIEGELI_ASSERT_LT(node_index, field_included_.size())
+      << "Node with a template out of range of the state machine";
+  if (field_included_[node_index] != absl::nullopt) {
+    // The decision was made for the same node of the previous chunk.
+    return ApplyFieldIncluded(context, *field_included_[node_index], node);
+  }
   StateMachineNodeTemplate* node_template = node.node_template;
+  internal::FieldIncluded field_included = internal::FieldIncluded::kNo;
   if (node_template->tag ==
       static_cast<uint32_t>(internal::MessageId::kStartOfSubmessage)) {
-    if (skipped_submessage_level > 0) {
-      node.callback_type = internal::CallbackType::kSkippedSubmessageStart;
-    } else {
-      node.callback_type = internal::CallbackType::kSubmessageStart;
+    if (skipped_submessage_level == 0) {
+      field_included = internal::FieldIncluded::kYes;
     }
   } else {
-    FieldIncluded field_included = FieldIncluded::kNo;
     uint32_t field_id = kInvalidPos;
     if (skipped_submessage_level == 0) {
-      field_included = FieldIncluded::kExistenceOnly;
+      field_included = internal::FieldIncluded::kExistenceOnly;
       for (const SubmessageStackElement& elem : submessage_stack) {
         const absl::optional<ReadFromStringResult<uint32_t>> tag = ReadVarint32(
             elem.tag_data.data, elem.tag_data.data + kMaxLengthVarint32);
         if (tag == absl::nullopt) RIEGELI_ASSERT_UNREACHABLE() << "Invalid tag";
         const absl::flat_hash_map<std::pair<uint32_t, int>,
-                                  Context::IncludedField>::const_iterator iter =
-            context.include_fields.find(
+                                  IncludedField>::const_iterator iter =
+            include_fields_.find(
                 std::make_pair(field_id, GetTagFieldNumber(tag->value)));
-        if (iter == context.include_fields.end()) {
-          field_included = FieldIncluded::kNo;
+        if (iter == include_fields_.end()) {
+          field_included = internal::FieldIncluded::kNo;
           break;
         }
-        if (iter->second.include_type == Context::IncludeType::kIncludeFully) {
-          field_included = FieldIncluded::kYes;
+        if (iter->second.include_type == IncludeType::kIncludeFully) {
+          field_included = internal::FieldIncluded::kYes;
           break;
         }
         field_id = iter->second.field_id;
@@ -1374,39 +1800,62 @@ ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
     //    In this case `field_included` is already set to `kNo`.
     // 2. If `kEndGroup` was not skipped, then its tag is on the top of the
     //    `submessage_stack` and in that case we already checked its tag in
-    //    `include_fields` in the loop above.
+    //    `include_fields_` in the loop above.
     const bool start_group_tag =
         GetTagWireType(node_template->tag) == WireType::kStartGroup;
-    if (!start_group_tag && field_included == FieldIncluded::kExistenceOnly) {
+    if (!start_group_tag &&
+        field_included == internal::FieldIncluded::kExistenceOnly) {
       const absl::optional<ReadFromStringResult<uint32_t>> tag = ReadVarint32(
           node.tag_data.data, node.tag_data.data + kMaxLengthVarint32);
       if (tag == absl::nullopt) RIEGELI_ASSERT_UNREACHABLE() << "Invalid tag";
       const absl::flat_hash_map<std::pair<uint32_t, int>,
-                                Context::IncludedField>::const_iterator iter =
-          context.include_fields.find(
+                                IncludedField>::const_iterator iter =
+          include_fields_.find(
               std::make_pair(field_id, GetTagFieldNumber(tag->value)));
-      if (iter == context.include_fields.end()) {
-        field_included = FieldIncluded::kNo;
+      if (iter == include_fields_.end()) {
+        field_included = internal::FieldIncluded::kNo;
       } else {
-        if (iter->second.include_type == Context::IncludeType::kIncludeFully ||
-            iter->second.include_type == Context::IncludeType::kIncludeChild) {
-          field_included = FieldIncluded::kYes;
+        if (iter->second.include_type == IncludeType::kIncludeFully ||
+            iter->second.include_type == IncludeType::kIncludeChild) {
+          field_included = internal::FieldIncluded::kYes;
         }
       }
     }
+  }
+  field_included_[node_index] = field_included;
+  return ApplyFieldIncluded(context, field_included, node);
+}
+
+inline bool TransposeDecoder::ApplyFieldIncluded(
+    Context& context, internal::FieldIncluded field_included,
+    StateMachineNode& node) {
+  const bool is_implicit = internal::IsImplicit(node.callback_type);
+  StateMachineNodeTemplate* node_template = node.node_template;
+  if (node_template->tag ==
+      static_cast<uint32_t>(internal::MessageId::kStartOfSubmessage)) {
+    if (field_included == internal::FieldIncluded::kNo) {
+      node.callback_type = internal::CallbackType::kSkippedSubmessageStart;
+    } else {
+      node.callback_type = internal::CallbackType::kSubmessageStart;
+    }
+  } else {
     if (node_template->bucket_index != kInvalidPos) {
       switch (field_included) {
-        case FieldIncluded::kYes:
+        case internal::FieldIncluded::kYes:
           node.buffer = GetBuffer(context, node_template->bucket_index,
                                   node_template->buffer_within_bucket_index);
           if (ABSL_PREDICT_FALSE(node.buffer == nullptr)) return false;
           break;
-        case FieldIncluded::kNo:
-          node.buffer = kEmptyReader();
-          break;
-        case FieldIncluded::kExistenceOnly:
+        case internal::FieldIncluded::kNo:
+        case internal::FieldIncluded::kExistenceOnly: {
           node.buffer = kEmptyReader();
-          break;
+          DataBucket& bucket = context.buckets[node_template->bucket_index];
+          if (node_template->buffer_within_bucket_index <
+              bucket.buffer_excluded.size()) {
+            bucket.buffer_excluded[node_template->buffer_within_bucket_index] =
+                true;
+          }
+        } break;
       }
     } else {
       node.buffer = kEmptyReader();
@@ -1414,7 +1863,7 @@ ABSL_ATTRIBUTE_NOINLINE inline bool TransposeDecoder::SetCallbackType(
     node.callback_type = GetCallbackType(field_included, node_template->tag,
                                          node_template->subtype,
                                          node_template->tag_length, true);
-    if (field_included == FieldIncluded::kExistenceOnly &&
+    if (field_included == internal::FieldIncluded::kExistenceOnly &&
         GetTagWireType(node_template->tag) == WireType::kVarint) {
       // The tag in `TagData` was followed by a subtype but must be followed by
       // zero now.
@@ -18,34 +18,74 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
 #include "riegeli/base/object.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/decompression_backend.h"
 #include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
 #include "riegeli/varint/varint_writing.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 namespace riegeli {
 
 namespace internal {
 enum class CallbackType : uint8_t;
+enum class FieldIncluded : uint8_t;
 }  // namespace internal
 
 class TransposeDecoder : public Object {
  public:
   // Creates a closed `TransposeDecoder`.
-  TransposeDecoder() noexcept : Object(kInitiallyClosed) {}
+  TransposeDecoder() noexcept;
 
   TransposeDecoder(const TransposeDecoder&) = delete;
   TransposeDecoder& operator=(const TransposeDecoder&) = delete;
 
+  TransposeDecoder(TransposeDecoder&& that) noexcept;
+  TransposeDecoder& operator=(TransposeDecoder&& that) noexcept;
+
+  ~TransposeDecoder();
+
   // Resets the `TransposeDecoder` and parses the chunk.
   //
   // Writes concatenated record values to `dest`. Sets `limits` to sorted
   // record end positions.
   //
+  // Records are decoded from the last one to the first one, because the
+  // encoder writes transitions and buffers backwards. Hence no record can be
+  // returned before the whole chunk is decoded, and memory needed for decoding
+  // is proportional to the decoded chunk size. To bound it, write smaller
+  // chunks with `RecordWriterBase::Options::set_chunk_size()`.
+  //
+  // `field_projection` is compiled once and reused while following calls pass
+  // an equal `field_projection`. If consecutive chunks have the same state
+  // machine, decisions which fields are included are reused too, so that only
+  // buffers of included fields are touched without per-chunk setup.
+  //
+  // Memory allocated for the state machine and the list of data buffers is
+  // kept for the next call, so that decoding chunks of a similar shape does
+  // not allocate it again.
+  //
+  // If the chunk was compressed with Zstd or Brotli, `zstd_dictionary` or
+  // `brotli_dictionary` respectively must be the dictionary used for
+  // compression.
+  //
+  // If `parallelism > 0` and projection is disabled, up to `parallelism`
+  // buckets are decompressed at once in `ThreadPool::global()`, in addition to
+  // the calling thread.
+  //
+  // If `decompression_backend` is not `nullptr`, it is offered decompression
+  // of the header, buckets, and transitions.
+  //
   // Precondition: `dest.pos() == 0`
   //
   // Return values:
@@ -54,9 +94,31 @@ class TransposeDecoder : public Object {
   //              if `!dest.healthy()` then the problem was at `dest`
   bool Decode(uint64_t num_records, uint64_t decoded_data_size,
               const FieldProjection& field_projection, Reader& src,
-              BackwardWriter& dest, std::vector<size_t>& limits);
+              BackwardWriter& dest, std::vector<size_t>& limits,
+              const ZstdReaderBase::Dictionary& zstd_dictionary =
+                  ZstdReaderBase::Dictionary(),
+              const BrotliReaderBase::Dictionary& brotli_dictionary =
+                  BrotliReaderBase::Dictionary(),
+              int parallelism = 0,
+              DecompressionBackend* decompression_backend = nullptr);
 
  private:
+  enum class IncludeType : uint8_t {
+    // Field is included.
+    kIncludeFully,
+    // Some child fields are included.
+    kIncludeChild,
+    // Field is existence only.
+    kExistenceOnly,
+  };
+
+  // Holds information about included field.
+  struct IncludedField {
+    // IDs are sequentially assigned to fields from FieldProjection.
+    uint32_t field_id;
+    IncludeType include_type;
+  };
+
   // Information about one proto tag.
   struct TagData {
     // `data` contains varint encoded tag (1 to 5 bytes) followed by inline
@@ -116,6 +178,11 @@ class TransposeDecoder : public Object {
 
   struct Context;
 
+  // Compiles `field_projection` into `include_fields_` unless it is equal to
+  // `field_projection_`. Invalidates the state machine cache if the projection
+  // changed.
+  bool CompileFieldProjection(const FieldProjection& field_projection);
+
   bool Parse(Context& context, Reader& src,
              const FieldProjection& field_projection);
 
@@ -124,6 +191,13 @@ class TransposeDecoder : public Object {
   // initially decompressed.
   bool ParseBuffers(Context& context, Reader& header_reader, Reader& src);
 
+  // Like `ParseBuffers()`, but decompresses buckets in parallel.
+  //
+  // Precondition: `context.parallelism > 0`
+  bool ParseBuffersInParallel(Context& context, Reader& header_reader,
+                              Reader& src, uint32_t num_buckets,
+                              uint32_t num_buffers);
+
   // Parse data buffers in `header_reader` and `src` into `context.buckets`.
   // When projection is enabled, buckets are decompressed on demand.
   // `bucket_indices` contains bucket index for each buffer.
@@ -133,6 +207,15 @@ class TransposeDecoder : public Object {
                                 std::vector<uint32_t>& first_buffer_indices,
                                 std::vector<uint32_t>& bucket_indices);
 
+  // Reads the optional list of encodings of data buffers at the end of the
+  // header. Without projection, decodes the buffers; with projection, records
+  // the encodings, so that buffers are decoded when their buckets are
+  // decompressed.
+  bool ParseBufferEncodings(Context& context, Reader& header_reader,
+                            uint32_t num_buffers,
+                            const std::vector<uint32_t>& first_buffer_indices,
+                            const std::vector<uint32_t>& bucket_indices);
+
   // Precondition: `projection_enabled`.
   Reader* GetBuffer(Context& context, uint32_t bucket_index,
                     uint32_t index_within_bucket);
@@ -144,11 +227,47 @@ class TransposeDecoder : public Object {
               std::vector<size_t>& limits);
 
   // Set `callback_type` in `node` based on `skipped_submessage_level`,
-  // `submessage_stack`, and `node.node_template`.
+  // `submessage_stack`, and `node.node_template`, and remember the decision in
+  // `field_included_`. If a decision is already remembered, it is used
+  // instead.
   bool SetCallbackType(
       Context& context, int skipped_submessage_level,
       const std::vector<SubmessageStackElement>& submessage_stack,
       StateMachineNode& node);
+
+  // Set `callback_type` and `buffer` in `node` based on `field_included` and
+  // `node.node_template`. The buffer of an excluded field is marked as unused,
+  // so that it is not kept in memory when its bucket is decompressed.
+  bool ApplyFieldIncluded(Context& context,
+                          internal::FieldIncluded field_included,
+                          StateMachineNode& node);
+
+  // The last compiled field projection, valid if `field_projection_compiled_`.
+  FieldProjection field_projection_;
+  bool field_projection_compiled_ = false;
+  // `false` if `field_projection_` includes all fields.
+  bool projection_enabled_ = false;
+  // Fields form a tree structure stored in `include_fields_` map. If `p` is
+  // the ID of parent submessage then `include_fields_[std::make_pair(p, f)]`
+  // holds the include information of the child with field number `f`. The root
+  // ID is assumed to be `kInvalidPos` and the root `IncludeType` is assumed to
+  // be `kIncludeChild`.
+  absl::flat_hash_map<std::pair<uint32_t, int>, IncludedField> include_fields_;
+
+  // State machine of the last chunk decoded with projection enabled, as read
+  // from its header. If the next chunk has the same state machine, then
+  // `field_included_` applies to it too.
+  std::vector<uint32_t> cached_tags_;
+  std::vector<uint32_t> cached_next_node_indices_;
+  std::string cached_subtypes_;
+  // For each node of the cached state machine, whether the field is included,
+  // or `absl::nullopt` if this has not been determined yet. For
+  // `MessageId::kStartOfSubmessage` nodes, `kNo` means a skipped submessage.
+  std::vector<absl::optional<internal::FieldIncluded>> field_included_;
+
+  // State of decoding a chunk, kept across chunks so that its vectors are
+  // reused, or `nullptr` before the first chunk.
+  std::unique_ptr<Context> context_;
 };
 
 }  // namespace riegeli
@@ -0,0 +1,134 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/transpose_dictionary_encoding.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+// Reads a string together with its length prefix, keeping the length prefix as
+// it was, which might be not in its canonical representation.
+bool ReadStringWithLength(ChainReader<>& reader, std::string& dest) {
+  const Position value_pos = reader.pos();
+  const absl::optional<uint32_t> length = ReadVarint32(reader);
+  if (ABSL_PREDICT_FALSE(length == absl::nullopt)) return false;
+  const size_t length_size = IntCast<size_t>(reader.pos() - value_pos);
+  if (ABSL_PREDICT_FALSE(!reader.Seek(value_pos))) return false;
+  return reader.Read(length_size + size_t{*length}, dest);
+}
+
+}  // namespace
+
+bool EncodeDictionaryBuffer(const Chain& src, Chain& dest) {
+  ChainReader<> reader(&src);
+  // Distinct values in their wire format, concatenated in the order of their
+  // first occurrence, and their indices.
+  Chain dictionary;
+  absl::flat_hash_map<std::string, uint32_t> indices;
+  std::vector<uint32_t> codes;
+  size_t codes_size = 0;
+  std::string value;
+  while (reader.Pull()) {
+    if (ABSL_PREDICT_FALSE(!ReadStringWithLength(reader, value))) return false;
+    const std::pair<absl::flat_hash_map<std::string, uint32_t>::iterator, bool>
+        inserted = indices.emplace(value, IntCast<uint32_t>(indices.size()));
+    if (inserted.second) {
+      dictionary.Append(value);
+      // Give up early if values are not repeated enough for the dictionary to
+      // pay off. This also bounds the memory used for the dictionary.
+      if (dictionary.size() > src.size() / 2) return false;
+    }
+    codes.push_back(inserted.first->second);
+    codes_size += LengthVarint32(inserted.first->second);
+  }
+  if (ABSL_PREDICT_FALSE(!reader.healthy())) return false;
+  if (LengthVarint32(IntCast<uint32_t>(indices.size())) + dictionary.size() +
+          codes_size >=
+      src.size()) {
+    return false;
+  }
+  dest.Clear();
+  ChainWriter<> writer(&dest);
+  WriteVarint32(IntCast<uint32_t>(indices.size()), writer);
+  writer.Write(std::move(dictionary));
+  for (const uint32_t code : codes) WriteVarint32(code, writer);
+  // Writing to a `Chain` can fail only if it exceeds its maximum size.
+  if (ABSL_PREDICT_FALSE(!writer.Close())) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Writing dictionary buffer failed: " << writer.status();
+  }
+  return true;
+}
+
+absl::Status DecodeDictionaryBuffer(const Chain& src, uint64_t max_size,
+                                    Chain& dest) {
+  ChainReader<> reader(&src);
+  const absl::optional<uint32_t> num_entries = ReadVarint32(reader);
+  if (ABSL_PREDICT_FALSE(num_entries == absl::nullopt)) {
+    return absl::DataLossError("Reading dictionary size failed");
+  }
+  // Each entry takes at least one byte.
+  if (ABSL_PREDICT_FALSE(*num_entries > src.size() - reader.pos())) {
+    return absl::DataLossError("Dictionary too large");
+  }
+  std::vector<std::string> entries(*num_entries);
+  for (std::string& entry : entries) {
+    if (ABSL_PREDICT_FALSE(!ReadStringWithLength(reader, entry))) {
+      return absl::DataLossError("Reading dictionary entry failed");
+    }
+  }
+  Chain decoded;
+  ChainWriter<> writer(&decoded);
+  while (reader.Pull()) {
+    const absl::optional<uint32_t> code = ReadVarint32(reader);
+    if (ABSL_PREDICT_FALSE(code == absl::nullopt)) {
+      return absl::DataLossError("Reading dictionary index failed");
+    }
+    if (ABSL_PREDICT_FALSE(*code >= entries.size())) {
+      return absl::DataLossError("Dictionary index too large");
+    }
+    const std::string& entry = entries[*code];
+    if (ABSL_PREDICT_FALSE(entry.size() > max_size - writer.pos())) {
+      return absl::DataLossError("Decoded string buffer too large");
+    }
+    writer.Write(entry);
+  }
+  if (ABSL_PREDICT_FALSE(!reader.VerifyEndAndClose())) return reader.status();
+  if (ABSL_PREDICT_FALSE(!writer.Close())) return writer.status();
+  dest = std::move(decoded);
+  return absl::OkStatus();
+}
+
+}  // namespace internal
+}  // namespace riegeli
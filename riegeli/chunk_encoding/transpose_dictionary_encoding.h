@@ -0,0 +1,49 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_TRANSPOSE_DICTIONARY_ENCODING_H_
+#define RIEGELI_CHUNK_ENCODING_TRANSPOSE_DICTIONARY_ENCODING_H_
+
+#include <stdint.h>
+
+#include "absl/status/status.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+namespace internal {
+
+// Encodes a data buffer of `WireType::kLengthDelimited` fields stored with
+// `BufferEncoding::kPlain` as `BufferEncoding::kDictionary`, replacing `dest`.
+//
+// Returns `false` if the buffer has too many distinct values for the dictionary
+// encoding to be smaller. Then `dest` is unchanged and the buffer must stay
+// plain.
+bool EncodeDictionaryBuffer(const Chain& src, Chain& dest);
+
+// Decodes a data buffer of `WireType::kLengthDelimited` fields encoded with
+// `BufferEncoding::kDictionary`, replacing `dest` with its
+// `BufferEncoding::kPlain` representation.
+//
+// Fails if the decoded buffer would be larger than `max_size`.
+//
+// Returns status:
+//  * `status.ok()`  - success
+//  * `!status.ok()` - failure (`src` is invalid)
+absl::Status DecodeDictionaryBuffer(const Chain& src, uint64_t max_size,
+                                    Chain& dest);
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_TRANSPOSE_DICTIONARY_ENCODING_H_
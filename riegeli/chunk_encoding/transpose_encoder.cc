@@ -18,6 +18,7 @@
 #include <stdint.h>
 
 #include <algorithm>
+#include <cstring>
 #include <iterator>
 #include <limits>
 #include <memory>
@@ -34,8 +35,11 @@
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "google/protobuf/descriptor.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
@@ -49,7 +53,11 @@
 #include "riegeli/chunk_encoding/compressor.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/transpose_dictionary_encoding.h"
+#include "riegeli/chunk_encoding/transpose_integer_encoding.h"
 #include "riegeli/chunk_encoding/transpose_internal.h"
+#include "riegeli/chunk_encoding/transpose_packed_encoding.h"
+#include "riegeli/endian/endian_reading.h"
 #include "riegeli/messages/message_wire_format.h"
 #include "riegeli/varint/varint_reading.h"
 #include "riegeli/varint/varint_writing.h"
@@ -164,7 +172,8 @@ inline TransposeEncoder::StateInfo::StateInfo(uint32_t etag_index,
                                               uint32_t base)
     : etag_index(etag_index), base(base), canonical_source(kInvalidPos) {}
 
-inline TransposeEncoder::DestInfo::DestInfo() : pos(kInvalidPos) {}
+inline TransposeEncoder::DestInfo::DestInfo(uint32_t dest_index)
+    : dest_index(dest_index), pos(kInvalidPos) {}
 
 inline TransposeEncoder::EncodedTagInfo::EncodedTagInfo(
     NodeId node_id, internal::Subtype subtype)
@@ -174,15 +183,22 @@ inline TransposeEncoder::EncodedTagInfo::EncodedTagInfo(
       public_list_noop_pos(kInvalidPos),
       base(kInvalidPos) {}
 
-inline TransposeEncoder::BufferWithMetadata::BufferWithMetadata(NodeId node_id)
-    : buffer(std::make_unique<Chain>()), node_id(node_id) {}
+inline TransposeEncoder::BufferWithMetadata::BufferWithMetadata(
+    std::unique_ptr<Chain> buffer, NodeId node_id)
+    : buffer(std::move(buffer)), node_id(node_id) {}
 
-TransposeEncoder::TransposeEncoder(CompressorOptions options,
-                                   uint64_t bucket_size)
+TransposeEncoder::TransposeEncoder(
+    CompressorOptions options, uint64_t bucket_size,
+    const google::protobuf::Descriptor* descriptor, bool integer_encodings,
+    bool string_dictionaries, bool packed_encodings)
     : compressor_options_(std::move(options)),
       bucket_size_(options.compression_type() == CompressionType::kNone
                        ? std::numeric_limits<uint64_t>::max()
                        : bucket_size),
+      descriptor_(descriptor),
+      integer_encodings_(integer_encodings),
+      string_dictionaries_(string_dictionaries),
+      packed_encodings_(packed_encodings),
       nonproto_lengths_writer_(std::forward_as_tuple()) {}
 
 TransposeEncoder::~TransposeEncoder() {}
@@ -190,14 +206,74 @@ TransposeEncoder::~TransposeEncoder() {}
 void TransposeEncoder::Clear() {
   ChunkEncoder::Clear();
   tags_list_.clear();
+  dest_infos_.clear();
   encoded_tags_.clear();
-  for (std::vector<BufferWithMetadata>& buffers : data_) buffers.clear();
+  for (std::pair<const NodeId, MessageNode>& entry : message_nodes_) {
+    if (entry.second.writer != nullptr) {
+      // Stop writing to the buffer before it is cleared.
+      entry.second.writer->Close();
+      spare_writers_.push_back(std::move(entry.second.writer));
+    }
+  }
+  for (std::vector<BufferWithMetadata>& buffers : data_) {
+    for (BufferWithMetadata& buffer : buffers) {
+      buffer.buffer->Clear();
+      spare_buffers_.push_back(std::move(buffer.buffer));
+    }
+    buffers.clear();
+  }
   group_stack_.clear();
   message_nodes_.clear();
-  nonproto_lengths_writer_.Reset(std::forward_as_tuple());
+  nonproto_lengths_writer_.Close();
+  Chain nonproto_lengths = std::move(nonproto_lengths_writer_.dest());
+  nonproto_lengths.Clear();
+  nonproto_lengths_writer_.Reset(std::move(nonproto_lengths));
   next_message_id_ = internal::MessageId::kRoot + 1;
 }
 
+void TransposeEncoder::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  ChunkEncoder::RegisterSubobjects(memory_estimator);
+  memory_estimator.RegisterDynamicMemory(tags_list_.capacity() *
+                                         sizeof(EncodedTagInfo));
+  memory_estimator.RegisterDynamicMemory(dest_infos_.capacity() *
+                                         sizeof(DestInfo));
+  memory_estimator.RegisterDynamicMemory(encoded_tags_.capacity() *
+                                         sizeof(uint32_t));
+  for (const std::vector<BufferWithMetadata>& buffers : data_) {
+    memory_estimator.RegisterDynamicMemory(buffers.capacity() *
+                                           sizeof(BufferWithMetadata));
+    for (const BufferWithMetadata& buffer : buffers) {
+      memory_estimator.RegisterDynamicMemory(sizeof(Chain));
+      buffer.buffer->RegisterSubobjects(memory_estimator);
+    }
+  }
+  memory_estimator.RegisterDynamicMemory(group_stack_.capacity() *
+                                         sizeof(OpenGroup));
+  // Each slot of `absl::flat_hash_map` has one control byte.
+  memory_estimator.RegisterDynamicMemory(message_nodes_.capacity() *
+                                         (sizeof(Node) + 1));
+  for (const Node& entry : message_nodes_) {
+    if (entry.second.writer != nullptr) {
+      memory_estimator.RegisterDynamicMemory(sizeof(ChainBackwardWriter<>));
+    }
+  }
+  nonproto_lengths_writer_.dest().RegisterSubobjects(memory_estimator);
+  for (const std::unique_ptr<Chain>& buffer : spare_buffers_) {
+    memory_estimator.RegisterDynamicMemory(sizeof(Chain));
+    buffer->RegisterSubobjects(memory_estimator);
+  }
+  memory_estimator.RegisterDynamicMemory(spare_writers_.size() *
+                                         sizeof(ChainBackwardWriter<>));
+}
+
+size_t TransposeEncoder::EstimateMemory() const {
+  MemoryEstimator memory_estimator;
+  memory_estimator.RegisterMemory(sizeof(TransposeEncoder));
+  RegisterSubobjects(memory_estimator);
+  return memory_estimator.TotalMemory();
+}
+
 bool TransposeEncoder::AddRecord(absl::string_view record) {
   StringReader<> reader(record);
   return AddRecordInternal(reader);
@@ -217,6 +293,9 @@ bool TransposeEncoder::AddRecords(Chain records, std::vector<size_t> limits) {
   RIEGELI_ASSERT_EQ(limits.empty() ? 0u : limits.back(), records.size())
       << "Failed precondition of ChunkEncoder::AddRecords(): "
          "record end positions do not match concatenated record values";
+  // Records of a whole chunk are often many small blocks. Merge them so that
+  // they are parsed from contiguous memory.
+  records.Compact();
   LimitingReader<ChainReader<>> record_reader(std::forward_as_tuple(&records));
   for (const size_t limit : limits) {
     RIEGELI_ASSERT_GE(limit, record_reader.pos())
@@ -267,7 +346,7 @@ inline bool TransposeEncoder::AddRecordInternal(Reader& record) {
         GetNode(NodeId(internal::MessageId::kStartOfMessage, 0)),
         internal::Subtype::kTrivial));
     LimitingReader<> message(&record);
-    return AddMessage(message, internal::MessageId::kRoot, 0);
+    return AddMessage(message, internal::MessageId::kRoot, descriptor_, 0);
   } else {
     Node* node = GetNode(NodeId(internal::MessageId::kNonProto, 0));
     encoded_tags_.push_back(
@@ -287,15 +366,87 @@ inline bool TransposeEncoder::AddRecordInternal(Reader& record) {
 inline BackwardWriter* TransposeEncoder::GetBuffer(Node* node,
                                                    BufferType type) {
   if (!node->second.writer) {
-    std::vector<BufferWithMetadata>& buffers =
-        data_[static_cast<uint32_t>(type)];
-    buffers.emplace_back(node->first);
-    node->second.writer =
-        std::make_unique<ChainBackwardWriter<>>(buffers.back().buffer.get());
+    std::unique_ptr<Chain> buffer;
+    if (spare_buffers_.empty()) {
+      buffer = std::make_unique<Chain>();
+    } else {
+      buffer = std::move(spare_buffers_.back());
+      spare_buffers_.pop_back();
+    }
+    Chain* const buffer_ptr = buffer.get();
+    data_[static_cast<uint32_t>(type)].emplace_back(std::move(buffer),
+                                                    node->first);
+    if (spare_writers_.empty()) {
+      node->second.writer = std::make_unique<ChainBackwardWriter<>>(buffer_ptr);
+    } else {
+      node->second.writer = std::move(spare_writers_.back());
+      spare_writers_.pop_back();
+      node->second.writer->Reset(buffer_ptr);
+    }
   }
   return node->second.writer.get();
 }
 
+inline void TransposeEncoder::ResolveFieldSchema(
+    Node* node, const google::protobuf::Descriptor* parent_descriptor) {
+  if (ABSL_PREDICT_TRUE(node->second.field_schema !=
+                        FieldSchema::kUnresolved)) {
+    return;
+  }
+  node->second.field_schema = FieldSchema::kUnknown;
+  if (parent_descriptor == nullptr) return;
+  const uint32_t tag = node->first.tag;
+  const google::protobuf::FieldDescriptor* const field =
+      parent_descriptor->FindFieldByNumber(GetTagFieldNumber(tag));
+  // Unknown fields and extensions are parsed speculatively.
+  if (field == nullptr) return;
+  if (GetTagWireType(tag) == WireType::kStartGroup) {
+    if (field->type() == google::protobuf::FieldDescriptor::TYPE_GROUP) {
+      node->second.field_schema = FieldSchema::kMessage;
+      node->second.message_type = field->message_type();
+    }
+    return;
+  }
+  switch (field->type()) {
+    case google::protobuf::FieldDescriptor::TYPE_MESSAGE:
+      node->second.field_schema = FieldSchema::kMessage;
+      node->second.message_type = field->message_type();
+      return;
+    case google::protobuf::FieldDescriptor::TYPE_GROUP:
+      // A group field encoded as length-delimited does not match the
+      // descriptor.
+      return;
+    case google::protobuf::FieldDescriptor::TYPE_STRING:
+    case google::protobuf::FieldDescriptor::TYPE_BYTES:
+      node->second.field_schema = FieldSchema::kString;
+      return;
+    default:
+      break;
+  }
+  if (!field->is_repeated()) {
+    // A length-delimited value of a non-repeated field of a primitive type
+    // does not match the descriptor.
+    node->second.field_schema = FieldSchema::kString;
+    return;
+  }
+  // A packed repeated field of a primitive type.
+  switch (field->type()) {
+    case google::protobuf::FieldDescriptor::TYPE_FIXED32:
+    case google::protobuf::FieldDescriptor::TYPE_SFIXED32:
+    case google::protobuf::FieldDescriptor::TYPE_FLOAT:
+      node->second.field_schema = FieldSchema::kPackedFixed32;
+      return;
+    case google::protobuf::FieldDescriptor::TYPE_FIXED64:
+    case google::protobuf::FieldDescriptor::TYPE_SFIXED64:
+    case google::protobuf::FieldDescriptor::TYPE_DOUBLE:
+      node->second.field_schema = FieldSchema::kPackedFixed64;
+      return;
+    default:
+      node->second.field_schema = FieldSchema::kPackedVarint;
+      return;
+  }
+}
+
 inline uint32_t TransposeEncoder::GetPosInTagsList(Node* node,
                                                    internal::Subtype subtype) {
   size_t pos = static_cast<size_t>(subtype);
@@ -320,12 +471,38 @@ inline TransposeEncoder::Node* TransposeEncoder::GetNode(NodeId node_id) {
   return &*it;
 }
 
+inline absl::Span<TransposeEncoder::DestInfo> TransposeEncoder::DestInfos(
+    const EncodedTagInfo& tag_info) {
+  return absl::MakeSpan(dest_infos_.data() + tag_info.dest_info_begin,
+                        dest_infos_.data() + tag_info.dest_info_end);
+}
+
+inline TransposeEncoder::DestInfo& TransposeEncoder::FindDestInfo(
+    const EncodedTagInfo& tag_info, uint32_t dest_index) {
+  const absl::Span<DestInfo> dest_infos = DestInfos(tag_info);
+  const absl::Span<DestInfo>::iterator iter = std::lower_bound(
+      dest_infos.begin(), dest_infos.end(), dest_index,
+      [](const DestInfo& dest_info, uint32_t dest_index) {
+        return dest_info.dest_index < dest_index;
+      });
+  RIEGELI_ASSERT(iter != dest_infos.end() && iter->dest_index == dest_index)
+      << "Failed precondition of TransposeEncoder::FindDestInfo(): "
+         "no transition to the destination";
+  return *iter;
+}
+
+inline bool TransposeEncoder::HasImplicitTransition(
+    const EncodedTagInfo& tag_info) {
+  return tag_info.dest_info_end - tag_info.dest_info_begin == 1 &&
+         !tag_info.no_implicit_transition;
+}
+
 // Precondition: `IsProtoMessage` returns `true` for this record.
 // Note: Encoded tags are appended into `encoded_tags_` but data is prepended
 // into respective buffers. `encoded_tags_` will be later traversed backwards.
-inline bool TransposeEncoder::AddMessage(LimitingReaderBase& record,
-                                         internal::MessageId parent_message_id,
-                                         int depth) {
+inline bool TransposeEncoder::AddMessage(
+    LimitingReaderBase& record, internal::MessageId parent_message_id,
+    const google::protobuf::Descriptor* descriptor, int depth) {
   while (record.Pull()) {
     const absl::optional<uint32_t> tag = ReadVarint32(record);
     if (tag == absl::nullopt) {
@@ -339,13 +516,26 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase& record,
         uint64_t value[2];
         static_assert(sizeof(value) >= kMaxLengthVarint64,
                       "value too small to hold a varint64");
-        const absl::optional<char*> value_end =
-            CopyVarint64(record, reinterpret_cast<char*>(value));
-        if (value_end == absl::nullopt) {
-          RIEGELI_ASSERT_UNREACHABLE() << "Invalid varint: " << record.status();
+        size_t value_length;
+        if (ABSL_PREDICT_TRUE(record.available() >= sizeof(uint64_t)) &&
+            (value_length = internal::ShortVarintLength(
+                 ReadLittleEndian64(record.cursor()))) > 0) {
+          // Fast path: the varint has at most 8 bytes and they are buffered,
+          // so its length is found without testing the bytes one by one.
+          // Bytes after the varint are copied too but ignored.
+          std::memcpy(value, record.cursor(), sizeof(uint64_t));
+          value[1] = 0;
+          record.move_cursor(value_length);
+        } else {
+          const absl::optional<char*> value_end =
+              CopyVarint64(record, reinterpret_cast<char*>(value));
+          if (value_end == absl::nullopt) {
+            RIEGELI_ASSERT_UNREACHABLE()
+                << "Invalid varint: " << record.status();
+          }
+          value_length =
+              PtrDistance(reinterpret_cast<char*>(value), *value_end);
         }
-        const size_t value_length =
-            PtrDistance(reinterpret_cast<char*>(value), *value_end);
         if (reinterpret_cast<const unsigned char*>(value)[0] <=
             kMaxVarintInline) {
           encoded_tags_.push_back(GetPosInTagsList(
@@ -388,9 +578,16 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase& record,
         }
         const Position value_pos = record.pos();
         LengthLimiter limiter(&record, *length);
+        ResolveFieldSchema(node, descriptor);
+        const google::protobuf::Descriptor* const message_type =
+            node->second.message_type;
         // Non-toplevel empty strings are treated as strings, not messages.
         // They have a simpler encoding this way (one node instead of two).
+        // Fields known to be strings or packed repeated fields are not parsed
+        // speculatively.
         if (depth < kMaxRecursionDepth && *length != 0 &&
+            (node->second.field_schema == FieldSchema::kUnknown ||
+             node->second.field_schema == FieldSchema::kMessage) &&
             IsProtoMessage(record)) {
           encoded_tags_.push_back(GetPosInTagsList(
               node, internal::Subtype::kLengthDelimitedStartOfSubmessage));
@@ -401,7 +598,8 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase& record,
           auto end_of_submessage_pos = GetPosInTagsList(
               node, internal::Subtype::kLengthDelimitedEndOfSubmessage);
           if (ABSL_PREDICT_FALSE(
-                  !AddMessage(record, node->second.message_id, depth + 1))) {
+                  !AddMessage(record, node->second.message_id, message_type,
+                              depth + 1))) {
             return false;
           }
           // Call to `AddMessage()` invalidates `node`.
@@ -425,12 +623,15 @@ inline bool TransposeEncoder::AddMessage(LimitingReaderBase& record,
       case WireType::kStartGroup: {
         encoded_tags_.push_back(
             GetPosInTagsList(node, internal::Subtype::kTrivial));
-        group_stack_.push_back(parent_message_id);
+        ResolveFieldSchema(node, descriptor);
+        group_stack_.push_back(OpenGroup{parent_message_id, descriptor});
         ++depth;
         parent_message_id = node->second.message_id;
+        descriptor = node->second.message_type;
       } break;
       case WireType::kEndGroup:
-        parent_message_id = group_stack_.back();
+        parent_message_id = group_stack_.back().parent_message_id;
+        descriptor = group_stack_.back().parent_descriptor;
         group_stack_.pop_back();
         --depth;
         // Note that `parent_message_id` was updated above so the `node` does
@@ -478,9 +679,95 @@ inline bool TransposeEncoder::AddBuffer(
   return true;
 }
 
+inline void TransposeEncoder::EncodeIntegerBuffers() {
+  // Lengths of varints in each varint buffer, in the order of the buffer. Data
+  // are prepended to buffers, so this is the reverse order of `encoded_tags_`.
+  absl::flat_hash_map<NodeId, std::vector<uint8_t>> varint_lengths;
+  if (!data_[static_cast<size_t>(BufferType::kVarint)].empty()) {
+    for (std::vector<uint32_t>::const_reverse_iterator iter =
+             encoded_tags_.crbegin();
+         iter != encoded_tags_.crend(); ++iter) {
+      const EncodedTagInfo& tag_info = tags_list_[*iter];
+      if (tag_info.node_id.tag != 0 &&
+          GetTagWireType(tag_info.node_id.tag) == WireType::kVarint &&
+          tag_info.subtype <= internal::Subtype::kVarintMax) {
+        varint_lengths[tag_info.node_id].push_back(IntCast<uint8_t>(
+            tag_info.subtype - internal::Subtype::kVarint1 + 1));
+      }
+    }
+  }
+  std::vector<uint64_t> values;
+  for (const std::pair<BufferType, WireType>& buffer_type :
+       {std::make_pair(BufferType::kVarint, WireType::kVarint),
+        std::make_pair(BufferType::kFixed32, WireType::kFixed32),
+        std::make_pair(BufferType::kFixed64, WireType::kFixed64)}) {
+    for (BufferWithMetadata& buffer :
+         data_[static_cast<size_t>(buffer_type.first)]) {
+      absl::Span<const uint8_t> lengths;
+      if (buffer_type.second == WireType::kVarint) {
+        const absl::flat_hash_map<NodeId, std::vector<uint8_t>>::const_iterator
+            iter = varint_lengths.find(buffer.node_id);
+        if (iter != varint_lengths.end()) lengths = iter->second;
+      }
+      if (!internal::ParseIntegerBuffer(buffer_type.second, *buffer.buffer,
+                                        lengths, values)) {
+        continue;
+      }
+      const internal::BufferEncoding encoding =
+          internal::ChooseIntegerEncoding(values, buffer.buffer->size());
+      if (encoding == internal::BufferEncoding::kPlain) continue;
+      internal::EncodeIntegerBuffer(encoding, values, *buffer.buffer);
+      buffer.encoding = encoding;
+    }
+  }
+}
+
+inline void TransposeEncoder::EncodePackedBuffers() {
+  Chain encoded;
+  for (BufferWithMetadata& buffer :
+       data_[static_cast<size_t>(BufferType::kString)]) {
+    const absl::flat_hash_map<NodeId, MessageNode>::const_iterator node =
+        message_nodes_.find(buffer.node_id);
+    if (node == message_nodes_.end()) continue;
+    internal::BufferEncoding encoding;
+    switch (node->second.field_schema) {
+      case FieldSchema::kPackedVarint:
+        encoding = internal::BufferEncoding::kPackedVarint;
+        break;
+      case FieldSchema::kPackedFixed32:
+        encoding = internal::BufferEncoding::kPackedFixed32;
+        break;
+      case FieldSchema::kPackedFixed64:
+        encoding = internal::BufferEncoding::kPackedFixed64;
+        break;
+      default:
+        continue;
+    }
+    if (!internal::EncodePackedBuffer(encoding, *buffer.buffer, encoded)) {
+      continue;
+    }
+    std::swap(*buffer.buffer, encoded);
+    buffer.encoding = encoding;
+  }
+}
+
+inline void TransposeEncoder::EncodeStringBuffers() {
+  Chain encoded;
+  for (BufferWithMetadata& buffer :
+       data_[static_cast<size_t>(BufferType::kString)]) {
+    if (buffer.encoding != internal::BufferEncoding::kPlain) continue;
+    if (!internal::EncodeDictionaryBuffer(*buffer.buffer, encoded)) continue;
+    std::swap(*buffer.buffer, encoded);
+    buffer.encoding = internal::BufferEncoding::kDictionary;
+  }
+}
+
 inline bool TransposeEncoder::WriteBuffers(
     Writer& header_writer, Writer& data_writer,
     absl::flat_hash_map<NodeId, uint32_t>* buffer_pos) {
+  if (integer_encodings_) EncodeIntegerBuffers();
+  if (packed_encodings_) EncodePackedBuffers();
+  if (string_dictionaries_) EncodeStringBuffers();
   size_t num_buffers = 0;
   for (std::vector<BufferWithMetadata>& buffers : data_) {
     // Sort buffers by length, smallest to largest.
@@ -611,18 +898,12 @@ inline bool TransposeEncoder::WriteBuffers(
 inline bool TransposeEncoder::WriteStatesAndData(
     uint32_t max_transition, const std::vector<StateInfo>& state_machine,
     Writer& header_writer, Writer& data_writer) {
-  if (!encoded_tags_.empty() &&
-      tags_list_[encoded_tags_[0]].dest_info.size() == 1) {
+  if (!encoded_tags_.empty()) {
     // There should be no implicit transition from the last state. If there was
     // one, then it would not be obvious whether to stop or continue decoding.
     // Only if transition is explicit we check whether there is more transition
     // bytes.
-    absl::flat_hash_map<uint32_t, DestInfo>& dest_info =
-        tags_list_[encoded_tags_[0]].dest_info;
-    const uint32_t first_key = dest_info.begin()->first;
-    dest_info[first_key + 1];
-    RIEGELI_ASSERT_NE(tags_list_[encoded_tags_[0]].dest_info.size(), 1u)
-        << "Number of transitions from the last state did not increase";
+    tags_list_[encoded_tags_[0]].no_implicit_transition = true;
   }
   absl::flat_hash_map<NodeId, uint32_t> buffer_pos;
   if (ABSL_PREDICT_FALSE(
@@ -718,7 +999,7 @@ inline bool TransposeEncoder::WriteStatesAndData(
       // Signal implicit transition by adding `state_machine.size()`.
       base_to_write.push_back(
           tags_list_[state_info.etag_index].base +
-          (tags_list_[state_info.etag_index].dest_info.size() == 1
+          (HasImplicitTransition(tags_list_[state_info.etag_index])
                ? IntCast<uint32_t>(state_machine.size())
                : uint32_t{0}));
     } else {
@@ -753,6 +1034,38 @@ inline bool TransposeEncoder::WriteStatesAndData(
     return Fail(header_writer);
   }
 
+  // Buffers are numbered in the order of `data_`, so this lists them in
+  // increasing order of buffer indices.
+  std::vector<const BufferWithMetadata*> encoded_buffers;
+  for (const std::vector<BufferWithMetadata>& buffers : data_) {
+    for (const BufferWithMetadata& buffer : buffers) {
+      if (buffer.encoding != internal::BufferEncoding::kPlain) {
+        encoded_buffers.push_back(&buffer);
+      }
+    }
+  }
+  if (!encoded_buffers.empty()) {
+    if (ABSL_PREDICT_FALSE(!WriteVarint32(
+            IntCast<uint32_t>(encoded_buffers.size()), header_writer))) {
+      return Fail(header_writer);
+    }
+    for (const BufferWithMetadata* const buffer : encoded_buffers) {
+      const absl::flat_hash_map<NodeId, uint32_t>::const_iterator iter =
+          buffer_pos.find(buffer->node_id);
+      RIEGELI_ASSERT(iter != buffer_pos.end())
+          << "Buffer not found: "
+          << static_cast<uint32_t>(buffer->node_id.parent_message_id) << "/"
+          << buffer->node_id.tag;
+      if (ABSL_PREDICT_FALSE(!WriteVarint32(iter->second, header_writer)) ||
+          ABSL_PREDICT_FALSE(!header_writer.WriteByte(static_cast<uint8_t>(
+              GetTagWireType(buffer->node_id.tag)))) ||
+          ABSL_PREDICT_FALSE(!header_writer.WriteByte(
+              static_cast<uint8_t>(buffer->encoding)))) {
+        return Fail(header_writer);
+      }
+    }
+  }
+
   internal::Compressor transitions_compressor(compressor_options_);
   if (ABSL_PREDICT_FALSE(!WriteTransitions(max_transition, state_machine,
                                            transitions_compressor.writer()))) {
@@ -793,9 +1106,9 @@ inline bool TransposeEncoder::WriteTransitions(
     //         the public list and then continue as above.
     uint32_t tag = encoded_tags_[i - 1];
     // Check whether this is implicit transition.
-    if (tags_list_[prev_etag].dest_info.size() != 1) {
+    if (!HasImplicitTransition(tags_list_[prev_etag])) {
       // Position in the private list.
-      uint32_t pos = tags_list_[prev_etag].dest_info[tag].pos;
+      uint32_t pos = FindDestInfo(tags_list_[prev_etag], tag).pos;
       if (pos == kInvalidPos) {
         // `pos` is not in the private list, go to `public_list_noop_pos` if
         // available.
@@ -899,13 +1212,54 @@ inline bool TransposeEncoder::WriteTransitions(
 
 inline void TransposeEncoder::CollectTransitionStatistics() {
   // Go through all the transitions from back to front and collect transition
-  // distribution statistics.
-  uint32_t prev_pos = encoded_tags_.back();
+  // distribution statistics. Transitions are first grouped by their source in
+  // flat arrays, then destinations of each source are deduplicated into
+  // `dest_infos_`, which avoids a hash map per source.
+  const uint32_t num_tags = IntCast<uint32_t>(tags_list_.size());
+  // `transitions_begin[source]` is the index in `transition_dests` of the first
+  // destination of a transition from `source`.
+  std::vector<uint32_t> transitions_begin(num_tags + 1, 0);
   for (size_t i = encoded_tags_.size() - 1; i > 0; --i) {
-    const uint32_t pos = encoded_tags_[i - 1];
-    ++tags_list_[prev_pos].dest_info[pos].num_transitions;
-    ++tags_list_[pos].num_incoming_transitions;
-    prev_pos = pos;
+    ++transitions_begin[encoded_tags_[i] + 1];
+  }
+  for (uint32_t tag = 0; tag < num_tags; ++tag) {
+    transitions_begin[tag + 1] += transitions_begin[tag];
+  }
+  std::vector<uint32_t> transition_dests(transitions_begin[num_tags]);
+  {
+    std::vector<uint32_t> transitions_end(transitions_begin.begin(),
+                                          transitions_begin.end() - 1);
+    for (size_t i = encoded_tags_.size() - 1; i > 0; --i) {
+      const uint32_t pos = encoded_tags_[i - 1];
+      transition_dests[transitions_end[encoded_tags_[i]]++] = pos;
+      ++tags_list_[pos].num_incoming_transitions;
+    }
+  }
+
+  dest_infos_.clear();
+  // `last_source[dest]` is the last source with a transition to `dest` seen so
+  // far, and `dest_info_index[dest]` is the index of its `DestInfo` in
+  // `dest_infos_`.
+  std::vector<uint32_t> last_source(num_tags, kInvalidPos);
+  std::vector<uint32_t> dest_info_index(num_tags);
+  for (uint32_t source = 0; source < num_tags; ++source) {
+    EncodedTagInfo& tag_info = tags_list_[source];
+    tag_info.dest_info_begin = IntCast<uint32_t>(dest_infos_.size());
+    for (uint32_t i = transitions_begin[source];
+         i < transitions_begin[source + 1]; ++i) {
+      const uint32_t dest = transition_dests[i];
+      if (last_source[dest] != source) {
+        last_source[dest] = source;
+        dest_info_index[dest] = IntCast<uint32_t>(dest_infos_.size());
+        dest_infos_.emplace_back(dest);
+      }
+      ++dest_infos_[dest_info_index[dest]].num_transitions;
+    }
+    tag_info.dest_info_end = IntCast<uint32_t>(dest_infos_.size());
+    std::sort(dest_infos_.begin() + tag_info.dest_info_begin,
+              dest_infos_.end(), [](const DestInfo& a, const DestInfo& b) {
+                return a.dest_index < b.dest_index;
+              });
   }
 
   if (tags_list_[encoded_tags_.back()].num_incoming_transitions == 0) {
@@ -934,15 +1288,15 @@ inline void TransposeEncoder::ComputeBaseIndices(
     uint32_t base = kInvalidPos;
     // Smallest position of node used in transition.
     uint32_t min_pos = kInvalidPos;
-    for (const std::pair<const uint32_t, DestInfo>& dest_info :
-         tags_list_[tag_index_and_state_index.first].dest_info) {
-      uint32_t pos = dest_info.second.pos;
+    for (const DestInfo& dest_info :
+         DestInfos(tags_list_[tag_index_and_state_index.first])) {
+      uint32_t pos = dest_info.pos;
       if (pos != kInvalidPos) {
         // This tag has a node in the private list.
         continue;
       }
       // Position of the state that we need to reach.
-      pos = tags_list_[dest_info.first].state_machine_pos;
+      pos = tags_list_[dest_info.dest_index].state_machine_pos;
       RIEGELI_ASSERT_NE(pos, kInvalidPos) << "Invalid position";
       // Assuming we processed some states already and `base` is already set to
       // non-`kInvalidPos` we find the base of the block that is the common
@@ -1017,13 +1371,13 @@ inline void TransposeEncoder::ComputeBaseIndices(
     }
     uint32_t base = kInvalidPos;
     uint32_t min_pos = kInvalidPos;
-    for (const std::pair<const uint32_t, DestInfo>& dest_info : tag.dest_info) {
-      uint32_t pos = dest_info.second.pos;
+    for (const DestInfo& dest_info : DestInfos(tag)) {
+      uint32_t pos = dest_info.pos;
       if (pos != kInvalidPos) {
         // Skip destinations in the private list.
         continue;
       }
-      pos = tags_list_[dest_info.first].state_machine_pos;
+      pos = tags_list_[dest_info.dest_index].state_machine_pos;
       RIEGELI_ASSERT_NE(pos, kInvalidPos) << "Invalid position";
       while (base > pos || pos - base > max_transition) {
         if (base > pos) {
@@ -1073,15 +1427,14 @@ TransposeEncoder::CreateStateMachine(uint32_t max_transition,
   // in the private list for the node.
   constexpr uint32_t kInListPos = 0;
   for (EncodedTagInfo& tag_info : tags_list_) {
-    for (std::pair<const uint32_t, DestInfo>& dest_and_count :
-         tag_info.dest_info) {
-      if (dest_and_count.second.num_transitions >= min_count_for_state) {
+    for (DestInfo& dest_info : DestInfos(tag_info)) {
+      if (dest_info.num_transitions >= min_count_for_state) {
         // Subtract transitions so we have the right estimate of the remaining
         // transitions into each node.
-        tags_list_[dest_and_count.first].num_incoming_transitions -=
-            dest_and_count.second.num_transitions;
+        tags_list_[dest_info.dest_index].num_incoming_transitions -=
+            dest_info.num_transitions;
         // Mark transition to be included in list.
-        dest_and_count.second.pos = kInListPos;
+        dest_info.pos = kInListPos;
       }
     }
   }
@@ -1099,36 +1452,36 @@ TransposeEncoder::CreateStateMachine(uint32_t max_transition,
   // After this loop:
   //  - `state_machine` will contain states of created private lists.
   //  - `base` in `tags_list_` will be set for tags with private list.
-  //  - `dest_info` in `tags_list_` will have `pos != kInvalidPos` for those
+  //  - `dest_infos_` will have `pos != kInvalidPos` for those
   //    nodes that already have state.
   //  - `public_list_noops` will have a record for all `kNoOp` states reaching
   //    public list.
   for (uint32_t tag_id = 0; tag_id < tags_list_.size(); ++tag_id) {
     EncodedTagInfo& tag_info = tags_list_[tag_id];
-    const uint32_t sz = IntCast<uint32_t>(tag_info.dest_info.size());
+    const uint32_t sz =
+        IntCast<uint32_t>(tag_info.dest_info_end - tag_info.dest_info_begin);
     // If we exclude just one state we add it instead of creating the `kNoOp`
     // state.
     PriorityQueueEntry excluded_state;
     // Number of transitions into public list states.
     uint32_t num_excluded_transitions = 0;
-    for (const std::pair<const uint32_t, DestInfo>& dest_info :
-         tag_info.dest_info) {
+    for (const DestInfo& dest_info : DestInfos(tag_info)) {
       // If destination was marked as `kInListPos` or all transitions into it go
       // from this node.
-      if (dest_info.second.pos == kInListPos ||
-          dest_info.second.num_transitions ==
-              tags_list_[dest_info.first].num_incoming_transitions) {
-        if (dest_info.second.pos != kInListPos) {
+      if (dest_info.pos == kInListPos ||
+          dest_info.num_transitions ==
+              tags_list_[dest_info.dest_index].num_incoming_transitions) {
+        if (dest_info.pos != kInListPos) {
           // Not yet subtracted.
-          tags_list_[dest_info.first].num_incoming_transitions -=
-              dest_info.second.num_transitions;
+          tags_list_[dest_info.dest_index].num_incoming_transitions -=
+              dest_info.num_transitions;
         }
         // Add to the priority queue.
-        tag_priority.emplace(dest_info.first, dest_info.second.num_transitions);
+        tag_priority.emplace(dest_info.dest_index, dest_info.num_transitions);
       } else {
-        num_excluded_transitions += dest_info.second.num_transitions;
-        excluded_state = PriorityQueueEntry(dest_info.first,
-                                            dest_info.second.num_transitions);
+        num_excluded_transitions += dest_info.num_transitions;
+        excluded_state =
+            PriorityQueueEntry(dest_info.dest_index, dest_info.num_transitions);
       }
     }
     uint32_t num_states = IntCast<uint32_t>(tag_priority.size());
@@ -1191,7 +1544,7 @@ TransposeEncoder::CreateStateMachine(uint32_t max_transition,
         } else {
           // Regular state.
           state_machine[--prev_state] = StateInfo(node_index, kInvalidPos);
-          tag_info.dest_info[node_index].pos = prev_state;
+          FindDestInfo(tag_info, node_index).pos = prev_state;
         }
         tag_priority.pop();
       }
@@ -27,7 +27,10 @@
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "google/protobuf/descriptor.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/reader.h"
@@ -59,6 +62,13 @@ class LimitingReaderBase;
 //      - Array of subtypes (for all tags where applicable)
 //      - Array of data buffer indices (for all tags/subtypes where applicable)
 //    - Initial state index
+//    - Only if some data buffers are not stored plain (readers which predate
+//      buffer encodings fail on these data):
+//      - Number of data buffers which are not stored plain
+//      - For each such buffer, in increasing order of buffer indices:
+//        - Buffer index
+//        - Wire type of values (byte)
+//        - `internal::BufferEncoding` (byte)
 //  - `num_buckets` buckets:
 //    - Bucket data (possibly compressed):
 //      - Concatenated data buffers in this bucket (bytes)
@@ -67,7 +77,33 @@ class LimitingReaderBase;
 class TransposeEncoder : public ChunkEncoder {
  public:
   // Creates an empty `TransposeEncoder`.
-  explicit TransposeEncoder(CompressorOptions options, uint64_t bucket_size);
+  //
+  // If `descriptor` is not `nullptr`, it describes the type of records, and
+  // must remain valid until the `TransposeEncoder` is destroyed. It tells
+  // which length-delimited fields are strings or packed repeated fields, so
+  // that they are not speculatively parsed as submessages. The encoded chunk
+  // does not depend on whether the descriptor was available, except that such
+  // fields are never broken down into columns. Records not matching the
+  // descriptor are still encoded correctly.
+  //
+  // If `integer_encodings` is `true`, data buffers of varint, fixed32, and
+  // fixed64 fields are stored with delta, zigzag delta, or frame of reference
+  // encoding when this makes them smaller (see `internal::BufferEncoding`).
+  //
+  // If `string_dictionaries` is `true`, data buffers of string fields with few
+  // distinct values are stored as a dictionary of the distinct values followed
+  // by indices into the dictionary, when this makes them smaller.
+  //
+  // If `packed_encodings` is `true` and `descriptor` is not `nullptr`, data
+  // buffers of packed repeated scalar fields are stored as numbers of elements
+  // followed by all elements, with bytes of fixed width elements split into
+  // separate streams. This helps compression, and lets the decoder process
+  // elements in bulk.
+  explicit TransposeEncoder(
+      CompressorOptions options, uint64_t bucket_size,
+      const google::protobuf::Descriptor* descriptor = nullptr,
+      bool integer_encodings = false, bool string_dictionaries = false,
+      bool packed_encodings = false);
 
   ~TransposeEncoder();
 
@@ -88,6 +124,12 @@ class TransposeEncoder : public ChunkEncoder {
                       uint64_t& num_records,
                       uint64_t& decoded_data_size) override;
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
+  // Returns an estimate of memory used by this `TransposeEncoder`, including
+  // data buffers of records added so far and buffers kept for reuse.
+  size_t EstimateMemory() const;
+
  private:
   bool AddRecordInternal(Reader& record);
 
@@ -119,14 +161,41 @@ class TransposeEncoder : public ChunkEncoder {
   static constexpr size_t kNumBufferTypes =
       static_cast<size_t>(BufferType::kNumBufferTypes);
 
+  // What the descriptor of the parent message tells about a length-delimited
+  // or group field.
+  enum class FieldSchema : uint8_t {
+    // Not looked up yet.
+    kUnresolved,
+    // No descriptor is known.
+    kUnknown,
+    // A string, bytes, or non-repeated field: never parsed as a submessage.
+    kString,
+    // A repeated field with packed varint elements: never parsed as a
+    // submessage.
+    kPackedVarint,
+    // A repeated field with packed 4-byte elements: never parsed as a
+    // submessage.
+    kPackedFixed32,
+    // A repeated field with packed 8-byte elements: never parsed as a
+    // submessage.
+    kPackedFixed64,
+    // A submessage or group of type `MessageNode::message_type`. The value is
+    // parsed as a submessage if it is valid.
+    kMessage,
+  };
+
   // Information about a field with unique proto path.
   struct MessageNode {
     explicit MessageNode(internal::MessageId message_id);
     // Some nodes (such as `kStartGroup`) contain no data. Buffer is assigned in
     // the first `GetBuffer()` call when we have data to write.
-    std::unique_ptr<BackwardWriter> writer;
+    std::unique_ptr<ChainBackwardWriter<>> writer;
     // Unique ID for every instance of this class within `TransposeEncoder`.
     internal::MessageId message_id;
+    // Set by `ResolveFieldSchema()`.
+    FieldSchema field_schema = FieldSchema::kUnresolved;
+    // The type of a `FieldSchema::kMessage` field, otherwise `nullptr`.
+    const google::protobuf::Descriptor* message_type = nullptr;
     // Position of encoded tag in `tags_list_` per subtype.
     // Size 14 works well with `kMaxVarintInline == 3`.
     absl::InlinedVector<uint32_t, 14> encoded_tag_pos;
@@ -153,9 +222,23 @@ class TransposeEncoder : public ChunkEncoder {
   // Add message recursively to the internal data structures.
   // Precondition: `message` is a valid proto message, i.e. `IsProtoMessage()`
   // on this message returns `true`.
+  // `descriptor` is the type of the message, or `nullptr` if unknown.
   // `depth` is the recursion depth.
   bool AddMessage(LimitingReaderBase& record,
-                  internal::MessageId parent_message_id, int depth);
+                  internal::MessageId parent_message_id,
+                  const google::protobuf::Descriptor* descriptor, int depth);
+
+  // Replaces data buffers of integers with their encodings which are smaller,
+  // setting `BufferWithMetadata::encoding`.
+  void EncodeIntegerBuffers();
+
+  // Replaces data buffers of packed repeated fields with their packed
+  // encodings, setting `BufferWithMetadata::encoding`.
+  void EncodePackedBuffers();
+
+  // Replaces data buffers of strings with their dictionary encodings which are
+  // smaller, setting `BufferWithMetadata::encoding`.
+  void EncodeStringBuffers();
 
   // Write all buffer lengths to `header_writer` and data buffers in `data_` to
   // `data_writer` (compressed using `compressor_`). Fill map with the
@@ -198,8 +281,9 @@ class TransposeEncoder : public ChunkEncoder {
       const std::vector<std::pair<uint32_t, uint32_t>>& public_list_noops,
       std::vector<StateInfo>& state_machine);
 
-  // Traverse `encoded_tags_` and populate `num_incoming_transitions` and
-  // `dest_info` in `tags_list_` based on transition distribution.
+  // Traverse `encoded_tags_` and populate `num_incoming_transitions`,
+  // `dest_info_begin`, and `dest_info_end` in `tags_list_`, and `dest_infos_`,
+  // based on transition distribution.
   void CollectTransitionStatistics();
 
   // Create a state machine for `encoded_tags_`.
@@ -224,6 +308,12 @@ class TransposeEncoder : public ChunkEncoder {
   // Returns node pointer from `node_id`.
   Node* GetNode(NodeId node_id);
 
+  // Sets `field_schema` and `message_type` of `node`, which is a field with
+  // wire type `kLengthDelimited` or `kStartGroup` of a message of type
+  // `parent_descriptor` (`nullptr` if unknown), if they are not set yet.
+  static void ResolveFieldSchema(
+      Node* node, const google::protobuf::Descriptor* parent_descriptor);
+
   // Get possition of the (`node`, `subtype`) pair in `tags_list_`, adding it
   // if not in the list yet.
   uint32_t GetPosInTagsList(Node* node, internal::Subtype subtype);
@@ -234,7 +324,9 @@ class TransposeEncoder : public ChunkEncoder {
 
   // Information about the state machine transition destination.
   struct DestInfo {
-    DestInfo();
+    explicit DestInfo(uint32_t dest_index);
+    // Index of the destination in `tags_list_`.
+    uint32_t dest_index;
     // Position of the destination in destination list created for this state.
     // `kInvalidPos` if transition destination is not in the list. In that case
     // transition is encoded using the public list of states.
@@ -248,8 +340,13 @@ class TransposeEncoder : public ChunkEncoder {
     explicit EncodedTagInfo(NodeId node_id, internal::Subtype subtype);
     NodeId node_id;
     internal::Subtype subtype;
-    // Maps all destinations reachable from this encoded tag to `DestInfo`.
-    absl::flat_hash_map<uint32_t, DestInfo> dest_info;
+    // All destinations reachable from this encoded tag are
+    // `dest_infos_[dest_info_begin..dest_info_end]`, sorted by `dest_index`.
+    uint32_t dest_info_begin = 0;
+    uint32_t dest_info_end = 0;
+    // If `true`, a transition from this encoded tag is never implicit, even if
+    // it has only one destination.
+    bool no_implicit_transition = false;
     // Number of incoming tranitions into this state.
     size_t num_incoming_transitions = 0;
     // Index of this state in the state machine.
@@ -265,14 +362,28 @@ class TransposeEncoder : public ChunkEncoder {
     uint32_t base;
   };
 
+  // Returns destinations reachable from `tag_info`.
+  absl::Span<DestInfo> DestInfos(const EncodedTagInfo& tag_info);
+
+  // Returns the destination `dest_index` reachable from `tag_info`.
+  //
+  // Precondition: there is a transition from `tag_info` to `dest_index`.
+  DestInfo& FindDestInfo(const EncodedTagInfo& tag_info, uint32_t dest_index);
+
+  // Returns `true` if the only transition from `tag_info` can be implicit.
+  static bool HasImplicitTransition(const EncodedTagInfo& tag_info);
+
   // Information about the data buffer.
   struct BufferWithMetadata {
-    explicit BufferWithMetadata(NodeId node_id);
+    explicit BufferWithMetadata(std::unique_ptr<Chain> buffer, NodeId node_id);
     // Buffer itself, wrapped in `std::unique_ptr` so that its address remains
     // constant when additional buffers are added.
     std::unique_ptr<Chain> buffer;
     // `NodeId` this buffer belongs to.
     NodeId node_id;
+    // Encoding of `*buffer`, set by `EncodeIntegerBuffers()`,
+    // `EncodePackedBuffers()`, and `EncodeStringBuffers()`.
+    internal::BufferEncoding encoding = internal::BufferEncoding::kPlain;
   };
 
   CompressorOptions compressor_options_;
@@ -280,19 +391,40 @@ class TransposeEncoder : public ChunkEncoder {
   // Finer bucket granularity (i.e. smaller size) worsens compression density
   // but makes field projection more effective.
   uint64_t bucket_size_;
+  // The type of records, or `nullptr` if unknown.
+  const google::protobuf::Descriptor* descriptor_;
+  // Whether data buffers of integers may have integer encodings.
+  bool integer_encodings_;
+  // Whether data buffers of strings may have dictionary encodings.
+  bool string_dictionaries_;
+  // Whether data buffers of packed repeated fields may have packed encodings.
+  bool packed_encodings_;
 
   // List of all distinct Encoded tags.
   std::vector<EncodedTagInfo> tags_list_;
+  // Destinations of transitions from all tags in `tags_list_`, grouped by the
+  // source tag. Filled by `CollectTransitionStatistics()`.
+  std::vector<DestInfo> dest_infos_;
   // Sequence of tags on input as indices into `tags_list_`.
   std::vector<uint32_t> encoded_tags_;
   // Data buffers in separate vectors per buffer type.
   std::vector<BufferWithMetadata> data_[kNumBufferTypes];
+  // An open group: the message containing it.
+  struct OpenGroup {
+    internal::MessageId parent_message_id;
+    const google::protobuf::Descriptor* parent_descriptor;
+  };
   // Every group creates a new message ID. We keep track of open groups in this
   // vector.
-  std::vector<internal::MessageId> group_stack_;
+  std::vector<OpenGroup> group_stack_;
   // Tree of message nodes.
   absl::flat_hash_map<NodeId, MessageNode> message_nodes_;
   ChainBackwardWriter<Chain> nonproto_lengths_writer_;
+  // Buffers and their writers released by `Clear()`, reused by `GetBuffer()`
+  // for later chunks. A cleared `Chain` keeps its first block if it is not
+  // shared, so chunks with many fields do not allocate buffers anew.
+  std::vector<std::unique_ptr<Chain>> spare_buffers_;
+  std::vector<std::unique_ptr<ChainBackwardWriter<>>> spare_writers_;
   // Counter used to assign unique IDs to the message nodes.
   internal::MessageId next_message_id_ = internal::MessageId::kRoot + 1;
 };
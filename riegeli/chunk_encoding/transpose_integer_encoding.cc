@@ -0,0 +1,409 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/transpose_integer_encoding.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/chunk_encoding/transpose_internal.h"
+#include "riegeli/endian/endian_reading.h"
+#include "riegeli/endian/endian_writing.h"
+#include "riegeli/messages/message_wire_format.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+inline uint64_t EncodeZigZag(uint64_t value) {
+  return (value << 1) ^
+         static_cast<uint64_t>(static_cast<int64_t>(value) >> 63);
+}
+
+inline uint64_t DecodeZigZag(uint64_t value) {
+  return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+// Returns the number of bits needed to store `value`.
+inline int BitWidth(uint64_t value) {
+  int width = 0;
+  while (value != 0) {
+    value >>= 1;
+    ++width;
+  }
+  return width;
+}
+
+// Returns the number of bytes of `num_values` values packed with `width` bits
+// each.
+inline uint64_t PackedSize(uint64_t num_values, int width) {
+  return (num_values / 8) * IntCast<uint64_t>(width) +
+         (num_values % 8 * IntCast<uint64_t>(width) + 7) / 8;
+}
+
+// Reads `width` bits starting at bit `bit_pos` of `data[0..size)`.
+inline uint64_t ReadBits(const char* data, size_t size, uint64_t bit_pos,
+                         int width) {
+  const size_t byte_pos = IntCast<size_t>(bit_pos / 8);
+  const int shift = static_cast<int>(bit_pos % 8);
+  const uint64_t mask =
+      width == 64 ? ~uint64_t{0} : (uint64_t{1} << width) - 1;
+  if (ABSL_PREDICT_TRUE(shift + width <= 64 &&
+                        size - byte_pos >= sizeof(uint64_t))) {
+    // Fast path: the bits are contained in one unaligned word.
+    return (ReadLittleEndian64(data + byte_pos) >> shift) & mask;
+  }
+  uint64_t value = 0;
+  int value_width = 0;
+  while (value_width < width) {
+    const int byte_shift = static_cast<int>(bit_pos % 8);
+    const int length = std::min(8 - byte_shift, width - value_width);
+    value |= ((static_cast<uint64_t>(static_cast<unsigned char>(
+                   data[IntCast<size_t>(bit_pos / 8)])) >>
+               byte_shift) &
+              ((uint64_t{1} << length) - 1))
+             << value_width;
+    value_width += length;
+    bit_pos += IntCast<uint64_t>(length);
+  }
+  return value;
+}
+
+// Writes `values` in their `BufferEncoding::kPlain` representation for
+// `wire_type` to `dest`.
+absl::Status WritePlainValues(WireType wire_type,
+                              absl::Span<const uint64_t> values, Chain& dest) {
+  ChainWriter<> writer(&dest);
+  switch (wire_type) {
+    case WireType::kVarint:
+      for (const uint64_t value : values) {
+        if (ABSL_PREDICT_FALSE(!writer.Push(kMaxLengthVarint64))) {
+          return writer.status();
+        }
+        char* const start = writer.cursor();
+        char* const end = WriteVarint64(value, start);
+        // Clear high bit of each byte.
+        for (char* ptr = start; ptr < end; ++ptr) *ptr &= 0x7f;
+        writer.set_cursor(end);
+      }
+      break;
+    case WireType::kFixed32:
+      for (const uint64_t value : values) {
+        if (ABSL_PREDICT_FALSE(value > std::numeric_limits<uint32_t>::max())) {
+          return absl::DataLossError("Fixed32 value out of range");
+        }
+        if (ABSL_PREDICT_FALSE(
+                !WriteLittleEndian32(static_cast<uint32_t>(value), writer))) {
+          return writer.status();
+        }
+      }
+      break;
+    case WireType::kFixed64:
+      if (ABSL_PREDICT_FALSE(!WriteLittleEndian64s(values, writer))) {
+        return writer.status();
+      }
+      break;
+    default:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Wire type without integer encodings: "
+          << static_cast<uint32_t>(wire_type);
+  }
+  if (ABSL_PREDICT_FALSE(!writer.Close())) return writer.status();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+bool HasIntegerEncodings(WireType wire_type) {
+  return wire_type == WireType::kVarint || wire_type == WireType::kFixed32 ||
+         wire_type == WireType::kFixed64;
+}
+
+bool ParseIntegerBuffer(WireType wire_type, const Chain& src,
+                        absl::Span<const uint8_t> varint_lengths,
+                        std::vector<uint64_t>& values) {
+  values.clear();
+  ChainReader<> reader(&src);
+  switch (wire_type) {
+    case WireType::kVarint:
+      values.reserve(varint_lengths.size());
+      for (const uint8_t length : varint_lengths) {
+        if (ABSL_PREDICT_FALSE(!reader.Pull(length))) {
+          RIEGELI_ASSERT_UNREACHABLE()
+              << "Varint buffer shorter than its varints";
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < length; ++i) {
+          value |= uint64_t{static_cast<unsigned char>(reader.cursor()[i])}
+                   << (i * 7);
+        }
+        // A varint of the maximum length can have bits outside of 64 bits.
+        if (length == kMaxLengthVarint64 &&
+            static_cast<unsigned char>(reader.cursor()[length - 1]) > 1) {
+          return false;
+        }
+        if (LengthVarint64(value) != length) return false;
+        reader.move_cursor(length);
+        values.push_back(value);
+      }
+      break;
+    case WireType::kFixed32: {
+      std::vector<uint32_t> values32(src.size() / sizeof(uint32_t));
+      if (ABSL_PREDICT_FALSE(
+              !ReadLittleEndian32s(reader, absl::MakeSpan(values32)))) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Reading fixed32 values failed: " << reader.status();
+      }
+      values.assign(values32.begin(), values32.end());
+      break;
+    }
+    case WireType::kFixed64:
+      values.resize(src.size() / sizeof(uint64_t));
+      if (ABSL_PREDICT_FALSE(
+              !ReadLittleEndian64s(reader, absl::MakeSpan(values)))) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Reading fixed64 values failed: " << reader.status();
+      }
+      break;
+    default:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Wire type without integer encodings: "
+          << static_cast<uint32_t>(wire_type);
+  }
+  RIEGELI_ASSERT_EQ(reader.pos(), src.size())
+      << "Integer buffer has data after its values";
+  return true;
+}
+
+BufferEncoding ChooseIntegerEncoding(absl::Span<const uint64_t> values,
+                                      size_t plain_size) {
+  if (values.empty()) return BufferEncoding::kPlain;
+  bool nondecreasing = true;
+  uint64_t delta_size = LengthVarint64(values.size());
+  uint64_t zigzag_delta_size = delta_size;
+  uint64_t min_value = values[0];
+  uint64_t max_value = values[0];
+  uint64_t previous = 0;
+  for (const uint64_t value : values) {
+    const uint64_t delta = value - previous;
+    if (value < previous) nondecreasing = false;
+    delta_size += LengthVarint64(delta);
+    zigzag_delta_size += LengthVarint64(EncodeZigZag(delta));
+    min_value = UnsignedMin(min_value, value);
+    max_value = UnsignedMax(max_value, value);
+    previous = value;
+  }
+  const uint64_t frame_of_reference_size =
+      LengthVarint64(values.size()) + LengthVarint64(min_value) + 1 +
+      PackedSize(values.size(), BitWidth(max_value - min_value));
+
+  BufferEncoding encoding = BufferEncoding::kPlain;
+  uint64_t size = plain_size;
+  if (nondecreasing && delta_size < size) {
+    encoding = BufferEncoding::kDelta;
+    size = delta_size;
+  }
+  if (zigzag_delta_size < size) {
+    encoding = BufferEncoding::kZigZagDelta;
+    size = zigzag_delta_size;
+  }
+  if (frame_of_reference_size < size) {
+    encoding = BufferEncoding::kFrameOfReference;
+    size = frame_of_reference_size;
+  }
+  return encoding;
+}
+
+void EncodeIntegerBuffer(BufferEncoding encoding,
+                         absl::Span<const uint64_t> values, Chain& dest) {
+  dest.Clear();
+  ChainWriter<> writer(&dest);
+  WriteVarint64(IntCast<uint64_t>(values.size()), writer);
+  switch (encoding) {
+    case BufferEncoding::kDelta: {
+      uint64_t previous = 0;
+      for (const uint64_t value : values) {
+        RIEGELI_ASSERT_GE(value, previous)
+            << "Failed precondition of EncodeIntegerBuffer(): "
+               "values not sorted";
+        WriteVarint64(value - previous, writer);
+        previous = value;
+      }
+    } break;
+    case BufferEncoding::kZigZagDelta: {
+      uint64_t previous = 0;
+      for (const uint64_t value : values) {
+        WriteVarint64(EncodeZigZag(value - previous), writer);
+        previous = value;
+      }
+    } break;
+    case BufferEncoding::kFrameOfReference: {
+      const uint64_t min_value =
+          *std::min_element(values.begin(), values.end());
+      const uint64_t max_value =
+          *std::max_element(values.begin(), values.end());
+      const int width = BitWidth(max_value - min_value);
+      WriteVarint64(min_value, writer);
+      writer.WriteByte(IntCast<uint8_t>(width));
+      uint64_t word = 0;
+      int word_width = 0;
+      for (const uint64_t value : values) {
+        const uint64_t offset = value - min_value;
+        word |= offset << word_width;
+        const int new_word_width = word_width + width;
+        if (new_word_width >= 64) {
+          WriteLittleEndian64(word, writer);
+          word = word_width == 0 ? 0 : offset >> (64 - word_width);
+          word_width = new_word_width - 64;
+        } else {
+          word_width = new_word_width;
+        }
+      }
+      for (; word_width > 0; word_width -= 8) {
+        writer.WriteByte(static_cast<uint8_t>(word));
+        word >>= 8;
+      }
+    } break;
+    case BufferEncoding::kPlain:
+    case BufferEncoding::kDictionary:
+    case BufferEncoding::kPackedFixed32:
+    case BufferEncoding::kPackedFixed64:
+    case BufferEncoding::kPackedVarint:
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed precondition of EncodeIntegerBuffer(): "
+             "not an integer encoding";
+  }
+  // Writing to a `Chain` can fail only if it exceeds its maximum size.
+  if (ABSL_PREDICT_FALSE(!writer.Close())) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Writing integer buffer failed: " << writer.status();
+  }
+}
+
+absl::Status DecodeIntegerBuffer(BufferEncoding encoding, WireType wire_type,
+                                 const Chain& src, uint64_t max_size,
+                                 Chain& dest) {
+  if (ABSL_PREDICT_FALSE(!HasIntegerEncodings(wire_type))) {
+    return absl::DataLossError("Wire type without integer encodings");
+  }
+  ChainReader<> reader(&src);
+  const absl::optional<uint64_t> num_values = ReadVarint64(reader);
+  if (ABSL_PREDICT_FALSE(num_values == absl::nullopt)) {
+    return absl::DataLossError("Reading number of values failed");
+  }
+  // Each value takes at least one byte when decoded.
+  if (ABSL_PREDICT_FALSE(*num_values > max_size)) {
+    return absl::DataLossError("Too many values");
+  }
+  std::vector<uint64_t> values;
+  switch (encoding) {
+    case BufferEncoding::kDelta:
+    case BufferEncoding::kZigZagDelta: {
+      // Each difference takes at least one byte.
+      if (ABSL_PREDICT_FALSE(*num_values > src.size() - reader.pos())) {
+        return absl::DataLossError("Too many values");
+      }
+      values.resize(IntCast<size_t>(*num_values));
+      if (ABSL_PREDICT_FALSE(
+              !ReadVarints64(reader, values.size(), values.data()))) {
+        return absl::DataLossError("Reading value differences failed");
+      }
+      uint64_t previous = 0;
+      if (encoding == BufferEncoding::kDelta) {
+        for (uint64_t& value : values) {
+          if (ABSL_PREDICT_FALSE(value >
+                                 std::numeric_limits<uint64_t>::max() -
+                                     previous)) {
+            return absl::DataLossError("Value overflow");
+          }
+          value += previous;
+          previous = value;
+        }
+      } else {
+        for (uint64_t& value : values) {
+          value = previous + DecodeZigZag(value);
+          previous = value;
+        }
+      }
+    } break;
+    case BufferEncoding::kFrameOfReference: {
+      const absl::optional<uint64_t> min_value = ReadVarint64(reader);
+      if (ABSL_PREDICT_FALSE(min_value == absl::nullopt)) {
+        return absl::DataLossError("Reading smallest value failed");
+      }
+      const absl::optional<uint8_t> width_byte = reader.ReadByte();
+      if (ABSL_PREDICT_FALSE(width_byte == absl::nullopt)) {
+        return absl::DataLossError("Reading value width failed");
+      }
+      const int width = *width_byte;
+      if (ABSL_PREDICT_FALSE(width > 64)) {
+        return absl::DataLossError("Value width too large");
+      }
+      if (ABSL_PREDICT_FALSE(src.size() - reader.pos() !=
+                             PackedSize(*num_values, width))) {
+        return absl::DataLossError("Packed values have a wrong size");
+      }
+      Chain packed;
+      if (ABSL_PREDICT_FALSE(!reader.Read(
+              IntCast<size_t>(src.size() - reader.pos()), packed))) {
+        return reader.status();
+      }
+      const absl::string_view packed_data = packed.Flatten();
+      values.resize(IntCast<size_t>(*num_values));
+      if (width == 0) {
+        std::fill(values.begin(), values.end(), *min_value);
+      } else {
+        uint64_t bit_pos = 0;
+        for (uint64_t& value : values) {
+          value = *min_value + ReadBits(packed_data.data(), packed_data.size(),
+                                        bit_pos, width);
+          bit_pos += IntCast<uint64_t>(width);
+        }
+      }
+    } break;
+    default:
+      return absl::DataLossError("Unknown integer encoding");
+  }
+  if (ABSL_PREDICT_FALSE(!reader.VerifyEndAndClose())) return reader.status();
+  Chain decoded;
+  {
+    const absl::Status status = WritePlainValues(wire_type, values, decoded);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (ABSL_PREDICT_FALSE(decoded.size() > max_size)) {
+    return absl::DataLossError("Decoded integer buffer too large");
+  }
+  dest = std::move(decoded);
+  return absl::OkStatus();
+}
+
+}  // namespace internal
+}  // namespace riegeli
@@ -0,0 +1,78 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CHUNK_ENCODING_TRANSPOSE_INTEGER_ENCODING_H_
+#define RIEGELI_CHUNK_ENCODING_TRANSPOSE_INTEGER_ENCODING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/chunk_encoding/transpose_internal.h"
+#include "riegeli/messages/message_wire_format.h"
+
+namespace riegeli {
+namespace internal {
+
+// Returns `true` if data buffers of fields with `wire_type` can have an
+// `BufferEncoding` other than `BufferEncoding::kPlain`.
+bool HasIntegerEncodings(WireType wire_type);
+
+// Parses a data buffer of fields with `wire_type` stored with
+// `BufferEncoding::kPlain` into `values`.
+//
+// If `wire_type == WireType::kVarint`, `varint_lengths` are lengths of
+// consecutive varints in `src`.
+//
+// Returns `false` if values do not determine the buffer, i.e. some varint is
+// not in its canonical representation. Then the buffer must stay plain.
+//
+// Precondition: `HasIntegerEncodings(wire_type)`
+bool ParseIntegerBuffer(WireType wire_type, const Chain& src,
+                        absl::Span<const uint8_t> varint_lengths,
+                        std::vector<uint64_t>& values);
+
+// Returns the encoding of `values` which is the smallest, or
+// `BufferEncoding::kPlain` if none is smaller than `plain_size`.
+BufferEncoding ChooseIntegerEncoding(absl::Span<const uint64_t> values,
+                                      size_t plain_size);
+
+// Encodes `values` with `encoding`, replacing `dest`.
+//
+// Precondition: `encoding` is `BufferEncoding::kDelta`,
+// `BufferEncoding::kZigZagDelta`, or `BufferEncoding::kFrameOfReference`, and
+// `values` are nondecreasing if `encoding == BufferEncoding::kDelta`.
+void EncodeIntegerBuffer(BufferEncoding encoding,
+                         absl::Span<const uint64_t> values, Chain& dest);
+
+// Decodes a data buffer of fields with `wire_type` encoded with `encoding`,
+// replacing `dest` with its `BufferEncoding::kPlain` representation.
+//
+// Fails if the decoded buffer would be larger than `max_size`.
+//
+// Returns status:
+//  * `status.ok()`  - success
+//  * `!status.ok()` - failure (`src` is invalid)
+absl::Status DecodeIntegerBuffer(BufferEncoding encoding, WireType wire_type,
+                                 const Chain& src, uint64_t max_size,
+                                 Chain& dest);
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_CHUNK_ENCODING_TRANSPOSE_INTEGER_ENCODING_H_
@@ -66,6 +66,64 @@ enum class Subtype : uint8_t {
   kLengthDelimitedEndOfSubmessage = 2,
 };
 
+// Encodings of whole data buffers, replacing the values stored one after
+// another in their wire format (varints with the high bit of each byte cleared,
+// strings preceded by their length). Values are numbered in the order of the
+// buffer.
+enum class BufferEncoding : uint8_t {
+  // Values in their wire format. Not listed in the header.
+  kPlain = 0,
+
+  // Encodings of `WireType::kVarint`, `WireType::kFixed32`, or
+  // `WireType::kFixed64` fields:
+  // Number of values, then differences between consecutive values as varints,
+  // the first one from 0. Values are nondecreasing.
+  kDelta = 1,
+  // Number of values, then differences between consecutive values modulo 2^64
+  // as zigzag-encoded varints, the first one from 0.
+  kZigZagDelta = 2,
+  // Number of values, the smallest value, the number of bits per value
+  // (0..64, one byte), then differences between values and the smallest value
+  // packed with that many bits, least significant bits first.
+  kFrameOfReference = 3,
+
+  // Encodings of `WireType::kLengthDelimited` fields:
+  // Number of distinct values, distinct values in their wire format, then
+  // indices of values among distinct values as varints, up to the end.
+  kDictionary = 4,
+  // Packed repeated fields with 4-byte elements (fixed32, sfixed32, float):
+  // number of values, numbers of elements of values as varints, then bytes of
+  // all elements split into 4 streams: the first byte of each element, then
+  // the second byte of each element, etc.
+  kPackedFixed32 = 5,
+  // Packed repeated fields with 8-byte elements (fixed64, sfixed64, double):
+  // like `kPackedFixed32`, with 8 streams.
+  kPackedFixed64 = 6,
+  // Packed repeated fields with varint elements: number of values, numbers of
+  // elements of values as varints, then elements of all values concatenated.
+  kPackedVarint = 7,
+};
+
+// Returns `true` if `encoding` is a valid encoding of a data buffer of fields
+// with `wire_type`, other than `BufferEncoding::kPlain`.
+inline bool ValidBufferEncoding(WireType wire_type, BufferEncoding encoding) {
+  switch (wire_type) {
+    case WireType::kVarint:
+    case WireType::kFixed32:
+    case WireType::kFixed64:
+      return encoding == BufferEncoding::kDelta ||
+             encoding == BufferEncoding::kZigZagDelta ||
+             encoding == BufferEncoding::kFrameOfReference;
+    case WireType::kLengthDelimited:
+      return encoding == BufferEncoding::kDictionary ||
+             encoding == BufferEncoding::kPackedFixed32 ||
+             encoding == BufferEncoding::kPackedFixed64 ||
+             encoding == BufferEncoding::kPackedVarint;
+    default:
+      return false;
+  }
+}
+
 inline Subtype operator+(Subtype a, uint8_t b) {
   return static_cast<Subtype>(static_cast<uint8_t>(a) + b);
 }
@@ -0,0 +1,234 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/chunk_encoding/transpose_packed_encoding.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/chunk_encoding/transpose_internal.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+namespace internal {
+
+namespace {
+
+// Returns the size of an element of a packed fixed encoding.
+inline size_t FixedWidth(BufferEncoding encoding) {
+  return encoding == BufferEncoding::kPackedFixed32 ? 4 : 8;
+}
+
+// Returns the number of varints in a packed run, or `absl::nullopt` if `run` is
+// not a sequence of valid varints. `scratch` holds decoded values, which are
+// not needed otherwise.
+absl::optional<size_t> CountVarints(const std::string& run,
+                                    std::vector<uint64_t>& scratch) {
+  const char* const limit = run.data() + run.size();
+  // Each varint ends with the only byte with the high bit cleared.
+  const size_t num_elements = IntCast<size_t>(
+      std::count_if(run.data(), limit, [](char byte) {
+        return static_cast<uint8_t>(byte) < 0x80;
+      }));
+  scratch.resize(num_elements);
+  const absl::optional<const char*> cursor =
+      ReadVarints64(run.data(), limit, num_elements, scratch.data());
+  if (ABSL_PREDICT_FALSE(cursor == absl::nullopt || *cursor != limit)) {
+    return absl::nullopt;
+  }
+  return num_elements;
+}
+
+}  // namespace
+
+bool EncodePackedBuffer(BufferEncoding encoding, const Chain& src,
+                        Chain& dest) {
+  RIEGELI_ASSERT(IsPackedEncoding(encoding))
+      << "Failed precondition of EncodePackedBuffer(): "
+         "not a packed encoding: "
+      << static_cast<int>(encoding);
+  ChainReader<> reader(&src);
+  std::vector<uint32_t> counts;
+  // For `BufferEncoding::kPackedVarint`: elements of all values.
+  // For packed fixed encodings: bytes of elements, not split yet.
+  std::string elements;
+  std::string value;
+  std::vector<uint64_t> scratch;
+  while (reader.Pull()) {
+    const Position value_pos = reader.pos();
+    const absl::optional<uint32_t> length = ReadVarint32(reader);
+    if (ABSL_PREDICT_FALSE(length == absl::nullopt)) return false;
+    // A non-canonical length would not be restored by decoding.
+    if (ABSL_PREDICT_FALSE(reader.pos() - value_pos !=
+                           LengthVarint32(*length))) {
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(!reader.Read(size_t{*length}, value))) return false;
+    if (encoding == BufferEncoding::kPackedVarint) {
+      const absl::optional<size_t> num_elements = CountVarints(value, scratch);
+      if (ABSL_PREDICT_FALSE(num_elements == absl::nullopt)) return false;
+      counts.push_back(IntCast<uint32_t>(*num_elements));
+    } else {
+      if (ABSL_PREDICT_FALSE(value.size() % FixedWidth(encoding) != 0)) {
+        return false;
+      }
+      counts.push_back(IntCast<uint32_t>(value.size() / FixedWidth(encoding)));
+    }
+    elements.append(value);
+  }
+  if (ABSL_PREDICT_FALSE(!reader.healthy())) return false;
+  dest.Clear();
+  ChainWriter<> writer(&dest);
+  WriteVarint32(IntCast<uint32_t>(counts.size()), writer);
+  for (const uint32_t count : counts) WriteVarint32(count, writer);
+  if (encoding == BufferEncoding::kPackedVarint) {
+    writer.Write(std::move(elements));
+  } else {
+    const size_t width = FixedWidth(encoding);
+    const size_t num_elements = elements.size() / width;
+    std::string streams(elements.size(), '\0');
+    for (size_t i = 0; i < num_elements; ++i) {
+      for (size_t j = 0; j < width; ++j) {
+        streams[j * num_elements + i] = elements[i * width + j];
+      }
+    }
+    writer.Write(std::move(streams));
+  }
+  // Writing to a `Chain` can fail only if it exceeds its maximum size.
+  if (ABSL_PREDICT_FALSE(!writer.Close())) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Writing packed buffer failed: " << writer.status();
+  }
+  return true;
+}
+
+absl::Status DecodePackedBuffer(BufferEncoding encoding, const Chain& src,
+                                uint64_t max_size, Chain& dest) {
+  RIEGELI_ASSERT(IsPackedEncoding(encoding))
+      << "Failed precondition of DecodePackedBuffer(): "
+         "not a packed encoding: "
+      << static_cast<int>(encoding);
+  ChainReader<> reader(&src);
+  const absl::optional<uint32_t> num_values = ReadVarint32(reader);
+  if (ABSL_PREDICT_FALSE(num_values == absl::nullopt)) {
+    return absl::DataLossError("Reading number of packed values failed");
+  }
+  // Each count takes at least one byte.
+  if (ABSL_PREDICT_FALSE(*num_values > src.size() - reader.pos())) {
+    return absl::DataLossError("Too many packed values");
+  }
+  std::vector<uint32_t> counts(*num_values);
+  uint64_t num_elements = 0;
+  for (uint32_t& count : counts) {
+    const absl::optional<uint32_t> count_read = ReadVarint32(reader);
+    if (ABSL_PREDICT_FALSE(count_read == absl::nullopt)) {
+      return absl::DataLossError("Reading number of packed elements failed");
+    }
+    count = *count_read;
+    num_elements += count;
+  }
+  std::string elements;
+  if (ABSL_PREDICT_FALSE(!reader.ReadAll(elements))) return reader.status();
+  Chain decoded;
+  ChainWriter<> writer(&decoded);
+  if (encoding == BufferEncoding::kPackedVarint) {
+    // Each element takes at least one byte.
+    if (ABSL_PREDICT_FALSE(num_elements > elements.size())) {
+      return absl::DataLossError("Too many packed elements");
+    }
+    const char* cursor = elements.data();
+    const char* const limit = elements.data() + elements.size();
+    std::vector<uint64_t> scratch;
+    for (const uint32_t count : counts) {
+      scratch.resize(count);
+      const absl::optional<const char*> value_end =
+          ReadVarints64(cursor, limit, count, scratch.data());
+      if (ABSL_PREDICT_FALSE(value_end == absl::nullopt)) {
+        return absl::DataLossError("Reading packed varints failed");
+      }
+      const size_t length = PtrDistance(cursor, *value_end);
+      if (ABSL_PREDICT_FALSE(length > std::numeric_limits<uint32_t>::max())) {
+        return absl::DataLossError("Packed value too long");
+      }
+      if (ABSL_PREDICT_FALSE(LengthVarint32(IntCast<uint32_t>(length)) +
+                                 length >
+                             max_size - writer.pos())) {
+        return absl::DataLossError("Decoded packed buffer too large");
+      }
+      WriteVarint32(IntCast<uint32_t>(length), writer);
+      writer.Write(absl::string_view(cursor, length));
+      cursor = *value_end;
+    }
+    if (ABSL_PREDICT_FALSE(cursor != limit)) {
+      return absl::DataLossError("Packed varints have trailing data");
+    }
+  } else {
+    const size_t width = FixedWidth(encoding);
+    if (ABSL_PREDICT_FALSE(num_elements != elements.size() / width ||
+                           elements.size() % width != 0)) {
+      return absl::DataLossError(
+          "Number of packed elements does not match their size");
+    }
+    uint64_t decoded_size = 0;
+    for (const uint32_t count : counts) {
+      if (ABSL_PREDICT_FALSE(count >
+                             std::numeric_limits<uint32_t>::max() / width)) {
+        return absl::DataLossError("Packed value too long");
+      }
+      const uint32_t length = IntCast<uint32_t>(count * width);
+      decoded_size += LengthVarint32(length) + length;
+    }
+    if (ABSL_PREDICT_FALSE(decoded_size > max_size)) {
+      return absl::DataLossError("Decoded packed buffer too large");
+    }
+    // Gather bytes of each element from the streams.
+    const size_t stride = IntCast<size_t>(num_elements);
+    size_t index = 0;
+    for (const uint32_t count : counts) {
+      const size_t length = size_t{count} * width;
+      WriteVarint32(IntCast<uint32_t>(length), writer);
+      if (ABSL_PREDICT_FALSE(!writer.Push(length))) break;
+      char* const value = writer.cursor();
+      for (size_t i = 0; i < count; ++i) {
+        for (size_t j = 0; j < width; ++j) {
+          value[i * width + j] = elements[j * stride + index + i];
+        }
+      }
+      writer.move_cursor(length);
+      index += count;
+    }
+  }
+  // Writing to a `Chain` can fail only if it exceeds its maximum size.
+  if (ABSL_PREDICT_FALSE(!writer.Close())) return writer.status();
+  dest = std::move(decoded);
+  return absl::OkStatus();
+}
+
+}  // namespace internal
+}  // namespace riegeli
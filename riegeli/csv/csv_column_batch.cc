@@ -0,0 +1,130 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/csv/csv_column_batch.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/csv/csv_record.h"
+
+namespace riegeli {
+
+size_t CsvColumnBatch::AddColumn(absl::string_view name, Type type,
+                                 absl::string_view time_format) {
+  RIEGELI_ASSERT_EQ(num_rows_, 0u)
+      << "Failed precondition of CsvColumnBatch::AddColumn(): "
+         "rows already present";
+  columns_.emplace_back();
+  Column& column = columns_.back();
+  column.name = std::string(name);
+  column.type = type;
+  column.time_format = std::string(time_format);
+  return columns_.size() - 1;
+}
+
+void CsvColumnBatch::ClearRows() {
+  for (Column& column : columns_) {
+    column.strings.clear();
+    column.int64s.clear();
+    column.doubles.clear();
+    column.times.clear();
+  }
+  num_rows_ = 0;
+}
+
+absl::Status CsvColumnBatch::ResolveColumns(const CsvHeader& header) {
+  for (Column& column : columns_) {
+    const absl::optional<size_t> field_index = header.IndexOf(column.name);
+    if (ABSL_PREDICT_FALSE(field_index == absl::nullopt)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Missing field name in CSV header: ", column.name));
+    }
+    column.field_index = *field_index;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CsvColumnBatch::AppendRow(
+    absl::Span<const absl::string_view> fields) {
+  for (Column& column : columns_) {
+    RIEGELI_ASSERT_LT(column.field_index, fields.size())
+        << "Failed precondition of CsvColumnBatch::AppendRow(): "
+           "field index out of range";
+    const absl::string_view field = fields[column.field_index];
+    bool ok = true;
+    switch (column.type) {
+      case Type::kString:
+        column.strings.emplace_back(field);
+        continue;
+      case Type::kInt64: {
+        int64_t value;
+        ok = absl::SimpleAtoi(field, &value);
+        if (ABSL_PREDICT_TRUE(ok)) column.int64s.push_back(value);
+        break;
+      }
+      case Type::kDouble: {
+        double value;
+        ok = absl::SimpleAtod(field, &value);
+        if (ABSL_PREDICT_TRUE(ok)) column.doubles.push_back(value);
+        break;
+      }
+      case Type::kTime: {
+        absl::Time value;
+        ok = absl::ParseTime(column.time_format, field, &value, nullptr);
+        if (ABSL_PREDICT_TRUE(ok)) column.times.push_back(value);
+        break;
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!ok)) {
+      // Remove fields of this row which have already been appended.
+      for (Column& appended : columns_) {
+        if (&appended == &column) break;
+        switch (appended.type) {
+          case Type::kString:
+            appended.strings.pop_back();
+            break;
+          case Type::kInt64:
+            appended.int64s.pop_back();
+            break;
+          case Type::kDouble:
+            appended.doubles.pop_back();
+            break;
+          case Type::kTime:
+            appended.times.pop_back();
+            break;
+        }
+      }
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid value of field ", column.name, ": \"",
+                       absl::CHexEscape(field), "\""));
+    }
+  }
+  ++num_rows_;
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
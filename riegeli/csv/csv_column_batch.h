@@ -0,0 +1,231 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CSV_CSV_COLUMN_BATCH_H_
+#define RIEGELI_CSV_CSV_COLUMN_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/csv/csv_record.h"
+
+namespace riegeli {
+
+class CsvReaderBase;
+
+// Rows of a CSV file stored by columns, with fields converted to the types of
+// their columns. Filled by `CsvReaderBase::ReadColumnBatch()`.
+//
+// Columns are selected by field names from the header of the CSV file, and
+// are stored in the order in which they have been added. Fields which are not
+// selected are not converted.
+//
+// A `CsvColumnBatch` is reused for reading consecutive batches to avoid
+// reallocating columns.
+//
+// ```
+//   riegeli::CsvColumnBatch batch;
+//   const size_t id_column = batch.AddInt64Column("id");
+//   const size_t price_column = batch.AddDoubleColumn("price");
+//   while (csv_reader.ReadColumnBatch(1024, batch)) {
+//     Aggregate(batch.int64_column(id_column),
+//               batch.double_column(price_column));
+//   }
+// ```
+class CsvColumnBatch {
+ public:
+  // Type of fields of a column.
+  enum class Type {
+    kString,  // `std::string`, unchanged
+    kInt64,   // `int64_t`, converted by `absl::SimpleAtoi()`
+    kDouble,  // `double`, converted by `absl::SimpleAtod()`
+    kTime,    // `absl::Time`, converted by `absl::ParseTime()`
+  };
+
+  // Creates a `CsvColumnBatch` without columns.
+  CsvColumnBatch() noexcept {}
+
+  CsvColumnBatch(const CsvColumnBatch& that) = default;
+  CsvColumnBatch& operator=(const CsvColumnBatch& that) = default;
+
+  CsvColumnBatch(CsvColumnBatch&& that) noexcept = default;
+  CsvColumnBatch& operator=(CsvColumnBatch&& that) noexcept = default;
+
+  // Adds a column of fields named `name`, and returns its index.
+  //
+  // For `AddTimeColumn()`, `time_format` is the format for
+  // `absl::ParseTime()`.
+  //
+  // Precondition: `num_rows() == 0`
+  size_t AddStringColumn(absl::string_view name);
+  size_t AddInt64Column(absl::string_view name);
+  size_t AddDoubleColumn(absl::string_view name);
+  size_t AddTimeColumn(absl::string_view name,
+                       absl::string_view time_format = absl::RFC3339_full);
+
+  // Removes all rows, keeping columns.
+  void ClearRows();
+
+  // Returns the number of columns.
+  size_t num_columns() const { return columns_.size(); }
+
+  // Returns the number of rows.
+  size_t num_rows() const { return num_rows_; }
+
+  // Returns the field name of the column at `index`.
+  //
+  // Precondition: `index < num_columns()`
+  const std::string& name(size_t index) const;
+
+  // Returns the type of the column at `index`.
+  //
+  // Precondition: `index < num_columns()`
+  Type type(size_t index) const;
+
+  // Returns fields of the column at `index`, one per row.
+  //
+  // Precondition: `index < num_columns()`, and the column has the given type
+  absl::Span<const std::string> string_column(size_t index) const;
+  absl::Span<const int64_t> int64_column(size_t index) const;
+  absl::Span<const double> double_column(size_t index) const;
+  absl::Span<const absl::Time> time_column(size_t index) const;
+
+ private:
+  friend class CsvReaderBase;
+
+  struct Column {
+    std::string name;
+    Type type = Type::kString;
+    // Meaningful if `type == Type::kTime`.
+    std::string time_format;
+    // Index of the field in records, set by `ResolveColumns()`.
+    size_t field_index = 0;
+    // Only the vector corresponding to `type` is used.
+    std::vector<std::string> strings;
+    std::vector<int64_t> int64s;
+    std::vector<double> doubles;
+    std::vector<absl::Time> times;
+  };
+
+  size_t AddColumn(absl::string_view name, Type type,
+                   absl::string_view time_format);
+
+  // Sets `field_index` of columns from `header`.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - some field name is missing in `header`
+  absl::Status ResolveColumns(const CsvHeader& header);
+
+  // Appends a row made of `fields`, which must have `header.size()` fields of
+  // the `header` given to `ResolveColumns()`.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - some field could not be converted; the row is not
+  //                     appended
+  absl::Status AppendRow(absl::Span<const absl::string_view> fields);
+
+  std::vector<Column> columns_;
+  size_t num_rows_ = 0;
+};
+
+// Implementation details follow.
+
+inline const std::string& CsvColumnBatch::name(size_t index) const {
+  RIEGELI_ASSERT_LT(index, columns_.size())
+      << "Failed precondition of CsvColumnBatch::name(): "
+         "index out of range";
+  return columns_[index].name;
+}
+
+inline CsvColumnBatch::Type CsvColumnBatch::type(size_t index) const {
+  RIEGELI_ASSERT_LT(index, columns_.size())
+      << "Failed precondition of CsvColumnBatch::type(): "
+         "index out of range";
+  return columns_[index].type;
+}
+
+inline absl::Span<const std::string> CsvColumnBatch::string_column(
+    size_t index) const {
+  RIEGELI_ASSERT_LT(index, columns_.size())
+      << "Failed precondition of CsvColumnBatch::string_column(): "
+         "index out of range";
+  RIEGELI_ASSERT(columns_[index].type == Type::kString)
+      << "Failed precondition of CsvColumnBatch::string_column(): "
+         "column type mismatch";
+  return columns_[index].strings;
+}
+
+inline absl::Span<const int64_t> CsvColumnBatch::int64_column(
+    size_t index) const {
+  RIEGELI_ASSERT_LT(index, columns_.size())
+      << "Failed precondition of CsvColumnBatch::int64_column(): "
+         "index out of range";
+  RIEGELI_ASSERT(columns_[index].type == Type::kInt64)
+      << "Failed precondition of CsvColumnBatch::int64_column(): "
+         "column type mismatch";
+  return columns_[index].int64s;
+}
+
+inline absl::Span<const double> CsvColumnBatch::double_column(
+    size_t index) const {
+  RIEGELI_ASSERT_LT(index, columns_.size())
+      << "Failed precondition of CsvColumnBatch::double_column(): "
+         "index out of range";
+  RIEGELI_ASSERT(columns_[index].type == Type::kDouble)
+      << "Failed precondition of CsvColumnBatch::double_column(): "
+         "column type mismatch";
+  return columns_[index].doubles;
+}
+
+inline absl::Span<const absl::Time> CsvColumnBatch::time_column(
+    size_t index) const {
+  RIEGELI_ASSERT_LT(index, columns_.size())
+      << "Failed precondition of CsvColumnBatch::time_column(): "
+         "index out of range";
+  RIEGELI_ASSERT(columns_[index].type == Type::kTime)
+      << "Failed precondition of CsvColumnBatch::time_column(): "
+         "column type mismatch";
+  return columns_[index].times;
+}
+
+inline size_t CsvColumnBatch::AddStringColumn(absl::string_view name) {
+  return AddColumn(name, Type::kString, absl::string_view());
+}
+
+inline size_t CsvColumnBatch::AddInt64Column(absl::string_view name) {
+  return AddColumn(name, Type::kInt64, absl::string_view());
+}
+
+inline size_t CsvColumnBatch::AddDoubleColumn(absl::string_view name) {
+  return AddColumn(name, Type::kDouble, absl::string_view());
+}
+
+inline size_t CsvColumnBatch::AddTimeColumn(absl::string_view name,
+                                            absl::string_view time_format) {
+  return AddColumn(name, Type::kTime, time_format);
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CSV_CSV_COLUMN_BATCH_H_
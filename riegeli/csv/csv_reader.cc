@@ -15,6 +15,7 @@
 #include "riegeli/csv/csv_reader.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <array>
 #include <functional>
@@ -77,6 +78,12 @@ void CsvReaderBase::Initialize(Reader* src, Options&& options) {
     char_classes_[static_cast<unsigned char>(*options.escape())] =
         CharClass::kEscape;
   }
+  special_chars_.Reset();
+  for (size_t i = 0; i < char_classes_.size(); ++i) {
+    if (char_classes_[i] != CharClass::kOther) {
+      special_chars_.Add(static_cast<char>(i));
+    }
+  }
   quote_ = options.quote().value_or('\0');
   max_num_fields_ = UnsignedMin(options.max_num_fields(),
                                 std::vector<std::string>().max_size());
@@ -146,6 +153,28 @@ bool CsvReaderBase::MaxFieldLengthExceeded() {
       absl::StrCat("Maximum field length exceeded: ", max_field_length_)));
 }
 
+inline const char* CsvReaderBase::SkipOrdinaryChars(const char* ptr,
+                                                    const char* limit) const {
+  // Short runs are common, and they are found faster a character at a time.
+  const char* const words_begin =
+      ptr + UnsignedMin(PtrDistance(ptr, limit),
+                        internal::WordScanner::kWordSize);
+  for (; ptr != words_begin; ++ptr) {
+    if (char_classes_[static_cast<unsigned char>(*ptr)] != CharClass::kOther) {
+      return ptr;
+    }
+  }
+  while (PtrDistance(ptr, limit) >= internal::WordScanner::kWordSize &&
+         !special_chars_.AnyInWord(ptr)) {
+    ptr += internal::WordScanner::kWordSize;
+  }
+  while (ptr != limit &&
+         char_classes_[static_cast<unsigned char>(*ptr)] == CharClass::kOther) {
+    ++ptr;
+  }
+  return ptr;
+}
+
 inline void CsvReaderBase::SkipLine(Reader& src) {
   const char* ptr = src.cursor();
   for (;;) {
@@ -174,7 +203,8 @@ inline void CsvReaderBase::SkipLine(Reader& src) {
   }
 }
 
-inline bool CsvReaderBase::ReadQuoted(Reader& src, std::string& field) {
+template <typename Field>
+inline bool CsvReaderBase::ReadQuoted(Reader& src, Field& field) {
   if (ABSL_PREDICT_FALSE(!field.empty())) {
     recoverable_ = true;
     return Fail(absl::DataLossError("Unquoted data before opening quote"));
@@ -183,6 +213,7 @@ inline bool CsvReaderBase::ReadQuoted(Reader& src, std::string& field) {
   // Data from `src.cursor()` to where `ptr` stops will be appended to `field`.
   const char* ptr = src.cursor();
   for (;;) {
+    ptr = SkipOrdinaryChars(ptr, src.limit());
     if (ABSL_PREDICT_FALSE(ptr == src.limit())) {
       if (ABSL_PREDICT_FALSE(src.available() >
                              max_field_length_ - field.size())) {
@@ -266,8 +297,8 @@ inline bool CsvReaderBase::ReadQuoted(Reader& src, std::string& field) {
   }
 }
 
-inline bool CsvReaderBase::ReadFields(Reader& src,
-                                      std::vector<std::string>& fields,
+template <typename Field>
+inline bool CsvReaderBase::ReadFields(Reader& src, std::vector<Field>& fields,
                                       size_t& field_index) {
   RIEGELI_ASSERT_EQ(field_index, 0u)
       << "Failed precondition of CsvReaderBase::ReadFields(): "
@@ -295,11 +326,12 @@ next_field:
   } else {
     fields[field_index].clear();
   }
-  std::string& field = fields[field_index];
+  Field& field = fields[field_index];
 
   // Data from `src.cursor()` to where `ptr` stops will be appended to `field`.
   const char* ptr = src.cursor();
   for (;;) {
+    ptr = SkipOrdinaryChars(ptr, src.limit());
     if (ABSL_PREDICT_FALSE(ptr == src.limit())) {
       if (ABSL_PREDICT_FALSE(src.available() >
                              max_field_length_ - field.size())) {
@@ -459,6 +491,109 @@ bool CsvReaderBase::ReadRecord(std::vector<std::string>& record) {
   return ReadRecordInternal(record);
 }
 
+bool CsvReaderBase::ReadRecordView(CsvRecordView& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) {
+    record.Reset();
+    return false;
+  }
+  Reader& src = *src_reader();
+try_again:
+  size_t field_index = 0;
+  bool read;
+  // Fields refer to data buffered in `src`, hence the whole record must be
+  // buffered. The record is parsed from a window of buffered data, where the
+  // end of the window looks like the end of the source. If parsing reaches the
+  // end of the window while `src` has more data, the record might continue
+  // beyond the window, and it is parsed again from a larger window.
+  const int64_t line_number = line_number_;
+  for (;;) {
+    const char* const window_start = src.cursor();
+    const size_t length = src.available();
+    StringReader<> window(absl::string_view(window_start, length));
+    read = ReadFields(window, record.builders_, field_index);
+    if (window.available() == 0) {
+      const bool pulled = src.Pull(length + 1, SaturatingAdd(length, length));
+      // Even if `Pull()` failed, buffered data might have been moved, and then
+      // fields would refer to the old buffer.
+      if (pulled || src.cursor() != window_start ||
+          src.available() != length || ABSL_PREDICT_FALSE(!src.healthy())) {
+        if (!read && !healthy()) {
+          recoverable_ = false;
+          MarkNotFailed();
+        }
+        line_number_ = line_number;
+        field_index = 0;
+        if (ABSL_PREDICT_FALSE(!src.healthy())) {
+          // After a failure `src` no longer reads more data, hence its buffer
+          // stays valid, and the record can be parsed from `src` itself. This
+          // reports the failure of `src` if the record needs more data.
+          read = ReadFields(src, record.builders_, field_index);
+          break;
+        }
+        continue;
+      }
+    }
+    src.move_cursor(window.pos());
+    break;
+  }
+  if (ABSL_PREDICT_FALSE(!read)) {
+    if (recovery_ != nullptr && recoverable_) {
+      recoverable_ = false;
+      absl::Status status = this->status();
+      MarkNotFailed();
+      SkipLine(src);
+      if (recovery_(std::move(status))) goto try_again;
+    }
+    record.Reset();
+    return false;
+  }
+  record.SetFields(field_index + 1);
+  ++record_index_;
+  return true;
+}
+
+bool CsvReaderBase::ReadColumnBatch(size_t max_rows, CsvColumnBatch& batch) {
+  RIEGELI_CHECK(has_header())
+      << "Failed precondition of CsvReaderBase::ReadColumnBatch(): "
+         "CsvReaderBase::Options::read_header() is required";
+  RIEGELI_ASSERT_GT(max_rows, 0u)
+      << "Failed precondition of CsvReaderBase::ReadColumnBatch(): "
+         "no rows requested";
+  batch.ClearRows();
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  {
+    absl::Status status = batch.ResolveColumns(header_);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      return FailWithoutAnnotation(std::move(status));
+    }
+  }
+  CsvRecordView record;
+  while (batch.num_rows() < max_rows) {
+    if (ABSL_PREDICT_FALSE(!ReadRecordView(record))) break;
+    if (ABSL_PREDICT_FALSE(record.size() != header_.size())) {
+      FailAtPreviousRecord(absl::DataLossError(
+          absl::StrCat("Mismatched number of CSV fields: header has ",
+                       header_.size(), ", record has ", record.size())));
+    } else {
+      const absl::Status status = batch.AppendRow(record.fields());
+      if (ABSL_PREDICT_TRUE(status.ok())) continue;
+      FailAtPreviousRecord(absl::DataLossError(status.message()));
+    }
+    --record_index_;
+    if (recovery_ == nullptr) break;
+    absl::Status status = this->status();
+    MarkNotFailed();
+    if (!recovery_(std::move(status))) break;
+  }
+  return batch.num_rows() > 0;
+}
+
+void CsvRecordView::SetFields(size_t size) {
+  builders_.erase(builders_.begin() + size, builders_.end());
+  fields_.resize(size);
+  for (size_t i = 0; i < size; ++i) fields_[i] = builders_[i].view();
+}
+
 namespace internal {
 
 inline bool ReadStandaloneRecord(CsvReaderBase& csv_reader,
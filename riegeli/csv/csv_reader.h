@@ -32,11 +32,14 @@
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/csv/csv_column_batch.h"
 #include "riegeli/csv/csv_record.h"
+#include "riegeli/csv/word_scanner.h"
 
 namespace riegeli {
 
@@ -47,6 +50,86 @@ bool ReadStandaloneRecord(CsvReaderBase& csv_reader,
                           std::vector<std::string>& record);
 }  // namespace internal
 
+// A record read by `CsvReaderBase::ReadRecordView()`: a sequence of fields
+// which refer to data owned by the `CsvReader` or by the `CsvRecordView`.
+//
+// Fields are valid until the next non-const operation on the `CsvReader`, on
+// its byte `Reader`, or on the `CsvRecordView`. A `CsvRecordView` is reused for
+// reading consecutive records to avoid allocations.
+class CsvRecordView {
+ public:
+  using iterator = std::vector<absl::string_view>::const_iterator;
+  using const_iterator = iterator;
+
+  // Creates an empty `CsvRecordView`.
+  CsvRecordView() noexcept {}
+
+  // Fields of short unescaped data would not survive moving, hence
+  // `CsvRecordView` is neither copyable nor movable.
+  CsvRecordView(const CsvRecordView&) = delete;
+  CsvRecordView& operator=(const CsvRecordView&) = delete;
+
+  // Makes `*this` equivalent to a newly constructed `CsvRecordView`.
+  void Reset();
+
+  // Returns the fields.
+  absl::Span<const absl::string_view> fields() const { return fields_; }
+
+  // Iterates over fields.
+  iterator begin() const { return fields_.begin(); }
+  iterator cbegin() const { return fields_.begin(); }
+  iterator end() const { return fields_.end(); }
+  iterator cend() const { return fields_.end(); }
+
+  // Returns the number of fields.
+  size_t size() const { return fields_.size(); }
+
+  // Returns `true` if there are no fields.
+  bool empty() const { return fields_.empty(); }
+
+  // Returns the field at `index`.
+  //
+  // Precondition: `index < size()`
+  absl::string_view operator[](size_t index) const;
+
+ private:
+  friend class CsvReaderBase;
+
+  // A field being read. It refers to the source while it consists of a single
+  // contiguous piece of source data, and it is copied to `scratch_` otherwise,
+  // i.e. when quotes or escapes are removed from its middle.
+  //
+  // Provides the subset of `std::string` API used for building a field.
+  class Field {
+   public:
+    bool empty() const { return size() == 0; }
+    size_t size() const { return owned_ ? scratch_.size() : view_.size(); }
+    void clear() {
+      view_ = absl::string_view();
+      owned_ = false;
+    }
+    void append(const char* src, size_t length);
+
+    absl::string_view view() const {
+      return owned_ ? absl::string_view(scratch_) : view_;
+    }
+
+   private:
+    absl::string_view view_;
+    // Meaningful if `owned_`.
+    std::string scratch_;
+    bool owned_ = false;
+  };
+
+  // Sets `fields_` from `builders_`, keeping the first `size` elements of
+  // `builders_`.
+  void SetFields(size_t size);
+
+  // Invariant: `fields_.size() == builders_.size()` after reading.
+  std::vector<Field> builders_;
+  std::vector<absl::string_view> fields_;
+};
+
 // Template parameter independent part of `CsvReader`.
 class CsvReaderBase : public Object {
  public:
@@ -302,6 +385,47 @@ class CsvReaderBase : public Object {
   //  * `false` (when `!healthy()`) - failure (`record` is empty)
   bool ReadRecord(std::vector<std::string>& record);
 
+  // Reads the next record expressed as a vector of fields which refer to the
+  // buffer of the byte `Reader` instead of being copied. Only fields from which
+  // quotes or escapes had to be removed from the middle are copied to storage
+  // owned by `record`.
+  //
+  // The whole record is kept in the buffer of the byte `Reader`, which is
+  // enlarged if needed.
+  //
+  // Fields are valid until the next non-const operation on the `CsvReader`, on
+  // its byte `Reader`, or on `record`.
+  //
+  // By a common convention each record should consist of the same number of
+  // fields, but this is not enforced.
+  //
+  // Return values:
+  //  * `true`                      - success (`record` is set)
+  //  * `false` (when `healthy()`)  - source ends (`record` is empty)
+  //  * `false` (when `!healthy()`) - failure (`record` is empty)
+  bool ReadRecordView(CsvRecordView& record);
+
+  // Reads up to `max_rows` next records into `batch`, converting fields of
+  // columns of `batch` to their types. Existing rows of `batch` are removed.
+  //
+  // Fields are taken from the buffer as by `ReadRecordView()`, so only fields
+  // of string columns are copied.
+  //
+  // If the number of fields read is not the same as expected by the header, or
+  // if a field cannot be converted to the type of its column, `CsvReader`
+  // fails. If some rows have been read before a failure, they are returned
+  // first, and the failure is reported by the next call.
+  //
+  // Precondition:
+  //   `has_header()`, i.e. `Options::read_header()`
+  //   `max_rows > 0`
+  //
+  // Return values:
+  //  * `true`                      - success (`batch` has at least one row)
+  //  * `false` (when `healthy()`)  - source ends (`batch` has no rows)
+  //  * `false` (when `!healthy()`) - failure (`batch` has no rows)
+  bool ReadColumnBatch(size_t max_rows, CsvColumnBatch& batch);
+
   // The index of the most recently read record, starting from 0.
   //
   // The record count does not include any header read with
@@ -371,10 +495,15 @@ class CsvReaderBase : public Object {
   };
 
   ABSL_ATTRIBUTE_COLD bool MaxFieldLengthExceeded();
+  // Returns the first position in [`ptr`, `limit`) with a character whose
+  // class is not `CharClass::kOther`, or `limit` if there is none.
+  const char* SkipOrdinaryChars(const char* ptr, const char* limit) const;
   void SkipLine(Reader& src);
-  bool ReadQuoted(Reader& src, std::string& field);
-  bool ReadFields(Reader& src, std::vector<std::string>& fields,
-                  size_t& field_index);
+  // `Field` is `std::string` or `CsvRecordView::Field`.
+  template <typename Field>
+  bool ReadQuoted(Reader& src, Field& field);
+  template <typename Field>
+  bool ReadFields(Reader& src, std::vector<Field>& fields, size_t& field_index);
   bool ReadRecordInternal(std::vector<std::string>& record);
 
   bool standalone_record_ = false;
@@ -383,6 +512,9 @@ class CsvReaderBase : public Object {
   // Lookup table for interpreting source characters.
   std::array<CharClass, std::numeric_limits<unsigned char>::max() + 1>
       char_classes_{};
+  // Characters whose class is not `CharClass::kOther`, so that runs of other
+  // characters can be skipped a word at a time.
+  internal::WordScanner special_chars_;
   // Meaningful if `char_classes_` contains `CharClass::kQuote`.
   char quote_ = '\0';
   size_t max_num_fields_ = 0;
@@ -511,6 +643,32 @@ absl::Status ReadCsvRecordFromString(
 
 // Implementation details follow.
 
+inline void CsvRecordView::Reset() {
+  builders_.clear();
+  fields_.clear();
+}
+
+inline absl::string_view CsvRecordView::operator[](size_t index) const {
+  RIEGELI_ASSERT_LT(index, fields_.size())
+      << "Failed precondition of CsvRecordView::operator[]: "
+         "index out of range";
+  return fields_[index];
+}
+
+inline void CsvRecordView::Field::append(const char* src, size_t length) {
+  if (owned_) {
+    scratch_.append(src, length);
+  } else if (view_.empty()) {
+    view_ = absl::string_view(src, length);
+  } else if (view_.data() + view_.size() == src) {
+    view_ = absl::string_view(view_.data(), view_.size() + length);
+  } else if (length > 0) {
+    scratch_.assign(view_.data(), view_.size());
+    scratch_.append(src, length);
+    owned_ = true;
+  }
+}
+
 inline CsvReaderBase::CsvReaderBase(InitiallyClosed) noexcept
     : Object(kInitiallyClosed) {}
 
@@ -525,6 +683,7 @@ inline CsvReaderBase::CsvReaderBase(CsvReaderBase&& that) noexcept
       has_header_(that.has_header_),
       header_(std::move(that.header_)),
       char_classes_(that.char_classes_),
+      special_chars_(that.special_chars_),
       quote_(that.quote_),
       max_num_fields_(that.max_num_fields_),
       max_field_length_(that.max_field_length_),
@@ -542,6 +701,7 @@ inline CsvReaderBase& CsvReaderBase::operator=(CsvReaderBase&& that) noexcept {
   has_header_ = that.has_header_;
   header_ = std::move(that.header_);
   char_classes_ = that.char_classes_;
+  special_chars_ = that.special_chars_;
   quote_ = that.quote_;
   max_num_fields_ = that.max_num_fields_;
   max_field_length_ = that.max_field_length_;
@@ -61,6 +61,10 @@ void CsvWriterBase::Initialize(Writer* dest, Options&& options) {
   if (options.quote() != absl::nullopt) {
     quotes_needed_[static_cast<unsigned char>(*options.quote())] = true;
   }
+  quotes_needed_chars_.Reset();
+  for (size_t i = 0; i < quotes_needed_.size(); ++i) {
+    if (quotes_needed_[i]) quotes_needed_chars_.Add(static_cast<char>(i));
+  }
   newline_ = options.newline();
   field_separator_ = options.field_separator();
   quote_ = options.quote();
@@ -72,6 +76,8 @@ void CsvWriterBase::Initialize(Writer* dest, Options&& options) {
       --record_index_;
     }
   }
+  // Set after writing the header, whose fields are always scanned.
+  assume_quote_free_ = options.assume_quote_free();
 }
 
 bool CsvWriterBase::Fail(absl::Status status) {
@@ -130,12 +136,31 @@ inline bool CsvWriterBase::WriteQuoted(Writer& dest, absl::string_view field,
   return true;
 }
 
-bool CsvWriterBase::WriteField(Writer& dest, absl::string_view field) {
-  for (size_t i = 0; i < field.size(); ++i) {
-    if (quotes_needed_[static_cast<unsigned char>(field[i])]) {
-      return WriteQuoted(dest, field, i);
+inline size_t CsvWriterBase::FindQuotesNeeded(absl::string_view field) const {
+  const char* ptr = field.data();
+  const char* const limit = field.data() + field.size();
+  while (PtrDistance(ptr, limit) >= internal::WordScanner::kWordSize &&
+         !quotes_needed_chars_.AnyInWord(ptr)) {
+    ptr += internal::WordScanner::kWordSize;
+  }
+  for (; ptr != limit; ++ptr) {
+    if (quotes_needed_[static_cast<unsigned char>(*ptr)]) {
+      return PtrDistance(field.data(), ptr);
     }
   }
+  return field.size();
+}
+
+bool CsvWriterBase::WriteField(Writer& dest, absl::string_view field) {
+  if (assume_quote_free_) {
+    RIEGELI_ASSERT_EQ(FindQuotesNeeded(field), field.size())
+        << "Failed precondition of CsvWriterBase::WriteRecord(): "
+           "CsvWriterBase::Options::assume_quote_free() is true "
+           "but a field needs quoting";
+  } else {
+    const size_t index = FindQuotesNeeded(field);
+    if (index != field.size()) return WriteQuoted(dest, field, index);
+  }
   if (ABSL_PREDICT_FALSE(!dest.Write(field))) return Fail(dest);
   return true;
 }
@@ -39,6 +39,7 @@
 #include "riegeli/bytes/writer.h"
 #include "riegeli/csv/containers.h"
 #include "riegeli/csv/csv_record.h"
+#include "riegeli/csv/word_scanner.h"
 #include "riegeli/lines/line_writing.h"
 
 namespace riegeli {
@@ -156,12 +157,30 @@ class CsvWriterBase : public Object {
     }
     absl::optional<char> quote() const { return quote_; }
 
+    // If `true`, the caller guarantees that fields contain no characters which
+    // would need quoting: LF, CR, comment character, field separator, or quote
+    // character. Fields are then written without scanning them. This is
+    // verified only in debug mode.
+    //
+    // This does not apply to the header.
+    //
+    // Default: `false`.
+    Options& set_assume_quote_free(bool assume_quote_free) & {
+      assume_quote_free_ = assume_quote_free;
+      return *this;
+    }
+    Options&& set_assume_quote_free(bool assume_quote_free) && {
+      return std::move(set_assume_quote_free(assume_quote_free));
+    }
+    bool assume_quote_free() const { return assume_quote_free_; }
+
    private:
     absl::optional<CsvHeader> header_;
     Newline newline_ = Newline::kLf;
     absl::optional<char> comment_;
     char field_separator_ = ',';
     absl::optional<char> quote_ = '"';
+    bool assume_quote_free_ = false;
   };
 
   // Returns the byte `Writer` being written to. Unchanged by `Close()`.
@@ -223,6 +242,17 @@ class CsvWriterBase : public Object {
   bool WriteRecord(const Record& record);
   bool WriteRecord(std::initializer_list<absl::string_view> record);
 
+  // Writes a sequence of records, each expressed as a sequence of fields.
+  //
+  // The type of `records` must support iteration yielding records accepted by
+  // `WriteRecord()`, e.g. `std::vector<std::vector<std::string>>`.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  template <typename Records>
+  bool WriteRecords(const Records& records);
+
   // The index of the most recently written record, starting from 0.
   //
   // The record count does not include any header written with
@@ -264,6 +294,9 @@ class CsvWriterBase : public Object {
 
   bool WriteQuoted(Writer& dest, absl::string_view field,
                    size_t already_scanned);
+  // Returns the index of the first character of `field` which needs quoting,
+  // or `field.size()` if there is none.
+  size_t FindQuotesNeeded(absl::string_view field) const;
   bool WriteField(Writer& dest, absl::string_view field);
   template <typename Record>
   bool WriteRecordInternal(const Record& record);
@@ -278,6 +311,10 @@ class CsvWriterBase : public Object {
   // of a more complicated lookup code.
   std::array<bool, std::numeric_limits<unsigned char>::max() + 1>
       quotes_needed_{};
+  // Characters for which `quotes_needed_` is `true`, so that fields can be
+  // scanned a word at a time.
+  internal::WordScanner quotes_needed_chars_;
+  bool assume_quote_free_ = false;
   Newline newline_ = Newline::kLf;
   char field_separator_ = '\0';
   absl::optional<char> quote_;
@@ -419,6 +456,8 @@ inline CsvWriterBase::CsvWriterBase(CsvWriterBase&& that) noexcept
       has_header_(that.has_header_),
       header_(std::move(that.header_)),
       quotes_needed_(that.quotes_needed_),
+      quotes_needed_chars_(that.quotes_needed_chars_),
+      assume_quote_free_(that.assume_quote_free_),
       newline_(that.newline_),
       field_separator_(that.field_separator_),
       quote_(that.quote_),
@@ -432,6 +471,8 @@ inline CsvWriterBase& CsvWriterBase::operator=(CsvWriterBase&& that) noexcept {
   has_header_ = that.has_header_;
   header_ = std::move(that.header_);
   quotes_needed_ = that.quotes_needed_;
+  quotes_needed_chars_ = that.quotes_needed_chars_;
+  assume_quote_free_ = that.assume_quote_free_;
   newline_ = that.newline_;
   field_separator_ = that.field_separator_;
   quote_ = that.quote_;
@@ -453,6 +494,7 @@ inline void CsvWriterBase::Reset(InitiallyOpen) {
   has_header_ = false;
   header_.Reset();
   quotes_needed_ = {};
+  assume_quote_free_ = false;
   record_index_ = 0;
 }
 
@@ -513,6 +555,14 @@ inline bool CsvWriterBase::WriteRecord(
   return WriteRecord<std::initializer_list<absl::string_view>>(record);
 }
 
+template <typename Records>
+bool CsvWriterBase::WriteRecords(const Records& records) {
+  for (const auto& record : records) {
+    if (ABSL_PREDICT_FALSE(!WriteRecord(record))) return false;
+  }
+  return healthy();
+}
+
 inline uint64_t CsvWriterBase::last_record_index() const {
   RIEGELI_ASSERT_GT(record_index_, 0u)
       << "Failed precondition of CsvWriterBase::last_record_index(): "
@@ -0,0 +1,200 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/csv/parallel_csv_reading.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/notification.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/csv/csv_reader.h"
+
+namespace riegeli {
+
+namespace {
+
+// Records parsed from a segment.
+struct ParsedSegment {
+  // Position where parsing began.
+  Position begin = 0;
+  // Position where parsing ended: the beginning of the first record which
+  // begins after the segment, or the end of the file.
+  Position end = 0;
+  std::vector<std::vector<std::string>> records;
+  // If not OK, parsing failed at `end`, after `records`.
+  absl::Status status;
+  // Notified when parsing has finished.
+  absl::Notification done;
+};
+
+// Skips to the position after the first line break at or after the current
+// position which is not preceded by `escape`.
+void SkipToLineBreak(Reader& src, absl::optional<char> escape) {
+  while (src.Pull()) {
+    const char ch = *src.cursor();
+    src.move_cursor(1);
+    if (ch == '\n') return;
+    if (ch == '\r') {
+      if (src.Pull() && *src.cursor() == '\n') src.move_cursor(1);
+      return;
+    }
+    if (ch == escape && src.Pull()) src.move_cursor(1);
+  }
+}
+
+// Parses records which begin in [`begin`, `segment_end`).
+//
+// If `speculative`, parsing begins after the first line break at or after
+// `begin - 1`, otherwise at `begin`.
+void ParseSegment(absl::string_view filename,
+                  const ParallelCsvReadingOptions& options, bool speculative,
+                  Position begin, Position segment_end,
+                  ParsedSegment& result) {
+  result.records.clear();
+  result.status = absl::OkStatus();
+  FdReader<> src(filename, O_RDONLY, options.fd_reader_options());
+  if (speculative && begin > 0) {
+    if (src.Seek(begin - 1)) {
+      SkipToLineBreak(src, options.csv_reader_options().escape());
+    }
+  } else {
+    src.Seek(begin);
+  }
+  result.begin = src.pos();
+  if (ABSL_PREDICT_FALSE(!src.healthy())) {
+    result.end = result.begin;
+    result.status = src.status();
+    return;
+  }
+  CsvReader<> csv_reader(&src, options.csv_reader_options());
+  std::vector<std::string> record;
+  while (src.pos() < segment_end) {
+    if (!csv_reader.ReadRecord(record)) {
+      if (ABSL_PREDICT_FALSE(!csv_reader.healthy())) {
+        result.status =
+            Annotate(csv_reader.status(),
+                     absl::StrCat("counting lines from byte ", result.begin));
+      }
+      break;
+    }
+    result.records.push_back(std::move(record));
+  }
+  result.end = src.pos();
+  if (ABSL_PREDICT_FALSE(!csv_reader.Close()) && result.status.ok()) {
+    result.status = csv_reader.status();
+  }
+  if (ABSL_PREDICT_FALSE(!src.Close()) && result.status.ok()) {
+    result.status = src.status();
+  }
+}
+
+}  // namespace
+
+absl::Status ReadCsvInParallel(
+    absl::string_view filename,
+    const std::function<absl::Status(std::vector<std::string>& record)>&
+        consumer,
+    const ParallelCsvReadingOptions& options) {
+  RIEGELI_ASSERT(!options.csv_reader_options().read_header())
+      << "Failed precondition of ReadCsvInParallel(): "
+         "CsvReaderBase::Options::read_header() not supported";
+  RIEGELI_ASSERT(options.csv_reader_options().recovery() == nullptr)
+      << "Failed precondition of ReadCsvInParallel(): "
+         "CsvReaderBase::Options::recovery() not supported";
+  Position size;
+  {
+    FdReader<> src(filename, O_RDONLY, options.fd_reader_options());
+    const absl::optional<Position> src_size = src.Size();
+    if (ABSL_PREDICT_FALSE(src_size == absl::nullopt)) return src.status();
+    size = *src_size;
+    if (ABSL_PREDICT_FALSE(!src.Close())) return src.status();
+  }
+  const Position segment_size = options.segment_size();
+  const size_t num_segments =
+      UnsignedMax(IntCast<size_t>((size + segment_size - 1) / segment_size),
+                  size_t{1});
+  const auto segment_end = [&](size_t segment) {
+    return segment + 1 == num_segments
+               ? size
+               : IntCast<Position>(segment + 1) * segment_size;
+  };
+  // Segments being parsed in the background, indexed modulo `parallelism`.
+  const size_t parallelism =
+      UnsignedMin(IntCast<size_t>(options.parallelism()), num_segments);
+  std::vector<std::unique_ptr<ParsedSegment>> in_flight(parallelism);
+  size_t next_to_schedule = 0;
+  const auto schedule = [&] {
+    std::unique_ptr<ParsedSegment>& parsed =
+        in_flight[next_to_schedule % parallelism];
+    parsed = std::make_unique<ParsedSegment>();
+    const Position begin = IntCast<Position>(next_to_schedule) * segment_size;
+    const Position end = segment_end(next_to_schedule);
+    ThreadPool::global().Schedule(
+        [filename, &options, begin, end, parsed = parsed.get()] {
+          ParseSegment(filename, options, true, begin, end, *parsed);
+          parsed->done.Notify();
+        });
+    ++next_to_schedule;
+  };
+  while (next_to_schedule < parallelism) schedule();
+
+  absl::Status status;
+  // Where the next segment must begin parsing, i.e. where records of the
+  // previous segment ended.
+  Position next_begin = 0;
+  for (size_t segment = 0; segment < num_segments; ++segment) {
+    std::unique_ptr<ParsedSegment> parsed =
+        std::move(in_flight[segment % parallelism]);
+    parsed->done.WaitForNotification();
+    if (next_to_schedule < num_segments) schedule();
+    if (ABSL_PREDICT_FALSE(parsed->begin != next_begin)) {
+      // Speculation failed, e.g. the file is split inside a quoted field, or
+      // a single record spans the whole segment. Parse again from the right
+      // position.
+      ParseSegment(filename, options, false, next_begin, segment_end(segment),
+                   *parsed);
+    }
+    for (std::vector<std::string>& record : parsed->records) {
+      status = consumer(record);
+      if (ABSL_PREDICT_FALSE(!status.ok())) break;
+    }
+    if (status.ok()) status = std::move(parsed->status);
+    if (ABSL_PREDICT_FALSE(!status.ok())) break;
+    next_begin = parsed->end;
+  }
+  // Wait for segments still in flight after a failure, because they refer to
+  // `filename` and `options`.
+  for (std::unique_ptr<ParsedSegment>& parsed : in_flight) {
+    if (parsed != nullptr) parsed->done.WaitForNotification();
+  }
+  return status;
+}
+
+}  // namespace riegeli
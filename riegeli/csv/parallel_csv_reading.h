@@ -0,0 +1,152 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CSV_PARALLEL_CSV_READING_H_
+#define RIEGELI_CSV_PARALLEL_CSV_READING_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/csv/csv_reader.h"
+
+namespace riegeli {
+
+class ParallelCsvReadingOptions {
+ public:
+  ParallelCsvReadingOptions() noexcept {}
+
+  // Options for parsing each segment.
+  //
+  // `CsvReaderBase::Options::read_header()` and
+  // `CsvReaderBase::Options::recovery()` are not supported, i.e. they must be
+  // `false` and `nullptr`. The header, if any, is passed as the first record.
+  //
+  // Default: `CsvReaderBase::Options()`.
+  ParallelCsvReadingOptions& set_csv_reader_options(
+      const CsvReaderBase::Options& csv_reader_options) & {
+    csv_reader_options_ = csv_reader_options;
+    return *this;
+  }
+  ParallelCsvReadingOptions& set_csv_reader_options(
+      CsvReaderBase::Options&& csv_reader_options) & {
+    csv_reader_options_ = std::move(csv_reader_options);
+    return *this;
+  }
+  ParallelCsvReadingOptions&& set_csv_reader_options(
+      const CsvReaderBase::Options& csv_reader_options) && {
+    return std::move(set_csv_reader_options(csv_reader_options));
+  }
+  ParallelCsvReadingOptions&& set_csv_reader_options(
+      CsvReaderBase::Options&& csv_reader_options) && {
+    return std::move(set_csv_reader_options(std::move(csv_reader_options)));
+  }
+  CsvReaderBase::Options& csv_reader_options() { return csv_reader_options_; }
+  const CsvReaderBase::Options& csv_reader_options() const {
+    return csv_reader_options_;
+  }
+
+  // Sets the maximum number of segments parsed in parallel. Parsed records of
+  // this many segments are kept in memory at a time.
+  //
+  // Default: 1.
+  ParallelCsvReadingOptions& set_parallelism(int parallelism) & {
+    RIEGELI_ASSERT_GT(parallelism, 0)
+        << "Failed precondition of "
+           "ParallelCsvReadingOptions::set_parallelism(): "
+           "non-positive parallelism";
+    parallelism_ = parallelism;
+    return *this;
+  }
+  ParallelCsvReadingOptions&& set_parallelism(int parallelism) && {
+    return std::move(set_parallelism(parallelism));
+  }
+  int parallelism() const { return parallelism_; }
+
+  // Sets the size of segments which the file is split into. Each segment is
+  // parsed sequentially, beginning with the first record which begins in it.
+  //
+  // Smaller segments balance the work better and use less memory, larger
+  // segments reduce the overhead of locating the first record of each segment.
+  //
+  // Default: 16MB.
+  ParallelCsvReadingOptions& set_segment_size(Position segment_size) & {
+    RIEGELI_ASSERT_GT(segment_size, 0u)
+        << "Failed precondition of "
+           "ParallelCsvReadingOptions::set_segment_size(): "
+           "zero segment size";
+    segment_size_ = segment_size;
+    return *this;
+  }
+  ParallelCsvReadingOptions&& set_segment_size(Position segment_size) && {
+    return std::move(set_segment_size(segment_size));
+  }
+  Position segment_size() const { return segment_size_; }
+
+  // Options for opening the file, once per segment being parsed.
+  //
+  // Default: `FdReaderBase::Options()`.
+  ParallelCsvReadingOptions& set_fd_reader_options(
+      const FdReaderBase::Options& fd_reader_options) & {
+    fd_reader_options_ = fd_reader_options;
+    return *this;
+  }
+  ParallelCsvReadingOptions&& set_fd_reader_options(
+      const FdReaderBase::Options& fd_reader_options) && {
+    return std::move(set_fd_reader_options(fd_reader_options));
+  }
+  FdReaderBase::Options& fd_reader_options() { return fd_reader_options_; }
+  const FdReaderBase::Options& fd_reader_options() const {
+    return fd_reader_options_;
+  }
+
+ private:
+  CsvReaderBase::Options csv_reader_options_;
+  int parallelism_ = 1;
+  Position segment_size_ = Position{16} << 20;
+  FdReaderBase::Options fd_reader_options_;
+};
+
+// Reads records of a CSV file, splitting the file into segments and parsing
+// them in parallel, and passes records to `consumer` in order, from the calling
+// thread.
+//
+// A segment other than the first one is parsed speculatively from the first
+// line break in it, assuming that the line break is not inside a quoted field.
+// The speculation is validated when the previous segment has been parsed: if
+// records of the previous segment do not end where the segment was assumed to
+// begin, the segment is parsed again from the right position. Hence records
+// are the same as if the whole file was read with `CsvReader`.
+//
+// If `consumer` returns a failed status, reading stops, and that status is
+// returned.
+//
+// Returns status:
+//  * `status.ok()`  - success (all records have been passed to `consumer`)
+//  * `!status.ok()` - failure; records before the failure have been passed
+//                     to `consumer`
+absl::Status ReadCsvInParallel(
+    absl::string_view filename,
+    const std::function<absl::Status(std::vector<std::string>& record)>&
+        consumer,
+    const ParallelCsvReadingOptions& options = ParallelCsvReadingOptions());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_CSV_PARALLEL_CSV_READING_H_
@@ -0,0 +1,98 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_CSV_WORD_SCANNER_H_
+#define RIEGELI_CSV_WORD_SCANNER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <cstring>
+
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+namespace internal {
+
+// Checks whether a word of characters contains any character from a small set,
+// so that runs of other characters can be skipped a word at a time.
+class WordScanner {
+ public:
+  // The maximum number of characters in the set.
+  static constexpr size_t kMaxChars = 6;
+
+  // The number of characters checked by `AnyInWord()`.
+  static constexpr size_t kWordSize = sizeof(uint64_t);
+
+  // Creates a `WordScanner` with an empty set.
+  WordScanner() noexcept {}
+
+  WordScanner(const WordScanner& that) noexcept = default;
+  WordScanner& operator=(const WordScanner& that) noexcept = default;
+
+  // Makes the set empty.
+  void Reset() { num_chars_ = 0; }
+
+  // Adds `ch` to the set.
+  //
+  // Precondition: fewer than `kMaxChars` characters were added since `Reset()`
+  void Add(char ch);
+
+  // Returns `true` if any of `kWordSize` characters at `ptr` is in the set.
+  //
+  // Precondition: some character was added since `Reset()`
+  bool AnyInWord(const char* ptr) const;
+
+ private:
+  // Characters of the set, each repeated in every byte of a word. Unused
+  // elements repeat the first character.
+  std::array<uint64_t, kMaxChars> char_words_{};
+  size_t num_chars_ = 0;
+};
+
+// Implementation details follow.
+
+inline void WordScanner::Add(char ch) {
+  RIEGELI_ASSERT_LT(num_chars_, char_words_.size())
+      << "Failed precondition of WordScanner::Add(): too many characters";
+  const uint64_t char_word =
+      uint64_t{0x0101010101010101} * static_cast<unsigned char>(ch);
+  if (num_chars_ == 0) char_words_.fill(char_word);
+  char_words_[num_chars_++] = char_word;
+}
+
+inline bool WordScanner::AnyInWord(const char* ptr) const {
+  RIEGELI_ASSERT_GT(num_chars_, 0u)
+      << "Failed precondition of WordScanner::AnyInWord(): empty set";
+  constexpr uint64_t kLowBits = 0x0101010101010101;
+  constexpr uint64_t kHighBits = 0x8080808080808080;
+  uint64_t word;
+  std::memcpy(&word, ptr, sizeof(uint64_t));
+  uint64_t found = 0;
+  // Iterating over all elements, including unused ones, lets the compiler
+  // unroll the loop.
+  for (const uint64_t char_word : char_words_) {
+    // A byte of `diff` is zero where `word` has the character. The expression
+    // below is non-zero if and only if some byte of `diff` is zero.
+    const uint64_t diff = word ^ char_word;
+    found |= (diff - kLowBits) & ~diff & kHighBits;
+  }
+  return found != 0;
+}
+
+}  // namespace internal
+}  // namespace riegeli
+
+#endif  // RIEGELI_CSV_WORD_SCANNER_H_
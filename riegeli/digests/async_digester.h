@@ -0,0 +1,199 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_DIGESTS_ASYNC_DIGESTER_H_
+#define RIEGELI_DIGESTS_ASYNC_DIGESTER_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/digesting_common.h"
+
+namespace riegeli {
+
+// A `Digester` for `DigestingReader` and `DigestingWriter` which feeds data to
+// another `Digester` in background, so that an expensive digest, e.g. a
+// cryptographic hash of a whole file, overlaps with reading or writing instead
+// of bounding its throughput.
+//
+// Data are copied and handed over to a thread of `ThreadPool::global()` in
+// blocks of at least `kBlockSize`, which are digested in order. At most
+// `kMaxBlocksInFlight` blocks wait for digesting; `Write()` blocks when this
+// limit is reached. `Digest()` and `Close()` wait until all data are digested.
+//
+// Copying costs about as much as a fast digest like `Crc32cDigester`, so such
+// digests are better computed synchronously.
+template <typename Digester>
+class AsyncDigester {
+ public:
+  static constexpr size_t kBlockSize = size_t{256} << 10;
+  static constexpr size_t kMaxBlocksInFlight = 4;
+
+  // The type of the digest.
+  using DigestType = internal::DigestType<Digester>;
+
+  // Constructs a `Digester` from `digester_args`.
+  template <
+      typename... DigesterArgs,
+      std::enable_if_t<!std::is_same<std::tuple<std::decay_t<DigesterArgs>...>,
+                                     std::tuple<AsyncDigester>>::value,
+                       int> = 0>
+  explicit AsyncDigester(DigesterArgs&&... digester_args)
+      : state_(std::make_unique<State>(
+            std::forward<DigesterArgs>(digester_args)...)) {}
+
+  AsyncDigester(AsyncDigester&& that) noexcept = default;
+  // Waits until data previously written to `*this` are digested.
+  AsyncDigester& operator=(AsyncDigester&& that) noexcept = default;
+
+  // Waits until data written to `*this` are digested.
+  ~AsyncDigester() = default;
+
+  void Write(absl::string_view src);
+  void WriteZeros(Position length);
+  void Close();
+  DigestType Digest();
+
+ private:
+  struct Block {
+    Chain data;
+    // Zeros digested after `data`.
+    Position zeros = 0;
+  };
+
+  class State {
+   public:
+    template <typename... DigesterArgs>
+    explicit State(DigesterArgs&&... digester_args)
+        : digester_(std::forward<DigesterArgs>(digester_args)...) {}
+
+    State(const State&) = delete;
+    State& operator=(const State&) = delete;
+
+    ~State() { Wait(); }
+
+    // Hands over `pending_` followed by `zeros` to the background thread.
+    void Submit(Position zeros);
+    // Waits until all submitted data are digested. Afterwards `digester_` may
+    // be accessed.
+    void Wait();
+
+    // Not yet submitted data, accessed only by the caller.
+    Chain pending_;
+    // Accessed by the background thread while running, otherwise by the
+    // caller after `Wait()`.
+    Digester digester_;
+
+   private:
+    void Run();
+
+    bool HasRoom() const ABSL_SHARED_LOCKS_REQUIRED(mutex_) {
+      return blocks_.size() < kMaxBlocksInFlight;
+    }
+    bool Idle() const ABSL_SHARED_LOCKS_REQUIRED(mutex_) { return !running_; }
+
+    absl::Mutex mutex_;
+    std::deque<Block> blocks_ ABSL_GUARDED_BY(mutex_);
+    // If `true`, a task of `ThreadPool::global()` is digesting `blocks_`.
+    bool running_ ABSL_GUARDED_BY(mutex_) = false;
+  };
+
+  // `std::unique_ptr` keeps the address of the state stable for the
+  // background thread when `AsyncDigester` is moved.
+  std::unique_ptr<State> state_;
+};
+
+// Implementation details follow.
+
+template <typename Digester>
+constexpr size_t AsyncDigester<Digester>::kBlockSize;
+template <typename Digester>
+constexpr size_t AsyncDigester<Digester>::kMaxBlocksInFlight;
+
+template <typename Digester>
+void AsyncDigester<Digester>::State::Submit(Position zeros) {
+  Block block{std::move(pending_), zeros};
+  pending_.Clear();
+  absl::MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(this, &State::HasRoom));
+  blocks_.push_back(std::move(block));
+  if (!running_) {
+    running_ = true;
+    ThreadPool::global().Schedule([this] { Run(); });
+  }
+}
+
+template <typename Digester>
+void AsyncDigester<Digester>::State::Run() {
+  mutex_.Lock();
+  while (!blocks_.empty()) {
+    Block block = std::move(blocks_.front());
+    blocks_.pop_front();
+    mutex_.Unlock();
+    for (const absl::string_view fragment : block.data.blocks()) {
+      digester_.Write(fragment);
+    }
+    if (block.zeros > 0) internal::DigesterWriteZeros(digester_, block.zeros);
+    mutex_.Lock();
+  }
+  running_ = false;
+  mutex_.Unlock();
+}
+
+template <typename Digester>
+void AsyncDigester<Digester>::State::Wait() {
+  absl::MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(this, &State::Idle));
+}
+
+template <typename Digester>
+void AsyncDigester<Digester>::Write(absl::string_view src) {
+  state_->pending_.Append(src);
+  if (state_->pending_.size() >= kBlockSize) state_->Submit(0);
+}
+
+template <typename Digester>
+void AsyncDigester<Digester>::WriteZeros(Position length) {
+  state_->Submit(length);
+}
+
+template <typename Digester>
+void AsyncDigester<Digester>::Close() {
+  if (!state_->pending_.empty()) state_->Submit(0);
+  state_->Wait();
+  internal::DigesterClose(state_->digester_);
+}
+
+template <typename Digester>
+typename AsyncDigester<Digester>::DigestType
+AsyncDigester<Digester>::Digest() {
+  if (!state_->pending_.empty()) state_->Submit(0);
+  state_->Wait();
+  return internal::DigesterDigest(state_->digester_);
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_DIGESTS_ASYNC_DIGESTER_H_
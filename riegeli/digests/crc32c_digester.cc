@@ -0,0 +1,69 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/digests/crc32c_digester.h"
+
+#include <stdint.h>
+
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+namespace {
+
+// CRC32C polynomial in the reflected bit order used by CRC32C, where the
+// coefficient of x^0 is the highest bit.
+constexpr uint32_t kPolynomial = 0x82f63b78;
+
+// Returns `a * b` modulo `kPolynomial`.
+uint32_t MultiplyModPolynomial(uint32_t a, uint32_t b) {
+  uint32_t product = 0;
+  for (uint32_t mask = uint32_t{1} << 31; mask != 0; mask >>= 1) {
+    if ((a & mask) != 0) {
+      product ^= b;
+      if ((a & (mask - 1)) == 0) break;
+    }
+    b = (b & 1) != 0 ? (b >> 1) ^ kPolynomial : b >> 1;
+  }
+  return product;
+}
+
+// Returns x^(8 * length) modulo `kPolynomial`, i.e. the factor by which
+// appending `length` zero bytes multiplies the CRC register.
+uint32_t ShiftFactor(Position length) {
+  // x^0.
+  uint32_t factor = uint32_t{1} << 31;
+  // x^8, squared for each bit of `length`.
+  uint32_t power = uint32_t{1} << 23;
+  for (; length != 0; length >>= 1) {
+    if ((length & 1) != 0) factor = MultiplyModPolynomial(power, factor);
+    power = MultiplyModPolynomial(power, power);
+  }
+  return factor;
+}
+
+}  // namespace
+
+uint32_t Crc32cDigester::Combine(uint32_t crc_a, uint32_t crc_b,
+                                 Position length_b) {
+  return MultiplyModPolynomial(ShiftFactor(length_b), crc_a) ^ crc_b;
+}
+
+void Crc32cDigester::WriteZeros(Position length) {
+  // The CRC register is the complement of the CRC. Appending zeros multiplies
+  // the register by a power of x.
+  crc_ = ~MultiplyModPolynomial(ShiftFactor(length), ~crc_);
+}
+
+}  // namespace riegeli
@@ -0,0 +1,70 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_DIGESTS_CRC32C_DIGESTER_H_
+#define RIEGELI_DIGESTS_CRC32C_DIGESTER_H_
+
+#include <stdint.h>
+
+#include "absl/strings/string_view.h"
+#include "crc32c/crc32c.h"
+#include "riegeli/base/base.h"
+
+namespace riegeli {
+
+// A `Digester` for `DigestingReader` and `DigestingWriter` computing CRC32C
+// (Castagnoli), the checksum used by TFRecord and by Snappy framing.
+//
+// The `crc32c` library selects at runtime an implementation using SSE4.2 or
+// ARM CRC32 instructions where available.
+//
+// CRC32Cs of consecutive parts of data can be computed independently, e.g. in
+// parallel, and merged with `Combine()`.
+class Crc32cDigester {
+ public:
+  // Continues a CRC32C of preceding data if `seed` is its digest.
+  explicit Crc32cDigester(uint32_t seed = 0) : crc_(seed) {}
+
+  Crc32cDigester(const Crc32cDigester& that) = default;
+  Crc32cDigester& operator=(const Crc32cDigester& that) = default;
+
+  // Returns the CRC32C of the concatenation of data `a` and `b`, given
+  // `crc_a` of `a`, `crc_b` of `b`, and the length of `b`.
+  //
+  // This takes time logarithmic in `length_b`.
+  static uint32_t Combine(uint32_t crc_a, uint32_t crc_b, Position length_b);
+
+  void Write(absl::string_view src) {
+    crc_ = crc32c::Extend(crc_, reinterpret_cast<const uint8_t*>(src.data()),
+                          src.size());
+  }
+
+  // Takes time logarithmic in `length`.
+  void WriteZeros(Position length);
+
+  // Continues with data whose CRC32C is `crc` and length is `length`, as if
+  // they were written.
+  void WriteCrc(uint32_t crc, Position length) {
+    crc_ = Combine(crc_, crc, length);
+  }
+
+  uint32_t Digest() { return crc_; }
+
+ private:
+  uint32_t crc_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_DIGESTS_CRC32C_DIGESTER_H_
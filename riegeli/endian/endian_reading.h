@@ -19,8 +19,10 @@
 
 #include <cstring>
 
+#include "absl/base/config.h"
 #include "absl/base/optimization.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "riegeli/bytes/reader.h"
 
 namespace riegeli {
@@ -45,6 +47,31 @@ uint16_t ReadBigEndian16(const char* src);
 uint32_t ReadBigEndian32(const char* src);
 uint64_t ReadBigEndian64(const char* src);
 
+// Reads an array of numbers in a fixed width Little/Big Endian encoding.
+//
+// If the encoding matches the host, this is a plain copy. Otherwise bytes of
+// each number are swapped in a simple loop, which compilers vectorize.
+//
+// Returns `false` on failure. Unlike for a single number, some bytes might
+// have been read then, and `dest` has unspecified contents.
+bool ReadLittleEndian16s(Reader& src, absl::Span<uint16_t> dest);
+bool ReadLittleEndian32s(Reader& src, absl::Span<uint32_t> dest);
+bool ReadLittleEndian64s(Reader& src, absl::Span<uint64_t> dest);
+bool ReadBigEndian16s(Reader& src, absl::Span<uint16_t> dest);
+bool ReadBigEndian32s(Reader& src, absl::Span<uint32_t> dest);
+bool ReadBigEndian64s(Reader& src, absl::Span<uint64_t> dest);
+
+// Reads an array of numbers in a fixed width Little/Big Endian encoding from
+// an array.
+//
+// Reads `dest.size() * sizeof(uint{16,32,64}_t)` bytes from `src[]`.
+void ReadLittleEndian16s(const char* src, absl::Span<uint16_t> dest);
+void ReadLittleEndian32s(const char* src, absl::Span<uint32_t> dest);
+void ReadLittleEndian64s(const char* src, absl::Span<uint64_t> dest);
+void ReadBigEndian16s(const char* src, absl::Span<uint16_t> dest);
+void ReadBigEndian32s(const char* src, absl::Span<uint32_t> dest);
+void ReadBigEndian64s(const char* src, absl::Span<uint64_t> dest);
+
 // Implementation details follow.
 
 inline absl::optional<uint16_t> ReadLittleEndian16(Reader& src) {
@@ -176,6 +203,138 @@ inline uint64_t ReadBigEndian64(const char* src) {
   return internal::DecodeBigEndian64(encoded);
 }
 
+inline bool ReadLittleEndian16s(Reader& src, absl::Span<uint16_t> dest) {
+  if (ABSL_PREDICT_FALSE(!src.Read(dest.size() * sizeof(uint16_t),
+                                   reinterpret_cast<char*>(dest.data())))) {
+    return false;
+  }
+#ifndef ABSL_IS_LITTLE_ENDIAN
+  for (uint16_t& value : dest) value = internal::DecodeLittleEndian16(value);
+#endif
+  return true;
+}
+
+inline bool ReadLittleEndian32s(Reader& src, absl::Span<uint32_t> dest) {
+  if (ABSL_PREDICT_FALSE(!src.Read(dest.size() * sizeof(uint32_t),
+                                   reinterpret_cast<char*>(dest.data())))) {
+    return false;
+  }
+#ifndef ABSL_IS_LITTLE_ENDIAN
+  for (uint32_t& value : dest) value = internal::DecodeLittleEndian32(value);
+#endif
+  return true;
+}
+
+inline bool ReadLittleEndian64s(Reader& src, absl::Span<uint64_t> dest) {
+  if (ABSL_PREDICT_FALSE(!src.Read(dest.size() * sizeof(uint64_t),
+                                   reinterpret_cast<char*>(dest.data())))) {
+    return false;
+  }
+#ifndef ABSL_IS_LITTLE_ENDIAN
+  for (uint64_t& value : dest) value = internal::DecodeLittleEndian64(value);
+#endif
+  return true;
+}
+
+inline bool ReadBigEndian16s(Reader& src, absl::Span<uint16_t> dest) {
+  if (ABSL_PREDICT_FALSE(!src.Read(dest.size() * sizeof(uint16_t),
+                                   reinterpret_cast<char*>(dest.data())))) {
+    return false;
+  }
+#ifndef ABSL_IS_BIG_ENDIAN
+  for (uint16_t& value : dest) value = internal::DecodeBigEndian16(value);
+#endif
+  return true;
+}
+
+inline bool ReadBigEndian32s(Reader& src, absl::Span<uint32_t> dest) {
+  if (ABSL_PREDICT_FALSE(!src.Read(dest.size() * sizeof(uint32_t),
+                                   reinterpret_cast<char*>(dest.data())))) {
+    return false;
+  }
+#ifndef ABSL_IS_BIG_ENDIAN
+  for (uint32_t& value : dest) value = internal::DecodeBigEndian32(value);
+#endif
+  return true;
+}
+
+inline bool ReadBigEndian64s(Reader& src, absl::Span<uint64_t> dest) {
+  if (ABSL_PREDICT_FALSE(!src.Read(dest.size() * sizeof(uint64_t),
+                                   reinterpret_cast<char*>(dest.data())))) {
+    return false;
+  }
+#ifndef ABSL_IS_BIG_ENDIAN
+  for (uint64_t& value : dest) value = internal::DecodeBigEndian64(value);
+#endif
+  return true;
+}
+
+inline void ReadLittleEndian16s(const char* src, absl::Span<uint16_t> dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  std::memcpy(dest.data(), src, dest.size() * sizeof(uint16_t));
+#else
+  for (uint16_t& value : dest) {
+    value = ReadLittleEndian16(src);
+    src += sizeof(uint16_t);
+  }
+#endif
+}
+
+inline void ReadLittleEndian32s(const char* src, absl::Span<uint32_t> dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  std::memcpy(dest.data(), src, dest.size() * sizeof(uint32_t));
+#else
+  for (uint32_t& value : dest) {
+    value = ReadLittleEndian32(src);
+    src += sizeof(uint32_t);
+  }
+#endif
+}
+
+inline void ReadLittleEndian64s(const char* src, absl::Span<uint64_t> dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  std::memcpy(dest.data(), src, dest.size() * sizeof(uint64_t));
+#else
+  for (uint64_t& value : dest) {
+    value = ReadLittleEndian64(src);
+    src += sizeof(uint64_t);
+  }
+#endif
+}
+
+inline void ReadBigEndian16s(const char* src, absl::Span<uint16_t> dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  std::memcpy(dest.data(), src, dest.size() * sizeof(uint16_t));
+#else
+  for (uint16_t& value : dest) {
+    value = ReadBigEndian16(src);
+    src += sizeof(uint16_t);
+  }
+#endif
+}
+
+inline void ReadBigEndian32s(const char* src, absl::Span<uint32_t> dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  std::memcpy(dest.data(), src, dest.size() * sizeof(uint32_t));
+#else
+  for (uint32_t& value : dest) {
+    value = ReadBigEndian32(src);
+    src += sizeof(uint32_t);
+  }
+#endif
+}
+
+inline void ReadBigEndian64s(const char* src, absl::Span<uint64_t> dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  std::memcpy(dest.data(), src, dest.size() * sizeof(uint64_t));
+#else
+  for (uint64_t& value : dest) {
+    value = ReadBigEndian64(src);
+    src += sizeof(uint64_t);
+  }
+#endif
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_ENDIAN_ENDIAN_READING_H_
@@ -15,11 +15,16 @@
 #ifndef RIEGELI_ENDIAN_ENDIAN_WRITING_H_
 #define RIEGELI_ENDIAN_ENDIAN_WRITING_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <cstring>
 
+#include "absl/base/config.h"
 #include "absl/base/optimization.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/writer.h"
 
@@ -51,6 +56,30 @@ void WriteBigEndian16(uint16_t data, char* dest);
 void WriteBigEndian32(uint32_t data, char* dest);
 void WriteBigEndian64(uint64_t data, char* dest);
 
+// Writes an array of numbers in a fixed width Little/Big Endian encoding.
+//
+// If the encoding matches the host, this is a plain copy. Otherwise bytes of
+// each number are swapped in a simple loop, which compilers vectorize.
+//
+// Returns `false` on failure.
+bool WriteLittleEndian16s(absl::Span<const uint16_t> data, Writer& dest);
+bool WriteLittleEndian32s(absl::Span<const uint32_t> data, Writer& dest);
+bool WriteLittleEndian64s(absl::Span<const uint64_t> data, Writer& dest);
+bool WriteBigEndian16s(absl::Span<const uint16_t> data, Writer& dest);
+bool WriteBigEndian32s(absl::Span<const uint32_t> data, Writer& dest);
+bool WriteBigEndian64s(absl::Span<const uint64_t> data, Writer& dest);
+
+// Writes an array of numbers in a fixed width Little/Big Endian encoding to an
+// array.
+//
+// Writes `data.size() * sizeof(uint{16,32,64}_t)` bytes to `dest[]`.
+void WriteLittleEndian16s(absl::Span<const uint16_t> data, char* dest);
+void WriteLittleEndian32s(absl::Span<const uint32_t> data, char* dest);
+void WriteLittleEndian64s(absl::Span<const uint64_t> data, char* dest);
+void WriteBigEndian16s(absl::Span<const uint16_t> data, char* dest);
+void WriteBigEndian32s(absl::Span<const uint32_t> data, char* dest);
+void WriteBigEndian64s(absl::Span<const uint64_t> data, char* dest);
+
 // Implementation details follow.
 
 inline bool WriteLittleEndian16(uint16_t data, Writer& dest) {
@@ -237,6 +266,210 @@ inline void WriteBigEndian64(uint64_t data, char* dest) {
   std::memcpy(dest, &encoded, sizeof(uint64_t));
 }
 
+inline bool WriteLittleEndian16s(absl::Span<const uint16_t> data,
+                                 Writer& dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  return dest.Write(
+      absl::string_view(reinterpret_cast<const char*>(data.data()),
+                        data.size() * sizeof(uint16_t)));
+#else
+  while (!data.empty()) {
+    if (ABSL_PREDICT_FALSE(!dest.Push(sizeof(uint16_t),
+                                      data.size() * sizeof(uint16_t)))) {
+      return false;
+    }
+    const size_t length =
+        UnsignedMin(data.size(), dest.available() / sizeof(uint16_t));
+    WriteLittleEndian16s(data.subspan(0, length), dest.cursor());
+    dest.move_cursor(length * sizeof(uint16_t));
+    data.remove_prefix(length);
+  }
+  return true;
+#endif
+}
+
+inline bool WriteLittleEndian32s(absl::Span<const uint32_t> data,
+                                 Writer& dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  return dest.Write(
+      absl::string_view(reinterpret_cast<const char*>(data.data()),
+                        data.size() * sizeof(uint32_t)));
+#else
+  while (!data.empty()) {
+    if (ABSL_PREDICT_FALSE(!dest.Push(sizeof(uint32_t),
+                                      data.size() * sizeof(uint32_t)))) {
+      return false;
+    }
+    const size_t length =
+        UnsignedMin(data.size(), dest.available() / sizeof(uint32_t));
+    WriteLittleEndian32s(data.subspan(0, length), dest.cursor());
+    dest.move_cursor(length * sizeof(uint32_t));
+    data.remove_prefix(length);
+  }
+  return true;
+#endif
+}
+
+inline bool WriteLittleEndian64s(absl::Span<const uint64_t> data,
+                                 Writer& dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  return dest.Write(
+      absl::string_view(reinterpret_cast<const char*>(data.data()),
+                        data.size() * sizeof(uint64_t)));
+#else
+  while (!data.empty()) {
+    if (ABSL_PREDICT_FALSE(!dest.Push(sizeof(uint64_t),
+                                      data.size() * sizeof(uint64_t)))) {
+      return false;
+    }
+    const size_t length =
+        UnsignedMin(data.size(), dest.available() / sizeof(uint64_t));
+    WriteLittleEndian64s(data.subspan(0, length), dest.cursor());
+    dest.move_cursor(length * sizeof(uint64_t));
+    data.remove_prefix(length);
+  }
+  return true;
+#endif
+}
+
+inline bool WriteBigEndian16s(absl::Span<const uint16_t> data,
+                              Writer& dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  return dest.Write(
+      absl::string_view(reinterpret_cast<const char*>(data.data()),
+                        data.size() * sizeof(uint16_t)));
+#else
+  while (!data.empty()) {
+    if (ABSL_PREDICT_FALSE(!dest.Push(sizeof(uint16_t),
+                                      data.size() * sizeof(uint16_t)))) {
+      return false;
+    }
+    const size_t length =
+        UnsignedMin(data.size(), dest.available() / sizeof(uint16_t));
+    WriteBigEndian16s(data.subspan(0, length), dest.cursor());
+    dest.move_cursor(length * sizeof(uint16_t));
+    data.remove_prefix(length);
+  }
+  return true;
+#endif
+}
+
+inline bool WriteBigEndian32s(absl::Span<const uint32_t> data,
+                              Writer& dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  return dest.Write(
+      absl::string_view(reinterpret_cast<const char*>(data.data()),
+                        data.size() * sizeof(uint32_t)));
+#else
+  while (!data.empty()) {
+    if (ABSL_PREDICT_FALSE(!dest.Push(sizeof(uint32_t),
+                                      data.size() * sizeof(uint32_t)))) {
+      return false;
+    }
+    const size_t length =
+        UnsignedMin(data.size(), dest.available() / sizeof(uint32_t));
+    WriteBigEndian32s(data.subspan(0, length), dest.cursor());
+    dest.move_cursor(length * sizeof(uint32_t));
+    data.remove_prefix(length);
+  }
+  return true;
+#endif
+}
+
+inline bool WriteBigEndian64s(absl::Span<const uint64_t> data,
+                              Writer& dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  return dest.Write(
+      absl::string_view(reinterpret_cast<const char*>(data.data()),
+                        data.size() * sizeof(uint64_t)));
+#else
+  while (!data.empty()) {
+    if (ABSL_PREDICT_FALSE(!dest.Push(sizeof(uint64_t),
+                                      data.size() * sizeof(uint64_t)))) {
+      return false;
+    }
+    const size_t length =
+        UnsignedMin(data.size(), dest.available() / sizeof(uint64_t));
+    WriteBigEndian64s(data.subspan(0, length), dest.cursor());
+    dest.move_cursor(length * sizeof(uint64_t));
+    data.remove_prefix(length);
+  }
+  return true;
+#endif
+}
+
+inline void WriteLittleEndian16s(absl::Span<const uint16_t> data,
+                                 char* dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  std::memcpy(dest, data.data(), data.size() * sizeof(uint16_t));
+#else
+  for (const uint16_t value : data) {
+    WriteLittleEndian16(value, dest);
+    dest += sizeof(uint16_t);
+  }
+#endif
+}
+
+inline void WriteLittleEndian32s(absl::Span<const uint32_t> data,
+                                 char* dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  std::memcpy(dest, data.data(), data.size() * sizeof(uint32_t));
+#else
+  for (const uint32_t value : data) {
+    WriteLittleEndian32(value, dest);
+    dest += sizeof(uint32_t);
+  }
+#endif
+}
+
+inline void WriteLittleEndian64s(absl::Span<const uint64_t> data,
+                                 char* dest) {
+#ifdef ABSL_IS_LITTLE_ENDIAN
+  std::memcpy(dest, data.data(), data.size() * sizeof(uint64_t));
+#else
+  for (const uint64_t value : data) {
+    WriteLittleEndian64(value, dest);
+    dest += sizeof(uint64_t);
+  }
+#endif
+}
+
+inline void WriteBigEndian16s(absl::Span<const uint16_t> data,
+                              char* dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  std::memcpy(dest, data.data(), data.size() * sizeof(uint16_t));
+#else
+  for (const uint16_t value : data) {
+    WriteBigEndian16(value, dest);
+    dest += sizeof(uint16_t);
+  }
+#endif
+}
+
+inline void WriteBigEndian32s(absl::Span<const uint32_t> data,
+                              char* dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  std::memcpy(dest, data.data(), data.size() * sizeof(uint32_t));
+#else
+  for (const uint32_t value : data) {
+    WriteBigEndian32(value, dest);
+    dest += sizeof(uint32_t);
+  }
+#endif
+}
+
+inline void WriteBigEndian64s(absl::Span<const uint64_t> data,
+                              char* dest) {
+#ifdef ABSL_IS_BIG_ENDIAN
+  std::memcpy(dest, data.data(), data.size() * sizeof(uint64_t));
+#else
+  for (const uint64_t value : data) {
+    WriteBigEndian64(value, dest);
+    dest += sizeof(uint64_t);
+  }
+#endif
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_ENDIAN_ENDIAN_WRITING_H_
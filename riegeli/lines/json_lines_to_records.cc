@@ -0,0 +1,75 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/lines/json_lines_to_records.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/stubs/stringpiece.h"
+#include "google/protobuf/util/json_util.h"
+#include "google/protobuf/util/type_resolver.h"
+#include "google/protobuf/util/type_resolver_util.h"
+#include "riegeli/lines/parallel_line_reading.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+constexpr absl::string_view kTypeUrlPrefix = "type.googleapis.com";
+
+}  // namespace
+
+absl::Status WriteJsonLinesAsRecords(
+    absl::string_view filename, const google::protobuf::Descriptor& descriptor,
+    RecordWriterBase& dest, const JsonLinesToRecordsOptions& options) {
+  // `DescriptorPool` lookups are thread-safe, hence so is the resolver.
+  const std::unique_ptr<google::protobuf::util::TypeResolver> type_resolver(
+      google::protobuf::util::NewTypeResolverForDescriptorPool(
+          std::string(kTypeUrlPrefix), descriptor.file()->pool()));
+  const std::string type_url =
+      absl::StrCat(kTypeUrlPrefix, "/", descriptor.full_name());
+  google::protobuf::util::JsonParseOptions json_parse_options;
+  json_parse_options.ignore_unknown_fields = options.ignore_unknown_fields();
+  return TransformLinesInParallel(
+      filename,
+      [&](absl::string_view line, std::string& binary) {
+        const auto status = google::protobuf::util::JsonToBinaryString(
+            type_resolver.get(), type_url,
+            google::protobuf::StringPiece(line.data(), line.size()), &binary,
+            json_parse_options);
+        if (ABSL_PREDICT_FALSE(!status.ok())) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("Invalid JSON for ", descriptor.full_name(), ": ",
+                           absl::string_view(status.message().data(),
+                                             status.message().size())));
+        }
+        return absl::OkStatus();
+      },
+      [&dest](absl::string_view record) {
+        if (ABSL_PREDICT_FALSE(!dest.WriteRecord(record))) {
+          return dest.status();
+        }
+        return absl::OkStatus();
+      },
+      options.parallel_line_reading_options());
+}
+
+}  // namespace riegeli
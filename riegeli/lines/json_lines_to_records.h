@@ -0,0 +1,99 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_LINES_JSON_LINES_TO_RECORDS_H_
+#define RIEGELI_LINES_JSON_LINES_TO_RECORDS_H_
+
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "riegeli/lines/parallel_line_reading.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+class JsonLinesToRecordsOptions {
+ public:
+  JsonLinesToRecordsOptions() noexcept {}
+
+  // Options for reading lines in parallel. Lines are converted in the threads
+  // which read them.
+  //
+  // Default: `ParallelLineReadingOptions()`.
+  JsonLinesToRecordsOptions& set_parallel_line_reading_options(
+      const ParallelLineReadingOptions& parallel_line_reading_options) & {
+    parallel_line_reading_options_ = parallel_line_reading_options;
+    return *this;
+  }
+  JsonLinesToRecordsOptions&& set_parallel_line_reading_options(
+      const ParallelLineReadingOptions& parallel_line_reading_options) && {
+    return std::move(
+        set_parallel_line_reading_options(parallel_line_reading_options));
+  }
+  ParallelLineReadingOptions& parallel_line_reading_options() {
+    return parallel_line_reading_options_;
+  }
+  const ParallelLineReadingOptions& parallel_line_reading_options() const {
+    return parallel_line_reading_options_;
+  }
+
+  // If `false`, a JSON field which is not present in the message type fails
+  // the conversion.
+  //
+  // If `true`, such fields are skipped.
+  //
+  // Default: `false`.
+  JsonLinesToRecordsOptions& set_ignore_unknown_fields(
+      bool ignore_unknown_fields) & {
+    ignore_unknown_fields_ = ignore_unknown_fields;
+    return *this;
+  }
+  JsonLinesToRecordsOptions&& set_ignore_unknown_fields(
+      bool ignore_unknown_fields) && {
+    return std::move(set_ignore_unknown_fields(ignore_unknown_fields));
+  }
+  bool ignore_unknown_fields() const { return ignore_unknown_fields_; }
+
+ private:
+  ParallelLineReadingOptions parallel_line_reading_options_;
+  bool ignore_unknown_fields_ = false;
+};
+
+// Reads lines of a text file, where each line is a JSON representation of a
+// proto message of type `descriptor`, in parallel, converts them to binary
+// protos, and writes them as records to `dest` in order.
+//
+// Messages are converted directly from JSON to the binary format, without
+// parsing them into message objects. Type information of `descriptor` is
+// shared by all conversions.
+//
+// `descriptor` can come from the metadata of another Riegeli/records file, by
+// `RecordsMetadataDescriptors`.
+//
+// `dest` is not closed.
+//
+// Returns status:
+//  * `status.ok()`  - success (all lines have been converted and written)
+//  * `!status.ok()` - failure; records before the failure have been written to
+//                     `dest`
+absl::Status WriteJsonLinesAsRecords(
+    absl::string_view filename, const google::protobuf::Descriptor& descriptor,
+    RecordWriterBase& dest,
+    const JsonLinesToRecordsOptions& options = JsonLinesToRecordsOptions());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_LINES_JSON_LINES_TO_RECORDS_H_
@@ -15,6 +15,7 @@
 #include "riegeli/lines/line_reading.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <cstring>
 #include <string>
@@ -25,6 +26,7 @@
 #include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/bytes/reader.h"
@@ -33,6 +35,51 @@ namespace riegeli {
 
 namespace {
 
+// Returns a pointer to the first LF or CR in [`ptr`, `limit`), or `nullptr` if
+// there is none.
+//
+// Checks a word at a time while there is no LF nor CR.
+inline const char* FindLfOrCr(const char* ptr, const char* limit) {
+  constexpr uint64_t kLowBits = 0x0101010101010101;
+  constexpr uint64_t kHighBits = 0x8080808080808080;
+  constexpr uint64_t kLfWord = kLowBits * '\n';
+  constexpr uint64_t kCrWord = kLowBits * '\r';
+  while (PtrDistance(ptr, limit) >= sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, ptr, sizeof(uint64_t));
+    // A byte of `lf_diff` or `cr_diff` is zero where `word` has LF or CR.
+    // `(diff - kLowBits) & ~diff & kHighBits` is non-zero if and only if some
+    // byte of `diff` is zero.
+    const uint64_t lf_diff = word ^ kLfWord;
+    const uint64_t cr_diff = word ^ kCrWord;
+    if ((((lf_diff - kLowBits) & ~lf_diff) |
+         ((cr_diff - kLowBits) & ~cr_diff)) &
+        kHighBits) {
+      break;
+    }
+    ptr += sizeof(uint64_t);
+  }
+  for (; ptr < limit; ++ptr) {
+    if (*ptr == '\n' || *ptr == '\r') return ptr;
+  }
+  return nullptr;
+}
+
+// Returns a pointer to the first line terminator in [`ptr`, `limit`), or
+// `nullptr` if there is none.
+inline const char* FindNewline(const char* ptr, const char* limit,
+                               ReadLineOptions::Newline newline) {
+  switch (newline) {
+    case ReadLineOptions::Newline::kLf:
+      return static_cast<const char*>(
+          std::memchr(ptr, '\n', PtrDistance(ptr, limit)));
+    case ReadLineOptions::Newline::kAny:
+      return FindLfOrCr(ptr, limit);
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown newline: " << static_cast<int>(newline);
+}
+
 // Reads `length_to_read` bytes from `src`, writes their prefix of
 // `length_to_write` bytes to `dest`, appending to existing contents
 // (unless `Dest` is `absl::string_view`).
@@ -115,23 +162,19 @@ inline bool ReadLineInternal(Reader& src, Dest& dest, ReadLineOptions options) {
         }
         goto continue_reading;
       }
-      case ReadLineOptions::Newline::kAny:
-        for (const char* newline = src.cursor(); newline < src.limit();
-             ++newline) {
-          if (ABSL_PREDICT_FALSE(*newline == '\n')) {
-            return FoundNewline(src, dest, options,
-                                PtrDistance(src.cursor(), newline), 1);
-          }
-          if (ABSL_PREDICT_FALSE(*newline == '\r')) {
-            const size_t length = PtrDistance(src.cursor(), newline);
-            return FoundNewline(src, dest, options, length,
-                                ABSL_PREDICT_TRUE(src.Pull(length + 2)) &&
-                                        src.cursor()[length + 1] == '\n'
-                                    ? size_t{2}
-                                    : size_t{1});
-          }
+      case ReadLineOptions::Newline::kAny: {
+        const char* const newline = FindLfOrCr(src.cursor(), src.limit());
+        if (ABSL_PREDICT_TRUE(newline != nullptr)) {
+          const size_t length = PtrDistance(src.cursor(), newline);
+          return FoundNewline(src, dest, options, length,
+                              *newline == '\r' &&
+                                      ABSL_PREDICT_TRUE(src.Pull(length + 2)) &&
+                                      src.cursor()[length + 1] == '\n'
+                                  ? size_t{2}
+                                  : size_t{1});
         }
         goto continue_reading;
+      }
     }
     RIEGELI_ASSERT_UNREACHABLE()
         << "Unknown newline: " << static_cast<int>(options.newline());
@@ -165,23 +208,20 @@ bool ReadLine(Reader& src, absl::string_view& dest, ReadLineOptions options) {
         }
         goto continue_reading;
       }
-      case ReadLineOptions::Newline::kAny:
-        for (const char* newline = src.cursor() + length; newline < src.limit();
-             ++newline) {
-          if (ABSL_PREDICT_FALSE(*newline == '\n')) {
-            return FoundNewline(src, dest, options,
-                                PtrDistance(src.cursor(), newline), 1);
-          }
-          if (ABSL_PREDICT_FALSE(*newline == '\r')) {
-            length = PtrDistance(src.cursor(), newline);
-            return FoundNewline(src, dest, options, length,
-                                ABSL_PREDICT_TRUE(src.Pull(length + 2)) &&
-                                        src.cursor()[length + 1] == '\n'
-                                    ? size_t{2}
-                                    : size_t{1});
-          }
+      case ReadLineOptions::Newline::kAny: {
+        const char* const newline =
+            FindLfOrCr(src.cursor() + length, src.limit());
+        if (ABSL_PREDICT_TRUE(newline != nullptr)) {
+          length = PtrDistance(src.cursor(), newline);
+          return FoundNewline(src, dest, options, length,
+                              *newline == '\r' &&
+                                      ABSL_PREDICT_TRUE(src.Pull(length + 2)) &&
+                                      src.cursor()[length + 1] == '\n'
+                                  ? size_t{2}
+                                  : size_t{1});
         }
         goto continue_reading;
+      }
     }
     RIEGELI_ASSERT_UNREACHABLE()
         << "Unknown newline: " << static_cast<int>(options.newline());
@@ -196,6 +236,35 @@ bool ReadLine(Reader& src, absl::string_view& dest, ReadLineOptions options) {
   return src.healthy();
 }
 
+size_t ReadLines(Reader& src, absl::Span<absl::string_view> dest,
+                 ReadLineOptions options) {
+  RIEGELI_ASSERT(!dest.empty())
+      << "Failed precondition of ReadLines(): no space for lines";
+  if (ABSL_PREDICT_FALSE(!ReadLine(src, dest[0], options))) return 0;
+  size_t num_lines = 1;
+  // Further lines are taken only from the buffer, so that earlier lines remain
+  // valid.
+  while (num_lines < dest.size()) {
+    const char* const newline =
+        FindNewline(src.cursor(), src.limit(), options.newline());
+    if (newline == nullptr) break;
+    size_t length = PtrDistance(src.cursor(), newline);
+    size_t newline_length = 1;
+    if (*newline == '\r') {
+      // Whether this is CR LF is not known without pulling more data.
+      if (newline + 1 == src.limit()) break;
+      if (newline[1] == '\n') newline_length = 2;
+    }
+    const size_t length_with_newline = length + newline_length;
+    if (options.keep_newline()) length = length_with_newline;
+    // Leave reporting the failure to the next call.
+    if (ABSL_PREDICT_FALSE(length > options.max_length())) break;
+    dest[num_lines++] = absl::string_view(src.cursor(), length);
+    src.move_cursor(length_with_newline);
+  }
+  return num_lines;
+}
+
 bool ReadLine(Reader& src, std::string& dest, ReadLineOptions options) {
   dest.clear();
   options.set_max_length(UnsignedMin(options.max_length(), dest.max_size()));
@@ -23,6 +23,7 @@
 
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/bytes/reader.h"
 
@@ -111,6 +112,24 @@ bool ReadLine(Reader& src, Chain& dest,
 bool ReadLine(Reader& src, absl::Cord& dest,
               ReadLineOptions options = ReadLineOptions());
 
+// Reads up to `dest.size()` lines, as if by repeated `ReadLine()` with
+// `absl::string_view` destinations, and returns the number of lines read.
+//
+// Apart from the first line, only lines already available in the buffer of
+// `src` are read, which avoids per-call overhead when lines are short. All
+// returned lines remain valid until the next non-const operation on `src`.
+//
+// Precondition: `!dest.empty()`
+//
+// Return values:
+//  * positive (number of lines)  - success (this many elements of `dest` are
+//                                  set)
+//  * 0 (when `src.healthy()`)    - source ends (`dest[0]` is empty)
+//  * 0 (when `!src.healthy()`)   - failure (`dest[0]` is set to the partial
+//                                  line read before the failure)
+size_t ReadLines(Reader& src, absl::Span<absl::string_view> dest,
+                 ReadLineOptions options = ReadLineOptions());
+
 // Skips an initial UTF-8 BOM if it is present.
 //
 // Does nothing unless `src.pos() == 0`.
@@ -0,0 +1,195 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/lines/parallel_line_reading.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/notification.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/lines/line_reading.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+// Lines read from a segment.
+struct SegmentLines {
+  // Concatenated lines, transformed if applicable.
+  std::string data;
+  // End positions of lines in `data`.
+  std::vector<size_t> line_ends;
+  // If not OK, reading failed after `line_ends.size()` lines.
+  absl::Status status;
+  // Notified when reading has finished.
+  absl::Notification done;
+};
+
+using Transform =
+    std::function<absl::Status(absl::string_view line, std::string& dest)>;
+
+// Reads lines which begin in [`begin`, `segment_end`) from `src`, and closes
+// `src`. If `transform` is not `nullptr`, lines are transformed by it.
+void ReadSegment(Reader& src, const ReadLineOptions& options,
+                 const Transform* transform, Position begin,
+                 Position segment_end, SegmentLines& result) {
+  if (begin > 0 && src.Seek(begin - 1)) {
+    // Skip the rest of the line which began before the segment. This also
+    // skips LF of CR LF if CR precedes the segment.
+    absl::string_view skipped;
+    ReadLine(src, skipped, ReadLineOptions().set_newline(options.newline()));
+  }
+  absl::string_view line;
+  for (;;) {
+    const Position line_pos = src.pos();
+    if (line_pos >= segment_end || !ReadLine(src, line, options)) break;
+    if (transform == nullptr) {
+      result.data.append(line.data(), line.size());
+    } else {
+      absl::Status status = (*transform)(line, result.data);
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        result.status = Annotate(
+            status, absl::StrCat("at line beginning at byte ", line_pos));
+        src.Close();
+        return;
+      }
+    }
+    result.line_ends.push_back(result.data.size());
+  }
+  if (ABSL_PREDICT_FALSE(!src.Close())) result.status = src.status();
+}
+
+void ReadSegment(absl::string_view filename,
+                 const ParallelLineReadingOptions& options,
+                 const Transform* transform, Position begin,
+                 Position segment_end, SegmentLines& result) {
+  if (options.use_mmap()) {
+    FdMMapReader<> src(filename, O_RDONLY);
+    ReadSegment(src, options.read_line_options(), transform, begin,
+                segment_end, result);
+  } else {
+    FdReader<> src(filename, O_RDONLY, options.fd_reader_options());
+    ReadSegment(src, options.read_line_options(), transform, begin,
+                segment_end, result);
+  }
+}
+
+absl::Status ReadLinesInParallelImpl(
+    absl::string_view filename, const Transform* transform,
+    const std::function<absl::Status(absl::string_view line)>& consumer,
+    const ParallelLineReadingOptions& options) {
+  Position size;
+  {
+    FdReader<> src(filename, O_RDONLY, options.fd_reader_options());
+    const absl::optional<Position> src_size = src.Size();
+    if (ABSL_PREDICT_FALSE(src_size == absl::nullopt)) return src.status();
+    size = *src_size;
+    if (ABSL_PREDICT_FALSE(!src.Close())) return src.status();
+  }
+  const Position segment_size = options.segment_size();
+  const size_t num_segments =
+      UnsignedMax(IntCast<size_t>((size + segment_size - 1) / segment_size),
+                  size_t{1});
+  // Segments being read in the background, indexed modulo `parallelism`.
+  const size_t parallelism =
+      UnsignedMin(IntCast<size_t>(options.parallelism()), num_segments);
+  std::vector<std::unique_ptr<SegmentLines>> in_flight(parallelism);
+  size_t next_to_schedule = 0;
+  const auto schedule = [&] {
+    std::unique_ptr<SegmentLines>& lines =
+        in_flight[next_to_schedule % parallelism];
+    lines = std::make_unique<SegmentLines>();
+    const Position begin = IntCast<Position>(next_to_schedule) * segment_size;
+    const Position end = next_to_schedule + 1 == num_segments
+                             ? size
+                             : begin + segment_size;
+    ThreadPool::global().Schedule(
+        [filename, &options, transform, begin, end, lines = lines.get()] {
+          ReadSegment(filename, options, transform, begin, end, *lines);
+          lines->done.Notify();
+        });
+    ++next_to_schedule;
+  };
+  while (next_to_schedule < parallelism) schedule();
+
+  absl::Status status;
+  for (size_t segment = 0; segment < num_segments; ++segment) {
+    std::unique_ptr<SegmentLines> lines =
+        std::move(in_flight[segment % parallelism]);
+    lines->done.WaitForNotification();
+    if (next_to_schedule < num_segments) schedule();
+    size_t line_begin = 0;
+    for (const size_t line_end : lines->line_ends) {
+      status = consumer(absl::string_view(lines->data.data() + line_begin,
+                                          line_end - line_begin));
+      if (ABSL_PREDICT_FALSE(!status.ok())) break;
+      line_begin = line_end;
+    }
+    if (status.ok()) status = std::move(lines->status);
+    if (ABSL_PREDICT_FALSE(!status.ok())) break;
+  }
+  // Wait for segments still in flight after a failure, because they refer to
+  // `filename`, `options`, and `transform`.
+  for (std::unique_ptr<SegmentLines>& lines : in_flight) {
+    if (lines != nullptr) lines->done.WaitForNotification();
+  }
+  return status;
+}
+
+}  // namespace
+
+absl::Status ReadLinesInParallel(
+    absl::string_view filename,
+    const std::function<absl::Status(absl::string_view line)>& consumer,
+    const ParallelLineReadingOptions& options) {
+  return ReadLinesInParallelImpl(filename, nullptr, consumer, options);
+}
+
+absl::Status TransformLinesInParallel(
+    absl::string_view filename, const Transform& transform,
+    const std::function<absl::Status(absl::string_view transformed)>& consumer,
+    const ParallelLineReadingOptions& options) {
+  return ReadLinesInParallelImpl(filename, &transform, consumer, options);
+}
+
+absl::Status WriteLinesAsRecords(absl::string_view filename,
+                                 RecordWriterBase& dest,
+                                 const ParallelLineReadingOptions& options) {
+  return ReadLinesInParallel(
+      filename,
+      [&dest](absl::string_view line) {
+        if (ABSL_PREDICT_FALSE(!dest.WriteRecord(line))) return dest.status();
+        return absl::OkStatus();
+      },
+      options);
+}
+
+}  // namespace riegeli
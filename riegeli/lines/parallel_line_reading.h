@@ -0,0 +1,183 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_LINES_PARALLEL_LINE_READING_H_
+#define RIEGELI_LINES_PARALLEL_LINE_READING_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/lines/line_reading.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+class ParallelLineReadingOptions {
+ public:
+  ParallelLineReadingOptions() noexcept {}
+
+  // Options for reading each line.
+  //
+  // Default: `ReadLineOptions()`.
+  ParallelLineReadingOptions& set_read_line_options(
+      ReadLineOptions read_line_options) & {
+    read_line_options_ = read_line_options;
+    return *this;
+  }
+  ParallelLineReadingOptions&& set_read_line_options(
+      ReadLineOptions read_line_options) && {
+    return std::move(set_read_line_options(read_line_options));
+  }
+  ReadLineOptions& read_line_options() { return read_line_options_; }
+  const ReadLineOptions& read_line_options() const {
+    return read_line_options_;
+  }
+
+  // Sets the maximum number of segments read in parallel. Lines of this many
+  // segments are kept in memory at a time.
+  //
+  // Default: 1.
+  ParallelLineReadingOptions& set_parallelism(int parallelism) & {
+    RIEGELI_ASSERT_GT(parallelism, 0)
+        << "Failed precondition of "
+           "ParallelLineReadingOptions::set_parallelism(): "
+           "non-positive parallelism";
+    parallelism_ = parallelism;
+    return *this;
+  }
+  ParallelLineReadingOptions&& set_parallelism(int parallelism) && {
+    return std::move(set_parallelism(parallelism));
+  }
+  int parallelism() const { return parallelism_; }
+
+  // Sets the size of segments which the file is split into. Each segment is
+  // read sequentially, beginning with the first line which begins in it.
+  //
+  // Default: 16MB.
+  ParallelLineReadingOptions& set_segment_size(Position segment_size) & {
+    RIEGELI_ASSERT_GT(segment_size, 0u)
+        << "Failed precondition of "
+           "ParallelLineReadingOptions::set_segment_size(): "
+           "zero segment size";
+    segment_size_ = segment_size;
+    return *this;
+  }
+  ParallelLineReadingOptions&& set_segment_size(Position segment_size) && {
+    return std::move(set_segment_size(segment_size));
+  }
+  Position segment_size() const { return segment_size_; }
+
+  // If `false`, the file is read with `FdReader`, once per segment, using
+  // `fd_reader_options()`.
+  //
+  // If `true`, the file is memory-mapped with `FdMMapReader`, once per
+  // segment, and `fd_reader_options()` are ignored. This avoids copying the
+  // file into buffers.
+  //
+  // Default: `false`.
+  ParallelLineReadingOptions& set_use_mmap(bool use_mmap) & {
+    use_mmap_ = use_mmap;
+    return *this;
+  }
+  ParallelLineReadingOptions&& set_use_mmap(bool use_mmap) && {
+    return std::move(set_use_mmap(use_mmap));
+  }
+  bool use_mmap() const { return use_mmap_; }
+
+  // Options for opening the file with `FdReader`, once per segment.
+  //
+  // Default: `FdReaderBase::Options()`.
+  ParallelLineReadingOptions& set_fd_reader_options(
+      const FdReaderBase::Options& fd_reader_options) & {
+    fd_reader_options_ = fd_reader_options;
+    return *this;
+  }
+  ParallelLineReadingOptions&& set_fd_reader_options(
+      const FdReaderBase::Options& fd_reader_options) && {
+    return std::move(set_fd_reader_options(fd_reader_options));
+  }
+  FdReaderBase::Options& fd_reader_options() { return fd_reader_options_; }
+  const FdReaderBase::Options& fd_reader_options() const {
+    return fd_reader_options_;
+  }
+
+ private:
+  ReadLineOptions read_line_options_;
+  int parallelism_ = 1;
+  Position segment_size_ = Position{16} << 20;
+  bool use_mmap_ = false;
+  FdReaderBase::Options fd_reader_options_;
+};
+
+// Reads lines of a text file, splitting the file into segments and reading
+// them in parallel, and passes lines to `consumer` in order, from the calling
+// thread.
+//
+// A segment begins with the first line which begins in it. Unlike for CSV,
+// this can be determined from the segment alone: a line begins after the
+// first line terminator at or after the byte preceding the segment. Hence
+// lines are the same as if the whole file was read with `ReadLine()`.
+//
+// `line` is valid only during the call to `consumer`.
+//
+// If `consumer` returns a failed status, reading stops, and that status is
+// returned.
+//
+// Returns status:
+//  * `status.ok()`  - success (all lines have been passed to `consumer`)
+//  * `!status.ok()` - failure; lines before the failure have been passed to
+//                     `consumer`
+absl::Status ReadLinesInParallel(
+    absl::string_view filename,
+    const std::function<absl::Status(absl::string_view line)>& consumer,
+    const ParallelLineReadingOptions& options = ParallelLineReadingOptions());
+
+// Reads lines of a text file like `ReadLinesInParallel()`, and transforms them
+// in parallel before passing them to `consumer` in order.
+//
+// `transform` is called from background threads, possibly concurrently, and
+// must be thread-safe. It should append the transformed line to `dest`.
+//
+// If `transform` returns a failed status, reading stops, and that status is
+// returned, annotated with the position of the line. Lines before it have been
+// passed to `consumer`.
+absl::Status TransformLinesInParallel(
+    absl::string_view filename,
+    const std::function<absl::Status(absl::string_view line,
+                                     std::string& dest)>& transform,
+    const std::function<absl::Status(absl::string_view transformed)>& consumer,
+    const ParallelLineReadingOptions& options = ParallelLineReadingOptions());
+
+// Reads lines of a text file like `ReadLinesInParallel()`, and writes each
+// line as a record to `dest`.
+//
+// `dest` is not closed. Encoding of chunks is parallelized by `dest` itself
+// if `RecordWriterBase::Options::parallelism() > 0`.
+//
+// Returns status:
+//  * `status.ok()`  - success (all lines have been written to `dest`)
+//  * `!status.ok()` - failure; lines before the failure have been written to
+//                     `dest`
+absl::Status WriteLinesAsRecords(
+    absl::string_view filename, RecordWriterBase& dest,
+    const ParallelLineReadingOptions& options = ParallelLineReadingOptions());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_LINES_PARALLEL_LINE_READING_H_
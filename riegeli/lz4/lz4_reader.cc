@@ -0,0 +1,139 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/lz4/lz4_reader.h"
+
+#include <stddef.h>
+
+#include <memory>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "lz4frame.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/recycling_pool.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/reader.h"
+
+namespace riegeli {
+
+void Lz4ReaderBase::Initialize(Reader* src) {
+  RIEGELI_ASSERT(src != nullptr)
+      << "Failed precondition of Lz4Reader: null Reader pointer";
+  if (ABSL_PREDICT_FALSE(!src->healthy()) && src->available() == 0) {
+    Fail(*src);
+    return;
+  }
+  decompressor_ = RecyclingPool<LZ4F_dctx, LZ4F_dctxDeleter>::global().Get(
+      [] {
+        LZ4F_dctx* decompressor = nullptr;
+        const size_t result =
+            LZ4F_createDecompressionContext(&decompressor, LZ4F_VERSION);
+        if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) decompressor = nullptr;
+        return std::unique_ptr<LZ4F_dctx, LZ4F_dctxDeleter>(decompressor);
+      },
+      [](LZ4F_dctx* decompressor) {
+        LZ4F_resetDecompressionContext(decompressor);
+      });
+  if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) {
+    Fail(absl::InternalError("LZ4F_createDecompressionContext() failed"));
+  }
+}
+
+void Lz4ReaderBase::Done() {
+  if (ABSL_PREDICT_FALSE(truncated_)) {
+    Reader& src = *src_reader();
+    Fail(Annotate(absl::DataLossError("Truncated LZ4-compressed stream"),
+                  absl::StrCat("at byte ", src.pos())));
+  }
+  decompressor_.reset();
+  BufferedReader::Done();
+}
+
+RecyclingPoolStats Lz4ReaderBase::decompressor_pool_stats() {
+  return RecyclingPool<LZ4F_dctx, LZ4F_dctxDeleter>::global().stats();
+}
+
+bool Lz4ReaderBase::Fail(absl::Status status) {
+  RIEGELI_ASSERT(!status.ok())
+      << "Failed precondition of Object::Fail(): status not failed";
+  return FailWithoutAnnotation(
+      Annotate(status, absl::StrCat("at uncompressed byte ", pos())));
+}
+
+bool Lz4ReaderBase::PullSlow(size_t min_length, size_t recommended_length) {
+  RIEGELI_ASSERT_LT(available(), min_length)
+      << "Failed precondition of Reader::PullSlow(): "
+         "enough data available, use Pull() instead";
+  // After all data have been decompressed, skip `BufferedReader::PullSlow()`
+  // to avoid allocating the buffer in case it was not allocated yet.
+  if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) return false;
+  return BufferedReader::PullSlow(min_length, recommended_length);
+}
+
+bool Lz4ReaderBase::ReadInternal(size_t min_length, size_t max_length,
+                                 char* dest) {
+  RIEGELI_ASSERT_GT(min_length, 0u)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "nothing to read";
+  RIEGELI_ASSERT_GE(max_length, min_length)
+      << "Failed precondition of BufferedReader::ReadInternal(): "
+         "max_length < min_length";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedReader::ReadInternal(): " << status();
+  if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) return false;
+  Reader& src = *src_reader();
+  truncated_ = false;
+  size_t length_read = 0;
+  for (;;) {
+    size_t dest_length = max_length - length_read;
+    size_t src_length = src.available();
+    const size_t result =
+        LZ4F_decompress(decompressor_.get(), dest + length_read, &dest_length,
+                        src.cursor(), &src_length, nullptr);
+    src.move_cursor(src_length);
+    length_read += dest_length;
+    if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+      move_limit_pos(length_read);
+      return Fail(Annotate(absl::DataLossError(absl::StrCat(
+                               "LZ4F_decompress() failed: ",
+                               LZ4F_getErrorName(result))),
+                           absl::StrCat("at byte ", src.pos())));
+    }
+    if (result == 0) {
+      // The frame has ended.
+      decompressor_.reset();
+      move_limit_pos(length_read);
+      return length_read >= min_length;
+    }
+    if (length_read >= min_length) {
+      move_limit_pos(length_read);
+      return true;
+    }
+    if (src.available() == 0) {
+      // `result` is a hint of how much compressed data the decompressor
+      // expects next.
+      if (ABSL_PREDICT_FALSE(!src.Pull(1, result))) {
+        move_limit_pos(length_read);
+        if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+        truncated_ = true;
+        return false;
+      }
+    }
+  }
+}
+
+}  // namespace riegeli
@@ -0,0 +1,210 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/lz4/lz4_writer.h"
+
+#include <stddef.h>
+
+#include <limits>
+#include <memory>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "lz4frame.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/recycling_pool.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/buffered_writer.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// Before C++17 if a constexpr static data member is ODR-used, its definition at
+// namespace scope is required. Since C++17 these definitions are deprecated:
+// http://en.cppreference.com/w/cpp/language/static
+#if __cplusplus < 201703
+constexpr int Lz4WriterBase::Options::kMinCompressionLevel;
+constexpr int Lz4WriterBase::Options::kMaxCompressionLevel;
+constexpr int Lz4WriterBase::Options::kMinHcCompressionLevel;
+constexpr int Lz4WriterBase::Options::kDefaultCompressionLevel;
+#endif
+
+namespace {
+
+// Data are passed to `LZ4F_compressUpdate()` in pieces of this size, so that
+// the output buffer reserved for each piece stays bounded.
+constexpr size_t kMaxPieceSize = size_t{64} << 10;
+
+}  // namespace
+
+void Lz4WriterBase::Initialize(Writer* dest, const Options& options) {
+  RIEGELI_ASSERT(dest != nullptr)
+      << "Failed precondition of Lz4Writer: null Writer pointer";
+  if (ABSL_PREDICT_FALSE(!dest->healthy())) {
+    Fail(*dest);
+    return;
+  }
+  compressor_ = RecyclingPool<LZ4F_cctx, LZ4F_cctxDeleter>::global().Get([] {
+    LZ4F_cctx* compressor = nullptr;
+    const size_t result =
+        LZ4F_createCompressionContext(&compressor, LZ4F_VERSION);
+    if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) compressor = nullptr;
+    return std::unique_ptr<LZ4F_cctx, LZ4F_cctxDeleter>(compressor);
+  });
+  // `LZ4F_compressBegin()` resets the context, so a recycled context does not
+  // need a refurbisher.
+  if (ABSL_PREDICT_FALSE(compressor_ == nullptr)) {
+    Fail(absl::InternalError("LZ4F_createCompressionContext() failed"));
+    return;
+  }
+  preferences_ = LZ4F_preferences_t();
+  preferences_.compressionLevel = options.compression_level();
+  preferences_.frameInfo.blockSizeID = LZ4F_max64KB;
+  preferences_.frameInfo.blockMode = LZ4F_blockLinked;
+  preferences_.frameInfo.contentChecksumFlag =
+      options.store_checksum() ? LZ4F_contentChecksumEnabled
+                               : LZ4F_noContentChecksum;
+  if (pledged_size_ != absl::nullopt) {
+    preferences_.frameInfo.contentSize =
+        IntCast<unsigned long long>(*pledged_size_);
+  }
+  if (ABSL_PREDICT_FALSE(!dest->Push(LZ4F_HEADER_SIZE_MAX))) {
+    Fail(*dest);
+    return;
+  }
+  const size_t result = LZ4F_compressBegin(compressor_.get(), dest->cursor(),
+                                           dest->available(), &preferences_);
+  if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+    FailOperation("LZ4F_compressBegin()", result);
+    return;
+  }
+  dest->move_cursor(result);
+}
+
+void Lz4WriterBase::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    Writer& dest = *dest_writer();
+    const absl::string_view data(start(), written_to_buffer());
+    set_buffer();
+    if (data.empty() || WriteInternal(data)) {
+      if (ABSL_PREDICT_FALSE(pledged_size_ != absl::nullopt &&
+                             start_pos() != *pledged_size_)) {
+        Fail(absl::FailedPreconditionError(absl::StrCat(
+            "Actual size does not match pledged size: ", start_pos(), " < ",
+            *pledged_size_)));
+      } else if (ABSL_PREDICT_FALSE(
+                     !dest.Push(LZ4F_compressBound(0, &preferences_)))) {
+        Fail(dest);
+      } else {
+        const size_t result = LZ4F_compressEnd(
+            compressor_.get(), dest.cursor(), dest.available(), nullptr);
+        if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+          FailOperation("LZ4F_compressEnd()", result);
+        } else {
+          dest.move_cursor(result);
+        }
+      }
+    }
+  }
+  compressor_.reset();
+  BufferedWriter::Done();
+}
+
+inline bool Lz4WriterBase::FailOperation(absl::string_view operation,
+                                         size_t result) {
+  RIEGELI_ASSERT(is_open())
+      << "Failed precondition of Lz4WriterBase::FailOperation(): "
+         "Object closed";
+  Writer& dest = *dest_writer();
+  return Fail(Annotate(absl::InternalError(absl::StrCat(
+                           operation, " failed: ", LZ4F_getErrorName(result))),
+                       absl::StrCat("at byte ", dest.pos())));
+}
+
+RecyclingPoolStats Lz4WriterBase::compressor_pool_stats() {
+  return RecyclingPool<LZ4F_cctx, LZ4F_cctxDeleter>::global().stats();
+}
+
+bool Lz4WriterBase::Fail(absl::Status status) {
+  RIEGELI_ASSERT(!status.ok())
+      << "Failed precondition of Object::Fail(): status not failed";
+  return FailWithoutAnnotation(
+      Annotate(status, absl::StrCat("at uncompressed byte ", pos())));
+}
+
+bool Lz4WriterBase::WriteInternal(absl::string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of BufferedWriter::WriteInternal(): " << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of BufferedWriter::WriteInternal(): "
+         "buffer not empty";
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - start_pos())) {
+    return FailOverflow();
+  }
+  if (pledged_size_ != absl::nullopt) {
+    const Position next_pos = start_pos() + src.size();
+    if (ABSL_PREDICT_FALSE(next_pos > *pledged_size_)) {
+      return Fail(absl::FailedPreconditionError(
+          absl::StrCat("Actual size does not match pledged size: ", next_pos,
+                       " > ", *pledged_size_)));
+    }
+  }
+  Writer& dest = *dest_writer();
+  do {
+    const size_t length = UnsignedMin(src.size(), kMaxPieceSize);
+    if (ABSL_PREDICT_FALSE(
+            !dest.Push(LZ4F_compressBound(length, &preferences_)))) {
+      return Fail(dest);
+    }
+    const size_t result =
+        LZ4F_compressUpdate(compressor_.get(), dest.cursor(), dest.available(),
+                            src.data(), length, nullptr);
+    if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+      return FailOperation("LZ4F_compressUpdate()", result);
+    }
+    dest.move_cursor(result);
+    move_start_pos(length);
+    src.remove_prefix(length);
+  } while (!src.empty());
+  return true;
+}
+
+bool Lz4WriterBase::FlushInternal() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const absl::string_view data(start(), written_to_buffer());
+  set_buffer();
+  if (!data.empty()) {
+    if (ABSL_PREDICT_FALSE(!WriteInternal(data))) return false;
+  }
+  Writer& dest = *dest_writer();
+  if (ABSL_PREDICT_FALSE(!dest.Push(LZ4F_compressBound(0, &preferences_)))) {
+    return Fail(dest);
+  }
+  const size_t result =
+      LZ4F_flush(compressor_.get(), dest.cursor(), dest.available(), nullptr);
+  if (ABSL_PREDICT_FALSE(LZ4F_isError(result))) {
+    return FailOperation("LZ4F_flush()", result);
+  }
+  dest.move_cursor(result);
+  return true;
+}
+
+}  // namespace riegeli
@@ -29,7 +29,6 @@
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
-#include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/cord_reader.h"
 #include "riegeli/bytes/reader.h"
 
@@ -114,10 +113,7 @@ absl::Status ParseFromChain(const Chain& src,
       return CheckInitialized(dest, options);
     }
   }
-  ChainReader<> reader(&src);
-  // Do not bother with `reader.healthy()` or `reader.Close()`. A `ChainReader`
-  // can never fail.
-  ReaderInputStream input_stream(&reader);
+  ChainInputStream input_stream(&src);
   if (ABSL_PREDICT_FALSE(!dest.ParsePartialFromZeroCopyStream(&input_stream))) {
     return absl::DataLossError(
         absl::StrCat("Failed to parse message of type ", dest.GetTypeName()));
@@ -184,4 +180,51 @@ int64_t ReaderInputStream::ByteCount() const {
   return IntCast<int64_t>(relative_pos());
 }
 
+bool ChainInputStream::Next(const void** data, int* size) {
+  while (iter_ != src_->blocks().cend() && cursor_ == iter_->size()) {
+    ++iter_;
+    cursor_ = 0;
+  }
+  if (ABSL_PREDICT_FALSE(iter_ == src_->blocks().cend())) return false;
+  const size_t length = UnsignedMin(iter_->size() - cursor_,
+                                    size_t{std::numeric_limits<int>::max()});
+  *data = iter_->data() + cursor_;
+  *size = IntCast<int>(length);
+  cursor_ += length;
+  pos_ += length;
+  return true;
+}
+
+void ChainInputStream::BackUp(int length) {
+  RIEGELI_ASSERT_GE(length, 0)
+      << "Failed precondition of ZeroCopyInputStream::BackUp(): "
+         "negative length";
+  RIEGELI_ASSERT_LE(IntCast<size_t>(length), cursor_)
+      << "Failed precondition of ZeroCopyInputStream::BackUp(): "
+         "length larger than the amount of buffered data";
+  cursor_ -= IntCast<size_t>(length);
+  pos_ -= IntCast<size_t>(length);
+}
+
+bool ChainInputStream::Skip(int length) {
+  RIEGELI_ASSERT_GE(length, 0)
+      << "Failed precondition of ZeroCopyInputStream::Skip(): negative length";
+  size_t remaining = IntCast<size_t>(length);
+  while (iter_ != src_->blocks().cend()) {
+    const size_t available = iter_->size() - cursor_;
+    if (remaining <= available) {
+      cursor_ += remaining;
+      pos_ += remaining;
+      return true;
+    }
+    remaining -= available;
+    pos_ += available;
+    ++iter_;
+    cursor_ = 0;
+  }
+  return remaining == 0;
+}
+
+int64_t ChainInputStream::ByteCount() const { return IntCast<int64_t>(pos_); }
+
 }  // namespace riegeli
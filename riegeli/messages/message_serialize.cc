@@ -49,6 +49,21 @@ absl::Status SerializeToWriterImpl(const google::protobuf::MessageLite& src,
         "Failed to serialize message of type ", src.GetTypeName(),
         " because it exceeds maximum protobuf size of 2GB: ", size));
   }
+  if (!options.deterministic() &&
+      (size <= dest.available() ||
+       (size <= kDefaultBufferSize && dest.Push(size)))) {
+    // The message fits in the buffer of `dest`. Serialize it there directly,
+    // without the overhead of `google::protobuf::io::CodedOutputStream`.
+    uint8_t* const cursor = reinterpret_cast<uint8_t*>(dest.cursor());
+    const uint8_t* const end = src.SerializeWithCachedSizesToArray(cursor);
+    RIEGELI_ASSERT_EQ(PtrDistance(cursor, end), size)
+        << "Byte size calculation and serialization were inconsistent. This "
+           "may indicate a bug in protocol buffers or it may be caused by "
+           "concurrent modification of "
+        << src.GetTypeName();
+    dest.move_cursor(size);
+    return absl::OkStatus();
+  }
   WriterOutputStream output_stream(&dest);
   google::protobuf::io::CodedOutputStream coded_stream(&output_stream);
   coded_stream.SetSerializationDeterministic(options.deterministic());
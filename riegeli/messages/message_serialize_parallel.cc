@@ -0,0 +1,192 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/messages/message_serialize_parallel.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/message.h"
+#include "google/protobuf/wire_format.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/messages/message_serialize.h"
+#include "riegeli/messages/message_wire_format.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+
+namespace {
+
+// A part of the serialized message, serialized independently.
+struct Piece {
+  // If not `nullptr`, the piece consists of elements [`begin`, `end`) of this
+  // repeated submessage field.
+  const google::protobuf::FieldDescriptor* split_field = nullptr;
+  int begin = 0;
+  int end = 0;
+  // If `split_field == nullptr`, the piece consists of these fields, followed
+  // by unknown fields if `unknown_fields` is `true`.
+  std::vector<const google::protobuf::FieldDescriptor*> fields;
+  bool unknown_fields = false;
+  // The serialized piece.
+  Chain dest;
+};
+
+// Returns `true` if elements of `field` can be serialized separately.
+bool IsSplittable(const google::protobuf::FieldDescriptor* field) {
+  return field->is_repeated() && !field->is_map() &&
+         field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE;
+}
+
+absl::Status SerializePiece(const google::protobuf::Message& src,
+                            SerializeOptions options, Piece& piece) {
+  const google::protobuf::Reflection* const reflection = src.GetReflection();
+  ChainWriter<> writer(&piece.dest);
+  if (piece.split_field != nullptr) {
+    const SerializeOptions element_options =
+        SerializeOptions()
+            .set_partial(true)
+            .set_deterministic(options.deterministic())
+            .set_has_cached_size(true);
+    for (int i = piece.begin; i < piece.end; ++i) {
+      const google::protobuf::Message& element =
+          reflection->GetRepeatedMessage(src, piece.split_field, i);
+      WriteLengthWithTag(piece.split_field->number(),
+                         IntCast<size_t>(element.GetCachedSize()), writer);
+      const absl::Status status =
+          SerializeToWriter(element, writer, element_options);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    }
+  } else {
+    WriterOutputStream output_stream(&writer);
+    google::protobuf::io::CodedOutputStream coded_stream(&output_stream);
+    coded_stream.SetSerializationDeterministic(options.deterministic());
+    for (const google::protobuf::FieldDescriptor* field : piece.fields) {
+      google::protobuf::internal::WireFormat::SerializeFieldWithCachedSizes(
+          field, src, &coded_stream);
+    }
+    if (piece.unknown_fields) {
+      google::protobuf::internal::WireFormat::SerializeUnknownFields(
+          reflection->GetUnknownFields(src), &coded_stream);
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!writer.Close())) return writer.status();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status SerializeToChainInParallel(const google::protobuf::Message& src,
+                                        Chain& dest, int parallelism,
+                                        SerializeOptions options,
+                                        size_t piece_size) {
+  RIEGELI_ASSERT(options.partial() || src.IsInitialized())
+      << "Failed to serialize message of type " << src.GetTypeName()
+      << " because it is missing required fields: "
+      << src.InitializationErrorString();
+  // This caches sizes of all submessages, which are then serialized
+  // concurrently without modifying them.
+  const size_t size = options.GetByteSize(src);
+  if (ABSL_PREDICT_FALSE(size > size_t{std::numeric_limits<int>::max()})) {
+    return absl::ResourceExhaustedError(absl::StrCat(
+        "Failed to serialize message of type ", src.GetTypeName(),
+        " because it exceeds maximum protobuf size of 2GB: ", size));
+  }
+  if (parallelism <= 1 || size / 2 < piece_size ||
+      src.GetDescriptor()->options().message_set_wire_format()) {
+    return SerializeToChain(src, dest, options);
+  }
+
+  const google::protobuf::Reflection* const reflection = src.GetReflection();
+  std::vector<const google::protobuf::FieldDescriptor*> fields;
+  reflection->ListFields(src, &fields);
+  std::vector<Piece> pieces;
+  for (const google::protobuf::FieldDescriptor* field : fields) {
+    if (!IsSplittable(field)) {
+      if (pieces.empty() || pieces.back().split_field != nullptr) {
+        pieces.emplace_back();
+      }
+      pieces.back().fields.push_back(field);
+      continue;
+    }
+    const int num_elements = reflection->FieldSize(src, field);
+    size_t current_size = 0;
+    for (int i = 0; i < num_elements; ++i) {
+      if (pieces.empty() || pieces.back().split_field != field ||
+          current_size >= piece_size) {
+        pieces.emplace_back();
+        pieces.back().split_field = field;
+        pieces.back().begin = i;
+        current_size = 0;
+      }
+      const size_t element_size = IntCast<size_t>(
+          reflection->GetRepeatedMessage(src, field, i).GetCachedSize());
+      current_size +=
+          element_size + LengthVarint32(IntCast<uint32_t>(element_size));
+      pieces.back().end = i + 1;
+    }
+  }
+  if (!reflection->GetUnknownFields(src).empty()) {
+    if (pieces.empty() || pieces.back().split_field != nullptr) {
+      pieces.emplace_back();
+    }
+    pieces.back().unknown_fields = true;
+  }
+
+  std::vector<absl::Status> statuses(pieces.size());
+  const size_t num_workers =
+      UnsignedMin(IntCast<size_t>(parallelism), pieces.size());
+  std::atomic<size_t> next_index(0);
+  absl::BlockingCounter workers(IntCast<int>(num_workers));
+  for (size_t worker = 0; worker < num_workers; ++worker) {
+    ThreadPool::global().Schedule([&] {
+      for (size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+           index < pieces.size();
+           index = next_index.fetch_add(1, std::memory_order_relaxed)) {
+        statuses[index] = SerializePiece(src, options, pieces[index]);
+      }
+      workers.DecrementCount();
+    });
+  }
+  workers.Wait();
+  for (absl::Status& status : statuses) {
+    if (ABSL_PREDICT_FALSE(!status.ok())) return std::move(status);
+  }
+
+  dest.Clear();
+  for (Piece& piece : pieces) dest.Append(std::move(piece.dest));
+  RIEGELI_ASSERT_EQ(dest.size(), size)
+      << "Byte size calculation and serialization were inconsistent. This "
+         "may indicate a bug in protocol buffers or it may be caused by "
+         "concurrent modification of "
+      << src.GetTypeName();
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,50 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_MESSAGES_MESSAGE_SERIALIZE_PARALLEL_H_
+#define RIEGELI_MESSAGES_MESSAGE_SERIALIZE_PARALLEL_H_
+
+#include <stddef.h>
+
+#include "absl/status/status.h"
+#include "google/protobuf/message.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/messages/message_serialize.h"
+
+namespace riegeli {
+
+// Writes the message in binary format to the given `Chain`, clearing it first,
+// like `SerializeToChain()`, but serializing parts of the message with up to
+// `parallelism` threads. This is meant for giant messages, e.g. checkpoints.
+//
+// Elements of repeated submessage fields of `src` (not maps or groups) are
+// split into ranges of about `piece_size` bytes, each serialized into its own
+// `Chain` with tags and length prefixes computed from cached sizes. Remaining
+// fields are serialized in between, in the order of field numbers. The pieces
+// are then concatenated without copying their data.
+//
+// If `parallelism <= 1`, or `src` is smaller than two pieces, this is the same
+// as `SerializeToChain()`.
+//
+// Returns status:
+//  * `status.ok()`  - success (`dest` is filled)
+//  * `!status.ok()` - failure (`dest` is unspecified)
+absl::Status SerializeToChainInParallel(
+    const google::protobuf::Message& src, Chain& dest, int parallelism,
+    SerializeOptions options = SerializeOptions(),
+    size_t piece_size = size_t{4} << 20);
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_MESSAGES_MESSAGE_SERIALIZE_PARALLEL_H_
@@ -21,6 +21,7 @@
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/hash.h"
 #include "riegeli/endian/endian_reading.h"
 #include "riegeli/endian/endian_writing.h"
@@ -32,10 +33,13 @@ class BlockHeader {
  public:
   BlockHeader() noexcept {}
 
-  explicit BlockHeader(uint64_t previous_chunk, uint64_t next_chunk) {
+  explicit BlockHeader(uint64_t previous_chunk, uint64_t next_chunk,
+                       HashType hash_type = HashType::kHighwayHash) {
     set_previous_chunk(previous_chunk);
     set_next_chunk(next_chunk);
-    set_header_hash(computed_header_hash());
+    set_header_hash(internal::Hash(
+        hash_type, absl::string_view(bytes() + sizeof(uint64_t),
+                                     size() - sizeof(uint64_t))));
   }
 
   BlockHeader(const BlockHeader& that) noexcept = default;
@@ -45,9 +49,12 @@ class BlockHeader {
   const char* bytes() const { return bytes_; }
   static constexpr size_t size() { return sizeof(bytes_); }
 
+  // Computes the header hash with the hash function which
+  // `stored_header_hash()` appears to have been computed with.
   uint64_t computed_header_hash() const {
-    return internal::Hash(absl::string_view(bytes() + sizeof(uint64_t),
-                                            size() - sizeof(uint64_t)));
+    return internal::HashLike(stored_header_hash(),
+                              absl::string_view(bytes() + sizeof(uint64_t),
+                                                size() - sizeof(uint64_t)));
   }
   uint64_t stored_header_hash() const { return ReadLittleEndian64(bytes_); }
   uint64_t previous_chunk() const {
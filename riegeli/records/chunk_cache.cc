@@ -0,0 +1,169 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/chunk_cache.h"
+
+#include <stddef.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+size_t DecodedChunk::EstimateMemory() const {
+  return sizeof(DecodedChunk) + values.EstimateMemory() - sizeof(Chain) +
+         limits.capacity() * sizeof(size_t);
+}
+
+class ChunkCache::Shard {
+ public:
+  explicit Shard(size_t max_memory) : max_memory_(max_memory) {}
+
+  Shard(const Shard&) = delete;
+  Shard& operator=(const Shard&) = delete;
+
+  std::shared_ptr<const DecodedChunk> Find(absl::string_view file_key,
+                                           Position chunk_begin);
+  void Insert(absl::string_view file_key, Position chunk_begin,
+              std::shared_ptr<const DecodedChunk> chunk);
+  size_t memory_usage() const;
+
+ private:
+  using Key = std::pair<std::string, Position>;
+
+  struct Entry {
+    Key key;
+    std::shared_ptr<const DecodedChunk> chunk;
+    size_t memory;
+  };
+
+  // Like `Key`, but does not own the file key, for lookups without copying it.
+  using KeyView = std::pair<absl::string_view, Position>;
+
+  struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(const Key& key) const {
+      return absl::HashOf(absl::string_view(key.first), key.second);
+    }
+    size_t operator()(const KeyView& key) const {
+      return absl::HashOf(key.first, key.second);
+    }
+  };
+
+  struct KeyEq {
+    using is_transparent = void;
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const {
+      return absl::string_view(a.first) == absl::string_view(b.first) &&
+             a.second == b.second;
+    }
+  };
+
+  const size_t max_memory_;
+  mutable absl::Mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<Key, std::list<Entry>::iterator, KeyHash, KeyEq> index_
+      ABSL_GUARDED_BY(mutex_);
+  size_t memory_usage_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+std::shared_ptr<const DecodedChunk> ChunkCache::Shard::Find(
+    absl::string_view file_key, Position chunk_begin) {
+  absl::MutexLock lock(&mutex_);
+  const auto iter = index_.find(KeyView(file_key, chunk_begin));
+  if (iter == index_.end()) return nullptr;
+  entries_.splice(entries_.begin(), entries_, iter->second);
+  return iter->second->chunk;
+}
+
+void ChunkCache::Shard::Insert(absl::string_view file_key,
+                               Position chunk_begin,
+                               std::shared_ptr<const DecodedChunk> chunk) {
+  const size_t memory = chunk->EstimateMemory() + file_key.size();
+  if (memory > max_memory_) return;
+  // Evicted chunks are destroyed after releasing the lock.
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    // Another user could have decoded the same chunk concurrently.
+    if (index_.contains(KeyView(file_key, chunk_begin))) return;
+    entries_.push_front(
+        Entry{Key(std::string(file_key), chunk_begin), std::move(chunk),
+              memory});
+    index_.emplace(entries_.front().key, entries_.begin());
+    memory_usage_ += memory;
+    while (memory_usage_ > max_memory_) {
+      const auto last = std::prev(entries_.end());
+      memory_usage_ -= last->memory;
+      index_.erase(last->key);
+      evicted.splice(evicted.end(), entries_, last);
+    }
+  }
+}
+
+size_t ChunkCache::Shard::memory_usage() const {
+  absl::MutexLock lock(&mutex_);
+  return memory_usage_;
+}
+
+ChunkCache::ChunkCache(Options options)
+    : max_shard_memory_(options.max_memory() / options.num_shards()) {
+  shards_.reserve(options.num_shards());
+  for (size_t i = 0; i < options.num_shards(); ++i) {
+    shards_.push_back(std::make_unique<Shard>(max_shard_memory_));
+  }
+}
+
+ChunkCache::~ChunkCache() {}
+
+inline ChunkCache::Shard& ChunkCache::ShardFor(absl::string_view file_key,
+                                               Position chunk_begin) const {
+  return *shards_[absl::HashOf(file_key, chunk_begin) % shards_.size()];
+}
+
+std::shared_ptr<const DecodedChunk> ChunkCache::Find(absl::string_view file_key,
+                                                     Position chunk_begin) {
+  if (max_shard_memory_ == 0) return nullptr;
+  return ShardFor(file_key, chunk_begin).Find(file_key, chunk_begin);
+}
+
+void ChunkCache::Insert(absl::string_view file_key, Position chunk_begin,
+                        std::shared_ptr<const DecodedChunk> chunk) {
+  if (max_shard_memory_ == 0) return;
+  ShardFor(file_key, chunk_begin)
+      .Insert(file_key, chunk_begin, std::move(chunk));
+}
+
+size_t ChunkCache::memory_usage() const {
+  size_t memory_usage = 0;
+  for (const std::unique_ptr<Shard>& shard : shards_) {
+    memory_usage += shard->memory_usage();
+  }
+  return memory_usage;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,138 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_CHUNK_CACHE_H_
+#define RIEGELI_RECORDS_CHUNK_CACHE_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+
+namespace riegeli {
+
+// Records of a decoded chunk, immutable and shared by users of a `ChunkCache`.
+struct DecodedChunk {
+  // Estimates the amount of memory used by this `DecodedChunk`.
+  size_t EstimateMemory() const;
+
+  // Concatenated record values.
+  Chain values;
+  // Positions in `values` where consecutive records end.
+  std::vector<size_t> limits;
+  // File position after the chunk, where the next chunk begins.
+  Position chunk_end = 0;
+};
+
+// A memory-bounded LRU cache of decoded chunks, keyed by file identity and
+// chunk position, which can be shared by readers of many files from many
+// threads.
+//
+// Decoded chunks are cached by `RecordReaderBase::Options::set_chunk_cache()`
+// and `SharedRecordFile::Options::set_chunk_cache()`. This helps random lookups
+// which tend to hit the same chunks, because a lookup in a chunk found in the
+// cache does not read, decompress, nor decode the chunk.
+//
+// The file key identifies the contents of a file, e.g. a file name if the file
+// does not change while being cached. All users of the same file key must
+// decode chunks with the same field projection.
+//
+// The cache is split into shards with separate locks and separate parts of the
+// memory limit, to reduce lock contention. A key is assigned to a shard by its
+// hash.
+//
+// `ChunkCache` is thread-safe.
+class ChunkCache {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the approximate limit of memory used by cached chunks. When the
+    // limit is exceeded, the least recently used chunks of the shard are
+    // evicted. Chunks larger than the limit of a shard are not cached.
+    //
+    // Chunks which are evicted while they are being read stay alive until
+    // their readers are done, beyond the limit.
+    //
+    // Default: 256M.
+    Options& set_max_memory(size_t max_memory) & {
+      max_memory_ = max_memory;
+      return *this;
+    }
+    Options&& set_max_memory(size_t max_memory) && {
+      return std::move(set_max_memory(max_memory));
+    }
+    size_t max_memory() const { return max_memory_; }
+
+    // Sets the number of shards. Each shard can use
+    // `max_memory() / num_shards()`.
+    //
+    // Default: 16.
+    Options& set_num_shards(size_t num_shards) & {
+      RIEGELI_ASSERT_GT(num_shards, 0u)
+          << "Failed precondition of ChunkCache::Options::set_num_shards(): "
+             "zero shards";
+      num_shards_ = num_shards;
+      return *this;
+    }
+    Options&& set_num_shards(size_t num_shards) && {
+      return std::move(set_num_shards(num_shards));
+    }
+    size_t num_shards() const { return num_shards_; }
+
+   private:
+    size_t max_memory_ = size_t{256} << 20;
+    size_t num_shards_ = 16;
+  };
+
+  explicit ChunkCache(Options options = Options());
+
+  ChunkCache(const ChunkCache&) = delete;
+  ChunkCache& operator=(const ChunkCache&) = delete;
+
+  ~ChunkCache();
+
+  // Returns the cached chunk of the file identified by `file_key` beginning at
+  // `chunk_begin`, marking it as recently used, or `nullptr` if it is absent.
+  std::shared_ptr<const DecodedChunk> Find(absl::string_view file_key,
+                                           Position chunk_begin);
+
+  // Adds a chunk of the file identified by `file_key` beginning at
+  // `chunk_begin`, unless such a chunk is already present, evicting least
+  // recently used chunks of its shard as needed.
+  void Insert(absl::string_view file_key, Position chunk_begin,
+              std::shared_ptr<const DecodedChunk> chunk);
+
+  // Returns the approximate amount of memory used by cached chunks.
+  size_t memory_usage() const;
+
+ private:
+  class Shard;
+
+  Shard& ShardFor(absl::string_view file_key, Position chunk_begin) const;
+
+  size_t max_shard_memory_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_CHUNK_CACHE_H_
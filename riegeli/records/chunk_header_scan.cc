@@ -0,0 +1,106 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/chunk_header_scan.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/records/block.h"
+
+namespace riegeli {
+
+absl::Status ScanChunkHeaders(Reader& src,
+                              std::vector<ScannedChunkHeader>& chunks,
+                              const ChunkHeaderScanOptions& options) {
+  RIEGELI_ASSERT(src.SupportsRandomAccess())
+      << "Failed precondition of ScanChunkHeaders(): "
+         "source does not support random access";
+  chunks.clear();
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) return src.status();
+  // Bytes of the file beginning at `window_begin`.
+  Chain window;
+  absl::string_view window_data;
+  Position window_begin = 0;
+  Position chunk_begin = 0;
+  while (chunk_begin < *size) {
+    if (ABSL_PREDICT_FALSE(!internal::IsPossibleChunkBoundary(chunk_begin))) {
+      return absl::DataLossError(
+          absl::StrCat("Invalid chunk boundary: ", chunk_begin));
+    }
+    const Position header_end =
+        internal::AddWithOverhead(chunk_begin, ChunkHeader::size());
+    // The last chunk is truncated.
+    if (ABSL_PREDICT_FALSE(header_end > *size)) break;
+    if (chunk_begin < window_begin ||
+        header_end > window_begin + window_data.size()) {
+      const size_t length = IntCast<size_t>(UnsignedMin(
+          UnsignedMax(header_end - chunk_begin,
+                      Position{options.min_read_length()}),
+          *size - chunk_begin));
+      if (ABSL_PREDICT_FALSE(!src.ReadRanges(
+              {ReadRange{chunk_begin, length}}, absl::MakeSpan(&window, 1)))) {
+        if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+        // The file became shorter.
+        break;
+      }
+      window_data = window.Flatten();
+      window_begin = chunk_begin;
+    }
+    // Gather the chunk header, skipping block headers.
+    ChunkHeader header;
+    size_t header_length = 0;
+    Position pos = chunk_begin;
+    while (header_length < ChunkHeader::size()) {
+      pos += internal::RemainingInBlockHeader(pos);
+      const size_t length = IntCast<size_t>(
+          UnsignedMin(ChunkHeader::size() - header_length,
+                      internal::RemainingInBlock(pos)));
+      memcpy(header.bytes() + header_length,
+             window_data.data() + IntCast<size_t>(pos - window_begin),
+             length);
+      header_length += length;
+      pos += length;
+    }
+    if (ABSL_PREDICT_FALSE(header.computed_header_hash() !=
+                           header.stored_header_hash())) {
+      return absl::DataLossError(
+          absl::StrCat("Corrupted chunk header at ", chunk_begin));
+    }
+    const Position chunk_end = internal::ChunkEnd(header, chunk_begin);
+    // The last chunk is truncated.
+    if (ABSL_PREDICT_FALSE(chunk_end > *size)) break;
+    chunks.push_back(ScannedChunkHeader{chunk_begin, chunk_end,
+                                        header.chunk_type(),
+                                        header.num_records(),
+                                        header.decoded_data_size()});
+    chunk_begin = chunk_end;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
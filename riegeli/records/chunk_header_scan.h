@@ -0,0 +1,90 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_CHUNK_HEADER_SCAN_H_
+#define RIEGELI_RECORDS_CHUNK_HEADER_SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/constants.h"
+
+namespace riegeli {
+
+// A chunk found by `ScanChunkHeaders()`.
+struct ScannedChunkHeader {
+  // File position of the beginning of the chunk, inclusive.
+  Position begin = 0;
+  // File position of the end of the chunk, exclusive, including intervening
+  // block headers and padding.
+  Position end = 0;
+  ChunkType chunk_type = ChunkType::kPadding;
+  uint64_t num_records = 0;
+  uint64_t decoded_data_size = 0;
+};
+
+class ChunkHeaderScanOptions {
+ public:
+  ChunkHeaderScanOptions() noexcept {}
+
+  // Sets the minimum length read at once. Headers of following chunks which
+  // are covered by the same read are parsed without reading again, which
+  // matters when chunks are small. Larger chunks are skipped without reading
+  // their data.
+  //
+  // Default: 4K.
+  ChunkHeaderScanOptions& set_min_read_length(size_t min_read_length) & {
+    min_read_length_ = min_read_length;
+    return *this;
+  }
+  ChunkHeaderScanOptions&& set_min_read_length(size_t min_read_length) && {
+    return std::move(set_min_read_length(min_read_length));
+  }
+  size_t min_read_length() const { return min_read_length_; }
+
+ private:
+  size_t min_read_length_ = size_t{4} << 10;
+};
+
+// Lists chunks of a Riegeli/records file by reading only their headers, and
+// jumping over chunk data using `data_size` from the header. This locates
+// chunks and counts records of a file without a chunk index or a file summary
+// much faster than `DefaultChunkReader`, which reads whole chunks or at least
+// whole buffers.
+//
+// Headers are read with `Reader::ReadRanges()`, which does not change the
+// position of `src`, and which for `FdReader` uses `pread()` bypassing its
+// buffer.
+//
+// Only chunk header hashes are verified. Block headers are skipped, and chunk
+// data are not read. A truncated last chunk is omitted.
+//
+// Precondition: `src.SupportsRandomAccess()`
+//
+// Returns status:
+//  * `status.ok()`  - success (`chunks` is set)
+//  * `!status.ok()` - failure (`chunks` has chunks before the failure)
+absl::Status ScanChunkHeaders(
+    Reader& src, std::vector<ScannedChunkHeader>& chunks,
+    const ChunkHeaderScanOptions& options = ChunkHeaderScanOptions());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_CHUNK_HEADER_SCAN_H_
@@ -0,0 +1,341 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/chunk_index.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/hash.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+
+namespace {
+
+// Reads a key prefixed with its size from `src` which ends at `end_pos`.
+bool ReadKey(Reader& src, Position end_pos, std::string& key) {
+  const absl::optional<uint64_t> size = ReadVarint64(src);
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) return false;
+  // Check the size before allocating the key.
+  if (ABSL_PREDICT_FALSE(*size > end_pos - src.pos())) return false;
+  return src.Read(IntCast<size_t>(*size), key);
+}
+
+// A key filter consists of the number of probes (1 byte) followed by the bit
+// array (at least 1 byte).
+constexpr int kMaxKeyFilterProbes = 30;
+
+bool ValidKeyFilter(absl::string_view key_filter) {
+  if (key_filter.empty()) return true;
+  const int num_probes = static_cast<unsigned char>(key_filter[0]);
+  return key_filter.size() >= 2 && num_probes >= 1 &&
+         num_probes <= kMaxKeyFilterProbes;
+}
+
+// Calls `probe(bit)` for successive bits of a key filter with `num_bits` bits
+// corresponding to `key_hash`, as long as it returns `true`. Returns `false` if
+// `probe()` returned `false`.
+template <typename Probe>
+bool ForEachKeyFilterProbe(uint64_t key_hash, int num_probes,
+                           uint64_t num_bits, Probe probe) {
+  // Double hashing: the probes are `key_hash + i * delta`.
+  const uint64_t delta = (key_hash >> 33) | (key_hash << 31);
+  for (int i = 0; i < num_probes; ++i) {
+    if (!probe(key_hash % num_bits)) return false;
+    key_hash += delta;
+  }
+  return true;
+}
+
+}  // namespace
+
+// Chunk data of a chunk index:
+//
+//  * `chunk_begin` (varint64) - position of the chunk index itself
+//  * `num_entries` (varint64)
+//  * `num_entries` times:
+//    * `chunk_begin_delta` (varint64) - distance from the beginning of the
+//                                       previous chunk (or from 0 for the first
+//                                       chunk)
+//    * `num_records` (varint64)       - number of records in the chunk
+//  * if keys are stored (present if there are remaining data), `num_entries`
+//    times:
+//    * `min_key_size` (varint64)
+//    * `min_key` (`min_key_size` bytes)
+//    * `max_key_size` (varint64)
+//    * `max_key` (`max_key_size` bytes)
+//  * if key filters are stored (present if there are remaining data),
+//    `num_entries` times:
+//    * `key_filter_size` (varint64)
+//    * `key_filter` (`key_filter_size` bytes) - empty, or the number of
+//                                                probes (1 byte) followed by
+//                                                the Bloom filter bit array
+
+void ChunkIndex::Clear() {
+  entries_.clear();
+  num_records_ = 0;
+  has_keys_ = false;
+  has_key_filters_ = false;
+}
+
+void ChunkIndex::Add(Position chunk_begin, uint64_t num_records) {
+  if (num_records == 0) return;
+  RIEGELI_ASSERT(entries_.empty() || chunk_begin > entries_.back().chunk_begin)
+      << "Failed precondition of ChunkIndex::Add(): "
+         "chunk positions not increasing";
+  RIEGELI_ASSERT(!has_keys_)
+      << "Failed precondition of ChunkIndex::Add(): "
+         "chunks added with and without keys";
+  entries_.push_back(Entry{chunk_begin, num_records_, {}, {}, {}});
+  num_records_ += num_records;
+}
+
+void ChunkIndex::Add(Position chunk_begin, uint64_t num_records,
+                     std::string min_key, std::string max_key,
+                     std::string key_filter) {
+  if (num_records == 0) return;
+  RIEGELI_ASSERT(entries_.empty() || chunk_begin > entries_.back().chunk_begin)
+      << "Failed precondition of ChunkIndex::Add(): "
+         "chunk positions not increasing";
+  RIEGELI_ASSERT(entries_.empty() || has_keys_)
+      << "Failed precondition of ChunkIndex::Add(): "
+         "chunks added with and without keys";
+  RIEGELI_ASSERT(entries_.empty() || has_key_filters_ == !key_filter.empty())
+      << "Failed precondition of ChunkIndex::Add(): "
+         "chunks added with and without key filters";
+  RIEGELI_ASSERT(ValidKeyFilter(key_filter))
+      << "Failed precondition of ChunkIndex::Add(): invalid key filter";
+  has_keys_ = true;
+  has_key_filters_ = !key_filter.empty();
+  entries_.push_back(Entry{chunk_begin, num_records_, std::move(min_key),
+                           std::move(max_key), std::move(key_filter)});
+  num_records_ += num_records;
+}
+
+uint64_t ChunkIndex::KeyHash(absl::string_view key) {
+  return internal::Hash(key);
+}
+
+std::string ChunkIndex::BuildKeyFilter(absl::Span<const uint64_t> key_hashes,
+                                       int bits_per_key) {
+  RIEGELI_ASSERT_GT(bits_per_key, 0)
+      << "Failed precondition of ChunkIndex::BuildKeyFilter(): "
+         "non-positive bits per key";
+  // `bits_per_key * ln(2)` probes minimize the false positive rate.
+  const int num_probes = SignedMax(
+      1, SignedMin(kMaxKeyFilterProbes, IntCast<int>(bits_per_key * 69 / 100)));
+  // A small minimum size avoids a high false positive rate for few keys.
+  const uint64_t num_bits = UnsignedMax(
+      uint64_t{64}, IntCast<uint64_t>(key_hashes.size()) *
+                        IntCast<uint64_t>(bits_per_key));
+  const size_t num_bytes = IntCast<size_t>((num_bits + 7) / 8);
+  std::string key_filter(1 + num_bytes, '\0');
+  key_filter[0] = static_cast<char>(num_probes);
+  char* const bits = &key_filter[1];
+  for (const uint64_t key_hash : key_hashes) {
+    ForEachKeyFilterProbe(
+        key_hash, num_probes, IntCast<uint64_t>(num_bytes) * 8,
+        [&](uint64_t bit) {
+          bits[bit / 8] |= static_cast<char>(1 << (bit % 8));
+          return true;
+        });
+  }
+  return key_filter;
+}
+
+bool ChunkIndex::MayContainKey(size_t chunk_index, uint64_t key_hash) const {
+  RIEGELI_ASSERT_LT(chunk_index, entries_.size())
+      << "Failed precondition of ChunkIndex::MayContainKey(): "
+         "chunk index out of range";
+  const absl::string_view key_filter = entries_[chunk_index].key_filter;
+  if (key_filter.empty()) return true;
+  const char* const bits = key_filter.data() + 1;
+  return ForEachKeyFilterProbe(
+      key_hash, static_cast<unsigned char>(key_filter[0]),
+      IntCast<uint64_t>(key_filter.size() - 1) * 8, [&](uint64_t bit) {
+        return (static_cast<unsigned char>(bits[bit / 8]) >> (bit % 8)) & 1;
+      });
+}
+
+size_t ChunkIndex::FirstChunkAtOrAfter(Position pos) const {
+  return IntCast<size_t>(
+      std::lower_bound(entries_.begin(), entries_.end(), pos,
+                       [](const Entry& entry, Position pos) {
+                         return entry.chunk_begin < pos;
+                       }) -
+      entries_.begin());
+}
+
+absl::optional<RecordPosition> ChunkIndex::Find(uint64_t record_index) const {
+  if (ABSL_PREDICT_FALSE(record_index >= num_records_)) return absl::nullopt;
+  // Find the last entry with `records_before <= record_index`. It exists
+  // because the first entry has `records_before == 0`.
+  const std::vector<Entry>::const_iterator next = std::upper_bound(
+      entries_.begin(), entries_.end(), record_index,
+      [](uint64_t record_index, const Entry& entry) {
+        return record_index < entry.records_before;
+      });
+  const Entry& entry = *(next - 1);
+  return RecordPosition(entry.chunk_begin, record_index - entry.records_before);
+}
+
+void ChunkIndex::EncodeChunk(Position chunk_begin, Chunk& chunk,
+                             HashType hash_type) const {
+  chunk.data.Clear();
+  ChainWriter<> data_writer(&chunk.data);
+  WriteVarint64(chunk_begin, data_writer);
+  WriteVarint64(IntCast<uint64_t>(entries_.size()), data_writer);
+  Position prev_chunk_begin = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const uint64_t num_records =
+        (i + 1 < entries_.size() ? entries_[i + 1].records_before
+                                 : num_records_) -
+        entries_[i].records_before;
+    WriteVarint64(entries_[i].chunk_begin - prev_chunk_begin, data_writer);
+    WriteVarint64(num_records, data_writer);
+    prev_chunk_begin = entries_[i].chunk_begin;
+  }
+  if (has_keys_) {
+    for (const Entry& entry : entries_) {
+      WriteVarint64(IntCast<uint64_t>(entry.min_key.size()), data_writer);
+      data_writer.Write(entry.min_key);
+      WriteVarint64(IntCast<uint64_t>(entry.max_key.size()), data_writer);
+      data_writer.Write(entry.max_key);
+    }
+    if (has_key_filters_) {
+      for (const Entry& entry : entries_) {
+        WriteVarint64(IntCast<uint64_t>(entry.key_filter.size()), data_writer);
+        data_writer.Write(entry.key_filter);
+      }
+    }
+  }
+  if (!data_writer.Close()) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Writing chunk index failed: " << data_writer.status();
+  }
+  chunk.header =
+      ChunkHeader(chunk.data, ChunkType::kChunkIndex, 0, 0, hash_type);
+}
+
+absl::Status ChunkIndex::DecodeChunk(const Chunk& chunk, Position chunk_begin) {
+  Clear();
+  if (ABSL_PREDICT_FALSE(chunk.header.chunk_type() != ChunkType::kChunkIndex)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Not a chunk index: chunk type ",
+        static_cast<unsigned>(chunk.header.chunk_type())));
+  }
+  ChainReader<> data_reader(&chunk.data);
+  const absl::optional<uint64_t> index_begin = ReadVarint64(data_reader);
+  if (ABSL_PREDICT_FALSE(index_begin == absl::nullopt)) {
+    return absl::DataLossError("Reading chunk index position failed");
+  }
+  if (ABSL_PREDICT_FALSE(*index_begin != chunk_begin)) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Chunk index was written at ", *index_begin, " but read from ",
+        chunk_begin));
+  }
+  const absl::optional<uint64_t> num_entries = ReadVarint64(data_reader);
+  if (ABSL_PREDICT_FALSE(num_entries == absl::nullopt)) {
+    return absl::DataLossError("Reading chunk index size failed");
+  }
+  // Each entry occupies at least 2 bytes, which bounds the allocation even if
+  // `num_entries` is invalid.
+  entries_.reserve(
+      UnsignedMin(*num_entries, IntCast<uint64_t>(chunk.data.size() / 2)));
+  Position prev_chunk_begin = 0;
+  for (uint64_t i = 0; i < *num_entries; ++i) {
+    const absl::optional<uint64_t> chunk_begin_delta =
+        ReadVarint64(data_reader);
+    if (ABSL_PREDICT_FALSE(chunk_begin_delta == absl::nullopt)) {
+      Clear();
+      return absl::DataLossError("Reading chunk index entry failed");
+    }
+    const absl::optional<uint64_t> num_records = ReadVarint64(data_reader);
+    if (ABSL_PREDICT_FALSE(num_records == absl::nullopt)) {
+      Clear();
+      return absl::DataLossError("Reading chunk index entry failed");
+    }
+    const Position entry_chunk_begin = prev_chunk_begin + *chunk_begin_delta;
+    if (ABSL_PREDICT_FALSE(
+            (i > 0 && *chunk_begin_delta == 0) ||
+            entry_chunk_begin < prev_chunk_begin ||
+            entry_chunk_begin >= chunk_begin || *num_records == 0 ||
+            *num_records > kMaxNumRecords)) {
+      Clear();
+      return absl::DataLossError("Invalid chunk index entry");
+    }
+    entries_.push_back(Entry{entry_chunk_begin, num_records_, {}, {}, {}});
+    num_records_ += *num_records;
+    prev_chunk_begin = entry_chunk_begin;
+  }
+  if (data_reader.Pull() && !entries_.empty()) {
+    for (Entry& entry : entries_) {
+      if (ABSL_PREDICT_FALSE(
+              !ReadKey(data_reader, chunk.data.size(), entry.min_key) ||
+              !ReadKey(data_reader, chunk.data.size(), entry.max_key))) {
+        Clear();
+        return absl::DataLossError("Reading chunk index keys failed");
+      }
+    }
+    has_keys_ = true;
+    if (data_reader.Pull()) {
+      for (Entry& entry : entries_) {
+        if (ABSL_PREDICT_FALSE(
+                !ReadKey(data_reader, chunk.data.size(), entry.key_filter) ||
+                !ValidKeyFilter(entry.key_filter))) {
+          Clear();
+          return absl::DataLossError("Reading chunk index key filters failed");
+        }
+      }
+      has_key_filters_ = true;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!data_reader.VerifyEndAndClose())) {
+    Clear();
+    return data_reader.status();
+  }
+  return absl::OkStatus();
+}
+
+void ChunkIndex::RegisterSubobjects(MemoryEstimator& memory_estimator) const {
+  memory_estimator.RegisterDynamicMemory(entries_.capacity() * sizeof(Entry));
+  if (!has_keys_ && !has_key_filters_) return;
+  for (const Entry& entry : entries_) {
+    memory_estimator.RegisterDynamicMemory(entry.min_key.capacity());
+    memory_estimator.RegisterDynamicMemory(entry.max_key.capacity());
+    memory_estimator.RegisterDynamicMemory(entry.key_filter.capacity());
+  }
+}
+
+}  // namespace riegeli
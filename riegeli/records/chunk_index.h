@@ -0,0 +1,219 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_CHUNK_INDEX_H_
+#define RIEGELI_RECORDS_CHUNK_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+
+// Positions of chunks containing records, together with the number of records
+// preceding each chunk. This allows to locate a record given its index in the
+// file without reading chunk headers.
+//
+// Optionally the smallest and largest keys of records in each chunk are stored
+// too, allowing to skip chunks which cannot contain desired records without
+// reading them. Optionally a Bloom filter of keys in each chunk is stored too,
+// allowing to skip chunks which do not contain a given key.
+//
+// `RecordWriter` writes a `ChunkIndex` as a chunk of type
+// `ChunkType::kChunkIndex` when closed, if
+// `RecordWriterBase::Options::chunk_index()` or `chunk_key()`. `RecordReader`
+// uses it in `SeekToRecordIndex()`, `SkipChunksWhere()`,
+// `SkipChunksWithoutKey()`, and `SearchChunkKeys()`.
+class ChunkIndex {
+ public:
+  ChunkIndex() noexcept {}
+
+  ChunkIndex(const ChunkIndex& that) = default;
+  ChunkIndex& operator=(const ChunkIndex& that) = default;
+
+  ChunkIndex(ChunkIndex&& that) noexcept = default;
+  ChunkIndex& operator=(ChunkIndex&& that) noexcept = default;
+
+  // Makes `*this` equivalent to a newly constructed `ChunkIndex`.
+  void Clear();
+
+  // Appends a chunk beginning at `chunk_begin` with `num_records` records.
+  // Chunks with no records are ignored.
+  //
+  // Precondition: `chunk_begin` is greater than positions of chunks added
+  // before.
+  void Add(Position chunk_begin, uint64_t num_records);
+
+  // Like `Add(chunk_begin, num_records)`, but also stores the smallest and
+  // largest keys of records in the chunk.
+  //
+  // If `key_filter` is not empty, it is a filter of keys of records in the
+  // chunk built by `BuildKeyFilter()`.
+  //
+  // Preconditions:
+  //   either all chunks are added with keys, or none of them
+  //   either all chunks are added with key filters, or none of them
+  void Add(Position chunk_begin, uint64_t num_records, std::string min_key,
+           std::string max_key, std::string key_filter = std::string());
+
+  // Returns the hash of `key` used by key filters.
+  static uint64_t KeyHash(absl::string_view key);
+
+  // Builds a Bloom filter of keys with the given `key_hashes`, with about
+  // `bits_per_key` bits per key. 10 bits per key give about 1% false
+  // positives.
+  //
+  // Precondition: `bits_per_key > 0`
+  static std::string BuildKeyFilter(absl::Span<const uint64_t> key_hashes,
+                                    int bits_per_key);
+
+  // Returns the total number of records in chunks added.
+  uint64_t num_records() const { return num_records_; }
+
+  // Returns `true` if chunks are stored together with their keys.
+  bool has_keys() const { return has_keys_; }
+
+  // Returns `true` if chunks are stored together with filters of their keys.
+  bool has_key_filters() const { return has_key_filters_; }
+
+  // Returns the number of chunks stored.
+  size_t num_chunks() const { return entries_.size(); }
+
+  // Returns the position of the chunk with the given index.
+  //
+  // Precondition: `chunk_index < num_chunks()`
+  Position chunk_begin(size_t chunk_index) const;
+
+  // Returns the number of records in the chunk with the given index.
+  //
+  // Precondition: `chunk_index < num_chunks()`
+  uint64_t chunk_num_records(size_t chunk_index) const;
+
+  // Returns the smallest and largest keys of records in the chunk with the
+  // given index.
+  //
+  // Preconditions:
+  //   `chunk_index < num_chunks()`
+  //   `has_keys()`
+  absl::string_view min_key(size_t chunk_index) const;
+  absl::string_view max_key(size_t chunk_index) const;
+
+  // Returns `false` if the chunk with the given index certainly does not
+  // contain a record with a key whose `KeyHash()` is `key_hash`, according to
+  // its key filter. Returns `true` if it might, including when key filters are
+  // not stored.
+  //
+  // Precondition: `chunk_index < num_chunks()`
+  bool MayContainKey(size_t chunk_index, uint64_t key_hash) const;
+
+  // Returns the index of the first chunk which begins at or after `pos`, or
+  // `num_chunks()` if there is none.
+  size_t FirstChunkAtOrAfter(Position pos) const;
+
+  // Returns the position of the record with the given index in the file,
+  // or `absl::nullopt` if `record_index >= num_records()`.
+  absl::optional<RecordPosition> Find(uint64_t record_index) const;
+
+  // Encodes the index as a chunk to be written at `chunk_begin`, with hashes
+  // computed with `hash_type`.
+  void EncodeChunk(Position chunk_begin, Chunk& chunk,
+                   HashType hash_type = HashType::kHighwayHash) const;
+
+  // Decodes the index from a chunk of type `ChunkType::kChunkIndex` read from
+  // `chunk_begin`, replacing `*this`.
+  //
+  // If the chunk was written at a different position, e.g. because the file
+  // was physically concatenated after another file, chunk positions in the
+  // index would be wrong, and `absl::FailedPreconditionError()` is returned.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - failure (`*this` is cleared)
+  absl::Status DecodeChunk(const Chunk& chunk, Position chunk_begin);
+
+  // Registers stored chunks with `MemoryEstimator`, but does not include
+  // `sizeof(*this)`.
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const;
+
+ private:
+  struct Entry {
+    Position chunk_begin;
+    // Number of records in chunks before this chunk.
+    uint64_t records_before;
+    // Empty unless `has_keys_`.
+    std::string min_key;
+    std::string max_key;
+    // Empty unless `has_key_filters_`.
+    std::string key_filter;
+  };
+
+  // Invariant: `chunk_begin` and `records_before` are strictly increasing.
+  std::vector<Entry> entries_;
+  uint64_t num_records_ = 0;
+  bool has_keys_ = false;
+  bool has_key_filters_ = false;
+};
+
+// Implementation details follow.
+
+inline Position ChunkIndex::chunk_begin(size_t chunk_index) const {
+  RIEGELI_ASSERT_LT(chunk_index, entries_.size())
+      << "Failed precondition of ChunkIndex::chunk_begin(): "
+         "chunk index out of range";
+  return entries_[chunk_index].chunk_begin;
+}
+
+inline uint64_t ChunkIndex::chunk_num_records(size_t chunk_index) const {
+  RIEGELI_ASSERT_LT(chunk_index, entries_.size())
+      << "Failed precondition of ChunkIndex::chunk_num_records(): "
+         "chunk index out of range";
+  return (chunk_index + 1 < entries_.size()
+              ? entries_[chunk_index + 1].records_before
+              : num_records_) -
+         entries_[chunk_index].records_before;
+}
+
+inline absl::string_view ChunkIndex::min_key(size_t chunk_index) const {
+  RIEGELI_ASSERT_LT(chunk_index, entries_.size())
+      << "Failed precondition of ChunkIndex::min_key(): "
+         "chunk index out of range";
+  RIEGELI_ASSERT(has_keys_)
+      << "Failed precondition of ChunkIndex::min_key(): no keys";
+  return entries_[chunk_index].min_key;
+}
+
+inline absl::string_view ChunkIndex::max_key(size_t chunk_index) const {
+  RIEGELI_ASSERT_LT(chunk_index, entries_.size())
+      << "Failed precondition of ChunkIndex::max_key(): "
+         "chunk index out of range";
+  RIEGELI_ASSERT(has_keys_)
+      << "Failed precondition of ChunkIndex::max_key(): no keys";
+  return entries_[chunk_index].max_key;
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_CHUNK_INDEX_H_
@@ -24,18 +24,34 @@
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/hash.h"
 #include "riegeli/records/block.h"
+#include "riegeli/records/encoded_chunk_cache.h"
 #include "riegeli/records/skipped_region.h"
+#include "riegeli/records/trace_sink.h"
 
 namespace riegeli {
 
+ChunkReaderStats& ChunkReaderStats::operator+=(const ChunkReaderStats& that) {
+  num_chunks += that.num_chunks;
+  num_cached_chunks += that.num_cached_chunks;
+  num_bytes += that.num_bytes;
+  num_recoveries += that.num_recoveries;
+  num_skipped_bytes += that.num_skipped_bytes;
+  read_time += that.read_time;
+  hash_time += that.hash_time;
+  return *this;
+}
+
 void DefaultChunkReaderBase::Initialize(Reader* src) {
   RIEGELI_ASSERT(src != nullptr)
       << "Failed precondition of DefaultChunkReader: null Reader pointer";
@@ -67,6 +83,12 @@ void DefaultChunkReaderBase::Done() {
   }
 }
 
+void DefaultChunkReaderBase::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  chunk_.data.RegisterSubobjects(memory_estimator);
+  memory_estimator.RegisterDynamicMemory(encoded_chunk_cache_key_.capacity());
+}
+
 inline bool DefaultChunkReaderBase::FailReading(const Reader& src) {
   if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
   if (ABSL_PREDICT_FALSE(src.pos() > pos_)) truncated_ = true;
@@ -86,12 +108,167 @@ bool DefaultChunkReaderBase::CheckFileFormat() {
   return PullChunkHeader(nullptr);
 }
 
+void DefaultChunkReaderBase::set_data_hash_verification_interval(
+    uint64_t interval) {
+  data_hash_verification_interval_ = interval;
+  chunks_until_verification_ = 0;
+}
+
+void DefaultChunkReaderBase::set_encoded_chunk_cache(
+    EncodedChunkCache* cache, absl::string_view file_key) {
+  encoded_chunk_cache_ = cache;
+  encoded_chunk_cache_key_ = std::string(file_key);
+  cached_chunk_.reset();
+}
+
+inline bool DefaultChunkReaderBase::FindCachedChunk() {
+  if (encoded_chunk_cache_ == nullptr || ABSL_PREDICT_FALSE(!healthy())) {
+    return false;
+  }
+  if (cached_chunk_ != nullptr && cached_chunk_begin_ == pos_) return true;
+  // If reading the chunk has started, the source is already positioned there.
+  if (src_reader()->pos() != pos_) return false;
+  cached_chunk_ = encoded_chunk_cache_->Find(encoded_chunk_cache_key_, pos_);
+  cached_chunk_begin_ = pos_;
+  return cached_chunk_ != nullptr;
+}
+
+inline bool DefaultChunkReaderBase::ReadCachedChunk(Chunk& chunk) {
+  Reader& src = *src_reader();
+  const Position chunk_end = cached_chunk_->chunk_end;
+  if (ABSL_PREDICT_FALSE(!src.Seek(chunk_end))) {
+    return FailSeeking(src, chunk_end);
+  }
+  chunk = cached_chunk_->chunk;
+  pos_ = chunk_end;
+  chunk_.Reset();
+  cached_chunk_.reset();
+  if (collect_stats_) {
+    ++stats_.num_chunks;
+    ++stats_.num_cached_chunks;
+  }
+  return true;
+}
+
+inline bool DefaultChunkReaderBase::SampleDataHashVerification() {
+  if (data_hash_verification_interval_ == 0 || chunks_until_verification_ > 0) {
+    if (chunks_until_verification_ > 0) --chunks_until_verification_;
+    ++num_unverified_chunks_;
+    return false;
+  }
+  chunks_until_verification_ = data_hash_verification_interval_ - 1;
+  return true;
+}
+
+absl::Status DefaultChunkReaderBase::VerifyDataHash(const Chunk& chunk,
+                                                    Position chunk_begin,
+                                                    Position chunk_end) {
+  const uint64_t computed_data_hash =
+      internal::HashLike(chunk.header.data_hash(), chunk.data);
+  if (ABSL_PREDICT_FALSE(computed_data_hash != chunk.header.data_hash())) {
+    return absl::DataLossError(absl::StrCat(
+        "Corrupted Riegeli/records file: chunk data hash mismatch (computed 0x",
+        absl::Hex(computed_data_hash, absl::PadSpec::kZeroPad16), ", stored 0x",
+        absl::Hex(chunk.header.data_hash(), absl::PadSpec::kZeroPad16),
+        "), chunk at ", chunk_begin, " with length ", chunk_end - chunk_begin));
+  }
+  return absl::OkStatus();
+}
+
 bool DefaultChunkReaderBase::ReadChunk(Chunk& chunk) {
-  if (ABSL_PREDICT_FALSE(!PullChunkHeader(nullptr))) return false;
+  if (FindCachedChunk()) return ReadCachedChunk(chunk);
+  Position chunk_end;
+  if (ABSL_PREDICT_FALSE(!ReadChunkData(chunk_end))) return false;
+  if (SampleDataHashVerification()) {
+    const bool measure = collect_stats_ || trace_sink_ != nullptr;
+    const absl::Time hash_start = measure ? absl::Now() : absl::InfinitePast();
+    absl::Status status = VerifyDataHash(chunk_, pos_, chunk_end);
+    if (measure) {
+      const absl::Time hash_end = absl::Now();
+      if (collect_stats_) stats_.hash_time += hash_end - hash_start;
+      if (trace_sink_ != nullptr) {
+        trace_sink_->AddEvent(TraceEvent{TraceStage::kVerifyHash, pos_,
+                                         chunk_.data.size(), hash_start,
+                                         hash_end});
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      // `Recoverable::kHaveChunk`, not `Recoverable::kFindChunk`, because while
+      // chunk data are invalid, chunk header has a correct hash, and thus the
+      // next chunk is believed to be present after this chunk.
+      recoverable_ = Recoverable::kHaveChunk;
+      recoverable_pos_ = chunk_end;
+      return Fail(std::move(status));
+    }
+  }
+  if (encoded_chunk_cache_ != nullptr) {
+    encoded_chunk_cache_->Insert(encoded_chunk_cache_key_, pos_, chunk_,
+                                 chunk_end);
+  }
+  if (collect_stats_) {
+    ++stats_.num_chunks;
+    stats_.num_bytes += chunk_end - pos_;
+  }
+  chunk = std::move(chunk_);
+  pos_ = chunk_end;
+  chunk_.Reset();
+  return true;
+}
+
+bool DefaultChunkReaderBase::ReadChunk(Chunk& chunk, bool& verify_data_hash) {
+  if (FindCachedChunk()) {
+    verify_data_hash = false;
+    return ReadCachedChunk(chunk);
+  }
+  Position chunk_end;
+  if (ABSL_PREDICT_FALSE(!ReadChunkData(chunk_end))) return false;
+  verify_data_hash = SampleDataHashVerification();
+  // A chunk which still needs verification is not offered to the cache,
+  // because the cache holds only chunks which will not be verified again.
+  if (encoded_chunk_cache_ != nullptr && !verify_data_hash) {
+    encoded_chunk_cache_->Insert(encoded_chunk_cache_key_, pos_, chunk_,
+                                 chunk_end);
+  }
+  if (collect_stats_) {
+    ++stats_.num_chunks;
+    stats_.num_bytes += chunk_end - pos_;
+  }
+  chunk = std::move(chunk_);
+  pos_ = chunk_end;
+  chunk_.Reset();
+  return true;
+}
+
+inline bool DefaultChunkReaderBase::ReadChunkData(Position& chunk_end) {
+  if (!collect_stats_ && trace_sink_ == nullptr) {
+    return ReadChunkDataImpl(chunk_end);
+  }
+  const absl::Time read_start = absl::Now();
+  const bool read_ok = ReadChunkDataImpl(chunk_end);
+  const absl::Time read_end = absl::Now();
+  if (collect_stats_) stats_.read_time += read_end - read_start;
+  if (trace_sink_ != nullptr && read_ok) {
+    trace_sink_->AddEvent(TraceEvent{TraceStage::kReadChunk, pos_,
+                                     chunk_end - pos_, read_start, read_end});
+  }
+  return read_ok;
+}
+
+inline bool DefaultChunkReaderBase::ReadChunkDataImpl(Position& chunk_end) {
+  if (ABSL_PREDICT_FALSE(!PullChunkHeaderFromSource(nullptr))) return false;
   Reader& src = *src_reader();
-  const Position chunk_end = internal::ChunkEnd(chunk_.header, pos_);
-  src.ReadHint(SaturatingIntCast<size_t>(
-      internal::AddWithOverhead(chunk_end, ChunkHeader::size()) - src.pos()));
+  chunk_end = internal::ChunkEnd(chunk_.header, pos_);
+  // Read the rest of the chunk and the next chunk header together. If they are
+  // already buffered but not necessarily resident in memory, e.g. in a mapped
+  // file, let the source load them at once rather than page by page.
+  const Position length_to_read =
+      internal::AddWithOverhead(chunk_end, ChunkHeader::size()) - src.pos();
+  src.PrefetchHint(length_to_read);
+  // If the rest of the chunk is already buffered, do not wait for the next
+  // chunk header, which a streaming source, e.g. a socket, might not have yet.
+  if (src.available() < chunk_end - src.pos()) {
+    src.ReadHint(SaturatingIntCast<size_t>(length_to_read));
+  }
 
   while (chunk_.data.size() < chunk_.header.data_size()) {
     if (internal::RemainingInBlockHeader(src.pos()) > 0) {
@@ -139,28 +316,43 @@ bool DefaultChunkReaderBase::ReadChunk(Chunk& chunk) {
   }
 
   if (ABSL_PREDICT_FALSE(!src.Seek(chunk_end))) return FailReading(src);
+  return true;
+}
 
-  const uint64_t computed_data_hash = internal::Hash(chunk_.data);
-  if (ABSL_PREDICT_FALSE(computed_data_hash != chunk_.header.data_hash())) {
-    // `Recoverable::kHaveChunk`, not `Recoverable::kFindChunk`, because while
-    // chunk data are invalid, chunk header has a correct hash, and thus the
-    // next chunk is believed to be present after this chunk.
-    recoverable_ = Recoverable::kHaveChunk;
-    recoverable_pos_ = chunk_end;
-    return Fail(absl::DataLossError(absl::StrCat(
-        "Corrupted Riegeli/records file: chunk data hash mismatch (computed 0x",
-        absl::Hex(computed_data_hash, absl::PadSpec::kZeroPad16), ", stored 0x",
-        absl::Hex(chunk_.header.data_hash(), absl::PadSpec::kZeroPad16),
-        "), chunk at ", pos_, " with length ", chunk_end - pos_)));
+bool DefaultChunkReaderBase::PullChunkHeader(const ChunkHeader** chunk_header) {
+  if (FindCachedChunk()) {
+    if (chunk_header != nullptr) *chunk_header = &cached_chunk_->chunk.header;
+    return true;
   }
+  return PullChunkHeaderFromSource(chunk_header);
+}
 
-  chunk = std::move(chunk_);
+bool DefaultChunkReaderBase::SkipChunk() {
+  const ChunkHeader* chunk_header;
+  if (ABSL_PREDICT_FALSE(!PullChunkHeader(&chunk_header))) return false;
+  const Position chunk_end = internal::ChunkEnd(*chunk_header, pos_);
+  Reader& src = *src_reader();
+  if (ABSL_PREDICT_FALSE(!src.Seek(chunk_end))) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+    // The chunk is truncated. Go back to the end of its header, like after a
+    // truncated `ReadChunk()` which did not read chunk data yet, so that the
+    // chunk can be read or skipped again if the source grows.
+    const Position chunk_header_end =
+        internal::AddWithOverhead(pos_, chunk_header->size());
+    if (ABSL_PREDICT_FALSE(!src.Seek(chunk_header_end))) {
+      return FailSeeking(src, chunk_header_end);
+    }
+    truncated_ = true;
+    return false;
+  }
   pos_ = chunk_end;
   chunk_.Reset();
+  cached_chunk_.reset();
   return true;
 }
 
-bool DefaultChunkReaderBase::PullChunkHeader(const ChunkHeader** chunk_header) {
+inline bool DefaultChunkReaderBase::PullChunkHeaderFromSource(
+    const ChunkHeader** chunk_header) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   Reader& src = *src_reader();
   truncated_ = false;
@@ -316,6 +508,16 @@ inline bool DefaultChunkReaderBase::ReadBlockHeader() {
 }
 
 bool DefaultChunkReaderBase::Recover(SkippedRegion* skipped_region) {
+  if (!collect_stats_) return RecoverImpl(skipped_region);
+  SkippedRegion region;
+  if (ABSL_PREDICT_FALSE(!RecoverImpl(&region))) return false;
+  ++stats_.num_recoveries;
+  stats_.num_skipped_bytes += region.length();
+  if (skipped_region != nullptr) *skipped_region = std::move(region);
+  return true;
+}
+
+inline bool DefaultChunkReaderBase::RecoverImpl(SkippedRegion* skipped_region) {
   if (recoverable_ == Recoverable::kNo) return false;
   Reader& src = *src_reader();
   const Position region_begin = pos_;
@@ -440,7 +642,7 @@ bool DefaultChunkReaderBase::SeekToChunk(Position new_pos) {
     // The current chunk begins before `new_pos`. If it also ends at or after
     // `block_begin`, it is better to start searching from the current position
     // than to seek back to `block_begin`.
-    if (ABSL_PREDICT_FALSE(!PullChunkHeader(nullptr))) {
+    if (ABSL_PREDICT_FALSE(!PullChunkHeaderFromSource(nullptr))) {
       if (ABSL_PREDICT_FALSE(!healthy())) return false;
       truncated_ = false;
       return FailSeeking(src, new_pos);
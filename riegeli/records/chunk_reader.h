@@ -15,22 +15,56 @@
 #ifndef RIEGELI_RECORDS_CHUNK_READER_H_
 #define RIEGELI_RECORDS_CHUNK_READER_H_
 
+#include <stdint.h>
+
+#include <memory>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/records/block.h"
+#include "riegeli/records/encoded_chunk_cache.h"
 #include "riegeli/records/skipped_region.h"
+#include "riegeli/records/trace_sink.h"
 
 namespace riegeli {
 
+// Counters describing the work of a `ChunkReader`, returned by its `stats()`
+// if enabled by `set_collect_stats()`.
+struct ChunkReaderStats {
+  ChunkReaderStats& operator+=(const ChunkReaderStats& that);
+
+  // Number of chunks read by `ReadChunk()`.
+  uint64_t num_chunks = 0;
+  // Number of these chunks found in the `EncodedChunkCache`.
+  uint64_t num_cached_chunks = 0;
+  // Number of bytes of the file spanned by chunks read from the source,
+  // including block headers and padding.
+  Position num_bytes = 0;
+  // Number of successful `Recover()` calls.
+  uint64_t num_recoveries = 0;
+  // Number of bytes skipped by `Recover()`.
+  Position num_skipped_bytes = 0;
+  // Time spent reading chunks from the source, including waiting for I/O and
+  // parsing block headers.
+  absl::Duration read_time;
+  // Time spent verifying chunk data hashes by `ReadChunk()`. Hashes left to
+  // the caller by `ReadChunk(chunk, verify_data_hash)` are not included.
+  absl::Duration hash_time;
+};
+
 // Template parameter independent part of `DefaultChunkReader`.
 class DefaultChunkReaderBase : public Object {
  public:
@@ -57,6 +91,86 @@ class DefaultChunkReaderBase : public Object {
   //  * `false` (when `!healthy()`) - failure
   bool ReadChunk(Chunk& chunk);
 
+  // Like `ReadChunk(chunk)`, but leaves verifying the chunk data hash to the
+  // caller, e.g. to verify it in another thread before decoding the chunk.
+  //
+  // `verify_data_hash` is set to whether the chunk data hash should be verified
+  // according to `set_data_hash_verification_interval()`. If so, the caller
+  // should verify it with `VerifyDataHash(chunk, chunk_begin, pos())`, where
+  // `chunk_begin` is `pos()` before `ReadChunk()`.
+  //
+  // Return values:
+  //  * `true`                      - success (`chunk` is set)
+  //  * `false` (when `healthy()`)  - source ends
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadChunk(Chunk& chunk, bool& verify_data_hash);
+
+  // Verifies the data hash of `chunk` read from `chunk_begin` to `chunk_end`.
+  //
+  // Returns `absl::OkStatus()` if the hash matches, otherwise an
+  // `absl::DataLossError()` describing the mismatch.
+  static absl::Status VerifyDataHash(const Chunk& chunk, Position chunk_begin,
+                                     Position chunk_end);
+
+  // Specifies which chunks read by `ReadChunk()` have their data hash
+  // verified:
+  //  * 1     - every chunk
+  //  * n > 1 - every n-th chunk, starting with the first one
+  //  * 0     - no chunk
+  //
+  // Skipping verification saves hashing CPU for trusted local media, where it
+  // can be a large part of reading uncompressed files. Corrupted chunk data
+  // which are not verified are detected by decoding only if they are invalid
+  // there. Chunk headers and block headers, which protect the file structure,
+  // are always verified.
+  //
+  // Default: 1.
+  void set_data_hash_verification_interval(uint64_t interval);
+  uint64_t data_hash_verification_interval() const {
+    return data_hash_verification_interval_;
+  }
+
+  // Returns the number of chunks read by `ReadChunk()` whose data hash was not
+  // verified because of `set_data_hash_verification_interval()`.
+  uint64_t num_unverified_chunks() const { return num_unverified_chunks_; }
+
+  // If `cache != nullptr`, chunks are looked up in `*cache` under `file_key`
+  // and the chunk position before reading them from the source, and offered
+  // to `*cache` after reading them. Chunks found in the cache are not verified
+  // again.
+  //
+  // `file_key` must identify the contents of the file, e.g. by its name. The
+  // `EncodedChunkCache` must outlive the `ChunkReader`.
+  //
+  // Default: `nullptr`.
+  void set_encoded_chunk_cache(EncodedChunkCache* cache,
+                               absl::string_view file_key);
+  EncodedChunkCache* encoded_chunk_cache() const {
+    return encoded_chunk_cache_;
+  }
+
+  // If `true`, counters returned by `stats()` are collected. This costs a few
+  // clock reads per chunk.
+  //
+  // Default: `false`.
+  void set_collect_stats(bool collect_stats) { collect_stats_ = collect_stats; }
+  bool collect_stats() const { return collect_stats_; }
+
+  // Returns counters collected while `collect_stats()`.
+  const ChunkReaderStats& stats() const { return stats_; }
+
+  // If not `nullptr`, `TraceStage::kReadChunk` and `TraceStage::kVerifyHash`
+  // events are reported to `trace_sink`, which must outlive the `ChunkReader`.
+  //
+  // Default: `nullptr`.
+  void set_trace_sink(TraceSink* trace_sink) { trace_sink_ = trace_sink; }
+  TraceSink* trace_sink() const { return trace_sink_; }
+
+  // Registers memory owned by this `ChunkReader` with `MemoryEstimator`, but
+  // does not include `sizeof(*this)`: the current chunk, and the byte `Reader`
+  // if it is owned.
+  virtual void RegisterSubobjects(MemoryEstimator& memory_estimator) const;
+
   // Reads the next chunk header, from same chunk which will be read by an
   // immediately following `ReadChunk()`.
   //
@@ -69,6 +183,15 @@ class DefaultChunkReaderBase : public Object {
   //  * `false` (when `!healthy()`) - failure
   bool PullChunkHeader(const ChunkHeader** chunk_header);
 
+  // Skips the next chunk, reading only its header. Chunk data are neither read
+  // nor verified, so this is faster than `ReadChunk()` if they are not needed.
+  //
+  // Return values:
+  //  * `true`                      - success
+  //  * `false` (when `healthy()`)  - source ends
+  //  * `false` (when `!healthy()`) - failure
+  bool SkipChunk();
+
   // If `!healthy()` and the failure was caused by invalid file contents, then
   // `Recover()` tries to recover from the failure and allow reading again by
   // skipping over the invalid region.
@@ -169,6 +292,30 @@ class DefaultChunkReaderBase : public Object {
   // Always returns `false`.
   bool FailSeeking(const Reader& src, Position new_pos);
 
+  // Reads or continues reading `chunk_`, and sets `chunk_end` to the position
+  // after the chunk. Does not verify the chunk data hash.
+  bool ReadChunkData(Position& chunk_end);
+  // Implementation of `ReadChunkData()` without collecting stats.
+  bool ReadChunkDataImpl(Position& chunk_end);
+
+  // Returns whether the data hash of the next chunk should be verified, and
+  // counts it in `num_unverified_chunks_` if not.
+  bool SampleDataHashVerification();
+
+  // Returns `true` if the chunk at `pos_` is in `cached_chunk_`, looking it up
+  // in `encoded_chunk_cache_` if reading it from the source has not started.
+  bool FindCachedChunk();
+
+  // Sets `chunk` to the chunk found by `FindCachedChunk()`, and skips it in
+  // the source.
+  bool ReadCachedChunk(Chunk& chunk);
+
+  // Implementation of `Recover()` without collecting stats.
+  bool RecoverImpl(SkippedRegion* skipped_region);
+
+  // Like `PullChunkHeader()`, but bypasses `encoded_chunk_cache_`.
+  bool PullChunkHeaderFromSource(const ChunkHeader** chunk_header);
+
   // Reads or continues reading `chunk_.header`.
   bool ReadChunkHeader();
 
@@ -225,6 +372,22 @@ class DefaultChunkReaderBase : public Object {
   // Invariant:
   //   if `recoverable_ != Recoverable::kNo` then `recoverable_pos_ >= pos_`
   Position recoverable_pos_ = 0;
+
+  uint64_t data_hash_verification_interval_ = 1;
+  // Number of chunks to skip verifying before the next verified chunk.
+  uint64_t chunks_until_verification_ = 0;
+  uint64_t num_unverified_chunks_ = 0;
+
+  EncodedChunkCache* encoded_chunk_cache_ = nullptr;
+  std::string encoded_chunk_cache_key_;
+  // The chunk at `cached_chunk_begin_` found in `encoded_chunk_cache_`, or
+  // `nullptr`.
+  std::shared_ptr<const EncodedChunk> cached_chunk_;
+  Position cached_chunk_begin_ = 0;
+
+  bool collect_stats_ = false;
+  ChunkReaderStats stats_;
+  TraceSink* trace_sink_ = nullptr;
 };
 
 // A `ChunkReader` reads chunks of a Riegeli/records file (rather than
@@ -286,6 +449,8 @@ class DefaultChunkReader : public DefaultChunkReaderBase {
   Reader* src_reader() override { return src_.get(); }
   const Reader* src_reader() const override { return src_.get(); }
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  protected:
   void Done() override;
 
@@ -320,7 +485,17 @@ inline DefaultChunkReaderBase::DefaultChunkReaderBase(
       chunk_(std::move(that.chunk_)),
       block_header_(that.block_header_),
       recoverable_(std::exchange(that.recoverable_, Recoverable::kNo)),
-      recoverable_pos_(that.recoverable_pos_) {}
+      recoverable_pos_(that.recoverable_pos_),
+      data_hash_verification_interval_(that.data_hash_verification_interval_),
+      chunks_until_verification_(that.chunks_until_verification_),
+      num_unverified_chunks_(that.num_unverified_chunks_),
+      encoded_chunk_cache_(std::exchange(that.encoded_chunk_cache_, nullptr)),
+      encoded_chunk_cache_key_(std::move(that.encoded_chunk_cache_key_)),
+      cached_chunk_(std::move(that.cached_chunk_)),
+      cached_chunk_begin_(that.cached_chunk_begin_),
+      collect_stats_(that.collect_stats_),
+      stats_(that.stats_),
+      trace_sink_(that.trace_sink_) {}
 
 inline DefaultChunkReaderBase& DefaultChunkReaderBase::operator=(
     DefaultChunkReaderBase&& that) noexcept {
@@ -333,6 +508,16 @@ inline DefaultChunkReaderBase& DefaultChunkReaderBase::operator=(
   block_header_ = that.block_header_;
   recoverable_ = std::exchange(that.recoverable_, Recoverable::kNo);
   recoverable_pos_ = that.recoverable_pos_;
+  data_hash_verification_interval_ = that.data_hash_verification_interval_;
+  chunks_until_verification_ = that.chunks_until_verification_;
+  num_unverified_chunks_ = that.num_unverified_chunks_;
+  encoded_chunk_cache_ = std::exchange(that.encoded_chunk_cache_, nullptr);
+  encoded_chunk_cache_key_ = std::move(that.encoded_chunk_cache_key_);
+  cached_chunk_ = std::move(that.cached_chunk_);
+  cached_chunk_begin_ = that.cached_chunk_begin_;
+  collect_stats_ = that.collect_stats_;
+  stats_ = that.stats_;
+  trace_sink_ = that.trace_sink_;
   return *this;
 }
 
@@ -343,6 +528,16 @@ inline void DefaultChunkReaderBase::Reset(InitiallyClosed) {
   chunk_.Reset();
   recoverable_ = Recoverable::kNo;
   recoverable_pos_ = 0;
+  data_hash_verification_interval_ = 1;
+  chunks_until_verification_ = 0;
+  num_unverified_chunks_ = 0;
+  encoded_chunk_cache_ = nullptr;
+  encoded_chunk_cache_key_.clear();
+  cached_chunk_.reset();
+  cached_chunk_begin_ = 0;
+  collect_stats_ = false;
+  stats_ = ChunkReaderStats();
+  trace_sink_ = nullptr;
 }
 
 inline void DefaultChunkReaderBase::Reset(InitiallyOpen) {
@@ -352,6 +547,16 @@ inline void DefaultChunkReaderBase::Reset(InitiallyOpen) {
   chunk_.Reset();
   recoverable_ = Recoverable::kNo;
   recoverable_pos_ = 0;
+  data_hash_verification_interval_ = 1;
+  chunks_until_verification_ = 0;
+  num_unverified_chunks_ = 0;
+  encoded_chunk_cache_ = nullptr;
+  encoded_chunk_cache_key_.clear();
+  cached_chunk_.reset();
+  cached_chunk_begin_ = 0;
+  collect_stats_ = false;
+  stats_ = ChunkReaderStats();
+  trace_sink_ = nullptr;
 }
 
 template <typename Src>
@@ -428,6 +633,13 @@ void DefaultChunkReader<Src>::Done() {
   }
 }
 
+template <typename Src>
+void DefaultChunkReader<Src>::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  DefaultChunkReaderBase::RegisterSubobjects(memory_estimator);
+  if (src_.is_owning()) src_->RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_RECORDS_CHUNK_READER_H_
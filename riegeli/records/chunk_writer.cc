@@ -20,6 +20,8 @@
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
@@ -31,9 +33,17 @@
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/hash.h"
 #include "riegeli/records/block.h"
+#include "riegeli/records/trace_sink.h"
 
 namespace riegeli {
 
+ChunkWriterStats& ChunkWriterStats::operator+=(const ChunkWriterStats& that) {
+  num_chunks += that.num_chunks;
+  num_bytes += that.num_bytes;
+  write_time += that.write_time;
+  return *this;
+}
+
 ChunkWriter::~ChunkWriter() {}
 
 void DefaultChunkWriterBase::Initialize(Writer* dest, Position pos) {
@@ -49,10 +59,31 @@ void DefaultChunkWriterBase::Initialize(Writer* dest, Position pos) {
 }
 
 bool DefaultChunkWriterBase::WriteChunk(const Chunk& chunk) {
-  RIEGELI_ASSERT_EQ(chunk.header.data_hash(), internal::Hash(chunk.data))
+  RIEGELI_ASSERT_EQ(chunk.header.data_hash(),
+                    internal::HashLike(chunk.header.data_hash(), chunk.data))
       << "Failed precondition of ChunkWriter::WriteChunk(): "
          "Wrong chunk data hash";
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (!collect_stats_ && trace_sink_ == nullptr) return WriteChunkImpl(chunk);
+  const Position chunk_begin = pos_;
+  const absl::Time write_start = absl::Now();
+  const bool write_ok = WriteChunkImpl(chunk);
+  const absl::Time write_end = absl::Now();
+  if (collect_stats_) stats_.write_time += write_end - write_start;
+  if (ABSL_PREDICT_FALSE(!write_ok)) return false;
+  if (collect_stats_) {
+    ++stats_.num_chunks;
+    stats_.num_bytes += pos_ - chunk_begin;
+  }
+  if (trace_sink_ != nullptr) {
+    trace_sink_->AddEvent(TraceEvent{TraceStage::kWriteChunk, chunk_begin,
+                                     pos_ - chunk_begin, write_start,
+                                     write_end});
+  }
+  return true;
+}
+
+inline bool DefaultChunkWriterBase::WriteChunkImpl(const Chunk& chunk) {
   // Matches `FutureRecordPosition::FutureChunkBegin::Resolve()`.
   Writer& dest = *dest_writer();
   StringReader<> header_reader(
@@ -60,16 +91,22 @@ bool DefaultChunkWriterBase::WriteChunk(const Chunk& chunk) {
   ChainReader<> data_reader(&chunk.data);
   const Position chunk_begin = pos_;
   const Position chunk_end = internal::ChunkEnd(chunk.header, chunk_begin);
+  // Block headers interrupting the chunk use the same hash function.
+  const HashType hash_type =
+      internal::HashTypeOf(chunk.header.stored_header_hash());
   dest.WriteHint(SaturatingIntCast<size_t>(chunk_end - pos_));
   if (ABSL_PREDICT_FALSE(
-          !WriteSection(header_reader, chunk_begin, chunk_end, dest))) {
+          !WriteSection(header_reader, chunk_begin, chunk_end, hash_type,
+                                 dest))) {
     return false;
   }
   if (ABSL_PREDICT_FALSE(
-          !WriteSection(data_reader, chunk_begin, chunk_end, dest))) {
+          !WriteSection(data_reader, chunk_begin, chunk_end, hash_type,
+                                 dest))) {
     return false;
   }
-  if (ABSL_PREDICT_FALSE(!WritePadding(chunk_begin, chunk_end, dest))) {
+  if (ABSL_PREDICT_FALSE(
+          !WritePadding(chunk_begin, chunk_end, hash_type, dest))) {
     return false;
   }
   RIEGELI_ASSERT_EQ(pos_, chunk_end)
@@ -80,6 +117,7 @@ bool DefaultChunkWriterBase::WriteChunk(const Chunk& chunk) {
 inline bool DefaultChunkWriterBase::WriteSection(Reader& src,
                                                  Position chunk_begin,
                                                  Position chunk_end,
+                                                 HashType hash_type,
                                                  Writer& dest) {
   const absl::optional<Position> size = src.Size();
   if (size == absl::nullopt) {
@@ -90,7 +128,8 @@ inline bool DefaultChunkWriterBase::WriteSection(Reader& src,
   while (src.pos() < *size) {
     if (internal::IsBlockBoundary(pos_)) {
       internal::BlockHeader block_header(IntCast<uint64_t>(pos_ - chunk_begin),
-                                         IntCast<uint64_t>(chunk_end - pos_));
+                                         IntCast<uint64_t>(chunk_end - pos_),
+                                         hash_type);
       if (ABSL_PREDICT_FALSE(!dest.Write(
               absl::string_view(block_header.bytes(), block_header.size())))) {
         return Fail(dest);
@@ -111,11 +150,13 @@ inline bool DefaultChunkWriterBase::WriteSection(Reader& src,
 
 inline bool DefaultChunkWriterBase::WritePadding(Position chunk_begin,
                                                  Position chunk_end,
+                                                 HashType hash_type,
                                                  Writer& dest) {
   while (pos_ < chunk_end) {
     if (internal::IsBlockBoundary(pos_)) {
       internal::BlockHeader block_header(IntCast<uint64_t>(pos_ - chunk_begin),
-                                         IntCast<uint64_t>(chunk_end - pos_));
+                                         IntCast<uint64_t>(chunk_end - pos_),
+                                         hash_type);
       if (ABSL_PREDICT_FALSE(!dest.Write(
               absl::string_view(block_header.bytes(), block_header.size())))) {
         return Fail(dest);
@@ -20,16 +20,36 @@
 #include <utility>
 
 #include "absl/base/optimization.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/records/trace_sink.h"
 
 namespace riegeli {
 
+// Counters describing the work of a `ChunkWriter`, returned by its `stats()`
+// if enabled by `set_collect_stats()`.
+struct ChunkWriterStats {
+  ChunkWriterStats& operator+=(const ChunkWriterStats& that);
+
+  // Number of chunks written by `WriteChunk()`, including padding chunks
+  // written by `PadToBlockBoundary()`.
+  uint64_t num_chunks = 0;
+  // Number of bytes of the file spanned by these chunks, including block
+  // headers and padding.
+  Position num_bytes = 0;
+  // Time spent writing chunks and flushing, including waiting for I/O.
+  absl::Duration write_time;
+};
+
 // A `ChunkWriter` writes chunks of a Riegeli/records file (rather than
 // individual records, as `RecordWriter` does) to a destination.
 //
@@ -88,6 +108,29 @@ class ChunkWriter : public Object {
   // Returns the current byte position. Unchanged by `Close()`.
   Position pos() const { return pos_; }
 
+  // If `true`, counters returned by `stats()` are collected. This costs a few
+  // clock reads per chunk.
+  //
+  // Default: `false`.
+  void set_collect_stats(bool collect_stats) { collect_stats_ = collect_stats; }
+  bool collect_stats() const { return collect_stats_; }
+
+  // Returns counters collected while `collect_stats()`.
+  const ChunkWriterStats& stats() const { return stats_; }
+
+  // If not `nullptr`, `TraceStage::kWriteChunk` and `TraceStage::kFlush` events
+  // are reported to `trace_sink`, which must outlive the `ChunkWriter`.
+  //
+  // Default: `nullptr`.
+  void set_trace_sink(TraceSink* trace_sink) { trace_sink_ = trace_sink; }
+  TraceSink* trace_sink() const { return trace_sink_; }
+
+  // Registers memory owned by this `ChunkWriter` with `MemoryEstimator`, but
+  // does not include `sizeof(*this)`.
+  //
+  // By default registers nothing.
+  virtual void RegisterSubobjects(MemoryEstimator& memory_estimator) const {}
+
  protected:
   void Reset(InitiallyClosed);
   void Reset(InitiallyOpen);
@@ -95,6 +138,11 @@ class ChunkWriter : public Object {
   virtual bool FlushImpl(FlushType flush_type) = 0;
 
   Position pos_ = 0;
+  bool collect_stats_ = false;
+  // Updated by implementations of `WriteChunk()` if `collect_stats_`.
+  ChunkWriterStats stats_;
+  // Reported to by implementations of `WriteChunk()` if not `nullptr`.
+  TraceSink* trace_sink_ = nullptr;
 };
 
 // Template parameter independent part of `DefaultChunkWriter`.
@@ -142,9 +190,12 @@ class DefaultChunkWriterBase : public ChunkWriter {
   void Initialize(Writer* dest, Position pos);
 
  private:
+  // Implementation of `WriteChunk()` without collecting stats.
+  bool WriteChunkImpl(const Chunk& chunk);
   bool WriteSection(Reader& src, Position chunk_begin, Position chunk_end,
-                    Writer& dest);
-  bool WritePadding(Position chunk_begin, Position chunk_end, Writer& dest);
+                    HashType hash_type, Writer& dest);
+  bool WritePadding(Position chunk_begin, Position chunk_end,
+                    HashType hash_type, Writer& dest);
 };
 
 // The default `ChunkWriter`. Writes chunks to a byte `Writer`, interleaving
@@ -196,6 +247,8 @@ class DefaultChunkWriter : public DefaultChunkWriterBase {
   Writer* dest_writer() override { return dest_.get(); }
   const Writer* dest_writer() const override { return dest_.get(); }
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  protected:
   void Done() override;
   bool FlushImpl(FlushType flush_type) override;
@@ -232,28 +285,49 @@ inline ChunkWriter::ChunkWriter(ChunkWriter&& that) noexcept
     : Object(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
-      pos_(that.pos_) {}
+      pos_(that.pos_),
+      collect_stats_(that.collect_stats_),
+      stats_(that.stats_),
+      trace_sink_(that.trace_sink_) {}
 
 inline ChunkWriter& ChunkWriter::operator=(ChunkWriter&& that) noexcept {
   Object::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
   pos_ = that.pos_;
+  collect_stats_ = that.collect_stats_;
+  stats_ = that.stats_;
+  trace_sink_ = that.trace_sink_;
   return *this;
 }
 
 inline void ChunkWriter::Reset(InitiallyClosed) {
   Object::Reset(kInitiallyClosed);
   pos_ = 0;
+  collect_stats_ = false;
+  stats_ = ChunkWriterStats();
+  trace_sink_ = nullptr;
 }
 
 inline void ChunkWriter::Reset(InitiallyOpen) {
   Object::Reset(kInitiallyOpen);
   pos_ = 0;
+  collect_stats_ = false;
+  stats_ = ChunkWriterStats();
+  trace_sink_ = nullptr;
 }
 
 inline bool ChunkWriter::Flush(FlushType flush_type) {
-  return FlushImpl(flush_type);
+  if (!collect_stats_ && trace_sink_ == nullptr) return FlushImpl(flush_type);
+  const absl::Time flush_start = absl::Now();
+  const bool flush_ok = FlushImpl(flush_type);
+  const absl::Time flush_end = absl::Now();
+  if (collect_stats_) stats_.write_time += flush_end - flush_start;
+  if (trace_sink_ != nullptr) {
+    trace_sink_->AddEvent(TraceEvent{TraceStage::kFlush, absl::nullopt, 0,
+                                     flush_start, flush_end});
+  }
+  return flush_ok;
 }
 
 inline DefaultChunkWriterBase::DefaultChunkWriterBase(
@@ -352,6 +426,13 @@ bool DefaultChunkWriter<Dest>::FlushImpl(FlushType flush_type) {
   return true;
 }
 
+template <typename Dest>
+void DefaultChunkWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  DefaultChunkWriterBase::RegisterSubobjects(memory_estimator);
+  if (dest_.is_owning()) dest_->RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_RECORDS_CHUNK_WRITER_H_
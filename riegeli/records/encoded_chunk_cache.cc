@@ -0,0 +1,208 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/encoded_chunk_cache.h"
+
+#include <stddef.h>
+
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/chunk_encoding/chunk.h"
+
+namespace riegeli {
+
+namespace {
+
+// Maximum number of access counts of chunks not yet admitted kept by a shard.
+// When it is reached, the counts are forgotten, so that chunks must be read
+// again frequently enough to be admitted.
+constexpr size_t kMaxAccessCounts = size_t{16} << 10;
+
+}  // namespace
+
+size_t EncodedChunk::EstimateMemory() const {
+  return sizeof(EncodedChunk) + chunk.data.EstimateMemory() - sizeof(Chain);
+}
+
+class EncodedChunkCache::Shard {
+ public:
+  explicit Shard(size_t max_memory, size_t admission_threshold)
+      : max_memory_(max_memory), admission_threshold_(admission_threshold) {}
+
+  Shard(const Shard&) = delete;
+  Shard& operator=(const Shard&) = delete;
+
+  std::shared_ptr<const EncodedChunk> Find(absl::string_view file_key,
+                                           Position chunk_begin);
+  void Insert(absl::string_view file_key, Position chunk_begin,
+              const Chunk& chunk, Position chunk_end);
+  size_t memory_usage() const;
+
+ private:
+  using Key = std::pair<std::string, Position>;
+
+  struct Entry {
+    Key key;
+    std::shared_ptr<const EncodedChunk> chunk;
+    size_t memory;
+  };
+
+  // Like `Key`, but does not own the file key, for lookups without copying it.
+  using KeyView = std::pair<absl::string_view, Position>;
+
+  struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(const Key& key) const {
+      return absl::HashOf(absl::string_view(key.first), key.second);
+    }
+    size_t operator()(const KeyView& key) const {
+      return absl::HashOf(key.first, key.second);
+    }
+  };
+
+  struct KeyEq {
+    using is_transparent = void;
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const {
+      return absl::string_view(a.first) == absl::string_view(b.first) &&
+             a.second == b.second;
+    }
+  };
+
+  // Counts an access to a chunk which is not cached, and returns whether it
+  // should be admitted.
+  bool Admit(absl::string_view file_key, Position chunk_begin)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const size_t max_memory_;
+  const size_t admission_threshold_;
+  mutable absl::Mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<Key, std::list<Entry>::iterator, KeyHash, KeyEq> index_
+      ABSL_GUARDED_BY(mutex_);
+  size_t memory_usage_ ABSL_GUARDED_BY(mutex_) = 0;
+  // Numbers of accesses to chunks not yet admitted, keyed by hashes of their
+  // keys. Collisions only make admission slightly more eager.
+  absl::flat_hash_map<size_t, size_t> access_counts_ ABSL_GUARDED_BY(mutex_);
+};
+
+std::shared_ptr<const EncodedChunk> EncodedChunkCache::Shard::Find(
+    absl::string_view file_key, Position chunk_begin) {
+  absl::MutexLock lock(&mutex_);
+  const auto iter = index_.find(KeyView(file_key, chunk_begin));
+  if (iter == index_.end()) return nullptr;
+  entries_.splice(entries_.begin(), entries_, iter->second);
+  return iter->second->chunk;
+}
+
+inline bool EncodedChunkCache::Shard::Admit(absl::string_view file_key,
+                                            Position chunk_begin) {
+  if (admission_threshold_ <= 1) return true;
+  const size_t hash = KeyHash()(KeyView(file_key, chunk_begin));
+  const auto iter = access_counts_.find(hash);
+  if (iter != access_counts_.end()) {
+    if (++iter->second < admission_threshold_) return false;
+    access_counts_.erase(iter);
+    return true;
+  }
+  if (access_counts_.size() >= kMaxAccessCounts) access_counts_.clear();
+  access_counts_.emplace(hash, 1);
+  return false;
+}
+
+void EncodedChunkCache::Shard::Insert(absl::string_view file_key,
+                                      Position chunk_begin, const Chunk& chunk,
+                                      Position chunk_end) {
+  // Evicted chunks are destroyed after releasing the lock.
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    // Another user could have read the same chunk concurrently.
+    if (index_.contains(KeyView(file_key, chunk_begin))) return;
+    if (!Admit(file_key, chunk_begin)) return;
+    std::shared_ptr<EncodedChunk> encoded_chunk =
+        std::make_shared<EncodedChunk>();
+    encoded_chunk->chunk = chunk;
+    encoded_chunk->chunk_end = chunk_end;
+    const size_t memory = encoded_chunk->EstimateMemory() + file_key.size();
+    if (memory > max_memory_) return;
+    entries_.push_front(Entry{Key(std::string(file_key), chunk_begin),
+                              std::move(encoded_chunk), memory});
+    index_.emplace(entries_.front().key, entries_.begin());
+    memory_usage_ += memory;
+    while (memory_usage_ > max_memory_) {
+      const auto last = std::prev(entries_.end());
+      memory_usage_ -= last->memory;
+      index_.erase(last->key);
+      evicted.splice(evicted.end(), entries_, last);
+    }
+  }
+}
+
+size_t EncodedChunkCache::Shard::memory_usage() const {
+  absl::MutexLock lock(&mutex_);
+  return memory_usage_;
+}
+
+EncodedChunkCache::EncodedChunkCache(Options options)
+    : max_shard_memory_(options.max_memory() / options.num_shards()) {
+  shards_.reserve(options.num_shards());
+  for (size_t i = 0; i < options.num_shards(); ++i) {
+    shards_.push_back(std::make_unique<Shard>(max_shard_memory_,
+                                              options.admission_threshold()));
+  }
+}
+
+EncodedChunkCache::~EncodedChunkCache() {}
+
+inline EncodedChunkCache::Shard& EncodedChunkCache::ShardFor(
+    absl::string_view file_key, Position chunk_begin) const {
+  return *shards_[absl::HashOf(file_key, chunk_begin) % shards_.size()];
+}
+
+std::shared_ptr<const EncodedChunk> EncodedChunkCache::Find(
+    absl::string_view file_key, Position chunk_begin) {
+  if (max_shard_memory_ == 0) return nullptr;
+  return ShardFor(file_key, chunk_begin).Find(file_key, chunk_begin);
+}
+
+void EncodedChunkCache::Insert(absl::string_view file_key,
+                               Position chunk_begin, const Chunk& chunk,
+                               Position chunk_end) {
+  if (max_shard_memory_ == 0) return;
+  ShardFor(file_key, chunk_begin)
+      .Insert(file_key, chunk_begin, chunk, chunk_end);
+}
+
+size_t EncodedChunkCache::memory_usage() const {
+  size_t memory_usage = 0;
+  for (const std::unique_ptr<Shard>& shard : shards_) {
+    memory_usage += shard->memory_usage();
+  }
+  return memory_usage;
+}
+
+}  // namespace riegeli
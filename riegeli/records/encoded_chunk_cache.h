@@ -0,0 +1,157 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_ENCODED_CHUNK_CACHE_H_
+#define RIEGELI_RECORDS_ENCODED_CHUNK_CACHE_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/chunk_encoding/chunk.h"
+
+namespace riegeli {
+
+// A chunk as stored in the file, immutable and shared by users of an
+// `EncodedChunkCache`.
+struct EncodedChunk {
+  // Estimates the amount of memory used by this `EncodedChunk`.
+  size_t EstimateMemory() const;
+
+  Chunk chunk;
+  // File position after the chunk, including intervening block headers and
+  // padding, where the next chunk begins.
+  Position chunk_end = 0;
+};
+
+// A memory-bounded LRU cache of chunks as stored in the file (still
+// compressed), keyed by file identity and chunk position, which can be shared
+// by readers of many files from many threads.
+//
+// Chunks are cached by `DefaultChunkReaderBase::set_encoded_chunk_cache()`.
+// This helps repeated and nearby seeks when reading a chunk is expensive, e.g.
+// on a remote filesystem. Compared to `ChunkCache`, a cached chunk still has
+// to be decoded, but it takes several times less memory, and the cache does not
+// depend on field projection.
+//
+// To avoid evicting frequently used chunks when many chunks are read once,
+// e.g. during a scan, a chunk is added only when it is read for the
+// `admission_threshold()`-th time since its shard last forgot access counts.
+//
+// The file key identifies the contents of a file, e.g. a file name if the file
+// does not change while being cached.
+//
+// The cache is split into shards with separate locks and separate parts of the
+// memory limit, to reduce lock contention. A key is assigned to a shard by its
+// hash.
+//
+// `EncodedChunkCache` is thread-safe.
+class EncodedChunkCache {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the approximate limit of memory used by cached chunks. When the
+    // limit is exceeded, the least recently used chunks of the shard are
+    // evicted. Chunks larger than the limit of a shard are not cached.
+    //
+    // Default: 64M.
+    Options& set_max_memory(size_t max_memory) & {
+      max_memory_ = max_memory;
+      return *this;
+    }
+    Options&& set_max_memory(size_t max_memory) && {
+      return std::move(set_max_memory(max_memory));
+    }
+    size_t max_memory() const { return max_memory_; }
+
+    // Sets the number of shards. Each shard can use
+    // `max_memory() / num_shards()`.
+    //
+    // Default: 16.
+    Options& set_num_shards(size_t num_shards) & {
+      RIEGELI_ASSERT_GT(num_shards, 0u)
+          << "Failed precondition of "
+             "EncodedChunkCache::Options::set_num_shards(): "
+             "zero shards";
+      num_shards_ = num_shards;
+      return *this;
+    }
+    Options&& set_num_shards(size_t num_shards) && {
+      return std::move(set_num_shards(num_shards));
+    }
+    size_t num_shards() const { return num_shards_; }
+
+    // Sets how many times a chunk must be offered to `Insert()` before it is
+    // added. 1 adds every chunk.
+    //
+    // Default: 2.
+    Options& set_admission_threshold(size_t admission_threshold) & {
+      RIEGELI_ASSERT_GT(admission_threshold, 0u)
+          << "Failed precondition of "
+             "EncodedChunkCache::Options::set_admission_threshold(): "
+             "zero threshold";
+      admission_threshold_ = admission_threshold;
+      return *this;
+    }
+    Options&& set_admission_threshold(size_t admission_threshold) && {
+      return std::move(set_admission_threshold(admission_threshold));
+    }
+    size_t admission_threshold() const { return admission_threshold_; }
+
+   private:
+    size_t max_memory_ = size_t{64} << 20;
+    size_t num_shards_ = 16;
+    size_t admission_threshold_ = 2;
+  };
+
+  explicit EncodedChunkCache(Options options = Options());
+
+  EncodedChunkCache(const EncodedChunkCache&) = delete;
+  EncodedChunkCache& operator=(const EncodedChunkCache&) = delete;
+
+  ~EncodedChunkCache();
+
+  // Returns the cached chunk of the file identified by `file_key` beginning at
+  // `chunk_begin`, marking it as recently used, or `nullptr` if it is absent.
+  std::shared_ptr<const EncodedChunk> Find(absl::string_view file_key,
+                                           Position chunk_begin);
+
+  // Offers a chunk of the file identified by `file_key` beginning at
+  // `chunk_begin` and ending at `chunk_end`. It is copied to the cache if it
+  // was offered `admission_threshold()` times and is not already present,
+  // evicting least recently used chunks of its shard as needed.
+  void Insert(absl::string_view file_key, Position chunk_begin,
+              const Chunk& chunk, Position chunk_end);
+
+  // Returns the approximate amount of memory used by cached chunks.
+  size_t memory_usage() const;
+
+ private:
+  class Shard;
+
+  Shard& ShardFor(absl::string_view file_key, Position chunk_begin) const;
+
+  size_t max_shard_memory_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_ENCODED_CHUNK_CACHE_H_
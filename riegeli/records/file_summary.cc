@@ -0,0 +1,245 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/file_summary.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/numeric/bits.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/hash.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+
+namespace {
+
+// The number of buckets of `FileSummary::record_size_histogram` needed for any
+// `uint64_t` size.
+constexpr size_t kMaxHistogramSize = 65;
+
+// The largest value of a register of `FileSummary::key_sketch`.
+constexpr int kMaxKeySketchRegister = 64 - FileSummary::kKeySketchBits + 1;
+
+// Decodes `summary.record_size_histogram` and `summary.key_sketch`, after
+// other fields of `summary` have been decoded.
+absl::Status DecodeRecordStats(Reader& src, FileSummary& summary) {
+  const absl::optional<uint64_t> histogram_size = ReadVarint64(src);
+  if (ABSL_PREDICT_FALSE(histogram_size == absl::nullopt ||
+                         *histogram_size > kMaxHistogramSize)) {
+    return absl::DataLossError("Reading record size histogram failed");
+  }
+  summary.record_size_histogram.resize(IntCast<size_t>(*histogram_size));
+  uint64_t histogram_num_records = 0;
+  for (uint64_t& count : summary.record_size_histogram) {
+    const absl::optional<uint64_t> bucket_count = ReadVarint64(src);
+    if (ABSL_PREDICT_FALSE(bucket_count == absl::nullopt ||
+                           *bucket_count >
+                               summary.num_records - histogram_num_records)) {
+      return absl::DataLossError("Reading record size histogram failed");
+    }
+    count = *bucket_count;
+    histogram_num_records += count;
+  }
+  if (ABSL_PREDICT_FALSE(!summary.record_size_histogram.empty() &&
+                         histogram_num_records != summary.num_records)) {
+    return absl::DataLossError(
+        "Invalid record size histogram: wrong number of records");
+  }
+  const absl::optional<uint64_t> sketch_size = ReadVarint64(src);
+  if (ABSL_PREDICT_FALSE(sketch_size == absl::nullopt ||
+                         (*sketch_size != 0 &&
+                          *sketch_size != FileSummary::kKeySketchSize))) {
+    return absl::DataLossError("Reading key sketch failed");
+  }
+  if (ABSL_PREDICT_FALSE(
+          !src.Read(IntCast<size_t>(*sketch_size), summary.key_sketch))) {
+    return absl::DataLossError("Reading key sketch failed");
+  }
+  for (const char rank : summary.key_sketch) {
+    if (ABSL_PREDICT_FALSE(rank < 0 || rank > kMaxKeySketchRegister)) {
+      return absl::DataLossError("Invalid key sketch");
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+constexpr int FileSummary::kKeySketchBits;
+constexpr size_t FileSummary::kKeySketchSize;
+
+void FileSummary::Add(uint64_t chunk_num_records, uint64_t decoded_data_size) {
+  if (chunk_num_records == 0) return;
+  num_records += chunk_num_records;
+  ++num_chunks;
+  num_decoded_bytes += decoded_data_size;
+}
+
+void FileSummary::AddRecordSize(uint64_t record_size) {
+  const size_t bucket = IntCast<size_t>(absl::bit_width(record_size));
+  if (record_size_histogram.size() <= bucket) {
+    record_size_histogram.resize(bucket + 1);
+  }
+  ++record_size_histogram[bucket];
+}
+
+void FileSummary::AddKey(absl::string_view key) {
+  if (key_sketch.empty()) key_sketch.assign(kKeySketchSize, '\0');
+  const uint64_t hash = internal::Hash(key);
+  const size_t index = IntCast<size_t>(hash >> (64 - kKeySketchBits));
+  const uint64_t rest = hash << kKeySketchBits;
+  const char rank = static_cast<char>(
+      rest == 0 ? kMaxKeySketchRegister : absl::countl_zero(rest) + 1);
+  if (key_sketch[index] < rank) key_sketch[index] = rank;
+}
+
+void FileSummary::Merge(const FileSummary& other) {
+  if (other.num_records == 0) return;
+  if (num_records == 0) {
+    record_size_histogram = other.record_size_histogram;
+    key_sketch = other.key_sketch;
+  } else {
+    if (record_size_histogram.empty() || other.record_size_histogram.empty()) {
+      record_size_histogram.clear();
+    } else {
+      if (record_size_histogram.size() < other.record_size_histogram.size()) {
+        record_size_histogram.resize(other.record_size_histogram.size());
+      }
+      for (size_t i = 0; i < other.record_size_histogram.size(); ++i) {
+        record_size_histogram[i] += other.record_size_histogram[i];
+      }
+    }
+    if (key_sketch.empty() || other.key_sketch.empty()) {
+      key_sketch.clear();
+    } else {
+      for (size_t i = 0; i < kKeySketchSize; ++i) {
+        key_sketch[i] = std::max(key_sketch[i], other.key_sketch[i]);
+      }
+    }
+  }
+  num_records += other.num_records;
+  num_chunks += other.num_chunks;
+  num_decoded_bytes += other.num_decoded_bytes;
+}
+
+double FileSummary::EstimateNumDistinctKeys() const {
+  if (key_sketch.empty()) return 0.0;
+  const double num_registers = static_cast<double>(kKeySketchSize);
+  double sum = 0.0;
+  size_t num_zeros = 0;
+  for (const char rank : key_sketch) {
+    sum += std::ldexp(1.0, -static_cast<int>(rank));
+    if (rank == 0) ++num_zeros;
+  }
+  const double estimate = 0.7213 / (1.0 + 1.079 / num_registers) *
+                          num_registers * num_registers / sum;
+  if (estimate <= 2.5 * num_registers && num_zeros > 0) {
+    // For small cardinalities linear counting is more accurate.
+    return num_registers *
+           std::log(num_registers / static_cast<double>(num_zeros));
+  }
+  return estimate;
+}
+
+void FileSummary::EncodeChunk(Position chunk_begin, Chunk& chunk,
+                              HashType hash_type) const {
+  chunk.data.Clear();
+  ChainWriter<> data_writer(&chunk.data);
+  WriteVarint64(chunk_begin, data_writer);
+  WriteVarint64(num_records, data_writer);
+  WriteVarint64(num_chunks, data_writer);
+  WriteVarint64(num_decoded_bytes, data_writer);
+  WriteVarint64(record_size_histogram.size(), data_writer);
+  for (const uint64_t count : record_size_histogram) {
+    WriteVarint64(count, data_writer);
+  }
+  WriteVarint64(key_sketch.size(), data_writer);
+  data_writer.Write(key_sketch);
+  if (!data_writer.Close()) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Writing file summary failed: " << data_writer.status();
+  }
+  chunk.header =
+      ChunkHeader(chunk.data, ChunkType::kFileSummary, 0, 0, hash_type);
+}
+
+absl::Status FileSummary::DecodeChunk(const Chunk& chunk,
+                                      Position chunk_begin) {
+  *this = FileSummary();
+  if (ABSL_PREDICT_FALSE(chunk.header.chunk_type() !=
+                         ChunkType::kFileSummary)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Not a file summary: chunk type ",
+        static_cast<unsigned>(chunk.header.chunk_type())));
+  }
+  ChainReader<> data_reader(&chunk.data);
+  const absl::optional<uint64_t> summary_begin = ReadVarint64(data_reader);
+  if (ABSL_PREDICT_FALSE(summary_begin == absl::nullopt)) {
+    return absl::DataLossError("Reading file summary position failed");
+  }
+  if (ABSL_PREDICT_FALSE(*summary_begin != chunk_begin)) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "File summary was written at ", *summary_begin, " but read from ",
+        chunk_begin));
+  }
+  const absl::optional<uint64_t> summary_num_records =
+      ReadVarint64(data_reader);
+  const absl::optional<uint64_t> summary_num_chunks =
+      ReadVarint64(data_reader);
+  const absl::optional<uint64_t> summary_num_decoded_bytes =
+      ReadVarint64(data_reader);
+  if (ABSL_PREDICT_FALSE(summary_num_records == absl::nullopt ||
+                         summary_num_chunks == absl::nullopt ||
+                         summary_num_decoded_bytes == absl::nullopt)) {
+    return absl::DataLossError("Reading file summary failed");
+  }
+  // Each chunk with records occupies more than a chunk header, and contains
+  // at least one record.
+  if (ABSL_PREDICT_FALSE(
+          *summary_num_chunks > chunk_begin / ChunkHeader::size() ||
+          *summary_num_records < *summary_num_chunks)) {
+    return absl::DataLossError("Invalid file summary");
+  }
+  num_records = *summary_num_records;
+  num_chunks = *summary_num_chunks;
+  num_decoded_bytes = *summary_num_decoded_bytes;
+  // File summaries written before record statistics end here.
+  if (!data_reader.Pull()) return absl::OkStatus();
+  absl::Status status = DecodeRecordStats(data_reader, *this);
+  if (ABSL_PREDICT_FALSE(!status.ok())) {
+    *this = FileSummary();
+    return status;
+  }
+  // Remaining data are reserved for future extensions.
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,105 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_FILE_SUMMARY_H_
+#define RIEGELI_RECORDS_FILE_SUMMARY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+
+namespace riegeli {
+
+// Totals describing records of a whole file, which can be read from the end of
+// the file without reading chunks with records.
+//
+// `RecordWriter` writes a `FileSummary` as a chunk of type
+// `ChunkType::kFileSummary` when closed, if
+// `RecordWriterBase::Options::file_summary()`. `RecordReader` returns it from
+// `ReadFileSummary()`.
+struct FileSummary {
+  // Accounts for a chunk with `num_records` records of `decoded_data_size`
+  // bytes in total. Chunks with no records are ignored.
+  void Add(uint64_t chunk_num_records, uint64_t decoded_data_size);
+
+  // Accounts for a record of `record_size` bytes in `record_size_histogram`.
+  void AddRecordSize(uint64_t record_size);
+
+  // Accounts for a record with `key` in `key_sketch`.
+  void AddKey(absl::string_view key);
+
+  // Accounts for everything accounted for in `other`, as if the files were
+  // concatenated.
+  //
+  // `record_size_histogram` and `key_sketch` stay present only if they are
+  // present in both summaries, where a summary without records counts as having
+  // them.
+  void Merge(const FileSummary& other);
+
+  // Returns the estimated number of distinct keys, with a relative standard
+  // error of about 1.6%, or 0 if `key_sketch` is absent.
+  double EstimateNumDistinctKeys() const;
+
+  // Encodes the summary as a chunk to be written at `chunk_begin`, with hashes
+  // computed with `hash_type`.
+  void EncodeChunk(Position chunk_begin, Chunk& chunk,
+                   HashType hash_type = HashType::kHighwayHash) const;
+
+  // Decodes the summary from a chunk of type `ChunkType::kFileSummary` read
+  // from `chunk_begin`, replacing `*this`.
+  //
+  // If the chunk was written at a different position, e.g. because the file
+  // was physically concatenated after another file, the summary would not
+  // describe the whole file, and `absl::FailedPreconditionError()` is returned.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - failure (`*this` is cleared)
+  absl::Status DecodeChunk(const Chunk& chunk, Position chunk_begin);
+
+  // Total number of records.
+  uint64_t num_records = 0;
+  // Number of chunks with records.
+  uint64_t num_chunks = 0;
+  // Total size of records, before compression.
+  Position num_decoded_bytes = 0;
+  // If not empty, `record_size_histogram[i]` is the number of records whose
+  // size has `i` significant bits, i.e. the size is 0 for `i == 0`, and in
+  // [2^(i - 1), 2^i) otherwise. Trailing zeros are omitted.
+  //
+  // It is empty if some records were not seen individually, e.g. if chunks were
+  // written with `RecordWriterBase::WriteChunk()`.
+  std::vector<uint64_t> record_size_histogram;
+  // If not empty, a HyperLogLog sketch of keys of records, with
+  // `kKeySketchSize` registers, for `EstimateNumDistinctKeys()`.
+  //
+  // Keys are extracted by `RecordWriterBase::Options::summary_key()`.
+  std::string key_sketch;
+
+  // The number of registers of `key_sketch`.
+  static constexpr int kKeySketchBits = 12;
+  static constexpr size_t kKeySketchSize = size_t{1} << kKeySketchBits;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_FILE_SUMMARY_H_
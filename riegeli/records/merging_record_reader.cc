@@ -0,0 +1,206 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/merging_record_reader.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/compare.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/messages/message_parse.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+MergingRecordReader::MergingRecordReader(std::vector<std::string> filenames,
+                                         Options options)
+    : Object(kInitiallyOpen),
+      filenames_(std::move(filenames)),
+      options_(std::move(options)) {
+  RIEGELI_ASSERT(options_.key() != nullptr)
+      << "Failed precondition of MergingRecordReader: no key function";
+  if (ABSL_PREDICT_FALSE(!OpenInputs())) return;
+  FillHeap();
+}
+
+void MergingRecordReader::Reset() {
+  Object::Reset(kInitiallyClosed);
+  filenames_.clear();
+  options_ = Options();
+  inputs_.clear();
+  heap_.clear();
+  record_.clear();
+  last_key_.clear();
+  last_file_index_ = 0;
+  last_pos_ = RecordPosition();
+  last_record_is_valid_ = false;
+}
+
+void MergingRecordReader::Reset(std::vector<std::string> filenames,
+                                Options options) {
+  RIEGELI_ASSERT(options.key() != nullptr)
+      << "Failed precondition of MergingRecordReader::Reset(): "
+         "no key function";
+  Object::Reset(kInitiallyOpen);
+  filenames_ = std::move(filenames);
+  options_ = std::move(options);
+  inputs_.clear();
+  heap_.clear();
+  record_.clear();
+  last_key_.clear();
+  last_file_index_ = 0;
+  last_pos_ = RecordPosition();
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!OpenInputs())) return;
+  FillHeap();
+}
+
+void MergingRecordReader::Done() {
+  last_record_is_valid_ = false;
+  for (Input& input : inputs_) {
+    if (ABSL_PREDICT_FALSE(!input.reader.Close())) Fail(input.reader);
+  }
+  inputs_.clear();
+  heap_.clear();
+}
+
+inline bool MergingRecordReader::OpenInputs() {
+  inputs_.reserve(filenames_.size());
+  for (const std::string& filename : filenames_) {
+    inputs_.emplace_back();
+    Input& input = inputs_.back();
+    input.reader.Reset(std::forward_as_tuple(filename, O_RDONLY,
+                                             options_.fd_reader_options()),
+                       options_.record_reader_options());
+    if (ABSL_PREDICT_FALSE(!input.reader.healthy())) return Fail(input.reader);
+  }
+  return true;
+}
+
+inline bool MergingRecordReader::ReadInput(size_t input_index) {
+  Input& input = inputs_[input_index];
+  if (ABSL_PREDICT_FALSE(!input.reader.ReadRecord(input.record))) {
+    if (ABSL_PREDICT_FALSE(!input.reader.healthy())) Fail(input.reader);
+    return false;
+  }
+  input.key = options_.key()(input.record);
+  input.pos = input.reader.last_pos();
+  return true;
+}
+
+inline bool MergingRecordReader::HeapGreater(size_t a, size_t b) const {
+  const int ordering = inputs_[a].key.compare(inputs_[b].key);
+  return ordering != 0 ? ordering > 0 : a > b;
+}
+
+inline bool MergingRecordReader::FillHeap() {
+  heap_.clear();
+  for (size_t input_index = 0; input_index < inputs_.size(); ++input_index) {
+    if (ReadInput(input_index)) {
+      heap_.push_back(input_index);
+    } else if (ABSL_PREDICT_FALSE(!healthy())) {
+      heap_.clear();
+      return false;
+    }
+  }
+  std::make_heap(heap_.begin(), heap_.end(), [this](size_t a, size_t b) {
+    return HeapGreater(a, b);
+  });
+  return true;
+}
+
+inline bool MergingRecordReader::NextRecord() {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (heap_.empty()) return false;
+  const auto greater = [this](size_t a, size_t b) { return HeapGreater(a, b); };
+  std::pop_heap(heap_.begin(), heap_.end(), greater);
+  const size_t input_index = heap_.back();
+  Input& input = inputs_[input_index];
+  std::swap(record_, input.record);
+  std::swap(last_key_, input.key);
+  last_file_index_ = input_index;
+  last_pos_ = input.pos;
+  if (ReadInput(input_index)) {
+    std::push_heap(heap_.begin(), heap_.end(), greater);
+  } else {
+    heap_.pop_back();
+    if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  }
+  last_record_is_valid_ = true;
+  return true;
+}
+
+bool MergingRecordReader::ReadRecord(google::protobuf::MessageLite& record) {
+  if (ABSL_PREDICT_FALSE(!NextRecord())) return false;
+  absl::Status status = ParseFromString(record_, record);
+  if (ABSL_PREDICT_FALSE(!status.ok())) {
+    last_record_is_valid_ = false;
+    return Fail(std::move(status));
+  }
+  return true;
+}
+
+bool MergingRecordReader::ReadRecord(absl::string_view& record) {
+  if (ABSL_PREDICT_FALSE(!NextRecord())) {
+    record = absl::string_view();
+    return false;
+  }
+  record = record_;
+  return true;
+}
+
+bool MergingRecordReader::ReadRecord(std::string& record) {
+  if (ABSL_PREDICT_FALSE(!NextRecord())) {
+    record.clear();
+    return false;
+  }
+  record = record_;
+  return true;
+}
+
+bool MergingRecordReader::Seek(absl::string_view key) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  for (Input& input : inputs_) {
+    // Returning `greater` in place of `equivalent` finds the earliest record
+    // with `key`.
+    if (ABSL_PREDICT_FALSE(
+            !input.reader.Search<std::string>([&](const std::string& record) {
+              return options_.key()(record) < key
+                         ? absl::partial_ordering::less
+                         : absl::partial_ordering::greater;
+            }))) {
+      heap_.clear();
+      return Fail(input.reader);
+    }
+  }
+  return FillHeap();
+}
+
+}  // namespace riegeli
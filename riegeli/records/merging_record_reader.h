@@ -0,0 +1,303 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_MERGING_RECORD_READER_H_
+#define RIEGELI_RECORDS_MERGING_RECORD_READER_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+// `MergingRecordReader` reads records of a set of Riegeli/records files, each
+// sorted by keys (e.g. written by `SortingRecordWriter`), as a single stream
+// sorted by keys.
+//
+// Records with equal keys are returned in the order of files, and within a
+// file in the order of the file.
+//
+// For reading records sequentially, this kind of loop can be used:
+// ```
+//   riegeli::MergingRecordReader reader(
+//       filenames, riegeli::MergingRecordReader::Options().set_key(key));
+//   SomeProto record;
+//   while (reader.ReadRecord(record)) {
+//     ... Process record.
+//   }
+//   if (!reader.Close()) {
+//     ... Failed with reason: reader.status()
+//   }
+// ```
+class MergingRecordReader : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets a function which extracts a key from a record (serialized, if the
+    // record is a proto message). Keys are compared as byte strings.
+    //
+    // This must be set, consistently with the order of files.
+    Options& set_key(
+        const std::function<std::string(absl::string_view record)>& key) & {
+      key_ = key;
+      return *this;
+    }
+    Options& set_key(
+        std::function<std::string(absl::string_view record)>&& key) & {
+      key_ = std::move(key);
+      return *this;
+    }
+    Options&& set_key(
+        const std::function<std::string(absl::string_view record)>& key) && {
+      return std::move(set_key(key));
+    }
+    Options&& set_key(
+        std::function<std::string(absl::string_view record)>&& key) && {
+      return std::move(set_key(std::move(key)));
+    }
+    std::function<std::string(absl::string_view record)>& key() {
+      return key_;
+    }
+    const std::function<std::string(absl::string_view record)>& key() const {
+      return key_;
+    }
+
+    // Options for reading each file.
+    //
+    // Default: `RecordReaderBase::Options().set_parallelism(1)`, i.e. each
+    // file decodes one chunk ahead in background.
+    Options& set_record_reader_options(
+        const RecordReaderBase::Options& record_reader_options) & {
+      record_reader_options_ = record_reader_options;
+      return *this;
+    }
+    Options& set_record_reader_options(
+        RecordReaderBase::Options&& record_reader_options) & {
+      record_reader_options_ = std::move(record_reader_options);
+      return *this;
+    }
+    Options&& set_record_reader_options(
+        const RecordReaderBase::Options& record_reader_options) && {
+      return std::move(set_record_reader_options(record_reader_options));
+    }
+    Options&& set_record_reader_options(
+        RecordReaderBase::Options&& record_reader_options) && {
+      return std::move(
+          set_record_reader_options(std::move(record_reader_options)));
+    }
+    RecordReaderBase::Options& record_reader_options() {
+      return record_reader_options_;
+    }
+    const RecordReaderBase::Options& record_reader_options() const {
+      return record_reader_options_;
+    }
+
+    // Options for opening each file.
+    //
+    // Default: `FdReaderBase::Options()`.
+    Options& set_fd_reader_options(
+        const FdReaderBase::Options& fd_reader_options) & {
+      fd_reader_options_ = fd_reader_options;
+      return *this;
+    }
+    Options&& set_fd_reader_options(
+        const FdReaderBase::Options& fd_reader_options) && {
+      return std::move(set_fd_reader_options(fd_reader_options));
+    }
+    FdReaderBase::Options& fd_reader_options() { return fd_reader_options_; }
+    const FdReaderBase::Options& fd_reader_options() const {
+      return fd_reader_options_;
+    }
+
+   private:
+    std::function<std::string(absl::string_view record)> key_;
+    RecordReaderBase::Options record_reader_options_ =
+        RecordReaderBase::Options().set_parallelism(1);
+    FdReaderBase::Options fd_reader_options_;
+  };
+
+  // Creates a closed `MergingRecordReader`.
+  MergingRecordReader() noexcept : Object(kInitiallyClosed) {}
+
+  // Will read from the files named by `filenames`.
+  //
+  // Precondition: `options.key() != nullptr`
+  explicit MergingRecordReader(std::vector<std::string> filenames,
+                               Options options = Options());
+
+  MergingRecordReader(MergingRecordReader&& that) noexcept;
+  MergingRecordReader& operator=(MergingRecordReader&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `MergingRecordReader`. This
+  // avoids constructing a temporary `MergingRecordReader` and moving from it.
+  void Reset();
+  void Reset(std::vector<std::string> filenames, Options options = Options());
+
+  // Returns the names of the files being read. Unchanged by `Close()`.
+  const std::vector<std::string>& filenames() const { return filenames_; }
+
+  // Reads the next record in the order of keys.
+  //
+  // For `ReadRecord(absl::string_view&)` the `absl::string_view` is valid until
+  // the next non-const operation on this `MergingRecordReader`.
+  //
+  // Return values:
+  //  * `true`                      - success (`record` is set)
+  //  * `false` (when `healthy()`)  - all files end
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadRecord(google::protobuf::MessageLite& record);
+  bool ReadRecord(absl::string_view& record);
+  bool ReadRecord(std::string& record);
+
+  // Returns the key of the last record read.
+  //
+  // Precondition: `last_record_is_valid()`
+  absl::string_view last_key() const;
+
+  // Returns the index in `filenames()` of the file of the last record read.
+  //
+  // Precondition: `last_record_is_valid()`
+  size_t last_file_index() const;
+
+  // Returns the canonical position of the last record read, within its file.
+  //
+  // Precondition: `last_record_is_valid()`
+  RecordPosition last_pos() const;
+
+  // Returns `true` if calling `last_key()`, `last_file_index()`, and
+  // `last_pos()` is valid.
+  bool last_record_is_valid() const { return last_record_is_valid_; }
+
+  // Seeks to the first record whose key is not less than `key`, by
+  // `RecordReaderBase::Search()` in each file.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool Seek(absl::string_view key);
+
+ protected:
+  void Done() override;
+
+ private:
+  struct Input {
+    RecordReader<FdReader<>> reader;
+    // The next record of the file, valid if the input is in `heap_`.
+    std::string record;
+    std::string key;
+    RecordPosition pos;
+  };
+
+  bool OpenInputs();
+  // Reads the next record of `inputs_[input_index]`.
+  //
+  // Return values:
+  //  * `true`                      - success
+  //  * `false` (when `healthy()`)  - the file ends
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadInput(size_t input_index);
+  // Returns `true` if the next record of `inputs_[a]` should be returned after
+  // the next record of `inputs_[b]`.
+  bool HeapGreater(size_t a, size_t b) const;
+  // Reads the next record of each input and rebuilds `heap_`.
+  bool FillHeap();
+  // Moves the smallest next record to `record_` and reads the next record of
+  // its input.
+  bool NextRecord();
+
+  std::vector<std::string> filenames_;
+  Options options_;
+  std::vector<Input> inputs_;
+  // Indices of `inputs_` which have a next record, as a heap with the smallest
+  // `(key, index)` at the front.
+  std::vector<size_t> heap_;
+  // The last record read, valid if `last_record_is_valid_`.
+  std::string record_;
+  std::string last_key_;
+  size_t last_file_index_ = 0;
+  RecordPosition last_pos_;
+  bool last_record_is_valid_ = false;
+};
+
+// Implementation details follow.
+
+inline MergingRecordReader::MergingRecordReader(
+    MergingRecordReader&& that) noexcept
+    : Object(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      filenames_(std::move(that.filenames_)),
+      options_(std::move(that.options_)),
+      inputs_(std::move(that.inputs_)),
+      heap_(std::move(that.heap_)),
+      record_(std::move(that.record_)),
+      last_key_(std::move(that.last_key_)),
+      last_file_index_(that.last_file_index_),
+      last_pos_(that.last_pos_),
+      last_record_is_valid_(std::exchange(that.last_record_is_valid_, false)) {}
+
+inline MergingRecordReader& MergingRecordReader::operator=(
+    MergingRecordReader&& that) noexcept {
+  Object::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  filenames_ = std::move(that.filenames_);
+  options_ = std::move(that.options_);
+  inputs_ = std::move(that.inputs_);
+  heap_ = std::move(that.heap_);
+  record_ = std::move(that.record_);
+  last_key_ = std::move(that.last_key_);
+  last_file_index_ = that.last_file_index_;
+  last_pos_ = that.last_pos_;
+  last_record_is_valid_ = std::exchange(that.last_record_is_valid_, false);
+  return *this;
+}
+
+inline absl::string_view MergingRecordReader::last_key() const {
+  RIEGELI_ASSERT(last_record_is_valid())
+      << "Failed precondition of MergingRecordReader::last_key(): "
+         "no record was recently read";
+  return last_key_;
+}
+
+inline size_t MergingRecordReader::last_file_index() const {
+  RIEGELI_ASSERT(last_record_is_valid())
+      << "Failed precondition of MergingRecordReader::last_file_index(): "
+         "no record was recently read";
+  return last_file_index_;
+}
+
+inline RecordPosition MergingRecordReader::last_pos() const {
+  RIEGELI_ASSERT(last_record_is_valid())
+      << "Failed precondition of MergingRecordReader::last_pos(): "
+         "no record was recently read";
+  return last_pos_;
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_MERGING_RECORD_READER_H_
@@ -0,0 +1,138 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/record_file_concat.h"
+
+#include <fcntl.h>
+
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/hash.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/chunk_writer.h"
+
+namespace riegeli {
+
+RecordFileConcatenator::RecordFileConcatenator(ChunkWriter* dest,
+                                               Options options)
+    : dest_(RIEGELI_ASSERT_NOTNULL(dest)),
+      options_(std::move(options)),
+      first_file_(dest->pos() == 0) {}
+
+absl::Status RecordFileConcatenator::Append(ChunkReader& src) {
+  if (ABSL_PREDICT_FALSE(!dest_->healthy())) return dest_->status();
+  bool src_first_chunk = true;
+  bool src_second_chunk = false;
+  Chunk chunk;
+  for (;;) {
+    if (ABSL_PREDICT_FALSE(!src.ReadChunk(chunk))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+      break;
+    }
+    const ChunkType chunk_type = chunk.header.chunk_type();
+    const bool is_first_chunk = std::exchange(src_first_chunk, false);
+    const bool is_second_chunk = std::exchange(src_second_chunk, false);
+    if (is_first_chunk && chunk_type == ChunkType::kFileSignature) {
+      src_second_chunk = true;
+      if (first_file_) {
+        hash_type_ = internal::HashTypeOf(chunk.header.stored_header_hash());
+      } else {
+        continue;
+      }
+    }
+    if (is_second_chunk) {
+      // Metadata, if present, directly follow the file signature.
+      absl::optional<Chain> src_metadata;
+      if (chunk_type == ChunkType::kFileMetadata) src_metadata = chunk.data;
+      if (first_file_) {
+        metadata_ = std::move(src_metadata);
+      } else if (ABSL_PREDICT_FALSE(src_metadata != metadata_)) {
+        return absl::FailedPreconditionError(absl::StrCat(
+            "File metadata differ from metadata of the first file: ",
+            src_metadata == absl::nullopt ? "absent" : "present", " vs. ",
+            metadata_ == absl::nullopt ? "absent" : "present"));
+      }
+      if (chunk_type == ChunkType::kFileMetadata && !first_file_) continue;
+    }
+    if (chunk_type == ChunkType::kPadding ||
+        chunk_type == ChunkType::kChunkIndex ||
+        chunk_type == ChunkType::kFileSummary) {
+      continue;
+    }
+    if (options_.chunk_index()) {
+      chunk_index_.Add(dest_->pos(), chunk.header.num_records());
+    }
+    if (ABSL_PREDICT_FALSE(!dest_->WriteChunk(chunk))) return dest_->status();
+  }
+  if (ABSL_PREDICT_FALSE(!src.Close())) return src.status();
+  first_file_ = false;
+  if (options_.pad_to_block_boundary()) {
+    if (ABSL_PREDICT_FALSE(!dest_->PadToBlockBoundary())) {
+      return dest_->status();
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status RecordFileConcatenator::Finish() {
+  if (ABSL_PREDICT_FALSE(!dest_->healthy())) return dest_->status();
+  if (options_.chunk_index()) {
+    Chunk chunk;
+    chunk_index_.EncodeChunk(dest_->pos(), chunk, hash_type_);
+    if (ABSL_PREDICT_FALSE(!dest_->WriteChunk(chunk))) return dest_->status();
+    if (options_.pad_to_block_boundary()) {
+      if (ABSL_PREDICT_FALSE(!dest_->PadToBlockBoundary())) {
+        return dest_->status();
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ConcatenateRecordFiles(absl::Span<const std::string> src_filenames,
+                                    absl::string_view dest_filename,
+                                    RecordFileConcatenator::Options options) {
+  DefaultChunkWriter<FdWriter<>> dest(
+      std::forward_as_tuple(dest_filename, O_WRONLY | O_CREAT | O_TRUNC));
+  if (ABSL_PREDICT_FALSE(!dest.healthy())) return dest.status();
+  RecordFileConcatenator concatenator(&dest, std::move(options));
+  for (const std::string& src_filename : src_filenames) {
+    DefaultChunkReader<FdReader<>> src(
+        std::forward_as_tuple(src_filename, O_RDONLY));
+    const absl::Status status = concatenator.Append(src);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  {
+    const absl::Status status = concatenator.Finish();
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (ABSL_PREDICT_FALSE(!dest.Close())) return dest.status();
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
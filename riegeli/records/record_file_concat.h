@@ -0,0 +1,150 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_RECORD_FILE_CONCAT_H_
+#define RIEGELI_RECORDS_RECORD_FILE_CONCAT_H_
+
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/records/chunk_index.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/chunk_writer.h"
+
+namespace riegeli {
+
+// Appends chunks of Riegeli/records files to a `ChunkWriter`, copying
+// compressed chunks as they are, so that the result reads as one file with
+// the records of all files in order. Only block headers are recomputed for new
+// chunk positions, by the `ChunkWriter`.
+//
+// The result keeps the file signature and file metadata of the first file.
+// File signatures of later files are dropped. Their file metadata must be
+// byte-identical to those of the first file, because records could depend on
+// metadata, e.g. on a Zstd dictionary.
+//
+// Padding and chunk indices of appended files are dropped, because chunk
+// positions in an index would be wrong after concatenation.
+//
+// ```
+//   riegeli::RecordFileConcatenator concatenator(&chunk_writer);
+//   for (riegeli::ChunkReader& src : ...) {
+//     const absl::Status status = concatenator.Append(src);
+//     if (!status.ok()) ... Failed with reason: status
+//   }
+//   const absl::Status status = concatenator.Finish();
+// ```
+class RecordFileConcatenator {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // If `true`, padding is written after each appended file to reach a 64KB
+    // block boundary, like `RecordWriterBase::Options::pad_to_block_boundary()`
+    // does when a file is closed. This allows to append to the result
+    // physically later.
+    //
+    // Default: `false`.
+    Options& set_pad_to_block_boundary(bool pad_to_block_boundary) & {
+      pad_to_block_boundary_ = pad_to_block_boundary;
+      return *this;
+    }
+    Options&& set_pad_to_block_boundary(bool pad_to_block_boundary) && {
+      return std::move(set_pad_to_block_boundary(pad_to_block_boundary));
+    }
+    bool pad_to_block_boundary() const { return pad_to_block_boundary_; }
+
+    // If `true`, `Finish()` writes a chunk index of the result, like
+    // `RecordWriterBase::Options::set_chunk_index()`. Chunk keys are not
+    // preserved.
+    //
+    // Default: `false`.
+    Options& set_chunk_index(bool chunk_index) & {
+      chunk_index_ = chunk_index;
+      return *this;
+    }
+    Options&& set_chunk_index(bool chunk_index) && {
+      return std::move(set_chunk_index(chunk_index));
+    }
+    bool chunk_index() const { return chunk_index_; }
+
+   private:
+    bool pad_to_block_boundary_ = false;
+    bool chunk_index_ = false;
+  };
+
+  // Will append to `*dest`, which must outlive the `RecordFileConcatenator`.
+  //
+  // If `dest->pos() > 0`, `*dest` is assumed to already contain a file, and
+  // appended files are treated as if they were not first, but metadata are not
+  // checked against metadata already there.
+  explicit RecordFileConcatenator(ChunkWriter* dest,
+                                  Options options = Options());
+
+  RecordFileConcatenator(const RecordFileConcatenator&) = delete;
+  RecordFileConcatenator& operator=(const RecordFileConcatenator&) = delete;
+
+  // Appends chunks of the file read by `src`, from its current position, which
+  // should be the beginning of the file, to its end. Closes `src`.
+  //
+  // Returns status:
+  //  * `status.ok()`                         - success
+  //  * `absl::IsFailedPrecondition(status)` - metadata differ from the first
+  //                                           file (nothing is written)
+  //  * other `!status.ok()`                  - failure
+  absl::Status Append(ChunkReader& src);
+
+  // Writes the chunk index if requested. `*dest` is not closed.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success
+  //  * `!status.ok()` - failure
+  absl::Status Finish();
+
+ private:
+  ChunkWriter* dest_;
+  Options options_;
+  bool first_file_;
+  // Data of the metadata chunk of the first file, or `absl::nullopt` if it
+  // had none. Valid if `!first_file_`.
+  absl::optional<Chain> metadata_;
+  // Hash function of the first file, used for the chunk index.
+  HashType hash_type_ = HashType::kHighwayHash;
+  // Chunks with records written so far, if `options_.chunk_index()`.
+  ChunkIndex chunk_index_;
+};
+
+// Concatenates Riegeli/records files named by `src_filenames` into a new file
+// named by `dest_filename`, with `RecordFileConcatenator`.
+//
+// Returns status:
+//  * `status.ok()`  - success
+//  * `!status.ok()` - failure
+absl::Status ConcatenateRecordFiles(
+    absl::Span<const std::string> src_filenames,
+    absl::string_view dest_filename,
+    RecordFileConcatenator::Options options =
+        RecordFileConcatenator::Options());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_RECORD_FILE_CONCAT_H_
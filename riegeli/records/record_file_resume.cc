@@ -0,0 +1,109 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/record_file_resume.h"
+
+#include <fcntl.h>
+
+#include <tuple>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/records/block.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+absl::Status FindResumePosition(ChunkReader& src, Position& resume_pos) {
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) return src.status();
+  if (*size == 0) {
+    resume_pos = 0;
+    return absl::OkStatus();
+  }
+  // Begin with the last block boundary before the end of the file.
+  Position block_begin = internal::RoundDownToBlockBoundary(*size - 1);
+  Chunk chunk;
+  for (;;) {
+    if (src.SeekToChunkBefore(block_begin)) {
+      bool found = false;
+      Position valid_end = src.pos();
+      while (src.ReadChunk(chunk)) {
+        found = true;
+        valid_end = src.pos();
+      }
+      if (found) {
+        // Leave `src` healthy after the invalid tail.
+        if (!src.healthy()) src.Recover();
+        resume_pos = valid_end;
+        return absl::OkStatus();
+      }
+    }
+    // Invalid file contents are expected in the tail. Other failures, e.g.
+    // reading errors, are not recoverable.
+    if (!src.healthy() && ABSL_PREDICT_FALSE(!src.Recover())) {
+      return src.status();
+    }
+    if (block_begin == 0) break;
+    block_begin -= internal::kBlockSize;
+  }
+  if (*size < internal::BlockHeader::size() + ChunkHeader::size()) {
+    // The file signature is incomplete.
+    resume_pos = 0;
+    return absl::OkStatus();
+  }
+  return absl::DataLossError(
+      absl::StrCat("No valid chunk found in a file of size ", *size,
+                   ", it is probably not a Riegeli/records file"));
+}
+
+absl::Status ResumeRecordFile(absl::string_view filename,
+                              RecordWriter<FdWriter<>>& dest,
+                              RecordWriterBase::Options options) {
+  Position resume_pos = 0;
+  {
+    DefaultChunkReader<FdReader<>> src(
+        std::forward_as_tuple(filename, O_RDONLY));
+    if (src.healthy()) {
+      const absl::Status status = FindResumePosition(src, resume_pos);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+      // An incomplete tail is reported as a failure of `Close()`.
+      if (!src.Close() && ABSL_PREDICT_FALSE(!src.Recover())) {
+        return src.status();
+      }
+    } else if (ABSL_PREDICT_FALSE(!absl::IsNotFound(src.status()))) {
+      return src.status();
+    }
+  }
+  FdWriter<> writer(filename, O_WRONLY | O_CREAT);
+  if (ABSL_PREDICT_FALSE(!writer.Truncate(resume_pos))) {
+    if (ABSL_PREDICT_FALSE(!writer.healthy())) return writer.status();
+    return absl::FailedPreconditionError(
+        absl::StrCat("File shrank concurrently below ", resume_pos));
+  }
+  dest.Reset(std::move(writer), std::move(options));
+  if (ABSL_PREDICT_FALSE(!dest.healthy())) return dest.status();
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,76 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_RECORD_FILE_RESUME_H_
+#define RIEGELI_RECORDS_RECORD_FILE_RESUME_H_
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+// Finds the position where writing a Riegeli/records file can be resumed after
+// the writer was interrupted, e.g. by a crash: the end of the last valid chunk,
+// excluding an incomplete or corrupted tail.
+//
+// The search uses block headers to locate the last chunk boundary before each
+// block boundary (every 64KB), starting from the last block of the file and
+// moving backwards only while no valid chunk is found there. Chunks are read
+// and verified from that boundary to the end of the file, so the cost is
+// proportional to the size of a chunk or a block rather than of the file.
+//
+// `src` must support random access. It is not closed. If the tail is
+// truncated, `src.Close()` reports that and `src.Recover()` clears it.
+//
+// If the file has no valid chunk, `resume_pos` is set to 0 if the file is too
+// short to contain one, i.e. it is empty or ends within the file signature.
+// Otherwise this is reported as a failure, to avoid discarding a file which
+// is not a Riegeli/records file.
+//
+// Returns status:
+//  * `status.ok()`  - success (`resume_pos` is set)
+//  * `!status.ok()` - failure
+absl::Status FindResumePosition(ChunkReader& src, Position& resume_pos);
+
+// Opens the Riegeli/records file named by `filename` for resuming writing with
+// `dest`, truncating an incomplete or corrupted tail found by
+// `FindResumePosition()`. If the file does not exist, it is created.
+//
+// Records in the file before the resume position are kept. Records written to
+// `dest` follow them, as if the file was opened with `O_APPEND`, so options
+// which apply only to new files (file metadata, chunk index, file summary) are
+// effective only if the resume position is 0.
+//
+// ```
+//   riegeli::RecordWriter<riegeli::FdWriter<>> writer;
+//   const absl::Status status = riegeli::ResumeRecordFile(
+//       filename, writer, riegeli::RecordWriterBase::Options());
+//   if (!status.ok()) ... Failed with reason: status
+//   ... Write records to writer.
+// ```
+//
+// Returns status:
+//  * `status.ok()`  - success (`dest` is open)
+//  * `!status.ok()` - failure
+absl::Status ResumeRecordFile(
+    absl::string_view filename, RecordWriter<FdWriter<>>& dest,
+    RecordWriterBase::Options options = RecordWriterBase::Options());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_RECORD_FILE_RESUME_H_
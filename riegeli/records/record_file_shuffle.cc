@@ -0,0 +1,249 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/record_file_shuffle.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/endian/endian_reading.h"
+#include "riegeli/endian/endian_writing.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+// The finalizer of SplitMix64: a bijection of 64-bit integers with good
+// avalanche.
+inline uint64_t Mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+inline uint64_t RecordKey(uint64_t seed, size_t input_index,
+                          uint64_t record_index) {
+  return Mix(Mix(seed ^ Mix(IntCast<uint64_t>(input_index))) ^ record_index);
+}
+
+// Records of one output, spilled to a temporary file as they are scattered.
+// Each temporary record is the key in little endian followed by the record.
+struct Bucket {
+  std::string temp_filename;
+  absl::Mutex mutex;
+  RecordWriter<FdWriter<>> temp_writer ABSL_GUARDED_BY(mutex);
+  uint64_t size ABSL_GUARDED_BY(mutex) = 0;
+};
+
+// Calls `task(index)` for each `index` in [0, `size`), with up to
+// `parallelism` concurrent calls. Returns the first failure in the order of
+// indices.
+absl::Status RunInParallel(size_t size, int parallelism,
+                           absl::FunctionRef<absl::Status(size_t)> task) {
+  std::vector<absl::Status> statuses(size);
+  const size_t num_workers =
+      UnsignedMin(IntCast<size_t>(parallelism), size);
+  std::atomic<size_t> next_index(0);
+  absl::BlockingCounter workers(IntCast<int>(num_workers));
+  for (size_t worker = 0; worker < num_workers; ++worker) {
+    ThreadPool::global().Schedule([&] {
+      for (size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+           index < size;
+           index = next_index.fetch_add(1, std::memory_order_relaxed)) {
+        statuses[index] = task(index);
+      }
+      workers.DecrementCount();
+    });
+  }
+  workers.Wait();
+  for (absl::Status& status : statuses) {
+    if (ABSL_PREDICT_FALSE(!status.ok())) return std::move(status);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CreateTempFile(absl::string_view temp_directory,
+                            std::string& filename) {
+  filename = std::string(temp_directory);
+  if (filename.empty()) {
+    const char* const tmpdir = getenv("TMPDIR");
+    filename = tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
+  }
+  filename.append("/riegeli_shuffle_XXXXXX");
+  const int fd = mkstemp(&filename[0]);
+  if (ABSL_PREDICT_FALSE(fd < 0)) {
+    const int error_number = errno;
+    const absl::Status status = ErrnoToCanonicalStatus(
+        error_number, absl::StrCat("mkstemp() failed for ", filename));
+    filename.clear();
+    return status;
+  }
+  close(fd);
+  return absl::OkStatus();
+}
+
+// Appends records of `input_filename` to temporary files of their outputs.
+absl::Status ScatterFile(size_t input_index, const std::string& input_filename,
+                         const ShuffleRecordFilesOptions& options,
+                         absl::Span<const std::unique_ptr<Bucket>> buckets) {
+  RecordReader<FdReader<>> reader(
+      std::forward_as_tuple(input_filename, O_RDONLY));
+  absl::string_view record;
+  std::string temp_record;
+  uint64_t record_index = 0;
+  while (reader.ReadRecord(record)) {
+    const uint64_t key = RecordKey(options.seed(), input_index, record_index);
+    ++record_index;
+    Bucket& bucket = *buckets[key % buckets.size()];
+    temp_record.resize(sizeof(uint64_t));
+    WriteLittleEndian64(key, &temp_record[0]);
+    temp_record.append(record.data(), record.size());
+    absl::MutexLock lock(&bucket.mutex);
+    bucket.size += record.size();
+    if (ABSL_PREDICT_FALSE(bucket.size > options.max_output_size())) {
+      return absl::ResourceExhaustedError(absl::StrCat(
+          "Output too large for shuffling in memory, more outputs "
+          "are needed: more than ",
+          options.max_output_size(), " bytes"));
+    }
+    if (ABSL_PREDICT_FALSE(!bucket.temp_writer.WriteRecord(temp_record))) {
+      return bucket.temp_writer.status();
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!reader.Close())) return reader.status();
+  return absl::OkStatus();
+}
+
+// Reads the temporary file of `bucket`, sorts its records by keys, and writes
+// them to `output_filename`.
+absl::Status GatherFile(Bucket& bucket, const std::string& output_filename,
+                        const ShuffleRecordFilesOptions& options) {
+  struct Entry {
+    uint64_t key;
+    std::string record;
+  };
+  std::vector<Entry> entries;
+  {
+    absl::MutexLock lock(&bucket.mutex);
+    if (ABSL_PREDICT_FALSE(!bucket.temp_writer.Close())) {
+      return bucket.temp_writer.status();
+    }
+  }
+  RecordReader<FdReader<>> reader(
+      std::forward_as_tuple(bucket.temp_filename, O_RDONLY));
+  std::string temp_record;
+  while (reader.ReadRecord(temp_record)) {
+    if (ABSL_PREDICT_FALSE(temp_record.size() < sizeof(uint64_t))) {
+      return absl::DataLossError(
+          absl::StrCat("Truncated temporary record in ", bucket.temp_filename));
+    }
+    const uint64_t key = ReadLittleEndian64(temp_record.data());
+    temp_record.erase(0, sizeof(uint64_t));
+    entries.push_back(Entry{key, std::move(temp_record)});
+  }
+  if (ABSL_PREDICT_FALSE(!reader.Close())) return reader.status();
+  unlink(bucket.temp_filename.c_str());
+  // Keys of different records are almost always different. Comparing records
+  // too keeps the order deterministic otherwise.
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) {
+              return a.key != b.key ? a.key < b.key : a.record < b.record;
+            });
+  RecordWriter<FdWriter<>> writer(
+      std::forward_as_tuple(output_filename, O_WRONLY | O_CREAT | O_TRUNC),
+      options.output_options());
+  for (Entry& entry : entries) {
+    if (ABSL_PREDICT_FALSE(!writer.WriteRecord(std::move(entry.record)))) {
+      break;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!writer.Close())) return writer.status();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status ShuffleRecordFiles(absl::Span<const std::string> input_filenames,
+                                absl::Span<const std::string> output_filenames,
+                                const ShuffleRecordFilesOptions& options) {
+  RIEGELI_ASSERT(!output_filenames.empty())
+      << "Failed precondition of ShuffleRecordFiles(): no outputs";
+  std::vector<std::unique_ptr<Bucket>> buckets;
+  buckets.reserve(output_filenames.size());
+  absl::Status status;
+  for (size_t i = 0; i < output_filenames.size(); ++i) {
+    buckets.push_back(std::make_unique<Bucket>());
+    Bucket& bucket = *buckets.back();
+    status = CreateTempFile(options.temp_directory(), bucket.temp_filename);
+    if (ABSL_PREDICT_FALSE(!status.ok())) break;
+    absl::MutexLock lock(&bucket.mutex);
+    bucket.temp_writer.Reset(
+        std::forward_as_tuple(bucket.temp_filename, O_WRONLY | O_TRUNC),
+        options.temp_options());
+    if (ABSL_PREDICT_FALSE(!bucket.temp_writer.healthy())) {
+      status = bucket.temp_writer.status();
+      break;
+    }
+  }
+  if (ABSL_PREDICT_TRUE(status.ok())) {
+    status = RunInParallel(
+        input_filenames.size(), options.parallelism(), [&](size_t index) {
+          return ScatterFile(index, input_filenames[index], options, buckets);
+        });
+  }
+  if (ABSL_PREDICT_TRUE(status.ok())) {
+    status = RunInParallel(
+        output_filenames.size(), options.parallelism(), [&](size_t index) {
+          return GatherFile(*buckets[index], output_filenames[index], options);
+        });
+  }
+  for (const std::unique_ptr<Bucket>& bucket : buckets) {
+    {
+      absl::MutexLock lock(&bucket->mutex);
+      bucket->temp_writer.Close();
+    }
+    if (!bucket->temp_filename.empty()) unlink(bucket->temp_filename.c_str());
+  }
+  return status;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,191 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_RECORD_FILE_SHUFFLE_H_
+#define RIEGELI_RECORDS_RECORD_FILE_SHUFFLE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+class ShuffleRecordFilesOptions {
+ public:
+  ShuffleRecordFilesOptions() noexcept {}
+
+  // Sets the seed of the permutation. The same inputs shuffled with the same
+  // seed and the same number of outputs give the same outputs, independently
+  // of `parallelism()` and of timing of threads.
+  //
+  // Default: 0.
+  ShuffleRecordFilesOptions& set_seed(uint64_t seed) & {
+    seed_ = seed;
+    return *this;
+  }
+  ShuffleRecordFilesOptions&& set_seed(uint64_t seed) && {
+    return std::move(set_seed(seed));
+  }
+  uint64_t seed() const { return seed_; }
+
+  // Sets the maximum number of input files read concurrently, and of output
+  // files written concurrently.
+  //
+  // Default: 4.
+  ShuffleRecordFilesOptions& set_parallelism(int parallelism) & {
+    RIEGELI_ASSERT_GT(parallelism, 0)
+        << "Failed precondition of "
+           "ShuffleRecordFilesOptions::set_parallelism(): "
+           "non-positive parallelism";
+    parallelism_ = parallelism;
+    return *this;
+  }
+  ShuffleRecordFilesOptions&& set_parallelism(int parallelism) && {
+    return std::move(set_parallelism(parallelism));
+  }
+  int parallelism() const { return parallelism_; }
+
+  // Sets the maximum total size of records of one output file, which are
+  // shuffled in memory. Up to `parallelism()` outputs are held in memory at
+  // once. If an output would be larger, shuffling fails with
+  // `absl::ResourceExhaustedError()`; more outputs should be requested then.
+  //
+  // Default: 1G.
+  ShuffleRecordFilesOptions& set_max_output_size(uint64_t max_output_size) & {
+    max_output_size_ = max_output_size;
+    return *this;
+  }
+  ShuffleRecordFilesOptions&& set_max_output_size(
+      uint64_t max_output_size) && {
+    return std::move(set_max_output_size(max_output_size));
+  }
+  uint64_t max_output_size() const { return max_output_size_; }
+
+  // Sets the directory where records are spilled, one temporary file per
+  // output.
+  //
+  // Empty is interpreted as `$TMPDIR`, or `/tmp` if that is not set.
+  //
+  // Default: empty.
+  ShuffleRecordFilesOptions& set_temp_directory(
+      absl::string_view temp_directory) & {
+    temp_directory_ = std::string(temp_directory);
+    return *this;
+  }
+  ShuffleRecordFilesOptions&& set_temp_directory(
+      absl::string_view temp_directory) && {
+    return std::move(set_temp_directory(temp_directory));
+  }
+  const std::string& temp_directory() const { return temp_directory_; }
+
+  // Options for writing temporary files.
+  //
+  // Default: `RecordWriterBase::Options().set_uncompressed()
+  //               .set_chunk_size(uint64_t{256} << 10)`,
+  // because temporary files are read only once, and a chunk is buffered for
+  // each output at once.
+  ShuffleRecordFilesOptions& set_temp_options(
+      const RecordWriterBase::Options& temp_options) & {
+    temp_options_ = temp_options;
+    return *this;
+  }
+  ShuffleRecordFilesOptions& set_temp_options(
+      RecordWriterBase::Options&& temp_options) & {
+    temp_options_ = std::move(temp_options);
+    return *this;
+  }
+  ShuffleRecordFilesOptions&& set_temp_options(
+      const RecordWriterBase::Options& temp_options) && {
+    return std::move(set_temp_options(temp_options));
+  }
+  ShuffleRecordFilesOptions&& set_temp_options(
+      RecordWriterBase::Options&& temp_options) && {
+    return std::move(set_temp_options(std::move(temp_options)));
+  }
+  RecordWriterBase::Options& temp_options() { return temp_options_; }
+  const RecordWriterBase::Options& temp_options() const {
+    return temp_options_;
+  }
+
+  // Options for writing output files.
+  //
+  // Default: `RecordWriterBase::Options()`.
+  ShuffleRecordFilesOptions& set_output_options(
+      const RecordWriterBase::Options& output_options) & {
+    output_options_ = output_options;
+    return *this;
+  }
+  ShuffleRecordFilesOptions& set_output_options(
+      RecordWriterBase::Options&& output_options) & {
+    output_options_ = std::move(output_options);
+    return *this;
+  }
+  ShuffleRecordFilesOptions&& set_output_options(
+      const RecordWriterBase::Options& output_options) && {
+    return std::move(set_output_options(output_options));
+  }
+  ShuffleRecordFilesOptions&& set_output_options(
+      RecordWriterBase::Options&& output_options) && {
+    return std::move(set_output_options(std::move(output_options)));
+  }
+  RecordWriterBase::Options& output_options() { return output_options_; }
+  const RecordWriterBase::Options& output_options() const {
+    return output_options_;
+  }
+
+ private:
+  uint64_t seed_ = 0;
+  int parallelism_ = 4;
+  uint64_t max_output_size_ = uint64_t{1} << 30;
+  std::string temp_directory_;
+  RecordWriterBase::Options temp_options_ =
+      RecordWriterBase::Options().set_uncompressed().set_chunk_size(
+          uint64_t{256} << 10);
+  RecordWriterBase::Options output_options_;
+};
+
+// Shuffles records of Riegeli/records files named by `input_filenames` into
+// new files named by `output_filenames`, e.g. to prepare training data.
+//
+// Each record is assigned a pseudo-random 64-bit key derived from the seed,
+// the index of its input file, and its index in that file. The key selects
+// the output file, and orders records within an output file.
+//
+// In the first phase input files are read concurrently, and each record is
+// appended to a temporary file of its output. In the second phase output files
+// are written concurrently, each by reading its temporary file, sorting its
+// records by keys in memory, and writing them.
+//
+// Precondition: `!output_filenames.empty()`
+//
+// Returns status:
+//  * `status.ok()`                        - success
+//  * `absl::IsResourceExhausted(status)` - an output would exceed
+//                                          `options.max_output_size()`
+//  * other `!status.ok()`                 - failure
+absl::Status ShuffleRecordFiles(
+    absl::Span<const std::string> input_filenames,
+    absl::Span<const std::string> output_filenames,
+    const ShuffleRecordFilesOptions& options = ShuffleRecordFilesOptions());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_RECORD_FILE_SHUFFLE_H_
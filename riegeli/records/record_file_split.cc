@@ -0,0 +1,70 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/record_file_split.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+
+#include <tuple>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/chunk_reader.h"
+
+namespace riegeli {
+
+absl::Status SplitRecordFile(ChunkReader& src, size_t max_splits,
+                             std::vector<RecordFileSplit>& splits) {
+  RIEGELI_ASSERT_GT(max_splits, 0u)
+      << "Failed precondition of SplitRecordFile(): zero splits";
+  splits.clear();
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) return src.status();
+  const Position num_splits = IntCast<Position>(max_splits);
+  Position split_begin = 0;
+  for (Position i = 1; i < num_splits; ++i) {
+    // `*size * i / num_splits`, avoiding overflow.
+    const Position target =
+        *size / num_splits * i + *size % num_splits * i / num_splits;
+    if (target <= split_begin) continue;
+    if (ABSL_PREDICT_FALSE(!src.SeekToChunkAfter(target))) return src.status();
+    const Position split_end = UnsignedMin(src.pos(), *size);
+    if (split_end <= split_begin) continue;
+    splits.push_back(RecordFileSplit{split_begin, split_end});
+    split_begin = split_end;
+  }
+  if (split_begin < *size || splits.empty()) {
+    splits.push_back(RecordFileSplit{split_begin, *size});
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SplitRecordFile(absl::string_view filename, size_t max_splits,
+                             std::vector<RecordFileSplit>& splits,
+                             const FdReaderBase::Options& fd_reader_options) {
+  DefaultChunkReader<FdReader<>> src(
+      std::forward_as_tuple(filename, O_RDONLY, fd_reader_options));
+  const absl::Status status = SplitRecordFile(src, max_splits, splits);
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  if (ABSL_PREDICT_FALSE(!src.Close())) return src.status();
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
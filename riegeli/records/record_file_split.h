@@ -0,0 +1,64 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_RECORD_FILE_SPLIT_H_
+#define RIEGELI_RECORDS_RECORD_FILE_SPLIT_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/chunk_reader.h"
+
+namespace riegeli {
+
+// A range of a Riegeli/records file, for processing a part of the file
+// independently from other parts.
+//
+// Both ends are chunk boundaries. The records of the range are the records of
+// chunks beginning in [`begin`, `end`). They can be read with a `RecordReader`
+// with `RecordReaderBase::Options().set_end_pos(split.end)`, after
+// `Seek(split.begin)`.
+struct RecordFileSplit {
+  Position begin = 0;
+  Position end = 0;
+};
+
+// Splits a Riegeli/records file into at most `max_splits` ranges of similar
+// sizes, which together cover the whole file without sharing records.
+//
+// Splitting targets evenly spaced byte positions, and moves each of them to
+// the nearest chunk boundary at or after it using block headers, without
+// reading chunks in between. Ranges which would be empty because a chunk spans
+// several targets are omitted.
+//
+// Precondition: `max_splits > 0`
+//
+// Returns status:
+//  * `status.ok()`  - success (`splits` is set)
+//  * `!status.ok()` - failure
+absl::Status SplitRecordFile(ChunkReader& src, size_t max_splits,
+                             std::vector<RecordFileSplit>& splits);
+absl::Status SplitRecordFile(
+    absl::string_view filename, size_t max_splits,
+    std::vector<RecordFileSplit>& splits,
+    const FdReaderBase::Options& fd_reader_options = FdReaderBase::Options());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_RECORD_FILE_SPLIT_H_
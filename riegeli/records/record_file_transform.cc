@@ -0,0 +1,314 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/record_file_transform.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+// Consecutive records passed between stages of the pipeline together.
+struct Batch {
+  // Records read, replaced in place by transformed records.
+  std::vector<std::string> records;
+  // Failure of the transform, after which the remaining records of the batch
+  // are not transformed.
+  absl::Status status;
+  bool transformed = false;
+};
+
+class TransformPipeline {
+ public:
+  explicit TransformPipeline(const RecordTransform& transform,
+                             const TransformRecordsOptions& options)
+      : transform_(transform), options_(options) {}
+
+  TransformPipeline(const TransformPipeline&) = delete;
+  TransformPipeline& operator=(const TransformPipeline&) = delete;
+
+  absl::Status Run(RecordReaderBase& src, RecordWriterBase& dest);
+
+ private:
+  // Reads batches from `src` until its end or cancellation.
+  void ReadBatches(RecordReaderBase& src);
+  // Transforms batches until there are no more.
+  void TransformBatches();
+  // Writes transformed batches to `dest` in order until there are no more.
+  absl::Status WriteBatches(RecordWriterBase& dest);
+
+  bool CanRead() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool CanTransform() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool CanWrite() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const RecordTransform& transform_;
+  const TransformRecordsOptions& options_;
+
+  absl::Mutex mutex_;
+  // Batches read but not written yet, in order.
+  std::deque<std::unique_ptr<Batch>> pending_ ABSL_GUARDED_BY(mutex_);
+  // Batches in `pending_` not taken for transforming yet, in order.
+  std::deque<Batch*> to_transform_ ABSL_GUARDED_BY(mutex_);
+  // Batches already written, kept to reuse memory allocated for records.
+  std::vector<std::unique_ptr<Batch>> free_batches_ ABSL_GUARDED_BY(mutex_);
+  // No more batches will be added to `pending_`.
+  bool reading_done_ ABSL_GUARDED_BY(mutex_) = false;
+  // Writing failed, remaining work should be abandoned.
+  bool cancelled_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+inline bool TransformPipeline::CanRead() const {
+  return cancelled_ || pending_.size() < options_.max_pending_batches();
+}
+
+inline bool TransformPipeline::CanTransform() const {
+  return cancelled_ || reading_done_ || !to_transform_.empty();
+}
+
+inline bool TransformPipeline::CanWrite() const {
+  return cancelled_ || (pending_.empty() ? reading_done_
+                                         : pending_.front()->transformed);
+}
+
+absl::Status TransformPipeline::Run(RecordReaderBase& src,
+                                    RecordWriterBase& dest) {
+  absl::BlockingCounter tasks(options_.parallelism() + 1);
+  ThreadPool::global().Schedule([&] {
+    ReadBatches(src);
+    tasks.DecrementCount();
+  });
+  for (int i = 0; i < options_.parallelism(); ++i) {
+    ThreadPool::global().Schedule([&] {
+      TransformBatches();
+      tasks.DecrementCount();
+    });
+  }
+  const absl::Status status = WriteBatches(dest);
+  tasks.Wait();
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  // Records read before a failure of `src` have been written.
+  if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+  return absl::OkStatus();
+}
+
+void TransformPipeline::ReadBatches(RecordReaderBase& src) {
+  for (;;) {
+    std::unique_ptr<Batch> batch;
+    {
+      absl::MutexLock lock(&mutex_,
+                           absl::Condition(this, &TransformPipeline::CanRead));
+      if (cancelled_) break;
+      if (free_batches_.empty()) {
+        batch = std::make_unique<Batch>();
+      } else {
+        batch = std::move(free_batches_.back());
+        free_batches_.pop_back();
+        batch->status = absl::OkStatus();
+        batch->transformed = false;
+      }
+    }
+    // Records keep their allocated capacity from a previous batch.
+    batch->records.resize(options_.batch_size());
+    size_t num_records = 0;
+    while (num_records < batch->records.size() &&
+           src.ReadRecord(batch->records[num_records])) {
+      ++num_records;
+    }
+    batch->records.resize(num_records);
+    absl::MutexLock lock(&mutex_);
+    if (num_records > 0) {
+      to_transform_.push_back(batch.get());
+      pending_.push_back(std::move(batch));
+    }
+    if (num_records < options_.batch_size()) break;
+  }
+  absl::MutexLock lock(&mutex_);
+  reading_done_ = true;
+}
+
+void TransformPipeline::TransformBatches() {
+  std::string dest;
+  for (;;) {
+    Batch* batch;
+    {
+      absl::MutexLock lock(
+          &mutex_, absl::Condition(this, &TransformPipeline::CanTransform));
+      if (cancelled_ || to_transform_.empty()) return;
+      batch = to_transform_.front();
+      to_transform_.pop_front();
+    }
+    for (std::string& record : batch->records) {
+      dest.clear();
+      absl::Status status = transform_(record, dest);
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        batch->status = std::move(status);
+        break;
+      }
+      // The previous buffer of `record` is reused for the next `dest`.
+      record.swap(dest);
+    }
+    absl::MutexLock lock(&mutex_);
+    batch->transformed = true;
+  }
+}
+
+absl::Status TransformPipeline::WriteBatches(RecordWriterBase& dest) {
+  absl::Status status;
+  for (;;) {
+    std::unique_ptr<Batch> batch;
+    {
+      absl::MutexLock lock(&mutex_,
+                           absl::Condition(this, &TransformPipeline::CanWrite));
+      if (pending_.empty()) break;
+      batch = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    if (ABSL_PREDICT_FALSE(!batch->status.ok())) {
+      status = std::move(batch->status);
+    } else {
+      for (const std::string& record : batch->records) {
+        if (ABSL_PREDICT_FALSE(!dest.WriteRecord(record))) {
+          status = dest.status();
+          break;
+        }
+      }
+    }
+    absl::MutexLock lock(&mutex_);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      cancelled_ = true;
+      break;
+    }
+    free_batches_.push_back(std::move(batch));
+  }
+  return status;
+}
+
+}  // namespace
+
+absl::Status TransformRecords(RecordReaderBase& src, RecordWriterBase& dest,
+                              const RecordTransform& transform,
+                              const TransformRecordsOptions& options) {
+  TransformPipeline pipeline(transform, options);
+  return pipeline.Run(src, dest);
+}
+
+absl::Status TransformRecordFile(absl::string_view src_filename,
+                                 absl::string_view dest_filename,
+                                 const RecordTransform& transform,
+                                 const TransformRecordsOptions& options) {
+  RecordReader<FdReader<>> reader(std::forward_as_tuple(src_filename, O_RDONLY),
+                                  options.reader_options());
+  RecordWriter<FdWriter<>> writer(
+      std::forward_as_tuple(dest_filename, O_WRONLY | O_CREAT | O_TRUNC),
+      options.writer_options());
+  absl::Status status = TransformRecords(reader, writer, transform, options);
+  if (ABSL_PREDICT_FALSE(!writer.Close()) && status.ok()) {
+    status = writer.status();
+  }
+  if (ABSL_PREDICT_FALSE(!reader.Close()) && status.ok()) {
+    status = reader.status();
+  }
+  return status;
+}
+
+absl::Status FilterRecords(ChunkReader& src, RecordWriterBase& dest,
+                           const RecordPredicate& keep) {
+  ChunkDecoder chunk_decoder;
+  Chunk chunk;
+  absl::string_view record;
+  // Whether each record of the current chunk is kept.
+  std::vector<bool> kept;
+  while (src.ReadChunk(chunk)) {
+    if (chunk.header.chunk_type() != ChunkType::kSimple &&
+        chunk.header.chunk_type() != ChunkType::kTransposed &&
+        chunk.header.chunk_type() != ChunkType::kDeduplicated) {
+      continue;
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_decoder.Decode(chunk))) {
+      return chunk_decoder.status();
+    }
+    kept.clear();
+    bool all_kept = true;
+    while (chunk_decoder.ReadRecord(record)) {
+      const bool keep_record = keep(record);
+      kept.push_back(keep_record);
+      all_kept &= keep_record;
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_decoder.healthy())) {
+      return chunk_decoder.status();
+    }
+    if (all_kept) {
+      if (ABSL_PREDICT_FALSE(!dest.WriteChunk(chunk))) return dest.status();
+      continue;
+    }
+    chunk_decoder.SetIndex(0);
+    for (const bool keep_record : kept) {
+      chunk_decoder.ReadRecord(record);
+      if (keep_record) {
+        if (ABSL_PREDICT_FALSE(!dest.WriteRecord(record))) {
+          return dest.status();
+        }
+      }
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+  return absl::OkStatus();
+}
+
+absl::Status FilterRecordFile(absl::string_view src_filename,
+                              absl::string_view dest_filename,
+                              const RecordPredicate& keep,
+                              RecordWriterBase::Options writer_options) {
+  DefaultChunkReader<FdReader<>> reader(
+      std::forward_as_tuple(src_filename, O_RDONLY));
+  RecordWriter<FdWriter<>> writer(
+      std::forward_as_tuple(dest_filename, O_WRONLY | O_CREAT | O_TRUNC),
+      std::move(writer_options));
+  absl::Status status = FilterRecords(reader, writer, keep);
+  if (ABSL_PREDICT_FALSE(!writer.Close()) && status.ok()) {
+    status = writer.status();
+  }
+  if (ABSL_PREDICT_FALSE(!reader.Close()) && status.ok()) {
+    status = reader.status();
+  }
+  return status;
+}
+
+}  // namespace riegeli
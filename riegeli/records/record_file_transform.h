@@ -0,0 +1,239 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_RECORD_FILE_TRANSFORM_H_
+#define RIEGELI_RECORDS_RECORD_FILE_TRANSFORM_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+// Computes the transformed value of a record, replacing `dest`, which is
+// cleared before the call.
+//
+// It is called concurrently from multiple threads, for different records.
+//
+// Returns status:
+//  * `status.ok()`  - success (`dest` is set)
+//  * `!status.ok()` - failure, which stops the transformation
+using RecordTransform =
+    std::function<absl::Status(absl::string_view src, std::string& dest)>;
+
+class TransformRecordsOptions {
+ public:
+  TransformRecordsOptions() noexcept {}
+
+  // Sets the number of threads calling the transform concurrently. Reading and
+  // writing use one more thread each, besides background threads of the
+  // `RecordReader` and `RecordWriter` if their parallelism is enabled.
+  //
+  // Default: 4.
+  TransformRecordsOptions& set_parallelism(int parallelism) & {
+    RIEGELI_ASSERT_GT(parallelism, 0)
+        << "Failed precondition of "
+           "TransformRecordsOptions::set_parallelism(): "
+           "non-positive parallelism";
+    parallelism_ = parallelism;
+    return *this;
+  }
+  TransformRecordsOptions&& set_parallelism(int parallelism) && {
+    return std::move(set_parallelism(parallelism));
+  }
+  int parallelism() const { return parallelism_; }
+
+  // Sets the number of consecutive records passed between threads together.
+  // Larger batches reduce synchronization overhead; smaller batches reduce
+  // memory usage and balance uneven transform costs better.
+  //
+  // Default: 64.
+  TransformRecordsOptions& set_batch_size(size_t batch_size) & {
+    RIEGELI_ASSERT_GT(batch_size, 0u)
+        << "Failed precondition of "
+           "TransformRecordsOptions::set_batch_size(): "
+           "zero batch size";
+    batch_size_ = batch_size;
+    return *this;
+  }
+  TransformRecordsOptions&& set_batch_size(size_t batch_size) && {
+    return std::move(set_batch_size(batch_size));
+  }
+  size_t batch_size() const { return batch_size_; }
+
+  // Sets the maximum number of batches which have been read but not written
+  // yet. This bounds memory usage when one stage is slower than the others.
+  // It should be larger than `parallelism()`, so that a batch transformed
+  // slowly does not prevent other threads from transforming further batches.
+  //
+  // Default: 16.
+  TransformRecordsOptions& set_max_pending_batches(
+      size_t max_pending_batches) & {
+    RIEGELI_ASSERT_GT(max_pending_batches, 0u)
+        << "Failed precondition of "
+           "TransformRecordsOptions::set_max_pending_batches(): "
+           "zero pending batches";
+    max_pending_batches_ = max_pending_batches;
+    return *this;
+  }
+  TransformRecordsOptions&& set_max_pending_batches(
+      size_t max_pending_batches) && {
+    return std::move(set_max_pending_batches(max_pending_batches));
+  }
+  size_t max_pending_batches() const { return max_pending_batches_; }
+
+  // Options for reading the input file. Used only by `TransformRecordFile()`.
+  //
+  // Default: `RecordReaderBase::Options().set_parallelism(2)`, so that chunks
+  // are decoded in background.
+  TransformRecordsOptions& set_reader_options(
+      const RecordReaderBase::Options& reader_options) & {
+    reader_options_ = reader_options;
+    return *this;
+  }
+  TransformRecordsOptions& set_reader_options(
+      RecordReaderBase::Options&& reader_options) & {
+    reader_options_ = std::move(reader_options);
+    return *this;
+  }
+  TransformRecordsOptions&& set_reader_options(
+      const RecordReaderBase::Options& reader_options) && {
+    return std::move(set_reader_options(reader_options));
+  }
+  TransformRecordsOptions&& set_reader_options(
+      RecordReaderBase::Options&& reader_options) && {
+    return std::move(set_reader_options(std::move(reader_options)));
+  }
+  RecordReaderBase::Options& reader_options() { return reader_options_; }
+  const RecordReaderBase::Options& reader_options() const {
+    return reader_options_;
+  }
+
+  // Options for writing the output file. Used only by `TransformRecordFile()`.
+  //
+  // Default: `RecordWriterBase::Options().set_parallelism(2)`, so that chunks
+  // are encoded in background.
+  TransformRecordsOptions& set_writer_options(
+      const RecordWriterBase::Options& writer_options) & {
+    writer_options_ = writer_options;
+    return *this;
+  }
+  TransformRecordsOptions& set_writer_options(
+      RecordWriterBase::Options&& writer_options) & {
+    writer_options_ = std::move(writer_options);
+    return *this;
+  }
+  TransformRecordsOptions&& set_writer_options(
+      const RecordWriterBase::Options& writer_options) && {
+    return std::move(set_writer_options(writer_options));
+  }
+  TransformRecordsOptions&& set_writer_options(
+      RecordWriterBase::Options&& writer_options) && {
+    return std::move(set_writer_options(std::move(writer_options)));
+  }
+  RecordWriterBase::Options& writer_options() { return writer_options_; }
+  const RecordWriterBase::Options& writer_options() const {
+    return writer_options_;
+  }
+
+ private:
+  int parallelism_ = 4;
+  size_t batch_size_ = 64;
+  size_t max_pending_batches_ = 16;
+  RecordReaderBase::Options reader_options_ =
+      RecordReaderBase::Options().set_parallelism(2);
+  RecordWriterBase::Options writer_options_ =
+      RecordWriterBase::Options().set_parallelism(2);
+};
+
+// Reads records from `src` until its end, transforms them with `transform`,
+// and writes the results to `dest` in the same order.
+//
+// Reading, transforming, and writing run concurrently as a pipeline: one
+// thread reads batches of records, `options.parallelism()` threads transform
+// them, and the calling thread writes them. Batches pass between stages
+// through a queue bounded by `options.max_pending_batches()`.
+//
+// `src` and `dest` are not closed.
+//
+// Returns status:
+//  * `status.ok()`  - success (all records of `src` have been written)
+//  * `!status.ok()` - failure of `transform`, `dest`, or `src`, the first one
+//                     in the order of records
+absl::Status TransformRecords(
+    RecordReaderBase& src, RecordWriterBase& dest,
+    const RecordTransform& transform,
+    const TransformRecordsOptions& options = TransformRecordsOptions());
+
+// Reads records of the Riegeli/records file named by `src_filename`, transforms
+// them with `transform`, and writes the results to a new file named by
+// `dest_filename`, with `TransformRecords()`.
+//
+// Returns status:
+//  * `status.ok()`  - success
+//  * `!status.ok()` - failure
+absl::Status TransformRecordFile(
+    absl::string_view src_filename, absl::string_view dest_filename,
+    const RecordTransform& transform,
+    const TransformRecordsOptions& options = TransformRecordsOptions());
+
+// Returns `true` if a record should be kept by `FilterRecords()`.
+using RecordPredicate = std::function<bool(absl::string_view record)>;
+
+// Reads chunks of `src` until its end, and writes to `dest` the records for
+// which `keep` returns `true`, in the same order.
+//
+// A chunk whose records are all kept is copied as it is with
+// `RecordWriterBase::WriteChunk()`, without encoding and compressing its
+// records again. Only kept records of other chunks are written with
+// `RecordWriterBase::WriteRecord()`, encoded according to options of `dest`.
+// This makes filtering which drops few records much faster than
+// `TransformRecords()`.
+//
+// Chunks of `src` other than chunks of records are skipped, so file metadata
+// of `dest` are specified by its options. Chunks of `src` must not depend on
+// its file metadata, e.g. on a Zstd dictionary.
+//
+// `src` and `dest` are not closed.
+//
+// Returns status:
+//  * `status.ok()`  - success (all kept records of `src` have been written)
+//  * `!status.ok()` - failure of `src` or `dest`
+absl::Status FilterRecords(ChunkReader& src, RecordWriterBase& dest,
+                           const RecordPredicate& keep);
+
+// Reads records of the Riegeli/records file named by `src_filename`, and writes
+// the records for which `keep` returns `true` to a new file named by
+// `dest_filename` with `writer_options`, with `FilterRecords()`.
+//
+// Returns status:
+//  * `status.ok()`  - success
+//  * `!status.ok()` - failure
+absl::Status FilterRecordFile(
+    absl::string_view src_filename, absl::string_view dest_filename,
+    const RecordPredicate& keep,
+    RecordWriterBase::Options writer_options = RecordWriterBase::Options());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_RECORD_FILE_TRANSFORM_H_
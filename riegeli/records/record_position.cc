@@ -17,8 +17,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
 #include <cstring>
 #include <future>
+#include <iterator>
 #include <limits>
 #include <memory>
 #include <ostream>
@@ -30,12 +32,16 @@
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "absl/types/variant.h"
 #include "riegeli/base/base.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/endian/endian_reading.h"
 #include "riegeli/endian/endian_writing.h"
 #include "riegeli/records/block.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
 
 namespace riegeli {
 
@@ -91,6 +97,82 @@ std::ostream& operator<<(std::ostream& out, RecordPosition pos) {
   return out << pos.ToString();
 }
 
+std::string EncodeRecordPositions(absl::Span<const RecordPosition> positions) {
+  RIEGELI_ASSERT(std::is_sorted(positions.begin(), positions.end()))
+      << "Failed precondition of EncodeRecordPositions(): "
+         "positions not sorted";
+  // Returns the value stored for `record_index`.
+  const auto record_index_delta = [](RecordPosition prev, RecordPosition pos) {
+    return pos.chunk_begin() == prev.chunk_begin()
+               ? pos.record_index() - prev.record_index()
+               : pos.record_index();
+  };
+  // Compute the exact size first, to avoid overallocating for many positions.
+  size_t size = LengthVarint64(IntCast<uint64_t>(positions.size()));
+  RecordPosition prev;
+  for (const RecordPosition pos : positions) {
+    size += LengthVarint64(pos.chunk_begin() - prev.chunk_begin()) +
+            LengthVarint64(record_index_delta(prev, pos));
+    prev = pos;
+  }
+  std::string serialized(size, '\0');
+  char* cursor = WriteVarint64(IntCast<uint64_t>(positions.size()),
+                               &serialized[0]);
+  prev = RecordPosition();
+  for (const RecordPosition pos : positions) {
+    cursor = WriteVarint64(pos.chunk_begin() - prev.chunk_begin(), cursor);
+    cursor = WriteVarint64(record_index_delta(prev, pos), cursor);
+    prev = pos;
+  }
+  RIEGELI_ASSERT_EQ(PtrDistance(serialized.data(), cursor), size)
+      << "Encoded positions have unexpected size";
+  return serialized;
+}
+
+bool DecodeRecordPositions(absl::string_view serialized,
+                           std::vector<RecordPosition>& dest) {
+  dest.clear();
+  const char* cursor = serialized.data();
+  const char* const limit = serialized.data() + serialized.size();
+  const absl::optional<ReadFromStringResult<uint64_t>> num_positions =
+      ReadVarint64(cursor, limit);
+  if (ABSL_PREDICT_FALSE(num_positions == absl::nullopt)) return false;
+  cursor = num_positions->cursor;
+  // Each position takes at least 2 bytes, which bounds the allocation even if
+  // `num_positions` is invalid.
+  dest.reserve(UnsignedMin(num_positions->value,
+                           IntCast<uint64_t>(PtrDistance(cursor, limit) / 2)));
+  RecordPosition prev;
+  for (uint64_t i = 0; i < num_positions->value; ++i) {
+    const absl::optional<ReadFromStringResult<uint64_t>> chunk_begin_delta =
+        ReadVarint64(cursor, limit);
+    if (ABSL_PREDICT_FALSE(chunk_begin_delta == absl::nullopt)) return false;
+    cursor = chunk_begin_delta->cursor;
+    const absl::optional<ReadFromStringResult<uint64_t>> record_index =
+        ReadVarint64(cursor, limit);
+    if (ABSL_PREDICT_FALSE(record_index == absl::nullopt)) return false;
+    cursor = record_index->cursor;
+    if (ABSL_PREDICT_FALSE(chunk_begin_delta->value >
+                           std::numeric_limits<uint64_t>::max() -
+                               prev.chunk_begin())) {
+      return false;
+    }
+    const uint64_t chunk_begin = prev.chunk_begin() + chunk_begin_delta->value;
+    uint64_t record_index_base = 0;
+    if (chunk_begin_delta->value == 0) {
+      record_index_base = prev.record_index();
+    }
+    if (ABSL_PREDICT_FALSE(record_index->value >
+                           std::numeric_limits<uint64_t>::max() - chunk_begin -
+                               record_index_base)) {
+      return false;
+    }
+    prev = RecordPosition(chunk_begin, record_index_base + record_index->value);
+    dest.push_back(prev);
+  }
+  return cursor == limit;
+}
+
 inline FutureRecordPosition::FutureChunkBegin::FutureChunkBegin(
     Position pos_before_chunks, std::vector<Action> actions)
     : pos_before_chunks_(pos_before_chunks), actions_(std::move(actions)) {}
@@ -129,4 +211,46 @@ FutureRecordPosition::FutureRecordPosition(Position pos_before_chunks,
       chunk_begin_(pos_before_chunks),
       record_index_(record_index) {}
 
+void FutureRecordPositions::Clear() {
+  runs_.clear();
+  size_ = 0;
+}
+
+void FutureRecordPositions::Add(FutureRecordPosition first,
+                                uint64_t num_records) {
+  if (num_records == 0) return;
+  size_ += IntCast<size_t>(num_records);
+  runs_.push_back(Run{std::move(first), size_});
+}
+
+RecordPosition FutureRecordPositions::get(size_t index) const {
+  RIEGELI_ASSERT_LT(index, size_)
+      << "Failed precondition of FutureRecordPositions::get(): "
+         "index out of range";
+  const std::vector<Run>::const_iterator run =
+      std::upper_bound(runs_.begin(), runs_.end(), index,
+                       [](size_t index, const Run& run) {
+                         return index < run.end;
+                       });
+  const size_t run_begin = run == runs_.begin() ? 0 : std::prev(run)->end;
+  const RecordPosition first = run->first.get();
+  return RecordPosition(first.chunk_begin(),
+                        first.record_index() + (index - run_begin));
+}
+
+std::vector<RecordPosition> FutureRecordPositions::GetAll() const {
+  std::vector<RecordPosition> positions;
+  positions.reserve(size_);
+  size_t run_begin = 0;
+  for (const Run& run : runs_) {
+    const RecordPosition first = run.first.get();
+    for (size_t index = run_begin; index < run.end; ++index) {
+      positions.emplace_back(first.chunk_begin(),
+                             first.record_index() + (index - run_begin));
+    }
+    run_begin = run.end;
+  }
+  return positions;
+}
+
 }  // namespace riegeli
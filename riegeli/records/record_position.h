@@ -15,6 +15,7 @@
 #ifndef RIEGELI_RECORDS_RECORD_POSITION_H_
 #define RIEGELI_RECORDS_RECORD_POSITION_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <future>
@@ -27,6 +28,7 @@
 
 #include "absl/base/call_once.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "absl/types/variant.h"
 #include "riegeli/base/base.h"
 #include "riegeli/chunk_encoding/chunk.h"
@@ -97,6 +99,24 @@ class RecordPosition {
   uint64_t record_index_ = 0;
 };
 
+// Encodes sorted `positions` compactly: each `chunk_begin` as a varint delta
+// from the previous one, and each `record_index` as a varint delta from the
+// previous one in the same chunk, or as a plain varint in a new chunk. This
+// suits storing many positions, e.g. in posting lists, where neighboring
+// positions tend to share a chunk. Typically a position takes 2 or 3 bytes
+// instead of 16 bytes of `RecordPosition::ToBytes()`.
+//
+// Precondition: `positions` are sorted
+std::string EncodeRecordPositions(absl::Span<const RecordPosition> positions);
+
+// Decodes positions encoded by `EncodeRecordPositions()`, replacing `dest`.
+//
+// Return values:
+//  * `true`  - success
+//  * `false` - failure (`dest` is unspecified)
+bool DecodeRecordPositions(absl::string_view serialized,
+                           std::vector<RecordPosition>& dest);
+
 // `FutureRecordPosition` is similar to `std::shared_future<RecordPosition>`.
 //
 // `RecordWriter` returns `FutureRecordPosition` instead of `RecordPosition`
@@ -140,6 +160,57 @@ class FutureRecordPosition {
   uint64_t record_index_ = 0;
 };
 
+// `FutureRecordPositions` holds positions of a batch of records, as returned
+// by `RecordWriterBase::WriteRecords()`.
+//
+// Consecutive records of the batch which fall into the same chunk share a
+// single `FutureRecordPosition` of the first of them, instead of needing one
+// per record.
+class FutureRecordPositions {
+ public:
+  FutureRecordPositions() noexcept {}
+
+  FutureRecordPositions(const FutureRecordPositions& that) = default;
+  FutureRecordPositions& operator=(const FutureRecordPositions& that) = default;
+
+  FutureRecordPositions(FutureRecordPositions&& that) noexcept = default;
+  FutureRecordPositions& operator=(FutureRecordPositions&& that) noexcept =
+      default;
+
+  // Makes `*this` equivalent to a newly constructed `FutureRecordPositions`.
+  void Clear();
+
+  // Appends positions of `num_records` consecutive records of a chunk, the
+  // first of them at `first`.
+  void Add(FutureRecordPosition first, uint64_t num_records);
+
+  // Returns the number of positions.
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns the position with the given index.
+  //
+  // May block if returned by `RecordWriter` with `parallelism > 0`.
+  //
+  // Precondition: `index < size()`
+  RecordPosition get(size_t index) const;
+
+  // Returns all positions, in order.
+  //
+  // May block if returned by `RecordWriter` with `parallelism > 0`.
+  std::vector<RecordPosition> GetAll() const;
+
+ private:
+  struct Run {
+    FutureRecordPosition first;
+    // Index of the position after the last position of this run.
+    size_t end;
+  };
+
+  std::vector<Run> runs_;
+  size_t size_ = 0;
+};
+
 // Implementation details follow.
 
 inline RecordPosition::RecordPosition(uint64_t chunk_begin,
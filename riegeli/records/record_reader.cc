@@ -17,43 +17,226 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <deque>
 #include <functional>
+#include <future>
+#include <limits>
+#include <list>
 #include <memory>
+#include <numeric>
+#include <random>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
 #include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/compare.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/dynamic_message.h"
 #include "google/protobuf/message.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/binary_search.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/memory_budget.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/simple_decoder.h"
 #include "riegeli/chunk_encoding/transpose_decoder.h"
 #include "riegeli/messages/message_parse.h"
+#include "riegeli/records/block.h"
+#include "riegeli/records/chunk_index.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/records_metadata.pb.h"
 #include "riegeli/records/skipped_region.h"
+#include "riegeli/records/trace_sink.h"
 
 namespace riegeli {
 
+namespace {
+
+// Returns the amount of memory to reserve for reading and decoding a chunk with
+// this header: the chunk data, and the decoded records.
+size_t ChunkMemorySize(const ChunkHeader& chunk_header) {
+  return IntCast<size_t>(UnsignedMin(
+      SaturatingAdd(chunk_header.data_size(), chunk_header.decoded_data_size()),
+      uint64_t{std::numeric_limits<size_t>::max()}));
+}
+
+// The position of the file metadata chunk, which can only directly follow the
+// file signature chunk at the beginning of the file.
+constexpr Position kFileMetadataBegin =
+    internal::BlockHeader::size() + ChunkHeader::size();
+
+// Decodes the serialized `RecordsMetadata` from the file metadata chunk.
+absl::Status DecodeMetadata(const Chunk& chunk, Chain& metadata) {
+  RIEGELI_ASSERT(chunk.header.chunk_type() == ChunkType::kFileMetadata)
+      << "Failed precondition of DecodeMetadata(): wrong chunk type";
+  if (ABSL_PREDICT_FALSE(chunk.header.num_records() != 0)) {
+    return absl::DataLossError(absl::StrCat(
+        "Invalid file metadata chunk: number of records is not zero: ",
+        chunk.header.num_records()));
+  }
+  ChainReader<> data_reader(&chunk.data);
+  TransposeDecoder transpose_decoder;
+  ChainBackwardWriter<> serialized_metadata_writer(
+      &metadata, ChainBackwardWriterBase::Options().set_size_hint(
+                     chunk.header.decoded_data_size()));
+  std::vector<size_t> limits;
+  const bool ok = transpose_decoder.Decode(1, chunk.header.decoded_data_size(),
+                                           FieldProjection::All(), data_reader,
+                                           serialized_metadata_writer, limits);
+  if (ABSL_PREDICT_FALSE(!serialized_metadata_writer.Close())) {
+    return serialized_metadata_writer.status();
+  }
+  if (ABSL_PREDICT_FALSE(!ok)) return transpose_decoder.status();
+  if (ABSL_PREDICT_FALSE(!data_reader.VerifyEndAndClose())) {
+    return data_reader.status();
+  }
+  RIEGELI_ASSERT_EQ(limits.size(), 1u)
+      << "Metadata chunk has unexpected record limits";
+  RIEGELI_ASSERT_EQ(limits.back(), metadata.size())
+      << "Metadata chunk has unexpected record limits";
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+RecordReaderStats& RecordReaderStats::operator+=(
+    const RecordReaderStats& that) {
+  num_records += that.num_records;
+  num_chunks += that.num_chunks;
+  num_cached_chunks += that.num_cached_chunks;
+  num_compressed_bytes += that.num_compressed_bytes;
+  num_decoded_bytes += that.num_decoded_bytes;
+  num_recoveries += that.num_recoveries;
+  hash_time += that.hash_time;
+  decode_time += that.decode_time;
+  chunk_reader += that.chunk_reader;
+  return *this;
+}
+
+namespace {
+
+// The maximum number of descriptor pools kept by
+// `RecordsMetadataDescriptors::PoolCache::global()`.
+constexpr size_t kMaxCachedPools = 64;
+
+}  // namespace
+
+struct RecordsMetadataDescriptors::Pool {
+  google::protobuf::DescriptorPool pool;
+  // Creates dynamic messages of types from `pool`. It is thread-safe, so it can
+  // be used through a const `Pool`.
+  mutable google::protobuf::DynamicMessageFactory factory{&pool};
+};
+
+// An LRU cache of successfully built descriptor pools, keyed by serialized file
+// descriptors they were built from.
+//
+// `PoolCache` is thread-safe.
+class RecordsMetadataDescriptors::PoolCache {
+ public:
+  explicit PoolCache(size_t max_size) : max_size_(max_size) {}
+
+  PoolCache(const PoolCache&) = delete;
+  PoolCache& operator=(const PoolCache&) = delete;
+
+  static PoolCache& global() {
+    static NoDestructor<PoolCache> kGlobalCache(kMaxCachedPools);
+    return *kGlobalCache;
+  }
+
+  // Returns the key of the pool built from `metadata.file_descriptor()`.
+  static std::string Key(const RecordsMetadata& metadata);
+
+  // Returns the cached pool with `key`, marking it as recently used, or
+  // `nullptr` if it is absent.
+  std::shared_ptr<const Pool> Find(absl::string_view key);
+
+  // Adds `pool` with `key` if it is not already present, evicting the least
+  // recently used pool as needed.
+  void Insert(std::string&& key, std::shared_ptr<const Pool> pool);
+
+ private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const Pool> pool;
+  };
+
+  const size_t max_size_;
+  absl::Mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // Keys point to keys owned by `entries_`.
+  absl::flat_hash_map<absl::string_view, std::list<Entry>::iterator> index_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+std::string RecordsMetadataDescriptors::PoolCache::Key(
+    const RecordsMetadata& metadata) {
+  std::string key;
+  for (const google::protobuf::FileDescriptorProto& file_descriptor :
+       metadata.file_descriptor()) {
+    // The length makes boundaries between file descriptors unambiguous.
+    absl::StrAppend(&key, file_descriptor.ByteSizeLong(), ":");
+    file_descriptor.AppendToString(&key);
+  }
+  return key;
+}
+
+std::shared_ptr<const RecordsMetadataDescriptors::Pool>
+RecordsMetadataDescriptors::PoolCache::Find(absl::string_view key) {
+  absl::MutexLock lock(&mutex_);
+  const auto iter = index_.find(key);
+  if (iter == index_.end()) return nullptr;
+  entries_.splice(entries_.begin(), entries_, iter->second);
+  return iter->second->pool;
+}
+
+void RecordsMetadataDescriptors::PoolCache::Insert(
+    std::string&& key, std::shared_ptr<const Pool> pool) {
+  // Evicted pools are destroyed after releasing the lock.
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    // Another reader could have built the same pool concurrently.
+    if (index_.contains(key)) return;
+    entries_.push_front(Entry{std::move(key), std::move(pool)});
+    index_.emplace(entries_.front().key, entries_.begin());
+    while (entries_.size() > max_size_) {
+      const auto last = std::prev(entries_.end());
+      index_.erase(last->key);
+      evicted.splice(evicted.end(), entries_, last);
+    }
+  }
+}
+
 class RecordsMetadataDescriptors::ErrorCollector
     : public google::protobuf::DescriptorPool::ErrorCollector {
  public:
@@ -83,21 +266,368 @@ RecordsMetadataDescriptors::RecordsMetadataDescriptors(
     const RecordsMetadata& metadata)
     : Object(kInitiallyOpen), record_type_name_(metadata.record_type_name()) {
   if (record_type_name_.empty() || metadata.file_descriptor().empty()) return;
-  pool_ = std::make_unique<google::protobuf::DescriptorPool>();
+  std::string key = PoolCache::Key(metadata);
+  pool_ = PoolCache::global().Find(key);
+  if (pool_ != nullptr) return;
+  std::shared_ptr<Pool> pool = std::make_shared<Pool>();
+  pool_ = pool;
   ErrorCollector error_collector(this);
   for (const google::protobuf::FileDescriptorProto& file_descriptor :
        metadata.file_descriptor()) {
-    if (ABSL_PREDICT_FALSE(pool_->BuildFileCollectingErrors(
+    if (ABSL_PREDICT_FALSE(pool->pool.BuildFileCollectingErrors(
                                file_descriptor, &error_collector) == nullptr)) {
       return;
     }
   }
+  PoolCache::global().Insert(std::move(key), std::move(pool));
 }
 
 const google::protobuf::Descriptor* RecordsMetadataDescriptors::descriptor()
     const {
   if (pool_ == nullptr) return nullptr;
-  return pool_->FindMessageTypeByName(record_type_name_);
+  return pool_->pool.FindMessageTypeByName(record_type_name_);
+}
+
+const google::protobuf::Message* RecordsMetadataDescriptors::prototype() const {
+  const google::protobuf::Descriptor* const message_descriptor = descriptor();
+  if (message_descriptor == nullptr) return nullptr;
+  return pool_->factory.GetPrototype(message_descriptor);
+}
+
+// Reads chunks following the current chunk ahead and decodes them in
+// background.
+//
+// Chunks are read from the `ChunkReader` in the thread of the `RecordReader`,
+// so that accesses to the `ChunkReader` are not concurrent, and are decoded by
+// `ThreadPool::global()`.
+//
+// If `memory_budget != nullptr`, memory of each chunk read ahead is reserved
+// from it and held until the chunk is taken, or until decoding a discarded
+// chunk finishes.
+//
+// If `collect_stats`, hashing and decoding of each chunk are measured in
+// background, and counted when the chunk is taken.
+//
+// If `trace_sink != nullptr`, hashing and decoding in background, and waiting
+// for them when the chunk is taken, are reported to it.
+class RecordReaderBase::ChunkPrefetcher {
+ public:
+  explicit ChunkPrefetcher(int parallelism, MemoryBudget* memory_budget,
+                           absl::optional<Position> end_pos,
+                           ChunkDecoder::Options chunk_decoder_options,
+                           bool collect_stats, TraceSink* trace_sink)
+      : parallelism_(parallelism),
+        memory_budget_(memory_budget),
+        end_pos_(end_pos),
+        chunk_decoder_options_(std::move(chunk_decoder_options)),
+        collect_stats_(collect_stats),
+        trace_sink_(trace_sink) {}
+
+  ChunkPrefetcher(const ChunkPrefetcher&) = delete;
+  ChunkPrefetcher& operator=(const ChunkPrefetcher&) = delete;
+
+  ~ChunkPrefetcher() { Clear(); }
+
+  // Changes the field projection of chunks read ahead later.
+  //
+  // Precondition: `empty()`
+  void SetFieldProjection(FieldProjection field_projection);
+
+  // Changes the Zstd dictionary of chunks read ahead later.
+  //
+  // Precondition: `empty()`
+  void SetZstdDictionary(ZstdReaderBase::Dictionary zstd_dictionary);
+
+  // Reads chunks from `src` until `parallelism` chunks are pending, until
+  // `src` ends or fails, until a chunk begins at or after `end_pos`, or until
+  // a chunk of type `ChunkType::kReferencing`, which needs records of chunks
+  // before it, or `ChunkType::kFileMetadata`, which can contain a Zstd
+  // dictionary needed for decoding chunks after it, and schedules decoding
+  // them.
+  //
+  // A failure of `src` is left for the caller to handle after the pending
+  // chunks are taken.
+  //
+  // If `memory_budget_ != nullptr` and `may_wait`, the first chunk read when
+  // no chunks are pending waits for its memory reservation. Other chunks are
+  // read only while their memory can be reserved without waiting. `may_wait`
+  // must be `false` if the caller holds another reservation from the same
+  // budget.
+  //
+  // `is_unsampled(records_before, num_records)` tells whether `num_records`
+  // records following `records_before` records of pending chunks are all
+  // unsampled. A chunk of only such records is skipped by its header, without
+  // reading or decoding its data, and does not count towards `parallelism`.
+  void ReadAhead(ChunkReader& src, bool may_wait,
+                 absl::FunctionRef<bool(uint64_t records_before,
+                                        uint64_t num_records)>
+                     is_unsampled);
+
+  // Returns `true` if there are no pending chunks.
+  bool empty() const { return chunks_.empty(); }
+
+  // Returns the position of the next pending chunk.
+  //
+  // Precondition: `!empty()`
+  Position chunk_begin() const;
+
+  // Returns the position after the next pending chunk.
+  //
+  // Precondition: `!empty()`
+  Position chunk_end() const;
+
+  // Discards the next pending chunks if they were skipped, and returns the
+  // number of their records.
+  uint64_t TakeSkippedChunks();
+
+  // Takes the next pending chunk, waiting until it is decoded, together with
+  // its memory reservation, and adds its measurements to `stats`.
+  //
+  // Precondition: `!empty()`, and the next pending chunk was not skipped
+  ChunkDecoder TakeChunk(MemoryBudget::Reservation& memory_reservation,
+                         RecordReaderStats& stats);
+
+  // Discards pending chunks, waiting until their decoding finishes, because
+  // background tasks use objects which are required to outlive only the
+  // `RecordReader`, e.g. the `DecompressionBackend` and the `TraceSink`.
+  void Clear();
+
+  // Registers pending chunks with `MemoryEstimator`, estimated from their
+  // sizes because they are owned by background tasks.
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const;
+
+ private:
+  struct DecodedChunk {
+    ChunkDecoder chunk_decoder;
+    MemoryBudget::Reservation memory_reservation;
+    RecordReaderStats stats;
+  };
+
+  struct PendingChunk {
+    Position chunk_begin;
+    Position chunk_end;
+    uint64_t num_records;
+    // Estimated memory of the chunk data and decoded records.
+    size_t memory;
+    // Not `valid()` for consecutive chunks which were skipped.
+    std::future<DecodedChunk> decoded_chunk;
+  };
+
+  int parallelism_;
+  MemoryBudget* memory_budget_;
+  absl::optional<Position> end_pos_;
+  ChunkDecoder::Options chunk_decoder_options_;
+  bool collect_stats_;
+  TraceSink* trace_sink_;
+  std::deque<PendingChunk> chunks_;
+  // The number of `chunks_` which were not skipped.
+  size_t num_decoding_ = 0;
+};
+
+inline void RecordReaderBase::ChunkPrefetcher::SetFieldProjection(
+    FieldProjection field_projection) {
+  RIEGELI_ASSERT(empty())
+      << "Failed precondition of "
+         "RecordReaderBase::ChunkPrefetcher::SetFieldProjection(): "
+         "chunks pending";
+  chunk_decoder_options_.set_field_projection(std::move(field_projection));
+}
+
+inline void RecordReaderBase::ChunkPrefetcher::SetZstdDictionary(
+    ZstdReaderBase::Dictionary zstd_dictionary) {
+  RIEGELI_ASSERT(empty())
+      << "Failed precondition of "
+         "RecordReaderBase::ChunkPrefetcher::SetZstdDictionary(): "
+         "chunks pending";
+  chunk_decoder_options_.set_zstd_dictionary(std::move(zstd_dictionary));
+}
+
+inline void RecordReaderBase::ChunkPrefetcher::ReadAhead(
+    ChunkReader& src, bool may_wait,
+    absl::FunctionRef<bool(uint64_t records_before, uint64_t num_records)>
+        is_unsampled) {
+  struct DecodeRequest {
+    Chunk chunk;
+    Position chunk_begin;
+    Position chunk_end;
+    bool verify_data_hash;
+    MemoryBudget::Reservation memory_reservation;
+    std::promise<DecodedChunk> decoded_chunk;
+  };
+  uint64_t records_before = 0;
+  for (const PendingChunk& pending_chunk : chunks_) {
+    records_before += pending_chunk.num_records;
+  }
+  while (num_decoding_ < IntCast<size_t>(parallelism_)) {
+    const Position chunk_begin = src.pos();
+    if (end_pos_ != absl::nullopt && chunk_begin >= *end_pos_) return;
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) return;
+    const uint64_t num_records = chunk_header->num_records();
+    if (num_records > 0 && is_unsampled(records_before, num_records)) {
+      if (ABSL_PREDICT_FALSE(!src.SkipChunk())) return;
+      if (!chunks_.empty() && !chunks_.back().decoded_chunk.valid()) {
+        chunks_.back().chunk_end = src.pos();
+        chunks_.back().num_records += num_records;
+      } else {
+        chunks_.push_back(PendingChunk{chunk_begin, src.pos(), num_records, 0,
+                                       std::future<DecodedChunk>()});
+      }
+      records_before += num_records;
+      continue;
+    }
+    if (chunk_header->chunk_type() == ChunkType::kReferencing ||
+        chunk_header->chunk_type() == ChunkType::kFileMetadata) {
+      return;
+    }
+    DecodeRequest* const request = new DecodeRequest();
+    if (memory_budget_ != nullptr) {
+      const size_t size = ChunkMemorySize(*chunk_header);
+      if (may_wait && num_decoding_ == 0) {
+        request->memory_reservation = memory_budget_->Reserve(size);
+      } else {
+        absl::optional<MemoryBudget::Reservation> memory_reservation =
+            memory_budget_->TryReserve(size);
+        if (memory_reservation == absl::nullopt) {
+          // Over budget. Read further chunks ahead later.
+          delete request;
+          return;
+        }
+        request->memory_reservation = std::move(*memory_reservation);
+      }
+    }
+    // The data hash is verified in background before decoding, so that hashing
+    // overlaps with decoding chunks read before.
+    if (ABSL_PREDICT_FALSE(
+            !src.ReadChunk(request->chunk, request->verify_data_hash))) {
+      delete request;
+      return;
+    }
+    request->chunk_begin = chunk_begin;
+    request->chunk_end = src.pos();
+    chunks_.push_back(PendingChunk{chunk_begin, request->chunk_end,
+                                   num_records,
+                                   ChunkMemorySize(request->chunk.header),
+                                   request->decoded_chunk.get_future()});
+    ++num_decoding_;
+    records_before += num_records;
+    ThreadPool::global().Schedule([request,
+                                   chunk_decoder_options =
+                                       chunk_decoder_options_,
+                                   collect_stats = collect_stats_,
+                                   trace_sink = trace_sink_] {
+      ChunkDecoder chunk_decoder(chunk_decoder_options);
+      RecordReaderStats stats;
+      const bool measure = collect_stats || trace_sink != nullptr;
+      const absl::Time hash_start = measure && request->verify_data_hash
+                                        ? absl::Now()
+                                        : absl::InfinitePast();
+      absl::Status status =
+          request->verify_data_hash
+              ? ChunkReader::VerifyDataHash(request->chunk,
+                                            request->chunk_begin,
+                                            request->chunk_end)
+              : absl::OkStatus();
+      if (measure && request->verify_data_hash) {
+        const absl::Time hash_end = absl::Now();
+        if (collect_stats) stats.hash_time = hash_end - hash_start;
+        if (trace_sink != nullptr) {
+          trace_sink->AddEvent(TraceEvent{
+              TraceStage::kVerifyHash, request->chunk_begin,
+              request->chunk.data.size(), hash_start, hash_end});
+        }
+      }
+      if (ABSL_PREDICT_TRUE(status.ok())) {
+        const absl::Time decode_start =
+            measure ? absl::Now() : absl::InfinitePast();
+        if (chunk_decoder.Decode(request->chunk) && collect_stats) {
+          stats.num_chunks = 1;
+          stats.num_compressed_bytes = request->chunk.header.data_size();
+          stats.num_decoded_bytes = request->chunk.header.decoded_data_size();
+        }
+        if (measure) {
+          const absl::Time decode_end = absl::Now();
+          if (collect_stats) stats.decode_time = decode_end - decode_start;
+          if (trace_sink != nullptr) {
+            trace_sink->AddEvent(TraceEvent{
+                TraceStage::kDecodeChunk, request->chunk_begin,
+                request->chunk.header.data_size(), decode_start, decode_end});
+          }
+        }
+      } else {
+        chunk_decoder.Fail(std::move(status));
+      }
+      request->chunk = Chunk();
+      request->decoded_chunk.set_value(
+          DecodedChunk{std::move(chunk_decoder),
+                       std::move(request->memory_reservation), stats});
+      delete request;
+    });
+  }
+}
+
+inline void RecordReaderBase::ChunkPrefetcher::Clear() {
+  for (const PendingChunk& pending_chunk : chunks_) {
+    if (pending_chunk.decoded_chunk.valid()) pending_chunk.decoded_chunk.wait();
+  }
+  chunks_.clear();
+  num_decoding_ = 0;
+}
+
+inline void RecordReaderBase::ChunkPrefetcher::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  for (const PendingChunk& pending_chunk : chunks_) {
+    memory_estimator.RegisterMemory(pending_chunk.memory);
+  }
+}
+
+inline Position RecordReaderBase::ChunkPrefetcher::chunk_begin() const {
+  RIEGELI_ASSERT(!empty())
+      << "Failed precondition of "
+         "RecordReaderBase::ChunkPrefetcher::chunk_begin(): "
+         "no chunks pending";
+  return chunks_.front().chunk_begin;
+}
+
+inline Position RecordReaderBase::ChunkPrefetcher::chunk_end() const {
+  RIEGELI_ASSERT(!empty())
+      << "Failed precondition of "
+         "RecordReaderBase::ChunkPrefetcher::chunk_end(): "
+         "no chunks pending";
+  return chunks_.front().chunk_end;
+}
+
+inline uint64_t RecordReaderBase::ChunkPrefetcher::TakeSkippedChunks() {
+  uint64_t num_records = 0;
+  while (!chunks_.empty() && !chunks_.front().decoded_chunk.valid()) {
+    num_records += chunks_.front().num_records;
+    chunks_.pop_front();
+  }
+  return num_records;
+}
+
+inline ChunkDecoder RecordReaderBase::ChunkPrefetcher::TakeChunk(
+    MemoryBudget::Reservation& memory_reservation, RecordReaderStats& stats) {
+  RIEGELI_ASSERT(!empty()) << "Failed precondition of "
+                              "RecordReaderBase::ChunkPrefetcher::TakeChunk(): "
+                              "no chunks pending";
+  RIEGELI_ASSERT(chunks_.front().decoded_chunk.valid())
+      << "Failed precondition of "
+         "RecordReaderBase::ChunkPrefetcher::TakeChunk(): "
+         "chunk skipped";
+  const absl::Time wait_start =
+      trace_sink_ != nullptr ? absl::Now() : absl::InfinitePast();
+  DecodedChunk decoded_chunk = chunks_.front().decoded_chunk.get();
+  if (trace_sink_ != nullptr) {
+    trace_sink_->AddEvent(TraceEvent{TraceStage::kWaitForDecoding,
+                                     chunks_.front().chunk_begin, 0,
+                                     wait_start, absl::Now()});
+  }
+  chunks_.pop_front();
+  --num_decoding_;
+  memory_reservation = std::move(decoded_chunk.memory_reservation);
+  stats += decoded_chunk.stats;
+  return std::move(decoded_chunk.chunk_decoder);
 }
 
 RecordReaderBase::RecordReaderBase(InitiallyClosed) noexcept
@@ -114,7 +644,39 @@ RecordReaderBase::RecordReaderBase(RecordReaderBase&& that) noexcept
       chunk_decoder_(std::move(that.chunk_decoder_)),
       last_record_is_valid_(std::exchange(that.last_record_is_valid_, false)),
       recoverable_(std::exchange(that.recoverable_, Recoverable::kNo)),
-      recovery_(std::move(that.recovery_)) {}
+      recovery_(std::move(that.recovery_)),
+      merge_skipped_regions_(that.merge_skipped_regions_),
+      sample_rate_(that.sample_rate_),
+      sample_random_(that.sample_random_),
+      records_to_skip_(that.records_to_skip_),
+      sample_gaps_(std::move(that.sample_gaps_)),
+      zstd_dictionary_(std::move(that.zstd_dictionary_)),
+      file_metadata_checked_(
+          std::exchange(that.file_metadata_checked_, false)),
+      brotli_dictionary_(std::move(that.brotli_dictionary_)),
+      simple_uncompressed_only_(that.simple_uncompressed_only_),
+      decompression_backend_(that.decompression_backend_),
+      memory_budget_(std::exchange(that.memory_budget_, nullptr)),
+      memory_reservation_(std::move(that.memory_reservation_)),
+      end_pos_(std::exchange(that.end_pos_, absl::nullopt)),
+      follow_(std::exchange(that.follow_, false)),
+      follow_poll_interval_(that.follow_poll_interval_),
+      follow_timeout_(that.follow_timeout_),
+      follow_backoff_(that.follow_backoff_),
+      follow_wait_start_(that.follow_wait_start_),
+      follow_chunk_begin_(that.follow_chunk_begin_),
+      chunk_cache_(std::exchange(that.chunk_cache_, nullptr)),
+      chunk_cache_key_(std::move(that.chunk_cache_key_)),
+      chunk_prefetcher_(std::move(that.chunk_prefetcher_)),
+      reference_chunks_(std::move(that.reference_chunks_)),
+      reference_chunks_end_(that.reference_chunks_end_),
+      max_reference_chunks_(std::exchange(that.max_reference_chunks_, 0)),
+      chunk_index_(std::move(that.chunk_index_)),
+      chunk_index_end_(that.chunk_index_end_),
+      chunk_index_loaded_(std::exchange(that.chunk_index_loaded_, false)),
+      collect_stats_(that.collect_stats_),
+      stats_(that.stats_),
+      trace_sink_(that.trace_sink_) {}
 
 RecordReaderBase& RecordReaderBase::operator=(
     RecordReaderBase&& that) noexcept {
@@ -126,9 +688,42 @@ RecordReaderBase& RecordReaderBase::operator=(
   last_record_is_valid_ = std::exchange(that.last_record_is_valid_, false);
   recoverable_ = std::exchange(that.recoverable_, Recoverable::kNo);
   recovery_ = std::move(that.recovery_);
+  merge_skipped_regions_ = that.merge_skipped_regions_;
+  sample_rate_ = that.sample_rate_;
+  sample_random_ = that.sample_random_;
+  records_to_skip_ = that.records_to_skip_;
+  sample_gaps_ = std::move(that.sample_gaps_);
+  zstd_dictionary_ = std::move(that.zstd_dictionary_);
+  file_metadata_checked_ = std::exchange(that.file_metadata_checked_, false);
+  brotli_dictionary_ = std::move(that.brotli_dictionary_);
+  simple_uncompressed_only_ = that.simple_uncompressed_only_;
+  decompression_backend_ = that.decompression_backend_;
+  memory_budget_ = std::exchange(that.memory_budget_, nullptr);
+  memory_reservation_ = std::move(that.memory_reservation_);
+  end_pos_ = std::exchange(that.end_pos_, absl::nullopt);
+  follow_ = std::exchange(that.follow_, false);
+  follow_poll_interval_ = that.follow_poll_interval_;
+  follow_timeout_ = that.follow_timeout_;
+  follow_backoff_ = that.follow_backoff_;
+  follow_wait_start_ = that.follow_wait_start_;
+  follow_chunk_begin_ = that.follow_chunk_begin_;
+  chunk_cache_ = std::exchange(that.chunk_cache_, nullptr);
+  chunk_cache_key_ = std::move(that.chunk_cache_key_);
+  chunk_prefetcher_ = std::move(that.chunk_prefetcher_);
+  reference_chunks_ = std::move(that.reference_chunks_);
+  reference_chunks_end_ = that.reference_chunks_end_;
+  max_reference_chunks_ = std::exchange(that.max_reference_chunks_, 0);
+  chunk_index_ = std::move(that.chunk_index_);
+  chunk_index_end_ = that.chunk_index_end_;
+  chunk_index_loaded_ = std::exchange(that.chunk_index_loaded_, false);
+  collect_stats_ = that.collect_stats_;
+  stats_ = that.stats_;
+  trace_sink_ = that.trace_sink_;
   return *this;
 }
 
+RecordReaderBase::~RecordReaderBase() {}
+
 void RecordReaderBase::Reset(InitiallyClosed) {
   Object::Reset(kInitiallyClosed);
   chunk_begin_ = 0;
@@ -136,6 +731,31 @@ void RecordReaderBase::Reset(InitiallyClosed) {
   last_record_is_valid_ = false;
   recoverable_ = Recoverable::kNo;
   recovery_ = nullptr;
+  merge_skipped_regions_ = false;
+  sample_rate_ = 1.0;
+  records_to_skip_ = 0;
+  sample_gaps_.clear();
+  zstd_dictionary_.reset();
+  file_metadata_checked_ = false;
+  brotli_dictionary_.reset();
+  simple_uncompressed_only_ = false;
+  decompression_backend_ = nullptr;
+  chunk_prefetcher_.reset();
+  reference_chunks_.clear();
+  reference_chunks_end_ = 0;
+  max_reference_chunks_ = 0;
+  memory_reservation_.Release();
+  memory_budget_ = nullptr;
+  end_pos_ = absl::nullopt;
+  follow_ = false;
+  chunk_cache_ = nullptr;
+  chunk_cache_key_.clear();
+  chunk_index_.Clear();
+  chunk_index_end_ = 0;
+  chunk_index_loaded_ = false;
+  collect_stats_ = false;
+  stats_ = RecordReaderStats();
+  trace_sink_ = nullptr;
 }
 
 void RecordReaderBase::Reset(InitiallyOpen) {
@@ -145,6 +765,31 @@ void RecordReaderBase::Reset(InitiallyOpen) {
   last_record_is_valid_ = false;
   recoverable_ = Recoverable::kNo;
   recovery_ = nullptr;
+  merge_skipped_regions_ = false;
+  sample_rate_ = 1.0;
+  records_to_skip_ = 0;
+  sample_gaps_.clear();
+  zstd_dictionary_.reset();
+  file_metadata_checked_ = false;
+  brotli_dictionary_.reset();
+  simple_uncompressed_only_ = false;
+  decompression_backend_ = nullptr;
+  chunk_prefetcher_.reset();
+  reference_chunks_.clear();
+  reference_chunks_end_ = 0;
+  max_reference_chunks_ = 0;
+  memory_reservation_.Release();
+  memory_budget_ = nullptr;
+  end_pos_ = absl::nullopt;
+  follow_ = false;
+  chunk_cache_ = nullptr;
+  chunk_cache_key_.clear();
+  chunk_index_.Clear();
+  chunk_index_end_ = 0;
+  chunk_index_loaded_ = false;
+  collect_stats_ = false;
+  stats_ = RecordReaderStats();
+  trace_sink_ = nullptr;
 }
 
 void RecordReaderBase::Initialize(ChunkReader* src, Options&& options) {
@@ -155,15 +800,73 @@ void RecordReaderBase::Initialize(ChunkReader* src, Options&& options) {
     return;
   }
   chunk_begin_ = src->pos();
-  chunk_decoder_.Reset(ChunkDecoder::Options().set_field_projection(
-      std::move(options.field_projection())));
+  src->set_data_hash_verification_interval(
+      options.data_hash_verification_interval());
+  collect_stats_ = options.collect_stats();
+  if (collect_stats_) src->set_collect_stats(true);
+  trace_sink_ = options.trace_sink();
+  if (trace_sink_ != nullptr) src->set_trace_sink(trace_sink_);
+  zstd_dictionary_ = std::move(options.zstd_dictionary());
+  brotli_dictionary_ = std::move(options.brotli_dictionary());
+  simple_uncompressed_only_ = options.simple_uncompressed_only();
+  decompression_backend_ = options.decompression_backend();
+  merge_skipped_regions_ = options.merge_skipped_regions();
+  sample_rate_ = options.sample_rate();
+  if (sample_rate_ < 1.0) {
+    sample_random_.seed(options.sample_seed());
+    records_to_skip_ = NextSampleGap();
+  }
+  memory_budget_ = options.memory_budget();
+  end_pos_ = options.end_pos();
+  follow_ = options.follow();
+  follow_poll_interval_ = options.follow_poll_interval();
+  follow_timeout_ = options.follow_timeout();
+  follow_backoff_ = absl::ZeroDuration();
+  if (options.encoded_chunk_cache() != nullptr) {
+    src->set_encoded_chunk_cache(options.encoded_chunk_cache(),
+                                 options.chunk_cache_key());
+  }
+  chunk_cache_ = options.chunk_cache();
+  chunk_cache_key_ = std::move(options.chunk_cache_key());
+  if (options.parallelism() > 0) {
+    chunk_prefetcher_ = std::make_unique<ChunkPrefetcher>(
+        options.parallelism(), memory_budget_, end_pos_,
+        ChunkDecoder::Options()
+            .set_field_projection(options.field_projection())
+            .set_zstd_dictionary(zstd_dictionary_)
+            .set_brotli_dictionary(brotli_dictionary_)
+            .set_simple_uncompressed_only(simple_uncompressed_only_)
+            .set_decompression_backend(decompression_backend_),
+        collect_stats_, trace_sink_);
+  }
+  chunk_decoder_.Reset(
+      ChunkDecoder::Options()
+          .set_field_projection(std::move(options.field_projection()))
+          .set_zstd_dictionary(zstd_dictionary_)
+          .set_brotli_dictionary(brotli_dictionary_)
+          .set_simple_uncompressed_only(simple_uncompressed_only_)
+          .set_decompression_backend(decompression_backend_));
   recovery_ = std::move(options.recovery());
+  if (options.sidecar_index() != absl::nullopt && src->SupportsRandomAccess()) {
+    const absl::optional<Position> size = src->Size();
+    if (ABSL_PREDICT_FALSE(size == absl::nullopt)) {
+      Fail(*src);
+      return;
+    }
+    if (*size == options.sidecar_index()->indexed_size) {
+      chunk_index_ = std::move(options.sidecar_index()->chunk_index);
+      chunk_index_end_ = options.sidecar_index()->index_end;
+      chunk_index_loaded_ = true;
+    }
+  }
 }
 
 void RecordReaderBase::Done() {
   last_record_is_valid_ = false;
   recoverable_ = Recoverable::kNo;
   if (ABSL_PREDICT_FALSE(!chunk_decoder_.Close())) Fail(chunk_decoder_);
+  if (chunk_prefetcher_ != nullptr) chunk_prefetcher_->Clear();
+  memory_reservation_.Release();
 }
 
 inline bool RecordReaderBase::FailReading(const ChunkReader& src) {
@@ -180,9 +883,29 @@ inline bool RecordReaderBase::FailSeeking(const ChunkReader& src) {
   return TryRecovery();
 }
 
+inline bool RecordReaderBase::FailLoadingChunkIndex(const ChunkReader& src) {
+  chunk_index_.Clear();
+  chunk_begin_ = src.pos();
+  chunk_decoder_.Clear();
+  recoverable_ = Recoverable::kRecoverChunkReader;
+  return Fail(src);
+}
+
+Position RecordReaderBase::PrefetchedChunkBegin(const ChunkReader& src) const {
+  RIEGELI_ASSERT(chunk_prefetcher_ != nullptr)
+      << "Failed precondition of RecordReaderBase::PrefetchedChunkBegin(): "
+         "no chunk prefetcher";
+  if (chunk_prefetcher_->empty()) return src.pos();
+  return chunk_prefetcher_->chunk_begin();
+}
+
 bool RecordReaderBase::CheckFileFormat() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   if (chunk_decoder_.num_records() > 0) return true;
+  if (chunk_prefetcher_ != nullptr && !chunk_prefetcher_->empty()) {
+    // A chunk has been read successfully.
+    return true;
+  }
   ChunkReader& src = *src_chunk_reader();
   if (ABSL_PREDICT_FALSE(!src.CheckFileFormat())) {
     chunk_decoder_.Clear();
@@ -248,39 +971,32 @@ bool RecordReaderBase::ReadSerializedMetadata(Chain& metadata) {
     recoverable_ = Recoverable::kRecoverChunkDecoder;
     return TryRecovery();
   }
+  LoadZstdDictionary(metadata);
   return true;
 }
 
-inline bool RecordReaderBase::ParseMetadata(const Chunk& chunk,
-                                            Chain& metadata) {
-  RIEGELI_ASSERT(chunk.header.chunk_type() == ChunkType::kFileMetadata)
-      << "Failed precondition of RecordReaderBase::ParseMetadata(): "
-         "wrong chunk type";
-  if (ABSL_PREDICT_FALSE(chunk.header.num_records() != 0)) {
-    return Fail(absl::DataLossError(absl::StrCat(
-        "Invalid file metadata chunk: number of records is not zero: ",
-        chunk.header.num_records())));
-  }
-  ChainReader<> data_reader(&chunk.data);
-  TransposeDecoder transpose_decoder;
-  ChainBackwardWriter<> serialized_metadata_writer(
-      &metadata, ChainBackwardWriterBase::Options().set_size_hint(
-                     chunk.header.decoded_data_size()));
-  std::vector<size_t> limits;
-  const bool ok = transpose_decoder.Decode(1, chunk.header.decoded_data_size(),
-                                           FieldProjection::All(), data_reader,
-                                           serialized_metadata_writer, limits);
-  if (ABSL_PREDICT_FALSE(!serialized_metadata_writer.Close())) {
-    return Fail(serialized_metadata_writer);
+inline void RecordReaderBase::LoadZstdDictionary(const Chain& metadata) {
+  file_metadata_checked_ = true;
+  if (!zstd_dictionary_.empty()) return;
+  RecordsMetadata parsed_metadata;
+  // If metadata cannot be parsed, this is reported by `ReadMetadata()`, while
+  // `ReadSerializedMetadata()` does not validate them.
+  if (ABSL_PREDICT_FALSE(!ParseFromChain(metadata, parsed_metadata).ok())) {
+    return;
   }
-  if (ABSL_PREDICT_FALSE(!ok)) return Fail(transpose_decoder);
-  if (ABSL_PREDICT_FALSE(!data_reader.VerifyEndAndClose())) {
-    return Fail(data_reader);
+  if (!parsed_metadata.has_zstd_dictionary()) return;
+  zstd_dictionary_.set_data(
+      std::move(*parsed_metadata.mutable_zstd_dictionary()));
+  if (chunk_prefetcher_ != nullptr) {
+    chunk_prefetcher_->SetZstdDictionary(zstd_dictionary_);
   }
-  RIEGELI_ASSERT_EQ(limits.size(), 1u)
-      << "Metadata chunk has unexpected record limits";
-  RIEGELI_ASSERT_EQ(limits.back(), metadata.size())
-      << "Metadata chunk has unexpected record limits";
+  chunk_decoder_.SetZstdDictionary(zstd_dictionary_);
+}
+
+inline bool RecordReaderBase::ParseMetadata(const Chunk& chunk,
+                                            Chain& metadata) {
+  absl::Status status = DecodeMetadata(chunk, metadata);
+  if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
   return true;
 }
 
@@ -304,13 +1020,267 @@ bool RecordReaderBase::ReadRecord(absl::Cord& record) {
   return ReadRecordImpl(record);
 }
 
-template <typename Record>
-inline bool RecordReaderBase::ReadRecordImpl(Record& record) {
+bool RecordReaderBase::ReadRecord(
+    const google::protobuf::MessageLite& prototype,
+    google::protobuf::Arena& arena, google::protobuf::MessageLite*& record) {
+  return ReadRecordImpl(prototype, arena, record);
+}
+
+size_t RecordReaderBase::ReadRecords(absl::Span<absl::string_view> records) {
+  return ReadRecordsImpl(records);
+}
+
+size_t RecordReaderBase::ReadRecords(absl::Span<Chain> records) {
+  return ReadRecordsImpl(records);
+}
+
+size_t RecordReaderBase::ReadRecords(
+    const google::protobuf::MessageLite& prototype,
+    google::protobuf::Arena& arena,
+    absl::Span<google::protobuf::MessageLite*> records) {
+  return ReadRecordsImpl(records, prototype, arena);
+}
+
+RecordReaderBase::FutureRecords RecordReaderBase::ReadRecordsAsync(
+    size_t max_records) {
+  std::shared_ptr<std::promise<std::vector<Chain>>> promise =
+      std::make_shared<std::promise<std::vector<Chain>>>();
+  FutureRecords result = promise->get_future();
+  ReadRecordsAsync(max_records, [promise](std::vector<Chain> records) {
+    promise->set_value(std::move(records));
+  });
+  return result;
+}
+
+void RecordReaderBase::ReadRecordsAsync(
+    size_t max_records, std::function<void(std::vector<Chain>)> done) {
+  if (ABSL_PREDICT_FALSE(!healthy() || max_records == 0)) {
+    done(std::vector<Chain>());
+    return;
+  }
+  ThreadPool::global().Schedule(
+      [this, max_records, done = std::move(done)] {
+        std::vector<Chain> records;
+        Chain record;
+        while (records.size() < max_records && ReadRecord(record)) {
+          records.push_back(std::move(record));
+        }
+        done(std::move(records));
+      });
+}
+
+bool RecordReaderBase::ReadRecordsAt(
+    absl::Span<const RecordPosition> positions, absl::Span<Chain> records) {
+  RIEGELI_ASSERT_EQ(positions.size(), records.size())
+      << "Failed precondition of RecordReaderBase::ReadRecordsAt(): "
+         "sizes of positions and records differ";
+  for (Chain& record : records) record.Clear();
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  std::vector<size_t> order(positions.size());
+  std::iota(order.begin(), order.end(), size_t{0});
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return positions[a] < positions[b];
+  });
+  bool all_read = true;
+  for (const size_t index : order) {
+    // Seeking within the current chunk reuses the decoded chunk.
+    if (ABSL_PREDICT_FALSE(!Seek(positions[index]))) return false;
+    if (ABSL_PREDICT_FALSE(!ReadRecord(records[index]))) {
+      if (ABSL_PREDICT_FALSE(!healthy())) return false;
+      all_read = false;
+    }
+  }
+  return all_read;
+}
+
+inline uint64_t RecordReaderBase::DrawSampleGap() {
+  RIEGELI_ASSERT_LT(sample_rate_, 1.0)
+      << "Failed precondition of RecordReaderBase::DrawSampleGap(): "
+         "sampling not enabled";
+  return std::geometric_distribution<uint64_t>(sample_rate_)(sample_random_);
+}
+
+inline uint64_t RecordReaderBase::NextSampleGap() {
+  RIEGELI_ASSERT_LT(sample_rate_, 1.0)
+      << "Failed precondition of RecordReaderBase::NextSampleGap(): "
+         "sampling not enabled";
+  if (sample_gaps_.empty()) return DrawSampleGap();
+  const uint64_t gap = sample_gaps_.front();
+  sample_gaps_.pop_front();
+  return gap;
+}
+
+inline bool RecordReaderBase::RecordsAreUnsampled(uint64_t records_before,
+                                                  uint64_t num_records) {
+  RIEGELI_ASSERT_LT(sample_rate_, 1.0)
+      << "Failed precondition of RecordReaderBase::RecordsAreUnsampled(): "
+         "sampling not enabled";
+  records_before += chunk_decoder_.num_records() - chunk_decoder_.index();
+  // The index of a sampled record, counting from the current record.
+  uint64_t sampled = records_to_skip_;
+  size_t gap_index = 0;
+  while (sampled < records_before) {
+    if (gap_index == sample_gaps_.size()) {
+      sample_gaps_.push_back(DrawSampleGap());
+    }
+    const uint64_t gap = sample_gaps_[gap_index++];
+    // The next sampled record is too far to be counted.
+    if (gap >= std::numeric_limits<uint64_t>::max() - sampled) return true;
+    sampled += gap + 1;
+  }
+  return sampled - records_before >= num_records;
+}
+
+inline void RecordReaderBase::SkipUnsampledRecords() {
+  RIEGELI_ASSERT_LT(sample_rate_, 1.0)
+      << "Failed precondition of RecordReaderBase::SkipUnsampledRecords(): "
+         "sampling not enabled";
+  const uint64_t num_skipped = UnsignedMin(
+      records_to_skip_, chunk_decoder_.num_records() - chunk_decoder_.index());
+  if (num_skipped == 0) return;
+  chunk_decoder_.SetIndex(chunk_decoder_.index() + num_skipped);
+  records_to_skip_ -= num_skipped;
+}
+
+inline bool RecordReaderBase::SkipUnsampledChunks() {
+  RIEGELI_ASSERT_LT(sample_rate_, 1.0)
+      << "Failed precondition of RecordReaderBase::SkipUnsampledChunks(): "
+         "sampling not enabled";
+  if (chunk_prefetcher_ != nullptr) return true;
+  ChunkReader& src = *src_chunk_reader();
+  for (;;) {
+    if (end_pos_ != absl::nullopt && src.pos() >= *end_pos_) return true;
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) break;
+    const uint64_t num_records = chunk_header->num_records();
+    // Chunks without records, e.g. file metadata, are left to `ReadChunk()`.
+    if (num_records == 0 || num_records > records_to_skip_) return true;
+    if (ABSL_PREDICT_FALSE(!src.SkipChunk())) break;
+    records_to_skip_ -= num_records;
+  }
+  if (ABSL_PREDICT_FALSE(!src.healthy())) {
+    chunk_decoder_.Clear();
+    recoverable_ = Recoverable::kRecoverChunkReader;
+    return Fail(src);
+  }
+  return true;
+}
+
+bool RecordReaderBase::ReadRecordTo(Writer& dest) {
+  last_record_is_valid_ = false;
+  if (chunk_prefetcher_ == nullptr && chunk_cache_ == nullptr &&
+      sample_rate_ >= 1.0 && healthy() && chunk_decoder_.healthy() &&
+      chunk_decoder_.index() == chunk_decoder_.num_records() &&
+      NextRecordFormsChunk()) {
+    return ReadChunkRecordTo(dest);
+  }
+  Chain record;
+  if (ABSL_PREDICT_FALSE(!ReadRecord(record))) return false;
+  if (ABSL_PREDICT_FALSE(!dest.Write(std::move(record)))) {
+    last_record_is_valid_ = false;
+    return Fail(dest);
+  }
+  return true;
+}
+
+inline bool RecordReaderBase::NextRecordFormsChunk() {
+  ChunkReader& src = *src_chunk_reader();
+  if (ABSL_PREDICT_FALSE(!SkipFileMetadata(src))) return false;
+  if (end_pos_ != absl::nullopt && src.pos() >= *end_pos_) return false;
+  const ChunkHeader* chunk_header;
+  if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) return false;
+  return chunk_header->chunk_type() == ChunkType::kSimple &&
+         chunk_header->num_records() == 1;
+}
+
+inline bool RecordReaderBase::ReadChunkRecordTo(Writer& dest) {
+  ChunkReader& src = *src_chunk_reader();
+  chunk_decoder_.Clear();
+  memory_reservation_.Release();
+  chunk_begin_ = src.pos();
+  if (memory_budget_ != nullptr) {
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed pulling a chunk header which was pulled before: "
+          << src.status();
+    }
+    // Only chunk data are held in memory, record values are not.
+    memory_reservation_ = memory_budget_->Reserve(IntCast<size_t>(
+        UnsignedMin(chunk_header->data_size(),
+                    uint64_t{std::numeric_limits<size_t>::max()})));
+  }
+  Chunk chunk;
+  if (ABSL_PREDICT_FALSE(!src.ReadChunk(chunk))) {
+    memory_reservation_.Release();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkReader;
+      return Fail(src);
+    }
+    return false;
+  }
+  const absl::Time decode_start =
+      collect_stats_ || trace_sink_ != nullptr ? absl::Now()
+                                               : absl::InfinitePast();
+  ChainReader<> data_reader(&chunk.data);
+  SimpleDecoder simple_decoder;
+  std::vector<size_t> limits;
+  if (ABSL_PREDICT_FALSE(!simple_decoder.Decode(
+          &data_reader, chunk.header.num_records(),
+          chunk.header.decoded_data_size(), limits, zstd_dictionary_,
+          brotli_dictionary_))) {
+    memory_reservation_.Release();
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return Fail(simple_decoder);
+  }
+  if (ABSL_PREDICT_FALSE(!simple_decoder.reader().Copy(
+          chunk.header.decoded_data_size(), dest))) {
+    memory_reservation_.Release();
+    if (ABSL_PREDICT_FALSE(!dest.healthy())) return Fail(dest);
+    simple_decoder.reader().Fail(
+        absl::DataLossError("Reading record values failed"));
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return Fail(simple_decoder.reader());
+  }
+  memory_reservation_.Release();
+  if (ABSL_PREDICT_FALSE(!simple_decoder.VerifyEndAndClose())) {
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return Fail(simple_decoder);
+  }
+  if (ABSL_PREDICT_FALSE(!data_reader.VerifyEndAndClose())) {
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return Fail(data_reader);
+  }
+  if (collect_stats_ || trace_sink_ != nullptr) {
+    const absl::Time decode_end = absl::Now();
+    if (trace_sink_ != nullptr) {
+      trace_sink_->AddEvent(TraceEvent{TraceStage::kDecodeChunk, chunk_begin_,
+                                       chunk.header.data_size(), decode_start,
+                                       decode_end});
+    }
+    if (collect_stats_) {
+      stats_.decode_time += decode_end - decode_start;
+      ++stats_.num_chunks;
+      ++stats_.num_records;
+      stats_.num_compressed_bytes += chunk.header.data_size();
+      stats_.num_decoded_bytes += chunk.header.decoded_data_size();
+    }
+  }
+  // The record is consumed, so reading continues from the next chunk.
+  chunk_begin_ = src.pos();
+  return true;
+}
+
+template <typename... Args>
+inline bool RecordReaderBase::ReadRecordImpl(Args&... args) {
   last_record_is_valid_ = false;
   for (;;) {
-    if (ABSL_PREDICT_TRUE(chunk_decoder_.ReadRecord(record))) {
+    if (sample_rate_ < 1.0) SkipUnsampledRecords();
+    if (ABSL_PREDICT_TRUE(chunk_decoder_.ReadRecord(args...))) {
       RIEGELI_ASSERT_GT(chunk_decoder_.index(), 0u)
           << "ChunkDecoder::ReadRecord() left record index at 0";
+      if (collect_stats_) ++stats_.num_records;
+      if (sample_rate_ < 1.0) records_to_skip_ = NextSampleGap();
       last_record_is_valid_ = true;
       return true;
     }
@@ -324,18 +1294,70 @@ inline bool RecordReaderBase::ReadRecordImpl(Record& record) {
       if (!TryRecovery()) return false;
       continue;
     }
-    if (ABSL_PREDICT_FALSE(!ReadChunk())) {
+    if (sample_rate_ < 1.0 && ABSL_PREDICT_FALSE(!SkipUnsampledChunks())) {
+      if (!TryRecovery()) return false;
+      continue;
+    }
+    if (ABSL_PREDICT_FALSE(!ReadNextChunk())) {
+      if (healthy() && WaitForMoreData()) continue;
       if (!TryRecovery()) return false;
     }
   }
 }
 
+template <typename Record, typename... Args>
+inline size_t RecordReaderBase::ReadRecordsImpl(absl::Span<Record> records,
+                                                Args&... args) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(records.empty())) return 0;
+  // Sampled records are not consecutive.
+  if (sample_rate_ < 1.0) records = records.subspan(0, 1);
+  for (;;) {
+    if (sample_rate_ < 1.0) SkipUnsampledRecords();
+    const size_t num_read = chunk_decoder_.ReadRecords(args..., records);
+    if (ABSL_PREDICT_TRUE(num_read > 0)) {
+      if (collect_stats_) stats_.num_records += num_read;
+      if (sample_rate_ < 1.0) records_to_skip_ = NextSampleGap();
+      last_record_is_valid_ = true;
+      return num_read;
+    }
+    if (ABSL_PREDICT_FALSE(!healthy())) {
+      if (!TryRecovery()) return 0;
+      continue;
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkDecoder;
+      Fail(chunk_decoder_);
+      if (!TryRecovery()) return 0;
+      continue;
+    }
+    if (sample_rate_ < 1.0 && ABSL_PREDICT_FALSE(!SkipUnsampledChunks())) {
+      if (!TryRecovery()) return 0;
+      continue;
+    }
+    if (ABSL_PREDICT_FALSE(!ReadNextChunk())) {
+      if (healthy() && WaitForMoreData()) continue;
+      if (!TryRecovery()) return 0;
+    }
+  }
+}
+
 bool RecordReaderBase::SetFieldProjection(FieldProjection field_projection) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   ChunkReader& src = *src_chunk_reader();
   const uint64_t record_index = chunk_decoder_.index();
-  chunk_decoder_.Reset(ChunkDecoder::Options().set_field_projection(
-      std::move(field_projection)));
+  if (chunk_prefetcher_ != nullptr) {
+    // Chunks read ahead have been decoded with the old field projection.
+    chunk_prefetcher_->Clear();
+    chunk_prefetcher_->SetFieldProjection(field_projection);
+  }
+  chunk_decoder_.Reset(
+      ChunkDecoder::Options()
+          .set_field_projection(std::move(field_projection))
+          .set_zstd_dictionary(zstd_dictionary_)
+          .set_brotli_dictionary(brotli_dictionary_)
+          .set_simple_uncompressed_only(simple_uncompressed_only_)
+          .set_decompression_backend(decompression_backend_));
   if (ABSL_PREDICT_FALSE(!src.Seek(chunk_begin_))) return FailSeeking(src);
   if (record_index > 0) {
     if (ABSL_PREDICT_FALSE(!ReadChunk())) return TryRecovery();
@@ -345,6 +1367,42 @@ bool RecordReaderBase::SetFieldProjection(FieldProjection field_projection) {
 }
 
 bool RecordReaderBase::Recover(SkippedRegion* skipped_region) {
+  if (ABSL_PREDICT_FALSE(!RecoverImpl(skipped_region))) return false;
+  if (collect_stats_) ++stats_.num_recoveries;
+  if (merge_skipped_regions_) MergeFollowingSkippedRegions(skipped_region);
+  return true;
+}
+
+inline void RecordReaderBase::MergeFollowingSkippedRegions(
+    SkippedRegion* skipped_region) {
+  RIEGELI_ASSERT(merge_skipped_regions_)
+      << "Failed precondition of "
+         "RecordReaderBase::MergeFollowingSkippedRegions(): "
+         "merging skipped regions not enabled";
+  uint64_t num_regions = 1;
+  Position region_end = skipped_region == nullptr ? 0 : skipped_region->end();
+  // Only a fully consumed chunk is followed by another chunk. Records remaining
+  // after an unparsable message are valid.
+  while (healthy() && chunk_decoder_.index() == chunk_decoder_.num_records() &&
+         !ReadNextChunk()) {
+    // No more chunks.
+    if (healthy()) break;
+    SkippedRegion next_region;
+    // If recovery is not applicable, the failure is reported by the next
+    // operation.
+    if (ABSL_PREDICT_FALSE(!RecoverImpl(&next_region))) break;
+    ++num_regions;
+    region_end = next_region.end();
+  }
+  if (skipped_region != nullptr && num_regions > 1) {
+    *skipped_region = SkippedRegion(
+        skipped_region->begin(), region_end,
+        absl::StrCat(skipped_region->message(), " (", num_regions,
+                     " consecutive invalid regions)"));
+  }
+}
+
+inline bool RecordReaderBase::RecoverImpl(SkippedRegion* skipped_region) {
   if (recoverable_ == Recoverable::kNo) return false;
   ChunkReader& src = *src_chunk_reader();
   RIEGELI_ASSERT(!healthy()) << "Failed invariant of RecordReader: "
@@ -380,6 +1438,30 @@ bool RecordReaderBase::Recover(SkippedRegion* skipped_region) {
       << "Unknown recoverable method: " << static_cast<int>(recoverable);
 }
 
+size_t RecordReaderBase::EstimateMemory() const {
+  MemoryEstimator memory_estimator;
+  RegisterSubobjects(memory_estimator);
+  return memory_estimator.TotalMemory();
+}
+
+void RecordReaderBase::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  chunk_decoder_.RegisterSubobjects(memory_estimator);
+  if (chunk_prefetcher_ != nullptr) {
+    memory_estimator.RegisterDynamicMemory(sizeof(ChunkPrefetcher));
+    chunk_prefetcher_->RegisterSubobjects(memory_estimator);
+  }
+  chunk_index_.RegisterSubobjects(memory_estimator);
+  memory_estimator.RegisterDynamicMemory(chunk_cache_key_.capacity());
+}
+
+RecordReaderStats RecordReaderBase::stats() const {
+  RecordReaderStats stats = stats_;
+  const ChunkReader* const src = src_chunk_reader();
+  if (src != nullptr) stats.chunk_reader = src->stats();
+  return stats;
+}
+
 bool RecordReaderBase::SupportsRandomAccess() {
   ChunkReader* const src = src_chunk_reader();
   return src != nullptr && src->SupportsRandomAccess();
@@ -398,16 +1480,7 @@ bool RecordReaderBase::Seek(RecordPosition new_pos) {
       goto skip_reading_chunk;
     }
   } else {
-    if (ABSL_PREDICT_FALSE(!src.Seek(new_pos.chunk_begin()))) {
-      return FailSeeking(src);
-    }
-    if (new_pos.record_index() == 0) {
-      // Seeking to the beginning of a chunk does not need reading the chunk,
-      // which is important because it may be non-existent at end of file.
-      chunk_begin_ = src.pos();
-      chunk_decoder_.Clear();
-      return true;
-    }
+    return SeekToOtherChunk(new_pos);
   }
   if (ABSL_PREDICT_FALSE(!ReadChunk())) return TryRecovery();
 skip_reading_chunk:
@@ -415,15 +1488,284 @@ skip_reading_chunk:
   return true;
 }
 
+inline bool RecordReaderBase::SeekToOtherChunk(RecordPosition new_pos) {
+  ChunkReader& src = *src_chunk_reader();
+  if (chunk_prefetcher_ != nullptr) chunk_prefetcher_->Clear();
+  if (ABSL_PREDICT_FALSE(!src.Seek(new_pos.chunk_begin()))) {
+    return FailSeeking(src);
+  }
+  if (new_pos.record_index() == 0) {
+    // Seeking to the beginning of a chunk does not need reading the chunk,
+    // which is important because it may be non-existent at end of file.
+    chunk_begin_ = src.pos();
+    chunk_decoder_.Clear();
+    return true;
+  }
+  if (ABSL_PREDICT_FALSE(!ReadChunk())) return TryRecovery();
+  chunk_decoder_.SetIndex(new_pos.record_index());
+  return true;
+}
+
+bool RecordReaderBase::SeekToRecordIndex(uint64_t record_index) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
+  if (ABSL_PREDICT_FALSE(!chunk_index_loaded_)) {
+    if (ABSL_PREDICT_FALSE(!LoadChunkIndex())) return TryRecovery();
+  }
+  const absl::optional<RecordPosition> new_pos =
+      chunk_index_.Find(record_index);
+  return Seek(new_pos != absl::nullopt ? *new_pos
+                                       : RecordPosition(chunk_index_end_, 0));
+}
+
+bool RecordReaderBase::SkipChunksWhere(
+    absl::FunctionRef<bool(absl::string_view min_key,
+                           absl::string_view max_key)>
+        predicate) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
+  if (ABSL_PREDICT_FALSE(!chunk_index_loaded_)) {
+    if (ABSL_PREDICT_FALSE(!LoadChunkIndex())) return TryRecovery();
+  }
+  if (!chunk_index_.has_keys()) return true;
+  const RecordPosition current_pos = pos();
+  // The current chunk is not skipped if some of its records have been read.
+  size_t chunk_index = chunk_index_.FirstChunkAtOrAfter(
+      current_pos.record_index() > 0 ? current_pos.chunk_begin() + 1
+                                     : current_pos.chunk_begin());
+  const size_t first_chunk_index = chunk_index;
+  while (chunk_index < chunk_index_.num_chunks() &&
+         predicate(chunk_index_.min_key(chunk_index),
+                   chunk_index_.max_key(chunk_index))) {
+    ++chunk_index;
+  }
+  if (chunk_index == first_chunk_index) return true;
+  return Seek(RecordPosition(chunk_index < chunk_index_.num_chunks()
+                                 ? chunk_index_.chunk_begin(chunk_index)
+                                 : chunk_index_end_,
+                             0));
+}
+
+bool RecordReaderBase::SkipChunksWithoutKey(absl::string_view key) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
+  if (ABSL_PREDICT_FALSE(!chunk_index_loaded_)) {
+    if (ABSL_PREDICT_FALSE(!LoadChunkIndex())) return TryRecovery();
+  }
+  if (!chunk_index_.has_keys()) return true;
+  const RecordPosition current_pos = pos();
+  // The rest of the current chunk is not skipped if some of its records have
+  // been read.
+  if (current_pos.record_index() > 0) return true;
+  const uint64_t key_hash = ChunkIndex::KeyHash(key);
+  size_t chunk_index =
+      chunk_index_.FirstChunkAtOrAfter(current_pos.chunk_begin());
+  const size_t first_chunk_index = chunk_index;
+  while (chunk_index < chunk_index_.num_chunks() &&
+         (key < chunk_index_.min_key(chunk_index) ||
+          key > chunk_index_.max_key(chunk_index) ||
+          !chunk_index_.MayContainKey(chunk_index, key_hash))) {
+    ++chunk_index;
+  }
+  if (chunk_index == first_chunk_index) return true;
+  return Seek(RecordPosition(chunk_index < chunk_index_.num_chunks()
+                                 ? chunk_index_.chunk_begin(chunk_index)
+                                 : chunk_index_end_,
+                             0));
+}
+
+bool RecordReaderBase::SearchChunkKeys(
+    absl::FunctionRef<absl::partial_ordering(absl::string_view key)> test) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
+  if (ABSL_PREDICT_FALSE(!chunk_index_loaded_)) {
+    if (ABSL_PREDICT_FALSE(!LoadChunkIndex())) return TryRecovery();
+  }
+  if (ABSL_PREDICT_FALSE(!chunk_index_.has_keys())) {
+    return Fail(absl::FailedPreconditionError(
+        "SearchChunkKeys() requires chunk keys, which are stored if "
+        "RecordWriterBase::Options::chunk_key() is set"));
+  }
+  // Find the first chunk whose largest key is not `less`.
+  size_t low = 0;
+  size_t high = chunk_index_.num_chunks();
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (test(chunk_index_.max_key(middle)) < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return Seek(RecordPosition(low < chunk_index_.num_chunks()
+                                 ? chunk_index_.chunk_begin(low)
+                                 : chunk_index_end_,
+                             0));
+}
+
+inline bool RecordReaderBase::LoadChunkIndex() {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of RecordReaderBase::LoadChunkIndex(): "
+      << status();
+  ChunkReader& src = *src_chunk_reader();
+  // `src` will be moved, so remember the position to return to.
+  const RecordPosition saved_pos = pos();
+  if (chunk_prefetcher_ != nullptr) chunk_prefetcher_->Clear();
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) {
+    return FailLoadingChunkIndex(src);
+  }
+  // The chunk index is the last chunk, possibly followed by padding.
+  Position chunk_pos = *size;
+  while (chunk_pos > 0) {
+    if (ABSL_PREDICT_FALSE(!src.SeekToChunkBefore(chunk_pos - 1))) {
+      return FailLoadingChunkIndex(src);
+    }
+    const Position chunk_begin = src.pos();
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) {
+        return FailLoadingChunkIndex(src);
+      }
+      break;
+    }
+    if (chunk_header->chunk_type() == ChunkType::kPadding) {
+      chunk_pos = chunk_begin;
+      continue;
+    }
+    if (chunk_header->chunk_type() == ChunkType::kChunkIndex) {
+      Chunk chunk;
+      if (ABSL_PREDICT_FALSE(!src.ReadChunk(chunk))) {
+        if (ABSL_PREDICT_FALSE(!src.healthy())) {
+          return FailLoadingChunkIndex(src);
+        }
+        break;
+      }
+      // If the chunk index is not valid here, e.g. if the file was physically
+      // concatenated after another file, fall back to reading chunk headers.
+      if (chunk_index_.DecodeChunk(chunk, chunk_begin).ok()) {
+        chunk_index_end_ = chunk_begin;
+        chunk_index_loaded_ = true;
+        return SeekToOtherChunk(saved_pos);
+      }
+    }
+    break;
+  }
+  // There is no usable chunk index. Build it by reading chunk headers, which
+  // is faster than reading chunks, but needs to visit the whole file.
+  chunk_index_.Clear();
+  if (ABSL_PREDICT_FALSE(!src.Seek(0))) return FailLoadingChunkIndex(src);
+  for (;;) {
+    const Position chunk_begin = src.pos();
+    const ChunkHeader* chunk_header;
+    if (!src.PullChunkHeader(&chunk_header)) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) {
+        return FailLoadingChunkIndex(src);
+      }
+      break;
+    }
+    const Position chunk_end = internal::ChunkEnd(*chunk_header, chunk_begin);
+    if (ABSL_PREDICT_FALSE(chunk_end > *size)) {
+      // The last chunk is truncated.
+      break;
+    }
+    chunk_index_.Add(chunk_begin, chunk_header->num_records());
+    if (ABSL_PREDICT_FALSE(!src.Seek(chunk_end))) {
+      return FailLoadingChunkIndex(src);
+    }
+  }
+  chunk_index_end_ = src.pos();
+  chunk_index_loaded_ = true;
+  return SeekToOtherChunk(saved_pos);
+}
+
+bool RecordReaderBase::ReadFileSummary(FileSummary& summary) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  ChunkReader& src = *src_chunk_reader();
+  if (!src.SupportsRandomAccess()) return false;
+  // `src` will be moved, so remember the position to return to.
+  const RecordPosition saved_pos = pos();
+  if (chunk_prefetcher_ != nullptr) chunk_prefetcher_->Clear();
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) {
+    FailSeeking(src);
+    return false;
+  }
+  // The file summary is the last chunk, possibly followed by the chunk index
+  // and padding.
+  bool found = false;
+  Position chunk_pos = *size;
+  while (chunk_pos > 0) {
+    if (ABSL_PREDICT_FALSE(!src.SeekToChunkBefore(chunk_pos - 1))) {
+      FailSeeking(src);
+      return false;
+    }
+    const Position chunk_begin = src.pos();
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) {
+        FailSeeking(src);
+        return false;
+      }
+      break;
+    }
+    if (chunk_header->chunk_type() == ChunkType::kPadding ||
+        chunk_header->chunk_type() == ChunkType::kChunkIndex) {
+      chunk_pos = chunk_begin;
+      continue;
+    }
+    if (chunk_header->chunk_type() == ChunkType::kFileSummary) {
+      Chunk chunk;
+      if (ABSL_PREDICT_FALSE(!src.ReadChunk(chunk))) {
+        if (ABSL_PREDICT_FALSE(!src.healthy())) {
+          FailSeeking(src);
+          return false;
+        }
+        break;
+      }
+      // If the file summary is not valid here, e.g. if the file was physically
+      // concatenated after another file, it does not describe the whole file.
+      found = summary.DecodeChunk(chunk, chunk_begin).ok();
+    }
+    break;
+  }
+  if (ABSL_PREDICT_FALSE(!SeekToOtherChunk(saved_pos))) return false;
+  return found;
+}
+
 bool RecordReaderBase::Seek(Position new_pos) {
   last_record_is_valid_ = false;
   if (ABSL_PREDICT_FALSE(!healthy())) return TryRecovery();
   ChunkReader& src = *src_chunk_reader();
-  if (new_pos >= chunk_begin_ && new_pos <= src.pos()) {
+  const Position next_chunk_begin = chunk_prefetcher_ != nullptr
+                                        ? PrefetchedChunkBegin(src)
+                                        : src.pos();
+  if (new_pos >= chunk_begin_ && new_pos <= next_chunk_begin) {
     // Seeking inside or just after the current chunk which has been read,
     // or to the beginning of the current chunk which has been located,
     // or to the end of file which has been reached.
+  } else if (chunk_index_loaded_ && chunk_index_.num_chunks() > 0 &&
+             new_pos >= chunk_index_.chunk_begin(0) &&
+             new_pos < chunk_index_end_) {
+    // The chunk index locates the chunk without reading block headers. Chunks
+    // before the first chunk with records, e.g. file metadata, are not indexed.
+    const size_t next_chunk = chunk_index_.FirstChunkAtOrAfter(new_pos);
+    if (next_chunk > 0) {
+      const Position chunk_begin = chunk_index_.chunk_begin(next_chunk - 1);
+      if (new_pos - chunk_begin <
+          chunk_index_.chunk_num_records(next_chunk - 1)) {
+        return SeekToOtherChunk(
+            RecordPosition(chunk_begin, new_pos - chunk_begin));
+      }
+    }
+    // `new_pos` falls after all records of the previous chunk.
+    return SeekToOtherChunk(
+        RecordPosition(next_chunk < chunk_index_.num_chunks()
+                           ? chunk_index_.chunk_begin(next_chunk)
+                           : chunk_index_end_,
+                       0));
   } else {
+    if (chunk_prefetcher_ != nullptr) chunk_prefetcher_->Clear();
     if (ABSL_PREDICT_FALSE(!src.SeekToChunkContaining(new_pos))) {
       return FailSeeking(src);
     }
@@ -452,6 +1794,7 @@ bool RecordReaderBase::SeekBack() {
     return true;
   }
   ChunkReader& src = *src_chunk_reader();
+  if (chunk_prefetcher_ != nullptr) chunk_prefetcher_->Clear();
   Position chunk_pos = chunk_begin_;
   while (chunk_pos > 0) {
     if (ABSL_PREDICT_FALSE(!src.SeekToChunkBefore(chunk_pos - 1))) {
@@ -531,6 +1874,7 @@ bool RecordReaderBase::Search(
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   last_record_is_valid_ = false;
   ChunkReader& src = *src_chunk_reader();
+  if (chunk_prefetcher_ != nullptr) chunk_prefetcher_->Clear();
   const absl::optional<Position> size = src.Size();
   if (ABSL_PREDICT_FALSE(size == absl::nullopt)) return Fail(src);
   struct ChunkSuffix {
@@ -659,24 +2003,366 @@ bool RecordReaderBase::Search(
   return true;
 }
 
+inline bool RecordReaderBase::SkipFileMetadata(ChunkReader& src) {
+  if (src.pos() == 0) {
+    // The file signature is read first.
+    return true;
+  }
+  if (!file_metadata_checked_ && zstd_dictionary_.empty()) {
+    // File metadata can contain a Zstd dictionary needed for decoding chunks.
+    if (src.pos() != kFileMetadataBegin) {
+      file_metadata_checked_ = true;
+      return LoadFileMetadataFrom(src);
+    }
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) return false;
+    file_metadata_checked_ = true;
+    if (chunk_header->chunk_type() != ChunkType::kFileMetadata) return true;
+    Chunk chunk;
+    if (ABSL_PREDICT_FALSE(!src.ReadChunk(chunk))) return false;
+    LoadZstdDictionary(chunk);
+    return true;
+  }
+  if (src.pos() != kFileMetadataBegin) return true;
+  const ChunkHeader* chunk_header;
+  if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) return false;
+  if (chunk_header->chunk_type() != ChunkType::kFileMetadata) return true;
+  return src.SkipChunk();
+}
+
+inline bool RecordReaderBase::LoadFileMetadataFrom(ChunkReader& src) {
+  if (!src.SupportsRandomAccess()) return true;
+  const Position pos = src.pos();
+  if (src.Seek(kFileMetadataBegin)) {
+    const ChunkHeader* chunk_header;
+    Chunk chunk;
+    if (src.PullChunkHeader(&chunk_header) &&
+        chunk_header->chunk_type() == ChunkType::kFileMetadata &&
+        src.ReadChunk(chunk)) {
+      LoadZstdDictionary(chunk);
+    }
+  }
+  // A failure to read file metadata is not reported here, because they are
+  // not needed unless they contain a Zstd dictionary.
+  if (ABSL_PREDICT_FALSE(!src.healthy()) && !src.Recover()) return false;
+  return src.Seek(pos);
+}
+
+inline void RecordReaderBase::LoadZstdDictionary(const Chunk& chunk) {
+  Chain metadata;
+  // Invalid metadata are reported only by `ReadMetadata()`.
+  if (ABSL_PREDICT_FALSE(!DecodeMetadata(chunk, metadata).ok())) return;
+  LoadZstdDictionary(metadata);
+}
+
 inline bool RecordReaderBase::ReadChunk() {
   RIEGELI_ASSERT(healthy())
       << "Failed precondition of RecordReaderBase::ReadChunk(): " << status();
   ChunkReader& src = *src_chunk_reader();
+  if (ABSL_PREDICT_FALSE(!SkipFileMetadata(src))) {
+    chunk_decoder_.Clear();
+    memory_reservation_.Release();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkReader;
+      return Fail(src);
+    }
+    return false;
+  }
   chunk_begin_ = src.pos();
+  if (end_pos_ != absl::nullopt && chunk_begin_ >= *end_pos_) {
+    chunk_decoder_.Clear();
+    memory_reservation_.Release();
+    return false;
+  }
+  if (chunk_cache_ != nullptr) {
+    const std::shared_ptr<const DecodedChunk> cached_chunk =
+        chunk_cache_->Find(chunk_cache_key_, chunk_begin_);
+    if (cached_chunk != nullptr) {
+      // The cache owns the memory of the chunk, shared with `chunk_decoder_`.
+      memory_reservation_.Release();
+      if (ABSL_PREDICT_FALSE(!src.Seek(cached_chunk->chunk_end))) {
+        chunk_decoder_.Clear();
+        recoverable_ = Recoverable::kRecoverChunkReader;
+        return Fail(src);
+      }
+      chunk_decoder_.SetRecords(cached_chunk->values, cached_chunk->limits);
+      UpdateReferenceChunks(cached_chunk->chunk_end);
+      if (collect_stats_) {
+        ++stats_.num_chunks;
+        ++stats_.num_cached_chunks;
+      }
+      return true;
+    }
+  }
+  if (memory_budget_ != nullptr) {
+    // Release memory of the previous chunk before waiting for memory of the
+    // next chunk, so that `RecordReader`s sharing the budget cannot deadlock.
+    chunk_decoder_.Clear();
+    memory_reservation_.Release();
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) {
+        recoverable_ = Recoverable::kRecoverChunkReader;
+        return Fail(src);
+      }
+      return false;
+    }
+    memory_reservation_ =
+        memory_budget_->Reserve(ChunkMemorySize(*chunk_header));
+  }
   Chunk chunk;
   if (ABSL_PREDICT_FALSE(!src.ReadChunk(chunk))) {
     chunk_decoder_.Clear();
+    memory_reservation_.Release();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkReader;
+      return Fail(src);
+    }
+    return false;
+  }
+  if (chunk.header.chunk_type() == ChunkType::kReferencing &&
+      ABSL_PREDICT_FALSE(!LoadReference(chunk))) {
+    return false;
+  }
+  if (ABSL_PREDICT_FALSE(!DecodeChunk(chunk))) {
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return Fail(chunk_decoder_);
+  }
+  UpdateReferenceChunks(src.pos());
+  if (chunk_cache_ != nullptr) {
+    std::shared_ptr<DecodedChunk> decoded_chunk =
+        std::make_shared<DecodedChunk>();
+    chunk_decoder_.TakeRecords(decoded_chunk->values, decoded_chunk->limits);
+    decoded_chunk->chunk_end = src.pos();
+    chunk_decoder_.SetRecords(decoded_chunk->values, decoded_chunk->limits);
+    chunk_cache_->Insert(chunk_cache_key_, chunk_begin_,
+                         std::move(decoded_chunk));
+  }
+  return true;
+}
+
+inline bool RecordReaderBase::DecodeChunk(const Chunk& chunk) {
+  if (!collect_stats_ && trace_sink_ == nullptr) {
+    return chunk_decoder_.Decode(chunk);
+  }
+  const absl::Time decode_start = absl::Now();
+  const bool decode_ok = chunk_decoder_.Decode(chunk);
+  const absl::Time decode_end = absl::Now();
+  if (trace_sink_ != nullptr) {
+    trace_sink_->AddEvent(TraceEvent{TraceStage::kDecodeChunk, chunk_begin_,
+                                     chunk.header.data_size(), decode_start,
+                                     decode_end});
+  }
+  if (!collect_stats_) return decode_ok;
+  stats_.decode_time += decode_end - decode_start;
+  if (ABSL_PREDICT_FALSE(!decode_ok)) return false;
+  ++stats_.num_chunks;
+  stats_.num_compressed_bytes += chunk.header.data_size();
+  stats_.num_decoded_bytes += chunk.header.decoded_data_size();
+  return true;
+}
+
+inline bool RecordReaderBase::LoadReference(const Chunk& chunk) {
+  const absl::optional<ChunkDecoder::Reference> reference =
+      ChunkDecoder::ReadReference(chunk);
+  if (ABSL_PREDICT_FALSE(reference == absl::nullopt ||
+                         reference->distance > chunk_begin_)) {
+    chunk_decoder_.Fail(absl::DataLossError("Invalid chunk reference"));
+    recoverable_ = Recoverable::kRecoverChunkDecoder;
+    return Fail(chunk_decoder_);
+  }
+  max_reference_chunks_ =
+      UnsignedMax(max_reference_chunks_, reference->num_chunks);
+  const Position reference_begin = chunk_begin_ - reference->distance;
+  if (reference_chunks_end_ != chunk_begin_) reference_chunks_.clear();
+  while (!reference_chunks_.empty() &&
+         reference_chunks_.front().chunk_begin < reference_begin) {
+    reference_chunks_.pop_front();
+  }
+  if (reference_chunks_.empty() ||
+      reference_chunks_.front().chunk_begin != reference_begin ||
+      reference_chunks_.size() != reference->num_chunks) {
+    // Chunks referred to were not read just before, e.g. after seeking. Read
+    // them, keeping their records also for chunks following this one.
+    reference_chunks_.clear();
+    ChunkReader& src = *src_chunk_reader();
+    const Position chunk_end = src.pos();
+    ChunkDecoder reference_decoder(
+        ChunkDecoder::Options()
+            .set_zstd_dictionary(zstd_dictionary_)
+            .set_brotli_dictionary(brotli_dictionary_)
+            .set_decompression_backend(decompression_backend_));
+    absl::Status status;
+    if (src.Seek(reference_begin)) {
+      while (reference_chunks_.size() < reference->num_chunks) {
+        const Position reference_chunk_begin = src.pos();
+        if (ABSL_PREDICT_FALSE(reference_chunk_begin >= chunk_begin_)) break;
+        Chunk reference_chunk;
+        if (ABSL_PREDICT_FALSE(!src.ReadChunk(reference_chunk))) break;
+        if (reference_chunk.header.num_records() == 0) continue;
+        if (reference_chunk.header.chunk_type() == ChunkType::kReferencing) {
+          // Chunks of a group refer to all preceding chunks of the group.
+          const absl::optional<ChunkDecoder::Reference> chunk_reference =
+              ChunkDecoder::ReadReference(reference_chunk);
+          if (ABSL_PREDICT_FALSE(
+                  chunk_reference == absl::nullopt ||
+                  chunk_reference->distance !=
+                      reference_chunk_begin - reference_begin ||
+                  chunk_reference->num_chunks != reference_chunks_.size())) {
+            status = absl::DataLossError("Invalid chunk reference");
+            break;
+          }
+          Chain records;
+          for (const ReferenceChunk& previous_chunk : reference_chunks_) {
+            records.Append(previous_chunk.records);
+          }
+          reference_decoder.SetReference(std::move(records));
+        }
+        if (ABSL_PREDICT_FALSE(!reference_decoder.Decode(reference_chunk))) {
+          status = reference_decoder.status();
+          break;
+        }
+        Chain records;
+        std::vector<size_t> limits;
+        reference_decoder.TakeRecords(records, limits);
+        reference_chunks_.push_back(
+            ReferenceChunk{reference_chunk_begin, std::move(records)});
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!src.healthy()) ||
+        ABSL_PREDICT_FALSE(!src.Seek(chunk_end))) {
+      reference_chunks_.clear();
+      chunk_decoder_.Clear();
+      recoverable_ = Recoverable::kRecoverChunkReader;
+      return Fail(src);
+    }
+    if (status.ok() && reference_chunks_.size() != reference->num_chunks) {
+      status = absl::DataLossError("Chunks referred to not found");
+    }
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      reference_chunks_.clear();
+      chunk_decoder_.Fail(std::move(status));
+      recoverable_ = Recoverable::kRecoverChunkDecoder;
+      return Fail(chunk_decoder_);
+    }
+  }
+  Chain records;
+  for (const ReferenceChunk& reference_chunk : reference_chunks_) {
+    records.Append(reference_chunk.records);
+  }
+  chunk_decoder_.SetReference(std::move(records));
+  reference_chunks_end_ = chunk_begin_;
+  return true;
+}
+
+inline void RecordReaderBase::UpdateReferenceChunks(Position chunk_end) {
+  if (max_reference_chunks_ == 0) return;
+  if (reference_chunks_end_ != chunk_begin_) reference_chunks_.clear();
+  reference_chunks_end_ = chunk_end;
+  if (chunk_decoder_.num_records() == 0) return;
+  if (ABSL_PREDICT_FALSE(!chunk_decoder_.field_projection().includes_all())) {
+    // Records are incomplete. Chunks referred to will be read again.
+    reference_chunks_.clear();
+    return;
+  }
+  Chain records;
+  std::vector<size_t> limits;
+  chunk_decoder_.TakeRecords(records, limits);
+  chunk_decoder_.SetRecords(records, std::move(limits));
+  if (reference_chunks_.size() == max_reference_chunks_) {
+    reference_chunks_.pop_front();
+  }
+  reference_chunks_.push_back(ReferenceChunk{chunk_begin_, std::move(records)});
+}
+
+bool RecordReaderBase::WaitForMoreData() {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of RecordReaderBase::WaitForMoreData(): "
+      << status();
+  if (!follow_) return false;
+  if (end_pos_ != absl::nullopt && chunk_begin_ >= *end_pos_) return false;
+  const absl::Time now = absl::Now();
+  if (follow_backoff_ == absl::ZeroDuration() ||
+      follow_chunk_begin_ != chunk_begin_) {
+    // This is the first wait at this position.
+    follow_chunk_begin_ = chunk_begin_;
+    follow_wait_start_ = now;
+    follow_backoff_ = absl::Milliseconds(1);
+  } else {
+    follow_backoff_ = std::min(follow_backoff_ * 2, follow_poll_interval_);
+  }
+  const absl::Duration remaining = follow_timeout_ - (now - follow_wait_start_);
+  if (remaining <= absl::ZeroDuration()) {
+    follow_backoff_ = absl::ZeroDuration();
+    return false;
+  }
+  absl::SleepFor(std::min(follow_backoff_, remaining));
+  return true;
+}
+
+inline bool RecordReaderBase::ReadNextChunk() {
+  if (chunk_prefetcher_ == nullptr) return ReadChunk();
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of RecordReaderBase::ReadNextChunk(): "
+      << status();
+  ChunkReader& src = *src_chunk_reader();
+  // Release memory of the previous chunk before the first chunk read ahead
+  // waits for memory.
+  chunk_decoder_.Clear();
+  memory_reservation_.Release();
+  // Skip file metadata before chunks are read ahead, because a Zstd dictionary
+  // loaded from them can be needed for decoding the chunks.
+  if (ABSL_PREDICT_FALSE(!SkipFileMetadata(src))) {
+    chunk_begin_ = src.pos();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) {
+      recoverable_ = Recoverable::kRecoverChunkReader;
+      return Fail(src);
+    }
+    return false;
+  }
+  const auto is_unsampled = [&](uint64_t records_before,
+                                uint64_t num_records) {
+    return sample_rate_ < 1.0 &&
+           RecordsAreUnsampled(records_before, num_records);
+  };
+  chunk_prefetcher_->ReadAhead(src, /*may_wait=*/true, is_unsampled);
+  if (sample_rate_ < 1.0) {
+    const uint64_t num_skipped = chunk_prefetcher_->TakeSkippedChunks();
+    RIEGELI_ASSERT_LE(num_skipped, records_to_skip_)
+        << "Chunk prefetcher skipped a sampled record";
+    records_to_skip_ -= num_skipped;
+  }
+  if (chunk_prefetcher_->empty()) {
+    const ChunkHeader* chunk_header;
+    if (src.healthy() && src.PullChunkHeader(&chunk_header) &&
+        (chunk_header->chunk_type() == ChunkType::kReferencing ||
+         chunk_header->chunk_type() == ChunkType::kFileMetadata)) {
+      // A chunk with a reference is not read ahead, because decoding it needs
+      // records of chunks before it. File metadata are left to
+      // `SkipFileMetadata()`.
+      return ReadChunk();
+    }
+    // No chunk could be read ahead, so `src` is positioned where reading ended
+    // or failed, like after `ReadChunk()`.
+    chunk_begin_ = src.pos();
     if (ABSL_PREDICT_FALSE(!src.healthy())) {
       recoverable_ = Recoverable::kRecoverChunkReader;
       return Fail(src);
     }
     return false;
   }
-  if (ABSL_PREDICT_FALSE(!chunk_decoder_.Decode(chunk))) {
+  chunk_begin_ = chunk_prefetcher_->chunk_begin();
+  const Position chunk_end = chunk_prefetcher_->chunk_end();
+  chunk_decoder_ = chunk_prefetcher_->TakeChunk(memory_reservation_, stats_);
+  // Keep `parallelism` chunks being decoded while records of this chunk are
+  // being read. This must not wait for memory while `memory_reservation_` is
+  // held.
+  chunk_prefetcher_->ReadAhead(src, /*may_wait=*/false, is_unsampled);
+  if (ABSL_PREDICT_FALSE(!chunk_decoder_.healthy())) {
     recoverable_ = Recoverable::kRecoverChunkDecoder;
     return Fail(chunk_decoder_);
   }
+  UpdateReferenceChunks(chunk_end);
   return true;
 }
 
@@ -15,12 +15,18 @@
 #ifndef RIEGELI_RECORDS_RECORD_READER_H_
 #define RIEGELI_RECORDS_RECORD_READER_H_
 
+#include <stddef.h>
+
+#include <deque>
 #include <functional>
+#include <future>
 #include <memory>
+#include <random>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/functional/function_ref.h"
@@ -28,25 +34,45 @@
 #include "absl/strings/string_view.h"
 #include "absl/types/compare.h"
 #include "absl/types/optional.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_budget.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/brotli/brotli_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/decompression_backend.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/records/chunk_cache.h"
+#include "riegeli/records/chunk_index.h"
 #include "riegeli/records/chunk_reader.h"
 #include "riegeli/records/chunk_reader_dependency.h"
+#include "riegeli/records/encoded_chunk_cache.h"
+#include "riegeli/records/file_summary.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/records_metadata.pb.h"
+#include "riegeli/records/sidecar_index.h"
 #include "riegeli/records/skipped_region.h"
+#include "riegeli/records/trace_sink.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 namespace riegeli {
 
 // Interprets `record_type_name` and `file_descriptor` from metadata.
+//
+// Descriptors built from the same `file_descriptor` are cached and shared by
+// `RecordsMetadataDescriptors` objects of the whole process, so that opening
+// many files with the same record type does not build them again.
 class RecordsMetadataDescriptors : public Object {
  public:
   explicit RecordsMetadataDescriptors(const RecordsMetadata& metadata);
@@ -61,14 +87,52 @@ class RecordsMetadataDescriptors : public Object {
   // object is valid.
   const google::protobuf::Descriptor* descriptor() const;
 
+  // Returns the default instance of a dynamic message of the record type, whose
+  // `New()` creates messages to parse records into, or `nullptr` if not
+  // available.
+  //
+  // The message is valid as long as the `RecordsMetadataDescriptors` object is
+  // valid.
+  const google::protobuf::Message* prototype() const;
+
   // Returns record type full name, or an empty string if not available.
   const std::string& record_type_name() const { return record_type_name_; }
 
  private:
   class ErrorCollector;
+  struct Pool;
+  class PoolCache;
 
   std::string record_type_name_;
-  std::unique_ptr<google::protobuf::DescriptorPool> pool_;
+  // Immutable, possibly shared with other `RecordsMetadataDescriptors`.
+  std::shared_ptr<const Pool> pool_;
+};
+
+// Counters describing the work of a `RecordReader`, returned by its `stats()`
+// if enabled by `RecordReaderBase::Options::set_collect_stats()`.
+struct RecordReaderStats {
+  RecordReaderStats& operator+=(const RecordReaderStats& that);
+
+  // Number of records read by `ReadRecord()` and `ReadRecords()`.
+  uint64_t num_records = 0;
+  // Number of chunks decoded, or found in the `ChunkCache`.
+  uint64_t num_chunks = 0;
+  // Number of these chunks found in the `ChunkCache`.
+  uint64_t num_cached_chunks = 0;
+  // Total chunk data size of chunks decoded, before decompression.
+  Position num_compressed_bytes = 0;
+  // Total size of records of chunks decoded, after decompression.
+  Position num_decoded_bytes = 0;
+  // Number of successful `Recover()` calls, including calls made because of
+  // `RecordReaderBase::Options::recovery()`.
+  uint64_t num_recoveries = 0;
+  // Time spent verifying chunk data hashes of chunks read ahead in background.
+  absl::Duration hash_time;
+  // Time spent decompressing and decoding chunks, including in background.
+  absl::Duration decode_time;
+  // Counters of `src_chunk_reader()`, including reading from the source and
+  // verifying chunk data hashes of chunks which were not read ahead.
+  ChunkReaderStats chunk_reader;
 };
 
 // Template parameter independent part of `RecordReader`.
@@ -106,6 +170,117 @@ class RecordReaderBase : public Object {
       return field_projection_;
     }
 
+    // Zstd dictionary which was passed to
+    // `RecordWriterBase::Options::set_zstd_dictionary()` for writing.
+    //
+    // If the dictionary has an ID, it is stored in `RecordsMetadata`, which
+    // allows to find out which dictionary is needed. File metadata can be read
+    // without the dictionary.
+    //
+    // If no dictionary is set here, and the dictionary was trained by the
+    // writer (`RecordWriterBase::Options::set_zstd_dictionary_training()`),
+    // it is loaded from `RecordsMetadata` when reading reaches the file
+    // metadata, or when the first chunk is read elsewhere, in which case the
+    // file metadata are read first if the source supports random access.
+    //
+    // Default: `ZstdReaderBase::Dictionary()` (no dictionary).
+    Options& set_zstd_dictionary(
+        const ZstdReaderBase::Dictionary& zstd_dictionary) & {
+      zstd_dictionary_ = zstd_dictionary;
+      return *this;
+    }
+    Options& set_zstd_dictionary(
+        ZstdReaderBase::Dictionary&& zstd_dictionary) & {
+      zstd_dictionary_ = std::move(zstd_dictionary);
+      return *this;
+    }
+    Options&& set_zstd_dictionary(
+        const ZstdReaderBase::Dictionary& zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(zstd_dictionary));
+    }
+    Options&& set_zstd_dictionary(
+        ZstdReaderBase::Dictionary&& zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+    }
+    ZstdReaderBase::Dictionary& zstd_dictionary() { return zstd_dictionary_; }
+    const ZstdReaderBase::Dictionary& zstd_dictionary() const {
+      return zstd_dictionary_;
+    }
+
+    // Brotli dictionary which was passed to
+    // `RecordWriterBase::Options::set_brotli_dictionary()` for writing.
+    //
+    // File metadata can be read without the dictionary.
+    //
+    // Default: `BrotliReaderBase::Dictionary()` (no dictionary).
+    Options& set_brotli_dictionary(
+        const BrotliReaderBase::Dictionary& brotli_dictionary) & {
+      brotli_dictionary_ = brotli_dictionary;
+      return *this;
+    }
+    Options& set_brotli_dictionary(
+        BrotliReaderBase::Dictionary&& brotli_dictionary) & {
+      brotli_dictionary_ = std::move(brotli_dictionary);
+      return *this;
+    }
+    Options&& set_brotli_dictionary(
+        const BrotliReaderBase::Dictionary& brotli_dictionary) && {
+      return std::move(set_brotli_dictionary(brotli_dictionary));
+    }
+    Options&& set_brotli_dictionary(
+        BrotliReaderBase::Dictionary&& brotli_dictionary) && {
+      return std::move(set_brotli_dictionary(std::move(brotli_dictionary)));
+    }
+    BrotliReaderBase::Dictionary& brotli_dictionary() {
+      return brotli_dictionary_;
+    }
+    const BrotliReaderBase::Dictionary& brotli_dictionary() const {
+      return brotli_dictionary_;
+    }
+
+    // If `true`, the caller asserts that the file was written only with simple
+    // chunks without compression, e.g. with
+    // `RecordWriterBase::Options::FromString("uncompressed")`. Chunks are then
+    // decoded by a specialized path which skips setting up decompressors, see
+    // `ChunkDecoder::Options::set_simple_uncompressed_only()`.
+    //
+    // Transposed or compressed chunks make reading fail with
+    // `absl::FailedPreconditionError()`.
+    //
+    // Default: `false`.
+    Options& set_simple_uncompressed_only(bool simple_uncompressed_only) & {
+      simple_uncompressed_only_ = simple_uncompressed_only;
+      return *this;
+    }
+    Options&& set_simple_uncompressed_only(bool simple_uncompressed_only) && {
+      return std::move(set_simple_uncompressed_only(simple_uncompressed_only));
+    }
+    bool simple_uncompressed_only() const { return simple_uncompressed_only_; }
+
+    // Alternative implementation of decompressing chunk data, e.g. on a GPU,
+    // see `ChunkDecoder::Options::set_decompression_backend()`. With
+    // `parallelism() > 0` it is called concurrently for chunks decoded in
+    // background, which lets it batch them.
+    //
+    // `decompression_backend` is not owned and must outlive the
+    // `RecordReader`.
+    //
+    // `nullptr` decompresses everything on the CPU.
+    //
+    // Default: `nullptr`.
+    Options& set_decompression_backend(
+        DecompressionBackend* decompression_backend) & {
+      decompression_backend_ = decompression_backend;
+      return *this;
+    }
+    Options&& set_decompression_backend(
+        DecompressionBackend* decompression_backend) && {
+      return std::move(set_decompression_backend(decompression_backend));
+    }
+    DecompressionBackend* decompression_backend() const {
+      return decompression_backend_;
+    }
+
     // Sets the recovery function to be called after skipping over invalid file
     // contents.
     //
@@ -158,11 +333,327 @@ class RecordReaderBase : public Object {
       return recovery_;
     }
 
+    // If `true`, `Recover()` also skips invalid chunks directly following the
+    // skipped region, until a valid chunk is read or the source ends, and
+    // reports them together as one skipped region. The recovery function is
+    // then called once per damaged area of the file rather than once per
+    // invalid chunk, which keeps reading badly damaged files, e.g. with
+    // garbage after a crash, from being dominated by recovery.
+    //
+    // This makes `Recover()` read the chunk following the skipped region,
+    // which would otherwise be read by the next `ReadRecord()`.
+    //
+    // Default: `false`.
+    Options& set_merge_skipped_regions(bool merge_skipped_regions) & {
+      merge_skipped_regions_ = merge_skipped_regions;
+      return *this;
+    }
+    Options&& set_merge_skipped_regions(bool merge_skipped_regions) && {
+      return std::move(set_merge_skipped_regions(merge_skipped_regions));
+    }
+    bool merge_skipped_regions() const { return merge_skipped_regions_; }
+
+    // If `sample_rate < 1`, reading returns a random sample of records: each
+    // record independently with probability `sample_rate`. The sample is
+    // determined by `sample_seed` (for a given standard library).
+    //
+    // The numbers of records between sampled records are drawn in advance, so
+    // unsampled records are skipped without being parsed, and a chunk without
+    // sampled records is skipped by its header, without reading or decoding its
+    // data. With a small `sample_rate` and chunks small enough that most of
+    // them are skipped, this reads only a small part of the file. If
+    // `parallelism() > 0`, chunks are skipped also while reading ahead.
+    //
+    // `ReadRecords()` returns at most one record per call.
+    //
+    // `sample_rate` must be positive and at most 1.
+    //
+    // Default: 1 (all records).
+    Options& set_sample_rate(double sample_rate, uint64_t sample_seed = 0) & {
+      RIEGELI_ASSERT(sample_rate > 0.0 && sample_rate <= 1.0)
+          << "Failed precondition of "
+             "RecordReaderBase::Options::set_sample_rate(): "
+             "sample rate out of range: "
+          << sample_rate;
+      sample_rate_ = sample_rate;
+      sample_seed_ = sample_seed;
+      return *this;
+    }
+    Options&& set_sample_rate(double sample_rate, uint64_t sample_seed = 0) && {
+      return std::move(set_sample_rate(sample_rate, sample_seed));
+    }
+    double sample_rate() const { return sample_rate_; }
+    uint64_t sample_seed() const { return sample_seed_; }
+
+    // Sets the maximum number of chunks being decoded in parallel in
+    // background. Larger parallelism can increase throughput, up to a point
+    // where it no longer matters; smaller parallelism reduces memory usage.
+    //
+    // If `parallelism > 0`, chunks following the current chunk are read ahead
+    // when reading records sequentially, and are decoded in background.
+    // Records are still returned in order, and reading errors are reported
+    // when reading reaches the failed position.
+    //
+    // Seeking and closing discard chunks which have been read ahead, waiting
+    // until their decoding in background finishes.
+    //
+    // Default: 0.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "RecordReaderBase::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+    // Sets a `MemoryBudget` to reserve memory from before reading and decoding
+    // each chunk, for the compressed and decoded size of the chunk. The
+    // reservation is held while records of the chunk are available or while
+    // the chunk is read ahead.
+    //
+    // When the budget is exhausted, reading the next chunk waits until other
+    // users of the budget release memory, and reading ahead stops early.
+    //
+    // `nullptr` disables memory accounting.
+    //
+    // The `MemoryBudget` must outlive the `RecordReader`.
+    //
+    // Default: `nullptr`.
+    Options& set_memory_budget(MemoryBudget* memory_budget) & {
+      memory_budget_ = memory_budget;
+      return *this;
+    }
+    Options&& set_memory_budget(MemoryBudget* memory_budget) && {
+      return std::move(set_memory_budget(memory_budget));
+    }
+    MemoryBudget* memory_budget() const { return memory_budget_; }
+
+    // Specifies which chunks have their data hash verified, as in
+    // `DefaultChunkReaderBase::set_data_hash_verification_interval()`:
+    // 1 verifies every chunk, n > 1 every n-th chunk, 0 no chunk. The number of
+    // chunks not verified is available as
+    // `src_chunk_reader()->num_unverified_chunks()`.
+    //
+    // If `parallelism > 0`, data hashes are verified in background together
+    // with decoding, so that hashing a chunk overlaps with decoding the
+    // previous one.
+    //
+    // Default: 1.
+    Options& set_data_hash_verification_interval(uint64_t interval) & {
+      data_hash_verification_interval_ = interval;
+      return *this;
+    }
+    Options&& set_data_hash_verification_interval(uint64_t interval) && {
+      return std::move(set_data_hash_verification_interval(interval));
+    }
+    uint64_t data_hash_verification_interval() const {
+      return data_hash_verification_interval_;
+    }
+
+    // If not `absl::nullopt`, reading ends before the first chunk which begins
+    // at or after `end_pos`, as if the file ended there. Seeking to such a
+    // chunk also behaves like seeking to the end.
+    //
+    // Together with seeking to the beginning of a range returned by
+    // `SplitRecordFile()`, this reads the records of that range, which does not
+    // share records with other ranges.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_end_pos(absl::optional<Position> end_pos) & {
+      end_pos_ = end_pos;
+      return *this;
+    }
+    Options&& set_end_pos(absl::optional<Position> end_pos) && {
+      return std::move(set_end_pos(end_pos));
+    }
+    absl::optional<Position> end_pos() const { return end_pos_; }
+
+    // If `true`, the file is expected to be still growing, e.g. a log being
+    // written. At the end of the file, `ReadRecord()` and `ReadRecords()` wait
+    // for more data instead of returning `false`, and a partially written chunk
+    // at the end is read when it is complete. Reading ends, as at the end of
+    // the file, after `follow_timeout()` passes without a new chunk, or before
+    // reaching `end_pos()`.
+    //
+    // The file is checked for more data with exponential backoff, starting at
+    // 1ms, up to `follow_poll_interval()`.
+    //
+    // Default: `false`.
+    Options& set_follow(bool follow) & {
+      follow_ = follow;
+      return *this;
+    }
+    Options&& set_follow(bool follow) && {
+      return std::move(set_follow(follow));
+    }
+    bool follow() const { return follow_; }
+
+    // Sets the maximum interval between checks for more data if `follow()`.
+    //
+    // Default: `absl::Seconds(1)`.
+    Options& set_follow_poll_interval(absl::Duration follow_poll_interval) & {
+      follow_poll_interval_ = follow_poll_interval;
+      return *this;
+    }
+    Options&& set_follow_poll_interval(absl::Duration follow_poll_interval) && {
+      return std::move(set_follow_poll_interval(follow_poll_interval));
+    }
+    absl::Duration follow_poll_interval() const {
+      return follow_poll_interval_;
+    }
+
+    // Sets how long reading waits for a new chunk if `follow()`.
+    //
+    // Default: `absl::InfiniteDuration()`.
+    Options& set_follow_timeout(absl::Duration follow_timeout) & {
+      follow_timeout_ = follow_timeout;
+      return *this;
+    }
+    Options&& set_follow_timeout(absl::Duration follow_timeout) && {
+      return std::move(set_follow_timeout(follow_timeout));
+    }
+    absl::Duration follow_timeout() const { return follow_timeout_; }
+
+    // If not `nullptr`, decoded chunks are looked up in `*chunk_cache` before
+    // reading them, and added there after decoding them, keyed by
+    // `chunk_cache_key()` and chunk position. This helps random access with
+    // `Seek()` and `SeekToRecordIndex()` which tends to visit the same chunks,
+    // possibly from many `RecordReader`s. Chunks read ahead with
+    // `parallelism() > 0` bypass the cache.
+    //
+    // The `ChunkCache` must outlive the `RecordReader`.
+    //
+    // Default: `nullptr`.
+    Options& set_chunk_cache(ChunkCache* chunk_cache) & {
+      chunk_cache_ = chunk_cache;
+      return *this;
+    }
+    Options&& set_chunk_cache(ChunkCache* chunk_cache) && {
+      return std::move(set_chunk_cache(chunk_cache));
+    }
+    ChunkCache* chunk_cache() const { return chunk_cache_; }
+
+    // If not `nullptr`, chunks as stored in the file are looked up in
+    // `*encoded_chunk_cache` before reading them, and offered there after
+    // reading them, keyed by `chunk_cache_key()` and chunk position. See
+    // `DefaultChunkReaderBase::set_encoded_chunk_cache()`.
+    //
+    // This is independent from `chunk_cache()`: cached chunks still need to be
+    // decoded, but they take less memory.
+    //
+    // The `EncodedChunkCache` must outlive the `RecordReader`.
+    //
+    // Default: `nullptr`.
+    Options& set_encoded_chunk_cache(EncodedChunkCache* encoded_chunk_cache) & {
+      encoded_chunk_cache_ = encoded_chunk_cache;
+      return *this;
+    }
+    Options&& set_encoded_chunk_cache(
+        EncodedChunkCache* encoded_chunk_cache) && {
+      return std::move(set_encoded_chunk_cache(encoded_chunk_cache));
+    }
+    EncodedChunkCache* encoded_chunk_cache() const {
+      return encoded_chunk_cache_;
+    }
+
+    // Sets the key identifying the file in `chunk_cache()` and
+    // `encoded_chunk_cache()`, e.g. its name. `RecordReader`s sharing a key
+    // must read the same file, and with `chunk_cache()` also with the same
+    // `field_projection()`.
+    //
+    // Default: `""`.
+    Options& set_chunk_cache_key(absl::string_view chunk_cache_key) & {
+      chunk_cache_key_ = std::string(chunk_cache_key);
+      return *this;
+    }
+    Options&& set_chunk_cache_key(absl::string_view chunk_cache_key) && {
+      return std::move(set_chunk_cache_key(chunk_cache_key));
+    }
+    std::string& chunk_cache_key() { return chunk_cache_key_; }
+    const std::string& chunk_cache_key() const { return chunk_cache_key_; }
+
+    // If `true`, counters returned by `stats()` are collected, also by
+    // `src_chunk_reader()`. This costs a few clock reads per chunk, and is
+    // cheap enough to be left enabled.
+    //
+    // Default: `false`.
+    Options& set_collect_stats(bool collect_stats) & {
+      collect_stats_ = collect_stats;
+      return *this;
+    }
+    Options&& set_collect_stats(bool collect_stats) && {
+      return std::move(set_collect_stats(collect_stats));
+    }
+    bool collect_stats() const { return collect_stats_; }
+
+    // If not `nullptr`, spans of reading, verifying, decoding, and waiting for
+    // chunks are reported to `trace_sink`, also by `src_chunk_reader()`.
+    // `trace_sink` must outlive the `RecordReader`.
+    //
+    // Default: `nullptr`.
+    Options& set_trace_sink(TraceSink* trace_sink) & {
+      trace_sink_ = trace_sink;
+      return *this;
+    }
+    Options&& set_trace_sink(TraceSink* trace_sink) && {
+      return std::move(set_trace_sink(trace_sink));
+    }
+    TraceSink* trace_sink() const { return trace_sink_; }
+
+    // If not `absl::nullopt`, the chunk index is taken from this index, usually
+    // built by `BuildSidecarIndex()` and read by `ReadSidecarIndex()`, instead
+    // of being looked for at the end of the file or built by reading chunk
+    // headers. This makes `Seek()`, `SeekToRecordIndex()`, and key searches
+    // jump directly to the right chunk in files written without a chunk index.
+    //
+    // The index is ignored if the size of the file differs from
+    // `sidecar_index->indexed_size`.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_sidecar_index(absl::optional<SidecarIndex> sidecar_index) & {
+      sidecar_index_ = std::move(sidecar_index);
+      return *this;
+    }
+    Options&& set_sidecar_index(absl::optional<SidecarIndex> sidecar_index) && {
+      return std::move(set_sidecar_index(std::move(sidecar_index)));
+    }
+    absl::optional<SidecarIndex>& sidecar_index() { return sidecar_index_; }
+    const absl::optional<SidecarIndex>& sidecar_index() const {
+      return sidecar_index_;
+    }
+
    private:
     FieldProjection field_projection_ = FieldProjection::All();
+    ZstdReaderBase::Dictionary zstd_dictionary_;
+    BrotliReaderBase::Dictionary brotli_dictionary_;
+    bool simple_uncompressed_only_ = false;
+    DecompressionBackend* decompression_backend_ = nullptr;
     std::function<bool(const SkippedRegion&)> recovery_;
+    bool merge_skipped_regions_ = false;
+    double sample_rate_ = 1.0;
+    uint64_t sample_seed_ = 0;
+    int parallelism_ = 0;
+    MemoryBudget* memory_budget_ = nullptr;
+    uint64_t data_hash_verification_interval_ = 1;
+    absl::optional<Position> end_pos_;
+    bool follow_ = false;
+    absl::Duration follow_poll_interval_ = absl::Seconds(1);
+    absl::Duration follow_timeout_ = absl::InfiniteDuration();
+    ChunkCache* chunk_cache_ = nullptr;
+    EncodedChunkCache* encoded_chunk_cache_ = nullptr;
+    std::string chunk_cache_key_;
+    bool collect_stats_ = false;
+    TraceSink* trace_sink_ = nullptr;
+    absl::optional<SidecarIndex> sidecar_index_;
   };
 
+  ~RecordReaderBase();
+
   // Returns the Riegeli/records file being read from. Unchanged by `Close()`.
   virtual ChunkReader* src_chunk_reader() = 0;
   virtual const ChunkReader* src_chunk_reader() const = 0;
@@ -189,6 +680,10 @@ class RecordReaderBase : public Object {
   // Record type in metadata can be conveniently interpreted by
   // `RecordsMetadataDescriptors`.
   //
+  // If metadata contain a Zstd dictionary trained by the writer, and
+  // `Options::zstd_dictionary()` is empty, the dictionary is used for reading
+  // records.
+  //
   // Return values:
   //  * `true`                      - success (`metadata` is set)
   //  * `false` (when `healthy()`)  - source ends
@@ -207,6 +702,12 @@ class RecordReaderBase : public Object {
   // `ReadRecord(absl::string_view&)` the `absl::string_view` is valid until the
   // next non-const operation on this `RecordReader`.
   //
+  // Records of simple chunks without compression are not copied if the source
+  // provides its data as shared blocks (e.g. `FdMMapReader` or `ChainReader`):
+  // `ReadRecord(absl::string_view&)` points into the source data unless the
+  // record crosses a block boundary of the file, and `ReadRecord(Chain&)` and
+  // `ReadRecord(absl::Cord&)` share the source data unless the record is short.
+  //
   // Return values:
   //  * `true`                      - success (`record` is set)
   //  * `false` (when `healthy()`)  - source ends
@@ -217,6 +718,118 @@ class RecordReaderBase : public Object {
   bool ReadRecord(Chain& record);
   bool ReadRecord(absl::Cord& record);
 
+  // Like `ReadRecord(google::protobuf::MessageLite&)`, but parses the record
+  // into a new message of the same type as `prototype`, created on `arena`.
+  // Submessages are allocated on `arena` too, and all of them are freed
+  // together with `arena`, which avoids a heap allocation per submessage.
+  //
+  // Messages which failed to parse remain allocated on `arena`.
+  //
+  // Return values:
+  //  * `true`                      - success (`record` is set)
+  //  * `false` (when `healthy()`)  - source ends
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadRecord(const google::protobuf::MessageLite& prototype,
+                  google::protobuf::Arena& arena,
+                  google::protobuf::MessageLite*& record);
+
+  // Reads the next record, writing its raw bytes to `dest`.
+  //
+  // This is meant for records too large to be conveniently held in memory as
+  // a whole, e.g. written by `RecordWriterBase::WriteRecordFrom()`. A record
+  // which forms a simple chunk of its own is decompressed directly to `dest`
+  // as it is decoded, so only its compressed form is held in memory. This
+  // requires `Options::parallelism() == 0`, `Options::chunk_cache() ==
+  // nullptr`, and `Options::sample_rate() == 1`. Other records are read whole
+  // with `ReadRecord()` and then written to `dest`.
+  //
+  // After a record decompressed directly to `dest`, `last_record_is_valid()`
+  // is `false`.
+  //
+  // If `dest` fails, `RecordReader` fails too.
+  //
+  // Return values:
+  //  * `true`                      - success (the record is written to `dest`)
+  //  * `false` (when `healthy()`)  - source ends
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadRecordTo(Writer& dest);
+
+  // Reads up to `records.size()` next records, all from the same chunk. This
+  // is faster than reading them one by one with `ReadRecord()`.
+  //
+  // For `ReadRecords(absl::Span<absl::string_view>)` all `absl::string_view`
+  // values are valid until the next non-const operation on this
+  // `RecordReader`. In order for that, reading may stop earlier if a record
+  // is not stored contiguously in the source.
+  //
+  // `ReadRecords(absl::Span<Chain>)` can be passed a `std::vector<Chain>`
+  // pre-sized by the caller, whose elements are reused across calls.
+  //
+  // `last_pos()` refers to the last record read.
+  //
+  // Return values:
+  //  * positive                - success (the number of records read)
+  //  * 0 (when `healthy()`)    - source ends
+  //  * 0 (when `!healthy()`)   - failure
+  size_t ReadRecords(absl::Span<absl::string_view> records);
+  size_t ReadRecords(absl::Span<Chain> records);
+
+  // Like `ReadRecord(prototype, arena, record)` repeated for up to
+  // `records.size()` next records, all from the same chunk, with all messages
+  // created on the same `arena`.
+  //
+  // Return values:
+  //  * positive                - success (the number of records read)
+  //  * 0 (when `healthy()`)    - source ends
+  //  * 0 (when `!healthy()`)   - failure
+  size_t ReadRecords(const google::protobuf::MessageLite& prototype,
+                     google::protobuf::Arena& arena,
+                     absl::Span<google::protobuf::MessageLite*> records);
+
+  // `get()` returns the records read. Can block.
+  using FutureRecords = std::future<std::vector<Chain>>;
+
+  // Reads up to `max_records` next records in background, so that reading from
+  // the source and decoding overlap with processing done by the caller.
+  //
+  // Fewer records are returned if the source ends or reading fails. This can
+  // be distinguished by `healthy()` after the result is ready.
+  //
+  // Until the result is ready (`get()` or `wait()` on it returned), no other
+  // member function of this `RecordReader` may be called, and it must not be
+  // moved or destroyed. There are no concurrency restrictions on calling
+  // `get()` on the result.
+  FutureRecords ReadRecordsAsync(size_t max_records);
+
+  // Like `ReadRecordsAsync(max_records)`, but instead of returning a future,
+  // calls `done` with the records read in a thread of `ThreadPool::global()`,
+  // for callers which must not block, e.g. event loops or coroutines.
+  //
+  // Until `done` is called, no other member function of this `RecordReader`
+  // may be called, and it must not be moved or destroyed.
+  void ReadRecordsAsync(size_t max_records,
+                        std::function<void(std::vector<Chain>)> done);
+
+  // Reads records at `positions` into the corresponding elements of
+  // `records`, e.g. for keys looked up in an index.
+  //
+  // Positions are visited in file order, so that the source is read forwards
+  // and each chunk is read and decoded once, even if `positions` are unsorted
+  // or repeated.
+  //
+  // Afterwards the current position is after the record at the largest
+  // position, or unspecified on failure.
+  //
+  // Precondition: `positions.size() == records.size()`
+  //
+  // Return values:
+  //  * `true`                      - success
+  //  * `false` (when `healthy()`)  - some position is at or after the end of
+  //                                  the source (its record is cleared)
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadRecordsAt(absl::Span<const RecordPosition> positions,
+                     absl::Span<Chain> records);
+
   // Like `Options::set_field_projection()`, but can be done at any time.
   //
   // This may cause reading the current chunk again.
@@ -239,6 +852,10 @@ class RecordReaderBase : public Object {
   // If `skipped_region != nullptr`, `*skipped_region` is set to the position of
   // the skipped region on success.
   //
+  // If `RecordReaderBase::Options::merge_skipped_regions()`, invalid chunks
+  // directly following the region are skipped too, and included in
+  // `*skipped_region`.
+  //
   // If a recovery function (`RecordReaderBase::Options::recovery()`) is set,
   // then `Recover()` is called automatically. Otherwise `Recover()` can be
   // called after one of the following functions returned `false`, and the
@@ -255,6 +872,25 @@ class RecordReaderBase : public Object {
   //  * `false` - failure not caused by invalid file contents
   bool Recover(SkippedRegion* skipped_region = nullptr);
 
+  // Returns counters collected if `Options::collect_stats()`. Unchanged by
+  // `Close()`.
+  //
+  // Chunks read ahead with `Options::parallelism() > 0` are counted when their
+  // records are reached.
+  RecordReaderStats stats() const;
+
+  // Returns an estimate of memory owned by this `RecordReader`, excluding
+  // `sizeof(*this)`: decoded records of the current chunk, chunks read ahead
+  // if `Options::parallelism() > 0`, the loaded chunk index, and the byte
+  // `Reader` with its buffer and decompressor state if it is owned.
+  //
+  // Chunks being decoded in background are estimated from their sizes.
+  size_t EstimateMemory() const;
+
+  // Registers memory owned by this `RecordReader` with `MemoryEstimator`, like
+  // `EstimateMemory()`, but allows to combine it with other objects.
+  virtual void RegisterSubobjects(MemoryEstimator& memory_estimator) const;
+
   // Returns the canonical position of the last record read.
   //
   // The canonical position is the largest among all equivalent positions.
@@ -301,6 +937,85 @@ class RecordReaderBase : public Object {
   bool Seek(RecordPosition new_pos);
   bool Seek(Position new_pos);
 
+  // Seeks to the record with the given index in the file, counting from 0, or
+  // to the end of file if the file has fewer records.
+  //
+  // On the first call, the chunk index is read from the end of the file if it
+  // was written (`RecordWriterBase::Options::chunk_index()`), otherwise chunk
+  // headers are read from the beginning of the file to build the index. Later
+  // calls locate the record with one lookup. Records appended to the file
+  // after the first call are not found.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool SeekToRecordIndex(uint64_t record_index);
+
+  // Reads the file summary from the end of the file if it was written
+  // (`RecordWriterBase::Options::file_summary()`), without reading other
+  // chunks. The current position is preserved.
+  //
+  // Return values:
+  //  * `true`                      - success (`summary` is set)
+  //  * `false` (when `healthy()`)  - there is no file summary, or the source
+  //                                  does not support random access
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadFileSummary(FileSummary& summary);
+
+  // Skips chunks following the current position for which
+  // `predicate(min_key, max_key)` returns `true`, given the smallest and
+  // largest keys of records in the chunk, stopping at the first chunk for which
+  // it returns `false`. Chunks are skipped without reading them.
+  //
+  // Keys are available if `RecordWriterBase::Options::chunk_key()` was set when
+  // writing the file, otherwise nothing is skipped. If some records of the
+  // current chunk have been read, the rest of the chunk is not skipped. The
+  // chunk index is loaded as by `SeekToRecordIndex()`.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool SkipChunksWhere(
+      absl::FunctionRef<bool(absl::string_view min_key,
+                             absl::string_view max_key)>
+          predicate);
+
+  // Skips chunks following the current position which certainly do not contain
+  // a record with `key`, stopping at the first chunk which might. Chunks are
+  // skipped without reading them.
+  //
+  // A chunk is skipped if `key` is outside the range of its keys, or if its key
+  // filter excludes `key`. Key filters are available if
+  // `RecordWriterBase::Options::chunk_key_filter_bits()` was set when writing
+  // the file. Filters have false positives, so records read from a chunk which
+  // was not skipped must still be checked.
+  //
+  // Finding all records with `key` alternates `SkipChunksWithoutKey(key)` with
+  // reading records, so that only chunks which might contain `key` are read and
+  // decoded. Calling it between records of the same chunk does nothing.
+  //
+  // Keys are available as for `SkipChunksWhere()`, otherwise nothing is
+  // skipped.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool SkipChunksWithoutKey(absl::string_view key);
+
+  // Seeks to the beginning of the first chunk whose largest key is not `less`
+  // than the desired position according to `test()`, or to the end of file if
+  // there is none, without reading chunks before. Requires the file to be
+  // sorted by keys, which must be available as for `SkipChunksWhere()`.
+  //
+  // A record-level `Search()` or `ReadRecord()` can then finish the search,
+  // because all records before the chunk are `less`.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`), including when keys are not available
+  bool SearchChunkKeys(
+      absl::FunctionRef<absl::partial_ordering(absl::string_view key)> test);
+
   // Seeks back by one record.
   //
   // Return values:
@@ -378,6 +1093,15 @@ class RecordReaderBase : public Object {
  protected:
   enum class Recoverable { kNo, kRecoverChunkReader, kRecoverChunkDecoder };
 
+  class ChunkPrefetcher;
+
+  // Records of a chunk which a chunk of type `ChunkType::kReferencing` can
+  // refer to.
+  struct ReferenceChunk {
+    Position chunk_begin;
+    Chain records;
+  };
+
   explicit RecordReaderBase(InitiallyClosed) noexcept;
   explicit RecordReaderBase(InitiallyOpen) noexcept;
 
@@ -424,23 +1148,238 @@ class RecordReaderBase : public Object {
   Recoverable recoverable_ = Recoverable::kNo;
 
   std::function<bool(const SkippedRegion&)> recovery_;
+  bool merge_skipped_regions_ = false;
+
+  // If less than 1, the probability of reading each record.
+  double sample_rate_ = 1.0;
+  std::mt19937_64 sample_random_;
+  // If `sample_rate_ < 1`, the number of records to skip before the next
+  // sampled record.
+  uint64_t records_to_skip_ = 0;
+  // Numbers of records between further sampled records, drawn for skipping
+  // chunks read ahead.
+  std::deque<uint64_t> sample_gaps_;
+
+  ZstdReaderBase::Dictionary zstd_dictionary_;
+  // Whether file metadata have been checked for a Zstd dictionary, which is
+  // then not loaded again.
+  bool file_metadata_checked_ = false;
+  BrotliReaderBase::Dictionary brotli_dictionary_;
+  bool simple_uncompressed_only_ = false;
+  DecompressionBackend* decompression_backend_ = nullptr;
+
+  // If not `nullptr`, memory of chunks being read and decoded is reserved from
+  // `*memory_budget_`.
+  MemoryBudget* memory_budget_ = nullptr;
+  // Memory reserved for `chunk_decoder_` if `memory_budget_ != nullptr`.
+  MemoryBudget::Reservation memory_reservation_;
+
+  // If not `absl::nullopt`, chunks beginning at or after `*end_pos_` are not
+  // read.
+  absl::optional<Position> end_pos_;
+
+  // If `follow_`, reading waits for the file to grow at its end.
+  bool follow_ = false;
+  absl::Duration follow_poll_interval_;
+  absl::Duration follow_timeout_;
+  // The next wait for the file to grow if `follow_`, growing exponentially
+  // while no new chunk is found.
+  absl::Duration follow_backoff_;
+  // The time since which no new chunk has been found at `follow_chunk_begin_`.
+  absl::Time follow_wait_start_;
+  Position follow_chunk_begin_ = 0;
+
+  // If not `nullptr`, decoded chunks are shared through `*chunk_cache_` under
+  // `chunk_cache_key_`.
+  ChunkCache* chunk_cache_ = nullptr;
+  std::string chunk_cache_key_;
+
+  // Chunks read ahead and being decoded in background if
+  // `Options::parallelism() > 0`, otherwise `nullptr`.
+  std::unique_ptr<ChunkPrefetcher> chunk_prefetcher_;
+
+  // Records of consecutive chunks with records read most recently, which
+  // chunks of type `ChunkType::kReferencing` read next can refer to.
+  // Maintained after such a chunk has been found, keeping at most
+  // `max_reference_chunks_` chunks.
+  std::deque<ReferenceChunk> reference_chunks_;
+  // The position after the chunk read most recently. `reference_chunks_` are
+  // continued only by a chunk beginning there.
+  Position reference_chunks_end_ = 0;
+  // The largest number of chunks referred to by a chunk read so far.
+  uint64_t max_reference_chunks_ = 0;
+
+  // Chunks with records, used by `SeekToRecordIndex()`, valid if
+  // `chunk_index_loaded_`.
+  ChunkIndex chunk_index_;
+  // The end of file as seen by `chunk_index_`, i.e. the position after records
+  // in chunks of `chunk_index_`.
+  Position chunk_index_end_ = 0;
+  bool chunk_index_loaded_ = false;
+
+  bool collect_stats_ = false;
+  RecordReaderStats stats_;
+  TraceSink* trace_sink_ = nullptr;
+
+  // Returns the position after the current chunk, taking into account chunks
+  // read ahead by `chunk_prefetcher_`.
+  //
+  // Precondition: `chunk_prefetcher_ != nullptr`
+  Position PrefetchedChunkBegin(const ChunkReader& src) const;
 
  private:
   class ChunkSearchTraits;
 
   bool FailReading(const ChunkReader& src);
   bool FailSeeking(const ChunkReader& src);
+  // Like `FailSeeking()`, but does not try recovery.
+  bool FailLoadingChunkIndex(const ChunkReader& src);
 
   bool ParseMetadata(const Chunk& chunk, Chain& metadata);
 
-  template <typename Record>
-  bool ReadRecordImpl(Record& record);
+  // Implementation of `Recover()` without collecting stats.
+  bool RecoverImpl(SkippedRegion* skipped_region);
+
+  // After a successful `RecoverImpl()`, reads the next chunk, skipping further
+  // invalid chunks, and extends `*skipped_region` (if not `nullptr`) over them.
+  //
+  // Precondition: `merge_skipped_regions_`
+  void MergeFollowingSkippedRegions(SkippedRegion* skipped_region);
+
+  // Decodes `chunk` into `chunk_decoder_`, collecting stats if
+  // `collect_stats_` and reporting to `trace_sink_` if not `nullptr`.
+  bool DecodeChunk(const Chunk& chunk);
+
+  // Sets the reference of `chunk` of type `ChunkType::kReferencing` beginning
+  // at `chunk_begin_` in `chunk_decoder_`, taking records of the chunks it
+  // refers to from `reference_chunks_`, or reading and decoding the chunks
+  // again, then returning to the position after `chunk`. On failure fails
+  // `*this` and sets `recoverable_`.
+  bool LoadReference(const Chunk& chunk);
+
+  // Adds records of `chunk_decoder_`, which holds the chunk beginning at
+  // `chunk_begin_` and ending at `chunk_end`, to `reference_chunks_` if they
+  // are maintained.
+  void UpdateReferenceChunks(Position chunk_end);
+
+  // If `zstd_dictionary_` is empty and `metadata` contain a Zstd dictionary,
+  // sets `zstd_dictionary_` and uses it for decoding chunks.
+  void LoadZstdDictionary(const Chain& metadata);
+  // Like `LoadZstdDictionary(const Chain&)`, but takes the file metadata
+  // chunk, and ignores invalid metadata.
+  void LoadZstdDictionary(const Chunk& chunk);
+
+  // If the next chunk of `src` is the file metadata chunk, skips it. Reading
+  // its data is needed only by `ReadMetadata()`, except that until the file
+  // metadata have been checked for a Zstd dictionary, it is loaded from them,
+  // reading them from the beginning of the file if `src` is elsewhere and
+  // supports random access.
+  //
+  // Return values:
+  //  * `true`                      - success
+  //  * `false` (when `healthy()`)  - source ends
+  //  * `false` (when `!healthy()`) - failure
+  bool SkipFileMetadata(ChunkReader& src);
+
+  // Loads a Zstd dictionary from file metadata at the beginning of `src`, if
+  // `src` supports random access, then returns to the current position.
+  // Failures of reading file metadata are ignored if `src` can recover from
+  // them.
+  //
+  // Return values:
+  //  * `true`  - success
+  //  * `false` - failure (`!src.healthy()`)
+  bool LoadFileMetadataFrom(ChunkReader& src);
+
+  // Draws the number of records between sampled records.
+  //
+  // Precondition: `sample_rate_ < 1`
+  uint64_t DrawSampleGap();
+
+  // Returns the number of records to skip before the next sampled record.
+  //
+  // Precondition: `sample_rate_ < 1`
+  uint64_t NextSampleGap();
+
+  // Returns `true` if `num_records` records following `records_before` records
+  // after the current record of `chunk_decoder_` are all unsampled, drawing
+  // further sample gaps as needed.
+  //
+  // Precondition: `sample_rate_ < 1`
+  bool RecordsAreUnsampled(uint64_t records_before, uint64_t num_records);
+
+  // Skips up to `records_to_skip_` records of `chunk_decoder_`.
+  //
+  // Precondition: `sample_rate_ < 1`
+  void SkipUnsampledRecords();
+
+  // Skips the following chunks which have only records to skip, reading only
+  // their headers, unless chunks are read ahead by `chunk_prefetcher_`, which
+  // then skips them itself.
+  //
+  // Precondition: `sample_rate_ < 1`
+  //
+  // Return values:
+  //  * `true`  - success, or the source ends (reported by reading the chunk)
+  //  * `false` - failure (`!healthy()`)
+  bool SkipUnsampledChunks();
+
+  // Reads a record with `chunk_decoder_.ReadRecord(args...)`, moving to next
+  // chunks as needed.
+  template <typename... Args>
+  bool ReadRecordImpl(Args&... args);
+
+  // Reads records with `chunk_decoder_.ReadRecords(args..., records)`, moving
+  // to next chunks as needed.
+  template <typename Record, typename... Args>
+  size_t ReadRecordsImpl(absl::Span<Record> records, Args&... args);
 
   // Reads the next chunk from `chunk_reader_` and decodes it into
   // `chunk_decoder_` and `chunk_begin_`. On failure resets `chunk_decoder_`.
   //
   // Precondition: `healthy()`
   bool ReadChunk();
+
+  // Returns `true` if the next record forms a simple chunk of its own, which
+  // `ReadRecordTo()` can decompress directly to its destination. Returns
+  // `false` if the chunk could not be examined, leaving any failure to be
+  // reported by reading the chunk.
+  //
+  // Precondition: `healthy()`
+  bool NextRecordFormsChunk();
+
+  // Reads the next chunk, which forms a single record, and decompresses the
+  // record to `dest`. On success leaves `chunk_decoder_` empty and
+  // `chunk_begin_` after the chunk.
+  //
+  // Precondition: `NextRecordFormsChunk()`
+  bool ReadChunkRecordTo(Writer& dest);
+
+  // Called if `ReadNextChunk()` returned `false` at the end of the file.
+  // If `follow_`, waits before trying again, and returns `true` if reading
+  // should be tried again.
+  //
+  // Precondition: `healthy()`
+  bool WaitForMoreData();
+
+  // Like `ReadChunk()`, but if `chunk_prefetcher_ != nullptr`, takes the next
+  // chunk from `chunk_prefetcher_`, and lets it read further chunks ahead.
+  //
+  // Precondition: `healthy()`
+  bool ReadNextChunk();
+
+  // Sets `chunk_index_` and `chunk_index_end_` from the chunk index at the end
+  // of the file, or by reading chunk headers, then returns to the current
+  // position.
+  //
+  // Precondition: `healthy()`
+  bool LoadChunkIndex();
+
+  // Seeks to `new_pos` without assuming that `src_chunk_reader()` is
+  // positioned after the current chunk.
+  //
+  // Precondition: `healthy()`
+  bool SeekToOtherChunk(RecordPosition new_pos);
 };
 
 // `RecordReader` reads records of a Riegeli/records file. A record is
@@ -547,6 +1486,8 @@ class RecordReader : public RecordReaderBase {
   // An optimized implementation in a derived class, avoiding a virtual call.
   RecordPosition pos() const;
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  protected:
   void Done() override;
 
@@ -616,6 +1557,9 @@ inline RecordPosition RecordReaderBase::pos() const {
       ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder)) {
     return RecordPosition(chunk_begin_, chunk_decoder_.index());
   }
+  if (ABSL_PREDICT_FALSE(chunk_prefetcher_ != nullptr)) {
+    return RecordPosition(PrefetchedChunkBegin(*src_chunk_reader()), 0);
+  }
   return RecordPosition(src_chunk_reader()->pos(), 0);
 }
 
@@ -715,9 +1659,19 @@ inline RecordPosition RecordReader<Src>::pos() const {
       ABSL_PREDICT_FALSE(recoverable_ == Recoverable::kRecoverChunkDecoder)) {
     return RecordPosition(chunk_begin_, chunk_decoder_.index());
   }
+  if (ABSL_PREDICT_FALSE(chunk_prefetcher_ != nullptr)) {
+    return RecordPosition(PrefetchedChunkBegin(*src_), 0);
+  }
   return RecordPosition(src_->pos(), 0);
 }
 
+template <typename Src>
+void RecordReader<Src>::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  RecordReaderBase::RegisterSubobjects(memory_estimator);
+  if (src_.is_owning()) src_->RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_RECORDS_RECORD_READER_H_
@@ -17,44 +17,69 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <deque>
+#include <functional>
 #include <future>
 #include <limits>
+#include <list>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "absl/types/variant.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/descriptor.pb.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory.h"
+#include "riegeli/base/memory_budget.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
 #include "riegeli/base/options_parser.h"
 #include "riegeli/base/parallelism.h"
+#include "riegeli/brotli/brotli_writer.h"
+#include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/chunk_encoder.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/deduplicating_encoder.h"
 #include "riegeli/chunk_encoding/deferred_encoder.h"
 #include "riegeli/chunk_encoding/simple_encoder.h"
 #include "riegeli/chunk_encoding/transpose_encoder.h"
 #include "riegeli/messages/message_serialize.h"
+#include "riegeli/records/chunk_index.h"
 #include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/file_summary.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/records_metadata.pb.h"
+#include "riegeli/records/trace_sink.h"
+#include "riegeli/varint/varint.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+#include "riegeli/zstd/zstd_writer.h"
+#include "zdict.h"
+#include "zstd.h"
 
 namespace riegeli {
 
@@ -68,12 +93,46 @@ constexpr int RecordWriterBase::Options::kDefaultBrotli;
 constexpr int RecordWriterBase::Options::kMinZstd;
 constexpr int RecordWriterBase::Options::kMaxZstd;
 constexpr int RecordWriterBase::Options::kDefaultZstd;
+constexpr int RecordWriterBase::Options::kMinLz4;
+constexpr int RecordWriterBase::Options::kMaxLz4;
+constexpr int RecordWriterBase::Options::kDefaultLz4;
 constexpr int RecordWriterBase::Options::kMinWindowLog;
 constexpr int RecordWriterBase::Options::kMaxWindowLog;
 #endif
 
 namespace {
 
+// If `Options::auto_transpose()`, the maximum total size of records at the
+// beginning of a chunk which are encoded both transposed and not, to choose how
+// to encode the whole chunk.
+constexpr uint64_t kAutoTransposeSampleSize = uint64_t{64} << 10;
+
+// The approximate limit of memory used by `MetadataChunkCache::global()`.
+constexpr size_t kMaxMetadataChunkCacheMemory = size_t{16} << 20;
+
+}  // namespace
+
+namespace internal {
+
+struct PreparedMetadata {
+  // `serialized_metadata()` and `hash_type()` of options which this was
+  // prepared for, before storing a Zstd dictionary ID.
+  Chain serialized_metadata;
+  HashType hash_type;
+  // The encoded metadata chunk.
+  Chunk chunk;
+  // Whether `record_type` has been built, which is done only for
+  // `transpose()` or `auto_transpose()`.
+  bool record_type_built = false;
+  // Owns `*record_type` if it is not `nullptr`.
+  std::unique_ptr<google::protobuf::DescriptorPool> record_type_pool;
+  const google::protobuf::Descriptor* record_type = nullptr;
+};
+
+}  // namespace internal
+
+namespace {
+
 class FileDescriptorCollector {
  public:
   explicit FileDescriptorCollector(
@@ -95,6 +154,266 @@ class FileDescriptorCollector {
   absl::flat_hash_set<std::string> files_seen_;
 };
 
+// Zstd recommends dictionaries of about 100 KiB, and about 100 times more
+// samples than that.
+constexpr size_t kMaxTrainedZstdDictionarySize = size_t{110} << 10;
+
+// Appends to `headers` headers of uncompressed transposed chunks of consecutive
+// `records` (with end positions `limits`) grouped like chunks written with
+// `options`, and appends their sizes to `header_sizes`.
+//
+// Headers hold state machines of the chunks. Training a Zstd dictionary on them
+// lets transposed chunks of records with a stable schema refer to their state
+// machine in the dictionary instead of repeating it, which makes headers of
+// small chunks small.
+void CollectTransposedHeaders(const RecordWriterBase::Options& options,
+                              absl::string_view records,
+                              const std::vector<size_t>& limits,
+                              std::string& headers,
+                              std::vector<size_t>& header_sizes) {
+  // The record type is not needed: it only makes encoding faster.
+  TransposeEncoder encoder(
+      CompressorOptions().set_uncompressed(),
+      std::numeric_limits<uint64_t>::max(), nullptr,
+      options.integer_encodings(), options.string_dictionaries(),
+      options.packed_encodings());
+  const uint64_t chunk_size = options.effective_chunk_size();
+  size_t chunk_begin = 0;
+  size_t record_begin = 0;
+  for (size_t i = 0; i < limits.size(); ++i) {
+    if (ABSL_PREDICT_FALSE(!encoder.AddRecord(
+            records.substr(record_begin, limits[i] - record_begin)))) {
+      return;
+    }
+    record_begin = limits[i];
+    if (record_begin - chunk_begin < chunk_size && i + 1 < limits.size()) {
+      continue;
+    }
+    chunk_begin = record_begin;
+    Chain chunk_data;
+    ChainWriter<> chunk_writer(&chunk_data);
+    ChunkType chunk_type;
+    uint64_t num_records;
+    uint64_t decoded_data_size;
+    if (ABSL_PREDICT_FALSE(!encoder.EncodeAndClose(
+            chunk_writer, chunk_type, num_records, decoded_data_size)) ||
+        ABSL_PREDICT_FALSE(!chunk_writer.Close())) {
+      return;
+    }
+    encoder.Clear();
+    // Skip the compression type, and read the header.
+    ChainReader<> chunk_reader(&chunk_data);
+    if (ABSL_PREDICT_FALSE(!chunk_reader.Skip(1))) return;
+    const absl::optional<uint64_t> header_size = ReadVarint64(chunk_reader);
+    if (ABSL_PREDICT_FALSE(header_size == absl::nullopt ||
+                           *header_size > chunk_data.size()) ||
+        ABSL_PREDICT_FALSE(!chunk_reader.ReadAndAppend(
+            IntCast<size_t>(*header_size), headers))) {
+      return;
+    }
+    header_sizes.push_back(IntCast<size_t>(*header_size));
+  }
+}
+
+// Merges `addition` into metadata in `options`, so that metadata are written
+// even if they were not set.
+void MergeMetadata(const RecordsMetadata& addition,
+                   RecordWriterBase::Options& options) {
+  if (options.serialized_metadata() != absl::nullopt) {
+    // Concatenated serialized messages are parsed as if they were merged.
+    options.serialized_metadata()->Append(addition.SerializeAsString());
+    return;
+  }
+  if (options.metadata() == absl::nullopt) options.metadata().emplace();
+  options.metadata()->MergeFrom(addition);
+}
+
+// If `options` specify a Zstd dictionary with an ID, stores the ID in metadata.
+void StoreZstdDictionaryId(RecordWriterBase::Options& options) {
+  if (options.compression_type() != CompressionType::kZstd) return;
+  const absl::string_view dictionary = options.zstd_dictionary().data();
+  const uint32_t dictionary_id =
+      ZSTD_getDictID_fromDict(dictionary.data(), dictionary.size());
+  if (dictionary_id == 0) return;
+  RecordsMetadata dictionary_metadata;
+  dictionary_metadata.set_zstd_dictionary_id(dictionary_id);
+  MergeMetadata(dictionary_metadata, options);
+}
+
+// Builds the record type named in metadata in `options` into `pool`, so that
+// `TransposeEncoder` can use it. Returns `nullptr` if metadata do not describe
+// the record type or the descriptors are invalid.
+const google::protobuf::Descriptor* BuildRecordType(
+    const RecordWriterBase::Options& options,
+    std::unique_ptr<google::protobuf::DescriptorPool>& pool) {
+  RecordsMetadata parsed_metadata;
+  const RecordsMetadata* metadata;
+  if (options.metadata() != absl::nullopt) {
+    metadata = &*options.metadata();
+  } else if (options.serialized_metadata() != absl::nullopt) {
+    if (ABSL_PREDICT_FALSE(!parsed_metadata.ParseFromString(
+            std::string(*options.serialized_metadata())))) {
+      return nullptr;
+    }
+    metadata = &parsed_metadata;
+  } else {
+    return nullptr;
+  }
+  if (metadata->record_type_name().empty() ||
+      metadata->file_descriptor().empty()) {
+    return nullptr;
+  }
+  pool = std::make_unique<google::protobuf::DescriptorPool>();
+  for (const google::protobuf::FileDescriptorProto& file_descriptor :
+       metadata->file_descriptor()) {
+    if (ABSL_PREDICT_FALSE(pool->BuildFile(file_descriptor) == nullptr)) {
+      pool.reset();
+      return nullptr;
+    }
+  }
+  return pool->FindMessageTypeByName(metadata->record_type_name());
+}
+
+// A memory-bounded LRU cache of encoded metadata chunks, keyed by serialized
+// metadata and options affecting their encoding, shared by writers of the whole
+// process. Many small files written with the same metadata, e.g. with the same
+// record type set by `SetRecordType()`, then do not compress the same file
+// descriptors again.
+//
+// `MetadataChunkCache` is thread-safe.
+class MetadataChunkCache {
+ public:
+  explicit MetadataChunkCache(size_t max_memory) : max_memory_(max_memory) {}
+
+  MetadataChunkCache(const MetadataChunkCache&) = delete;
+  MetadataChunkCache& operator=(const MetadataChunkCache&) = delete;
+
+  static MetadataChunkCache& global() {
+    static NoDestructor<MetadataChunkCache> kGlobalCache(
+        kMaxMetadataChunkCacheMemory);
+    return *kGlobalCache;
+  }
+
+  // Returns the key of the metadata chunk with `serialized_metadata` encoded
+  // according to `options`.
+  //
+  // Compressor options not included in the key only tune compression, so
+  // chunks differing in them decode to the same metadata.
+  static std::string Key(const RecordWriterBase::Options& options,
+                         const Chain& serialized_metadata);
+
+  // Sets `chunk` to the cached chunk with `key`, marking it as recently used.
+  // Returns `false` if it is absent.
+  bool Find(absl::string_view key, Chunk& chunk);
+
+  // Adds a copy of `chunk` with `key` if it is not already present, evicting
+  // least recently used chunks as needed.
+  void Insert(std::string&& key, const Chunk& chunk);
+
+ private:
+  struct Entry {
+    std::string key;
+    Chunk chunk;
+    size_t memory;
+  };
+
+  const size_t max_memory_;
+  absl::Mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // Keys point to keys owned by `entries_`.
+  absl::flat_hash_map<absl::string_view, std::list<Entry>::iterator> index_
+      ABSL_GUARDED_BY(mutex_);
+  size_t memory_usage_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+std::string MetadataChunkCache::Key(const RecordWriterBase::Options& options,
+                                    const Chain& serialized_metadata) {
+  const CompressorOptions& compressor_options = options.compressor_options();
+  std::string key = absl::StrCat(
+      static_cast<int>(compressor_options.compression_type()), ":",
+      compressor_options.compression_level(), ":",
+      compressor_options.window_log().value_or(-1), ":",
+      static_cast<int>(options.hash_type()), ":");
+  serialized_metadata.AppendTo(key);
+  return key;
+}
+
+bool MetadataChunkCache::Find(absl::string_view key, Chunk& chunk) {
+  absl::MutexLock lock(&mutex_);
+  const auto iter = index_.find(key);
+  if (iter == index_.end()) return false;
+  entries_.splice(entries_.begin(), entries_, iter->second);
+  // Copying `chunk.data` shares its blocks.
+  chunk = iter->second->chunk;
+  return true;
+}
+
+void MetadataChunkCache::Insert(std::string&& key, const Chunk& chunk) {
+  const size_t memory = key.capacity() + chunk.data.EstimateMemory();
+  if (memory > max_memory_) return;
+  // Evicted chunks are destroyed after releasing the lock.
+  std::list<Entry> evicted;
+  {
+    absl::MutexLock lock(&mutex_);
+    // Another writer could have encoded the same chunk concurrently.
+    if (index_.contains(key)) return;
+    entries_.push_front(Entry{std::move(key), chunk, memory});
+    index_.emplace(entries_.front().key, entries_.begin());
+    memory_usage_ += memory;
+    while (memory_usage_ > max_memory_) {
+      const auto last = std::prev(entries_.end());
+      memory_usage_ -= last->memory;
+      index_.erase(last->key);
+      evicted.splice(evicted.end(), entries_, last);
+    }
+  }
+}
+
+// Encodes the metadata chunk for `options`, reusing a chunk encoded before by
+// this process if possible.
+//
+// Precondition: metadata are set
+absl::Status EncodeMetadataChunk(const RecordWriterBase::Options& options,
+                                 Chunk& chunk) {
+  Chain serialized_metadata_storage;
+  const Chain* serialized_metadata;
+  if (options.metadata() != absl::nullopt) {
+    absl::Status status =
+        SerializeToChain(*options.metadata(), serialized_metadata_storage);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    serialized_metadata = &serialized_metadata_storage;
+  } else {
+    serialized_metadata = &*options.serialized_metadata();
+  }
+  std::string key = MetadataChunkCache::Key(options, *serialized_metadata);
+  if (MetadataChunkCache::global().Find(key, chunk)) return absl::OkStatus();
+  // Metadata must be readable without a dictionary, because they tell which
+  // dictionary is needed.
+  TransposeEncoder transpose_encoder(
+      CompressorOptions(options.compressor_options())
+          .set_zstd_dictionary(ZstdWriterBase::Dictionary())
+          .set_brotli_dictionary(BrotliWriterBase::Dictionary()),
+      std::numeric_limits<uint64_t>::max());
+  if (ABSL_PREDICT_FALSE(!transpose_encoder.AddRecord(*serialized_metadata))) {
+    return transpose_encoder.status();
+  }
+  chunk.data.Clear();
+  ChainWriter<> data_writer(&chunk.data);
+  ChunkType chunk_type;
+  uint64_t num_records;
+  uint64_t decoded_data_size;
+  if (ABSL_PREDICT_FALSE(!transpose_encoder.EncodeAndClose(
+          data_writer, chunk_type, num_records, decoded_data_size))) {
+    return transpose_encoder.status();
+  }
+  if (ABSL_PREDICT_FALSE(!data_writer.Close())) return data_writer.status();
+  chunk.header = ChunkHeader(chunk.data, ChunkType::kFileMetadata, 0,
+                             decoded_data_size, options.hash_type());
+  MetadataChunkCache::global().Insert(std::move(key), chunk);
+  return absl::OkStatus();
+}
+
 }  // namespace
 
 void SetRecordType(const google::protobuf::Descriptor& descriptor,
@@ -105,21 +424,54 @@ void SetRecordType(const google::protobuf::Descriptor& descriptor,
   collector.AddFile(descriptor.file());
 }
 
+RecordWriterStats& RecordWriterStats::operator+=(
+    const RecordWriterStats& that) {
+  num_records += that.num_records;
+  num_chunks += that.num_chunks;
+  num_decoded_bytes += that.num_decoded_bytes;
+  num_compressed_bytes += that.num_compressed_bytes;
+  encode_time += that.encode_time;
+  hash_time += that.hash_time;
+  max_chunks_in_flight =
+      UnsignedMax(max_chunks_in_flight, that.max_chunks_in_flight);
+  max_bytes_in_flight =
+      UnsignedMax(max_bytes_in_flight, that.max_bytes_in_flight);
+  in_flight_wait_time += that.in_flight_wait_time;
+  chunk_writer += that.chunk_writer;
+  return *this;
+}
+
 absl::Status RecordWriterBase::Options::FromString(absl::string_view text) {
   std::string compressor_text;
   uint64_t chunk_size;
+  uint64_t min_encoding_speed;
+  uint64_t max_chunk_records;
   OptionsParser options_parser;
   options_parser.AddOption("default", ValueParser::FailIfAnySeen());
   options_parser.AddOption(
       "transpose",
+      ValueParser::Or(
+          ValueParser::Enum({{"auto", true}}, &auto_transpose_),
+          ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                            &transpose_)));
+  options_parser.AddOption(
+      "deduplicate",
       ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
-                        &transpose_));
+                        &deduplicate_));
   options_parser.AddOption("uncompressed",
                            ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("brotli", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("zstd", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("snappy", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("lz4", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption("window_log", ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("long_distance_matching",
+                           ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("ldm_hash_log",
+                           ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("target_length",
+                           ValueParser::CopyTo(&compressor_text));
+  options_parser.AddOption("strategy", ValueParser::CopyTo(&compressor_text));
   options_parser.AddOption(
       "chunk_size",
       ValueParser::Or(
@@ -131,27 +483,151 @@ absl::Status RecordWriterBase::Options::FromString(absl::string_view text) {
                 chunk_size_ = chunk_size;
                 return true;
               })));
+  options_parser.AddOption(
+      "adaptive_chunk_size",
+      ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                        &adaptive_chunk_size_));
+  options_parser.AddOption(
+      "min_chunk_size",
+      ValueParser::Bytes(1, std::numeric_limits<uint64_t>::max(),
+                         &min_chunk_size_));
+  options_parser.AddOption(
+      "max_chunk_size",
+      ValueParser::Bytes(1, std::numeric_limits<uint64_t>::max(),
+                         &max_chunk_size_));
+  options_parser.AddOption(
+      "min_encoding_speed",
+      ValueParser::And(
+          ValueParser::Bytes(0, std::numeric_limits<uint64_t>::max(),
+                             &min_encoding_speed),
+          [this, &min_encoding_speed](ValueParser& value_parser) {
+            min_encoding_speed_ = static_cast<double>(min_encoding_speed);
+            return true;
+          }));
+  options_parser.AddOption(
+      "max_chunk_records",
+      ValueParser::Or(
+          ValueParser::Enum({{"auto", absl::nullopt}}, &max_chunk_records_),
+          ValueParser::And(
+              ValueParser::Bytes(1, std::numeric_limits<uint64_t>::max(),
+                                 &max_chunk_records),
+              [this, &max_chunk_records](ValueParser& value_parser) {
+                max_chunk_records_ = max_chunk_records;
+                return true;
+              })));
   options_parser.AddOption("bucket_fraction",
                            ValueParser::Real(0.0, 1.0, &bucket_fraction_));
+  options_parser.AddOption(
+      "integer_encodings",
+      ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                        &integer_encodings_));
+  options_parser.AddOption(
+      "string_dictionaries",
+      ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                        &string_dictionaries_));
+  options_parser.AddOption(
+      "packed_encodings",
+      ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                        &packed_encodings_));
+  options_parser.AddOption(
+      "zstd_dictionary_training",
+      ValueParser::Bytes(0, std::numeric_limits<uint64_t>::max(),
+                         &zstd_dictionary_training_));
+  options_parser.AddOption("zstd_reference_chunks",
+                           ValueParser::Int(0, std::numeric_limits<int>::max(),
+                                            &zstd_reference_chunks_));
   options_parser.AddOption(
       "pad_to_block_boundary",
       ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
                         &pad_to_block_boundary_));
+  options_parser.AddOption(
+      "chunk_index",
+      ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                        &chunk_index_));
+  options_parser.AddOption(
+      "file_summary",
+      ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                        &file_summary_));
+  options_parser.AddOption(
+      "hash", ValueParser::Enum({{"highwayhash", HashType::kHighwayHash},
+                                 {"crc32c", HashType::kCrc32c}},
+                                &hash_type_));
   options_parser.AddOption(
       "parallelism",
       ValueParser::Int(0, std::numeric_limits<int>::max(), &parallelism_));
+  options_parser.AddOption(
+      "max_in_flight_bytes",
+      ValueParser::Or(
+          ValueParser::Enum(
+              {{"unlimited", std::numeric_limits<uint64_t>::max()}},
+              &max_in_flight_bytes_),
+          ValueParser::Bytes(1, std::numeric_limits<uint64_t>::max(),
+                             &max_in_flight_bytes_)));
+  options_parser.AddOption(
+      "numa_aware",
+      ValueParser::Enum({{"", true}, {"true", true}, {"false", false}},
+                        &numa_aware_));
+  options_parser.AddOption(
+      "priority", ValueParser::Enum({{"low", ThreadPool::Priority::kLow},
+                                     {"normal", ThreadPool::Priority::kNormal},
+                                     {"high", ThreadPool::Priority::kHigh}},
+                                    &priority_));
   if (ABSL_PREDICT_FALSE(!options_parser.FromString(text))) {
     return options_parser.status();
   }
   return compressor_options_.FromString(compressor_text);
 }
 
+absl::Status RecordWriterBase::Options::Prepare() {
+  if (metadata_ == absl::nullopt && serialized_metadata_ == absl::nullopt) {
+    prepared_metadata_.reset();
+    return absl::OkStatus();
+  }
+  Options effective_options = *this;
+  if (effective_options.metadata_ != absl::nullopt) {
+    Chain serialized_metadata;
+    {
+      absl::Status status =
+          SerializeToChain(*effective_options.metadata_, serialized_metadata);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    }
+    effective_options.set_serialized_metadata(std::move(serialized_metadata));
+  }
+  std::shared_ptr<internal::PreparedMetadata> prepared_metadata =
+      std::make_shared<internal::PreparedMetadata>();
+  prepared_metadata->serialized_metadata =
+      *effective_options.serialized_metadata_;
+  prepared_metadata->hash_type = hash_type_;
+  StoreZstdDictionaryId(effective_options);
+  {
+    absl::Status status =
+        EncodeMetadataChunk(effective_options, prepared_metadata->chunk);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (transpose_ || auto_transpose_) {
+    prepared_metadata->record_type_built = true;
+    prepared_metadata->record_type = BuildRecordType(
+        effective_options, prepared_metadata->record_type_pool);
+  }
+  metadata_ = absl::nullopt;
+  serialized_metadata_ = prepared_metadata->serialized_metadata;
+  prepared_metadata_ = std::move(prepared_metadata);
+  return absl::OkStatus();
+}
+
 class RecordWriterBase::Worker : public Object {
  public:
   explicit Worker(ChunkWriter* chunk_writer, Options&& options)
       : Object(kInitiallyOpen),
         options_(std::move(options)),
+        chunk_size_(InitialChunkSize(options_)),
         chunk_writer_(RIEGELI_ASSERT_NOTNULL(chunk_writer)),
+        record_type_(!options_.transpose() && !options_.auto_transpose()
+                         ? nullptr
+                     : options_.prepared_metadata_ != nullptr &&
+                             options_.prepared_metadata_->record_type_built
+                         ? options_.prepared_metadata_->record_type
+                         : BuildRecordType(options_, record_type_pool_)),
         chunk_encoder_(MakeChunkEncoder()) {
     if (ABSL_PREDICT_FALSE(!chunk_writer_->healthy())) Fail(*chunk_writer_);
   }
@@ -169,13 +645,39 @@ class RecordWriterBase::Worker : public Object {
   bool AddRecord(const google::protobuf::MessageLite& record,
                  SerializeOptions serialize_options);
 
+  // Precondition: chunk is open.
+  bool AddRecords(Chain records, std::vector<size_t> limits);
+
+  // Encodes a record of `size` bytes read from `src` as a chunk of its own,
+  // and writes it after any chunks closed before.
+  //
+  // Precondition: chunk is not open, or is open with no records;
+  //               `!NeedsRecordKeys()`
+  //
+  // If the result is `false` then `!healthy()`.
+  bool AddRecordFrom(Reader& src, uint64_t size);
+
   // Precondition: chunk is open.
   //
   // If the result is `false` then `!healthy()`.
   virtual bool CloseChunk() = 0;
 
+  // Writes a chunk of records which is already encoded, after any chunks
+  // closed before.
+  //
+  // Precondition: chunk is not open, or is open with no records.
+  //
+  // If the result is `false` then `!healthy()`.
+  bool AddEncodedChunk(const Chunk& chunk);
+
   bool MaybePadToBlockBoundary();
 
+  // Precondition: chunk is not open.
+  bool MaybeWriteFileSummary();
+
+  // Precondition: chunk is not open.
+  bool MaybeWriteChunkIndex();
+
   // Precondition: chunk is not open.
   virtual bool Flush(FlushType flush_type) = 0;
 
@@ -188,28 +690,201 @@ class RecordWriterBase::Worker : public Object {
 
   virtual Position EstimatedSize() const = 0;
 
+  // Returns `true` if records must be serialized before adding them, so that
+  // keys can be extracted.
+  bool NeedsRecordKeys() const;
+
+  // Returns counters collected if `options_.collect_stats()`.
+  virtual RecordWriterStats stats() const;
+
+  // Returns the desired uncompressed size of the next chunk. If
+  // `options_.adaptive_chunk_size()`, adjusts it first for the most recent
+  // chunk encoded since the last call.
+  //
+  // Precondition for `OpenChunk()` to use the returned size: chunk is not open.
+  uint64_t NextChunkSize();
+
+  // Registers memory owned by the worker with `MemoryEstimator`, including
+  // the chunk writer if `chunk_writer_is_owned` and it is not used by another
+  // thread.
+  virtual void RegisterSubobjects(bool chunk_writer_is_owned,
+                                  MemoryEstimator& memory_estimator) const;
+
  protected:
   void Initialize(Position initial_pos);
   virtual bool WriteSignature() = 0;
   virtual bool WriteMetadata() = 0;
+  virtual bool WriteEncodedChunk(const Chunk& chunk) = 0;
   virtual bool PadToBlockBoundary() = 0;
-
+  // Writes `file_summary_`, with record statistics taken from `record_stats`.
+  virtual bool WriteFileSummary(FileSummary record_stats) = 0;
+  virtual bool WriteChunkIndex() = 0;
+
+  // Returns `chunk_writer_->stats()`, as visible in the thread of
+  // `RecordWriter`.
+  virtual ChunkWriterStats chunk_writer_stats() const = 0;
+
+  static uint64_t InitialChunkSize(const Options& options);
+  static bool UsesZstdReferences(const Options& options);
+  // If `options_.memory_budget() != nullptr`, reserves memory for a chunk of
+  // `chunk_size_` in `memory_reservation_`, waiting if needed.
+  //
+  // Precondition: `memory_reservation_` holds nothing.
+  void ReserveChunkMemory();
   std::unique_ptr<ChunkEncoder> MakeChunkEncoder();
+  std::unique_ptr<ChunkEncoder> MakeBaseChunkEncoder(bool transpose);
+  // Makes the chunk which has just been written at `chunk_begin` a part of the
+  // reference of the next chunk, or starts a new group if the group is full.
+  //
+  // Precondition: `zstd_references_`
+  void UpdateReference(Position chunk_begin);
+  // Makes the next chunk the first chunk of a group, compressed without a
+  // reference.
+  void StartReferenceGroup();
+  // Like `StartReferenceGroup()`, before a chunk is written bypassing the open
+  // chunk, which then cannot be a part of the reference. If the open chunk is
+  // empty, its chunk encoder was created with the previous reference, and it
+  // is replaced.
+  void BreakReferenceGroup();
   void EncodeSignature(Chunk& chunk);
   bool EncodeMetadata(Chunk& chunk);
   bool EncodeChunk(ChunkEncoder& chunk_encoder, Chunk& chunk);
 
+  // Precondition: `collect_record_stats_`
+  void UpdateRecordStats(absl::string_view record);
+  void UpdateRecordStats(const std::string& record);
+  void UpdateRecordStats(const Chain& record);
+  void UpdateRecordStats(const absl::Cord& record);
+
+  // Stops collecting record statistics, because some records are not seen
+  // individually.
+  void DropRecordStats();
+
+  // Moves statistics of records from `record_stats` to `file_summary_`.
+  void SetRecordStats(FileSummary&& record_stats);
+
+  // Precondition: `options_.chunk_key() != nullptr`
+  void UpdateChunkKeys(absl::string_view record);
+  void UpdateChunkKeys(const std::string& record);
+  void UpdateChunkKeys(const Chain& record);
+  void UpdateChunkKeys(const absl::Cord& record);
+
+  // Returns a filter of keys of records added to the current chunk if
+  // `options_.chunk_key_filter_bits() > 0`, otherwise an empty string, and
+  // clears `chunk_key_hashes_`.
+  //
+  // Precondition: `options_.chunk_key() != nullptr`
+  std::string TakeChunkKeyFilter();
+
+  // Adds a chunk written at `chunk_begin` to `chunk_index_`, with `min_key`,
+  // `max_key`, and `key_filter` if `options_.chunk_key() != nullptr`.
+  //
+  // Precondition: `write_chunk_index_`
+  void AddToChunkIndex(Position chunk_begin, uint64_t num_records,
+                       std::string min_key, std::string max_key,
+                       std::string key_filter);
+
+  // Accounts for a written chunk in `file_summary_` and `chunk_index_`.
+  void AddWrittenChunk(Position chunk_begin, const ChunkHeader& chunk_header,
+                       std::string min_key, std::string max_key,
+                       std::string key_filter);
+
   Options options_;
+  // Desired uncompressed size of chunks being opened.
+  uint64_t chunk_size_;
   // Invariant: `chunk_writer_ != nullptr`
   ChunkWriter* chunk_writer_;
+  // Owns `*record_type_` if it is not `nullptr`.
+  std::unique_ptr<google::protobuf::DescriptorPool> record_type_pool_;
+  // The type of records from metadata, used by `TransposeEncoder`, or
+  // `nullptr` if unknown.
+  const google::protobuf::Descriptor* record_type_;
+  // Whether chunks are compressed with records of preceding chunks as a Zstd
+  // dictionary, according to `options_.zstd_reference_chunks()`.
+  bool zstd_references_ = UsesZstdReferences(options_);
+  // Records of chunks of the current group written so far, which the next
+  // chunk refers to, if `zstd_references_`.
+  Chain reference_;
+  // The number of chunks in `reference_`.
+  int num_reference_chunks_ = 0;
+  // The position of the first chunk in `reference_`.
+  Position reference_begin_ = 0;
+  // `options_.compressor_options()` with `reference_` as the Zstd dictionary,
+  // valid if `num_reference_chunks_ > 0`.
+  CompressorOptions reference_compressor_options_;
+  // Records added to the current chunk, if `zstd_references_`.
+  Chain chunk_records_;
   // Invariant: if chunk is open then `chunk_encoder_ != nullptr`
   std::unique_ptr<ChunkEncoder> chunk_encoder_;
+  // Memory reserved for the open chunk if
+  // `options_.memory_budget() != nullptr`.
+  MemoryBudget::Reservation memory_reservation_;
+  // Whether chunks are collected in `chunk_index_` to be written by
+  // `MaybeWriteChunkIndex()`.
+  bool write_chunk_index_ = false;
+  // Chunks written so far, if `write_chunk_index_`. Updated by the thread which
+  // writes chunks to `*chunk_writer_`.
+  ChunkIndex chunk_index_;
+  // Whether chunks are counted in `file_summary_` to be written by
+  // `MaybeWriteFileSummary()`.
+  bool write_file_summary_ = false;
+  // Totals of chunks written so far, if `write_file_summary_`. Updated by the
+  // thread which writes chunks to `*chunk_writer_`.
+  FileSummary file_summary_;
+  // Whether records are accounted for in `record_stats_`.
+  bool collect_record_stats_ = false;
+  // Statistics of records added so far, if `collect_record_stats_`: the
+  // record size histogram and the key sketch. Updated by the thread of
+  // `RecordWriter`, and passed to `WriteFileSummary()`.
+  FileSummary record_stats_;
+  // If `options_.chunk_key() != nullptr`, the smallest and largest keys of
+  // records added to the current chunk, valid if `chunk_has_keys_`.
+  bool chunk_has_keys_ = false;
+  std::string chunk_min_key_;
+  std::string chunk_max_key_;
+  // If `options_.chunk_key_filter_bits() > 0`, hashes of keys of records added
+  // to the current chunk.
+  std::vector<uint64_t> chunk_key_hashes_;
+
+ private:
+  // Measurements of encoding a chunk, for `options_.adaptive_chunk_size()`.
+  struct ChunkStats {
+    uint64_t decoded_data_size;
+    uint64_t data_size;
+    absl::Duration encoding_time;
+  };
+
+  // Compression ratio of the chunk which led to the last adjustment of
+  // `chunk_size_`.
+  absl::optional<double> last_compression_ratio_;
+  // Chunks can be encoded in background, so their measurements are passed to
+  // `NextChunkSize()` and `stats()` through `stats_mutex_`.
+  mutable absl::Mutex stats_mutex_;
+  absl::optional<ChunkStats> recent_chunk_stats_
+      ABSL_GUARDED_BY(stats_mutex_);
+  // Counters of chunks encoded if `options_.collect_stats()`, except for
+  // `chunk_writer`.
+  RecordWriterStats encoding_stats_ ABSL_GUARDED_BY(stats_mutex_);
 };
 
 RecordWriterBase::Worker::~Worker() {}
 
+inline void RecordWriterBase::Worker::ReserveChunkMemory() {
+  if (options_.memory_budget() == nullptr) return;
+  // Records are buffered, and then their encoded form coexists with them.
+  memory_reservation_ = options_.memory_budget()->Reserve(IntCast<size_t>(
+      UnsignedMin(SaturatingAdd(chunk_size_, chunk_size_),
+                  uint64_t{std::numeric_limits<size_t>::max()})));
+}
+
 inline void RecordWriterBase::Worker::Initialize(Position initial_pos) {
   if (initial_pos == 0) {
+    // When appending, records already in the file are not known, so the chunk
+    // index would be incomplete.
+    write_chunk_index_ =
+        options_.chunk_index() || options_.chunk_key() != nullptr;
+    write_file_summary_ = options_.file_summary();
+    collect_record_stats_ = write_file_summary_;
     if (ABSL_PREDICT_FALSE(!WriteSignature())) return;
     if (ABSL_PREDICT_FALSE(!WriteMetadata())) return;
   } else {
@@ -225,12 +900,162 @@ inline bool RecordWriterBase::Worker::MaybePadToBlockBoundary() {
   }
 }
 
+bool RecordWriterBase::Worker::AddEncodedChunk(const Chunk& chunk) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(
+          chunk.header.chunk_type() != ChunkType::kSimple &&
+          chunk.header.chunk_type() != ChunkType::kTransposed &&
+          chunk.header.chunk_type() != ChunkType::kDeduplicated)) {
+    return Fail(absl::InvalidArgumentError(
+        "Writing an encoded chunk requires a chunk of records"));
+  }
+  if (ABSL_PREDICT_FALSE(options_.chunk_key() != nullptr)) {
+    // Keys of records in the chunk are not known without decoding it.
+    return Fail(absl::FailedPreconditionError(
+        "Writing an encoded chunk is not supported with chunk keys"));
+  }
+  DropRecordStats();
+  BreakReferenceGroup();
+  return WriteEncodedChunk(chunk);
+}
+
+inline bool RecordWriterBase::Worker::MaybeWriteFileSummary() {
+  if (write_file_summary_) {
+    return WriteFileSummary(std::move(record_stats_));
+  } else {
+    return true;
+  }
+}
+
+inline bool RecordWriterBase::Worker::MaybeWriteChunkIndex() {
+  if (write_chunk_index_) {
+    return WriteChunkIndex();
+  } else {
+    return true;
+  }
+}
+
+inline uint64_t RecordWriterBase::Worker::InitialChunkSize(
+    const Options& options) {
+  if (!options.adaptive_chunk_size()) return options.effective_chunk_size();
+  return UnsignedMax(
+      UnsignedMin(options.effective_chunk_size(), options.max_chunk_size()),
+      options.min_chunk_size());
+}
+
+uint64_t RecordWriterBase::Worker::NextChunkSize() {
+  if (!options_.adaptive_chunk_size()) return chunk_size_;
+  absl::optional<ChunkStats> stats;
+  {
+    absl::MutexLock lock(&stats_mutex_);
+    stats = std::exchange(recent_chunk_stats_, absl::nullopt);
+  }
+  if (stats == absl::nullopt || stats->decoded_data_size == 0) {
+    return chunk_size_;
+  }
+  const double compression_ratio =
+      static_cast<double>(stats->data_size) /
+      static_cast<double>(stats->decoded_data_size);
+  const double encoding_seconds = absl::ToDoubleSeconds(stats->encoding_time);
+  if (options_.min_encoding_speed() > 0.0 &&
+      static_cast<double>(stats->decoded_data_size) <
+          options_.min_encoding_speed() * encoding_seconds) {
+    // Encoding is too slow. Smaller chunks are usually encoded faster per
+    // byte, because compression state fits better in caches.
+    chunk_size_ = UnsignedMax(chunk_size_ / 2, options_.min_chunk_size());
+  } else if (last_compression_ratio_ == absl::nullopt ||
+             compression_ratio < *last_compression_ratio_ * 0.99) {
+    // The first measurement, or the last growth paid off by at least 1%:
+    // try larger chunks.
+    chunk_size_ = chunk_size_ >= options_.max_chunk_size() / 2
+                      ? options_.max_chunk_size()
+                      : chunk_size_ * 2;
+  }
+  last_compression_ratio_ = compression_ratio;
+  return chunk_size_;
+}
+
+inline bool RecordWriterBase::Worker::UsesZstdReferences(
+    const Options& options) {
+  return options.zstd_reference_chunks() > 0 && options.parallelism() == 0 &&
+         options.compressor_options().compression_type() ==
+             CompressionType::kZstd &&
+         options.zstd_dictionary().data().empty();
+}
+
+void RecordWriterBase::Worker::UpdateReference(Position chunk_begin) {
+  RIEGELI_ASSERT(zstd_references_)
+      << "Failed precondition of RecordWriterBase::Worker::UpdateReference(): "
+         "Zstd references not used";
+  if (num_reference_chunks_ == options_.zstd_reference_chunks()) {
+    // The group is full.
+    StartReferenceGroup();
+    return;
+  }
+  if (num_reference_chunks_ == 0) reference_begin_ = chunk_begin;
+  reference_.Append(std::move(chunk_records_));
+  chunk_records_ = Chain();
+  ++num_reference_chunks_;
+  reference_compressor_options_ = options_.compressor_options();
+  reference_compressor_options_.set_zstd_dictionary(
+      ZstdWriterBase::Dictionary()
+          .set_content_type(ZstdWriterBase::ContentType::kRaw)
+          .set_data(std::string(reference_)));
+}
+
+inline void RecordWriterBase::Worker::StartReferenceGroup() {
+  reference_.Clear();
+  chunk_records_.Clear();
+  num_reference_chunks_ = 0;
+  reference_compressor_options_ = CompressorOptions();
+}
+
+inline void RecordWriterBase::Worker::BreakReferenceGroup() {
+  if (num_reference_chunks_ == 0) return;
+  StartReferenceGroup();
+  if (chunk_encoder_ != nullptr) chunk_encoder_ = MakeChunkEncoder();
+}
+
+void RecordWriterBase::Worker::RegisterSubobjects(
+    bool chunk_writer_is_owned, MemoryEstimator& memory_estimator) const {
+  if (chunk_encoder_ != nullptr) {
+    chunk_encoder_->RegisterSubobjects(memory_estimator);
+  }
+  reference_.RegisterSubobjects(memory_estimator);
+  chunk_records_.RegisterSubobjects(memory_estimator);
+  memory_estimator.RegisterDynamicMemory(chunk_min_key_.capacity());
+  memory_estimator.RegisterDynamicMemory(chunk_max_key_.capacity());
+  memory_estimator.RegisterDynamicMemory(chunk_key_hashes_.capacity() *
+                                         sizeof(uint64_t));
+}
+
 inline std::unique_ptr<ChunkEncoder>
 RecordWriterBase::Worker::MakeChunkEncoder() {
+  if (options_.auto_transpose()) {
+    std::vector<std::unique_ptr<ChunkEncoder>> base_encoders;
+    base_encoders.push_back(MakeBaseChunkEncoder(false));
+    base_encoders.push_back(MakeBaseChunkEncoder(true));
+    return std::make_unique<DeferredEncoder>(std::move(base_encoders),
+                                             kAutoTransposeSampleSize);
+  }
+  std::unique_ptr<ChunkEncoder> chunk_encoder =
+      MakeBaseChunkEncoder(options_.transpose());
+  if (options_.parallelism() == 0) {
+    return chunk_encoder;
+  } else {
+    return std::make_unique<DeferredEncoder>(std::move(chunk_encoder));
+  }
+}
+
+inline std::unique_ptr<ChunkEncoder>
+RecordWriterBase::Worker::MakeBaseChunkEncoder(bool transpose) {
+  const CompressorOptions& compressor_options =
+      num_reference_chunks_ > 0 ? reference_compressor_options_
+                                : options_.compressor_options();
   std::unique_ptr<ChunkEncoder> chunk_encoder;
-  if (options_.transpose()) {
+  if (transpose) {
     const long double long_double_bucket_size =
-        std::round(static_cast<long double>(options_.effective_chunk_size()) *
+        std::round(static_cast<long double>(chunk_size_) *
                    static_cast<long double>(options_.bucket_fraction()));
     const uint64_t bucket_size =
         ABSL_PREDICT_FALSE(
@@ -241,49 +1066,182 @@ RecordWriterBase::Worker::MakeChunkEncoder() {
             ? static_cast<uint64_t>(long_double_bucket_size)
             : uint64_t{1};
     chunk_encoder = std::make_unique<TransposeEncoder>(
-        options_.compressor_options(), bucket_size);
+        compressor_options, bucket_size, record_type_,
+        options_.integer_encodings(), options_.string_dictionaries(),
+        options_.packed_encodings());
   } else {
-    chunk_encoder = std::make_unique<SimpleEncoder>(
-        options_.compressor_options(), options_.effective_chunk_size());
+    chunk_encoder =
+        std::make_unique<SimpleEncoder>(compressor_options, chunk_size_);
   }
-  if (options_.parallelism() == 0) {
-    return chunk_encoder;
-  } else {
-    return std::make_unique<DeferredEncoder>(std::move(chunk_encoder));
+  if (options_.deduplicate()) {
+    return std::make_unique<DeduplicatingEncoder>(compressor_options,
+                                                  std::move(chunk_encoder));
   }
+  return chunk_encoder;
 }
 
 inline void RecordWriterBase::Worker::EncodeSignature(Chunk& chunk) {
-  chunk.header = ChunkHeader(chunk.data, ChunkType::kFileSignature, 0, 0);
+  chunk.header = ChunkHeader(chunk.data, ChunkType::kFileSignature, 0, 0,
+                             options_.hash_type());
 }
 
 inline bool RecordWriterBase::Worker::EncodeMetadata(Chunk& chunk) {
-  TransposeEncoder transpose_encoder(options_.compressor_options(),
-                                     std::numeric_limits<uint64_t>::max());
-  if (ABSL_PREDICT_FALSE(
-          options_.metadata() != absl::nullopt
-              ? !transpose_encoder.AddRecord(*options_.metadata())
-              : !transpose_encoder.AddRecord(
-                    *options_.serialized_metadata()))) {
-    return Fail(transpose_encoder);
-  }
-  ChainWriter<> data_writer(&chunk.data);
-  ChunkType chunk_type;
-  uint64_t num_records;
-  uint64_t decoded_data_size;
-  if (ABSL_PREDICT_FALSE(!transpose_encoder.EncodeAndClose(
-          data_writer, chunk_type, num_records, decoded_data_size))) {
-    return Fail(transpose_encoder);
+  if (options_.prepared_metadata_ != nullptr) {
+    // Copying `chunk.data` shares its blocks.
+    chunk = options_.prepared_metadata_->chunk;
+    return true;
   }
-  if (ABSL_PREDICT_FALSE(!data_writer.Close())) return Fail(data_writer);
-  chunk.header =
-      ChunkHeader(chunk.data, ChunkType::kFileMetadata, 0, decoded_data_size);
+  absl::Status status = EncodeMetadataChunk(options_, chunk);
+  if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
   return true;
 }
 
+inline bool RecordWriterBase::Worker::NeedsRecordKeys() const {
+  return options_.chunk_key() != nullptr ||
+         (collect_record_stats_ && options_.summary_key() != nullptr);
+}
+
+inline void RecordWriterBase::Worker::UpdateRecordStats(
+    absl::string_view record) {
+  record_stats_.AddRecordSize(record.size());
+  if (options_.summary_key() != nullptr) {
+    record_stats_.AddKey(options_.summary_key()(record));
+  }
+}
+
+inline void RecordWriterBase::Worker::UpdateRecordStats(
+    const std::string& record) {
+  UpdateRecordStats(absl::string_view(record));
+}
+
+inline void RecordWriterBase::Worker::UpdateRecordStats(const Chain& record) {
+  if (options_.summary_key() == nullptr) {
+    record_stats_.AddRecordSize(record.size());
+    return;
+  }
+  const absl::optional<absl::string_view> flat = record.TryFlat();
+  if (flat != absl::nullopt) {
+    UpdateRecordStats(*flat);
+  } else {
+    UpdateRecordStats(absl::string_view(std::string(record)));
+  }
+}
+
+inline void RecordWriterBase::Worker::UpdateRecordStats(
+    const absl::Cord& record) {
+  if (options_.summary_key() == nullptr) {
+    record_stats_.AddRecordSize(record.size());
+    return;
+  }
+  const absl::optional<absl::string_view> flat = record.TryFlat();
+  if (flat != absl::nullopt) {
+    UpdateRecordStats(*flat);
+  } else {
+    UpdateRecordStats(absl::string_view(std::string(record)));
+  }
+}
+
+inline void RecordWriterBase::Worker::DropRecordStats() {
+  if (!collect_record_stats_) return;
+  collect_record_stats_ = false;
+  record_stats_ = FileSummary();
+}
+
+inline void RecordWriterBase::Worker::SetRecordStats(
+    FileSummary&& record_stats) {
+  file_summary_.record_size_histogram =
+      std::move(record_stats.record_size_histogram);
+  file_summary_.key_sketch = std::move(record_stats.key_sketch);
+}
+
+inline void RecordWriterBase::Worker::UpdateChunkKeys(
+    absl::string_view record) {
+  std::string key = options_.chunk_key()(record);
+  if (options_.chunk_key_filter_bits() > 0) {
+    chunk_key_hashes_.push_back(ChunkIndex::KeyHash(key));
+  }
+  if (!chunk_has_keys_) {
+    chunk_min_key_ = key;
+    chunk_max_key_ = std::move(key);
+    chunk_has_keys_ = true;
+  } else if (key < chunk_min_key_) {
+    chunk_min_key_ = std::move(key);
+  } else if (key > chunk_max_key_) {
+    chunk_max_key_ = std::move(key);
+  }
+}
+
+inline void RecordWriterBase::Worker::UpdateChunkKeys(
+    const std::string& record) {
+  UpdateChunkKeys(absl::string_view(record));
+}
+
+inline void RecordWriterBase::Worker::UpdateChunkKeys(const Chain& record) {
+  const absl::optional<absl::string_view> flat = record.TryFlat();
+  if (flat != absl::nullopt) {
+    UpdateChunkKeys(*flat);
+  } else {
+    UpdateChunkKeys(absl::string_view(std::string(record)));
+  }
+}
+
+inline void RecordWriterBase::Worker::UpdateChunkKeys(
+    const absl::Cord& record) {
+  const absl::optional<absl::string_view> flat = record.TryFlat();
+  if (flat != absl::nullopt) {
+    UpdateChunkKeys(*flat);
+  } else {
+    UpdateChunkKeys(absl::string_view(std::string(record)));
+  }
+}
+
+inline std::string RecordWriterBase::Worker::TakeChunkKeyFilter() {
+  if (options_.chunk_key_filter_bits() <= 0) return std::string();
+  std::string key_filter = ChunkIndex::BuildKeyFilter(
+      chunk_key_hashes_, options_.chunk_key_filter_bits());
+  chunk_key_hashes_.clear();
+  return key_filter;
+}
+
+inline void RecordWriterBase::Worker::AddToChunkIndex(Position chunk_begin,
+                                                      uint64_t num_records,
+                                                      std::string min_key,
+                                                      std::string max_key,
+                                                      std::string key_filter) {
+  RIEGELI_ASSERT(write_chunk_index_)
+      << "Failed precondition of RecordWriterBase::Worker::AddToChunkIndex(): "
+         "chunk index not written";
+  if (options_.chunk_key() != nullptr) {
+    chunk_index_.Add(chunk_begin, num_records, std::move(min_key),
+                     std::move(max_key), std::move(key_filter));
+  } else {
+    chunk_index_.Add(chunk_begin, num_records);
+  }
+}
+
+inline void RecordWriterBase::Worker::AddWrittenChunk(
+    Position chunk_begin, const ChunkHeader& chunk_header, std::string min_key,
+    std::string max_key, std::string key_filter) {
+  if (options_.chunk_written() != nullptr && chunk_header.num_records() > 0) {
+    options_.chunk_written()(chunk_begin, chunk_header.num_records());
+  }
+  if (write_file_summary_) {
+    file_summary_.Add(chunk_header.num_records(),
+                      chunk_header.decoded_data_size());
+  }
+  if (write_chunk_index_) {
+    AddToChunkIndex(chunk_begin, chunk_header.num_records(),
+                    std::move(min_key), std::move(max_key),
+                    std::move(key_filter));
+  }
+}
+
 template <typename Record>
 inline bool RecordWriterBase::Worker::AddRecord(Record&& record) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (options_.chunk_key() != nullptr) UpdateChunkKeys(record);
+  if (collect_record_stats_) UpdateRecordStats(record);
+  if (zstd_references_) chunk_records_.Append(record);
   if (ABSL_PREDICT_FALSE(
           !chunk_encoder_->AddRecord(std::forward<Record>(record)))) {
     return Fail(*chunk_encoder_);
@@ -295,6 +1253,23 @@ inline bool RecordWriterBase::Worker::AddRecord(
     const google::protobuf::MessageLite& record,
     SerializeOptions serialize_options) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (NeedsRecordKeys() || zstd_references_) {
+    // The key is extracted from the serialized record, or the serialized
+    // record is kept for the reference of the next chunk, so it is serialized
+    // here rather than by the chunk encoder.
+    Chain serialized;
+    {
+      absl::Status status =
+          SerializeToChain(record, serialized, std::move(serialize_options));
+      if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+    }
+    return AddRecord(std::move(serialized));
+  }
+  if (collect_record_stats_) {
+    // The size is cached in `record`, so it is not computed again by the chunk
+    // encoder.
+    record_stats_.AddRecordSize(serialize_options.GetByteSize(record));
+  }
   if (ABSL_PREDICT_FALSE(
           !chunk_encoder_->AddRecord(record, std::move(serialize_options)))) {
     return Fail(*chunk_encoder_);
@@ -302,6 +1277,54 @@ inline bool RecordWriterBase::Worker::AddRecord(
   return true;
 }
 
+inline bool RecordWriterBase::Worker::AddRecords(Chain records,
+                                                 std::vector<size_t> limits) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (NeedsRecordKeys()) {
+    ChainReader<> records_reader(&records);
+    for (const size_t limit : limits) {
+      absl::string_view record;
+      if (!records_reader.Read(
+              limit - IntCast<size_t>(records_reader.pos()), record)) {
+        RIEGELI_ASSERT_UNREACHABLE()
+            << "Failed reading record from records reader: "
+            << records_reader.status();
+      }
+      if (options_.chunk_key() != nullptr) UpdateChunkKeys(record);
+      if (collect_record_stats_) UpdateRecordStats(record);
+    }
+  } else if (collect_record_stats_) {
+    size_t record_begin = 0;
+    for (const size_t limit : limits) {
+      record_stats_.AddRecordSize(limit - record_begin);
+      record_begin = limit;
+    }
+  }
+  if (zstd_references_) chunk_records_.Append(records);
+  if (ABSL_PREDICT_FALSE(
+          !chunk_encoder_->AddRecords(std::move(records), std::move(limits)))) {
+    return Fail(*chunk_encoder_);
+  }
+  return true;
+}
+
+inline bool RecordWriterBase::Worker::AddRecordFrom(Reader& src,
+                                                    uint64_t size) {
+  RIEGELI_ASSERT(!NeedsRecordKeys())
+      << "Failed precondition of RecordWriterBase::Worker::AddRecordFrom(): "
+         "record keys are needed";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  BreakReferenceGroup();
+  SimpleEncoder chunk_encoder(options_.compressor_options(), size);
+  if (ABSL_PREDICT_FALSE(!chunk_encoder.AddRecordFrom(src, size))) {
+    return Fail(chunk_encoder);
+  }
+  Chunk chunk;
+  if (ABSL_PREDICT_FALSE(!EncodeChunk(chunk_encoder, chunk))) return false;
+  if (collect_record_stats_) record_stats_.AddRecordSize(size);
+  return WriteEncodedChunk(chunk);
+}
+
 inline bool RecordWriterBase::Worker::EncodeChunk(ChunkEncoder& chunk_encoder,
                                                   Chunk& chunk) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
@@ -309,32 +1332,97 @@ inline bool RecordWriterBase::Worker::EncodeChunk(ChunkEncoder& chunk_encoder,
   uint64_t num_records;
   uint64_t decoded_data_size;
   ChainWriter<> data_writer(&chunk.data);
+  const bool measure_time = options_.adaptive_chunk_size() ||
+                            options_.collect_stats() ||
+                            options_.trace_sink() != nullptr;
+  const absl::Time encoding_start =
+      measure_time ? absl::Now() : absl::InfinitePast();
   if (ABSL_PREDICT_FALSE(!chunk_encoder.EncodeAndClose(
           data_writer, chunk_type, num_records, decoded_data_size))) {
     return Fail(chunk_encoder);
   }
   if (ABSL_PREDICT_FALSE(!data_writer.Close())) return Fail(data_writer);
-  chunk.header =
-      ChunkHeader(chunk.data, chunk_type, num_records, decoded_data_size);
+  if (num_reference_chunks_ > 0) {
+    // The chunk was compressed with `reference_` by `MakeBaseChunkEncoder()`.
+    // References are used only by `SerialWorker`, which writes the chunk at
+    // `chunk_writer_->pos()`.
+    char reference[kMaxLengthVarint64 * 2 + 1];
+    char* cursor =
+        WriteVarint64(chunk_writer_->pos() - reference_begin_, reference);
+    cursor = WriteVarint64(IntCast<uint64_t>(num_reference_chunks_), cursor);
+    *cursor++ = static_cast<char>(chunk_type);
+    chunk.data.Prepend(
+        absl::string_view(reference, PtrDistance(reference, cursor)));
+    chunk_type = ChunkType::kReferencing;
+  }
+  const absl::Time hashing_start =
+      measure_time ? absl::Now() : absl::InfinitePast();
+  chunk.header = ChunkHeader(chunk.data, chunk_type, num_records,
+                             decoded_data_size, options_.hash_type());
+  const absl::Time hashing_end =
+      measure_time ? absl::Now() : absl::InfinitePast();
+  if (options_.adaptive_chunk_size()) {
+    const ChunkStats stats = {decoded_data_size, chunk.data.size(),
+                              hashing_end - encoding_start};
+    absl::MutexLock lock(&stats_mutex_);
+    recent_chunk_stats_ = stats;
+  }
+  if (options_.trace_sink() != nullptr) {
+    options_.trace_sink()->AddEvent(
+        TraceEvent{TraceStage::kEncodeChunk, absl::nullopt, decoded_data_size,
+                   encoding_start, hashing_start});
+    options_.trace_sink()->AddEvent(
+        TraceEvent{TraceStage::kHashChunk, absl::nullopt, chunk.data.size(),
+                   hashing_start, hashing_end});
+  }
+  if (options_.collect_stats()) {
+    absl::MutexLock lock(&stats_mutex_);
+    encoding_stats_.num_records += num_records;
+    ++encoding_stats_.num_chunks;
+    encoding_stats_.num_decoded_bytes += decoded_data_size;
+    encoding_stats_.num_compressed_bytes += chunk.data.size();
+    encoding_stats_.encode_time += hashing_start - encoding_start;
+    encoding_stats_.hash_time += hashing_end - hashing_start;
+  }
   return true;
 }
 
+RecordWriterStats RecordWriterBase::Worker::stats() const {
+  RecordWriterStats stats;
+  {
+    absl::MutexLock lock(&stats_mutex_);
+    stats = encoding_stats_;
+  }
+  stats.chunk_writer = chunk_writer_stats();
+  return stats;
+}
+
 class RecordWriterBase::SerialWorker : public Worker {
  public:
   explicit SerialWorker(ChunkWriter* chunk_writer, Options&& options);
 
-  void OpenChunk() override { chunk_encoder_->Clear(); }
+  void OpenChunk() override;
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
   std::future<bool> FutureFlush(FlushType flush_type) override;
   FutureRecordPosition LastPos() const override;
   FutureRecordPosition Pos() const override;
   Position EstimatedSize() const override;
+  void RegisterSubobjects(bool chunk_writer_is_owned,
+                          MemoryEstimator& memory_estimator) const override;
 
  protected:
   bool WriteSignature() override;
   bool WriteMetadata() override;
+  bool WriteEncodedChunk(const Chunk& chunk) override;
   bool PadToBlockBoundary() override;
+  bool WriteFileSummary(FileSummary record_stats) override;
+  bool WriteChunkIndex() override;
+  ChunkWriterStats chunk_writer_stats() const override;
+
+ private:
+  // The chunk size which `chunk_encoder_` was created for.
+  uint64_t chunk_encoder_size_ = chunk_size_;
 };
 
 inline RecordWriterBase::SerialWorker::SerialWorker(ChunkWriter* chunk_writer,
@@ -367,21 +1455,63 @@ bool RecordWriterBase::SerialWorker::WriteMetadata() {
   return true;
 }
 
-bool RecordWriterBase::SerialWorker::CloseChunk() {
+bool RecordWriterBase::SerialWorker::CloseChunk() {
+  // Released when the chunk is written.
+  MemoryBudget::Reservation memory_reservation =
+      std::move(memory_reservation_);
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Chunk chunk;
+  if (ABSL_PREDICT_FALSE(!EncodeChunk(*chunk_encoder_, chunk))) {
+    return false;
+  }
+  const Position chunk_begin = chunk_writer_->pos();
+  if (ABSL_PREDICT_FALSE(!chunk_writer_->WriteChunk(chunk))) {
+    return Fail(*chunk_writer_);
+  }
+  if (zstd_references_) UpdateReference(chunk_begin);
+  std::string key_filter;
+  if (options_.chunk_key() != nullptr) key_filter = TakeChunkKeyFilter();
+  AddWrittenChunk(chunk_begin, chunk.header, std::move(chunk_min_key_),
+                  std::move(chunk_max_key_), std::move(key_filter));
+  chunk_has_keys_ = false;
+  return true;
+}
+
+bool RecordWriterBase::SerialWorker::WriteEncodedChunk(const Chunk& chunk) {
+  const Position chunk_begin = chunk_writer_->pos();
+  if (ABSL_PREDICT_FALSE(!chunk_writer_->WriteChunk(chunk))) {
+    return Fail(*chunk_writer_);
+  }
+  AddWrittenChunk(chunk_begin, chunk.header, std::string(), std::string(),
+                  std::string());
+  return true;
+}
+
+bool RecordWriterBase::SerialWorker::PadToBlockBoundary() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  Chunk chunk;
-  if (ABSL_PREDICT_FALSE(!EncodeChunk(*chunk_encoder_, chunk))) {
-    return false;
+  if (ABSL_PREDICT_FALSE(!chunk_writer_->PadToBlockBoundary())) {
+    return Fail(*chunk_writer_);
   }
+  return true;
+}
+
+bool RecordWriterBase::SerialWorker::WriteFileSummary(
+    FileSummary record_stats) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  SetRecordStats(std::move(record_stats));
+  Chunk chunk;
+  file_summary_.EncodeChunk(chunk_writer_->pos(), chunk, options_.hash_type());
   if (ABSL_PREDICT_FALSE(!chunk_writer_->WriteChunk(chunk))) {
     return Fail(*chunk_writer_);
   }
   return true;
 }
 
-bool RecordWriterBase::SerialWorker::PadToBlockBoundary() {
+bool RecordWriterBase::SerialWorker::WriteChunkIndex() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  if (ABSL_PREDICT_FALSE(!chunk_writer_->PadToBlockBoundary())) {
+  Chunk chunk;
+  chunk_index_.EncodeChunk(chunk_writer_->pos(), chunk, options_.hash_type());
+  if (ABSL_PREDICT_FALSE(!chunk_writer_->WriteChunk(chunk))) {
     return Fail(*chunk_writer_);
   }
   return true;
@@ -419,27 +1549,59 @@ Position RecordWriterBase::SerialWorker::EstimatedSize() const {
   return chunk_writer_->pos();
 }
 
+void RecordWriterBase::SerialWorker::RegisterSubobjects(
+    bool chunk_writer_is_owned, MemoryEstimator& memory_estimator) const {
+  Worker::RegisterSubobjects(chunk_writer_is_owned, memory_estimator);
+  chunk_index_.RegisterSubobjects(memory_estimator);
+  if (chunk_writer_is_owned) {
+    chunk_writer_->RegisterSubobjects(memory_estimator);
+  }
+}
+
+ChunkWriterStats RecordWriterBase::SerialWorker::chunk_writer_stats() const {
+  return chunk_writer_->stats();
+}
+
 // `ParallelWorker` uses parallelism internally, but the class is still only
 // thread-compatible, not thread-safe.
+inline void RecordWriterBase::SerialWorker::OpenChunk() {
+  ReserveChunkMemory();
+  if (chunk_size_ != chunk_encoder_size_ || zstd_references_) {
+    // The chunk encoder was created for a different chunk size, or with a
+    // different reference.
+    chunk_encoder_ = MakeChunkEncoder();
+    chunk_encoder_size_ = chunk_size_;
+  } else {
+    chunk_encoder_->Clear();
+  }
+}
+
 class RecordWriterBase::ParallelWorker : public Worker {
  public:
   explicit ParallelWorker(ChunkWriter* chunk_writer, Options&& options);
 
   ~ParallelWorker();
 
-  void OpenChunk() override { chunk_encoder_ = MakeChunkEncoder(); }
+  void OpenChunk() override;
   bool CloseChunk() override;
   bool Flush(FlushType flush_type) override;
   std::future<bool> FutureFlush(FlushType flush_type) override;
   FutureRecordPosition LastPos() const override;
   FutureRecordPosition Pos() const override;
   Position EstimatedSize() const override;
+  RecordWriterStats stats() const override;
+  void RegisterSubobjects(bool chunk_writer_is_owned,
+                          MemoryEstimator& memory_estimator) const override;
 
  protected:
   void Done() override;
   bool WriteSignature() override;
   bool WriteMetadata() override;
+  bool WriteEncodedChunk(const Chunk& chunk) override;
   bool PadToBlockBoundary() override;
+  bool WriteFileSummary(FileSummary record_stats) override;
+  bool WriteChunkIndex() override;
+  ChunkWriterStats chunk_writer_stats() const override;
 
  private:
   struct ChunkPromises {
@@ -448,37 +1610,134 @@ class RecordWriterBase::ParallelWorker : public Worker {
   };
 
   // A request to the chunk writer thread.
+  struct PadToBlockBoundaryRequest {};
   struct DoneRequest {
     std::promise<void> done;
   };
   struct WriteChunkRequest {
     std::shared_future<ChunkHeader> chunk_header;
     std::future<Chunk> chunk;
+    // Contribution of the chunk to `in_flight_memory_`.
+    size_t memory;
+    // Keys of records in the chunk, if `options_.chunk_key() != nullptr`.
+    std::string min_key;
+    std::string max_key;
+    std::string key_filter;
   };
-  struct PadToBlockBoundaryRequest {};
+  // Written only when closing, so `PosInternal()` does not account for them.
+  struct WriteFileSummaryRequest {
+    FileSummary record_stats;
+  };
+  struct WriteChunkIndexRequest {};
   struct FlushRequest {
     FlushType flush_type;
     std::promise<bool> done;
   };
+  // `PadToBlockBoundaryRequest` is first so that empty slots of
+  // `chunk_writer_requests_` are cheap.
   using ChunkWriterRequest =
-      absl::variant<DoneRequest, WriteChunkRequest, PadToBlockBoundaryRequest,
+      absl::variant<PadToBlockBoundaryRequest, DoneRequest, WriteChunkRequest,
+                    WriteFileSummaryRequest, WriteChunkIndexRequest,
                     FlushRequest>;
 
+  ThreadPool& thread_pool() const;
+
+  // Schedules `task` in `thread_pool()` with `options_.priority()`, so that it
+  // can be boosted by `BoostTasks()`.
+  void ScheduleTask(std::function<void()> task);
+
+  // Boosts tasks scheduled by `ScheduleTask()` which have not started yet,
+  // before waiting for them.
+  void BoostTasks();
+
+  bool HasRequest() const;
   bool HasCapacityForRequest() const;
+  bool HasCapacityForBytes() const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(in_flight_mutex_);
+
+  // Records time spent waiting for chunks in flight, which started at
+  // `wait_start`.
+  void FinishInFlightWait(absl::Time wait_start);
+
+  // Adds a request for the chunk writer thread, waiting until there is a free
+  // slot.
+  void AddRequest(ChunkWriterRequest request);
+
+  // Returns the position after handling requests before `requests_begin`,
+  // and sets `requests_begin` to `requests_begin_`.
+  Position PosBeforeRequests(size_t& requests_begin) const;
+
   template <typename GetRecordIndex>
   FutureRecordPosition PosInternal(GetRecordIndex get_record_index) const;
 
-  mutable absl::Mutex mutex_;
-  std::deque<ChunkWriterRequest> chunk_writer_requests_ ABSL_GUARDED_BY(mutex_);
-  // Position before handling `chunk_writer_requests_`.
-  Position pos_before_chunks_ ABSL_GUARDED_BY(mutex_);
+  // Requests are passed from the thread of `RecordWriter` (the only producer)
+  // to the chunk writer thread (the only consumer) through a ring buffer.
+  // `mutex_` is used only for waiting while the ring buffer is empty or full,
+  // and is touched by the other side only if `consumer_waiting_` or
+  // `producer_waiting_` is set.
+  //
+  // Requests with indices `requests_begin_..requests_end_` are pending, the
+  // request with index `i` is in `chunk_writer_requests_[i % max_requests_]`.
+  // A slot is reset by the producer when it is reused.
+
+  // Invariant: `requests_end_ - requests_begin_ <= max_requests_`
+  const size_t max_requests_;
+  const Position initial_pos_;
+  std::vector<ChunkWriterRequest> chunk_writer_requests_;
+  // Modified by the consumer.
+  std::atomic<size_t> requests_begin_{0};
+  // Modified by the producer.
+  std::atomic<size_t> requests_end_{0};
+  // Position after handling the request with index `i`, stored in
+  // `pos_after_requests_[i % (max_requests_ + 1)]`. The extra slot ensures
+  // that the position after the last handled request read by the producer is
+  // not overwritten while it is read.
+  std::vector<std::atomic<Position>> pos_after_requests_;
+  std::atomic<bool> consumer_waiting_{false};
+  std::atomic<bool> producer_waiting_{false};
+  absl::Mutex mutex_;
+
+  // Chunk encoders which finished encoding in `thread_pool()`, kept to be
+  // cleared and reused by `OpenChunk()` instead of creating new ones, together
+  // with their compressor state. At most `max_requests_` are kept, which is
+  // the number of chunks being encoded at once.
+  mutable absl::Mutex idle_chunk_encoders_mutex_;
+  std::vector<std::unique_ptr<ChunkEncoder>> idle_chunk_encoders_
+      ABSL_GUARDED_BY(idle_chunk_encoders_mutex_);
+  // The chunk size which `idle_chunk_encoders_` were created for.
+  uint64_t idle_chunk_encoders_size_
+      ABSL_GUARDED_BY(idle_chunk_encoders_mutex_) = chunk_size_;
+
+  // Estimated memory of chunks closed but not written yet, which are owned by
+  // background tasks: their records while they are encoded, then the encoded
+  // chunk. Compared with `options_.max_in_flight_bytes()`.
+  mutable absl::Mutex in_flight_mutex_;
+  size_t in_flight_memory_ ABSL_GUARDED_BY(in_flight_mutex_) = 0;
+  size_t in_flight_chunks_ ABSL_GUARDED_BY(in_flight_mutex_) = 0;
+
+  // Counters of chunks in flight, if `options_.collect_stats()`. Used only by
+  // the producer.
+  uint64_t max_chunks_in_flight_ = 0;
+  Position max_bytes_in_flight_ = 0;
+  absl::Duration in_flight_wait_time_;
+
+  // A copy of `chunk_writer_->stats()` made by the chunk writer thread after
+  // each request, if `options_.collect_stats()`.
+  mutable absl::Mutex chunk_writer_stats_mutex_;
+  ChunkWriterStats chunk_writer_stats_
+      ABSL_GUARDED_BY(chunk_writer_stats_mutex_);
 };
 
 inline RecordWriterBase::ParallelWorker::ParallelWorker(
     ChunkWriter* chunk_writer, Options&& options)
     : Worker(chunk_writer, std::move(options)),
-      pos_before_chunks_(chunk_writer_->pos()) {
-  internal::ThreadPool::global().Schedule([this] {
+      max_requests_(IntCast<size_t>(options_.parallelism())),
+      initial_pos_(chunk_writer_->pos()),
+      chunk_writer_requests_(max_requests_),
+      pos_after_requests_(max_requests_ + 1) {
+  // The chunk writer thread waits for chunks encoded by `thread_pool()`, so it
+  // runs in `ThreadPool::global()` which has no thread count limit.
+  ThreadPool::global().Schedule([this] {
     struct Visitor {
       bool operator()(DoneRequest& request) const {
         request.done.set_value();
@@ -489,11 +1748,30 @@ inline RecordWriterBase::ParallelWorker::ParallelWorker(
         // If `!healthy()`, the chunk must still be waited for, to ensure that
         // the chunk encoder thread exits before the chunk writer thread
         // responds to `DoneRequest`.
+        TraceSink* const trace_sink = self->options_.trace_sink();
+        const absl::Time wait_start =
+            trace_sink != nullptr ? absl::Now() : absl::InfinitePast();
         const Chunk chunk = request.chunk.get();
+        {
+          absl::MutexLock lock(&self->in_flight_mutex_);
+          self->in_flight_memory_ -= request.memory;
+          --self->in_flight_chunks_;
+        }
+        if (trace_sink != nullptr) {
+          trace_sink->AddEvent(TraceEvent{TraceStage::kWaitForEncoding,
+                                          self->chunk_writer_->pos(), 0,
+                                          wait_start, absl::Now()});
+        }
         if (ABSL_PREDICT_FALSE(!self->healthy())) return true;
+        const Position chunk_begin = self->chunk_writer_->pos();
         if (ABSL_PREDICT_FALSE(!self->chunk_writer_->WriteChunk(chunk))) {
           self->Fail(*self->chunk_writer_);
+          return true;
         }
+        self->AddWrittenChunk(chunk_begin, chunk.header,
+                              std::move(request.min_key),
+                              std::move(request.max_key),
+                              std::move(request.key_filter));
         return true;
       }
 
@@ -505,6 +1783,29 @@ inline RecordWriterBase::ParallelWorker::ParallelWorker(
         return true;
       }
 
+      bool operator()(WriteFileSummaryRequest& request) const {
+        if (ABSL_PREDICT_FALSE(!self->healthy())) return true;
+        self->SetRecordStats(std::move(request.record_stats));
+        Chunk chunk;
+        self->file_summary_.EncodeChunk(self->chunk_writer_->pos(), chunk,
+                                        self->options_.hash_type());
+        if (ABSL_PREDICT_FALSE(!self->chunk_writer_->WriteChunk(chunk))) {
+          self->Fail(*self->chunk_writer_);
+        }
+        return true;
+      }
+
+      bool operator()(WriteChunkIndexRequest& request) const {
+        if (ABSL_PREDICT_FALSE(!self->healthy())) return true;
+        Chunk chunk;
+        self->chunk_index_.EncodeChunk(self->chunk_writer_->pos(), chunk,
+                                       self->options_.hash_type());
+        if (ABSL_PREDICT_FALSE(!self->chunk_writer_->WriteChunk(chunk))) {
+          self->Fail(*self->chunk_writer_);
+        }
+        return true;
+      }
+
       bool operator()(FlushRequest& request) const {
         if (ABSL_PREDICT_FALSE(!self->healthy())) {
           request.done.set_value(false);
@@ -523,22 +1824,33 @@ inline RecordWriterBase::ParallelWorker::ParallelWorker(
       ParallelWorker* self;
     };
 
-    mutex_.Lock();
     for (;;) {
-      mutex_.Await(absl::Condition(
-          +[](std::deque<ChunkWriterRequest>* chunk_writer_requests) {
-            return !chunk_writer_requests->empty();
-          },
-          &chunk_writer_requests_));
-      ChunkWriterRequest& request = chunk_writer_requests_.front();
-      mutex_.Unlock();
+      const size_t requests_begin =
+          requests_begin_.load(std::memory_order_relaxed);
+      if (requests_end_.load(std::memory_order_acquire) == requests_begin) {
+        consumer_waiting_.store(true);
+        mutex_.LockWhen(absl::Condition(this, &ParallelWorker::HasRequest));
+        mutex_.Unlock();
+        consumer_waiting_.store(false, std::memory_order_relaxed);
+      }
+      ChunkWriterRequest& request =
+          chunk_writer_requests_[requests_begin % max_requests_];
       if (ABSL_PREDICT_FALSE(!absl::visit(Visitor{this}, request))) return;
-      mutex_.Lock();
-      chunk_writer_requests_.pop_front();
-      pos_before_chunks_ = chunk_writer_->pos();
+      pos_after_requests_[requests_begin % (max_requests_ + 1)].store(
+          chunk_writer_->pos(), std::memory_order_relaxed);
+      if (options_.collect_stats()) {
+        absl::MutexLock lock(&chunk_writer_stats_mutex_);
+        chunk_writer_stats_ = chunk_writer_->stats();
+      }
+      requests_begin_.store(requests_begin + 1);
+      if (producer_waiting_.load()) {
+        // Wake up the producer waiting in `AddRequest()`.
+        mutex_.Lock();
+        mutex_.Unlock();
+      }
     }
   });
-  Initialize(pos_before_chunks_);
+  Initialize(initial_pos_);
 }
 
 RecordWriterBase::ParallelWorker::~ParallelWorker() {
@@ -550,19 +1862,94 @@ RecordWriterBase::ParallelWorker::~ParallelWorker() {
 }
 
 void RecordWriterBase::ParallelWorker::Done() {
+  BoostTasks();
   std::promise<void> done_promise;
   std::future<void> done_future = done_promise.get_future();
-  {
-    absl::MutexLock lock(&mutex_);
-    chunk_writer_requests_.emplace_back(DoneRequest{std::move(done_promise)});
-  }
+  AddRequest(DoneRequest{std::move(done_promise)});
   done_future.get();
 }
 
-bool RecordWriterBase::ParallelWorker::HasCapacityForRequest() const
-    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
-  return chunk_writer_requests_.size() <
-         IntCast<size_t>(options_.parallelism());
+ChunkWriterStats RecordWriterBase::ParallelWorker::chunk_writer_stats() const {
+  absl::MutexLock lock(&chunk_writer_stats_mutex_);
+  return chunk_writer_stats_;
+}
+
+inline ThreadPool& RecordWriterBase::ParallelWorker::thread_pool() const {
+  if (options_.thread_pool() != nullptr) return *options_.thread_pool();
+  if (options_.numa_aware()) return NumaThreadPools::global().ForCurrentNode();
+  return ThreadPool::global();
+}
+
+inline void RecordWriterBase::ParallelWorker::ScheduleTask(
+    std::function<void()> task) {
+  thread_pool().Schedule(std::move(task), options_.priority(), this);
+}
+
+void RecordWriterBase::ParallelWorker::BoostTasks() {
+  if (options_.thread_pool() == nullptr && options_.numa_aware()) {
+    // Tasks were scheduled on pools of various nodes.
+    NumaThreadPools::global().Boost(this);
+    return;
+  }
+  thread_pool().Boost(this);
+}
+
+bool RecordWriterBase::ParallelWorker::HasRequest() const {
+  return requests_end_.load() != requests_begin_.load();
+}
+
+bool RecordWriterBase::ParallelWorker::HasCapacityForRequest() const {
+  return requests_end_.load() - requests_begin_.load() < max_requests_;
+}
+
+bool RecordWriterBase::ParallelWorker::HasCapacityForBytes() const {
+  return in_flight_memory_ <= options_.max_in_flight_bytes() ||
+         in_flight_chunks_ <= 1;
+}
+
+inline void RecordWriterBase::ParallelWorker::FinishInFlightWait(
+    absl::Time wait_start) {
+  TraceSink* const trace_sink = options_.trace_sink();
+  if (trace_sink == nullptr && !options_.collect_stats()) return;
+  const absl::Time wait_end = absl::Now();
+  if (options_.collect_stats()) in_flight_wait_time_ += wait_end - wait_start;
+  if (trace_sink != nullptr) {
+    trace_sink->AddEvent(TraceEvent{TraceStage::kWaitForWriter, absl::nullopt,
+                                    0, wait_start, wait_end});
+  }
+}
+
+inline void RecordWriterBase::ParallelWorker::AddRequest(
+    ChunkWriterRequest request) {
+  const size_t requests_end = requests_end_.load(std::memory_order_relaxed);
+  if (requests_end - requests_begin_.load(std::memory_order_acquire) >=
+      max_requests_) {
+    const absl::Time wait_start =
+        options_.trace_sink() != nullptr || options_.collect_stats()
+            ? absl::Now()
+            : absl::InfinitePast();
+    producer_waiting_.store(true);
+    mutex_.LockWhen(
+        absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
+    mutex_.Unlock();
+    producer_waiting_.store(false, std::memory_order_relaxed);
+    FinishInFlightWait(wait_start);
+  }
+  chunk_writer_requests_[requests_end % max_requests_] = std::move(request);
+  requests_end_.store(requests_end + 1);
+  if (consumer_waiting_.load()) {
+    // Wake up the consumer waiting for a request.
+    mutex_.Lock();
+    mutex_.Unlock();
+  }
+}
+
+inline Position RecordWriterBase::ParallelWorker::PosBeforeRequests(
+    size_t& requests_begin) const {
+  requests_begin = requests_begin_.load(std::memory_order_acquire);
+  if (requests_begin == 0) return initial_pos_;
+  return pos_after_requests_[(requests_begin - 1) % (max_requests_ + 1)].load(
+      std::memory_order_relaxed);
 }
 
 bool RecordWriterBase::ParallelWorker::WriteSignature() {
@@ -572,12 +1959,8 @@ bool RecordWriterBase::ParallelWorker::WriteSignature() {
   ChunkPromises chunk_promises;
   chunk_promises.chunk_header.set_value(chunk.header);
   chunk_promises.chunk.set_value(std::move(chunk));
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
-  chunk_writer_requests_.emplace_back(
-      WriteChunkRequest{chunk_promises.chunk_header.get_future(),
-                        chunk_promises.chunk.get_future()});
-  mutex_.Unlock();
+  AddRequest(WriteChunkRequest{chunk_promises.chunk_header.get_future(),
+                               chunk_promises.chunk.get_future()});
   return true;
 }
 
@@ -588,13 +1971,9 @@ bool RecordWriterBase::ParallelWorker::WriteMetadata() {
     return true;
   }
   ChunkPromises* const chunk_promises = new ChunkPromises();
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
-  chunk_writer_requests_.emplace_back(
-      WriteChunkRequest{chunk_promises->chunk_header.get_future(),
-                        chunk_promises->chunk.get_future()});
-  mutex_.Unlock();
-  internal::ThreadPool::global().Schedule([this, chunk_promises] {
+  AddRequest(WriteChunkRequest{chunk_promises->chunk_header.get_future(),
+                               chunk_promises->chunk.get_future()});
+  ScheduleTask([this, chunk_promises] {
     Chunk chunk;
     EncodeMetadata(chunk);
     chunk_promises->chunk_header.set_value(chunk.header);
@@ -604,50 +1983,130 @@ bool RecordWriterBase::ParallelWorker::WriteMetadata() {
   return true;
 }
 
+bool RecordWriterBase::ParallelWorker::WriteEncodedChunk(const Chunk& chunk) {
+  ChunkPromises chunk_promises;
+  chunk_promises.chunk_header.set_value(chunk.header);
+  // Copying `chunk.data` shares its blocks.
+  chunk_promises.chunk.set_value(chunk);
+  AddRequest(WriteChunkRequest{chunk_promises.chunk_header.get_future(),
+                               chunk_promises.chunk.get_future()});
+  return true;
+}
+
+void RecordWriterBase::ParallelWorker::OpenChunk() {
+  // The previous chunk passed its reservation to its encoding task, so this
+  // does not wait while holding a reservation.
+  ReserveChunkMemory();
+  {
+    absl::MutexLock lock(&idle_chunk_encoders_mutex_);
+    if (idle_chunk_encoders_size_ != chunk_size_) {
+      // Idle chunk encoders were created for a different chunk size.
+      idle_chunk_encoders_.clear();
+      idle_chunk_encoders_size_ = chunk_size_;
+    } else if (!idle_chunk_encoders_.empty()) {
+      chunk_encoder_ = std::move(idle_chunk_encoders_.back());
+      idle_chunk_encoders_.pop_back();
+    }
+  }
+  if (chunk_encoder_ != nullptr) {
+    chunk_encoder_->Clear();
+  } else {
+    chunk_encoder_ = MakeChunkEncoder();
+  }
+}
+
 bool RecordWriterBase::ParallelWorker::CloseChunk() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   ChunkEncoder* const chunk_encoder = chunk_encoder_.release();
+  const size_t chunk_memory = IntCast<size_t>(UnsignedMin(
+      chunk_encoder->decoded_data_size(), std::numeric_limits<size_t>::max()));
+  {
+    absl::MutexLock lock(&in_flight_mutex_);
+    in_flight_memory_ += chunk_memory;
+    ++in_flight_chunks_;
+    if (options_.collect_stats()) {
+      max_chunks_in_flight_ =
+          UnsignedMax(max_chunks_in_flight_, uint64_t{in_flight_chunks_});
+      max_bytes_in_flight_ =
+          UnsignedMax(max_bytes_in_flight_, Position{in_flight_memory_});
+    }
+  }
+  MemoryBudget::Reservation* const memory_reservation =
+      new MemoryBudget::Reservation(std::move(memory_reservation_));
+  const uint64_t chunk_encoder_size = chunk_size_;
   ChunkPromises* const chunk_promises = new ChunkPromises();
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
-  chunk_writer_requests_.emplace_back(
-      WriteChunkRequest{chunk_promises->chunk_header.get_future(),
-                        chunk_promises->chunk.get_future()});
-  mutex_.Unlock();
-  internal::ThreadPool::global().Schedule(
-      [this, chunk_encoder, chunk_promises] {
-        Chunk chunk;
-        EncodeChunk(*chunk_encoder, chunk);
-        delete chunk_encoder;
-        chunk_promises->chunk_header.set_value(chunk.header);
-        chunk_promises->chunk.set_value(std::move(chunk));
-        delete chunk_promises;
-      });
+  std::string key_filter;
+  if (options_.chunk_key() != nullptr) key_filter = TakeChunkKeyFilter();
+  AddRequest(WriteChunkRequest{
+      chunk_promises->chunk_header.get_future(),
+      chunk_promises->chunk.get_future(), chunk_memory,
+      std::move(chunk_min_key_), std::move(chunk_max_key_),
+      std::move(key_filter)});
+  chunk_has_keys_ = false;
+  ScheduleTask([this, chunk_encoder, memory_reservation, chunk_encoder_size,
+                chunk_promises] {
+    std::unique_ptr<ChunkEncoder> owned_chunk_encoder(chunk_encoder);
+    // Released when the chunk is encoded.
+    std::unique_ptr<MemoryBudget::Reservation> owned_memory_reservation(
+        memory_reservation);
+    Chunk chunk;
+    EncodeChunk(*owned_chunk_encoder, chunk);
+    {
+      absl::MutexLock lock(&idle_chunk_encoders_mutex_);
+      if (idle_chunk_encoders_size_ == chunk_encoder_size &&
+          idle_chunk_encoders_.size() < max_requests_) {
+        idle_chunk_encoders_.push_back(std::move(owned_chunk_encoder));
+      }
+    }
+    chunk_promises->chunk_header.set_value(chunk.header);
+    chunk_promises->chunk.set_value(std::move(chunk));
+    delete chunk_promises;
+  });
+  // If too many bytes are in flight, wait until earlier chunks are written.
+  // This chunk is encoded meanwhile.
+  absl::MutexLock lock(&in_flight_mutex_);
+  if (ABSL_PREDICT_FALSE(!HasCapacityForBytes())) {
+    const absl::Time wait_start =
+        options_.trace_sink() != nullptr || options_.collect_stats()
+            ? absl::Now()
+            : absl::InfinitePast();
+    in_flight_mutex_.Await(
+        absl::Condition(this, &ParallelWorker::HasCapacityForBytes));
+    FinishInFlightWait(wait_start);
+  }
   return true;
 }
 
 bool RecordWriterBase::ParallelWorker::PadToBlockBoundary() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
-  chunk_writer_requests_.emplace_back(PadToBlockBoundaryRequest());
-  mutex_.Unlock();
+  AddRequest(PadToBlockBoundaryRequest());
+  return true;
+}
+
+bool RecordWriterBase::ParallelWorker::WriteFileSummary(
+    FileSummary record_stats) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  AddRequest(WriteFileSummaryRequest{std::move(record_stats)});
+  return true;
+}
+
+bool RecordWriterBase::ParallelWorker::WriteChunkIndex() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  AddRequest(WriteChunkIndexRequest());
   return true;
 }
 
 bool RecordWriterBase::ParallelWorker::Flush(FlushType flush_type) {
-  return FutureFlush(flush_type).get();
+  std::future<bool> done_future = FutureFlush(flush_type);
+  BoostTasks();
+  return done_future.get();
 }
 
 std::future<bool> RecordWriterBase::ParallelWorker::FutureFlush(
     FlushType flush_type) {
   std::promise<bool> done_promise;
   std::future<bool> done_future = done_promise.get_future();
-  mutex_.LockWhen(
-      absl::Condition(this, &ParallelWorker::HasCapacityForRequest));
-  chunk_writer_requests_.emplace_back(
-      FlushRequest{flush_type, std::move(done_promise)});
-  mutex_.Unlock();
+  AddRequest(FlushRequest{flush_type, std::move(done_promise)});
   return done_future;
 }
 
@@ -662,17 +2121,23 @@ FutureRecordPosition RecordWriterBase::ParallelWorker::PosInternal(
     void operator()(const PadToBlockBoundaryRequest&) {
       actions.emplace_back(FutureRecordPosition::PadToBlockBoundary());
     }
+    void operator()(const WriteFileSummaryRequest&) {}
+    void operator()(const WriteChunkIndexRequest&) {}
     void operator()(const FlushRequest&) {}
 
     std::vector<FutureRecordPosition::Action> actions;
   };
   Visitor visitor;
-  absl::MutexLock lock(&mutex_);
-  visitor.actions.reserve(chunk_writer_requests_.size());
-  for (const ChunkWriterRequest& request : chunk_writer_requests_) {
-    absl::visit(visitor, request);
+  // Pending requests are not modified by the consumer in ways visible to the
+  // visitor, and their slots are reused only by this thread.
+  size_t requests_begin;
+  const Position pos_before_requests = PosBeforeRequests(requests_begin);
+  const size_t requests_end = requests_end_.load(std::memory_order_relaxed);
+  visitor.actions.reserve(requests_end - requests_begin);
+  for (size_t i = requests_begin; i < requests_end; ++i) {
+    absl::visit(visitor, chunk_writer_requests_[i % max_requests_]);
   }
-  return FutureRecordPosition(pos_before_chunks_, std::move(visitor.actions),
+  return FutureRecordPosition(pos_before_requests, std::move(visitor.actions),
                               get_record_index());
 }
 
@@ -700,10 +2165,45 @@ FutureRecordPosition RecordWriterBase::ParallelWorker::Pos() const {
 }
 
 Position RecordWriterBase::ParallelWorker::EstimatedSize() const {
-  absl::MutexLock lock(&mutex_);
-  return pos_before_chunks_;
+  size_t requests_begin;
+  return PosBeforeRequests(requests_begin);
 }
 
+RecordWriterStats RecordWriterBase::ParallelWorker::stats() const {
+  RecordWriterStats stats = Worker::stats();
+  stats.max_chunks_in_flight = max_chunks_in_flight_;
+  stats.max_bytes_in_flight = max_bytes_in_flight_;
+  stats.in_flight_wait_time = in_flight_wait_time_;
+  return stats;
+}
+
+void RecordWriterBase::ParallelWorker::RegisterSubobjects(
+    bool chunk_writer_is_owned, MemoryEstimator& memory_estimator) const {
+  // `*chunk_writer_` and `chunk_index_` are used by the chunk writer thread,
+  // so they are not registered.
+  Worker::RegisterSubobjects(chunk_writer_is_owned, memory_estimator);
+  memory_estimator.RegisterDynamicMemory(chunk_writer_requests_.capacity() *
+                                         sizeof(ChunkWriterRequest));
+  {
+    absl::MutexLock lock(&in_flight_mutex_);
+    memory_estimator.RegisterMemory(in_flight_memory_);
+  }
+  absl::MutexLock lock(&idle_chunk_encoders_mutex_);
+  for (const std::unique_ptr<ChunkEncoder>& chunk_encoder :
+       idle_chunk_encoders_) {
+    chunk_encoder->RegisterSubobjects(memory_estimator);
+  }
+}
+
+struct RecordWriterBase::ZstdDictionaryTraining {
+  ChunkWriter* dest;
+  Options options;
+  // Concatenated records buffered for training.
+  Chain samples;
+  // Record end positions in `samples`.
+  std::vector<size_t> limits;
+};
+
 RecordWriterBase::RecordWriterBase(InitiallyClosed) noexcept
     : Object(kInitiallyClosed) {}
 
@@ -713,17 +2213,27 @@ RecordWriterBase::RecordWriterBase(InitiallyOpen) noexcept
 void RecordWriterBase::Reset(InitiallyClosed) {
   Object::Reset(kInitiallyClosed);
   desired_chunk_size_ = 0;
+  max_chunk_records_ = std::numeric_limits<uint64_t>::max();
   chunk_size_so_far_ = 0;
+  chunk_records_so_far_ = 0;
+  max_chunk_delay_ = absl::InfiniteDuration();
+  chunk_deadline_ = absl::InfiniteFuture();
   last_record_is_valid_ = false;
   worker_.reset();
+  zstd_dictionary_training_.reset();
 }
 
 void RecordWriterBase::Reset(InitiallyOpen) {
   Object::Reset(kInitiallyOpen);
   desired_chunk_size_ = 0;
+  max_chunk_records_ = std::numeric_limits<uint64_t>::max();
   chunk_size_so_far_ = 0;
+  chunk_records_so_far_ = 0;
+  max_chunk_delay_ = absl::InfiniteDuration();
+  chunk_deadline_ = absl::InfiniteFuture();
   last_record_is_valid_ = false;
   worker_.reset();
+  zstd_dictionary_training_.reset();
 }
 
 RecordWriterBase::RecordWriterBase(RecordWriterBase&& that) noexcept
@@ -731,9 +2241,14 @@ RecordWriterBase::RecordWriterBase(RecordWriterBase&& that) noexcept
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
       desired_chunk_size_(that.desired_chunk_size_),
+      max_chunk_records_(that.max_chunk_records_),
       chunk_size_so_far_(that.chunk_size_so_far_),
+      chunk_records_so_far_(that.chunk_records_so_far_),
+      max_chunk_delay_(that.max_chunk_delay_),
+      chunk_deadline_(that.chunk_deadline_),
       last_record_is_valid_(std::exchange(that.last_record_is_valid_, false)),
-      worker_(std::move(that.worker_)) {}
+      worker_(std::move(that.worker_)),
+      zstd_dictionary_training_(std::move(that.zstd_dictionary_training_)) {}
 
 RecordWriterBase& RecordWriterBase::operator=(
     RecordWriterBase&& that) noexcept {
@@ -741,9 +2256,14 @@ RecordWriterBase& RecordWriterBase::operator=(
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
   desired_chunk_size_ = that.desired_chunk_size_;
+  max_chunk_records_ = that.max_chunk_records_;
   chunk_size_so_far_ = that.chunk_size_so_far_;
+  chunk_records_so_far_ = that.chunk_records_so_far_;
+  max_chunk_delay_ = that.max_chunk_delay_;
+  chunk_deadline_ = that.chunk_deadline_;
   last_record_is_valid_ = std::exchange(that.last_record_is_valid_, false);
   worker_ = std::move(that.worker_);
+  zstd_dictionary_training_ = std::move(that.zstd_dictionary_training_);
   return *this;
 }
 
@@ -756,19 +2276,123 @@ void RecordWriterBase::Initialize(ChunkWriter* dest, Options&& options) {
     Fail(*dest);
     return;
   }
-  // Ensure that `num_records` does not overflow when `WriteRecordImpl()` keeps
-  // `num_records * sizeof(uint64_t)` under `desired_chunk_size_`.
-  desired_chunk_size_ = UnsignedMin(options.effective_chunk_size(),
-                                    kMaxNumRecords * sizeof(uint64_t));
+  if (options.collect_stats()) dest->set_collect_stats(true);
+  if (options.trace_sink() != nullptr) {
+    dest->set_trace_sink(options.trace_sink());
+  }
+  if (options.max_chunk_records() != absl::nullopt) {
+    max_chunk_records_ = *options.max_chunk_records();
+  }
+  max_chunk_delay_ = options.max_chunk_delay();
+  if (options.zstd_dictionary_training() > 0 &&
+      options.compression_type() == CompressionType::kZstd &&
+      options.zstd_dictionary().data().empty()) {
+    // Creating the worker is deferred until the dictionary is trained, because
+    // the worker writes metadata which include the dictionary.
+    zstd_dictionary_training_ = std::make_unique<ZstdDictionaryTraining>(
+        ZstdDictionaryTraining{dest, std::move(options), Chain(), {}});
+    return;
+  }
+  StartWorker(dest, std::move(options));
+}
+
+bool RecordWriterBase::CheckPreparedMetadata(Options& options) {
+  if (options.prepared_metadata_ == nullptr) return false;
+  if (options.metadata_ == absl::nullopt &&
+      options.serialized_metadata_ != absl::nullopt &&
+      options.hash_type_ == options.prepared_metadata_->hash_type &&
+      *options.serialized_metadata_ ==
+          options.prepared_metadata_->serialized_metadata) {
+    return true;
+  }
+  options.prepared_metadata_.reset();
+  return false;
+}
+
+inline void RecordWriterBase::StartWorker(ChunkWriter* dest,
+                                          Options&& options) {
+  // Prepared metadata already include the Zstd dictionary ID.
+  if (!CheckPreparedMetadata(options)) StoreZstdDictionaryId(options);
   if (options.parallelism() == 0) {
     worker_ = std::make_unique<SerialWorker>(dest, std::move(options));
   } else {
     worker_ = std::make_unique<ParallelWorker>(dest, std::move(options));
   }
+  // Ensure that `num_records` does not overflow when `PrepareForRecord()` keeps
+  // `num_records * sizeof(uint64_t)` under `desired_chunk_size_`.
+  desired_chunk_size_ = UnsignedMin(worker_->NextChunkSize(),
+                                    kMaxNumRecords * sizeof(uint64_t));
   if (ABSL_PREDICT_FALSE(!worker_->healthy())) Fail(*worker_);
 }
 
+template <typename Record>
+inline bool RecordWriterBase::AddTrainingRecord(Record&& record) {
+  RIEGELI_ASSERT(zstd_dictionary_training_ != nullptr)
+      << "Failed precondition of RecordWriterBase::AddTrainingRecord(): "
+         "Zstd dictionary is not being trained";
+  ZstdDictionaryTraining& training = *zstd_dictionary_training_;
+  training.samples.Append(std::forward<Record>(record));
+  training.limits.push_back(training.samples.size());
+  if (training.samples.size() < training.options.zstd_dictionary_training()) {
+    return true;
+  }
+  return FinishZstdDictionaryTraining();
+}
+
+bool RecordWriterBase::FinishZstdDictionaryTraining() {
+  RIEGELI_ASSERT(zstd_dictionary_training_ != nullptr)
+      << "Failed precondition of "
+         "RecordWriterBase::FinishZstdDictionaryTraining(): "
+         "Zstd dictionary is not being trained";
+  const std::unique_ptr<ZstdDictionaryTraining> training =
+      std::move(zstd_dictionary_training_);
+  // `ZDICT_trainFromBuffer()` takes samples concatenated in a flat array,
+  // together with their sizes.
+  absl::string_view samples = training->samples.Flatten();
+  std::vector<size_t> sample_sizes;
+  sample_sizes.reserve(training->limits.size());
+  size_t sample_begin = 0;
+  for (const size_t limit : training->limits) {
+    sample_sizes.push_back(limit - sample_begin);
+    sample_begin = limit;
+  }
+  std::string samples_with_headers;
+  if (training->options.transpose()) {
+    // Headers of transposed chunks follow records.
+    samples_with_headers.append(samples.data(), samples.size());
+    CollectTransposedHeaders(training->options, samples, training->limits,
+                             samples_with_headers, sample_sizes);
+    samples = samples_with_headers;
+  }
+  sample_sizes.resize(UnsignedMin(
+      sample_sizes.size(), size_t{std::numeric_limits<unsigned>::max()}));
+  std::string dictionary(
+      UnsignedMin(samples.size() / 8, kMaxTrainedZstdDictionarySize), '\0');
+  if (!dictionary.empty()) {
+    const size_t dictionary_size = ZDICT_trainFromBuffer(
+        &dictionary[0], dictionary.size(), samples.data(), sample_sizes.data(),
+        IntCast<unsigned>(sample_sizes.size()));
+    // If training fails, e.g. because samples are too small or too uniform,
+    // records are compressed without a dictionary.
+    if (!ZDICT_isError(dictionary_size)) {
+      dictionary.resize(dictionary_size);
+      RecordsMetadata dictionary_metadata;
+      dictionary_metadata.set_zstd_dictionary(dictionary);
+      MergeMetadata(dictionary_metadata, training->options);
+      training->options.set_zstd_dictionary(
+          ZstdWriterBase::Dictionary().set_data(std::move(dictionary)));
+    }
+  }
+  StartWorker(training->dest, std::move(training->options));
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  return WriteRecords(std::move(training->samples),
+                      std::move(training->limits));
+}
+
 void RecordWriterBase::Done() {
+  if (zstd_dictionary_training_ != nullptr && healthy()) {
+    FinishZstdDictionaryTraining();
+  }
   if (ABSL_PREDICT_FALSE(worker_ == nullptr)) {
     RIEGELI_ASSERT(!healthy()) << "Failed invariant of RecordWriterBase: "
                                   "null worker_ but RecordWriterBase healthy()";
@@ -779,31 +2403,44 @@ void RecordWriterBase::Done() {
     if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) Fail(*worker_);
     chunk_size_so_far_ = 0;
   }
+  if (ABSL_PREDICT_FALSE(!worker_->MaybeWriteFileSummary())) Fail(*worker_);
+  if (ABSL_PREDICT_FALSE(!worker_->MaybeWriteChunkIndex())) Fail(*worker_);
   if (ABSL_PREDICT_FALSE(!worker_->MaybePadToBlockBoundary())) Fail(*worker_);
   if (ABSL_PREDICT_FALSE(!worker_->Close())) Fail(*worker_);
 }
 
 void RecordWriterBase::DoneBackground() { worker_.reset(); }
 
+RecordWriterStats RecordWriterBase::stats() const {
+  if (worker_ == nullptr) return RecordWriterStats();
+  return worker_->stats();
+}
+
 bool RecordWriterBase::WriteRecord(const google::protobuf::MessageLite& record,
                                    SerializeOptions serialize_options) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(zstd_dictionary_training_ != nullptr)) {
+    Chain serialized;
+    {
+      absl::Status status =
+          SerializeToChain(record, serialized, std::move(serialize_options));
+      if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+    }
+    if (ABSL_PREDICT_FALSE(!AddTrainingRecord(std::move(serialized)))) {
+      return false;
+    }
+    last_record_is_valid_ = worker_ != nullptr;
+    return true;
+  }
   // Decoding a chunk writes records to one array, and their positions to
   // another array. We limit the size of both arrays together, to include
   // attempts to accumulate an unbounded number of empty records.
   const size_t size = serialize_options.GetByteSize(record);
-  const uint64_t added_size =
-      SaturatingAdd(IntCast<uint64_t>(size), uint64_t{sizeof(uint64_t)});
-  if (ABSL_PREDICT_FALSE(chunk_size_so_far_ > desired_chunk_size_ ||
-                         added_size >
-                             desired_chunk_size_ - chunk_size_so_far_) &&
-      chunk_size_so_far_ > 0) {
-    if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) return Fail(*worker_);
-    worker_->OpenChunk();
-    chunk_size_so_far_ = 0;
+  if (ABSL_PREDICT_FALSE(!PrepareForRecord(SaturatingAdd(
+          IntCast<uint64_t>(size), uint64_t{sizeof(uint64_t)})))) {
+    return false;
   }
-  chunk_size_so_far_ += added_size;
   if (ABSL_PREDICT_FALSE(!worker_->AddRecord(record, serialize_options))) {
     return Fail(*worker_);
   }
@@ -845,20 +2482,21 @@ template <typename Record>
 inline bool RecordWriterBase::WriteRecordImpl(Record&& record) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(zstd_dictionary_training_ != nullptr)) {
+    if (ABSL_PREDICT_FALSE(
+            !AddTrainingRecord(std::forward<Record>(record)))) {
+      return false;
+    }
+    last_record_is_valid_ = worker_ != nullptr;
+    return true;
+  }
   // Decoding a chunk writes records to one array, and their positions to
   // another array. We limit the size of both arrays together, to include
   // attempts to accumulate an unbounded number of empty records.
-  const uint64_t added_size = SaturatingAdd(IntCast<uint64_t>(record.size()),
-                                            uint64_t{sizeof(uint64_t)});
-  if (ABSL_PREDICT_FALSE(chunk_size_so_far_ > desired_chunk_size_ ||
-                         added_size >
-                             desired_chunk_size_ - chunk_size_so_far_) &&
-      chunk_size_so_far_ > 0) {
-    if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) return Fail(*worker_);
-    worker_->OpenChunk();
-    chunk_size_so_far_ = 0;
+  if (ABSL_PREDICT_FALSE(!PrepareForRecord(SaturatingAdd(
+          IntCast<uint64_t>(record.size()), uint64_t{sizeof(uint64_t)})))) {
+    return false;
   }
-  chunk_size_so_far_ += added_size;
   if (ABSL_PREDICT_FALSE(!worker_->AddRecord(std::forward<Record>(record)))) {
     return Fail(*worker_);
   }
@@ -866,8 +2504,162 @@ inline bool RecordWriterBase::WriteRecordImpl(Record&& record) {
   return true;
 }
 
+bool RecordWriterBase::WriteRecordFrom(Reader& src, uint64_t size) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (zstd_dictionary_training_ != nullptr || worker_->NeedsRecordKeys() ||
+      SaturatingAdd(size, uint64_t{sizeof(uint64_t)}) <= desired_chunk_size_) {
+    ChainWriter<Chain> record_writer(std::forward_as_tuple());
+    if (ABSL_PREDICT_FALSE(!src.Copy(Position{size}, record_writer))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      return Fail(absl::InvalidArgumentError("Record truncated"));
+    }
+    if (ABSL_PREDICT_FALSE(!record_writer.Close())) {
+      return Fail(record_writer);
+    }
+    return WriteRecord(std::move(record_writer.dest()));
+  }
+  last_record_is_valid_ = false;
+  const bool chunk_has_records = chunk_size_so_far_ != 0;
+  if (chunk_has_records) {
+    if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) return Fail(*worker_);
+  }
+  if (ABSL_PREDICT_FALSE(!worker_->AddRecordFrom(src, size))) {
+    return Fail(*worker_);
+  }
+  if (chunk_has_records) OpenChunk();
+  return true;
+}
+
+bool RecordWriterBase::WriteRecords(Chain records,
+                                    std::vector<size_t> limits) {
+  return WriteRecordsImpl(std::move(records), std::move(limits), nullptr);
+}
+
+bool RecordWriterBase::WriteRecords(Chain records, std::vector<size_t> limits,
+                                    FutureRecordPositions& positions) {
+  RIEGELI_ASSERT(zstd_dictionary_training_ == nullptr)
+      << "Failed precondition of RecordWriterBase::WriteRecords(): "
+         "Zstd dictionary is being trained";
+  return WriteRecordsImpl(std::move(records), std::move(limits), &positions);
+}
+
+inline bool RecordWriterBase::WriteRecordsImpl(
+    Chain records, std::vector<size_t> limits,
+    FutureRecordPositions* positions) {
+  RIEGELI_ASSERT(std::is_sorted(limits.begin(), limits.end()))
+      << "Failed precondition of RecordWriterBase::WriteRecords(): "
+         "record end positions not sorted";
+  RIEGELI_ASSERT_EQ(limits.empty() ? 0u : limits.back(), records.size())
+      << "Failed precondition of RecordWriterBase::WriteRecords(): "
+         "record end positions do not match concatenated record values";
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  last_record_is_valid_ = false;
+  if (limits.empty()) return true;
+  if (ABSL_PREDICT_FALSE(zstd_dictionary_training_ != nullptr)) {
+    ZstdDictionaryTraining& training = *zstd_dictionary_training_;
+    const size_t records_begin = training.samples.size();
+    training.samples.Append(std::move(records));
+    for (const size_t limit : limits) {
+      training.limits.push_back(records_begin + limit);
+    }
+    if (training.samples.size() < training.options.zstd_dictionary_training()) {
+      return true;
+    }
+    return FinishZstdDictionaryTraining();
+  }
+  ChainReader<> records_reader(&records);
+  size_t index = 0;
+  while (index < limits.size()) {
+    // Collect records which fit in the current chunk, closing it first if not
+    // even the first record fits.
+    const size_t batch_begin = index == 0 ? 0 : limits[index - 1];
+    std::vector<size_t> batch_limits;
+    do {
+      const size_t record_begin = index == 0 ? 0 : limits[index - 1];
+      const uint64_t added_size =
+          SaturatingAdd(IntCast<uint64_t>(limits[index] - record_begin),
+                        uint64_t{sizeof(uint64_t)});
+      if (ChunkIsFull(added_size) && !batch_limits.empty()) break;
+      if (ABSL_PREDICT_FALSE(!PrepareForRecord(added_size))) return false;
+      batch_limits.push_back(limits[index] - batch_begin);
+      ++index;
+    } while (index < limits.size());
+    Chain batch;
+    if (!records_reader.Read(batch_limits.back(), batch)) {
+      RIEGELI_ASSERT_UNREACHABLE()
+          << "Failed reading records from records reader: "
+          << records_reader.status();
+    }
+    // The batch goes to the current chunk, after records already there.
+    if (positions != nullptr) {
+      positions->Add(worker_->Pos(), IntCast<uint64_t>(batch_limits.size()));
+    }
+    if (ABSL_PREDICT_FALSE(
+            !worker_->AddRecords(std::move(batch), std::move(batch_limits)))) {
+      return Fail(*worker_);
+    }
+  }
+  last_record_is_valid_ = true;
+  return true;
+}
+
+bool RecordWriterBase::WriteRecords(
+    absl::Span<const absl::string_view> records) {
+  Chain concatenated;
+  std::vector<size_t> limits;
+  limits.reserve(records.size());
+  for (const absl::string_view record : records) {
+    concatenated.Append(record);
+    limits.push_back(concatenated.size());
+  }
+  return WriteRecords(std::move(concatenated), std::move(limits));
+}
+
+inline bool RecordWriterBase::ChunkIsFull(uint64_t added_size) const {
+  // Decoding a chunk writes records to one array, and their positions to
+  // another array. We limit the size of both arrays together, to include
+  // attempts to accumulate an unbounded number of empty records.
+  return (chunk_size_so_far_ > desired_chunk_size_ ||
+          added_size > desired_chunk_size_ - chunk_size_so_far_ ||
+          chunk_records_so_far_ >= max_chunk_records_) &&
+         chunk_size_so_far_ > 0;
+}
+
+inline bool RecordWriterBase::PrepareForRecord(uint64_t added_size) {
+  absl::Time now;
+  if (ABSL_PREDICT_FALSE(max_chunk_delay_ != absl::InfiniteDuration())) {
+    now = absl::Now();
+    if (now >= chunk_deadline_) {
+      if (ABSL_PREDICT_FALSE(!Flush(FlushType::kFromObject))) return false;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(ChunkIsFull(added_size))) {
+    if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) return Fail(*worker_);
+    OpenChunk();
+  }
+  if (ABSL_PREDICT_FALSE(max_chunk_delay_ != absl::InfiniteDuration()) &&
+      chunk_size_so_far_ == 0) {
+    chunk_deadline_ = now + max_chunk_delay_;
+  }
+  chunk_size_so_far_ += added_size;
+  ++chunk_records_so_far_;
+  return true;
+}
+
+inline void RecordWriterBase::OpenChunk() {
+  desired_chunk_size_ = UnsignedMin(worker_->NextChunkSize(),
+                                    kMaxNumRecords * sizeof(uint64_t));
+  worker_->OpenChunk();
+  chunk_size_so_far_ = 0;
+  chunk_records_so_far_ = 0;
+  chunk_deadline_ = absl::InfiniteFuture();
+}
+
 bool RecordWriterBase::Flush(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(zstd_dictionary_training_ != nullptr)) {
+    if (ABSL_PREDICT_FALSE(!FinishZstdDictionaryTraining())) return false;
+  }
   last_record_is_valid_ = false;
   if (chunk_size_so_far_ != 0) {
     if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) return Fail(*worker_);
@@ -878,13 +2670,36 @@ bool RecordWriterBase::Flush(FlushType flush_type) {
   if (flush_type != FlushType::kFromObject || is_owning()) {
     if (ABSL_PREDICT_FALSE(!worker_->Flush(flush_type))) return Fail(*worker_);
   }
-  if (chunk_size_so_far_ != 0) {
-    worker_->OpenChunk();
-    chunk_size_so_far_ = 0;
+  if (chunk_size_so_far_ != 0) OpenChunk();
+  return true;
+}
+
+bool RecordWriterBase::WriteChunk(const Chunk& chunk) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(zstd_dictionary_training_ != nullptr)) {
+    if (ABSL_PREDICT_FALSE(!FinishZstdDictionaryTraining())) return false;
+  }
+  last_record_is_valid_ = false;
+  const bool chunk_has_records = chunk_size_so_far_ != 0;
+  if (chunk_has_records) {
+    if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) return Fail(*worker_);
+  }
+  if (ABSL_PREDICT_FALSE(!worker_->AddEncodedChunk(chunk))) {
+    return Fail(*worker_);
   }
+  if (chunk_has_records) OpenChunk();
   return true;
 }
 
+bool RecordWriterBase::FlushIfDue(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (chunk_deadline_ == absl::InfiniteFuture() ||
+      absl::Now() < chunk_deadline_) {
+    return true;
+  }
+  return Flush(flush_type);
+}
+
 RecordWriterBase::FutureBool RecordWriterBase::FutureFlush(
     FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!healthy())) {
@@ -892,6 +2707,13 @@ RecordWriterBase::FutureBool RecordWriterBase::FutureFlush(
     promise.set_value(false);
     return promise.get_future();
   }
+  if (ABSL_PREDICT_FALSE(zstd_dictionary_training_ != nullptr)) {
+    if (ABSL_PREDICT_FALSE(!FinishZstdDictionaryTraining())) {
+      std::promise<bool> promise;
+      promise.set_value(false);
+      return promise.get_future();
+    }
+  }
   last_record_is_valid_ = false;
   if (chunk_size_so_far_ != 0) {
     if (ABSL_PREDICT_FALSE(!worker_->CloseChunk())) {
@@ -915,13 +2737,17 @@ RecordWriterBase::FutureBool RecordWriterBase::FutureFlush(
   } else {
     result = worker_->FutureFlush(flush_type);
   }
-  if (chunk_size_so_far_ != 0) {
-    worker_->OpenChunk();
-    chunk_size_so_far_ = 0;
-  }
+  if (chunk_size_so_far_ != 0) OpenChunk();
   return result;
 }
 
+void RecordWriterBase::FlushAsync(FlushType flush_type,
+                                  std::function<void(bool)> done) {
+  ThreadPool::global().Schedule([this, flush_type, done = std::move(done)] {
+    done(Flush(flush_type));
+  });
+}
+
 FutureRecordPosition RecordWriterBase::LastPos() const {
   RIEGELI_ASSERT(last_record_is_valid())
       << "Failed precondition of RecordWriterBase::LastPos(): "
@@ -933,6 +2759,9 @@ FutureRecordPosition RecordWriterBase::LastPos() const {
 }
 
 FutureRecordPosition RecordWriterBase::Pos() const {
+  RIEGELI_ASSERT(zstd_dictionary_training_ == nullptr)
+      << "Failed precondition of RecordWriterBase::Pos(): "
+         "Zstd dictionary is being trained";
   if (ABSL_PREDICT_FALSE(worker_ == nullptr)) return FutureRecordPosition();
   return worker_->Pos();
 }
@@ -942,4 +2771,20 @@ Position RecordWriterBase::EstimatedSize() const {
   return worker_->EstimatedSize();
 }
 
+size_t RecordWriterBase::EstimateMemory() const {
+  MemoryEstimator memory_estimator;
+  if (worker_ != nullptr) {
+    worker_->RegisterSubobjects(is_owning(), memory_estimator);
+  }
+  if (zstd_dictionary_training_ != nullptr) {
+    zstd_dictionary_training_->samples.RegisterSubobjects(memory_estimator);
+    memory_estimator.RegisterDynamicMemory(
+        zstd_dictionary_training_->limits.capacity() * sizeof(size_t));
+    if (is_owning()) {
+      zstd_dictionary_training_->dest->RegisterSubobjects(memory_estimator);
+    }
+  }
+  return memory_estimator.TotalMemory();
+}
+
 }  // namespace riegeli
@@ -15,26 +15,38 @@
 #ifndef RIEGELI_RECORDS_RECORD_WRITER_H_
 #define RIEGELI_RECORDS_RECORD_WRITER_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <functional>
+#include <limits>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/message_lite.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/memory_budget.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/stable_dependency.h"
+#include "riegeli/brotli/brotli_writer.h"
+#include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
 #include "riegeli/chunk_encoding/compressor_options.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/messages/message_serialize.h"
@@ -42,9 +54,18 @@
 #include "riegeli/records/chunk_writer_dependency.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/records_metadata.pb.h"
+#include "riegeli/records/trace_sink.h"
+#include "riegeli/zstd/zstd_writer.h"
 
 namespace riegeli {
 
+namespace internal {
+
+// Work precomputed by `RecordWriterBase::Options::Prepare()`.
+struct PreparedMetadata;
+
+}  // namespace internal
+
 // Sets `record_type_name` and `file_descriptor` in metadata, based on the
 // message descriptor of the type of records.
 //
@@ -53,6 +74,42 @@ namespace riegeli {
 void SetRecordType(const google::protobuf::Descriptor& descriptor,
                    RecordsMetadata& metadata);
 
+// Counters describing the work of a `RecordWriter`, returned by its `stats()`
+// if enabled by `RecordWriterBase::Options::set_collect_stats()`.
+//
+// Records are counted when their chunk is encoded.
+struct RecordWriterStats {
+  RecordWriterStats& operator+=(const RecordWriterStats& that);
+
+  // Number of records in chunks encoded.
+  uint64_t num_records = 0;
+  // Number of chunks of records encoded.
+  uint64_t num_chunks = 0;
+  // Total size of records of chunks encoded, before compression.
+  Position num_decoded_bytes = 0;
+  // Total chunk data size of chunks encoded, after compression.
+  Position num_compressed_bytes = 0;
+  // Time spent encoding and compressing chunks, including in background.
+  absl::Duration encode_time;
+  // Time spent computing chunk data hashes, including in background.
+  absl::Duration hash_time;
+  // If `RecordWriterBase::Options::parallelism() > 0`: the maximum number of
+  // chunks closed but not written yet at once.
+  uint64_t max_chunks_in_flight = 0;
+  // If `RecordWriterBase::Options::parallelism() > 0`: the maximum total size
+  // of records of chunks closed but not written yet at once.
+  Position max_bytes_in_flight = 0;
+  // If `RecordWriterBase::Options::parallelism() > 0`: time spent waiting
+  // because too many chunks or bytes were in flight, which shows that writing
+  // is the bottleneck.
+  absl::Duration in_flight_wait_time;
+  // Counters of `dest_chunk_writer()`, including writing to the destination.
+  //
+  // If `RecordWriterBase::Options::parallelism() > 0`, chunks are written in
+  // background, and these counters include chunks written so far.
+  ChunkWriterStats chunk_writer;
+};
+
 // Template parameter independent part of `RecordWriter`.
 class RecordWriterBase : public Object {
  public:
@@ -65,23 +122,59 @@ class RecordWriterBase : public Object {
     //   options ::= option? ("," option?)*
     //   option ::=
     //     "default" |
-    //     "transpose" (":" ("true" | "false"))? |
+    //     "transpose" (":" ("true" | "false" | "auto"))? |
+    //     "deduplicate" (":" ("true" | "false"))? |
     //     "uncompressed" |
     //     "brotli" (":" brotli_level)? |
     //     "zstd" (":" zstd_level)? |
     //     "snappy" |
+    //     "lz4" (":" lz4_level)? |
     //     "window_log" ":" window_log |
+    //     "long_distance_matching" (":" ("true" | "false" | "auto"))? |
+    //     "ldm_hash_log" ":" ldm_hash_log |
+    //     "target_length" ":" target_length |
+    //     "strategy" ":" strategy |
     //     "chunk_size" ":" chunk_size |
+    //     "adaptive_chunk_size" (":" ("true" | "false"))? |
+    //     "min_chunk_size" ":" chunk_size |
+    //     "max_chunk_size" ":" chunk_size |
+    //     "min_encoding_speed" ":" min_encoding_speed |
+    //     "max_chunk_records" ":" max_chunk_records |
     //     "bucket_fraction" ":" bucket_fraction |
+    //     "integer_encodings" (":" ("true" | "false"))? |
+    //     "string_dictionaries" (":" ("true" | "false"))? |
+    //     "packed_encodings" (":" ("true" | "false"))? |
+    //     "zstd_dictionary_training" ":" zstd_dictionary_training |
+    //     "zstd_reference_chunks" ":" zstd_reference_chunks |
     //     "pad_to_block_boundary" (":" ("true" | "false"))? |
-    //     "parallelism" ":" parallelism
+    //     "chunk_index" (":" ("true" | "false"))? |
+    //     "file_summary" (":" ("true" | "false"))? |
+    //     "hash" ":" ("highwayhash" | "crc32c") |
+    //     "parallelism" ":" parallelism |
+    //     "max_in_flight_bytes" ":" max_in_flight_bytes |
+    //     "numa_aware" (":" ("true" | "false"))? |
+    //     "priority" ":" ("low" | "normal" | "high")
     //   brotli_level ::= integer 0..11 (default 6)
     //   zstd_level ::= integer -131072..22 (default 3)
+    //   lz4_level ::= integer -65537..12 (default 0)
     //   window_log ::= "auto" or integer 10..31
+    //   ldm_hash_log ::= "auto" or integer 6..30
+    //   target_length ::= "auto" or integer 0..131072
+    //   strategy ::= "auto" | "fast" | "dfast" | "greedy" | "lazy" | "lazy2" |
+    //     "btlazy2" | "btopt" | "btultra" | "btultra2"
     //   chunk_size ::= "auto" or integer expressed as real with optional suffix
     //     [BkKMGTPE], 1..
+    //   min_encoding_speed ::= integer expressed as real with optional suffix
+    //     [BkKMGTPE], 0..
+    //   max_chunk_records ::= "auto" or integer expressed as real with optional
+    //     suffix [BkKMGTPE], 1..
     //   bucket_fraction ::= real 0..1
+    //   zstd_dictionary_training ::= integer expressed as real with optional
+    //     suffix [BkKMGTPE], 0..
+    //   zstd_reference_chunks ::= integer 0..
     //   parallelism ::= integer 0..
+    //   max_in_flight_bytes ::= "unlimited" or integer expressed as real with
+    //     optional suffix [BkKMGTPE], 1..
     // ```
     //
     // An empty string is the same as "default".
@@ -94,6 +187,23 @@ class RecordWriterBase : public Object {
     //  * `!status.ok()` - failure
     absl::Status FromString(absl::string_view text);
 
+    // Precomputes work which each `RecordWriter` created with these options
+    // would otherwise repeat: serializing metadata, encoding them in a chunk,
+    // and building the record type from metadata for `transpose()`. Copies of
+    // these options share the results, which makes creating many short-lived
+    // writers from the same options cheaper, especially if metadata include a
+    // record type set by `SetRecordType()`.
+    //
+    // This should be called after setting other options. `metadata()` are
+    // replaced with equivalent `serialized_metadata()`. The results are used
+    // only while `serialized_metadata()` and `hash_type()` stay unchanged. The
+    // metadata chunk keeps the compression which was set during `Prepare()`.
+    //
+    // Returns status:
+    //  * `status.ok()`  - success
+    //  * `!status.ok()` - failure (options are unchanged)
+    absl::Status Prepare();
+
     // If `true`, records should be serialized proto messages (but nothing will
     // break if they are not). A chunk of records will be processed in a way
     // which allows for better compression.
@@ -111,6 +221,47 @@ class RecordWriterBase : public Object {
     }
     bool transpose() const { return transpose_; }
 
+    // If `true`, overrides `transpose()`: each chunk is written either
+    // transposed or not, whichever is smaller after compression, judged by
+    // encoding a sample of records at the beginning of the chunk in both ways.
+    //
+    // This suits files where some records are proto messages and some are
+    // opaque, at the cost of encoding the sample twice.
+    //
+    // Default: `false`.
+    Options& set_auto_transpose(bool auto_transpose) & {
+      auto_transpose_ = auto_transpose;
+      return *this;
+    }
+    Options&& set_auto_transpose(bool auto_transpose) && {
+      return std::move(set_auto_transpose(auto_transpose));
+    }
+    bool auto_transpose() const { return auto_transpose_; }
+
+    // If `true`, byte-identical records repeated within a chunk are stored
+    // once: the chunk stores distinct records, encoded according to
+    // `transpose()`, and the index of the distinct record for each record.
+    // Repeated records are not encoded again, and reading shares their bytes.
+    // This suits streams with many identical records, e.g. retries or
+    // heartbeats. A chunk without repeated records is written as usual.
+    //
+    // This reduces the size most with `snappy()`, `lz4()`, or no compression.
+    // Zstd and Brotli already find repeated records close enough to each
+    // other, so with them this mostly saves encoding and decoding work.
+    //
+    // Chunks with repeated records have type `ChunkType::kDeduplicated`,
+    // which older readers do not support.
+    //
+    // Default: `false`.
+    Options& set_deduplicate(bool deduplicate) & {
+      deduplicate_ = deduplicate;
+      return *this;
+    }
+    Options&& set_deduplicate(bool deduplicate) && {
+      return std::move(set_deduplicate(deduplicate));
+    }
+    bool deduplicate() const { return deduplicate_; }
+
     // Changes compression algorithm to Uncompressed (turns compression off).
     Options& set_uncompressed() & {
       compressor_options_.set_uncompressed();
@@ -164,6 +315,26 @@ class RecordWriterBase : public Object {
     }
     Options&& set_snappy() && { return std::move(set_snappy()); }
 
+    // Changes compression algorithm to LZ4. Sets compression level which tunes
+    // the tradeoff between compression density and compression speed (higher =
+    // better density but slower).
+    //
+    // Levels from 3 use the LZ4-HC compressor, which is much slower but denser;
+    // decompression is fast at every level.
+    //
+    // `compression_level` must be between `kMinLz4` (-65537) and
+    // `kMaxLz4` (12). Default: `kDefaultLz4` (0).
+    static constexpr int kMinLz4 = CompressorOptions::kMinLz4;
+    static constexpr int kMaxLz4 = CompressorOptions::kMaxLz4;
+    static constexpr int kDefaultLz4 = CompressorOptions::kDefaultLz4;
+    Options& set_lz4(int compression_level = kDefaultLz4) & {
+      compressor_options_.set_lz4(compression_level);
+      return *this;
+    }
+    Options&& set_lz4(int compression_level = kDefaultLz4) && {
+      return std::move(set_lz4(compression_level));
+    }
+
     CompressionType compression_type() const {
       return compressor_options_.compression_type();
     }
@@ -204,6 +375,135 @@ class RecordWriterBase : public Object {
       return compressor_options_.window_log();
     }
 
+    // Zstd dictionary, used if `compression_type() == CompressionType::kZstd`.
+    // The same dictionary must be passed to
+    // `RecordReaderBase::Options::set_zstd_dictionary()` for reading.
+    //
+    // A dictionary trained on samples of records allows to keep compression
+    // density with a smaller `chunk_size()`, which makes seeking finer.
+    //
+    // The file metadata are compressed without the dictionary. If the
+    // dictionary has an ID, it is stored in `RecordsMetadata`, so that the
+    // reader can find out which dictionary is needed.
+    //
+    // Default: `ZstdWriterBase::Dictionary()` (no dictionary).
+    Options& set_zstd_dictionary(
+        const ZstdWriterBase::Dictionary& zstd_dictionary) & {
+      compressor_options_.set_zstd_dictionary(zstd_dictionary);
+      return *this;
+    }
+    Options& set_zstd_dictionary(
+        ZstdWriterBase::Dictionary&& zstd_dictionary) & {
+      compressor_options_.set_zstd_dictionary(std::move(zstd_dictionary));
+      return *this;
+    }
+    Options&& set_zstd_dictionary(
+        const ZstdWriterBase::Dictionary& zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(zstd_dictionary));
+    }
+    Options&& set_zstd_dictionary(
+        ZstdWriterBase::Dictionary&& zstd_dictionary) && {
+      return std::move(set_zstd_dictionary(std::move(zstd_dictionary)));
+    }
+    const ZstdWriterBase::Dictionary& zstd_dictionary() const {
+      return compressor_options_.zstd_dictionary();
+    }
+
+    // Brotli dictionary, used if
+    // `compression_type() == CompressionType::kBrotli`. The same dictionary
+    // must be passed to `RecordReaderBase::Options::set_brotli_dictionary()`
+    // for reading.
+    //
+    // The file metadata are compressed without the dictionary.
+    //
+    // Default: `BrotliWriterBase::Dictionary()` (no dictionary).
+    Options& set_brotli_dictionary(
+        const BrotliWriterBase::Dictionary& brotli_dictionary) & {
+      compressor_options_.set_brotli_dictionary(brotli_dictionary);
+      return *this;
+    }
+    Options& set_brotli_dictionary(
+        BrotliWriterBase::Dictionary&& brotli_dictionary) & {
+      compressor_options_.set_brotli_dictionary(std::move(brotli_dictionary));
+      return *this;
+    }
+    Options&& set_brotli_dictionary(
+        const BrotliWriterBase::Dictionary& brotli_dictionary) && {
+      return std::move(set_brotli_dictionary(brotli_dictionary));
+    }
+    Options&& set_brotli_dictionary(
+        BrotliWriterBase::Dictionary&& brotli_dictionary) && {
+      return std::move(set_brotli_dictionary(std::move(brotli_dictionary)));
+    }
+    const BrotliWriterBase::Dictionary& brotli_dictionary() const {
+      return compressor_options_.brotli_dictionary();
+    }
+
+    // If positive, and `compression_type()` is `CompressionType::kZstd`, and
+    // `zstd_dictionary()` is empty, then the first records with the total size
+    // of at least `zstd_dictionary_training` bytes are buffered, a Zstd
+    // dictionary is trained on them, and all records, including the buffered
+    // ones, are compressed with that dictionary.
+    //
+    // The dictionary is stored in `RecordsMetadata`, from where `RecordReader`
+    // loads it. If training fails, e.g. because there are too few samples,
+    // records are compressed without a dictionary.
+    //
+    // If `transpose()` is `true`, the dictionary is trained also on headers of
+    // transposed chunks of the buffered records, which hold their state
+    // machines. Chunks of records with a stable schema then mostly refer to the
+    // dictionary instead of repeating the state machine, which makes small
+    // transposed chunks cheaper.
+    //
+    // Until the dictionary is trained, `LastPos()` is not valid and `Pos()`
+    // must not be called. Training is finished early by `Flush()` and
+    // `FutureFlush()`.
+    //
+    // Default: 0 (no training).
+    Options& set_zstd_dictionary_training(uint64_t zstd_dictionary_training) & {
+      zstd_dictionary_training_ = zstd_dictionary_training;
+      return *this;
+    }
+    Options&& set_zstd_dictionary_training(
+        uint64_t zstd_dictionary_training) && {
+      return std::move(set_zstd_dictionary_training(zstd_dictionary_training));
+    }
+    uint64_t zstd_dictionary_training() const {
+      return zstd_dictionary_training_;
+    }
+
+    // If positive, and `compression_type()` is `CompressionType::kZstd`, and
+    // `zstd_dictionary()` is empty, then chunks are compressed in groups of
+    // `zstd_reference_chunks + 1` consecutive chunks: the first chunk of a
+    // group is compressed on its own, and each following chunk is compressed
+    // with records of the preceding chunks of its group as a Zstd dictionary.
+    // This improves compression density of small chunks, while reading a chunk
+    // at a random position needs to decode at most `zstd_reference_chunks`
+    // chunks before it. Reading sequentially reuses records of chunks already
+    // read.
+    //
+    // Chunks compressed with a reference have type `ChunkType::kReferencing`,
+    // which older readers do not support. Records of the chunks they refer to
+    // are found by `RecordReader`, while a bare `ChunkDecoder` needs them from
+    // the caller.
+    //
+    // This is ignored if `parallelism() > 0`. `WriteRecordFrom()` and
+    // `WriteChunk()` start a new group.
+    //
+    // Default: 0 (chunks are compressed independently).
+    Options& set_zstd_reference_chunks(int zstd_reference_chunks) & {
+      RIEGELI_ASSERT_GE(zstd_reference_chunks, 0)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_zstd_reference_chunks(): "
+             "negative number of chunks";
+      zstd_reference_chunks_ = zstd_reference_chunks;
+      return *this;
+    }
+    Options&& set_zstd_reference_chunks(int zstd_reference_chunks) && {
+      return std::move(set_zstd_reference_chunks(zstd_reference_chunks));
+    }
+    int zstd_reference_chunks() const { return zstd_reference_chunks_; }
+
     // Returns grouped compression options.
     CompressorOptions& compressor_options() { return compressor_options_; }
     const CompressorOptions& compressor_options() const {
@@ -243,6 +543,124 @@ class RecordWriterBase : public Object {
       return *chunk_size_;
     }
 
+    // If `true`, the chunk size adapts to compression of recent chunks within
+    // `min_chunk_size()`..`max_chunk_size()`, starting from
+    // `effective_chunk_size()`. It doubles while the compression ratio improves
+    // noticeably, and halves while encoding is slower than
+    // `min_encoding_speed()`.
+    //
+    // Default: `false`.
+    Options& set_adaptive_chunk_size(bool adaptive_chunk_size) & {
+      adaptive_chunk_size_ = adaptive_chunk_size;
+      return *this;
+    }
+    Options&& set_adaptive_chunk_size(bool adaptive_chunk_size) && {
+      return std::move(set_adaptive_chunk_size(adaptive_chunk_size));
+    }
+    bool adaptive_chunk_size() const { return adaptive_chunk_size_; }
+
+    // Sets bounds of the chunk size if `adaptive_chunk_size()`.
+    //
+    // Default: 4K and 64M.
+    Options& set_min_chunk_size(uint64_t min_chunk_size) & {
+      RIEGELI_ASSERT_GT(min_chunk_size, 0u)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_min_chunk_size(): "
+             "zero chunk size";
+      min_chunk_size_ = min_chunk_size;
+      return *this;
+    }
+    Options&& set_min_chunk_size(uint64_t min_chunk_size) && {
+      return std::move(set_min_chunk_size(min_chunk_size));
+    }
+    uint64_t min_chunk_size() const { return min_chunk_size_; }
+    Options& set_max_chunk_size(uint64_t max_chunk_size) & {
+      RIEGELI_ASSERT_GT(max_chunk_size, 0u)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_max_chunk_size(): "
+             "zero chunk size";
+      max_chunk_size_ = max_chunk_size;
+      return *this;
+    }
+    Options&& set_max_chunk_size(uint64_t max_chunk_size) && {
+      return std::move(set_max_chunk_size(max_chunk_size));
+    }
+    uint64_t max_chunk_size() const { return max_chunk_size_; }
+
+    // Sets the desired speed of encoding chunks, in uncompressed bytes per
+    // second of a single thread, if `adaptive_chunk_size()`.
+    //
+    // 0 means that the chunk size is chosen only for compression density.
+    //
+    // Default: 0.
+    Options& set_min_encoding_speed(double min_encoding_speed) & {
+      RIEGELI_ASSERT_GE(min_encoding_speed, 0.0)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_min_encoding_speed(): "
+             "negative speed";
+      min_encoding_speed_ = min_encoding_speed;
+      return *this;
+    }
+    Options&& set_min_encoding_speed(double min_encoding_speed) && {
+      return std::move(set_min_encoding_speed(min_encoding_speed));
+    }
+    double min_encoding_speed() const { return min_encoding_speed_; }
+
+    // Sets the maximum number of records in a chunk, which bounds the number of
+    // records to be decoded for seeking to a record, in addition to the chunk
+    // size.
+    //
+    // `absl::nullopt` means no limit.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_max_chunk_records(
+        absl::optional<uint64_t> max_chunk_records) & {
+      if (max_chunk_records != absl::nullopt) {
+        RIEGELI_ASSERT_GT(*max_chunk_records, 0u)
+            << "Failed precondition of "
+               "RecordWriterBase::Options::set_max_chunk_records(): "
+               "zero records";
+      }
+      max_chunk_records_ = max_chunk_records;
+      return *this;
+    }
+    Options&& set_max_chunk_records(
+        absl::optional<uint64_t> max_chunk_records) && {
+      return std::move(set_max_chunk_records(max_chunk_records));
+    }
+    absl::optional<uint64_t> max_chunk_records() const {
+      return max_chunk_records_;
+    }
+
+    // Sets the maximum time for which a record stays buffered in the current
+    // chunk, which bounds the latency of streaming records, e.g. over a
+    // socket, while letting chunks grow to `chunk_size()` when records arrive
+    // fast enough.
+    //
+    // When a record is written after this time has passed since the first
+    // record of the current chunk, or when `FlushIfDue()` is called then, the
+    // chunk is closed and written with `Flush(FlushType::kFromObject)`.
+    //
+    // `RecordWriter` is not thread-safe, so this is not driven by a timer:
+    // a writer which otherwise stays idle should call `FlushIfDue()` at
+    // `FlushDeadline()`, e.g. from its event loop.
+    //
+    // `absl::InfiniteDuration()` means no limit.
+    //
+    // Default: `absl::InfiniteDuration()`.
+    Options& set_max_chunk_delay(absl::Duration max_chunk_delay) & {
+      RIEGELI_ASSERT_GE(max_chunk_delay, absl::ZeroDuration())
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_max_chunk_delay(): "
+             "negative delay";
+      max_chunk_delay_ = max_chunk_delay;
+      return *this;
+    }
+    Options&& set_max_chunk_delay(absl::Duration max_chunk_delay) && {
+      return std::move(set_max_chunk_delay(max_chunk_delay));
+    }
+    absl::Duration max_chunk_delay() const { return max_chunk_delay_; }
+
     // Sets the desired uncompressed size of a bucket which groups values of
     // several fields of the given wire type to be compressed together,
     // relative to the desired chunk size, on the scale between 0.0 (compress
@@ -272,6 +690,61 @@ class RecordWriterBase : public Object {
     }
     double bucket_fraction() const { return bucket_fraction_; }
 
+    // If `true`, data buffers of varint, fixed32, and fixed64 fields in
+    // transposed chunks are stored with delta, zigzag delta, or frame of
+    // reference encoding, whichever is the smallest, if it is smaller than the
+    // values themselves. This suits e.g. increasing timestamps and IDs.
+    //
+    // This is meaningful if transpose is enabled. Readers which predate this
+    // option fail on chunks with such buffers.
+    //
+    // Default: `false`.
+    Options& set_integer_encodings(bool integer_encodings) & {
+      integer_encodings_ = integer_encodings;
+      return *this;
+    }
+    Options&& set_integer_encodings(bool integer_encodings) && {
+      return std::move(set_integer_encodings(integer_encodings));
+    }
+    bool integer_encodings() const { return integer_encodings_; }
+
+    // If `true`, data buffers of string and bytes fields with few distinct
+    // values in transposed chunks are stored as a dictionary of the distinct
+    // values followed by their indices, if this is smaller than the values
+    // themselves. This suits e.g. enum-like strings such as country codes.
+    //
+    // This is meaningful if transpose is enabled. Readers which predate this
+    // option fail on chunks with such buffers.
+    //
+    // Default: `false`.
+    Options& set_string_dictionaries(bool string_dictionaries) & {
+      string_dictionaries_ = string_dictionaries;
+      return *this;
+    }
+    Options&& set_string_dictionaries(bool string_dictionaries) && {
+      return std::move(set_string_dictionaries(string_dictionaries));
+    }
+    bool string_dictionaries() const { return string_dictionaries_; }
+
+    // If `true`, data buffers of packed repeated scalar fields in transposed
+    // chunks are stored as numbers of elements followed by all elements, with
+    // bytes of fixed width elements split into separate streams, so that they
+    // compress better and are decoded in bulk.
+    //
+    // This is meaningful if transpose is enabled and the record type is known
+    // from `metadata()`, which tells which fields are packed repeated fields.
+    // Readers which predate this option fail on chunks with such buffers.
+    //
+    // Default: `false`.
+    Options& set_packed_encodings(bool packed_encodings) & {
+      packed_encodings_ = packed_encodings;
+      return *this;
+    }
+    Options&& set_packed_encodings(bool packed_encodings) && {
+      return std::move(set_packed_encodings(packed_encodings));
+    }
+    bool packed_encodings() const { return packed_encodings_; }
+
     // Sets file metadata to be written at the beginning (unless
     // `absl::nullopt`).
     //
@@ -387,6 +860,200 @@ class RecordWriterBase : public Object {
     }
     bool pad_to_block_boundary() const { return pad_to_block_boundary_; }
 
+    // If `true`, a chunk index is written when the `RecordWriter` is closed.
+    // It lists chunks with their numbers of records, which lets
+    // `RecordReaderBase::SeekToRecordIndex()` locate a record by its index in
+    // the file with one lookup. Readers which do not use the chunk index skip
+    // it.
+    //
+    // The chunk index is written only if the `RecordWriter` starts writing at
+    // the beginning of the file, because when appending, records already in
+    // the file are not known.
+    //
+    // Default: `false`.
+    Options& set_chunk_index(bool chunk_index) & {
+      chunk_index_ = chunk_index;
+      return *this;
+    }
+    Options&& set_chunk_index(bool chunk_index) && {
+      return std::move(set_chunk_index(chunk_index));
+    }
+    bool chunk_index() const { return chunk_index_; }
+
+    // If `true`, a file summary is written when the `RecordWriter` is closed,
+    // before the chunk index if any. It stores the numbers of records and
+    // chunks, and the total size of records, which lets
+    // `RecordReaderBase::ReadFileSummary()` read them from the end of the file
+    // without reading other chunks. Readers which do not use the file summary
+    // skip it.
+    //
+    // The file summary also stores a histogram of record sizes, and a sketch
+    // estimating the number of distinct keys if `summary_key()` is not
+    // `nullptr`. These are computed while records are written, and omitted if
+    // `WriteChunk()` is used.
+    //
+    // The file summary is written only if the `RecordWriter` starts writing at
+    // the beginning of the file, because when appending, records already in
+    // the file are not known.
+    //
+    // Default: `false`.
+    Options& set_file_summary(bool file_summary) & {
+      file_summary_ = file_summary;
+      return *this;
+    }
+    Options&& set_file_summary(bool file_summary) && {
+      return std::move(set_file_summary(file_summary));
+    }
+    bool file_summary() const { return file_summary_; }
+
+    // Sets a function which extracts a key from a record (serialized, if the
+    // record is a proto message), for estimating the number of distinct keys
+    // in the file summary. Used only if `file_summary()` is `true`.
+    //
+    // Proto messages are then serialized by `WriteRecord()` rather than by the
+    // chunk encoder, so that the key can be extracted.
+    //
+    // Default: `nullptr`.
+    Options& set_summary_key(
+        const std::function<std::string(absl::string_view record)>&
+            summary_key) & {
+      summary_key_ = summary_key;
+      return *this;
+    }
+    Options& set_summary_key(
+        std::function<std::string(absl::string_view record)>&& summary_key) & {
+      summary_key_ = std::move(summary_key);
+      return *this;
+    }
+    Options&& set_summary_key(
+        const std::function<std::string(absl::string_view record)>&
+            summary_key) && {
+      return std::move(set_summary_key(summary_key));
+    }
+    Options&& set_summary_key(
+        std::function<std::string(absl::string_view record)>&& summary_key) && {
+      return std::move(set_summary_key(std::move(summary_key)));
+    }
+    std::function<std::string(absl::string_view record)>& summary_key() {
+      return summary_key_;
+    }
+    const std::function<std::string(absl::string_view record)>& summary_key()
+        const {
+      return summary_key_;
+    }
+
+    // Sets the hash function protecting chunk headers, chunk data, and block
+    // headers of chunks being written.
+    //
+    // `HashType::kCrc32c` is faster to compute and verify on hardware
+    // supporting CRC32C instructions, but it detects corruption less reliably.
+    // A CRC32C hash carries a tag which lets readers recognize it, so files
+    // can mix both hash functions, e.g. when appending. Readers older than
+    // this option do not recognize CRC32C hashes.
+    //
+    // Default: `HashType::kHighwayHash`.
+    Options& set_hash_type(HashType hash_type) & {
+      hash_type_ = hash_type;
+      return *this;
+    }
+    Options&& set_hash_type(HashType hash_type) && {
+      return std::move(set_hash_type(hash_type));
+    }
+    HashType hash_type() const { return hash_type_; }
+
+    // Sets a function which extracts a key from a record (serialized, if the
+    // record is a proto message). Keys are compared as byte strings.
+    //
+    // If not `nullptr`, the smallest and largest keys of records in each chunk
+    // are stored in the chunk index, which is then written even if
+    // `chunk_index()` is `false`. This lets
+    // `RecordReaderBase::SkipChunksWhere()` and
+    // `RecordReaderBase::SearchChunkKeys()` skip chunks without reading them.
+    //
+    // Proto messages are then serialized by `WriteRecord()` rather than by the
+    // chunk encoder, so that the key can be extracted.
+    //
+    // Default: `nullptr`.
+    Options& set_chunk_key(
+        const std::function<std::string(absl::string_view record)>&
+            chunk_key) & {
+      chunk_key_ = chunk_key;
+      return *this;
+    }
+    Options& set_chunk_key(
+        std::function<std::string(absl::string_view record)>&& chunk_key) & {
+      chunk_key_ = std::move(chunk_key);
+      return *this;
+    }
+    Options&& set_chunk_key(
+        const std::function<std::string(absl::string_view record)>&
+            chunk_key) && {
+      return std::move(set_chunk_key(chunk_key));
+    }
+    Options&& set_chunk_key(
+        std::function<std::string(absl::string_view record)>&& chunk_key) && {
+      return std::move(set_chunk_key(std::move(chunk_key)));
+    }
+    std::function<std::string(absl::string_view record)>& chunk_key() {
+      return chunk_key_;
+    }
+    const std::function<std::string(absl::string_view record)>& chunk_key()
+        const {
+      return chunk_key_;
+    }
+
+    // If `chunk_key_filter_bits > 0` and `chunk_key()` is not `nullptr`, a
+    // Bloom filter of keys of records in each chunk is stored in the chunk
+    // index too, with about `chunk_key_filter_bits` bits per record. This lets
+    // `RecordReaderBase::SkipChunksWithoutKey()` skip chunks which do not
+    // contain a given key even if keys are not sorted.
+    //
+    // 10 bits per record give about 1% false positives.
+    //
+    // Default: 0.
+    Options& set_chunk_key_filter_bits(int chunk_key_filter_bits) & {
+      RIEGELI_ASSERT_GE(chunk_key_filter_bits, 0)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_chunk_key_filter_bits(): "
+             "negative bits per key";
+      chunk_key_filter_bits_ = chunk_key_filter_bits;
+      return *this;
+    }
+    Options&& set_chunk_key_filter_bits(int chunk_key_filter_bits) && {
+      return std::move(set_chunk_key_filter_bits(chunk_key_filter_bits));
+    }
+    int chunk_key_filter_bits() const { return chunk_key_filter_bits_; }
+
+    // If not `nullptr`, `chunk_written(chunk_begin, num_records)` is called
+    // after writing each chunk containing records, in the order of chunks.
+    // Records of the chunk are at `RecordPosition(chunk_begin, i)` for `i` in
+    // [0, `num_records`), so a caller which counts records it writes can
+    // derive positions of all records from this, without calling `LastPos()`
+    // for each record.
+    //
+    // With `parallelism() > 0`, `LastPos()` allocates shared state and
+    // resolves futures of pending chunks, which is avoided this way.
+    //
+    // If `parallelism() > 0`, `chunk_written` is called from a background
+    // thread, otherwise from the thread writing records.
+    //
+    // Default: `nullptr`.
+    Options& set_chunk_written(
+        std::function<void(Position chunk_begin, uint64_t num_records)>
+            chunk_written) & {
+      chunk_written_ = std::move(chunk_written);
+      return *this;
+    }
+    Options&& set_chunk_written(
+        std::function<void(Position chunk_begin, uint64_t num_records)>
+            chunk_written) && {
+      return std::move(set_chunk_written(std::move(chunk_written)));
+    }
+    const std::function<void(Position chunk_begin, uint64_t num_records)>&
+    chunk_written() const {
+      return chunk_written_;
+    }
+
     // Sets the maximum number of chunks being encoded in parallel in
     // background. Larger parallelism can increase throughput, up to a point
     // where it no longer matters; smaller parallelism reduces memory usage.
@@ -408,15 +1075,181 @@ class RecordWriterBase : public Object {
     }
     int parallelism() const { return parallelism_; }
 
+    // Sets the maximum total size of records of chunks which are closed but not
+    // written yet, before compression. This matters only if
+    // `parallelism() > 0`.
+    //
+    // When this is exceeded, closing a chunk waits until earlier chunks are
+    // written. A single chunk is always allowed, even if it is larger.
+    //
+    // This bounds memory usage of a fast producer and a slow destination better
+    // than `parallelism()` alone when record sizes vary.
+    //
+    // Default: `std::numeric_limits<uint64_t>::max()`.
+    Options& set_max_in_flight_bytes(uint64_t max_in_flight_bytes) & {
+      RIEGELI_ASSERT_GT(max_in_flight_bytes, 0u)
+          << "Failed precondition of "
+             "RecordWriterBase::Options::set_max_in_flight_bytes(): "
+             "zero max_in_flight_bytes";
+      max_in_flight_bytes_ = max_in_flight_bytes;
+      return *this;
+    }
+    Options&& set_max_in_flight_bytes(uint64_t max_in_flight_bytes) && {
+      return std::move(set_max_in_flight_bytes(max_in_flight_bytes));
+    }
+    uint64_t max_in_flight_bytes() const { return max_in_flight_bytes_; }
+
+    // Sets the thread pool used for encoding chunks in background if
+    // `parallelism() > 0`. Sharing a pool with a thread count limit between
+    // writers bounds the number of threads they use together.
+    //
+    // The thread pool is not owned and must outlive the `RecordWriter`.
+    //
+    // `nullptr` is interpreted as `ThreadPool::global()`.
+    //
+    // Default: `nullptr`.
+    Options& set_thread_pool(ThreadPool* thread_pool) & {
+      thread_pool_ = thread_pool;
+      return *this;
+    }
+    Options&& set_thread_pool(ThreadPool* thread_pool) && {
+      return std::move(set_thread_pool(thread_pool));
+    }
+    ThreadPool* thread_pool() const { return thread_pool_; }
+
+    // If `true` and `thread_pool() == nullptr`, chunks are encoded in
+    // `NumaThreadPools::global()`, on the NUMA node of the CPU which closes the
+    // chunk, i.e. where its records were buffered. This avoids reading the
+    // records and allocating encoded data across nodes.
+    //
+    // This matters only if `parallelism() > 0`, and only on machines with
+    // multiple NUMA nodes.
+    //
+    // Default: `false`.
+    Options& set_numa_aware(bool numa_aware) & {
+      numa_aware_ = numa_aware;
+      return *this;
+    }
+    Options&& set_numa_aware(bool numa_aware) && {
+      return std::move(set_numa_aware(numa_aware));
+    }
+    bool numa_aware() const { return numa_aware_; }
+
+    // Sets the priority of encoding chunks in background if
+    // `parallelism() > 0`, relative to other tasks of the same thread pool.
+    //
+    // `ThreadPool::Priority::kLow` suits bulk exports which should not delay
+    // latency-sensitive writers sharing the pool. Tasks of lower priority still
+    // run eventually, see `ThreadPool`.
+    //
+    // Regardless of this, when `Flush()` or `Close()` waits for chunks being
+    // encoded, their encoding is boosted to `ThreadPool::Priority::kHigh`.
+    //
+    // Default: `ThreadPool::Priority::kNormal`.
+    Options& set_priority(ThreadPool::Priority priority) & {
+      priority_ = priority;
+      return *this;
+    }
+    Options&& set_priority(ThreadPool::Priority priority) && {
+      return std::move(set_priority(priority));
+    }
+    ThreadPool::Priority priority() const { return priority_; }
+
+    // Sets a `MemoryBudget` to reserve memory from before encoding each chunk,
+    // for records of the chunk and their encoded form. The reservation is made
+    // when the first record of a chunk is written, and is held until the chunk
+    // is encoded (and written, if `parallelism() == 0`).
+    //
+    // When the budget is exhausted, writing the first record of a chunk waits
+    // until other users of the budget release memory.
+    //
+    // `nullptr` disables memory accounting.
+    //
+    // The `MemoryBudget` must outlive the `RecordWriter`.
+    //
+    // Default: `nullptr`.
+    Options& set_memory_budget(MemoryBudget* memory_budget) & {
+      memory_budget_ = memory_budget;
+      return *this;
+    }
+    Options&& set_memory_budget(MemoryBudget* memory_budget) && {
+      return std::move(set_memory_budget(memory_budget));
+    }
+    MemoryBudget* memory_budget() const { return memory_budget_; }
+
+    // If `true`, counters returned by `stats()` are collected, also by
+    // `dest_chunk_writer()`. This costs a few clock reads per chunk, and is
+    // cheap enough to be left enabled.
+    //
+    // Default: `false`.
+    Options& set_collect_stats(bool collect_stats) & {
+      collect_stats_ = collect_stats;
+      return *this;
+    }
+    Options&& set_collect_stats(bool collect_stats) && {
+      return std::move(set_collect_stats(collect_stats));
+    }
+    bool collect_stats() const { return collect_stats_; }
+
+    // If not `nullptr`, spans of encoding, hashing, writing, and waiting for
+    // chunks are reported to `trace_sink`, also by `dest_chunk_writer()`.
+    // `trace_sink` must outlive the `RecordWriter`.
+    //
+    // With `parallelism() > 0`, `TraceStage::kWaitForEncoding` and
+    // `TraceStage::kWaitForWriter` show whether encoding or writing is the
+    // bottleneck.
+    //
+    // Default: `nullptr`.
+    Options& set_trace_sink(TraceSink* trace_sink) & {
+      trace_sink_ = trace_sink;
+      return *this;
+    }
+    Options&& set_trace_sink(TraceSink* trace_sink) && {
+      return std::move(set_trace_sink(trace_sink));
+    }
+    TraceSink* trace_sink() const { return trace_sink_; }
+
    private:
     bool transpose_ = false;
+    bool auto_transpose_ = false;
+    bool deduplicate_ = false;
     CompressorOptions compressor_options_;
     absl::optional<uint64_t> chunk_size_;
+    bool adaptive_chunk_size_ = false;
+    uint64_t min_chunk_size_ = uint64_t{4} << 10;
+    uint64_t max_chunk_size_ = uint64_t{64} << 20;
+    double min_encoding_speed_ = 0.0;
+    absl::optional<uint64_t> max_chunk_records_;
+    absl::Duration max_chunk_delay_ = absl::InfiniteDuration();
     double bucket_fraction_ = 1.0;
+    bool integer_encodings_ = false;
+    bool string_dictionaries_ = false;
+    bool packed_encodings_ = false;
+    uint64_t zstd_dictionary_training_ = 0;
+    int zstd_reference_chunks_ = 0;
     absl::optional<RecordsMetadata> metadata_;
     absl::optional<Chain> serialized_metadata_;
     bool pad_to_block_boundary_ = false;
+    bool chunk_index_ = false;
+    bool file_summary_ = false;
+    std::function<std::string(absl::string_view record)> summary_key_;
+    HashType hash_type_ = HashType::kHighwayHash;
+    std::function<std::string(absl::string_view record)> chunk_key_;
+    int chunk_key_filter_bits_ = 0;
+    std::function<void(Position chunk_begin, uint64_t num_records)>
+        chunk_written_;
     int parallelism_ = 0;
+    uint64_t max_in_flight_bytes_ = std::numeric_limits<uint64_t>::max();
+    ThreadPool* thread_pool_ = nullptr;
+    bool numa_aware_ = false;
+    ThreadPool::Priority priority_ = ThreadPool::Priority::kNormal;
+    MemoryBudget* memory_budget_ = nullptr;
+    bool collect_stats_ = false;
+    TraceSink* trace_sink_ = nullptr;
+    // Set by `Prepare()`, shared by copies.
+    std::shared_ptr<const internal::PreparedMetadata> prepared_metadata_;
+
+    friend class RecordWriterBase;
   };
 
   // `get()` returns the resolved value. Can block.
@@ -433,6 +1266,11 @@ class RecordWriterBase : public Object {
   // `WriteRecord(google::protobuf::MessageLite)` serializes a proto message to
   // raw bytes beforehand. The remaining overloads accept raw bytes.
   //
+  // The size of a proto message is computed once, and cached sizes are used
+  // by the chunk encoder and by serialization afterwards. If
+  // `record.ByteSizeLong()` has been called already,
+  // `serialize_options.set_has_cached_size(true)` avoids computing it again.
+  //
   // `std::string&&` is accepted with a template to avoid implicit conversions
   // to `std::string` which can be ambiguous against `absl::string_view`
   // (e.g. `const char*`).
@@ -452,6 +1290,79 @@ class RecordWriterBase : public Object {
   bool WriteRecord(const absl::Cord& record);
   bool WriteRecord(absl::Cord&& record);
 
+  // Writes the next record, consisting of `size` bytes read from `src`.
+  //
+  // This is meant for records too large to be conveniently held in memory as
+  // a whole, e.g. file contents. A record which does not fit in a chunk of
+  // the desired size is written as a chunk of its own: records written before
+  // are closed in a chunk first, and the record is compressed as it is read,
+  // so only its compressed form is held in memory. Such a chunk is always
+  // simple, i.e. `Options::transpose()` does not apply to it, and it is
+  // encoded in the calling thread even if `Options::parallelism() > 0`.
+  //
+  // A smaller record, or any record if `Options::chunk_key()` or
+  // `Options::summary_key()` is used or a Zstd dictionary is being trained,
+  // is read whole and written with `WriteRecord()`.
+  //
+  // After a record written as a chunk of its own, `last_record_is_valid()` is
+  // `false`.
+  //
+  // If `src` fails or ends before `size` bytes, `RecordWriter` fails too.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool WriteRecordFrom(Reader& src, uint64_t size);
+
+  // Writes multiple records, expressed as concatenated record values and
+  // sorted record end positions. This is faster than writing them one by one
+  // with `WriteRecord()`. Records are assigned to chunks in the same way.
+  //
+  // `WriteRecords(absl::Span<const absl::string_view>)` accepts records
+  // separately.
+  //
+  // `LastPos()` refers to the last record written.
+  //
+  // Preconditions:
+  //   `limits` are sorted
+  //   `(limits.empty() ? 0 : limits.back()) == records.size()`
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool WriteRecords(Chain records, std::vector<size_t> limits);
+  bool WriteRecords(absl::Span<const absl::string_view> records);
+
+  // Like `WriteRecords(records, limits)`, but also appends canonical positions
+  // of the records written to `positions`, i.e. what `LastPos()` would return
+  // after each of them.
+  //
+  // With `Options::parallelism() > 0` this costs one `FutureRecordPosition` per
+  // chunk rather than per record.
+  //
+  // Precondition: a Zstd dictionary is not being trained
+  // (see `Options::set_zstd_dictionary_training()`)
+  bool WriteRecords(Chain records, std::vector<size_t> limits,
+                    FutureRecordPositions& positions);
+
+  // Writes a chunk of records which is already encoded, e.g. read from another
+  // file by `ChunkReader::ReadChunk()`, copying it as it is instead of decoding
+  // and encoding its records again. Records written before are closed in a
+  // chunk first.
+  //
+  // The chunk must not depend on file metadata which differ from those of this
+  // file, e.g. on a different Zstd dictionary. Its records are not checked
+  // against `Options::transpose()` or `Options::compressor_options()`.
+  //
+  // `Options::chunk_key()` is not supported, because keys of records in the
+  // chunk are not known without decoding it. For the same reason, the file
+  // summary then omits record statistics.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool WriteChunk(const Chunk& chunk);
+
   // Finalizes any open chunk and pushes buffered data to the destination.
   // If `Options::parallelism() > 0`, waits for any background writing to
   // complete.
@@ -492,6 +1403,26 @@ class RecordWriterBase : public Object {
   // `Flush()` is equivalent to `FutureFlush().get()`.
   FutureBool FutureFlush(FlushType flush_type = FlushType::kFromProcess);
 
+  // Like `Flush()`, but instead of blocking, calls `done` with the result in a
+  // thread of `ThreadPool::global()`, for callers which must not block, e.g.
+  // event loops or coroutines.
+  //
+  // Until `done` is called, no other member function of this `RecordWriter`
+  // may be called, and it must not be moved or destroyed.
+  void FlushAsync(FlushType flush_type, std::function<void(bool)> done);
+
+  // Returns the time when buffered records should be flushed because of
+  // `Options::max_chunk_delay()`, or `absl::InfiniteFuture()` if there are no
+  // such records.
+  absl::Time FlushDeadline() const { return chunk_deadline_; }
+
+  // If `FlushDeadline()` has passed, calls `Flush(flush_type)`.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool FlushIfDue(FlushType flush_type = FlushType::kFromObject);
+
   // Returns the canonical position of the last record written.
   //
   // The canonical position is the largest among all equivalent positions.
@@ -520,6 +1451,9 @@ class RecordWriterBase : public Object {
   //
   // After opening the file, `Close()`, or `Flush()`, `Pos()` is the canonical
   // position of the next record, and `Pos().get().record_index() == 0`.
+  //
+  // Precondition: a Zstd dictionary is not being trained
+  // (see `Options::set_zstd_dictionary_training()`)
   FutureRecordPosition Pos() const;
 
   // Returns an estimation of the file size if no more data is written, without
@@ -527,6 +1461,7 @@ class RecordWriterBase : public Object {
   // without blocking.
   //
   // This is an underestimation because pending work is not taken into account:
+  //  * Records buffered for training a Zstd dictionary.
   //  * The currently open chunk.
   //  * If `Options::parallelism() > 0`, chunks being encoded in background.
   //
@@ -536,6 +1471,21 @@ class RecordWriterBase : public Object {
   // background work to complete.
   Position EstimatedSize() const;
 
+  // Returns an estimate of memory owned by this `RecordWriter`, excluding
+  // `sizeof(*this)`: records of the currently open chunk with the state of its
+  // chunk encoder, records buffered for training a Zstd dictionary, and the
+  // byte `Writer` with its buffer if it is owned.
+  //
+  // If `Options::parallelism() > 0`, chunks being encoded or waiting to be
+  // written in background are included, estimated from sizes of their
+  // records, together with chunk encoders kept for reuse. The byte `Writer` is
+  // then not included because it is used by a background thread.
+  size_t EstimateMemory() const;
+
+  // Returns counters collected if `Options::collect_stats()`. Unchanged by
+  // `Close()`.
+  RecordWriterStats stats() const;
+
  protected:
   explicit RecordWriterBase(InitiallyClosed) noexcept;
   explicit RecordWriterBase(InitiallyOpen) noexcept;
@@ -556,15 +1506,59 @@ class RecordWriterBase : public Object {
   class Worker;
   class SerialWorker;
   class ParallelWorker;
+  struct ZstdDictionaryTraining;
+
+  // Creates `worker_` writing to `dest`.
+  void StartWorker(ChunkWriter* dest, Options&& options);
+
+  // Buffers a record for training a Zstd dictionary, and finishes training if
+  // enough records are buffered.
+  //
+  // Precondition: `zstd_dictionary_training_ != nullptr`
+  template <typename Record>
+  bool AddTrainingRecord(Record&& record);
+
+  // Trains a Zstd dictionary on buffered records, creates `worker_` with that
+  // dictionary, and writes buffered records.
+  //
+  // Precondition: `zstd_dictionary_training_ != nullptr`
+  bool FinishZstdDictionaryTraining();
+
+  // Returns `true` if `options.prepared_metadata_` applies to current metadata
+  // and hash type, otherwise discards it.
+  static bool CheckPreparedMetadata(Options& options);
 
   template <typename Record>
   bool WriteRecordImpl(Record&& record);
 
+  bool WriteRecordsImpl(Chain records, std::vector<size_t> limits,
+                        FutureRecordPositions* positions);
+
+  // Returns `true` if a record of `added_size` (including overhead) does not
+  // fit in the current chunk.
+  bool ChunkIsFull(uint64_t added_size) const;
+  // Makes room for a record of `added_size` (including overhead) in the
+  // current chunk, closing it and opening another one if needed.
+  bool PrepareForRecord(uint64_t added_size);
+  // Opens another chunk after the current chunk was closed.
+  void OpenChunk();
+
   uint64_t desired_chunk_size_ = 0;
+  // Invariant: `max_chunk_records_ > 0`
+  uint64_t max_chunk_records_ = std::numeric_limits<uint64_t>::max();
   uint64_t chunk_size_so_far_ = 0;
+  uint64_t chunk_records_so_far_ = 0;
+  absl::Duration max_chunk_delay_ = absl::InfiniteDuration();
+  // If `max_chunk_delay_` is finite and the current chunk has records, the time
+  // when the current chunk should be flushed, otherwise
+  // `absl::InfiniteFuture()`.
+  absl::Time chunk_deadline_ = absl::InfiniteFuture();
   bool last_record_is_valid_ = false;
-  // Invariant: if `is_open()` then `worker_ != nullptr`.
+  // Invariant: if `is_open()` then
+  //   `(worker_ != nullptr) != (zstd_dictionary_training_ != nullptr)`
   std::unique_ptr<Worker> worker_;
+  // Present while a Zstd dictionary is being trained.
+  std::unique_ptr<ZstdDictionaryTraining> zstd_dictionary_training_;
 };
 
 // `RecordWriter` writes records to a Riegeli/records file. A record is
@@ -0,0 +1,162 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/recovery_scan.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/records/block.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/skipped_region.h"
+
+namespace riegeli {
+
+namespace {
+
+// Scans chunks which begin in [`segment_begin`, `segment_end`), possibly
+// followed by skipped regions which begin there too.
+absl::Status ScanSegment(absl::string_view filename,
+                         const FdReaderBase::Options& fd_reader_options,
+                         Position segment_begin, Position segment_end,
+                         RecoveryScanResult& result) {
+  DefaultChunkReader<FdReader<>> reader(
+      std::forward_as_tuple(filename, O_RDONLY, fd_reader_options));
+  if (segment_begin > 0) reader.SeekToChunkAfter(segment_begin);
+  Chunk chunk;
+  for (;;) {
+    if (reader.healthy()) {
+      if (reader.pos() >= segment_end) break;
+      const Position chunk_begin = reader.pos();
+      if (reader.ReadChunk(chunk)) {
+        result.chunks.push_back(ScannedChunk{chunk_begin, reader.pos(),
+                                             chunk.header.chunk_type(),
+                                             chunk.header.num_records()});
+        continue;
+      }
+      if (reader.healthy()) break;
+    }
+    SkippedRegion skipped_region;
+    if (ABSL_PREDICT_FALSE(!reader.Recover(&skipped_region))) {
+      return reader.status();
+    }
+    result.skipped_regions.push_back(std::move(skipped_region));
+    if (!reader.is_open()) return absl::OkStatus();
+  }
+  if (ABSL_PREDICT_FALSE(!reader.Close())) {
+    // The file ends inside a chunk.
+    SkippedRegion skipped_region;
+    if (ABSL_PREDICT_FALSE(!reader.Recover(&skipped_region))) {
+      return reader.status();
+    }
+    result.skipped_regions.push_back(std::move(skipped_region));
+  }
+  return absl::OkStatus();
+}
+
+// Appends `src` to `dest`, dropping chunks already covered by `dest` and
+// merging overlapping skipped regions.
+void MergeSegment(RecoveryScanResult&& src, RecoveryScanResult& dest) {
+  for (ScannedChunk& chunk : src.chunks) {
+    if (!dest.chunks.empty() && chunk.begin < dest.chunks.back().end) continue;
+    dest.chunks.push_back(chunk);
+  }
+  for (SkippedRegion& skipped_region : src.skipped_regions) {
+    if (!dest.skipped_regions.empty() &&
+        skipped_region.begin() <= dest.skipped_regions.back().end()) {
+      SkippedRegion& last = dest.skipped_regions.back();
+      last = SkippedRegion(UnsignedMin(last.begin(), skipped_region.begin()),
+                           UnsignedMax(last.end(), skipped_region.end()),
+                           last.message());
+      continue;
+    }
+    dest.skipped_regions.push_back(std::move(skipped_region));
+  }
+}
+
+}  // namespace
+
+absl::Status ScanForRecovery(absl::string_view filename,
+                             RecoveryScanResult& result,
+                             const RecoveryScanOptions& options) {
+  result.chunks.clear();
+  result.skipped_regions.clear();
+  Position size;
+  {
+    FdReader<> src(filename, O_RDONLY, options.fd_reader_options());
+    const absl::optional<Position> src_size = src.Size();
+    if (ABSL_PREDICT_FALSE(src_size == absl::nullopt)) return src.status();
+    size = *src_size;
+    if (ABSL_PREDICT_FALSE(!src.Close())) return src.status();
+  }
+  const Position segment_size =
+      UnsignedMax(options.segment_size() +
+                      internal::RemainingInBlock(options.segment_size()),
+                  internal::kBlockSize);
+  const size_t num_segments =
+      UnsignedMax(IntCast<size_t>((size + segment_size - 1) / segment_size),
+                  size_t{1});
+  std::vector<RecoveryScanResult> segment_results(num_segments);
+  std::vector<absl::Status> segment_statuses(num_segments);
+  std::atomic<size_t> next_segment(0);
+  const auto scan_segments = [&] {
+    for (;;) {
+      const size_t segment = next_segment.fetch_add(1);
+      if (segment >= num_segments) return;
+      const Position segment_begin = IntCast<Position>(segment) * segment_size;
+      segment_statuses[segment] = ScanSegment(
+          filename, options.fd_reader_options(), segment_begin,
+          segment + 1 == num_segments ? size : segment_begin + segment_size,
+          segment_results[segment]);
+    }
+  };
+  const size_t num_tasks =
+      UnsignedMin(IntCast<size_t>(options.parallelism()), num_segments);
+  absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&scan_segments, &background_tasks] {
+      scan_segments();
+      background_tasks.DecrementCount();
+    });
+  }
+  scan_segments();
+  background_tasks.Wait();
+
+  for (size_t segment = 0; segment < num_segments; ++segment) {
+    if (ABSL_PREDICT_FALSE(!segment_statuses[segment].ok())) {
+      result.chunks.clear();
+      result.skipped_regions.clear();
+      return segment_statuses[segment];
+    }
+    MergeSegment(std::move(segment_results[segment]), result);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
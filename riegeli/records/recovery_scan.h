@@ -0,0 +1,142 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_RECOVERY_SCAN_H_
+#define RIEGELI_RECORDS_RECOVERY_SCAN_H_
+
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/records/skipped_region.h"
+
+namespace riegeli {
+
+// A valid chunk found by `ScanForRecovery()`.
+struct ScannedChunk {
+  // File position of the beginning of the chunk, inclusive. A reader can
+  // `Seek()` there.
+  Position begin = 0;
+  // File position of the end of the chunk, exclusive, including intervening
+  // block headers and padding.
+  Position end = 0;
+  ChunkType chunk_type = ChunkType::kPadding;
+  uint64_t num_records = 0;
+};
+
+// Result of `ScanForRecovery()`.
+struct RecoveryScanResult {
+  // Valid chunks, sorted by position, not overlapping.
+  std::vector<ScannedChunk> chunks;
+  // Invalid regions, sorted by position, not overlapping. Regions found by
+  // different segments which overlap are merged, keeping the message of the
+  // first one.
+  std::vector<SkippedRegion> skipped_regions;
+};
+
+class RecoveryScanOptions {
+ public:
+  RecoveryScanOptions() noexcept {}
+
+  // Sets the maximum number of segments scanned in parallel. The calling
+  // thread takes part in scanning.
+  //
+  // Default: 1.
+  RecoveryScanOptions& set_parallelism(int parallelism) & {
+    RIEGELI_ASSERT_GT(parallelism, 0)
+        << "Failed precondition of "
+           "RecoveryScanOptions::set_parallelism(): "
+           "non-positive parallelism";
+    parallelism_ = parallelism;
+    return *this;
+  }
+  RecoveryScanOptions&& set_parallelism(int parallelism) && {
+    return std::move(set_parallelism(parallelism));
+  }
+  int parallelism() const { return parallelism_; }
+
+  // Sets the size of segments which the file is split into, rounded up to a
+  // multiple of the block size (64KB). Each segment is scanned sequentially,
+  // beginning with the first chunk which begins in it.
+  //
+  // Smaller segments balance the work better, larger segments reduce the
+  // overhead of locating the first chunk of each segment.
+  //
+  // Default: 1GB.
+  RecoveryScanOptions& set_segment_size(Position segment_size) & {
+    RIEGELI_ASSERT_GT(segment_size, 0u)
+        << "Failed precondition of "
+           "RecoveryScanOptions::set_segment_size(): "
+           "zero segment size";
+    segment_size_ = segment_size;
+    return *this;
+  }
+  RecoveryScanOptions&& set_segment_size(Position segment_size) && {
+    return std::move(set_segment_size(segment_size));
+  }
+  Position segment_size() const { return segment_size_; }
+
+  // Options for opening the file, once per segment being scanned.
+  //
+  // Default: `FdReaderBase::Options()`.
+  RecoveryScanOptions& set_fd_reader_options(
+      const FdReaderBase::Options& fd_reader_options) & {
+    fd_reader_options_ = fd_reader_options;
+    return *this;
+  }
+  RecoveryScanOptions&& set_fd_reader_options(
+      const FdReaderBase::Options& fd_reader_options) && {
+    return std::move(set_fd_reader_options(fd_reader_options));
+  }
+  FdReaderBase::Options& fd_reader_options() { return fd_reader_options_; }
+  const FdReaderBase::Options& fd_reader_options() const {
+    return fd_reader_options_;
+  }
+
+ private:
+  int parallelism_ = 1;
+  Position segment_size_ = Position{1} << 30;
+  FdReaderBase::Options fd_reader_options_;
+};
+
+// Scans a possibly damaged Riegeli/records file for valid chunks and invalid
+// regions, splitting the file into segments at block boundaries and scanning
+// them in parallel.
+//
+// Block headers, chunk headers, and chunk data hashes are verified as by
+// `DefaultChunkReader`. The result has the same chunks and (up to merging)
+// skipped regions as reading the whole file with `DefaultChunkReader` and
+// calling `Recover()` after each failure, but segments after damage do not
+// wait for the scan to get past it.
+//
+// A reader can consume the result by seeking to each chunk, skipping the
+// skipped regions without having to find them again.
+//
+// Returns status:
+//  * `status.ok()`  - success (`result` is set)
+//  * `!status.ok()` - failure not caused by invalid file contents, e.g. a read
+//                     error
+absl::Status ScanForRecovery(
+    absl::string_view filename, RecoveryScanResult& result,
+    const RecoveryScanOptions& options = RecoveryScanOptions());
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_RECOVERY_SCAN_H_
@@ -0,0 +1,328 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/sharded_record_reader.h"
+
+#include <fcntl.h>
+#include <glob.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+absl::Status GlobShards(absl::string_view pattern,
+                        std::vector<std::string>& filenames) {
+  filenames.clear();
+  glob_t glob_result;
+  const int result =
+      glob(std::string(pattern).c_str(), GLOB_ERR, nullptr, &glob_result);
+  if (ABSL_PREDICT_FALSE(result != 0)) {
+    if (result != GLOB_NOMATCH) globfree(&glob_result);
+    if (result == GLOB_NOMATCH) {
+      return absl::NotFoundError(
+          absl::StrCat("No files match pattern: ", pattern));
+    }
+    if (result == GLOB_NOSPACE) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Out of memory expanding pattern: ", pattern));
+    }
+    return absl::UnknownError(
+        absl::StrCat("Read error expanding pattern: ", pattern));
+  }
+  filenames.reserve(glob_result.gl_pathc);
+  for (size_t i = 0; i < glob_result.gl_pathc; ++i) {
+    filenames.emplace_back(glob_result.gl_pathv[i]);
+  }
+  globfree(&glob_result);
+  // `glob()` sorts file names unless `GLOB_NOSORT` is given, but according to
+  // the current locale. Sort them bytewise for determinism.
+  std::sort(filenames.begin(), filenames.end());
+  return absl::OkStatus();
+}
+
+ShardedRecordPosition::ShardedRecordPosition(size_t next_shard,
+                                             size_t next_slot,
+                                             std::vector<OpenShard> open_shards)
+    : next_shard_(next_shard),
+      next_slot_(next_slot),
+      open_shards_(std::move(open_shards)) {}
+
+std::string ShardedRecordPosition::ToString() const {
+  std::string serialized = absl::StrCat(next_shard_, ";", next_slot_);
+  for (const OpenShard& open_shard : open_shards_) {
+    absl::StrAppend(&serialized, ";", open_shard.shard_index, ":",
+                    open_shard.pos.ToString());
+  }
+  return serialized;
+}
+
+bool ShardedRecordPosition::FromString(absl::string_view serialized) {
+  const std::vector<absl::string_view> parts = absl::StrSplit(serialized, ';');
+  if (ABSL_PREDICT_FALSE(parts.size() < 2)) return false;
+  size_t next_shard;
+  if (ABSL_PREDICT_FALSE(!absl::SimpleAtoi(parts[0], &next_shard))) {
+    return false;
+  }
+  size_t next_slot;
+  if (ABSL_PREDICT_FALSE(!absl::SimpleAtoi(parts[1], &next_slot))) {
+    return false;
+  }
+  std::vector<OpenShard> open_shards;
+  open_shards.reserve(parts.size() - 2);
+  for (size_t i = 2; i < parts.size(); ++i) {
+    const size_t sep = parts[i].find(':');
+    if (ABSL_PREDICT_FALSE(sep == absl::string_view::npos)) return false;
+    OpenShard open_shard;
+    if (ABSL_PREDICT_FALSE(!absl::SimpleAtoi(parts[i].substr(0, sep),
+                                             &open_shard.shard_index))) {
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(
+            !open_shard.pos.FromString(parts[i].substr(sep + 1)))) {
+      return false;
+    }
+    open_shards.push_back(open_shard);
+  }
+  next_shard_ = next_shard;
+  next_slot_ = next_slot;
+  open_shards_ = std::move(open_shards);
+  return true;
+}
+
+bool operator==(const ShardedRecordPosition& a,
+                const ShardedRecordPosition& b) {
+  if (a.next_shard() != b.next_shard() || a.next_slot() != b.next_slot() ||
+      a.open_shards().size() != b.open_shards().size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.open_shards().size(); ++i) {
+    if (a.open_shards()[i].shard_index != b.open_shards()[i].shard_index ||
+        a.open_shards()[i].pos != b.open_shards()[i].pos) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool operator!=(const ShardedRecordPosition& a,
+                const ShardedRecordPosition& b) {
+  return !(a == b);
+}
+
+ShardedRecordReader::ShardedRecordReader(std::vector<std::string> filenames,
+                                         Options options)
+    : Object(kInitiallyOpen),
+      filenames_(std::move(filenames)),
+      options_(std::move(options)) {
+  Seek(ShardedRecordPosition());
+}
+
+void ShardedRecordReader::Reset() {
+  Object::Reset(kInitiallyClosed);
+  filenames_.clear();
+  options_ = Options();
+  next_shard_ = 0;
+  next_slot_ = 0;
+  shards_.clear();
+  last_shard_index_ = 0;
+  last_pos_ = RecordPosition();
+  last_record_is_valid_ = false;
+}
+
+void ShardedRecordReader::Reset(std::vector<std::string> filenames,
+                                Options options) {
+  Object::Reset(kInitiallyOpen);
+  filenames_ = std::move(filenames);
+  options_ = std::move(options);
+  next_shard_ = 0;
+  next_slot_ = 0;
+  shards_.clear();
+  last_shard_index_ = 0;
+  last_pos_ = RecordPosition();
+  last_record_is_valid_ = false;
+  Seek(ShardedRecordPosition());
+}
+
+void ShardedRecordReader::Done() {
+  last_record_is_valid_ = false;
+  CloseShards();
+}
+
+inline bool ShardedRecordReader::CloseShards() {
+  bool ok = true;
+  for (Shard& shard : shards_) {
+    if (ABSL_PREDICT_FALSE(!shard.reader.Close())) ok = Fail(shard.reader);
+  }
+  shards_.clear();
+  return ok;
+}
+
+inline bool ShardedRecordReader::OpenShard(Shard& shard) {
+  RIEGELI_ASSERT_LT(next_shard_, filenames_.size())
+      << "Failed precondition of ShardedRecordReader::OpenShard(): "
+         "no more shards";
+  shard.shard_index = next_shard_++;
+  shard.reader.Reset(std::forward_as_tuple(filenames_[shard.shard_index],
+                                           O_RDONLY,
+                                           options_.fd_reader_options()),
+                     options_.record_reader_options());
+  if (ABSL_PREDICT_FALSE(!shard.reader.healthy())) return Fail(shard.reader);
+  return true;
+}
+
+inline bool ShardedRecordReader::NextShard() {
+  RIEGELI_ASSERT_LT(next_slot_, shards_.size())
+      << "Failed invariant of ShardedRecordReader: no current shard";
+  if (ABSL_PREDICT_FALSE(!shards_[next_slot_].reader.Close())) {
+    return Fail(shards_[next_slot_].reader);
+  }
+  switch (options_.order()) {
+    case Order::kSequential:
+      shards_.erase(shards_.begin());
+      if (next_shard_ < filenames_.size()) {
+        shards_.emplace_back();
+        if (ABSL_PREDICT_FALSE(!OpenShard(shards_.back()))) return false;
+      }
+      return true;
+    case Order::kInterleaved:
+      if (next_shard_ < filenames_.size()) {
+        return OpenShard(shards_[next_slot_]);
+      }
+      shards_.erase(shards_.begin() + next_slot_);
+      if (next_slot_ == shards_.size()) next_slot_ = 0;
+      return true;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown order: " << static_cast<int>(options_.order());
+}
+
+bool ShardedRecordReader::ReadRecord(google::protobuf::MessageLite& record) {
+  return ReadRecordImpl(record);
+}
+
+bool ShardedRecordReader::ReadRecord(absl::string_view& record) {
+  return ReadRecordImpl(record);
+}
+
+bool ShardedRecordReader::ReadRecord(std::string& record) {
+  return ReadRecordImpl(record);
+}
+
+bool ShardedRecordReader::ReadRecord(Chain& record) {
+  return ReadRecordImpl(record);
+}
+
+bool ShardedRecordReader::ReadRecord(absl::Cord& record) {
+  return ReadRecordImpl(record);
+}
+
+template <typename Record>
+inline bool ShardedRecordReader::ReadRecordImpl(Record& record) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  while (!shards_.empty()) {
+    Shard& shard = shards_[next_slot_];
+    if (ABSL_PREDICT_TRUE(shard.reader.ReadRecord(record))) {
+      last_shard_index_ = shard.shard_index;
+      last_pos_ = shard.reader.last_pos();
+      last_record_is_valid_ = true;
+      if (options_.order() == Order::kInterleaved) {
+        next_slot_ = (next_slot_ + 1) % shards_.size();
+      }
+      return true;
+    }
+    if (ABSL_PREDICT_FALSE(!shard.reader.healthy())) {
+      return Fail(shard.reader);
+    }
+    if (ABSL_PREDICT_FALSE(!NextShard())) return false;
+  }
+  return false;
+}
+
+ShardedRecordPosition ShardedRecordReader::pos() const {
+  std::vector<ShardedRecordPosition::OpenShard> open_shards;
+  open_shards.reserve(shards_.size());
+  for (const Shard& shard : shards_) {
+    open_shards.push_back(ShardedRecordPosition::OpenShard{
+        shard.shard_index, shard.reader.pos()});
+  }
+  return ShardedRecordPosition(next_shard_, next_slot_, std::move(open_shards));
+}
+
+bool ShardedRecordReader::Seek(const ShardedRecordPosition& new_pos) {
+  last_record_is_valid_ = false;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (ABSL_PREDICT_FALSE(!CloseShards())) return false;
+  if (ABSL_PREDICT_FALSE(new_pos.next_shard() > filenames_.size())) {
+    return Fail(absl::InvalidArgumentError(
+        absl::StrCat("Invalid ShardedRecordPosition: next shard ",
+                     new_pos.next_shard(), " exceeds the number of shards ",
+                     filenames_.size())));
+  }
+  if (ABSL_PREDICT_FALSE(
+          new_pos.open_shards().empty()
+              ? new_pos.next_slot() != 0
+              : new_pos.next_slot() >= new_pos.open_shards().size())) {
+    return Fail(absl::InvalidArgumentError(absl::StrCat(
+        "Invalid ShardedRecordPosition: next slot ", new_pos.next_slot(),
+        " exceeds the number of open shards ", new_pos.open_shards().size())));
+  }
+  next_slot_ = new_pos.next_slot();
+  shards_.reserve(IntCast<size_t>(options_.parallelism()));
+  for (const ShardedRecordPosition::OpenShard& open_shard :
+       new_pos.open_shards()) {
+    if (ABSL_PREDICT_FALSE(open_shard.shard_index >= new_pos.next_shard())) {
+      return Fail(absl::InvalidArgumentError(absl::StrCat(
+          "Invalid ShardedRecordPosition: open shard ", open_shard.shard_index,
+          " is not before next shard ", new_pos.next_shard())));
+    }
+    next_shard_ = open_shard.shard_index;
+    shards_.emplace_back();
+    if (ABSL_PREDICT_FALSE(!OpenShard(shards_.back()))) return false;
+    if (ABSL_PREDICT_FALSE(!shards_.back().reader.Seek(open_shard.pos))) {
+      return Fail(shards_.back().reader);
+    }
+  }
+  next_shard_ = new_pos.next_shard();
+  // Open more shards up to `parallelism()`, which happens when starting to
+  // read, or when resuming with larger parallelism.
+  while (shards_.size() < IntCast<size_t>(options_.parallelism()) &&
+         next_shard_ < filenames_.size()) {
+    shards_.emplace_back();
+    if (ABSL_PREDICT_FALSE(!OpenShard(shards_.back()))) return false;
+  }
+  return true;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,349 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SHARDED_RECORD_READER_H_
+#define RIEGELI_RECORDS_SHARDED_RECORD_READER_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace riegeli {
+
+// Expands a file name pattern (as interpreted by `glob()`) to the sorted list
+// of matching file names, replacing `filenames`.
+//
+// Returns status:
+//  * `status.ok()`  - success
+//  * `!status.ok()` - failure (`absl::NotFoundError()` if nothing matches)
+absl::Status GlobShards(absl::string_view pattern,
+                        std::vector<std::string>& filenames);
+
+// Position in a set of shards read by `ShardedRecordReader`, which allows to
+// resume reading from a checkpoint.
+class ShardedRecordPosition {
+ public:
+  // A shard being read, with the position of its next record.
+  struct OpenShard {
+    size_t shard_index = 0;
+    RecordPosition pos;
+  };
+
+  // Creates a `ShardedRecordPosition` corresponding to the first record.
+  ShardedRecordPosition() noexcept {}
+
+  explicit ShardedRecordPosition(size_t next_shard, size_t next_slot,
+                                 std::vector<OpenShard> open_shards);
+
+  ShardedRecordPosition(const ShardedRecordPosition& that) = default;
+  ShardedRecordPosition& operator=(const ShardedRecordPosition& that) =
+      default;
+
+  ShardedRecordPosition(ShardedRecordPosition&& that) noexcept = default;
+  ShardedRecordPosition& operator=(ShardedRecordPosition&& that) noexcept =
+      default;
+
+  // Index of the next shard to be opened. Shards with smaller indices are
+  // either in `open_shards()` or have been read completely.
+  size_t next_shard() const { return next_shard_; }
+
+  // Index in `open_shards()` of the shard to read the next record from.
+  size_t next_slot() const { return next_slot_; }
+
+  // Shards being read, in the order in which they are read from.
+  const std::vector<OpenShard>& open_shards() const { return open_shards_; }
+
+  // Text format:
+  // "<next_shard>;<next_slot>(;<shard_index>:<chunk_begin>/<record_index>)*".
+  std::string ToString() const;
+  bool FromString(absl::string_view serialized);
+
+  friend bool operator==(const ShardedRecordPosition& a,
+                         const ShardedRecordPosition& b);
+  friend bool operator!=(const ShardedRecordPosition& a,
+                         const ShardedRecordPosition& b);
+
+ private:
+  size_t next_shard_ = 0;
+  size_t next_slot_ = 0;
+  std::vector<OpenShard> open_shards_;
+};
+
+// `ShardedRecordReader` reads records of a set of Riegeli/records files
+// (shards) as a single stream, keeping several shards open at once.
+//
+// For reading records sequentially, this kind of loop can be used:
+// ```
+//   riegeli::ShardedRecordReader reader(filenames);
+//   SomeProto record;
+//   while (reader.ReadRecord(record)) {
+//     ... Process record.
+//   }
+//   if (!reader.Close()) {
+//     ... Failed with reason: reader.status()
+//   }
+// ```
+//
+// `pos()` and `Seek()` allow to checkpoint and resume reading the whole set.
+class ShardedRecordReader : public Object {
+ public:
+  // Order in which records of different shards are returned. Both orders are
+  // deterministic.
+  enum class Order {
+    // Shards are read one after another, in the order of file names. Shards
+    // following the current one are opened ahead.
+    kSequential,
+    // Records are taken in turn from `parallelism()` shards read at once.
+    // When a shard ends, the next shard takes its place.
+    kInterleaved,
+  };
+
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the number of shards open at once.
+    //
+    // Default: 1.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "ShardedRecordReader::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+    // Sets the order in which records of different shards are returned.
+    //
+    // Default: `Order::kSequential`.
+    Options& set_order(Order order) & {
+      order_ = order;
+      return *this;
+    }
+    Options&& set_order(Order order) && { return std::move(set_order(order)); }
+    Order order() const { return order_; }
+
+    // Options for reading each shard.
+    //
+    // Default: `RecordReaderBase::Options().set_parallelism(1)`, i.e. each
+    // shard decodes one chunk ahead in background.
+    Options& set_record_reader_options(
+        const RecordReaderBase::Options& record_reader_options) & {
+      record_reader_options_ = record_reader_options;
+      return *this;
+    }
+    Options& set_record_reader_options(
+        RecordReaderBase::Options&& record_reader_options) & {
+      record_reader_options_ = std::move(record_reader_options);
+      return *this;
+    }
+    Options&& set_record_reader_options(
+        const RecordReaderBase::Options& record_reader_options) && {
+      return std::move(set_record_reader_options(record_reader_options));
+    }
+    Options&& set_record_reader_options(
+        RecordReaderBase::Options&& record_reader_options) && {
+      return std::move(
+          set_record_reader_options(std::move(record_reader_options)));
+    }
+    RecordReaderBase::Options& record_reader_options() {
+      return record_reader_options_;
+    }
+    const RecordReaderBase::Options& record_reader_options() const {
+      return record_reader_options_;
+    }
+
+    // Options for opening each shard file.
+    //
+    // Default: `FdReaderBase::Options()`.
+    Options& set_fd_reader_options(
+        const FdReaderBase::Options& fd_reader_options) & {
+      fd_reader_options_ = fd_reader_options;
+      return *this;
+    }
+    Options&& set_fd_reader_options(
+        const FdReaderBase::Options& fd_reader_options) && {
+      return std::move(set_fd_reader_options(fd_reader_options));
+    }
+    FdReaderBase::Options& fd_reader_options() { return fd_reader_options_; }
+    const FdReaderBase::Options& fd_reader_options() const {
+      return fd_reader_options_;
+    }
+
+   private:
+    int parallelism_ = 1;
+    Order order_ = Order::kSequential;
+    RecordReaderBase::Options record_reader_options_ =
+        RecordReaderBase::Options().set_parallelism(1);
+    FdReaderBase::Options fd_reader_options_;
+  };
+
+  // Creates a closed `ShardedRecordReader`.
+  ShardedRecordReader() noexcept : Object(kInitiallyClosed) {}
+
+  // Will read from the files named by `filenames`.
+  explicit ShardedRecordReader(std::vector<std::string> filenames,
+                               Options options = Options());
+
+  ShardedRecordReader(ShardedRecordReader&& that) noexcept;
+  ShardedRecordReader& operator=(ShardedRecordReader&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `ShardedRecordReader`. This
+  // avoids constructing a temporary `ShardedRecordReader` and moving from it.
+  void Reset();
+  void Reset(std::vector<std::string> filenames, Options options = Options());
+
+  // Returns the names of the files being read. Unchanged by `Close()`.
+  const std::vector<std::string>& filenames() const { return filenames_; }
+
+  // Reads the next record.
+  //
+  // For `ReadRecord(absl::string_view&)` the `absl::string_view` is valid until
+  // the next non-const operation on this `ShardedRecordReader`.
+  //
+  // Return values:
+  //  * `true`                      - success (`record` is set)
+  //  * `false` (when `healthy()`)  - all shards end
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadRecord(google::protobuf::MessageLite& record);
+  bool ReadRecord(absl::string_view& record);
+  bool ReadRecord(std::string& record);
+  bool ReadRecord(Chain& record);
+  bool ReadRecord(absl::Cord& record);
+
+  // Returns the index in `filenames()` of the shard of the last record read.
+  //
+  // Precondition: `last_record_is_valid()`
+  size_t last_shard_index() const;
+
+  // Returns the canonical position of the last record read, within its shard.
+  //
+  // Precondition: `last_record_is_valid()`
+  RecordPosition last_pos() const;
+
+  // Returns `true` if calling `last_shard_index()` and `last_pos()` is valid.
+  bool last_record_is_valid() const { return last_record_is_valid_; }
+
+  // Returns the position of the next record, which can be passed to `Seek()`
+  // to resume reading, possibly by another `ShardedRecordReader` with the same
+  // `filenames()` and `Options::order()`.
+  ShardedRecordPosition pos() const;
+
+  // Seeks to a position obtained by `pos()`.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool Seek(const ShardedRecordPosition& new_pos);
+
+ protected:
+  void Done() override;
+
+ private:
+  struct Shard {
+    size_t shard_index;
+    RecordReader<FdReader<>> reader;
+  };
+
+  // Opens the shard `next_shard_` and increments `next_shard_`.
+  //
+  // Precondition: `next_shard_ < filenames_.size()`
+  bool OpenShard(Shard& shard);
+
+  // Replaces or removes `shards_[next_slot_]` which has ended.
+  bool NextShard();
+
+  bool CloseShards();
+
+  template <typename Record>
+  bool ReadRecordImpl(Record& record);
+
+  std::vector<std::string> filenames_;
+  Options options_;
+  size_t next_shard_ = 0;
+  size_t next_slot_ = 0;
+  // Invariant: if `!shards_.empty()` then `next_slot_ < shards_.size()`
+  std::vector<Shard> shards_;
+  size_t last_shard_index_ = 0;
+  RecordPosition last_pos_;
+  bool last_record_is_valid_ = false;
+};
+
+// Implementation details follow.
+
+inline ShardedRecordReader::ShardedRecordReader(
+    ShardedRecordReader&& that) noexcept
+    : Object(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      filenames_(std::move(that.filenames_)),
+      options_(std::move(that.options_)),
+      next_shard_(std::exchange(that.next_shard_, 0)),
+      next_slot_(std::exchange(that.next_slot_, 0)),
+      shards_(std::move(that.shards_)),
+      last_shard_index_(that.last_shard_index_),
+      last_pos_(that.last_pos_),
+      last_record_is_valid_(std::exchange(that.last_record_is_valid_, false)) {}
+
+inline ShardedRecordReader& ShardedRecordReader::operator=(
+    ShardedRecordReader&& that) noexcept {
+  Object::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  filenames_ = std::move(that.filenames_);
+  options_ = std::move(that.options_);
+  next_shard_ = std::exchange(that.next_shard_, 0);
+  next_slot_ = std::exchange(that.next_slot_, 0);
+  shards_ = std::move(that.shards_);
+  last_shard_index_ = that.last_shard_index_;
+  last_pos_ = that.last_pos_;
+  last_record_is_valid_ = std::exchange(that.last_record_is_valid_, false);
+  return *this;
+}
+
+inline size_t ShardedRecordReader::last_shard_index() const {
+  RIEGELI_ASSERT(last_record_is_valid())
+      << "Failed precondition of ShardedRecordReader::last_shard_index(): "
+         "no record was recently read";
+  return last_shard_index_;
+}
+
+inline RecordPosition ShardedRecordReader::last_pos() const {
+  RIEGELI_ASSERT(last_record_is_valid())
+      << "Failed precondition of ShardedRecordReader::last_pos(): "
+         "no record was recently read";
+  return last_pos_;
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SHARDED_RECORD_READER_H_
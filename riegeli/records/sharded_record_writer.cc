@@ -0,0 +1,210 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/sharded_record_writer.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_budget.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/messages/message_serialize.h"
+#include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+// Returns the largest memory reserved by a `RecordWriter` with `options` from
+// its `MemoryBudget` for a chunk.
+size_t ChunkMemory(const RecordWriterBase::Options& options) {
+  uint64_t chunk_size = options.effective_chunk_size();
+  if (options.adaptive_chunk_size()) {
+    chunk_size = UnsignedMax(chunk_size, options.max_chunk_size());
+  }
+  // Records are buffered, and then their encoded form coexists with them.
+  return IntCast<size_t>(
+      UnsignedMin(SaturatingAdd(chunk_size, chunk_size),
+                  uint64_t{std::numeric_limits<size_t>::max()}));
+}
+
+std::vector<std::unique_ptr<ChunkWriter>> OpenShards(
+    const std::vector<std::string>& filenames) {
+  std::vector<std::unique_ptr<ChunkWriter>> shards;
+  shards.reserve(filenames.size());
+  for (const std::string& filename : filenames) {
+    shards.push_back(std::make_unique<DefaultChunkWriter<FdWriter<>>>(
+        std::forward_as_tuple(filename, O_WRONLY | O_CREAT | O_TRUNC)));
+  }
+  return shards;
+}
+
+}  // namespace
+
+ShardedRecordWriter::ShardedRecordWriter(
+    std::vector<std::unique_ptr<ChunkWriter>> shards, Options options)
+    : Object(kInitiallyOpen), options_(std::move(options)) {
+  Initialize(std::move(shards));
+}
+
+ShardedRecordWriter::ShardedRecordWriter(
+    const std::vector<std::string>& filenames, Options options)
+    : Object(kInitiallyOpen), options_(std::move(options)) {
+  Initialize(OpenShards(filenames));
+}
+
+void ShardedRecordWriter::Reset() {
+  Object::Reset(kInitiallyClosed);
+  options_ = Options();
+  // Shards are destroyed before the thread pool and memory budget they use.
+  shards_.clear();
+  thread_pool_.reset();
+  memory_budget_.reset();
+  next_shard_ = 0;
+  last_shard_index_ = 0;
+}
+
+void ShardedRecordWriter::Reset(
+    std::vector<std::unique_ptr<ChunkWriter>> shards, Options options) {
+  Object::Reset(kInitiallyOpen);
+  options_ = std::move(options);
+  shards_.clear();
+  thread_pool_.reset();
+  memory_budget_.reset();
+  next_shard_ = 0;
+  last_shard_index_ = 0;
+  Initialize(std::move(shards));
+}
+
+void ShardedRecordWriter::Reset(const std::vector<std::string>& filenames,
+                                Options options) {
+  Reset(OpenShards(filenames), std::move(options));
+}
+
+void ShardedRecordWriter::Initialize(
+    std::vector<std::unique_ptr<ChunkWriter>> shards) {
+  RIEGELI_ASSERT(!shards.empty())
+      << "Failed precondition of ShardedRecordWriter: no shards";
+  RecordWriterBase::Options shard_options = options_.record_writer_options();
+  shard_options.set_thread_pool(nullptr).set_memory_budget(nullptr);
+  if (shard_options.parallelism() > 0) {
+    thread_pool_ = std::make_unique<ThreadPool>(
+        ThreadPool::Options().set_max_threads(
+            IntCast<size_t>(options_.parallelism())));
+    shard_options.set_thread_pool(thread_pool_.get());
+  }
+  if (options_.memory_limit() != std::numeric_limits<size_t>::max()) {
+    // Each shard can hold a reservation for a chunk being filled while another
+    // shard waits for memory in the same thread. Such a wait ends only when
+    // chunks encoded in background release their reservations, so chunks being
+    // filled must not exhaust the limit by themselves.
+    const size_t chunk_memory = ChunkMemory(shard_options);
+    const size_t min_memory_limit =
+        chunk_memory > std::numeric_limits<size_t>::max() / shards.size()
+            ? std::numeric_limits<size_t>::max()
+            : chunk_memory * shards.size();
+    memory_budget_ = std::make_unique<MemoryBudget>(
+        UnsignedMax(options_.memory_limit(), min_memory_limit));
+    shard_options.set_memory_budget(memory_budget_.get());
+  }
+  shards_.reserve(shards.size());
+  for (std::unique_ptr<ChunkWriter>& chunk_writer : shards) {
+    shards_.emplace_back(std::move(chunk_writer), shard_options);
+    if (ABSL_PREDICT_FALSE(!shards_.back().healthy())) Fail(shards_.back());
+  }
+}
+
+void ShardedRecordWriter::Done() {
+  for (Shard& shard : shards_) {
+    if (ABSL_PREDICT_FALSE(!shard.Close())) Fail(shard);
+  }
+}
+
+inline size_t ShardedRecordWriter::NextShard() {
+  const size_t shard_index = next_shard_;
+  next_shard_ = next_shard_ + 1 == shards_.size() ? 0 : next_shard_ + 1;
+  return shard_index;
+}
+
+size_t ShardedRecordWriter::ShardIndex(absl::string_view record) {
+  if (options_.shard_function() == nullptr) return NextShard();
+  return options_.shard_function()(record) % shards_.size();
+}
+
+size_t ShardedRecordWriter::ShardIndex(const Chain& record) {
+  if (options_.shard_function() == nullptr) return NextShard();
+  const absl::optional<absl::string_view> flat = record.TryFlat();
+  if (flat != absl::nullopt) return ShardIndex(*flat);
+  return ShardIndex(absl::string_view(std::string(record)));
+}
+
+size_t ShardedRecordWriter::ShardIndex(const absl::Cord& record) {
+  if (options_.shard_function() == nullptr) return NextShard();
+  const absl::optional<absl::string_view> flat = record.TryFlat();
+  if (flat != absl::nullopt) return ShardIndex(*flat);
+  return ShardIndex(absl::string_view(std::string(record)));
+}
+
+bool ShardedRecordWriter::WriteRecord(
+    const google::protobuf::MessageLite& record,
+    SerializeOptions serialize_options) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  if (options_.shard_function() == nullptr) {
+    return WriteRecordToShard(NextShard(), record,
+                              std::move(serialize_options));
+  }
+  // The shard is chosen by the serialized record, so it is serialized here
+  // rather than by the chunk encoder.
+  Chain serialized;
+  {
+    absl::Status status =
+        SerializeToChain(record, serialized, std::move(serialize_options));
+    if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+  }
+  return WriteRecord(std::move(serialized));
+}
+
+bool ShardedRecordWriter::Flush(FlushType flush_type) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  // Shards are flushed concurrently, each waiting for its own background work.
+  std::vector<RecordWriterBase::FutureBool> flushed;
+  flushed.reserve(shards_.size());
+  for (Shard& shard : shards_) flushed.push_back(shard.FutureFlush(flush_type));
+  bool ok = true;
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    if (ABSL_PREDICT_FALSE(!flushed[i].get())) ok = Fail(shards_[i]);
+  }
+  return ok;
+}
+
+}  // namespace riegeli
@@ -0,0 +1,395 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SHARDED_RECORD_WRITER_H_
+#define RIEGELI_RECORDS_SHARDED_RECORD_WRITER_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_budget.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/messages/message_serialize.h"
+#include "riegeli/records/chunk_writer.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+// `ShardedRecordWriter` writes records to a set of Riegeli/records files
+// (shards), routing each record to a shard by a user function.
+//
+// Chunks of all shards are encoded by one thread pool with a limited number of
+// threads, and reserve memory from one `MemoryBudget`, so resources used for
+// encoding do not grow with the number of shards, unlike with independent
+// `RecordWriter`s with their own `RecordWriterBase::Options::parallelism()`.
+// `Flush()` and `Close()` apply to all shards at once.
+//
+// For writing records to shards chosen by a hash of a key:
+// ```
+//   riegeli::ShardedRecordWriter writer(
+//       filenames,
+//       riegeli::ShardedRecordWriter::Options().set_shard_function(
+//           [](absl::string_view record) {
+//             return absl::Hash<absl::string_view>()(ExtractKey(record));
+//           }));
+//   for (const SomeProto& record : records) {
+//     if (!writer.WriteRecord(record)) break;
+//   }
+//   if (!writer.Close()) {
+//     ... Failed with reason: writer.status()
+//   }
+// ```
+class ShardedRecordWriter : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets a function which returns the shard of a record (serialized, if the
+    // record is a proto message). The result is taken modulo the number of
+    // shards, so a hash can be returned directly.
+    //
+    // If `nullptr`, records are distributed round-robin, and proto messages are
+    // not serialized before choosing the shard.
+    //
+    // Default: `nullptr`.
+    Options& set_shard_function(
+        const std::function<size_t(absl::string_view record)>&
+            shard_function) & {
+      shard_function_ = shard_function;
+      return *this;
+    }
+    Options& set_shard_function(
+        std::function<size_t(absl::string_view record)>&& shard_function) & {
+      shard_function_ = std::move(shard_function);
+      return *this;
+    }
+    Options&& set_shard_function(
+        const std::function<size_t(absl::string_view record)>&
+            shard_function) && {
+      return std::move(set_shard_function(shard_function));
+    }
+    Options&& set_shard_function(
+        std::function<size_t(absl::string_view record)>&& shard_function) && {
+      return std::move(set_shard_function(std::move(shard_function)));
+    }
+    std::function<size_t(absl::string_view record)>& shard_function() {
+      return shard_function_;
+    }
+    const std::function<size_t(absl::string_view record)>& shard_function()
+        const {
+      return shard_function_;
+    }
+
+    // Sets the number of threads encoding chunks of all shards together.
+    //
+    // This matters only if `record_writer_options().parallelism() > 0`,
+    // otherwise chunks are encoded by the thread writing records.
+    //
+    // Default: 4.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "ShardedRecordWriter::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+    // Sets the limit of memory reserved for chunks of all shards together,
+    // for records of each chunk and their encoded form, as by
+    // `RecordWriterBase::Options::set_memory_budget()`.
+    //
+    // Each shard can have a chunk being filled with records while other shards
+    // wait for memory, so the limit is raised to at least the memory of one
+    // chunk per shard. Memory above that bounds chunks being encoded and
+    // written in background.
+    //
+    // `std::numeric_limits<size_t>::max()` disables memory accounting.
+    //
+    // Default: `std::numeric_limits<size_t>::max()`.
+    Options& set_memory_limit(size_t memory_limit) & {
+      memory_limit_ = memory_limit;
+      return *this;
+    }
+    Options&& set_memory_limit(size_t memory_limit) && {
+      return std::move(set_memory_limit(memory_limit));
+    }
+    size_t memory_limit() const { return memory_limit_; }
+
+    // Options for writing each shard.
+    //
+    // `parallelism()` of these options is the number of chunks of each shard
+    // which can be encoded at once. Their `thread_pool()` and `memory_budget()`
+    // are replaced with those shared by all shards.
+    //
+    // Default: `RecordWriterBase::Options().set_parallelism(1)`, i.e. each
+    // shard encodes one chunk in background while the next one is filled.
+    Options& set_record_writer_options(
+        const RecordWriterBase::Options& record_writer_options) & {
+      record_writer_options_ = record_writer_options;
+      return *this;
+    }
+    Options& set_record_writer_options(
+        RecordWriterBase::Options&& record_writer_options) & {
+      record_writer_options_ = std::move(record_writer_options);
+      return *this;
+    }
+    Options&& set_record_writer_options(
+        const RecordWriterBase::Options& record_writer_options) && {
+      return std::move(set_record_writer_options(record_writer_options));
+    }
+    Options&& set_record_writer_options(
+        RecordWriterBase::Options&& record_writer_options) && {
+      return std::move(
+          set_record_writer_options(std::move(record_writer_options)));
+    }
+    RecordWriterBase::Options& record_writer_options() {
+      return record_writer_options_;
+    }
+    const RecordWriterBase::Options& record_writer_options() const {
+      return record_writer_options_;
+    }
+
+   private:
+    std::function<size_t(absl::string_view record)> shard_function_;
+    int parallelism_ = 4;
+    size_t memory_limit_ = std::numeric_limits<size_t>::max();
+    RecordWriterBase::Options record_writer_options_ =
+        RecordWriterBase::Options().set_parallelism(1);
+  };
+
+  // Creates a closed `ShardedRecordWriter`.
+  ShardedRecordWriter() noexcept : Object(kInitiallyClosed) {}
+
+  // Will write to the `ChunkWriter`s of `shards`, which are owned.
+  //
+  // Precondition: `!shards.empty()`
+  explicit ShardedRecordWriter(std::vector<std::unique_ptr<ChunkWriter>> shards,
+                               Options options = Options());
+
+  // Will write to new files named by `filenames`, truncating existing files.
+  //
+  // Precondition: `!filenames.empty()`
+  explicit ShardedRecordWriter(const std::vector<std::string>& filenames,
+                               Options options = Options());
+
+  ShardedRecordWriter(ShardedRecordWriter&& that) noexcept;
+  ShardedRecordWriter& operator=(ShardedRecordWriter&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `ShardedRecordWriter`. This
+  // avoids constructing a temporary `ShardedRecordWriter` and moving from it.
+  void Reset();
+  void Reset(std::vector<std::unique_ptr<ChunkWriter>> shards,
+             Options options = Options());
+  void Reset(const std::vector<std::string>& filenames,
+             Options options = Options());
+
+  // Returns the number of shards.
+  size_t num_shards() const { return shards_.size(); }
+
+  // Returns the `RecordWriter` of the shard with the given index, e.g. for
+  // writing a record to a shard chosen by the caller, or for `LastPos()`.
+  //
+  // Writing to it directly bypasses `Options::shard_function()`. A failure of
+  // the shard is reported by `ShardedRecordWriter` at the latest by `Close()`.
+  //
+  // Precondition: `index < num_shards()`
+  RecordWriterBase& shard(size_t index);
+  const RecordWriterBase& shard(size_t index) const;
+
+  // Writes the next record to the shard chosen by `Options::shard_function()`.
+  //
+  // The overloads mirror `RecordWriterBase::WriteRecord()`.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool WriteRecord(const google::protobuf::MessageLite& record);
+  bool WriteRecord(const google::protobuf::MessageLite& record,
+                   SerializeOptions serialize_options);
+  bool WriteRecord(absl::string_view record);
+  template <typename Src,
+            std::enable_if_t<std::is_same<Src, std::string>::value, int> = 0>
+  bool WriteRecord(Src&& record);
+  bool WriteRecord(const Chain& record);
+  bool WriteRecord(Chain&& record);
+  bool WriteRecord(const absl::Cord& record);
+  bool WriteRecord(absl::Cord&& record);
+
+  // Returns the index of the shard of the last record written by
+  // `WriteRecord()`, whose position is `shard(last_shard_index()).LastPos()`.
+  //
+  // Precondition: some record was successfully written.
+  size_t last_shard_index() const { return last_shard_index_; }
+
+  // Finalizes any open chunks of all shards and pushes buffered data to the
+  // destinations, waiting for background encoding and writing of all shards
+  // together.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool Flush(FlushType flush_type = FlushType::kFromProcess);
+
+ protected:
+  void Done() override;
+
+ private:
+  using Shard = RecordWriter<std::unique_ptr<ChunkWriter>>;
+
+  void Initialize(std::vector<std::unique_ptr<ChunkWriter>> shards);
+
+  // Returns the next shard in the round-robin order.
+  size_t NextShard();
+
+  // Returns the index of the shard for `record`.
+  size_t ShardIndex(absl::string_view record);
+  size_t ShardIndex(const Chain& record);
+  size_t ShardIndex(const absl::Cord& record);
+
+  template <typename Record>
+  bool WriteRecordImpl(Record&& record);
+  // Writes a record to `shards_[shard_index]`, passing `args` to
+  // `RecordWriterBase::WriteRecord()`.
+  template <typename... Args>
+  bool WriteRecordToShard(size_t shard_index, Args&&... args);
+
+  Options options_;
+  // Shared by `shards_`, which are declared later so that they are destroyed
+  // earlier.
+  std::unique_ptr<ThreadPool> thread_pool_;
+  std::unique_ptr<MemoryBudget> memory_budget_;
+  std::vector<Shard> shards_;
+  // The shard of the next record if `options_.shard_function() == nullptr`.
+  size_t next_shard_ = 0;
+  size_t last_shard_index_ = 0;
+};
+
+// Implementation details follow.
+
+inline ShardedRecordWriter::ShardedRecordWriter(
+    ShardedRecordWriter&& that) noexcept
+    : Object(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      options_(std::move(that.options_)),
+      thread_pool_(std::move(that.thread_pool_)),
+      memory_budget_(std::move(that.memory_budget_)),
+      shards_(std::move(that.shards_)),
+      next_shard_(std::exchange(that.next_shard_, 0)),
+      last_shard_index_(std::exchange(that.last_shard_index_, 0)) {}
+
+inline ShardedRecordWriter& ShardedRecordWriter::operator=(
+    ShardedRecordWriter&& that) noexcept {
+  Object::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  options_ = std::move(that.options_);
+  // Previous shards are destroyed before the thread pool and memory budget
+  // they use.
+  shards_ = std::move(that.shards_);
+  thread_pool_ = std::move(that.thread_pool_);
+  memory_budget_ = std::move(that.memory_budget_);
+  next_shard_ = std::exchange(that.next_shard_, 0);
+  last_shard_index_ = std::exchange(that.last_shard_index_, 0);
+  return *this;
+}
+
+inline RecordWriterBase& ShardedRecordWriter::shard(size_t index) {
+  RIEGELI_ASSERT_LT(index, shards_.size())
+      << "Failed precondition of ShardedRecordWriter::shard(): "
+         "shard index out of range";
+  return shards_[index];
+}
+
+inline const RecordWriterBase& ShardedRecordWriter::shard(size_t index) const {
+  RIEGELI_ASSERT_LT(index, shards_.size())
+      << "Failed precondition of ShardedRecordWriter::shard(): "
+         "shard index out of range";
+  return shards_[index];
+}
+
+inline bool ShardedRecordWriter::WriteRecord(
+    const google::protobuf::MessageLite& record) {
+  return WriteRecord(record, SerializeOptions());
+}
+
+inline bool ShardedRecordWriter::WriteRecord(absl::string_view record) {
+  return WriteRecordImpl(record);
+}
+
+template <typename Src,
+          std::enable_if_t<std::is_same<Src, std::string>::value, int>>
+inline bool ShardedRecordWriter::WriteRecord(Src&& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const size_t shard_index = ShardIndex(absl::string_view(record));
+  return WriteRecordToShard(shard_index, std::move(record));
+}
+
+inline bool ShardedRecordWriter::WriteRecord(const Chain& record) {
+  return WriteRecordImpl(record);
+}
+
+inline bool ShardedRecordWriter::WriteRecord(Chain&& record) {
+  return WriteRecordImpl(std::move(record));
+}
+
+inline bool ShardedRecordWriter::WriteRecord(const absl::Cord& record) {
+  return WriteRecordImpl(record);
+}
+
+inline bool ShardedRecordWriter::WriteRecord(absl::Cord&& record) {
+  return WriteRecordImpl(std::move(record));
+}
+
+template <typename Record>
+inline bool ShardedRecordWriter::WriteRecordImpl(Record&& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  const size_t shard_index = ShardIndex(record);
+  return WriteRecordToShard(shard_index, std::forward<Record>(record));
+}
+
+template <typename... Args>
+inline bool ShardedRecordWriter::WriteRecordToShard(size_t shard_index,
+                                                    Args&&... args) {
+  Shard& shard = shards_[shard_index];
+  if (ABSL_PREDICT_FALSE(!shard.WriteRecord(std::forward<Args>(args)...))) {
+    return Fail(shard);
+  }
+  last_shard_index_ = shard_index;
+  return true;
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SHARDED_RECORD_WRITER_H_
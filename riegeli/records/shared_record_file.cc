@@ -0,0 +1,272 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/shared_record_file.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/messages/message_parse.h"
+#include "riegeli/records/block.h"
+#include "riegeli/records/chunk_cache.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+
+namespace {
+
+inline absl::Status ReadRecordValue(ChainReader<>& values_reader,
+                                    Position limit,
+                                    google::protobuf::MessageLite& record) {
+  return ParseFromReader(LimitingReader<>(&values_reader, limit), record);
+}
+
+template <typename Record>
+inline absl::Status ReadRecordValue(ChainReader<>& values_reader,
+                                    Position limit, Record& record) {
+  if (!values_reader.Read(IntCast<size_t>(limit - values_reader.pos()),
+                          record)) {
+    RIEGELI_ASSERT_UNREACHABLE() << "Failed reading record from values reader: "
+                                 << values_reader.status();
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+SharedRecordFile::SharedRecordFile(absl::string_view filename, Options options)
+    : Object(kInitiallyOpen),
+      file_(filename, O_RDONLY,
+            FdReaderBase::Options(options.fd_reader_options())
+                .set_independent_pos(0)),
+      fd_reader_options_(std::move(options.fd_reader_options())),
+      chunk_decoder_options_(std::move(options.chunk_decoder_options())),
+      chunk_cache_(options.chunk_cache()),
+      cache_key_(options.cache_key() != absl::nullopt
+                     ? std::move(*options.cache_key())
+                     : file_.filename()) {
+  fd_reader_options_.set_independent_pos(0);
+  if (chunk_cache_ == nullptr) {
+    owned_chunk_cache_ = std::make_unique<ChunkCache>();
+    chunk_cache_ = owned_chunk_cache_.get();
+  }
+  if (ABSL_PREDICT_FALSE(!file_.healthy())) Fail(file_);
+}
+
+void SharedRecordFile::Done() {
+  if (ABSL_PREDICT_FALSE(!file_.Close())) Fail(file_);
+}
+
+SharedRecordFile::Cursor SharedRecordFile::NewCursor() { return Cursor(this); }
+
+absl::Status SharedRecordFile::FindRecord(uint64_t record_index,
+                                          RecordPosition& pos) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return status();
+  absl::MutexLock lock(&index_mutex_);
+  if (!chunk_index_loaded_) {
+    const absl::Status status = LoadChunkIndex();
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  const absl::optional<RecordPosition> found = chunk_index_.Find(record_index);
+  if (ABSL_PREDICT_FALSE(found == absl::nullopt)) {
+    return absl::NotFoundError(absl::StrCat("Record index out of range: ",
+                                            record_index, " >= ",
+                                            chunk_index_.num_records()));
+  }
+  pos = *found;
+  return absl::OkStatus();
+}
+
+absl::Status SharedRecordFile::GetChunkIndex(const ChunkIndex*& chunk_index) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return status();
+  absl::MutexLock lock(&index_mutex_);
+  if (!chunk_index_loaded_) {
+    const absl::Status status = LoadChunkIndex();
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  chunk_index = &chunk_index_;
+  return absl::OkStatus();
+}
+
+absl::Status SharedRecordFile::LoadChunkIndex() {
+  // Matches `RecordReaderBase::LoadChunkIndex()`.
+  DefaultChunkReader<FdReader<UnownedFd>> src(
+      std::forward_as_tuple(file_.src_fd(), fd_reader_options_));
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) return src.status();
+  // The chunk index is the last chunk, possibly followed by padding.
+  Position chunk_pos = *size;
+  while (chunk_pos > 0) {
+    if (ABSL_PREDICT_FALSE(!src.SeekToChunkBefore(chunk_pos - 1))) {
+      return src.status();
+    }
+    const Position chunk_begin = src.pos();
+    const ChunkHeader* chunk_header;
+    if (ABSL_PREDICT_FALSE(!src.PullChunkHeader(&chunk_header))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+      break;
+    }
+    if (chunk_header->chunk_type() == ChunkType::kPadding) {
+      chunk_pos = chunk_begin;
+      continue;
+    }
+    if (chunk_header->chunk_type() == ChunkType::kChunkIndex) {
+      Chunk chunk;
+      if (ABSL_PREDICT_FALSE(!src.ReadChunk(chunk))) {
+        if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+        break;
+      }
+      if (chunk_index_.DecodeChunk(chunk, chunk_begin).ok()) {
+        chunk_index_loaded_ = true;
+        return absl::OkStatus();
+      }
+    }
+    break;
+  }
+  // There is no usable chunk index. Build it by reading chunk headers.
+  chunk_index_.Clear();
+  if (ABSL_PREDICT_FALSE(!src.Seek(0))) return src.status();
+  for (;;) {
+    const Position chunk_begin = src.pos();
+    const ChunkHeader* chunk_header;
+    if (!src.PullChunkHeader(&chunk_header)) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+      break;
+    }
+    const Position chunk_end = internal::ChunkEnd(*chunk_header, chunk_begin);
+    if (ABSL_PREDICT_FALSE(chunk_end > *size)) {
+      // The last chunk is truncated.
+      break;
+    }
+    chunk_index_.Add(chunk_begin, chunk_header->num_records());
+    if (ABSL_PREDICT_FALSE(!src.Seek(chunk_end))) return src.status();
+  }
+  chunk_index_loaded_ = true;
+  return absl::OkStatus();
+}
+
+SharedRecordFile::Cursor::Cursor(SharedRecordFile* file)
+    : file_(file),
+      chunk_reader_(std::forward_as_tuple(file->file_.src_fd(),
+                                          file->fd_reader_options_)),
+      chunk_decoder_(file->chunk_decoder_options_) {}
+
+void SharedRecordFile::Cursor::ResetChunkReader() {
+  chunk_reader_.Reset(
+      std::forward_as_tuple(file_->file_.src_fd(), file_->fd_reader_options_));
+}
+
+absl::Status SharedRecordFile::Cursor::ReadRecordAt(
+    RecordPosition pos, google::protobuf::MessageLite& record) {
+  return ReadRecordAtImpl(pos, record);
+}
+
+absl::Status SharedRecordFile::Cursor::ReadRecordAt(RecordPosition pos,
+                                                    std::string& record) {
+  return ReadRecordAtImpl(pos, record);
+}
+
+absl::Status SharedRecordFile::Cursor::ReadRecordAt(RecordPosition pos,
+                                                    Chain& record) {
+  return ReadRecordAtImpl(pos, record);
+}
+
+absl::Status SharedRecordFile::Cursor::ReadRecordAt(RecordPosition pos,
+                                                    absl::Cord& record) {
+  return ReadRecordAtImpl(pos, record);
+}
+
+template <typename Record>
+inline absl::Status SharedRecordFile::Cursor::ReadRecordAtImpl(
+    RecordPosition pos, Record& record) {
+  if (ABSL_PREDICT_FALSE(file_ == nullptr)) {
+    return absl::FailedPreconditionError(
+        "SharedRecordFile::Cursor not associated with a file");
+  }
+  {
+    const absl::Status status = FindChunk(pos.chunk_begin());
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (ABSL_PREDICT_FALSE(pos.record_index() >= chunk_->limits.size())) {
+    return absl::NotFoundError(
+        absl::StrCat("No record at position ", pos.ToString()));
+  }
+  const size_t index = IntCast<size_t>(pos.record_index());
+  const size_t start = index == 0 ? size_t{0} : chunk_->limits[index - 1];
+  const size_t limit = chunk_->limits[index];
+  ChainReader<> values_reader(&chunk_->values);
+  if (!values_reader.Seek(start)) {
+    RIEGELI_ASSERT_UNREACHABLE()
+        << "Seeking record values failed: " << values_reader.status();
+  }
+  return ReadRecordValue(values_reader, limit, record);
+}
+
+absl::Status SharedRecordFile::Cursor::FindChunk(Position chunk_begin) {
+  if (chunk_ != nullptr && chunk_begin_ == chunk_begin) return absl::OkStatus();
+  chunk_.reset();
+  if (ABSL_PREDICT_FALSE(!file_->healthy())) return file_->status();
+  std::shared_ptr<const DecodedChunk> chunk =
+      file_->chunk_cache_->Find(file_->cache_key_, chunk_begin);
+  if (chunk == nullptr) {
+    if (ABSL_PREDICT_FALSE(!chunk_reader_.healthy())) ResetChunkReader();
+    Chunk encoded_chunk;
+    if (ABSL_PREDICT_FALSE(!chunk_reader_.Seek(chunk_begin) ||
+                           !chunk_reader_.ReadChunk(encoded_chunk))) {
+      if (chunk_reader_.healthy()) {
+        return absl::NotFoundError(
+            absl::StrCat("No chunk at position ", chunk_begin));
+      }
+      return chunk_reader_.status();
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_decoder_.Decode(encoded_chunk))) {
+      return chunk_decoder_.status();
+    }
+    std::shared_ptr<DecodedChunk> decoded_chunk =
+        std::make_shared<DecodedChunk>();
+    chunk_decoder_.TakeRecords(decoded_chunk->values, decoded_chunk->limits);
+    decoded_chunk->chunk_end = chunk_reader_.pos();
+    chunk = std::move(decoded_chunk);
+    file_->chunk_cache_->Insert(file_->cache_key_, chunk_begin, chunk);
+  }
+  chunk_begin_ = chunk_begin;
+  chunk_ = std::move(chunk);
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,265 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SHARED_RECORD_FILE_H_
+#define RIEGELI_RECORDS_SHARED_RECORD_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/fd_dependency.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/records/chunk_cache.h"
+#include "riegeli/records/chunk_index.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
+
+namespace riegeli {
+
+// `SharedRecordFile` serves random lookups of records of a Riegeli/records
+// file from many threads at once.
+//
+// The file descriptor, the chunk index, and a cache of decoded chunks are
+// shared. Each thread performs lookups through its own `Cursor`, which keeps
+// only a small buffer for reading chunks with `pread()`, and a `ChunkDecoder`
+// without decoded data.
+//
+// ```
+//   riegeli::SharedRecordFile file(filename);
+//   if (!file.healthy()) ... Failed with reason: file.status()
+//
+//   // In each thread:
+//   riegeli::SharedRecordFile::Cursor cursor = file.NewCursor();
+//   std::string record;
+//   const absl::Status status = cursor.ReadRecordAt(pos, record);
+// ```
+//
+// Functions of `SharedRecordFile` are thread-safe. A `Cursor` is not: it
+// should be used by one thread at a time. The `SharedRecordFile` must outlive
+// its cursors.
+class SharedRecordFile : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Options for decoding chunks: field projection, and dictionaries which
+    // were used for writing.
+    //
+    // Default: `ChunkDecoder::Options()`.
+    Options& set_chunk_decoder_options(
+        const ChunkDecoder::Options& chunk_decoder_options) & {
+      chunk_decoder_options_ = chunk_decoder_options;
+      return *this;
+    }
+    Options& set_chunk_decoder_options(
+        ChunkDecoder::Options&& chunk_decoder_options) & {
+      chunk_decoder_options_ = std::move(chunk_decoder_options);
+      return *this;
+    }
+    Options&& set_chunk_decoder_options(
+        const ChunkDecoder::Options& chunk_decoder_options) && {
+      return std::move(set_chunk_decoder_options(chunk_decoder_options));
+    }
+    Options&& set_chunk_decoder_options(
+        ChunkDecoder::Options&& chunk_decoder_options) && {
+      return std::move(
+          set_chunk_decoder_options(std::move(chunk_decoder_options)));
+    }
+    ChunkDecoder::Options& chunk_decoder_options() {
+      return chunk_decoder_options_;
+    }
+    const ChunkDecoder::Options& chunk_decoder_options() const {
+      return chunk_decoder_options_;
+    }
+
+    // Options for opening the file, and for reading it by each `Cursor`.
+    // `FdReaderBase::Options::independent_pos()` is overridden, because
+    // cursors share the file descriptor.
+    //
+    // Default: `FdReaderBase::Options()`.
+    Options& set_fd_reader_options(
+        const FdReaderBase::Options& fd_reader_options) & {
+      fd_reader_options_ = fd_reader_options;
+      return *this;
+    }
+    Options&& set_fd_reader_options(
+        const FdReaderBase::Options& fd_reader_options) && {
+      return std::move(set_fd_reader_options(fd_reader_options));
+    }
+    FdReaderBase::Options& fd_reader_options() { return fd_reader_options_; }
+    const FdReaderBase::Options& fd_reader_options() const {
+      return fd_reader_options_;
+    }
+
+    // Sets the cache of decoded chunks, which can be shared with other files
+    // and with `RecordReader`s. The `ChunkCache` must outlive the
+    // `SharedRecordFile`.
+    //
+    // `nullptr` uses a private `ChunkCache` with default options.
+    //
+    // Default: `nullptr`.
+    Options& set_chunk_cache(ChunkCache* chunk_cache) & {
+      chunk_cache_ = chunk_cache;
+      return *this;
+    }
+    Options&& set_chunk_cache(ChunkCache* chunk_cache) && {
+      return std::move(set_chunk_cache(chunk_cache));
+    }
+    ChunkCache* chunk_cache() const { return chunk_cache_; }
+
+    // Sets the key identifying the file in the chunk cache. Users of the same
+    // key must decode chunks with the same field projection.
+    //
+    // `absl::nullopt` uses the filename.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_cache_key(absl::optional<std::string> cache_key) & {
+      cache_key_ = std::move(cache_key);
+      return *this;
+    }
+    Options&& set_cache_key(absl::optional<std::string> cache_key) && {
+      return std::move(set_cache_key(std::move(cache_key)));
+    }
+    absl::optional<std::string>& cache_key() { return cache_key_; }
+    const absl::optional<std::string>& cache_key() const { return cache_key_; }
+
+   private:
+    ChunkDecoder::Options chunk_decoder_options_;
+    FdReaderBase::Options fd_reader_options_;
+    ChunkCache* chunk_cache_ = nullptr;
+    absl::optional<std::string> cache_key_;
+  };
+
+  // Performs lookups in a `SharedRecordFile` from one thread at a time.
+  class Cursor {
+   public:
+    // Creates a `Cursor` not associated with a file. Lookups fail.
+    Cursor() noexcept {}
+
+    Cursor(Cursor&& that) noexcept = default;
+    Cursor& operator=(Cursor&& that) noexcept = default;
+
+    // Reads the record at `pos`.
+    //
+    // Returns status:
+    //  * `status.ok()`                    - success (`record` is set)
+    //  * `absl::IsNotFound(status)`       - there is no record at `pos`
+    //  * other `!status.ok()`             - failure
+    //
+    // A failed lookup does not affect later lookups.
+    absl::Status ReadRecordAt(RecordPosition pos,
+                              google::protobuf::MessageLite& record);
+    absl::Status ReadRecordAt(RecordPosition pos, std::string& record);
+    absl::Status ReadRecordAt(RecordPosition pos, Chain& record);
+    absl::Status ReadRecordAt(RecordPosition pos, absl::Cord& record);
+
+   private:
+    friend class SharedRecordFile;
+
+    explicit Cursor(SharedRecordFile* file);
+
+    // Reopens `chunk_reader_` after a failure.
+    void ResetChunkReader();
+
+    // Sets `chunk_` to the decoded chunk beginning at `chunk_begin`, from the
+    // cache of `*file_` or by reading and decoding it.
+    absl::Status FindChunk(Position chunk_begin);
+
+    template <typename Record>
+    absl::Status ReadRecordAtImpl(RecordPosition pos, Record& record);
+
+    SharedRecordFile* file_ = nullptr;
+    DefaultChunkReader<FdReader<UnownedFd>> chunk_reader_;
+    ChunkDecoder chunk_decoder_;
+    // The chunk of the last lookup, kept to avoid consulting the cache when
+    // the next lookup is in the same chunk.
+    Position chunk_begin_ = 0;
+    std::shared_ptr<const DecodedChunk> chunk_;
+  };
+
+  // Creates a closed `SharedRecordFile`.
+  SharedRecordFile() noexcept : Object(kInitiallyClosed) {}
+
+  // Opens the file named by `filename` for reading.
+  explicit SharedRecordFile(absl::string_view filename,
+                            Options options = Options());
+
+  SharedRecordFile(const SharedRecordFile&) = delete;
+  SharedRecordFile& operator=(const SharedRecordFile&) = delete;
+
+  // Returns the name of the file being read. Unchanged by `Close()`.
+  const std::string& filename() const { return file_.filename(); }
+
+  // Returns a new `Cursor` for lookups in this file.
+  Cursor NewCursor();
+
+  // Finds the position of the record with the given index in the file.
+  //
+  // The chunk index is loaded on the first call, from the chunk index written
+  // with `RecordWriterBase::Options::set_chunk_index()` if present, otherwise
+  // by reading chunk headers of the whole file.
+  //
+  // Returns status:
+  //  * `status.ok()`              - success (`pos` is set)
+  //  * `absl::IsNotFound(status)` - `record_index` is out of range
+  //  * other `!status.ok()`       - failure
+  absl::Status FindRecord(uint64_t record_index, RecordPosition& pos);
+
+  // Returns the chunk index, loading it as by `FindRecord()` if needed. Once
+  // loaded, it does not change until the `SharedRecordFile` is closed.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success (`chunk_index` is set)
+  //  * `!status.ok()` - failure
+  absl::Status GetChunkIndex(const ChunkIndex*& chunk_index);
+
+ protected:
+  void Done() override;
+
+ private:
+  absl::Status LoadChunkIndex() ABSL_EXCLUSIVE_LOCKS_REQUIRED(index_mutex_);
+
+  // Owns the file descriptor shared by cursors. Not read from directly.
+  FdReader<> file_;
+  FdReaderBase::Options fd_reader_options_;
+  ChunkDecoder::Options chunk_decoder_options_;
+  // Set if `Options::chunk_cache()` was `nullptr`.
+  std::unique_ptr<ChunkCache> owned_chunk_cache_;
+  ChunkCache* chunk_cache_ = nullptr;
+  std::string cache_key_;
+
+  absl::Mutex index_mutex_;
+  bool chunk_index_loaded_ ABSL_GUARDED_BY(index_mutex_) = false;
+  ChunkIndex chunk_index_ ABSL_GUARDED_BY(index_mutex_);
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SHARED_RECORD_FILE_H_
@@ -0,0 +1,187 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/sidecar_index.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/hash.h"
+#include "riegeli/records/chunk_header_scan.h"
+#include "riegeli/records/chunk_index.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/varint/varint_reading.h"
+#include "riegeli/varint/varint_writing.h"
+
+namespace riegeli {
+
+namespace {
+
+constexpr absl::string_view kSignature = "RiegIdx1";
+
+absl::Status BuildSidecarIndexWithKeys(Reader& src, SidecarIndex& index,
+                                       const SidecarIndexOptions& options) {
+  DefaultChunkReader<Reader*> chunk_reader(&src);
+  ChunkDecoder chunk_decoder;
+  Chunk chunk;
+  std::vector<uint64_t> key_hashes;
+  for (;;) {
+    const Position chunk_begin = chunk_reader.pos();
+    if (!chunk_reader.ReadChunk(chunk)) {
+      if (ABSL_PREDICT_FALSE(!chunk_reader.healthy())) {
+        return chunk_reader.status();
+      }
+      // The end of file, or the last chunk is truncated.
+      break;
+    }
+    index.index_end = chunk_reader.pos();
+    if (chunk.header.num_records() == 0) continue;
+    if (ABSL_PREDICT_FALSE(!chunk_decoder.Decode(chunk))) {
+      return chunk_decoder.status();
+    }
+    std::string min_key;
+    std::string max_key;
+    bool first = true;
+    absl::string_view record;
+    while (chunk_decoder.ReadRecord(record)) {
+      std::string key = options.chunk_key()(record);
+      if (options.chunk_key_filter_bits() > 0) {
+        key_hashes.push_back(ChunkIndex::KeyHash(key));
+      }
+      if (first) {
+        min_key = key;
+        max_key = std::move(key);
+        first = false;
+      } else if (key < min_key) {
+        min_key = std::move(key);
+      } else if (key > max_key) {
+        max_key = std::move(key);
+      }
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_decoder.healthy())) {
+      return chunk_decoder.status();
+    }
+    std::string key_filter;
+    if (options.chunk_key_filter_bits() > 0) {
+      key_filter = ChunkIndex::BuildKeyFilter(key_hashes,
+                                              options.chunk_key_filter_bits());
+      key_hashes.clear();
+    }
+    index.chunk_index.Add(chunk_begin, chunk.header.num_records(),
+                          std::move(min_key), std::move(max_key),
+                          std::move(key_filter));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status BuildSidecarIndex(Reader& src, SidecarIndex& index,
+                               const SidecarIndexOptions& options) {
+  RIEGELI_ASSERT(src.SupportsRandomAccess())
+      << "Failed precondition of BuildSidecarIndex(): "
+         "source does not support random access";
+  index.chunk_index.Clear();
+  index.index_end = 0;
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) return src.status();
+  index.indexed_size = *size;
+  if (options.chunk_key() != nullptr) {
+    if (ABSL_PREDICT_FALSE(!src.Seek(0))) return src.status();
+    return BuildSidecarIndexWithKeys(src, index, options);
+  }
+  std::vector<ScannedChunkHeader> chunks;
+  const absl::Status status = ScanChunkHeaders(src, chunks);
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  for (const ScannedChunkHeader& chunk : chunks) {
+    index.chunk_index.Add(chunk.begin, chunk.num_records);
+  }
+  if (!chunks.empty()) index.index_end = chunks.back().end;
+  return absl::OkStatus();
+}
+
+absl::Status WriteSidecarIndex(const SidecarIndex& index, Writer& dest) {
+  Chunk chunk;
+  index.chunk_index.EncodeChunk(index.index_end, chunk);
+  dest.Write(kSignature);
+  WriteVarint64(index.indexed_size, dest);
+  WriteVarint64(index.index_end, dest);
+  if (ABSL_PREDICT_FALSE(!chunk.WriteTo(dest))) return dest.status();
+  return absl::OkStatus();
+}
+
+absl::Status ReadSidecarIndex(Reader& src, SidecarIndex& index) {
+  std::string signature;
+  if (ABSL_PREDICT_FALSE(!src.Read(kSignature.size(), signature) ||
+                         signature != kSignature)) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+    return absl::InvalidArgumentError("Not a sidecar index");
+  }
+  const absl::optional<uint64_t> indexed_size = ReadVarint64(src);
+  if (ABSL_PREDICT_FALSE(indexed_size == absl::nullopt)) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+    return absl::DataLossError("Reading indexed size failed");
+  }
+  const absl::optional<uint64_t> index_end = ReadVarint64(src);
+  if (ABSL_PREDICT_FALSE(index_end == absl::nullopt)) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+    return absl::DataLossError("Reading index end failed");
+  }
+  Chunk chunk;
+  if (ABSL_PREDICT_FALSE(
+          !src.Read(chunk.header.size(), chunk.header.bytes()))) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+    return absl::DataLossError("Truncated sidecar index");
+  }
+  if (ABSL_PREDICT_FALSE(chunk.header.computed_header_hash() !=
+                         chunk.header.stored_header_hash())) {
+    return absl::DataLossError("Corrupted sidecar index header");
+  }
+  if (ABSL_PREDICT_FALSE(!src.Read(chunk.header.data_size(), chunk.data))) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+    return absl::DataLossError("Truncated sidecar index");
+  }
+  if (ABSL_PREDICT_FALSE(internal::HashLike(chunk.header.data_hash(),
+                                            chunk.data) !=
+                         chunk.header.data_hash())) {
+    return absl::DataLossError("Corrupted sidecar index data");
+  }
+  if (ABSL_PREDICT_FALSE(*index_end > *indexed_size)) {
+    return absl::DataLossError("Inconsistent sidecar index");
+  }
+  {
+    const absl::Status status =
+        index.chunk_index.DecodeChunk(chunk, *index_end);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  index.indexed_size = *indexed_size;
+  index.index_end = *index_end;
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,131 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SIDECAR_INDEX_H_
+#define RIEGELI_RECORDS_SIDECAR_INDEX_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/records/chunk_index.h"
+
+namespace riegeli {
+
+// A chunk index of a Riegeli/records file stored in a separate file, usually
+// named like the indexed file with ".idx" appended. This provides what
+// `RecordWriterBase::Options::chunk_index()` and `chunk_key()` provide for
+// files written without them, without rewriting these files.
+//
+// `RecordReaderBase::Options::set_sidecar_index()` makes `RecordReader` use it
+// instead of looking for a chunk index at the end of the file.
+struct SidecarIndex {
+  // The size of the indexed file. The index is not used for a file of a
+  // different size, because it is likely stale.
+  Position indexed_size = 0;
+  // The position after the last complete chunk of the indexed file.
+  Position index_end = 0;
+  ChunkIndex chunk_index;
+};
+
+class SidecarIndexOptions {
+ public:
+  SidecarIndexOptions() noexcept {}
+
+  // If not `nullptr`, the smallest and largest keys of records in each chunk
+  // are stored in the index, like with
+  // `RecordWriterBase::Options::chunk_key()`.
+  //
+  // This requires reading and decoding all chunks. Otherwise only chunk headers
+  // are read.
+  //
+  // Default: `nullptr`.
+  SidecarIndexOptions& set_chunk_key(
+      std::function<std::string(absl::string_view record)> chunk_key) & {
+    chunk_key_ = std::move(chunk_key);
+    return *this;
+  }
+  SidecarIndexOptions&& set_chunk_key(
+      std::function<std::string(absl::string_view record)> chunk_key) && {
+    return std::move(set_chunk_key(std::move(chunk_key)));
+  }
+  const std::function<std::string(absl::string_view record)>& chunk_key()
+      const {
+    return chunk_key_;
+  }
+
+  // If `chunk_key_filter_bits > 0` and `chunk_key()` is not `nullptr`, a Bloom
+  // filter of keys of records in each chunk is stored in the index too, like
+  // with `RecordWriterBase::Options::chunk_key_filter_bits()`.
+  //
+  // Default: 0.
+  SidecarIndexOptions& set_chunk_key_filter_bits(int chunk_key_filter_bits) & {
+    RIEGELI_ASSERT_GE(chunk_key_filter_bits, 0)
+        << "Failed precondition of "
+           "SidecarIndexOptions::set_chunk_key_filter_bits(): "
+           "negative bits per key";
+    chunk_key_filter_bits_ = chunk_key_filter_bits;
+    return *this;
+  }
+  SidecarIndexOptions&& set_chunk_key_filter_bits(
+      int chunk_key_filter_bits) && {
+    return std::move(set_chunk_key_filter_bits(chunk_key_filter_bits));
+  }
+  int chunk_key_filter_bits() const { return chunk_key_filter_bits_; }
+
+ private:
+  std::function<std::string(absl::string_view record)> chunk_key_;
+  int chunk_key_filter_bits_ = 0;
+};
+
+// Builds a `SidecarIndex` of the Riegeli/records file read from `src`.
+//
+// Without `options.chunk_key()`, only chunk headers are read, with
+// `ScanChunkHeaders()`.
+//
+// Precondition: `src.SupportsRandomAccess()`
+//
+// Returns status:
+//  * `status.ok()`  - success (`index` is set)
+//  * `!status.ok()` - failure (`index` is unspecified)
+absl::Status BuildSidecarIndex(
+    Reader& src, SidecarIndex& index,
+    const SidecarIndexOptions& options = SidecarIndexOptions());
+
+// Writes `index` to `dest`.
+//
+// The format is a signature, varints `indexed_size` and `index_end`, and the
+// chunk index encoded as a chunk of type `ChunkType::kChunkIndex` as if it was
+// appended to the indexed file at `index_end`, protected by its hashes.
+//
+// Returns status:
+//  * `status.ok()`  - success
+//  * `!status.ok()` - failure
+absl::Status WriteSidecarIndex(const SidecarIndex& index, Writer& dest);
+
+// Reads an index written by `WriteSidecarIndex()` from `src`.
+//
+// Returns status:
+//  * `status.ok()`  - success (`index` is set)
+//  * `!status.ok()` - failure (`index` is unspecified)
+absl::Status ReadSidecarIndex(Reader& src, SidecarIndex& index);
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SIDECAR_INDEX_H_
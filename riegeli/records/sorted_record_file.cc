@@ -0,0 +1,222 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/sorted_record_file.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/records/chunk_index.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/shared_record_file.h"
+
+namespace riegeli {
+
+SortedRecordFile::SortedRecordFile(absl::string_view filename,
+                                   Options options)
+    : Object(kInitiallyOpen),
+      key_(std::move(options.key())),
+      file_(filename, std::move(options.shared_record_file_options())) {
+  RIEGELI_ASSERT(key_ != nullptr)
+      << "Failed precondition of SortedRecordFile: no key function";
+  if (ABSL_PREDICT_FALSE(!file_.healthy())) Fail(file_);
+}
+
+void SortedRecordFile::Done() {
+  if (ABSL_PREDICT_FALSE(!file_.Close())) Fail(file_);
+}
+
+SortedRecordFile::Cursor SortedRecordFile::NewCursor() { return Cursor(this); }
+
+absl::Status SortedRecordFile::LoadLevels() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return status();
+  absl::MutexLock lock(&levels_mutex_);
+  if (levels_loaded_) return absl::OkStatus();
+  const ChunkIndex* chunk_index;
+  {
+    const absl::Status status = file_.GetChunkIndex(chunk_index);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  std::vector<std::string> first_keys;
+  first_keys.reserve(chunk_index->num_chunks());
+  if (chunk_index->has_keys()) {
+    // In a sorted file the smallest key of a chunk is the key of its first
+    // record.
+    for (size_t i = 0; i < chunk_index->num_chunks(); ++i) {
+      first_keys.emplace_back(chunk_index->min_key(i));
+    }
+  } else {
+    SharedRecordFile::Cursor cursor = file_.NewCursor();
+    std::string record;
+    for (size_t i = 0; i < chunk_index->num_chunks(); ++i) {
+      const absl::Status status = cursor.ReadRecordAt(
+          RecordPosition(chunk_index->chunk_begin(i), 0), record);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+      first_keys.push_back(key_(record));
+    }
+  }
+  chunk_index_ = chunk_index;
+  first_keys_ = std::move(first_keys);
+  levels_loaded_ = true;
+  return absl::OkStatus();
+}
+
+SortedRecordFile::Cursor::Cursor(SortedRecordFile* file)
+    : file_(file), cursor_(file->file_.NewCursor()) {}
+
+inline absl::Status SortedRecordFile::Cursor::ReadAt(Location location,
+                                                     std::string& record,
+                                                     std::string& record_key) {
+  const absl::Status status = cursor_.ReadRecordAt(
+      RecordPosition(file_->chunk_index_->chunk_begin(location.chunk_index),
+                     location.record_index),
+      record);
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  record_key = file_->key_(record);
+  return absl::OkStatus();
+}
+
+inline absl::Status SortedRecordFile::Cursor::LowerBound(absl::string_view key,
+                                                         Location& location) {
+  const std::vector<std::string>& first_keys = file_->first_keys_;
+  // The number of chunks whose first key is less than `key`.
+  const size_t num_less = IntCast<size_t>(
+      std::lower_bound(first_keys.begin(), first_keys.end(), key,
+                       [](const std::string& first_key, absl::string_view key) {
+                         return first_key < key;
+                       }) -
+      first_keys.begin());
+  if (num_less == 0) {
+    location = Location{0, 0};
+    return absl::OkStatus();
+  }
+  // The answer is in the last chunk whose first key is less than `key`, after
+  // its first record, or it is the first record of the next chunk.
+  const size_t chunk_index = num_less - 1;
+  uint64_t low = 1;
+  uint64_t high = file_->chunk_index_->chunk_num_records(chunk_index);
+  std::string record;
+  std::string record_key;
+  while (low < high) {
+    const uint64_t middle = low + (high - low) / 2;
+    const absl::Status status =
+        ReadAt(Location{chunk_index, middle}, record, record_key);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    if (record_key < key) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low < file_->chunk_index_->chunk_num_records(chunk_index)) {
+    location = Location{chunk_index, low};
+  } else {
+    location = Location{chunk_index + 1, 0};
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SortedRecordFile::Cursor::Lookup(absl::string_view key,
+                                              std::string& record) {
+  if (ABSL_PREDICT_FALSE(file_ == nullptr)) {
+    return absl::FailedPreconditionError("Cursor not associated with a file");
+  }
+  {
+    const absl::Status status = file_->LoadLevels();
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  Location location;
+  {
+    const absl::Status status = LowerBound(key, location);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (location.chunk_index < file_->chunk_index_->num_chunks()) {
+    std::string record_key;
+    const absl::Status status = ReadAt(location, record, record_key);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    if (record_key == key) return absl::OkStatus();
+  }
+  return absl::NotFoundError(absl::StrCat("Key not found: ", key));
+}
+
+absl::Status SortedRecordFile::Cursor::LookupBatch(
+    absl::Span<const absl::string_view> keys,
+    std::vector<absl::optional<std::string>>& records) {
+  records.clear();
+  records.resize(keys.size());
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+  std::string record;
+  for (const size_t i : order) {
+    const absl::Status status = Lookup(keys[i], record);
+    if (status.ok()) {
+      records[i] = record;
+    } else if (ABSL_PREDICT_FALSE(!absl::IsNotFound(status))) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SortedRecordFile::Cursor::ReadRange(
+    absl::string_view begin_key, absl::string_view end_key,
+    std::vector<std::string>& records) {
+  if (ABSL_PREDICT_FALSE(file_ == nullptr)) {
+    return absl::FailedPreconditionError("Cursor not associated with a file");
+  }
+  {
+    const absl::Status status = file_->LoadLevels();
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  Location location;
+  {
+    const absl::Status status = LowerBound(begin_key, location);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  const ChunkIndex& chunk_index = *file_->chunk_index_;
+  std::string record;
+  std::string record_key;
+  while (location.chunk_index < chunk_index.num_chunks()) {
+    if (location.record_index == 0 &&
+        file_->first_keys_[location.chunk_index] >= end_key) {
+      break;
+    }
+    const absl::Status status = ReadAt(location, record, record_key);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    if (record_key >= end_key) break;
+    records.push_back(std::move(record));
+    if (++location.record_index ==
+        chunk_index.chunk_num_records(location.chunk_index)) {
+      location = Location{location.chunk_index + 1, 0};
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,239 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SORTED_RECORD_FILE_H_
+#define RIEGELI_RECORDS_SORTED_RECORD_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/records/chunk_index.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/shared_record_file.h"
+
+namespace riegeli {
+
+// `SortedRecordFile` serves lookups by key in a Riegeli/records file sorted by
+// keys (e.g. written by `SortingRecordWriter`), from many threads at once.
+// This makes the file a read-only key-value store without a separate index.
+//
+// The upper level of the search, i.e. positions of chunks together with the
+// first key of each chunk, is loaded on the first lookup and kept in memory.
+// First keys come from the chunk index if the file was written with
+// `RecordWriterBase::Options::chunk_key()`, otherwise the first record of
+// each chunk is read once. The lower level is a binary search among records
+// of a chunk, which is decoded once and shared through the chunk cache of the
+// underlying `SharedRecordFile`.
+//
+// ```
+//   riegeli::SortedRecordFile file(
+//       filename, riegeli::SortedRecordFile::Options().set_key(key));
+//   if (!file.healthy()) ... Failed with reason: file.status()
+//
+//   // In each thread:
+//   riegeli::SortedRecordFile::Cursor cursor = file.NewCursor();
+//   std::string record;
+//   const absl::Status status = cursor.Lookup(key, record);
+// ```
+//
+// Functions of `SortedRecordFile` are thread-safe. A `Cursor` is not: it
+// should be used by one thread at a time. The `SortedRecordFile` must outlive
+// its cursors.
+class SortedRecordFile : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets a function which extracts a key from a record (serialized, if the
+    // record is a proto message). Keys are compared as byte strings.
+    //
+    // This must be set, consistently with the order of the file.
+    Options& set_key(
+        const std::function<std::string(absl::string_view record)>& key) & {
+      key_ = key;
+      return *this;
+    }
+    Options& set_key(
+        std::function<std::string(absl::string_view record)>&& key) & {
+      key_ = std::move(key);
+      return *this;
+    }
+    Options&& set_key(
+        const std::function<std::string(absl::string_view record)>& key) && {
+      return std::move(set_key(key));
+    }
+    Options&& set_key(
+        std::function<std::string(absl::string_view record)>&& key) && {
+      return std::move(set_key(std::move(key)));
+    }
+    std::function<std::string(absl::string_view record)>& key() {
+      return key_;
+    }
+    const std::function<std::string(absl::string_view record)>& key() const {
+      return key_;
+    }
+
+    // Options of the underlying `SharedRecordFile`, including its chunk cache.
+    //
+    // Default: `SharedRecordFile::Options()`.
+    Options& set_shared_record_file_options(
+        const SharedRecordFile::Options& shared_record_file_options) & {
+      shared_record_file_options_ = shared_record_file_options;
+      return *this;
+    }
+    Options& set_shared_record_file_options(
+        SharedRecordFile::Options&& shared_record_file_options) & {
+      shared_record_file_options_ = std::move(shared_record_file_options);
+      return *this;
+    }
+    Options&& set_shared_record_file_options(
+        const SharedRecordFile::Options& shared_record_file_options) && {
+      return std::move(
+          set_shared_record_file_options(shared_record_file_options));
+    }
+    Options&& set_shared_record_file_options(
+        SharedRecordFile::Options&& shared_record_file_options) && {
+      return std::move(set_shared_record_file_options(
+          std::move(shared_record_file_options)));
+    }
+    SharedRecordFile::Options& shared_record_file_options() {
+      return shared_record_file_options_;
+    }
+    const SharedRecordFile::Options& shared_record_file_options() const {
+      return shared_record_file_options_;
+    }
+
+   private:
+    std::function<std::string(absl::string_view record)> key_;
+    SharedRecordFile::Options shared_record_file_options_;
+  };
+
+  // Performs lookups in a `SortedRecordFile` from one thread at a time.
+  class Cursor {
+   public:
+    // Creates a `Cursor` not associated with a file. Lookups fail.
+    Cursor() noexcept {}
+
+    Cursor(Cursor&& that) noexcept = default;
+    Cursor& operator=(Cursor&& that) noexcept = default;
+
+    // Reads the first record with `key`.
+    //
+    // Returns status:
+    //  * `status.ok()`              - success (`record` is set)
+    //  * `absl::IsNotFound(status)` - there is no record with `key`
+    //  * other `!status.ok()`       - failure
+    absl::Status Lookup(absl::string_view key, std::string& record);
+
+    // Like `Lookup()` for each of `keys`, setting the corresponding element of
+    // `records` (resized to `keys.size()`), or `absl::nullopt` if there is no
+    // record with that key.
+    //
+    // Keys are looked up in sorted order, so that lookups falling into the
+    // same chunk find it already decoded.
+    //
+    // Returns status:
+    //  * `status.ok()`  - success (`records` are set)
+    //  * `!status.ok()` - failure
+    absl::Status LookupBatch(absl::Span<const absl::string_view> keys,
+                             std::vector<absl::optional<std::string>>& records);
+
+    // Reads records with keys in [`begin_key`, `end_key`), appending them to
+    // `records` in the order of the file.
+    //
+    // Returns status:
+    //  * `status.ok()`  - success
+    //  * `!status.ok()` - failure (`records` may have been partially appended)
+    absl::Status ReadRange(absl::string_view begin_key,
+                           absl::string_view end_key,
+                           std::vector<std::string>& records);
+
+   private:
+    friend class SortedRecordFile;
+
+    // A record position expressed as an index of a chunk in the chunk index
+    // and an index of a record in the chunk.
+    struct Location {
+      size_t chunk_index;
+      uint64_t record_index;
+    };
+
+    explicit Cursor(SortedRecordFile* file);
+
+    // Reads the record at `location`, together with its key.
+    absl::Status ReadAt(Location location, std::string& record,
+                        std::string& record_key);
+
+    // Finds the first record whose key is not less than `key`, setting
+    // `location`, or `location.chunk_index == num_chunks()` if there is none.
+    absl::Status LowerBound(absl::string_view key, Location& location);
+
+    SortedRecordFile* file_ = nullptr;
+    SharedRecordFile::Cursor cursor_;
+  };
+
+  // Creates a closed `SortedRecordFile`.
+  SortedRecordFile() noexcept : Object(kInitiallyClosed) {}
+
+  // Opens the file named by `filename` for reading.
+  //
+  // Precondition: `options.key() != nullptr`
+  explicit SortedRecordFile(absl::string_view filename,
+                            Options options = Options());
+
+  SortedRecordFile(const SortedRecordFile&) = delete;
+  SortedRecordFile& operator=(const SortedRecordFile&) = delete;
+
+  // Returns the name of the file being read. Unchanged by `Close()`.
+  const std::string& filename() const { return file_.filename(); }
+
+  // Returns a new `Cursor` for lookups in this file.
+  Cursor NewCursor();
+
+ protected:
+  void Done() override;
+
+ private:
+  // Loads `chunk_index_` and `first_keys_` if needed.
+  absl::Status LoadLevels();
+
+  std::function<std::string(absl::string_view record)> key_;
+  SharedRecordFile file_;
+
+  absl::Mutex levels_mutex_;
+  bool levels_loaded_ ABSL_GUARDED_BY(levels_mutex_) = false;
+  // Owned by `file_`. Constant after `levels_loaded_` is set.
+  const ChunkIndex* chunk_index_ = nullptr;
+  // The key of the first record of each chunk of `*chunk_index_`. Constant
+  // after `levels_loaded_` is set.
+  std::vector<std::string> first_keys_;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SORTED_RECORD_FILE_H_
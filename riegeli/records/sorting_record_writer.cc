@@ -0,0 +1,294 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/sorting_record_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/messages/message_serialize.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+namespace {
+
+// Sorts `entries` by keys and writes their records to `filename`.
+template <typename Entry>
+absl::Status WriteRun(std::vector<Entry>& entries, const std::string& filename,
+                      const RecordWriterBase::Options& run_options) {
+  std::stable_sort(
+      entries.begin(), entries.end(),
+      [](const Entry& a, const Entry& b) { return a.key < b.key; });
+  RecordWriter<FdWriter<>> writer(
+      std::forward_as_tuple(filename, O_WRONLY | O_TRUNC), run_options);
+  for (Entry& entry : entries) {
+    if (ABSL_PREDICT_FALSE(!writer.WriteRecord(std::move(entry.record)))) {
+      break;
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!writer.Close())) return writer.status();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+SortingRecordWriter::SortingRecordWriter(RecordWriterBase* dest,
+                                         Options options)
+    : Object(kInitiallyOpen),
+      dest_(RIEGELI_ASSERT_NOTNULL(dest)),
+      options_(std::move(options)),
+      spilling_(std::make_unique<Spilling>()) {
+  RIEGELI_ASSERT(options_.key() != nullptr)
+      << "Failed precondition of SortingRecordWriter: no key function";
+}
+
+SortingRecordWriter::~SortingRecordWriter() {
+  WaitForRuns().IgnoreError();
+  RemoveRunFiles();
+}
+
+void SortingRecordWriter::Reset() {
+  WaitForRuns().IgnoreError();
+  RemoveRunFiles();
+  Object::Reset(kInitiallyClosed);
+  dest_ = nullptr;
+  options_ = Options();
+  buffer_ = std::vector<Entry>();
+  buffer_size_ = 0;
+  spilling_.reset();
+}
+
+void SortingRecordWriter::Reset(RecordWriterBase* dest, Options options) {
+  RIEGELI_ASSERT(options.key() != nullptr)
+      << "Failed precondition of SortingRecordWriter::Reset(): "
+         "no key function";
+  WaitForRuns().IgnoreError();
+  RemoveRunFiles();
+  Object::Reset(kInitiallyOpen);
+  dest_ = RIEGELI_ASSERT_NOTNULL(dest);
+  options_ = std::move(options);
+  buffer_.clear();
+  buffer_size_ = 0;
+  spilling_ = std::make_unique<Spilling>();
+}
+
+void SortingRecordWriter::Done() {
+  if (ABSL_PREDICT_TRUE(healthy())) {
+    if (run_filenames_.empty()) {
+      // All records fit in memory. Write them directly.
+      std::stable_sort(
+          buffer_.begin(), buffer_.end(),
+          [](const Entry& a, const Entry& b) { return a.key < b.key; });
+      for (Entry& entry : buffer_) {
+        if (ABSL_PREDICT_FALSE(!dest_->WriteRecord(std::move(entry.record)))) {
+          Fail(*dest_);
+          break;
+        }
+      }
+    } else if (SpillRun()) {
+      const absl::Status status = WaitForRuns();
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        Fail(status);
+      } else {
+        MergeRuns();
+      }
+    }
+  }
+  WaitForRuns().IgnoreError();
+  RemoveRunFiles();
+  buffer_ = std::vector<Entry>();
+  buffer_size_ = 0;
+}
+
+bool SortingRecordWriter::WriteRecord(
+    const google::protobuf::MessageLite& record,
+    SerializeOptions serialize_options) {
+  std::string serialized;
+  {
+    absl::Status status =
+        SerializeToString(record, serialized, std::move(serialize_options));
+    if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+  }
+  return WriteRecordImpl(std::move(serialized));
+}
+
+bool SortingRecordWriter::WriteRecordImpl(std::string&& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  std::string key = options_.key()(record);
+  buffer_size_ += key.size() + record.size() + sizeof(Entry);
+  buffer_.push_back(Entry{std::move(key), std::move(record)});
+  if (buffer_size_ >= options_.max_run_size()) return SpillRun();
+  return true;
+}
+
+inline bool SortingRecordWriter::CreateRunFile() {
+  std::string filename = options_.temp_directory();
+  if (filename.empty()) {
+    const char* const tmpdir = getenv("TMPDIR");
+    filename = tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
+  }
+  filename.append("/riegeli_sort_XXXXXX");
+  const int fd = mkstemp(&filename[0]);
+  if (ABSL_PREDICT_FALSE(fd < 0)) {
+    const int error_number = errno;
+    return Fail(ErrnoToCanonicalStatus(
+        error_number, absl::StrCat("mkstemp() failed for ", filename)));
+  }
+  close(fd);
+  run_filenames_.push_back(std::move(filename));
+  return true;
+}
+
+inline bool SortingRecordWriter::SpillRun() {
+  if (ABSL_PREDICT_FALSE(!CreateRunFile())) return false;
+  const std::string& filename = run_filenames_.back();
+  if (options_.parallelism() == 0) {
+    absl::Status status = WriteRun(buffer_, filename, options_.run_options());
+    buffer_.clear();
+    buffer_size_ = 0;
+    if (ABSL_PREDICT_FALSE(!status.ok())) return Fail(std::move(status));
+    return true;
+  }
+  Spilling* const spilling = spilling_.get();
+  {
+    absl::MutexLock lock(&spilling->mutex);
+    struct Args {
+      const Spilling* spilling;
+      int parallelism;
+    } args = {spilling, options_.parallelism()};
+    spilling->mutex.Await(absl::Condition(
+        +[](Args* args) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+          return args->spilling->num_pending < args->parallelism;
+        },
+        &args));
+    if (ABSL_PREDICT_FALSE(!spilling->status.ok())) {
+      return Fail(spilling->status);
+    }
+    ++spilling->num_pending;
+  }
+  // Owned by the task.
+  std::vector<Entry>* const entries =
+      new std::vector<Entry>(std::move(buffer_));
+  buffer_ = std::vector<Entry>();
+  buffer_size_ = 0;
+  ThreadPool& thread_pool = options_.thread_pool() != nullptr
+                                ? *options_.thread_pool()
+                                : ThreadPool::global();
+  thread_pool.Schedule([spilling, entries, filename,
+                        run_options = options_.run_options()] {
+    std::unique_ptr<std::vector<Entry>> owned_entries(entries);
+    absl::Status status = WriteRun(*owned_entries, filename, run_options);
+    owned_entries.reset();
+    absl::MutexLock lock(&spilling->mutex);
+    if (ABSL_PREDICT_FALSE(!status.ok()) && spilling->status.ok()) {
+      spilling->status = std::move(status);
+    }
+    --spilling->num_pending;
+  });
+  return true;
+}
+
+absl::Status SortingRecordWriter::WaitForRuns() {
+  if (spilling_ == nullptr) return absl::OkStatus();
+  absl::MutexLock lock(&spilling_->mutex);
+  spilling_->mutex.Await(absl::Condition(
+      +[](Spilling* spilling) ABSL_NO_THREAD_SAFETY_ANALYSIS {
+        return spilling->num_pending == 0;
+      },
+      spilling_.get()));
+  return spilling_->status;
+}
+
+inline bool SortingRecordWriter::MergeRuns() {
+  // A run with its next record, ordered by key and then by run index, so that
+  // records with equal keys keep their relative order.
+  struct Head {
+    std::string key;
+    size_t run_index;
+  };
+  const auto greater = [](const Head& a, const Head& b) {
+    return a.key != b.key ? a.key > b.key : a.run_index > b.run_index;
+  };
+  std::vector<RecordReader<FdReader<>>> readers;
+  readers.reserve(run_filenames_.size());
+  std::vector<std::string> records(run_filenames_.size());
+  std::vector<Head> heap;
+  heap.reserve(run_filenames_.size());
+  for (size_t run_index = 0; run_index < run_filenames_.size(); ++run_index) {
+    readers.emplace_back(
+        std::forward_as_tuple(run_filenames_[run_index], O_RDONLY));
+    RecordReader<FdReader<>>& reader = readers.back();
+    if (ABSL_PREDICT_FALSE(!reader.ReadRecord(records[run_index]))) {
+      if (ABSL_PREDICT_FALSE(!reader.healthy())) return Fail(reader);
+      continue;
+    }
+    heap.push_back(Head{options_.key()(records[run_index]), run_index});
+  }
+  std::make_heap(heap.begin(), heap.end(), greater);
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), greater);
+    Head& head = heap.back();
+    std::string& record = records[head.run_index];
+    if (ABSL_PREDICT_FALSE(!dest_->WriteRecord(std::move(record)))) {
+      return Fail(*dest_);
+    }
+    RecordReader<FdReader<>>& reader = readers[head.run_index];
+    if (ABSL_PREDICT_FALSE(!reader.ReadRecord(record))) {
+      if (ABSL_PREDICT_FALSE(!reader.healthy())) return Fail(reader);
+      heap.pop_back();
+      continue;
+    }
+    head.key = options_.key()(record);
+    std::push_heap(heap.begin(), heap.end(), greater);
+  }
+  for (RecordReader<FdReader<>>& reader : readers) {
+    if (ABSL_PREDICT_FALSE(!reader.Close())) return Fail(reader);
+  }
+  return true;
+}
+
+void SortingRecordWriter::RemoveRunFiles() {
+  for (const std::string& filename : run_filenames_) {
+    unlink(filename.c_str());
+  }
+  run_filenames_.clear();
+}
+
+}  // namespace riegeli
@@ -0,0 +1,330 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_SORTING_RECORD_WRITER_H_
+#define RIEGELI_RECORDS_SORTING_RECORD_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/message_lite.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/messages/message_serialize.h"
+#include "riegeli/records/record_writer.h"
+
+namespace riegeli {
+
+// `SortingRecordWriter` writes records to a `RecordWriter` in the order of
+// their keys, regardless of the order in which they are written to the
+// `SortingRecordWriter`. Records with equal keys keep their relative order.
+//
+// Records are buffered in memory. When the buffer exceeds
+// `Options::max_run_size()`, its records are sorted and spilled to a temporary
+// Riegeli/records file (a run). `Close()` merges all runs into the
+// destination. If all records fit in the buffer, no temporary files are used.
+//
+// Setting `RecordWriterBase::Options::chunk_key()` of the destination to the
+// same key function stores the range of keys of each chunk in the chunk index.
+// Because records arrive sorted, ranges of consecutive chunks do not overlap,
+// and `RecordReaderBase::SearchChunkKeys()` can find a key without reading
+// other chunks.
+//
+// The destination is not owned: it is not closed by `Close()`, and it must be
+// valid until `Close()` returns.
+class SortingRecordWriter : public Object {
+ public:
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets a function which extracts a key from a record (serialized, if the
+    // record is a proto message). Keys are compared as byte strings.
+    //
+    // This must be set.
+    Options& set_key(
+        const std::function<std::string(absl::string_view record)>& key) & {
+      key_ = key;
+      return *this;
+    }
+    Options& set_key(
+        std::function<std::string(absl::string_view record)>&& key) & {
+      key_ = std::move(key);
+      return *this;
+    }
+    Options&& set_key(
+        const std::function<std::string(absl::string_view record)>& key) && {
+      return std::move(set_key(key));
+    }
+    Options&& set_key(
+        std::function<std::string(absl::string_view record)>&& key) && {
+      return std::move(set_key(std::move(key)));
+    }
+    std::function<std::string(absl::string_view record)>& key() {
+      return key_;
+    }
+    const std::function<std::string(absl::string_view record)>& key() const {
+      return key_;
+    }
+
+    // Sets the size of records and keys buffered in memory before they are
+    // sorted and spilled as a run.
+    //
+    // With `parallelism() > 0`, up to `parallelism() + 1` buffers can be held
+    // in memory at once.
+    //
+    // Default: 64M.
+    Options& set_max_run_size(uint64_t max_run_size) & {
+      RIEGELI_ASSERT_GT(max_run_size, 0u)
+          << "Failed precondition of "
+             "SortingRecordWriter::Options::set_max_run_size(): "
+             "zero run size";
+      max_run_size_ = max_run_size;
+      return *this;
+    }
+    Options&& set_max_run_size(uint64_t max_run_size) && {
+      return std::move(set_max_run_size(max_run_size));
+    }
+    uint64_t max_run_size() const { return max_run_size_; }
+
+    // Sets the directory where runs are spilled.
+    //
+    // Empty is interpreted as `$TMPDIR`, or `/tmp` if that is not set.
+    //
+    // Default: empty.
+    Options& set_temp_directory(absl::string_view temp_directory) & {
+      temp_directory_ = std::string(temp_directory);
+      return *this;
+    }
+    Options&& set_temp_directory(absl::string_view temp_directory) && {
+      return std::move(set_temp_directory(temp_directory));
+    }
+    const std::string& temp_directory() const { return temp_directory_; }
+
+    // Options for writing runs.
+    //
+    // Default: `RecordWriterBase::Options().set_uncompressed()`, because runs
+    // are read only once.
+    Options& set_run_options(const RecordWriterBase::Options& run_options) & {
+      run_options_ = run_options;
+      return *this;
+    }
+    Options& set_run_options(RecordWriterBase::Options&& run_options) & {
+      run_options_ = std::move(run_options);
+      return *this;
+    }
+    Options&& set_run_options(const RecordWriterBase::Options& run_options) && {
+      return std::move(set_run_options(run_options));
+    }
+    Options&& set_run_options(RecordWriterBase::Options&& run_options) && {
+      return std::move(set_run_options(std::move(run_options)));
+    }
+    RecordWriterBase::Options& run_options() { return run_options_; }
+    const RecordWriterBase::Options& run_options() const {
+      return run_options_;
+    }
+
+    // Sets the maximum number of runs being sorted and spilled in background
+    // while further records are buffered.
+    //
+    // If 0, runs are sorted and spilled by the thread which writes records.
+    //
+    // Default: 0.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "SortingRecordWriter::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+    // Sets the thread pool where runs are sorted and spilled if
+    // `parallelism() > 0`.
+    //
+    // `nullptr` is interpreted as `ThreadPool::global()`.
+    //
+    // Default: `nullptr`.
+    Options& set_thread_pool(ThreadPool* thread_pool) & {
+      thread_pool_ = thread_pool;
+      return *this;
+    }
+    Options&& set_thread_pool(ThreadPool* thread_pool) && {
+      return std::move(set_thread_pool(thread_pool));
+    }
+    ThreadPool* thread_pool() const { return thread_pool_; }
+
+   private:
+    std::function<std::string(absl::string_view record)> key_;
+    uint64_t max_run_size_ = uint64_t{64} << 20;
+    std::string temp_directory_;
+    RecordWriterBase::Options run_options_ =
+        RecordWriterBase::Options().set_uncompressed();
+    int parallelism_ = 0;
+    ThreadPool* thread_pool_ = nullptr;
+  };
+
+  // Creates a closed `SortingRecordWriter`.
+  SortingRecordWriter() noexcept : Object(kInitiallyClosed) {}
+
+  // Will write sorted records to `*dest`.
+  //
+  // Precondition: `options.key() != nullptr`
+  explicit SortingRecordWriter(RecordWriterBase* dest,
+                               Options options = Options());
+
+  SortingRecordWriter(SortingRecordWriter&& that) noexcept;
+  SortingRecordWriter& operator=(SortingRecordWriter&& that) noexcept;
+
+  // Waits for runs being spilled in background and removes temporary files.
+  // Records are written to the destination only by `Close()`.
+  ~SortingRecordWriter();
+
+  // Makes `*this` equivalent to a newly constructed `SortingRecordWriter`.
+  // This avoids constructing a temporary `SortingRecordWriter` and moving from
+  // it.
+  void Reset();
+  void Reset(RecordWriterBase* dest, Options options = Options());
+
+  // Returns the `RecordWriter` being written to. Unchanged by `Close()`.
+  RecordWriterBase* dest() const { return dest_; }
+
+  // Buffers the next record.
+  //
+  // `WriteRecord(google::protobuf::MessageLite)` serializes a proto message to
+  // raw bytes beforehand. If `record.ByteSizeLong()` has been called already,
+  // `serialize_options.set_has_cached_size(true)` avoids computing it again.
+  //
+  // `std::string&&` is accepted with a template to avoid implicit conversions
+  // to `std::string` which can be ambiguous against `absl::string_view`
+  // (e.g. `const char*`).
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool WriteRecord(const google::protobuf::MessageLite& record);
+  bool WriteRecord(const google::protobuf::MessageLite& record,
+                   SerializeOptions serialize_options);
+  bool WriteRecord(absl::string_view record);
+  template <typename Src,
+            std::enable_if_t<std::is_same<Src, std::string>::value, int> = 0>
+  bool WriteRecord(Src&& record);
+
+  // Returns the number of runs spilled so far.
+  size_t num_runs() const { return run_filenames_.size(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  struct Entry {
+    std::string key;
+    std::string record;
+  };
+
+  // State shared with runs being spilled in background.
+  struct Spilling {
+    absl::Mutex mutex;
+    int num_pending ABSL_GUARDED_BY(mutex) = 0;
+    absl::Status status ABSL_GUARDED_BY(mutex);
+  };
+
+  bool WriteRecordImpl(std::string&& record);
+  // Creates a temporary file and appends its name to `run_filenames_`.
+  bool CreateRunFile();
+  // Sorts and spills `buffer_` as a new run.
+  bool SpillRun();
+  // Waits until no runs are being spilled in background.
+  //
+  // Returns status:
+  //  * `status.ok()`  - success (all runs were spilled)
+  //  * `!status.ok()` - failure of spilling some run
+  absl::Status WaitForRuns();
+  // Merges spilled runs into `*dest_`.
+  bool MergeRuns();
+  void RemoveRunFiles();
+
+  RecordWriterBase* dest_ = nullptr;
+  Options options_;
+  std::vector<Entry> buffer_;
+  uint64_t buffer_size_ = 0;
+  std::vector<std::string> run_filenames_;
+  // Invariant: if `!closed()` then `spilling_ != nullptr`
+  std::unique_ptr<Spilling> spilling_;
+};
+
+// Implementation details follow.
+
+inline SortingRecordWriter::SortingRecordWriter(
+    SortingRecordWriter&& that) noexcept
+    : Object(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      dest_(std::exchange(that.dest_, nullptr)),
+      options_(std::move(that.options_)),
+      buffer_(std::move(that.buffer_)),
+      buffer_size_(std::exchange(that.buffer_size_, 0)),
+      run_filenames_(std::move(that.run_filenames_)),
+      spilling_(std::move(that.spilling_)) {}
+
+inline SortingRecordWriter& SortingRecordWriter::operator=(
+    SortingRecordWriter&& that) noexcept {
+  WaitForRuns().IgnoreError();
+  RemoveRunFiles();
+  Object::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  dest_ = std::exchange(that.dest_, nullptr);
+  options_ = std::move(that.options_);
+  buffer_ = std::move(that.buffer_);
+  buffer_size_ = std::exchange(that.buffer_size_, 0);
+  run_filenames_ = std::move(that.run_filenames_);
+  spilling_ = std::move(that.spilling_);
+  return *this;
+}
+
+inline bool SortingRecordWriter::WriteRecord(
+    const google::protobuf::MessageLite& record) {
+  return WriteRecord(record, SerializeOptions());
+}
+
+inline bool SortingRecordWriter::WriteRecord(absl::string_view record) {
+  return WriteRecordImpl(std::string(record));
+}
+
+template <typename Src,
+          std::enable_if_t<std::is_same<Src, std::string>::value, int>>
+inline bool SortingRecordWriter::WriteRecord(Src&& record) {
+  return WriteRecordImpl(std::move(record));
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_SORTING_RECORD_WRITER_H_
@@ -0,0 +1,88 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Builds sidecar chunk indices of existing Riegeli/records files, reading only
+// their chunk headers.
+
+#include <fcntl.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/sidecar_index.h"
+
+ABSL_FLAG(std::string, suffix, ".idx",
+          "Suffix appended to the name of each file to name its index");
+
+namespace riegeli {
+namespace tools {
+namespace {
+
+absl::Status BuildIndexFile(absl::string_view src_filename,
+                            absl::string_view dest_filename) {
+  SidecarIndex index;
+  {
+    FdReader<> src(src_filename, O_RDONLY);
+    const absl::Status status = BuildSidecarIndex(src, index);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    if (ABSL_PREDICT_FALSE(!src.Close())) return src.status();
+  }
+  FdWriter<> dest(dest_filename, O_WRONLY | O_CREAT | O_TRUNC);
+  {
+    const absl::Status status = WriteSidecarIndex(index, dest);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (ABSL_PREDICT_FALSE(!dest.Close())) return dest.status();
+  return absl::OkStatus();
+}
+
+const char kUsage[] =
+    "Usage: build_sidecar_index (OPTION)... SRC...\n"
+    "\n"
+    "Writes a chunk index of each Riegeli/records file SRC to SRC.idx, which "
+    "RecordReaderBase::Options::set_sidecar_index() accepts.\n";
+
+}  // namespace
+}  // namespace tools
+}  // namespace riegeli
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(riegeli::tools::kUsage);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  if (args.size() < 2) {
+    std::cerr << absl::ProgramUsageMessage() << std::endl;
+    return 1;
+  }
+  const std::string suffix = absl::GetFlag(FLAGS_suffix);
+  int exit_code = 0;
+  for (size_t i = 1; i < args.size(); ++i) {
+    const absl::Status status =
+        riegeli::tools::BuildIndexFile(args[i], absl::StrCat(args[i], suffix));
+    if (!status.ok()) {
+      std::cerr << args[i] << ": " << status.message() << std::endl;
+      exit_code = 1;
+    }
+  }
+  return exit_code;
+}
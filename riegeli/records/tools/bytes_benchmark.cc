@@ -0,0 +1,403 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures throughput of small and large reads and writes, and of copying,
+// through `Reader` and `Writer` classes of `riegeli/bytes`, alone and stacked
+// over each other, to quantify the overhead of their virtual slow paths.
+//
+// Rows marked "(final)" use the same classes through their concrete types, so
+// that their slow paths declared `final` dispatch statically.
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/functional/function_ref.h"
+#include "absl/strings/cord.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/cord_reader.h"
+#include "riegeli/bytes/cord_writer.h"
+#include "riegeli/bytes/digesting_reader.h"
+#include "riegeli/bytes/digesting_writer.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/limiting_reader.h"
+#include "riegeli/bytes/limiting_writer.h"
+#include "riegeli/bytes/null_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/bytes/string_reader.h"
+#include "riegeli/bytes/string_writer.h"
+#include "riegeli/bytes/wrapped_reader.h"
+#include "riegeli/bytes/wrapped_writer.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/digests/crc32c_digester.h"
+
+ABSL_FLAG(uint64_t, size, uint64_t{64} << 20,
+          "Number of bytes read or written by each benchmark");
+ABSL_FLAG(uint64_t, small_size, 16, "Size of small reads and writes, in bytes");
+ABSL_FLAG(uint64_t, large_size, uint64_t{64} << 10,
+          "Size of large reads and writes, in bytes");
+ABSL_FLAG(std::string, output_dir, "/tmp",
+          "Directory to write files to (files are named bytes_benchmark_*)");
+ABSL_FLAG(int32_t, repetitions, 5, "Number of times to repeat each benchmark");
+
+namespace {
+
+uint64_t RealTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_MONOTONIC, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+// Returns the fastest time of calling `function()`.
+uint64_t BestTime_ns(int repetitions, absl::FunctionRef<void()> function) {
+  uint64_t best_time_ns = std::numeric_limits<uint64_t>::max();
+  for (int repetition = 0; repetition < repetitions; ++repetition) {
+    const uint64_t start_ns = RealTimeNow_ns();
+    function();
+    best_time_ns =
+        riegeli::UnsignedMin(best_time_ns, RealTimeNow_ns() - start_ns);
+  }
+  return best_time_ns;
+}
+
+using ReaderFactory = std::function<std::unique_ptr<riegeli::Reader>()>;
+using WriterFactory = std::function<std::unique_ptr<riegeli::Writer>()>;
+
+ReaderFactory LimitingReaderFactory(ReaderFactory src) {
+  return [src = std::move(src)] {
+    return std::make_unique<
+        riegeli::LimitingReader<std::unique_ptr<riegeli::Reader>>>(src());
+  };
+}
+
+ReaderFactory DigestingReaderFactory(ReaderFactory src) {
+  return [src = std::move(src)] {
+    return std::make_unique<riegeli::DigestingReader<
+        riegeli::Crc32cDigester, std::unique_ptr<riegeli::Reader>>>(src());
+  };
+}
+
+ReaderFactory WrappedReaderFactory(ReaderFactory src) {
+  return [src = std::move(src)] {
+    return std::make_unique<
+        riegeli::WrappedReader<std::unique_ptr<riegeli::Reader>>>(src());
+  };
+}
+
+WriterFactory LimitingWriterFactory(WriterFactory dest) {
+  return [dest = std::move(dest)] {
+    return std::make_unique<
+        riegeli::LimitingWriter<std::unique_ptr<riegeli::Writer>>>(dest());
+  };
+}
+
+WriterFactory DigestingWriterFactory(WriterFactory dest) {
+  return [dest = std::move(dest)] {
+    return std::make_unique<riegeli::DigestingWriter<
+        riegeli::Crc32cDigester, std::unique_ptr<riegeli::Writer>>>(dest());
+  };
+}
+
+WriterFactory WrappedWriterFactory(WriterFactory dest) {
+  return [dest = std::move(dest)] {
+    return std::make_unique<
+        riegeli::WrappedWriter<std::unique_ptr<riegeli::Writer>>>(dest());
+  };
+}
+
+class Benchmarks {
+ public:
+  explicit Benchmarks(size_t size, size_t small_size, size_t large_size,
+                      std::string output_dir, int repetitions);
+
+  void RunAll(std::ostream& report);
+
+ private:
+  template <typename ReaderType>
+  void RunReader(
+      absl::string_view name,
+      const std::function<std::unique_ptr<ReaderType>()>& make_reader,
+      std::ostream& report);
+  template <typename WriterType>
+  void RunWriter(
+      absl::string_view name,
+      const std::function<std::unique_ptr<WriterType>()>& make_writer,
+      std::ostream& report);
+
+  void Report(absl::string_view name, absl::string_view kind,
+              const std::vector<uint64_t>& times_ns, std::ostream& report);
+
+  std::string data_;
+  riegeli::Chain chain_;
+  absl::Cord cord_;
+  size_t small_size_;
+  size_t large_size_;
+  std::string filename_;
+  int repetitions_;
+  // Destinations of writers, cleared before each run.
+  std::string dest_string_;
+  riegeli::Chain dest_chain_;
+  absl::Cord dest_cord_;
+};
+
+Benchmarks::Benchmarks(size_t size, size_t small_size, size_t large_size,
+                       std::string output_dir, int repetitions)
+    : small_size_(small_size),
+      large_size_(large_size),
+      filename_(absl::StrCat(output_dir, "/bytes_benchmark_data")),
+      repetitions_(repetitions) {
+  data_.reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    data_.push_back(static_cast<char>(i * 0x9e3779b97f4a7c15 >> 56));
+  }
+  chain_ = riegeli::Chain(data_);
+  cord_ = absl::Cord(data_);
+  riegeli::FdWriter<> file_writer(filename_, O_WRONLY | O_CREAT | O_TRUNC);
+  RIEGELI_CHECK(file_writer.Write(data_)) << file_writer.status();
+  RIEGELI_CHECK(file_writer.Close()) << file_writer.status();
+}
+
+void Benchmarks::Report(absl::string_view name, absl::string_view kind,
+                        const std::vector<uint64_t>& times_ns,
+                        std::ostream& report) {
+  absl::Format(&report, "%-8s %-32s", kind, name);
+  for (const uint64_t time_ns : times_ns) {
+    absl::Format(&report, " %9.1f",
+                 static_cast<double>(data_.size()) /
+                     static_cast<double>(time_ns) * 1000.0);
+  }
+  absl::Format(&report, "\n");
+}
+
+template <typename ReaderType>
+void Benchmarks::RunReader(
+    absl::string_view name,
+    const std::function<std::unique_ptr<ReaderType>()>& make_reader,
+    std::ostream& report) {
+  std::vector<uint64_t> times_ns;
+  std::string buffer(large_size_, '\0');
+  for (const size_t length : {small_size_, large_size_}) {
+    times_ns.push_back(BestTime_ns(repetitions_, [&] {
+      const std::unique_ptr<ReaderType> reader = make_reader();
+      while (reader->Read(length, &buffer[0])) {
+      }
+      RIEGELI_CHECK(reader->Close()) << reader->status();
+    }));
+  }
+  times_ns.push_back(BestTime_ns(repetitions_, [&] {
+    const std::unique_ptr<ReaderType> reader = make_reader();
+    riegeli::NullWriter dest(riegeli::NullWriter::kInitiallyOpen);
+    RIEGELI_CHECK(reader->CopyAll(dest)) << reader->status();
+    RIEGELI_CHECK(reader->Close()) << reader->status();
+    RIEGELI_CHECK(dest.Close()) << dest.status();
+  }));
+  Report(name, "reader", times_ns, report);
+}
+
+template <typename WriterType>
+void Benchmarks::RunWriter(
+    absl::string_view name,
+    const std::function<std::unique_ptr<WriterType>()>& make_writer,
+    std::ostream& report) {
+  std::vector<uint64_t> times_ns;
+  for (const size_t length : {small_size_, large_size_}) {
+    times_ns.push_back(BestTime_ns(repetitions_, [&] {
+      const std::unique_ptr<WriterType> writer = make_writer();
+      for (size_t pos = 0; pos < data_.size(); pos += length) {
+        RIEGELI_CHECK(
+            writer->Write(absl::string_view(data_).substr(pos, length)))
+            << writer->status();
+      }
+      RIEGELI_CHECK(writer->Close()) << writer->status();
+    }));
+  }
+  times_ns.push_back(BestTime_ns(repetitions_, [&] {
+    const std::unique_ptr<WriterType> writer = make_writer();
+    riegeli::StringReader<> src(data_);
+    RIEGELI_CHECK(src.CopyAll(*writer)) << src.status();
+    RIEGELI_CHECK(writer->Close()) << writer->status();
+  }));
+  Report(name, "writer", times_ns, report);
+}
+
+void Benchmarks::RunAll(std::ostream& report) {
+  absl::Format(&report, "Data size: %.3f MB\n",
+               static_cast<double>(data_.size()) / 1000000.0);
+  absl::Format(&report, "%-8s %-32s %9s %9s %9s\n", "", "", "Small", "Large",
+               "Copy");
+  absl::Format(&report, "%-8s %-32s %9s %9s %9s\n", "Kind", "Name", "MB/s",
+               "MB/s", "MB/s");
+  absl::Format(&report, "%s\n", std::string(8 + 1 + 32 + 3 * 10, '-'));
+
+  const ReaderFactory string_reader = [this] {
+    return std::make_unique<riegeli::StringReader<>>(data_);
+  };
+  const ReaderFactory fd_reader = [this] {
+    return std::make_unique<riegeli::FdReader<>>(filename_, O_RDONLY);
+  };
+  const std::vector<std::pair<std::string, ReaderFactory>> readers = {
+      {"StringReader", string_reader},
+      {"ChainReader",
+       [this] { return std::make_unique<riegeli::ChainReader<>>(&chain_); }},
+      {"CordReader",
+       [this] { return std::make_unique<riegeli::CordReader<>>(&cord_); }},
+      {"FdReader", fd_reader},
+      {"WrappedReader(String)", WrappedReaderFactory(string_reader)},
+      {"LimitingReader(String)", LimitingReaderFactory(string_reader)},
+      {"DigestingReader(String)", DigestingReaderFactory(string_reader)},
+      {"LimitingReader(Fd)", LimitingReaderFactory(fd_reader)},
+      {"Limiting(Digesting(Fd))",
+       LimitingReaderFactory(DigestingReaderFactory(fd_reader))},
+      {"Limiting(Wrapped(Limiting(Fd)))",
+       LimitingReaderFactory(
+           WrappedReaderFactory(LimitingReaderFactory(fd_reader)))},
+  };
+  for (const std::pair<std::string, ReaderFactory>& reader : readers) {
+    RunReader(reader.first, reader.second, report);
+  }
+  RunReader<riegeli::StringReader<>>(
+      "StringReader (final)",
+      [this] { return std::make_unique<riegeli::StringReader<>>(data_); },
+      report);
+  RunReader<riegeli::ChainReader<>>(
+      "ChainReader (final)",
+      [this] { return std::make_unique<riegeli::ChainReader<>>(&chain_); },
+      report);
+  RunReader<riegeli::CordReader<>>(
+      "CordReader (final)",
+      [this] { return std::make_unique<riegeli::CordReader<>>(&cord_); },
+      report);
+  RunReader<riegeli::FdReader<>>(
+      "FdReader (final)",
+      [this] {
+        return std::make_unique<riegeli::FdReader<>>(filename_, O_RDONLY);
+      },
+      report);
+
+  const WriterFactory string_writer = [this] {
+    dest_string_.clear();
+    return std::make_unique<riegeli::StringWriter<>>(&dest_string_);
+  };
+  const std::string write_filename = absl::StrCat(filename_, "_written");
+  const WriterFactory fd_writer = [write_filename] {
+    return std::make_unique<riegeli::FdWriter<>>(write_filename,
+                                                 O_WRONLY | O_CREAT | O_TRUNC);
+  };
+  const std::vector<std::pair<std::string, WriterFactory>> writers = {
+      {"NullWriter",
+       [] {
+         return std::make_unique<riegeli::NullWriter>(
+             riegeli::NullWriter::kInitiallyOpen);
+       }},
+      {"StringWriter", string_writer},
+      {"ChainWriter",
+       [this] {
+         dest_chain_.Clear();
+         return std::make_unique<riegeli::ChainWriter<>>(&dest_chain_);
+       }},
+      {"CordWriter",
+       [this] {
+         dest_cord_.Clear();
+         return std::make_unique<riegeli::CordWriter<>>(&dest_cord_);
+       }},
+      {"FdWriter", fd_writer},
+      {"WrappedWriter(String)", WrappedWriterFactory(string_writer)},
+      {"LimitingWriter(String)", LimitingWriterFactory(string_writer)},
+      {"DigestingWriter(String)", DigestingWriterFactory(string_writer)},
+      {"LimitingWriter(Fd)", LimitingWriterFactory(fd_writer)},
+      {"Limiting(Digesting(Fd))",
+       LimitingWriterFactory(DigestingWriterFactory(fd_writer))},
+      {"Limiting(Wrapped(Limiting(Fd)))",
+       LimitingWriterFactory(
+           WrappedWriterFactory(LimitingWriterFactory(fd_writer)))},
+  };
+  for (const std::pair<std::string, WriterFactory>& writer : writers) {
+    RunWriter(writer.first, writer.second, report);
+  }
+  RunWriter<riegeli::StringWriter<>>(
+      "StringWriter (final)",
+      [this] {
+        dest_string_.clear();
+        return std::make_unique<riegeli::StringWriter<>>(&dest_string_);
+      },
+      report);
+  RunWriter<riegeli::ChainWriter<>>(
+      "ChainWriter (final)",
+      [this] {
+        dest_chain_.Clear();
+        return std::make_unique<riegeli::ChainWriter<>>(&dest_chain_);
+      },
+      report);
+  RunWriter<riegeli::CordWriter<>>(
+      "CordWriter (final)",
+      [this] {
+        dest_cord_.Clear();
+        return std::make_unique<riegeli::CordWriter<>>(&dest_cord_);
+      },
+      report);
+  RunWriter<riegeli::FdWriter<>>(
+      "FdWriter (final)",
+      [write_filename] {
+        return std::make_unique<riegeli::FdWriter<>>(
+            write_filename, O_WRONLY | O_CREAT | O_TRUNC);
+      },
+      report);
+}
+
+const char kUsage[] =
+    "Usage: bytes_benchmark (OPTION)...\n"
+    "\n"
+    "Measures reading, writing, and copying through Riegeli readers and "
+    "writers, alone and stacked.\n";
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(kUsage);
+  absl::ParseCommandLine(argc, argv);
+  const size_t small_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_small_size));
+  const size_t large_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_large_size));
+  if (small_size == 0 || large_size == 0) {
+    absl::Format(&std::cerr,
+                 "--small_size and --large_size must be positive\n");
+    return 1;
+  }
+  Benchmarks benchmarks(riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_size)),
+                        small_size, large_size,
+                        absl::GetFlag(FLAGS_output_dir),
+                        absl::GetFlag(FLAGS_repetitions));
+  benchmarks.RunAll(std::cout);
+}
@@ -0,0 +1,453 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures components of chunk encoding in isolation: `Compressor`,
+// `Decompressor`, `SimpleEncoder`, `TransposeEncoder`, and `ChunkDecoder` of
+// simple and transposed chunks, with and without a field projection, for a
+// synthetic corpus and for records of given Riegeli/records files.
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/null_writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
+#include "riegeli/chunk_encoding/compressor.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/decompressor.h"
+#include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/simple_encoder.h"
+#include "riegeli/chunk_encoding/transpose_encoder.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/varint/varint_writing.h"
+
+ABSL_FLAG(std::string, compression, "uncompressed brotli:6 zstd:3 snappy",
+          "Whitespace-separated compressor options, in the format of "
+          "CompressorOptions::FromString()");
+ABSL_FLAG(std::string, chunk_size, "65536 1048576",
+          "Whitespace-separated uncompressed sizes of chunks, in bytes");
+ABSL_FLAG(std::string, bucket_fraction, "1 0.25",
+          "Whitespace-separated bucket fractions for transposed chunks");
+ABSL_FLAG(std::string, field_projection, "",
+          "Whitespace-separated field projections for decoding transposed "
+          "chunks, besides decoding all fields. A projection is "
+          "comma-separated fields, a field is '.'-separated field numbers, "
+          "e.g. \"1 2,3.4\"");
+ABSL_FLAG(uint64_t, synthetic_size, uint64_t{16} << 20,
+          "Size of the synthetic corpus, in bytes, or 0 to skip it");
+ABSL_FLAG(uint64_t, max_size, uint64_t{100} * 1000 * 1000,
+          "Maximum size of records to read from files, in bytes");
+ABSL_FLAG(int32_t, repetitions, 5, "Number of times to repeat each benchmark");
+
+namespace {
+
+uint64_t RealTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_MONOTONIC, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+void AppendVarint(uint64_t value, std::string& dest) {
+  char buffer[riegeli::kMaxLengthVarint64];
+  const char* const end = riegeli::WriteVarint64(value, buffer);
+  dest.append(buffer, riegeli::PtrDistance(buffer, end));
+}
+
+// Field numbers start at 1 and tags with wire type `kVarint` (0) and
+// `kLengthDelimited` (2) are `field << 3` and `(field << 3) | 2`.
+void AppendVarintField(uint64_t field, uint64_t value, std::string& dest) {
+  AppendVarint(field << 3, dest);
+  AppendVarint(value, dest);
+}
+
+void AppendLengthDelimitedField(uint64_t field, absl::string_view value,
+                                std::string& dest) {
+  AppendVarint((field << 3) | 2, dest);
+  AppendVarint(value.size(), dest);
+  dest.append(value.data(), value.size());
+}
+
+// Each record has a small varint id (field 1), a large varint (field 2), a
+// string from a small vocabulary (field 3), and a submessage (field 4) with a
+// varint (field 1) and a string of varying length (field 2), so that buckets
+// of different fields compress differently.
+std::vector<std::string> SyntheticRecords(size_t size) {
+  static constexpr absl::string_view kWords[] = {
+      "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf"};
+  std::vector<std::string> records;
+  size_t total_size = 0;
+  for (uint64_t i = 0; total_size < size; ++i) {
+    std::string record;
+    AppendVarintField(1, i % 1000, record);
+    AppendVarintField(2, i * uint64_t{0x9e3779b97f4a7c15}, record);
+    AppendLengthDelimitedField(
+        3, kWords[i % (sizeof(kWords) / sizeof(kWords[0]))], record);
+    std::string submessage;
+    AppendVarintField(1, i / 7, submessage);
+    AppendLengthDelimitedField(
+        2, std::string(i % 61, static_cast<char>('a' + i % 26)), submessage);
+    AppendLengthDelimitedField(4, submessage, record);
+    total_size += record.size();
+    records.push_back(std::move(record));
+  }
+  return records;
+}
+
+std::vector<std::string> ReadRecords(absl::string_view filename,
+                                     size_t max_size) {
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      std::forward_as_tuple(filename, O_RDONLY));
+  std::vector<std::string> records;
+  size_t total_size = 0;
+  std::string record;
+  while (total_size < max_size && record_reader.ReadRecord(record)) {
+    total_size += record.size();
+    records.push_back(std::move(record));
+  }
+  RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+  return records;
+}
+
+// Returns the fastest time of calling `function()`.
+uint64_t BestTime_ns(int repetitions, absl::FunctionRef<void()> function) {
+  uint64_t best_time_ns = std::numeric_limits<uint64_t>::max();
+  for (int repetition = 0; repetition < repetitions; ++repetition) {
+    const uint64_t start_ns = RealTimeNow_ns();
+    function();
+    best_time_ns =
+        riegeli::UnsignedMin(best_time_ns, RealTimeNow_ns() - start_ns);
+  }
+  return best_time_ns;
+}
+
+// Groups records into ranges of about `chunk_size` bytes.
+std::vector<std::vector<absl::string_view>> SplitIntoChunks(
+    const std::vector<std::string>& records, size_t chunk_size) {
+  std::vector<std::vector<absl::string_view>> chunks;
+  size_t size = 0;
+  for (const std::string& record : records) {
+    if (chunks.empty() || size >= chunk_size) {
+      chunks.emplace_back();
+      size = 0;
+    }
+    chunks.back().push_back(record);
+    size += record.size();
+  }
+  return chunks;
+}
+
+uint64_t BucketSize(size_t chunk_size, double bucket_fraction) {
+  const double bucket_size =
+      std::round(static_cast<double>(chunk_size) * bucket_fraction);
+  return bucket_size >= 1.0 ? static_cast<uint64_t>(bucket_size) : uint64_t{1};
+}
+
+riegeli::Chunk EncodeChunk(riegeli::ChunkEncoder& encoder,
+                           const std::vector<absl::string_view>& records) {
+  for (const absl::string_view record : records) {
+    RIEGELI_CHECK(encoder.AddRecord(record)) << encoder.status();
+  }
+  riegeli::Chunk chunk;
+  riegeli::ChainWriter<> data_writer(&chunk.data);
+  riegeli::ChunkType chunk_type;
+  uint64_t num_records;
+  uint64_t decoded_data_size;
+  RIEGELI_CHECK(encoder.EncodeAndClose(data_writer, chunk_type, num_records,
+                                       decoded_data_size))
+      << encoder.status();
+  RIEGELI_CHECK(data_writer.Close()) << data_writer.status();
+  chunk.header = riegeli::ChunkHeader(chunk.data, chunk_type, num_records,
+                                      decoded_data_size);
+  return chunk;
+}
+
+void DecodeChunk(const riegeli::Chunk& chunk,
+                 riegeli::ChunkDecoder::Options options) {
+  riegeli::ChunkDecoder decoder(std::move(options));
+  RIEGELI_CHECK(decoder.Decode(chunk)) << decoder.status();
+  absl::string_view record;
+  while (decoder.ReadRecord(record)) {
+  }
+  RIEGELI_CHECK(decoder.Close()) << decoder.status();
+}
+
+class Benchmark {
+ public:
+  explicit Benchmark(absl::string_view corpus_name,
+                     const std::vector<std::string>& records,
+                     absl::string_view compression, size_t chunk_size,
+                     int repetitions);
+
+  void RunCompressor();
+  void RunSimple();
+  void RunTranspose(double bucket_fraction,
+                    const std::vector<std::pair<std::string,
+                                                riegeli::FieldProjection>>&
+                        field_projections);
+
+ private:
+  void Report(absl::string_view component, absl::string_view variant,
+              size_t compressed_size, uint64_t time_ns);
+  size_t ChunksSize(const std::vector<riegeli::Chunk>& chunks);
+
+  absl::string_view corpus_name_;
+  absl::string_view compression_;
+  riegeli::CompressorOptions compressor_options_;
+  size_t chunk_size_;
+  int repetitions_;
+  std::vector<std::vector<absl::string_view>> chunks_;
+  size_t uncompressed_size_ = 0;
+};
+
+Benchmark::Benchmark(absl::string_view corpus_name,
+                     const std::vector<std::string>& records,
+                     absl::string_view compression, size_t chunk_size,
+                     int repetitions)
+    : corpus_name_(corpus_name),
+      compression_(compression),
+      chunk_size_(chunk_size),
+      repetitions_(repetitions),
+      chunks_(SplitIntoChunks(records, chunk_size)) {
+  RIEGELI_CHECK_EQ(compressor_options_.FromString(compression),
+                   absl::OkStatus());
+  for (const std::string& record : records) uncompressed_size_ += record.size();
+}
+
+size_t Benchmark::ChunksSize(const std::vector<riegeli::Chunk>& chunks) {
+  size_t size = 0;
+  for (const riegeli::Chunk& chunk : chunks) size += chunk.data.size();
+  return size;
+}
+
+void Benchmark::Report(absl::string_view component, absl::string_view variant,
+                       size_t compressed_size, uint64_t time_ns) {
+  absl::Format(&std::cout, "%-12s %-16s %8u %-10s %-20s %7.3f %8.1f\n",
+               corpus_name_, compression_, chunk_size_, component, variant,
+               static_cast<double>(compressed_size) /
+                   static_cast<double>(uncompressed_size_) * 100.0,
+               static_cast<double>(uncompressed_size_) /
+                   static_cast<double>(time_ns) * 1000.0);
+}
+
+void Benchmark::RunCompressor() {
+  std::vector<riegeli::Chain> compressed(chunks_.size());
+  const uint64_t compress_time_ns = BestTime_ns(repetitions_, [&] {
+    riegeli::internal::Compressor compressor(compressor_options_);
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      compressor.Clear();
+      for (const absl::string_view record : chunks_[i]) {
+        RIEGELI_CHECK(compressor.writer().Write(record))
+            << compressor.writer().status();
+      }
+      compressed[i].Clear();
+      riegeli::ChainWriter<> dest(&compressed[i]);
+      RIEGELI_CHECK(compressor.EncodeAndClose(dest)) << compressor.status();
+      RIEGELI_CHECK(dest.Close()) << dest.status();
+    }
+  });
+  size_t compressed_size = 0;
+  for (const riegeli::Chain& data : compressed) compressed_size += data.size();
+  Report("compress", "", compressed_size, compress_time_ns);
+
+  const uint64_t decompress_time_ns = BestTime_ns(repetitions_, [&] {
+    for (const riegeli::Chain& data : compressed) {
+      riegeli::internal::Decompressor<riegeli::ChainReader<>> decompressor(
+          std::forward_as_tuple(&data),
+          compressor_options_.compression_type());
+      riegeli::NullWriter dest(riegeli::NullWriter::kInitiallyOpen);
+      RIEGELI_CHECK(decompressor.reader().CopyAll(dest))
+          << decompressor.reader().status();
+      RIEGELI_CHECK(decompressor.VerifyEndAndClose()) << decompressor.status();
+      RIEGELI_CHECK(dest.Close()) << dest.status();
+    }
+  });
+  Report("decompress", "", compressed_size, decompress_time_ns);
+}
+
+void Benchmark::RunSimple() {
+  std::vector<riegeli::Chunk> chunks(chunks_.size());
+  const uint64_t encode_time_ns = BestTime_ns(repetitions_, [&] {
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      riegeli::SimpleEncoder encoder(compressor_options_, chunk_size_);
+      chunks[i] = EncodeChunk(encoder, chunks_[i]);
+    }
+  });
+  Report("simple", "encode", ChunksSize(chunks), encode_time_ns);
+  const uint64_t decode_time_ns = BestTime_ns(repetitions_, [&] {
+    for (const riegeli::Chunk& chunk : chunks) {
+      DecodeChunk(chunk, riegeli::ChunkDecoder::Options());
+    }
+  });
+  Report("simple", "decode", ChunksSize(chunks), decode_time_ns);
+}
+
+void Benchmark::RunTranspose(
+    double bucket_fraction,
+    const std::vector<std::pair<std::string, riegeli::FieldProjection>>&
+        field_projections) {
+  const uint64_t bucket_size = BucketSize(chunk_size_, bucket_fraction);
+  const std::string variant_prefix = absl::StrFormat("b%g ", bucket_fraction);
+  std::vector<riegeli::Chunk> chunks(chunks_.size());
+  const uint64_t encode_time_ns = BestTime_ns(repetitions_, [&] {
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      riegeli::TransposeEncoder encoder(compressor_options_, bucket_size);
+      chunks[i] = EncodeChunk(encoder, chunks_[i]);
+    }
+  });
+  Report("transpose", absl::StrCat(variant_prefix, "encode"),
+         ChunksSize(chunks), encode_time_ns);
+  const uint64_t decode_time_ns = BestTime_ns(repetitions_, [&] {
+    for (const riegeli::Chunk& chunk : chunks) {
+      DecodeChunk(chunk, riegeli::ChunkDecoder::Options());
+    }
+  });
+  Report("transpose", absl::StrCat(variant_prefix, "decode"),
+         ChunksSize(chunks), decode_time_ns);
+  for (const std::pair<std::string, riegeli::FieldProjection>&
+           field_projection : field_projections) {
+    const uint64_t projected_time_ns = BestTime_ns(repetitions_, [&] {
+      for (const riegeli::Chunk& chunk : chunks) {
+        DecodeChunk(chunk,
+                    riegeli::ChunkDecoder::Options().set_field_projection(
+                        field_projection.second));
+      }
+    });
+    Report("transpose",
+           absl::StrCat(variant_prefix, "decode ", field_projection.first),
+           ChunksSize(chunks), projected_time_ns);
+  }
+}
+
+riegeli::FieldProjection ParseFieldProjection(absl::string_view text) {
+  riegeli::FieldProjection field_projection;
+  for (const absl::string_view field_text : absl::StrSplit(text, ',')) {
+    riegeli::Field field;
+    for (const absl::string_view number_text :
+         absl::StrSplit(field_text, '.')) {
+      int field_number;
+      RIEGELI_CHECK(absl::SimpleAtoi(number_text, &field_number) &&
+                    field_number >= 0 && field_number <= (1 << 29) - 1)
+          << "Invalid field projection: " << text;
+      field.AddFieldNumber(field_number);
+    }
+    field_projection.AddField(std::move(field));
+  }
+  return field_projection;
+}
+
+std::vector<absl::string_view> Words(absl::string_view text) {
+  return absl::StrSplit(text, absl::ByAnyChar("\t\n "), absl::SkipEmpty());
+}
+
+const char kUsage[] =
+    "Usage: chunk_encoding_benchmark (OPTION|FILE)...\n"
+    "\n"
+    "Measures components of chunk encoding for a synthetic corpus and for "
+    "records of Riegeli/records FILEs. Speeds are in MB/s of uncompressed "
+    "records.\n";
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(kUsage);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  const int repetitions = absl::GetFlag(FLAGS_repetitions);
+
+  std::vector<std::pair<std::string, std::vector<std::string>>> corpora;
+  const size_t synthetic_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_synthetic_size));
+  if (synthetic_size > 0) {
+    corpora.emplace_back("synthetic", SyntheticRecords(synthetic_size));
+  }
+  const size_t max_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_max_size));
+  for (size_t i = 1; i < args.size(); ++i) {
+    const absl::string_view filename = args[i];
+    corpora.emplace_back(filename.substr(filename.rfind('/') + 1),
+                         ReadRecords(filename, max_size));
+  }
+
+  const std::string chunk_size_flag = absl::GetFlag(FLAGS_chunk_size);
+  std::vector<size_t> chunk_sizes;
+  for (const absl::string_view word : Words(chunk_size_flag)) {
+    size_t chunk_size;
+    RIEGELI_CHECK(absl::SimpleAtoi(word, &chunk_size) && chunk_size > 0)
+        << "Invalid chunk size: " << word;
+    chunk_sizes.push_back(chunk_size);
+  }
+  const std::string bucket_fraction_flag = absl::GetFlag(FLAGS_bucket_fraction);
+  std::vector<double> bucket_fractions;
+  for (const absl::string_view word : Words(bucket_fraction_flag)) {
+    double bucket_fraction;
+    RIEGELI_CHECK(absl::SimpleAtod(word, &bucket_fraction) &&
+                  bucket_fraction > 0.0 && bucket_fraction <= 1.0)
+        << "Invalid bucket fraction: " << word;
+    bucket_fractions.push_back(bucket_fraction);
+  }
+  const std::string field_projection_flag =
+      absl::GetFlag(FLAGS_field_projection);
+  std::vector<std::pair<std::string, riegeli::FieldProjection>>
+      field_projections;
+  for (const absl::string_view word : Words(field_projection_flag)) {
+    field_projections.emplace_back(std::string(word),
+                                   ParseFieldProjection(word));
+  }
+  const std::string compression_flag = absl::GetFlag(FLAGS_compression);
+
+  absl::Format(&std::cout, "%-12s %-16s %8s %-10s %-20s %7s %8s\n", "Corpus",
+               "Compression", "Chunk", "Component", "Variant", "Ratio%",
+               "MB/s");
+  for (const std::pair<std::string, std::vector<std::string>>& corpus :
+       corpora) {
+    for (const absl::string_view compression : Words(compression_flag)) {
+      for (const size_t chunk_size : chunk_sizes) {
+        Benchmark benchmark(corpus.first, corpus.second, compression,
+                            chunk_size, repetitions);
+        benchmark.RunCompressor();
+        benchmark.RunSimple();
+        for (const double bucket_fraction : bucket_fractions) {
+          benchmark.RunTranspose(bucket_fraction, field_projections);
+        }
+      }
+    }
+  }
+}
@@ -16,10 +16,17 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include "absl/base/optimization.h"
@@ -30,34 +37,74 @@
 #include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/text_format.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/bytes/chain_backward_writer.h"
 #include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/fd_reader.h"
 #include "riegeli/bytes/limiting_reader.h"
 #include "riegeli/bytes/null_backward_writer.h"
+#include "riegeli/bytes/null_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/chunk_decoder.h"
+#include "riegeli/chunk_encoding/chunk_encoder.h"
 #include "riegeli/chunk_encoding/constants.h"
 #include "riegeli/chunk_encoding/decompressor.h"
 #include "riegeli/chunk_encoding/field_projection.h"
+#include "riegeli/chunk_encoding/simple_encoder.h"
 #include "riegeli/chunk_encoding/transpose_decoder.h"
+#include "riegeli/chunk_encoding/transpose_encoder.h"
+#include "riegeli/chunk_encoding/transpose_internal.h"
 #include "riegeli/messages/message_parse.h"
+#include "riegeli/messages/message_wire_format.h"
 #include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/file_summary.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
 #include "riegeli/records/records_metadata.pb.h"
 #include "riegeli/records/skipped_region.h"
 #include "riegeli/records/tools/riegeli_summary.pb.h"
 #include "riegeli/varint/varint_reading.h"
+#include "riegeli/zstd/zstd_reader.h"
 
 ABSL_FLAG(bool, show_records_metadata, true,
           "If true, show parsed file metadata.");
 ABSL_FLAG(bool, show_record_sizes, false,
           "If true, show the list of record sizes in each chunk.");
+ABSL_FLAG(bool, show_chunks, true, "If true, show each chunk.");
+ABSL_FLAG(bool, show_field_sizes, false,
+          "If true, show sizes of values of each field in each transposed "
+          "chunk.");
+ABSL_FLAG(bool, show_summary, false,
+          "If true, show a summary of all chunks: distributions of chunk "
+          "sizes, compression ratios per chunk type, state machine sizes and "
+          "sizes of fields of transposed chunks, and recompression estimates.");
+ABSL_FLAG(bool, file_summary_only, false,
+          "If true, show only the file summary written by RecordWriter with "
+          "file_summary, read from the end of the file without reading other "
+          "chunks.");
+ABSL_FLAG(int32_t, parallelism, 0,
+          "Maximum number of chunks described in parallel, while the file is "
+          "read by one thread. If 0, chunks are described serially.");
+ABSL_FLAG(std::string, recompress, "",
+          "If not empty, estimate the size of records written with other "
+          "options, as a list of RecordWriterBase::Options::FromString() "
+          "strings separated by ';', e.g. \"transpose,zstd:3;brotli:9\". "
+          "Records of each sampled chunk are encoded again as one chunk, so "
+          "chunk_size and zstd_dictionary_training are not taken into "
+          "account. Shown in the summary.");
+ABSL_FLAG(int32_t, recompress_sample_interval, 10,
+          "With --recompress, records of every N-th chunk containing records "
+          "are encoded again.");
 
 namespace riegeli {
 namespace tools {
@@ -95,8 +142,9 @@ absl::Status DescribeFileMetadataChunk(const Chunk& chunk,
   return ParseFromChain(serialized_metadata, records_metadata);
 }
 
-absl::Status DescribeSimpleChunk(const Chunk& chunk,
-                                 summary::SimpleChunk& simple_chunk) {
+absl::Status DescribeSimpleChunk(
+    const Chunk& chunk, const ZstdReaderBase::Dictionary& zstd_dictionary,
+    summary::SimpleChunk& simple_chunk) {
   // Based on `SimpleDecoder::Decode()`.
   ChainReader<> chunk_reader(&chunk.data);
 
@@ -121,7 +169,7 @@ absl::Status DescribeSimpleChunk(const Chunk& chunk,
     }
     internal::Decompressor<LimitingReader<>> sizes_decompressor(
         std::forward_as_tuple(&chunk_reader, chunk_reader.pos() + *sizes_size),
-        compression_type);
+        compression_type, zstd_dictionary);
     if (ABSL_PREDICT_FALSE(!sizes_decompressor.healthy())) {
       return sizes_decompressor.status();
     }
@@ -144,7 +192,8 @@ absl::Status DescribeSimpleChunk(const Chunk& chunk,
 }
 
 absl::Status DescribeTransposedChunk(
-    const Chunk& chunk, summary::TransposedChunk& transposed_chunk) {
+    const Chunk& chunk, const ZstdReaderBase::Dictionary& zstd_dictionary,
+    summary::TransposedChunk& transposed_chunk) {
   // Based on `TransposeDecoder::Decode()`.
   ChainReader<> chunk_reader(&chunk.data);
 
@@ -163,7 +212,8 @@ absl::Status DescribeTransposedChunk(
     std::vector<size_t> limits;
     const bool ok = transpose_decoder.Decode(
         chunk.header.num_records(), chunk.header.decoded_data_size(),
-        FieldProjection::All(), chunk_reader, dest_writer, limits);
+        FieldProjection::All(), chunk_reader, dest_writer, limits,
+        zstd_dictionary);
     if (ABSL_PREDICT_FALSE(!dest_writer.Close())) return dest_writer.status();
     if (ABSL_PREDICT_FALSE(!ok)) return transpose_decoder.status();
     if (ABSL_PREDICT_FALSE(!chunk_reader.VerifyEndAndClose())) {
@@ -181,7 +231,616 @@ absl::Status DescribeTransposedChunk(
   return absl::OkStatus();
 }
 
-void DescribeFile(absl::string_view filename, std::ostream& report) {
+// Describes the structure of a transposed chunk from its header.
+//
+// If `field_sizes`, buckets are decompressed to find which buffers they
+// contain, and sizes of buffers are attributed to fields.
+absl::Status DescribeTransposedLayout(
+    const Chunk& chunk, const ZstdReaderBase::Dictionary& zstd_dictionary,
+    bool field_sizes, summary::TransposedChunk& transposed_chunk) {
+  // Based on `TransposeDecoder::Parse()` and
+  // `TransposeDecoder::ParseBuffers()`.
+  ChainReader<> chunk_reader(&chunk.data);
+
+  const absl::optional<uint8_t> compression_type_byte = chunk_reader.ReadByte();
+  if (ABSL_PREDICT_FALSE(compression_type_byte == absl::nullopt)) {
+    return absl::DataLossError("Reading compression type failed");
+  }
+  const CompressionType compression_type =
+      static_cast<CompressionType>(*compression_type_byte);
+
+  const absl::optional<uint64_t> header_size = ReadVarint64(chunk_reader);
+  if (ABSL_PREDICT_FALSE(header_size == absl::nullopt)) {
+    return absl::DataLossError("Reading header size failed");
+  }
+  Chain header;
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Read(*header_size, header))) {
+    return absl::DataLossError("Reading header failed");
+  }
+  transposed_chunk.set_header_size(*header_size);
+  internal::Decompressor<ChainReader<>> header_decompressor(
+      std::forward_as_tuple(&header), compression_type, zstd_dictionary);
+  if (ABSL_PREDICT_FALSE(!header_decompressor.healthy())) {
+    return header_decompressor.status();
+  }
+  Reader& header_reader = header_decompressor.reader();
+
+  const absl::optional<uint32_t> num_buckets = ReadVarint32(header_reader);
+  if (ABSL_PREDICT_FALSE(num_buckets == absl::nullopt)) {
+    return absl::DataLossError("Reading number of buckets failed");
+  }
+  const absl::optional<uint32_t> num_buffers = ReadVarint32(header_reader);
+  if (ABSL_PREDICT_FALSE(num_buffers == absl::nullopt)) {
+    return absl::DataLossError("Reading number of buffers failed");
+  }
+  transposed_chunk.set_num_buckets(*num_buckets);
+  transposed_chunk.set_num_buffers(*num_buffers);
+  std::vector<uint64_t> bucket_lengths;
+  uint64_t buckets_size = 0;
+  for (uint32_t bucket_index = 0; bucket_index < *num_buckets; ++bucket_index) {
+    const absl::optional<uint64_t> bucket_length = ReadVarint64(header_reader);
+    if (ABSL_PREDICT_FALSE(bucket_length == absl::nullopt)) {
+      return absl::DataLossError("Reading bucket length failed");
+    }
+    if (ABSL_PREDICT_FALSE(*bucket_length > chunk.data.size())) {
+      return absl::DataLossError("Bucket too large");
+    }
+    bucket_lengths.push_back(*bucket_length);
+    buckets_size += *bucket_length;
+  }
+  // `buffer_lengths` are populated one by one, so their number is limited by
+  // the header size even if `*num_buffers` is corrupted.
+  std::vector<uint64_t> buffer_lengths;
+  for (uint32_t buffer_index = 0; buffer_index < *num_buffers;
+       ++buffer_index) {
+    const absl::optional<uint64_t> buffer_length = ReadVarint64(header_reader);
+    if (ABSL_PREDICT_FALSE(buffer_length == absl::nullopt)) {
+      return absl::DataLossError("Reading buffer length failed");
+    }
+    buffer_lengths.push_back(*buffer_length);
+  }
+  if (ABSL_PREDICT_FALSE(buckets_size >
+                         chunk.data.size() - chunk_reader.pos())) {
+    return absl::DataLossError("Buckets too large");
+  }
+  transposed_chunk.set_buckets_size(buckets_size);
+  transposed_chunk.set_transitions_size(chunk.data.size() -
+                                        chunk_reader.pos() - buckets_size);
+
+  const absl::optional<uint32_t> state_machine_size =
+      ReadVarint32(header_reader);
+  if (ABSL_PREDICT_FALSE(state_machine_size == absl::nullopt)) {
+    return absl::DataLossError("Reading state machine size failed");
+  }
+  transposed_chunk.set_state_machine_size(*state_machine_size);
+  if (!field_sizes) return absl::OkStatus();
+
+  std::vector<uint32_t> tags;
+  size_t num_subtypes = 0;
+  for (uint32_t i = 0; i < *state_machine_size; ++i) {
+    const absl::optional<uint32_t> tag = ReadVarint32(header_reader);
+    if (ABSL_PREDICT_FALSE(tag == absl::nullopt)) {
+      return absl::DataLossError("Reading field tag failed");
+    }
+    tags.push_back(*tag);
+    if (*tag >= 8 && GetTagWireType(*tag) <= WireType::kFixed32 &&
+        internal::HasSubtype(*tag)) {
+      ++num_subtypes;
+    }
+  }
+  for (uint32_t i = 0; i < *state_machine_size; ++i) {
+    if (ABSL_PREDICT_FALSE(ReadVarint32(header_reader) == absl::nullopt)) {
+      return absl::DataLossError("Reading next node index failed");
+    }
+  }
+  std::string subtypes;
+  if (ABSL_PREDICT_FALSE(!header_reader.Read(num_subtypes, subtypes))) {
+    return absl::DataLossError("Reading subtypes failed");
+  }
+  // Tag of the field whose values are in each buffer, 0 for non-proto records.
+  std::vector<absl::optional<uint32_t>> buffer_tags(buffer_lengths.size());
+  bool has_nonproto_op = false;
+  size_t subtype_index = 0;
+  for (uint32_t tag : tags) {
+    switch (static_cast<internal::MessageId>(tag)) {
+      case internal::MessageId::kNoOp:
+      case internal::MessageId::kStartOfMessage:
+      case internal::MessageId::kStartOfSubmessage:
+        continue;
+      case internal::MessageId::kNonProto:
+        has_nonproto_op = true;
+        tag = 0;
+        break;
+      default: {
+        internal::Subtype subtype = internal::Subtype::kTrivial;
+        if (GetTagWireType(tag) == internal::kSubmessageWireType) {
+          tag -= static_cast<uint32_t>(internal::kSubmessageWireType) -
+                 static_cast<uint32_t>(WireType::kLengthDelimited);
+          subtype = internal::Subtype::kLengthDelimitedEndOfSubmessage;
+        }
+        if (ABSL_PREDICT_FALSE(tag < 8 ||
+                               GetTagWireType(tag) > WireType::kFixed32)) {
+          return absl::DataLossError("Invalid tag");
+        }
+        if (internal::HasSubtype(tag)) {
+          if (ABSL_PREDICT_FALSE(subtype_index == subtypes.size())) {
+            return absl::DataLossError("Too few subtypes");
+          }
+          subtype = static_cast<internal::Subtype>(subtypes[subtype_index++]);
+        }
+        if (!internal::HasDataBuffer(tag, subtype)) continue;
+      } break;
+    }
+    const absl::optional<uint32_t> buffer_index = ReadVarint32(header_reader);
+    if (ABSL_PREDICT_FALSE(buffer_index == absl::nullopt)) {
+      return absl::DataLossError("Reading buffer index failed");
+    }
+    if (ABSL_PREDICT_FALSE(*buffer_index >= buffer_tags.size())) {
+      return absl::DataLossError("Buffer index too large");
+    }
+    // Nodes for varints of different lengths share a buffer.
+    if (buffer_tags[*buffer_index] == absl::nullopt) {
+      buffer_tags[*buffer_index] = tag;
+    }
+  }
+  if (has_nonproto_op && !buffer_tags.empty()) {
+    // The last buffer contains lengths of non-proto records.
+    buffer_tags.back() = 0;
+  }
+
+  // Buffers are stored consecutively in buckets, with sizes of buckets not
+  // stored, so buckets are decompressed to find out which buffers they
+  // contain.
+  std::vector<uint64_t> bucket_decoded_sizes;
+  for (const uint64_t bucket_length : bucket_lengths) {
+    Chain bucket;
+    if (ABSL_PREDICT_FALSE(!chunk_reader.Read(bucket_length, bucket))) {
+      return absl::DataLossError("Reading bucket failed");
+    }
+    internal::Decompressor<ChainReader<>> bucket_decompressor(
+        std::forward_as_tuple(&bucket), compression_type, zstd_dictionary);
+    uint64_t decoded_size = 0;
+    while (bucket_decompressor.reader().Pull()) {
+      decoded_size += bucket_decompressor.reader().available();
+      bucket_decompressor.reader().move_cursor(
+          bucket_decompressor.reader().available());
+    }
+    if (ABSL_PREDICT_FALSE(!bucket_decompressor.VerifyEndAndClose())) {
+      return bucket_decompressor.status();
+    }
+    bucket_decoded_sizes.push_back(decoded_size);
+  }
+  if (ABSL_PREDICT_FALSE(bucket_decoded_sizes.empty() &&
+                         !buffer_lengths.empty())) {
+    return absl::DataLossError("Too few buckets");
+  }
+  std::map<uint32_t, summary::FieldSize> fields;
+  size_t bucket_index = 0;
+  uint64_t remaining = bucket_decoded_sizes.empty() ? 0
+                                                    : bucket_decoded_sizes[0];
+  for (size_t buffer_index = 0; buffer_index < buffer_lengths.size();
+       ++buffer_index) {
+    const uint64_t buffer_length = buffer_lengths[buffer_index];
+    if (ABSL_PREDICT_FALSE(buffer_length > remaining)) {
+      return absl::DataLossError("Buffer too large");
+    }
+    remaining -= buffer_length;
+    const uint32_t tag = buffer_tags[buffer_index].value_or(0);
+    summary::FieldSize& field = fields[tag];
+    field.set_field_number(IntCast<uint32_t>(tag >> 3));
+    field.set_wire_type(tag & 7);
+    field.set_decoded_size(field.decoded_size() + buffer_length);
+    if (buffer_length > 0) {
+      field.set_estimated_size(
+          field.estimated_size() +
+          static_cast<uint64_t>(std::round(
+              static_cast<double>(bucket_lengths[bucket_index]) *
+              static_cast<double>(buffer_length) /
+              static_cast<double>(bucket_decoded_sizes[bucket_index]))));
+    }
+    while (remaining == 0 && bucket_index + 1 < bucket_decoded_sizes.size()) {
+      remaining = bucket_decoded_sizes[++bucket_index];
+    }
+  }
+  for (const auto& field : fields) {
+    *transposed_chunk.add_field_sizes() = field.second;
+  }
+  return absl::OkStatus();
+}
+
+// `RecordWriter` options whose effect is estimated by encoding records again.
+struct Recompression {
+  std::string text;
+  RecordWriterBase::Options options;
+};
+
+// Sizes of records of a chunk encoded again with a `Recompression`.
+struct RecompressionSample {
+  uint64_t recompressed_size = 0;
+  absl::Duration encoding_time;
+};
+
+// Returns the size of `records` split at `limits` encoded as one chunk.
+//
+// Based on `RecordWriterBase::Worker::MakeBaseChunkEncoder()`.
+absl::Status EncodedSize(const RecordWriterBase::Options& options,
+                         bool transpose, Chain records,
+                         std::vector<size_t> limits, uint64_t& size) {
+  std::unique_ptr<ChunkEncoder> chunk_encoder;
+  if (transpose) {
+    const uint64_t bucket_size = UnsignedMax(
+        static_cast<uint64_t>(std::round(static_cast<double>(records.size()) *
+                                         options.bucket_fraction())),
+        uint64_t{1});
+    chunk_encoder = std::make_unique<TransposeEncoder>(
+        options.compressor_options(), bucket_size);
+  } else {
+    chunk_encoder = std::make_unique<SimpleEncoder>(
+        options.compressor_options(), records.size());
+  }
+  if (ABSL_PREDICT_FALSE(
+          !chunk_encoder->AddRecords(std::move(records), std::move(limits)))) {
+    return chunk_encoder->status();
+  }
+  NullWriter dest(NullWriter::kInitiallyOpen);
+  ChunkType chunk_type;
+  uint64_t num_records;
+  uint64_t decoded_data_size;
+  if (ABSL_PREDICT_FALSE(!chunk_encoder->EncodeAndClose(
+          dest, chunk_type, num_records, decoded_data_size))) {
+    return chunk_encoder->status();
+  }
+  if (ABSL_PREDICT_FALSE(!dest.Close())) return dest.status();
+  size = dest.pos();
+  return absl::OkStatus();
+}
+
+// Decodes records of `chunk` and encodes them again with each of
+// `recompressions`. With `auto_transpose`, the smaller encoding is taken.
+absl::Status Recompress(const Chunk& chunk,
+                        const ZstdReaderBase::Dictionary& zstd_dictionary,
+                        const std::vector<Recompression>& recompressions,
+                        std::vector<RecompressionSample>& samples) {
+  ChunkDecoder chunk_decoder(
+      ChunkDecoder::Options().set_zstd_dictionary(zstd_dictionary));
+  if (ABSL_PREDICT_FALSE(!chunk_decoder.Decode(chunk))) {
+    return chunk_decoder.status();
+  }
+  Chain records;
+  std::vector<size_t> limits;
+  chunk_decoder.TakeRecords(records, limits);
+  for (const Recompression& recompression : recompressions) {
+    const RecordWriterBase::Options& options = recompression.options;
+    RecompressionSample sample;
+    const absl::Time encoding_start = absl::Now();
+    {
+      const absl::Status status =
+          EncodedSize(options, options.transpose() && !options.auto_transpose(),
+                      records, limits, sample.recompressed_size);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    }
+    if (options.auto_transpose()) {
+      uint64_t transposed_size;
+      const absl::Status status =
+          EncodedSize(options, true, records, limits, transposed_size);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+      sample.recompressed_size =
+          UnsignedMin(sample.recompressed_size, transposed_size);
+    }
+    sample.encoding_time = absl::Now() - encoding_start;
+    samples.push_back(sample);
+  }
+  return absl::OkStatus();
+}
+
+void DescribeFileSummary(const FileSummary& file_summary,
+                         summary::FileSummaryChunk& file_summary_chunk) {
+  file_summary_chunk.set_num_records(file_summary.num_records);
+  file_summary_chunk.set_num_chunks(file_summary.num_chunks);
+  file_summary_chunk.set_num_decoded_bytes(file_summary.num_decoded_bytes);
+  for (const uint64_t count : file_summary.record_size_histogram) {
+    file_summary_chunk.add_record_size_histogram(count);
+  }
+  if (!file_summary.key_sketch.empty()) {
+    file_summary_chunk.set_estimated_num_distinct_keys(
+        file_summary.EstimateNumDistinctKeys());
+  }
+}
+
+// What is found about a chunk, possibly in background.
+struct ChunkDescription {
+  summary::Chunk chunk_summary;
+  // Parallel to `Recompression`s, empty if the chunk is not sampled.
+  std::vector<RecompressionSample> recompression_samples;
+  // Problems found while describing the chunk.
+  std::vector<absl::Status> errors;
+};
+
+// Describes `chunk` which begins at `chunk_begin`.
+//
+// If `recompressions != nullptr`, records are encoded again with them.
+ChunkDescription DescribeChunk(
+    const Chunk& chunk, Position chunk_begin,
+    const ZstdReaderBase::Dictionary& zstd_dictionary, bool field_sizes,
+    const std::vector<Recompression>* recompressions) {
+  ChunkDescription description;
+  summary::Chunk& chunk_summary = description.chunk_summary;
+  chunk_summary.set_chunk_begin(chunk_begin);
+  chunk_summary.set_chunk_type(
+      static_cast<summary::ChunkType>(chunk.header.chunk_type()));
+  chunk_summary.set_data_size(chunk.header.data_size());
+  chunk_summary.set_num_records(chunk.header.num_records());
+  chunk_summary.set_decoded_data_size(chunk.header.decoded_data_size());
+  absl::Status status;
+  switch (chunk.header.chunk_type()) {
+    case ChunkType::kFileMetadata:
+      status = DescribeFileMetadataChunk(
+          chunk, *chunk_summary.mutable_file_metadata_chunk());
+      break;
+    case ChunkType::kSimple:
+      status = DescribeSimpleChunk(chunk, zstd_dictionary,
+                                   *chunk_summary.mutable_simple_chunk());
+      break;
+    case ChunkType::kTransposed:
+      status = DescribeTransposedChunk(
+          chunk, zstd_dictionary, *chunk_summary.mutable_transposed_chunk());
+      if (status.ok()) {
+        status = DescribeTransposedLayout(
+            chunk, zstd_dictionary, field_sizes,
+            *chunk_summary.mutable_transposed_chunk());
+      }
+      break;
+    case ChunkType::kFileSummary: {
+      FileSummary file_summary;
+      status = file_summary.DecodeChunk(chunk, chunk_begin);
+      if (status.ok()) {
+        DescribeFileSummary(file_summary,
+                            *chunk_summary.mutable_file_summary_chunk());
+      }
+    } break;
+    default:
+      break;
+  }
+  if (ABSL_PREDICT_FALSE(!status.ok())) {
+    description.errors.push_back(std::move(status));
+  }
+  if (recompressions != nullptr) {
+    status = Recompress(chunk, zstd_dictionary, *recompressions,
+                        description.recompression_samples);
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      description.recompression_samples.clear();
+      description.errors.push_back(std::move(status));
+    }
+  }
+  return description;
+}
+
+bool HasRecords(const summary::Chunk& chunk_summary) {
+  return chunk_summary.chunk_type() == summary::SIMPLE ||
+         chunk_summary.chunk_type() == summary::TRANSPOSED;
+}
+
+void FillDistribution(std::vector<uint64_t> values,
+                      summary::Distribution& distribution) {
+  if (values.empty()) return;
+  std::sort(values.begin(), values.end());
+  long double sum = 0.0L;
+  for (const uint64_t value : values) sum += static_cast<long double>(value);
+  // Nearest-rank percentile.
+  const auto percentile = [&](double fraction) {
+    const size_t rank = static_cast<size_t>(
+        std::ceil(fraction * static_cast<double>(values.size())));
+    return values[UnsignedMax(rank, size_t{1}) - 1];
+  };
+  distribution.set_count(values.size());
+  distribution.set_min(values.front());
+  distribution.set_max(values.back());
+  distribution.set_mean(
+      static_cast<double>(sum / static_cast<long double>(values.size())));
+  distribution.set_p50(percentile(0.50));
+  distribution.set_p90(percentile(0.90));
+  distribution.set_p99(percentile(0.99));
+}
+
+// Accumulates `ChunkDescription`s into a `summary::Summary`.
+class SummaryBuilder {
+ public:
+  explicit SummaryBuilder(const std::vector<Recompression>& recompressions)
+      : recompressions_(&recompressions),
+        recompression_totals_(recompressions.size()) {}
+
+  void AddSkippedRegion(const SkippedRegion& skipped_region) {
+    skipped_size_ += skipped_region.length();
+  }
+
+  void AddChunk(const ChunkDescription& description);
+
+  void Build(summary::Summary& summary) const;
+
+ private:
+  struct RecompressionTotals {
+    uint64_t num_sampled_chunks = 0;
+    uint64_t original_size = 0;
+    uint64_t recompressed_size = 0;
+    uint64_t decoded_size = 0;
+    absl::Duration encoding_time;
+  };
+
+  const std::vector<Recompression>* recompressions_;
+  uint64_t num_chunks_ = 0;
+  uint64_t num_records_ = 0;
+  uint64_t skipped_size_ = 0;
+  uint64_t records_data_size_ = 0;
+  std::vector<uint64_t> chunk_data_sizes_;
+  std::vector<uint64_t> chunk_decoded_data_sizes_;
+  std::vector<uint64_t> chunk_num_records_;
+  // Keyed by chunk type and compression type.
+  std::map<std::pair<int, int>, summary::ChunkTypeSummary> chunk_types_;
+  summary::TransposedSummary transposed_;
+  std::vector<uint64_t> state_machine_sizes_;
+  // Keyed by field number and wire type.
+  std::map<std::pair<uint32_t, uint32_t>, summary::FieldSize> field_sizes_;
+  std::vector<RecompressionTotals> recompression_totals_;
+};
+
+void SummaryBuilder::AddChunk(const ChunkDescription& description) {
+  const summary::Chunk& chunk_summary = description.chunk_summary;
+  ++num_chunks_;
+  num_records_ += chunk_summary.num_records();
+  int compression_type = summary::NONE;
+  if (chunk_summary.has_simple_chunk()) {
+    compression_type = chunk_summary.simple_chunk().compression_type();
+  } else if (chunk_summary.has_transposed_chunk()) {
+    compression_type = chunk_summary.transposed_chunk().compression_type();
+  }
+  summary::ChunkTypeSummary& chunk_type =
+      chunk_types_[std::make_pair(chunk_summary.chunk_type(),
+                                  compression_type)];
+  chunk_type.set_chunk_type(chunk_summary.chunk_type());
+  chunk_type.set_compression_type(
+      static_cast<summary::CompressionType>(compression_type));
+  chunk_type.set_num_chunks(chunk_type.num_chunks() + 1);
+  chunk_type.set_num_records(chunk_type.num_records() +
+                             chunk_summary.num_records());
+  chunk_type.set_data_size(chunk_type.data_size() + chunk_summary.data_size());
+  chunk_type.set_decoded_data_size(chunk_type.decoded_data_size() +
+                                   chunk_summary.decoded_data_size());
+  if (!HasRecords(chunk_summary)) return;
+  records_data_size_ += chunk_summary.data_size();
+  chunk_data_sizes_.push_back(chunk_summary.data_size());
+  chunk_decoded_data_sizes_.push_back(chunk_summary.decoded_data_size());
+  chunk_num_records_.push_back(chunk_summary.num_records());
+  if (chunk_summary.has_transposed_chunk()) {
+    const summary::TransposedChunk& transposed_chunk =
+        chunk_summary.transposed_chunk();
+    transposed_.set_num_chunks(transposed_.num_chunks() + 1);
+    transposed_.set_header_size(transposed_.header_size() +
+                                transposed_chunk.header_size());
+    transposed_.set_buckets_size(transposed_.buckets_size() +
+                                 transposed_chunk.buckets_size());
+    transposed_.set_transitions_size(transposed_.transitions_size() +
+                                     transposed_chunk.transitions_size());
+    state_machine_sizes_.push_back(transposed_chunk.state_machine_size());
+    for (const summary::FieldSize& field : transposed_chunk.field_sizes()) {
+      summary::FieldSize& total = field_sizes_[std::make_pair(
+          field.field_number(), field.wire_type())];
+      total.set_field_number(field.field_number());
+      total.set_wire_type(field.wire_type());
+      total.set_decoded_size(total.decoded_size() + field.decoded_size());
+      total.set_estimated_size(total.estimated_size() +
+                               field.estimated_size());
+    }
+  }
+  for (size_t i = 0; i < description.recompression_samples.size(); ++i) {
+    const RecompressionSample& sample = description.recompression_samples[i];
+    RecompressionTotals& totals = recompression_totals_[i];
+    ++totals.num_sampled_chunks;
+    totals.original_size += chunk_summary.data_size();
+    totals.recompressed_size += sample.recompressed_size;
+    totals.decoded_size += chunk_summary.decoded_data_size();
+    totals.encoding_time += sample.encoding_time;
+  }
+}
+
+void SummaryBuilder::Build(summary::Summary& summary) const {
+  summary.set_num_chunks(num_chunks_);
+  summary.set_num_records(num_records_);
+  summary.set_skipped_size(skipped_size_);
+  FillDistribution(chunk_data_sizes_, *summary.mutable_chunk_data_size());
+  FillDistribution(chunk_decoded_data_sizes_,
+                   *summary.mutable_chunk_decoded_data_size());
+  FillDistribution(chunk_num_records_, *summary.mutable_chunk_num_records());
+  for (const auto& entry : chunk_types_) {
+    summary::ChunkTypeSummary& chunk_type = *summary.add_chunk_types();
+    chunk_type = entry.second;
+    if (chunk_type.data_size() > 0) {
+      chunk_type.set_compression_ratio(
+          static_cast<double>(chunk_type.decoded_data_size()) /
+          static_cast<double>(chunk_type.data_size()));
+    }
+  }
+  if (transposed_.num_chunks() > 0) {
+    summary::TransposedSummary& transposed = *summary.mutable_transposed();
+    transposed = transposed_;
+    FillDistribution(state_machine_sizes_,
+                     *transposed.mutable_state_machine_size());
+    std::vector<summary::FieldSize> field_sizes;
+    for (const auto& entry : field_sizes_) field_sizes.push_back(entry.second);
+    std::stable_sort(
+        field_sizes.begin(), field_sizes.end(),
+        [](const summary::FieldSize& a, const summary::FieldSize& b) {
+          return a.estimated_size() > b.estimated_size();
+        });
+    for (summary::FieldSize& field : field_sizes) {
+      *transposed.add_field_sizes() = std::move(field);
+    }
+  }
+  for (size_t i = 0; i < recompression_totals_.size(); ++i) {
+    const RecompressionTotals& totals = recompression_totals_[i];
+    summary::RecompressionEstimate& estimate = *summary.add_recompression();
+    estimate.set_options((*recompressions_)[i].text);
+    estimate.set_num_sampled_chunks(totals.num_sampled_chunks);
+    estimate.set_original_size(totals.original_size);
+    estimate.set_recompressed_size(totals.recompressed_size);
+    if (totals.original_size > 0) {
+      const double size_ratio = static_cast<double>(totals.recompressed_size) /
+                                static_cast<double>(totals.original_size);
+      estimate.set_size_ratio(size_ratio);
+      estimate.set_estimated_records_size(static_cast<uint64_t>(
+          std::round(static_cast<double>(records_data_size_) * size_ratio)));
+    }
+    if (totals.encoding_time > absl::ZeroDuration()) {
+      estimate.set_encoding_speed(
+          static_cast<double>(totals.decoded_size) / 1e6 /
+          absl::ToDoubleSeconds(totals.encoding_time));
+    }
+  }
+}
+
+// Shows only the file summary, for `--file_summary_only`.
+void DescribeFileSummaryOnly(absl::string_view filename,
+                             std::ostream& report) {
+  absl::Format(&report,
+               "file {\n"
+               "  filename: \"%s\"\n",
+               absl::Utf8SafeCEscape(filename));
+  RecordReader<FdReader<>> record_reader(
+      std::forward_as_tuple(filename, O_RDONLY));
+  FileSummary file_summary;
+  if (record_reader.ReadFileSummary(file_summary)) {
+    summary::FileSummaryChunk file_summary_chunk;
+    DescribeFileSummary(file_summary, file_summary_chunk);
+    google::protobuf::TextFormat::Printer printer;
+    printer.SetInitialIndentLevel(2);
+    printer.SetUseShortRepeatedPrimitives(true);
+    absl::Format(&report, "  file_summary {\n");
+    {
+      // `proto_out` is flushed when destroyed.
+      google::protobuf::io::OstreamOutputStream proto_out(&report);
+      printer.Print(file_summary_chunk, &proto_out);
+    }
+    absl::Format(&report, "  }\n");
+  } else if (record_reader.healthy()) {
+    absl::Format(&std::cerr, "No file summary in %s\n", filename);
+  }
+  absl::Format(&report, "}\n");
+  report.flush();
+  if (!record_reader.Close()) {
+    absl::Format(&std::cerr, "%s\n", record_reader.status().message());
+  }
+}
+
+void DescribeFile(absl::string_view filename,
+                  const std::vector<Recompression>& recompressions,
+                  std::ostream& report) {
+  const bool show_records_metadata = absl::GetFlag(FLAGS_show_records_metadata);
+  const bool show_chunks = absl::GetFlag(FLAGS_show_chunks);
+  const bool show_field_sizes = absl::GetFlag(FLAGS_show_field_sizes);
+  const bool show_summary =
+      absl::GetFlag(FLAGS_show_summary) || !recompressions.empty();
+  const int parallelism = absl::GetFlag(FLAGS_parallelism);
+  const uint64_t recompress_sample_interval = IntCast<uint64_t>(
+      std::max(absl::GetFlag(FLAGS_recompress_sample_interval), 1));
   absl::Format(&report,
                "file {\n"
                "  filename: \"%s\"\n",
@@ -196,6 +855,43 @@ void DescribeFile(absl::string_view filename, std::ostream& report) {
   printer.SetInitialIndentLevel(2);
   printer.SetUseShortRepeatedPrimitives(true);
   printer.SetUseUtf8StringEscaping(true);
+  SummaryBuilder summary_builder(recompressions);
+  ZstdReaderBase::Dictionary zstd_dictionary;
+  const auto report_chunk = [&](ChunkDescription description) {
+    for (const absl::Status& error : description.errors) {
+      absl::Format(&std::cerr, "%s\n", error.message());
+    }
+    if (show_summary) summary_builder.AddChunk(description);
+    if (!show_chunks) return;
+    summary::Chunk& chunk_summary = description.chunk_summary;
+    if (!show_records_metadata) chunk_summary.clear_file_metadata_chunk();
+    if (!show_field_sizes && chunk_summary.has_transposed_chunk()) {
+      chunk_summary.mutable_transposed_chunk()->clear_field_sizes();
+    }
+    absl::Format(&report, "  chunk {\n");
+    {
+      // `proto_out` is flushed when destroyed.
+      google::protobuf::io::OstreamOutputStream proto_out(&report);
+      printer.Print(chunk_summary, &proto_out);
+    }
+    absl::Format(&report, "  }\n");
+  };
+  struct DescribeRequest {
+    Chunk chunk;
+    Position chunk_begin;
+    ZstdReaderBase::Dictionary zstd_dictionary;
+    bool sampled;
+    std::promise<ChunkDescription> description;
+  };
+  // Chunks being described in background, in the order of the file.
+  std::deque<std::future<ChunkDescription>> pending;
+  const auto report_pending = [&](size_t max_pending) {
+    while (pending.size() > max_pending) {
+      report_chunk(pending.front().get());
+      pending.pop_front();
+    }
+  };
+  uint64_t num_chunks_with_records = 0;
   for (;;) {
     report.flush();
     const Position chunk_begin = chunk_reader.pos();
@@ -203,45 +899,60 @@ void DescribeFile(absl::string_view filename, std::ostream& report) {
     if (ABSL_PREDICT_FALSE(!chunk_reader.ReadChunk(chunk))) {
       SkippedRegion skipped_region;
       if (chunk_reader.Recover(&skipped_region)) {
+        report_pending(0);
         absl::Format(&std::cerr, "%s\n", skipped_region.message());
+        summary_builder.AddSkippedRegion(skipped_region);
         continue;
       }
       break;
     }
-    summary::Chunk chunk_summary;
-    chunk_summary.set_chunk_begin(chunk_begin);
-    chunk_summary.set_chunk_type(
-        static_cast<summary::ChunkType>(chunk.header.chunk_type()));
-    chunk_summary.set_data_size(chunk.header.data_size());
-    chunk_summary.set_num_records(chunk.header.num_records());
-    chunk_summary.set_decoded_data_size(chunk.header.decoded_data_size());
-    {
-      absl::Status status;
-      switch (chunk.header.chunk_type()) {
-        case ChunkType::kFileMetadata:
-          if (absl::GetFlag(FLAGS_show_records_metadata)) {
-            status = DescribeFileMetadataChunk(
-                chunk, *chunk_summary.mutable_file_metadata_chunk());
-          }
-          break;
-        case ChunkType::kSimple:
-          status =
-              DescribeSimpleChunk(chunk, *chunk_summary.mutable_simple_chunk());
-          break;
-        case ChunkType::kTransposed:
-          status = DescribeTransposedChunk(
-              chunk, *chunk_summary.mutable_transposed_chunk());
-          break;
-        default:
-          break;
-      }
-      if (ABSL_PREDICT_FALSE(!status.ok())) {
-        absl::Format(&std::cerr, "%s\n", status.message());
+    const bool has_records =
+        chunk.header.chunk_type() == ChunkType::kSimple ||
+        chunk.header.chunk_type() == ChunkType::kTransposed;
+    const bool sampled =
+        has_records && !recompressions.empty() &&
+        num_chunks_with_records++ % recompress_sample_interval == 0;
+    const bool field_sizes = show_field_sizes || show_summary;
+    if (parallelism == 0 ||
+        chunk.header.chunk_type() == ChunkType::kFileMetadata) {
+      // File metadata are described in this thread because they can contain
+      // a Zstd dictionary needed for describing further chunks.
+      report_pending(0);
+      ChunkDescription description =
+          DescribeChunk(chunk, chunk_begin, zstd_dictionary, field_sizes,
+                        sampled ? &recompressions : nullptr);
+      const summary::Chunk& chunk_summary = description.chunk_summary;
+      if (zstd_dictionary.empty() && chunk_summary.has_file_metadata_chunk() &&
+          chunk_summary.file_metadata_chunk().has_zstd_dictionary()) {
+        zstd_dictionary.set_data(
+            chunk_summary.file_metadata_chunk().zstd_dictionary());
       }
+      report_chunk(std::move(description));
+      continue;
+    }
+    report_pending(IntCast<size_t>(parallelism) - 1);
+    DescribeRequest* const request = new DescribeRequest();
+    request->chunk = std::move(chunk);
+    request->chunk_begin = chunk_begin;
+    request->zstd_dictionary = zstd_dictionary;
+    request->sampled = sampled;
+    pending.push_back(request->description.get_future());
+    ThreadPool::global().Schedule([request, field_sizes, &recompressions] {
+      request->description.set_value(DescribeChunk(
+          request->chunk, request->chunk_begin, request->zstd_dictionary,
+          field_sizes, request->sampled ? &recompressions : nullptr));
+      delete request;
+    });
+  }
+  report_pending(0);
+  if (show_summary) {
+    summary::Summary summary;
+    summary_builder.Build(summary);
+    absl::Format(&report, "  summary {\n");
+    {
+      google::protobuf::io::OstreamOutputStream proto_out(&report);
+      printer.Print(summary, &proto_out);
     }
-    absl::Format(&report, "  chunk {\n");
-    google::protobuf::io::OstreamOutputStream proto_out(&report);
-    printer.Print(chunk_summary, &proto_out);
     absl::Format(&report, "  }\n");
   }
   absl::Format(&report, "}\n");
@@ -263,7 +974,29 @@ const char kUsage[] =
 int main(int argc, char** argv) {
   absl::SetProgramUsageMessage(riegeli::tools::kUsage);
   const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  if (absl::GetFlag(FLAGS_parallelism) < 0) {
+    std::cerr << "--parallelism must not be negative" << std::endl;
+    return 1;
+  }
+  std::vector<riegeli::tools::Recompression> recompressions;
+  const std::string recompress = absl::GetFlag(FLAGS_recompress);
+  for (const absl::string_view text :
+       absl::StrSplit(recompress, ';', absl::SkipWhitespace())) {
+    riegeli::tools::Recompression recompression;
+    recompression.text = std::string(text);
+    const absl::Status status = recompression.options.FromString(text);
+    if (!status.ok()) {
+      std::cerr << "--recompress: " << status.message() << std::endl;
+      return 1;
+    }
+    recompressions.push_back(std::move(recompression));
+  }
+  const bool file_summary_only = absl::GetFlag(FLAGS_file_summary_only);
   for (size_t i = 1; i < args.size(); ++i) {
-    riegeli::tools::DescribeFile(args[i], std::cout);
+    if (file_summary_only) {
+      riegeli::tools::DescribeFileSummaryOnly(args[i], std::cout);
+    } else {
+      riegeli::tools::DescribeFile(args[i], recompressions, std::cout);
+    }
   }
 }
@@ -0,0 +1,164 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Converts a file of JSON lines to a Riegeli/records file of binary protos.
+// The message type is taken from the metadata of another Riegeli/records file,
+// and is stored in the metadata of the output file.
+
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/lines/json_lines_to_records.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/records_metadata.pb.h"
+
+ABSL_FLAG(std::string, metadata_from, "",
+          "Riegeli/records file whose metadata specifies the message type "
+          "(record_type_name and file_descriptor). Required.");
+ABSL_FLAG(std::string, record_writer_options, "",
+          "Options for writing, in the format of "
+          "RecordWriterBase::Options::FromString(), e.g. "
+          "\"transpose,parallelism:8\".");
+ABSL_FLAG(int32_t, parallelism, 8,
+          "Maximum number of segments of the input read and converted in "
+          "parallel.");
+ABSL_FLAG(int64_t, segment_size, int64_t{16} << 20,
+          "Size of segments of the input, in bytes.");
+ABSL_FLAG(bool, ignore_unknown_fields, false,
+          "Skip JSON fields which are not present in the message type instead "
+          "of failing.");
+
+namespace riegeli {
+namespace tools {
+namespace {
+
+absl::Status ReadMetadataFrom(absl::string_view filename,
+                              RecordsMetadata& metadata) {
+  RecordReader<FdReader<>> record_reader(
+      std::forward_as_tuple(filename, O_RDONLY));
+  if (ABSL_PREDICT_FALSE(!record_reader.ReadMetadata(metadata))) {
+    return record_reader.status();
+  }
+  if (ABSL_PREDICT_FALSE(!record_reader.Close())) {
+    return record_reader.status();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ConvertFile(absl::string_view src_filename,
+                         absl::string_view dest_filename,
+                         absl::string_view metadata_filename,
+                         RecordWriterBase::Options record_writer_options,
+                         const JsonLinesToRecordsOptions& options) {
+  RecordsMetadata metadata;
+  {
+    const absl::Status status = ReadMetadataFrom(metadata_filename, metadata);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  const RecordsMetadataDescriptors descriptors(metadata);
+  if (ABSL_PREDICT_FALSE(!descriptors.healthy())) return descriptors.status();
+  const google::protobuf::Descriptor* const descriptor =
+      descriptors.descriptor();
+  if (ABSL_PREDICT_FALSE(descriptor == nullptr)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("No message type in metadata of ", metadata_filename));
+  }
+  RecordsMetadata dest_metadata;
+  dest_metadata.set_record_type_name(metadata.record_type_name());
+  *dest_metadata.mutable_file_descriptor() = metadata.file_descriptor();
+  record_writer_options.set_metadata(std::move(dest_metadata));
+  RecordWriter<FdWriter<>> record_writer(
+      std::forward_as_tuple(dest_filename, O_WRONLY | O_CREAT | O_TRUNC),
+      std::move(record_writer_options));
+  {
+    const absl::Status status = WriteJsonLinesAsRecords(
+        src_filename, *descriptor, record_writer, options);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (ABSL_PREDICT_FALSE(!record_writer.Close())) {
+    return record_writer.status();
+  }
+  return absl::OkStatus();
+}
+
+const char kUsage[] =
+    "Usage: json_lines_to_riegeli (OPTION)... SRC DEST\n"
+    "\n"
+    "Converts a file of JSON lines to a Riegeli/records file of binary "
+    "protos.\n";
+
+}  // namespace
+}  // namespace tools
+}  // namespace riegeli
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(riegeli::tools::kUsage);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  if (args.size() != 3) {
+    std::cerr << absl::ProgramUsageMessage() << std::endl;
+    return 1;
+  }
+  const std::string metadata_from = absl::GetFlag(FLAGS_metadata_from);
+  if (metadata_from.empty()) {
+    std::cerr << "--metadata_from is required" << std::endl;
+    return 1;
+  }
+  riegeli::RecordWriterBase::Options record_writer_options;
+  {
+    const absl::Status status = record_writer_options.FromString(
+        absl::GetFlag(FLAGS_record_writer_options));
+    if (!status.ok()) {
+      std::cerr << "--record_writer_options: " << status.message()
+                << std::endl;
+      return 1;
+    }
+  }
+  const int parallelism = absl::GetFlag(FLAGS_parallelism);
+  const int64_t segment_size = absl::GetFlag(FLAGS_segment_size);
+  if (parallelism <= 0 || segment_size <= 0) {
+    std::cerr << "--parallelism and --segment_size must be positive"
+              << std::endl;
+    return 1;
+  }
+  riegeli::JsonLinesToRecordsOptions options;
+  options.parallel_line_reading_options()
+      .set_parallelism(parallelism)
+      .set_segment_size(riegeli::IntCast<riegeli::Position>(segment_size));
+  options.set_ignore_unknown_fields(absl::GetFlag(FLAGS_ignore_unknown_fields));
+  const absl::Status status =
+      riegeli::tools::ConvertFile(args[1], args[2], metadata_from,
+                                  std::move(record_writer_options), options);
+  if (!status.ok()) {
+    std::cerr << args[1] << ": " << status.message() << std::endl;
+    return 1;
+  }
+}
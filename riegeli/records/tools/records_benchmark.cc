@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -31,7 +32,9 @@
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <random>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
@@ -42,16 +45,20 @@
 #include "absl/flags/usage.h"
 #include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/buffer_pool_allocator.h"
 #include "riegeli/base/errno_mapping.h"
+#include "riegeli/base/memory.h"
 #include "riegeli/base/options_parser.h"
 #include "riegeli/bytes/fd_reader.h"
 #include "riegeli/bytes/fd_writer.h"
 #include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/record_position.h"
 #include "riegeli/records/record_reader.h"
 #include "riegeli/records/record_writer.h"
 #include "riegeli/records/tools/tfrecord_recognizer.h"
@@ -77,6 +84,9 @@ ABSL_FLAG(std::string, riegeli_benchmarks,
           "zstd:3 "
           "zstd:15 "
           "snappy "
+          "snappy,chunk_size:64k "
+          "snappy,chunk_size:64k,parallelism:4 "
+          "snappy,chunk_size:64k,parallelism:16 "
           "transpose,uncompressed "
           "transpose,brotli:6 "
           "transpose,brotli:6,parallelism:10 "
@@ -88,9 +98,69 @@ ABSL_FLAG(uint64_t, max_size, uint64_t{100} * 1000 * 1000,
 ABSL_FLAG(std::string, output_dir, "/tmp",
           "Directory to write files to (files are named record_benchmark_*)");
 ABSL_FLAG(int32_t, repetitions, 5, "Number of times to repeat each benchmark");
+ABSL_FLAG(std::string, threads, "1",
+          "Whitespace-separated numbers of threads. Each benchmark is run once "
+          "per number, by that many concurrent writers, each writing its own "
+          "file, then as many concurrent readers. Read speeds are aggregated "
+          "over threads for real time, and per CPU second for CPU time");
+ABSL_FLAG(bool, shared_file, false,
+          "With multiple threads, make all readers read the file of the first "
+          "writer instead of each reading the file of its writer");
+ABSL_FLAG(bool, latencies, false,
+          "Also report percentiles of latencies of single operations for "
+          "Riegeli benchmarks: WriteRecord() (including stalls for encoding "
+          "chunks), sequential ReadRecord(), and Seek() to a random record "
+          "followed by ReadRecord()");
+ABSL_FLAG(int32_t, random_seeks, 10000,
+          "Number of random seeks measured for --latencies");
+ABSL_FLAG(std::string, allocator, "new",
+          "Allocator of Riegeli buffers and Chain blocks: "
+          "new (operator new), "
+          "malloc (posix_memalign() and free()), "
+          "pool (operator new, with thread-local free lists of common buffer "
+          "sizes), "
+          "huge_pages (operator new, with transparent huge pages for large "
+          "blocks). Run the benchmark once per allocator to compare them");
 
 namespace {
 
+class MallocAllocator : public riegeli::Allocator {
+ public:
+  void* Allocate(size_t size, size_t alignment) override;
+  void Deallocate(void* ptr, size_t size, size_t alignment) override;
+};
+
+void* MallocAllocator::Allocate(size_t size, size_t alignment) {
+  void* ptr;
+  RIEGELI_CHECK_EQ(
+      posix_memalign(&ptr, std::max(alignment, sizeof(void*)), size), 0)
+      << "Out of memory";
+  return ptr;
+}
+
+void MallocAllocator::Deallocate(void* ptr, size_t size, size_t alignment) {
+  free(ptr);
+}
+
+void SetAllocator(absl::string_view allocator) {
+  if (allocator == "new") return;
+  if (allocator == "malloc") {
+    static riegeli::NoDestructor<MallocAllocator> kMallocAllocator;
+    riegeli::SetAllocator(kMallocAllocator.get());
+    return;
+  }
+  if (allocator == "pool") {
+    riegeli::SetAllocator(&riegeli::BufferPoolAllocator::global());
+    return;
+  }
+  if (allocator == "huge_pages") {
+    riegeli::SetHugePagesForLargeAllocations(true);
+    return;
+  }
+  absl::Format(&std::cerr, "Unknown allocator: %s\n", allocator);
+  std::exit(1);
+}
+
 class SizeLimiter {
  public:
   explicit SizeLimiter(size_t limit);
@@ -124,6 +194,21 @@ uint64_t FileSize(const std::string& filename) {
   return riegeli::IntCast<uint64_t>(stat_info.st_size);
 }
 
+// Runs `function(thread_index)` for `thread_index` in [0, `num_threads`)
+// concurrently, and waits for all of them.
+void RunThreads(int num_threads, absl::FunctionRef<void(int)> function) {
+  if (num_threads == 1) {
+    function(0);
+    return;
+  }
+  std::vector<std::thread> threads;
+  threads.reserve(riegeli::IntCast<size_t>(num_threads));
+  for (int thread_index = 0; thread_index < num_threads; ++thread_index) {
+    threads.emplace_back([function, thread_index] { function(thread_index); });
+  }
+  for (std::thread& thread : threads) thread.join();
+}
+
 uint64_t CpuTimeNow_ns() {
   struct timespec time_info;
   RIEGELI_CHECK_EQ(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_info), 0);
@@ -159,6 +244,39 @@ double Stats::Median() {
   return samples_[middle];
 }
 
+// Latencies of single operations, for percentiles of their distribution.
+class Latencies {
+ public:
+  void Add(uint64_t latency_ns);
+
+  bool empty() const { return samples_ns_.empty(); }
+
+  // Returns the latency not exceeded by the `fraction` of samples, in
+  // microseconds.
+  double Percentile(double fraction);
+
+ private:
+  std::vector<uint64_t> samples_ns_;
+  bool sorted_ = true;
+};
+
+void Latencies::Add(uint64_t latency_ns) {
+  samples_ns_.push_back(latency_ns);
+  sorted_ = false;
+}
+
+double Latencies::Percentile(double fraction) {
+  RIEGELI_CHECK(!samples_ns_.empty()) << "No data";
+  if (!sorted_) {
+    std::sort(samples_ns_.begin(), samples_ns_.end());
+    sorted_ = true;
+  }
+  const size_t index = std::min(
+      static_cast<size_t>(fraction * static_cast<double>(samples_ns_.size())),
+      samples_ns_.size() - 1);
+  return static_cast<double>(samples_ns_[index]) / 1000.0;
+}
+
 class Benchmarks {
  public:
   static bool ReadFile(absl::string_view filename,
@@ -166,7 +284,8 @@ class Benchmarks {
                        SizeLimiter* size_limiter, std::ostream& report);
 
   explicit Benchmarks(std::vector<std::string> records, std::string output_dir,
-                      int repetitions);
+                      int repetitions, std::vector<int> num_threads,
+                      bool shared_file, bool latencies, int random_seeks);
 
   void RegisterTFRecord(absl::string_view tfrecord_options);
   void RegisterRiegeli(absl::string_view riegeli_options);
@@ -174,6 +293,9 @@ class Benchmarks {
   void RunAll(std::ostream& report);
 
  private:
+  void RunAllWithThreads(int num_threads, std::ostream& report);
+  void RunLatencies(std::ostream& report);
+
   static void WriteTFRecord(
       absl::string_view filename,
       const tensorflow::io::RecordWriterOptions& record_writer_options,
@@ -193,7 +315,7 @@ class Benchmarks {
       std::vector<std::string>* records, SizeLimiter* size_limiter = nullptr);
 
   void RunOne(
-      absl::string_view name,
+      absl::string_view name, int num_threads,
       absl::FunctionRef<void(absl::string_view,
                              const std::vector<std::string>&)>
           write_records,
@@ -201,12 +323,21 @@ class Benchmarks {
           read_records,
       std::ostream& report);
 
+  void RunOneLatencies(
+      absl::string_view name,
+      const riegeli::RecordWriterBase::Options& record_writer_options,
+      std::ostream& report);
+
   static std::string Filename(absl::string_view name);
 
   std::vector<std::string> records_;
   size_t original_size_;
   std::string output_dir_;
   int repetitions_;
+  std::vector<int> num_threads_;
+  bool shared_file_;
+  bool latencies_;
+  int random_seeks_;
   std::vector<std::pair<std::string, const char*>> tfrecord_benchmarks_;
   std::vector<std::pair<std::string, riegeli::RecordWriterBase::Options>>
       riegeli_benchmarks_;
@@ -347,11 +478,16 @@ std::string Benchmarks::Filename(absl::string_view name) {
 }
 
 Benchmarks::Benchmarks(std::vector<std::string> records, std::string output_dir,
-                       int repetitions)
+                       int repetitions, std::vector<int> num_threads,
+                       bool shared_file, bool latencies, int random_seeks)
     : records_(std::move(records)),
       original_size_(0),
       output_dir_(std::move(output_dir)),
-      repetitions_(repetitions) {
+      repetitions_(repetitions),
+      num_threads_(std::move(num_threads)),
+      shared_file_(shared_file),
+      latencies_(latencies),
+      random_seeks_(random_seeks) {
   for (const std::string& record : records_) {
     original_size_ += riegeli::LengthVarint64(record.size()) + record.size();
   }
@@ -394,20 +530,30 @@ void Benchmarks::RunAll(std::ostream& report) {
   absl::Format(&report, "Original uncompressed size: %.3f MB\n",
                static_cast<double>(original_size_) / 1000000.0);
   absl::Format(&report, "Creating files %s/record_benchmark_*\n", output_dir_);
-  absl::Format(&report, "%-*s  Compr.    Write       Read\n", max_name_width_,
-               "");
-  absl::Format(&report, "%-*s  ratio    CPU Real   CPU Real\n", max_name_width_,
-               "");
-  absl::Format(&report, "%-*s    %%     MB/s MB/s  MB/s MB/s\n",
-               max_name_width_, "Format");
-  absl::Format(
-      &report, "%s\n",
-      std::string(riegeli::IntCast<size_t>(max_name_width_ + 30), '-'));
+  for (const int num_threads : num_threads_) {
+    if (num_threads > 1) {
+      absl::Format(&report, "\nThreads: %d, reading %s\n", num_threads,
+                   shared_file_ ? "a shared file" : "separate files");
+    }
+    absl::Format(&report, "%-*s  Compr.    Write       Read\n",
+                 max_name_width_, "");
+    absl::Format(&report, "%-*s  ratio    CPU Real   CPU Real\n",
+                 max_name_width_, "");
+    absl::Format(&report, "%-*s    %%     MB/s MB/s  MB/s MB/s\n",
+                 max_name_width_, "Format");
+    absl::Format(
+        &report, "%s\n",
+        std::string(riegeli::IntCast<size_t>(max_name_width_ + 30), '-'));
+    RunAllWithThreads(num_threads, report);
+  }
+  if (latencies_) RunLatencies(report);
+}
 
+void Benchmarks::RunAllWithThreads(int num_threads, std::ostream& report) {
   for (const std::pair<std::string, const char*>& tfrecord_options :
        tfrecord_benchmarks_) {
     RunOne(
-        absl::StrCat("tfrecord ", tfrecord_options.first),
+        absl::StrCat("tfrecord ", tfrecord_options.first), num_threads,
         [&](absl::string_view filename,
             const std::vector<std::string>& records) {
           WriteTFRecord(
@@ -428,7 +574,7 @@ void Benchmarks::RunAll(std::ostream& report) {
   for (const std::pair<std::string, riegeli::RecordWriterBase::Options>&
            riegeli_options : riegeli_benchmarks_) {
     RunOne(
-        absl::StrCat("riegeli ", riegeli_options.first),
+        absl::StrCat("riegeli ", riegeli_options.first), num_threads,
         [&](absl::string_view filename,
             const std::vector<std::string>& records) {
           WriteRiegeli(filename, riegeli_options.second, records);
@@ -442,7 +588,7 @@ void Benchmarks::RunAll(std::ostream& report) {
 }
 
 void Benchmarks::RunOne(
-    absl::string_view name,
+    absl::string_view name, int num_threads,
     absl::FunctionRef<void(absl::string_view, const std::vector<std::string>&)>
         write_records,
     absl::FunctionRef<void(absl::string_view, std::vector<std::string>*)>
@@ -452,6 +598,17 @@ void Benchmarks::RunOne(
   report.flush();
   const std::string filename =
       absl::StrCat(output_dir_, "/record_benchmark_", Filename(name));
+  std::vector<std::string> filenames;
+  if (num_threads == 1) {
+    filenames.push_back(filename);
+  } else {
+    for (int thread_index = 0; thread_index < num_threads; ++thread_index) {
+      filenames.push_back(absl::StrCat(filename, "_", thread_index));
+    }
+  }
+  // Total size of records written or read by all threads.
+  const double total_size =
+      static_cast<double>(original_size_) * static_cast<double>(num_threads);
 
   Stats compression;
   Stats writing_cpu_speed;
@@ -461,40 +618,50 @@ void Benchmarks::RunOne(
   for (int i = 0; i < repetitions_ + 1; ++i) {
     const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
     const uint64_t real_time_before_ns = RealTimeNow_ns();
-    write_records(filename, records_);
+    RunThreads(num_threads, [&](int thread_index) {
+      write_records(filenames[riegeli::IntCast<size_t>(thread_index)],
+                    records_);
+    });
     const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
     const uint64_t real_time_after_ns = RealTimeNow_ns();
     if (i == 0) {
       // Warm-up.
     } else {
-      compression.Add(static_cast<double>(FileSize(filename)) /
+      compression.Add(static_cast<double>(FileSize(filenames[0])) /
                       static_cast<double>(original_size_) * 100.0);
       writing_cpu_speed.Add(
-          static_cast<double>(original_size_) /
+          total_size /
           static_cast<double>(cpu_time_after_ns - cpu_time_before_ns) * 1000.0);
       writing_real_speed.Add(
-          static_cast<double>(original_size_) /
+          total_size /
           static_cast<double>(real_time_after_ns - real_time_before_ns) *
           1000.0);
     }
   }
   for (int i = 0; i < repetitions_ + 1; ++i) {
-    std::vector<std::string> decoded_records;
+    std::vector<std::vector<std::string>> decoded_records(
+        riegeli::IntCast<size_t>(num_threads));
     const uint64_t cpu_time_before_ns = CpuTimeNow_ns();
     const uint64_t real_time_before_ns = RealTimeNow_ns();
-    read_records(filename, &decoded_records);
+    RunThreads(num_threads, [&](int thread_index) {
+      read_records(
+          filenames[shared_file_ ? 0 : riegeli::IntCast<size_t>(thread_index)],
+          &decoded_records[riegeli::IntCast<size_t>(thread_index)]);
+    });
     const uint64_t cpu_time_after_ns = CpuTimeNow_ns();
     const uint64_t real_time_after_ns = RealTimeNow_ns();
     if (i == 0) {
       // Warm-up and correctness check.
-      RIEGELI_CHECK(decoded_records == records_)
-          << "Decoded records do not match for " << name;
+      for (const std::vector<std::string>& thread_records : decoded_records) {
+        RIEGELI_CHECK(thread_records == records_)
+            << "Decoded records do not match for " << name;
+      }
     } else {
       reading_cpu_speed.Add(
-          static_cast<double>(original_size_) /
+          total_size /
           static_cast<double>(cpu_time_after_ns - cpu_time_before_ns) * 1000.0);
       reading_real_speed.Add(
-          static_cast<double>(original_size_) /
+          total_size /
           static_cast<double>(real_time_after_ns - real_time_before_ns) *
           1000.0);
     }
@@ -512,6 +679,101 @@ void Benchmarks::RunOne(
   absl::Format(&report, "\n");
 }
 
+void Benchmarks::RunLatencies(std::ostream& report) {
+  absl::Format(&report, "\nLatencies (us)\n");
+  absl::Format(&report,
+               "%-*s      WriteRecord           ReadRecord        "
+               "Seek+ReadRecord\n",
+               max_name_width_, "");
+  absl::Format(&report,
+               "%-*s   p50   p99  p999   max   p50   p99  p999   max   p50   "
+               "p99  p999   max\n",
+               max_name_width_, "Format");
+  absl::Format(
+      &report, "%s\n",
+      std::string(riegeli::IntCast<size_t>(max_name_width_ + 72), '-'));
+  for (const std::pair<std::string, riegeli::RecordWriterBase::Options>&
+           riegeli_options : riegeli_benchmarks_) {
+    RunOneLatencies(absl::StrCat("riegeli ", riegeli_options.first),
+                    riegeli_options.second, report);
+  }
+}
+
+void Benchmarks::RunOneLatencies(
+    absl::string_view name,
+    const riegeli::RecordWriterBase::Options& record_writer_options,
+    std::ostream& report) {
+  absl::Format(&report, "%-*s", max_name_width_, name);
+  report.flush();
+  const std::string filename = absl::StrCat(
+      output_dir_, "/record_benchmark_", Filename(name), "_latencies");
+
+  Latencies writing;
+  {
+    riegeli::RecordWriter<riegeli::FdWriter<>> record_writer(
+        std::forward_as_tuple(filename, O_WRONLY | O_CREAT | O_TRUNC),
+        record_writer_options);
+    for (const std::string& record : records_) {
+      const uint64_t time_before_ns = RealTimeNow_ns();
+      RIEGELI_CHECK(record_writer.WriteRecord(record))
+          << record_writer.status();
+      writing.Add(RealTimeNow_ns() - time_before_ns);
+    }
+    RIEGELI_CHECK(record_writer.Close()) << record_writer.status();
+  }
+
+  Latencies reading;
+  std::vector<riegeli::RecordPosition> positions;
+  positions.reserve(records_.size());
+  {
+    riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+        std::forward_as_tuple(filename, O_RDONLY));
+    std::string record;
+    for (;;) {
+      const uint64_t time_before_ns = RealTimeNow_ns();
+      if (!record_reader.ReadRecord(record)) break;
+      reading.Add(RealTimeNow_ns() - time_before_ns);
+      positions.push_back(record_reader.last_pos());
+    }
+    RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+    RIEGELI_CHECK_EQ(positions.size(), records_.size())
+        << "Decoded records do not match for " << name;
+  }
+
+  Latencies seeking;
+  if (!positions.empty()) {
+    riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+        std::forward_as_tuple(filename, O_RDONLY));
+    std::mt19937_64 random;
+    std::uniform_int_distribution<size_t> record_index_distribution(
+        0, positions.size() - 1);
+    std::string record;
+    for (int i = 0; i < random_seeks_; ++i) {
+      const size_t record_index = record_index_distribution(random);
+      const uint64_t time_before_ns = RealTimeNow_ns();
+      RIEGELI_CHECK(record_reader.Seek(positions[record_index]))
+          << record_reader.status();
+      RIEGELI_CHECK(record_reader.ReadRecord(record))
+          << record_reader.status();
+      seeking.Add(RealTimeNow_ns() - time_before_ns);
+      RIEGELI_CHECK(record == records_[record_index])
+          << "Decoded records do not match for " << name;
+    }
+    RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+  }
+
+  for (Latencies* const latencies : {&writing, &reading, &seeking}) {
+    for (const double fraction : {0.5, 0.99, 0.999, 1.0}) {
+      if (latencies->empty()) {
+        absl::Format(&report, "     -");
+      } else {
+        absl::Format(&report, " %5.1f", latencies->Percentile(fraction));
+      }
+    }
+  }
+  absl::Format(&report, "\n");
+}
+
 const char kUsage[] =
     "Usage: records_benchmark (OPTION|FILE)...\n"
     "\n"
@@ -535,6 +797,9 @@ int main(int argc, char** argv) {
     absl::Format(&std::cerr, "%s\n", kUsage);
     return 1;
   }
+  // This must precede any Riegeli allocation.
+  SetAllocator(absl::GetFlag(FLAGS_allocator));
+  absl::Format(&std::cout, "Allocator: %s\n", absl::GetFlag(FLAGS_allocator));
   SizeLimiter size_limiter(
       riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_max_size)));
   for (size_t i = 1; i < args.size(); ++i) {
@@ -542,8 +807,21 @@ int main(int argc, char** argv) {
       break;
     }
   }
+  std::vector<int> num_threads;
+  ForEachWord(absl::GetFlag(FLAGS_threads), [&](absl::string_view word) {
+    int value;
+    if (!absl::SimpleAtoi(word, &value) || value <= 0) {
+      absl::Format(&std::cerr, "Invalid number of threads: %s\n", word);
+      std::exit(1);
+    }
+    num_threads.push_back(value);
+  });
   Benchmarks benchmarks(std::move(records), absl::GetFlag(FLAGS_output_dir),
-                        absl::GetFlag(FLAGS_repetitions));
+                        absl::GetFlag(FLAGS_repetitions),
+                        std::move(num_threads),
+                        absl::GetFlag(FLAGS_shared_file),
+                        absl::GetFlag(FLAGS_latencies),
+                        absl::GetFlag(FLAGS_random_seeks));
   ForEachWord(absl::GetFlag(FLAGS_tfrecord_benchmarks),
               [&](absl::string_view tfrecord_options) {
                 benchmarks.RegisterTFRecord(tfrecord_options);
@@ -0,0 +1,111 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Shuffles records of Riegeli/records files into a given number of output
+// files, deterministically for a given seed.
+
+#include <stdint.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "riegeli/records/record_file_shuffle.h"
+#include "riegeli/records/record_writer.h"
+
+ABSL_FLAG(std::string, output_prefix, "",
+          "Prefix of output files, named PREFIX-NNNNN-of-MMMMM");
+ABSL_FLAG(int32_t, num_outputs, 1, "Number of output files");
+ABSL_FLAG(uint64_t, seed, 0, "Seed of the permutation");
+ABSL_FLAG(int32_t, parallelism, 4,
+          "Maximum number of files read or written concurrently");
+ABSL_FLAG(uint64_t, max_output_size, uint64_t{1} << 30,
+          "Maximum size of records of one output file, which are shuffled in "
+          "memory, in bytes");
+ABSL_FLAG(std::string, options, "",
+          "RecordWriter options of output files, in the format of "
+          "RecordWriterBase::Options::FromString()");
+ABSL_FLAG(std::string, temp_dir, "",
+          "Directory for temporary files; empty means $TMPDIR or /tmp");
+
+namespace riegeli {
+namespace tools {
+namespace {
+
+const char kUsage[] =
+    "Usage: shuffle_riegeli_files --output_prefix=PREFIX --num_outputs=M "
+    "(OPTION)... SRC...\n"
+    "\n"
+    "Shuffles records of Riegeli/records files into M files. Outputs are "
+    "incomplete if shuffling fails.\n";
+
+}  // namespace
+}  // namespace tools
+}  // namespace riegeli
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(riegeli::tools::kUsage);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  const std::string output_prefix = absl::GetFlag(FLAGS_output_prefix);
+  const int num_outputs = absl::GetFlag(FLAGS_num_outputs);
+  if (args.size() < 2 || output_prefix.empty()) {
+    std::cerr << absl::ProgramUsageMessage() << std::endl;
+    return 1;
+  }
+  const int parallelism = absl::GetFlag(FLAGS_parallelism);
+  if (num_outputs <= 0 || parallelism <= 0) {
+    std::cerr << "--num_outputs and --parallelism must be positive"
+              << std::endl;
+    return 1;
+  }
+  riegeli::ShuffleRecordFilesOptions options;
+  options.set_seed(absl::GetFlag(FLAGS_seed))
+      .set_parallelism(parallelism)
+      .set_max_output_size(absl::GetFlag(FLAGS_max_output_size))
+      .set_temp_directory(absl::GetFlag(FLAGS_temp_dir));
+  {
+    const absl::Status status =
+        options.output_options().FromString(absl::GetFlag(FLAGS_options));
+    if (!status.ok()) {
+      std::cerr << "--options: " << status.message() << std::endl;
+      return 1;
+    }
+  }
+  const std::vector<std::string> input_filenames(args.begin() + 1, args.end());
+  std::vector<std::string> output_filenames;
+  output_filenames.reserve(num_outputs);
+  for (int i = 0; i < num_outputs; ++i) {
+    output_filenames.push_back(
+        absl::StrFormat("%s-%05d-of-%05d", output_prefix, i, num_outputs));
+  }
+
+  const absl::Time start_time = absl::Now();
+  const absl::Status status =
+      riegeli::ShuffleRecordFiles(input_filenames, output_filenames, options);
+  if (!status.ok()) {
+    std::cerr << status.message() << std::endl;
+    return 1;
+  }
+  std::cerr << "Shuffled " << input_filenames.size() << " files into "
+            << num_outputs << " files in " << absl::Now() - start_time
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,439 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Converts TFRecord files (uncompressed, gzip, or zlib) to Riegeli/records
+// files. Records are read in batches, CRCs of a batch are verified in parallel
+// while the batch is written and the next batch is read, and several files are
+// converted concurrently.
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "crc32c/crc32c.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/endian/endian_reading.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/zlib/zlib_reader.h"
+
+ABSL_FLAG(std::string, compression_type, "auto",
+          "Compression of TFRecord files: none, zlib, gzip, or auto to detect "
+          "it per file");
+ABSL_FLAG(std::string, options, "parallelism:4",
+          "RecordWriter options, in the format of "
+          "RecordWriterBase::Options::FromString()");
+ABSL_FLAG(std::string, output_dir, "",
+          "If not empty, all arguments are SRC files, converted to files in "
+          "this directory named like SRC with --output_suffix appended. "
+          "Otherwise arguments are SRC DEST");
+ABSL_FLAG(std::string, output_suffix, ".riegeli",
+          "Suffix of files written to --output_dir");
+ABSL_FLAG(int32_t, parallelism, 4,
+          "Maximum number of tasks verifying CRCs of a batch, per file");
+ABSL_FLAG(uint64_t, batch_size, uint64_t{4} << 20,
+          "Size of records read before verifying their CRCs, in bytes");
+ABSL_FLAG(int32_t, max_concurrent_files, 4,
+          "Maximum number of files converted concurrently");
+
+namespace riegeli {
+namespace tools {
+namespace {
+
+enum class CompressionType { kAuto, kNone, kZlibOrGzip };
+
+// Each TFRecord is a little endian `uint64_t` length, masked CRC32C of the
+// length, data, and masked CRC32C of the data.
+constexpr size_t kHeaderSize = sizeof(uint64_t) + sizeof(uint32_t);
+
+uint32_t MaskedCrc32c(const char* data, size_t size) {
+  const uint32_t crc = crc32c::Crc32c(data, size);
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8;
+}
+
+struct Batch {
+  struct Record {
+    size_t begin;
+    size_t size;
+    uint32_t masked_crc;
+  };
+
+  void Clear() {
+    data.clear();
+    records.clear();
+  }
+
+  absl::string_view record(size_t index) const {
+    return absl::string_view(data.data() + records[index].begin,
+                             records[index].size);
+  }
+
+  // Data of all records, concatenated, so that reading a batch does not
+  // allocate each record separately.
+  std::string data;
+  std::vector<Record> records;
+  // Index in the file of the first record of the batch.
+  uint64_t first_record_index = 0;
+};
+
+// Verifies data CRCs of records of a batch in background, in contiguous ranges
+// of records, one per task.
+class CrcVerification {
+ public:
+  explicit CrcVerification(const Batch* batch, int parallelism);
+
+  CrcVerification(const CrcVerification&) = delete;
+  CrcVerification& operator=(const CrcVerification&) = delete;
+
+  ~CrcVerification() { Wait().IgnoreError(); }
+
+  // Waits for verification to finish. Returns an error for the first corrupted
+  // record.
+  absl::Status Wait();
+
+ private:
+  const Batch* batch_;
+  size_t num_tasks_;
+  absl::BlockingCounter tasks_;
+  bool waited_ = false;
+  // For each task, the index of the first corrupted record, or `size_t` max.
+  std::vector<size_t> first_corrupted_;
+};
+
+CrcVerification::CrcVerification(const Batch* batch, int parallelism)
+    : batch_(batch),
+      num_tasks_(UnsignedMax(UnsignedMin(IntCast<size_t>(parallelism),
+                                         batch->records.size()),
+                             size_t{1})),
+      tasks_(IntCast<int>(num_tasks_)),
+      first_corrupted_(num_tasks_, std::numeric_limits<size_t>::max()) {
+  const size_t num_records = batch_->records.size();
+  for (size_t task = 0; task < num_tasks_; ++task) {
+    ThreadPool::global().Schedule([this, task, num_records] {
+      const size_t end = (task + 1) * num_records / num_tasks_;
+      for (size_t i = task * num_records / num_tasks_; i < end; ++i) {
+        const absl::string_view record = batch_->record(i);
+        if (ABSL_PREDICT_FALSE(MaskedCrc32c(record.data(), record.size()) !=
+                               batch_->records[i].masked_crc)) {
+          first_corrupted_[task] = i;
+          break;
+        }
+      }
+      tasks_.DecrementCount();
+    });
+  }
+}
+
+absl::Status CrcVerification::Wait() {
+  if (!waited_) {
+    tasks_.Wait();
+    waited_ = true;
+  }
+  for (const size_t index : first_corrupted_) {
+    if (ABSL_PREDICT_FALSE(index != std::numeric_limits<size_t>::max())) {
+      return absl::DataLossError(
+          absl::StrCat("Corrupted TFRecord data of record ",
+                       batch_->first_record_index + index));
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Reads records into `batch` until it has at least `batch_size` bytes or the
+// source ends, verifying length CRCs. Sets `end` if the source ends.
+absl::Status ReadBatch(Reader& src, size_t batch_size, uint64_t& num_records,
+                       Batch& batch, bool& end) {
+  batch.Clear();
+  batch.first_record_index = num_records;
+  while (batch.data.size() < batch_size) {
+    if (ABSL_PREDICT_FALSE(!src.Pull(kHeaderSize))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+      if (ABSL_PREDICT_FALSE(src.available() > 0)) {
+        return absl::DataLossError(absl::StrCat(
+            "Truncated TFRecord header of record ", num_records));
+      }
+      end = true;
+      return absl::OkStatus();
+    }
+    if (ABSL_PREDICT_FALSE(MaskedCrc32c(src.cursor(), sizeof(uint64_t)) !=
+                           ReadLittleEndian32(src.cursor() +
+                                              sizeof(uint64_t)))) {
+      return absl::DataLossError(
+          absl::StrCat("Corrupted TFRecord length of record ", num_records));
+    }
+    const uint64_t length = ReadLittleEndian64(src.cursor());
+    src.move_cursor(kHeaderSize);
+    if (ABSL_PREDICT_FALSE(length > std::numeric_limits<size_t>::max() -
+                                        batch.data.size())) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("TFRecord too large: ", length));
+    }
+    const size_t begin = batch.data.size();
+    if (ABSL_PREDICT_FALSE(
+            !src.ReadAndAppend(IntCast<size_t>(length), batch.data))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+      return absl::DataLossError(
+          absl::StrCat("Truncated TFRecord data of record ", num_records));
+    }
+    const absl::optional<uint32_t> masked_crc = ReadLittleEndian32(src);
+    if (ABSL_PREDICT_FALSE(masked_crc == absl::nullopt)) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+      return absl::DataLossError(
+          absl::StrCat("Truncated TFRecord CRC of record ", num_records));
+    }
+    batch.records.push_back(
+        Batch::Record{begin, IntCast<size_t>(length), *masked_crc});
+    ++num_records;
+  }
+  return absl::OkStatus();
+}
+
+// Detects whether `src` starts with an uncompressed TFRecord, or a zlib or
+// gzip header.
+absl::Status DetectCompressionType(Reader& src,
+                                   CompressionType& compression_type) {
+  if (!src.Pull(kHeaderSize)) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+    if (src.available() == 0) {
+      // Empty file: no records in any format.
+      compression_type = CompressionType::kNone;
+      return absl::OkStatus();
+    }
+  }
+  if (src.available() >= kHeaderSize &&
+      MaskedCrc32c(src.cursor(), sizeof(uint64_t)) ==
+          ReadLittleEndian32(src.cursor() + sizeof(uint64_t))) {
+    compression_type = CompressionType::kNone;
+    return absl::OkStatus();
+  }
+  if (src.available() >= 2) {
+    const uint8_t byte0 = static_cast<uint8_t>(src.cursor()[0]);
+    const uint8_t byte1 = static_cast<uint8_t>(src.cursor()[1]);
+    const bool is_gzip = byte0 == 0x1f && byte1 == 0x8b;
+    const bool is_zlib = (byte0 & 0x0f) == 8 && (byte0 >> 4) <= 7 &&
+                         (uint32_t{byte0} << 8 | byte1) % 31 == 0;
+    if (is_gzip || is_zlib) {
+      compression_type = CompressionType::kZlibOrGzip;
+      return absl::OkStatus();
+    }
+  }
+  return absl::InvalidArgumentError("Not a TFRecord file");
+}
+
+struct ConvertStats {
+  uint64_t num_records = 0;
+  uint64_t records_size = 0;
+};
+
+absl::Status ConvertFile(absl::string_view src_filename,
+                         absl::string_view dest_filename,
+                         CompressionType compression_type,
+                         const RecordWriterBase::Options& options,
+                         int parallelism, size_t batch_size,
+                         ConvertStats& stats) {
+  FdReader<> file_reader(src_filename, O_RDONLY);
+  if (compression_type == CompressionType::kAuto) {
+    const absl::Status status =
+        DetectCompressionType(file_reader, compression_type);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  absl::optional<ZlibReader<Reader*>> decompressor;
+  Reader* src = &file_reader;
+  if (compression_type == CompressionType::kZlibOrGzip) {
+    decompressor.emplace(&file_reader,
+                         ZlibReaderBase::Options().set_header(
+                             ZlibReaderBase::Header::kZlibOrGzip));
+    src = &*decompressor;
+  }
+  RecordWriter<FdWriter<>> record_writer(
+      std::forward_as_tuple(dest_filename, O_WRONLY | O_CREAT | O_TRUNC),
+      options);
+
+  Batch batches[2];
+  Batch* batch = &batches[0];
+  Batch* next_batch = &batches[1];
+  uint64_t num_records = 0;
+  bool end = false;
+  {
+    const absl::Status status =
+        ReadBatch(*src, batch_size, num_records, *batch, end);
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  while (!batch->records.empty()) {
+    CrcVerification verification(batch, parallelism);
+    for (size_t i = 0; i < batch->records.size(); ++i) {
+      if (ABSL_PREDICT_FALSE(!record_writer.WriteRecord(batch->record(i)))) {
+        return record_writer.status();
+      }
+    }
+    stats.records_size += batch->data.size();
+    next_batch->Clear();
+    absl::Status read_status;
+    if (!end) {
+      read_status = ReadBatch(*src, batch_size, num_records, *next_batch, end);
+    }
+    {
+      const absl::Status status = verification.Wait();
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    }
+    if (ABSL_PREDICT_FALSE(!read_status.ok())) return read_status;
+    std::swap(batch, next_batch);
+  }
+  stats.num_records += num_records;
+  if (decompressor != absl::nullopt) {
+    if (ABSL_PREDICT_FALSE(!decompressor->VerifyEndAndClose())) {
+      return decompressor->status();
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!file_reader.Close())) return file_reader.status();
+  if (ABSL_PREDICT_FALSE(!record_writer.Close())) return record_writer.status();
+  return absl::OkStatus();
+}
+
+const char kUsage[] =
+    "Usage: tfrecord_to_riegeli (OPTION)... SRC DEST\n"
+    "   or: tfrecord_to_riegeli --output_dir=DIR (OPTION)... SRC...\n"
+    "\n"
+    "Converts TFRecord files to Riegeli/records files. DEST is incomplete if "
+    "conversion fails.\n";
+
+}  // namespace
+}  // namespace tools
+}  // namespace riegeli
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(riegeli::tools::kUsage);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  const std::string output_dir = absl::GetFlag(FLAGS_output_dir);
+  std::vector<std::pair<std::string, std::string>> files;
+  if (output_dir.empty()) {
+    if (args.size() != 3) {
+      std::cerr << absl::ProgramUsageMessage() << std::endl;
+      return 1;
+    }
+    files.emplace_back(args[1], args[2]);
+  } else {
+    if (args.size() < 2) {
+      std::cerr << absl::ProgramUsageMessage() << std::endl;
+      return 1;
+    }
+    const std::string output_suffix = absl::GetFlag(FLAGS_output_suffix);
+    for (size_t i = 1; i < args.size(); ++i) {
+      const absl::string_view src = args[i];
+      files.emplace_back(
+          std::string(src),
+          absl::StrCat(output_dir, "/", src.substr(src.rfind('/') + 1),
+                       output_suffix));
+    }
+  }
+  const std::string compression_type_flag =
+      absl::GetFlag(FLAGS_compression_type);
+  riegeli::tools::CompressionType compression_type;
+  if (compression_type_flag == "auto") {
+    compression_type = riegeli::tools::CompressionType::kAuto;
+  } else if (compression_type_flag == "none") {
+    compression_type = riegeli::tools::CompressionType::kNone;
+  } else if (compression_type_flag == "zlib" ||
+             compression_type_flag == "gzip") {
+    compression_type = riegeli::tools::CompressionType::kZlibOrGzip;
+  } else {
+    std::cerr << "--compression_type must be none, zlib, gzip, or auto"
+              << std::endl;
+    return 1;
+  }
+  riegeli::RecordWriterBase::Options options;
+  {
+    const absl::Status status =
+        options.FromString(absl::GetFlag(FLAGS_options));
+    if (!status.ok()) {
+      std::cerr << "--options: " << status.message() << std::endl;
+      return 1;
+    }
+  }
+  const int parallelism = absl::GetFlag(FLAGS_parallelism);
+  const int max_concurrent_files = absl::GetFlag(FLAGS_max_concurrent_files);
+  const uint64_t batch_size = absl::GetFlag(FLAGS_batch_size);
+  if (parallelism <= 0 || max_concurrent_files <= 0 || batch_size == 0) {
+    std::cerr << "--parallelism, --max_concurrent_files, and --batch_size "
+                 "must be positive"
+              << std::endl;
+    return 1;
+  }
+
+  const absl::Time start_time = absl::Now();
+  std::vector<absl::Status> statuses(files.size());
+  std::vector<riegeli::tools::ConvertStats> stats(files.size());
+  const size_t num_workers = riegeli::UnsignedMin(
+      riegeli::IntCast<size_t>(max_concurrent_files), files.size());
+  std::atomic<size_t> next_file(0);
+  absl::BlockingCounter workers(riegeli::IntCast<int>(num_workers));
+  for (size_t worker = 0; worker < num_workers; ++worker) {
+    riegeli::ThreadPool::global().Schedule([&] {
+      for (size_t i = next_file.fetch_add(1, std::memory_order_relaxed);
+           i < files.size();
+           i = next_file.fetch_add(1, std::memory_order_relaxed)) {
+        statuses[i] = riegeli::tools::ConvertFile(
+            files[i].first, files[i].second, compression_type, options,
+            parallelism,
+            riegeli::UnsignedMin(batch_size,
+                                 std::numeric_limits<size_t>::max()),
+            stats[i]);
+      }
+      workers.DecrementCount();
+    });
+  }
+  workers.Wait();
+  const absl::Duration elapsed = absl::Now() - start_time;
+
+  int exit_code = 0;
+  riegeli::tools::ConvertStats total;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!statuses[i].ok()) {
+      std::cerr << files[i].first << ": " << statuses[i].message()
+                << std::endl;
+      exit_code = 1;
+      continue;
+    }
+    total.num_records += stats[i].num_records;
+    total.records_size += stats[i].records_size;
+  }
+  std::cerr << "Converted " << total.num_records << " records ("
+            << total.records_size << " bytes) in " << elapsed << ", "
+            << static_cast<double>(total.records_size) /
+                   absl::ToDoubleMicroseconds(elapsed)
+            << " MB/s" << std::endl;
+  return exit_code;
+}
@@ -0,0 +1,191 @@
+// Copyright 2017 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Recompresses simple chunks of a Riegeli/records file with different
+// compressor options, without decoding records. Other chunks are copied as
+// they are, except for padding and chunk indices, which are dropped because
+// chunk positions change.
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/chunk_encoding/chunk.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/simple_transcoder.h"
+#include "riegeli/records/chunk_reader.h"
+#include "riegeli/records/chunk_writer.h"
+
+ABSL_FLAG(std::string, compression, "brotli",
+          "Compressor options for simple chunks, in the format of "
+          "RecordWriterBase::Options::FromString() compression options, "
+          "e.g. \"brotli:9\" or \"zstd:19\".");
+ABSL_FLAG(int32_t, parallelism, 8,
+          "Maximum number of chunks transcoded in parallel.");
+ABSL_FLAG(int32_t, chunks_per_batch, 64,
+          "Number of chunks read before transcoding them in parallel.");
+
+namespace riegeli {
+namespace tools {
+namespace {
+
+struct TranscodeStats {
+  uint64_t transcoded_chunks = 0;
+  uint64_t copied_chunks = 0;
+  uint64_t src_size = 0;
+  uint64_t dest_size = 0;
+};
+
+// Transcodes simple chunks in `chunks` in place, in parallel.
+absl::Status TranscodeBatch(std::vector<Chunk>& chunks,
+                            const CompressorOptions& compressor_options,
+                            int parallelism, TranscodeStats& stats) {
+  std::vector<size_t> simple_chunks;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (chunks[i].header.chunk_type() == ChunkType::kSimple) {
+      simple_chunks.push_back(i);
+      stats.src_size += chunks[i].data.size();
+    }
+  }
+  std::vector<absl::Status> statuses(simple_chunks.size());
+  const size_t num_tasks =
+      UnsignedMin(IntCast<size_t>(parallelism), simple_chunks.size());
+  absl::BlockingCounter tasks(IntCast<int>(num_tasks));
+  for (size_t task = 0; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&, task] {
+      for (size_t i = task; i < simple_chunks.size(); i += num_tasks) {
+        Chunk& chunk = chunks[simple_chunks[i]];
+        Chunk transcoded;
+        statuses[i] =
+            TranscodeSimpleChunk(chunk, compressor_options, transcoded);
+        if (statuses[i].ok()) chunk = std::move(transcoded);
+      }
+      tasks.DecrementCount();
+    });
+  }
+  tasks.Wait();
+  for (size_t i = 0; i < simple_chunks.size(); ++i) {
+    if (ABSL_PREDICT_FALSE(!statuses[i].ok())) return statuses[i];
+    stats.dest_size += chunks[simple_chunks[i]].data.size();
+  }
+  stats.transcoded_chunks += simple_chunks.size();
+  stats.copied_chunks += chunks.size() - simple_chunks.size();
+  return absl::OkStatus();
+}
+
+absl::Status TranscodeFile(absl::string_view src_filename,
+                           absl::string_view dest_filename,
+                           const CompressorOptions& compressor_options,
+                           int parallelism, size_t chunks_per_batch,
+                           TranscodeStats& stats) {
+  DefaultChunkReader<FdReader<>> chunk_reader(
+      std::forward_as_tuple(src_filename, O_RDONLY));
+  DefaultChunkWriter<FdWriter<>> chunk_writer(
+      std::forward_as_tuple(dest_filename, O_WRONLY | O_CREAT | O_TRUNC));
+  std::vector<Chunk> chunks;
+  for (;;) {
+    chunks.clear();
+    while (chunks.size() < chunks_per_batch) {
+      Chunk chunk;
+      if (ABSL_PREDICT_FALSE(!chunk_reader.ReadChunk(chunk))) break;
+      if (chunk.header.chunk_type() == ChunkType::kPadding ||
+          chunk.header.chunk_type() == ChunkType::kChunkIndex ||
+          chunk.header.chunk_type() == ChunkType::kFileSummary) {
+        continue;
+      }
+      chunks.push_back(std::move(chunk));
+    }
+    if (ABSL_PREDICT_FALSE(!chunk_reader.healthy())) {
+      return chunk_reader.status();
+    }
+    if (chunks.empty()) break;
+    {
+      const absl::Status status =
+          TranscodeBatch(chunks, compressor_options, parallelism, stats);
+      if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+    }
+    for (const Chunk& chunk : chunks) {
+      if (ABSL_PREDICT_FALSE(!chunk_writer.WriteChunk(chunk))) {
+        return chunk_writer.status();
+      }
+    }
+  }
+  if (ABSL_PREDICT_FALSE(!chunk_reader.Close())) return chunk_reader.status();
+  if (ABSL_PREDICT_FALSE(!chunk_writer.Close())) return chunk_writer.status();
+  return absl::OkStatus();
+}
+
+const char kUsage[] =
+    "Usage: transcode_riegeli_file (OPTION)... SRC DEST\n"
+    "\n"
+    "Recompresses simple chunks of a Riegeli/records file without decoding "
+    "records.\n";
+
+}  // namespace
+}  // namespace tools
+}  // namespace riegeli
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(riegeli::tools::kUsage);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  if (args.size() != 3) {
+    std::cerr << absl::ProgramUsageMessage() << std::endl;
+    return 1;
+  }
+  riegeli::CompressorOptions compressor_options;
+  {
+    const absl::Status status =
+        compressor_options.FromString(absl::GetFlag(FLAGS_compression));
+    if (!status.ok()) {
+      std::cerr << "--compression: " << status.message() << std::endl;
+      return 1;
+    }
+  }
+  const int parallelism = absl::GetFlag(FLAGS_parallelism);
+  const int chunks_per_batch = absl::GetFlag(FLAGS_chunks_per_batch);
+  if (parallelism <= 0 || chunks_per_batch <= 0) {
+    std::cerr << "--parallelism and --chunks_per_batch must be positive"
+              << std::endl;
+    return 1;
+  }
+  riegeli::tools::TranscodeStats stats;
+  const absl::Status status = riegeli::tools::TranscodeFile(
+      args[1], args[2], compressor_options, parallelism,
+      riegeli::IntCast<size_t>(chunks_per_batch), stats);
+  if (!status.ok()) {
+    std::cerr << args[1] << ": " << status.message() << std::endl;
+    return 1;
+  }
+  std::cerr << "Transcoded " << stats.transcoded_chunks << " simple chunks ("
+            << stats.src_size << " -> " << stats.dest_size
+            << " bytes), copied " << stats.copied_chunks << " other chunks"
+            << std::endl;
+}
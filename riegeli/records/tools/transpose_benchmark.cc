@@ -0,0 +1,181 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how `TransposeEncoder` scales with the number of distinct tags, for
+// synthetic records of wide messages (many distinct fields) and deep messages
+// (many levels of nested submessages).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/null_writer.h"
+#include "riegeli/chunk_encoding/compressor_options.h"
+#include "riegeli/chunk_encoding/constants.h"
+#include "riegeli/chunk_encoding/transpose_encoder.h"
+#include "riegeli/varint/varint_writing.h"
+
+ABSL_FLAG(std::string, num_tags, "16 64 256 1024 4096 16384",
+          "Whitespace-separated numbers of distinct tags to benchmark");
+ABSL_FLAG(uint64_t, num_records, 10000, "Number of records per chunk");
+ABSL_FLAG(uint64_t, fields_per_record, 32,
+          "Number of fields in each record of a wide message");
+ABSL_FLAG(int32_t, repetitions, 5, "Number of times to repeat each benchmark");
+
+namespace {
+
+uint64_t RealTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_MONOTONIC, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+void AppendVarint(uint64_t value, std::string& dest) {
+  char buffer[riegeli::kMaxLengthVarint64];
+  const char* const end = riegeli::WriteVarint64(value, buffer);
+  dest.append(buffer, riegeli::PtrDistance(buffer, end));
+}
+
+// Field numbers start at 1 and tags with wire type `kVarint` (0) and
+// `kLengthDelimited` (2) are `field << 3` and `(field << 3) | 2`.
+void AppendVarintField(uint64_t field, uint64_t value, std::string& dest) {
+  AppendVarint(field << 3, dest);
+  AppendVarint(value, dest);
+}
+
+void AppendLengthDelimitedField(uint64_t field, absl::string_view value,
+                                std::string& dest) {
+  AppendVarint((field << 3) | 2, dest);
+  AppendVarint(value.size(), dest);
+  dest.append(value.data(), value.size());
+}
+
+// Each record has `fields_per_record` consecutive fields out of `num_tags`,
+// starting at a position rotating between records, so that all `num_tags`
+// fields occur and transitions between them are varied.
+std::vector<std::string> WideRecords(size_t num_tags, size_t num_records,
+                                     size_t fields_per_record) {
+  std::vector<std::string> records(num_records);
+  for (size_t i = 0; i < num_records; ++i) {
+    const size_t first_field = (i * fields_per_record) % num_tags;
+    for (size_t j = 0; j < fields_per_record; ++j) {
+      AppendVarintField((first_field + j) % num_tags + 1, i + j, records[i]);
+    }
+  }
+  return records;
+}
+
+// Each record has `depth` levels of nested submessages, each level with a
+// varint field and a submessage field. The depth of each record is between 1
+// and `num_tags / 2`, so that all `num_tags` tags occur.
+std::vector<std::string> DeepRecords(size_t num_tags, size_t num_records) {
+  const size_t max_depth = riegeli::UnsignedMax(num_tags / 2, size_t{1});
+  std::vector<std::string> records(num_records);
+  for (size_t i = 0; i < num_records; ++i) {
+    const size_t depth = max_depth - i % max_depth;
+    std::string message;
+    AppendVarintField(1, i, message);
+    for (size_t level = 1; level < depth; ++level) {
+      std::string parent;
+      AppendVarintField(1, i + level, parent);
+      AppendLengthDelimitedField(2, message, parent);
+      message = std::move(parent);
+    }
+    records[i] = std::move(message);
+  }
+  return records;
+}
+
+// Returns the fastest time of encoding `records` as a single chunk.
+uint64_t EncodeTime_ns(const std::vector<std::string>& records,
+                       int repetitions) {
+  uint64_t best_time_ns = 0;
+  for (int repetition = 0; repetition < repetitions; ++repetition) {
+    riegeli::TransposeEncoder encoder(
+        riegeli::CompressorOptions().set_uncompressed(), uint64_t{1} << 20);
+    const uint64_t start_ns = RealTimeNow_ns();
+    for (const std::string& record : records) {
+      RIEGELI_CHECK(encoder.AddRecord(absl::string_view(record)))
+          << encoder.status();
+    }
+    riegeli::NullWriter dest(riegeli::NullWriter::kInitiallyOpen);
+    riegeli::ChunkType chunk_type;
+    uint64_t num_records;
+    uint64_t decoded_data_size;
+    RIEGELI_CHECK(encoder.EncodeAndClose(dest, chunk_type, num_records,
+                                         decoded_data_size))
+        << encoder.status();
+    const uint64_t time_ns = RealTimeNow_ns() - start_ns;
+    RIEGELI_CHECK(dest.Close()) << dest.status();
+    if (repetition == 0 || time_ns < best_time_ns) best_time_ns = time_ns;
+  }
+  return best_time_ns;
+}
+
+const char kUsage[] =
+    "Usage: transpose_benchmark (OPTION...)\n"
+    "\n"
+    "Encodes synthetic records with TransposeEncoder for various numbers of "
+    "distinct tags.\n";
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(kUsage);
+  absl::ParseCommandLine(argc, argv);
+  const size_t num_records =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_num_records));
+  const size_t fields_per_record =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_fields_per_record));
+  const int repetitions = absl::GetFlag(FLAGS_repetitions);
+  absl::Format(&std::cout, "%-8s %8s %12s %12s\n", "Schema", "Tags",
+               "Time [ms]", "ns/tag");
+  for (const absl::string_view word :
+       absl::StrSplit(absl::GetFlag(FLAGS_num_tags), absl::ByAnyChar("\t\n "),
+                      absl::SkipEmpty())) {
+    size_t num_tags;
+    RIEGELI_CHECK(absl::SimpleAtoi(word, &num_tags) && num_tags > 0)
+        << "Invalid number of tags: " << word;
+    const struct {
+      absl::string_view name;
+      std::vector<std::string> records;
+    } schemas[] = {
+        {"wide",
+         WideRecords(num_tags, num_records,
+                     riegeli::UnsignedMin(fields_per_record, num_tags))},
+        {"deep", DeepRecords(num_tags, num_records)},
+    };
+    for (const auto& schema : schemas) {
+      const uint64_t time_ns = EncodeTime_ns(schema.records, repetitions);
+      absl::Format(
+          &std::cout, "%-8s %8u %12.3f %12.1f\n", schema.name, num_tags,
+          static_cast<double>(time_ns) / 1e6,
+          static_cast<double>(time_ns) / static_cast<double>(num_tags));
+    }
+  }
+}
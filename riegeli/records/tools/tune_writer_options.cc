@@ -0,0 +1,277 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Searches `RecordWriterBase::Options` for a sample of records of given
+// Riegeli/records files: writes and reads the sample in memory with each
+// combination of candidate values of compression, transpose, `chunk_size`,
+// `bucket_fraction`, and `window_log`, and prints the options which are not
+// dominated by other options in compressed size, write speed, and read speed
+// on the current machine.
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+ABSL_FLAG(std::string, compression,
+          "uncompressed snappy lz4 zstd:1 zstd:3 zstd:9 zstd:19 brotli:0 "
+          "brotli:6 brotli:9",
+          "Whitespace-separated candidate compressions, in the format of "
+          "RecordWriterBase::Options::FromString()");
+ABSL_FLAG(std::string, transpose, "false true",
+          "Whitespace-separated candidate values of transpose");
+ABSL_FLAG(std::string, chunk_size, "256k 1M 4M",
+          "Whitespace-separated candidate chunk sizes, with optional "
+          "k/M/G suffixes");
+ABSL_FLAG(std::string, bucket_fraction, "1 0.25",
+          "Whitespace-separated candidate bucket fractions, used only with "
+          "transpose");
+ABSL_FLAG(std::string, window_log, "auto",
+          "Whitespace-separated candidate window logs, used only with brotli "
+          "and zstd");
+ABSL_FLAG(std::string, extra_options, "",
+          "Options appended to every candidate, e.g. \"parallelism:4\"");
+ABSL_FLAG(uint64_t, max_size, uint64_t{16} * 1000 * 1000,
+          "Maximum size of records to read from files, in bytes");
+ABSL_FLAG(int32_t, repetitions, 3,
+          "Number of times to repeat writing and reading with each "
+          "candidate; the fastest time is used");
+ABSL_FLAG(bool, show_all, false,
+          "Print all candidates, marking the Pareto frontier with '*', instead "
+          "of only the frontier");
+
+namespace {
+
+uint64_t RealTimeNow_ns() {
+  struct timespec time_info;
+  RIEGELI_CHECK_EQ(clock_gettime(CLOCK_MONOTONIC, &time_info), 0);
+  return riegeli::IntCast<uint64_t>(time_info.tv_sec) * uint64_t{1000000000} +
+         riegeli::IntCast<uint64_t>(time_info.tv_nsec);
+}
+
+// Returns the fastest time of calling `function()`.
+uint64_t BestTime_ns(int repetitions, absl::FunctionRef<void()> function) {
+  uint64_t best_time_ns = std::numeric_limits<uint64_t>::max();
+  for (int repetition = 0; repetition < repetitions; ++repetition) {
+    const uint64_t start_ns = RealTimeNow_ns();
+    function();
+    best_time_ns =
+        riegeli::UnsignedMin(best_time_ns, RealTimeNow_ns() - start_ns);
+  }
+  return best_time_ns;
+}
+
+void ReadRecords(absl::string_view filename, size_t max_size,
+                 std::vector<std::string>& records, size_t& total_size) {
+  riegeli::RecordReader<riegeli::FdReader<>> record_reader(
+      std::forward_as_tuple(filename, O_RDONLY));
+  std::string record;
+  while (total_size < max_size && record_reader.ReadRecord(record)) {
+    total_size += record.size();
+    records.push_back(std::move(record));
+  }
+  RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+}
+
+std::vector<absl::string_view> Words(absl::string_view text) {
+  return absl::StrSplit(text, absl::ByAnyChar("\t\n "), absl::SkipEmpty());
+}
+
+bool HasWindowLog(absl::string_view compression) {
+  return absl::StartsWith(compression, "brotli") ||
+         absl::StartsWith(compression, "zstd");
+}
+
+// Returns candidate options texts: the cartesian product of flag values,
+// skipping parameters which do not apply to the given compression or layout.
+std::vector<std::string> CandidateOptions() {
+  const std::string compression_flag = absl::GetFlag(FLAGS_compression);
+  const std::string transpose_flag = absl::GetFlag(FLAGS_transpose);
+  const std::string chunk_size_flag = absl::GetFlag(FLAGS_chunk_size);
+  const std::string bucket_fraction_flag = absl::GetFlag(FLAGS_bucket_fraction);
+  const std::string window_log_flag = absl::GetFlag(FLAGS_window_log);
+  const std::string extra_options = absl::GetFlag(FLAGS_extra_options);
+  const std::vector<absl::string_view> no_values = {""};
+  const std::vector<absl::string_view> bucket_fractions =
+      Words(bucket_fraction_flag);
+  const std::vector<absl::string_view> window_logs = Words(window_log_flag);
+  std::vector<std::string> candidates;
+  for (const absl::string_view compression : Words(compression_flag)) {
+    for (const absl::string_view transpose : Words(transpose_flag)) {
+      const bool is_transposed = transpose != "false";
+      for (const absl::string_view chunk_size : Words(chunk_size_flag)) {
+        for (const absl::string_view bucket_fraction :
+             is_transposed && !bucket_fractions.empty() ? bucket_fractions
+                                                        : no_values) {
+          for (const absl::string_view window_log :
+               HasWindowLog(compression) && !window_logs.empty()
+                   ? window_logs
+                   : no_values) {
+            std::string text =
+                absl::StrCat(compression, ",chunk_size:", chunk_size);
+            if (is_transposed) absl::StrAppend(&text, ",transpose:", transpose);
+            if (!bucket_fraction.empty()) {
+              absl::StrAppend(&text, ",bucket_fraction:", bucket_fraction);
+            }
+            if (!window_log.empty() && window_log != "auto") {
+              absl::StrAppend(&text, ",window_log:", window_log);
+            }
+            if (!extra_options.empty()) {
+              absl::StrAppend(&text, ",", extra_options);
+            }
+            candidates.push_back(std::move(text));
+          }
+        }
+      }
+    }
+  }
+  return candidates;
+}
+
+struct Result {
+  std::string options;
+  size_t compressed_size;
+  double write_speed;  // MB/s of uncompressed records.
+  double read_speed;   // MB/s of uncompressed records.
+};
+
+Result Measure(const std::string& options_text,
+               const std::vector<std::string>& records, size_t total_size,
+               int repetitions) {
+  riegeli::RecordWriterBase::Options options;
+  {
+    const absl::Status status = options.FromString(options_text);
+    RIEGELI_CHECK(status.ok())
+        << "Invalid candidate options " << options_text << ": " << status;
+  }
+  riegeli::Chain compressed;
+  const uint64_t write_time_ns = BestTime_ns(repetitions, [&] {
+    compressed.Clear();
+    riegeli::RecordWriter<riegeli::ChainWriter<>> record_writer(
+        std::forward_as_tuple(&compressed), options);
+    for (const std::string& record : records) {
+      RIEGELI_CHECK(record_writer.WriteRecord(record))
+          << record_writer.status();
+    }
+    RIEGELI_CHECK(record_writer.Close()) << record_writer.status();
+  });
+  const uint64_t read_time_ns = BestTime_ns(repetitions, [&] {
+    riegeli::RecordReader<riegeli::ChainReader<>> record_reader(
+        std::forward_as_tuple(&compressed));
+    size_t num_records = 0;
+    absl::string_view record;
+    while (record_reader.ReadRecord(record)) ++num_records;
+    RIEGELI_CHECK(record_reader.Close()) << record_reader.status();
+    RIEGELI_CHECK_EQ(num_records, records.size())
+        << "Wrong number of records read with " << options_text;
+  });
+  const auto speed = [&](uint64_t time_ns) {
+    return static_cast<double>(total_size) /
+           static_cast<double>(std::max(time_ns, uint64_t{1})) * 1000.0;
+  };
+  return Result{options_text, compressed.size(), speed(write_time_ns),
+                speed(read_time_ns)};
+}
+
+// Returns true if `a` is at least as good as `b` in every dimension, and
+// better in at least one.
+bool Dominates(const Result& a, const Result& b) {
+  return a.compressed_size <= b.compressed_size &&
+         a.write_speed >= b.write_speed && a.read_speed >= b.read_speed &&
+         (a.compressed_size < b.compressed_size ||
+          a.write_speed > b.write_speed || a.read_speed > b.read_speed);
+}
+
+const char kUsage[] =
+    "Usage: tune_writer_options (OPTION|FILE)...\n"
+    "\n"
+    "Writes and reads a sample of records of Riegeli/records FILEs in memory "
+    "with candidate RecordWriter options, and prints the Pareto frontier of "
+    "compressed size against write and read speed, ordered by size. Speeds "
+    "are in MB/s of uncompressed records.\n";
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::SetProgramUsageMessage(kUsage);
+  const std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  RIEGELI_CHECK_GT(args.size(), 1u) << "No files given";
+  const int repetitions = absl::GetFlag(FLAGS_repetitions);
+  RIEGELI_CHECK_GT(repetitions, 0) << "--repetitions must be positive";
+
+  const size_t max_size =
+      riegeli::IntCast<size_t>(absl::GetFlag(FLAGS_max_size));
+  std::vector<std::string> records;
+  size_t total_size = 0;
+  for (size_t i = 1; i < args.size() && total_size < max_size; ++i) {
+    ReadRecords(args[i], max_size, records, total_size);
+  }
+  RIEGELI_CHECK_GT(total_size, 0u) << "No records read";
+
+  const std::vector<std::string> candidates = CandidateOptions();
+  std::cerr << "Measuring " << candidates.size() << " candidates on "
+            << records.size() << " records, " << total_size << " bytes"
+            << std::endl;
+  std::vector<Result> results;
+  results.reserve(candidates.size());
+  for (const std::string& candidate : candidates) {
+    results.push_back(Measure(candidate, records, total_size, repetitions));
+  }
+  std::stable_sort(results.begin(), results.end(),
+            [](const Result& a, const Result& b) {
+              return a.compressed_size < b.compressed_size;
+            });
+
+  const bool show_all = absl::GetFlag(FLAGS_show_all);
+  absl::Format(&std::cout, "%s%7s %8s %8s  %s\n", show_all ? "  " : "",
+               "Ratio%", "Write", "Read", "Options");
+  for (const Result& result : results) {
+    const bool on_frontier =
+        std::none_of(results.begin(), results.end(), [&](const Result& that) {
+          return Dominates(that, result);
+        });
+    if (!on_frontier && !show_all) continue;
+    absl::Format(&std::cout, "%s%7.3f %8.1f %8.1f  %s\n",
+                 show_all ? (on_frontier ? "* " : "  ") : "",
+                 static_cast<double>(result.compressed_size) /
+                     static_cast<double>(total_size) * 100.0,
+                 result.write_speed, result.read_speed, result.options);
+  }
+}
@@ -0,0 +1,108 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/records/trace_sink.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+absl::string_view TraceStageName(TraceStage stage) {
+  switch (stage) {
+    case TraceStage::kReadChunk:
+      return "read_chunk";
+    case TraceStage::kVerifyHash:
+      return "verify_hash";
+    case TraceStage::kDecodeChunk:
+      return "decode_chunk";
+    case TraceStage::kWaitForDecoding:
+      return "wait_for_decoding";
+    case TraceStage::kEncodeChunk:
+      return "encode_chunk";
+    case TraceStage::kHashChunk:
+      return "hash_chunk";
+    case TraceStage::kWaitForEncoding:
+      return "wait_for_encoding";
+    case TraceStage::kWaitForWriter:
+      return "wait_for_writer";
+    case TraceStage::kWriteChunk:
+      return "write_chunk";
+    case TraceStage::kFlush:
+      return "flush";
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown trace stage: " << static_cast<int>(stage);
+}
+
+TraceSink::~TraceSink() {}
+
+ChromeTraceSink::ChromeTraceSink(size_t max_events)
+    : max_events_(max_events), start_(absl::Now()) {}
+
+void ChromeTraceSink::AddEvent(const TraceEvent& event) {
+  const std::thread::id thread_id = std::this_thread::get_id();
+  absl::MutexLock lock(&mutex_);
+  if (ABSL_PREDICT_FALSE(events_.size() >= max_events_)) {
+    ++num_dropped_events_;
+    return;
+  }
+  const uint32_t thread_index =
+      thread_indices_
+          .emplace(thread_id, IntCast<uint32_t>(thread_indices_.size()))
+          .first->second;
+  events_.push_back(Event{event, thread_index});
+}
+
+bool ChromeTraceSink::WriteJson(Writer& dest) const {
+  absl::MutexLock lock(&mutex_);
+  if (ABSL_PREDICT_FALSE(!dest.Write("{\"traceEvents\":["))) return false;
+  std::string line;
+  for (size_t i = 0; i < events_.size(); ++i) {
+    const TraceEvent& event = events_[i].event;
+    line.clear();
+    absl::StrAppend(
+        &line, i == 0 ? "\n" : ",\n", "{\"name\":\"",
+        TraceStageName(event.stage), "\",\"cat\":\"riegeli\",\"ph\":\"X\","
+        "\"ts\":", absl::ToDoubleMicroseconds(event.begin - start_),
+        ",\"dur\":", absl::ToDoubleMicroseconds(event.end - event.begin),
+        ",\"pid\":1,\"tid\":", events_[i].thread_index, ",\"args\":{");
+    if (event.chunk_begin != absl::nullopt) {
+      absl::StrAppend(&line, "\"chunk_begin\":", *event.chunk_begin, ",");
+    }
+    absl::StrAppend(&line, "\"size\":", event.size, "}}");
+    if (ABSL_PREDICT_FALSE(!dest.Write(line))) return false;
+  }
+  return dest.Write("\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+uint64_t ChromeTraceSink::num_dropped_events() const {
+  absl::MutexLock lock(&mutex_);
+  return num_dropped_events_;
+}
+
+}  // namespace riegeli
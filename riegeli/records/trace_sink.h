@@ -0,0 +1,142 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_RECORDS_TRACE_SINK_H_
+#define RIEGELI_RECORDS_TRACE_SINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
+#include "riegeli/bytes/writer.h"
+
+namespace riegeli {
+
+// A stage of reading or writing a Riegeli/records file, traced as a span.
+enum class TraceStage {
+  // `ChunkReader` reads a chunk from the source, including waiting for I/O.
+  kReadChunk,
+  // A chunk data hash is verified while reading.
+  kVerifyHash,
+  // `RecordReader` decompresses and decodes a chunk. These are not separate
+  // spans because decoders decompress incrementally while decoding.
+  kDecodeChunk,
+  // `RecordReader` waits for a chunk being decoded in background.
+  kWaitForDecoding,
+  // `RecordWriter` encodes and compresses a chunk.
+  kEncodeChunk,
+  // A chunk data hash is computed while writing.
+  kHashChunk,
+  // The chunk writer thread of `RecordWriter` with `parallelism() > 0` waits
+  // for a chunk being encoded in background. Long spans mean that encoding is
+  // the bottleneck.
+  kWaitForEncoding,
+  // `RecordWriter` with `parallelism() > 0` waits until the chunk writer thread
+  // has room for another request. Long spans mean that writing is the
+  // bottleneck.
+  kWaitForWriter,
+  // `ChunkWriter` writes a chunk to the destination, including waiting for
+  // I/O.
+  kWriteChunk,
+  // `ChunkWriter` flushes the destination.
+  kFlush,
+};
+
+// Returns a short name of `stage`, e.g. "read_chunk".
+absl::string_view TraceStageName(TraceStage stage);
+
+// A span of work on a chunk, reported to a `TraceSink` when it ends.
+struct TraceEvent {
+  TraceStage stage;
+  // Position of the chunk in the file, or `absl::nullopt` if not known yet,
+  // e.g. for a chunk being encoded in background.
+  absl::optional<Position> chunk_begin;
+  // Number of bytes processed: for reading and writing the length of the chunk
+  // in the file, otherwise the size of the chunk data. 0 if not applicable.
+  Position size = 0;
+  absl::Time begin;
+  absl::Time end;
+};
+
+// Receives trace events from `RecordReader`, `RecordWriter`, `ChunkReader`,
+// and `ChunkWriter`, if set by their `set_trace_sink()`.
+//
+// `AddEvent()` is called in the thread which did the work, possibly from
+// multiple threads concurrently, so it must be thread-safe, and it should be
+// fast because it is called synchronously.
+class TraceSink {
+ public:
+  virtual ~TraceSink();
+
+  virtual void AddEvent(const TraceEvent& event) = 0;
+};
+
+// A `TraceSink` which collects events in memory, and writes them in the Chrome
+// trace event JSON format, which can be loaded into Perfetto
+// (https://ui.perfetto.dev) or `chrome://tracing`.
+//
+// Each thread is shown as a separate track. Timestamps are relative to the
+// creation of the `ChromeTraceSink`.
+//
+// `ChromeTraceSink` is thread-safe.
+class ChromeTraceSink : public TraceSink {
+ public:
+  // Creates a `ChromeTraceSink` keeping at most `max_events` events. Further
+  // events are counted by `num_dropped_events()` and discarded.
+  explicit ChromeTraceSink(size_t max_events = size_t{1} << 20);
+
+  ChromeTraceSink(const ChromeTraceSink&) = delete;
+  ChromeTraceSink& operator=(const ChromeTraceSink&) = delete;
+
+  void AddEvent(const TraceEvent& event) override;
+
+  // Writes events collected so far as a JSON object to `dest`.
+  //
+  // Return values:
+  //  * `true`  - success (`dest.healthy()`)
+  //  * `false` - failure (`!dest.healthy()`)
+  bool WriteJson(Writer& dest) const;
+
+  // Returns the number of events discarded because of `max_events`.
+  uint64_t num_dropped_events() const;
+
+ private:
+  struct Event {
+    TraceEvent event;
+    uint32_t thread_index;
+  };
+
+  size_t max_events_;
+  absl::Time start_;
+  mutable absl::Mutex mutex_;
+  // Small consecutive numbers of threads which reported events, used as
+  // Chrome trace thread ids.
+  absl::flat_hash_map<std::thread::id, uint32_t> thread_indices_
+      ABSL_GUARDED_BY(mutex_);
+  std::vector<Event> events_ ABSL_GUARDED_BY(mutex_);
+  uint64_t num_dropped_events_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_RECORDS_TRACE_SINK_H_
@@ -17,6 +17,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <limits>
 #include <string>
 
@@ -24,9 +27,12 @@
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/types/optional.h"
 #include "crc32c/crc32c.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/pullable_reader.h"
 #include "riegeli/bytes/reader.h"
@@ -42,12 +48,28 @@ inline uint32_t MaskChecksum(uint32_t x) {
   return ((x >> 15) | (x << 17)) + 0xa282ead8;
 }
 
+// Maximum length of the varint32 which begins Snappy-compressed data and holds
+// its uncompressed length.
+constexpr size_t kMaxUncompressedLengthLength = 5;
+
 }  // namespace
 
 void FramedSnappyReaderBase::Initialize(Reader* src) {
   RIEGELI_ASSERT(src != nullptr)
       << "Failed precondition of FramedSnappyReader: null Reader pointer";
-  if (ABSL_PREDICT_FALSE(!src->healthy()) && src->available() == 0) Fail(*src);
+  if (ABSL_PREDICT_FALSE(!src->healthy()) && src->available() == 0) {
+    Fail(*src);
+    return;
+  }
+  AddSeekPoint(*src);
+}
+
+void FramedSnappyReaderBase::AddSeekPoint(Reader& src) {
+  if (!src.SupportsRandomAccess()) return;
+  if (seek_points_.empty() ||
+      src.pos() > seek_points_.back().compressed_pos) {
+    seek_points_.push_back(SeekPoint{src.pos(), limit_pos()});
+  }
 }
 
 void FramedSnappyReaderBase::Done() {
@@ -83,6 +105,7 @@ bool FramedSnappyReaderBase::PullSlow(size_t min_length,
   }
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   Reader& src = *src_reader();
+  if (parallelism_ > 1) return PullFramesInParallel(src);
   truncated_ = false;
   while (src.Pull(sizeof(uint32_t))) {
     const uint32_t chunk_header = ReadLittleEndian32(src.cursor());
@@ -105,6 +128,7 @@ bool FramedSnappyReaderBase::PullSlow(size_t min_length,
           set_buffer();
           return FailInvalidStream("compressed data too short");
         }
+        AddSeekPoint(src);
         const uint32_t checksum =
             ReadLittleEndian32(src.cursor() + sizeof(uint32_t));
         const char* const compressed_data = src.cursor() + 2 * sizeof(uint32_t);
@@ -149,6 +173,7 @@ bool FramedSnappyReaderBase::PullSlow(size_t min_length,
           set_buffer();
           return FailInvalidStream("uncompressed data too short");
         }
+        AddSeekPoint(src);
         const uint32_t checksum =
             ReadLittleEndian32(src.cursor() + sizeof(uint32_t));
         const char* const uncompressed_data =
@@ -201,4 +226,271 @@ bool FramedSnappyReaderBase::PullSlow(size_t min_length,
   return false;
 }
 
+bool FramedSnappyReaderBase::PullFramesInParallel(Reader& src) {
+  for (;;) {
+    if (next_frame_ == num_frames_) {
+      if (ABSL_PREDICT_FALSE(!ReadFrames(src))) return false;
+    }
+    const Frame& frame = frames_[next_frame_++];
+    if (ABSL_PREDICT_FALSE(frame.error != nullptr)) {
+      // Frames before an invalid frame are returned first, as if they were
+      // decoded serially.
+      set_buffer();
+      num_frames_ = 0;
+      next_frame_ = 0;
+      return FailInvalidStream(frame.error);
+    }
+    if (ABSL_PREDICT_FALSE(frame.length == 0)) continue;
+    if (ABSL_PREDICT_FALSE(frame.length >
+                           std::numeric_limits<Position>::max() -
+                               limit_pos())) {
+      set_buffer();
+      return FailOverflow();
+    }
+    set_buffer(frame.data, frame.length);
+    move_limit_pos(available());
+    return true;
+  }
+}
+
+bool FramedSnappyReaderBase::ReadFrames(Reader& src) {
+  num_frames_ = 0;
+  next_frame_ = 0;
+  truncated_ = false;
+  const size_t max_frames = IntCast<size_t>(parallelism_);
+  if (frames_.size() < max_frames) frames_.resize(max_frames);
+  // Problems found after some frames were read are reported when reading frames
+  // again, so that the frames before them are returned first.
+  while (num_frames_ < max_frames && src.Pull(sizeof(uint32_t))) {
+    const uint32_t chunk_header = ReadLittleEndian32(src.cursor());
+    const uint8_t chunk_type = static_cast<uint8_t>(chunk_header);
+    const size_t chunk_length = IntCast<size_t>(chunk_header >> 8);
+    if (ABSL_PREDICT_FALSE(!src.Pull(sizeof(uint32_t) + chunk_length))) {
+      if (num_frames_ > 0) break;
+      set_buffer();
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      truncated_ = true;
+      return false;
+    }
+    if (ABSL_PREDICT_FALSE(src.pos() == 0 &&
+                           chunk_type != 0xff /* Stream identifier */)) {
+      set_buffer();
+      return FailInvalidStream("missing stream identifier");
+    }
+    switch (chunk_type) {
+      case 0x00:    // Compressed data.
+      case 0x01: {  // Uncompressed data.
+        if (ABSL_PREDICT_FALSE(chunk_length < sizeof(uint32_t))) {
+          if (num_frames_ > 0) break;
+          set_buffer();
+          return FailInvalidStream(chunk_type == 0x00
+                                       ? "compressed data too short"
+                                       : "uncompressed data too short");
+        }
+        // Frames of a batch are decoded together, so only the beginning of
+        // the batch is remembered for seeking.
+        if (num_frames_ == 0) AddSeekPoint(src);
+        Frame& frame = frames_[num_frames_++];
+        frame.chunk_type = chunk_type;
+        frame.checksum = ReadLittleEndian32(src.cursor() + sizeof(uint32_t));
+        frame.compressed_length = chunk_length - sizeof(uint32_t);
+        frame.compressed.Reset(frame.compressed_length);
+        std::memcpy(frame.compressed.data(),
+                    src.cursor() + 2 * sizeof(uint32_t),
+                    frame.compressed_length);
+        src.move_cursor(sizeof(uint32_t) + chunk_length);
+        continue;
+      }
+      case 0xff:  // Stream identifier.
+        if (ABSL_PREDICT_FALSE(
+                absl::string_view(src.cursor() + sizeof(uint32_t),
+                                  chunk_length) !=
+                absl::string_view("sNaPpY", 6))) {
+          if (num_frames_ > 0) break;
+          set_buffer();
+          return FailInvalidStream("invalid stream identifier");
+        }
+        src.move_cursor(sizeof(uint32_t) + chunk_length);
+        continue;
+      default:
+        if (ABSL_PREDICT_FALSE(chunk_type < 0x80)) {
+          if (num_frames_ > 0) break;
+          set_buffer();
+          return FailInvalidStream("reserved unskippable chunk");
+        }
+        src.move_cursor(sizeof(uint32_t) + chunk_length);
+        continue;
+    }
+    break;
+  }
+  if (num_frames_ == 0) {
+    set_buffer();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+    if (ABSL_PREDICT_FALSE(src.available() > 0)) truncated_ = true;
+    return false;
+  }
+
+  std::atomic<size_t> next_frame(0);
+  const auto decode_frames = [&] {
+    for (;;) {
+      const size_t frame = next_frame.fetch_add(1);
+      if (frame >= num_frames_) return;
+      DecodeFrame(frames_[frame]);
+    }
+  };
+  const size_t num_tasks = UnsignedMin(max_frames, num_frames_);
+  absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&decode_frames, &background_tasks] {
+      decode_frames();
+      background_tasks.DecrementCount();
+    });
+  }
+  decode_frames();
+  background_tasks.Wait();
+  return true;
+}
+
+bool FramedSnappyReaderBase::SupportsRandomAccess() {
+  Reader* const src = src_reader();
+  return src != nullptr && src->SupportsRandomAccess();
+}
+
+bool FramedSnappyReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!SeekUsingScratch(new_pos))) return true;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader& src = *src_reader();
+  if (seek_points_.empty()) return PullableReader::SeekSlow(new_pos);
+  set_buffer();
+  truncated_ = false;
+  if (new_pos <= limit_pos() || next_frame_ < num_frames_) {
+    // Seeking backwards, or frames were read ahead: begin decoding at the
+    // last known chunk beginning at or before `new_pos`.
+    const SeekPoint& seek_point =
+        *(std::upper_bound(seek_points_.begin(), seek_points_.end(), new_pos,
+                           [](Position pos, const SeekPoint& seek_point) {
+                             return pos < seek_point.uncompressed_pos;
+                           }) -
+          1);
+    num_frames_ = 0;
+    next_frame_ = 0;
+    if (ABSL_PREDICT_FALSE(!src.Seek(seek_point.compressed_pos))) {
+      return Fail(src);
+    }
+    set_limit_pos(seek_point.uncompressed_pos);
+  }
+  // Skip whole frames before `new_pos` by their headers. Invalid frames are
+  // left for `PullSlow()` to report. Skipped frames are not verified against
+  // their checksums.
+  while (limit_pos() < new_pos && src.Pull(sizeof(uint32_t))) {
+    const uint32_t chunk_header = ReadLittleEndian32(src.cursor());
+    const uint8_t chunk_type = static_cast<uint8_t>(chunk_header);
+    const size_t chunk_length = IntCast<size_t>(chunk_header >> 8);
+    if (src.pos() == 0 && chunk_type != 0xff /* Stream identifier */) break;
+    size_t uncompressed_length;
+    if (chunk_type == 0x00) {  // Compressed data.
+      if (ABSL_PREDICT_FALSE(chunk_length < sizeof(uint32_t))) break;
+      const size_t length_length = UnsignedMin(
+          chunk_length - sizeof(uint32_t), kMaxUncompressedLengthLength);
+      if (ABSL_PREDICT_FALSE(
+              !src.Pull(2 * sizeof(uint32_t) + length_length) ||
+              !snappy::GetUncompressedLength(
+                  src.cursor() + 2 * sizeof(uint32_t),
+                  UnsignedMin(src.available() - 2 * sizeof(uint32_t),
+                              chunk_length - sizeof(uint32_t)),
+                  &uncompressed_length))) {
+        break;
+      }
+    } else if (chunk_type == 0x01) {  // Uncompressed data.
+      if (ABSL_PREDICT_FALSE(chunk_length < sizeof(uint32_t))) break;
+      uncompressed_length = chunk_length - sizeof(uint32_t);
+    } else if (chunk_type == 0xff) {  // Stream identifier.
+      if (ABSL_PREDICT_FALSE(
+              !src.Pull(sizeof(uint32_t) + chunk_length) ||
+              absl::string_view(src.cursor() + sizeof(uint32_t),
+                                chunk_length) !=
+                  absl::string_view("sNaPpY", 6))) {
+        break;
+      }
+      uncompressed_length = 0;
+    } else if (chunk_type >= 0x80) {  // Skippable chunk.
+      uncompressed_length = 0;
+    } else {
+      break;
+    }
+    if (ABSL_PREDICT_FALSE(uncompressed_length > snappy::kBlockSize)) break;
+    // This frame contains `new_pos` and needs to be decompressed.
+    if (new_pos - limit_pos() < uncompressed_length) break;
+    if (uncompressed_length > 0) AddSeekPoint(src);
+    if (ABSL_PREDICT_FALSE(!src.Skip(sizeof(uint32_t) + chunk_length))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      truncated_ = true;
+      return false;
+    }
+    move_limit_pos(uncompressed_length);
+  }
+  if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+  if (limit_pos() == new_pos) return true;
+  return PullableReader::SeekSlow(new_pos);
+}
+
+absl::optional<Position> FramedSnappyReaderBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  if (ABSL_PREDICT_FALSE(seek_points_.empty())) {
+    Fail(absl::UnimplementedError(
+        "FramedSnappyReaderBase::Size() not supported"));
+    return absl::nullopt;
+  }
+  const Position pos_before = pos();
+  Seek(std::numeric_limits<Position>::max());
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  const Position size = pos();
+  if (ABSL_PREDICT_FALSE(!Seek(pos_before))) return absl::nullopt;
+  return size;
+}
+
+void FramedSnappyReaderBase::DecodeFrame(Frame& frame) {
+  frame.data = nullptr;
+  frame.length = 0;
+  frame.error = nullptr;
+  if (frame.chunk_type == 0x00) {  // Compressed data.
+    size_t uncompressed_length;
+    if (ABSL_PREDICT_FALSE(!snappy::GetUncompressedLength(
+            frame.compressed.data(), frame.compressed_length,
+            &uncompressed_length))) {
+      frame.error = "invalid uncompressed length";
+      return;
+    }
+    if (ABSL_PREDICT_FALSE(uncompressed_length > snappy::kBlockSize)) {
+      frame.error = "uncompressed length too large";
+      return;
+    }
+    frame.uncompressed.Reset(uncompressed_length);
+    if (ABSL_PREDICT_FALSE(!snappy::RawUncompress(frame.compressed.data(),
+                                                  frame.compressed_length,
+                                                  frame.uncompressed.data()))) {
+      frame.error = "invalid compressed data";
+      return;
+    }
+    frame.data = frame.uncompressed.data();
+    frame.length = uncompressed_length;
+  } else {  // Uncompressed data.
+    if (ABSL_PREDICT_FALSE(frame.compressed_length > snappy::kBlockSize)) {
+      frame.error = "uncompressed length too large";
+      return;
+    }
+    frame.data = frame.compressed.data();
+    frame.length = frame.compressed_length;
+  }
+  if (ABSL_PREDICT_FALSE(MaskChecksum(crc32c::Crc32c(
+                             frame.data, frame.length)) != frame.checksum)) {
+    frame.data = nullptr;
+    frame.length = 0;
+    frame.error = "wrong checksum";
+  }
+}
+
 }  // namespace riegeli
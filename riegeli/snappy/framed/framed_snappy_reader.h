@@ -16,15 +16,19 @@
 #define RIEGELI_SNAPPY_FRAMED_FRAMED_SNAPPY_READER_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
@@ -36,7 +40,36 @@ namespace riegeli {
 // Template parameter independent part of `FramedSnappyReader`.
 class FramedSnappyReaderBase : public PullableReader {
  public:
-  class Options {};
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the maximum number of frames decompressed in parallel. The calling
+    // thread takes part in decompression.
+    //
+    // If greater than 1, up to `parallelism()` frames are read ahead from the
+    // compressed `Reader` and decompressed and verified together on the thread
+    // pool. This makes reading wait for more compressed data than is needed to
+    // return the next uncompressed data, so it is meant for bulk transfers
+    // rather than interactive streams.
+    //
+    // Default: 1.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "FramedSnappyReaderBase::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+   private:
+    int parallelism_ = 1;
+  };
 
   // Returns the compressed `Reader`. Unchanged by `Close()`.
   virtual Reader* src_reader() = 0;
@@ -49,35 +82,98 @@ class FramedSnappyReaderBase : public PullableReader {
   using PullableReader::Fail;
   ABSL_ATTRIBUTE_COLD bool Fail(absl::Status status) override;
 
+  // Random access is supported if the compressed `Reader` supports it.
+  //
+  // Frames are decodable independently. Chunk headers visited while reading
+  // are remembered for seeking backwards, and seeking forwards skips whole
+  // frames by their headers without decompressing them. `Size()` seeks to the
+  // end this way.
+  bool SupportsRandomAccess() override;
+  bool SupportsSize() override { return SupportsRandomAccess(); }
+  absl::optional<Position> Size() override;
+
  protected:
   explicit FramedSnappyReaderBase(InitiallyClosed) noexcept
       : PullableReader(kInitiallyClosed) {}
-  explicit FramedSnappyReaderBase(InitiallyOpen) noexcept
-      : PullableReader(kInitiallyOpen) {}
+  explicit FramedSnappyReaderBase(InitiallyOpen, int parallelism = 1) noexcept
+      : PullableReader(kInitiallyOpen), parallelism_(parallelism) {}
 
   FramedSnappyReaderBase(FramedSnappyReaderBase&& that) noexcept;
   FramedSnappyReaderBase& operator=(FramedSnappyReaderBase&& that) noexcept;
 
   void Reset(InitiallyClosed);
-  void Reset(InitiallyOpen);
+  void Reset(InitiallyOpen, int parallelism = 1);
   void Initialize(Reader* src);
 
   void Done() override;
   bool PullSlow(size_t min_length, size_t recommended_length) override;
+  bool SeekSlow(Position new_pos) override;
 
  private:
+  // A position where decoding can begin: the beginning of a chunk.
+  struct SeekPoint {
+    Position compressed_pos;
+    Position uncompressed_pos;
+  };
+
+  // A data frame read ahead if `parallelism_ > 1`.
+  struct Frame {
+    uint8_t chunk_type = 0;
+    uint32_t checksum = 0;
+    // Frame data after the checksum.
+    Buffer compressed;
+    size_t compressed_length = 0;
+    // Decompressed data, used for compressed frames.
+    Buffer uncompressed;
+    // Result of `DecodeFrame()`: uncompressed data, pointing to `compressed`
+    // or `uncompressed`, or the reason why the frame is invalid.
+    const char* data = nullptr;
+    size_t length = 0;
+    const char* error = nullptr;
+  };
+
   ABSL_ATTRIBUTE_COLD bool FailInvalidStream(absl::string_view message);
 
+  // Remembers that decoding can begin at `src.pos()`, corresponding to
+  // `limit_pos()`, if `src` supports random access.
+  void AddSeekPoint(Reader& src);
+
+  // Implements `PullSlow()` if `parallelism_ > 1`.
+  bool PullFramesInParallel(Reader& src);
+
+  // Reads up to `parallelism_` data frames to `frames_` and decodes them in
+  // parallel.
+  //
+  // Return values:
+  //  * `true`  - success (`num_frames_ > 0`)
+  //  * `false` - end of source or failure
+  bool ReadFrames(Reader& src);
+
+  // Verifies and decompresses `frame`, setting `frame.data` and `frame.length`,
+  // or `frame.error`.
+  static void DecodeFrame(Frame& frame);
+
+  int parallelism_ = 1;
+  // Frames read ahead, with `frames_[next_frame_..num_frames_)` not returned
+  // yet. Only the first `num_frames_` entries are meaningful, the rest keep
+  // their buffers for reuse.
+  std::vector<Frame> frames_;
+  size_t num_frames_ = 0;
+  size_t next_frame_ = 0;
+
   // If `true`, the source is truncated (without a clean end of the compressed
   // stream) at the current position. If the source does not grow, `Close()`
   // will fail.
   bool truncated_ = false;
   // Buffered uncompressed data.
   Buffer uncompressed_;
+  // Chunk beginnings found so far, sorted and distinct, beginning with the
+  // initial position. Filled only if `src_reader()->SupportsRandomAccess()`.
+  std::vector<SeekPoint> seek_points_;
 
   // Invariant if scratch is not used:
   //   `start() == nullptr` or `start() == uncompressed_.data()` or
-  //   `limit() == src_reader()->cursor()`
+  //   `limit() == src_reader()->cursor()` or `start()` points to `frames_`
 };
 
 // A `Reader` which decompresses data with framed Snappy format after getting
@@ -167,39 +263,58 @@ inline FramedSnappyReaderBase::FramedSnappyReaderBase(
     : PullableReader(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
+      parallelism_(that.parallelism_),
+      frames_(std::move(that.frames_)),
+      num_frames_(std::exchange(that.num_frames_, 0)),
+      next_frame_(std::exchange(that.next_frame_, 0)),
       truncated_(that.truncated_),
-      uncompressed_(std::move(that.uncompressed_)) {}
+      uncompressed_(std::move(that.uncompressed_)),
+      seek_points_(std::move(that.seek_points_)) {}
 
 inline FramedSnappyReaderBase& FramedSnappyReaderBase::operator=(
     FramedSnappyReaderBase&& that) noexcept {
   PullableReader::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
+  parallelism_ = that.parallelism_;
+  frames_ = std::move(that.frames_);
+  num_frames_ = std::exchange(that.num_frames_, 0);
+  next_frame_ = std::exchange(that.next_frame_, 0);
   truncated_ = that.truncated_;
   uncompressed_ = std::move(that.uncompressed_);
+  seek_points_ = std::move(that.seek_points_);
   return *this;
 }
 
 inline void FramedSnappyReaderBase::Reset(InitiallyClosed) {
   PullableReader::Reset(kInitiallyClosed);
+  parallelism_ = 1;
+  num_frames_ = 0;
+  next_frame_ = 0;
   truncated_ = false;
+  seek_points_.clear();
 }
 
-inline void FramedSnappyReaderBase::Reset(InitiallyOpen) {
+inline void FramedSnappyReaderBase::Reset(InitiallyOpen, int parallelism) {
   PullableReader::Reset(kInitiallyOpen);
+  parallelism_ = parallelism;
+  num_frames_ = 0;
+  next_frame_ = 0;
   truncated_ = false;
+  seek_points_.clear();
 }
 
 template <typename Src>
 inline FramedSnappyReader<Src>::FramedSnappyReader(const Src& src,
                                                    Options options)
-    : FramedSnappyReaderBase(kInitiallyOpen), src_(src) {
+    : FramedSnappyReaderBase(kInitiallyOpen, options.parallelism()), src_(src) {
   Initialize(src_.get());
 }
 
 template <typename Src>
 inline FramedSnappyReader<Src>::FramedSnappyReader(Src&& src, Options options)
-    : FramedSnappyReaderBase(kInitiallyOpen), src_(std::move(src)) {
+    : FramedSnappyReaderBase(kInitiallyOpen, options.parallelism()),
+      src_(std::move(src)) {
   Initialize(src_.get());
 }
 
@@ -207,7 +322,8 @@ template <typename Src>
 template <typename... SrcArgs>
 inline FramedSnappyReader<Src>::FramedSnappyReader(
     std::tuple<SrcArgs...> src_args, Options options)
-    : FramedSnappyReaderBase(kInitiallyOpen), src_(std::move(src_args)) {
+    : FramedSnappyReaderBase(kInitiallyOpen, options.parallelism()),
+      src_(std::move(src_args)) {
   Initialize(src_.get());
 }
 
@@ -238,14 +354,14 @@ inline void FramedSnappyReader<Src>::Reset() {
 
 template <typename Src>
 inline void FramedSnappyReader<Src>::Reset(const Src& src, Options options) {
-  FramedSnappyReaderBase::Reset(kInitiallyOpen);
+  FramedSnappyReaderBase::Reset(kInitiallyOpen, options.parallelism());
   src_.Reset(src);
   Initialize(src_.get());
 }
 
 template <typename Src>
 inline void FramedSnappyReader<Src>::Reset(Src&& src, Options options) {
-  FramedSnappyReaderBase::Reset(kInitiallyOpen);
+  FramedSnappyReaderBase::Reset(kInitiallyOpen, options.parallelism());
   src_.Reset(std::move(src));
   Initialize(src_.get());
 }
@@ -254,7 +370,7 @@ template <typename Src>
 template <typename... SrcArgs>
 inline void FramedSnappyReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
                                            Options options) {
-  FramedSnappyReaderBase::Reset(kInitiallyOpen);
+  FramedSnappyReaderBase::Reset(kInitiallyOpen, options.parallelism());
   src_.Reset(std::move(src_args));
   Initialize(src_.get());
 }
@@ -17,17 +17,21 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <cstring>
 #include <limits>
 #include <string>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "crc32c/crc32c.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/pushable_writer.h"
 #include "riegeli/bytes/writer.h"
@@ -43,6 +47,35 @@ inline uint32_t MaskChecksum(uint32_t x) {
   return ((x >> 15) | (x << 17)) + 0xa282ead8;
 }
 
+// Writes a frame with `uncompressed_data[0..uncompressed_length)` to `dest`,
+// which must have space for `2 * sizeof(uint32_t) +
+// snappy::MaxCompressedLength(uncompressed_length)` bytes. Returns the length
+// of the frame.
+size_t WriteFrame(const char* uncompressed_data, size_t uncompressed_length,
+                  char* dest) {
+  size_t compressed_length;
+  snappy::RawCompress(uncompressed_data, uncompressed_length,
+                      dest + 2 * sizeof(uint32_t), &compressed_length);
+  if (compressed_length < uncompressed_length) {
+    WriteLittleEndian32(
+        IntCast<uint32_t>(0x00 /* Compressed data */ |
+                          ((sizeof(uint32_t) + compressed_length) << 8)),
+        dest);
+  } else {
+    std::memcpy(dest + 2 * sizeof(uint32_t), uncompressed_data,
+                uncompressed_length);
+    compressed_length = uncompressed_length;
+    WriteLittleEndian32(
+        IntCast<uint32_t>(0x01 /* Uncompressed data */ |
+                          ((sizeof(uint32_t) + compressed_length) << 8)),
+        dest);
+  }
+  WriteLittleEndian32(
+      MaskChecksum(crc32c::Crc32c(uncompressed_data, uncompressed_length)),
+      dest + sizeof(uint32_t));
+  return 2 * sizeof(uint32_t) + compressed_length;
+}
+
 }  // namespace
 
 void FramedSnappyWriterBase::Initialize(Writer* dest) {
@@ -91,9 +124,10 @@ bool FramedSnappyWriterBase::PushSlow(size_t min_length,
   if (ABSL_PREDICT_FALSE(start_pos() == std::numeric_limits<Position>::max())) {
     return FailOverflow();
   }
-  const size_t length =
-      UnsignedMin(BufferLength(1, snappy::kBlockSize, size_hint_, start_pos()),
-                  std::numeric_limits<Position>::max() - start_pos());
+  const size_t length = UnsignedMin(
+      BufferLength(1, IntCast<size_t>(parallelism_) * snappy::kBlockSize,
+                   size_hint_, start_pos()),
+      std::numeric_limits<Position>::max() - start_pos());
   uncompressed_.Reset(length);
   set_buffer(uncompressed_.data(), length);
   return true;
@@ -101,39 +135,66 @@ bool FramedSnappyWriterBase::PushSlow(size_t min_length,
 
 inline bool FramedSnappyWriterBase::PushInternal(Writer& dest) {
   const size_t uncompressed_length = written_to_buffer();
-  RIEGELI_ASSERT_LE(uncompressed_length, snappy::kBlockSize)
+  RIEGELI_ASSERT_LE(uncompressed_length,
+                    IntCast<size_t>(parallelism_) * snappy::kBlockSize)
       << "Failed invariant of FramedSnappyWriterBase: buffer too large";
   if (uncompressed_length == 0) return true;
   set_cursor(start());
   const char* const uncompressed_data = cursor();
+  if (uncompressed_length > snappy::kBlockSize) {
+    return PushFramesInParallel(dest, uncompressed_data, uncompressed_length);
+  }
   if (ABSL_PREDICT_FALSE(
           !dest.Push(2 * sizeof(uint32_t) +
                      snappy::MaxCompressedLength(uncompressed_length)))) {
     return Fail(dest);
   }
-  char* const compressed_chunk = dest.cursor();
-  size_t compressed_length;
-  snappy::RawCompress(uncompressed_data, uncompressed_length,
-                      compressed_chunk + 2 * sizeof(uint32_t),
-                      &compressed_length);
-  if (compressed_length < uncompressed_length) {
-    WriteLittleEndian32(
-        IntCast<uint32_t>(0x00 /* Compressed data */ |
-                          ((sizeof(uint32_t) + compressed_length) << 8)),
-        compressed_chunk);
-  } else {
-    std::memcpy(compressed_chunk + 2 * sizeof(uint32_t), uncompressed_data,
-                uncompressed_length);
-    compressed_length = uncompressed_length;
-    WriteLittleEndian32(
-        IntCast<uint32_t>(0x01 /* Uncompressed data */ |
-                          ((sizeof(uint32_t) + compressed_length) << 8)),
-        compressed_chunk);
+  dest.move_cursor(
+      WriteFrame(uncompressed_data, uncompressed_length, dest.cursor()));
+  move_start_pos(uncompressed_length);
+  return true;
+}
+
+bool FramedSnappyWriterBase::PushFramesInParallel(Writer& dest,
+                                                  const char* uncompressed_data,
+                                                  size_t uncompressed_length) {
+  const size_t num_frames =
+      (uncompressed_length + snappy::kBlockSize - 1) / snappy::kBlockSize;
+  const size_t max_frame_length =
+      2 * sizeof(uint32_t) + snappy::MaxCompressedLength(snappy::kBlockSize);
+  compressed_.Reset(num_frames * max_frame_length);
+  std::vector<size_t> frame_lengths(num_frames);
+  std::atomic<size_t> next_frame(0);
+  const auto compress_frames = [&] {
+    for (;;) {
+      const size_t frame = next_frame.fetch_add(1);
+      if (frame >= num_frames) return;
+      const size_t frame_begin = frame * snappy::kBlockSize;
+      frame_lengths[frame] = WriteFrame(
+          uncompressed_data + frame_begin,
+          UnsignedMin(uncompressed_length - frame_begin, snappy::kBlockSize),
+          compressed_.data() + frame * max_frame_length);
+    }
+  };
+  const size_t num_tasks =
+      UnsignedMin(IntCast<size_t>(parallelism_), num_frames);
+  absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&compress_frames, &background_tasks] {
+      compress_frames();
+      background_tasks.DecrementCount();
+    });
+  }
+  compress_frames();
+  background_tasks.Wait();
+
+  for (size_t frame = 0; frame < num_frames; ++frame) {
+    if (ABSL_PREDICT_FALSE(!dest.Write(absl::string_view(
+            compressed_.data() + frame * max_frame_length,
+            frame_lengths[frame])))) {
+      return Fail(dest);
+    }
   }
-  WriteLittleEndian32(
-      MaskChecksum(crc32c::Crc32c(uncompressed_data, uncompressed_length)),
-      compressed_chunk + sizeof(uint32_t));
-  dest.move_cursor(2 * sizeof(uint32_t) + compressed_length);
   move_start_pos(uncompressed_length);
   return true;
 }
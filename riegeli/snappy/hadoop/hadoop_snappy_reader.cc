@@ -17,6 +17,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <limits>
 #include <string>
 
@@ -24,8 +27,11 @@
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/pullable_reader.h"
 #include "riegeli/bytes/reader.h"
@@ -34,10 +40,32 @@
 
 namespace riegeli {
 
+namespace {
+
+// Maximum length of the varint32 which begins Snappy-compressed data and holds
+// its uncompressed length.
+constexpr size_t kMaxUncompressedLengthLength = 5;
+
+}  // namespace
+
 void HadoopSnappyReaderBase::Initialize(Reader* src) {
   RIEGELI_ASSERT(src != nullptr)
       << "Failed precondition of HadoopSnappyReader: null Reader pointer";
-  if (ABSL_PREDICT_FALSE(!src->healthy()) && src->available() == 0) Fail(*src);
+  if (ABSL_PREDICT_FALSE(!src->healthy()) && src->available() == 0) {
+    Fail(*src);
+    return;
+  }
+  AddSeekPoint(*src, limit_pos());
+}
+
+void HadoopSnappyReaderBase::AddSeekPoint(Reader& src,
+                                          Position uncompressed_pos) {
+  if (!src.SupportsRandomAccess()) return;
+  if (seek_points_.empty() ||
+      src.pos() > seek_points_.back().compressed_pos) {
+    seek_points_.push_back(
+        SeekPoint{src.pos(), uncompressed_pos, remaining_chunk_length_});
+  }
 }
 
 void HadoopSnappyReaderBase::Done() {
@@ -75,6 +103,7 @@ bool HadoopSnappyReaderBase::PullSlow(size_t min_length,
   }
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   Reader& src = *src_reader();
+  if (parallelism_ > 1) return PullBlocksInParallel(src);
   truncated_ = false;
   while (remaining_chunk_length_ == 0) {
     if (ABSL_PREDICT_FALSE(!src.Pull(sizeof(uint32_t)))) {
@@ -86,6 +115,7 @@ bool HadoopSnappyReaderBase::PullSlow(size_t min_length,
     remaining_chunk_length_ = ReadBigEndian32(src.cursor());
     src.move_cursor(sizeof(uint32_t));
   }
+  AddSeekPoint(src, limit_pos());
   size_t uncompressed_length;
   char* uncompressed_data;
   do {
@@ -138,4 +168,265 @@ bool HadoopSnappyReaderBase::PullSlow(size_t min_length,
   return true;
 }
 
+bool HadoopSnappyReaderBase::SupportsRandomAccess() {
+  Reader* const src = src_reader();
+  return src != nullptr && src->SupportsRandomAccess();
+}
+
+bool HadoopSnappyReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (ABSL_PREDICT_FALSE(!SeekUsingScratch(new_pos))) return true;
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader& src = *src_reader();
+  if (next_block_ < num_blocks_) {
+    set_buffer();
+    if (new_pos < limit_pos()) {
+      SkipBlocksReadAhead();
+    } else {
+      // Seeking forwards: return the block read ahead which contains
+      // `new_pos`, if any.
+      while (next_block_ < num_blocks_) {
+        const Block& block = blocks_[next_block_];
+        // An invalid block is left for `PullSlow()` to report.
+        if (ABSL_PREDICT_FALSE(block.error != nullptr)) {
+          return PullableReader::SeekSlow(new_pos);
+        }
+        ++next_block_;
+        if (new_pos - limit_pos() < block.uncompressed_length) {
+          set_buffer(block.uncompressed.data(), block.uncompressed_length,
+                     IntCast<size_t>(new_pos - limit_pos()));
+          move_limit_pos(block.uncompressed_length);
+          return true;
+        }
+        move_limit_pos(block.uncompressed_length);
+      }
+      num_blocks_ = 0;
+      next_block_ = 0;
+    }
+  }
+  if (seek_points_.empty()) return PullableReader::SeekSlow(new_pos);
+  set_buffer();
+  truncated_ = false;
+  if (new_pos <= limit_pos()) {
+    // Seeking backwards: begin decoding at the last known block beginning at
+    // or before `new_pos`.
+    const SeekPoint& seek_point =
+        *(std::upper_bound(seek_points_.begin(), seek_points_.end(), new_pos,
+                           [](Position pos, const SeekPoint& seek_point) {
+                             return pos < seek_point.uncompressed_pos;
+                           }) -
+          1);
+    if (ABSL_PREDICT_FALSE(!src.Seek(seek_point.compressed_pos))) {
+      return Fail(src);
+    }
+    set_limit_pos(seek_point.uncompressed_pos);
+    remaining_chunk_length_ = seek_point.remaining_chunk_length;
+  }
+  // Skip whole blocks before `new_pos` by their headers. Invalid blocks are
+  // left for `PullSlow()` to report.
+  while (limit_pos() < new_pos) {
+    if (remaining_chunk_length_ == 0) {
+      if (ABSL_PREDICT_FALSE(!src.Pull(sizeof(uint32_t)))) break;
+      remaining_chunk_length_ = ReadBigEndian32(src.cursor());
+      src.move_cursor(sizeof(uint32_t));
+      continue;
+    }
+    if (ABSL_PREDICT_FALSE(!src.Pull(sizeof(uint32_t)))) break;
+    const uint32_t compressed_length = ReadBigEndian32(src.cursor());
+    if (ABSL_PREDICT_FALSE(compressed_length >
+                           std::numeric_limits<uint32_t>::max() -
+                               sizeof(uint32_t))) {
+      break;
+    }
+    const size_t length_length =
+        UnsignedMin(size_t{compressed_length}, kMaxUncompressedLengthLength);
+    size_t uncompressed_length;
+    if (ABSL_PREDICT_FALSE(
+            !src.Pull(sizeof(uint32_t) + length_length) ||
+            !snappy::GetUncompressedLength(
+                src.cursor() + sizeof(uint32_t),
+                UnsignedMin(src.available() - sizeof(uint32_t),
+                            size_t{compressed_length}),
+                &uncompressed_length))) {
+      break;
+    }
+    if (ABSL_PREDICT_FALSE(uncompressed_length > remaining_chunk_length_)) {
+      break;
+    }
+    // This block contains `new_pos` and needs to be decompressed.
+    if (new_pos - limit_pos() < uncompressed_length) break;
+    if (uncompressed_length > 0) AddSeekPoint(src, limit_pos());
+    if (ABSL_PREDICT_FALSE(
+            !src.Skip(sizeof(uint32_t) + Position{compressed_length}))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      truncated_ = true;
+      return false;
+    }
+    remaining_chunk_length_ -= IntCast<uint32_t>(uncompressed_length);
+    move_limit_pos(uncompressed_length);
+  }
+  if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+  if (limit_pos() == new_pos) return true;
+  return PullableReader::SeekSlow(new_pos);
+}
+
+bool HadoopSnappyReaderBase::PullBlocksInParallel(Reader& src) {
+  if (next_block_ == num_blocks_) {
+    if (ABSL_PREDICT_FALSE(!ReadBlocks(src))) return false;
+  }
+  const Block& block = blocks_[next_block_++];
+  if (ABSL_PREDICT_FALSE(block.error != nullptr)) {
+    // Blocks before an invalid block are returned first, as if they were
+    // decoded serially.
+    set_buffer();
+    num_blocks_ = 0;
+    next_block_ = 0;
+    return FailInvalidStream(block.error);
+  }
+  if (ABSL_PREDICT_FALSE(block.uncompressed_length >
+                         std::numeric_limits<Position>::max() - limit_pos())) {
+    set_buffer();
+    return FailOverflow();
+  }
+  set_buffer(block.uncompressed.data(), block.uncompressed_length);
+  move_limit_pos(available());
+  return true;
+}
+
+bool HadoopSnappyReaderBase::ReadBlocks(Reader& src) {
+  num_blocks_ = 0;
+  next_block_ = 0;
+  truncated_ = false;
+  const size_t max_blocks = IntCast<size_t>(parallelism_);
+  if (blocks_.size() < max_blocks) blocks_.resize(max_blocks);
+  Position uncompressed_pos = limit_pos();
+  // Problems found after some blocks were read are reported when reading blocks
+  // again, so that the blocks before them are returned first.
+  while (num_blocks_ < max_blocks) {
+    if (remaining_chunk_length_ == 0) {
+      if (ABSL_PREDICT_FALSE(!src.Pull(sizeof(uint32_t)))) {
+        if (num_blocks_ > 0) break;
+        set_buffer();
+        if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+        if (ABSL_PREDICT_FALSE(src.available() > 0)) truncated_ = true;
+        return false;
+      }
+      remaining_chunk_length_ = ReadBigEndian32(src.cursor());
+      src.move_cursor(sizeof(uint32_t));
+      continue;
+    }
+    AddSeekPoint(src, uncompressed_pos);
+    if (ABSL_PREDICT_FALSE(!src.Pull(sizeof(uint32_t)))) {
+      if (num_blocks_ > 0) break;
+      set_buffer();
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      truncated_ = true;
+      return false;
+    }
+    const uint32_t compressed_length = ReadBigEndian32(src.cursor());
+    if (ABSL_PREDICT_FALSE(compressed_length >
+                           std::numeric_limits<uint32_t>::max() -
+                               sizeof(uint32_t))) {
+      if (num_blocks_ > 0) break;
+      set_buffer();
+      return FailInvalidStream("compressed length too large");
+    }
+    if (ABSL_PREDICT_FALSE(!src.Pull(sizeof(uint32_t) + compressed_length))) {
+      if (num_blocks_ > 0) break;
+      set_buffer();
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      truncated_ = true;
+      return false;
+    }
+    const char* const compressed_data = src.cursor() + sizeof(uint32_t);
+    size_t uncompressed_length;
+    if (ABSL_PREDICT_FALSE(!snappy::GetUncompressedLength(
+            compressed_data, compressed_length, &uncompressed_length))) {
+      if (num_blocks_ > 0) break;
+      set_buffer();
+      return FailInvalidStream("invalid uncompressed length");
+    }
+    if (ABSL_PREDICT_FALSE(uncompressed_length > remaining_chunk_length_)) {
+      if (num_blocks_ > 0) break;
+      set_buffer();
+      return FailInvalidStream("uncompressed length too large");
+    }
+    if (uncompressed_length == 0) {
+      // An empty block is verified here rather than returned.
+      char empty;
+      if (ABSL_PREDICT_FALSE(!snappy::RawUncompress(
+              compressed_data, compressed_length, &empty))) {
+        if (num_blocks_ > 0) break;
+        set_buffer();
+        return FailInvalidStream("invalid compressed data");
+      }
+    } else {
+      Block& block = blocks_[num_blocks_++];
+      block.compressed_length = compressed_length;
+      block.compressed.Reset(compressed_length);
+      std::memcpy(block.compressed.data(), compressed_data, compressed_length);
+      block.uncompressed_length = uncompressed_length;
+      remaining_chunk_length_ -= IntCast<uint32_t>(uncompressed_length);
+      uncompressed_pos = SaturatingAdd(uncompressed_pos,
+                                       Position{uncompressed_length});
+    }
+    src.move_cursor(sizeof(uint32_t) + compressed_length);
+  }
+
+  std::atomic<size_t> next_block(0);
+  const auto decode_blocks = [&] {
+    for (;;) {
+      const size_t block = next_block.fetch_add(1);
+      if (block >= num_blocks_) return;
+      DecodeBlock(blocks_[block]);
+    }
+  };
+  const size_t num_tasks = UnsignedMin(max_blocks, num_blocks_);
+  absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&decode_blocks, &background_tasks] {
+      decode_blocks();
+      background_tasks.DecrementCount();
+    });
+  }
+  decode_blocks();
+  background_tasks.Wait();
+  return true;
+}
+
+void HadoopSnappyReaderBase::DecodeBlock(Block& block) {
+  block.error = nullptr;
+  block.uncompressed.Reset(block.uncompressed_length);
+  if (ABSL_PREDICT_FALSE(!snappy::RawUncompress(block.compressed.data(),
+                                                block.compressed_length,
+                                                block.uncompressed.data()))) {
+    block.error = "invalid compressed data";
+  }
+}
+
+void HadoopSnappyReaderBase::SkipBlocksReadAhead() {
+  while (next_block_ < num_blocks_) {
+    move_limit_pos(blocks_[next_block_++].uncompressed_length);
+  }
+  num_blocks_ = 0;
+  next_block_ = 0;
+}
+
+absl::optional<Position> HadoopSnappyReaderBase::Size() {
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  if (ABSL_PREDICT_FALSE(seek_points_.empty())) {
+    Fail(absl::UnimplementedError(
+        "HadoopSnappyReaderBase::Size() not supported"));
+    return absl::nullopt;
+  }
+  const Position pos_before = pos();
+  Seek(std::numeric_limits<Position>::max());
+  if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
+  const Position size = pos();
+  if (ABSL_PREDICT_FALSE(!Seek(pos_before))) return absl::nullopt;
+  return size;
+}
+
 }  // namespace riegeli
@@ -21,11 +21,14 @@
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/dependency.h"
 #include "riegeli/base/object.h"
@@ -37,7 +40,36 @@ namespace riegeli {
 // Template parameter independent part of `HadoopSnappyReader`.
 class HadoopSnappyReaderBase : public PullableReader {
  public:
-  class Options {};
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Sets the maximum number of blocks decompressed in parallel. The calling
+    // thread takes part in decompression.
+    //
+    // If greater than 1, up to `parallelism()` blocks are read ahead from the
+    // compressed `Reader` and decompressed together on the thread pool. This
+    // makes reading wait for more compressed data than is needed to return the
+    // next uncompressed data, so it is meant for bulk transfers rather than
+    // interactive streams.
+    //
+    // Default: 1.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "HadoopSnappyReaderBase::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
+   private:
+    int parallelism_ = 1;
+  };
 
   // Returns the compressed `Reader`. Unchanged by `Close()`.
   virtual Reader* src_reader() = 0;
@@ -50,25 +82,77 @@ class HadoopSnappyReaderBase : public PullableReader {
   using PullableReader::Fail;
   ABSL_ATTRIBUTE_COLD bool Fail(absl::Status status) override;
 
+  // Random access is supported if the compressed `Reader` supports it.
+  //
+  // Compressed blocks are decodable independently. Block headers visited while
+  // reading are remembered for seeking backwards, and seeking forwards skips
+  // whole blocks by their headers without decompressing them. `Size()` seeks
+  // to the end this way.
+  bool SupportsRandomAccess() override;
+  bool SupportsSize() override { return SupportsRandomAccess(); }
+  absl::optional<Position> Size() override;
+
  protected:
   explicit HadoopSnappyReaderBase(InitiallyClosed) noexcept
       : PullableReader(kInitiallyClosed) {}
-  explicit HadoopSnappyReaderBase(InitiallyOpen) noexcept
-      : PullableReader(kInitiallyOpen) {}
+  explicit HadoopSnappyReaderBase(InitiallyOpen, int parallelism = 1) noexcept
+      : PullableReader(kInitiallyOpen), parallelism_(parallelism) {}
 
   HadoopSnappyReaderBase(HadoopSnappyReaderBase&& that) noexcept;
   HadoopSnappyReaderBase& operator=(HadoopSnappyReaderBase&& that) noexcept;
 
   void Reset(InitiallyClosed);
-  void Reset(InitiallyOpen);
+  void Reset(InitiallyOpen, int parallelism = 1);
   void Initialize(Reader* src);
 
   void Done() override;
   bool PullSlow(size_t min_length, size_t recommended_length) override;
+  bool SeekSlow(Position new_pos) override;
 
  private:
+  // A position where decoding can begin: the beginning of a chunk or of a
+  // compressed block inside a chunk.
+  struct SeekPoint {
+    Position compressed_pos;
+    Position uncompressed_pos;
+    // `remaining_chunk_length_` at this position.
+    uint32_t remaining_chunk_length;
+  };
+
+  // A non-empty block read ahead if `parallelism_ > 1`.
+  struct Block {
+    Buffer compressed;
+    size_t compressed_length = 0;
+    Buffer uncompressed;
+    size_t uncompressed_length = 0;
+    // Set by `DecodeBlock()` if the block is invalid.
+    const char* error = nullptr;
+  };
+
   ABSL_ATTRIBUTE_COLD bool FailInvalidStream(absl::string_view message);
 
+  // Remembers that decoding can begin at `src.pos()`, corresponding to
+  // `uncompressed_pos`, if `src` supports random access.
+  void AddSeekPoint(Reader& src, Position uncompressed_pos);
+
+  // Implements `PullSlow()` if `parallelism_ > 1`.
+  bool PullBlocksInParallel(Reader& src);
+
+  // Reads up to `parallelism_` non-empty blocks to `blocks_` and decompresses
+  // them in parallel.
+  //
+  // Return values:
+  //  * `true`  - success (`num_blocks_ > 0`)
+  //  * `false` - end of source or failure
+  bool ReadBlocks(Reader& src);
+
+  // Decompresses `block`, setting `block.error` if it is invalid.
+  static void DecodeBlock(Block& block);
+
+  // Moves `limit_pos()` over all blocks read ahead and not returned yet, and
+  // discards them, so that `limit_pos()` corresponds to `src_reader()->pos()`.
+  void SkipBlocksReadAhead();
+
   // If `true`, the source is truncated (without a clean end of the compressed
   // stream) at the current position. If the source does not grow, `Close()`
   // will fail.
@@ -77,9 +161,20 @@ class HadoopSnappyReaderBase : public PullableReader {
   uint32_t remaining_chunk_length_ = 0;
   // Buffered uncompressed data.
   Buffer uncompressed_;
+  // Block beginnings found so far, sorted and distinct, beginning with the
+  // initial position. Filled only if `src_reader()->SupportsRandomAccess()`.
+  std::vector<SeekPoint> seek_points_;
+  int parallelism_ = 1;
+  // Blocks read ahead, with `blocks_[next_block_..num_blocks_)` not returned
+  // yet. Only the first `num_blocks_` entries are meaningful, the rest keep
+  // their buffers for reuse.
+  std::vector<Block> blocks_;
+  size_t num_blocks_ = 0;
+  size_t next_block_ = 0;
 
   // Invariant if scratch is not used:
-  //   `start() == nullptr` or `start() == uncompressed_.data()`
+  //   `start() == nullptr` or `start() == uncompressed_.data()` or `start()`
+  //   points to `blocks_`
 };
 
 // A `Reader` which decompresses data with Hadoop Snappy format after getting
@@ -169,7 +264,12 @@ inline HadoopSnappyReaderBase::HadoopSnappyReaderBase(
       // part was moved.
       truncated_(that.truncated_),
       remaining_chunk_length_(that.remaining_chunk_length_),
-      uncompressed_(std::move(that.uncompressed_)) {}
+      uncompressed_(std::move(that.uncompressed_)),
+      seek_points_(std::move(that.seek_points_)),
+      parallelism_(that.parallelism_),
+      blocks_(std::move(that.blocks_)),
+      num_blocks_(std::exchange(that.num_blocks_, 0)),
+      next_block_(std::exchange(that.next_block_, 0)) {}
 
 inline HadoopSnappyReaderBase& HadoopSnappyReaderBase::operator=(
     HadoopSnappyReaderBase&& that) noexcept {
@@ -179,6 +279,11 @@ inline HadoopSnappyReaderBase& HadoopSnappyReaderBase::operator=(
   truncated_ = that.truncated_;
   remaining_chunk_length_ = that.remaining_chunk_length_;
   uncompressed_ = std::move(that.uncompressed_);
+  seek_points_ = std::move(that.seek_points_);
+  parallelism_ = that.parallelism_;
+  blocks_ = std::move(that.blocks_);
+  num_blocks_ = std::exchange(that.num_blocks_, 0);
+  next_block_ = std::exchange(that.next_block_, 0);
   return *this;
 }
 
@@ -186,24 +291,33 @@ inline void HadoopSnappyReaderBase::Reset(InitiallyClosed) {
   PullableReader::Reset(kInitiallyClosed);
   truncated_ = false;
   remaining_chunk_length_ = 0;
+  seek_points_.clear();
+  parallelism_ = 1;
+  num_blocks_ = 0;
+  next_block_ = 0;
 }
 
-inline void HadoopSnappyReaderBase::Reset(InitiallyOpen) {
+inline void HadoopSnappyReaderBase::Reset(InitiallyOpen, int parallelism) {
   PullableReader::Reset(kInitiallyOpen);
   truncated_ = false;
   remaining_chunk_length_ = 0;
+  seek_points_.clear();
+  parallelism_ = parallelism;
+  num_blocks_ = 0;
+  next_block_ = 0;
 }
 
 template <typename Src>
 inline HadoopSnappyReader<Src>::HadoopSnappyReader(const Src& src,
                                                    Options options)
-    : HadoopSnappyReaderBase(kInitiallyOpen), src_(src) {
+    : HadoopSnappyReaderBase(kInitiallyOpen, options.parallelism()), src_(src) {
   Initialize(src_.get());
 }
 
 template <typename Src>
 inline HadoopSnappyReader<Src>::HadoopSnappyReader(Src&& src, Options options)
-    : HadoopSnappyReaderBase(kInitiallyOpen), src_(std::move(src)) {
+    : HadoopSnappyReaderBase(kInitiallyOpen, options.parallelism()),
+      src_(std::move(src)) {
   Initialize(src_.get());
 }
 
@@ -211,7 +325,8 @@ template <typename Src>
 template <typename... SrcArgs>
 inline HadoopSnappyReader<Src>::HadoopSnappyReader(
     std::tuple<SrcArgs...> src_args, Options options)
-    : HadoopSnappyReaderBase(kInitiallyOpen), src_(std::move(src_args)) {
+    : HadoopSnappyReaderBase(kInitiallyOpen, options.parallelism()),
+      src_(std::move(src_args)) {
   Initialize(src_.get());
 }
 
@@ -242,14 +357,14 @@ inline void HadoopSnappyReader<Src>::Reset() {
 
 template <typename Src>
 inline void HadoopSnappyReader<Src>::Reset(const Src& src, Options options) {
-  HadoopSnappyReaderBase::Reset(kInitiallyOpen);
+  HadoopSnappyReaderBase::Reset(kInitiallyOpen, options.parallelism());
   src_.Reset(src);
   Initialize(src_.get());
 }
 
 template <typename Src>
 inline void HadoopSnappyReader<Src>::Reset(Src&& src, Options options) {
-  HadoopSnappyReaderBase::Reset(kInitiallyOpen);
+  HadoopSnappyReaderBase::Reset(kInitiallyOpen, options.parallelism());
   src_.Reset(std::move(src));
   Initialize(src_.get());
 }
@@ -258,7 +373,7 @@ template <typename Src>
 template <typename... SrcArgs>
 inline void HadoopSnappyReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
                                            Options options) {
-  HadoopSnappyReaderBase::Reset(kInitiallyOpen);
+  HadoopSnappyReaderBase::Reset(kInitiallyOpen, options.parallelism());
   src_.Reset(std::move(src_args));
   Initialize(src_.get());
 }
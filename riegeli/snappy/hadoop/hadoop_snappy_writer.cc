@@ -17,14 +17,19 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <limits>
 #include <string>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/pushable_writer.h"
 #include "riegeli/bytes/writer.h"
@@ -33,6 +38,25 @@
 
 namespace riegeli {
 
+namespace {
+
+// Writes a block with `uncompressed_data[0..uncompressed_length)` to `dest`,
+// which must have space for `2 * sizeof(uint32_t) +
+// snappy::MaxCompressedLength(uncompressed_length)` bytes. Returns the length
+// of the block.
+size_t WriteBlock(const char* uncompressed_data, size_t uncompressed_length,
+                  char* dest) {
+  WriteBigEndian32(IntCast<uint32_t>(uncompressed_length), dest);
+  size_t compressed_length;
+  snappy::RawCompress(uncompressed_data, uncompressed_length,
+                      dest + 2 * sizeof(uint32_t), &compressed_length);
+  WriteBigEndian32(IntCast<uint32_t>(compressed_length),
+                   dest + sizeof(uint32_t));
+  return 2 * sizeof(uint32_t) + compressed_length;
+}
+
+}  // namespace
+
 void HadoopSnappyWriterBase::Initialize(Writer* dest) {
   RIEGELI_ASSERT(dest != nullptr)
       << "Failed precondition of HadoopSnappyWriter: null Writer pointer";
@@ -70,9 +94,10 @@ bool HadoopSnappyWriterBase::PushSlow(size_t min_length,
   if (ABSL_PREDICT_FALSE(start_pos() == std::numeric_limits<Position>::max())) {
     return FailOverflow();
   }
-  const size_t length =
-      UnsignedMin(BufferLength(1, snappy::kBlockSize, size_hint_, start_pos()),
-                  std::numeric_limits<Position>::max() - start_pos());
+  const size_t length = UnsignedMin(
+      BufferLength(1, IntCast<size_t>(parallelism_) * snappy::kBlockSize,
+                   size_hint_, start_pos()),
+      std::numeric_limits<Position>::max() - start_pos());
   uncompressed_.Reset(length);
   set_buffer(uncompressed_.data(), length);
   return true;
@@ -80,25 +105,66 @@ bool HadoopSnappyWriterBase::PushSlow(size_t min_length,
 
 inline bool HadoopSnappyWriterBase::PushInternal(Writer& dest) {
   const size_t uncompressed_length = written_to_buffer();
-  RIEGELI_ASSERT_LE(uncompressed_length, snappy::kBlockSize)
+  RIEGELI_ASSERT_LE(uncompressed_length,
+                    IntCast<size_t>(parallelism_) * snappy::kBlockSize)
       << "Failed invariant of HadoopSnappyWriterBase: buffer too large";
   if (uncompressed_length == 0) return true;
   set_cursor(start());
   const char* const uncompressed_data = cursor();
+  if (uncompressed_length > snappy::kBlockSize) {
+    return PushBlocksInParallel(dest, uncompressed_data, uncompressed_length);
+  }
   if (ABSL_PREDICT_FALSE(
           !dest.Push(2 * sizeof(uint32_t) +
                      snappy::MaxCompressedLength(uncompressed_length)))) {
     return Fail(dest);
   }
-  char* const compressed_chunk = dest.cursor();
-  WriteBigEndian32(IntCast<uint32_t>(uncompressed_length), compressed_chunk);
-  size_t compressed_length;
-  snappy::RawCompress(uncompressed_data, uncompressed_length,
-                      compressed_chunk + 2 * sizeof(uint32_t),
-                      &compressed_length);
-  WriteBigEndian32(IntCast<uint32_t>(compressed_length),
-                   compressed_chunk + sizeof(uint32_t));
-  dest.move_cursor(2 * sizeof(uint32_t) + compressed_length);
+  dest.move_cursor(
+      WriteBlock(uncompressed_data, uncompressed_length, dest.cursor()));
+  move_start_pos(uncompressed_length);
+  return true;
+}
+
+bool HadoopSnappyWriterBase::PushBlocksInParallel(Writer& dest,
+                                                  const char* uncompressed_data,
+                                                  size_t uncompressed_length) {
+  const size_t num_blocks =
+      (uncompressed_length + snappy::kBlockSize - 1) / snappy::kBlockSize;
+  const size_t max_block_length =
+      2 * sizeof(uint32_t) + snappy::MaxCompressedLength(snappy::kBlockSize);
+  compressed_.Reset(num_blocks * max_block_length);
+  std::vector<size_t> block_lengths(num_blocks);
+  std::atomic<size_t> next_block(0);
+  const auto compress_blocks = [&] {
+    for (;;) {
+      const size_t block = next_block.fetch_add(1);
+      if (block >= num_blocks) return;
+      const size_t block_begin = block * snappy::kBlockSize;
+      block_lengths[block] = WriteBlock(
+          uncompressed_data + block_begin,
+          UnsignedMin(uncompressed_length - block_begin, snappy::kBlockSize),
+          compressed_.data() + block * max_block_length);
+    }
+  };
+  const size_t num_tasks =
+      UnsignedMin(IntCast<size_t>(parallelism_), num_blocks);
+  absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&compress_blocks, &background_tasks] {
+      compress_blocks();
+      background_tasks.DecrementCount();
+    });
+  }
+  compress_blocks();
+  background_tasks.Wait();
+
+  for (size_t block = 0; block < num_blocks; ++block) {
+    if (ABSL_PREDICT_FALSE(!dest.Write(absl::string_view(
+            compressed_.data() + block * max_block_length,
+            block_lengths[block])))) {
+      return Fail(dest);
+    }
+  }
   move_start_pos(uncompressed_length);
   return true;
 }
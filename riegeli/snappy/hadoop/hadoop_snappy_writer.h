@@ -56,8 +56,31 @@ class HadoopSnappyWriterBase : public PushableWriter {
     }
     absl::optional<Position> size_hint() const { return size_hint_; }
 
+    // Sets the maximum number of blocks compressed in parallel. The calling
+    // thread takes part in compression.
+    //
+    // If greater than 1, up to `parallelism()` blocks of 64KB are buffered and
+    // compressed together on the thread pool, and written in order. This
+    // increases the amount of data held before it reaches the compressed
+    // `Writer`, until `Flush()`.
+    //
+    // Default: 1.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "HadoopSnappyWriterBase::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
    private:
     absl::optional<Position> size_hint_;
+    int parallelism_ = 1;
   };
 
   // Returns the compressed `Writer`. Unchanged by `Close()`.
@@ -74,13 +97,14 @@ class HadoopSnappyWriterBase : public PushableWriter {
  protected:
   HadoopSnappyWriterBase() noexcept : PushableWriter(kInitiallyClosed) {}
 
-  explicit HadoopSnappyWriterBase(absl::optional<Position> size_hint);
+  explicit HadoopSnappyWriterBase(absl::optional<Position> size_hint,
+                                  int parallelism);
 
   HadoopSnappyWriterBase(HadoopSnappyWriterBase&& that) noexcept;
   HadoopSnappyWriterBase& operator=(HadoopSnappyWriterBase&& that) noexcept;
 
   void Reset();
-  void Reset(absl::optional<Position> size_hint);
+  void Reset(absl::optional<Position> size_hint, int parallelism);
   void Initialize(Writer* dest);
 
   void Done() override;
@@ -96,13 +120,23 @@ class HadoopSnappyWriterBase : public PushableWriter {
   // Postcondition: `written_to_buffer() == 0`
   bool PushInternal(Writer& dest);
 
+  // Compresses buffered data spanning more than one block, compressing blocks
+  // in parallel.
+  //
+  // Precondition: `healthy()`
+  bool PushBlocksInParallel(Writer& dest, const char* uncompressed_data,
+                            size_t uncompressed_length);
+
   Position size_hint_ = 0;
+  int parallelism_ = 1;
   // Buffered uncompressed data.
   Buffer uncompressed_;
+  // Compressed blocks, used if `parallelism_ > 1`.
+  Buffer compressed_;
 
   // Invariants if scratch is not used:
   //   `start() == nullptr` or `start() == uncompressed_.data()`
-  //   `buffer_size() <= snappy::kBlockSize`
+  //   `buffer_size() <= parallelism_ * snappy::kBlockSize`
 };
 
 // A `Writer` which compresses data with Hadoop Snappy format before passing it
@@ -186,8 +220,10 @@ explicit HadoopSnappyWriter(
 // Implementation details follow.
 
 inline HadoopSnappyWriterBase::HadoopSnappyWriterBase(
-    absl::optional<Position> size_hint)
-    : PushableWriter(kInitiallyOpen), size_hint_(size_hint.value_or(0)) {}
+    absl::optional<Position> size_hint, int parallelism)
+    : PushableWriter(kInitiallyOpen),
+      size_hint_(size_hint.value_or(0)),
+      parallelism_(parallelism) {}
 
 inline HadoopSnappyWriterBase::HadoopSnappyWriterBase(
     HadoopSnappyWriterBase&& that) noexcept
@@ -195,7 +231,9 @@ inline HadoopSnappyWriterBase::HadoopSnappyWriterBase(
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
       size_hint_(that.size_hint_),
-      uncompressed_(std::move(that.uncompressed_)) {}
+      parallelism_(that.parallelism_),
+      uncompressed_(std::move(that.uncompressed_)),
+      compressed_(std::move(that.compressed_)) {}
 
 inline HadoopSnappyWriterBase& HadoopSnappyWriterBase::operator=(
     HadoopSnappyWriterBase&& that) noexcept {
@@ -203,31 +241,38 @@ inline HadoopSnappyWriterBase& HadoopSnappyWriterBase::operator=(
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
   size_hint_ = that.size_hint_;
+  parallelism_ = that.parallelism_;
   uncompressed_ = std::move(that.uncompressed_);
+  compressed_ = std::move(that.compressed_);
   return *this;
 }
 
 inline void HadoopSnappyWriterBase::Reset() {
   PushableWriter::Reset(kInitiallyClosed);
   size_hint_ = 0;
+  parallelism_ = 1;
 }
 
-inline void HadoopSnappyWriterBase::Reset(absl::optional<Position> size_hint) {
+inline void HadoopSnappyWriterBase::Reset(absl::optional<Position> size_hint,
+                                          int parallelism) {
   PushableWriter::Reset(kInitiallyOpen);
   size_hint_ = size_hint.value_or(0);
+  parallelism_ = parallelism;
 }
 
 template <typename Dest>
 inline HadoopSnappyWriter<Dest>::HadoopSnappyWriter(const Dest& dest,
                                                     Options options)
-    : HadoopSnappyWriterBase(options.size_hint()), dest_(dest) {
+    : HadoopSnappyWriterBase(options.size_hint(), options.parallelism()),
+      dest_(dest) {
   Initialize(dest_.get());
 }
 
 template <typename Dest>
 inline HadoopSnappyWriter<Dest>::HadoopSnappyWriter(Dest&& dest,
                                                     Options options)
-    : HadoopSnappyWriterBase(options.size_hint()), dest_(std::move(dest)) {
+    : HadoopSnappyWriterBase(options.size_hint(), options.parallelism()),
+      dest_(std::move(dest)) {
   Initialize(dest_.get());
 }
 
@@ -235,7 +280,8 @@ template <typename Dest>
 template <typename... DestArgs>
 inline HadoopSnappyWriter<Dest>::HadoopSnappyWriter(
     std::tuple<DestArgs...> dest_args, Options options)
-    : HadoopSnappyWriterBase(options.size_hint()), dest_(std::move(dest_args)) {
+    : HadoopSnappyWriterBase(options.size_hint(), options.parallelism()),
+      dest_(std::move(dest_args)) {
   Initialize(dest_.get());
 }
 
@@ -265,14 +311,14 @@ inline void HadoopSnappyWriter<Dest>::Reset() {
 
 template <typename Dest>
 inline void HadoopSnappyWriter<Dest>::Reset(const Dest& dest, Options options) {
-  HadoopSnappyWriterBase::Reset(options.size_hint());
+  HadoopSnappyWriterBase::Reset(options.size_hint(), options.parallelism());
   dest_.Reset(dest);
   Initialize(dest_.get());
 }
 
 template <typename Dest>
 inline void HadoopSnappyWriter<Dest>::Reset(Dest&& dest, Options options) {
-  HadoopSnappyWriterBase::Reset(options.size_hint());
+  HadoopSnappyWriterBase::Reset(options.size_hint(), options.parallelism());
   dest_.Reset(std::move(dest));
   Initialize(dest_.get());
 }
@@ -281,7 +327,7 @@ template <typename Dest>
 template <typename... DestArgs>
 inline void HadoopSnappyWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
                                             Options options) {
-  HadoopSnappyWriterBase::Reset(options.size_hint());
+  HadoopSnappyWriterBase::Reset(options.size_hint(), options.parallelism());
   dest_.Reset(std::move(dest_args));
   Initialize(dest_.get());
 }
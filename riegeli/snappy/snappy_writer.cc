@@ -15,25 +15,32 @@
 #include "riegeli/snappy/snappy_writer.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <atomic>
 #include <cstring>
 #include <limits>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/chain_reader.h"
+#include "riegeli/bytes/chain_writer.h"
 #include "riegeli/bytes/reader.h"
 #include "riegeli/bytes/writer.h"
 #include "riegeli/snappy/snappy_streams.h"
+#include "riegeli/varint/varint_writing.h"
 #include "snappy.h"
 
 namespace riegeli {
@@ -42,6 +49,7 @@ namespace riegeli {
 // namespace scope is required. Since C++17 these definitions are deprecated:
 // http://en.cppreference.com/w/cpp/language/static
 #if __cplusplus < 201703
+constexpr size_t SnappyWriterBase::Options::kSubBlockSize;
 constexpr size_t SnappyWriterBase::kBlockSize;
 #endif
 
@@ -50,8 +58,18 @@ void SnappyWriterBase::Done() {
   Writer::Done();
   if (ABSL_PREDICT_TRUE(healthy())) {
     Writer& dest = *dest_writer();
+    if (ABSL_PREDICT_FALSE(uncompressed_.size() >
+                           std::numeric_limits<uint32_t>::max())) {
+      // The Snappy format stores the uncompressed size as 32 bits.
+      Fail(absl::ResourceExhaustedError(
+          "Snappy can compress at most 4GB in one stream"));
+      return;
+    }
     {
-      absl::Status status = SnappyCompress(ChainReader<>(&uncompressed_), dest);
+      absl::Status status =
+          parallelism_ > 1 && uncompressed_.size() > Options::kSubBlockSize
+              ? CompressInParallel(dest)
+              : SnappyCompress(ChainReader<>(&uncompressed_), dest);
       if (ABSL_PREDICT_FALSE(!status.ok())) {
         Fail(std::move(status));
       }
@@ -59,6 +77,69 @@ void SnappyWriterBase::Done() {
   }
 }
 
+absl::Status SnappyWriterBase::CompressInParallel(Writer& dest) {
+  // Each sub-block is compressed as a separate Snappy stream. The compressor
+  // splits its input into 64KB fragments and compresses each fragment
+  // independently, and sub-blocks are a multiple of 64KB, so concatenating
+  // streams without their uncompressed size prefixes and prepending the total
+  // size gives exactly the stream which compressing everything at once would.
+  static_assert(Options::kSubBlockSize % kBlockSize == 0,
+                "sub-blocks must consist of whole Snappy fragments");
+  std::vector<Chain> sub_blocks;
+  sub_blocks.reserve((uncompressed_.size() + Options::kSubBlockSize - 1) /
+                     Options::kSubBlockSize);
+  {
+    ChainReader<> src(&uncompressed_);
+    while (src.pos() < uncompressed_.size()) {
+      sub_blocks.emplace_back();
+      src.Read(UnsignedMin(IntCast<size_t>(uncompressed_.size() - src.pos()),
+                           Options::kSubBlockSize),
+               sub_blocks.back());
+    }
+  }
+  std::vector<Chain> compressed(sub_blocks.size());
+  std::vector<absl::Status> statuses(sub_blocks.size());
+  std::atomic<size_t> next_sub_block(0);
+  const auto compress_sub_blocks = [&] {
+    for (;;) {
+      const size_t sub_block = next_sub_block.fetch_add(1);
+      if (sub_block >= sub_blocks.size()) return;
+      const size_t size = sub_blocks[sub_block].size();
+      statuses[sub_block] =
+          SnappyCompress(ChainReader<>(&sub_blocks[sub_block]),
+                         ChainWriter<>(&compressed[sub_block]));
+      if (ABSL_PREDICT_TRUE(statuses[sub_block].ok())) {
+        compressed[sub_block].RemovePrefix(LengthVarint64(size));
+      }
+    }
+  };
+  const size_t num_tasks =
+      UnsignedMin(IntCast<size_t>(parallelism_), sub_blocks.size());
+  absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&compress_sub_blocks, &background_tasks] {
+      compress_sub_blocks();
+      background_tasks.DecrementCount();
+    });
+  }
+  compress_sub_blocks();
+  background_tasks.Wait();
+
+  for (const absl::Status& status : statuses) {
+    if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  }
+  if (ABSL_PREDICT_FALSE(
+          !WriteVarint64(IntCast<uint64_t>(uncompressed_.size()), dest))) {
+    return dest.status();
+  }
+  for (Chain& sub_block : compressed) {
+    if (ABSL_PREDICT_FALSE(!dest.Write(std::move(sub_block)))) {
+      return dest.status();
+    }
+  }
+  return absl::OkStatus();
+}
+
 bool SnappyWriterBase::Fail(absl::Status status) {
   RIEGELI_ASSERT(!status.ok())
       << "Failed precondition of Object::Fail(): status not failed";
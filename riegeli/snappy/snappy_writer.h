@@ -57,8 +57,32 @@ class SnappyWriterBase : public Writer {
     }
     absl::optional<Position> size_hint() const { return size_hint_; }
 
+    // Sets the maximum number of sub-blocks compressed in parallel in
+    // `Close()`. The calling thread takes part in compression.
+    //
+    // Data are split into sub-blocks of `kSubBlockSize` (1MB), compressed
+    // independently on the thread pool, and joined. Snappy compresses 64KB
+    // fragments independently, so the result is the same as with
+    // `parallelism() == 1`, and readers need no changes.
+    //
+    // Default: 1.
+    static constexpr size_t kSubBlockSize = size_t{1} << 20;
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "SnappyWriterBase::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
    private:
     absl::optional<Position> size_hint_;
+    int parallelism_ = 1;
   };
 
   // Returns the compressed `Writer`. Unchanged by `Close()`.
@@ -75,13 +99,14 @@ class SnappyWriterBase : public Writer {
  protected:
   SnappyWriterBase() noexcept : Writer(kInitiallyClosed) {}
 
-  explicit SnappyWriterBase(absl::optional<Position> size_hint);
+  explicit SnappyWriterBase(absl::optional<Position> size_hint,
+                            int parallelism);
 
   SnappyWriterBase(SnappyWriterBase&& that) noexcept;
   SnappyWriterBase& operator=(SnappyWriterBase&& that) noexcept;
 
   void Reset();
-  void Reset(absl::optional<Position> size_hint);
+  void Reset(absl::optional<Position> size_hint, int parallelism);
   void Initialize(Writer* dest);
 
   void Done() override;
@@ -99,6 +124,10 @@ class SnappyWriterBase : public Writer {
 
   void MoveUncompressed(SnappyWriterBase&& that);
 
+  // Compresses `uncompressed_` to `dest` in sub-blocks of
+  // `Options::kSubBlockSize`, up to `parallelism_` at a time.
+  absl::Status CompressInParallel(Writer& dest);
+
   // Prefer sharing instead of copying data at least of this length.
   size_t MinBytesToShare() const;
 
@@ -107,6 +136,7 @@ class SnappyWriterBase : public Writer {
   void SyncBuffer();
 
   Chain::Options options_;
+  int parallelism_ = 1;
 
   // `Writer` methods are similar to `ChainWriter` methods writing to
   // `uncompressed_`.
@@ -133,7 +163,8 @@ class SnappyWriterBase : public Writer {
 // closed or no longer used.
 //
 // `SnappyWriter` does not compress incrementally but buffers uncompressed data
-// and compresses them all in `Close()`.
+// and compresses them all in `Close()`, possibly in parallel
+// (`SnappyWriterBase::Options::set_parallelism()`).
 //
 // `Flush()` does nothing. It does not make data written so far visible.
 template <typename Dest = Writer*>
@@ -284,19 +315,22 @@ size_t SnappyMaxCompressedSize(size_t uncompressed_size);
 
 // Implementation details follow.
 
-inline SnappyWriterBase::SnappyWriterBase(absl::optional<Position> size_hint)
+inline SnappyWriterBase::SnappyWriterBase(absl::optional<Position> size_hint,
+                                          int parallelism)
     : Writer(kInitiallyOpen),
       options_(
           Chain::Options()
               .set_size_hint(SaturatingIntCast<size_t>(size_hint.value_or(0)))
               .set_min_block_size(kBlockSize)
-              .set_max_block_size(kBlockSize)) {}
+              .set_max_block_size(kBlockSize)),
+      parallelism_(parallelism) {}
 
 inline SnappyWriterBase::SnappyWriterBase(SnappyWriterBase&& that) noexcept
     : Writer(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
-      options_(that.options_) {
+      options_(that.options_),
+      parallelism_(that.parallelism_) {
   MoveUncompressed(std::move(that));
 }
 
@@ -306,6 +340,7 @@ inline SnappyWriterBase& SnappyWriterBase::operator=(
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
   options_ = that.options_;
+  parallelism_ = that.parallelism_;
   MoveUncompressed(std::move(that));
   return *this;
 }
@@ -313,16 +348,19 @@ inline SnappyWriterBase& SnappyWriterBase::operator=(
 inline void SnappyWriterBase::Reset() {
   Writer::Reset(kInitiallyClosed);
   options_ = Chain::Options();
+  parallelism_ = 1;
   uncompressed_.Clear();
 }
 
-inline void SnappyWriterBase::Reset(absl::optional<Position> size_hint) {
+inline void SnappyWriterBase::Reset(absl::optional<Position> size_hint,
+                                    int parallelism) {
   Writer::Reset(kInitiallyOpen);
   options_ =
       Chain::Options()
           .set_size_hint(SaturatingIntCast<size_t>(size_hint.value_or(0)))
           .set_min_block_size(kBlockSize)
           .set_max_block_size(kBlockSize);
+  parallelism_ = parallelism;
   uncompressed_.Clear();
 }
 
@@ -347,13 +385,15 @@ inline void SnappyWriterBase::MoveUncompressed(SnappyWriterBase&& that) {
 
 template <typename Dest>
 inline SnappyWriter<Dest>::SnappyWriter(const Dest& dest, Options options)
-    : SnappyWriterBase(options.size_hint()), dest_(dest) {
+    : SnappyWriterBase(options.size_hint(), options.parallelism()),
+      dest_(dest) {
   Initialize(dest_.get());
 }
 
 template <typename Dest>
 inline SnappyWriter<Dest>::SnappyWriter(Dest&& dest, Options options)
-    : SnappyWriterBase(options.size_hint()), dest_(std::move(dest)) {
+    : SnappyWriterBase(options.size_hint(), options.parallelism()),
+      dest_(std::move(dest)) {
   Initialize(dest_.get());
 }
 
@@ -361,7 +401,8 @@ template <typename Dest>
 template <typename... DestArgs>
 inline SnappyWriter<Dest>::SnappyWriter(std::tuple<DestArgs...> dest_args,
                                         Options options)
-    : SnappyWriterBase(options.size_hint()), dest_(std::move(dest_args)) {
+    : SnappyWriterBase(options.size_hint(), options.parallelism()),
+      dest_(std::move(dest_args)) {
   Initialize(dest_.get());
 }
 
@@ -390,14 +431,14 @@ inline void SnappyWriter<Dest>::Reset() {
 
 template <typename Dest>
 inline void SnappyWriter<Dest>::Reset(const Dest& dest, Options options) {
-  SnappyWriterBase::Reset(options.size_hint());
+  SnappyWriterBase::Reset(options.size_hint(), options.parallelism());
   dest_.Reset(dest);
   Initialize(dest_.get());
 }
 
 template <typename Dest>
 inline void SnappyWriter<Dest>::Reset(Dest&& dest, Options options) {
-  SnappyWriterBase::Reset(options.size_hint());
+  SnappyWriterBase::Reset(options.size_hint(), options.parallelism());
   dest_.Reset(std::move(dest));
   Initialize(dest_.get());
 }
@@ -406,7 +447,7 @@ template <typename Dest>
 template <typename... DestArgs>
 inline void SnappyWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
                                       Options options) {
-  SnappyWriterBase::Reset(options.size_hint());
+  SnappyWriterBase::Reset(options.size_hint(), options.parallelism());
   dest_.Reset(std::move(dest_args));
   Initialize(dest_.get());
 }
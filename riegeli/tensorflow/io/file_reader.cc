@@ -21,6 +21,7 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
@@ -28,10 +29,13 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/synchronization/blocking_counter.h"
+#include "absl/synchronization/notification.h"
 #include "absl/types/span.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/backward_writer.h"
 #include "riegeli/bytes/reader.h"
@@ -45,6 +49,19 @@
 namespace riegeli {
 namespace tensorflow {
 
+struct FileReaderBase::PendingRead {
+  // The position of the first byte of `result` not consumed yet.
+  Position pos;
+  // The length of `result` consumed so far.
+  size_t consumed = 0;
+  // `buffer`, `result`, and `status` are set in a background thread, and
+  // can be accessed after `done` is notified.
+  Buffer buffer;
+  absl::string_view result;
+  ::tensorflow::Status status;
+  absl::Notification done;
+};
+
 bool FileReaderBase::InitializeFilename(::tensorflow::RandomAccessFile* src,
                                         ::tensorflow::Env* env) {
   absl::string_view filename;
@@ -112,6 +129,18 @@ bool FileReaderBase::FailOperation(const ::tensorflow::Status& status,
                absl::StrCat(operation, " failed")));
 }
 
+void FileReaderBase::Done() {
+  DoneBackground();
+  Reader::Done();
+}
+
+void FileReaderBase::DoneBackground() {
+  for (const std::shared_ptr<PendingRead>& pending_read : pending_reads_) {
+    pending_read->done.WaitForNotification();
+  }
+  pending_reads_.clear();
+}
+
 bool FileReaderBase::Fail(absl::Status status) {
   RIEGELI_ASSERT(!status.ok())
       << "Failed precondition of Object::Fail(): status not failed";
@@ -443,8 +472,8 @@ inline bool FileReaderBase::ReadToDest(size_t length,
     return FailOverflow();
   }
   absl::string_view result;
-  const ::tensorflow::Status status = src->Read(
-      IntCast<::tensorflow::uint64>(limit_pos()), length, &result, dest);
+  const ::tensorflow::Status status =
+      ReadFromFile(src, limit_pos(), length, &result, dest);
   RIEGELI_ASSERT_LE(result.size(), length)
       << "RandomAccessFile::Read() read more than requested";
   if (result.data() != dest) std::memcpy(dest, result.data(), result.size());
@@ -474,9 +503,8 @@ inline bool FileReaderBase::ReadToBuffer(size_t cursor_index,
     return FailOverflow();
   }
   absl::string_view result;
-  const ::tensorflow::Status status =
-      src->Read(IntCast<::tensorflow::uint64>(limit_pos()), flat_buffer.size(),
-                &result, flat_buffer.data());
+  const ::tensorflow::Status status = ReadFromFile(
+      src, limit_pos(), flat_buffer.size(), &result, flat_buffer.data());
   RIEGELI_ASSERT_LE(result.size(), flat_buffer.size())
       << "RandomAccessFile::Read() read more than requested";
   if (result.data() == flat_buffer.data()) {
@@ -502,6 +530,151 @@ inline bool FileReaderBase::ReadToBuffer(size_t cursor_index,
   return true;
 }
 
+::tensorflow::Status FileReaderBase::ReadFromFile(
+    ::tensorflow::RandomAccessFile* src, Position pos, size_t length,
+    absl::string_view* result, char* scratch) {
+  if (read_ahead_ == 0) {
+    return src->Read(IntCast<::tensorflow::uint64>(pos), length, result,
+                     scratch);
+  }
+  if (pending_reads_.empty() || pending_reads_.front()->pos != pos) {
+    // Reads ahead, if any, are not useful for this position.
+    DoneBackground();
+    read_ahead_pos_ = pos;
+  }
+  size_t length_read = 0;
+  ::tensorflow::Status status;
+  while (length_read < length) {
+    ScheduleReadsAhead(src);
+    if (ABSL_PREDICT_FALSE(pending_reads_.empty())) {
+      // Reads ahead would overflow the position. Read the rest directly.
+      absl::string_view rest;
+      status = src->Read(IntCast<::tensorflow::uint64>(pos + length_read),
+                         length - length_read, &rest, scratch + length_read);
+      if (rest.data() != scratch + length_read) {
+        std::memcpy(scratch + length_read, rest.data(), rest.size());
+      }
+      length_read += rest.size();
+      break;
+    }
+    PendingRead& pending_read = *pending_reads_.front();
+    pending_read.done.WaitForNotification();
+    const size_t length_to_copy =
+        UnsignedMin(pending_read.result.size() - pending_read.consumed,
+                    length - length_read);
+    if (
+        // `std::memcpy(_, nullptr, 0)` is undefined.
+        length_to_copy > 0) {
+      std::memcpy(scratch + length_read,
+                  pending_read.result.data() + pending_read.consumed,
+                  length_to_copy);
+      length_read += length_to_copy;
+      pending_read.consumed += length_to_copy;
+      pending_read.pos += length_to_copy;
+    }
+    if (pending_read.consumed == pending_read.result.size()) {
+      if (ABSL_PREDICT_FALSE(!pending_read.status.ok())) {
+        // The file ends or reading failed. Discard reads ahead so that reading
+        // is attempted again next time.
+        status = pending_read.status;
+        DoneBackground();
+        break;
+      }
+      pending_reads_.pop_front();
+      if (ABSL_PREDICT_FALSE(!pending_reads_.empty() &&
+                             pending_reads_.front()->pos !=
+                                 pos + length_read)) {
+        // A read ahead was short without reaching the end of the file.
+        DoneBackground();
+        read_ahead_pos_ = pos + length_read;
+      }
+    }
+  }
+  *result = absl::string_view(scratch, length_read);
+  return status;
+}
+
+void FileReaderBase::ScheduleReadsAhead(::tensorflow::RandomAccessFile* src) {
+  while (pending_reads_.size() < IntCast<size_t>(read_ahead_) &&
+         read_ahead_pos_ <= std::numeric_limits<::tensorflow::uint64>::max() -
+                                buffer_size_) {
+    std::shared_ptr<PendingRead> pending_read = std::make_shared<PendingRead>();
+    pending_read->pos = read_ahead_pos_;
+    pending_read->buffer.Reset(buffer_size_);
+    ThreadPool::global().Schedule(
+        [src, pending_read,
+         pos = IntCast<::tensorflow::uint64>(read_ahead_pos_),
+         length = buffer_size_] {
+          pending_read->status = src->Read(pos, length, &pending_read->result,
+                                           pending_read->buffer.data());
+          pending_read->done.Notify();
+        });
+    read_ahead_pos_ += buffer_size_;
+    pending_reads_.push_back(std::move(pending_read));
+  }
+}
+
+bool FileReaderBase::ReadRanges(absl::Span<const ReadRange> ranges,
+                                absl::Span<Chain> dest) {
+  RIEGELI_ASSERT_EQ(ranges.size(), dest.size())
+      << "Failed precondition of Reader::ReadRanges(): "
+         "ranges and dest have different sizes";
+  if (filename_.empty() || ABSL_PREDICT_FALSE(!healthy())) {
+    return Reader::ReadRanges(ranges, dest);
+  }
+  if (ranges.empty()) return true;
+  ::tensorflow::RandomAccessFile* const src = src_file();
+  // Ranges with `index % num_tasks == task` are read by `task`. Task 0 runs in
+  // the current thread.
+  const size_t num_tasks = UnsignedMin(ranges.size(), kMaxConcurrentReads);
+  std::vector<::tensorflow::Status> statuses(num_tasks);
+  std::vector<char> all_read(num_tasks, true);
+  const auto read_ranges = [&](size_t task) {
+    for (size_t index = task; index < ranges.size(); index += num_tasks) {
+      Chain& chain = dest[index];
+      chain.Clear();
+      const absl::Span<char> flat_buffer =
+          chain.AppendFixedBuffer(ranges[index].length);
+      absl::string_view result;
+      ::tensorflow::Status status =
+          src->Read(IntCast<::tensorflow::uint64>(ranges[index].pos),
+                    flat_buffer.size(), &result, flat_buffer.data());
+      RIEGELI_ASSERT_LE(result.size(), flat_buffer.size())
+          << "RandomAccessFile::Read() read more than requested";
+      if (result.data() != flat_buffer.data()) {
+        std::memcpy(flat_buffer.data(), result.data(), result.size());
+      }
+      chain.RemoveSuffix(flat_buffer.size() - result.size());
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        if (ABSL_PREDICT_FALSE(!::tensorflow::errors::IsOutOfRange(status))) {
+          statuses[task] = std::move(status);
+          chain.Clear();
+          return;
+        }
+        all_read[task] = false;
+      }
+    }
+  };
+  absl::BlockingCounter tasks_done(IntCast<int>(num_tasks - 1));
+  for (size_t task = 1; task < num_tasks; ++task) {
+    ThreadPool::global().Schedule([&read_ranges, &tasks_done, task] {
+      read_ranges(task);
+      tasks_done.DecrementCount();
+    });
+  }
+  read_ranges(0);
+  tasks_done.Wait();
+  for (const ::tensorflow::Status& status : statuses) {
+    if (ABSL_PREDICT_FALSE(!status.ok())) {
+      return FailOperation(status, "RandomAccessFile::Read()");
+    }
+  }
+  for (const char task_read_all : all_read) {
+    if (!task_read_all) return false;
+  }
+  return true;
+}
+
 bool FileReaderBase::SeekSlow(Position new_pos) {
   RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
       << "Failed precondition of Reader::SeekSlow(): "
@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <tuple>
@@ -93,10 +94,33 @@ class FileReaderBase : public Reader {
     }
     size_t buffer_size() const { return buffer_size_; }
 
+    // If positive, up to this many reads of `buffer_size()` bytes following
+    // the current position are issued ahead of time, in parallel in a
+    // background thread pool, so that sequential reading is not limited by
+    // the latency of a single `::tensorflow::RandomAccessFile::Read()`. This
+    // helps with remote filesystems where each read is a round trip.
+    //
+    // Reads ahead are discarded after seeking to another position.
+    //
+    // Default: 0 (reading is synchronous).
+    Options& set_read_ahead(int read_ahead) & {
+      RIEGELI_ASSERT_GE(read_ahead, 0)
+          << "Failed precondition of "
+             "FileReaderBase::Options::set_read_ahead(): "
+             "negative read ahead";
+      read_ahead_ = read_ahead;
+      return *this;
+    }
+    Options&& set_read_ahead(int read_ahead) && {
+      return std::move(set_read_ahead(read_ahead));
+    }
+    int read_ahead() const { return read_ahead_; }
+
    private:
     ::tensorflow::Env* env_ = nullptr;
     Position initial_pos_ = 0;
     size_t buffer_size_ = kDefaultBufferSize;
+    int read_ahead_ = 0;
   };
 
   // Returns the `::tensorflow::RandomAccessFile` being read from. If the
@@ -113,17 +137,19 @@ class FileReaderBase : public Reader {
   bool SupportsRandomAccess() override { return !filename_.empty(); }
   bool SupportsSize() override { return !filename_.empty(); }
   absl::optional<Position> Size() override;
+  bool ReadRanges(absl::Span<const ReadRange> ranges,
+                  absl::Span<Chain> dest) override;
 
  protected:
   FileReaderBase() noexcept : Reader(kInitiallyClosed) {}
 
-  explicit FileReaderBase(size_t buffer_size);
+  explicit FileReaderBase(size_t buffer_size, int read_ahead);
 
   FileReaderBase(FileReaderBase&& that) noexcept;
   FileReaderBase& operator=(FileReaderBase&& that) noexcept;
 
   void Reset();
-  void Reset(size_t buffer_size);
+  void Reset(size_t buffer_size, int read_ahead);
   void Initialize(::tensorflow::RandomAccessFile* src, ::tensorflow::Env* env,
                   Position initial_pos);
   bool InitializeFilename(::tensorflow::RandomAccessFile* src,
@@ -133,6 +159,10 @@ class FileReaderBase : public Reader {
   void InitializePos(Position initial_pos);
   ABSL_ATTRIBUTE_COLD bool FailOperation(const ::tensorflow::Status& status,
                                          absl::string_view operation);
+  void Done() override;
+  // Waits for reads ahead to finish and discards them. This must be done
+  // before the `::tensorflow::RandomAccessFile` is deleted.
+  void DoneBackground();
 
   bool PullSlow(size_t min_length, size_t recommended_length) override;
   using Reader::ReadSlow;
@@ -145,6 +175,12 @@ class FileReaderBase : public Reader {
   bool CopySlow(size_t length, BackwardWriter& dest) override;
 
  private:
+  struct PendingRead;
+
+  // Maximum number of threads issuing `::tensorflow::RandomAccessFile::Read()`
+  // concurrently in `ReadRanges()`.
+  static constexpr size_t kMaxConcurrentReads = 16;
+
   // Minimum length for which it is better to append current contents of
   // `buffer_` and read the remaining data directly than to read the data
   // through `buffer_`.
@@ -171,6 +207,16 @@ class FileReaderBase : public Reader {
   bool ReadToBuffer(size_t cursor_index, ::tensorflow::RandomAccessFile* src,
                     absl::Span<char> flat_buffer);
 
+  // Like `::tensorflow::RandomAccessFile::Read()`, but served from reads ahead
+  // if `read_ahead_ > 0`.
+  ::tensorflow::Status ReadFromFile(::tensorflow::RandomAccessFile* src,
+                                    Position pos, size_t length,
+                                    absl::string_view* result, char* scratch);
+
+  // Issues reads ahead from `read_ahead_pos_` until there are `read_ahead_`
+  // of them.
+  void ScheduleReadsAhead(::tensorflow::RandomAccessFile* src);
+
   // Discards buffer contents.
   void ClearBuffer();
 
@@ -185,6 +231,12 @@ class FileReaderBase : public Reader {
   // data are in memory managed by the `::tensorflow::RandomAccessFile`. In any
   // case `start()` points to them.
   ChainBlock buffer_;
+  int read_ahead_ = 0;
+  // Reads ahead, at consecutive positions. The first one can be partially
+  // consumed.
+  std::deque<std::shared_ptr<PendingRead>> pending_reads_;
+  // The position of the next read ahead to issue.
+  Position read_ahead_pos_ = 0;
 
   // Invariants if `!buffer_.empty()`:
   //   `start() == buffer_.data()`
@@ -228,6 +280,8 @@ class FileReader : public FileReaderBase {
   FileReader(FileReader&& that) noexcept;
   FileReader& operator=(FileReader&& that) noexcept;
 
+  ~FileReader() { DoneBackground(); }
+
   // Makes `*this` equivalent to a newly constructed `FileReader`. This avoids
   // constructing a temporary `FileReader` and moving from it.
   void Reset();
@@ -282,8 +336,10 @@ explicit FileReader(absl::string_view filename,
 
 // Implementation details follow.
 
-inline FileReaderBase::FileReaderBase(size_t buffer_size)
-    : Reader(kInitiallyOpen), buffer_size_(buffer_size) {}
+inline FileReaderBase::FileReaderBase(size_t buffer_size, int read_ahead)
+    : Reader(kInitiallyOpen),
+      buffer_size_(buffer_size),
+      read_ahead_(read_ahead) {}
 
 inline FileReaderBase::FileReaderBase(FileReaderBase&& that) noexcept
     : Reader(std::move(that)),
@@ -292,10 +348,14 @@ inline FileReaderBase::FileReaderBase(FileReaderBase&& that) noexcept
       filename_(std::move(that.filename_)),
       file_system_(that.file_system_),
       buffer_size_(that.buffer_size_),
-      buffer_(std::move(that.buffer_)) {}
+      buffer_(std::move(that.buffer_)),
+      read_ahead_(that.read_ahead_),
+      pending_reads_(std::move(that.pending_reads_)),
+      read_ahead_pos_(that.read_ahead_pos_) {}
 
 inline FileReaderBase& FileReaderBase::operator=(
     FileReaderBase&& that) noexcept {
+  DoneBackground();
   Reader::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
@@ -303,23 +363,30 @@ inline FileReaderBase& FileReaderBase::operator=(
   file_system_ = that.file_system_;
   buffer_size_ = that.buffer_size_;
   buffer_ = std::move(that.buffer_);
+  read_ahead_ = that.read_ahead_;
+  pending_reads_ = std::move(that.pending_reads_);
+  read_ahead_pos_ = that.read_ahead_pos_;
   return *this;
 }
 
 inline void FileReaderBase::Reset() {
+  DoneBackground();
   Reader::Reset(kInitiallyClosed);
   filename_.clear();
   file_system_ = nullptr;
   buffer_size_ = 0;
   buffer_.Clear();
+  read_ahead_ = 0;
 }
 
-inline void FileReaderBase::Reset(size_t buffer_size) {
+inline void FileReaderBase::Reset(size_t buffer_size, int read_ahead) {
+  DoneBackground();
   Reader::Reset(kInitiallyOpen);
   filename_.clear();
   file_system_ = nullptr;
   buffer_size_ = buffer_size;
   buffer_.Clear();
+  read_ahead_ = read_ahead;
 }
 
 inline void FileReaderBase::Initialize(::tensorflow::RandomAccessFile* src,
@@ -333,13 +400,15 @@ inline void FileReaderBase::Initialize(::tensorflow::RandomAccessFile* src,
 
 template <typename Src>
 inline FileReader<Src>::FileReader(const Src& src, Options options)
-    : FileReaderBase(options.buffer_size()), src_(src) {
+    : FileReaderBase(options.buffer_size(), options.read_ahead()),
+      src_(src) {
   Initialize(src_.get(), options.env(), options.initial_pos());
 }
 
 template <typename Src>
 inline FileReader<Src>::FileReader(Src&& src, Options options)
-    : FileReaderBase(options.buffer_size()), src_(std::move(src)) {
+    : FileReaderBase(options.buffer_size(), options.read_ahead()),
+      src_(std::move(src)) {
   Initialize(src_.get(), options.env(), options.initial_pos());
 }
 
@@ -347,13 +416,14 @@ template <typename Src>
 template <typename... SrcArgs>
 inline FileReader<Src>::FileReader(std::tuple<SrcArgs...> src_args,
                                    Options options)
-    : FileReaderBase(options.buffer_size()), src_(std::move(src_args)) {
+    : FileReaderBase(options.buffer_size(), options.read_ahead()),
+      src_(std::move(src_args)) {
   Initialize(src_.get(), options.env(), options.initial_pos());
 }
 
 template <typename Src>
 inline FileReader<Src>::FileReader(absl::string_view filename, Options options)
-    : FileReaderBase(options.buffer_size()) {
+    : FileReaderBase(options.buffer_size(), options.read_ahead()) {
   Initialize(filename, options.env(), options.initial_pos());
 }
 
@@ -365,14 +435,14 @@ inline void FileReader<Src>::Reset() {
 
 template <typename Src>
 inline void FileReader<Src>::Reset(const Src& src, Options options) {
-  FileReaderBase::Reset(options.buffer_size());
+  FileReaderBase::Reset(options.buffer_size(), options.read_ahead());
   src_.Reset(src);
   Initialize(src_.get(), options.env(), options.initial_pos());
 }
 
 template <typename Src>
 inline void FileReader<Src>::Reset(Src&& src, Options options) {
-  FileReaderBase::Reset(options.buffer_size());
+  FileReaderBase::Reset(options.buffer_size(), options.read_ahead());
   src_.Reset(std::move(src));
   Initialize(src_.get(), options.env(), options.initial_pos());
 }
@@ -381,7 +451,7 @@ template <typename Src>
 template <typename... SrcArgs>
 inline void FileReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
                                    Options options) {
-  FileReaderBase::Reset(options.buffer_size());
+  FileReaderBase::Reset(options.buffer_size(), options.read_ahead());
   src_.Reset(std::move(src_args));
   Initialize(src_.get(), options.env(), options.initial_pos());
 }
@@ -389,7 +459,7 @@ inline void FileReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
 template <typename Src>
 inline void FileReader<Src>::Reset(absl::string_view filename,
                                    Options options) {
-  FileReaderBase::Reset(options.buffer_size());
+  FileReaderBase::Reset(options.buffer_size(), options.read_ahead());
   src_.Reset();  // In case `OpenFile()` fails.
   Initialize(filename, options.env(), options.initial_pos());
 }
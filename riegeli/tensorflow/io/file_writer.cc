@@ -26,10 +26,12 @@
 #include "absl/strings/cord.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
 #include "riegeli/base/memory.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/writer.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -104,6 +106,32 @@ bool FileWriterBase::FailOperation(const ::tensorflow::Status& status,
                absl::StrCat(operation, " failed")));
 }
 
+void FileWriterBase::Done() {
+  WaitForAppends();
+  Writer::Done();
+}
+
+void FileWriterBase::DoneBackground() {
+  if (async_ == nullptr) return;
+  absl::MutexLock lock(&async_->mutex);
+  async_->mutex.Await(absl::Condition(
+      +[](bool* busy) { return !*busy; }, &async_->busy));
+}
+
+bool FileWriterBase::WaitForAppends() {
+  if (async_ == nullptr) return healthy();
+  DoneBackground();
+  ::tensorflow::Status status;
+  {
+    absl::MutexLock lock(&async_->mutex);
+    status = async_->status;
+  }
+  if (ABSL_PREDICT_FALSE(!status.ok()) && ABSL_PREDICT_TRUE(healthy())) {
+    return FailOperation(status, "WritableFile::Append(string_view)");
+  }
+  return healthy();
+}
+
 bool FileWriterBase::Fail(absl::Status status) {
   RIEGELI_ASSERT(!status.ok())
       << "Failed precondition of Object::Fail(): status not failed";
@@ -114,6 +142,9 @@ bool FileWriterBase::Fail(absl::Status status) {
 }
 
 inline size_t FileWriterBase::LengthToWriteDirectly() const {
+  // Writing directly would not keep appends aligned to `buffer_size_`, and
+  // `src` would have to be copied anyway to be appended in the background.
+  if (async()) return std::numeric_limits<size_t>::max();
   size_t length = buffer_size_;
   if (written_to_buffer() > 0) {
     // Two writes are needed because current contents of `buffer_` must be
@@ -148,7 +179,9 @@ bool FileWriterBase::PushInternal() {
   if (ABSL_PREDICT_FALSE(!healthy())) return false;
   const absl::string_view data(start(), written_to_buffer());
   set_buffer();
-  return data.empty() || WriteInternal(data);
+  if (data.empty()) return true;
+  if (async()) return WriteInternalAsync(data);
+  return WriteInternal(data);
 }
 
 bool FileWriterBase::WriteSlow(absl::string_view src) {
@@ -186,6 +219,44 @@ bool FileWriterBase::WriteInternal(absl::string_view src) {
   return true;
 }
 
+bool FileWriterBase::WriteInternalAsync(absl::string_view src) {
+  RIEGELI_ASSERT(!src.empty())
+      << "Failed precondition of FileWriterBase::WriteInternalAsync(): "
+         "nothing to write";
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of FileWriterBase::WriteInternalAsync(): "
+      << status();
+  RIEGELI_ASSERT(async())
+      << "Failed precondition of FileWriterBase::WriteInternalAsync(): "
+         "not async";
+  RIEGELI_ASSERT(src.data() == buffer_.data())
+      << "Failed precondition of FileWriterBase::WriteInternalAsync(): "
+         "data not in buffer_";
+  if (ABSL_PREDICT_FALSE(!WaitForAppends())) return false;
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - start_pos())) {
+    return FailOverflow();
+  }
+  ::tensorflow::WritableFile* const dest = dest_file();
+  AsyncState* const async = async_.get();
+  // `async->buffer` is not accessed by the background thread while not busy.
+  std::swap(buffer_, async->buffer);
+  {
+    absl::MutexLock lock(&async->mutex);
+    async->busy = true;
+  }
+  ThreadPool::global().Schedule([dest, async, src] {
+    const ::tensorflow::Status status = dest->Append(src);
+    absl::MutexLock lock(&async->mutex);
+    if (ABSL_PREDICT_FALSE(!status.ok()) && async->status.ok()) {
+      async->status = status;
+    }
+    async->busy = false;
+  });
+  move_start_pos(src.size());
+  return true;
+}
+
 void FileWriterBase::WriteHintSlow(size_t length) {
   RIEGELI_ASSERT_LT(available(), length)
       << "Failed precondition of Writer::WriteHintSlow(): "
@@ -28,6 +28,7 @@
 #include "absl/status/status.h"
 #include "absl/strings/cord.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/buffer.h"
 #include "riegeli/base/chain.h"
@@ -95,10 +96,34 @@ class FileWriterBase : public Writer {
     }
     size_t buffer_size() const { return buffer_size_; }
 
+    // If `false`, buffered data are appended to the file synchronously, and
+    // large writes bypass the buffer.
+    //
+    // If `true`, buffered data are appended to the file in the background
+    // while the next buffer is being filled, and all data go through the
+    // buffer, so that they are appended in pieces of `buffer_size()`, except
+    // before flushing or closing, or when `Push()` needs a larger contiguous
+    // region. This suits multipart uploads to object stores if `buffer_size()`
+    // is a multiple of the part size.
+    //
+    // In this mode `Flush(FlushType::kFromObject)` does not call
+    // `::tensorflow::WritableFile::Flush()`, and waits for appending to finish
+    // only if the `::tensorflow::WritableFile` is not owned. Failures of
+    // appending are reported by a later operation.
+    //
+    // Default: `false`.
+    Options& set_async(bool async) & {
+      async_ = async;
+      return *this;
+    }
+    Options&& set_async(bool async) && { return std::move(set_async(async)); }
+    bool async() const { return async_; }
+
    private:
     ::tensorflow::Env* env_ = nullptr;
     bool append_ = false;
     size_t buffer_size_ = kDefaultBufferSize;
+    bool async_ = false;
   };
 
   // Returns the `::tensorflow::WritableFile` being written to. Unchanged by
@@ -115,13 +140,13 @@ class FileWriterBase : public Writer {
  protected:
   FileWriterBase() noexcept : Writer(kInitiallyClosed) {}
 
-  explicit FileWriterBase(size_t buffer_size);
+  explicit FileWriterBase(size_t buffer_size, bool async);
 
   FileWriterBase(FileWriterBase&& that) noexcept;
   FileWriterBase& operator=(FileWriterBase&& that) noexcept;
 
   void Reset();
-  void Reset(size_t buffer_size);
+  void Reset(size_t buffer_size, bool async);
   void Initialize(::tensorflow::WritableFile* dest);
   void InitializeFilename(::tensorflow::WritableFile* dest);
   std::unique_ptr<::tensorflow::WritableFile> OpenFile(
@@ -129,6 +154,22 @@ class FileWriterBase : public Writer {
   void InitializePos(::tensorflow::WritableFile* dest);
   ABSL_ATTRIBUTE_COLD bool FailOperation(const ::tensorflow::Status& status,
                                          absl::string_view operation);
+  void Done() override;
+  // Waits for appending in the background to finish, without reporting its
+  // failure. This must be done before the `::tensorflow::WritableFile` is
+  // deleted.
+  void DoneBackground();
+
+  // Returns `true` if data are appended in the background.
+  bool async() const { return async_ != nullptr; }
+
+  // Waits for appending in the background to finish, and fails `*this` if it
+  // failed.
+  //
+  // Return values:
+  //  * `true`  - success (`healthy()`)
+  //  * `false` - failure (`!healthy()`)
+  bool WaitForAppends();
 
   bool PushSlow(size_t min_length, size_t recommended_length) override;
 
@@ -150,15 +191,40 @@ class FileWriterBase : public Writer {
   bool WriteInternal(absl::string_view src);
 
  private:
+  // State of appending in the background.
+  struct AsyncState {
+    absl::Mutex mutex;
+    // Whether `buffer` is being appended.
+    bool busy ABSL_GUARDED_BY(mutex) = false;
+    // The first failure of appending.
+    ::tensorflow::Status status ABSL_GUARDED_BY(mutex);
+    // Data being appended if `busy`, otherwise a spare buffer.
+    Buffer buffer;
+  };
+
   // Minimum length for which it is better to push current contents of `buffer_`
   // and write the data directly than to write the data through `buffer_`.
   size_t LengthToWriteDirectly() const;
 
+  // Starts appending `src`, which is a prefix of `buffer_`, in the background,
+  // after waiting for the previous append. Swaps `buffer_` with the spare
+  // buffer.
+  //
+  // Increments `start_pos()` by the length written.
+  //
+  // Preconditions:
+  //   `!src.empty()`
+  //   `healthy()`
+  //   `async()`
+  bool WriteInternalAsync(absl::string_view src);
+
   std::string filename_;
   // Invariant: if `is_open()` then `buffer_size_ > 0`
   size_t buffer_size_ = 0;
   // Buffered data to be written.
   Buffer buffer_;
+  // If not `nullptr`, data are appended in the background.
+  std::unique_ptr<AsyncState> async_;
 };
 
 // A `Writer` which writes to a `::tensorflow::WritableFile`.
@@ -200,6 +266,8 @@ class FileWriter : public FileWriterBase {
   FileWriter(FileWriter&& that) noexcept;
   FileWriter& operator=(FileWriter&& that) noexcept;
 
+  ~FileWriter() { DoneBackground(); }
+
   // Makes `*this` equivalent to a newly constructed `FileWriter`. This avoids
   // constructing a temporary `FileWriter` and moving from it.
   void Reset();
@@ -251,8 +319,10 @@ explicit FileWriter(absl::string_view filename,
 
 // Implementation details follow.
 
-inline FileWriterBase::FileWriterBase(size_t buffer_size)
-    : Writer(kInitiallyOpen), buffer_size_(buffer_size) {}
+inline FileWriterBase::FileWriterBase(size_t buffer_size, bool async)
+    : Writer(kInitiallyOpen),
+      buffer_size_(buffer_size),
+      async_(async ? std::make_unique<AsyncState>() : nullptr) {}
 
 inline FileWriterBase::FileWriterBase(FileWriterBase&& that) noexcept
     : Writer(std::move(that)),
@@ -260,29 +330,36 @@ inline FileWriterBase::FileWriterBase(FileWriterBase&& that) noexcept
       // part was moved.
       filename_(std::move(that.filename_)),
       buffer_size_(that.buffer_size_),
-      buffer_(std::move(that.buffer_)) {}
+      buffer_(std::move(that.buffer_)),
+      async_(std::move(that.async_)) {}
 
 inline FileWriterBase& FileWriterBase::operator=(
     FileWriterBase&& that) noexcept {
+  DoneBackground();
   Writer::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
   filename_ = std::move(that.filename_);
   buffer_size_ = that.buffer_size_;
   buffer_ = std::move(that.buffer_);
+  async_ = std::move(that.async_);
   return *this;
 }
 
 inline void FileWriterBase::Reset() {
+  DoneBackground();
   Writer::Reset(kInitiallyClosed);
   filename_.clear();
   buffer_size_ = 0;
+  async_.reset();
 }
 
-inline void FileWriterBase::Reset(size_t buffer_size) {
+inline void FileWriterBase::Reset(size_t buffer_size, bool async) {
+  DoneBackground();
   Writer::Reset(kInitiallyOpen);
   filename_.clear();
   buffer_size_ = buffer_size;
+  async_ = async ? std::make_unique<AsyncState>() : nullptr;
 }
 
 inline void FileWriterBase::Initialize(::tensorflow::WritableFile* dest) {
@@ -294,13 +371,14 @@ inline void FileWriterBase::Initialize(::tensorflow::WritableFile* dest) {
 
 template <typename Dest>
 inline FileWriter<Dest>::FileWriter(const Dest& dest, Options options)
-    : FileWriterBase(options.buffer_size()), dest_(dest) {
+    : FileWriterBase(options.buffer_size(), options.async()), dest_(dest) {
   Initialize(dest_.get());
 }
 
 template <typename Dest>
 inline FileWriter<Dest>::FileWriter(Dest&& dest, Options options)
-    : FileWriterBase(options.buffer_size()), dest_(std::move(dest)) {
+    : FileWriterBase(options.buffer_size(), options.async()),
+      dest_(std::move(dest)) {
   Initialize(dest_.get());
 }
 
@@ -308,13 +386,14 @@ template <typename Dest>
 template <typename... DestArgs>
 inline FileWriter<Dest>::FileWriter(std::tuple<DestArgs...> dest_args,
                                     Options options)
-    : FileWriterBase(options.buffer_size()), dest_(std::move(dest_args)) {
+    : FileWriterBase(options.buffer_size(), options.async()),
+      dest_(std::move(dest_args)) {
   Initialize(dest_.get());
 }
 
 template <typename Dest>
 inline FileWriter<Dest>::FileWriter(absl::string_view filename, Options options)
-    : FileWriterBase(options.buffer_size()) {
+    : FileWriterBase(options.buffer_size(), options.async()) {
   Initialize(filename, options.env(), options.append());
 }
 
@@ -344,14 +423,14 @@ inline void FileWriter<Dest>::Reset() {
 
 template <typename Dest>
 inline void FileWriter<Dest>::Reset(const Dest& dest, Options options) {
-  FileWriterBase::Reset(options.buffer_size());
+  FileWriterBase::Reset(options.buffer_size(), options.async());
   dest_.Reset(dest);
   Initialize(dest_.get());
 }
 
 template <typename Dest>
 inline void FileWriter<Dest>::Reset(Dest&& dest, Options options) {
-  FileWriterBase::Reset(options.buffer_size());
+  FileWriterBase::Reset(options.buffer_size(), options.async());
   dest_.Reset(std::move(dest));
   Initialize(dest_.get());
 }
@@ -360,7 +439,7 @@ template <typename Dest>
 template <typename... DestArgs>
 inline void FileWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
                                     Options options) {
-  FileWriterBase::Reset(options.buffer_size());
+  FileWriterBase::Reset(options.buffer_size(), options.async());
   dest_.Reset(std::move(dest_args));
   Initialize(dest_.get());
 }
@@ -368,7 +447,7 @@ inline void FileWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
 template <typename Dest>
 inline void FileWriter<Dest>::Reset(absl::string_view filename,
                                     Options options) {
-  FileWriterBase::Reset(options.buffer_size());
+  FileWriterBase::Reset(options.buffer_size(), options.async());
   dest_.Reset();  // In case `OpenFile()` fails.
   Initialize(filename, options.env(), options.append());
 }
@@ -402,9 +481,14 @@ bool FileWriter<Dest>::FlushImpl(FlushType flush_type) {
   if (ABSL_PREDICT_FALSE(!PushInternal())) return false;
   switch (flush_type) {
     case FlushType::kFromObject:
+      if (async()) {
+        if (dest_.is_owning()) return true;
+        return WaitForAppends();
+      }
       if (!dest_.is_owning()) return true;
       ABSL_FALLTHROUGH_INTENDED;
     case FlushType::kFromProcess: {
+      if (ABSL_PREDICT_FALSE(!WaitForAppends())) return false;
       const ::tensorflow::Status status = dest_->Flush();
       if (ABSL_PREDICT_FALSE(!status.ok())) {
         return FailOperation(status, "WritableFile::Flush()");
@@ -412,6 +496,7 @@ bool FileWriter<Dest>::FlushImpl(FlushType flush_type) {
     }
       return true;
     case FlushType::kFromMachine: {
+      if (ABSL_PREDICT_FALSE(!WaitForAppends())) return false;
       const ::tensorflow::Status status = dest_->Sync();
       if (ABSL_PREDICT_FALSE(!status.ok())) {
         return FailOperation(status, "WritableFile::Sync()");
@@ -14,6 +14,7 @@
 
 #include <stddef.h>
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <tuple>
@@ -22,16 +23,22 @@
 
 #include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/chunk_encoding/field_projection.h"
 #include "riegeli/records/record_position.h"
 #include "riegeli/records/record_reader.h"
 #include "riegeli/records/skipped_region.h"
 #include "riegeli/tensorflow/io/file_reader.h"
-#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/framework/allocation_description.pb.h"
+#include "tensorflow/core/framework/attr_value.pb.h"
 #include "tensorflow/core/framework/dataset.h"
 #include "tensorflow/core/framework/kernel_def_builder.h"
 #include "tensorflow/core/framework/op_kernel.h"
@@ -60,9 +67,45 @@ namespace riegeli {
 namespace tensorflow {
 namespace {
 
+// A buffer of a string tensor whose elements can be views of records. Keeps
+// the records alive.
+class RecordsTensorBuffer : public ::tensorflow::TensorBuffer {
+ public:
+  explicit RecordsTensorBuffer(std::vector<::tensorflow::tstring>&& elements,
+                               std::vector<Chain>&& owners)
+      : TensorBuffer(elements.data()),
+        elements_(std::move(elements)),
+        owners_(std::move(owners)) {}
+
+  size_t size() const override {
+    return elements_.size() * sizeof(::tensorflow::tstring);
+  }
+
+  ::tensorflow::TensorBuffer* root_buffer() override { return this; }
+
+  void FillAllocationDescription(
+      ::tensorflow::AllocationDescription* proto) const override {
+    proto->set_requested_bytes(IntCast<::tensorflow::int64>(size()));
+    proto->set_allocator_name("RiegeliDataset");
+  }
+
+ private:
+  // Moving a `std::vector` preserves the address of its elements, which is
+  // the data pointer passed to `TensorBuffer`.
+  std::vector<::tensorflow::tstring> elements_;
+  // Blocks referred to by views in `elements_`.
+  std::vector<Chain> owners_;
+};
+
 class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
  public:
-  using DatasetOpKernel::DatasetOpKernel;
+  explicit RiegeliDatasetOp(::tensorflow::OpKernelConstruction* ctx)
+      : DatasetOpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("batch_size", &batch_size_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("cycle_length", &cycle_length_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("field_projection", &field_paths_));
+    OP_REQUIRES_OK(ctx, ParseFieldProjection(field_paths_, field_projection_));
+  }
 
   void MakeDataset(::tensorflow::OpKernelContext* ctx,
                    ::tensorflow::data::DatasetBase** output) override {
@@ -87,18 +130,59 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
         ctx, buffer_size > 0,
         ::tensorflow::errors::InvalidArgument("`buffer_size` must be > 0"));
 
-    *output = new Dataset(ctx, std::move(filenames), buffer_size);
+    *output = new Dataset(ctx, std::move(filenames), buffer_size, batch_size_,
+                          cycle_length_, field_paths_, field_projection_);
   }
 
  private:
+  // Parses `field_paths`, where each path consists of field numbers separated
+  // by '.', and 0 stands for `Field::kExistenceOnly`. No paths mean all fields.
+  static ::tensorflow::Status ParseFieldProjection(
+      const std::vector<std::string>& field_paths,
+      FieldProjection& field_projection) {
+    if (field_paths.empty()) {
+      field_projection = FieldProjection::All();
+      return ::tensorflow::Status::OK();
+    }
+    for (const std::string& field_path : field_paths) {
+      Field field;
+      for (const absl::string_view field_number_text :
+           absl::StrSplit(field_path, '.')) {
+        int field_number;
+        if (TF_PREDICT_FALSE(
+                !absl::SimpleAtoi(field_number_text, &field_number) ||
+                field_number < Field::kExistenceOnly ||
+                field_number > (1 << 29) - 1)) {
+          return ::tensorflow::errors::InvalidArgument(
+              "Invalid field path in `field_projection`: \"", field_path,
+              "\"");
+        }
+        field.AddFieldNumber(field_number);
+      }
+      field_projection.AddField(std::move(field));
+    }
+    return ::tensorflow::Status::OK();
+  }
+
   class Dataset : public ::tensorflow::data::DatasetBase {
    public:
     explicit Dataset(::tensorflow::OpKernelContext* ctx,
                      std::vector<std::string> filenames,
-                     ::tensorflow::int64 buffer_size)
+                     ::tensorflow::int64 buffer_size,
+                     ::tensorflow::int64 batch_size,
+                     ::tensorflow::int64 cycle_length,
+                     std::vector<std::string> field_paths,
+                     FieldProjection field_projection)
         : DatasetBase(::tensorflow::data::DatasetContext(ctx)),
           filenames_(std::move(filenames)),
-          buffer_size_(buffer_size) {}
+          buffer_size_(buffer_size),
+          batch_size_(batch_size),
+          cycle_length_(cycle_length),
+          field_paths_(std::move(field_paths)),
+          field_projection_(std::move(field_projection)),
+          output_shapes_({batch_size_ > 0
+                              ? ::tensorflow::PartialTensorShape({-1})
+                              : ::tensorflow::PartialTensorShape({})}) {}
 
     std::unique_ptr<::tensorflow::data::IteratorBase> MakeIteratorInternal(
         const std::string& prefix) const override {
@@ -114,9 +198,7 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
 
     const std::vector<::tensorflow::PartialTensorShape>& output_shapes()
         const override {
-      static const std::vector<::tensorflow::PartialTensorShape>* const shapes =
-          new std::vector<::tensorflow::PartialTensorShape>({{}});
-      return *shapes;
+      return output_shapes_;
     }
 
     std::string DebugString() const override {
@@ -139,72 +221,81 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
       TF_RETURN_IF_ERROR(b->AddVector(filenames_, &filenames));
       ::tensorflow::Node* buffer_size = nullptr;
       TF_RETURN_IF_ERROR(b->AddScalar(buffer_size_, &buffer_size));
-      TF_RETURN_IF_ERROR(b->AddDataset(this, {filenames, buffer_size}, output));
+      ::tensorflow::AttrValue batch_size;
+      b->BuildAttrValue(batch_size_, &batch_size);
+      ::tensorflow::AttrValue cycle_length;
+      b->BuildAttrValue(cycle_length_, &cycle_length);
+      ::tensorflow::AttrValue field_projection;
+      b->BuildAttrValue(field_paths_, &field_projection);
+      TF_RETURN_IF_ERROR(b->AddDataset(this, {filenames, buffer_size},
+                                       {{"batch_size", batch_size},
+                                        {"cycle_length", cycle_length},
+                                        {"field_projection", field_projection}},
+                                       output));
       return ::tensorflow::Status::OK();
     }
 
    private:
+    // Files are read in up to `cycle_length_` slots. Each round reads a block
+    // of up to `max(batch_size_, 1)` records from each slot, concurrently if
+    // there are several slots, and queues them in the order of slots. Elements
+    // are taken from the queue, and a batch can span blocks and files.
+    //
+    // A new round begins when the queue is empty. Only then slots which
+    // finished their files are refilled with next files, so that each queued
+    // record belongs to the file currently assigned to its slot, and iterator
+    // state can be saved as a position in each slot.
     class Iterator : public ::tensorflow::data::DatasetIterator<Dataset> {
      public:
       explicit Iterator(const Params& params)
-          : DatasetIterator<Dataset>(params) {}
+          : DatasetIterator<Dataset>(params),
+            slots_(IntCast<size_t>(dataset()->cycle_length_)) {}
 
       ::tensorflow::Status GetNextInternal(
           ::tensorflow::data::IteratorContext* ctx,
           std::vector<::tensorflow::Tensor>* out_tensors,
           bool* end_of_sequence) override ABSL_LOCKS_EXCLUDED(mu_) {
         absl::MutexLock l(&mu_);
-        for (;;) {
-          if (reader_ != absl::nullopt) {
-            // We are currently processing a file, so try to read the next
-            // record.
-            ::tensorflow::Tensor result_tensor(::tensorflow::cpu_allocator(),
-                                               ::tensorflow::DT_STRING, {});
-            absl::string_view value;
-            if (TF_PREDICT_TRUE(reader_->ReadRecord(value))) {
-              result_tensor.scalar<::tensorflow::tstring>()().assign(
-                  value.data(), value.size());
-              out_tensors->push_back(std::move(result_tensor));
-              *end_of_sequence = false;
-              return ::tensorflow::Status::OK();
-            }
-            SkippedRegion skipped_region;
-            if (reader_->Recover(&skipped_region)) {
-              // File has invalid contents: return an error. Further iteration
-              // will resume reading the file after the invalid region has been
-              // skipped.
-              *end_of_sequence = false;
-              return ::tensorflow::errors::DataLoss(
-                  "Skipping invalid region of a Riegeli/records file: ",
-                  skipped_region.ToString());
-            }
-            if (TF_PREDICT_FALSE(!reader_->Close())) {
-              // Failed to read the file: return an error.
-              const absl::Status status = reader_->status();
-              // Further iteration will move on to the next file, if any.
-              reader_.reset();
-              ++current_file_index_;
-              *end_of_sequence =
-                  current_file_index_ == dataset()->filenames_.size();
-              return ::tensorflow::Status(
-                  static_cast<::tensorflow::error::Code>(status.code()),
-                  status.message());
-            }
-            // We have reached the end of the current file, so move on to the
-            // next file, if any.
-            reader_.reset();
-            ++current_file_index_;
+        const size_t max_records =
+            dataset()->batch_size_ > 0
+                ? IntCast<size_t>(dataset()->batch_size_)
+                : size_t{1};
+        std::vector<::tensorflow::tstring> records;
+        std::vector<Chain> owners;
+        while (records.size() < max_records) {
+          if (queue_.empty()) {
+            if (AtEnd()) break;
+            ReadRound(ctx);
+            continue;
           }
-
-          // Iteration ends when there are no more files to process.
-          if (current_file_index_ == dataset()->filenames_.size()) {
-            *end_of_sequence = true;
-            return ::tensorflow::Status::OK();
+          QueuedRecord& queued = queue_.front();
+          if (TF_PREDICT_FALSE(!queued.status.ok())) {
+            // Return records read before the error first.
+            if (!records.empty()) break;
+            const ::tensorflow::Status status = std::move(queued.status);
+            queue_.pop_front();
+            *end_of_sequence = false;
+            return status;
           }
-
-          // Actually move on to next file.
-          OpenFile(ctx);
+          records.push_back(std::move(queued.record));
+          if (!queued.owner.empty()) owners.push_back(std::move(queued.owner));
+          queue_.pop_front();
         }
+        if (records.empty()) {
+          *end_of_sequence = true;
+          return ::tensorflow::Status::OK();
+        }
+        const ::tensorflow::TensorShape shape =
+            dataset()->batch_size_ > 0
+                ? ::tensorflow::TensorShape(
+                      {IntCast<::tensorflow::int64>(records.size())})
+                : ::tensorflow::TensorShape({});
+        RecordsTensorBuffer* const buffer =
+            new RecordsTensorBuffer(std::move(records), std::move(owners));
+        out_tensors->emplace_back(::tensorflow::DT_STRING, shape, buffer);
+        buffer->Unref();
+        *end_of_sequence = false;
+        return ::tensorflow::Status::OK();
       }
 
      protected:
@@ -218,11 +309,49 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
           ABSL_LOCKS_EXCLUDED(mu_) {
         absl::MutexLock l(&mu_);
         TF_RETURN_IF_ERROR(writer->WriteScalar(
-            full_name("current_file_index"),
-            IntCast<::tensorflow::int64>(current_file_index_)));
-        if (reader_ != absl::nullopt) {
-          TF_RETURN_IF_ERROR(writer->WriteScalar(full_name("current_pos"),
-                                                 reader_->pos().ToBytes()));
+            full_name("next_file_index"),
+            IntCast<::tensorflow::int64>(next_file_index_)));
+        // Queued records are read again after restoring, so the position of a
+        // slot is the position of its first queued record, and the current
+        // round continues from the slot of the first queued record.
+        std::vector<absl::optional<RecordPosition>> first_queued(
+            slots_.size());
+        absl::optional<size_t> round_begin;
+        size_t first_block_length = 0;
+        for (const QueuedRecord& queued : queue_) {
+          if (!queued.status.ok()) continue;
+          if (first_queued[queued.slot_index] == absl::nullopt) {
+            first_queued[queued.slot_index] = queued.pos;
+          }
+          if (round_begin == absl::nullopt) round_begin = queued.slot_index;
+          if (queued.slot_index == *round_begin) ++first_block_length;
+        }
+        if (round_begin == absl::nullopt) {
+          round_begin = round_begin_;
+          first_block_length = first_block_length_;
+        }
+        TF_RETURN_IF_ERROR(
+            writer->WriteScalar(full_name("round_begin"),
+                                IntCast<::tensorflow::int64>(*round_begin)));
+        TF_RETURN_IF_ERROR(writer->WriteScalar(
+            full_name("first_block_length"),
+            IntCast<::tensorflow::int64>(first_block_length)));
+        for (size_t slot_index = 0; slot_index < slots_.size(); ++slot_index) {
+          const absl::optional<Slot>& slot = slots_[slot_index];
+          if (slot == absl::nullopt) continue;
+          TF_RETURN_IF_ERROR(writer->WriteScalar(
+              full_name(absl::StrCat("slot_file_index[", slot_index, "]")),
+              IntCast<::tensorflow::int64>(slot->file_index)));
+          absl::optional<RecordPosition> pos = first_queued[slot_index];
+          if (pos == absl::nullopt && slot->reader != absl::nullopt) {
+            pos = slot->reader->pos();
+          }
+          // A slot without a position has finished its file.
+          if (pos != absl::nullopt) {
+            TF_RETURN_IF_ERROR(writer->WriteScalar(
+                full_name(absl::StrCat("slot_pos[", slot_index, "]")),
+                pos->ToBytes()));
+          }
         }
         return ::tensorflow::Status::OK();
       }
@@ -232,66 +361,309 @@ class RiegeliDatasetOp : public ::tensorflow::data::DatasetOpKernel {
           ::tensorflow::data::IteratorStateReader* reader) override
           ABSL_LOCKS_EXCLUDED(mu_) {
         absl::MutexLock l(&mu_);
-        current_file_index_ = 0;
-        reader_.reset();
-
-        ::tensorflow::int64 current_file_index;
-        TF_RETURN_IF_ERROR(reader->ReadScalar(full_name("current_file_index"),
-                                              &current_file_index));
-        if (TF_PREDICT_FALSE(current_file_index < 0 ||
-                             IntCast<::tensorflow::uint64>(current_file_index) >
+        for (absl::optional<Slot>& slot : slots_) slot.reset();
+        queue_.clear();
+        next_file_index_ = 0;
+        round_begin_ = 0;
+        first_block_length_ = 0;
+
+        if (reader->Contains(full_name("current_file_index"))) {
+          // State saved before files could be read in parallel.
+          size_t current_file_index;
+          TF_RETURN_IF_ERROR(ReadFileIndex(reader, "current_file_index",
+                                           &current_file_index));
+          next_file_index_ = current_file_index;
+          if (reader->Contains(full_name("current_pos"))) {
+            if (TF_PREDICT_FALSE(current_file_index ==
                                  dataset()->filenames_.size())) {
-          return ::tensorflow::errors::Internal(
-              "current_file_index out of range");
+              return ::tensorflow::errors::Internal(
+                  "current_file_index out of range");
+            }
+            ++next_file_index_;
+            slots_[0].emplace();
+            slots_[0]->file_index = current_file_index;
+            TF_RETURN_IF_ERROR(
+                RestorePos(ctx, reader, "current_pos", *slots_[0]));
+          }
+          return ::tensorflow::Status::OK();
         }
-        current_file_index_ = IntCast<size_t>(current_file_index);
 
-        if (reader->Contains(full_name("current_pos"))) {
-          if (TF_PREDICT_FALSE(current_file_index_ ==
+        TF_RETURN_IF_ERROR(
+            ReadFileIndex(reader, "next_file_index", &next_file_index_));
+        ::tensorflow::int64 round_begin;
+        TF_RETURN_IF_ERROR(
+            reader->ReadScalar(full_name("round_begin"), &round_begin));
+        ::tensorflow::int64 first_block_length;
+        TF_RETURN_IF_ERROR(reader->ReadScalar(full_name("first_block_length"),
+                                              &first_block_length));
+        if (TF_PREDICT_FALSE(round_begin < 0 ||
+                             IntCast<::tensorflow::uint64>(round_begin) >=
+                                 slots_.size() ||
+                             first_block_length < 0)) {
+          return ::tensorflow::errors::Internal("round state out of range");
+        }
+        round_begin_ = IntCast<size_t>(round_begin);
+        first_block_length_ = IntCast<size_t>(first_block_length);
+        for (size_t slot_index = 0; slot_index < slots_.size(); ++slot_index) {
+          const std::string file_index_key =
+              absl::StrCat("slot_file_index[", slot_index, "]");
+          if (!reader->Contains(full_name(file_index_key))) continue;
+          absl::optional<Slot>& slot = slots_[slot_index];
+          slot.emplace();
+          TF_RETURN_IF_ERROR(
+              ReadFileIndex(reader, file_index_key, &slot->file_index));
+          if (TF_PREDICT_FALSE(slot->file_index ==
                                dataset()->filenames_.size())) {
             return ::tensorflow::errors::Internal(
-                "current_file_index out of range");
+                file_index_key, " out of range");
           }
-          ::tensorflow::tstring current_pos;
-          TF_RETURN_IF_ERROR(
-              reader->ReadScalar(full_name("current_pos"), &current_pos));
-          RecordPosition pos;
-          if (TF_PREDICT_FALSE(!pos.FromBytes(current_pos))) {
-            return ::tensorflow::errors::Internal(
-                "current_pos is not a valid RecordPosition");
+          const std::string pos_key =
+              absl::StrCat("slot_pos[", slot_index, "]");
+          if (reader->Contains(full_name(pos_key))) {
+            TF_RETURN_IF_ERROR(RestorePos(ctx, reader, pos_key, *slot));
           }
-          OpenFile(ctx);
-          reader_->Seek(pos);
-          // Any errors from seeking will be reported during reading.
         }
         return ::tensorflow::Status::OK();
       }
 
      private:
-      void OpenFile(::tensorflow::data::IteratorContext* ctx)
+      // A file being read.
+      struct Slot {
+        // Index of the file in `dataset()->filenames_`.
+        size_t file_index = 0;
+        // `absl::nullopt` means that the file has been finished.
+        absl::optional<RecordReader<tensorflow::FileReader<>>> reader;
+      };
+
+      struct QueuedRecord {
+        size_t slot_index = 0;
+        // Position of the record, if `status.ok()`.
+        RecordPosition pos;
+        ::tensorflow::tstring record;
+        // If not empty, `record` is a view of `owner`.
+        Chain owner;
+        // If not OK, this is an error to return instead of a record.
+        ::tensorflow::Status status;
+      };
+
+      ::tensorflow::Status ReadFileIndex(
+          ::tensorflow::data::IteratorStateReader* reader,
+          const std::string& key, size_t* file_index) {
+        ::tensorflow::int64 value;
+        TF_RETURN_IF_ERROR(reader->ReadScalar(full_name(key), &value));
+        if (TF_PREDICT_FALSE(value < 0 ||
+                             IntCast<::tensorflow::uint64>(value) >
+                                 dataset()->filenames_.size())) {
+          return ::tensorflow::errors::Internal(key, " out of range");
+        }
+        *file_index = IntCast<size_t>(value);
+        return ::tensorflow::Status::OK();
+      }
+
+      ::tensorflow::Status RestorePos(
+          ::tensorflow::data::IteratorContext* ctx,
+          ::tensorflow::data::IteratorStateReader* reader,
+          const std::string& key, Slot& slot) {
+        ::tensorflow::tstring pos_bytes;
+        TF_RETURN_IF_ERROR(reader->ReadScalar(full_name(key), &pos_bytes));
+        RecordPosition pos;
+        if (TF_PREDICT_FALSE(!pos.FromBytes(pos_bytes))) {
+          return ::tensorflow::errors::Internal(
+              key, " is not a valid RecordPosition");
+        }
+        OpenFile(ctx, slot);
+        slot.reader->Seek(pos);
+        // Any errors from seeking will be reported during reading.
+        return ::tensorflow::Status::OK();
+      }
+
+      bool AtEnd() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (next_file_index_ < dataset()->filenames_.size()) return false;
+        for (const absl::optional<Slot>& slot : slots_) {
+          if (slot != absl::nullopt && slot->reader != absl::nullopt) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      // Reads a block from each slot being read, and appends the records to
+      // `queue_`.
+      //
+      // Precondition: `queue_.empty()`
+      void ReadRound(::tensorflow::data::IteratorContext* ctx)
           ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-        reader_.emplace(std::forward_as_tuple(
-            dataset()->filenames_[current_file_index_],
-            tensorflow::FileReaderBase::Options()
-                .set_env(ctx->env())
-                .set_buffer_size(IntCast<size_t>(dataset()->buffer_size_))));
+        const size_t block_length =
+            dataset()->batch_size_ > 0
+                ? IntCast<size_t>(dataset()->batch_size_)
+                : size_t{1};
+        const size_t round_begin = round_begin_;
+        const size_t first_block_length = first_block_length_;
+        round_begin_ = 0;
+        first_block_length_ = 0;
+        if (first_block_length == 0) {
+          // A full round: refill slots which finished their files.
+          for (absl::optional<Slot>& slot : slots_) {
+            if (slot != absl::nullopt && slot->reader == absl::nullopt) {
+              slot.reset();
+            }
+            if (slot == absl::nullopt &&
+                next_file_index_ < dataset()->filenames_.size()) {
+              slot.emplace();
+              slot->file_index = next_file_index_++;
+              OpenFile(ctx, *slot);
+            }
+          }
+        }
+        struct SlotToRead {
+          size_t slot_index;
+          Slot* slot;
+          size_t max_records;
+        };
+        std::vector<SlotToRead> slots_to_read;
+        for (size_t slot_index = round_begin; slot_index < slots_.size();
+             ++slot_index) {
+          absl::optional<Slot>& slot = slots_[slot_index];
+          if (slot != absl::nullopt && slot->reader != absl::nullopt) {
+            slots_to_read.push_back(SlotToRead{
+                slot_index, &*slot,
+                slot_index == round_begin && first_block_length > 0
+                    ? first_block_length
+                    : block_length});
+          }
+        }
+        std::vector<std::vector<QueuedRecord>> blocks(slots_to_read.size());
+        if (slots_to_read.size() == 1) {
+          ReadBlock(slots_to_read[0].slot_index, *slots_to_read[0].slot,
+                    slots_to_read[0].max_records, blocks[0]);
+        } else if (slots_to_read.size() > 1) {
+          // Different slots can be read concurrently.
+          absl::BlockingCounter blocks_read(
+              IntCast<int>(slots_to_read.size()));
+          for (size_t i = 0; i < slots_to_read.size(); ++i) {
+            (*ctx->runner())([&slot_to_read = slots_to_read[i],
+                              &block = blocks[i], &blocks_read] {
+              ReadBlock(slot_to_read.slot_index, *slot_to_read.slot,
+                        slot_to_read.max_records, block);
+              blocks_read.DecrementCount();
+            });
+          }
+          blocks_read.Wait();
+        }
+        for (std::vector<QueuedRecord>& block : blocks) {
+          for (QueuedRecord& queued : block) {
+            queue_.push_back(std::move(queued));
+          }
+        }
+      }
+
+      // Reads up to `max_records` records from `slot` to `block`. Stops early
+      // at the end of the file or after an error.
+      static void ReadBlock(size_t slot_index, Slot& slot, size_t max_records,
+                            std::vector<QueuedRecord>& block) {
+        block.reserve(max_records);
+        while (block.size() < max_records) {
+          Chain record;
+          if (TF_PREDICT_TRUE(slot.reader->ReadRecord(record))) {
+            block.emplace_back();
+            QueuedRecord& queued = block.back();
+            queued.slot_index = slot_index;
+            queued.pos = slot.reader->last_pos();
+            SetRecord(std::move(record), queued);
+            continue;
+          }
+          SkippedRegion skipped_region;
+          if (slot.reader->Recover(&skipped_region)) {
+            // File has invalid contents: return an error. Further iteration
+            // will resume reading the file after the invalid region has been
+            // skipped.
+            block.emplace_back();
+            QueuedRecord& queued = block.back();
+            queued.slot_index = slot_index;
+            queued.status = ::tensorflow::errors::DataLoss(
+                "Skipping invalid region of a Riegeli/records file: ",
+                skipped_region.ToString());
+            return;
+          }
+          if (TF_PREDICT_FALSE(!slot.reader->Close())) {
+            // Failed to read the file: return an error. Further iteration will
+            // move on to the next file, if any.
+            const absl::Status status = slot.reader->status();
+            block.emplace_back();
+            QueuedRecord& queued = block.back();
+            queued.slot_index = slot_index;
+            queued.status = ::tensorflow::Status(
+                static_cast<::tensorflow::error::Code>(status.code()),
+                status.message());
+          }
+          // We have reached the end of the file.
+          slot.reader.reset();
+          return;
+        }
+      }
+
+      // Sets `queued.record` to `record`.
+      //
+      // A record longer than `kMaxBytesToCopy` shares blocks of the decoded
+      // chunk. If it is flat, it is not copied: `queued.record` becomes a view
+      // of it, and `queued.owner` keeps the blocks alive.
+      static void SetRecord(Chain&& record, QueuedRecord& queued) {
+        if (record.size() > kMaxBytesToCopy &&
+            record.TryFlat() != absl::nullopt) {
+          queued.owner = std::move(record);
+          const absl::string_view flat = *queued.owner.TryFlat();
+          queued.record.assign_as_view(flat.data(), flat.size());
+          return;
+        }
+        queued.record.resize_uninitialized(record.size());
+        record.CopyTo(queued.record.mdata());
+      }
+
+      void OpenFile(::tensorflow::data::IteratorContext* ctx, Slot& slot) {
+        slot.reader.emplace(
+            std::forward_as_tuple(
+                dataset()->filenames_[slot.file_index],
+                tensorflow::FileReaderBase::Options()
+                    .set_env(ctx->env())
+                    .set_buffer_size(IntCast<size_t>(dataset()->buffer_size_))),
+            RecordReaderBase::Options()
+                .set_field_projection(dataset()->field_projection_)
+                // Report one `DataLoss` error per damaged area of the file.
+                .set_merge_skipped_regions(true));
       }
 
       // Invariants:
-      //   `current_file_index_ <= dataset()->filenames_.size()`
-      //   if `current_file_index_ == dataset()->filenames_.size()` then
-      //       `reader_ == absl::nullopt`
+      //   `slots_.size() == dataset()->cycle_length_`
+      //   `next_file_index_ <= dataset()->filenames_.size()`
+      //   `round_begin_ < slots_.size()`
 
       absl::Mutex mu_;
-      size_t current_file_index_ ABSL_GUARDED_BY(mu_) = 0;
-      // `absl::nullopt` means not open yet.
-      absl::optional<RecordReader<tensorflow::FileReader<>>> reader_
-          ABSL_GUARDED_BY(mu_);
+      // `absl::nullopt` means an empty slot.
+      std::vector<absl::optional<Slot>> slots_ ABSL_GUARDED_BY(mu_);
+      // Index of the next file to assign to a slot.
+      size_t next_file_index_ ABSL_GUARDED_BY(mu_) = 0;
+      // Records read in the current round and not returned yet.
+      std::deque<QueuedRecord> queue_ ABSL_GUARDED_BY(mu_);
+      // If `first_block_length_ > 0`, which happens after restoring, the next
+      // round continues a round from the slot `round_begin_`, reading
+      // `first_block_length_` records from that slot.
+      size_t round_begin_ ABSL_GUARDED_BY(mu_) = 0;
+      size_t first_block_length_ ABSL_GUARDED_BY(mu_) = 0;
     };
 
     const std::vector<std::string> filenames_;
     const ::tensorflow::int64 buffer_size_;
+    const ::tensorflow::int64 batch_size_;
+    const ::tensorflow::int64 cycle_length_;
+    const std::vector<std::string> field_paths_;
+    const FieldProjection field_projection_;
+    const std::vector<::tensorflow::PartialTensorShape> output_shapes_;
   };
+
+  ::tensorflow::int64 batch_size_;
+  ::tensorflow::int64 cycle_length_;
+  std::vector<std::string> field_paths_;
+  FieldProjection field_projection_;
 };
 
 REGISTER_KERNEL_BUILDER(Name("RiegeliDataset").Device(::tensorflow::DEVICE_CPU),
@@ -23,6 +23,9 @@ REGISTER_OP("RiegeliDataset")
     .Input("filenames: string")
     .Input("buffer_size: int64")
     .Output("handle: variant")
+    .Attr("batch_size: int >= 0 = 0")
+    .Attr("cycle_length: int >= 1 = 1")
+    .Attr("field_projection: list(string) = []")
     .SetIsStateful()
     .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
       ::tensorflow::shape_inference::ShapeHandle unused;
@@ -38,6 +41,17 @@ Creates a dataset that emits the records from one or more Riegeli/records files.
 filenames: A scalar or vector containing the name(s) of the file(s) to be
   read.
 buffer_size: Tunes how much data is buffered after reading from the file.
+batch_size: If positive, elements are vectors of this many consecutive records,
+  except that the last one can be smaller. If 0, elements are single records.
+cycle_length: How many files are read concurrently. Blocks of
+  `max(batch_size, 1)` records are taken from the files in turn, as in
+  `interleave()`. If 1, files are read one after another.
+field_projection: If not empty, only these fields are included in records, and
+  other fields are removed. Each field is a path of field numbers separated by
+  '.', e.g. "1.3" for field 3 of the submessage in field 1. Field number 0
+  (`riegeli.EXISTENCE_ONLY`) at the end of a path includes only the existence
+  of the field, as an empty submessage. Projection is efficient if the files
+  were written with `transpose`: only the needed fields are decompressed.
 )doc");
 
 }  // namespace tensorflow
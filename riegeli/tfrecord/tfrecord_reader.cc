@@ -0,0 +1,226 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "riegeli/tfrecord/tfrecord_reader.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "crc32c/crc32c.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/object.h"
+#include "riegeli/base/status.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/endian/endian_reading.h"
+#include "riegeli/zlib/zlib_reader.h"
+
+namespace riegeli {
+
+namespace {
+
+constexpr size_t kHeaderSize = sizeof(uint64_t) + sizeof(uint32_t);
+constexpr size_t kFooterSize = sizeof(uint32_t);
+
+inline uint32_t MaskedCrc32c(absl::string_view data) {
+  const uint32_t crc = crc32c::Crc32c(data.data(), data.size());
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8;
+}
+
+// Returns `true` if `src` begins with a record header whose length CRC is
+// valid.
+inline bool HasValidHeader(const Reader& src) {
+  return src.available() >= kHeaderSize &&
+         MaskedCrc32c(absl::string_view(src.cursor(), sizeof(uint64_t))) ==
+             ReadLittleEndian32(src.cursor() + sizeof(uint64_t));
+}
+
+}  // namespace
+
+void TFRecordReaderBase::Initialize(Reader* src, Options&& options) {
+  RIEGELI_ASSERT(src != nullptr)
+      << "Failed precondition of TFRecordReader: null Reader pointer";
+  verify_crc_ = options.verify_crc();
+  max_record_size_ = options.max_record_size();
+  if (ABSL_PREDICT_FALSE(!src->healthy())) {
+    Fail(*src);
+    return;
+  }
+  compression_type_ = options.compression_type();
+  if (compression_type_ == CompressionType::kAuto) {
+    if (ABSL_PREDICT_FALSE(!src->Pull(kHeaderSize)) &&
+        ABSL_PREDICT_FALSE(!src->healthy())) {
+      Fail(*src);
+      return;
+    }
+    compression_type_ = CompressionType::kNone;
+    if (!HasValidHeader(*src) && src->available() >= 2) {
+      const uint8_t byte0 = static_cast<uint8_t>(src->cursor()[0]);
+      const uint8_t byte1 = static_cast<uint8_t>(src->cursor()[1]);
+      if (byte0 == 0x1f && byte1 == 0x8b) {
+        compression_type_ = CompressionType::kGzip;
+      } else if ((byte0 & 0x0f) == 8 && (byte0 >> 4) <= 7 &&
+                 (uint32_t{byte0} << 8 | byte1) % 31 == 0) {
+        compression_type_ = CompressionType::kZlib;
+      }
+    }
+  }
+  if (compression_type_ == CompressionType::kZlib ||
+      compression_type_ == CompressionType::kGzip) {
+    decompressor_.Reset(src, ZlibReaderBase::Options().set_header(
+                                 compression_type_ == CompressionType::kZlib
+                                     ? ZlibReaderBase::Header::kZlib
+                                     : ZlibReaderBase::Header::kGzip));
+  }
+}
+
+void TFRecordReaderBase::Done() {
+  if (compression_type_ == CompressionType::kZlib ||
+      compression_type_ == CompressionType::kGzip) {
+    if (ABSL_PREDICT_FALSE(!decompressor_.Close())) Fail(decompressor_);
+  }
+}
+
+bool TFRecordReaderBase::FailAtRecord(absl::Status status) {
+  RIEGELI_ASSERT(!status.ok())
+      << "Failed precondition of TFRecordReaderBase::FailAtRecord(): "
+         "status not failed";
+  return Fail(Annotate(status, absl::StrCat("at record ", record_index_)));
+}
+
+inline bool TFRecordReaderBase::ReadHeader(size_t& length) {
+  Reader& src = records_reader();
+  if (ABSL_PREDICT_FALSE(!src.Pull(kHeaderSize))) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+    if (ABSL_PREDICT_FALSE(src.available() > 0)) {
+      return FailAtRecord(absl::DataLossError("Truncated TFRecord header"));
+    }
+    return false;
+  }
+  if (verify_crc_ && ABSL_PREDICT_FALSE(!HasValidHeader(src))) {
+    return FailAtRecord(absl::DataLossError("Corrupted TFRecord length"));
+  }
+  const uint64_t length64 = ReadLittleEndian64(src.cursor());
+  if (ABSL_PREDICT_FALSE(length64 > max_record_size_ ||
+                         length64 > std::string().max_size() - kFooterSize)) {
+    return FailAtRecord(absl::ResourceExhaustedError(
+        absl::StrCat("TFRecord too large: ", length64)));
+  }
+  src.move_cursor(kHeaderSize);
+  length = IntCast<size_t>(length64);
+  return true;
+}
+
+inline bool TFRecordReaderBase::VerifyData(absl::string_view record,
+                                           uint32_t masked_crc) {
+  if (verify_crc_ && ABSL_PREDICT_FALSE(MaskedCrc32c(record) != masked_crc)) {
+    return FailAtRecord(absl::DataLossError("Corrupted TFRecord data"));
+  }
+  ++record_index_;
+  return true;
+}
+
+bool TFRecordReaderBase::ReadRecord(absl::string_view& record) {
+  if (ABSL_PREDICT_FALSE(!healthy())) {
+    record = absl::string_view();
+    return false;
+  }
+  size_t length;
+  if (ABSL_PREDICT_FALSE(!ReadHeader(length))) {
+    record = absl::string_view();
+    return false;
+  }
+  Reader& src = records_reader();
+  if (ABSL_PREDICT_FALSE(!src.Pull(length + kFooterSize))) {
+    record = absl::string_view();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+    return FailAtRecord(absl::DataLossError("Truncated TFRecord data"));
+  }
+  record = absl::string_view(src.cursor(), length);
+  const uint32_t masked_crc = ReadLittleEndian32(src.cursor() + length);
+  src.move_cursor(length + kFooterSize);
+  if (ABSL_PREDICT_FALSE(!VerifyData(record, masked_crc))) {
+    record = absl::string_view();
+    return false;
+  }
+  return true;
+}
+
+bool TFRecordReaderBase::ReadRecord(std::string& record) {
+  record.clear();
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  size_t length;
+  if (ABSL_PREDICT_FALSE(!ReadHeader(length))) return false;
+  Reader& src = records_reader();
+  if (ABSL_PREDICT_FALSE(!src.Read(length, record))) {
+    record.clear();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+    return FailAtRecord(absl::DataLossError("Truncated TFRecord data"));
+  }
+  const absl::optional<uint32_t> masked_crc = ReadLittleEndian32(src);
+  if (ABSL_PREDICT_FALSE(masked_crc == absl::nullopt)) {
+    record.clear();
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+    return FailAtRecord(absl::DataLossError("Truncated TFRecord CRC"));
+  }
+  if (ABSL_PREDICT_FALSE(!VerifyData(record, *masked_crc))) {
+    record.clear();
+    return false;
+  }
+  return true;
+}
+
+bool TFRecordReaderBase::ReadRecords(size_t max_size, TFRecordBatch& batch) {
+  batch.Clear();
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  Reader& src = records_reader();
+  do {
+    size_t length;
+    if (ABSL_PREDICT_FALSE(!ReadHeader(length))) {
+      return healthy() && !batch.empty();
+    }
+    const size_t begin = batch.data_.size();
+    if (ABSL_PREDICT_FALSE(length > batch.data_.max_size() - begin)) {
+      return FailAtRecord(absl::ResourceExhaustedError(
+          absl::StrCat("TFRecord batch too large: ", begin, " + ", length)));
+    }
+    if (ABSL_PREDICT_FALSE(!src.ReadAndAppend(length, batch.data_))) {
+      batch.data_.resize(begin);
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      return FailAtRecord(absl::DataLossError("Truncated TFRecord data"));
+    }
+    const absl::optional<uint32_t> masked_crc = ReadLittleEndian32(src);
+    if (ABSL_PREDICT_FALSE(masked_crc == absl::nullopt)) {
+      batch.data_.resize(begin);
+      if (ABSL_PREDICT_FALSE(!src.healthy())) return Fail(src);
+      return FailAtRecord(absl::DataLossError("Truncated TFRecord CRC"));
+    }
+    if (ABSL_PREDICT_FALSE(!VerifyData(
+            absl::string_view(batch.data_).substr(begin), *masked_crc))) {
+      batch.data_.resize(begin);
+      return false;
+    }
+    batch.limits_.push_back(batch.data_.size());
+  } while (batch.data_.size() < max_size);
+  return true;
+}
+
+}  // namespace riegeli
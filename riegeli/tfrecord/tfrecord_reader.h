@@ -0,0 +1,454 @@
+// Copyright 2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RIEGELI_TFRECORD_TFRECORD_READER_H_
+#define RIEGELI_TFRECORD_TFRECORD_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/base.h"
+#include "riegeli/base/dependency.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/reader.h"
+#include "riegeli/zlib/zlib_reader.h"
+
+namespace riegeli {
+
+class TFRecordReaderBase;
+
+// Records read by `TFRecordReaderBase::ReadRecords()`, stored contiguously so
+// that reading a batch does not allocate each record separately.
+class TFRecordBatch {
+ public:
+  TFRecordBatch() noexcept {}
+
+  TFRecordBatch(TFRecordBatch&& that) noexcept;
+  TFRecordBatch& operator=(TFRecordBatch&& that) noexcept;
+
+  // Removes all records, keeping allocated memory.
+  void Clear();
+
+  // Returns the number of records.
+  size_t size() const { return limits_.size(); }
+  bool empty() const { return limits_.empty(); }
+
+  // Returns the total size of records.
+  size_t data_size() const { return data_.size(); }
+
+  // Returns the record at `index`.
+  //
+  // Precondition: `index < size()`
+  absl::string_view operator[](size_t index) const;
+
+ private:
+  friend class TFRecordReaderBase;
+
+  std::string data_;
+  // For each record, the position in `data_` after the record.
+  std::vector<size_t> limits_;
+};
+
+// Template parameter independent part of `TFRecordReader`.
+class TFRecordReaderBase : public Object {
+ public:
+  // Compression of a TFRecord file.
+  enum class CompressionType {
+    // Detected from the beginning of the file: a valid uncompressed record
+    // header, or a zlib or gzip header.
+    kAuto,
+    kNone,
+    kZlib,
+    kGzip,
+  };
+
+  class Options {
+   public:
+    Options() noexcept {}
+
+    // Compression of the file.
+    //
+    // Default: `CompressionType::kAuto`
+    Options& set_compression_type(CompressionType compression_type) & {
+      compression_type_ = compression_type;
+      return *this;
+    }
+    Options&& set_compression_type(CompressionType compression_type) && {
+      return std::move(set_compression_type(compression_type));
+    }
+    CompressionType compression_type() const { return compression_type_; }
+
+    // If `false`, CRCs of record lengths and data are not verified. This
+    // makes reading faster, but corruption of a record length is detected only
+    // if it makes the file appear truncated.
+    //
+    // Default: `true`
+    Options& set_verify_crc(bool verify_crc) & {
+      verify_crc_ = verify_crc;
+      return *this;
+    }
+    Options&& set_verify_crc(bool verify_crc) && {
+      return std::move(set_verify_crc(verify_crc));
+    }
+    bool verify_crc() const { return verify_crc_; }
+
+    // Maximum size of a record. A larger record length fails the reader
+    // instead of allocating memory for the record.
+    //
+    // Default: no limit
+    Options& set_max_record_size(uint64_t max_record_size) & {
+      max_record_size_ = max_record_size;
+      return *this;
+    }
+    Options&& set_max_record_size(uint64_t max_record_size) && {
+      return std::move(set_max_record_size(max_record_size));
+    }
+    uint64_t max_record_size() const { return max_record_size_; }
+
+   private:
+    CompressionType compression_type_ = CompressionType::kAuto;
+    bool verify_crc_ = true;
+    uint64_t max_record_size_ = std::numeric_limits<uint64_t>::max();
+  };
+
+  // Returns the byte `Reader` being read from. Unchanged by `Close()`.
+  virtual Reader* src_reader() = 0;
+  virtual const Reader* src_reader() const = 0;
+
+  // Returns the compression of the file, after `CompressionType::kAuto` is
+  // resolved. `CompressionType::kAuto` if not detected yet.
+  CompressionType compression_type() const { return compression_type_; }
+
+  // Reads the next record.
+  //
+  // `ReadRecord(absl::string_view&)` points `record` to the buffer of the byte
+  // `Reader` or of the decompressor, which is enlarged if needed. The record
+  // is valid until the next non-const operation on the `TFRecordReader`.
+  //
+  // Return values:
+  //  * `true`                      - success (`record` is set)
+  //  * `false` (when `healthy()`)  - source ends (`record` is empty)
+  //  * `false` (when `!healthy()`) - failure (`record` is empty)
+  bool ReadRecord(absl::string_view& record);
+  bool ReadRecord(std::string& record);
+
+  // Reads next records into `batch`, at least one record and until their total
+  // size reaches `max_size` or the source ends. Existing records of `batch`
+  // are removed.
+  //
+  // Return values:
+  //  * `true`                      - success (`batch` has at least one record)
+  //  * `false` (when `healthy()`)  - source ends (`batch` is empty)
+  //  * `false` (when `!healthy()`) - failure (`batch` has records read before
+  //                                  the failure)
+  bool ReadRecords(size_t max_size, TFRecordBatch& batch);
+
+  // The index of the next record, starting from 0.
+  //
+  // `record_index()` is unchanged by `Close()`.
+  uint64_t record_index() const { return record_index_; }
+
+ protected:
+  explicit TFRecordReaderBase(InitiallyClosed) noexcept
+      : Object(kInitiallyClosed) {}
+  explicit TFRecordReaderBase(InitiallyOpen) noexcept
+      : Object(kInitiallyOpen) {}
+
+  TFRecordReaderBase(TFRecordReaderBase&& that) noexcept;
+  TFRecordReaderBase& operator=(TFRecordReaderBase&& that) noexcept;
+
+  void Reset(InitiallyClosed);
+  void Reset(InitiallyOpen);
+  void Initialize(Reader* src, Options&& options);
+  // Points the decompressor to `src` after the byte `Reader` moved.
+  void MoveSrc(Reader* src);
+  void Done() override;
+
+ private:
+  // Fails, annotating `status` with `record_index()`.
+  ABSL_ATTRIBUTE_COLD bool FailAtRecord(absl::Status status);
+
+  // Returns the `Reader` of uncompressed records.
+  Reader& records_reader();
+
+  // Reads the length of the next record and verifies its CRC.
+  //
+  // Return values:
+  //  * `true`                      - success (`length` is set)
+  //  * `false` (when `healthy()`)  - source ends
+  //  * `false` (when `!healthy()`) - failure
+  bool ReadHeader(size_t& length);
+  // Verifies the data CRC of `record`, given its stored `masked_crc`.
+  bool VerifyData(absl::string_view record, uint32_t masked_crc);
+
+  CompressionType compression_type_ = CompressionType::kAuto;
+  bool verify_crc_ = true;
+  uint64_t max_record_size_ = std::numeric_limits<uint64_t>::max();
+  // Used if `compression_type_` is `kZlib` or `kGzip`.
+  ZlibReader<Reader*> decompressor_;
+  uint64_t record_index_ = 0;
+};
+
+// A `TFRecordReader` reads records of a TFRecord file, the file format of
+// TensorFlow's `tensorflow::io::RecordReader`, without depending on
+// TensorFlow.
+//
+// Each record is a little endian 64-bit length, a masked CRC32C of the length,
+// the data, and a masked CRC32C of the data. The file is optionally compressed
+// with zlib or gzip as a whole.
+//
+// CRC32C uses hardware instructions when available.
+//
+// The `Src` template parameter specifies the type of the object providing and
+// possibly owning the byte `Reader`. `Src` must support
+// `Dependency<Reader*, Src>`, e.g. `Reader*` (not owned, default),
+// `std::unique_ptr<Reader>` (owned), `FdReader<>` (owned).
+//
+// By relying on CTAD the template argument can be deduced as the value type of
+// the first constructor argument. This requires C++17.
+//
+// For an uncompressed file, the current position is synchronized with the byte
+// `Reader` between records.
+template <typename Src = Reader*>
+class TFRecordReader : public TFRecordReaderBase {
+ public:
+  // Creates a closed `TFRecordReader`.
+  TFRecordReader() noexcept : TFRecordReaderBase(kInitiallyClosed) {}
+
+  // Will read from the byte `Reader` provided by `src`.
+  explicit TFRecordReader(const Src& src, Options options = Options());
+  explicit TFRecordReader(Src&& src, Options options = Options());
+
+  // Will read from the byte `Reader` provided by a `Src` constructed from
+  // elements of `src_args`. This avoids constructing a temporary `Src` and
+  // moving from it.
+  template <typename... SrcArgs>
+  explicit TFRecordReader(std::tuple<SrcArgs...> src_args,
+                          Options options = Options());
+
+  TFRecordReader(TFRecordReader&& that) noexcept;
+  TFRecordReader& operator=(TFRecordReader&& that) noexcept;
+
+  // Makes `*this` equivalent to a newly constructed `TFRecordReader`. This
+  // avoids constructing a temporary `TFRecordReader` and moving from it.
+  void Reset();
+  void Reset(const Src& src, Options options = Options());
+  void Reset(Src&& src, Options options = Options());
+  template <typename... SrcArgs>
+  void Reset(std::tuple<SrcArgs...> src_args, Options options = Options());
+
+  // Returns the object providing and possibly owning the byte `Reader`.
+  // Unchanged by `Close()`.
+  Src& src() { return src_.manager(); }
+  const Src& src() const { return src_.manager(); }
+  Reader* src_reader() override { return src_.get(); }
+  const Reader* src_reader() const override { return src_.get(); }
+
+ protected:
+  void Done() override;
+
+ private:
+  // The object providing and possibly owning the byte `Reader`.
+  Dependency<Reader*, Src> src_;
+};
+
+// Support CTAD.
+#if __cpp_deduction_guides
+TFRecordReader()->TFRecordReader<DeleteCtad<>>;
+template <typename Src>
+explicit TFRecordReader(const Src& src, TFRecordReaderBase::Options options =
+                                            TFRecordReaderBase::Options())
+    -> TFRecordReader<std::decay_t<Src>>;
+template <typename Src>
+explicit TFRecordReader(Src&& src, TFRecordReaderBase::Options options =
+                                       TFRecordReaderBase::Options())
+    -> TFRecordReader<std::decay_t<Src>>;
+template <typename... SrcArgs>
+explicit TFRecordReader(
+    std::tuple<SrcArgs...> src_args,
+    TFRecordReaderBase::Options options = TFRecordReaderBase::Options())
+    -> TFRecordReader<DeleteCtad<std::tuple<SrcArgs...>>>;
+#endif
+
+// Implementation details follow.
+
+inline TFRecordBatch::TFRecordBatch(TFRecordBatch&& that) noexcept
+    : data_(std::move(that.data_)), limits_(std::move(that.limits_)) {}
+
+inline TFRecordBatch& TFRecordBatch::operator=(TFRecordBatch&& that) noexcept {
+  data_ = std::move(that.data_);
+  limits_ = std::move(that.limits_);
+  return *this;
+}
+
+inline void TFRecordBatch::Clear() {
+  data_.clear();
+  limits_.clear();
+}
+
+inline absl::string_view TFRecordBatch::operator[](size_t index) const {
+  RIEGELI_ASSERT_LT(index, limits_.size())
+      << "Failed precondition of TFRecordBatch::operator[]: "
+         "index out of range";
+  const size_t begin = index == 0 ? 0 : limits_[index - 1];
+  return absl::string_view(data_.data() + begin, limits_[index] - begin);
+}
+
+inline TFRecordReaderBase::TFRecordReaderBase(
+    TFRecordReaderBase&& that) noexcept
+    : Object(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      compression_type_(that.compression_type_),
+      verify_crc_(that.verify_crc_),
+      max_record_size_(that.max_record_size_),
+      decompressor_(std::move(that.decompressor_)),
+      record_index_(std::exchange(that.record_index_, 0)) {}
+
+inline TFRecordReaderBase& TFRecordReaderBase::operator=(
+    TFRecordReaderBase&& that) noexcept {
+  Object::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  compression_type_ = that.compression_type_;
+  verify_crc_ = that.verify_crc_;
+  max_record_size_ = that.max_record_size_;
+  decompressor_ = std::move(that.decompressor_);
+  record_index_ = std::exchange(that.record_index_, 0);
+  return *this;
+}
+
+inline void TFRecordReaderBase::Reset(InitiallyClosed) {
+  Object::Reset(kInitiallyClosed);
+  compression_type_ = CompressionType::kAuto;
+  verify_crc_ = true;
+  max_record_size_ = std::numeric_limits<uint64_t>::max();
+  decompressor_.Reset();
+  record_index_ = 0;
+}
+
+inline void TFRecordReaderBase::Reset(InitiallyOpen) {
+  Object::Reset(kInitiallyOpen);
+  compression_type_ = CompressionType::kAuto;
+  verify_crc_ = true;
+  max_record_size_ = std::numeric_limits<uint64_t>::max();
+  decompressor_.Reset();
+  record_index_ = 0;
+}
+
+inline void TFRecordReaderBase::MoveSrc(Reader* src) {
+  if (compression_type_ == CompressionType::kZlib ||
+      compression_type_ == CompressionType::kGzip) {
+    decompressor_.src() = src;
+  }
+}
+
+inline Reader& TFRecordReaderBase::records_reader() {
+  if (compression_type_ == CompressionType::kZlib ||
+      compression_type_ == CompressionType::kGzip) {
+    return decompressor_;
+  }
+  return *src_reader();
+}
+
+template <typename Src>
+inline TFRecordReader<Src>::TFRecordReader(const Src& src, Options options)
+    : TFRecordReaderBase(kInitiallyOpen), src_(src) {
+  Initialize(src_.get(), std::move(options));
+}
+
+template <typename Src>
+inline TFRecordReader<Src>::TFRecordReader(Src&& src, Options options)
+    : TFRecordReaderBase(kInitiallyOpen), src_(std::move(src)) {
+  Initialize(src_.get(), std::move(options));
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline TFRecordReader<Src>::TFRecordReader(std::tuple<SrcArgs...> src_args,
+                                           Options options)
+    : TFRecordReaderBase(kInitiallyOpen), src_(std::move(src_args)) {
+  Initialize(src_.get(), std::move(options));
+}
+
+template <typename Src>
+inline TFRecordReader<Src>::TFRecordReader(TFRecordReader&& that) noexcept
+    : TFRecordReaderBase(std::move(that)),
+      // Using `that` after it was moved is correct because only the base class
+      // part was moved.
+      src_(std::move(that.src_)) {
+  MoveSrc(src_.get());
+}
+
+template <typename Src>
+inline TFRecordReader<Src>& TFRecordReader<Src>::operator=(
+    TFRecordReader&& that) noexcept {
+  TFRecordReaderBase::operator=(std::move(that));
+  // Using `that` after it was moved is correct because only the base class part
+  // was moved.
+  src_ = std::move(that.src_);
+  MoveSrc(src_.get());
+  return *this;
+}
+
+template <typename Src>
+inline void TFRecordReader<Src>::Reset() {
+  TFRecordReaderBase::Reset(kInitiallyClosed);
+  src_.Reset();
+}
+
+template <typename Src>
+inline void TFRecordReader<Src>::Reset(const Src& src, Options options) {
+  TFRecordReaderBase::Reset(kInitiallyOpen);
+  src_.Reset(src);
+  Initialize(src_.get(), std::move(options));
+}
+
+template <typename Src>
+inline void TFRecordReader<Src>::Reset(Src&& src, Options options) {
+  TFRecordReaderBase::Reset(kInitiallyOpen);
+  src_.Reset(std::move(src));
+  Initialize(src_.get(), std::move(options));
+}
+
+template <typename Src>
+template <typename... SrcArgs>
+inline void TFRecordReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
+                                       Options options) {
+  TFRecordReaderBase::Reset(kInitiallyOpen);
+  src_.Reset(std::move(src_args));
+  Initialize(src_.get(), std::move(options));
+}
+
+template <typename Src>
+void TFRecordReader<Src>::Done() {
+  TFRecordReaderBase::Done();
+  if (src_.is_owning()) {
+    if (ABSL_PREDICT_FALSE(!src_->Close())) Fail(*src_);
+  }
+}
+
+}  // namespace riegeli
+
+#endif  // RIEGELI_TFRECORD_TFRECORD_READER_H_
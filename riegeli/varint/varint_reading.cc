@@ -20,8 +20,69 @@
 #include "absl/base/optimization.h"
 #include "absl/types/optional.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/endian/endian_reading.h"
 
 namespace riegeli {
+
+namespace {
+
+// Decodes varints from `src` to `dest` while at least 8 bytes are available
+// and the next varint is not longer than 8 bytes, decrementing `num_values`.
+// Returns the pointer to remaining data.
+//
+// A varint of up to 8 bytes cannot overflow, so it is decoded by masking its
+// bytes in a 64-bit word and compacting their 7-bit groups with a few shifts.
+inline const char* ReadVarints64Fast(const char* src, const char* limit,
+                                     size_t& num_values, uint64_t*& dest) {
+  while (num_values > 0 && PtrDistance(src, limit) >= sizeof(uint64_t)) {
+    const uint64_t word = ReadLittleEndian64(src);
+    const size_t length = internal::ShortVarintLength(word);
+    if (ABSL_PREDICT_FALSE(length == 0)) break;
+    uint64_t value = word & (~uint64_t{0} >> (64 - length * 8)) &
+                     uint64_t{0x7f7f7f7f7f7f7f7f};
+    value = (value & uint64_t{0x007f007f007f007f}) |
+            ((value & uint64_t{0x7f007f007f007f00}) >> 1);
+    value = (value & uint64_t{0x00003fff00003fff}) |
+            ((value & uint64_t{0x3fff00003fff0000}) >> 2);
+    value = (value & uint64_t{0x000000000fffffff}) |
+            ((value & uint64_t{0x0fffffff00000000}) >> 4);
+    *dest++ = value;
+    --num_values;
+    src += length;
+  }
+  return src;
+}
+
+}  // namespace
+
+bool ReadVarints64(Reader& src, size_t num_values, uint64_t* dest) {
+  for (;;) {
+    src.set_cursor(
+        ReadVarints64Fast(src.cursor(), src.limit(), num_values, dest));
+    if (num_values == 0) return true;
+    // Fewer than 8 bytes are buffered, or the next varint is longer.
+    const absl::optional<uint64_t> value = ReadVarint64(src);
+    if (ABSL_PREDICT_FALSE(value == absl::nullopt)) return false;
+    *dest++ = *value;
+    --num_values;
+  }
+}
+
+absl::optional<const char*> ReadVarints64(const char* src, const char* limit,
+                                          size_t num_values, uint64_t* dest) {
+  for (;;) {
+    src = ReadVarints64Fast(src, limit, num_values, dest);
+    if (num_values == 0) return src;
+    // Fewer than 8 bytes remain, or the next varint is longer.
+    const absl::optional<ReadFromStringResult<uint64_t>> result =
+        ReadVarint64(src, limit);
+    if (ABSL_PREDICT_FALSE(result == absl::nullopt)) return absl::nullopt;
+    *dest++ = result->value;
+    --num_values;
+    src = result->cursor;
+  }
+}
+
 namespace internal {
 
 absl::optional<ReadFromStringResult<uint64_t>> ReadVarint64Slow(
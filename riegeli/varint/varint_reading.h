@@ -82,6 +82,23 @@ absl::optional<ReadFromStringResult<uint32_t>> ReadVarint32(const char* src,
 absl::optional<ReadFromStringResult<uint64_t>> ReadVarint64(const char* src,
                                                             const char* limit);
 
+// Reads `num_values` consecutive varints to `dest[]`.
+//
+// This is faster than `ReadVarint64()` called in a loop, because varints of up
+// to 8 bytes are decoded from a whole 64-bit word without testing each byte.
+//
+// Return values:
+//  * `true`  - success
+//  * `false` - failure; values read before the failure are stored in `dest[]`
+//              and the current position is after them
+bool ReadVarints64(Reader& src, size_t num_values, uint64_t* dest);
+
+// Reads `num_values` consecutive varints from an array to `dest[]`.
+//
+// Returns the pointer to remaining data, or `absl::nullopt` on failure.
+absl::optional<const char*> ReadVarints64(const char* src, const char* limit,
+                                          size_t num_values, uint64_t* dest);
+
 // Copies a varint to an array.
 //
 // Writes up to `kMaxLengthVarint{32,64}` bytes to `dest[]`.
@@ -244,6 +261,23 @@ inline absl::optional<ReadFromStringResult<uint32_t>> ReadVarint32(
 
 namespace internal {
 
+// Returns the length of the varint whose first 8 bytes are `word` read in
+// little endian order, if the length is at most 8, otherwise returns 0.
+//
+// This finds the first byte without the continuation bit without testing the
+// bytes one by one.
+inline size_t ShortVarintLength(uint64_t word) {
+  // The high bit of each byte which ends a varint.
+  const uint64_t ends = ~word & uint64_t{0x8080808080808080};
+  if (ends == 0) return 0;
+  // Bits of bytes up to and including the first byte ending a varint. This is
+  // correct also if the varint has 8 bytes, because the shift wraps to 0.
+  const uint64_t mask = ((ends & (~ends + 1)) << 1) - 1;
+  // The number of bytes covered by `mask`, summed in the highest byte.
+  constexpr uint64_t kLowBits = 0x0101010101010101;
+  return IntCast<size_t>(((mask & kLowBits) * kLowBits) >> 56);
+}
+
 constexpr size_t kReadVarint64SlowThreshold = 5 * 7;
 
 absl::optional<ReadFromStringResult<uint64_t>> ReadVarint64Slow(
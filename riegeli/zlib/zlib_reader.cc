@@ -67,6 +67,19 @@ void ZlibReaderBase::Initialize(Reader* src, int window_bits) {
                         zlib_code);
         }
       });
+  if (window_bits < 0 && !dictionary_.empty()) {
+    // Raw data do not request the dictionary with `Z_NEED_DICT`, it must be
+    // set upfront.
+    const int zlib_code = inflateSetDictionary(
+        decompressor_.get(),
+        const_cast<z_const Bytef*>(
+            reinterpret_cast<const Bytef*>(dictionary_.data().data())),
+        SaturatingIntCast<uInt>(dictionary_.data().size()));
+    if (ABSL_PREDICT_FALSE(zlib_code != Z_OK)) {
+      FailOperation(absl::StatusCode::kInternal, "inflateSetDictionary()",
+                    zlib_code);
+    }
+  }
 }
 
 void ZlibReaderBase::Done() {
@@ -124,6 +137,10 @@ inline bool ZlibReaderBase::FailOperation(absl::StatusCode code,
                        absl::StrCat("at byte ", src.pos())));
 }
 
+RecyclingPoolStats ZlibReaderBase::decompressor_pool_stats() {
+  return RecyclingPool<z_stream, ZStreamDeleter>::global().stats();
+}
+
 bool ZlibReaderBase::Fail(absl::Status status) {
   RIEGELI_ASSERT(!status.ok())
       << "Failed precondition of Object::Fail(): status not failed";
@@ -80,6 +80,7 @@ class ZlibReaderBase : public BufferedReader {
                "ZlibReaderBase::Options::set_window_log(): "
                "window log out of range";
       }
+      window_log_ = window_log;
       return *this;
     }
     Options&& set_window_log(absl::optional<int> window_log) && {
@@ -189,6 +190,11 @@ class ZlibReaderBase : public BufferedReader {
   using BufferedReader::Fail;
   ABSL_ATTRIBUTE_COLD bool Fail(absl::Status status) override;
 
+  // Returns statistics of the pool of zlib decompression streams which are
+  // shared by all `ZlibReader` objects, so that consecutive readers reset an
+  // existing stream instead of allocating a new one.
+  static RecyclingPoolStats decompressor_pool_stats();
+
   // Returns `true` if the source is truncated (without a clean end of the
   // compressed stream) at the current position. In such case, if the source
   // does not grow, `Close()` will fail.
@@ -15,20 +15,26 @@
 #include "riegeli/zlib/zlib_writer.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <atomic>
 #include <limits>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/endian/endian_writing.h"
 #include "zconf.h"
 #include "zlib.h"
 
@@ -45,16 +51,79 @@ constexpr int ZlibWriterBase::Options::kMinWindowLog;
 constexpr int ZlibWriterBase::Options::kMaxWindowLog;
 constexpr int ZlibWriterBase::Options::kDefaultWindowLog;
 constexpr ZlibWriterBase::Header ZlibWriterBase::Options::kDefaultHeader;
+constexpr size_t ZlibWriterBase::Options::kParallelBlockSize;
 #endif
 
-void ZlibWriterBase::Initialize(Writer* dest, int compression_level,
-                                int window_bits) {
+namespace {
+
+// Returns a message describing a failure of a Zlib `operation`.
+std::string ZlibErrorMessage(absl::string_view operation, const char* details,
+                             int zlib_code) {
+  std::string message = absl::StrCat(operation, " failed");
+  if (details == nullptr) {
+    switch (zlib_code) {
+      case Z_STREAM_END:
+        details = "stream end";
+        break;
+      case Z_NEED_DICT:
+        details = "need dictionary";
+        break;
+      case Z_ERRNO:
+        details = "file error";
+        break;
+      case Z_STREAM_ERROR:
+        details = "stream error";
+        break;
+      case Z_DATA_ERROR:
+        details = "data error";
+        break;
+      case Z_MEM_ERROR:
+        details = "insufficient memory";
+        break;
+      case Z_BUF_ERROR:
+        details = "buffer error";
+        break;
+      case Z_VERSION_ERROR:
+        details = "incompatible version";
+        break;
+    }
+  }
+  if (details != nullptr) absl::StrAppend(&message, ": ", details);
+  return message;
+}
+
+}  // namespace
+
+void ZlibWriterBase::Initialize(Writer* dest, const Options& options) {
   RIEGELI_ASSERT(dest != nullptr)
       << "Failed precondition of ZlibWriter: null Writer pointer";
   if (ABSL_PREDICT_FALSE(!dest->healthy())) {
     Fail(*dest);
     return;
   }
+  const int compression_level = options.compression_level();
+  if (parallelism_ > 1) {
+    compression_level_ = compression_level;
+    window_log_ = options.window_log();
+    header_ = options.header();
+    if (ABSL_PREDICT_FALSE(header_ == Header::kGzip && !dictionary_.empty())) {
+      // Like `deflateSetDictionary()` for a gzip stream.
+      Fail(absl::InternalError(ZlibErrorMessage("deflateSetDictionary()",
+                                                nullptr, Z_STREAM_ERROR)));
+      return;
+    }
+    const size_t window_size = size_t{1} << window_log_;
+    const absl::string_view dictionary = dictionary_.data();
+    history_.assign(dictionary.data() +
+                        (dictionary.size() - UnsignedMin(dictionary.size(),
+                                                         window_size)),
+                    UnsignedMin(dictionary.size(), window_size));
+    check_ = header_ == Header::kGzip ? crc32(0, nullptr, 0)
+                                      : adler32(0, nullptr, 0);
+    WriteParallelHeader(*dest);
+    return;
+  }
+  const int window_bits = GetWindowBits(options);
   // Do not reduce `window_log` based on `size_hint`. An unexpected reduction
   // of `window_log` would break concatenation of compressed streams, because
   // Zlib decompressor rejects `window_log` in a subsequent header greater than
@@ -95,7 +164,11 @@ void ZlibWriterBase::Done() {
     Writer& dest = *dest_writer();
     const absl::string_view data(start(), written_to_buffer());
     set_buffer();
-    WriteInternal(data, dest, Z_FINISH);
+    if (parallelism_ > 1) {
+      if (WriteInParallel(data, dest)) WriteParallelTrailer(dest);
+    } else {
+      WriteInternal(data, dest, Z_FINISH);
+    }
   }
   compressor_.reset();
   BufferedWriter::Done();
@@ -107,41 +180,16 @@ inline bool ZlibWriterBase::FailOperation(absl::string_view operation,
       << "Failed precondition of ZlibWriterBase::FailOperation(): "
          "Object closed";
   Writer& dest = *dest_writer();
-  std::string message = absl::StrCat(operation, " failed");
-  const char* details = compressor_->msg;
-  if (details == nullptr) {
-    switch (zlib_code) {
-      case Z_STREAM_END:
-        details = "stream end";
-        break;
-      case Z_NEED_DICT:
-        details = "need dictionary";
-        break;
-      case Z_ERRNO:
-        details = "file error";
-        break;
-      case Z_STREAM_ERROR:
-        details = "stream error";
-        break;
-      case Z_DATA_ERROR:
-        details = "data error";
-        break;
-      case Z_MEM_ERROR:
-        details = "insufficient memory";
-        break;
-      case Z_BUF_ERROR:
-        details = "buffer error";
-        break;
-      case Z_VERSION_ERROR:
-        details = "incompatible version";
-        break;
-    }
-  }
-  if (details != nullptr) absl::StrAppend(&message, ": ", details);
-  return Fail(Annotate(absl::InternalError(message),
+  return Fail(Annotate(absl::InternalError(ZlibErrorMessage(
+                           operation, compressor_->msg, zlib_code)),
                        absl::StrCat("at byte ", dest.pos())));
 }
 
+RecyclingPoolStats ZlibWriterBase::compressor_pool_stats() {
+  return KeyedRecyclingPool<z_stream, ZStreamKey, ZStreamDeleter>::global()
+      .stats();
+}
+
 bool ZlibWriterBase::Fail(absl::Status status) {
   RIEGELI_ASSERT(!status.ok())
       << "Failed precondition of Object::Fail(): status not failed";
@@ -159,6 +207,7 @@ bool ZlibWriterBase::WriteInternal(absl::string_view src) {
       << "Failed precondition of BufferedWriter::WriteInternal(): "
          "buffer not empty";
   Writer& dest = *dest_writer();
+  if (parallelism_ > 1) return WriteInParallel(src, dest);
   return WriteInternal(src, dest, Z_NO_FLUSH);
 }
 
@@ -222,7 +271,254 @@ bool ZlibWriterBase::FlushInternal() {
   Writer& dest = *dest_writer();
   const absl::string_view data(start(), written_to_buffer());
   set_buffer();
+  if (parallelism_ > 1) return WriteInParallel(data, dest);
   return WriteInternal(data, dest, Z_SYNC_FLUSH);
 }
 
+bool ZlibWriterBase::WriteParallelHeader(Writer& dest) {
+  // Write the same header as `deflate()` would, as the header depends on
+  // parameters not visible in the joined raw data.
+  switch (header_) {
+    case Header::kRaw:
+      return true;
+    case Header::kZlib: {
+      const uint32_t level_flags =
+          compression_level_ < 2   ? 0
+          : compression_level_ < 6 ? 1
+          : compression_level_ == 6 ? 2
+                                    : 3;
+      uint32_t header =
+          IntCast<uint32_t>((Z_DEFLATED + ((window_log_ - 8) << 4)) << 8) |
+          (level_flags << 6);
+      if (!dictionary_.empty()) header |= 0x20;  // `PRESET_DICT`
+      header += 31 - header % 31;
+      if (ABSL_PREDICT_FALSE(
+              !WriteBigEndian16(IntCast<uint16_t>(header), dest))) {
+        return Fail(dest);
+      }
+      if (!dictionary_.empty()) {
+        const uLong dictionary_id = adler32(
+            adler32(0, nullptr, 0),
+            reinterpret_cast<const Bytef*>(dictionary_.data().data()),
+            IntCast<uInt>(dictionary_.data().size()));
+        if (ABSL_PREDICT_FALSE(!WriteBigEndian32(
+                IntCast<uint32_t>(dictionary_id), dest))) {
+          return Fail(dest);
+        }
+      }
+      return true;
+    }
+    case Header::kGzip: {
+      // Magic, `Z_DEFLATED`, no flags, no modification time, extra flags, and
+      // Unix as the operating system.
+      const char header[10] = {
+          '\x1f',
+          '\x8b',
+          Z_DEFLATED,
+          0,
+          0,
+          0,
+          0,
+          0,
+          static_cast<char>(compression_level_ == 9  ? 2
+                            : compression_level_ < 2 ? 4
+                                                     : 0),
+          3};
+      if (ABSL_PREDICT_FALSE(
+              !dest.Write(absl::string_view(header, sizeof(header))))) {
+        return Fail(dest);
+      }
+      return true;
+    }
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown header: " << static_cast<int>(header_);
+}
+
+bool ZlibWriterBase::WriteInParallel(absl::string_view src, Writer& dest) {
+  RIEGELI_ASSERT(healthy())
+      << "Failed precondition of ZlibWriterBase::WriteInParallel(): "
+      << status();
+  RIEGELI_ASSERT_EQ(written_to_buffer(), 0u)
+      << "Failed precondition of ZlibWriterBase::WriteInParallel(): "
+         "buffer not empty";
+  if (ABSL_PREDICT_FALSE(src.size() >
+                         std::numeric_limits<Position>::max() - start_pos())) {
+    return FailOverflow();
+  }
+  const size_t window_size = size_t{1} << window_log_;
+  const size_t batch_size =
+      IntCast<size_t>(parallelism_) * Options::kParallelBlockSize;
+  std::vector<std::string> compressed_blocks;
+  std::vector<uLong> block_checks;
+  std::vector<absl::Status> block_statuses;
+  while (!src.empty()) {
+    const absl::string_view batch = src.substr(0, batch_size);
+    src.remove_prefix(batch.size());
+    const size_t num_blocks =
+        (batch.size() + Options::kParallelBlockSize - 1) /
+        Options::kParallelBlockSize;
+    compressed_blocks.resize(num_blocks);
+    block_checks.assign(num_blocks, 0);
+    block_statuses.assign(num_blocks, absl::OkStatus());
+    std::atomic<size_t> next_block(0);
+    const auto compress_blocks = [&] {
+      for (;;) {
+        const size_t block = next_block.fetch_add(1);
+        if (block >= num_blocks) return;
+        const size_t block_begin = block * Options::kParallelBlockSize;
+        const absl::string_view block_data =
+            batch.substr(block_begin, Options::kParallelBlockSize);
+        // Blocks are larger than the window, so only the first block of the
+        // batch needs `history_`.
+        const absl::string_view dictionary =
+            block == 0 ? absl::string_view(history_)
+                       : batch.substr(block_begin - window_size, window_size);
+        block_statuses[block] =
+            CompressBlock(compression_level_, window_log_, dictionary,
+                          block_data, compressed_blocks[block]);
+        const Bytef* const data =
+            reinterpret_cast<const Bytef*>(block_data.data());
+        const uInt length = IntCast<uInt>(block_data.size());
+        block_checks[block] = header_ == Header::kGzip
+                                  ? crc32(crc32(0, nullptr, 0), data, length)
+                                  : adler32(adler32(0, nullptr, 0), data,
+                                            length);
+      }
+    };
+    const size_t num_tasks =
+        UnsignedMin(IntCast<size_t>(parallelism_), num_blocks);
+    absl::BlockingCounter background_tasks(IntCast<int>(num_tasks - 1));
+    for (size_t task = 1; task < num_tasks; ++task) {
+      ThreadPool::global().Schedule([&compress_blocks, &background_tasks] {
+        compress_blocks();
+        background_tasks.DecrementCount();
+      });
+    }
+    compress_blocks();
+    background_tasks.Wait();
+
+    for (size_t block = 0; block < num_blocks; ++block) {
+      if (ABSL_PREDICT_FALSE(!block_statuses[block].ok())) {
+        return Fail(Annotate(block_statuses[block],
+                             absl::StrCat("at byte ", dest.pos())));
+      }
+      if (ABSL_PREDICT_FALSE(!dest.Write(compressed_blocks[block]))) {
+        return Fail(dest);
+      }
+      const size_t block_length = UnsignedMin(
+          batch.size() - block * Options::kParallelBlockSize,
+          Options::kParallelBlockSize);
+      const z_off_t combine_length = IntCast<z_off_t>(block_length);
+      check_ = header_ == Header::kGzip
+                   ? crc32_combine(check_, block_checks[block], combine_length)
+                   : adler32_combine(check_, block_checks[block],
+                                     combine_length);
+    }
+    if (batch.size() >= window_size) {
+      history_.assign(batch.data() + batch.size() - window_size, window_size);
+    } else {
+      history_.append(batch.data(), batch.size());
+      if (history_.size() > window_size) {
+        history_.erase(0, history_.size() - window_size);
+      }
+    }
+    move_start_pos(batch.size());
+  }
+  return true;
+}
+
+bool ZlibWriterBase::WriteParallelTrailer(Writer& dest) {
+  // An empty final block with fixed Huffman codes ends the joined data, which
+  // consist of blocks ending with sync flushes.
+  if (ABSL_PREDICT_FALSE(!dest.Write(absl::string_view("\x03\x00", 2)))) {
+    return Fail(dest);
+  }
+  switch (header_) {
+    case Header::kRaw:
+      return true;
+    case Header::kZlib:
+      if (ABSL_PREDICT_FALSE(
+              !WriteBigEndian32(IntCast<uint32_t>(check_), dest))) {
+        return Fail(dest);
+      }
+      return true;
+    case Header::kGzip:
+      if (ABSL_PREDICT_FALSE(
+              !WriteLittleEndian32(IntCast<uint32_t>(check_), dest) ||
+              !WriteLittleEndian32(static_cast<uint32_t>(start_pos()),
+                                   dest))) {
+        return Fail(dest);
+      }
+      return true;
+  }
+  RIEGELI_ASSERT_UNREACHABLE()
+      << "Unknown header: " << static_cast<int>(header_);
+}
+
+absl::Status ZlibWriterBase::CompressBlock(int compression_level,
+                                           int window_log,
+                                           absl::string_view dictionary,
+                                           absl::string_view src,
+                                           std::string& dest) {
+  absl::Status status;
+  KeyedRecyclingPool<z_stream, ZStreamKey, ZStreamDeleter>::Handle compressor =
+      KeyedRecyclingPool<z_stream, ZStreamKey, ZStreamDeleter>::global().Get(
+          ZStreamKey{compression_level, -window_log},
+          [&] {
+            std::unique_ptr<z_stream, ZStreamDeleter> ptr(new z_stream());
+            const int zlib_code =
+                deflateInit2(ptr.get(), compression_level, Z_DEFLATED,
+                             -window_log, 8, Z_DEFAULT_STRATEGY);
+            if (ABSL_PREDICT_FALSE(zlib_code != Z_OK)) {
+              status = absl::InternalError(
+                  ZlibErrorMessage("deflateInit2()", ptr->msg, zlib_code));
+            }
+            return ptr;
+          },
+          [&](z_stream* ptr) {
+            const int zlib_code = deflateReset(ptr);
+            if (ABSL_PREDICT_FALSE(zlib_code != Z_OK)) {
+              status = absl::InternalError(
+                  ZlibErrorMessage("deflateReset()", ptr->msg, zlib_code));
+            }
+          });
+  if (ABSL_PREDICT_FALSE(!status.ok())) return status;
+  if (!dictionary.empty()) {
+    const int zlib_code = deflateSetDictionary(
+        compressor.get(),
+        const_cast<z_const Bytef*>(
+            reinterpret_cast<const Bytef*>(dictionary.data())),
+        IntCast<uInt>(dictionary.size()));
+    if (ABSL_PREDICT_FALSE(zlib_code != Z_OK)) {
+      return absl::InternalError(ZlibErrorMessage(
+          "deflateSetDictionary()", compressor->msg, zlib_code));
+    }
+  }
+  compressor->next_in =
+      const_cast<z_const Bytef*>(reinterpret_cast<const Bytef*>(src.data()));
+  compressor->avail_in = IntCast<uInt>(src.size());
+  // `deflateBound()` does not include the sync flush marker.
+  dest.resize(IntCast<size_t>(deflateBound(compressor.get(),
+                                           IntCast<uLong>(src.size()))) +
+              16);
+  size_t length = 0;
+  for (;;) {
+    compressor->next_out = reinterpret_cast<Bytef*>(&dest[length]);
+    compressor->avail_out = IntCast<uInt>(dest.size() - length);
+    const int result = deflate(compressor.get(), Z_SYNC_FLUSH);
+    length = dest.size() - size_t{compressor->avail_out};
+    if (ABSL_PREDICT_FALSE(result != Z_OK && result != Z_BUF_ERROR)) {
+      return absl::InternalError(
+          ZlibErrorMessage("deflate()", compressor->msg, result));
+    }
+    if (compressor->avail_out > 0) break;
+    dest.resize(dest.size() * 2);
+  }
+  RIEGELI_ASSERT_EQ(compressor->avail_in, 0u)
+      << "deflate() returned but there are still input data";
+  dest.resize(length);
+  return absl::OkStatus();
+}
+
 }  // namespace riegeli
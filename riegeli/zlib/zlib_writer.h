@@ -17,6 +17,7 @@
 
 #include <stddef.h>
 
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
@@ -167,7 +168,33 @@ class ZlibWriterBase : public BufferedWriter {
     Options&& set_buffer_size(size_t buffer_size) && {
       return std::move(set_buffer_size(buffer_size));
     }
-    size_t buffer_size() { return buffer_size_; }
+    size_t buffer_size() const { return buffer_size_; }
+
+    // Sets the maximum number of blocks compressed in parallel. The calling
+    // thread takes part in compression.
+    //
+    // If greater than 1, data are split into blocks of `kParallelBlockSize`
+    // (128KB), each compressed separately on the thread pool with the
+    // preceding window of data as the dictionary, and the compressed blocks
+    // are joined into a single stream with a combined checksum, as pigz does.
+    // The result can be decompressed by any Zlib decompressor. Compression
+    // density is slightly worse than with a single stream, and the buffer
+    // size is raised to at least `parallelism() * kParallelBlockSize`.
+    //
+    // Default: 1.
+    static constexpr size_t kParallelBlockSize = size_t{128} << 10;
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GT(parallelism, 0)
+          << "Failed precondition of "
+             "ZlibWriterBase::Options::set_parallelism(): "
+             "non-positive parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
 
    private:
     int compression_level_ = kDefaultCompressionLevel;
@@ -176,6 +203,7 @@ class ZlibWriterBase : public BufferedWriter {
     ZlibDictionary dictionary_;
     absl::optional<Position> size_hint_;
     size_t buffer_size_ = kDefaultBufferSize;
+    int parallelism_ = 1;
   };
 
   // Returns the compressed `Writer`. Unchanged by `Close()`.
@@ -189,20 +217,26 @@ class ZlibWriterBase : public BufferedWriter {
   using BufferedWriter::Fail;
   ABSL_ATTRIBUTE_COLD bool Fail(absl::Status status) override;
 
+  // Returns statistics of the pool of zlib compression streams which are
+  // shared by all `ZlibWriter` objects, so that consecutive writers reset an
+  // existing stream instead of allocating a new one.
+  static RecyclingPoolStats compressor_pool_stats();
+
  protected:
   ZlibWriterBase() noexcept {}
 
   explicit ZlibWriterBase(ZlibDictionary&& dictionary, size_t buffer_size,
-                          absl::optional<Position> size_hint);
+                          absl::optional<Position> size_hint, int parallelism);
 
   ZlibWriterBase(ZlibWriterBase&& that) noexcept;
   ZlibWriterBase& operator=(ZlibWriterBase&& that) noexcept;
 
   void Reset();
   void Reset(ZlibDictionary&& dictionary, size_t buffer_size,
-             absl::optional<Position> size_hint);
+             absl::optional<Position> size_hint, int parallelism);
+  static size_t GetBufferSize(const Options& options);
   static int GetWindowBits(const Options& options);
-  void Initialize(Writer* dest, int compression_level, int window_bits);
+  void Initialize(Writer* dest, const Options& options);
 
   void Done() override;
   bool WriteInternal(absl::string_view src) override;
@@ -240,8 +274,32 @@ class ZlibWriterBase : public BufferedWriter {
                                          int zlib_code);
   bool WriteInternal(absl::string_view src, Writer& dest, int flush);
 
+  // Writes the header of the joined stream if `parallelism_ > 1`.
+  bool WriteParallelHeader(Writer& dest);
+  // Compresses `src` in blocks in parallel if `parallelism_ > 1`. Each block
+  // ends with a sync flush, so that blocks can be joined.
+  bool WriteInParallel(absl::string_view src, Writer& dest);
+  // Ends the joined stream if `parallelism_ > 1`.
+  bool WriteParallelTrailer(Writer& dest);
+  // Compresses one block of `src` as raw deflate data ending with a sync flush,
+  // with `dictionary` preceding it.
+  static absl::Status CompressBlock(int compression_level, int window_log,
+                                    absl::string_view dictionary,
+                                    absl::string_view src, std::string& dest);
+
   ZlibDictionary dictionary_;
   KeyedRecyclingPool<z_stream, ZStreamKey, ZStreamDeleter>::Handle compressor_;
+  int parallelism_ = 1;
+  // Parameters of the joined stream, used if `parallelism_ > 1`.
+  int compression_level_ = 0;
+  int window_log_ = 0;
+  Header header_ = Header::kZlib;
+  // The last window of data written so far or the dictionary, used as the
+  // dictionary of the next block if `parallelism_ > 1`.
+  std::string history_;
+  // CRC-32 (gzip) or Adler-32 (zlib) of data written so far, used if
+  // `parallelism_ > 1`.
+  uLong check_ = 0;
 };
 
 // A `Writer` which compresses data with Zlib before passing it to another
@@ -323,16 +381,24 @@ explicit ZlibWriter(std::tuple<DestArgs...> dest_args,
 
 inline ZlibWriterBase::ZlibWriterBase(ZlibDictionary&& dictionary,
                                       size_t buffer_size,
-                                      absl::optional<Position> size_hint)
+                                      absl::optional<Position> size_hint,
+                                      int parallelism)
     : BufferedWriter(buffer_size, size_hint),
-      dictionary_(std::move(dictionary)) {}
+      dictionary_(std::move(dictionary)),
+      parallelism_(parallelism) {}
 
 inline ZlibWriterBase::ZlibWriterBase(ZlibWriterBase&& that) noexcept
     : BufferedWriter(std::move(that)),
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
       dictionary_(std::move(that.dictionary_)),
-      compressor_(std::move(that.compressor_)) {}
+      compressor_(std::move(that.compressor_)),
+      parallelism_(that.parallelism_),
+      compression_level_(that.compression_level_),
+      window_log_(that.window_log_),
+      header_(that.header_),
+      history_(std::move(that.history_)),
+      check_(that.check_) {}
 
 inline ZlibWriterBase& ZlibWriterBase::operator=(
     ZlibWriterBase&& that) noexcept {
@@ -341,6 +407,12 @@ inline ZlibWriterBase& ZlibWriterBase::operator=(
   // was moved.
   dictionary_ = std::move(that.dictionary_);
   compressor_ = std::move(that.compressor_);
+  parallelism_ = that.parallelism_;
+  compression_level_ = that.compression_level_;
+  window_log_ = that.window_log_;
+  header_ = that.header_;
+  history_ = std::move(that.history_);
+  check_ = that.check_;
   return *this;
 }
 
@@ -348,14 +420,26 @@ inline void ZlibWriterBase::Reset() {
   BufferedWriter::Reset();
   dictionary_.reset();
   compressor_.reset();
+  parallelism_ = 1;
+  history_ = std::string();
 }
 
 inline void ZlibWriterBase::Reset(ZlibDictionary&& dictionary,
                                   size_t buffer_size,
-                                  absl::optional<Position> size_hint) {
+                                  absl::optional<Position> size_hint,
+                                  int parallelism) {
   BufferedWriter::Reset(buffer_size, size_hint);
   dictionary_ = std::move(dictionary);
   compressor_.reset();
+  parallelism_ = parallelism;
+  history_.clear();
+}
+
+inline size_t ZlibWriterBase::GetBufferSize(const Options& options) {
+  if (options.parallelism() == 1) return options.buffer_size();
+  return UnsignedMax(options.buffer_size(),
+                     IntCast<size_t>(options.parallelism()) *
+                         Options::kParallelBlockSize);
 }
 
 inline int ZlibWriterBase::GetWindowBits(const Options& options) {
@@ -366,28 +450,28 @@ inline int ZlibWriterBase::GetWindowBits(const Options& options) {
 
 template <typename Dest>
 inline ZlibWriter<Dest>::ZlibWriter(const Dest& dest, Options options)
-    : ZlibWriterBase(std::move(options.dictionary()), options.buffer_size(),
-                     options.size_hint()),
+    : ZlibWriterBase(std::move(options.dictionary()), GetBufferSize(options),
+                     options.size_hint(), options.parallelism()),
       dest_(dest) {
-  Initialize(dest_.get(), options.compression_level(), GetWindowBits(options));
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
 inline ZlibWriter<Dest>::ZlibWriter(Dest&& dest, Options options)
-    : ZlibWriterBase(std::move(options.dictionary()), options.buffer_size(),
-                     options.size_hint()),
+    : ZlibWriterBase(std::move(options.dictionary()), GetBufferSize(options),
+                     options.size_hint(), options.parallelism()),
       dest_(std::move(dest)) {
-  Initialize(dest_.get(), options.compression_level(), GetWindowBits(options));
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
 template <typename... DestArgs>
 inline ZlibWriter<Dest>::ZlibWriter(std::tuple<DestArgs...> dest_args,
                                     Options options)
-    : ZlibWriterBase(std::move(options.dictionary()), options.buffer_size(),
-                     options.size_hint()),
+    : ZlibWriterBase(std::move(options.dictionary()), GetBufferSize(options),
+                     options.size_hint(), options.parallelism()),
       dest_(std::move(dest_args)) {
-  Initialize(dest_.get(), options.compression_level(), GetWindowBits(options));
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -415,28 +499,31 @@ inline void ZlibWriter<Dest>::Reset() {
 
 template <typename Dest>
 inline void ZlibWriter<Dest>::Reset(const Dest& dest, Options options) {
-  ZlibWriterBase::Reset(std::move(options.dictionary()), options.buffer_size(),
-                        options.size_hint());
+  ZlibWriterBase::Reset(std::move(options.dictionary()),
+                        GetBufferSize(options), options.size_hint(),
+                        options.parallelism());
   dest_.Reset(dest);
-  Initialize(dest_.get(), options.compression_level(), GetWindowBits(options));
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
 inline void ZlibWriter<Dest>::Reset(Dest&& dest, Options options) {
-  ZlibWriterBase::Reset(std::move(options.dictionary()), options.buffer_size(),
-                        options.size_hint());
+  ZlibWriterBase::Reset(std::move(options.dictionary()),
+                        GetBufferSize(options), options.size_hint(),
+                        options.parallelism());
   dest_.Reset(std::move(dest));
-  Initialize(dest_.get(), options.compression_level(), GetWindowBits(options));
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
 template <typename... DestArgs>
 inline void ZlibWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
                                     Options options) {
-  ZlibWriterBase::Reset(std::move(options.dictionary()), options.buffer_size(),
-                        options.size_hint());
+  ZlibWriterBase::Reset(std::move(options.dictionary()),
+                        GetBufferSize(options), options.size_hint(),
+                        options.parallelism());
   dest_.Reset(std::move(dest_args));
-  Initialize(dest_.get(), options.compression_level(), GetWindowBits(options));
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -14,6 +14,8 @@
 
 // Enables the experimental zstd API:
 //  * `ZSTD_d_stableOutBuffer`
+//  * `ZSTD_frameHeaderSize()`
+//  * `ZSTD_getFrameHeader()`
 //  * `ZSTD_createDDict_advanced()`
 //  * `ZSTD_dictLoadMethod_e`
 //  * `ZSTD_dictContentType_e`
@@ -22,10 +24,14 @@
 #include "riegeli/zstd/zstd_reader.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <algorithm>
+#include <future>
 #include <limits>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <utility>
 
 #include "absl/base/optimization.h"
@@ -36,10 +42,15 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
+#include "riegeli/base/memory_estimator.h"
+#include "riegeli/base/parallelism.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
+#include "riegeli/endian/endian_reading.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -62,6 +73,93 @@ struct ZSTD_DDictDeleter {
   void operator()(ZSTD_DDict* ptr) const { ZSTD_freeDDict(ptr); }
 };
 
+// Constants of the Zstd seekable format, see
+// https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md
+constexpr uint32_t kSeekTableMagic = ZSTD_MAGIC_SKIPPABLE_START | 0xe;
+constexpr uint32_t kSeekableMagic = 0x8f92eab1;
+constexpr Position kSeekTableFooterSize = 9;
+
+// Reads a frame from `src`, ending before `data_end`, and appends it to `dest`.
+// Frame boundaries are found from the frame header and block headers, so the
+// frame does not need to be decompressed.
+//
+// A skippable frame is skipped, leaving `dest` unchanged.
+absl::Status ReadFrame(Reader& src, Position data_end, Chain& dest) {
+  const auto truncated = [&] {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) return src.status();
+    return Annotate(absl::DataLossError("Truncated Zstd-compressed stream"),
+                    absl::StrCat("at byte ", src.pos()));
+  };
+  const auto invalid = [&](absl::string_view message) {
+    return Annotate(absl::DataLossError(message),
+                    absl::StrCat("at byte ", src.pos()));
+  };
+  if (ABSL_PREDICT_FALSE(
+          !src.Pull(ZSTD_FRAMEHEADERSIZE_PREFIX(ZSTD_f_zstd1)))) {
+    return truncated();
+  }
+  if ((ReadLittleEndian32(src.cursor()) & ZSTD_MAGIC_SKIPPABLE_MASK) ==
+      ZSTD_MAGIC_SKIPPABLE_START) {
+    if (ABSL_PREDICT_FALSE(!src.Pull(ZSTD_SKIPPABLEHEADERSIZE))) {
+      return truncated();
+    }
+    const Position frame_size = Position{ZSTD_SKIPPABLEHEADERSIZE} +
+                                ReadLittleEndian32(src.cursor() + 4);
+    if (ABSL_PREDICT_FALSE(frame_size > data_end - src.pos() ||
+                           !src.Skip(frame_size))) {
+      return truncated();
+    }
+    return absl::OkStatus();
+  }
+  const size_t header_size =
+      ZSTD_frameHeaderSize(src.cursor(), src.available());
+  if (ABSL_PREDICT_FALSE(ZSTD_isError(header_size))) {
+    return invalid(absl::StrCat("ZSTD_frameHeaderSize() failed: ",
+                                ZSTD_getErrorName(header_size)));
+  }
+  if (ABSL_PREDICT_FALSE(!src.Pull(header_size))) return truncated();
+  ZSTD_frameHeader header;
+  {
+    const size_t result =
+        ZSTD_getFrameHeader(&header, src.cursor(), header_size);
+    if (ABSL_PREDICT_FALSE(result != 0)) {
+      return invalid(absl::StrCat(
+          "ZSTD_getFrameHeader() failed: ",
+          ZSTD_isError(result) ? ZSTD_getErrorName(result)
+                               : "incomplete frame header"));
+    }
+  }
+  const auto read_part = [&](size_t length) {
+    return length <= data_end - src.pos() && src.ReadAndAppend(length, dest);
+  };
+  if (ABSL_PREDICT_FALSE(!read_part(header_size))) return truncated();
+  // Each block begins with a 3-byte header: bit 0 marks the last block, bits
+  // 1..2 are the block type, bits 3..23 are the block size.
+  constexpr size_t kBlockHeaderSize = 3;
+  for (;;) {
+    if (ABSL_PREDICT_FALSE(!src.Pull(kBlockHeaderSize))) return truncated();
+    const uint32_t block_header =
+        uint32_t{static_cast<unsigned char>(src.cursor()[0])} |
+        uint32_t{static_cast<unsigned char>(src.cursor()[1])} << 8 |
+        uint32_t{static_cast<unsigned char>(src.cursor()[2])} << 16;
+    const bool last_block = (block_header & 1) != 0;
+    const uint32_t block_type = (block_header >> 1) & 3;
+    // An RLE block (type 1) stores one byte regardless of its size.
+    const size_t block_size = block_type == 1 ? 1 : block_header >> 3;
+    if (ABSL_PREDICT_FALSE(block_type == 3)) {
+      return invalid("Invalid Zstd block type");
+    }
+    if (ABSL_PREDICT_FALSE(!read_part(kBlockHeaderSize + block_size))) {
+      return truncated();
+    }
+    if (last_block) break;
+  }
+  if (header.checksumFlag != 0) {
+    if (ABSL_PREDICT_FALSE(!read_part(4))) return truncated();
+  }
+  return absl::OkStatus();
+}
+
 }  // namespace
 
 struct ZstdReaderBase::Dictionary::Shared {
@@ -95,7 +193,7 @@ ZstdReaderBase::Dictionary::PrepareDictionary() const {
   return shared->prepared_dictionary;
 }
 
-void ZstdReaderBase::Initialize(Reader* src) {
+void ZstdReaderBase::Initialize(Reader* src, bool seekable) {
   RIEGELI_ASSERT(src != nullptr)
       << "Failed precondition of ZstdReader: null Reader pointer";
   if (ABSL_PREDICT_FALSE(!src->healthy()) && src->available() == 0) {
@@ -155,7 +253,17 @@ void ZstdReaderBase::Initialize(Reader* src) {
       return;
     }
   }
-  uncompressed_size_ = ZstdUncompressedSize(*src);
+  if (seekable && src->SupportsRandomAccess()) {
+    ReadSeekTable(*src);
+    if (ABSL_PREDICT_FALSE(!healthy())) return;
+  }
+  if (!seek_points_.empty()) {
+    uncompressed_size_ = seek_points_.back().uncompressed_pos;
+  } else if (parallelism_ == 0) {
+    // With parallelism, all frames are decompressed, so the size stored in the
+    // first frame is not necessarily the uncompressed size.
+    uncompressed_size_ = ZstdUncompressedSize(*src);
+  }
   if (uncompressed_size_ != absl::nullopt) {
     // If `uncompressed_size_` is 0, set `size_hint` to 1, because the first
     // `Pull()` call will need a non-empty destination buffer before calling the
@@ -165,16 +273,130 @@ void ZstdReaderBase::Initialize(Reader* src) {
   just_initialized_ = true;
 }
 
+void ZstdReaderBase::ReadSeekTable(Reader& src) {
+  const Position initial_pos = src.pos();
+  const absl::optional<Position> size = src.Size();
+  if (ABSL_PREDICT_FALSE(size == absl::nullopt)) {
+    Fail(src);
+    return;
+  }
+  if (*size < initial_pos || *size - initial_pos < kSeekTableFooterSize + 8) {
+    return;
+  }
+  absl::optional<uint32_t> num_frames;
+  absl::optional<uint8_t> descriptor;
+  absl::optional<uint32_t> magic;
+  if (ABSL_PREDICT_FALSE(!src.Seek(*size - kSeekTableFooterSize) ||
+                         (num_frames = ReadLittleEndian32(src)) ==
+                             absl::nullopt ||
+                         (descriptor = src.ReadByte()) == absl::nullopt ||
+                         (magic = ReadLittleEndian32(src)) == absl::nullopt)) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) {
+      Fail(src);
+      return;
+    }
+    src.Seek(initial_pos);
+    return;
+  }
+  if (*magic != kSeekableMagic) {
+    // Not the seekable format.
+    src.Seek(initial_pos);
+    return;
+  }
+  const auto invalid = [&] {
+    seek_points_.clear();
+    Fail(Annotate(absl::DataLossError("Invalid Zstd seek table"),
+                  absl::StrCat("at byte ", src.pos())));
+  };
+  // Bit 7: checksums are present. Bits 2..6: reserved.
+  if (ABSL_PREDICT_FALSE((*descriptor & 0x7c) != 0)) {
+    invalid();
+    return;
+  }
+  const Position entry_size =
+      (*descriptor & 0x80) != 0 ? 3 * sizeof(uint32_t) : 2 * sizeof(uint32_t);
+  const Position table_size =
+      Position{*num_frames} * entry_size + kSeekTableFooterSize;
+  if (ABSL_PREDICT_FALSE(table_size + 8 > *size - initial_pos)) {
+    invalid();
+    return;
+  }
+  const Position table_begin = *size - (table_size + 8);
+  absl::optional<uint32_t> table_magic;
+  absl::optional<uint32_t> frame_size;
+  if (ABSL_PREDICT_FALSE(
+          !src.Seek(table_begin) ||
+          (table_magic = ReadLittleEndian32(src)) == absl::nullopt ||
+          (frame_size = ReadLittleEndian32(src)) == absl::nullopt)) {
+    if (ABSL_PREDICT_FALSE(!src.healthy())) {
+      Fail(src);
+      return;
+    }
+    invalid();
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(*table_magic != kSeekTableMagic ||
+                         *frame_size != table_size)) {
+    invalid();
+    return;
+  }
+  seek_points_.reserve(size_t{*num_frames} + 1);
+  SeekPoint seek_point = {initial_pos, 0};
+  for (uint32_t frame = 0; frame < *num_frames; ++frame) {
+    const absl::optional<uint32_t> compressed_size = ReadLittleEndian32(src);
+    const absl::optional<uint32_t> decompressed_size = ReadLittleEndian32(src);
+    if (ABSL_PREDICT_FALSE(compressed_size == absl::nullopt ||
+                           decompressed_size == absl::nullopt ||
+                           !src.Skip(entry_size - 2 * sizeof(uint32_t)))) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) {
+        seek_points_.clear();
+        Fail(src);
+        return;
+      }
+      invalid();
+      return;
+    }
+    seek_points_.push_back(seek_point);
+    seek_point.compressed_pos += *compressed_size;
+    seek_point.uncompressed_pos += *decompressed_size;
+  }
+  seek_points_.push_back(seek_point);
+  if (ABSL_PREDICT_FALSE(seek_point.compressed_pos != table_begin)) {
+    invalid();
+    return;
+  }
+  if (ABSL_PREDICT_FALSE(!src.Seek(initial_pos))) {
+    seek_points_.clear();
+    Fail(src);
+  }
+}
+
 void ZstdReaderBase::Done() {
   if (ABSL_PREDICT_FALSE(truncated_)) {
     Reader& src = *src_reader();
     Fail(Annotate(absl::DataLossError("Truncated Zstd-compressed stream"),
                   absl::StrCat("at byte ", src.pos())));
   }
+  CancelDecodingFrames();
   decompressor_.reset();
   BufferedReader::Done();
 }
 
+RecyclingPoolStats ZstdReaderBase::decompressor_pool_stats() {
+  return RecyclingPool<ZSTD_DCtx, ZSTD_DCtxDeleter>::global().stats();
+}
+
+void ZstdReaderBase::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  BufferedReader::RegisterSubobjects(memory_estimator);
+  if (decompressor_ != nullptr) {
+    memory_estimator.RegisterDynamicMemory(
+        ZSTD_sizeof_DCtx(decompressor_.get()));
+  }
+  memory_estimator.RegisterDynamicMemory(seek_points_.capacity() *
+                                         sizeof(SeekPoint));
+}
+
 bool ZstdReaderBase::Fail(absl::Status status) {
   RIEGELI_ASSERT(!status.ok())
       << "Failed precondition of Object::Fail(): status not failed";
@@ -203,14 +425,23 @@ bool ZstdReaderBase::ReadInternal(size_t min_length, size_t max_length,
   RIEGELI_ASSERT(healthy())
       << "Failed precondition of BufferedReader::ReadInternal(): " << status();
   if (ABSL_PREDICT_FALSE(decompressor_ == nullptr)) return false;
+  if (parallelism_ > 0) {
+    return ReadDecodedFrames(min_length, max_length, dest);
+  }
   Reader& src = *src_reader();
   truncated_ = false;
+  // In the seekable format, frames end at `data_end`, followed by the seek
+  // table.
+  const Position data_end = seek_points_.empty()
+                                ? std::numeric_limits<Position>::max()
+                                : seek_points_.back().compressed_pos;
+  if (ABSL_PREDICT_FALSE(src.pos() >= data_end)) return false;
   if (ABSL_PREDICT_FALSE(max_length >
                          std::numeric_limits<Position>::max() - limit_pos())) {
     return FailOverflow();
   }
   size_t effective_min_length = min_length;
-  if (just_initialized_ && !growing_source_ &&
+  if (just_initialized_ && !growing_source_ && seek_points_.empty() &&
       uncompressed_size_ != absl::nullopt &&
       max_length >= *uncompressed_size_) {
     // Avoid a memory copy from an internal buffer of the Zstd engine to `dest`
@@ -227,11 +458,24 @@ bool ZstdReaderBase::ReadInternal(size_t min_length, size_t max_length,
   just_initialized_ = false;
   ZSTD_outBuffer output = {dest, max_length, 0};
   for (;;) {
-    ZSTD_inBuffer input = {src.cursor(), src.available(), 0};
+    ZSTD_inBuffer input = {
+        src.cursor(),
+        IntCast<size_t>(UnsignedMin(Position{src.available()},
+                                    data_end - src.pos())),
+        0};
     const size_t result =
         ZSTD_decompressStream(decompressor_.get(), &output, &input);
     src.set_cursor(static_cast<const char*>(input.src) + input.pos);
     if (ABSL_PREDICT_FALSE(result == 0)) {
+      if (!seek_points_.empty()) {
+        // Continue with the next frame, if any. Keep `decompressor_` for
+        // seeking back.
+        if (src.pos() < data_end && output.pos < effective_min_length) {
+          continue;
+        }
+        move_limit_pos(output.pos);
+        return output.pos >= min_length;
+      }
       decompressor_.reset();
       move_limit_pos(output.pos);
       return output.pos >= min_length;
@@ -251,6 +495,12 @@ bool ZstdReaderBase::ReadInternal(size_t min_length, size_t max_length,
     RIEGELI_ASSERT_EQ(input.pos, input.size)
         << "ZSTD_decompressStream() returned but there are still input data "
            "and output space";
+    if (ABSL_PREDICT_FALSE(src.pos() >= data_end)) {
+      Fail(Annotate(absl::DataLossError("Truncated Zstd seekable frame"),
+                    absl::StrCat("at byte ", src.pos())));
+      move_limit_pos(output.pos);
+      return output.pos >= min_length;
+    }
     if (ABSL_PREDICT_FALSE(!src.Pull(1, result))) {
       move_limit_pos(output.pos);
       if (ABSL_PREDICT_FALSE(!src.healthy())) {
@@ -266,6 +516,165 @@ bool ZstdReaderBase::ReadInternal(size_t min_length, size_t max_length,
   }
 }
 
+inline bool ZstdReaderBase::ReadDecodedFrames(size_t min_length,
+                                              size_t max_length, char* dest) {
+  if (ABSL_PREDICT_FALSE(max_length >
+                         std::numeric_limits<Position>::max() - limit_pos())) {
+    return FailOverflow();
+  }
+  size_t length_read = 0;
+  for (;;) {
+    const size_t remaining = IntCast<size_t>(decoded_frame_.src().size() -
+                                             decoded_frame_.pos());
+    if (remaining > 0) {
+      const size_t length = UnsignedMin(remaining, max_length - length_read);
+      decoded_frame_.Read(length, dest + length_read);
+      length_read += length;
+      if (length_read == max_length) break;
+    }
+    // Avoid waiting for the next frame if enough data have been read.
+    if (length_read >= min_length) break;
+    if (ABSL_PREDICT_FALSE(!NextDecodedFrame())) {
+      move_limit_pos(length_read);
+      return false;
+    }
+  }
+  move_limit_pos(length_read);
+  return true;
+}
+
+void ZstdReaderBase::StartDecodingFrames() {
+  Reader& src = *src_reader();
+  // In the seekable format, frames end at `data_end`, followed by the seek
+  // table.
+  const Position data_end = seek_points_.empty()
+                                ? std::numeric_limits<Position>::max()
+                                : seek_points_.back().compressed_pos;
+  struct DecodeRequest {
+    Chain compressed;
+    Position compressed_pos;
+    Dictionary dictionary;
+    std::promise<DecodedFrame> decoded;
+  };
+  // Reports `status` after frames being decompressed.
+  const auto fail_later = [&](absl::Status status) {
+    std::promise<DecodedFrame> decoded;
+    DecodedFrame frame;
+    frame.status = std::move(status);
+    decoded.set_value(std::move(frame));
+    decoding_frames_.push_back(decoded.get_future());
+    frames_exhausted_ = true;
+  };
+  while (!frames_exhausted_ && decoding_frames_.size() < parallelism_) {
+    if (src.pos() >= data_end || !src.Pull()) {
+      if (ABSL_PREDICT_FALSE(!src.healthy())) {
+        fail_later(src.status());
+        return;
+      }
+      frames_exhausted_ = true;
+      return;
+    }
+    std::unique_ptr<DecodeRequest> request = std::make_unique<DecodeRequest>();
+    request->compressed_pos = src.pos();
+    {
+      absl::Status status = ReadFrame(src, data_end, request->compressed);
+      if (ABSL_PREDICT_FALSE(!status.ok())) {
+        fail_later(std::move(status));
+        return;
+      }
+    }
+    // A skippable frame has nothing to decompress.
+    if (request->compressed.empty()) continue;
+    request->dictionary = dictionary_;
+    decoding_frames_.push_back(request->decoded.get_future());
+    ThreadPool::global().Schedule([request = request.release()] {
+      DecodedFrame frame;
+      ZstdReader<ChainReader<Chain>> reader(
+          std::forward_as_tuple(std::move(request->compressed)),
+          ZstdReaderBase::Options().set_dictionary(
+              std::move(request->dictionary)));
+      if (ABSL_PREDICT_FALSE(!reader.ReadAll(frame.data) || !reader.Close())) {
+        frame.status =
+            Annotate(reader.status(), absl::StrCat("in frame at byte ",
+                                                   request->compressed_pos));
+      }
+      request->decoded.set_value(std::move(frame));
+      delete request;
+    });
+  }
+}
+
+bool ZstdReaderBase::NextDecodedFrame() {
+  StartDecodingFrames();
+  if (decoding_frames_.empty()) {
+    // All frames have been decompressed. Keep `decompressor_` for seeking back
+    // in the seekable format.
+    if (seek_points_.empty()) decompressor_.reset();
+    return false;
+  }
+  DecodedFrame frame = decoding_frames_.front().get();
+  decoding_frames_.pop_front();
+  if (ABSL_PREDICT_FALSE(!frame.status.ok())) {
+    return Fail(std::move(frame.status));
+  }
+  decoded_frame_.Reset(std::move(frame.data));
+  StartDecodingFrames();
+  return true;
+}
+
+void ZstdReaderBase::CancelDecodingFrames() {
+  for (std::future<DecodedFrame>& frame : decoding_frames_) frame.wait();
+  decoding_frames_.clear();
+  frames_exhausted_ = false;
+  decoded_frame_.Reset();
+}
+
+bool ZstdReaderBase::SeekSlow(Position new_pos) {
+  RIEGELI_ASSERT(new_pos < start_pos() || new_pos > limit_pos())
+      << "Failed precondition of Reader::SeekSlow(): "
+         "position in the buffer, use Seek() instead";
+  if (seek_points_.empty()) return BufferedReader::SeekSlow(new_pos);
+  if (ABSL_PREDICT_FALSE(!healthy())) return false;
+  // The last frame beginning at or before `new_pos`. The end of the last frame
+  // is never chosen because `new_pos` at or after it is handled separately.
+  const SeekPoint& frame =
+      *(std::upper_bound(seek_points_.begin(), seek_points_.end() - 1, new_pos,
+                         [](Position pos, const SeekPoint& seek_point) {
+                           return pos < seek_point.uncompressed_pos;
+                         }) -
+        1);
+  if (new_pos > limit_pos() && limit_pos() >= frame.uncompressed_pos &&
+      new_pos < seek_points_.back().uncompressed_pos) {
+    // Seeking forwards within the current frame.
+    return BufferedReader::SeekSlow(new_pos);
+  }
+  Reader& src = *src_reader();
+  ClearBuffer();
+  CancelDecodingFrames();
+  truncated_ = false;
+  just_initialized_ = false;
+  {
+    const size_t result =
+        ZSTD_DCtx_reset(decompressor_.get(), ZSTD_reset_session_only);
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      return Fail(absl::InternalError(absl::StrCat(
+          "ZSTD_DCtx_reset() failed: ", ZSTD_getErrorName(result))));
+    }
+  }
+  if (new_pos >= seek_points_.back().uncompressed_pos) {
+    // Seeking to the end or beyond.
+    if (ABSL_PREDICT_FALSE(!src.Seek(seek_points_.back().compressed_pos))) {
+      return Fail(src);
+    }
+    set_limit_pos(seek_points_.back().uncompressed_pos);
+    return new_pos == limit_pos();
+  }
+  if (ABSL_PREDICT_FALSE(!src.Seek(frame.compressed_pos))) return Fail(src);
+  set_limit_pos(frame.uncompressed_pos);
+  if (new_pos == limit_pos()) return true;
+  return BufferedReader::SeekSlow(new_pos);
+}
+
 absl::optional<Position> ZstdReaderBase::Size() {
   if (ABSL_PREDICT_FALSE(!healthy())) return absl::nullopt;
   if (ABSL_PREDICT_FALSE(uncompressed_size_ == absl::nullopt)) {
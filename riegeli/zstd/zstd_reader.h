@@ -17,11 +17,14 @@
 
 #include <stddef.h>
 
+#include <deque>
+#include <future>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
@@ -30,9 +33,12 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/chain.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_reader.h"
+#include "riegeli/bytes/chain_reader.h"
 #include "riegeli/bytes/reader.h"
 #include "zstd.h"
 
@@ -196,6 +202,51 @@ class ZstdReaderBase : public BufferedReader {
     }
     bool growing_source() const { return growing_source_; }
 
+    // If `true` and the compressed `Reader` supports random access, looks for
+    // a seek table of the Zstd seekable format at its end, which is written by
+    // `ZstdWriterBase::Options::set_seekable_frame_size()`. If found, all
+    // frames are decompressed, and random access is supported by seeking to
+    // the frame containing the new position.
+    //
+    // The compressed stream must extend to the end of the compressed `Reader`.
+    //
+    // Default: `false`.
+    Options& set_seekable(bool seekable) & {
+      seekable_ = seekable;
+      return *this;
+    }
+    Options&& set_seekable(bool seekable) && {
+      return std::move(set_seekable(seekable));
+    }
+    bool seekable() const { return seekable_; }
+
+    // Sets the maximum number of frames being decompressed in parallel in
+    // background, on threads from `ThreadPool::global()`.
+    //
+    // This speeds up decompressing data consisting of multiple independent
+    // frames, e.g. written by `pzstd`, or by `ZstdWriter` with
+    // `ZstdWriterBase::Options::set_seekable_frame_size()`. A single frame is
+    // decompressed by one thread.
+    //
+    // If `parallelism > 0`, whole frames are read from the compressed `Reader`
+    // ahead of the current position, and their boundaries are found from frame
+    // and block headers. `Size()` is then supported only in the seekable
+    // format. Parallelism is ignored if `growing_source()`.
+    //
+    // Default: 0.
+    Options& set_parallelism(int parallelism) & {
+      RIEGELI_ASSERT_GE(parallelism, 0)
+          << "Failed precondition of "
+             "ZstdReaderBase::Options::set_parallelism(): "
+             "negative parallelism";
+      parallelism_ = parallelism;
+      return *this;
+    }
+    Options&& set_parallelism(int parallelism) && {
+      return std::move(set_parallelism(parallelism));
+    }
+    int parallelism() const { return parallelism_; }
+
     // Zstd dictionary. The same dictionary must have been used for compression.
     //
     // Default: `Dictionary()`.
@@ -250,6 +301,8 @@ class ZstdReaderBase : public BufferedReader {
 
    private:
     bool growing_source_ = false;
+    bool seekable_ = false;
+    int parallelism_ = 0;
     Dictionary dictionary_;
     absl::optional<Position> size_hint_;
     size_t buffer_size_ = DefaultBufferSize();
@@ -266,41 +319,90 @@ class ZstdReaderBase : public BufferedReader {
   using BufferedReader::Fail;
   ABSL_ATTRIBUTE_COLD bool Fail(absl::Status status) override;
 
+  // Returns statistics of the pool of Zstd decompression contexts which are
+  // shared by all `ZstdReader` objects, so that consecutive readers reset an
+  // existing context instead of allocating a new one.
+  static RecyclingPoolStats decompressor_pool_stats();
+
   // Returns `true` if the source is truncated (without a clean end of the
   // compressed stream) at the current position. In such case, if the source
   // does not grow, `Close()` will fail.
   bool truncated() const { return truncated_; }
 
+  bool SupportsRandomAccess() override { return !seek_points_.empty(); }
   bool SupportsSize() override { return uncompressed_size_ != absl::nullopt; }
   absl::optional<Position> Size() override;
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
 
  protected:
   ZstdReaderBase() noexcept {}
 
-  explicit ZstdReaderBase(bool growing_source, Dictionary&& dictionary,
-                          size_t buffer_size,
+  explicit ZstdReaderBase(bool growing_source, int parallelism,
+                          Dictionary&& dictionary, size_t buffer_size,
                           absl::optional<Position> size_hint);
 
   ZstdReaderBase(ZstdReaderBase&& that) noexcept;
   ZstdReaderBase& operator=(ZstdReaderBase&& that) noexcept;
 
   void Reset();
-  void Reset(bool growing_source, Dictionary&& dictionary, size_t buffer_size,
-             absl::optional<Position> size_hint);
-  void Initialize(Reader* src);
+  void Reset(bool growing_source, int parallelism, Dictionary&& dictionary,
+             size_t buffer_size, absl::optional<Position> size_hint);
+  void Initialize(Reader* src, bool seekable);
 
   void Done() override;
   bool PullSlow(size_t min_length, size_t recommended_length) override;
   bool ReadInternal(size_t min_length, size_t max_length, char* dest) override;
+  bool SeekSlow(Position new_pos) override;
 
  private:
   struct ZSTD_DCtxDeleter {
     void operator()(ZSTD_DCtx* ptr) const { ZSTD_freeDCtx(ptr); }
   };
 
+  // Beginning of a frame of the Zstd seekable format.
+  struct SeekPoint {
+    // Position in the compressed `Reader`.
+    Position compressed_pos;
+    // Uncompressed position.
+    Position uncompressed_pos;
+  };
+
+  // Result of decompressing a frame in background.
+  struct DecodedFrame {
+    absl::Status status;
+    Chain data;
+  };
+
+  // Fills `seek_points_` if `src` ends with a valid seek table. Preserves the
+  // position of `src` unless `src` fails.
+  void ReadSeekTable(Reader& src);
+
+  // Implements `ReadInternal()` if `parallelism_ > 0`, copying data from
+  // frames decompressed in background.
+  bool ReadDecodedFrames(size_t min_length, size_t max_length, char* dest);
+
+  // Starts decompressing frames following the frames being decompressed, until
+  // `parallelism_` frames are pending or the compressed stream ends.
+  void StartDecodingFrames();
+
+  // Makes the next frame decompressed in background the current frame,
+  // waiting for it if needed.
+  //
+  // Return values:
+  //  * `true`                 - success
+  //  * `false` (`healthy()`)  - the compressed stream ends
+  //  * `false` (`!healthy()`) - failure
+  bool NextDecodedFrame();
+
+  // Waits until decompressing frames in background is finished, and discards
+  // them and the current frame.
+  void CancelDecodingFrames();
+
   // If `true`, supports decompressing as much as possible from a truncated
   // source, then retrying when the source has grown.
   bool growing_source_ = false;
+  // If positive, the maximum number of frames being decompressed in background.
+  size_t parallelism_ = 0;
   // If `true`, calling `ZSTD_DCtx_setParameter()` is valid.
   bool just_initialized_ = false;
   // If `true`, the source is truncated (without a clean end of the compressed
@@ -315,6 +417,16 @@ class ZstdReaderBase : public BufferedReader {
   RecyclingPool<ZSTD_DCtx, ZSTD_DCtxDeleter>::Handle decompressor_;
   // Uncompressed size, if known.
   absl::optional<Position> uncompressed_size_;
+  // If not empty, the seekable format is being read: beginnings of frames,
+  // followed by the end of the last frame.
+  std::vector<SeekPoint> seek_points_;
+  // If `parallelism_ > 0`, frames being decompressed in background, in order.
+  std::deque<std::future<DecodedFrame>> decoding_frames_;
+  // If `true`, all frames of the compressed stream have been read to
+  // `decoding_frames_`.
+  bool frames_exhausted_ = false;
+  // If `parallelism_ > 0`, the current decompressed frame.
+  ChainReader<Chain> decoded_frame_;
 };
 
 // A `Reader` which decompresses data with Zstd after getting it from another
@@ -365,6 +477,8 @@ class ZstdReader : public ZstdReaderBase {
   Reader* src_reader() override { return src_.get(); }
   const Reader* src_reader() const override { return src_.get(); }
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
   void VerifyEnd() override;
 
  protected:
@@ -434,12 +548,13 @@ inline ZstdReaderBase::Dictionary& ZstdReaderBase::Dictionary::operator=(
 
 inline void ZstdReaderBase::Dictionary::InvalidateShared() { shared_.reset(); }
 
-inline ZstdReaderBase::ZstdReaderBase(bool growing_source,
+inline ZstdReaderBase::ZstdReaderBase(bool growing_source, int parallelism,
                                       Dictionary&& dictionary,
                                       size_t buffer_size,
                                       absl::optional<Position> size_hint)
     : BufferedReader(buffer_size, size_hint),
       growing_source_(growing_source),
+      parallelism_(growing_source ? 0 : IntCast<size_t>(parallelism)),
       dictionary_(std::move(dictionary)) {}
 
 inline ZstdReaderBase::ZstdReaderBase(ZstdReaderBase&& that) noexcept
@@ -447,76 +562,98 @@ inline ZstdReaderBase::ZstdReaderBase(ZstdReaderBase&& that) noexcept
       // Using `that` after it was moved is correct because only the base class
       // part was moved.
       growing_source_(that.growing_source_),
+      parallelism_(that.parallelism_),
       just_initialized_(that.just_initialized_),
       truncated_(that.truncated_),
       dictionary_(std::move(that.dictionary_)),
       prepared_dictionary_(std::move(that.prepared_dictionary_)),
       decompressor_(std::move(that.decompressor_)),
-      uncompressed_size_(that.uncompressed_size_) {}
+      uncompressed_size_(that.uncompressed_size_),
+      seek_points_(std::move(that.seek_points_)),
+      decoding_frames_(std::move(that.decoding_frames_)),
+      frames_exhausted_(that.frames_exhausted_),
+      decoded_frame_(std::move(that.decoded_frame_)) {}
 
 inline ZstdReaderBase& ZstdReaderBase::operator=(
     ZstdReaderBase&& that) noexcept {
+  CancelDecodingFrames();
   BufferedReader::operator=(std::move(that));
   // Using `that` after it was moved is correct because only the base class part
   // was moved.
   growing_source_ = that.growing_source_;
+  parallelism_ = that.parallelism_;
   just_initialized_ = that.just_initialized_;
   truncated_ = that.truncated_;
   dictionary_ = std::move(that.dictionary_);
   prepared_dictionary_ = std::move(that.prepared_dictionary_);
   decompressor_ = std::move(that.decompressor_);
   uncompressed_size_ = that.uncompressed_size_;
+  seek_points_ = std::move(that.seek_points_);
+  decoding_frames_ = std::move(that.decoding_frames_);
+  frames_exhausted_ = that.frames_exhausted_;
+  decoded_frame_ = std::move(that.decoded_frame_);
   return *this;
 }
 
 inline void ZstdReaderBase::Reset() {
+  CancelDecodingFrames();
   BufferedReader::Reset();
   growing_source_ = false;
+  parallelism_ = 0;
   just_initialized_ = false;
   truncated_ = false;
   dictionary_.reset();
   prepared_dictionary_.reset();
   decompressor_.reset();
   uncompressed_size_ = absl::nullopt;
+  seek_points_ = std::vector<SeekPoint>();
+  frames_exhausted_ = false;
 }
 
-inline void ZstdReaderBase::Reset(bool growing_source, Dictionary&& dictionary,
-                                  size_t buffer_size,
+inline void ZstdReaderBase::Reset(bool growing_source, int parallelism,
+                                  Dictionary&& dictionary, size_t buffer_size,
                                   absl::optional<Position> size_hint) {
+  CancelDecodingFrames();
   BufferedReader::Reset(buffer_size, size_hint);
   growing_source_ = growing_source;
+  parallelism_ = growing_source ? 0 : IntCast<size_t>(parallelism);
   just_initialized_ = false;
   truncated_ = false;
   dictionary_ = std::move(dictionary);
   prepared_dictionary_.reset();
   decompressor_.reset();
   uncompressed_size_ = absl::nullopt;
+  seek_points_.clear();
+  frames_exhausted_ = false;
 }
 
 template <typename Src>
 inline ZstdReader<Src>::ZstdReader(const Src& src, Options options)
-    : ZstdReaderBase(options.growing_source(), std::move(options.dictionary()),
-                     options.buffer_size(), options.size_hint()),
+    : ZstdReaderBase(options.growing_source(), options.parallelism(),
+                     std::move(options.dictionary()), options.buffer_size(),
+                     options.size_hint()),
       src_(src) {
-  Initialize(src_.get());
+  Initialize(src_.get(), options.seekable());
 }
 
 template <typename Src>
 inline ZstdReader<Src>::ZstdReader(Src&& src, Options options)
-    : ZstdReaderBase(options.growing_source(), std::move(options.dictionary()),
-                     options.buffer_size(), options.size_hint()),
+    : ZstdReaderBase(options.growing_source(), options.parallelism(),
+                     std::move(options.dictionary()), options.buffer_size(),
+                     options.size_hint()),
       src_(std::move(src)) {
-  Initialize(src_.get());
+  Initialize(src_.get(), options.seekable());
 }
 
 template <typename Src>
 template <typename... SrcArgs>
 inline ZstdReader<Src>::ZstdReader(std::tuple<SrcArgs...> src_args,
                                    Options options)
-    : ZstdReaderBase(options.growing_source(), std::move(options.dictionary()),
-                     options.buffer_size(), options.size_hint()),
+    : ZstdReaderBase(options.growing_source(), options.parallelism(),
+                     std::move(options.dictionary()), options.buffer_size(),
+                     options.size_hint()),
       src_(std::move(src_args)) {
-  Initialize(src_.get());
+  Initialize(src_.get(), options.seekable());
 }
 
 template <typename Src>
@@ -543,31 +680,31 @@ inline void ZstdReader<Src>::Reset() {
 
 template <typename Src>
 inline void ZstdReader<Src>::Reset(const Src& src, Options options) {
-  ZstdReaderBase::Reset(options.growing_source(),
+  ZstdReaderBase::Reset(options.growing_source(), options.parallelism(),
                         std::move(options.dictionary()), options.buffer_size(),
                         options.size_hint());
   src_.Reset(src);
-  Initialize(src_.get());
+  Initialize(src_.get(), options.seekable());
 }
 
 template <typename Src>
 inline void ZstdReader<Src>::Reset(Src&& src, Options options) {
-  ZstdReaderBase::Reset(options.growing_source(),
+  ZstdReaderBase::Reset(options.growing_source(), options.parallelism(),
                         std::move(options.dictionary()), options.buffer_size(),
                         options.size_hint());
   src_.Reset(std::move(src));
-  Initialize(src_.get());
+  Initialize(src_.get(), options.seekable());
 }
 
 template <typename Src>
 template <typename... SrcArgs>
 inline void ZstdReader<Src>::Reset(std::tuple<SrcArgs...> src_args,
                                    Options options) {
-  ZstdReaderBase::Reset(options.growing_source(),
+  ZstdReaderBase::Reset(options.growing_source(), options.parallelism(),
                         std::move(options.dictionary()), options.buffer_size(),
                         options.size_hint());
   src_.Reset(std::move(src_args));
-  Initialize(src_.get());
+  Initialize(src_.get(), options.seekable());
 }
 
 template <typename Src>
@@ -584,6 +721,13 @@ void ZstdReader<Src>::VerifyEnd() {
   if (src_.is_owning() && ABSL_PREDICT_TRUE(healthy())) src_->VerifyEnd();
 }
 
+template <typename Src>
+void ZstdReader<Src>::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  ZstdReaderBase::RegisterSubobjects(memory_estimator);
+  if (src_.is_owning()) src_->RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_ZSTD_ZSTD_READER_H_
@@ -22,6 +22,7 @@
 #include "riegeli/zstd/zstd_writer.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <limits>
 #include <memory>
@@ -36,10 +37,12 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/base/status.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
+#include "riegeli/endian/endian_writing.h"
 #include "zstd.h"
 
 namespace riegeli {
@@ -53,6 +56,10 @@ constexpr int ZstdWriterBase::Options::kMaxCompressionLevel;
 constexpr int ZstdWriterBase::Options::kDefaultCompressionLevel;
 constexpr int ZstdWriterBase::Options::kMinWindowLog;
 constexpr int ZstdWriterBase::Options::kMaxWindowLog;
+constexpr int ZstdWriterBase::Options::kMinLdmHashLog;
+constexpr int ZstdWriterBase::Options::kMaxLdmHashLog;
+constexpr int ZstdWriterBase::Options::kMaxTargetLength;
+constexpr Position ZstdWriterBase::Options::kMaxSeekableFrameSize;
 #endif
 
 // Constants are defined as integer literals in zstd_writer.h and asserted here
@@ -114,10 +121,7 @@ ZstdWriterBase::Dictionary::PrepareDictionary(int compression_level) const {
   return prepared->shared_dictionary;
 }
 
-void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
-                                absl::optional<int> window_log,
-                                bool store_checksum,
-                                absl::optional<Position> size_hint) {
+void ZstdWriterBase::Initialize(Writer* dest, const Options& options) {
   RIEGELI_ASSERT(dest != nullptr)
       << "Failed precondition of ZstdWriter: null Writer pointer";
   if (ABSL_PREDICT_FALSE(!dest->healthy())) {
@@ -140,7 +144,8 @@ void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
   }
   {
     const size_t result = ZSTD_CCtx_setParameter(
-        compressor_.get(), ZSTD_c_compressionLevel, compression_level);
+        compressor_.get(), ZSTD_c_compressionLevel,
+        options.compression_level());
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       Fail(absl::InternalError(absl::StrCat(
           "ZSTD_CCtx_setParameter(ZSTD_c_compressionLevel) failed: ",
@@ -148,9 +153,9 @@ void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
       return;
     }
   }
-  if (window_log != absl::nullopt) {
-    const size_t result = ZSTD_CCtx_setParameter(compressor_.get(),
-                                                 ZSTD_c_windowLog, *window_log);
+  if (options.window_log() != absl::nullopt) {
+    const size_t result = ZSTD_CCtx_setParameter(
+        compressor_.get(), ZSTD_c_windowLog, *options.window_log());
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       Fail(absl::InternalError(
           absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_windowLog) failed: ",
@@ -158,9 +163,52 @@ void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
       return;
     }
   }
-  {
+  if (options.long_distance_matching() != absl::nullopt) {
+    const size_t result = ZSTD_CCtx_setParameter(
+        compressor_.get(), ZSTD_c_enableLongDistanceMatching,
+        *options.long_distance_matching() ? 1 : 0);
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      Fail(absl::InternalError(absl::StrCat(
+          "ZSTD_CCtx_setParameter(ZSTD_c_enableLongDistanceMatching) failed: ",
+          ZSTD_getErrorName(result))));
+      return;
+    }
+  }
+  if (options.ldm_hash_log() != absl::nullopt) {
+    const size_t result = ZSTD_CCtx_setParameter(
+        compressor_.get(), ZSTD_c_ldmHashLog, *options.ldm_hash_log());
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      Fail(absl::InternalError(
+          absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_ldmHashLog) failed: ",
+                       ZSTD_getErrorName(result))));
+      return;
+    }
+  }
+  if (options.target_length() != absl::nullopt) {
     const size_t result = ZSTD_CCtx_setParameter(
-        compressor_.get(), ZSTD_c_checksumFlag, store_checksum ? 1 : 0);
+        compressor_.get(), ZSTD_c_targetLength, *options.target_length());
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      Fail(absl::InternalError(
+          absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_targetLength) failed: ",
+                       ZSTD_getErrorName(result))));
+      return;
+    }
+  }
+  if (options.strategy() != absl::nullopt) {
+    const size_t result =
+        ZSTD_CCtx_setParameter(compressor_.get(), ZSTD_c_strategy,
+                               static_cast<int>(*options.strategy()));
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      Fail(absl::InternalError(
+          absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_strategy) failed: ",
+                       ZSTD_getErrorName(result))));
+      return;
+    }
+  }
+  {
+    const size_t result =
+        ZSTD_CCtx_setParameter(compressor_.get(), ZSTD_c_checksumFlag,
+                               options.store_checksum() ? 1 : 0);
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       Fail(absl::InternalError(
           absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_checksumFlag) failed: ",
@@ -168,7 +216,32 @@ void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
       return;
     }
   }
-  if (pledged_size_ != absl::nullopt) {
+  if (options.num_workers() > 0) {
+    const size_t result = ZSTD_CCtx_setParameter(
+        compressor_.get(), ZSTD_c_nbWorkers, options.num_workers());
+    if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+      Fail(absl::InternalError(
+          absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_nbWorkers) failed: ",
+                       ZSTD_getErrorName(result))));
+      return;
+    }
+    if (options.job_size() != absl::nullopt) {
+      const size_t result =
+          ZSTD_CCtx_setParameter(compressor_.get(), ZSTD_c_jobSize,
+                                 SaturatingIntCast<int>(*options.job_size()));
+      if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
+        Fail(absl::InternalError(
+            absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_jobSize) failed: ",
+                         ZSTD_getErrorName(result))));
+        return;
+      }
+    }
+  }
+  seekable_frame_size_ = options.seekable_frame_size();
+  frame_begin_compressed_ = dest->pos();
+  // In the seekable format the pledged size covers all frames, so it is not
+  // passed to the compressor which would apply it to the first frame.
+  if (pledged_size_ != absl::nullopt && seekable_frame_size_ == absl::nullopt) {
     const size_t result = ZSTD_CCtx_setPledgedSrcSize(
         compressor_.get(), IntCast<unsigned long long>(*pledged_size_));
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
@@ -177,10 +250,15 @@ void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
                        ZSTD_getErrorName(result))));
       return;
     }
-  } else if (size_hint != absl::nullopt) {
+  } else if (options.effective_size_hint() != absl::nullopt) {
+    const Position size_hint =
+        seekable_frame_size_ == absl::nullopt
+            ? *options.effective_size_hint()
+            : UnsignedMin(*options.effective_size_hint(),
+                          *seekable_frame_size_);
     const size_t result =
         ZSTD_CCtx_setParameter(compressor_.get(), ZSTD_c_srcSizeHint,
-                               SaturatingIntCast<int>(*size_hint));
+                               SaturatingIntCast<int>(size_hint));
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
       Fail(absl::InternalError(
           absl::StrCat("ZSTD_CCtx_setParameter(ZSTD_c_srcSizeHint) failed: ",
@@ -189,7 +267,8 @@ void ZstdWriterBase::Initialize(Writer* dest, int compression_level,
     }
   }
   if (!dictionary_.empty()) {
-    prepared_dictionary_ = dictionary_.PrepareDictionary(compression_level);
+    prepared_dictionary_ =
+        dictionary_.PrepareDictionary(options.compression_level());
     if (ABSL_PREDICT_FALSE(prepared_dictionary_ == nullptr)) {
       Fail(absl::InternalError("ZSTD_createCDict_advanced() failed"));
       return;
@@ -209,12 +288,29 @@ void ZstdWriterBase::Done() {
     Writer& dest = *dest_writer();
     const absl::string_view data(start(), written_to_buffer());
     set_buffer();
-    WriteInternal(data, dest, ZSTD_e_end);
+    if (WriteInternal(data, dest, ZSTD_e_end) &&
+        seekable_frame_size_ != absl::nullopt) {
+      WriteSeekTable(dest);
+    }
   }
   compressor_.reset();
   BufferedWriter::Done();
 }
 
+RecyclingPoolStats ZstdWriterBase::compressor_pool_stats() {
+  return RecyclingPool<ZSTD_CCtx, ZSTD_CCtxDeleter>::global().stats();
+}
+
+void ZstdWriterBase::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  BufferedWriter::RegisterSubobjects(memory_estimator);
+  if (compressor_ != nullptr) {
+    memory_estimator.RegisterDynamicMemory(
+        ZSTD_sizeof_CCtx(compressor_.get()));
+  }
+  memory_estimator.RegisterDynamicMemory(seek_table_.capacity());
+}
+
 bool ZstdWriterBase::Fail(absl::Status status) {
   RIEGELI_ASSERT(!status.ok())
       << "Failed precondition of Object::Fail(): status not failed";
@@ -268,6 +364,44 @@ bool ZstdWriterBase::WriteInternal(absl::string_view src, Writer& dest,
       }
     }
   }
+  if (seekable_frame_size_ != absl::nullopt) {
+    // End frames at multiples of `*seekable_frame_size_`.
+    for (;;) {
+      const Position remaining_in_frame =
+          frame_begin_ + *seekable_frame_size_ - start_pos();
+      if (src.size() < remaining_in_frame) break;
+      const size_t length = IntCast<size_t>(remaining_in_frame);
+      if (ABSL_PREDICT_FALSE(
+              !CompressInternal(src.substr(0, length), dest, ZSTD_e_end))) {
+        return false;
+      }
+      EndFrame(dest);
+      src.remove_prefix(length);
+      if (src.empty()) {
+        if (end_op == ZSTD_e_end) compressor_.reset();
+        return true;
+      }
+    }
+    if (end_op == ZSTD_e_end && src.empty() && start_pos() == frame_begin_) {
+      // Do not write an empty frame.
+      compressor_.reset();
+      return true;
+    }
+    if (ABSL_PREDICT_FALSE(!CompressInternal(src, dest, end_op))) return false;
+    if (end_op == ZSTD_e_end) {
+      EndFrame(dest);
+      compressor_.reset();
+    }
+    return true;
+  }
+  if (ABSL_PREDICT_FALSE(!CompressInternal(src, dest, end_op))) return false;
+  if (end_op == ZSTD_e_end) compressor_.reset();
+  return true;
+}
+
+inline bool ZstdWriterBase::CompressInternal(absl::string_view src,
+                                             Writer& dest,
+                                             ZSTD_EndDirective end_op) {
   ZSTD_inBuffer input = {src.data(), src.size(), 0};
   for (;;) {
     ZSTD_outBuffer output = {dest.cursor(), dest.available(), 0};
@@ -278,7 +412,6 @@ bool ZstdWriterBase::WriteInternal(absl::string_view src, Writer& dest,
       RIEGELI_ASSERT_EQ(input.pos, input.size)
           << "ZSTD_compressStream2() returned 0 but there are still input data";
       move_start_pos(input.pos);
-      if (end_op == ZSTD_e_end) compressor_.reset();
       return true;
     }
     if (ABSL_PREDICT_FALSE(ZSTD_isError(result))) {
@@ -288,9 +421,10 @@ bool ZstdWriterBase::WriteInternal(absl::string_view src, Writer& dest,
           absl::StrCat("at byte ", dest.pos())));
     }
     if (output.pos < output.size) {
-      RIEGELI_ASSERT_EQ(input.pos, input.size)
-          << "ZSTD_compressStream2() returned but there are still input data "
-             "and output space";
+      // With `ZSTD_c_nbWorkers > 0`, `ZSTD_compressStream2()` can return before
+      // consuming all input while workers are busy. Calling it again waits for
+      // a worker.
+      if (input.pos < input.size) continue;
       move_start_pos(input.pos);
       return true;
     }
@@ -306,4 +440,35 @@ bool ZstdWriterBase::FlushInternal() {
   return WriteInternal(data, dest, ZSTD_e_flush);
 }
 
+inline void ZstdWriterBase::EndFrame(Writer& dest) {
+  char entry[2 * sizeof(uint32_t)];
+  WriteLittleEndian32(IntCast<uint32_t>(dest.pos() - frame_begin_compressed_),
+                      entry);
+  WriteLittleEndian32(IntCast<uint32_t>(start_pos() - frame_begin_),
+                      entry + sizeof(uint32_t));
+  seek_table_.append(entry, sizeof(entry));
+  frame_begin_ = start_pos();
+  frame_begin_compressed_ = dest.pos();
+}
+
+bool ZstdWriterBase::WriteSeekTable(Writer& dest) {
+  // See
+  // https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md
+  const size_t num_frames = seek_table_.size() / (2 * sizeof(uint32_t));
+  if (ABSL_PREDICT_FALSE(num_frames > std::numeric_limits<uint32_t>::max())) {
+    return Fail(absl::ResourceExhaustedError("Too many Zstd seekable frames"));
+  }
+  const size_t frame_size = seek_table_.size() + 9;
+  if (ABSL_PREDICT_FALSE(
+          !WriteLittleEndian32(ZSTD_MAGIC_SKIPPABLE_START | 0xe, dest) ||
+          !WriteLittleEndian32(IntCast<uint32_t>(frame_size), dest) ||
+          !dest.Write(seek_table_) ||
+          !WriteLittleEndian32(IntCast<uint32_t>(num_frames), dest) ||
+          !dest.WriteByte(0) ||  // `Seek_Table_Descriptor`: no checksums.
+          !WriteLittleEndian32(0x8f92eab1, dest))) {
+    return Fail(dest);
+  }
+  return true;
+}
+
 }  // namespace riegeli
@@ -31,6 +31,7 @@
 #include "absl/types/optional.h"
 #include "riegeli/base/base.h"
 #include "riegeli/base/dependency.h"
+#include "riegeli/base/memory_estimator.h"
 #include "riegeli/base/recycling_pool.h"
 #include "riegeli/bytes/buffered_writer.h"
 #include "riegeli/bytes/writer.h"
@@ -53,6 +54,20 @@ class ZstdWriterBase : public BufferedWriter {
     kSerialized = 2,
   };
 
+  // Match finding strategy (`ZSTD_strategy`), in order of increasing
+  // compression density and decreasing speed.
+  enum class Strategy {
+    kFast = 1,      // `ZSTD_fast`
+    kDfast = 2,     // `ZSTD_dfast`
+    kGreedy = 3,    // `ZSTD_greedy`
+    kLazy = 4,      // `ZSTD_lazy`
+    kLazy2 = 5,     // `ZSTD_lazy2`
+    kBtlazy2 = 6,   // `ZSTD_btlazy2`
+    kBtopt = 7,     // `ZSTD_btopt`
+    kBtultra = 8,   // `ZSTD_btultra`
+    kBtultra2 = 9,  // `ZSTD_btultra2`
+  };
+
   // Stores an optional Zstd dictionary for compression.
   //
   // An empty dictionary is equivalent to no dictionary.
@@ -246,6 +261,104 @@ class ZstdWriterBase : public BufferedWriter {
     }
     absl::optional<int> window_log() const { return window_log_; }
 
+    // If `true`, finds matches also further back than the usual match finder
+    // does, up to the window size (`ZSTD_c_enableLongDistanceMatching`). This
+    // improves compression density of large inputs with repetitions far apart,
+    // e.g. near-duplicate records in a large chunk with a large `window_log`.
+    // The same window size must be supported by decompression.
+    //
+    // Special value `absl::nullopt` means to keep the default (enabled for
+    // `window_log() >= 27` with strategies from `Strategy::kBtopt`).
+    //
+    // Default: `absl::nullopt`.
+    Options& set_long_distance_matching(
+        absl::optional<bool> long_distance_matching) & {
+      long_distance_matching_ = long_distance_matching;
+      return *this;
+    }
+    Options&& set_long_distance_matching(
+        absl::optional<bool> long_distance_matching) && {
+      return std::move(set_long_distance_matching(long_distance_matching));
+    }
+    absl::optional<bool> long_distance_matching() const {
+      return long_distance_matching_;
+    }
+
+    // Logarithm of the size of the hash table used by long distance matching
+    // (`ZSTD_c_ldmHashLog`). Larger tables find more matches but use more
+    // memory.
+    //
+    // Special value `absl::nullopt` means to derive `ldm_hash_log` from
+    // `window_log`.
+    //
+    // `ldm_hash_log` must be `absl::nullopt` or between `kMinLdmHashLog` (6)
+    // and `kMaxLdmHashLog` (30). Default: `absl::nullopt`.
+    static constexpr int kMinLdmHashLog = 6;   // `ZSTD_LDM_HASHLOG_MIN`
+    static constexpr int kMaxLdmHashLog = 30;  // `ZSTD_LDM_HASHLOG_MAX`
+    Options& set_ldm_hash_log(absl::optional<int> ldm_hash_log) & {
+      if (ldm_hash_log != absl::nullopt) {
+        RIEGELI_ASSERT_GE(*ldm_hash_log, kMinLdmHashLog)
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_ldm_hash_log(): "
+               "LDM hash log out of range";
+        RIEGELI_ASSERT_LE(*ldm_hash_log, kMaxLdmHashLog)
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_ldm_hash_log(): "
+               "LDM hash log out of range";
+      }
+      ldm_hash_log_ = ldm_hash_log;
+      return *this;
+    }
+    Options&& set_ldm_hash_log(absl::optional<int> ldm_hash_log) && {
+      return std::move(set_ldm_hash_log(ldm_hash_log));
+    }
+    absl::optional<int> ldm_hash_log() const { return ldm_hash_log_; }
+
+    // Match length which the match finder considers good enough to stop
+    // searching (`ZSTD_c_targetLength`). The meaning depends on the strategy;
+    // larger values generally give better density but slower compression.
+    //
+    // Special value `absl::nullopt` means to derive `target_length` from
+    // `compression_level`.
+    //
+    // `target_length` must be `absl::nullopt` or between 0 and
+    // `kMaxTargetLength` (131072). Default: `absl::nullopt`.
+    static constexpr int kMaxTargetLength = 1 << 17;  // `ZSTD_TARGETLENGTH_MAX`
+    Options& set_target_length(absl::optional<int> target_length) & {
+      if (target_length != absl::nullopt) {
+        RIEGELI_ASSERT_GE(*target_length, 0)
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_target_length(): "
+               "target length out of range";
+        RIEGELI_ASSERT_LE(*target_length, kMaxTargetLength)
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_target_length(): "
+               "target length out of range";
+      }
+      target_length_ = target_length;
+      return *this;
+    }
+    Options&& set_target_length(absl::optional<int> target_length) && {
+      return std::move(set_target_length(target_length));
+    }
+    absl::optional<int> target_length() const { return target_length_; }
+
+    // Overrides the match finding strategy implied by `compression_level`
+    // (`ZSTD_c_strategy`).
+    //
+    // Special value `absl::nullopt` means to derive the strategy from
+    // `compression_level`.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_strategy(absl::optional<Strategy> strategy) & {
+      strategy_ = strategy;
+      return *this;
+    }
+    Options&& set_strategy(absl::optional<Strategy> strategy) && {
+      return std::move(set_strategy(strategy));
+    }
+    absl::optional<Strategy> strategy() const { return strategy_; }
+
     // Zstd dictionary. The same dictionary must be used for decompression.
     //
     // Default: `Dictionary()`.
@@ -279,6 +392,81 @@ class ZstdWriterBase : public BufferedWriter {
     }
     bool store_checksum() const { return store_checksum_; }
 
+    // Number of worker threads compressing in parallel with Zstd's built-in
+    // multithreading (`ZSTD_c_nbWorkers`). 0 compresses in the calling thread.
+    //
+    // If greater than 0, input is split into jobs which are compressed by
+    // workers while the calling thread keeps writing, and `Flush()` and
+    // `Close()` wait for pending jobs. This requires Zstd built with
+    // multithreading support, otherwise the `ZstdWriter` fails.
+    //
+    // Default: 0.
+    Options& set_num_workers(int num_workers) & {
+      RIEGELI_ASSERT_GE(num_workers, 0)
+          << "Failed precondition of "
+             "ZstdWriterBase::Options::set_num_workers(): "
+             "negative number of workers";
+      num_workers_ = num_workers;
+      return *this;
+    }
+    Options&& set_num_workers(int num_workers) && {
+      return std::move(set_num_workers(num_workers));
+    }
+    int num_workers() const { return num_workers_; }
+
+    // Size of a compression job if `num_workers() > 0` (`ZSTD_c_jobSize`).
+    // Smaller jobs use more workers for moderately sized data, larger jobs
+    // compress better.
+    //
+    // Special value `absl::nullopt` means to derive the job size from
+    // `window_log`. Other values are clamped by Zstd to at least 512KB.
+    //
+    // Default: `absl::nullopt`.
+    Options& set_job_size(absl::optional<size_t> job_size) & {
+      job_size_ = job_size;
+      return *this;
+    }
+    Options&& set_job_size(absl::optional<size_t> job_size) && {
+      return std::move(set_job_size(job_size));
+    }
+    absl::optional<size_t> job_size() const { return job_size_; }
+
+    // If not `absl::nullopt`, writes the Zstd seekable format: data are split
+    // into independent frames of `seekable_frame_size` uncompressed bytes
+    // (except the last one), followed by a seek table in a skippable frame.
+    // `ZstdReader` with `ZstdReaderBase::Options::set_seekable()` then supports
+    // efficient random access. Other decompressors read the data as
+    // concatenated frames.
+    //
+    // Smaller frames make seeking faster but decrease compression density. In
+    // this format `pledged_size()` is verified but not stored.
+    //
+    // `seekable_frame_size` must be `absl::nullopt` or between 1 and
+    // `kMaxSeekableFrameSize` (1GB). Default: `absl::nullopt`.
+    static constexpr Position kMaxSeekableFrameSize = Position{1} << 30;
+    Options& set_seekable_frame_size(
+        absl::optional<Position> seekable_frame_size) & {
+      if (seekable_frame_size != absl::nullopt) {
+        RIEGELI_ASSERT_GT(*seekable_frame_size, 0u)
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_seekable_frame_size(): "
+               "zero frame size";
+        RIEGELI_ASSERT_LE(*seekable_frame_size, kMaxSeekableFrameSize)
+            << "Failed precondition of "
+               "ZstdWriterBase::Options::set_seekable_frame_size(): "
+               "frame size out of range";
+      }
+      seekable_frame_size_ = seekable_frame_size;
+      return *this;
+    }
+    Options&& set_seekable_frame_size(
+        absl::optional<Position> seekable_frame_size) && {
+      return std::move(set_seekable_frame_size(seekable_frame_size));
+    }
+    absl::optional<Position> seekable_frame_size() const {
+      return seekable_frame_size_;
+    }
+
     // Exact uncompressed size, or `absl::nullopt` if unknown. This may improve
     // compression density and performance, and causes the size to be stored in
     // the compressed stream header.
@@ -368,8 +556,15 @@ class ZstdWriterBase : public BufferedWriter {
    private:
     int compression_level_ = kDefaultCompressionLevel;
     absl::optional<int> window_log_;
+    absl::optional<bool> long_distance_matching_;
+    absl::optional<int> ldm_hash_log_;
+    absl::optional<int> target_length_;
+    absl::optional<Strategy> strategy_;
     Dictionary dictionary_;
     bool store_checksum_ = false;
+    int num_workers_ = 0;
+    absl::optional<size_t> job_size_;
+    absl::optional<Position> seekable_frame_size_;
     absl::optional<Position> pledged_size_;
     absl::optional<Position> size_hint_;
     bool reserve_max_size_ = false;
@@ -387,6 +582,13 @@ class ZstdWriterBase : public BufferedWriter {
   using BufferedWriter::Fail;
   ABSL_ATTRIBUTE_COLD bool Fail(absl::Status status) override;
 
+  // Returns statistics of the pool of Zstd compression contexts which are
+  // shared by all `ZstdWriter` objects, so that consecutive writers reset an
+  // existing context instead of allocating a new one.
+  static RecyclingPoolStats compressor_pool_stats();
+
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  protected:
   ZstdWriterBase() noexcept {}
 
@@ -402,9 +604,9 @@ class ZstdWriterBase : public BufferedWriter {
   void Reset(Dictionary&& dictionary, size_t buffer_size,
              absl::optional<Position> pledged_size,
              absl::optional<Position> size_hint, bool reserve_max_size);
-  void Initialize(Writer* dest, int compression_level,
-                  absl::optional<int> window_log, bool store_checksum,
-                  absl::optional<Position> size_hint);
+  // Sets compression parameters from `options`, except for those passed to
+  // the constructor or `Reset()`.
+  void Initialize(Writer* dest, const Options& options);
 
   void Done() override;
   bool WriteInternal(absl::string_view src) override;
@@ -417,6 +619,14 @@ class ZstdWriterBase : public BufferedWriter {
 
   bool WriteInternal(absl::string_view src, Writer& dest,
                      ZSTD_EndDirective end_op);
+  // Like `WriteInternal()`, but does not split frames for the seekable format
+  // and does not reset `compressor_`.
+  bool CompressInternal(absl::string_view src, Writer& dest,
+                        ZSTD_EndDirective end_op);
+  // Records the frame which has just been ended in `seek_table_`.
+  void EndFrame(Writer& dest);
+  // Writes the skippable frame with `seek_table_`.
+  bool WriteSeekTable(Writer& dest);
 
   Dictionary dictionary_;
   std::shared_ptr<const ZSTD_CDict> prepared_dictionary_;
@@ -425,6 +635,15 @@ class ZstdWriterBase : public BufferedWriter {
   // If `healthy()` but `compressor_ == nullptr` then `*pledged_size_` has been
   // reached. In this case `ZSTD_compressStream()` must not be called again.
   RecyclingPool<ZSTD_CCtx, ZSTD_CCtxDeleter>::Handle compressor_;
+  // If not `absl::nullopt`, the seekable format is written.
+  absl::optional<Position> seekable_frame_size_;
+  // Uncompressed and compressed positions of the beginning of the current
+  // frame, used for the seekable format.
+  Position frame_begin_ = 0;
+  Position frame_begin_compressed_ = 0;
+  // Encoded seek table entries of frames written so far, used for the
+  // seekable format.
+  std::string seek_table_;
 };
 
 // A `Writer` which compresses data with Zstd before passing it to another
@@ -476,6 +695,8 @@ class ZstdWriter : public ZstdWriterBase {
   Writer* dest_writer() override { return dest_.get(); }
   const Writer* dest_writer() const override { return dest_.get(); }
 
+  void RegisterSubobjects(MemoryEstimator& memory_estimator) const override;
+
  protected:
   void Done() override;
   bool FlushImpl(FlushType flush_type) override;
@@ -554,7 +775,11 @@ inline ZstdWriterBase::ZstdWriterBase(ZstdWriterBase&& that) noexcept
       prepared_dictionary_(std::move(that.prepared_dictionary_)),
       pledged_size_(that.pledged_size_),
       reserve_max_size_(that.reserve_max_size_),
-      compressor_(std::move(that.compressor_)) {}
+      compressor_(std::move(that.compressor_)),
+      seekable_frame_size_(that.seekable_frame_size_),
+      frame_begin_(that.frame_begin_),
+      frame_begin_compressed_(that.frame_begin_compressed_),
+      seek_table_(std::move(that.seek_table_)) {}
 
 inline ZstdWriterBase& ZstdWriterBase::operator=(
     ZstdWriterBase&& that) noexcept {
@@ -566,6 +791,10 @@ inline ZstdWriterBase& ZstdWriterBase::operator=(
   pledged_size_ = std::move(that.pledged_size_);
   reserve_max_size_ = that.reserve_max_size_;
   compressor_ = std::move(that.compressor_);
+  seekable_frame_size_ = that.seekable_frame_size_;
+  frame_begin_ = that.frame_begin_;
+  frame_begin_compressed_ = that.frame_begin_compressed_;
+  seek_table_ = std::move(that.seek_table_);
   return *this;
 }
 
@@ -576,6 +805,10 @@ inline void ZstdWriterBase::Reset() {
   pledged_size_ = absl::nullopt;
   reserve_max_size_ = false;
   compressor_.reset();
+  seekable_frame_size_ = absl::nullopt;
+  frame_begin_ = 0;
+  frame_begin_compressed_ = 0;
+  seek_table_ = std::string();
 }
 
 inline void ZstdWriterBase::Reset(Dictionary&& dictionary, size_t buffer_size,
@@ -588,6 +821,10 @@ inline void ZstdWriterBase::Reset(Dictionary&& dictionary, size_t buffer_size,
   pledged_size_ = pledged_size;
   reserve_max_size_ = reserve_max_size;
   compressor_.reset();
+  seekable_frame_size_ = absl::nullopt;
+  frame_begin_ = 0;
+  frame_begin_compressed_ = 0;
+  seek_table_.clear();
 }
 
 template <typename Dest>
@@ -596,8 +833,7 @@ inline ZstdWriter<Dest>::ZstdWriter(const Dest& dest, Options options)
                      options.effective_buffer_size(), options.pledged_size(),
                      options.effective_size_hint(), options.reserve_max_size()),
       dest_(dest) {
-  Initialize(dest_.get(), options.compression_level(), options.window_log(),
-             options.store_checksum(), options.effective_size_hint());
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -606,8 +842,7 @@ inline ZstdWriter<Dest>::ZstdWriter(Dest&& dest, Options options)
                      options.effective_buffer_size(), options.pledged_size(),
                      options.effective_size_hint(), options.reserve_max_size()),
       dest_(std::move(dest)) {
-  Initialize(dest_.get(), options.compression_level(), options.window_log(),
-             options.store_checksum(), options.effective_size_hint());
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -618,8 +853,7 @@ inline ZstdWriter<Dest>::ZstdWriter(std::tuple<DestArgs...> dest_args,
                      options.effective_buffer_size(), options.pledged_size(),
                      options.effective_size_hint(), options.reserve_max_size()),
       dest_(std::move(dest_args)) {
-  Initialize(dest_.get(), options.compression_level(), options.window_log(),
-             options.store_checksum(), options.effective_size_hint());
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -652,8 +886,7 @@ inline void ZstdWriter<Dest>::Reset(const Dest& dest, Options options) {
                         options.effective_size_hint(),
                         options.reserve_max_size());
   dest_.Reset(dest);
-  Initialize(dest_.get(), options.compression_level(), options.window_log(),
-             options.store_checksum(), options.effective_size_hint());
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -663,8 +896,7 @@ inline void ZstdWriter<Dest>::Reset(Dest&& dest, Options options) {
                         options.effective_size_hint(),
                         options.reserve_max_size());
   dest_.Reset(std::move(dest));
-  Initialize(dest_.get(), options.compression_level(), options.window_log(),
-             options.store_checksum(), options.effective_size_hint());
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -676,8 +908,7 @@ inline void ZstdWriter<Dest>::Reset(std::tuple<DestArgs...> dest_args,
                         options.effective_size_hint(),
                         options.reserve_max_size());
   dest_.Reset(std::move(dest_args));
-  Initialize(dest_.get(), options.compression_level(), options.window_log(),
-             options.store_checksum(), options.effective_size_hint());
+  Initialize(dest_.get(), options);
 }
 
 template <typename Dest>
@@ -697,6 +928,13 @@ bool ZstdWriter<Dest>::FlushImpl(FlushType flush_type) {
   return true;
 }
 
+template <typename Dest>
+void ZstdWriter<Dest>::RegisterSubobjects(
+    MemoryEstimator& memory_estimator) const {
+  ZstdWriterBase::RegisterSubobjects(memory_estimator);
+  if (dest_.is_owning()) dest_->RegisterSubobjects(memory_estimator);
+}
+
 }  // namespace riegeli
 
 #endif  // RIEGELI_ZSTD_ZSTD_WRITER_H_